@@ -9,6 +9,7 @@
  */
 
 #pragma once
+#include <atomic>
 
 #include <map>
 #include <memory>
@@ -29,7 +30,7 @@ class Schedule;
 class ConfigParserPlugin;
 class ConfigRefreshRunner;
 
-/// The name of the executing query within the single-threaded schedule.
+/// The name(s), newline-separated, of the executing scheduled queries.
 extern const std::string kExecutingQuery;
 
 /**
@@ -73,15 +74,11 @@ class Config : private boost::noncopyable {
    *
    * @param name The unique name of the scheduled item
    * @param delay Number of seconds (wall time) taken by the query
-   * @param size Number of characters generated by query
-   * @param r0 the process row before the query
-   * @param r1 the process row after the query
+   * @param usage The resources used by the query's executing thread
    */
   void recordQueryPerformance(const std::string& name,
                               size_t delay,
-                              size_t size,
-                              const Row& r0,
-                              const Row& r1);
+                              const QueryUsage& usage);
 
   /**
    * @brief Record a query 'initialization', meaning the query will run.
@@ -115,6 +112,52 @@ class Config : private boost::noncopyable {
    */
   bool hashSource(const std::string& source, const std::string& content);
 
+  /**
+   * @brief Record how late a scheduled query started.
+   *
+   * @param name The unique name of the scheduled item.
+   * @param lateness Seconds between the query's deadline and its execution.
+   * @param missed The number of deadlines coalesced into this execution.
+   */
+  void recordQueryLateness(const std::string& name,
+                           size_t lateness,
+                           size_t missed);
+
+  /**
+   * @brief Record the interval a scheduled query is next due after.
+   *
+   * @param name The unique name of the scheduled item.
+   * @param interval Seconds to the next deadline, adapted to the load.
+   */
+  void recordQueryInterval(const std::string& name, size_t interval);
+
+  /**
+   * @brief Set the server's schedule load signal.
+   *
+   * Intervals with adaptive bounds are stretched above 100 percent and
+   * compressed below it, see SchedulerRunner::adaptInterval.
+   *
+   * @param percent The load, 100 for the configured intervals.
+   */
+  void setScheduleLoad(size_t percent) {
+    schedule_load_ = percent;
+  }
+
+  /// The server's schedule load signal as a percent, see setScheduleLoad.
+  size_t getScheduleLoad() const {
+    return schedule_load_;
+  }
+
+  /**
+   * @brief A counter incremented whenever packs are added or removed.
+   *
+   * The scheduler compares generations to rebuild its deadlines only when
+   * the schedule changes.
+   */
+  size_t getScheduleGeneration() const {
+    return schedule_generation_;
+  }
+
   /// Whether or not the last loaded config was valid.
   bool isValid() const {
     return valid_;
@@ -254,9 +297,28 @@ class Config : private boost::noncopyable {
    */
   Status load();
 
-  /// A step method for Config::update.
+  /**
+   * @brief A step method for Config::update.
+   *
+   * Only the packs of the source with changed content are reloaded, and the
+   * remaining content is only parsed again if it changed.
+   *
+   * @return Status code 2 if nothing changed that requires reconfiguring.
+   */
   Status updateSource(const std::string& source, const std::string& json);
 
+  /**
+   * @brief Add or replace a pack from a source, unless it is unchanged.
+   *
+   * @param name The pack name, or "*" for a tree of named packs.
+   * @param source The config content source identifier.
+   * @param tree The pack content.
+   * @return true if the pack was added or replaced.
+   */
+  bool updatePack(const std::string& name,
+                  const std::string& source,
+                  const boost::property_tree::ptree& tree);
+
   /**
    * @brief Generate pack content from a resource handled by the Plugin.
    *
@@ -295,6 +357,16 @@ class Config : private boost::noncopyable {
                     const boost::property_tree::ptree& tree,
                     bool pack = false);
 
+  /**
+   * @brief Apply each ConfigParser to a property tree owned by the caller.
+   *
+   * Each parser's keys are moved out of the tree while the parser updates and
+   * are moved back afterward, so parsers share the content without copies.
+   */
+  void applyParsers(const std::string& source,
+                    boost::property_tree::ptree& tree,
+                    bool pack = false);
+
   /**
    * @brief When config sources are updated the config will 'purge'.
    *
@@ -325,9 +397,35 @@ class Config : private boost::noncopyable {
   /// A set of hashes for each source of the config.
   std::map<std::string, std::string> hash_;
 
+  /// The content hash of a pack loaded from a source, see updatePack.
+  struct PackHash {
+    std::string hash;
+
+    /// True if the pack content includes keys handled by config parsers.
+    bool parsed{false};
+
+    /// True if the pack was included in the last update of its source.
+    bool seen{false};
+  };
+
+  /// Hashes of the packs loaded from each source, by source then pack name.
+  std::map<std::string, std::map<std::string, PackHash>> pack_hash_;
+
+  /// Hashes of the content of each source, excluding packs.
+  std::map<std::string, std::string> settings_hash_;
+
+  /// Set when a pack with content handled by config parsers changes.
+  bool pack_parsed_{false};
+
   /// Check if the config received valid/parsable content from a config plugin.
   bool valid_{false};
 
+  /// See getScheduleGeneration.
+  std::atomic<size_t> schedule_generation_{0};
+
+  /// See getScheduleLoad.
+  std::atomic<size_t> schedule_load_{100};
+
   /**
    * @brief Check if the configuration has attempted a load.
    *
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <atomic>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -50,6 +51,15 @@ extern const std::string kEvents;
 /// The "domain" where the results of carve queries are stored.
 extern const std::string kCarves;
 
+/// The "domain" where file hashes are cached, keyed by the file's identity.
+extern const std::string kFileHashes;
+
+/// The "domain" where package inventories are cached, keyed by table name.
+extern const std::string kPackages;
+
+/// The "domain" where code signature verifications are cached.
+extern const std::string kSignatures;
+
 /**
  * @brief The "domain" where buffered log results are stored.
  *
@@ -59,6 +69,119 @@ extern const std::string kCarves;
  */
 extern const std::string kLogs;
 
+/**
+ * @brief A set of puts and removes applied together.
+ *
+ * Callers that write many small values, such as event subscribers, collect
+ * them into a batch and apply it with a single writeDatabaseBatch. Backing
+ * stores that support atomic batches apply all or none of the operations.
+ */
+class DatabaseBatch {
+ public:
+  /// The kind of batch operation.
+  enum class Type { Put, Remove, RemoveRange };
+
+  /**
+   * @brief A single put, or a remove, of a domain and key.
+   *
+   * A RemoveRange uses the key and value as the inclusive low and high keys,
+   * see DatabasePlugin::removeRange.
+   */
+  struct Operation {
+    std::string domain;
+    std::string key;
+    std::string value;
+    Type type{Type::Put};
+  };
+
+ public:
+  /// Add a put of a value to the batch.
+  void put(const std::string& domain,
+           const std::string& key,
+           std::string value) {
+    operations_.push_back({domain, key, std::move(value), Type::Put});
+  }
+
+  /// Add a remove of a key to the batch.
+  void remove(const std::string& domain, const std::string& key) {
+    operations_.push_back({domain, key, "", Type::Remove});
+  }
+
+  /// Add a remove of the keys from low to high, inclusive, to the batch.
+  void removeRange(const std::string& domain,
+                   const std::string& low,
+                   const std::string& high) {
+    operations_.push_back({domain, low, high, Type::RemoveRange});
+  }
+
+  /// The operations, in the order they are applied.
+  const std::vector<Operation>& operations() const {
+    return operations_;
+  }
+
+  size_t size() const {
+    return operations_.size();
+  }
+
+  bool empty() const {
+    return operations_.empty();
+  }
+
+  void clear() {
+    operations_.clear();
+  }
+
+ private:
+  std::vector<Operation> operations_;
+};
+
+/**
+ * @brief Receives each key and value of a range scan.
+ *
+ * Return false to stop the scan.
+ */
+using DatabaseScanCallback =
+    std::function<bool(const std::string& key, const std::string& value)>;
+
+/// Storage statistics of a domain, reported by the osquery_database table.
+struct DatabaseDomainStats {
+  /// The domain name.
+  std::string domain;
+
+  /// The storage tuning profile applied to the domain.
+  std::string profile;
+
+  /// The estimated number of keys.
+  uint64_t keys{0};
+
+  /// The size of persisted table files.
+  uint64_t disk_bytes{0};
+
+  /// The size of unpersisted writes in memory.
+  uint64_t memory_bytes{0};
+
+  /// The estimated size of table files that compaction will rewrite.
+  uint64_t pending_compaction_bytes{0};
+
+  /// The rate in bytes per second writes are delayed to, 0 if not delayed.
+  uint64_t delayed_write_rate{0};
+
+  /// Writes are stopped until compaction catches up.
+  bool write_stopped{false};
+
+  /// The UNIX time of the last maintenance compaction, 0 if never compacted.
+  uint64_t last_compaction{0};
+
+  /// Lookups answered by the in-memory cache, see --database_cache_size.
+  uint64_t cache_hits{0};
+
+  /// Lookups of a cached domain read from the database plugin.
+  uint64_t cache_misses{0};
+
+  /// The size of the domain's cached keys and values.
+  uint64_t cache_bytes{0};
+};
+
 /**
  * @brief An osquery backing storage (database) type that persists executions.
  *
@@ -119,6 +242,70 @@ class DatabasePlugin : public Plugin {
                       const std::string& prefix,
                       size_t max) const;
 
+  /**
+   * @brief Iterate the keys and values within a range of a domain, in order.
+   *
+   * The default implementation scans and sorts every key in the domain, then
+   * gets each value in the range. Plugins with ordered iteration should
+   * override this with a seek, and visit a consistent view of the domain.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param low The inclusive lower bound key.
+   * @param high The exclusive upper bound key, empty for no upper bound.
+   * @param callback Receives each key and value.
+   * @return Failure if the domain could not be scanned.
+   */
+  virtual Status scanRange(const std::string& domain,
+                           const std::string& low,
+                           const std::string& high,
+                           const DatabaseScanCallback& callback) const;
+
+  /**
+   * @brief Apply a batch of puts and removes.
+   *
+   * The default implementation applies each operation in order, stopping at
+   * the first failure. Plugins should override this to apply the batch as a
+   * single atomic write.
+   *
+   * @param batch The operations to apply.
+   * @return Failure if any operation could not be applied.
+   */
+  virtual Status write(const DatabaseBatch& batch);
+
+  /**
+   * @brief Report storage statistics for each domain.
+   *
+   * @param stats Output, the statistics of each domain.
+   * @return Failure if the plugin does not report statistics.
+   */
+  virtual Status getStats(std::vector<DatabaseDomainStats>& stats) const {
+    return Status(1, "Not supported");
+  }
+
+  /**
+   * @brief Flush and compact a domain to reclaim space from removed keys.
+   *
+   * This is requested by database maintenance while the daemon is idle.
+   *
+   * @param domain The domain to compact.
+   * @return Failure if the plugin does not support compaction.
+   */
+  virtual Status compact(const std::string& domain) {
+    return Status(1, "Not supported");
+  }
+
+  /**
+   * @brief Persist buffered writes and release their memory.
+   *
+   * This is requested by the schedule reload, unlike reset the database is
+   * not closed and its caches are kept.
+   *
+   * @return Failure if the plugin does not buffer writes.
+   */
+  virtual Status flush() {
+    return Status(1, "Not supported");
+  }
+
   /**
    * @brief Shutdown the database and release initialization resources.
    *
@@ -226,6 +413,16 @@ Status setDatabaseValue(const std::string& domain,
 /// Remove a domain/key identified value from backing-store.
 Status deleteDatabaseValue(const std::string& domain, const std::string& key);
 
+/**
+ * @brief Apply a batch of puts and removes to the active DatabasePlugin.
+ *
+ * See DatabasePlugin::write, extensions apply each operation separately.
+ *
+ * @param batch The operations to apply.
+ * @return Storage operation status.
+ */
+Status writeDatabaseBatch(const DatabaseBatch& batch);
+
 /// Remove a range of keys in domain.
 Status deleteDatabaseRange(const std::string& domain,
                            const std::string& low,
@@ -242,6 +439,56 @@ Status scanDatabaseKeys(const std::string& domain,
                         const std::string& prefix,
                         size_t max = 0);
 
+/**
+ * @brief Iterate the keys and values within a range of a domain, in order.
+ *
+ * See DatabasePlugin::scanRange, extensions scan the keys then get values.
+ *
+ * @param domain A string value representing abstract storage indexing.
+ * @param low The inclusive lower bound key.
+ * @param high The exclusive upper bound key, empty for no upper bound.
+ * @param callback Receives each key and value.
+ * @return Storage operation status.
+ */
+Status scanDatabaseRange(const std::string& domain,
+                         const std::string& low,
+                         const std::string& high,
+                         const DatabaseScanCallback& callback);
+
+/**
+ * @brief Iterate the keys and values sharing a prefix, in order.
+ *
+ * This is a single scanDatabaseRange, use it rather than scanning keys then
+ * getting each value.
+ *
+ * @param domain A string value representing abstract storage indexing.
+ * @param prefix The key prefix, empty for every key.
+ * @param callback Receives each key and value.
+ * @param max The maximum number of keys to visit, 0 for unlimited.
+ * @return Storage operation status.
+ */
+Status scanDatabasePrefix(const std::string& domain,
+                          const std::string& prefix,
+                          const DatabaseScanCallback& callback,
+                          size_t max = 0);
+
+/// The exclusive upper bound of the keys sharing a prefix, empty if none.
+std::string getPrefixUpperBound(const std::string& prefix);
+
+/**
+ * @brief Get the storage and cache statistics of each domain.
+ *
+ * See DatabasePlugin::getStats, if the plugin does not report storage
+ * statistics only the cache statistics are reported.
+ */
+Status getDatabaseStats(std::vector<DatabaseDomainStats>& stats);
+
+/// Flush and compact a domain, see DatabasePlugin::compact.
+Status compactDatabase(const std::string& domain);
+
+/// Persist buffered writes of every domain, see DatabasePlugin::flush.
+Status flushDatabase();
+
 /// Allow callers to reload or reset the database plugin.
 void resetDatabase();
 
@@ -14,6 +14,7 @@
 #include <chrono>
 #include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -159,6 +160,40 @@ class InternalRunnable : private boost::noncopyable,
  private:
   std::atomic<bool> run_{false};
   std::string name_;
+
+ private:
+  friend class Dispatcher;
+};
+
+/**
+ * @brief A service that runs a short task every period.
+ *
+ * Most services only wake to do a little work and sleep again. Periodic
+ * services do not keep a thread of their own, the Dispatcher ticks them from
+ * executor threads shared by every periodic service, see --service_threads.
+ * A service is never ticked concurrently with itself.
+ */
+class PeriodicRunnable : public InternalRunnable {
+ public:
+  explicit PeriodicRunnable(const std::string& name)
+      : InternalRunnable(name) {}
+
+ protected:
+  /// The periodic task, the first tick runs when the service is added.
+  virtual void tick() = 0;
+
+  /// The delay after a tick before the next, read after each tick.
+  virtual std::chrono::milliseconds period() = 0;
+
+  /// Without executor threads, tick on a thread of the service's own.
+  void start() final;
+
+ private:
+  /// Tick unless the service was interrupted.
+  bool tickOnce();
+
+ private:
+  friend class Dispatcher;
 };
 
 /// An internal runnable used throughout osquery as dispatcher services.
@@ -214,6 +249,12 @@ class Dispatcher : private boost::noncopyable {
   /// When a service ends, it will remove itself from the dispatcher.
   static void removeService(const InternalRunnable* service);
 
+  /// Executor thread entry point, ticks periodic services until none remain.
+  static void runPeriodic();
+
+  /// Tick an interrupted periodic service soon, such that it is removed.
+  static void wakePeriodic(const InterruptableRunnable* service);
+
  private:
   /// For testing only, reset the stopping status for unittests.
   void resetStopping() {
@@ -227,6 +268,27 @@ class Dispatcher : private boost::noncopyable {
   /// The set of shared osquery services.
   std::vector<InternalRunnableRef> services_;
 
+  /// A periodic service and the time of its next tick.
+  struct PeriodicService {
+    std::shared_ptr<PeriodicRunnable> service;
+    std::chrono::steady_clock::time_point deadline;
+
+    /// The service is being ticked by an executor thread.
+    bool ticking{false};
+  };
+
+  /// The periodic services ticked by the executor threads.
+  std::vector<PeriodicService> periodic_;
+
+  /// The number of running executor threads.
+  size_t periodic_threads_{0};
+
+  /// Protection around the periodic services.
+  std::mutex periodic_mutex_;
+
+  /// Wakes the executor threads when a deadline changes.
+  std::condition_variable periodic_condition_;
+
   // Protection around service access.
   mutable Mutex mutex_;
 
@@ -247,6 +309,7 @@ class Dispatcher : private boost::noncopyable {
   std::atomic<bool> stopping_{false};
 
  private:
+  friend class InterruptableRunnable;
   friend class InternalRunnable;
   friend class ExtensionsTests;
   friend class DispatcherTests;
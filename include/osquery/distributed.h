@@ -226,10 +226,15 @@ class Distributed {
   /// Serialize result data into a JSON string and clear the results
   Status serializeResults(std::string& json);
 
-  /// Process and execute queued queries
+  /**
+   * @brief Process and execute queued queries
+   *
+   * Up to distributed_concurrency queries execute at once, and results are
+   * flushed as the queries complete.
+   */
   Status runQueries();
 
-  // Getter for ID of currently executing request
+  // Getter for ID of the request executing on this thread
   static std::string getCurrentRequestId();
 
  protected:
@@ -260,19 +265,50 @@ class Distributed {
 
   /**
    * @brief Flush all of the collected results to the server
+   *
+   * When distributed_chunk_size is set the results are written in chunks of
+   * about that many bytes, a failed chunk is written again by the next flush.
    */
   Status flushCompleted();
 
+  /**
+   * @brief Serialize the next chunk of results into a JSON string
+   *
+   * Results split across chunks are described by a "chunks" object, with the
+   * sequence of the chunk and whether it is the final chunk of the result.
+   * The status of a split result is only included with its final chunk.
+   *
+   * @param json the output JSON string
+   * @param completed the output number of results completed by the chunk
+   * @param offset the output row offset of the first result's next chunk
+   */
+  Status serializeChunk(std::string& json, size_t& completed, size_t& offset);
+
   // Setter for ID of currently executing request
   static void setCurrentRequestId(const std::string& cReqId);
 
+  /**
+   * @brief Execute a request on the calling thread
+   *
+   * The query is interrupted after distributed_query_timeout seconds.
+   */
+  static DistributedQueryResult runRequest(
+      const DistributedQueryRequest& request);
+
   std::vector<DistributedQueryResult> results_;
 
-  // ID of the currently executing query
-  static std::string currentRequestId_;
+  /// The first row of the first result not yet written
+  size_t chunk_offset_{0};
+
+  /// The sequence of the first result's next chunk
+  size_t chunk_sequence_{0};
+
+  // ID of the query executing on the thread
+  static thread_local std::string currentRequestId_;
 
  private:
   friend class DistributedTests;
   FRIEND_TEST(DistributedTests, test_workflow);
+  FRIEND_TEST(DistributedTests, test_chunked_results);
 };
 }
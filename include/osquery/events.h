@@ -11,20 +11,26 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/dispatcher.h>
 #include <osquery/registry.h>
 #include <osquery/status.h>
 #include <osquery/tables.h>
 
+#include "osquery/events/pool.h"
+
 namespace osquery {
 
 struct Subscription;
@@ -33,11 +39,13 @@ class EventPublisher;
 template <class PUB>
 class EventSubscriber;
 class EventFactory;
+class EventQueryPredicates;
+class EventRollup;
+class EventSubscriberQueue;
 
 using EventID = const std::string;
 using EventContextID = uint64_t;
 using EventTime = uint64_t;
-using EventRecord = std::pair<std::string, EventTime>;
 
 /**
  * @brief An EventPublisher will define a SubscriptionContext for
@@ -110,9 +118,6 @@ using EventCallback = std::function<Status(const EventContextRef&,
 /// An EventPublisher must track every subscription added.
 using SubscriptionVector = std::vector<SubscriptionRef>;
 
-/// The set of search-time binned lookup tables.
-extern const std::vector<size_t> kEventTimeLists;
-
 /**
  * @brief Details for each subscriber as it relates to the schedule.
  *
@@ -262,6 +267,17 @@ class EventPublisherPlugin : public Plugin,
     return Status(1, "No run loop required");
   }
 
+  /**
+   * @brief Run the publisher within a thread of its own.
+   *
+   * A publisher whose OS callbacks are delivered on a shared queue should
+   * return false. It has no run loop, it is configured when the EventFactory
+   * starts publishers, and torn down when it is deregistered.
+   */
+  virtual bool usesThread() const {
+    return true;
+  }
+
   /**
    * @brief Allow the EventFactory to interrupt the run loop.
    *
@@ -341,6 +357,21 @@ class EventPublisherPlugin : public Plugin,
     return restart_count_;
   }
 
+  /// Get the number of events dropped before they were fired.
+  size_t droppedCount() const {
+    return dropped_count_;
+  }
+
+  /// Get the number of EventContext%s allocated, see EventContextPool.
+  virtual size_t contextsAllocated() const {
+    return 0;
+  }
+
+  /// Get the number of EventContext%s reusing a pooled allocation.
+  virtual size_t contextsReused() const {
+    return 0;
+  }
+
  public:
   explicit EventPublisherPlugin(EventPublisherPlugin const&) = delete;
   EventPublisherPlugin& operator=(EventPublisherPlugin const&) = delete;
@@ -361,16 +392,35 @@ class EventPublisherPlugin : public Plugin,
   virtual void fireCallback(const SubscriptionRef& sub,
                             const EventContextRef& ec) const = 0;
 
+  /**
+   * @brief Replace the copy of the Subscription%s used by `fire`.
+   *
+   * Publishers that change `subscriptions_` must call this while holding the
+   * `subscription_lock_`.
+   */
+  void updateSubscriptions();
+
   /// A lock for subscription manipulation.
   Mutex subscription_lock_;
 
   /// The EventPublisher will keep track of Subscription%s that contain callins.
   SubscriptionVector subscriptions_;
 
+  /**
+   * @brief An immutable copy of the Subscription%s.
+   *
+   * This is swapped by `updateSubscriptions` such that `fire` does not lock
+   * against subscription changes or against other firing threads.
+   */
+  std::shared_ptr<const SubscriptionVector> fire_subscriptions_;
+
   /// An Event ID is assigned by the EventPublisher within the EventContext.
   /// This is not used to store event date in the backing store.
   std::atomic<EventContextID> next_ec_id_{0};
 
+  /// A publisher that buffers events counts those it could not buffer.
+  std::atomic<size_t> dropped_count_{0};
+
  private:
   /// Set ending to True to cause event type run loops to finish.
   std::atomic<bool> ending_{false};
@@ -384,6 +434,12 @@ class EventPublisherPlugin : public Plugin,
   /// A helper count of event publisher runloop iterations.
   std::atomic<size_t> restart_count_{0};
 
+  /// Serialize configure with the start of the run loop.
+  Mutex configure_lock_;
+
+  /// A deferred configure is called by the run loop's thread before it runs.
+  bool configure_pending_{false};
+
  private:
   /// Enable event factory "callins" through static publisher callbacks.
   friend class EventFactory;
@@ -391,8 +447,61 @@ class EventPublisherPlugin : public Plugin,
  private:
   FRIEND_TEST(EventsTests, test_event_publisher);
   FRIEND_TEST(EventsTests, test_fire_event);
+  FRIEND_TEST(EventsTests, test_fire_queued_event);
 };
 
+/**
+ * @brief A compact binary encoding of event rows for the backing store.
+ *
+ * Rows are encoded against a subscriber's columns: a version byte, a 32-bit
+ * hash of the column names, then each field as a varint key and a varint
+ * length-prefixed value. The key is the 1-indexed column, or 0 followed by
+ * the length-prefixed name of a column the subscriber does not declare.
+ *
+ * Decoding requires the same columns, see EventRowCodec::getSchema. This
+ * avoids a JSON serialize and parse for every event stored and selected.
+ */
+class EventRowCodec : private boost::noncopyable {
+ public:
+  /// The leading byte of an encoded row, JSON rows begin with '{'.
+  static const char kVersion;
+
+  explicit EventRowCodec(std::vector<std::string> columns);
+
+  /// Encode a row, appending to data.
+  void encode(const Row& r, std::string& data) const;
+
+  /// Decode a row, the data's schema must match this codec.
+  Status decode(const std::string& data, Row& r) const;
+
+  /// The hash of column names that encoded rows are keyed against.
+  uint32_t schema() const {
+    return schema_;
+  }
+
+  /// The columns that encoded rows are keyed against.
+  const std::vector<std::string>& columns() const {
+    return columns_;
+  }
+
+  /// Check if data is an encoded row, otherwise it may be JSON.
+  static bool isEncoded(const std::string& data);
+
+  /// Read the schema of an encoded row.
+  static uint32_t getSchema(const std::string& data);
+
+ private:
+  /// The ordered columns, a column's key is its index + 1.
+  std::vector<std::string> columns_;
+
+  /// Lookup of a column name to its index.
+  std::unordered_map<std::string, size_t> ids_;
+
+  uint32_t schema_{0};
+};
+
+using EventRowCodecRef = std::shared_ptr<EventRowCodec>;
+
 class EventSubscriberPlugin : public Plugin, public Eventer {
  public:
   /**
@@ -405,6 +514,18 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
     return Status(0);
   }
 
+  /**
+   * @brief Call the subscriber's callbacks from the event callback threads.
+   *
+   * A subscriber with an expensive callback, such as scanning file content,
+   * should return true. Its events are queued and its callbacks are called in
+   * order, and it will not delay the publisher or the other subscribers. See
+   * the events_async_callbacks flag to queue every subscriber's events.
+   */
+  virtual bool usesQueue() const {
+    return false;
+  }
+
   /// This is a plugin type and must implement a call method.
   Status call(const PluginRequest& /*request*/,
               PluginResponse& /*response*/) override {
@@ -442,28 +563,49 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
    */
   virtual void get(RowYield& yield, EventTime start, EventTime stop) final;
 
+  /**
+   * @brief Return events within start, stop in the order a query requested.
+   *
+   * @param yield The Row yield method.
+   * @param start Inclusive lower bound time limit.
+   * @param stop Inclusive upper bound time limit.
+   * @param descending Yield the newest events first.
+   * @param limit The number of events the query uses, 0 for every event.
+   */
+  void getRange(RowYield& yield,
+                EventTime start,
+                EventTime stop,
+                bool descending,
+                size_t limit);
+
  private:
   /// Overload add for tests and allow them to override the event time.
   virtual Status add(Row& r, EventTime event_time) final;
 
- private:
-  /*
-   * @brief When `get`ing event results, return EventID%s from time indexes.
-   *
-   * Used by EventSubscriber::get to retrieve EventID, EventTime indexes. This
-   * applies the lookup-efficiency checks for time list appropriate bins.
-   * If the time range in 24 hours and there is a 24-hour list bin it will
-   * be queried using a single backing store `Get` followed by two `Get`s of
-   * the most-specific boundary lists.
+  /**
+   * @brief Select the events a scheduled query has not consumed.
    *
-   * @param index the set of index to scan.
-   * @param optimize if true apply optimization checks.
+   * Scheduled queries selecting from the same table share a single read of
+   * new events. Events are deserialized once and kept in a history until the
+   * cursor of every scheduled query passes them.
    *
-   * @return List of EventID, EventTime%s
+   * @param yield The Row yield method.
+   * @param query The executing scheduled query.
+   * @param start The query's cursor time, the time of its previous select.
+   * @return false if the history does not include the query's cursor.
    */
-  std::vector<EventRecord> getRecords(const std::vector<std::string>& indexes,
-                                      bool optimize = true);
+  bool getShared(RowYield& yield, const std::string& query, EventTime start);
+
+  /// Read events added since the previous shared read into the history.
+  void readHistory(EventTime expire_time);
 
+  /// Drop history events every scheduled query consumed, or that expired.
+  void trimHistory(EventTime expire_time);
+
+  /// Update the expire time and the executing query's cursor after a select.
+  void recordSelect();
+
+ private:
   /**
    * @brief Get a unique storage-related EventID.
    *
@@ -479,34 +621,18 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
    */
   const std::string getEventID();
 
-  /**
-   * @brief Plan the best set of indexes for event record access.
-   *
-   * @param start an inclusive time to begin searching.
-   * @param stop an inclusive time to end searching.
-   * @param sort if true the indexes will be sorted.
-   *
-   * @return List of 'index.step' index strings.
-   */
-  std::vector<std::string> getIndexes(EventTime start,
-                                      EventTime stop,
-                                      bool sort = true);
+  /// The key prefix for this subscriber's event data.
+  std::string getDataKey() const {
+    return "data." + dbNamespace() + ".";
+  }
 
   /**
-   * @brief Expire indexes and eventually records.
+   * @brief Remove events at or before the expire time.
    *
-   * @param list_type the string representation of list binning type.
-   * @param indexes complete set of 'index.step' indexes for the list_type.
-   * @param expirations of the indexes, the set to expire.
+   * Event data is keyed by 'data.<namespace>.<time>.<eid>', and ordered by
+   * time, such that expiration is a single range deletion.
    */
-  void expireIndexes(const std::string& list_type,
-                     const std::vector<std::string>& indexes,
-                     const std::vector<std::string>& expirations);
-
-  /// Expire all datums within a bin.
-  void expireRecords(const std::string& list_type,
-                     const std::string& index,
-                     bool all);
+  void expireEvents();
 
   /**
    * @brief Inspect the number of events, expire those overflowing events_max.
@@ -517,23 +643,50 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
    * The subscriber must count the number of buffered records and check if
    * that count exceeds the configured `events_max` limit. If an overflow
    * occurs the subscriber will expire N-events_max from the end of the queue.
+   * The records are only counted when an upper bound of the count, tracked
+   * as events are flushed, exceeds the limit.
    */
   void expireCheck();
 
   /**
-   * @brief Add an EventID, EventTime pair to all matching list types.
+   * @brief Expire events by time and by count, called by the expiration runner.
+   *
+   * When events_expiry_interval is set, stored events are expired by a single
+   * service thread rather than by the publisher's thread as events are added
+   * and by the scheduler as events are selected.
+   */
+  void expireStored();
+
+  /**
+   * @brief Buffer an event keyed by its EventTime and EventID.
    *
-   * The list types are defined by time size. Based on the EventTime this pair
-   * is added to the list bin for each list type. If there are two list types:
-   * 60 seconds and 3600 seconds and `time` is 92, this pair will be added to
-   * list type 1 bin 4 and list type 2 bin 1.
+   * The event data is written by flushEvents.
    *
    * @param eid A unique EventID.
    * @param time The time when this EventID%'s event occurred.
+   * @param data The serialized event row.
+   */
+  void recordEvent(const std::string& eid, EventTime time, std::string data);
+
+  /// Check if buffered events exceed the events_batch_size or interval.
+  bool shouldFlushEvents();
+
+  /**
+   * @brief Write buffered events as a single batch.
    *
-   * @return Were the indexes recorded.
+   * This is called before events are selected or expired, such that buffered
+   * events are included.
    */
-  Status recordEvent(const std::string& eid, EventTime time);
+  Status flushEvents();
+
+  /**
+   * @brief Move events stored with the previous list-bin index layout.
+   *
+   * Events were keyed by EventID and indexed by comma-joined 'eid:time'
+   * records. Each is rewritten to the time-ordered key layout once, when the
+   * subscriber is registered.
+   */
+  void migrateEvents();
 
   /**
    * @brief Get the expiration timeout for this event type
@@ -593,6 +746,20 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
     return event_count_;
   }
 
+  /// The UNIX time the last event was added, see a query's "triggers".
+  size_t lastEventTime() const {
+    return last_event_time_;
+  }
+
+  /// The number of events waiting for the subscriber's callbacks.
+  size_t queuedCount() const;
+
+  /// The number of events dropped because the subscriber's queue was full.
+  size_t droppedCount() const;
+
+  /// An upper bound of the number of stored events, including expired events.
+  size_t storedCount() const;
+
   /// Compare the number of queries run against the queries configured.
   bool executedAllQueries() const;
 
@@ -628,6 +795,22 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
   /// Remove all subscriptions from this subscriber.
   void removeSubscriptions();
 
+  /**
+   * @brief Encode an event row for the backing store.
+   *
+   * Rows are encoded against the columns of the subscriber's table. The
+   * columns are stored alongside the events so rows encoded against previous
+   * columns may be decoded.
+   */
+  void serializeEvent(const Row& r, std::string& data);
+
+  /// Decode a stored event row, which may be JSON.
+  Status deserializeEvent(const std::string& data, Row& r);
+
+ private:
+  /// Get the codec for the subscriber's table columns.
+  const EventRowCodecRef& getCodec();
+
  protected:
   /// A helper value counting the number of fired events tracked by publishers.
   EventContextID event_count_{0};
@@ -647,6 +830,20 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
   /// Events before the expire_time_ are invalid and will be purged.
   EventTime expire_time_{0};
 
+  /// The last expire_time_ applied by expireEvents.
+  EventTime expired_time_{0};
+
+  /// The stored events are counted by the first expireCheck.
+  static constexpr size_t kUnknownStoredEvents = static_cast<size_t>(-1);
+
+  /**
+   * @brief An upper bound of the number of stored events.
+   *
+   * This is counted by expireCheck, and is increased as events are flushed,
+   * such that events_max is enforced without scanning every checkpoint.
+   */
+  size_t stored_events_{kUnknownStoredEvents};
+
   /// Cached value of last generated EventID.
   size_t last_eid_{0};
 
@@ -674,6 +871,9 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
   /// The number of scheduled queries using this subscriber.
   std::atomic<size_t> query_count_{0};
 
+  /// See lastEventTime.
+  std::atomic<size_t> last_event_time_{0};
+
   /// Set of queries that have used this subscriber table.
   std::set<std::string> queries_;
 
@@ -683,24 +883,97 @@ class EventSubscriberPlugin : public Plugin, public Eventer {
   /// Lock used when recording an EventID and time into search bins.
   Mutex event_record_lock_;
 
+  /// Lock used when updating the expire time and expiring events.
+  mutable Mutex event_expire_lock_;
+
+  /// An event read for the scheduled queries.
+  struct HistoryEvent {
+    EventTime time;
+    size_t eid;
+    Row row;
+  };
+
+  /// Events shared by the scheduled queries, in the order they were read.
+  std::deque<HistoryEvent> history_;
+
+  /// Set after the first shared read.
+  bool history_valid_{false};
+
+  /// The history includes every event at or after this time.
+  EventTime history_start_{0};
+
+  /// The time and largest EventID of the previous shared read.
+  EventTime history_time_{0};
+  size_t history_eid_{0};
+
+  /// The time and last EventID selected by each scheduled query.
+  std::map<std::string, std::pair<EventTime, size_t>> cursors_;
+
+  /// Lock used when reading or trimming the shared history.
+  Mutex history_lock_;
+
+  /// Buffered event data.
+  DatabaseBatch pending_;
+
+  /// The time the first buffered event was recorded.
+  std::chrono::steady_clock::time_point pending_start_;
+
   /// Lock used when recording queries executing against this subscriber.
   mutable Mutex event_query_record_;
 
+  /// Create the codec for the subscriber's table columns once.
+  std::once_flag codec_flag_;
+
+  /// The codec used to encode stored events.
+  EventRowCodecRef codec_;
+
+  /// Codecs for events stored using previous columns, keyed by schema.
+  std::map<uint32_t, EventRowCodecRef> previous_codecs_;
+
+  /// Lock used when looking up codecs for previous columns.
+  Mutex codec_lock_;
+
+  /**
+   * @brief The predicates of the scheduled queries selecting from this table.
+   *
+   * When events_pushdown is enabled, events not matched by any scheduled
+   * query are not stored. This is nullptr if every event is stored.
+   */
+  std::shared_ptr<const EventQueryPredicates> predicates_;
+
+  /// The rollups aggregating this table's events, nullptr if there are none.
+  std::shared_ptr<const std::vector<std::shared_ptr<EventRollup>>> rollups_;
+
+  /// False if events are only aggregated by rollups, they are not stored.
+  std::atomic<bool> store_events_{true};
+
+  /// The queue of callbacks if the subscriber usesQueue.
+  std::shared_ptr<EventSubscriberQueue> queue_;
+
  private:
   friend class EventFactory;
   friend class EventPublisherPlugin;
+  friend class EventExpirationRunner;
 
  private:
   FRIEND_TEST(EventsDatabaseTests, test_event_module_id);
-  FRIEND_TEST(EventsDatabaseTests, test_record_indexing);
+  FRIEND_TEST(EventsDatabaseTests, test_record_keys);
   FRIEND_TEST(EventsDatabaseTests, test_record_range);
   FRIEND_TEST(EventsDatabaseTests, test_record_expiration);
   FRIEND_TEST(EventsDatabaseTests, test_gentable);
   FRIEND_TEST(EventsDatabaseTests, test_expire_check);
+  FRIEND_TEST(EventsDatabaseTests, test_expire_stored);
   FRIEND_TEST(EventsDatabaseTests, test_optimize);
+  FRIEND_TEST(EventsDatabaseTests, test_shared_history);
+  FRIEND_TEST(EventsDatabaseTests, test_event_serialize);
+  FRIEND_TEST(EventsDatabaseTests, test_event_batch);
+  FRIEND_TEST(EventsDatabaseTests, test_event_pushdown);
+  FRIEND_TEST(EventsDatabaseTests, test_event_migration);
   FRIEND_TEST(EventsTests, test_event_subscriber_configure);
   friend class DBFakeEventSubscriber;
   friend class BenchmarkEventSubscriber;
+  friend class WorkloadEventSubscriber;
+  friend class ReplayEvents;
 };
 
 /**
@@ -833,6 +1106,9 @@ class EventFactory : private boost::noncopyable {
   /// Optionally forward events to loggers.
   static void forwardEvent(const std::string& event);
 
+  /// Check if any logger receives forwarded events.
+  static bool forwardsEvents();
+
   /**
    * @brief The event factory, subscribers, and publishers respond to updates.
    *
@@ -850,6 +1126,16 @@ class EventFactory : private boost::noncopyable {
   /// An initializer's entry-point for spawning all event type run loops.
   static void delay();
 
+  /**
+   * @brief Configure publishers in their run loop threads.
+   *
+   * Publishers that have not started are configured by their run loop's
+   * thread, such that an expensive configure, such as watching a large tree,
+   * does not delay the daemon's startup. Controlled by
+   * --events_defer_configure.
+   */
+  static void deferConfigure();
+
   /// If a static EventPublisher callback wants to fire
   template <typename PUB>
   static void fire(const EventContextRef& ec) {
@@ -906,6 +1192,19 @@ class EventFactory : private boost::noncopyable {
 
   /// Factory publisher state manipulation.
   Mutex factory_lock_;
+
+  /// Publisher configures are deferred to their run loops.
+  std::atomic<bool> defer_configure_{false};
+
+  /// The configured rollups, keyed by their table name.
+  std::map<std::string, std::shared_ptr<EventRollup>> rollups_;
+
+ private:
+  /// Configure each publisher, or defer the configure if it has not started.
+  static void configurePublishers();
+
+  /// Register the configured rollup tables and attach them to subscribers.
+  static void configureRollups();
 };
 
 /**
@@ -962,9 +1261,9 @@ class EventPublisher : public EventPublisherPlugin {
     return std::static_pointer_cast<SC>(sc);
   }
 
-  /// Create a EventContext based on the templated type.
+  /// Create a EventContext based on the templated type, see EventContextPool.
   static ECRef createEventContext() {
-    return std::make_shared<EC>();
+    return std::allocate_shared<EC>(EventContextAllocator<EC, EC>());
   }
 
   /// Create a SubscriptionContext based on the templated type.
@@ -972,6 +1271,14 @@ class EventPublisher : public EventPublisherPlugin {
     return std::make_shared<SC>();
   }
 
+  size_t contextsAllocated() const override {
+    return EventContextPool<EC>::get().allocated();
+  }
+
+  size_t contextsReused() const override {
+    return EventContextPool<EC>::get().reused();
+  }
+
  protected:
   /**
    * @brief The internal `fire` phase of publishing.
@@ -1012,6 +1319,7 @@ class EventPublisher : public EventPublisherPlugin {
   FRIEND_TEST(EventsTests, test_event_subscriber_subscribe);
   FRIEND_TEST(EventsTests, test_event_subscriber_context);
   FRIEND_TEST(EventsTests, test_fire_event);
+  FRIEND_TEST(EventsTests, test_fire_queued_event);
 };
 
 /**
@@ -1115,4 +1423,10 @@ class EventSubscriber : public EventSubscriberPlugin {
 /// Iterate the event publisher registry and create run loops for each using
 /// the event factory.
 void attachEvents();
+
+/// Register and set up each event publisher, in parallel.
+void attachEventPublishers();
+
+/// Register each event subscriber and configure the publishers and subscribers.
+void attachEventSubscribers();
 } // namespace osquery
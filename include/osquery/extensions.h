@@ -10,6 +10,10 @@
 
 #pragma once
 
+#include <memory>
+
+#include <boost/noncopyable.hpp>
+
 #include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/sql.h>
@@ -20,6 +24,7 @@ DECLARE_string(extensions_socket);
 DECLARE_string(extensions_autoload);
 DECLARE_string(extensions_timeout);
 DECLARE_bool(disable_extensions);
+DECLARE_bool(extensions_shared_memory);
 
 /// A millisecond internal applied to extension initialization.
 extern const size_t kExtensionInitializeLatency;
@@ -76,6 +81,21 @@ Status getExtensions(ExtensionList& extensions);
 Status getExtensions(const std::string& manager_path,
                      ExtensionList& extensions);
 
+/// The calls made from this process to an extension's plugins.
+struct ExtensionCalls {
+  size_t calls{0};
+  size_t failures{0};
+
+  /// Calls in progress, or waiting for one of the extension's call slots.
+  size_t active{0};
+
+  /// Call latency in milliseconds, by "registry/item".
+  std::map<std::string, PerformanceHistogram> latency;
+};
+
+/// Get the calls made to an extension, if any were made.
+bool getExtensionCalls(RouteUUID uuid, ExtensionCalls& calls);
+
 /// Ping an extension manager or extension.
 Status pingExtension(const std::string& path);
 
@@ -167,6 +187,61 @@ Status callExtension(const std::string& extension_path,
                      const PluginRequest& request,
                      PluginResponse& response);
 
+class EXClient;
+
+/// The maximum rows read from an extension table at a time.
+const size_t kExtensionTableBatch = 1024;
+
+/**
+ * @brief Read the rows of a table exposed by an Extension in batches.
+ *
+ * Rows are requested as typed columns and decoded into the caller's rows.
+ * The extension keeps a cursor, and resumes a generator table only as batches
+ * are read, over a connection held by this cursor. Destroying the cursor
+ * before the last batch, such as when SQLite stops reading for a LIMIT,
+ * closes the extension's cursor and generator.
+ *
+ * Extensions built with an SDK that cannot generate typed columns are called
+ * using the table plugin's generate action, and return a single batch.
+ */
+class ExtensionTableCursor : private boost::noncopyable {
+ public:
+  ExtensionTableCursor(RouteUUID uuid, const std::string& table);
+  ~ExtensionTableCursor();
+
+  /**
+   * @brief Start generating rows.
+   *
+   * @param request The table plugin request, a "generate" action.
+   * @param rows The output first batch of typed rows.
+   */
+  Status open(const PluginRequest& request, TableRows& rows);
+
+  /// Read the next batch of typed rows.
+  Status next(TableRows& rows);
+
+  /// Check if every batch was read.
+  bool done() const {
+    return cursor_ == 0;
+  }
+
+ private:
+  /// Request the first batch, as typed rows if the extension supports them.
+  Status openRows(const std::string& extension_path,
+                  const PluginRequest& request,
+                  TableRows& rows);
+
+ private:
+  RouteUUID uuid_{0};
+  std::string table_;
+
+  /// The extension's cursor ID, 0 if there are no more rows.
+  int64_t cursor_{0};
+
+  /// The connection used to read each batch.
+  std::unique_ptr<EXClient> client_;
+};
+
 /// The main runloop entered by an Extension, start an ExtensionRunner thread.
 Status startExtension(const std::string& name, const std::string& version);
 
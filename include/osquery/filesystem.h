@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
 #include <set>
 #include <string>
@@ -86,6 +87,27 @@ Status readFile(const boost::filesystem::path& path,
                 std::function<void(std::string& buffer, size_t size)> predicate,
                 bool blocking = false);
 
+/**
+ * @brief Read a file's content in place, without copying it into buffers.
+ *
+ * With --read_mapped, a regular file is mapped read-only a window at a time
+ * and the predicate is called with each window. Otherwise, or if the file is
+ * special or cannot be mapped, it is read in blocks of block_size bytes. The
+ * limits and time preservation of readFile apply.
+ *
+ * @param path the path of the file that you would like to read.
+ * @param block_size the size of each block when the file is not mapped.
+ * @param preserve_time Attempt to preserve file mtime and atime.
+ * @param predicate called with each consecutive part of the content.
+ *
+ * @return an instance of Status, indicating success or failure.
+ */
+Status readMappedFile(
+    const boost::filesystem::path& path,
+    size_t block_size,
+    bool preserve_time,
+    std::function<void(const char* buffer, size_t size)> predicate);
+
 /**
  * @brief Write text to disk.
  *
@@ -200,6 +222,24 @@ Status resolveFilePattern(const boost::filesystem::path& pattern,
                           std::vector<std::string>& results,
                           GlobLimits setting);
 
+/**
+ * @brief Given a filesystem globbing patten, stream each matching path.
+ *
+ * See resolveFilePattern, but each matching path is provided to the predicate
+ * as the filesystem is walked, such that the matches are never all held in
+ * memory. The predicate returns false to stop resolving the pattern.
+ *
+ * @param pattern filesystem globbing pattern.
+ * @param setting a bit list of match types, e.g., files, folders.
+ * @param predicate called with each matching path.
+ *
+ * @return an instance of Status, indicating success or failure.
+ */
+Status resolveFilePattern(
+    const boost::filesystem::path& pattern,
+    GlobLimits setting,
+    std::function<bool(const std::string& path)> predicate);
+
 /**
  * @brief Transform a path with SQL wildcards to globbing wildcard.
  *
@@ -289,6 +329,20 @@ Status parseJSON(const boost::filesystem::path& path,
 Status parseJSONContent(const std::string& content,
                         boost::property_tree::ptree& tree);
 
+/**
+ * @brief Parse JSON content into a property tree, in place.
+ *
+ * The content buffer is decoded in situ and is left in an unspecified state.
+ * Use this when the caller owns a copy of the content it no longer needs.
+ *
+ * @param content JSON string data, consumed by the parser.
+ * @param tree output property tree.
+ *
+ * @return an instance of Status, indicating success or failure if malformed.
+ */
+Status parseJSONContent(std::string&& content,
+                        boost::property_tree::ptree& tree);
+
 #ifdef __APPLE__
 /**
  * @brief Parse a property list on disk into a property tree.
@@ -391,6 +445,24 @@ Status readRawMem(size_t base, size_t length, void** buffer);
 Status archive(const std::set<boost::filesystem::path>& path,
                const boost::filesystem::path& out);
 
+/// Receives blocks of archive output, return false to stop archiving.
+using ArchiveSink = std::function<bool(const char* data, size_t size)>;
+
+/*
+ * @brief A function to stream files specified into a tar archive
+ *
+ * @param paths The paths that you want bundled into the archive
+ * @param compress Compress the archive with zstd
+ * @param sink Receives the archive in bounded blocks
+ *
+ * The files are read, tar framed, and optionally compressed in a single pass
+ * without intermediate files. A file changing size while it is read is
+ * truncated or zero padded to the size recorded in its header.
+ */
+Status archive(const std::set<boost::filesystem::path>& paths,
+               bool compress,
+               const ArchiveSink& sink);
+
 /*
  * @brief Given a path, compress it with zstd and save to out.
  *
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -193,6 +195,43 @@ class LoggerPlugin : public Plugin {
    */
   virtual Status logString(const std::string& s) = 0;
 
+  /**
+   * @brief Log a results string with the priority class of its query.
+   *
+   * Plugins buffering results may forward higher priority classes first,
+   * by default the priority is ignored and the string is sent to logString.
+   *
+   * @param s The serialized results.
+   * @param priority The priority class of the scheduled query.
+   */
+  virtual Status logPriorityString(const std::string& s,
+                                   size_t /*priority*/) {
+    return logString(s);
+  }
+
+  /**
+   * @brief Log a batch of results strings with the priority class of their
+   * queries.
+   *
+   * The scheduler hands the results of each step to loggers as one batch.
+   * Plugins may amortize their writes or requests over the batch, by default
+   * each string is sent to logPriorityString.
+   *
+   * @param strings The serialized results, in the order they were logged.
+   * @param priority The priority class of the scheduled queries.
+   */
+  virtual Status logPriorityStrings(const std::vector<std::string>& strings,
+                                    size_t priority) {
+    Status status;
+    for (const auto& s : strings) {
+      auto result = logPriorityString(s, priority);
+      if (!result.ok()) {
+        status = result;
+      }
+    }
+    return status;
+  }
+
   /**
    * @brief See the usesLogStatus method, log a Glog status.
    *
@@ -330,6 +369,24 @@ Status logQueryLogItem(const QueryLogItem& item);
  */
 Status logQueryLogItem(const QueryLogItem& item, const std::string& receiver);
 
+/**
+ * @brief Collect the results logged by logQueryLogItem into a batch.
+ *
+ * While enabled, results are serialized and queued, then handed to each
+ * logger's LoggerPlugin::logPriorityStrings by flushLoggerBatch. A large
+ * batch is flushed by the logging thread.
+ *
+ * @param enabled Queue results rather than logging them, disabling flushes.
+ */
+void setLoggerBatching(bool enabled);
+
+/**
+ * @brief Hand the batched results to the loggers.
+ *
+ * @return The last failure of a logger, if any.
+ */
+Status flushLoggerBatch();
+
 /**
  * @brief Log raw results from a query (or a snapshot scheduled query).
  *
@@ -339,6 +396,56 @@ Status logQueryLogItem(const QueryLogItem& item, const std::string& receiver);
  */
 Status logSnapshotQuery(const QueryLogItem& item);
 
+/**
+ * @brief Log the rows of a snapshot query as they are generated.
+ *
+ * Each row is serialized when it is added, and the lines are handed to the
+ * loggers in batches, such that a large snapshot is not held in memory. The
+ * messagepack logger_format collects the rows and logs them at the end.
+ */
+class SnapshotLogStream : private boost::noncopyable {
+ public:
+  /// Start a snapshot with the metadata of an item.
+  explicit SnapshotLogStream(QueryLogItem item);
+
+  /// Serialize a row, logging the batch once it is large.
+  Status add(Row& r);
+
+  /// Log the remaining lines of the snapshot.
+  Status end();
+
+ private:
+  /// Hand the serialized lines to the loggers.
+  Status flush();
+
+ private:
+  QueryLogItem item_;
+
+  /// Serializes the rows, unless they are collected.
+  std::unique_ptr<SnapshotJSONWriter> writer_;
+
+  /// Lines waiting to be logged, and their size.
+  std::vector<std::string> lines_;
+  size_t size_{0};
+
+  /// The last logging failure.
+  Status status_;
+};
+
+/**
+ * @brief Forward a published event to logger plugins.
+ *
+ * Internal logger plugins receive the event by reference, it is only copied
+ * into a request for logger plugins within extensions.
+ *
+ * @param event the serialized event
+ * @param loggers the logger plugins that use logEvent
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status logEvent(const std::string& event,
+                const std::vector<std::string>& loggers);
+
 /**
  * @brief Sink a set of buffered status logs.
  *
@@ -360,6 +467,27 @@ size_t queuedStatuses();
 /// Inspect the number of active internal status log sender threads.
 size_t queuedSenders();
 
+/**
+ * @brief Report the lowest priority class a logger accepts without deferral.
+ *
+ * Loggers that buffer results report backpressure when they cannot keep up,
+ * scheduled queries with a lower priority class may be deferred until the
+ * logger drains. A priority of 0 removes the logger's backpressure.
+ *
+ * @param name A unique name of the reporting logger.
+ * @param priority The lowest priority class the logger accepts.
+ */
+void setLoggerBackpressure(const std::string& name, size_t priority);
+
+/// The highest backpressure reported by any logger, 0 if none is saturated.
+size_t getLoggerBackpressure();
+
+/// Report the number of lines a buffering logger has not yet sent.
+void setLoggerBuffered(const std::string& name, size_t lines);
+
+/// The lines buffered by each buffering logger.
+std::map<std::string, size_t> getLoggerBuffered();
+
 /**
  * @brief Write a log line to the OS system log.
  *
@@ -103,6 +103,18 @@ class Pack : private boost::noncopyable {
   /// Verify that a given discovery query returns the appropriate results
   bool checkDiscovery();
 
+  /**
+   * @brief Evaluate discovery queries, shared by every pack.
+   *
+   * Results are cached by the query's SQL for --pack_refresh_interval, such
+   * that packs with the same discovery queries evaluate them once. Queries
+   * without a cached result are evaluated concurrently.
+   *
+   * @param queries Discovery queries, possibly repeated.
+   * @return The number of queries evaluated.
+   */
+  static size_t discover(const std::vector<std::string>& queries);
+
   /**
    * @brief Returns whether this pack is executing
    *
@@ -10,12 +10,16 @@
 
 #pragma once
 
+#include <array>
+#include <functional>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/core.h>
@@ -219,6 +223,24 @@ Status serializeDiffResultsJSON(const DiffResults& d, std::string& json);
  */
 DiffResults diff(QueryDataSet& old_, QueryData& new_);
 
+/**
+ * @brief A stable 64-bit fingerprint of a Row's columns and values.
+ *
+ * Query::addNewResults stores fingerprints of the previous results and
+ * compares them with the current results, only rows with fingerprints missing
+ * from either side are materialized.
+ */
+uint64_t getRowFingerprint(const Row& r);
+
+/// The separator between a query name and the keys of its stored chunks.
+extern const std::string kQueryChunkKey;
+
+/// The suffix of a query's metadata: the epoch, counter, and query text.
+extern const std::string kQueryMetadataKey;
+
+/// The suffix of a query's changes since its stored results were written.
+extern const std::string kQueryDeltaKey;
+
 /**
  * @brief Add a Row to a QueryData if the Row hasn't appeared in the QueryData
  * already
@@ -252,6 +274,78 @@ void escapeQueryData(const QueryData& oldData, QueryData& newData);
 /**
  * @brief performance statistics about a query
  */
+/**
+ * @brief Counts of observed values in power of two buckets.
+ *
+ * Bucket 0 counts values of 0 and bucket N counts values in [2^(N-1), 2^N),
+ * such that the tail of a distribution is kept, unlike with an average.
+ */
+struct PerformanceHistogram {
+  /// The last bucket also counts every larger value.
+  static const size_t kBuckets = 40;
+
+  std::array<size_t, kBuckets> counts{};
+
+  /// The largest observed value.
+  uint64_t max{0};
+
+  /// Count an observed value.
+  void add(uint64_t value);
+
+  /**
+   * @brief An upper bound of the value at a percentile, such as 99.
+   *
+   * This is the last value of the bucket holding the percentile, or the
+   * largest observed value if smaller. Returns 0 if nothing was observed.
+   */
+  uint64_t percentile(double percent) const;
+
+  /// The non-empty buckets as "lower:count" pairs, separated by commas.
+  std::string toString() const;
+};
+
+/// The rows and bytes generated by a table for a query.
+struct TableUsage {
+  uint64_t rows{0};
+  uint64_t bytes{0};
+};
+
+/// The resources used by a single execution of a query.
+struct QueryUsage {
+  /// Wall time in milliseconds.
+  uint64_t wall_time{0};
+
+  /// CPU time of the executing thread in microseconds.
+  uint64_t user_time{0};
+  uint64_t system_time{0};
+
+  /// Characters, bytes, of the results.
+  uint64_t output_size{0};
+
+  /// Number of result rows.
+  uint64_t rows{0};
+
+  /// Hardware and scheduler events of the executing thread.
+  uint64_t instructions{0};
+  uint64_t cycles{0};
+  uint64_t cache_misses{0};
+  uint64_t context_switches{0};
+  uint64_t major_faults{0};
+  uint64_t minor_faults{0};
+
+  /// Generated rows and bytes by table name.
+  std::map<std::string, TableUsage> tables;
+
+  /// The execution was cancelled at its deadline.
+  bool timed_out{false};
+
+  /// The execution stopped at its max_rows or max_bytes.
+  bool truncated{false};
+
+  /// SQLite heap bytes allocated while executing, see QueryBudget.
+  uint64_t sqlite_memory{0};
+};
+
 struct QueryPerformance {
   /// Number of executions.
   size_t executions{0};
@@ -259,20 +353,67 @@ struct QueryPerformance {
   /// Last UNIX time in seconds the query was executed successfully.
   size_t last_executed{0};
 
-  /// Total wall time taken
+  /// Total wall time taken in seconds.
   unsigned long long int wall_time{0};
 
-  /// Total user time (cycles)
+  /// Total user time of the executing thread in milliseconds.
   unsigned long long int user_time{0};
 
-  /// Total system time (cycles)
+  /// Total system time of the executing thread in milliseconds.
   unsigned long long int system_time{0};
 
-  /// Average memory differentials. This should be near 0.
+  /// Average bytes generated by the tables a query scanned.
   unsigned long long int average_memory{0};
 
   /// Total characters, bytes, generated by query.
   unsigned long long int output_size{0};
+
+  /// Total seconds executions started after their scheduled deadline.
+  unsigned long long int lateness{0};
+
+  /// Number of deadlines coalesced into a later execution.
+  size_t missed{0};
+
+  /// Number of executions cancelled at --schedule_query_timeout.
+  size_t timeouts{0};
+
+  /// Number of executions stopped at the query's max_rows or max_bytes.
+  size_t truncations{0};
+
+  /// The seconds to the query's next deadline, adapted to the schedule load.
+  size_t effective_interval{0};
+
+  /// Total hardware and scheduler events, see --schedule_perf_counters.
+  unsigned long long int instructions{0};
+  unsigned long long int cycles{0};
+  unsigned long long int cache_misses{0};
+  unsigned long long int context_switches{0};
+  unsigned long long int major_faults{0};
+  unsigned long long int minor_faults{0};
+
+  /// Wall time of each execution in milliseconds.
+  PerformanceHistogram wall_time_histogram;
+
+  /// CPU time of each execution in milliseconds.
+  PerformanceHistogram cpu_time_histogram;
+
+  /// Bytes generated by tables for each execution.
+  PerformanceHistogram memory_histogram;
+
+  /// Result rows of each execution.
+  PerformanceHistogram rows_histogram;
+
+  /// Result bytes of each execution.
+  PerformanceHistogram output_size_histogram;
+
+  /// Seconds each execution started after its scheduled deadline.
+  PerformanceHistogram lateness_histogram;
+
+  /// SQLite heap bytes allocated while each execution ran.
+  PerformanceHistogram sqlite_memory_histogram;
+
+  /// Total rows and bytes generated by table name.
+  std::map<std::string, TableUsage> tables;
 };
 
 /**
@@ -303,6 +444,26 @@ struct ScheduledQuery {
   /// Set of query options.
   std::map<std::string, bool> options;
 
+  /// The priority class of the query's results, higher classes log first.
+  size_t priority{0};
+
+  /// The most result rows and bytes of an execution, 0 for no limit.
+  size_t max_rows{0};
+  size_t max_bytes{0};
+
+  /// The bounds of the interval adapted to the schedule load, 0 for the
+  /// splayed interval.
+  size_t min_interval{0};
+  size_t max_interval{0};
+
+  /**
+   * @brief Event tables whose events make the query due.
+   *
+   * The query executes once a triggering table stops receiving events, the
+   * interval is the longest it waits for a trigger.
+   */
+  std::vector<std::string> triggers;
+
   ScheduledQuery() = default;
 
   /// equals operator
@@ -351,6 +512,12 @@ struct QueryLogItem {
   /// A set of additional fields to emit with the log line.
   std::map<std::string, std::string> decorations;
 
+  /// The decorations rendered as a JSON object, when set by getDecorations.
+  std::shared_ptr<const std::string> decorations_json;
+
+  /// The priority class of the scheduled query, this is not serialized.
+  size_t priority{0};
+
   /// equals operator
   bool operator==(const QueryLogItem& comp) const {
     return (comp.results == results) && (comp.name == name);
@@ -414,6 +581,40 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& item,
 Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
                                          std::vector<std::string>& items);
 
+/**
+ * @brief Serialize the rows of a snapshot as they are generated.
+ *
+ * As events, each row is written as a line when it is added. Otherwise rows
+ * are written into the single snapshot line, completed by end. The lines
+ * match serializeQueryLogItemAsEventsJSON and serializeQueryLogItemJSON, and
+ * the rows are not kept.
+ */
+class SnapshotJSONWriter : private boost::noncopyable {
+ public:
+  /**
+   * @param item The snapshot's metadata, it must outlive the writer.
+   * @param events Write a line for each row.
+   */
+  SnapshotJSONWriter(const QueryLogItem& item, bool events);
+
+  /// Serialize a row, appending its event line to lines.
+  void add(const Row& r, std::vector<std::string>& lines);
+
+  /// Complete the snapshot line, appending it to lines.
+  void end(std::vector<std::string>& lines);
+
+ private:
+  const QueryLogItem& item_;
+  bool events_{false};
+
+  /// The number of rows added.
+  size_t rows_{0};
+
+  /// The snapshot line, or each event line.
+  rj::StringBuffer sb_;
+  rj::Writer<rj::StringBuffer> writer_;
+};
+
 /**
  * @brief Interact with the historical on-disk storage for a given query.
  */
@@ -537,6 +738,30 @@ class Query {
    */
   static std::vector<std::string> getStoredQueryNames();
 
+  /**
+   * @brief Forget the metadata of a query read or written by this process.
+   *
+   * The metadata is mirrored in memory, a query's metadata removed from the
+   * database without the Query API must be invalidated.
+   *
+   * @param name the scheduled query name.
+   */
+  static void invalidateMetadata(const std::string& name);
+
+ private:
+  /**
+   * @brief Check if the previous results may be used for a differential.
+   *
+   * @param epoch the epoch associated with the current results.
+   * @param new_query output, true if the query was altered.
+   *
+   * @return true if the current results are 'fresh'.
+   */
+  bool checkResults(uint64_t epoch, bool& new_query) const;
+
+  /// True if removed rows are reported, and must be stored as JSON.
+  bool keepRows() const;
+
  private:
   /// The scheduled query and internal
   ScheduledQuery query_;
@@ -544,6 +769,9 @@ class Query {
   /// The scheduled query name.
   std::string name_;
 
+ private:
+  friend class QueryDiffStream;
+
  private:
   FRIEND_TEST(QueryTests, test_private_members);
   FRIEND_TEST(QueryTests, test_add_and_get_current_results);
@@ -554,4 +782,121 @@ class Query {
   FRIEND_TEST(QueryTests, test_query_name_not_found_in_db);
 };
 
+/**
+ * @brief Calculate a scheduled query's differential as its rows are generated.
+ *
+ * Unlike Query::addNewResults, neither the previous nor the current results
+ * are kept in memory. Current rows are compared with an index of previous row
+ * fingerprints and written to the database in chunks. Added and removed rows
+ * are handed to an emitter in batches of at most the chunk size.
+ *
+ * Call begin, add each row, then end. If end is not called the previous
+ * results are kept, and the rows already emitted as added may be emitted
+ * again by the next execution.
+ */
+class QueryDiffStream : private boost::noncopyable {
+ public:
+  /// Receives each batch of added or removed rows.
+  using Emitter = std::function<Status(DiffResults& results)>;
+
+  /**
+   * @brief Stream a differential for a query.
+   *
+   * @param query the scheduled query.
+   * @param epoch the epoch associated with the current results.
+   * @param chunk the number of rows in each stored chunk and emitted batch.
+   * @param emit the emitter for batches of differential results.
+   */
+  QueryDiffStream(const Query& query,
+                  uint64_t epoch,
+                  size_t chunk,
+                  Emitter emit);
+
+  /**
+   * @brief Read the index of previous results and get the execution counter.
+   *
+   * @param counter the output that holds the query execution counter.
+   */
+  Status begin(uint64_t& counter);
+
+  /// Add a current row, the row may be moved into an emitted batch.
+  Status add(Row& r);
+
+  /// Emit the remaining added rows and all removed rows, then store results.
+  Status end();
+
+ private:
+  /// Store the current chunk of rows.
+  Status flushChunk();
+
+  /// Emit and clear a batch of results.
+  Status flush(DiffResults& results);
+
+  /// Deserialize a removed row's stored JSON into a batch.
+  Status emitRemoved(const std::string& stored,
+                     size_t offset,
+                     size_t size,
+                     DiffResults& removed);
+
+ private:
+  const Query& query_;
+
+  uint64_t epoch_{0};
+
+  size_t chunk_size_{0};
+
+  Emitter emit_;
+
+  /// True if removed rows are reported.
+  bool keep_rows_{true};
+
+  /// True if the previous results may not be used.
+  bool fresh_{false};
+
+  /// The execution counter, and epoch, written with the query's metadata.
+  uint64_t counter_{0};
+
+  uint64_t previous_epoch_{0};
+
+  /// True if the previous results were stored inline, and may have a delta.
+  bool previous_inline_{false};
+
+  /**
+   * @brief The sorted previous row fingerprints and their stored location.
+   *
+   * For chunked results this is the chunk holding each row, otherwise it is
+   * the offset and size of each row's JSON within previous_rows_.
+   */
+  std::vector<std::pair<uint64_t, std::pair<size_t, size_t>>> previous_;
+
+  /// The previous rows matched by a current row.
+  std::vector<bool> consumed_;
+
+  /// Previous results stored inline are read once into memory.
+  std::string previous_rows_;
+
+  bool previous_chunked_{false};
+
+  size_t previous_generation_{0};
+
+  size_t previous_chunks_{0};
+
+  /// The generation of chunks written for the current results.
+  size_t generation_{0};
+
+  /// The number of chunks written for the current results.
+  size_t chunks_{0};
+
+  /// The content, and row count, of the current chunk.
+  std::string chunk_;
+
+  size_t chunk_rows_{0};
+
+  /// The current row fingerprints and the chunk holding each row.
+  std::vector<std::pair<uint64_t, size_t>> index_;
+
+  /// The pending batch of added rows.
+  DiffResults added_;
+};
+
 } // namespace osquery
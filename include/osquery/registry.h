@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <mutex>
 #include <set>
@@ -197,6 +198,11 @@ class RegistryInterface : private boost::noncopyable {
   /// Facility method to check if a registry item exists.
   bool exists(const std::string& item_name, bool local = false) const;
 
+  /// Changes when a local item is added or removed, or the active item is set.
+  size_t generation() const {
+    return generation_;
+  }
+
   /// Facility method to count the number of items in this registry.
   size_t count() const {
     return items_.size();
@@ -349,6 +355,9 @@ class RegistryInterface : private boost::noncopyable {
   /// be directed to the 'active' plugin.
   std::string active_;
 
+  /// Incremented by changes to the local items or the active item.
+  std::atomic<size_t> generation_{0};
+
  private:
   friend class RegistryFactory;
 };
@@ -467,6 +476,23 @@ class RegistryFactory : private boost::noncopyable {
   static Status call(const std::string& registry_name,
                      const PluginRequest& request);
 
+  /**
+   * @brief Call a local plugin's method with the handling of Registry::call.
+   *
+   * Exceptions thrown by the plugin are logged and returned as a failed
+   * status, unless registry exceptions are allowed.
+   */
+  template <typename Function>
+  static Status callLocal(const std::string& registry_name,
+                          const std::string& item_name,
+                          Function function) {
+    try {
+      return function();
+    } catch (...) {
+      return pluginException(registry_name, item_name);
+    }
+  }
+
   /// Run `setUp` on every registry that is not marked 'lazy'.
   static void setUp();
 
@@ -576,6 +602,10 @@ class RegistryFactory : private boost::noncopyable {
   RegistryFactory() = default;
   virtual ~RegistryFactory() = default;
 
+  /// Log and convert the exception being handled, or rethrow it.
+  static Status pluginException(const std::string& registry_name,
+                                const std::string& item_name);
+
  private:
   /// Track duplicate registry item support, used for testing.
   bool allow_duplicates_{false};
@@ -619,6 +649,57 @@ class RegistryFactory : private boost::noncopyable {
  */
 using Registry = RegistryFactory;
 
+/**
+ * @brief A cached handle to a local plugin, used to call it directly.
+ *
+ * Frequent in-process calls, such as to the database, logger, and sql
+ * plugins, use the plugin type's methods rather than building a
+ * PluginRequest and resolving the item for each call. The plugin is looked
+ * up again when the registry's generation changes.
+ *
+ * A handle is not thread safe and is usually thread_local. An item routed to
+ * an extension has no local plugin and must be called using Registry::call.
+ */
+template <class PluginType>
+class PluginHandle : private boost::noncopyable {
+ public:
+  /// A handle to a registry item, or the active item if the item is empty.
+  explicit PluginHandle(std::string registry, std::string item = "")
+      : registry_name_(std::move(registry)), item_(std::move(item)) {}
+
+  /// Get the local plugin, nullptr if the item is not a local PluginType.
+  std::shared_ptr<PluginType> get() {
+    if (registry_ == nullptr) {
+      if (!RegistryFactory::get().exists(registry_name_)) {
+        return nullptr;
+      }
+      registry_ = RegistryFactory::get().registry(registry_name_);
+    }
+
+    auto generation = registry_->generation();
+    if (cached_ && generation == generation_) {
+      return plugin_;
+    }
+
+    const auto& item = (item_.empty()) ? registry_->getActive() : item_;
+    plugin_ = nullptr;
+    if (registry_->exists(item, true)) {
+      plugin_ = std::dynamic_pointer_cast<PluginType>(registry_->plugin(item));
+    }
+    generation_ = generation;
+    cached_ = true;
+    return plugin_;
+  }
+
+ private:
+  std::string registry_name_;
+  std::string item_;
+  RegistryInterfaceRef registry_{nullptr};
+  std::shared_ptr<PluginType> plugin_{nullptr};
+  size_t generation_{0};
+  bool cached_{false};
+};
+
 class AutoRegisterInterface;
 using AutoRegisterSet = std::vector<std::unique_ptr<AutoRegisterInterface>>;
 
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -103,6 +104,9 @@ class SQL : private only_movable {
   /// ASCII escape the results of the query.
   void escapeResults();
 
+  /// ASCII escape a single row, used for results consumed as they stream.
+  static void escapeRow(Row& r);
+
  public:
   /**
    * @brief Get all, 'SELECT * ...', results given a virtual table name.
@@ -252,4 +256,61 @@ Status getQueryColumns(const std::string& q, TableColumns& columns);
  * @return status indicating success or failure of the operation.
  */
 Status getQueryTables(const std::string& q, std::vector<std::string>& tables);
+
+/**
+ * @brief Check if a query must execute alone, not alongside other queries.
+ *
+ * Event-based and cacheable tables share process-wide state about the
+ * executing query, extension tables and queries with unknown tables cannot
+ * be inspected.
+ *
+ * @param q the query to analyze.
+ * @param tables the output set of the query's tables.
+ *
+ * @return true if the query must not execute concurrently.
+ */
+bool isQueryExclusive(const std::string& q, std::set<std::string>& tables);
+
+/**
+ * @brief Interrupt the queries executed by this thread after a deadline.
+ *
+ * A query executing past the deadline, a UNIX time, stops with an error. The
+ * table generating rows when the deadline passes completes first.
+ *
+ * @param deadline the UNIX time, 0 to remove the deadline.
+ */
+void setQueryDeadline(size_t deadline);
+
+/// The deadline of queries executed by this thread, 0 for no deadline.
+size_t getQueryDeadline();
+
+/// The result limits of queries executed by a thread, see setQueryBudget.
+struct QueryBudget {
+  /// The most result rows, 0 for no limit.
+  size_t rows{0};
+
+  /// The most bytes of result column names and values, 0 for no limit.
+  size_t bytes{0};
+
+  /// The last query stopped at a limit.
+  bool truncated{false};
+
+  /// The SQLite heap bytes allocated while the last query executed.
+  size_t memory{0};
+};
+
+/**
+ * @brief Limit the results of the queries executed by this thread.
+ *
+ * Result rows are counted as SQLite steps the query, and the query stops,
+ * successfully, before the row that would exceed a limit. Generator tables
+ * stop yielding rows. The query is then truncated, see QueryBudget.
+ *
+ * @param rows the most result rows, 0 for no limit.
+ * @param bytes the most result bytes, 0 for no limit.
+ */
+void setQueryBudget(size_t rows, size_t bytes);
+
+/// The result limits of queries executed by this thread.
+QueryBudget& getQueryBudget();
 } // namespace osquery
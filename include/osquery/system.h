@@ -284,6 +284,19 @@ size_t toUnixTime(const struct tm* tm_time);
  */
 size_t getUnixTime();
 
+/**
+ * @brief Get the next delay of a jittered exponential backoff.
+ *
+ * The delay is random, between the base and three times the previous delay,
+ * such that many clients retrying a failed server spread their requests.
+ *
+ * @param base The smallest delay, and the first.
+ * @param previous The previous delay, 0 before the first retry.
+ * @param cap The largest delay.
+ * @return The delay, in the unit of the arguments.
+ */
+size_t getBackoffDelay(size_t base, size_t previous, size_t cap);
+
 /**
  * @brief Converts a struct tm into a human-readable format. This expected the
  * struct tm to be already in UTC time/
@@ -10,11 +10,13 @@
 
 #pragma once
 
+#include <atomic>
 #include <deque>
 #include <map>
 #include <memory>
 #include <set>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -40,6 +42,7 @@
 #endif
 
 #include <boost/lexical_cast.hpp>
+#include <boost/optional.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/core.h>
@@ -47,6 +50,8 @@
 #include <osquery/registry.h>
 #include <osquery/status.h>
 
+#include "osquery/core/arena.h"
+
 /// Allow Tables to use "tracked" deprecated OS APIs.
 #define OSQUERY_USE_DEPRECATED(expr)                                           \
   do {                                                                         \
@@ -237,6 +242,23 @@ enum class ColumnOptions {
 
   /// This column should be hidden from '*'' selects.
   HIDDEN = 16,
+
+  /*
+   * @brief The table can generate rows ordered by this column.
+   *
+   * If a query orders by only this column, SQLite does not sort the rows and
+   * the table must generate them in the order of QueryContext::orderBy.
+   * Event subscriber tables are ordered by their time column.
+   */
+  ORDERED = 32,
+
+  /*
+   * @brief The column content may change between scans within a query.
+   *
+   * A table is not memoized across the scans of a JOIN when the query uses
+   * this column, see TableScanMemo.
+   */
+  VOLATILE = 64,
 };
 
 /// Treat column options as a set of flags.
@@ -270,6 +292,9 @@ enum class TableAttributes {
 
   /// This table's data requires an osquery kernel extension/module.
   KERNEL_REQUIRED = 16,
+
+  /// The results do not change until the host reboots, they are kept.
+  STATIC = 32,
 };
 
 /// Treat table attributes as a set of flags.
@@ -293,9 +318,15 @@ using TableColumns =
 /// Alias for map of column alias sets.
 using ColumnAliasSet = std::map<std::string, std::set<std::string>>;
 
+/// The names of the columns a query may use.
+using UsedColumns = std::unordered_set<std::string>;
+
 /// Forward declaration of QueryContext for ConstraintList relationships.
 struct QueryContext;
 
+/// A ConstraintList's expressions, parsed once for the list's affinity.
+class ConstraintMatcher;
+
 /**
  * @brief A ConstraintList is a set of constraints for a column. This list
  * should be mapped to a left-hand-side column name.
@@ -320,6 +351,10 @@ struct ConstraintList : private boost::noncopyable {
    * If there are no predicate constraints in this list, all expression will
    * match. Constraints are limitations.
    *
+   * Constraints added after the affinity is set are compiled as they are
+   * added: expressions are parsed once and comparisons are merged into an
+   * equality and a range. TEXT constraints also match LIKE and GLOB patterns.
+   *
    * @param expr a SQL type expression of the column literal type to check.
    * @return If the expression matched all constraints.
    */
@@ -419,9 +454,7 @@ struct ConstraintList : private boost::noncopyable {
    *
    * @param constraint a new operator/expression to constrain.
    */
-  void add(const struct Constraint& constraint) {
-    constraints_.push_back(constraint);
-  }
+  void add(const struct Constraint& constraint);
 
   /**
    * @brief Serialize a ConstraintList into a property tree.
@@ -443,6 +476,9 @@ struct ConstraintList : private boost::noncopyable {
   /// List of constraint operator/expressions.
   std::vector<struct Constraint> constraints_;
 
+  /// The constraints compiled for the affinity they were added with.
+  std::shared_ptr<ConstraintMatcher> matcher_;
+
  private:
   friend struct QueryContext;
 
@@ -456,6 +492,225 @@ using ConstraintMap = std::map<std::string, struct ConstraintList>;
 /// Populate a constraint list from a query's parsed predicate.
 using ConstraintSet = std::vector<std::pair<std::string, struct Constraint>>;
 
+/**
+ * @brief A single typed value within a TableRows batch.
+ *
+ * Text values are not owned by the cell, they point into the arena owned or
+ * referenced by the TableRows batch.
+ */
+struct TableCell {
+  /// The storage kind of a cell, a Null cell has no value.
+  enum class Kind : unsigned char {
+    Null = 0,
+    Integer,
+    Double,
+    Text,
+  };
+
+  union Value {
+    int64_t integer;
+    double real;
+    const char* text;
+  };
+
+  /// The cell value, interpret using the kind.
+  Value value{};
+
+  /// The size of a Text value, not including the NULL terminator.
+  uint32_t size{0};
+
+  /// The storage kind.
+  Kind kind{Kind::Null};
+};
+
+/**
+ * @brief A columnar, typed, batch of table rows.
+ *
+ * The Row type is a map of column name to string. Every cell in every row
+ * repeats the column name, allocates a tree node, and is later parsed back
+ * into its SQLite type when the virtual table cursor reads the column.
+ *
+ * A TableRows batch is instead indexed by column position, taken from the
+ * table's TableColumns, and stores integer and double values natively. Text
+ * values are copied into an Arena that is either owned by the batch or
+ * provided by the caller. The virtual table cursor binds these cells to
+ * SQLite without re-parsing.
+ *
+ * Tables should resolve each column index once, using TableRows::column, and
+ * then set values on the most recent row, created with TableRows::addRow.
+ */
+class TableRows : private only_movable {
+ public:
+  /// Returned by TableRows::column if a column name is unknown.
+  static const size_t kInvalidColumn;
+
+  /// Create a batch using its own arena for text storage.
+  explicit TableRows(const TableColumns& columns);
+
+  /// Create a batch that copies text into a caller-owned arena.
+  TableRows(const TableColumns& columns, Arena& arena);
+
+  TableRows(TableRows&&) = default;
+  TableRows& operator=(TableRows&&) = default;
+
+ public:
+  /// Lookup the index of a column by name.
+  size_t column(const std::string& name) const;
+
+  /// The number of columns in this batch.
+  size_t columns() const {
+    return types_.size();
+  }
+
+  /// The number of rows in this batch.
+  size_t size() const {
+    return rows_;
+  }
+
+  /// Check if the batch has no rows.
+  bool empty() const {
+    return rows_ == 0;
+  }
+
+  /// The bytes of cells and text allocated for the rows.
+  size_t bytes() const;
+
+  /// Append a row of Null cells, set values with the typed setters.
+  void addRow();
+
+  /// Append, and convert, a Row keyed by column name.
+  void addRow(const Row& row);
+
+  /// Set an integer value for a column in the most recent row.
+  void setInteger(size_t column, int64_t value);
+
+  /// Set a double value for a column in the most recent row.
+  void setDouble(size_t column, double value);
+
+  /// Set a text value for a column in the most recent row.
+  void setText(size_t column, const char* data, size_t size);
+
+  /// See TableRows::setText.
+  void setText(size_t column, const std::string& value) {
+    setText(column, value.data(), value.size());
+  }
+
+  /**
+   * @brief Set a value for a column from its string representation.
+   *
+   * The value is converted once, using the column's type affinity. A value
+   * that cannot be converted is stored as Null, matching the virtual table
+   * behavior for string rows.
+   */
+  void set(size_t column, const std::string& value);
+
+  /// Access a cell by row and column index.
+  const TableCell& cell(size_t row, size_t column) const {
+    return cells_[column][row];
+  }
+
+  /// The declared type of a column.
+  ColumnType type(size_t column) const {
+    return types_[column];
+  }
+
+  /// The name of a column.
+  const std::string& name(size_t column) const {
+    return names_[column];
+  }
+
+  /// Convert a single row to a string Row (Null cells become empty strings).
+  Row toRow(size_t row) const;
+
+  /// Convert the entire batch into QueryData.
+  QueryData toQueryData() const;
+
+  /// Remove all rows, releasing text storage if the arena is owned.
+  void clear();
+
+ private:
+  /// Access the arena used for text values.
+  Arena& arena() {
+    return (arena_ != nullptr) ? *arena_ : *owned_arena_;
+  }
+
+  /// Access the most recent cell for a column.
+  TableCell& last(size_t column) {
+    return cells_[column][rows_ - 1];
+  }
+
+ private:
+  /// Column names by index.
+  std::vector<std::string> names_;
+
+  /// Column type affinities by index.
+  std::vector<ColumnType> types_;
+
+  /// Cells stored by column then row.
+  std::vector<std::vector<TableCell>> cells_;
+
+  /// The number of rows.
+  size_t rows_{0};
+
+  /// Arena used if the caller did not provide one.
+  std::unique_ptr<Arena> owned_arena_{nullptr};
+
+  /// A caller-provided arena.
+  Arena* arena_{nullptr};
+};
+
+/// The order and limit SQLite requested for a set of constraints.
+struct TableScanPlan {
+  /// A column with ColumnOptions::ORDERED that SQLite will not sort by.
+  std::string order_by;
+
+  /// The order_by direction.
+  bool descending{false};
+
+  /// The xFilter argument with the query's LIMIT, -1 if not used.
+  int limit_argv{-1};
+
+  /// The xFilter argument with the query's OFFSET, -1 if not used.
+  int offset_argv{-1};
+};
+
+/// A column's content, resolved once when the virtual table is created.
+struct VirtualTableColumn {
+  /// The name of the content within a Row, an alias reads its target.
+  std::string name;
+
+  /// The type the content is bound to SQLite as.
+  ColumnType type{UNKNOWN_TYPE};
+
+  /// The position of the content within a TableRows batch.
+  size_t index{0};
+};
+
+/**
+ * @brief A table's generated rows, memoized for the rest of a query.
+ *
+ * A nested-loop JOIN filters the inner table once per outer row. If the table
+ * cannot use the constraints then the rows are generated once, without the
+ * constraints, and each filter selects rows using a hash index on a column
+ * compared with EQUALS. SQLite still applies every constraint to the rows.
+ */
+struct TableScanMemo {
+  /// Row positions by column value.
+  using Index = std::unordered_map<std::string, std::vector<size_t>>;
+
+  /// The number of times the table was filtered.
+  size_t scans{0};
+
+  /// True if rows are generated, the first filter generates normally.
+  bool generated{false};
+
+  /// The unconstrained rows.
+  QueryData rows;
+
+  /// The hash indexes built by filters, none if a column cannot be indexed.
+  std::map<std::string, boost::optional<Index>> indexes;
+};
+
 /**
  * @brief osquery table content descriptor.
  *
@@ -481,6 +736,9 @@ struct VirtualTableContent {
   /// passed to the SQL and optional Query for inspection.
   TableAttributes attributes{TableAttributes::NONE};
 
+  /// Seconds the core keeps an extension table's results, 0 if not kept.
+  size_t cache_ttl{0};
+
   /**
    * @brief Table column aliases structure.
    *
@@ -490,9 +748,21 @@ struct VirtualTableContent {
    */
   std::map<std::string, size_t> aliases;
 
+  /// The resolved content of each column, by SQLite column ordinal.
+  std::vector<VirtualTableColumn> ordinals;
+
   /// Transient set of virtual table access constraints.
   std::unordered_map<size_t, ConstraintSet> constraints;
 
+  /// Transient set of the columns used, for each set of constraints.
+  std::unordered_map<size_t, UsedColumns> colsUsed;
+
+  /// Transient set of the scan order and limit, for each set of constraints.
+  std::unordered_map<size_t, TableScanPlan> scanPlans;
+
+  /// Transient set of memoized rows, by the columns used and scan order.
+  std::map<std::string, TableScanMemo> scanMemos;
+
   /*
    * @brief A table implementation specific query result cache.
    *
@@ -514,6 +784,9 @@ struct VirtualTableContent {
 using RowGenerator = boost::coroutines2::coroutine<Row&>;
 using RowYield = RowGenerator::push_type;
 
+using TableRowsGenerator = boost::coroutines2::coroutine<TableRows&>;
+using TableRowsYield = TableRowsGenerator::push_type;
+
 /**
  * @brief A QueryContext is provided to every table generator for optimization
  * on query components like predicate constraints and limits.
@@ -555,6 +828,42 @@ struct QueryContext : private only_movable {
   bool hasConstraint(const std::string& column,
                      ConstraintOperator op = EQUALS) const;
 
+  /**
+   * @brief Check if the query may use a column.
+   *
+   * Tables may skip generating expensive columns the query does not select,
+   * filter, or otherwise reference. If the used columns are not known, every
+   * column is used.
+   *
+   * @param column The name of a column within this table.
+   * @return true if the column may be used.
+   */
+  bool isColumnUsed(const std::string& column) const;
+
+  /**
+   * @brief Check if a table has generated every row the query may use.
+   *
+   * The limit is only known if the query has no constraints on the table,
+   * then the first rows generated are the rows SQLite returns.
+   *
+   * @param rows The number of rows generated.
+   * @return true if no more rows should be generated.
+   */
+  bool isLimitReached(size_t rows) const {
+    return limit > 0 && rows >= limit;
+  }
+
+  /**
+   * @brief Check if the query executing past its deadline was cancelled.
+   *
+   * SQLite interrupts the query and its results are discarded, tables walking
+   * many paths or files should stop generating. This may be called from
+   * threads the table started.
+   *
+   * @return true if no more rows should be generated.
+   */
+  bool isCancelled() const;
+
   /**
    * @brief Apply a predicate function to each expression in a constraint list.
    *
@@ -648,6 +957,26 @@ struct QueryContext : private only_movable {
   /// The map of column name to constraint list.
   ConstraintMap constraints;
 
+  /// The columns the query may use, if known. See isColumnUsed.
+  boost::optional<UsedColumns> colsUsed;
+
+  /// The number of rows the query may use including any offset, 0 if unknown.
+  size_t limit{0};
+
+  /**
+   * @brief The ORDERED column rows must be generated in the order of, if any.
+   *
+   * SQLite does not sort the generated rows by this column, see
+   * ColumnOptions::ORDERED.
+   */
+  std::string orderBy;
+
+  /// Generate rows from the largest to the smallest orderBy value.
+  bool orderDescending{false};
+
+  /// The UNIX time in seconds the query is cancelled, 0 for no deadline.
+  size_t deadline{0};
+
  private:
   /// If false then the context is maintaining an ephemeral cache.
   bool enable_cache_{false};
@@ -704,6 +1033,33 @@ class TablePlugin : public Plugin {
     return TableAttributes::NONE;
   }
 
+  /**
+   * @brief The files the table's results are parsed from.
+   *
+   * A table whose results depend only on these files keeps its results in
+   * memory, as a STATIC table does, until one of the files changes. A path
+   * ending in '/' is a directory, a change to any file within it counts.
+   *
+   * @return POSIX paths, empty if the table does not keep its results.
+   */
+  virtual std::vector<std::string> dependencies() const {
+    return {};
+  }
+
+  /**
+   * @brief The seconds the core may keep the results of an extension's table.
+   *
+   * The results of a table exposed by an extension are kept in the core's
+   * memory, for each set of constraints and used columns, such that repeated
+   * queries within the TTL do not call the extension. The TTL is advertised
+   * in the table's route info when the extension registers.
+   *
+   * @return The TTL in seconds, 0 if the results are not kept.
+   */
+  virtual size_t cacheTTL() const {
+    return 0;
+  }
+
   /**
    * @brief Generate a complete table representation.
    *
@@ -721,10 +1077,7 @@ class TablePlugin : public Plugin {
    * @param context A query context filled in by SQLite's virtual table API.
    * @return The result rows for this table, given the query context.
    */
-  virtual QueryData generate(QueryContext& context) {
-    (void)context;
-    return QueryData();
-  }
+  virtual QueryData generate(QueryContext& context);
 
   /**
    * @brief Generate a table representation by yielding each row.
@@ -756,6 +1109,60 @@ class TablePlugin : public Plugin {
     return false;
   }
 
+  /**
+   * @brief The bytes of stack used by the generator's coroutine.
+   *
+   * Coroutine stacks are fixed-size, protected, and pooled between cursors.
+   * Override if the generator needs more than the default stack size.
+   *
+   * @return the stack size, or 0 for the default coroutine stack size.
+   */
+  virtual size_t generatorStackSize() const {
+    return 0;
+  }
+
+  /**
+   * @brief Generate a complete table representation as a typed batch.
+   *
+   * For tables that set typed=True in their spec's implementation, rows are
+   * added to a TableRows batch created from TablePlugin::columns. This avoids
+   * building a string-keyed Row for every result and allows the virtual table
+   * cursor to bind native integer and double values to SQLite.
+   *
+   * @param results a typed batch using this table's column positions.
+   * @param context a query context filled in by SQLite's virtual table API.
+   */
+  virtual void generateRows(TableRows& results, QueryContext& context) {
+    (void)results;
+    (void)context;
+  }
+
+  /**
+   * @brief Generate typed batches of rows by yielding each batch.
+   *
+   * This is the generator variant of TablePlugin::generateRows, used when a
+   * table returns true for both usesGenerator and usesTypedRows. Fill the
+   * provided batch and yield it when it is reasonably sized. The batch is
+   * cleared by the caller before the generator is resumed, and any rows
+   * remaining when this method returns are yielded automatically.
+   *
+   * @param yield a callable that takes the filled batch as input.
+   * @param batch an empty typed batch using this table's column positions.
+   * @param context a query context filled in by SQLite's virtual table API.
+   */
+  virtual void rowsGenerator(TableRowsYield& yield,
+                             TableRows& batch,
+                             QueryContext& context) {
+    (void)yield;
+    (void)batch;
+    (void)context;
+  }
+
+  /// Override and return true to generate TableRows instead of QueryData.
+  virtual bool usesTypedRows() const {
+    return false;
+  }
+
  protected:
   /// An SQL table containing the table definition/syntax.
   std::string columnDefinition() const;
@@ -799,6 +1206,11 @@ class TablePlugin : public Plugin {
    */
   QueryData getCache() const;
 
+  /// The number of generates answered by getCache.
+  size_t cacheHits() const {
+    return cache_hits_;
+  }
+
   /**
    * @brief Similar to getCache, stores the results from generate.
    *
@@ -811,6 +1223,33 @@ class TablePlugin : public Plugin {
                 const QueryContext& ctx,
                 const QueryData& results);
 
+  /**
+   * @brief Copy the kept results of a STATIC table.
+   *
+   * The results of a table with the STATIC attribute, or with dependencies,
+   * are generated once, with every column, and kept in memory for
+   * --static_tables_refresh seconds, or until a dependency changes.
+   * They are not used if the query constrains an index, required, additional,
+   * or optimized column.
+   *
+   * @param ctx The query context.
+   * @param results Output, the kept results.
+   * @param state Output, the state of the dependencies for setStaticCache.
+   * @return True if the kept results were copied, otherwise false.
+   */
+  bool getStaticCache(const QueryContext& ctx,
+                      QueryData& results,
+                      std::string& state) const;
+
+  /// Keep the results generated after getStaticCache returned state.
+  void setStaticCache(const QueryContext& ctx,
+                      const QueryData& results,
+                      const std::string& state);
+
+ public:
+  /// Drop the kept results of a STATIC table, the next query generates.
+  void clearStaticCache();
+
  private:
   /// The last time in seconds the table data results were saved to cache.
   size_t last_cached_{0};
@@ -818,6 +1257,21 @@ class TablePlugin : public Plugin {
   /// The last interval in seconds when the table data was cached.
   size_t last_interval_{0};
 
+  /// Counted by getCache, reported by osquery_table_stats.
+  mutable std::atomic<size_t> cache_hits_{0};
+
+  /// The kept results of a STATIC table.
+  QueryData static_results_;
+
+  /// The UNIX time the results were kept, 0 if none are kept.
+  size_t static_time_{0};
+
+  /// The state of the dependencies when the kept results were generated.
+  std::string static_state_;
+
+  /// Protects the kept results, queries may execute concurrently.
+  mutable Mutex static_mutex_;
+
  public:
   /**
    * @brief The scheduled interval for the executing query.
@@ -879,6 +1333,11 @@ class TablePlugin : public Plugin {
   FRIEND_TEST(VirtualTableTests, test_indexing_costs);
   FRIEND_TEST(VirtualTableTests, test_table_results_cache);
   FRIEND_TEST(VirtualTableTests, test_yield_generator);
+  FRIEND_TEST(VirtualTableTests, test_typed_rows);
+  FRIEND_TEST(VirtualTableTests, test_typed_yield_generator);
+  FRIEND_TEST(VirtualTableTests, test_order_limit_pushdown);
+  FRIEND_TEST(VirtualTableTests, test_join_scan_memo);
+  FRIEND_TEST(VirtualTableTests, test_table_scan_stats);
 };
 
 /// Helper method to generate the virtual table CREATE statement.
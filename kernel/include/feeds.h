@@ -28,7 +28,7 @@
  *  A daemon may only connect to a kernel with the same communication version.
  *  Bump this number when changing or adding any event structs.
  */
-#define OSQUERY_KERNEL_COMMUNICATION_VERSION 4
+#define OSQUERY_KERNEL_COMMUNICATION_VERSION 6
 #ifdef KERNEL_TEST
 #define OSQUERY_KERNEL_COMM_VERSION \
   (OSQUERY_KERNEL_COMMUNICATION_VERSION | (1UL << 63))
@@ -122,10 +122,16 @@ typedef struct {
   char path[MAXPATHLEN];
 } osquery_file_event_t;
 
+/** @brief A subscription filter evaluated before an event is queued.
+ *
+ *  File events match the actions and paths beginning with the path. Process
+ *  events match executable paths beginning with the path. An empty path, or
+ *  no actions, matches every event.
+ */
 typedef struct {
   osquery_file_action_t actions;
   char path[MAXPATHLEN];
-} osquery_file_event_subscription_t;
+} osquery_event_filter_t;
 
 #ifdef KERNEL_TEST
 typedef struct {
@@ -161,6 +167,13 @@ typedef struct {
   osquery_event_time_t time;
 } osquery_data_header_t;
 
+/** @brief The maximum number of per-CPU queues sharing the buffer.
+ *
+ *  The shared buffer is divided into one circular queue for each CPU, up to
+ *  this count, so that CPUs do not contend for a single queue lock.
+ */
+#define OSQUERY_MAX_CQUEUES 32
+
 //
 // IOCTL messages
 //
@@ -168,6 +181,10 @@ typedef struct {
 typedef struct {
   osquery_event_t event;
   int subscribe;
+
+  // Events matching any subscribed filter of the event type are published.
+  // Unsubscribing removes every filter of the event type.
+  osquery_event_filter_t filter;
 } osquery_subscription_args_t;
 
 // Flags for buffer sync options.
@@ -180,11 +197,11 @@ typedef struct {
   // Option such as OSQUERY_NO_BLOCK.
   int options;
 
-  // Offset of daemon read pointer.
-  size_t read_offset;
+  // Offset of daemon read pointer, in the shared buffer, for each queue.
+  size_t read_offset[OSQUERY_MAX_CQUEUES];
 
-  // (Output) Offset of max_read pointer.
-  size_t max_read_offset;
+  // (Output) Offset of max_read pointer for each queue.
+  size_t max_read_offset[OSQUERY_MAX_CQUEUES];
 
   // (Output) Number of drops or negative on overflow.
   int drops;
@@ -197,6 +214,8 @@ typedef struct {
   void *buffer;
   // osquery kernel communication version.
   uint64_t version;
+  // (Output) Number of queues, each using an equal part of the buffer.
+  uint32_t queues;
 } osquery_buf_allocate_args_t;
 
 // TODO: Choose a proper IOCTL num.
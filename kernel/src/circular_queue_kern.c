@@ -11,11 +11,19 @@
 #include <libkern/libkern.h>
 
 #include <sys/proc.h>
+#include <sys/sysctl.h>
 
 #include <kern/assert.h>
+#include <kern/cpu_number.h>
 
 #include "circular_queue_kern.h"
 
+// Each per-CPU queue must fit several large events.
+#define OSQUERY_MIN_LANE_SIZE (256 * (1 << 10))
+
+// A blocked reader checks every queue at least this often (nanoseconds).
+#define OSQUERY_WAIT_INTERVAL (100 * 1000 * 1000)
+
 static inline void setup_queue_locks(osquery_cqueue_t *queue) {
   /* Create locks.  Cannot be done on the stack. */
   queue->lck_grp_attr = lck_grp_attr_alloc_init();
@@ -25,11 +33,15 @@ static inline void setup_queue_locks(osquery_cqueue_t *queue) {
 
   queue->lck_attr = lck_attr_alloc_init();
 
-  queue->lck = lck_spin_alloc_init(queue->lck_grp, queue->lck_attr);
+  for (int i = 0; i < OSQUERY_MAX_CQUEUES; i++) {
+    queue->lanes[i].lck = lck_spin_alloc_init(queue->lck_grp, queue->lck_attr);
+  }
 }
 
 static inline void teardown_queue_locks(osquery_cqueue_t *queue) {
-  lck_spin_free(queue->lck, queue->lck_grp);
+  for (int i = 0; i < OSQUERY_MAX_CQUEUES; i++) {
+    lck_spin_free(queue->lanes[i].lck, queue->lck_grp);
+  }
 
   lck_attr_free(queue->lck_attr);
 
@@ -38,18 +50,18 @@ static inline void teardown_queue_locks(osquery_cqueue_t *queue) {
   lck_grp_attr_free(queue->lck_grp_attr);
 }
 
-static inline void *advance_pointer(osquery_cqueue_t *queue, void *ptr,
+static inline void *advance_pointer(osquery_cqueue_lane_t *lane, void *ptr,
                                     size_t bytes) {
-  return ((uint8_t *)ptr + bytes - queue->buffer) % queue->size + queue->buffer;
+  return ((uint8_t *)ptr + bytes - lane->buffer) % lane->size + lane->buffer;
 }
 
-static inline size_t get_distance(osquery_cqueue_t *queue, void *lower,
+static inline size_t get_distance(osquery_cqueue_lane_t *lane, void *lower,
                                   void *upper, int cannot_be_empty) {
   ssize_t size = (uint8_t *)upper - (uint8_t *)lower;
   if (size == 0) {
-    return cannot_be_empty ? queue->size : 0;
+    return cannot_be_empty ? lane->size : 0;
   } else if (size < 0) {
-    return queue->size + size;
+    return lane->size + size;
   } else {
     return size;
   }
@@ -62,12 +74,12 @@ typedef enum {
   OSQUERY_NOT_IN_BUFFER = 1 << 2
 } osquery_between_t;
 
-static inline osquery_between_t is_between(osquery_cqueue_t *queue, void *ptr,
-                                           void *lower, void *upper,
+static inline osquery_between_t is_between(osquery_cqueue_lane_t *lane,
+                                           void *ptr, void *lower, void *upper,
                                            size_t size) {
   osquery_between_t b = OSQUERY_BETWEEN_INIT;
-  if (ptr < (void *)queue->buffer
-      || ((uint8_t *)ptr) + size > (queue->buffer + queue->size)) {
+  if (ptr < (void *)lane->buffer
+      || ((uint8_t *)ptr) + size > (lane->buffer + lane->size)) {
     b |= OSQUERY_NOT_IN_BUFFER;
   }
 
@@ -84,14 +96,44 @@ static inline osquery_between_t is_between(osquery_cqueue_t *queue, void *ptr,
   return b;
 }
 
+/** @brief Find the per-CPU queue containing reserved space.
+ *
+ *  @return The queue, NULL if the space is not within the buffer.
+ */
+static inline osquery_cqueue_lane_t *find_lane(osquery_cqueue_t *queue,
+                                               void *space) {
+  uint32_t lane_count = queue->lane_count;
+  if (lane_count == 0 || (uint8_t *)space < queue->buffer) {
+    return NULL;
+  }
+
+  size_t index = ((uint8_t *)space - queue->buffer) / queue->lane_size;
+  return (index < lane_count) ? &queue->lanes[index] : NULL;
+}
+
+/// The number of CPUs, each receives a queue.
+static uint32_t get_cpu_count() {
+  int ncpu = 0;
+  size_t length = sizeof(ncpu);
+  if (sysctlbyname("hw.ncpu", &ncpu, &length, NULL, 0) != 0 || ncpu < 1) {
+    return 1;
+  }
+  return (uint32_t)ncpu;
+}
+
 void osquery_cqueue_setup(osquery_cqueue_t *queue) {
   queue->last_destruction_time = 0;
   queue->initialized = 0;
+  queue->lane_count = 0;
+  for (int i = 0; i < OSQUERY_MAX_CQUEUES; i++) {
+    queue->lanes[i].initialized = 0;
+    queue->lanes[i].reservations = 0;
+  }
   setup_queue_locks(queue);
 }
 
 int osquery_cqueue_teardown(osquery_cqueue_t *queue) {
-  lck_spin_lock(queue->lck);
+  lck_spin_lock(queue->lanes[0].lck);
 
   // We make sure that the queue hasn't been serving requests for at least 1
   // second before we free up our locks.  This is in an attempt to make sure
@@ -105,111 +147,175 @@ int osquery_cqueue_teardown(osquery_cqueue_t *queue) {
   clock_usec_t micro_sec;
   clock_get_system_microtime(&seconds, &micro_sec);
   if (!queue->initialized && seconds > 2 + queue->last_destruction_time) {
-    lck_spin_unlock(queue->lck);
+    lck_spin_unlock(queue->lanes[0].lck);
     teardown_queue_locks(queue);
     return 0;
   } else {
-    lck_spin_unlock(queue->lck);
+    lck_spin_unlock(queue->lanes[0].lck);
     return -1;
   }
 }
 
-void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size) {
-  lck_spin_lock(queue->lck);
-  queue->buffer = (uint8_t *)buffer;
-  queue->size = size;
+uint32_t osquery_cqueue_init(osquery_cqueue_t *queue,
+                             void *buffer,
+                             size_t size) {
+  uint32_t lane_count = get_cpu_count();
+  if (lane_count > OSQUERY_MAX_CQUEUES) {
+    lane_count = OSQUERY_MAX_CQUEUES;
+  }
+  if (lane_count > size / OSQUERY_MIN_LANE_SIZE) {
+    lane_count = (uint32_t)(size / OSQUERY_MIN_LANE_SIZE);
+  }
+  if (lane_count == 0) {
+    lane_count = 1;
+  }
 
-  queue->write = queue->buffer;
-  queue->max_read = queue->buffer;
-  queue->read = queue->buffer;
+  // Each queue is aligned for its event headers.
+  size_t lane_size = (size / lane_count) & ~((size_t)sizeof(uint64_t) - 1);
 
-  queue->drops = 0;
+  lck_spin_lock(queue->lanes[0].lck);
+  queue->buffer = (uint8_t *)buffer;
+  queue->lane_size = lane_size;
+  queue->lane_count = lane_count;
+  lck_spin_unlock(queue->lanes[0].lck);
+
+  for (uint32_t i = 0; i < lane_count; i++) {
+    osquery_cqueue_lane_t *lane = &queue->lanes[i];
+    lck_spin_lock(lane->lck);
+    lane->buffer = (uint8_t *)buffer + i * lane_size;
+    lane->size = lane_size;
+
+    lane->write = lane->buffer;
+    lane->max_read = lane->buffer;
+    lane->read = lane->buffer;
+
+    lane->drops = 0;
+    lane->initialized = 1;
+    lane->reservations = 0;
+    lck_spin_unlock(lane->lck);
+  }
+
+  lck_spin_lock(queue->lanes[0].lck);
   queue->initialized = 1;
-  queue->reservations = 0;
-  lck_spin_unlock(queue->lck);
+  lck_spin_unlock(queue->lanes[0].lck);
+  return lane_count;
 }
 
 void osquery_cqueue_destroy(osquery_cqueue_t *queue) {
-  lck_spin_lock(queue->lck);
-  if (queue->initialized) {
-    queue->initialized = 0;
+  lck_spin_lock(queue->lanes[0].lck);
+  int initialized = queue->initialized;
+  queue->initialized = 0;
+  lck_spin_unlock(queue->lanes[0].lck);
+  if (!initialized) {
+    return;
+  }
+
+  // Wake a reader blocked waiting for data.
+  wakeup(&queue->data_event);
 
-    while (queue->reservations > 0) {
-      lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT, &queue->reservations,
+  for (uint32_t i = 0; i < queue->lane_count; i++) {
+    osquery_cqueue_lane_t *lane = &queue->lanes[i];
+    lck_spin_lock(lane->lck);
+    lane->initialized = 0;
+    while (lane->reservations > 0) {
+      lck_spin_sleep(lane->lck, LCK_SLEEP_DEFAULT, &lane->reservations,
                      THREAD_UNINT);
     }
-
-    // Time is recorded so we can fail cqueue_teardown (destruction of cqueue
-    // locks) for a short period of time.  This should allow pending event
-    // callbacks to notice ths cqueue has been unitialized and error out before
-    // the locks become unusable.
-    clock_usec_t micro_sec;
-    clock_get_system_microtime(&queue->last_destruction_time, &micro_sec);
+    lck_spin_unlock(lane->lck);
   }
 
-  lck_spin_unlock(queue->lck);
+  // Time is recorded so we can fail cqueue_teardown (destruction of cqueue
+  // locks) for a short period of time.  This should allow pending event
+  // callbacks to notice ths cqueue has been unitialized and error out before
+  // the locks become unusable.
+  lck_spin_lock(queue->lanes[0].lck);
+  clock_usec_t micro_sec;
+  clock_get_system_microtime(&queue->last_destruction_time, &micro_sec);
+  lck_spin_unlock(queue->lanes[0].lck);
 }
 
-int osquery_cqueue_advance_read(osquery_cqueue_t *queue, size_t read_offset,
+int osquery_cqueue_advance_read(osquery_cqueue_t *queue,
+                                const size_t *read_offset,
                                 size_t *max_read_offset) {
   int err = 0;
-  lck_spin_lock(queue->lck);
-
-  if (!queue->initialized) {
-    err = -1;
-    goto error_exit;
-  }
+  for (uint32_t i = 0; i < queue->lane_count; i++) {
+    osquery_cqueue_lane_t *lane = &queue->lanes[i];
+    lck_spin_lock(lane->lck);
+    if (!lane->initialized) {
+      lck_spin_unlock(lane->lck);
+      return -1;
+    }
 
-  uint8_t *new_read = queue->buffer + read_offset;
-  if (OSQUERY_BETWEEN == is_between(queue, new_read, queue->read,
-                                    queue->max_read, 0)) {
-    queue->read = new_read;
-  } else {
-    queue->read = queue->max_read;
-    err = -1;
+    uint8_t *new_read = queue->buffer + read_offset[i];
+    if (OSQUERY_BETWEEN == is_between(lane, new_read, lane->read,
+                                      lane->max_read, 0)) {
+      lane->read = new_read;
+    } else {
+      lane->read = lane->max_read;
+      err = -1;
+    }
+    max_read_offset[i] = lane->max_read - queue->buffer;
+    lck_spin_unlock(lane->lck);
   }
-  *max_read_offset = queue->max_read - queue->buffer;
-
-error_exit:
-  lck_spin_unlock(queue->lck);
 
   return err;
 }
 
-ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue) {
-  ssize_t offset = 0;
-  lck_spin_lock(queue->lck);
+int osquery_cqueue_wait_for_data(osquery_cqueue_t *queue,
+                                 size_t *max_read_offset) {
+  wait_result_t wait_result = THREAD_AWAKENED;
+  while (wait_result != THREAD_INTERRUPTED) {
+    int readable = 0;
+    for (uint32_t i = 0; i < queue->lane_count; i++) {
+      osquery_cqueue_lane_t *lane = &queue->lanes[i];
+      lck_spin_lock(lane->lck);
+      if (!lane->initialized) {
+        lck_spin_unlock(lane->lck);
+        return -1;
+      }
+      readable |= (lane->max_read != lane->read);
+      max_read_offset[i] = lane->max_read - queue->buffer;
+      lck_spin_unlock(lane->lck);
+    }
 
-  if (!queue->initialized) {
-    offset = -1;
-    goto error_exit;
-  }
+    if (readable) {
+      break;
+    }
 
-  wait_result_t wait_result = THREAD_AWAKENED;
-  while (wait_result == THREAD_AWAKENED && queue->max_read == queue->read) {
-    wait_result = lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT,
-                                 &queue->max_read, THREAD_ABORTSAFE);
+    // A commit to another queue may wake before this thread sleeps, so the
+    // sleep is bounded and every queue is checked again.
+    uint64_t deadline;
+    clock_interval_to_deadline(OSQUERY_WAIT_INTERVAL, 1, &deadline);
+    lck_spin_lock(queue->lanes[0].lck);
+    if (!queue->initialized) {
+      lck_spin_unlock(queue->lanes[0].lck);
+      return -1;
+    }
+    wait_result = lck_spin_sleep_deadline(queue->lanes[0].lck,
+                                          LCK_SLEEP_DEFAULT,
+                                          &queue->data_event,
+                                          THREAD_ABORTSAFE,
+                                          deadline);
+    lck_spin_unlock(queue->lanes[0].lck);
   }
-  offset = queue->max_read - queue->buffer;
 
-error_exit:
-  lck_spin_unlock(queue->lck);
-  return offset;
+  return 0;
 }
 
 int osquery_cqueue_dropped_data(osquery_cqueue_t *queue) {
-  int drops;
-  lck_spin_lock(queue->lck);
-  if (!queue->initialized) {
-    drops = -1;
-    goto error_exit;
-  }
-
-  drops = queue->drops;
-  queue->drops = 0;
+  int drops = 0;
+  for (uint32_t i = 0; i < queue->lane_count; i++) {
+    osquery_cqueue_lane_t *lane = &queue->lanes[i];
+    lck_spin_lock(lane->lck);
+    if (!lane->initialized) {
+      lck_spin_unlock(lane->lck);
+      return -1;
+    }
 
-error_exit:
-  lck_spin_unlock(queue->lck);
+    drops += lane->drops;
+    lane->drops = 0;
+    lck_spin_unlock(lane->lck);
+  }
 
   return drops;
 }
@@ -217,9 +323,18 @@ error_exit:
 void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
                              osquery_event_t event,
                              size_t size) {
+  uint32_t lane_count = queue->lane_count;
+  if (lane_count == 0) {
+    return NULL;
+  }
+
+  // The thread may move to another CPU before committing, which only costs
+  // contention on this queue's lock.
+  osquery_cqueue_lane_t *lane = &queue->lanes[cpu_number() % lane_count];
+
   void *ret = NULL;
-  lck_spin_lock(queue->lck);
-  if (!queue->initialized) {
+  lck_spin_lock(lane->lck);
+  if (!lane->initialized) {
     ret = NULL;
     goto error_exit;
   }
@@ -232,25 +347,25 @@ void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
   // We do not want the write pointer to ever equal the read pointer unless
   // everything is empty.  Otherwise we need to track the empty states for the
   // buffer.
-  if (get_distance(queue, queue->write, queue->read, 1) > size) {
-    if (get_distance(queue, queue->write,
-                     queue->buffer + queue->size, 0) >= size) {
+  if (get_distance(lane, lane->write, lane->read, 1) > size) {
+    if (get_distance(lane, lane->write,
+                     lane->buffer + lane->size, 0) >= size) {
       // We can fit the allocation by advancing the write pointer.
-      header = (osquery_data_header_t *)queue->write;
-      queue->write = (uint8_t *)advance_pointer(queue, queue->write, size);
-    } else if (get_distance(queue, queue->buffer, queue->read, 0) > size) {
+      header = (osquery_data_header_t *)lane->write;
+      lane->write = (uint8_t *)advance_pointer(lane, lane->write, size);
+    } else if (get_distance(lane, lane->buffer, lane->read, 0) > size) {
       // We can fit the allocation by wrapping the write pointer.
-      if (get_distance(queue, queue->write, queue->buffer + queue->size, 0)
+      if (get_distance(lane, lane->write, lane->buffer + lane->size, 0)
           >= sizeof(osquery_data_header_t)) {
         // Signal a Null event ie. jump to beginning of buf.  If there
         // is not enough room to do so, this is ok because it will know to
         // skip to the beginning of the buffer based on the amount of space
         // left.
-        header = (osquery_data_header_t *)queue->write;
+        header = (osquery_data_header_t *)lane->write;
         header->event = END_OF_BUFFER_EVENT;
       }
-      header = (osquery_data_header_t *)queue->buffer;
-      queue->write = (uint8_t *)advance_pointer(queue, queue->buffer, size);
+      header = (osquery_data_header_t *)lane->buffer;
+      lane->write = (uint8_t *)advance_pointer(lane, lane->buffer, size);
     }
   }
 
@@ -261,15 +376,15 @@ void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
 
     // Give them the pointer to the space not the header.
     ret = (void *)(header + 1);
-    queue->reservations++;
+    lane->reservations++;
   } else {
-    if (queue->drops >= 0) {
-      queue->drops += 1;
+    if (lane->drops >= 0) {
+      lane->drops += 1;
     }
     ret = NULL;
   }
 error_exit:
-  lck_spin_unlock(queue->lck);
+  lck_spin_unlock(lane->lck);
 
   return ret;
 }
@@ -279,45 +394,53 @@ error_exit:
  *
  *  REQUIRES the lock.
  *
- *  @param queue The queue to create readable space in.
- *  @return Void.
+ *  @param lane The queue to create readable space in.
+ *  @return 1 if space was made readable.
  */
-static inline void coalesce_readable(osquery_cqueue_t *queue) {
-  osquery_data_header_t *header = (osquery_data_header_t *)queue->max_read;
+static inline int coalesce_readable(osquery_cqueue_lane_t *lane) {
+  osquery_data_header_t *header = (osquery_data_header_t *)lane->max_read;
   osquery_between_t b;
+  int readable = 0;
 
-  while (OSQUERY_BETWEEN & (b = is_between(queue, header, queue->max_read,
-                                       queue->write, sizeof(osquery_data_header_t)))) {
+  while (OSQUERY_BETWEEN & (b = is_between(lane, header, lane->max_read,
+                                       lane->write, sizeof(osquery_data_header_t)))) {
     if (b & OSQUERY_NOT_IN_BUFFER || header->event == END_OF_BUFFER_EVENT) {
-      queue->max_read = queue->buffer;
-      header = (osquery_data_header_t *)queue->max_read;
+      lane->max_read = lane->buffer;
+      header = (osquery_data_header_t *)lane->max_read;
       continue;
     } else if (!header->finished) {
       break;
     }
 
-    queue->max_read = (uint8_t *)advance_pointer(
-        queue, queue->max_read, header->size + sizeof(osquery_data_header_t));
+    lane->max_read = (uint8_t *)advance_pointer(
+        lane, lane->max_read, header->size + sizeof(osquery_data_header_t));
 
-    header = (osquery_data_header_t *)queue->max_read;
-    wakeup(&queue->max_read);
+    header = (osquery_data_header_t *)lane->max_read;
+    readable = 1;
 
-    lck_spin_unlock(queue->lck);
-    lck_spin_lock(queue->lck);
+    lck_spin_unlock(lane->lck);
+    lck_spin_lock(lane->lck);
   }
+  return readable;
 }
 
 int osquery_cqueue_commit(osquery_cqueue_t *queue, void *space) {
   int err = 0;
 
-  lck_spin_lock(queue->lck);
+  // Space is committed to the queue it was reserved from.
+  osquery_cqueue_lane_t *lane = find_lane(queue, space);
+  if (lane == NULL) {
+    return -1;
+  }
+
+  lck_spin_lock(lane->lck);
 
   // Retrieve the header for the initialized space.
   osquery_data_header_t *header = ((osquery_data_header_t *)space) - 1;
-  if (OSQUERY_BETWEEN != is_between(queue, header, queue->max_read,
-                                    queue->write,
+  if (OSQUERY_BETWEEN != is_between(lane, header, lane->max_read,
+                                    lane->write,
                                     sizeof(osquery_data_header_t)) ||
-      queue->reservations == 0 || header->event == END_OF_BUFFER_EVENT ||
+      lane->reservations == 0 || header->event == END_OF_BUFFER_EVENT ||
       header->finished) {
     err = -1;  // Invalid space.
     goto error_exit;
@@ -331,12 +454,13 @@ int osquery_cqueue_commit(osquery_cqueue_t *queue, void *space) {
   clock_get_system_microtime(&seconds, &microsecs);
   header->time.uptime = (uint64_t)seconds;
 
-  coalesce_readable(queue);
+  if (coalesce_readable(lane)) {
+    wakeup(&queue->data_event);
+  }
 
-  queue->reservations--;
-  wakeup(&queue->reservations);
+  lane->reservations--;
+  wakeup(&lane->reservations);
 error_exit:
-  lck_spin_unlock(queue->lck);
+  lck_spin_unlock(lane->lck);
   return err;
 }
-
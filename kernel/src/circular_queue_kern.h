@@ -12,6 +12,11 @@
  *  Specifically this circular queue implementation is used for passing event
  *  information from the kernel to the user.
  *
+ *  The shared buffer is divided into a circular queue for each CPU, each with
+ *  its own lock.  Events are reserved in the queue of the reserving CPU and
+ *  committed to the queue containing the reserved space.  Events are ordered
+ *  within a queue, but the daemon must use the event time to order events
+ *  between queues.
  *
  *  For safety this queue on an error should log the error and reset to a known
  *  safe state possibly dropping all data in held within it.
@@ -31,7 +36,7 @@
 extern "C" {
 #endif
 
-// Circular queue data structure.
+// A single CPU's circular queue within the shared buffer.
 typedef struct {
   uint8_t *buffer;
   size_t size;
@@ -41,12 +46,27 @@ typedef struct {
   int drops;
   int initialized;
   uint32_t reservations;
+
+  lck_spin_t *lck;
+} osquery_cqueue_lane_t;
+
+// Circular queue data structure.
+typedef struct {
+  osquery_cqueue_lane_t lanes[OSQUERY_MAX_CQUEUES];
+  uint32_t lane_count;
+  uint8_t *buffer;
+  size_t lane_size;
+
+  // The following are protected by the first lane's lock.
+  int initialized;
   clock_sec_t last_destruction_time;
 
+  // Readers blocked on an empty queue sleep on this event.
+  int data_event;
+
   lck_grp_attr_t *lck_grp_attr;
   lck_grp_t *lck_grp;
   lck_attr_t *lck_attr;
-  lck_spin_t *lck;
 } osquery_cqueue_t;
 
 /** @brief Setup a circular queue lock system.
@@ -73,13 +93,16 @@ int osquery_cqueue_teardown(osquery_cqueue_t *queue);
 /** @brief Initialize a circular queue.
  *
  *  Initializes a circular queue given a preallocated buffer of a given size.
+ *  The buffer is divided into an equal part for each CPU.
  *
  *  @param queue The circular queue structure to initialize.
  *  @param buffer The buffer to use in the queue.
  *  @param size The size of the passed in buffer.
- *  @return Void.
+ *  @return The number of per-CPU queues.
  */
-void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size);
+uint32_t osquery_cqueue_init(osquery_cqueue_t *queue,
+                             void *buffer,
+                             size_t size);
 
 
 /** @brief Cleanup a cqueue.
@@ -99,35 +122,40 @@ void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size);
 void osquery_cqueue_destroy(osquery_cqueue_t *queue);
 
 
-/** @brief Advance the read head in the buffer.
+/** @brief Advance the read head of each per-CPU queue.
  *
- *  @param queue The circular queue structure to advance the read head in.
- *  @param read_offset Offset of pointer to new location of read head.
- *  @param max_read_offset (Output) Output the offset of the max_read pointer.
- *  @return Return negative on failure (invalid offset).
+ *  @param queue The circular queue structure to advance the read heads in.
+ *  @param read_offset Offset of the new location of each read head.
+ *  @param max_read_offset (Output) Output the offset of each max_read pointer.
+ *  @return Return negative on failure (an invalid offset).
  */
-int osquery_cqueue_advance_read(osquery_cqueue_t *queue, size_t read_offset,
+int osquery_cqueue_advance_read(osquery_cqueue_t *queue,
+                                const size_t *read_offset,
                                 size_t *max_read_offset);
 
 
-/** @brief Find the position of the max_read pointer.  Block if buffer is empty.
+/** @brief Find the position of each max_read pointer.  Block if all are empty.
  *
- *  @param queue The queue to find the offset of the max_read pointer in.
- *  @return Return offset of max_read pointer.  Negative on failure.
+ *  @param queue The queue to find the offsets of the max_read pointers in.
+ *  @param max_read_offset (Output) Output the offset of each max_read pointer.
+ *  @return Return negative on failure.
  */
-ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue);
+int osquery_cqueue_wait_for_data(osquery_cqueue_t *queue,
+                                 size_t *max_read_offset);
 
 /** @brief Returns if the cqueue has dropped data.
  *
- *  Returns whether data has been dropped since the last call of this function.
+ *  Returns the number of events dropped by every per-CPU queue since the last
+ *  call of this function.
  *
  *  @param queue The cqueue to look for dropped data in.
- *  @return 0 for no data dropped 1 for dropped data.
+ *  @return The number of dropped events, negative if not initialized.
  */
 int osquery_cqueue_dropped_data(osquery_cqueue_t *queue);
 
 /** @brief Reserve space to store an event in the queue.
  *
+ *  Space is reserved in the queue of the current CPU.
  *  This gives you a brief moment to write data to the returned space.
  *  NOTE: You must call the commit function on your pointer shortly after
  *  reserving it.  Otherwise the buffer will become deadlocked.
@@ -111,7 +111,9 @@ static void unsubscribe_all_events() {
   }
 }
 
-static int subscribe_to_event(osquery_event_t event, int subscribe) {
+static int subscribe_to_event(osquery_event_t event,
+                              int subscribe,
+                              const osquery_event_filter_t *filter) {
   if (osquery.buffer == NULL) {
     return -EINVAL;
   }
@@ -123,7 +125,7 @@ static int subscribe_to_event(osquery_event_t event, int subscribe) {
   }
 
   if (subscribe) {
-    if (osquery_publishers[event]->subscribe(&osquery.cqueue)) {
+    if (osquery_publishers[event]->subscribe(&osquery.cqueue, filter)) {
       return -EINVAL;
     }
   } else {
@@ -134,7 +136,7 @@ static int subscribe_to_event(osquery_event_t event, int subscribe) {
 }
 
 static int update_user_kernel_buffer(int options,
-                                     size_t read_offset,
+                                     const size_t *read_offset,
                                      size_t *max_read_offset,
                                      int *drops) {
   if (osquery_cqueue_advance_read(
@@ -142,12 +144,9 @@ static int update_user_kernel_buffer(int options,
     return -EINVAL;
   }
   if (!(options & OSQUERY_OPTIONS_NO_BLOCK)) {
-    ssize_t offset = 0;
-    if ((offset = osquery_cqueue_wait_for_data(&osquery.cqueue)) < 0) {
+    if (osquery_cqueue_wait_for_data(&osquery.cqueue, max_read_offset) < 0) {
       return -EINVAL;
     }
-
-    *max_read_offset = offset;
   }
   *drops = osquery_cqueue_dropped_data(&osquery.cqueue);
   return 0;
@@ -172,7 +171,9 @@ static void cleanup_user_kernel_buffer() {
   }
 }
 
-static int allocate_user_kernel_buffer(size_t size, void **buf) {
+static int allocate_user_kernel_buffer(size_t size,
+                                       void **buf,
+                                       uint32_t *queues) {
   int err = 0;
 
   // The user space daemon is requesting a new circular queue.
@@ -217,7 +218,8 @@ static int allocate_user_kernel_buffer(size_t size, void **buf) {
   // The virtual address will be shared back to the user space queue manager.
   *buf = (void *)osquery.mm->getAddress();
   // Initialize the kernel space queue manager with the new buffer.
-  osquery_cqueue_init(&osquery.cqueue, osquery.buffer, osquery.buf_size);
+  *queues =
+      osquery_cqueue_init(&osquery.cqueue, osquery.buffer, osquery.buf_size);
 
   return 0;
 error_exit:
@@ -311,7 +313,8 @@ static int osquery_ioctl(
   // Daemon is requesting a new subscription (e.g., monitored path).
   case OSQUERY_IOCTL_SUBSCRIPTION:
     sub = (osquery_subscription_args_t *)data;
-    if ((err = subscribe_to_event(sub->event, sub->subscribe))) {
+    if ((err = subscribe_to_event(
+             sub->event, sub->subscribe, &(sub->filter)))) {
       goto error_exit;
     }
     break;
@@ -329,7 +332,7 @@ static int osquery_ioctl(
     sync = (osquery_buf_sync_args_t *)data;
     if ((err = update_user_kernel_buffer(sync->options,
                                          sync->read_offset,
-                                         &(sync->max_read_offset),
+                                         sync->max_read_offset,
                                          &(sync->drops)))) {
       lck_mtx_lock(osquery.mtx);
       goto error_exit;
@@ -355,12 +358,15 @@ static int osquery_ioctl(
     }
 
     // Attempt to allocation and set up the circular queue.
-    if ((err = allocate_user_kernel_buffer(alloc->size, &(alloc->buffer)))) {
+    if ((err = allocate_user_kernel_buffer(
+             alloc->size, &(alloc->buffer), &(alloc->queues)))) {
       goto error_exit;
     }
 
-    dbg_printf(
-        "IOCTL alloc: size %lu, location %p\n", alloc->size, alloc->buffer);
+    dbg_printf("IOCTL alloc: size %lu, location %p, queues %u\n",
+               alloc->size,
+               alloc->buffer,
+               alloc->queues);
     break;
   default:
     err = -ENOTTY;
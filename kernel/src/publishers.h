@@ -16,13 +16,16 @@
  *
  *  This function type is called when someone subscribes to a publisher.  It
  *  should initialize all event callbacks and start publishing events to the
- *  queue.
+ *  queue.  A publisher may be subscribed to again with more filters, events
+ *  not matching any filter are not reserved in the queue.
  *
  *  @param queue The queue to publish to.  A subscriber will only publish to the
  *         last queue (not an issue as there should only be one queue).
+ *  @param filter The events to publish.
  *  @return 0 on success, negative on failure.
  */
-typedef int (*osquery_subscriber_t)(osquery_cqueue_t *queue);
+typedef int (*osquery_subscriber_t)(osquery_cqueue_t *queue,
+                                    const osquery_event_filter_t *filter);
 /** @brief Unsubscribe function type.
  *
  *  Functions of this type stop a publisher from publishing events to the queue
@@ -24,7 +24,7 @@ static osquery_cqueue_t *cqueue = NULL;
 static kauth_listener_t fileop_listener = NULL;
 
 typedef struct subscription {
-  osquery_file_event_subscription_t subscription;
+  osquery_event_filter_t subscription;
   size_t pathlen;
   SLIST_ENTRY(subscription) next;
 } subscription_t;
@@ -130,7 +130,8 @@ static int fileop_scope_callback(kauth_cred_t credential,
   return KAUTH_RESULT_DEFER;
 }
 
-static int subscribe(osquery_cqueue_t *queue) {
+static int subscribe(osquery_cqueue_t *queue,
+                     const osquery_event_filter_t *filter) {
   if (malloc_tag == NULL) {
     malloc_tag = OSMalloc_Tagalloc(TAGNAME, OSMT_DEFAULT);
     if (malloc_tag == NULL) {
@@ -154,6 +155,15 @@ static int subscribe(osquery_cqueue_t *queue) {
     goto error_exit;
   }
 
+  // A filter without actions is subscribed to every action.
+  sub->subscription = *filter;
+  sub->subscription.path[MAXPATHLEN - 1] = '\0';
+  if (sub->subscription.actions == OSQUERY_FILE_ACTION_NONE) {
+    sub->subscription.actions =
+        (osquery_file_action_t)(OSQUERY_FILE_ACTION_OPEN |
+                                OSQUERY_FILE_ACTION_CLOSE |
+                                OSQUERY_FILE_ACTION_CLOSE_MODIFIED);
+  }
   sub->pathlen = strnlen(sub->subscription.path, MAXPATHLEN);
 
   // Check if we are already subscribed to this event.
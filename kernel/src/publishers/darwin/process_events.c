@@ -16,11 +16,31 @@
 #include <security/mac_framework.h>
 #include <security/mac.h>
 #include <security/mac_policy.h>
+#include <sys/queue.h>
+
+#include <libkern/OSMalloc.h>
+
+#define TAGNAME "com.facebook.security.osquery.process_events"
 
 #include "publishers.h"
 
 static osquery_cqueue_t *cqueue = NULL;
 
+typedef struct process_filter {
+  char path[MAXPATHLEN];
+  size_t pathlen;
+  SLIST_ENTRY(process_filter) next;
+} process_filter_t;
+
+SLIST_HEAD(process_filter_list, process_filter);
+static struct process_filter_list filter_list =
+    SLIST_HEAD_INITIALIZER(filter_list);
+
+/// Set when a filter without a path is subscribed, every process is published.
+static int filter_all = 0;
+
+static OSMallocTag malloc_tag = NULL;
+
 #define MAX_VECTOR_LENGTH 4096
 
 static inline int str_num(char *buf, size_t length) {
@@ -35,6 +55,16 @@ static inline int str_num(char *buf, size_t length) {
   return strs;
 }
 
+static int process_filter_matches(const char *path) {
+  process_filter_t *filter = NULL;
+  SLIST_FOREACH(filter, &filter_list, next) {
+    if (strncmp(path, filter->path, filter->pathlen) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 static int process_cred_label_update_execvew(kauth_cred_t old_cred,
                                              kauth_cred_t new_cred,
                                              struct proc *p,
@@ -54,6 +84,16 @@ static int process_cred_label_update_execvew(kauth_cred_t old_cred,
     goto error_exit;
   }
 
+  // Filter on the executable path before reserving space in the queue.
+  char path[MAXPATHLEN];
+  int filtered = !filter_all;
+  if (filtered) {
+    if (vn_getpath(vp, path, &path_len) != 0 ||
+        !process_filter_matches(path)) {
+      goto error_exit;
+    }
+  }
+
   // Determine address of image_params based off of csflags pointer. (HACKY)
   struct image_params *img =
       (struct image_params *)((char *)csflags -
@@ -129,7 +169,11 @@ static int process_cred_label_update_execvew(kauth_cred_t old_cred,
   e->gid = kauth_cred_getrgid(new_cred);
   e->egid = kauth_cred_getgid(new_cred);
 
-  vn_getpath(vp, e->path, &path_len);
+  if (filtered) {
+    memcpy(e->path, path, path_len);
+  } else {
+    vn_getpath(vp, e->path, &path_len);
+  }
 
   osquery_cqueue_commit(cqueue, e);
 error_exit:
@@ -152,14 +196,34 @@ static struct mac_policy_conf policy_conf = {
     .mpc_field_off = NULL,
     .mpc_runtime_flags = 0};
 
-static int subscribe(osquery_cqueue_t *queue) {
+static int subscribe(osquery_cqueue_t *queue,
+                     const osquery_event_filter_t *filter) {
   cqueue = queue;
-  if (handle != 0) {
-    return -1;
-  }
+  if (filter->path[0] == '\0') {
+    filter_all = 1;
+  } else if (!filter_all) {
+    if (malloc_tag == NULL) {
+      malloc_tag = OSMalloc_Tagalloc(TAGNAME, OSMT_DEFAULT);
+      if (malloc_tag == NULL) {
+        return -1;
+      }
+    }
 
-  mac_policy_register(&policy_conf, &handle, NULL);
+    process_filter_t *entry = OSMalloc(sizeof(process_filter_t), malloc_tag);
+    if (entry == NULL) {
+      return -1;
+    }
+    strlcpy(entry->path, filter->path, MAXPATHLEN);
+    entry->pathlen = strnlen(entry->path, MAXPATHLEN);
+
+    // Filters are only added while the policy may be running, the head is
+    // published after the new entry is complete.
+    SLIST_INSERT_HEAD(&filter_list, entry, next);
+  }
 
+  if (handle == 0) {
+    mac_policy_register(&policy_conf, &handle, NULL);
+  }
   return 0;
 }
 
@@ -168,6 +232,19 @@ static void unsubscribe() {
     mac_policy_unregister(handle);
     handle = 0;
   }
+
+  while (!SLIST_EMPTY(&filter_list)) {
+    process_filter_t *entry = SLIST_FIRST(&filter_list);
+    SLIST_REMOVE_HEAD(&filter_list, next);
+    OSFree(entry, sizeof(process_filter_t), malloc_tag);
+  }
+
+  if (malloc_tag) {
+    OSMalloc_Tagfree(malloc_tag);
+    malloc_tag = NULL;
+  }
+
+  filter_all = 0;
 }
 
 osquery_kernel_event_publisher_t process_events_publisher = {
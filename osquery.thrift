@@ -21,6 +21,8 @@ struct InternalExtensionInfo {
   2:string version,
   3:string sdk_version,
   4:string min_sdk_version,
+  /// An optional shared memory ring for one-way calls to the extension.
+  5:string shared_memory,
 }
 
 /// Unique ID for each extension.
@@ -51,6 +53,26 @@ struct ExtensionResponse {
   2:ExtensionPluginResponse response,
 }
 
+/// A column of typed table rows.
+struct ExtensionColumn {
+  1:string name,
+  /// One byte per row: 0 is NULL, 1 is an integer, 2 a double, 3 text.
+  2:binary kinds,
+  /// The values of each kind, in row order.
+  3:list<i64> integers,
+  4:list<double> doubles,
+  5:list<binary> texts,
+}
+
+/// A batch of table rows as typed columns, each column name is sent once.
+struct ExtensionRowsResponse {
+  1:ExtensionStatus status,
+  2:i64 rows,
+  3:list<ExtensionColumn> columns,
+  /// The cursor to read the next batch, 0 if there are no more rows.
+  4:i64 cursor,
+}
+
 exception ExtensionException {
   1:i32 code,
   2:string message,
@@ -70,6 +92,20 @@ service Extension {
     3:ExtensionPluginRequest request),
   /// Request that an extension shutdown (does not apply to managers).
   void shutdown(),
+  /// Start generating a table plugin's rows, returns the first batch.
+  ExtensionRowsResponse openRows(
+    /// The table plugin name.
+    1:string table,
+    /// The table plugin request, including the serialized query context.
+    2:ExtensionPluginRequest request,
+    /// The maximum rows of each batch, 0 returns every row in one batch.
+    3:i64 batch),
+  /// Return the next batch of an open cursor.
+  ExtensionRowsResponse nextRows(
+    1:i64 cursor),
+  /// Stop generating rows before the last batch was returned.
+  ExtensionStatus closeRows(
+    1:i64 cursor),
 }
 
 /// The extension manager is run by the osquery core process.
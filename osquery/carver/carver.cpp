@@ -14,6 +14,10 @@
 #include <Windows.h>
 #endif
 
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
 #include <boost/algorithm/string.hpp>
 #include <boost/property_tree/ptree.hpp>
 
@@ -26,6 +30,7 @@
 #include "osquery/carver/carver.h"
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/core/process.h"
 #include "osquery/filesystem/fileops.h"
 #include "osquery/remote/serializers/json.h"
 #include "osquery/remote/utility.h"
@@ -72,7 +77,58 @@ CLI_FLAG(bool,
          false,
          "Compress archives using zstd prior to upload (default false)");
 
-DECLARE_uint64(read_max);
+CLI_FLAG(uint32,
+         carver_concurrency,
+         1,
+         "Number of carve blocks uploaded at once (default 1)");
+
+CLI_FLAG(uint32,
+         carver_max_attempts,
+         3,
+         "Number of times to attempt uploading each carve block (default 3)");
+
+CLI_FLAG(bool,
+         carver_raw_blocks,
+         false,
+         "POST carve blocks as binary bodies instead of base64 JSON");
+
+CLI_FLAG(bool,
+         carver_block_hashes,
+         false,
+         "Send carve block SHA256s, the server may skip blocks it has");
+
+CarveBlockHashes::CarveBlockHashes(size_t block_size)
+    : block_size_(std::max(block_size, size_t{1})) {}
+
+CarveBlockHashes::~CarveBlockHashes() {}
+
+void CarveBlockHashes::update(const char* data, size_t size) {
+  while (size > 0) {
+    if (hash_ == nullptr) {
+      hash_.reset(new Hash(HASH_TYPE_SHA256));
+    }
+
+    auto length = std::min(size, block_size_ - filled_);
+    hash_->update(data, length);
+    filled_ += length;
+    data += length;
+    size -= length;
+    if (filled_ == block_size_) {
+      hashes_.push_back(hash_->digest());
+      hash_.reset();
+      filled_ = 0;
+    }
+  }
+}
+
+std::vector<std::string> CarveBlockHashes::finish() {
+  if (hash_ != nullptr) {
+    hashes_.push_back(hash_->digest());
+    hash_.reset();
+    filled_ = 0;
+  }
+  return std::move(hashes_);
+}
 
 /// Helper function to update values related to a carve
 void updateCarveValue(const std::string& guid,
@@ -104,6 +160,26 @@ void updateCarveValue(const std::string& guid,
   }
 }
 
+/// Helper function to read a value related to a carve, empty if missing
+static std::string getCarveValue(const std::string& guid,
+                                 const std::string& key) {
+  std::string carve;
+  auto s = getDatabaseValue(kCarveDbDomain, kCarverDBPrefix + guid, carve);
+  if (!s.ok()) {
+    return "";
+  }
+
+  pt::ptree tree;
+  try {
+    std::stringstream ss(carve);
+    pt::read_json(ss, tree);
+  } catch (const pt::ptree_error& e) {
+    VLOG(1) << "Failed to parse carve entries: " << e.what();
+    return "";
+  }
+  return tree.get<std::string>(key, "");
+}
+
 Carver::Carver(const std::set<std::string>& paths,
                const std::string& guid,
                const std::string& requestId)
@@ -126,6 +202,16 @@ Carver::Carver(const std::set<std::string>& paths,
   // TODO: Adding in a manifest file of all carved files might be nice.
   carveDir_ =
       fs::temp_directory_path() / fs::path(kCarvePathPrefix + carveGuid_);
+
+  // An upload interrupted by a restart continues from the kept archive.
+  resume_ = (getCarveValue(carveGuid_, "status") == "UPLOADING");
+  if (resume_) {
+    if (!fs::exists(carveDir_)) {
+      status_ = Status(1, "Missing carve file store");
+    }
+    return;
+  }
+
   auto ret = fs::create_directory(carveDir_);
   if (!ret) {
     status_ = Status(1, "Failed to create carve file store");
@@ -142,7 +228,9 @@ Carver::Carver(const std::set<std::string>& paths,
 };
 
 Carver::~Carver() {
-  fs::remove_all(carveDir_);
+  if (!resumable_) {
+    fs::remove_all(carveDir_);
+  }
 }
 
 void Carver::start() {
@@ -151,6 +239,20 @@ void Carver::start() {
     LOG(WARNING) << "Carver has not been properly constructed";
     return;
   }
+
+  // Reading and compressing files yields to the event publishers.
+  BackgroundPriorityGuard priority;
+
+  if (resume_) {
+    auto s = postCarve(getCarveValue(carveGuid_, "upload_path"));
+    if (!s.ok() && !resumable_) {
+      VLOG(1) << "Failed to resume carve: " << s.getMessage();
+      updateCarveValue(carveGuid_, "status", "DATA POST FAILED");
+    }
+    return;
+  }
+
+  std::set<fs::path> carvedFiles;
   for (const auto& p : carvePaths_) {
     // Ensure the file is a flat file on disk before carving
     PlatformFile pFile(p, PF_OPEN_EXISTING | PF_READ);
@@ -158,148 +260,266 @@ void Carver::start() {
       VLOG(1) << "File does not exist on disk or is subdirectory: " << p;
       continue;
     }
-    Status s = carve(p);
-    if (!s.ok()) {
-      VLOG(1) << "Failed to carve file " << p << " " << s.getMessage();
-    }
+    carvedFiles.insert(p);
   }
 
-  std::set<fs::path> carvedFiles;
-  for (const auto& p : platformGlob((carveDir_ / "*").string())) {
-    carvedFiles.insert(fs::path(p));
-  }
+  // Carve, archive, compress, and hash the files in one pass.
+  auto uploadPath = (FLAGS_carver_compression) ? compressPath_ : archivePath_;
+  Hash hash(HASH_TYPE_SHA256);
+  CarveBlockHashes blockHashes(FLAGS_carver_block_size);
+  size_t uploadSize = 0;
+  Status s;
+  {
+    PlatformFile uploadFile(uploadPath, PF_CREATE_NEW | PF_WRITE);
+    if (!uploadFile.isValid()) {
+      updateCarveValue(carveGuid_, "status", "ARCHIVE FAILED");
+      return;
+    }
 
-  auto s = archive(carvedFiles, archivePath_);
+    s = archive(carvedFiles,
+                FLAGS_carver_compression,
+                [&](const char* data, size_t size) {
+                  hash.update(data, size);
+                  if (FLAGS_carver_block_hashes) {
+                    blockHashes.update(data, size);
+                  }
+                  uploadSize += size;
+                  return uploadFile.write(data, size) ==
+                         static_cast<ssize_t>(size);
+                });
+  }
   if (!s.ok()) {
     VLOG(1) << "Failed to create carve archive: " << s.getMessage();
     updateCarveValue(carveGuid_, "status", "ARCHIVE FAILED");
     return;
   }
 
-  fs::path uploadPath;
-  if (FLAGS_carver_compression) {
-    uploadPath = compressPath_;
-    s = compress(archivePath_, compressPath_);
-    if (!s.ok()) {
-      VLOG(1) << "Failed to compress carve archive: " << s.getMessage();
-      updateCarveValue(carveGuid_, "status", "COMPRESS FAILED");
-      return;
-    }
-  } else {
-    uploadPath = archivePath_;
-  }
-
-  PlatformFile uploadFile(uploadPath, PF_OPEN_EXISTING | PF_READ);
-  updateCarveValue(carveGuid_, "size", std::to_string(uploadFile.size()));
-
-  std::string uploadHash =
-      (uploadFile.size() > FLAGS_read_max)
-          ? "-1"
-          : hashFromFile(HashType::HASH_TYPE_SHA256, uploadPath.string());
-  if (uploadHash == "-1") {
-    VLOG(1)
-        << "Archive file size exceeds read max, skipping integrity computation";
-  }
-  updateCarveValue(carveGuid_, "sha256", uploadHash);
+  updateCarveValue(carveGuid_, "size", std::to_string(uploadSize));
+  updateCarveValue(carveGuid_, "sha256", hash.digest());
+  blockHashes_ = blockHashes.finish();
 
   s = postCarve(uploadPath);
-  if (!s.ok()) {
+  if (!s.ok() && !resumable_) {
     VLOG(1) << "Failed to post carve: " << s.getMessage();
     updateCarveValue(carveGuid_, "status", "DATA POST FAILED");
     return;
   }
 };
 
-Status Carver::carve(const boost::filesystem::path& path) {
-  PlatformFile src(path, PF_OPEN_EXISTING | PF_READ);
-  PlatformFile dst(carveDir_ / path.leaf(), PF_CREATE_NEW | PF_WRITE);
-
-  if (!dst.isValid()) {
-    return Status(1, "Destination tmp FS is not valid.");
+Status Carver::postCarve(const boost::filesystem::path& path) {
+  PlatformFile pFile(path, PF_OPEN_EXISTING | PF_READ);
+  if (!pFile.isValid()) {
+    return Status(1, "Cannot open carve archive: " + path.string());
   }
 
-  auto blkCount = ceil(static_cast<double>(src.size()) /
-                       static_cast<double>(FLAGS_carver_block_size));
-
-  std::vector<char> inBuff(FLAGS_carver_block_size, 0);
-  for (size_t i = 0; i < blkCount; i++) {
-    inBuff.clear();
-    auto bytesRead = src.read(inBuff.data(), FLAGS_carver_block_size);
-    if (bytesRead > 0) {
-      auto bytesWritten = dst.write(inBuff.data(), bytesRead);
-      if (bytesWritten < 0) {
-        return Status(1, "Error writing bytes to tmp fs");
+  auto blkCount =
+      static_cast<size_t>(ceil(static_cast<double>(pFile.size()) /
+                               static_cast<double>(FLAGS_carver_block_size)));
+
+  // A resumed carve continues its session after the acknowledged blocks.
+  size_t acked = 0;
+  std::set<size_t> known;
+  auto session_id = getCarveValue(carveGuid_, "session_id");
+  if (!session_id.empty()) {
+    unsigned long long value = 0;
+    auto blocks = getCarveValue(carveGuid_, "blocks_acked");
+    if (safeStrtoull(blocks, 10, value).ok()) {
+      acked = static_cast<size_t>(value);
+    }
+
+    for (const auto& block :
+         split(getCarveValue(carveGuid_, "blocks_known"), ",")) {
+      if (safeStrtoull(block, 10, value).ok()) {
+        known.insert(static_cast<size_t>(value));
       }
     }
-  }
+  } else {
+    // Perform the start request to get the session id
+    auto startRequest = Request<TLSTransport, JSONSerializer>(startUri_);
+    pt::ptree startParams;
+
+    startParams.put<size_t>("block_count", blkCount);
+    startParams.put<size_t>("block_size", FLAGS_carver_block_size);
+    startParams.put<size_t>("carve_size", pFile.size());
+    startParams.put<std::string>("carve_id", carveGuid_);
+    startParams.put<std::string>("request_id", requestId_);
+    startParams.put<std::string>("node_key", getNodeKey("tls"));
+    if (blockHashes_.size() == blkCount) {
+      pt::ptree hashes;
+      for (const auto& blockHash : blockHashes_) {
+        pt::ptree child;
+        child.put("", blockHash);
+        hashes.push_back(std::make_pair("", child));
+      }
+      startParams.add_child("block_sha256", hashes);
+    }
 
-  return Status(0, "Ok");
-};
+    auto status = startRequest.call(startParams);
+    if (!status.ok()) {
+      return status;
+    }
 
-Status Carver::postCarve(const boost::filesystem::path& path) {
-  auto startRequest = Request<TLSTransport, JSONSerializer>(startUri_);
+    // The call succeeded, store the session id for future posts
+    boost::property_tree::ptree startRecv;
+    status = startRequest.getResponse(startRecv);
+    if (!status.ok()) {
+      return status;
+    }
 
-  // Perform the start request to get the session id
-  PlatformFile pFile(path, PF_OPEN_EXISTING | PF_READ);
-  auto blkCount =
-      static_cast<size_t>(ceil(static_cast<double>(pFile.size()) /
-                               static_cast<double>(FLAGS_carver_block_size)));
-  pt::ptree startParams;
-
-  startParams.put<size_t>("block_count", blkCount);
-  startParams.put<size_t>("block_size", FLAGS_carver_block_size);
-  startParams.put<size_t>("carve_size", pFile.size());
-  startParams.put<std::string>("carve_id", carveGuid_);
-  startParams.put<std::string>("request_id", requestId_);
-  startParams.put<std::string>("node_key", getNodeKey("tls"));
-
-  auto status = startRequest.call(startParams);
-  if (!status.ok()) {
-    return status;
-  }
+    session_id = startRecv.get("session_id", "");
+    if (session_id.empty()) {
+      return Status(1, "No session_id received from remote endpoint");
+    }
+
+    // The server may already have the content of some blocks.
+    std::string knownBlocks;
+    auto knownRecv = startRecv.get_child_optional("known_blocks");
+    if (knownRecv && blockHashes_.size() == blkCount) {
+      for (const auto& block : *knownRecv) {
+        auto id = block.second.get_value<size_t>(blkCount);
+        if (id < blkCount && known.insert(id).second) {
+          knownBlocks += (knownBlocks.empty() ? "" : ",") + std::to_string(id);
+        }
+      }
+      VLOG(1) << "Carve " << carveGuid_ << " skips " << known.size() << " of "
+              << blkCount << " blocks known by the server";
+    }
 
-  // The call succeeded, store the session id for future posts
-  boost::property_tree::ptree startRecv;
-  status = startRequest.getResponse(startRecv);
-  if (!status.ok()) {
-    return status;
+    updateCarveValue(carveGuid_, "session_id", session_id);
+    updateCarveValue(carveGuid_, "blocks_known", knownBlocks);
+    updateCarveValue(carveGuid_, "request_id", requestId_);
+    updateCarveValue(carveGuid_, "upload_path", path.string());
+    updateCarveValue(carveGuid_, "blocks_acked", "0");
   }
+  updateCarveValue(carveGuid_, "status", "UPLOADING");
 
-  auto session_id = startRecv.get("session_id", "");
-  if (session_id.empty()) {
-    return Status(1, "No session_id received from remote endpoint");
+  // Blocks known by the server are complete without being uploaded.
+  std::set<size_t> completed(known.lower_bound(acked), known.end());
+  while (!completed.empty() && *completed.begin() == acked) {
+    completed.erase(completed.begin());
+    acked++;
   }
 
-  auto contRequest = Request<TLSTransport, JSONSerializer>(contUri_);
-  for (size_t i = 0; i < blkCount; i++) {
-    std::vector<char> block(FLAGS_carver_block_size, 0);
-    auto r = pFile.read(block.data(), FLAGS_carver_block_size);
+  std::mutex mutex;
+  size_t next = acked;
+  Status failure(0, "OK");
+
+  // Each worker reads blocks into its own buffer, reused for every block.
+  auto upload = [&]() {
+    PlatformFile file(path, PF_OPEN_EXISTING | PF_READ);
+    std::string block;
+    while (true) {
+      size_t id = 0;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (known.count(next) > 0) {
+          next++;
+        }
+        if (!failure.ok() || next >= blkCount || interrupted()) {
+          break;
+        }
+        id = next++;
+      }
+
+      block.resize(FLAGS_carver_block_size);
+      file.seek(static_cast<off_t>(id * FLAGS_carver_block_size),
+                PF_SEEK_BEGIN);
+      auto r = file.read(&block[0], FLAGS_carver_block_size);
+      block.resize((r > 0) ? static_cast<size_t>(r) : 0);
+
+      auto status = postBlock(session_id, id, block);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!status.ok()) {
+        if (failure.ok()) {
+          failure = status;
+        }
+        break;
+      }
 
-    if (r != FLAGS_carver_block_size && r > 0) {
-      // resize the buffer to size we read as last block is likely smaller
-      block.resize(r);
+      // Record the blocks acknowledged in order, a resume starts after them.
+      completed.insert(id);
+      if (id == acked) {
+        while (!completed.empty() && *completed.begin() == acked) {
+          completed.erase(completed.begin());
+          acked++;
+        }
+        updateCarveValue(carveGuid_, "blocks_acked", std::to_string(acked));
+      }
     }
+  };
+
+  auto size = std::min(
+      std::max(static_cast<size_t>(FLAGS_carver_concurrency), size_t{1}),
+      std::max(blkCount - std::min(acked, blkCount), size_t{1}));
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < size; ++i) {
+    workers.emplace_back(upload);
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
 
-    pt::ptree params;
-    params.put<size_t>("block_id", i);
-    params.put<std::string>("session_id", session_id);
-    params.put<std::string>("request_id", requestId_);
-    params.put<std::string>(
-        "data", base64Encode(std::string(block.begin(), block.end())));
+  if (!failure.ok()) {
+    return failure;
+  }
 
-    // TODO: Error sending files.
-    status = contRequest.call(params);
-    if (!status.ok()) {
-      VLOG(1) << "Post of carved block " << i
-              << " failed: " << status.getMessage();
-      continue;
-    }
+  if (acked < blkCount) {
+    // Keep the archive so the upload resumes when osquery restarts.
+    resumable_ = true;
+    return Status(1, "Carve upload interrupted");
   }
 
   updateCarveValue(carveGuid_, "status", "SUCCESS");
   return Status(0, "Ok");
 };
 
+Status Carver::postBlock(const std::string& session_id,
+                         size_t block_id,
+                         const std::string& block) {
+  // Binary blocks identify themselves with URI parameters.
+  auto uri = contUri_;
+  pt::ptree params;
+  if (FLAGS_carver_raw_blocks) {
+    uri += ((uri.find('?') != std::string::npos) ? "&" : "?");
+    uri += "block_id=" + std::to_string(block_id);
+    uri += "&session_id=" + session_id + "&request_id=" + requestId_;
+  } else {
+    params.put<size_t>("block_id", block_id);
+    params.put<std::string>("session_id", session_id);
+    params.put<std::string>("request_id", requestId_);
+    params.put<std::string>("data", base64Encode(block));
+  }
+
+  Status status;
+  auto attempts = std::max(static_cast<size_t>(FLAGS_carver_max_attempts),
+                           size_t{1});
+  size_t delay = 0;
+  for (size_t i = 1; i <= attempts; i++) {
+    auto contRequest = Request<TLSTransport, JSONSerializer>(uri);
+    if (FLAGS_carver_raw_blocks) {
+      contRequest.setOption("content_type", "application/octet-stream");
+      status = contRequest.call(block);
+    } else {
+      status = contRequest.call(params);
+    }
+
+    if (status.ok()) {
+      break;
+    }
+
+    VLOG(1) << "Post of carved block " << block_id
+            << " failed: " << status.getMessage();
+    if (i < attempts && !interrupted()) {
+      delay = getTLSBackoffDelay(delay);
+      if (delay == 0) {
+        break;
+      }
+      pauseMilli(delay);
+    }
+  }
+  return status;
+}
+
 Status carvePaths(const std::set<std::string>& paths) {
   auto guid = generateNewUUID();
 
@@ -327,4 +547,43 @@ Status carvePaths(const std::set<std::string>& paths) {
   }
   return s;
 }
+
+Status resumeCarves() {
+  if (FLAGS_disable_carver) {
+    return Status(1, "Carver disabled");
+  }
+
+  std::vector<std::pair<std::string, std::string>> carves;
+  scanDatabasePrefix(
+      kCarveDbDomain,
+      kCarverDBPrefix,
+      [&carves](const std::string&, const std::string& carve) {
+        pt::ptree tree;
+        try {
+          std::stringstream ss(carve);
+          pt::read_json(ss, tree);
+        } catch (const pt::ptree_error& e) {
+          VLOG(1) << "Failed to parse carve entries: " << e.what();
+          return true;
+        }
+
+        if (tree.get<std::string>("status", "") == "UPLOADING") {
+          carves.push_back({tree.get<std::string>("carve_guid", ""),
+                            tree.get<std::string>("request_id", "")});
+        }
+        return true;
+      });
+
+  for (const auto& carve : carves) {
+    if (!fs::exists(getCarveValue(carve.first, "upload_path"))) {
+      updateCarveValue(carve.first, "status", "DATA POST FAILED");
+      continue;
+    }
+
+    VLOG(1) << "Resuming upload of carve " << carve.first;
+    Dispatcher::addService(std::make_shared<Carver>(
+        std::set<std::string>(), carve.first, carve.second));
+  }
+  return Status(0, "OK");
+}
 } // namespace osquery
@@ -10,8 +10,10 @@
 
 #pragma once
 
+#include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
@@ -30,6 +32,38 @@ const std::string kCarveNamePrefix = "carve_";
 /// Database prefix used to directly access and manipulate our carver entries
 const std::string kCarverDBPrefix = "carves.";
 
+class Hash;
+
+/**
+ * @brief The SHA256 of each block of a carve, hashed as its archive is written.
+ *
+ * The hashes are sent with the carve's start request, such that the server
+ * may skip blocks whose content it already has.
+ */
+class CarveBlockHashes {
+ public:
+  explicit CarveBlockHashes(size_t block_size);
+
+  ~CarveBlockHashes();
+
+  /// Hash the next bytes of the archive.
+  void update(const char* data, size_t size);
+
+  /// The hashes of every block, the last block may be partial.
+  std::vector<std::string> finish();
+
+ private:
+  size_t block_size_;
+
+  /// The bytes hashed of the current block.
+  size_t filled_{0};
+
+  /// The current block's hash, created by its first bytes.
+  std::unique_ptr<Hash> hash_;
+
+  std::vector<std::string> hashes_;
+};
+
 class Carver : public InternalRunnable {
  public:
   Carver(const std::set<std::string>& paths,
@@ -44,27 +78,31 @@ class Carver : public InternalRunnable {
    * This function walks through the carve, compress, and exfil functions
    * in one fell swoop. Use of this class should largely happen through
    * this function.
+   *
+   * The files are read, archived, compressed, and hashed in a single pass
+   * into the upload file, without intermediate copies.
    */
   void start();
 
  private:
-  /*
-   * @brief A helper function to 'carve' files from disk
-   *
-   * This function performs a "forensic carve" of a specified path to the
-   * users tmp directory
-   */
-  Status carve(const boost::filesystem::path& path);
-
   /*
    * @brief Helper function to POST a carve to the graph endpoint.
    *
    * Once all of the files have been carved and the tgz has been
    * created, we POST the carved file to an endpoint specified by the
    * carver_start_endpoint and carver_continue_endpoint
+   *
+   * Up to carver_concurrency blocks are uploaded at once. The blocks
+   * acknowledged in order are recorded in the carve's database entry, and a
+   * resumed carve continues its session after them.
    */
   Status postCarve(const boost::filesystem::path& path);
 
+  /// POST a single block of a carve, retried up to carver_max_attempts.
+  Status postBlock(const std::string& session_id,
+                   size_t block_id,
+                   const std::string& block);
+
   // Getter for the carver status
   Status getStatus() {
     return status_;
@@ -78,9 +116,8 @@ class Carver : public InternalRunnable {
   /*
    * @brief a variable to keep track of the temp fs used in carving
    *
-   * This variable represents the location in which we store all of our carved
-   * files. When a carve has completed all of the desired files, as well
-   * as the tar archive should reside in this directory
+   * This variable represents the location in which we store the archive of
+   * carved files, it is kept while an interrupted upload may resume.
    */
   boost::filesystem::path carveDir_;
 
@@ -96,15 +133,15 @@ class Carver : public InternalRunnable {
    * @brief a helper variable for keeping track of the posix tar archive.
    *
    * This variable is the absolute location of the tar archive created from
-   * tar'ing all of the carved files from the carve temp dir.
+   * tar'ing all of the carved files.
    */
   boost::filesystem::path archivePath_;
 
   /*
    * @brief a helper variable for keeping track of the compressed tar.
    *
-   * This variable is the absolute location of the tar archive created from
-   * zstd of the archive.
+   * This variable is the absolute location of the tar archive compressed
+   * with zstd as it is created.
    */
   boost::filesystem::path compressPath_;
 
@@ -136,18 +173,40 @@ class Carver : public InternalRunnable {
   /// The uri used to receive the data blocks of a carve
   std::string contUri_;
 
+  /// The SHA256 of each block, if they are sent with the start request.
+  std::vector<std::string> blockHashes_;
+
   // Running status of the carver
   Status status_;
 
+  /// True if the carve resumes an upload interrupted by a restart.
+  bool resume_{false};
+
+  /// True if the upload was interrupted and the archive is kept to resume.
+  bool resumable_{false};
+
  private:
   friend class CarverTests;
   FRIEND_TEST(CarverTests, test_carve_files_locally);
+  FRIEND_TEST(CarverTests, test_carve_resume);
 };
 
+/// Helper function to update values related to a carve
+void updateCarveValue(const std::string& guid,
+                      const std::string& key,
+                      const std::string& value);
+
 /**
  * @brief Start a file carve of the given paths
  *
  * @return A status returning if the carves were started successfully
  */
 Status carvePaths(const std::set<std::string>& paths);
+
+/**
+ * @brief Resume the uploads of carves interrupted by a restart
+ *
+ * @return A status returning if the carver is enabled
+ */
+Status resumeCarves();
 } // namespace osquery
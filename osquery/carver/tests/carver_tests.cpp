@@ -16,6 +16,7 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/database.h>
 #include <osquery/sql.h>
 
 #include "osquery/carver/carver.h"
@@ -74,28 +75,94 @@ TEST_F(CarverTests, test_carve_files_locally) {
   std::string requestId = "";
   Carver carve(getCarvePaths(), guid_, requestId);
 
-  Status s;
-  for (const auto& p : paths_) {
-    s = carve.carve(fs::path(p));
-    EXPECT_TRUE(s.ok());
-  }
-
-  std::string carveFSPath = carve.getCarveDir().string();
-  auto paths = platformGlob(carveFSPath + "/*");
   std::set<fs::path> carves;
-  for (const auto& p : paths) {
+  for (const auto& p : paths_) {
     carves.insert(fs::path(p));
   }
-
   EXPECT_EQ(carves.size(), 2U);
-  s = archive(carves,
-              carveFSPath + "/" + kTestCarveNamePrefix + guid_ + ".tar");
-  EXPECT_TRUE(s.ok());
 
+  std::string carveFSPath = carve.getCarveDir().string();
   auto tarPath = carveFSPath + "/" + kTestCarveNamePrefix + guid_ + ".tar";
+  auto s = archive(carves, tarPath);
+  EXPECT_TRUE(s.ok());
+
   PlatformFile tar(tarPath, PF_OPEN_EXISTING | PF_READ);
   EXPECT_TRUE(tar.isValid());
   EXPECT_GT(tar.size(), 0U);
+
+  // Streaming the same files produces the same archive, without a file.
+  std::string streamed;
+  s = archive(carves, false, [&streamed](const char* data, size_t size) {
+    streamed.append(data, size);
+    return true;
+  });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(streamed.size(), tar.size());
+
+  // A compressed stream starts with the zstd frame magic.
+  std::string compressed;
+  s = archive(carves, true, [&compressed](const char* data, size_t size) {
+    compressed.append(data, size);
+    return true;
+  });
+  EXPECT_TRUE(s.ok());
+  ASSERT_GT(compressed.size(), 4U);
+  EXPECT_EQ(compressed.substr(0, 4), std::string("\x28\xB5\x2F\xFD"));
+  EXPECT_LT(compressed.size(), streamed.size());
+}
+
+TEST_F(CarverTests, test_block_hashes) {
+  std::set<fs::path> carves;
+  for (const auto& p : getCarvePaths()) {
+    carves.insert(fs::path(p));
+  }
+
+  // Blocks are hashed as the archive is streamed, in writes of any size.
+  std::string streamed;
+  CarveBlockHashes blockHashes(100);
+  auto s = archive(carves, false, [&](const char* data, size_t size) {
+    streamed.append(data, size);
+    blockHashes.update(data, size);
+    return true;
+  });
+  ASSERT_TRUE(s.ok());
+
+  auto hashes = blockHashes.finish();
+  ASSERT_EQ(hashes.size(), (streamed.size() + 99) / 100);
+  for (size_t i = 0; i < hashes.size(); i++) {
+    auto block = streamed.substr(i * 100, 100);
+    EXPECT_EQ(hashes[i],
+              hashFromBuffer(HASH_TYPE_SHA256, block.data(), block.size()));
+  }
+}
+
+TEST_F(CarverTests, test_carve_resume) {
+  // A carve recorded as uploading resumes from its kept archive.
+  auto guid = genGuid();
+  pt::ptree tree;
+  tree.put("carve_guid", guid);
+  tree.put("status", "UPLOADING");
+  tree.put("session_id", "session");
+  tree.put("blocks_acked", 2);
+
+  std::ostringstream os;
+  pt::write_json(os, tree, false);
+  auto s = setDatabaseValue(kCarveDbDomain, kCarverDBPrefix + guid, os.str());
+  ASSERT_TRUE(s.ok());
+
+  {
+    Carver carve({}, guid, "");
+    EXPECT_TRUE(carve.resume_);
+
+    // The archive was not kept, so the carve cannot resume.
+    EXPECT_FALSE(carve.getStatus().ok());
+  }
+  deleteDatabaseValue(kCarveDbDomain, kCarverDBPrefix + guid);
+
+  // A new carve does not resume.
+  Carver carve(getCarvePaths(), genGuid(), "");
+  EXPECT_FALSE(carve.resume_);
+  EXPECT_TRUE(carve.getStatus().ok());
 }
 
 TEST_F(CarverTests, test_compression) {
@@ -0,0 +1,94 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <sstream>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/config.h>
+#include <osquery/filesystem.h>
+
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+static std::string getExampleConfig(size_t packs,
+                                    size_t queries,
+                                    size_t interval) {
+  pt::ptree tree;
+  tree.put("options.host_identifier", "hostname");
+
+  for (size_t i = 0; i < packs; i++) {
+    auto prefix = "packs.pack_" + std::to_string(i);
+    tree.put(prefix + ".version", "1.5.0");
+    for (size_t j = 0; j < queries; j++) {
+      auto query = prefix + ".queries.query_" + std::to_string(j);
+      tree.put(query + ".query", "SELECT * FROM processes;");
+      tree.put(query + ".interval", interval);
+      tree.put(query + ".description", "Example query content");
+    }
+  }
+
+  std::stringstream ss;
+  pt::write_json(ss, tree, false);
+  return ss.str();
+}
+
+static void CONFIG_read_json(benchmark::State& state) {
+  auto json = getExampleConfig(state.range_x(), state.range_y(), 60);
+  while (state.KeepRunning()) {
+    pt::ptree tree;
+    std::stringstream input;
+    input << json;
+    pt::read_json(input, tree);
+  }
+}
+
+BENCHMARK(CONFIG_read_json)
+    ->ArgPair(1, 10)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100)
+    ->ArgPair(100, 100);
+
+static void CONFIG_parse_json_content(benchmark::State& state) {
+  auto json = getExampleConfig(state.range_x(), state.range_y(), 60);
+  while (state.KeepRunning()) {
+    pt::ptree tree;
+    parseJSONContent(json, tree);
+  }
+}
+
+BENCHMARK(CONFIG_parse_json_content)
+    ->ArgPair(1, 10)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100)
+    ->ArgPair(100, 100);
+
+static void CONFIG_update(benchmark::State& state) {
+  // Alternate content so each update is parsed and applied.
+  std::vector<std::string> configs = {
+      getExampleConfig(state.range_x(), state.range_y(), 60),
+      getExampleConfig(state.range_x(), state.range_y(), 120),
+  };
+
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    Config::get().update({{"benchmark", configs[i++ % configs.size()]}});
+  }
+  Config::get().update({{"benchmark", "{}"}});
+}
+
+BENCHMARK(CONFIG_update)
+    ->ArgPair(1, 10)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+}
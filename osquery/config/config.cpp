@@ -8,6 +8,7 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
 #include <map>
 #include <string>
 #include <vector>
@@ -19,14 +20,17 @@
 #include <osquery/config.h>
 #include <osquery/database.h>
 #include <osquery/events.h>
+#include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/packs.h>
+#include <osquery/query.h>
 #include <osquery/registry.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/core/memory.h"
 
 namespace pt = boost::property_tree;
 
@@ -101,6 +105,9 @@ RecursiveMutex config_schedule_mutex_;
 RecursiveMutex config_files_mutex_;
 RecursiveMutex config_performance_mutex_;
 
+/// The set of executing queries, more than one when scheduling in parallel.
+std::vector<std::string> kExecutingQueries;
+
 using PackRef = std::shared_ptr<Pack>;
 
 /**
@@ -290,10 +297,13 @@ Schedule::Schedule() {
   // Check if any queries were executing when the tool last stopped.
   getDatabaseValue(kPersistentSettings, kExecutingQuery, failed_query_);
   if (!failed_query_.empty()) {
-    LOG(WARNING) << "Scheduled query may have failed: " << failed_query_;
     setDatabaseValue(kPersistentSettings, kExecutingQuery, "");
-    // Add this query name to the blacklist and save the blacklist.
-    blacklist_[failed_query_] = getUnixTime() + 86400;
+    // A parallel schedule may record several newline-separated queries.
+    for (const auto& name : osquery::split(failed_query_, "\n")) {
+      LOG(WARNING) << "Scheduled query may have failed: " << name;
+      // Add this query name to the blacklist and save the blacklist.
+      blacklist_[name] = getUnixTime() + 86400;
+    }
     saveScheduleBlacklist(blacklist_);
   }
 }
@@ -309,6 +319,7 @@ void Config::addPack(const std::string& name,
   auto addSinglePack = ([this, &source](const std::string pack_name,
                                         const pt::ptree& pack_tree) {
     RecursiveLock wlock(config_schedule_mutex_);
+    schedule_generation_++;
     try {
       schedule_->add(std::make_shared<Pack>(pack_name, source, pack_tree));
       if (schedule_->last()->shouldPackExecute()) {
@@ -342,6 +353,7 @@ void Config::setStartTime(size_t st) {
 
 void Config::removePack(const std::string& pack) {
   RecursiveLock wlock(config_schedule_mutex_);
+  schedule_generation_++;
   return schedule_->remove(pack);
 }
 
@@ -388,6 +400,15 @@ void Config::scheduledQueries(
         predicate,
     bool blacklisted) {
   RecursiveLock lock(config_schedule_mutex_);
+
+  // Evaluate the discovery queries due in every pack together.
+  std::vector<std::string> discovery;
+  for (const auto& pack : schedule_->packs_) {
+    const auto& queries = pack->getDiscoveryQueries();
+    discovery.insert(discovery.end(), queries.begin(), queries.end());
+  }
+  Pack::discover(discovery);
+
   for (PackRef& pack : *schedule_) {
     for (auto& it : pack->getSchedule()) {
       std::string name = it.first;
@@ -519,6 +540,31 @@ void stripConfigComments(std::string& json) {
   json = sink;
 }
 
+/// Check if content includes keys handled by any config parser.
+static bool hasParserKeys(const pt::ptree& tree) {
+  for (const auto& plugin : RegistryFactory::get().plugins("config_parser")) {
+    auto parser = std::dynamic_pointer_cast<ConfigParserPlugin>(plugin.second);
+    if (parser == nullptr) {
+      continue;
+    }
+
+    for (const auto& key : parser->keys()) {
+      if (tree.count(key) > 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/// Hash content as it is serialized, the order of keys is kept.
+static std::string hashTree(const pt::ptree& tree) {
+  std::stringstream ss;
+  pt::write_json(ss, tree, false);
+  auto content = ss.str();
+  return getBufferSHA1(content.c_str(), content.size());
+}
+
 Status Config::updateSource(const std::string& source,
                             const std::string& json) {
   // Compute a 'synthesized' hash using the content before it is parsed.
@@ -528,24 +574,28 @@ Status Config::updateSource(const std::string& source,
     return Status(2);
   }
 
-  {
+  // load the config (source.second) into a pt::ptree
+  pt::ptree tree;
+  auto clone = json;
+  stripConfigComments(clone);
+  if (!parseJSONContent(std::move(clone), tree)) {
     RecursiveLock lock(config_schedule_mutex_);
-    // Remove all packs from this source.
+    // Remove all packs and files from this source.
+    schedule_generation_++;
     schedule_->removeAll(source);
-    // Remove all files from this source.
     removeFiles(source);
+    pack_hash_.erase(source);
+    settings_hash_.erase(source);
+    return Status(1, "Error parsing the config JSON");
   }
 
-  // load the config (source.second) into a pt::ptree
-  pt::ptree tree;
-  try {
-    auto clone = json;
-    stripConfigComments(clone);
-    std::stringstream json_stream;
-    json_stream << clone;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
-    return Status(1, "Error parsing the config JSON");
+  {
+    // Packs not included in this update are removed after it.
+    RecursiveLock lock(config_schedule_mutex_);
+    for (auto& pack : pack_hash_[source]) {
+      pack.second.seen = false;
+    }
+    pack_parsed_ = false;
   }
 
   // extract the "schedule" key and store it as the main pack
@@ -554,7 +604,7 @@ Status Config::updateSource(const std::string& source,
     auto& schedule = tree.get_child("schedule");
     pt::ptree main_pack;
     main_pack.add_child("queries", schedule);
-    addPack("main", source, main_pack);
+    updatePack("main", source, main_pack);
   }
 
   if (tree.count("scheduledQueries") > 0 && !rf.external()) {
@@ -569,7 +619,7 @@ Status Config::updateSource(const std::string& source,
     }
     pt::ptree legacy_pack;
     legacy_pack.add_child("queries", queries);
-    addPack("legacy_main", source, legacy_pack);
+    updatePack("legacy_main", source, legacy_pack);
   }
 
   // extract the "packs" key into additional pack objects
@@ -579,15 +629,77 @@ Status Config::updateSource(const std::string& source,
       auto value = packs.get<std::string>(pack.first, "");
       if (value.empty()) {
         // The pack is a JSON object, treat the content as pack data.
-        addPack(pack.first, source, pack.second);
+        updatePack(pack.first, source, pack.second);
       } else {
         genPack(pack.first, source, value);
       }
     }
   }
 
-  applyParsers(source, tree, false);
-  return Status(0, "OK");
+  {
+    RecursiveLock lock(config_schedule_mutex_);
+    auto& packs = pack_hash_[source];
+    for (auto pack = packs.begin(); pack != packs.end();) {
+      if (pack->second.seen) {
+        ++pack;
+        continue;
+      }
+
+      schedule_generation_++;
+      schedule_->remove(pack->first, source);
+      pack_parsed_ = pack_parsed_ || pack->second.parsed;
+      pack = packs.erase(pack);
+    }
+  }
+
+  // The content besides packs is only parsed again if it changed.
+  pt::ptree settings;
+  for (const auto& item : tree) {
+    if (item.first != "schedule" && item.first != "scheduledQueries" &&
+        item.first != "packs") {
+      settings.push_back(item);
+    }
+  }
+  auto hash = hashTree(settings);
+  if (settings_hash_[source] != hash) {
+    settings_hash_[source] = hash;
+    removeFiles(source);
+    applyParsers(source, tree, false);
+    return Status(0, "OK");
+  }
+
+  // Only packs changed, the registry is reconfigured if parsers saw changes.
+  return (pack_parsed_) ? Status(0, "OK") : Status(2);
+}
+
+bool Config::updatePack(const std::string& name,
+                        const std::string& source,
+                        const pt::ptree& tree) {
+  if (name == "*") {
+    // This is a multi-pack, each named pack is compared on its own.
+    bool updated = false;
+    for (const auto& pack : tree) {
+      updated = updatePack(pack.first, source, pack.second) || updated;
+    }
+    return updated;
+  }
+
+  auto hash = hashTree(tree);
+  auto parsed = hasParserKeys(tree);
+
+  RecursiveLock lock(config_schedule_mutex_);
+  auto& pack = pack_hash_[source][name];
+  pack.seen = true;
+  if (pack.hash == hash) {
+    return false;
+  }
+
+  // Adding the pack replaces the pack of the same name from the source.
+  pack_parsed_ = pack_parsed_ || pack.parsed || parsed;
+  pack.hash = std::move(hash);
+  pack.parsed = parsed;
+  addPack(name, source, tree);
+  return true;
 }
 
 Status Config::genPack(const std::string& name,
@@ -604,28 +716,47 @@ Status Config::genPack(const std::string& name,
     return Status(1, "Invalid plugin response");
   }
 
-  try {
-    auto clone = response[0][name];
-    if (clone == "") {
-      LOG(WARNING) << "Error reading the query pack named: " << name;
-      return Status(0);
-    }
-    stripConfigComments(clone);
-    pt::ptree pack_tree;
-    std::stringstream pack_stream;
-    pack_stream << clone;
-    pt::read_json(pack_stream, pack_tree);
-    addPack(name, source, pack_tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
+  auto clone = response[0][name];
+  if (clone == "") {
+    LOG(WARNING) << "Error reading the query pack named: " << name;
+    return Status(0);
+  }
+  stripConfigComments(clone);
+  pt::ptree pack_tree;
+  auto status = parseJSONContent(std::move(clone), pack_tree);
+  if (!status.ok()) {
     LOG(WARNING) << "Error parsing the \"" << name
-                 << "\" pack JSON: " << e.what();
+                 << "\" pack JSON: " << status.getMessage();
+    return Status(0);
   }
+  updatePack(name, source, pack_tree);
   return Status(0);
 }
 
 void Config::applyParsers(const std::string& source,
                           const pt::ptree& tree,
                           bool pack) {
+  // Only the content requested by parsers is copied, then shared by them.
+  pt::ptree content;
+  for (const auto& plugin : RegistryFactory::get().plugins("config_parser")) {
+    auto parser = std::dynamic_pointer_cast<ConfigParserPlugin>(plugin.second);
+    if (parser == nullptr) {
+      continue;
+    }
+
+    for (const auto& key : parser->keys()) {
+      auto item = tree.find(key);
+      if (item != tree.not_found() && content.count(key) == 0) {
+        content.push_back(*item);
+      }
+    }
+  }
+  applyParsers(source, content, pack);
+}
+
+void Config::applyParsers(const std::string& source,
+                          pt::ptree& tree,
+                          bool pack) {
   // Iterate each parser.
   RecursiveLock lock(config_schedule_mutex_);
   for (const auto& plugin : RegistryFactory::get().plugins("config_parser")) {
@@ -639,23 +770,33 @@ void Config::applyParsers(const std::string& source,
       continue;
     }
 
-    // For each key requested by the parser, add a property tree reference.
+    // For each key requested by the parser, lend the parsed property tree.
     std::map<std::string, pt::ptree> parser_config;
     for (const auto& key : parser->keys()) {
-      if (tree.count(key) > 0) {
-        parser_config[key] = tree.get_child(key);
+      auto item = tree.find(key);
+      if (item != tree.not_found()) {
+        parser_config[key].swap(item->second);
       } else {
         parser_config[key] = pt::ptree();
       }
     }
-    // The config parser plugin will receive a copy of each property tree for
-    // each top-level-config key. The parser may choose to update the config's
-    // internal state
+    // The config parser plugin receives each top-level-config key without a
+    // copy. The parser may choose to update the config's internal state.
     parser->update(source, parser_config);
+
+    // Return the content to the tree, the next parser may request it too.
+    for (auto& config : parser_config) {
+      auto item = tree.find(config.first);
+      if (item != tree.not_found()) {
+        item->second.swap(config.second);
+      }
+    }
   }
 }
 
 Status Config::update(const std::map<std::string, std::string>& config) {
+  MEMORY_TAG(CONFIG);
+
   // A config plugin may call update from an extension. This will update
   // the config instance within the extension process and the update must be
   // reflected in the core.
@@ -730,9 +871,34 @@ void Config::purge() {
     return false;
   };
 
+  // The chunks, metadata, and delta of stored results are kept, and expired,
+  // with their query.
+  auto findQueryPart = [](const std::string& saved_query) {
+    for (const auto& part :
+         {kQueryChunkKey, kQueryMetadataKey, kQueryDeltaKey}) {
+      auto pos = saved_query.find(part);
+      if (pos != std::string::npos) {
+        return pos;
+      }
+    }
+    return std::string::npos;
+  };
+
+  std::map<std::string, std::vector<std::string>> saved_parts;
+  for (const auto& saved_query : saved_queries) {
+    auto pos = findQueryPart(saved_query);
+    if (pos != std::string::npos) {
+      saved_parts[saved_query.substr(0, pos)].push_back(saved_query);
+    }
+  }
+
   RecursiveLock lock(config_schedule_mutex_);
   // Iterate over each result set in the database.
   for (const auto& saved_query : saved_queries) {
+    if (findQueryPart(saved_query) != std::string::npos) {
+      continue;
+    }
+
     if (queryExists(saved_query)) {
       continue;
     }
@@ -762,6 +928,10 @@ void Config::purge() {
       // Query has not run in the last week, expire results and interval.
       deleteDatabaseValue(kQueries, saved_query);
       deleteDatabaseValue(kQueries, saved_query + "epoch");
+      Query::invalidateMetadata(saved_query);
+      for (const auto& part : saved_parts[saved_query]) {
+        deleteDatabaseValue(kQueries, part);
+      }
       deleteDatabaseValue(kPersistentSettings, "interval." + saved_query);
       deleteDatabaseValue(kPersistentSettings, "timestamp." + saved_query);
       VLOG(1) << "Expiring results for scheduled query: " << saved_query;
@@ -773,9 +943,13 @@ void Config::reset() {
   setStartTime(getUnixTime());
 
   schedule_ = std::make_shared<Schedule>();
+  schedule_generation_++;
+  schedule_load_ = 100;
   std::map<std::string, QueryPerformance>().swap(performance_);
   std::map<std::string, FileCategories>().swap(files_);
   std::map<std::string, std::string>().swap(hash_);
+  pack_hash_.clear();
+  settings_hash_.clear();
   valid_ = false;
   loaded_ = false;
 
@@ -806,9 +980,7 @@ void ConfigParserPlugin::reset() {
 
 void Config::recordQueryPerformance(const std::string& name,
                                     size_t delay,
-                                    size_t size,
-                                    const Row& r0,
-                                    const Row& r1) {
+                                    const QueryUsage& usage) {
   RecursiveLock lock(config_performance_mutex_);
   if (performance_.count(name) == 0) {
     performance_[name] = QueryPerformance();
@@ -816,45 +988,78 @@ void Config::recordQueryPerformance(const std::string& name,
 
   // Grab access to the non-const schedule item.
   auto& query = performance_.at(name);
-  BIGINT_LITERAL diff = 0;
-  if (!r1.at("user_time").empty() && !r0.at("user_time").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("user_time")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("user_time"));
-    if (diff > 0) {
-      query.user_time += diff;
-    }
+  query.user_time += usage.user_time / 1000;
+  query.system_time += usage.system_time / 1000;
+  query.instructions += usage.instructions;
+  query.cycles += usage.cycles;
+  query.cache_misses += usage.cache_misses;
+  query.context_switches += usage.context_switches;
+  query.major_faults += usage.major_faults;
+  query.minor_faults += usage.minor_faults;
+  if (usage.timed_out) {
+    query.timeouts++;
   }
-
-  if (!r1.at("system_time").empty() && !r0.at("system_time").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("system_time")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("system_time"));
-    if (diff > 0) {
-      query.system_time += diff;
-    }
+  if (usage.truncated) {
+    query.truncations++;
   }
 
-  if (!r1.at("resident_size").empty() && !r0.at("resident_size").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("resident_size")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("resident_size"));
-    if (diff > 0) {
-      // Memory is stored as an average of RSS changes between query executions.
-      query.average_memory = (query.average_memory * query.executions) + diff;
-      query.average_memory = (query.average_memory / (query.executions + 1));
-    }
+  // Memory is the bytes generated by the tables the query scanned.
+  uint64_t bytes = 0;
+  for (const auto& table : usage.tables) {
+    auto& total = query.tables[table.first];
+    total.rows += table.second.rows;
+    total.bytes += table.second.bytes;
+    bytes += table.second.bytes;
   }
+  query.average_memory = (query.average_memory * query.executions) + bytes;
+  query.average_memory = (query.average_memory / (query.executions + 1));
+
+  query.wall_time_histogram.add(usage.wall_time);
+  query.cpu_time_histogram.add((usage.user_time + usage.system_time) / 1000);
+  query.memory_histogram.add(bytes);
+  query.rows_histogram.add(usage.rows);
+  query.output_size_histogram.add(usage.output_size);
+  query.sqlite_memory_histogram.add(usage.sqlite_memory);
 
   query.wall_time += delay;
-  query.output_size += size;
+  query.output_size += usage.output_size;
   query.executions += 1;
   query.last_executed = getUnixTime();
 
   // Clear the executing query (remove the dirty bit).
-  setDatabaseValue(kPersistentSettings, kExecutingQuery, "");
+  auto it = std::find(kExecutingQueries.begin(), kExecutingQueries.end(), name);
+  if (it != kExecutingQueries.end()) {
+    kExecutingQueries.erase(it);
+  }
+  setDatabaseValue(kPersistentSettings,
+                   kExecutingQuery,
+                   osquery::join(kExecutingQueries, "\n"));
+}
+
+void Config::recordQueryLateness(const std::string& name,
+                                 size_t lateness,
+                                 size_t missed) {
+  RecursiveLock lock(config_performance_mutex_);
+  auto& query = performance_[name];
+  query.lateness += lateness;
+  query.missed += missed;
+  query.lateness_histogram.add(lateness);
+}
+
+void Config::recordQueryInterval(const std::string& name, size_t interval) {
+  RecursiveLock lock(config_performance_mutex_);
+  performance_[name].effective_interval = interval;
 }
 
 void Config::recordQueryStart(const std::string& name) {
-  // There should only ever be a single executing query in the schedule.
-  setDatabaseValue(kPersistentSettings, kExecutingQuery, name);
+  {
+    // There is a single executing query unless the schedule is parallel.
+    RecursiveLock lock(config_performance_mutex_);
+    kExecutingQueries.push_back(name);
+    setDatabaseValue(kPersistentSettings,
+                     kExecutingQuery,
+                     osquery::join(kExecutingQueries, "\n"));
+  }
   // Store the time this query name last executed for later results eviction.
   // When configuration updates occur the previous schedule is searched for
   // 'stale' query names, aka those that have week-old or longer last execute
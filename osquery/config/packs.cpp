@@ -9,7 +9,9 @@
  */
 
 #include <algorithm>
+#include <future>
 #include <random>
+#include <set>
 
 #include <osquery/core.h>
 #include <osquery/database.h>
@@ -30,6 +32,11 @@ FLAG(uint64,
      3600,
      "Cache expiration for a packs discovery queries");
 
+FLAG(uint64,
+     pack_discovery_threads,
+     4,
+     "Threads evaluating pack discovery queries concurrently");
+
 FLAG(string, pack_delimiter, "_", "Delimiter for pack and query names");
 
 FLAG(uint64, schedule_splay_percent, 10, "Percent to splay config times");
@@ -41,6 +48,12 @@ FLAG(uint64,
 
 size_t kMaxQueryInterval = 604800;
 
+/// Discovery query SQL to the time and result of its evaluation.
+static std::map<std::string, std::pair<size_t, bool>> kDiscoveryResults;
+
+/// Protection around kDiscoveryResults.
+static Mutex kDiscoveryResultsMutex;
+
 size_t splayValue(size_t original, size_t splayPercent) {
   if (splayPercent == 0 || splayPercent > 100) {
     return original;
@@ -154,6 +167,15 @@ void Pack::initialize(const std::string& name,
     FLAGS_schedule_splay_percent = 10;
   }
 
+  // The pack's priority class is the default for each of its queries.
+  auto priority = tree.get<size_t>("priority", 0);
+  auto sandbox = tree.get<bool>("sandbox", false);
+  auto background = tree.get<bool>("background", false);
+  auto max_rows = tree.get<size_t>("max_rows", 0);
+  auto max_bytes = tree.get<size_t>("max_bytes", 0);
+  auto min_interval = tree.get<size_t>("min_interval", 0);
+  auto max_interval = tree.get<size_t>("max_interval", 0);
+
   schedule_.clear();
   if (tree.count("queries") == 0) {
     // This pack contained no queries.
@@ -196,6 +218,27 @@ void Pack::initialize(const std::string& name,
     query.options["snapshot"] = q.second.get<bool>("snapshot", false);
     query.options["removed"] = q.second.get<bool>("removed", true);
     query.options["blacklist"] = q.second.get<bool>("blacklist", true);
+    query.options["catchup"] = q.second.get<bool>("catchup", false);
+    query.options["sandbox"] = q.second.get<bool>("sandbox", sandbox);
+    query.options["background"] =
+        q.second.get<bool>("background", background);
+    query.priority = q.second.get<size_t>("priority", priority);
+    query.max_rows = q.second.get<size_t>("max_rows", max_rows);
+    query.max_bytes = q.second.get<size_t>("max_bytes", max_bytes);
+    query.min_interval = q.second.get<size_t>("min_interval", min_interval);
+    query.max_interval = q.second.get<size_t>("max_interval", max_interval);
+    if (q.second.count("triggers") > 0) {
+      // Triggers are a list of event tables, or a comma-separated string.
+      const auto& triggers = q.second.get_child("triggers");
+      if (triggers.empty()) {
+        for (const auto& table : osquery::split(triggers.data(), ",")) {
+          query.triggers.push_back(table);
+        }
+      }
+      for (const auto& table : triggers) {
+        query.triggers.push_back(table.second.data());
+      }
+    }
     schedule_[q.first] = query;
   }
 }
@@ -291,17 +334,14 @@ bool Pack::checkDiscovery() {
   }
 
   stats_.misses++;
+  discover(discovery_queries_);
+
   discovery_cache_.first = current;
   discovery_cache_.second = true;
+  ReadLock lock(kDiscoveryResultsMutex);
   for (const auto& q : discovery_queries_) {
-    SQL results(q);
-    if (!results.ok()) {
-      LOG(WARNING) << "Discovery query failed (" << q
-                   << "): " << results.getMessageString();
-      discovery_cache_.second = false;
-      break;
-    }
-    if (results.rows().size() == 0) {
+    auto result = kDiscoveryResults.find(q);
+    if (result == kDiscoveryResults.end() || !result->second.second) {
       discovery_cache_.second = false;
       break;
     }
@@ -309,6 +349,66 @@ bool Pack::checkDiscovery() {
   return discovery_cache_.second;
 }
 
+/// Evaluate a discovery query, it passes if it returns rows.
+static bool evaluateDiscovery(const std::string& query) {
+  SQL results(query);
+  if (!results.ok()) {
+    LOG(WARNING) << "Discovery query failed (" << query
+                 << "): " << results.getMessageString();
+    return false;
+  }
+  return results.rows().size() > 0;
+}
+
+size_t Pack::discover(const std::vector<std::string>& queries) {
+  size_t current = osquery::getUnixTime();
+  std::vector<std::string> pending;
+  {
+    std::set<std::string> unique;
+    ReadLock lock(kDiscoveryResultsMutex);
+    for (const auto& q : queries) {
+      auto result = kDiscoveryResults.find(q);
+      if (result != kDiscoveryResults.end() &&
+          current - result->second.first < FLAGS_pack_refresh_interval) {
+        continue;
+      }
+      if (unique.insert(q).second) {
+        pending.push_back(q);
+      }
+    }
+  }
+
+  if (pending.empty()) {
+    return 0;
+  }
+
+  // Each worker takes the next pending query until none remain.
+  std::vector<char> passed(pending.size(), 0);
+  std::atomic<size_t> next{0};
+  auto work = [&pending, &passed, &next]() {
+    for (auto i = next++; i < pending.size(); i = next++) {
+      passed[i] = evaluateDiscovery(pending[i]) ? 1 : 0;
+    }
+  };
+
+  auto threads = std::min<size_t>(
+      std::max<size_t>(FLAGS_pack_discovery_threads, 1), pending.size());
+  std::vector<std::future<void>> workers;
+  for (size_t i = 1; i < threads; i++) {
+    workers.push_back(std::async(std::launch::async, work));
+  }
+  work();
+  for (auto& worker : workers) {
+    worker.wait();
+  }
+
+  WriteLock lock(kDiscoveryResultsMutex);
+  for (size_t i = 0; i < pending.size(); i++) {
+    kDiscoveryResults[pending[i]] = std::make_pair(current, passed[i] != 0);
+  }
+  return pending.size();
+}
+
 bool Pack::isActive() const {
   return active_;
 }
@@ -8,14 +8,19 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <atomic>
+
 #include <osquery/config.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
+#include <osquery/system.h>
 
 #include "osquery/config/parsers/decorators.h"
+#include "osquery/core/json.h"
 
 namespace pt = boost::property_tree;
+namespace rj = rapidjson;
 
 namespace osquery {
 
@@ -26,6 +31,11 @@ FLAG(bool,
      false,
      "Add decorators as top level JSON objects");
 
+FLAG(uint64,
+     decorations_always_ttl,
+     1,
+     "Seconds the always decorators' results are reused, 0 to run per query");
+
 /// Statically define the parser name to avoid mistakes.
 #define PARSER_NAME "decorators"
 
@@ -97,17 +107,34 @@ class DecoratorsConfigParserPlugin : public ConfigParserPlugin {
   /// The result set of decorations, column names and their values.
   static DecorationStore kDecorations;
 
+  /// The decorations of every source, merged when they change.
+  static KeyValueMap kDecorationsMerged;
+
+  /// The merged decorations rendered as a JSON object.
+  static std::shared_ptr<const std::string> kDecorationsJSON;
+
+  /// Set when a decoration changes, the merged decorations are stale.
+  static bool kDecorationsChanged;
+
   /// Protect additions to the decorator set.
   static Mutex kDecorationsMutex;
 
   /// Protect the configuration controlled content.
   static Mutex kDecorationsConfigMutex;
+
+  /// The time the always decorators last ran, 0 if they must run.
+  static std::atomic<size_t> kDecorationsAlwaysTime;
 };
 }
 
 DecorationStore DecoratorsConfigParserPlugin::kDecorations;
+KeyValueMap DecoratorsConfigParserPlugin::kDecorationsMerged;
+std::shared_ptr<const std::string>
+    DecoratorsConfigParserPlugin::kDecorationsJSON;
+bool DecoratorsConfigParserPlugin::kDecorationsChanged{false};
 Mutex DecoratorsConfigParserPlugin::kDecorationsMutex;
 Mutex DecoratorsConfigParserPlugin::kDecorationsConfigMutex;
+std::atomic<size_t> DecoratorsConfigParserPlugin::kDecorationsAlwaysTime{0};
 
 Status DecoratorsConfigParserPlugin::setUp() {
   // Decorators are kept within customized data structures.
@@ -144,6 +171,9 @@ void DecoratorsConfigParserPlugin::clearSources(const std::string& source) {
   if (load_.count(source) > 0) {
     load_[source].clear();
   }
+
+  // The always decorators run again with the updated configuration.
+  kDecorationsAlwaysTime = 0;
 }
 
 void DecoratorsConfigParserPlugin::reset() {
@@ -199,7 +229,12 @@ inline void addDecoration(const std::string& source,
                           const std::string& name,
                           const std::string& value) {
   WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
-  DecoratorsConfigParserPlugin::kDecorations[source][name] = value;
+  auto& decorations = DecoratorsConfigParserPlugin::kDecorations[source];
+  auto decoration = decorations.find(name);
+  if (decoration == decorations.end() || decoration->second != value) {
+    decorations[name] = value;
+    DecoratorsConfigParserPlugin::kDecorationsChanged = true;
+  }
 }
 
 inline void runDecorators(const std::string& source,
@@ -224,7 +259,11 @@ inline void runDecorators(const std::string& source,
 
 void clearDecorations(const std::string& source) {
   WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
-  DecoratorsConfigParserPlugin::kDecorations[source].clear();
+  auto& decorations = DecoratorsConfigParserPlugin::kDecorations[source];
+  if (!decorations.empty()) {
+    decorations.clear();
+    DecoratorsConfigParserPlugin::kDecorationsChanged = true;
+  }
 }
 
 void runDecorators(DecorationPoint point,
@@ -250,6 +289,20 @@ void runDecorators(DecorationPoint point,
       }
     }
   } else if (point == DECORATE_ALWAYS) {
+    if (source.empty() && FLAGS_decorations_always_ttl > 0) {
+      // Queries launched within the TTL share one run of the decorators.
+      auto now = getUnixTime();
+      auto& last = DecoratorsConfigParserPlugin::kDecorationsAlwaysTime;
+      auto previous = last.load();
+      if (previous != 0 && now < previous + FLAGS_decorations_always_ttl) {
+        return;
+      }
+      if (!last.compare_exchange_strong(previous, now)) {
+        // Another query is running the decorators.
+        return;
+      }
+    }
+
     for (const auto& target_source : dp->always_) {
       if (source.empty() || target_source.first == source) {
         runDecorators(target_source.first, target_source.second);
@@ -268,18 +321,75 @@ void runDecorators(DecorationPoint point,
   }
 }
 
+/// Merge and render the decorations of every source if they changed.
+static void mergeDecorations() {
+  {
+    ReadLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+    if (!DecoratorsConfigParserPlugin::kDecorationsChanged) {
+      return;
+    }
+  }
+
+  WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+  if (!DecoratorsConfigParserPlugin::kDecorationsChanged) {
+    return;
+  }
+
+  auto& merged = DecoratorsConfigParserPlugin::kDecorationsMerged;
+  merged.clear();
+  for (const auto& source : DecoratorsConfigParserPlugin::kDecorations) {
+    for (const auto& decoration : source.second) {
+      merged[decoration.first] = decoration.second;
+    }
+  }
+
+  DecoratorsConfigParserPlugin::kDecorationsJSON = nullptr;
+  if (!merged.empty()) {
+    rj::StringBuffer sb;
+    rj::Writer<rj::StringBuffer> w(sb);
+    w.StartObject();
+    for (const auto& decoration : merged) {
+      w.Key(decoration.first.c_str(),
+            static_cast<rj::SizeType>(decoration.first.size()));
+      w.String(decoration.second.c_str(),
+               static_cast<rj::SizeType>(decoration.second.size()));
+    }
+    w.EndObject();
+    DecoratorsConfigParserPlugin::kDecorationsJSON =
+        std::make_shared<const std::string>(sb.GetString(), sb.GetSize());
+  }
+  DecoratorsConfigParserPlugin::kDecorationsChanged = false;
+}
+
 void getDecorations(std::map<std::string, std::string>& results) {
+  std::shared_ptr<const std::string> json;
+  getDecorations(results, json);
+}
+
+void getDecorations(std::map<std::string, std::string>& results,
+                    std::shared_ptr<const std::string>& json) {
   if (FLAGS_disable_decorators) {
     return;
   }
 
+  mergeDecorations();
   ReadLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
   // Copy the decorations into the log_item.
-  for (const auto& source : DecoratorsConfigParserPlugin::kDecorations) {
-    for (const auto& decoration : source.second) {
-      results[decoration.first] = decoration.second;
-    }
+  const auto& merged = DecoratorsConfigParserPlugin::kDecorationsMerged;
+  for (const auto& decoration : merged) {
+    results[decoration.first] = decoration.second;
+  }
+  json = DecoratorsConfigParserPlugin::kDecorationsJSON;
+}
+
+std::shared_ptr<const std::string> getDecorationsJSON() {
+  if (FLAGS_disable_decorators) {
+    return nullptr;
   }
+
+  mergeDecorations();
+  ReadLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+  return DecoratorsConfigParserPlugin::kDecorationsJSON;
 }
 
 REGISTER_INTERNAL(DecoratorsConfigParserPlugin, "config_parser", PARSER_NAME);
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <functional>
 
 #include <osquery/config.h>
@@ -55,6 +56,21 @@ void runDecorators(DecorationPoint point,
  */
 void getDecorations(std::map<std::string, std::string>& results);
 
+/**
+ * @brief Access the decorations and their rendering as a JSON object.
+ *
+ * The JSON object is rendered once each time the decorators produce new
+ * values, and is shared by log lines until the decorations change again.
+ *
+ * @param results the output parameter to write decorations.
+ * @param json the output JSON object, nullptr if there are no decorations.
+ */
+void getDecorations(std::map<std::string, std::string>& results,
+                    std::shared_ptr<const std::string>& json);
+
+/// Access the decorations as a JSON object, nullptr if there are none.
+std::shared_ptr<const std::string> getDecorationsJSON();
+
 /// Clear decorations for a source when it updates.
 void clearDecorations(const std::string& source);
 }
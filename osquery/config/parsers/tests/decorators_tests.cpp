@@ -21,6 +21,7 @@ namespace osquery {
 
 DECLARE_bool(disable_decorators);
 DECLARE_bool(decorations_top_level);
+DECLARE_uint64(decorations_always_ttl);
 
 class DecoratorsConfigParserPluginTests : public testing::Test {
  public:
@@ -107,6 +108,75 @@ TEST_F(DecoratorsConfigParserPluginTests, test_decorators_run_interval) {
   ASSERT_EQ(second_item.decorations.size(), 2U);
 }
 
+TEST_F(DecoratorsConfigParserPluginTests, test_decorators_json) {
+  // Prevent loads from executing.
+  FLAGS_disable_decorators = true;
+  Config::get().update(config_data_);
+
+  FLAGS_disable_decorators = false;
+  runDecorators(DECORATE_INTERVAL, 60);
+
+  // The rendered object is shared until the decorations change.
+  QueryLogItem item;
+  getDecorations(item.decorations, item.decorations_json);
+  ASSERT_NE(item.decorations_json, nullptr);
+  EXPECT_EQ(*item.decorations_json,
+            "{\"internal_60_test\":\"test\",\"one\":\"1\"}");
+  runDecorators(DECORATE_INTERVAL, 60);
+  EXPECT_EQ(getDecorationsJSON(), item.decorations_json);
+
+  // The item serializes as if each decoration was written.
+  std::string rendered;
+  serializeQueryLogItemJSON(item, rendered);
+  item.decorations_json = nullptr;
+  std::string written;
+  serializeQueryLogItemJSON(item, written);
+  EXPECT_EQ(rendered, written);
+
+  clearDecorations("awesome");
+  EXPECT_EQ(getDecorationsJSON(), nullptr);
+}
+
+TEST_F(DecoratorsConfigParserPluginTests, test_decorators_run_always_ttl) {
+  // Prevent loads from executing.
+  FLAGS_disable_decorators = true;
+  Config::get().update(config_data_);
+
+  FLAGS_disable_decorators = false;
+  auto ttl = FLAGS_decorations_always_ttl;
+  FLAGS_decorations_always_ttl = 3600;
+  runDecorators(DECORATE_ALWAYS);
+
+  std::map<std::string, std::string> decorations;
+  getDecorations(decorations);
+  EXPECT_EQ(decorations["always_test"], "test");
+
+  // Queries launched within the TTL reuse the results.
+  clearDecorations("awesome");
+  runDecorators(DECORATE_ALWAYS);
+  decorations.clear();
+  getDecorations(decorations);
+  EXPECT_EQ(decorations.count("always_test"), 0U);
+
+  // A configuration update runs the decorators again.
+  FLAGS_disable_decorators = true;
+  Config::get().update(config_data_);
+  FLAGS_disable_decorators = false;
+  runDecorators(DECORATE_ALWAYS);
+  decorations.clear();
+  getDecorations(decorations);
+  EXPECT_EQ(decorations["always_test"], "test");
+
+  // Without a TTL the decorators run for every query.
+  FLAGS_decorations_always_ttl = 0;
+  clearDecorations("awesome");
+  runDecorators(DECORATE_ALWAYS);
+  decorations.clear();
+  getDecorations(decorations);
+  EXPECT_EQ(decorations["always_test"], "test");
+  FLAGS_decorations_always_ttl = ttl;
+}
+
 TEST_F(DecoratorsConfigParserPluginTests, test_decorators_run_load_top_level) {
   // Re-enable the decorators, then update the config.
   // The 'load' decorator set should run every time the config is updated.
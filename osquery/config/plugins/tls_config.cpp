@@ -16,6 +16,7 @@
 #include <osquery/config.h>
 #include <osquery/dispatcher.h>
 #include <osquery/enroll.h>
+#include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/registry.h>
 
@@ -72,17 +73,24 @@ Status TLSConfigPlugin::genConfig(std::map<std::string, std::string>& config) {
     params.put("_get", true);
   }
 
+  // Only request the config if it changed since it was last retrieved.
+  if (!etag_.empty()) {
+    params.put("_if_none_match", etag_);
+  }
+
   auto s = TLSRequestHelper::go<JSONSerializer>(
       uri_, params, json, FLAGS_config_tls_max_attempts);
+  if (s.ok() && params.count("_not_modified") > 0) {
+    // The config source hash is unchanged, so it is not parsed again.
+    config["tls_plugin"] = config_;
+    return s;
+  }
+
   if (s.ok()) {
     if (FLAGS_tls_node_api) {
       // The node API embeds configuration data (JSON escaped).
       pt::ptree tree;
-      try {
-        std::stringstream input;
-        input << json;
-        pt::read_json(input, tree);
-      } catch (const pt::json_parser::json_parser_error& /* e */) {
+      if (!parseJSONContent(std::move(json), tree)) {
         VLOG(1) << "Could not parse JSON from TLS node API";
       }
 
@@ -91,6 +99,9 @@ Status TLSConfigPlugin::genConfig(std::map<std::string, std::string>& config) {
     } else {
       config["tls_plugin"] = json;
     }
+
+    etag_ = params.get<std::string>("_etag", "");
+    config_ = config["tls_plugin"];
   }
 
   return s;
@@ -27,6 +27,12 @@ class TLSConfigPlugin : public ConfigPlugin,
   /// Calculate the URL once and cache the result.
   std::string uri_;
 
+  /// The entity tag of the last config, sent to make requests conditional.
+  std::string etag_;
+
+  /// The last config, returned again when the server reports it unchanged.
+  std::string config_;
+
  private:
   friend class TLSConfigTests;
 };
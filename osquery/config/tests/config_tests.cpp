@@ -268,6 +268,46 @@ TEST_F(ConfigTests, test_content_update) {
   EXPECT_EQ(count, 0U);
 }
 
+TEST_F(ConfigTests, test_pack_diff) {
+  auto getPacks = []() {
+    std::map<std::string, std::shared_ptr<Pack>> packs;
+    get().packs([&packs](std::shared_ptr<Pack>& pack) {
+      packs[pack->getName()] = pack;
+    });
+    return packs;
+  };
+
+  auto query = [](const std::string& sql) {
+    return "{\"queries\": {\"q\": {\"query\": \"" + sql +
+           "\", \"interval\": 60}}}";
+  };
+  std::map<std::string, std::string> config_data;
+  config_data["awesome"] = "{\"packs\": {\"a\": " + query("select 1") +
+                           ", \"b\": " + query("select 2") + "}}";
+  EXPECT_TRUE(get().update(config_data).ok());
+  auto first = getPacks();
+  ASSERT_EQ(first.size(), 2U);
+
+  // Only the changed pack is replaced, an unchanged pack is kept.
+  auto generation = get().getScheduleGeneration();
+  config_data["awesome"] = "{\"packs\": {\"a\": " + query("select 1") +
+                           ", \"b\": " + query("select 3") + "}}";
+  EXPECT_TRUE(get().update(config_data).ok());
+  auto second = getPacks();
+  ASSERT_EQ(second.size(), 2U);
+  EXPECT_EQ(first["a"], second["a"]);
+  EXPECT_NE(first["b"], second["b"]);
+  EXPECT_GT(get().getScheduleGeneration(), generation);
+
+  // A pack no longer included by the source is removed.
+  config_data["awesome"] =
+      "{\"packs\": {\"a\": " + query("select 1") + "}}";
+  EXPECT_TRUE(get().update(config_data).ok());
+  auto third = getPacks();
+  ASSERT_EQ(third.size(), 1U);
+  EXPECT_EQ(first["a"], third["a"]);
+}
+
 TEST_F(ConfigTests, test_get_scheduled_queries) {
   std::vector<std::string> query_names;
   std::vector<ScheduledQuery> queries;
@@ -135,6 +135,64 @@ TEST_F(PacksTests, test_schedule) {
   EXPECT_EQ(fpack.getSchedule().size(), 1U);
 }
 
+TEST_F(PacksTests, test_priority) {
+  std::string content =
+      "{\"priority\": 2, \"queries\": {"
+      "\"alerts\": {\"query\": \"select 1\", \"interval\": 60}, "
+      "\"inventory\": {\"query\": \"select 1\", \"interval\": 60, "
+      "\"priority\": 0}}}";
+  pt::ptree tree;
+  std::stringstream json_stream;
+  json_stream << content;
+  pt::read_json(json_stream, tree);
+
+  // The pack's priority class is the default for its queries.
+  Pack fpack("priority_pack", tree);
+  ASSERT_EQ(fpack.getSchedule().size(), 2U);
+  EXPECT_EQ(fpack.getSchedule().at("alerts").priority, 2U);
+  EXPECT_EQ(fpack.getSchedule().at("inventory").priority, 0U);
+}
+
+TEST_F(PacksTests, test_budget) {
+  std::string content =
+      "{\"max_rows\": 1000, \"queries\": {"
+      "\"files\": {\"query\": \"select 1\", \"interval\": 60}, "
+      "\"hashes\": {\"query\": \"select 1\", \"interval\": 60, "
+      "\"max_rows\": 10, \"max_bytes\": 4096}}}";
+  pt::ptree tree;
+  std::stringstream json_stream;
+  json_stream << content;
+  pt::read_json(json_stream, tree);
+
+  // The pack's budget is the default for its queries.
+  Pack fpack("budget_pack", tree);
+  ASSERT_EQ(fpack.getSchedule().size(), 2U);
+  EXPECT_EQ(fpack.getSchedule().at("files").max_rows, 1000U);
+  EXPECT_EQ(fpack.getSchedule().at("files").max_bytes, 0U);
+  EXPECT_EQ(fpack.getSchedule().at("hashes").max_rows, 10U);
+  EXPECT_EQ(fpack.getSchedule().at("hashes").max_bytes, 4096U);
+}
+
+TEST_F(PacksTests, test_adaptive_interval) {
+  std::string content =
+      "{\"max_interval\": 3600, \"queries\": {"
+      "\"files\": {\"query\": \"select 1\", \"interval\": 60}, "
+      "\"hashes\": {\"query\": \"select 1\", \"interval\": 60, "
+      "\"min_interval\": 30, \"max_interval\": 120}}}";
+  pt::ptree tree;
+  std::stringstream json_stream;
+  json_stream << content;
+  pt::read_json(json_stream, tree);
+
+  // The pack's bounds are the default for its queries.
+  Pack fpack("adaptive_pack", tree);
+  ASSERT_EQ(fpack.getSchedule().size(), 2U);
+  EXPECT_EQ(fpack.getSchedule().at("files").min_interval, 0U);
+  EXPECT_EQ(fpack.getSchedule().at("files").max_interval, 3600U);
+  EXPECT_EQ(fpack.getSchedule().at("hashes").min_interval, 30U);
+  EXPECT_EQ(fpack.getSchedule().at("hashes").max_interval, 120U);
+}
+
 TEST_F(PacksTests, test_discovery_cache) {
   Config c;
   // This pack and discovery query are valid, expect the SQL to execute.
@@ -162,6 +220,37 @@ TEST_F(PacksTests, test_discovery_cache) {
   c.reset();
 }
 
+TEST_F(PacksTests, test_discovery_shared) {
+  // Repeated queries are evaluated once.
+  std::vector<std::string> queries = {"select 'shared_discovery_1'",
+                                      "select 'shared_discovery_2'",
+                                      "select 'shared_discovery_1'"};
+  EXPECT_EQ(Pack::discover(queries), 2U);
+
+  // Cached results are shared, only new queries are evaluated.
+  queries.push_back("select 'shared_discovery_3' where 0");
+  EXPECT_EQ(Pack::discover(queries), 1U);
+  EXPECT_EQ(Pack::discover(queries), 0U);
+
+  // A pack uses the cached results.
+  pt::ptree tree;
+  pt::ptree discovery;
+  pt::ptree query;
+  query.put("", "select 'shared_discovery_1'");
+  discovery.push_back(std::make_pair("", query));
+  tree.add_child("discovery", discovery);
+  Pack pack("shared_discovery_pack", tree);
+  EXPECT_TRUE(pack.shouldPackExecute());
+  EXPECT_EQ(pack.getStats().misses, 1U);
+
+  discovery.clear();
+  query.put("", "select 'shared_discovery_3' where 0");
+  discovery.push_back(std::make_pair("", query));
+  tree.put_child("discovery", discovery);
+  Pack failing("shared_discovery_pack", tree);
+  EXPECT_FALSE(failing.shouldPackExecute());
+}
+
 TEST_F(PacksTests, test_multi_pack) {
   std::string multi_pack_content = "{\"first\": {}, \"second\": {}}";
   pt::ptree multi_pack;
@@ -0,0 +1,96 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include "osquery/core/arena.h"
+
+namespace osquery {
+
+const size_t Arena::kDefaultBlockSize = 32 * 1024;
+
+Arena::Arena(size_t block_size)
+    : block_size_((block_size > 0) ? block_size : kDefaultBlockSize) {}
+
+char* Arena::newBlock(size_t size) {
+  blocks_.emplace_back(new char[size]);
+  reserved_ += size;
+  return blocks_.back().get();
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    alignment = alignof(std::max_align_t);
+  }
+
+  if (size + alignment > block_size_ / 4) {
+    // A large allocation gets a dedicated block, the current block is kept.
+    auto* block = newBlock(size + alignment);
+    auto padding = (alignment - (reinterpret_cast<uintptr_t>(block) %
+                                 alignment)) % alignment;
+    used_ += size;
+    if (current_ != nullptr) {
+      // Keep the current block as the last block for the next allocation.
+      std::swap(blocks_[blocks_.size() - 1], blocks_[blocks_.size() - 2]);
+    }
+    return block + padding;
+  }
+
+  auto padding =
+      (alignment - (reinterpret_cast<uintptr_t>(current_) % alignment)) %
+      alignment;
+  if (current_ == nullptr || padding + size > remaining_) {
+    current_ = newBlock(block_size_);
+    remaining_ = block_size_;
+    padding =
+        (alignment - (reinterpret_cast<uintptr_t>(current_) % alignment)) %
+        alignment;
+  }
+
+  auto* result = current_ + padding;
+  current_ += padding + size;
+  remaining_ -= padding + size;
+  used_ += size;
+  return result;
+}
+
+const char* Arena::copy(const char* data, size_t size) {
+  auto* dest = static_cast<char*>(allocate(size + 1, 1));
+  if (size > 0) {
+    memcpy(dest, data, size);
+  }
+  dest[size] = '\0';
+  return dest;
+}
+
+void Arena::reset() {
+  used_ = 0;
+  if (blocks_.empty()) {
+    return;
+  }
+
+  // Find a block of the default size to keep, dedicated blocks are released.
+  std::unique_ptr<char[]> first;
+  if (current_ != nullptr) {
+    first = std::move(blocks_.back());
+  }
+  blocks_.clear();
+  current_ = nullptr;
+  remaining_ = 0;
+  reserved_ = 0;
+  if (first != nullptr) {
+    blocks_.push_back(std::move(first));
+    current_ = blocks_.back().get();
+    remaining_ = block_size_;
+    reserved_ = block_size_;
+  }
+}
+} // namespace osquery
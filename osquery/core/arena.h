@@ -0,0 +1,97 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/**
+ * @brief A simple bump-pointer memory arena.
+ *
+ * Memory is handed out from large blocks and is only released all at once,
+ * either when the arena is reset or destroyed. This is intended for data with
+ * a shared lifetime, such as the cells generated for a single query, where
+ * each individual allocation would otherwise be a separate malloc and free.
+ *
+ * No destructors are run for memory allocated from the arena; only store
+ * trivially-destructible content.
+ */
+class Arena : private boost::noncopyable {
+ public:
+  /// The default size of each block of arena memory.
+  static const size_t kDefaultBlockSize;
+
+  explicit Arena(size_t block_size = kDefaultBlockSize);
+
+  /**
+   * @brief Allocate size bytes aligned to alignment.
+   *
+   * Allocations larger than a quarter of the block size are given a dedicated
+   * block so they do not waste the remainder of the current block.
+   */
+  void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+  /// Copy size bytes of data into the arena, the copy is NULL-terminated.
+  const char* copy(const char* data, size_t size);
+
+  /// See Arena::copy.
+  const char* copy(const std::string& data) {
+    return copy(data.data(), data.size());
+  }
+
+  /**
+   * @brief Release all memory allocated from the arena.
+   *
+   * The first block is kept, and reused, such that an arena reset between
+   * queries does not return to the system allocator for small result sets.
+   */
+  void reset();
+
+  /// The number of bytes handed out by allocate and copy.
+  size_t used() const {
+    return used_;
+  }
+
+  /// The number of bytes reserved from the system allocator.
+  size_t reserved() const {
+    return reserved_;
+  }
+
+ private:
+  /// Create a new block of at least size bytes.
+  char* newBlock(size_t size);
+
+ private:
+  /// The requested size of each block.
+  size_t block_size_{0};
+
+  /// The set of blocks owned by this arena.
+  std::vector<std::unique_ptr<char[]>> blocks_;
+
+  /// The next free byte in the current block.
+  char* current_{nullptr};
+
+  /// The remaining bytes in the current block.
+  size_t remaining_{0};
+
+  /// Accounting for used bytes.
+  size_t used_{0};
+
+  /// Accounting for reserved bytes.
+  size_t reserved_{0};
+};
+} // namespace osquery
@@ -0,0 +1,295 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/database.h>
+#include <osquery/query.h>
+
+#include "osquery/core/json.h"
+#include "osquery/core/memory.h"
+
+#if defined(OSQUERY_MEMORY_TAGS)
+// Memory tag builds replace operator new and count every allocation.
+#define QUERY_BENCHMARK_ALLOCATIONS() osquery::getMemoryTagAllocations()
+#else
+/// Allocations made by every thread, see QueryAllocations.
+static std::atomic<size_t> kQueryBenchmarkAllocations{0};
+
+#define QUERY_BENCHMARK_ALLOCATIONS() kQueryBenchmarkAllocations.load()
+
+void* operator new(std::size_t size) {
+  kQueryBenchmarkAllocations.fetch_add(1, std::memory_order_relaxed);
+  auto* p = std::malloc((size > 0) ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+#endif
+
+namespace osquery {
+
+extern void escapeNonPrintableBytesEx(std::string& data);
+
+/**
+ * @brief Count the allocations of a benchmark's iterations.
+ *
+ * Benchmarks take the number of rows and the number of columns of each row
+ * as arguments. The allocations per iteration are reported as the label.
+ */
+class QueryAllocations {
+ public:
+  explicit QueryAllocations(benchmark::State& state)
+      : state_(state), start_(QUERY_BENCHMARK_ALLOCATIONS()) {}
+
+  ~QueryAllocations() {
+    auto allocations = QUERY_BENCHMARK_ALLOCATIONS() - start_ - paused_;
+    auto iterations = std::max<size_t>(state_.iterations(), 1);
+    state_.SetLabel("allocs/iter=" + std::to_string(allocations / iterations));
+  }
+
+  /// Pause timing, allocations until resume are not counted.
+  void pause() {
+    state_.PauseTiming();
+    pause_start_ = QUERY_BENCHMARK_ALLOCATIONS();
+  }
+
+  void resume() {
+    paused_ += QUERY_BENCHMARK_ALLOCATIONS() - pause_start_;
+    state_.ResumeTiming();
+  }
+
+ private:
+  benchmark::State& state_;
+  size_t start_;
+
+  /// Allocations made while paused.
+  size_t paused_{0};
+  size_t pause_start_{0};
+};
+
+/// Build a row similar to a process or file row.
+static Row getBenchmarkRow(size_t width, size_t id) {
+  Row r;
+  for (size_t i = 0; i < width; i++) {
+    r["column_" + std::to_string(i)] =
+        "/usr/local/bin/value_" + std::to_string(id) + "_" + std::to_string(i);
+  }
+  return r;
+}
+
+static QueryData getBenchmarkRows(size_t rows, size_t width, size_t id = 0) {
+  QueryData data;
+  data.reserve(rows);
+  for (size_t i = 0; i < rows; i++) {
+    data.push_back(getBenchmarkRow(width, id + i));
+  }
+  return data;
+}
+
+/// Row counts and widths, such as a small table and a large process list.
+static void getBenchmarkArgs(benchmark::internal::Benchmark* b) {
+  b->ArgPair(10, 10)->ArgPair(100, 10)->ArgPair(1000, 10)->ArgPair(1000, 40);
+}
+
+static void QUERY_row_construction(benchmark::State& state) {
+  QueryAllocations allocations(state);
+  while (state.KeepRunning()) {
+    auto data = getBenchmarkRows(state.range_x(), state.range_y());
+    benchmark::DoNotOptimize(data);
+  }
+}
+
+BENCHMARK(QUERY_row_construction)->Apply(getBenchmarkArgs);
+
+static void QUERY_escape_results(benchmark::State& state) {
+  auto rows = getBenchmarkRows(state.range_x(), state.range_y());
+  QueryAllocations allocations(state);
+  while (state.KeepRunning()) {
+    for (auto& r : rows) {
+      for (auto& column : r) {
+        escapeNonPrintableBytesEx(column.second);
+      }
+    }
+  }
+}
+
+BENCHMARK(QUERY_escape_results)->Apply(getBenchmarkArgs);
+
+static void QUERY_escape_results_utf8(benchmark::State& state) {
+  // A tenth of the rows contain non-ASCII values.
+  auto rows = getBenchmarkRows(state.range_x(), state.range_y());
+  for (size_t i = 0; i < rows.size(); i += 10) {
+    for (auto& column : rows[i]) {
+      column.second += "\xC3\xA9";
+    }
+  }
+
+  QueryAllocations allocations(state);
+  while (state.KeepRunning()) {
+    allocations.pause();
+    auto data = rows;
+    allocations.resume();
+    for (auto& r : data) {
+      for (auto& column : r) {
+        escapeNonPrintableBytesEx(column.second);
+      }
+    }
+  }
+}
+
+BENCHMARK(QUERY_escape_results_utf8)->Apply(getBenchmarkArgs);
+
+static void QUERY_serialize_json(benchmark::State& state) {
+  auto rows = getBenchmarkRows(state.range_x(), state.range_y());
+  QueryAllocations allocations(state);
+  while (state.KeepRunning()) {
+    std::string json;
+    serializeQueryDataJSON(rows, json);
+  }
+}
+
+BENCHMARK(QUERY_serialize_json)->Apply(getBenchmarkArgs);
+
+static void QUERY_serialize_json_rj(benchmark::State& state) {
+  auto rows = getBenchmarkRows(state.range_x(), state.range_y());
+  QueryAllocations allocations(state);
+  while (state.KeepRunning()) {
+    std::string json;
+    serializeQueryDataJSONRJ(rows, json);
+  }
+}
+
+BENCHMARK(QUERY_serialize_json_rj)->Apply(getBenchmarkArgs);
+
+static void QUERY_deserialize_json(benchmark::State& state) {
+  std::string json;
+  serializeQueryDataJSON(
+      getBenchmarkRows(state.range_x(), state.range_y()), json);
+  QueryAllocations allocations(state);
+  while (state.KeepRunning()) {
+    QueryData rows;
+    deserializeQueryDataJSON(json, rows);
+  }
+}
+
+BENCHMARK(QUERY_deserialize_json)->Apply(getBenchmarkArgs);
+
+static void QUERY_deserialize_json_rj(benchmark::State& state) {
+  std::string json;
+  serializeQueryDataJSON(
+      getBenchmarkRows(state.range_x(), state.range_y()), json);
+  QueryAllocations allocations(state);
+  while (state.KeepRunning()) {
+    auto doc = JSON::newArray();
+    doc.doc().Parse(json.c_str());
+    QueryData rows;
+    deserializeQueryDataRJ(doc.doc(), rows);
+  }
+}
+
+BENCHMARK(QUERY_deserialize_json_rj)->Apply(getBenchmarkArgs);
+
+static void QUERY_diff(benchmark::State& state) {
+  // A tenth of the rows changed since the previous execution.
+  size_t rows = state.range_x();
+  auto previous = getBenchmarkRows(rows, state.range_y());
+  auto current = getBenchmarkRows(rows, state.range_y(), rows / 10);
+  QueryAllocations allocations(state);
+  while (state.KeepRunning()) {
+    allocations.pause();
+    QueryDataSet old(previous.begin(), previous.end());
+    auto data = current;
+    allocations.resume();
+    auto results = diff(old, data);
+    benchmark::DoNotOptimize(results);
+  }
+}
+
+BENCHMARK(QUERY_diff)->Apply(getBenchmarkArgs);
+
+static void QUERY_serialize_events_json(benchmark::State& state) {
+  QueryLogItem item;
+  item.name = "benchmark";
+  item.identifier = "hostname";
+  item.time = 1408993857;
+  item.calendar_time = "Mon Aug 25 19:10:57 2014";
+  item.results.added = getBenchmarkRows(state.range_x(), state.range_y());
+  QueryAllocations allocations(state);
+  while (state.KeepRunning()) {
+    std::vector<std::string> lines;
+    serializeQueryLogItemAsEventsJSON(item, lines);
+  }
+}
+
+BENCHMARK(QUERY_serialize_events_json)->Apply(getBenchmarkArgs);
+
+/**
+ * @brief The post-processing of a scheduled query's results.
+ *
+ * Each iteration escapes the results, stores them and diffs them against the
+ * previous execution, and serializes the differential as event lines, as
+ * launchQuery does.
+ */
+static void QUERY_post_process(benchmark::State& state) {
+  size_t rows = state.range_x();
+  ScheduledQuery query;
+  query.query = "SELECT * FROM benchmark;";
+  query.interval = 60;
+  Query stored("query_benchmark", query);
+
+  uint64_t counter = 0;
+  DiffResults initial;
+  stored.addNewResults(
+      getBenchmarkRows(rows, state.range_y()), 0, counter, initial);
+
+  size_t execution = 0;
+  QueryAllocations allocations(state);
+  while (state.KeepRunning()) {
+    allocations.pause();
+    // Alternate between two result sets, each differing by a tenth.
+    auto data = getBenchmarkRows(
+        rows, state.range_y(), (execution++ % 2 == 0) ? rows / 10 : 0);
+    allocations.resume();
+
+    for (auto& r : data) {
+      for (auto& column : r) {
+        escapeNonPrintableBytesEx(column.second);
+      }
+    }
+
+    QueryLogItem item;
+    item.name = "query_benchmark";
+    stored.addNewResults(std::move(data), 0, counter, item.results);
+
+    std::vector<std::string> lines;
+    serializeQueryLogItemAsEventsJSON(item, lines);
+  }
+
+  deleteDatabaseRange(kQueries, "query_benchmark", "query_benchmark~");
+  Query::invalidateMetadata("query_benchmark");
+}
+
+BENCHMARK(QUERY_post_process)->Apply(getBenchmarkArgs);
+} // namespace osquery
@@ -0,0 +1,212 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/core/cgroup.h"
+
+namespace osquery {
+
+DECLARE_bool(watchdog_cgroup);
+DECLARE_uint64(watchdog_pressure_limit);
+
+/// The highest scheduled query priority class, it is never deferred.
+const size_t kPressureMaxPriority = 3;
+
+#ifdef __linux__
+static bool readCgroupFile(const std::string& path, std::string& content) {
+  auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  // Kernel files report a size of 0, read until the end.
+  char buffer[4096];
+  ssize_t size = 0;
+  content.clear();
+  while ((size = ::read(fd, buffer, sizeof(buffer))) > 0) {
+    content.append(buffer, static_cast<size_t>(size));
+  }
+  ::close(fd);
+  return size == 0;
+}
+
+static bool writeCgroupFile(const std::string& path,
+                            const std::string& content) {
+  auto fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  auto size = ::write(fd, content.data(), content.size());
+  ::close(fd);
+  return size == static_cast<ssize_t>(content.size());
+}
+
+/// The unified hierarchy path of this process, relative to the mount.
+static bool getSelfCgroup(std::string& cgroup) {
+  std::string content;
+  if (!readCgroupFile("/proc/self/cgroup", content)) {
+    return false;
+  }
+
+  std::istringstream lines(content);
+  std::string line;
+  while (std::getline(lines, line)) {
+    if (line.compare(0, 3, "0::") == 0) {
+      cgroup = line.substr(3);
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+
+Status limitWorkerCgroup(pid_t worker, size_t utilization, size_t memory) {
+#ifdef __linux__
+  std::string cgroup;
+  if (!getSelfCgroup(cgroup)) {
+    return Status(1, "The watcher is not in a cgroup v2");
+  }
+
+  // A previous worker's start moved the watcher into its leaf.
+  const std::string leaf = "/watcher";
+  if (cgroup.size() > leaf.size() &&
+      cgroup.compare(cgroup.size() - leaf.size(), leaf.size(), leaf) == 0) {
+    cgroup.resize(cgroup.size() - leaf.size());
+  }
+
+  if (cgroup.empty() || cgroup == "/") {
+    return Status(1, "The watcher must run in a delegated cgroup");
+  }
+
+  auto base = kCgroupRoot + cgroup;
+  for (const auto& name : {"/watcher", "/worker"}) {
+    auto path = base + name;
+    if (::mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+      return Status(1, "Cannot create cgroup " + path);
+    }
+  }
+
+  // Controllers are only enabled for children of a cgroup without processes.
+  std::string procs;
+  if (readCgroupFile(base + "/cgroup.procs", procs)) {
+    std::istringstream pids(procs);
+    std::string pid;
+    while (std::getline(pids, pid)) {
+      if (!pid.empty()) {
+        writeCgroupFile(base + "/watcher/cgroup.procs", pid);
+      }
+    }
+  }
+
+  if (!writeCgroupFile(base + "/cgroup.subtree_control", "+cpu +memory")) {
+    return Status(1, "Cannot enable cgroup controllers in " + base);
+  }
+
+  // The CPU quota is a share of each 100ms period.
+  auto path = base + "/worker";
+  auto quota = std::max(utilization, static_cast<size_t>(1)) * 1000;
+  if (!writeCgroupFile(path + "/cpu.max", std::to_string(quota) + " 100000") ||
+      !writeCgroupFile(path + "/memory.high", std::to_string(memory))) {
+    return Status(1, "Cannot set cgroup limits in " + path);
+  }
+
+  if (!writeCgroupFile(path + "/cgroup.procs", std::to_string(worker))) {
+    return Status(1, "Cannot move the worker into " + path);
+  }
+  return Status(0, "OK");
+#else
+  return Status(1, "Worker cgroups are only supported on Linux");
+#endif
+}
+
+bool parsePressureStall(const std::string& content, double& stall) {
+  const std::string some = "some avg10=";
+  auto position = content.find(some);
+  if (position == std::string::npos) {
+    return false;
+  }
+
+  auto start = content.c_str() + position + some.size();
+  char* end = nullptr;
+  stall = strtod(start, &end);
+  return end != start;
+}
+
+size_t getPressurePriority(double stall, size_t limit) {
+  if (limit == 0) {
+    return 0;
+  }
+
+  // Each doubling of the stall defers another priority class.
+  size_t priority = 0;
+  auto threshold = static_cast<double>(limit);
+  while (stall >= threshold && priority < kPressureMaxPriority) {
+    priority++;
+    threshold *= 2;
+  }
+  return priority;
+}
+
+size_t getResourcePressure() {
+  if (!FLAGS_watchdog_cgroup) {
+    return 0;
+  }
+
+#ifdef __linux__
+  // The averages are updated every 2 seconds, read them at most once a second.
+  static std::atomic<size_t> checked{0};
+  static std::atomic<size_t> pressure{0};
+  auto now = getUnixTime();
+  if (checked.exchange(now) == now) {
+    return pressure;
+  }
+
+  std::string cgroup;
+  double stall = 0;
+  if (getSelfCgroup(cgroup)) {
+    for (const auto& resource : {"/cpu.pressure", "/memory.pressure"}) {
+      std::string content;
+      double resource_stall = 0;
+      if (readCgroupFile(kCgroupRoot + cgroup + resource, content) &&
+          parsePressureStall(content, resource_stall)) {
+        stall = std::max(stall, resource_stall);
+      }
+    }
+  }
+
+  auto priority = getPressurePriority(stall, FLAGS_watchdog_pressure_limit);
+  if (pressure.exchange(priority) != priority) {
+    VLOG(1) << "Worker cgroup stalled " << stall
+            << "% of the time, deferring scheduled queries below priority "
+            << priority;
+  }
+  return priority;
+#else
+  return 0;
+#endif
+}
+} // namespace osquery
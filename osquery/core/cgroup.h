@@ -0,0 +1,55 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <osquery/core.h>
+
+namespace osquery {
+
+/// The cgroup v2 mount.
+const std::string kCgroupRoot = "/sys/fs/cgroup";
+
+/**
+ * @brief Place the worker in its own cgroup v2 with CPU and memory limits.
+ *
+ * The watcher's cgroup, such as a service's, is divided into a "watcher" leaf,
+ * holding the watcher and extensions, and a "worker" leaf. The worker leaf
+ * uses cpu.max to cap utilization and memory.high to reclaim and throttle
+ * allocations before the watchdog limits would stop the worker.
+ *
+ * @param worker The worker process.
+ * @param utilization The percent of one CPU the worker may use.
+ * @param memory The bytes of memory the worker may use before throttling.
+ */
+Status limitWorkerCgroup(pid_t worker, size_t utilization, size_t memory);
+
+/**
+ * @brief Parse the "some" 10 second average of a pressure file.
+ *
+ * @param content The content of a cgroup's cpu.pressure or memory.pressure.
+ * @param stall Output, the percent of time any task stalled.
+ */
+bool parsePressureStall(const std::string& content, double& stall);
+
+/// Map a stall percentage to a scheduled query priority class to defer.
+size_t getPressurePriority(double stall, size_t limit);
+
+/**
+ * @brief The lowest scheduled query priority class to run under pressure.
+ *
+ * The worker reads the pressure stall information of its cgroup. Scheduled
+ * queries with a lower priority class are deferred while the worker's tasks
+ * stall on CPU or memory. Requires --watchdog_cgroup.
+ */
+size_t getResourcePressure();
+} // namespace osquery
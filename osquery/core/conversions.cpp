@@ -17,6 +17,8 @@
 #include <boost/archive/iterators/transform_width.hpp>
 #include <boost/uuid/sha1.hpp>
 
+#include <zstd.h>
+
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
@@ -169,6 +171,42 @@ std::string base64Encode(const std::string& unencoded) {
   return os.str();
 }
 
+Status compressString(const std::string& data, std::string& compressed) {
+  compressed.resize(ZSTD_compressBound(data.size()));
+  auto size = ZSTD_compress(
+      &compressed[0], compressed.size(), data.data(), data.size(), 1);
+  if (ZSTD_isError(size)) {
+    compressed.clear();
+    return Status(1,
+                  "ZSTD_compress() error : " +
+                      std::string(ZSTD_getErrorName(size)));
+  }
+  compressed.resize(size);
+  return Status(0, "OK");
+}
+
+Status decompressString(const std::string& compressed,
+                        size_t size,
+                        std::string& data) {
+  if (ZSTD_getDecompressedSize(compressed.data(), compressed.size()) != size) {
+    return Status(1, "Compressed size does not match");
+  }
+
+  data.resize(size);
+  auto result = ZSTD_decompress(
+      &data[0], data.size(), compressed.data(), compressed.size());
+  if (ZSTD_isError(result)) {
+    data.clear();
+    return Status(1,
+                  "ZSTD_decompress() error : " +
+                      std::string(ZSTD_getErrorName(result)));
+  } else if (result != size) {
+    data.clear();
+    return Status(1, "Decompressed size does not match");
+  }
+  return Status(0, "OK");
+}
+
 bool isPrintable(const std::string& check) {
   for (const unsigned char ch : check) {
     if (ch >= 0x7F || ch <= 0x1F) {
@@ -178,6 +216,145 @@ bool isPrintable(const std::string& check) {
   return true;
 }
 
+/// Decode the UTF-8 character at i and move past it, invalid bytes are single.
+static uint32_t nextCharacter(const std::string& s, size_t& i) {
+  auto c = static_cast<unsigned char>(s[i++]);
+  size_t length = 0;
+  uint32_t character = c;
+  if (c >= 0xF0 && c < 0xF8) {
+    length = 3;
+    character = c & 0x07;
+  } else if (c >= 0xE0 && c < 0xF0) {
+    length = 2;
+    character = c & 0x0F;
+  } else if (c >= 0xC0 && c < 0xE0) {
+    length = 1;
+    character = c & 0x1F;
+  }
+
+  auto start = i;
+  for (; length > 0; length--) {
+    if (i >= s.size() || (static_cast<unsigned char>(s[i]) & 0xC0) != 0x80) {
+      // Not a valid sequence, the lead byte is a character.
+      i = start;
+      return c;
+    }
+    character = (character << 6) | (static_cast<unsigned char>(s[i++]) & 0x3F);
+  }
+  return character;
+}
+
+static uint32_t asciiLower(uint32_t c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/**
+ * @brief Match a GLOB character set starting after the '['.
+ *
+ * @return 1 if matched, 0 if not, and -1 if the set is not terminated.
+ */
+static int matchCharacterSet(const std::string& pattern,
+                             size_t& p,
+                             uint32_t c) {
+  bool invert = false;
+  if (p < pattern.size() && pattern[p] == '^') {
+    invert = true;
+    p++;
+  }
+
+  bool matched = false;
+  if (p < pattern.size() && pattern[p] == ']') {
+    // A leading ']' is a member of the set.
+    matched = (c == ']');
+    p++;
+  }
+
+  uint32_t prior = 0;
+  bool range = false;
+  while (p < pattern.size() && pattern[p] != ']') {
+    if (pattern[p] == '-' && range && p + 1 < pattern.size() &&
+        pattern[p + 1] != ']') {
+      p++;
+      auto upper = nextCharacter(pattern, p);
+      matched = matched || (c >= prior && c <= upper);
+      range = false;
+    } else {
+      prior = nextCharacter(pattern, p);
+      matched = matched || (c == prior);
+      range = true;
+    }
+  }
+
+  if (p >= pattern.size()) {
+    return -1;
+  }
+  p++;
+  return (matched != invert) ? 1 : 0;
+}
+
+/// The shared LIKE and GLOB matching, backtracking to the last wildcard.
+static bool patternMatches(const std::string& pattern,
+                           const std::string& value,
+                           bool glob) {
+  const uint32_t any = (glob) ? '*' : '%';
+  const uint32_t one = (glob) ? '?' : '_';
+
+  size_t p = 0, v = 0;
+  // The pattern and value positions after the last wildcard.
+  size_t star = std::string::npos, star_v = 0;
+  while (v < value.size()) {
+    if (p < pattern.size() && pattern[p] == static_cast<char>(any)) {
+      star = ++p;
+      star_v = v;
+      continue;
+    }
+
+    if (p < pattern.size()) {
+      auto next_p = p;
+      auto next_v = v;
+      auto pc = nextCharacter(pattern, next_p);
+      auto vc = nextCharacter(value, next_v);
+      bool matched = false;
+      if (pc == one) {
+        matched = true;
+      } else if (glob && pc == '[') {
+        matched = (matchCharacterSet(pattern, next_p, vc) == 1);
+      } else if (glob) {
+        matched = (pc == vc);
+      } else {
+        matched = (asciiLower(pc) == asciiLower(vc));
+      }
+
+      if (matched) {
+        p = next_p;
+        v = next_v;
+        continue;
+      }
+    }
+
+    if (star == std::string::npos) {
+      return false;
+    }
+    // Let the last wildcard match one more character.
+    p = star;
+    nextCharacter(value, star_v);
+    v = star_v;
+  }
+
+  while (p < pattern.size() && pattern[p] == static_cast<char>(any)) {
+    p++;
+  }
+  return p == pattern.size();
+}
+
+bool likeMatches(const std::string& pattern, const std::string& value) {
+  return patternMatches(pattern, value, false);
+}
+
+bool globMatches(const std::string& pattern, const std::string& value) {
+  return patternMatches(pattern, value, true);
+}
+
 std::vector<std::string> split(const std::string& s, const std::string& delim) {
   std::vector<std::string> elems;
   boost::split(elems, s, boost::is_any_of(delim));
@@ -124,6 +124,27 @@ std::string base64Decode(const std::string& encoded);
  */
 std::string base64Encode(const std::string& unencoded);
 
+/**
+ * @brief Compress a string with zstd.
+ *
+ * @param data The string to compress.
+ * @param compressed Output, a zstd frame.
+ * @return Failure if the string could not be compressed.
+ */
+Status compressString(const std::string& data, std::string& compressed);
+
+/**
+ * @brief Decompress a zstd frame created by compressString.
+ *
+ * @param compressed The zstd frame.
+ * @param size The size of the decompressed string.
+ * @param data Output, the decompressed string.
+ * @return Failure if the frame is invalid or does not decompress to size.
+ */
+Status decompressString(const std::string& compressed,
+                        size_t size,
+                        std::string& data);
+
 /**
  * @brief Check if a string is ASCII printable
  *
@@ -132,6 +153,22 @@ std::string base64Encode(const std::string& unencoded);
  */
 bool isPrintable(const std::string& check);
 
+/**
+ * @brief Match a value against a SQLite LIKE pattern.
+ *
+ * A '%' matches any sequence of characters and a '_' matches one UTF-8
+ * character. As with SQLite, only ASCII characters are case-insensitive.
+ */
+bool likeMatches(const std::string& pattern, const std::string& value);
+
+/**
+ * @brief Match a value against a SQLite GLOB pattern, case-sensitive.
+ *
+ * A '*' matches any sequence of characters, a '?' matches one UTF-8
+ * character, and a '[...]' matches one character of a set, '^' inverts.
+ */
+bool globMatches(const std::string& pattern, const std::string& value);
+
 /// Safely convert a string representation of an integer base.
 inline Status safeStrtol(const std::string& rep, size_t base, long int& out) {
   char* end{nullptr};
@@ -9,6 +9,7 @@
  */
 
 #include <chrono>
+#include <future>
 #include <iostream>
 #include <random>
 #include <thread>
@@ -44,6 +45,8 @@
 #include <osquery/system.h>
 
 #include "osquery/core/process.h"
+#include "osquery/core/startup.h"
+#include "osquery/core/trace.h"
 #include "osquery/core/watcher.h"
 
 #ifdef __linux__
@@ -176,6 +179,7 @@ DECLARE_string(distributed_plugin);
 DECLARE_bool(config_check);
 DECLARE_bool(config_dump);
 DECLARE_bool(database_dump);
+DECLARE_bool(database_read_only);
 DECLARE_string(database_path);
 DECLARE_bool(disable_distributed);
 DECLARE_bool(disable_database);
@@ -354,6 +358,12 @@ Initializer::Initializer(int& argc, char**& argv, ToolType tool)
 
   std::signal(SIGABRT, signalHandler);
   std::signal(SIGUSR1, signalHandler);
+#ifndef WIN32
+  if (isTraceEnabled()) {
+    // Dumps are written by the worker, a watcher only ignores the signal.
+    std::signal(SIGUSR2, requestTraceDump);
+  }
+#endif
 
   // All tools handle the same set of signals.
   // If a daemon process is a watchdog the signal is passed to the worker,
@@ -566,6 +576,8 @@ void Initializer::installShutdown(std::function<void()>& handler) {
 }
 
 void Initializer::start() const {
+  startTraceDumps();
+
   // Pre-extension manager initialization options checking.
   // If the shell or daemon does not need extensions and it will exit quickly,
   // prefer to disable the extension manager.
@@ -578,9 +590,14 @@ void Initializer::start() const {
   // If there are spurious access then warning logs will be emitted since the
   // set-allow-open will never be called.
   if (!isWatcher()) {
+    StartupPhaseScope phase("database");
     DatabasePlugin::setAllowOpen(true);
+    if (FLAGS_database_dump) {
+      // Dumping the database does not need the lock of a running daemon.
+      FLAGS_database_read_only = true;
+    }
     // A daemon must always have R/W access to the database.
-    DatabasePlugin::setRequireWrite(isDaemon());
+    DatabasePlugin::setRequireWrite(isDaemon() && !FLAGS_database_dump);
 
     for (size_t i = 1; i <= kDatabaseMaxRetryCount; i++) {
       if (DatabasePlugin::initPlugin().ok()) {
@@ -601,7 +618,11 @@ void Initializer::start() const {
   // Bind to an extensions socket and wait for registry additions.
   // After starting the extension manager, osquery MUST shutdown using the
   // internal 'shutdown' method.
-  auto s = osquery::startExtensionManager();
+  Status s;
+  {
+    StartupPhaseScope phase("extensions");
+    s = osquery::startExtensionManager();
+  }
   if (!s.ok()) {
     auto severity = (Watcher::get().hasManagedExtensions()) ? google::GLOG_ERROR
                                                             : google::GLOG_INFO;
@@ -617,7 +638,10 @@ void Initializer::start() const {
   initActivePlugin("config", FLAGS_config_plugin);
 
   // Run the setup for all lazy registries (tables, SQL).
-  Registry::setUp();
+  {
+    StartupPhaseScope phase("registry");
+    Registry::setUp();
+  }
 
   if (FLAGS_config_check) {
     // The initiator requested an initialization and config check.
@@ -636,7 +660,10 @@ void Initializer::start() const {
   }
 
   // Load the osquery config using the default/active config plugin.
-  s = Config::get().load();
+  {
+    StartupPhaseScope phase("config");
+    s = Config::get().load();
+  }
   if (!s.ok()) {
     auto message = "Error reading config: " + s.toString();
     if (isDaemon()) {
@@ -646,20 +673,38 @@ void Initializer::start() const {
     }
   }
 
+  // Event publishers may use options from the config. Each is set up in its
+  // own thread while the logger and distributed plugins initialize.
+  auto publishers = std::async(std::launch::async, []() {
+    StartupPhaseScope phase("event publishers");
+    osquery::attachEventPublishers();
+  });
+
   // Initialize the status and result plugin logger.
-  if (!FLAGS_disable_logging) {
-    initActivePlugin("logger", FLAGS_logger_plugin);
+  {
+    StartupPhaseScope phase("logger");
+    if (!FLAGS_disable_logging) {
+      initActivePlugin("logger", FLAGS_logger_plugin);
+    }
+    initLogger(binary_);
   }
-  initLogger(binary_);
 
   // Initialize the distributed plugin, if necessary
   if (!FLAGS_disable_distributed) {
+    StartupPhaseScope phase("distributed");
     initActivePlugin("distributed", FLAGS_distributed_plugin);
   }
 
-  // Start event threads.
-  osquery::attachEvents();
-  EventFactory::delay();
+  // Subscribers require their publishers, then start event threads.
+  publishers.wait();
+  {
+    StartupPhaseScope phase("event subscribers");
+    if (isDaemon()) {
+      EventFactory::deferConfigure();
+    }
+    osquery::attachEventSubscribers();
+    EventFactory::delay();
+  }
 }
 
 void Initializer::waitForShutdown() {
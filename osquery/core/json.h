@@ -21,6 +21,13 @@
 
 #define RAPIDJSON_HAS_STDSTRING 1
 
+// Strings without characters to escape are written in blocks.
+#if defined(__SSE2__)
+#define RAPIDJSON_SSE2
+#elif defined(__aarch64__)
+#define RAPIDJSON_NEON
+#endif
+
 #define RAPIDJSON_NO_SIZETYPEDEFINE
 namespace rapidjson {
 using SizeType = ::std::size_t;
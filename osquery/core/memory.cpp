@@ -0,0 +1,123 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <array>
+#include <atomic>
+
+#include <osquery/logger.h>
+
+#include "osquery/core/memory.h"
+
+namespace osquery {
+
+/// Names of each MemoryTag, reported by the osquery_memory table.
+static const std::array<const char*, kMemoryTags> kMemoryTagNames = {{
+    "untagged",
+    "scheduler",
+    "events",
+    "database",
+    "logger",
+    "extensions",
+    "tables",
+    "config",
+}};
+
+/// Counters of a tag, updated by operator new without locks.
+struct MemoryTagCounters {
+  std::atomic<uint64_t> live{0};
+  std::atomic<uint64_t> peak{0};
+  std::atomic<uint64_t> allocations{0};
+};
+
+/// Constant initialized, such that allocations during static init count.
+static std::array<MemoryTagCounters, kMemoryTags> kMemoryTagCounters;
+
+/// The calling thread's tag, a thread local POD safe to use within new.
+static thread_local MemoryTag kMemoryTag{MemoryTag::UNTAGGED};
+
+MemoryTagScope::MemoryTagScope(MemoryTag tag) : previous_(kMemoryTag) {
+  kMemoryTag = tag;
+}
+
+MemoryTagScope::~MemoryTagScope() {
+  kMemoryTag = previous_;
+}
+
+MemoryTag getMemoryTag() {
+  return kMemoryTag;
+}
+
+bool isMemoryTagging() {
+#if defined(OSQUERY_MEMORY_TAGS)
+  return true;
+#else
+  return false;
+#endif
+}
+
+void recordMemoryAllocation(MemoryTag tag, size_t size) {
+  auto& counters = kMemoryTagCounters[static_cast<size_t>(tag)];
+  counters.allocations.fetch_add(1, std::memory_order_relaxed);
+  auto live = counters.live.fetch_add(size, std::memory_order_relaxed) + size;
+  auto peak = counters.peak.load(std::memory_order_relaxed);
+  while (live > peak &&
+         !counters.peak.compare_exchange_weak(
+             peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+void recordMemoryFree(MemoryTag tag, size_t size) {
+  auto& counters = kMemoryTagCounters[static_cast<size_t>(tag)];
+  counters.live.fetch_sub(size, std::memory_order_relaxed);
+}
+
+std::vector<MemoryTagStats> getMemoryTagStats() {
+  std::vector<MemoryTagStats> stats;
+  for (size_t i = 0; i < kMemoryTags; i++) {
+    MemoryTagStats tag;
+    tag.tag = kMemoryTagNames[i];
+    tag.live_bytes = kMemoryTagCounters[i].live.load();
+    tag.peak_bytes = kMemoryTagCounters[i].peak.load();
+    tag.allocations = kMemoryTagCounters[i].allocations.load();
+    stats.push_back(std::move(tag));
+  }
+  return stats;
+}
+
+uint64_t getMemoryTagAllocations() {
+  uint64_t allocations = 0;
+  for (const auto& counters : kMemoryTagCounters) {
+    allocations += counters.allocations.load(std::memory_order_relaxed);
+  }
+  return allocations;
+}
+
+void checkMemoryTags(uint64_t limit) {
+  if (!isMemoryTagging() || limit == 0) {
+    return;
+  }
+
+  auto stats = getMemoryTagStats();
+  uint64_t live = 0;
+  for (const auto& tag : stats) {
+    live += tag.live_bytes;
+  }
+  if (live < limit / 10 * 8) {
+    return;
+  }
+
+  std::string usage;
+  for (const auto& tag : stats) {
+    usage += " " + tag.tag + "=" + std::to_string(tag.live_bytes);
+  }
+  LOG(WARNING) << "Tagged memory " << live << " bytes approaches the limit "
+               << limit << ":" << usage;
+}
+} // namespace osquery
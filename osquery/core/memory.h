@@ -0,0 +1,108 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/// The subsystem an allocation is attributed to.
+enum class MemoryTag : uint8_t {
+  UNTAGGED = 0,
+  SCHEDULER,
+  EVENTS,
+  DATABASE,
+  LOGGER,
+  EXTENSIONS,
+  TABLES,
+  CONFIG,
+};
+
+/// The number of memory tags, including UNTAGGED.
+const size_t kMemoryTags = 8;
+
+/// The accounting of a memory tag.
+struct MemoryTagStats {
+  /// The tag's name, such as "scheduler".
+  std::string tag;
+
+  /// Bytes allocated under the tag and not yet freed.
+  uint64_t live_bytes{0};
+
+  /// The most live bytes observed.
+  uint64_t peak_bytes{0};
+
+  /// The number of allocations made under the tag.
+  uint64_t allocations{0};
+};
+
+/**
+ * @brief Attribute the calling thread's allocations to a subsystem.
+ *
+ * Scopes nest, the innermost tag is used, and the previous tag is restored
+ * when the scope ends. Memory is attributed to the tag it was allocated with,
+ * even when another thread frees it.
+ *
+ * Allocations are only counted when osquery is built with the
+ * OSQUERY_MEMORY_TAGS environment variable set, which replaces the global
+ * operator new. Otherwise scopes only set a thread local.
+ */
+class MemoryTagScope : private boost::noncopyable {
+ public:
+  explicit MemoryTagScope(MemoryTag tag);
+  ~MemoryTagScope();
+
+ private:
+  MemoryTag previous_;
+};
+
+/// The calling thread's memory tag.
+MemoryTag getMemoryTag();
+
+/// Check if allocations are counted, see OSQUERY_MEMORY_TAGS.
+bool isMemoryTagging();
+
+/// Count an allocation, called by the replaced operator new.
+void recordMemoryAllocation(MemoryTag tag, size_t size);
+
+/// Count a free, called by the replaced operator delete.
+void recordMemoryFree(MemoryTag tag, size_t size);
+
+/// The accounting of every tag, in the order of MemoryTag.
+std::vector<MemoryTagStats> getMemoryTagStats();
+
+/// The number of allocations made under every tag.
+uint64_t getMemoryTagAllocations();
+
+/**
+ * @brief Log the live bytes of each tag if they approach a limit.
+ *
+ * The watchdog runs in another process and only observes the worker's
+ * footprint. The worker logs a warning with its tagged usage when the tagged
+ * live bytes exceed 80% of the limit, such that a later memory limit restart
+ * can be attributed to a subsystem.
+ *
+ * @param limit The watchdog memory limit in bytes, 0 for no limit.
+ */
+void checkMemoryTags(uint64_t limit);
+} // namespace osquery
+
+#if defined(OSQUERY_MEMORY_TAGS)
+#define MEMORY_TAG(tag)                                                        \
+  ::osquery::MemoryTagScope memory_tag_scope_(::osquery::MemoryTag::tag)
+#else
+#define MEMORY_TAG(tag)
+#endif
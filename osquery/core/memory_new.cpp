@@ -0,0 +1,100 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+// The global allocation functions are replaced only for memory tag builds.
+// This unit defines nothing else, such that it is only linked when used.
+#if defined(OSQUERY_MEMORY_TAGS)
+
+#include <cstdlib>
+#include <new>
+
+#include "osquery/core/memory.h"
+
+namespace {
+
+/// Each allocation is prefixed with its size and tag, keeping its alignment.
+struct alignas(16) MemoryTagHeader {
+  size_t size;
+  osquery::MemoryTag tag;
+};
+
+void* taggedAllocate(std::size_t size) noexcept {
+  auto* header = static_cast<MemoryTagHeader*>(
+      std::malloc(sizeof(MemoryTagHeader) + size));
+  if (header == nullptr) {
+    return nullptr;
+  }
+
+  header->size = size;
+  header->tag = osquery::getMemoryTag();
+  osquery::recordMemoryAllocation(header->tag, size);
+  return header + 1;
+}
+
+void taggedFree(void* p) noexcept {
+  if (p == nullptr) {
+    return;
+  }
+
+  auto* header = static_cast<MemoryTagHeader*>(p) - 1;
+  osquery::recordMemoryFree(header->tag, header->size);
+  std::free(header);
+}
+
+void* taggedNew(std::size_t size) {
+  auto* p = taggedAllocate(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+} // namespace
+
+void* operator new(std::size_t size) {
+  return taggedNew(size);
+}
+
+void* operator new[](std::size_t size) {
+  return taggedNew(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return taggedAllocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return taggedAllocate(size);
+}
+
+void operator delete(void* p) noexcept {
+  taggedFree(p);
+}
+
+void operator delete[](void* p) noexcept {
+  taggedFree(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  taggedFree(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  taggedFree(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  taggedFree(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  taggedFree(p);
+}
+
+#endif
@@ -0,0 +1,138 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <mutex>
+
+#include "osquery/core/metrics.h"
+
+namespace osquery {
+
+/// Metrics are registered during static initialization of other units.
+struct MetricRegistry {
+  std::mutex mutex;
+  std::vector<const Metric*> metrics;
+  std::vector<const MetricHistogram*> histograms;
+};
+
+static MetricRegistry& getMetricRegistry() {
+  static MetricRegistry registry;
+  return registry;
+}
+
+Metric::Metric(const char* name, const char* help, Type type)
+    : name_(name), help_(help), type_(type) {
+  auto& registry = getMetricRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.metrics.push_back(this);
+}
+
+MetricHistogram::MetricHistogram(const char* name, const char* help)
+    : name_(name), help_(help) {
+  auto& registry = getMetricRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.histograms.push_back(this);
+}
+
+void MetricHistogram::observe(uint64_t value) {
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  size_t bucket = 0;
+  while (value > 0 && bucket < kBuckets - 1) {
+    value >>= 1;
+    bucket++;
+  }
+  counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<const Metric*> getMetrics() {
+  auto& registry = getMetricRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  return registry.metrics;
+}
+
+std::vector<const MetricHistogram*> getMetricHistograms() {
+  auto& registry = getMetricRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  return registry.histograms;
+}
+
+uint64_t getMetricValue(const std::string& name) {
+  for (const auto& metric : getMetrics()) {
+    if (name == metric->name()) {
+      return metric->value();
+    }
+  }
+  return 0;
+}
+
+static std::string escapeMetricLabel(const std::string& value) {
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (const auto& c : value) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+void MetricsText::family(const std::string& name,
+                         const std::string& type,
+                         const std::string& help) {
+  text_ += "# HELP " + name + " " + help + "\n";
+  text_ += "# TYPE " + name + " " + type + "\n";
+}
+
+void MetricsText::sample(const std::string& name,
+                         const MetricLabels& labels,
+                         uint64_t value) {
+  text_ += name;
+  if (!labels.empty()) {
+    text_ += '{';
+    for (size_t i = 0; i < labels.size(); i++) {
+      if (i > 0) {
+        text_ += ',';
+      }
+      text_ += labels[i].first + "=\"" + escapeMetricLabel(labels[i].second) +
+               "\"";
+    }
+    text_ += '}';
+  }
+  text_ += " " + std::to_string(value) + "\n";
+}
+
+void MetricsText::add(const Metric& metric) {
+  family(metric.name(),
+         (metric.type() == Metric::COUNTER) ? "counter" : "gauge",
+         metric.help());
+  sample(metric.name(), metric.value());
+}
+
+void MetricsText::add(const MetricHistogram& histogram) {
+  std::string name = histogram.name();
+  family(name, "histogram", histogram.help());
+
+  // Prometheus buckets are cumulative, bounded by their largest value.
+  uint64_t count = 0;
+  for (size_t i = 0; i < MetricHistogram::kBuckets - 1; i++) {
+    count += histogram.bucket(i);
+    auto le = (i == 0) ? 0 : (1ULL << i) - 1;
+    sample(name + "_bucket", {{"le", std::to_string(le)}}, count);
+  }
+  count += histogram.bucket(MetricHistogram::kBuckets - 1);
+  sample(name + "_bucket", {{"le", "+Inf"}}, count);
+  sample(name + "_sum", histogram.sum());
+  sample(name + "_count", count);
+}
+} // namespace osquery
@@ -0,0 +1,158 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/// Label names and values of a metric sample.
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * @brief A process-wide counter or gauge, exported with --metrics_path.
+ *
+ * Metrics are static objects declared next to the code they measure, and
+ * register themselves when constructed. Updates are relaxed atomic
+ * operations, so hot paths do not take locks.
+ */
+class Metric : private boost::noncopyable {
+ public:
+  enum Type {
+    COUNTER,
+    GAUGE,
+  };
+
+  Metric(const char* name, const char* help, Type type = COUNTER);
+
+  void add(uint64_t value = 1) {
+    value_.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void set(uint64_t value) {
+    value_.store(value, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+  const char* name() const {
+    return name_;
+  }
+
+  const char* help() const {
+    return help_;
+  }
+
+  Type type() const {
+    return type_;
+  }
+
+ private:
+  const char* name_;
+  const char* help_;
+  Type type_;
+  std::atomic<uint64_t> value_{0};
+};
+
+/**
+ * @brief A process-wide histogram of power of two buckets.
+ *
+ * Bucket 0 counts values of 0 and bucket N counts values in [2^(N-1), 2^N),
+ * the last bucket also counts every larger value.
+ */
+class MetricHistogram : private boost::noncopyable {
+ public:
+  static const size_t kBuckets = 24;
+
+  MetricHistogram(const char* name, const char* help);
+
+  /// Count an observed value.
+  void observe(uint64_t value);
+
+  /// The count of a bucket.
+  uint64_t bucket(size_t i) const {
+    return counts_[i].load(std::memory_order_relaxed);
+  }
+
+  uint64_t sum() const {
+    return sum_.load(std::memory_order_relaxed);
+  }
+
+  const char* name() const {
+    return name_;
+  }
+
+  const char* help() const {
+    return help_;
+  }
+
+ private:
+  const char* name_;
+  const char* help_;
+  std::array<std::atomic<uint64_t>, kBuckets> counts_{};
+  std::atomic<uint64_t> sum_{0};
+};
+
+/// The registered metrics, in the order they were constructed.
+std::vector<const Metric*> getMetrics();
+
+/// The registered histograms, in the order they were constructed.
+std::vector<const MetricHistogram*> getMetricHistograms();
+
+/// The value of a registered metric, 0 if no metric uses the name.
+uint64_t getMetricValue(const std::string& name);
+
+/**
+ * @brief Build the Prometheus text exposition format.
+ *
+ * Each family is started with its HELP and TYPE lines, followed by its
+ * samples. Label values are escaped.
+ */
+class MetricsText {
+ public:
+  /// Start a metric family, type is "counter", "gauge", or "histogram".
+  void family(const std::string& name,
+              const std::string& type,
+              const std::string& help);
+
+  /// Add a sample to the current family.
+  void sample(const std::string& name,
+              const MetricLabels& labels,
+              uint64_t value);
+
+  void sample(const std::string& name, uint64_t value) {
+    sample(name, {}, value);
+  }
+
+  /// Add a registered metric as its own family.
+  void add(const Metric& metric);
+
+  /// Add a registered histogram as its own family.
+  void add(const MetricHistogram& histogram);
+
+  const std::string& str() const {
+    return text_;
+  }
+
+ private:
+  std::string text_;
+};
+} // namespace osquery
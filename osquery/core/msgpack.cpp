@@ -0,0 +1,348 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <cstring>
+#include <set>
+
+#include <osquery/flags.h>
+
+#include "osquery/core/msgpack.h"
+
+namespace osquery {
+
+DECLARE_string(logger_format);
+DECLARE_bool(decorations_top_level);
+
+const std::string kLoggerFormatMessagePack = "msgpack";
+
+bool loggerUsesMessagePack() {
+  return FLAGS_logger_format == kLoggerFormatMessagePack;
+}
+
+void MessagePackWriter::bigEndian(uint64_t value, size_t bytes) {
+  for (size_t i = bytes; i > 0; i--) {
+    output_.push_back(static_cast<char>((value >> ((i - 1) * 8)) & 0xff));
+  }
+}
+
+void MessagePackWriter::header(uint8_t fix,
+                               uint8_t fix_max,
+                               uint8_t code,
+                               size_t size) {
+  // The 8, 16, and 32-bit size codes are consecutive, maps and arrays do not
+  // have an 8-bit size and start at the 16-bit code.
+  if (size <= fix_max) {
+    output_.push_back(static_cast<char>(fix | size));
+  } else if (code == 0xd9 && size <= 0xff) {
+    output_.push_back(static_cast<char>(code));
+    bigEndian(size, 1);
+  } else if (size <= 0xffff) {
+    output_.push_back(static_cast<char>((code == 0xd9) ? code + 1 : code));
+    bigEndian(size, 2);
+  } else {
+    output_.push_back(static_cast<char>((code == 0xd9) ? code + 2 : code + 1));
+    bigEndian(size, 4);
+  }
+}
+
+void MessagePackWriter::nil() {
+  output_.push_back(static_cast<char>(0xc0));
+}
+
+void MessagePackWriter::integer(uint64_t value) {
+  if (value < 0x80) {
+    output_.push_back(static_cast<char>(value));
+  } else if (value <= 0xff) {
+    output_.push_back(static_cast<char>(0xcc));
+    bigEndian(value, 1);
+  } else if (value <= 0xffff) {
+    output_.push_back(static_cast<char>(0xcd));
+    bigEndian(value, 2);
+  } else if (value <= 0xffffffff) {
+    output_.push_back(static_cast<char>(0xce));
+    bigEndian(value, 4);
+  } else {
+    output_.push_back(static_cast<char>(0xcf));
+    bigEndian(value, 8);
+  }
+}
+
+void MessagePackWriter::string(const std::string& value) {
+  header(0xa0, 31, 0xd9, value.size());
+  output_.append(value);
+}
+
+void MessagePackWriter::string(const char* value) {
+  auto size = strlen(value);
+  header(0xa0, 31, 0xd9, size);
+  output_.append(value, size);
+}
+
+void MessagePackWriter::array(size_t size) {
+  header(0x90, 15, 0xdc, size);
+}
+
+void MessagePackWriter::map(size_t size) {
+  header(0x80, 15, 0xde, size);
+}
+
+/// Reserve the record's length, the record is written after it.
+static inline size_t startRecord(std::string& record) {
+  auto start = record.size();
+  record.append(4, '\0');
+  return start;
+}
+
+/// Complete a record by writing its length.
+static inline void finishRecord(size_t start, std::string& record) {
+  auto size = record.size() - start - 4;
+  for (size_t i = 0; i < 4; i++) {
+    record[start + i] = static_cast<char>((size >> ((3 - i) * 8)) & 0xff);
+  }
+}
+
+/// The number of map entries written by writeLegacyFields.
+static size_t countLegacyFields(const QueryLogItem& item) {
+  size_t count = 6;
+  if (!item.decorations.empty()) {
+    count += (FLAGS_decorations_top_level) ? item.decorations.size() : 1;
+  }
+  return count;
+}
+
+static void writeLegacyFields(MessagePackWriter& w, const QueryLogItem& item) {
+  w.string("name");
+  w.string(item.name);
+  w.string("hostIdentifier");
+  w.string(item.identifier);
+  w.string("calendarTime");
+  w.string(item.calendar_time);
+  w.string("unixTime");
+  w.integer(item.time);
+  w.string("epoch");
+  w.integer(item.epoch);
+  w.string("counter");
+  w.integer(item.counter);
+
+  if (item.decorations.empty()) {
+    return;
+  }
+
+  if (!FLAGS_decorations_top_level) {
+    w.string("decorations");
+    w.map(item.decorations.size());
+  }
+  for (const auto& decoration : item.decorations) {
+    w.string(decoration.first);
+    w.string(decoration.second);
+  }
+}
+
+static void writeRows(MessagePackWriter& w,
+                      const std::vector<std::string>& columns,
+                      const QueryData& q) {
+  w.array(q.size());
+  for (const auto& r : q) {
+    w.array(columns.size());
+    for (const auto& column : columns) {
+      auto value = r.find(column);
+      if (value == r.end()) {
+        w.nil();
+      } else {
+        w.string(value->second);
+      }
+    }
+  }
+}
+
+Status serializeQueryLogItemMessagePack(const QueryLogItem& item,
+                                        std::string& record) {
+  bool diff = !item.results.added.empty() || !item.results.removed.empty();
+
+  // Name each column once, rows may have different columns.
+  std::set<std::string> names;
+  auto addNames = [&names](const QueryData& q) {
+    for (const auto& r : q) {
+      for (const auto& column : r) {
+        names.insert(column.first);
+      }
+    }
+  };
+  if (diff) {
+    addNames(item.results.removed);
+    addNames(item.results.added);
+  } else {
+    addNames(item.snapshot_results);
+  }
+  std::vector<std::string> columns(names.begin(), names.end());
+
+  auto start = startRecord(record);
+  MessagePackWriter w(record);
+  w.map(countLegacyFields(item) + ((diff) ? 2 : 3));
+  writeLegacyFields(w, item);
+  w.string("columns");
+  w.array(columns.size());
+  for (const auto& column : columns) {
+    w.string(column);
+  }
+
+  if (diff) {
+    w.string("diffResults");
+    w.map(2);
+    w.string("removed");
+    writeRows(w, columns, item.results.removed);
+    w.string("added");
+    writeRows(w, columns, item.results.added);
+  } else {
+    w.string("snapshot");
+    writeRows(w, columns, item.snapshot_results);
+    w.string("action");
+    w.string("snapshot");
+  }
+  finishRecord(start, record);
+  return Status(0, "OK");
+}
+
+static void writeEvents(const QueryLogItem& item,
+                        const QueryData& q,
+                        const char* action,
+                        std::vector<std::string>& records) {
+  for (const auto& r : q) {
+    records.emplace_back();
+    auto& record = records.back();
+    auto start = startRecord(record);
+
+    MessagePackWriter w(record);
+    w.map(countLegacyFields(item) + 2);
+    writeLegacyFields(w, item);
+    w.string("columns");
+    w.map(r.size());
+    for (const auto& column : r) {
+      w.string(column.first);
+      w.string(column.second);
+    }
+    w.string("action");
+    w.string(action);
+    finishRecord(start, record);
+  }
+}
+
+Status serializeQueryLogItemAsEventsMessagePack(
+    const QueryLogItem& item, std::vector<std::string>& records) {
+  if (!item.results.added.empty() || !item.results.removed.empty()) {
+    writeEvents(item, item.results.removed, "removed", records);
+    writeEvents(item, item.results.added, "added", records);
+  } else if (!item.snapshot_results.empty()) {
+    writeEvents(item, item.snapshot_results, "snapshot", records);
+  } else {
+    return Status(1, "No diff results or snapshot results");
+  }
+  return Status(0, "OK");
+}
+
+void serializeEventMessagePack(const std::string& table,
+                               uint32_t schema,
+                               const std::vector<std::string>& columns,
+                               const Row& r,
+                               std::string& record) {
+  size_t known = 0;
+  for (const auto& column : columns) {
+    known += r.count(column);
+  }
+  size_t extra = r.size() - known;
+
+  auto start = startRecord(record);
+  MessagePackWriter w(record);
+  w.map((extra > 0) ? 4 : 3);
+  w.string("name");
+  w.string(table);
+  w.string("schema");
+  w.integer(schema);
+  w.string("values");
+  w.array(columns.size());
+  for (const auto& column : columns) {
+    auto value = r.find(column);
+    if (value == r.end()) {
+      w.nil();
+    } else {
+      w.string(value->second);
+    }
+  }
+
+  if (extra > 0) {
+    std::set<std::string> named(columns.begin(), columns.end());
+    w.string("extra");
+    w.map(extra);
+    for (const auto& column : r) {
+      if (named.count(column.first) == 0) {
+        w.string(column.first);
+        w.string(column.second);
+      }
+    }
+  }
+  finishRecord(start, record);
+}
+
+/// Read the size following a MessagePack str, array, or map type code.
+static bool readSize(const std::string& record,
+                     size_t& pos,
+                     uint8_t fix,
+                     uint8_t fix_mask,
+                     uint8_t code,
+                     size_t& size) {
+  if (pos >= record.size()) {
+    return false;
+  }
+
+  auto type = static_cast<uint8_t>(record[pos++]);
+  if ((type & ~fix_mask) == fix) {
+    size = type & fix_mask;
+    return true;
+  }
+
+  // Strings have an 8-bit size code, maps and arrays start at 16-bits.
+  size_t bytes = 0;
+  if (code == 0xd9) {
+    bytes = (type == 0xd9) ? 1 : (type == 0xda) ? 2 : (type == 0xdb) ? 4 : 0;
+  } else {
+    bytes = (type == code) ? 2 : (type == code + 1) ? 4 : 0;
+  }
+  if (bytes == 0 || pos + bytes > record.size()) {
+    return false;
+  }
+
+  size = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    size = (size << 8) | static_cast<uint8_t>(record[pos++]);
+  }
+  return true;
+}
+
+std::string getMessagePackRecordName(const std::string& record) {
+  // Skip the record length, the "name" is the first key of every record.
+  size_t pos = 4;
+  size_t size = 0;
+  if (!readSize(record, pos, 0x80, 0x0f, 0xde, size) || size == 0) {
+    return "";
+  }
+
+  if (!readSize(record, pos, 0xa0, 0x1f, 0xd9, size) || size != 4 ||
+      record.compare(pos, 4, "name") != 0) {
+    return "";
+  }
+  pos += 4;
+
+  if (!readSize(record, pos, 0xa0, 0x1f, 0xd9, size) ||
+      pos + size > record.size()) {
+    return "";
+  }
+  return record.substr(pos, size);
+}
+} // namespace osquery
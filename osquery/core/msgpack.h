@@ -0,0 +1,93 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <osquery/query.h>
+
+namespace osquery {
+
+/// The logger_format value for length-delimited MessagePack records.
+extern const std::string kLoggerFormatMessagePack;
+
+/// Check if results and forwarded events are logged as MessagePack records.
+bool loggerUsesMessagePack();
+
+/**
+ * @brief Append MessagePack values to a string.
+ *
+ * Only the types used by osquery's result logs are provided. Maps and arrays
+ * are written with their size, followed by the elements (and keys).
+ */
+class MessagePackWriter {
+ public:
+  explicit MessagePackWriter(std::string& output) : output_(output) {}
+
+  void nil();
+
+  void integer(uint64_t value);
+
+  void string(const std::string& value);
+
+  void string(const char* value);
+
+  void array(size_t size);
+
+  void map(size_t size);
+
+ private:
+  void header(uint8_t fix, uint8_t fix_max, uint8_t code, size_t size);
+
+  void bigEndian(uint64_t value, size_t bytes);
+
+ private:
+  std::string& output_;
+};
+
+/**
+ * @brief Serialize a QueryLogItem as a length-delimited MessagePack record.
+ *
+ * Each record is a 4-byte big-endian length followed by a MessagePack map.
+ * The map has the same keys as serializeQueryLogItemJSON, integers are not
+ * strings, and a "columns" array names the row values once per record. Rows
+ * are arrays of values in column order, nil if a row does not have a column.
+ * The "name" is the first key of every record.
+ */
+Status serializeQueryLogItemMessagePack(const QueryLogItem& item,
+                                        std::string& record);
+
+/**
+ * @brief Serialize a QueryLogItem as length-delimited MessagePack events.
+ *
+ * Each event is a map with the same keys as the JSON events.
+ */
+Status serializeQueryLogItemAsEventsMessagePack(
+    const QueryLogItem& item, std::vector<std::string>& records);
+
+/**
+ * @brief Serialize a forwarded event row as a length-delimited record.
+ *
+ * The "values" are ordered by the table's columns, which are identified by
+ * the "schema" hash of the subscriber's EventRowCodec. Values for columns
+ * outside the table schema are included in an "extra" map.
+ */
+void serializeEventMessagePack(const std::string& table,
+                               uint32_t schema,
+                               const std::vector<std::string>& columns,
+                               const Row& r,
+                               std::string& record);
+
+/// Read the "name" of a record, empty if the record is malformed.
+std::string getMessagePackRecordName(const std::string& record);
+} // namespace osquery
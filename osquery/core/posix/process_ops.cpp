@@ -8,10 +8,15 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <atomic>
 #include <string>
 
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <sys/resource.h>
 #include <sys/syscall.h>
@@ -19,6 +24,17 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#if defined(__APPLE__)
+#include <libproc.h>
+#include <mach/mach.h>
+#elif defined(__FreeBSD__)
+#include <sys/sysctl.h>
+#include <sys/user.h>
+#elif defined(__linux__)
+#include <linux/perf_event.h>
+#include <sched.h>
+#endif
+
 #include <boost/optional.hpp>
 
 #include <osquery/flags.h>
@@ -79,6 +95,53 @@ void setToBackgroundPriority() {
   setpriority(PRIO_PGRP, 0, 10);
 }
 
+#if defined(__linux__)
+/// The idle I/O class, see ioprio_set(2).
+const int kIOPrioIdle = 3 << 13;
+
+/// ioprio_set(2) applies to the calling thread with IOPRIO_WHO_PROCESS, 0.
+const int kIOPrioWhoThread = 1;
+#endif
+
+BackgroundPriorityGuard::BackgroundPriorityGuard(bool background) {
+  if (!background) {
+    return;
+  }
+
+  background_ = true;
+#if defined(__linux__)
+  io_ = static_cast<int>(syscall(SYS_ioprio_get, kIOPrioWhoThread, 0));
+  syscall(SYS_ioprio_set, kIOPrioWhoThread, 0, kIOPrioIdle);
+
+  cpu_ = sched_getscheduler(0);
+  struct sched_param param = {};
+  sched_setscheduler(0, SCHED_BATCH, &param);
+#elif defined(__APPLE__)
+  io_ = getiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD);
+  setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, IOPOL_THROTTLE);
+#endif
+}
+
+BackgroundPriorityGuard::~BackgroundPriorityGuard() {
+  if (!background_) {
+    return;
+  }
+
+#if defined(__linux__)
+  if (io_ >= 0) {
+    syscall(SYS_ioprio_set, kIOPrioWhoThread, 0, io_);
+  }
+  if (cpu_ >= 0) {
+    struct sched_param param = {};
+    sched_setscheduler(0, cpu_, &param);
+  }
+#elif defined(__APPLE__)
+  if (io_ >= 0) {
+    setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, io_);
+  }
+#endif
+}
+
 // Helper function to determine if thread is running with admin privilege.
 bool isUserAdmin() {
   return getuid() == 0;
@@ -91,4 +154,203 @@ int platformGetPid() {
 int platformGetTid() {
   return std::hash<std::thread::id>()(std::this_thread::get_id());
 }
+
+#if defined(__linux__)
+Status getProcessUsage(pid_t pid, ProcessUsage& usage) {
+  auto path = "/proc/" + std::to_string(pid) + "/stat";
+  auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(1, "Cannot open process stat");
+  }
+
+  char content[1024];
+  auto size = ::read(fd, content, sizeof(content) - 1);
+  ::close(fd);
+  if (size <= 0) {
+    return Status(1, "Cannot read process stat");
+  }
+  content[size] = '\0';
+
+  // Fields follow the parenthesized process name, which may include spaces.
+  auto fields = strrchr(content, ')');
+  if (fields == nullptr) {
+    return Status(1, "Invalid process stat");
+  }
+
+  char state = 0;
+  long long parent = 0;
+  unsigned long long user_time = 0;
+  unsigned long long system_time = 0;
+  long long pages = 0;
+  auto count = sscanf(fields + 1,
+                      " %c %lld %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
+                      " %*d %*d %*d %*d %*d %*d %*u %*u %lld",
+                      &state,
+                      &parent,
+                      &user_time,
+                      &system_time,
+                      &pages);
+  if (count != 5) {
+    return Status(1, "Invalid process stat");
+  }
+
+  // CPU times are reported in clock ticks, and memory in pages.
+  usage.parent = static_cast<pid_t>(parent);
+  usage.user_time = user_time;
+  usage.system_time = system_time;
+  usage.resident_size = static_cast<uint64_t>(pages) * ::getpagesize();
+  return Status(0, "OK");
+}
+#elif defined(__APPLE__)
+Status getProcessUsage(pid_t pid, ProcessUsage& usage) {
+  struct rusage_info_v2 info;
+  if (proc_pid_rusage(pid, RUSAGE_INFO_V2, (rusage_info_t*)&info) != 0) {
+    return Status(1, "Cannot read process usage");
+  }
+
+  struct proc_bsdshortinfo bsd;
+  if (proc_pidinfo(pid, PROC_PIDT_SHORTBSDINFO, 1, &bsd, sizeof(bsd)) !=
+      sizeof(bsd)) {
+    return Status(1, "Cannot read process parent");
+  }
+
+  // CPU times are reported in nanoseconds.
+  usage.parent = static_cast<pid_t>(bsd.pbsi_ppid);
+  usage.user_time = info.ri_user_time / 1000000;
+  usage.system_time = info.ri_system_time / 1000000;
+  usage.resident_size = info.ri_resident_size;
+  return Status(0, "OK");
+}
+#elif defined(__FreeBSD__)
+Status getProcessUsage(pid_t pid, ProcessUsage& usage) {
+  int mib[4] = {CTL_KERN, KERN_PROC, KERN_PROC_PID, pid};
+  struct kinfo_proc proc;
+  size_t size = sizeof(proc);
+  if (::sysctl(mib, 4, &proc, &size, nullptr, 0) != 0 || size == 0) {
+    return Status(1, "Cannot read process usage");
+  }
+
+  usage.parent = proc.ki_ppid;
+  usage.user_time = proc.ki_rusage.ru_utime.tv_sec;
+  usage.system_time = proc.ki_rusage.ru_stime.tv_sec;
+  usage.resident_size = static_cast<uint64_t>(proc.ki_rssize) * getpagesize();
+  return Status(0, "OK");
+}
+#endif
+
+#if defined(__APPLE__)
+Status getThreadUsage(ThreadUsage& usage) {
+  struct thread_basic_info info;
+  mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+  auto thread = mach_thread_self();
+  auto result =
+      thread_info(thread, THREAD_BASIC_INFO, (thread_info_t)&info, &count);
+  mach_port_deallocate(mach_task_self(), thread);
+  if (result != KERN_SUCCESS) {
+    return Status(1, "Cannot read thread usage");
+  }
+
+  usage.user_time = static_cast<uint64_t>(info.user_time.seconds) * 1000000 +
+                    info.user_time.microseconds;
+  usage.system_time =
+      static_cast<uint64_t>(info.system_time.seconds) * 1000000 +
+      info.system_time.microseconds;
+  return Status(0, "OK");
+}
+#else
+Status getThreadUsage(ThreadUsage& usage) {
+  struct rusage ru;
+  if (::getrusage(RUSAGE_THREAD, &ru) != 0) {
+    return Status(1, "Cannot read thread usage");
+  }
+
+  usage.user_time =
+      static_cast<uint64_t>(ru.ru_utime.tv_sec) * 1000000 + ru.ru_utime.tv_usec;
+  usage.system_time =
+      static_cast<uint64_t>(ru.ru_stime.tv_sec) * 1000000 + ru.ru_stime.tv_usec;
+  return Status(0, "OK");
+}
+#endif
+
+#if defined(__linux__)
+/// Hardware events of ThreadCounters, in the order of the descriptors.
+static const std::vector<uint64_t> kThreadCounterEvents = {
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_CACHE_MISSES,
+};
+
+/// Set when perf events are denied, such that each query does not retry.
+static std::atomic<bool> kThreadCountersDenied{false};
+
+static int openThreadCounter(uint64_t event) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = event;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  // Count the calling thread on any CPU.
+  auto fd = ::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd < 0 && (errno == EACCES || errno == EPERM || errno == ENOSYS)) {
+    kThreadCountersDenied = true;
+  }
+  return static_cast<int>(fd);
+}
+
+static void readThreadRusage(ThreadCounters& counters) {
+  struct rusage ru;
+  if (::getrusage(RUSAGE_THREAD, &ru) == 0) {
+    counters.context_switches = ru.ru_nvcsw + ru.ru_nivcsw;
+    counters.major_faults = ru.ru_majflt;
+    counters.minor_faults = ru.ru_minflt;
+  }
+}
+
+ThreadCounterScope::ThreadCounterScope() {
+  for (const auto& event : kThreadCounterEvents) {
+    events_.push_back((kThreadCountersDenied) ? -1 : openThreadCounter(event));
+  }
+  readThreadRusage(start_);
+}
+
+ThreadCounterScope::~ThreadCounterScope() {
+  for (auto fd : events_) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+}
+
+Status ThreadCounterScope::read(ThreadCounters& counters) const {
+  std::vector<uint64_t> values;
+  for (auto fd : events_) {
+    uint64_t value = 0;
+    if (fd < 0 || ::read(fd, &value, sizeof(value)) != sizeof(value)) {
+      value = 0;
+    }
+    values.push_back(value);
+  }
+  counters.instructions = values[0];
+  counters.cycles = values[1];
+  counters.cache_misses = values[2];
+
+  ThreadCounters now;
+  readThreadRusage(now);
+  counters.context_switches = now.context_switches - start_.context_switches;
+  counters.major_faults = now.major_faults - start_.major_faults;
+  counters.minor_faults = now.minor_faults - start_.minor_faults;
+  return Status(0, "OK");
+}
+#else
+ThreadCounterScope::ThreadCounterScope() {}
+
+ThreadCounterScope::~ThreadCounterScope() {}
+
+Status ThreadCounterScope::read(ThreadCounters& counters) const {
+  return Status(1, "Thread counters are not supported");
+}
+#endif
 }
@@ -14,6 +14,7 @@
 #include <memory>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 #include <boost/optional.hpp>
@@ -271,6 +272,110 @@ bool isLauncherProcessDead(PlatformProcess& launcher);
 /// Sets the current process to run with background scheduling priority.
 void setToBackgroundPriority();
 
+/**
+ * @brief Run the calling thread with background CPU and I/O priority.
+ *
+ * Heavy work, such as hashing, carving, and queries with the `background`
+ * option, yields the disk and CPU to event publishers that must keep up with
+ * the kernel. On Linux the thread uses the idle I/O class and SCHED_BATCH,
+ * on macOS throttled disk I/O, and on Windows background processing mode.
+ *
+ * The thread's previous priority is restored when the guard is destroyed.
+ */
+class BackgroundPriorityGuard : private boost::noncopyable {
+ public:
+  explicit BackgroundPriorityGuard(bool background = true);
+  ~BackgroundPriorityGuard();
+
+ private:
+  /// The priority was changed and is restored.
+  bool background_{false};
+
+  /// The thread's previous I/O priority and CPU scheduling policy.
+  int io_{-1};
+  int cpu_{-1};
+};
+
+/**
+ * @brief The CPU time and memory used by a process.
+ *
+ * Values use the units of the processes table on each platform, such that
+ * watchdog limits and query performance compare with previous values.
+ */
+struct ProcessUsage {
+  /// The parent process.
+  pid_t parent{0};
+
+  /// CPU time spent in user and kernel mode.
+  uint64_t user_time{0};
+  uint64_t system_time{0};
+
+  /// Resident memory in bytes.
+  uint64_t resident_size{0};
+};
+
+/**
+ * @brief Read the CPU time and memory used by a process.
+ *
+ * Unlike selecting from the processes table, only the accounting is read, not
+ * the process' paths and arguments. This is used to measure osquery itself.
+ */
+Status getProcessUsage(pid_t pid, ProcessUsage& usage);
+
+/// The CPU time used by a thread, in microseconds.
+struct ThreadUsage {
+  uint64_t user_time{0};
+  uint64_t system_time{0};
+};
+
+/**
+ * @brief Read the CPU time used by the calling thread.
+ *
+ * Work done concurrently by other threads, such as event publishers and
+ * loggers, is not included. This is used to attribute CPU to a query.
+ */
+Status getThreadUsage(ThreadUsage& usage);
+
+/// Hardware and scheduler event counts of a thread.
+struct ThreadCounters {
+  /// Retired instructions, CPU cycles, and last level cache misses.
+  uint64_t instructions{0};
+  uint64_t cycles{0};
+  uint64_t cache_misses{0};
+
+  /// Voluntary and involuntary context switches.
+  uint64_t context_switches{0};
+
+  /// Page faults that required, and did not require, IO.
+  uint64_t major_faults{0};
+  uint64_t minor_faults{0};
+};
+
+/**
+ * @brief Count hardware and scheduler events of the calling thread.
+ *
+ * On Linux the hardware counters use perf_event_open, and count user mode
+ * only such that an unprivileged process may use them. They are 0 when
+ * kernel.perf_event_paranoid or a virtual machine denies them. Context
+ * switches and faults are read from the thread's rusage. On Windows only the
+ * thread's cycles are counted. Other platforms do not support counters.
+ */
+class ThreadCounterScope : private boost::noncopyable {
+ public:
+  ThreadCounterScope();
+  ~ThreadCounterScope();
+
+  /// Read the counts since the scope started, on the same thread.
+  Status read(ThreadCounters& counters) const;
+
+ private:
+  /// Open perf event descriptors on Linux, -1 for denied events.
+  std::vector<int> events_;
+
+  /// Counters read when the scope started.
+  ThreadCounters start_;
+};
+
 /**
 * @brief Returns the current processes pid
 *
@@ -9,7 +9,10 @@
  */
 
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <osquery/database.h>
@@ -17,6 +20,7 @@
 #include <osquery/logger.h>
 #include <osquery/query.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
 
 namespace pt = boost::property_tree;
@@ -26,28 +30,592 @@ namespace osquery {
 
 DECLARE_bool(decorations_top_level);
 
-uint64_t Query::getPreviousEpoch() const {
-  uint64_t epoch = 0;
+/**
+ * @brief The header of stored results kept as row fingerprints.
+ *
+ * Each following line is a row fingerprint in hex, a space, and the row's JSON
+ * when removed rows may be reported. Lines are sorted by fingerprint. Stored
+ * results without this header are a legacy JSON array of rows.
+ */
+const std::string kQueryFingerprints{"fingerprints\n"};
+
+/**
+ * @brief The header of stored results kept as an index of chunked rows.
+ *
+ * The second line is the chunk generation and count. Each following line is
+ * a row fingerprint in hex, a space, and the 1-indexed chunk holding the row's
+ * JSON, or 0. Each chunk is stored at the query name, kQueryChunkKey, the
+ * generation, a '.', and the chunk, using the kQueryFingerprints line format.
+ */
+const std::string kQueryChunks{"chunks\n"};
+
+/**
+ * @brief The header of stored results compressed with zstd.
+ *
+ * The second line is the size of the kQueryFingerprints results, followed by
+ * the compressed frame.
+ */
+const std::string kQueryCompressed{"zstd\n"};
+
+/**
+ * @brief The header of the changes since a query's results were stored.
+ *
+ * Each following line is a '+' or '-', a row fingerprint in hex, a space, and
+ * the JSON of an added row. The delta is cumulative, it is replaced at each
+ * change and removed when the stored results are rewritten.
+ */
+const std::string kQueryDelta{"delta\n"};
+
+const std::string kQueryChunkKey{"#chunk."};
+
+const std::string kQueryMetadataKey{"#meta"};
+
+const std::string kQueryDeltaKey{"#delta"};
+
+/// Stored results of at least this size are compressed and may use a delta.
+const size_t kQueryCompressSize{4096};
+
+/// A stored row's fingerprint and the offset and size of its JSON.
+using StoredRow = std::pair<uint64_t, std::pair<size_t, size_t>>;
+
+uint64_t getRowFingerprint(const Row& r) {
+  // FNV-1a, the fingerprints are persisted and must be stable across builds.
+  uint64_t hash = 14695981039346656037ULL;
+  auto add = [&hash](const std::string& data) {
+    for (const auto& c : data) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ULL;
+    }
+    // Mix in the size, such that columns and values cannot shift.
+    hash ^= data.size();
+    hash *= 1099511628211ULL;
+  };
+
+  for (const auto& column : r) {
+    add(column.first);
+    add(column.second);
+  }
+  return hash;
+}
+
+static inline void appendStoredRow(uint64_t fingerprint,
+                                   const char* json,
+                                   size_t size,
+                                   std::string& stored) {
+  static const char kHex[] = "0123456789abcdef";
+  for (int shift = 60; shift >= 0; shift -= 4) {
+    stored.push_back(kHex[(fingerprint >> shift) & 0xf]);
+  }
+  stored.push_back(' ');
+  stored.append(json, size);
+  stored.push_back('\n');
+}
+
+static inline void appendStoredRow(uint64_t fingerprint,
+                                   const Row& r,
+                                   bool keep_rows,
+                                   std::string& stored) {
+  std::string json;
+  if (keep_rows) {
+    serializeRowJSONRJ(r, json);
+  }
+  appendStoredRow(fingerprint, json.data(), json.size(), stored);
+}
+
+static void parseStoredRows(const std::string& stored,
+                            std::vector<StoredRow>& rows,
+                            size_t pos) {
+  while (pos + 17 <= stored.size()) {
+    auto end = stored.find('\n', pos);
+    if (end == std::string::npos) {
+      end = stored.size();
+    }
+
+    auto fingerprint = strtoull(stored.c_str() + pos, nullptr, 16);
+    auto json = pos + 17;
+    rows.push_back(std::make_pair(
+        fingerprint, std::make_pair(json, (end > json) ? end - json : 0)));
+    pos = end + 1;
+  }
+
+  if (!std::is_sorted(rows.begin(), rows.end())) {
+    std::sort(rows.begin(), rows.end());
+  }
+}
+
+static void fingerprintRows(const QueryData& qd,
+                            std::vector<std::pair<uint64_t, size_t>>& rows) {
+  rows.reserve(qd.size());
+  for (size_t i = 0; i < qd.size(); ++i) {
+    rows.push_back(std::make_pair(getRowFingerprint(qd[i]), i));
+  }
+  std::sort(rows.begin(), rows.end());
+}
+
+static void storeRows(const QueryData& qd,
+                      bool keep_rows,
+                      std::string& stored) {
+  std::vector<std::pair<uint64_t, size_t>> rows;
+  fingerprintRows(qd, rows);
+  stored = kQueryFingerprints;
+  for (const auto& row : rows) {
+    appendStoredRow(row.first, qd[row.second], keep_rows, stored);
+  }
+}
+
+/**
+ * @brief Calculate a differential against stored row fingerprints.
+ *
+ * Only rows with a fingerprint missing from one side are materialized: added
+ * rows are moved out of current and removed rows are deserialized from their
+ * stored JSON. Unchanged rows reuse their stored JSON in the replacement.
+ *
+ * @return true if any row was added or removed.
+ */
+static bool diffStoredRows(const std::string& previous,
+                           QueryData& current,
+                           bool keep_rows,
+                           DiffResults& dr,
+                           std::string& stored) {
+  std::vector<StoredRow> old_rows;
+  parseStoredRows(previous, old_rows, kQueryFingerprints.size());
+  std::vector<std::pair<uint64_t, size_t>> new_rows;
+  fingerprintRows(current, new_rows);
+
+  std::vector<bool> added(current.size(), false);
+  bool changed = false;
+  stored = kQueryFingerprints;
+  stored.reserve(previous.size());
+
+  size_t i = 0;
+  size_t j = 0;
+  while (i < new_rows.size() || j < old_rows.size()) {
+    if (j == old_rows.size() ||
+        (i < new_rows.size() && new_rows[i].first < old_rows[j].first)) {
+      added[new_rows[i].second] = true;
+      appendStoredRow(
+          new_rows[i].first, current[new_rows[i].second], keep_rows, stored);
+      changed = true;
+      i++;
+    } else if (i == new_rows.size() || old_rows[j].first < new_rows[i].first) {
+      const auto& location = old_rows[j].second;
+      Row r;
+      if (location.second > 0 &&
+          deserializeRowJSONRJ(previous.substr(location.first, location.second),
+                               r)
+              .ok()) {
+        dr.removed.push_back(std::move(r));
+      }
+      changed = true;
+      j++;
+    } else {
+      const auto& location = old_rows[j].second;
+      if (keep_rows && location.second == 0) {
+        // The row was stored while removed rows were not reported.
+        appendStoredRow(
+            new_rows[i].first, current[new_rows[i].second], true, stored);
+      } else {
+        appendStoredRow(new_rows[i].first,
+                        previous.data() + location.first,
+                        (keep_rows) ? location.second : 0,
+                        stored);
+      }
+      i++;
+      j++;
+    }
+  }
+
+  // Added rows are reported in result order, removed rows in row order.
+  for (size_t k = 0; k < current.size(); ++k) {
+    if (added[k]) {
+      dr.added.push_back(std::move(current[k]));
+    }
+  }
+  std::sort(dr.removed.begin(), dr.removed.end());
+  return changed;
+}
+
+/// The metadata of a query, stored as the epoch, counter, and query text.
+struct QueryMetadata {
+  uint64_t epoch{0};
+
+  /// The counter of the previous execution, if the query was executed.
+  bool executed{false};
+
+  uint64_t counter{0};
+
+  std::string query;
+
+  /// True if the metadata is stored as separate epoch, counter, and query.
+  bool legacy{false};
+};
+
+/**
+ * @brief The metadata of each query read or written by this process.
+ *
+ * Results are diffed at each execution of a scheduled query, the mirror keeps
+ * the metadata reads of an execution from reaching the database. A query
+ * without metadata is mirrored too. The mirror is updated once a batch
+ * holding a query's metadata is written, see Query::invalidateMetadata.
+ */
+static std::unordered_map<std::string, QueryMetadata> kQueryMetadata;
+
+static Mutex kQueryMetadataMutex;
+
+static bool readQueryMetadata(const std::string& name, QueryMetadata& meta) {
   std::string raw;
-  auto status = getDatabaseValue(kQueries, name_ + "epoch", raw);
-  if (status.ok()) {
-    epoch = std::stoull(raw);
+  if (getDatabaseValue(kQueries, name + kQueryMetadataKey, raw).ok()) {
+    char* end = nullptr;
+    meta.epoch = strtoull(raw.c_str(), &end, 10);
+    meta.counter = strtoull(end, nullptr, 10);
+    meta.executed = true;
+    auto pos = raw.find('\n');
+    if (pos != std::string::npos) {
+      meta.query = raw.substr(pos + 1);
+    }
+    return true;
+  }
+
+  if (getDatabaseValue(kQueries, name + "epoch", raw).ok()) {
+    meta.epoch = strtoull(raw.c_str(), nullptr, 10);
+    meta.legacy = true;
+  }
+  if (getDatabaseValue(kQueries, name + "counter", raw).ok()) {
+    meta.counter = strtoull(raw.c_str(), nullptr, 10);
+    meta.executed = true;
+    meta.legacy = true;
+  }
+  if (getDatabaseValue(kQueries, "query." + name, meta.query).ok()) {
+    meta.legacy = true;
+  }
+  return meta.legacy;
+}
+
+/// Read a query's metadata, false if the query has none.
+static bool getQueryMetadata(const std::string& name, QueryMetadata& meta) {
+  {
+    ReadLock lock(kQueryMetadataMutex);
+    auto it = kQueryMetadata.find(name);
+    if (it != kQueryMetadata.end()) {
+      meta = it->second;
+      return meta.executed || meta.legacy;
+    }
+  }
+
+  auto stored = readQueryMetadata(name, meta);
+  WriteLock lock(kQueryMetadataMutex);
+  // A concurrent write of the metadata is mirrored already.
+  kQueryMetadata.emplace(name, meta);
+  return stored;
+}
+
+/// Replace a query's metadata, and remove the legacy keys.
+static void putQueryMetadata(const std::string& name,
+                             uint64_t epoch,
+                             uint64_t counter,
+                             const std::string& query,
+                             bool legacy,
+                             DatabaseBatch& batch) {
+  batch.put(kQueries,
+            name + kQueryMetadataKey,
+            std::to_string(epoch) + " " + std::to_string(counter) + "\n" +
+                query);
+  if (legacy) {
+    batch.remove(kQueries, name + "epoch");
+    batch.remove(kQueries, name + "counter");
+    batch.remove(kQueries, "query." + name);
   }
-  return epoch;
+}
+
+/// Write a batch holding metadata from putQueryMetadata, then mirror it.
+static Status writeQueryMetadata(const std::string& name,
+                                 uint64_t epoch,
+                                 uint64_t counter,
+                                 const std::string& query,
+                                 DatabaseBatch& batch) {
+  auto status = writeDatabaseBatch(batch);
+  WriteLock lock(kQueryMetadataMutex);
+  if (!status.ok()) {
+    // The batch may be partially written, read the metadata again.
+    kQueryMetadata.erase(name);
+    return status;
+  }
+
+  auto& meta = kQueryMetadata[name];
+  meta = QueryMetadata();
+  meta.epoch = epoch;
+  meta.executed = true;
+  meta.counter = counter;
+  meta.query = query;
+  return status;
+}
+
+void Query::invalidateMetadata(const std::string& name) {
+  WriteLock lock(kQueryMetadataMutex);
+  kQueryMetadata.erase(name);
+}
+
+uint64_t Query::getPreviousEpoch() const {
+  QueryMetadata meta;
+  getQueryMetadata(name_, meta);
+  return meta.epoch;
 }
 
 uint64_t Query::getQueryCounter(bool new_query) const {
-  uint64_t counter = 0;
   if (new_query) {
-    return counter;
+    return 0;
   }
 
-  std::string raw;
-  auto status = getDatabaseValue(kQueries, name_ + "counter", raw);
-  if (status.ok()) {
-    counter = std::stoull(raw) + 1;
+  QueryMetadata meta;
+  getQueryMetadata(name_, meta);
+  return (meta.executed) ? meta.counter + 1 : 0;
+}
+
+static inline bool isStoredFormat(const std::string& stored,
+                                  const std::string& header) {
+  return stored.compare(0, header.size(), header) == 0;
+}
+
+/// True if the results are stored inline, and may have a delta.
+static inline bool isInlineFormat(const std::string& stored) {
+  return isStoredFormat(stored, kQueryFingerprints) ||
+         isStoredFormat(stored, kQueryCompressed);
+}
+
+/// Read inline stored results, without their delta, as kQueryFingerprints.
+static Status decodeStoredRows(const std::string& raw, std::string& stored) {
+  if (!isStoredFormat(raw, kQueryCompressed)) {
+    stored = raw;
+    return Status(0, "OK");
+  }
+
+  auto pos = raw.find('\n', kQueryCompressed.size());
+  if (pos == std::string::npos) {
+    return Status(1, "Invalid compressed results");
+  }
+  auto size = static_cast<size_t>(
+      strtoull(raw.c_str() + kQueryCompressed.size(), nullptr, 10));
+  return decompressString(raw.substr(pos + 1), size, stored);
+}
+
+/// Compress kQueryFingerprints results of at least kQueryCompressSize.
+static void encodeStoredRows(std::string& stored) {
+  if (stored.size() < kQueryCompressSize) {
+    return;
+  }
+
+  std::string compressed;
+  if (compressString(stored, compressed).ok()) {
+    stored =
+        kQueryCompressed + std::to_string(stored.size()) + "\n" + compressed;
+  }
+}
+
+static inline bool getStoredDelta(const std::string& name,
+                                  std::string& delta) {
+  return getDatabaseValue(kQueries, name + kQueryDeltaKey, delta).ok() &&
+         isStoredFormat(delta, kQueryDelta);
+}
+
+/// Create the delta, see kQueryDelta, from stored results to current results.
+static std::string createDelta(const std::string& base,
+                               const std::string& current) {
+  std::vector<StoredRow> old_rows;
+  parseStoredRows(base, old_rows, kQueryFingerprints.size());
+  std::vector<StoredRow> new_rows;
+  parseStoredRows(current, new_rows, kQueryFingerprints.size());
+
+  std::string delta = kQueryDelta;
+  auto add = [&delta, &current](const StoredRow& row) {
+    delta.push_back('+');
+    appendStoredRow(row.first,
+                    current.data() + row.second.first,
+                    row.second.second,
+                    delta);
+  };
+  auto remove = [&delta](const StoredRow& row) {
+    delta.push_back('-');
+    appendStoredRow(row.first, "", 0, delta);
+  };
+
+  size_t i = 0;
+  size_t j = 0;
+  while (i < new_rows.size() || j < old_rows.size()) {
+    if (j == old_rows.size() ||
+        (i < new_rows.size() && new_rows[i].first < old_rows[j].first)) {
+      add(new_rows[i++]);
+    } else if (i == new_rows.size() || old_rows[j].first < new_rows[i].first) {
+      remove(old_rows[j++]);
+    } else {
+      // The row's stored JSON may differ if removed rows are now reported.
+      const auto& previous = old_rows[j].second;
+      const auto& next = new_rows[i].second;
+      if (base.compare(previous.first,
+                       previous.second,
+                       current,
+                       next.first,
+                       next.second) != 0) {
+        remove(old_rows[j]);
+        add(new_rows[i]);
+      }
+      i++;
+      j++;
+    }
+  }
+  return delta;
+}
+
+/// Apply a delta, see kQueryDelta, to kQueryFingerprints results.
+static void applyDelta(const std::string& delta, std::string& stored) {
+  std::vector<uint64_t> removed;
+  std::vector<StoredRow> added;
+  auto pos = kQueryDelta.size();
+  while (pos + 18 <= delta.size()) {
+    auto end = delta.find('\n', pos);
+    if (end == std::string::npos) {
+      end = delta.size();
+    }
+
+    auto fingerprint = strtoull(delta.c_str() + pos + 1, nullptr, 16);
+    if (delta[pos] == '-') {
+      removed.push_back(fingerprint);
+    } else {
+      auto json = pos + 18;
+      added.push_back(std::make_pair(
+          fingerprint, std::make_pair(json, (end > json) ? end - json : 0)));
+    }
+    pos = end + 1;
+  }
+  std::sort(removed.begin(), removed.end());
+  std::sort(added.begin(), added.end());
+
+  std::vector<StoredRow> rows;
+  parseStoredRows(stored, rows, kQueryFingerprints.size());
+  std::string result = kQueryFingerprints;
+  result.reserve(stored.size() + delta.size());
+
+  // Each removed fingerprint removes a single row, added rows stay sorted.
+  size_t r = 0;
+  size_t a = 0;
+  for (const auto& row : rows) {
+    for (; a < added.size() && added[a].first < row.first; ++a) {
+      appendStoredRow(added[a].first,
+                      delta.data() + added[a].second.first,
+                      added[a].second.second,
+                      result);
+    }
+    while (r < removed.size() && removed[r] < row.first) {
+      r++;
+    }
+    if (r < removed.size() && removed[r] == row.first) {
+      r++;
+      continue;
+    }
+    appendStoredRow(row.first,
+                    stored.data() + row.second.first,
+                    row.second.second,
+                    result);
+  }
+  for (; a < added.size(); ++a) {
+    appendStoredRow(added[a].first,
+                    delta.data() + added[a].second.first,
+                    added[a].second.second,
+                    result);
   }
-  return counter;
+  stored = std::move(result);
+}
+
+static inline std::string getChunkKey(const std::string& name,
+                                      size_t generation,
+                                      size_t chunk) {
+  return name + kQueryChunkKey + std::to_string(generation) + "." +
+         std::to_string(chunk);
+}
+
+/// Parse a chunk index, the fingerprint and chunk pairs are sorted.
+static void parseChunkIndex(const std::string& stored,
+                            size_t& generation,
+                            size_t& chunks,
+                            std::vector<std::pair<uint64_t, size_t>>* rows) {
+  char* end = nullptr;
+  auto pos = kQueryChunks.size();
+  generation = static_cast<size_t>(strtoull(stored.c_str() + pos, &end, 10));
+  chunks = static_cast<size_t>(strtoull(end, &end, 10));
+  pos = stored.find('\n', pos);
+  if (pos == std::string::npos || rows == nullptr) {
+    return;
+  }
+
+  pos++;
+  while (pos + 17 <= stored.size()) {
+    auto fingerprint = strtoull(stored.c_str() + pos, &end, 16);
+    auto chunk = static_cast<size_t>(strtoull(end, &end, 10));
+    rows->push_back(std::make_pair(fingerprint, chunk));
+    pos = stored.find('\n', pos);
+    if (pos == std::string::npos) {
+      break;
+    }
+    pos++;
+  }
+}
+
+static void deleteChunks(const std::string& name,
+                         size_t generation,
+                         size_t chunks,
+                         DatabaseBatch& batch) {
+  for (size_t chunk = 1; chunk <= chunks; ++chunk) {
+    batch.remove(kQueries, getChunkKey(name, generation, chunk));
+  }
+}
+
+/**
+ * @brief Read a query's stored results, of any format, as kQueryFingerprints.
+ *
+ * This materializes the entire previous result, streamed differentials only
+ * read the chunks holding removed rows.
+ */
+static Status readStoredRows(const std::string& name,
+                             const std::string& raw,
+                             std::string& stored) {
+  if (isInlineFormat(raw)) {
+    auto status = decodeStoredRows(raw, stored);
+    std::string delta;
+    if (status.ok() && getStoredDelta(name, delta)) {
+      applyDelta(delta, stored);
+    }
+    return status;
+  }
+
+  if (!isStoredFormat(raw, kQueryChunks)) {
+    // Results stored as a JSON array of rows.
+    QueryDataSet previous_qd;
+    auto status = deserializeQueryDataJSON(raw, previous_qd);
+    if (!status.ok()) {
+      return status;
+    }
+    QueryData previous(previous_qd.begin(), previous_qd.end());
+    storeRows(previous, true, stored);
+    return Status(0, "OK");
+  }
+
+  size_t generation = 0;
+  size_t chunks = 0;
+  std::vector<std::pair<uint64_t, size_t>> rows;
+  parseChunkIndex(raw, generation, chunks, &rows);
+  stored = kQueryFingerprints;
+  for (size_t chunk = 1; chunk <= chunks; ++chunk) {
+    std::string content;
+    getDatabaseValue(kQueries, getChunkKey(name, generation, chunk), content);
+    stored += content;
+  }
+
+  // Rows without stored JSON are only fingerprints.
+  for (const auto& row : rows) {
+    if (row.second == 0) {
+      appendStoredRow(row.first, "", 0, stored);
+    }
+  }
+  return Status(0, "OK");
 }
 
 Status Query::getPreviousQueryResults(QueryDataSet& results) const {
@@ -57,10 +625,30 @@ Status Query::getPreviousQueryResults(QueryDataSet& results) const {
     return status;
   }
 
-  status = deserializeQueryDataJSON(raw, results);
+  if (!isInlineFormat(raw) && !isStoredFormat(raw, kQueryChunks)) {
+    return deserializeQueryDataJSON(raw, results);
+  }
+
+  std::string stored;
+  status = readStoredRows(name_, raw, stored);
   if (!status.ok()) {
     return status;
   }
+
+  // Rows stored only as fingerprints cannot be materialized.
+  std::vector<StoredRow> rows;
+  parseStoredRows(stored, rows, kQueryFingerprints.size());
+  for (const auto& row : rows) {
+    if (row.second.second > 0) {
+      Row r;
+      status = deserializeRowJSONRJ(
+          stored.substr(row.second.first, row.second.second), r);
+      if (!status.ok()) {
+        return status;
+      }
+      results.insert(std::move(r));
+    }
+  }
   return Status(0, "OK");
 }
 
@@ -71,19 +659,20 @@ std::vector<std::string> Query::getStoredQueryNames() {
 }
 
 bool Query::isQueryNameInDatabase() const {
-  auto names = Query::getStoredQueryNames();
-  return std::find(names.begin(), names.end(), name_) != names.end();
-}
+  // The metadata is stored with the query's results.
+  QueryMetadata meta;
+  if (getQueryMetadata(name_, meta) && !meta.legacy) {
+    return true;
+  }
 
-static inline void saveQuery(const std::string& name,
-                             const std::string& query) {
-  setDatabaseValue(kQueries, "query." + name, query);
+  std::string raw;
+  return getDatabaseValue(kQueries, name_, raw).ok();
 }
 
 bool Query::isNewQuery() const {
-  std::string query;
-  getDatabaseValue(kQueries, "query." + name_, query);
-  return (query != query_.query);
+  QueryMetadata meta;
+  getQueryMetadata(name_, meta);
+  return (meta.query != query_.query);
 }
 
 Status Query::addNewResults(QueryData qd,
@@ -93,79 +682,346 @@ Status Query::addNewResults(QueryData qd,
   return addNewResults(std::move(qd), epoch, counter, dr, false);
 }
 
+bool Query::checkResults(const uint64_t epoch, bool& new_query) const {
+  QueryMetadata meta;
+  auto stored = getQueryMetadata(name_, meta) && !meta.legacy;
+  if (!stored && !isQueryNameInDatabase()) {
+    // This is the first encounter of the scheduled query.
+    LOG(INFO) << "Storing initial results for new scheduled query: " << name_;
+    return true;
+  } else if (meta.epoch != epoch) {
+    LOG(INFO) << "New Epoch " << epoch << " for scheduled query " << name_;
+    return true;
+  } else if (meta.query != query_.query) {
+    // This query is 'new' in that the previous results may be invalid.
+    new_query = true;
+    LOG(INFO) << "Scheduled query has been updated: " + name_;
+  }
+  return false;
+}
+
+bool Query::keepRows() const {
+  // Removed rows are stored as JSON only while they may be reported.
+  return !(query_.options.count("removed") && !query_.options.at("removed"));
+}
+
 Status Query::addNewResults(QueryData current_qd,
                             const uint64_t current_epoch,
                             uint64_t& counter,
                             DiffResults& dr,
                             bool calculate_diff) const {
   // The current results are 'fresh' when not calculating a differential.
-  bool fresh_results = !calculate_diff;
   bool new_query = false;
-  if (!isQueryNameInDatabase()) {
-    // This is the first encounter of the scheduled query.
-    fresh_results = true;
-    LOG(INFO) << "Storing initial results for new scheduled query: " << name_;
-    saveQuery(name_, query_.query);
-  } else if (getPreviousEpoch() != current_epoch) {
-    fresh_results = true;
-    LOG(INFO) << "New Epoch " << current_epoch << " for scheduled query "
-              << name_;
-  } else if (isNewQuery()) {
-    // This query is 'new' in that the previous results may be invalid.
-    new_query = true;
-    LOG(INFO) << "Scheduled query has been updated: " + name_;
-    saveQuery(name_, query_.query);
+  bool fresh_results = checkResults(current_epoch, new_query);
+  fresh_results = fresh_results || !calculate_diff;
+  bool keep_rows = keepRows();
+
+  // The replacement stored results, see kQueryFingerprints.
+  std::string stored;
+  // The index of previous results stored in chunks, see kQueryChunks.
+  std::string previous_chunks;
+  bool update_db = true;
+  // Get the rows from the last run of this query name.
+  std::string previous;
+  getDatabaseValue(kQueries, name_, previous);
+  if (isStoredFormat(previous, kQueryChunks)) {
+    previous_chunks = previous;
   }
 
-  // Use a 'target' avoid copying the query data when serializing and saving.
-  // If a differential is requested and needed the target remains the original
-  // query data, otherwise the content is moved to the differential's added set.
-  const auto* target_gd = &current_qd;
-  bool update_db = true;
+  // The previous inline results, without their delta.
+  std::string base;
+  std::string delta;
+  bool inline_format = isInlineFormat(previous);
+  bool previous_delta = inline_format && getStoredDelta(name_, delta);
   if (!fresh_results && calculate_diff) {
-    // Get the rows from the last run of this query name.
-    QueryDataSet previous_qd;
-    auto status = getPreviousQueryResults(previous_qd);
+    std::string previous_rows;
+    auto status = (inline_format)
+                      ? decodeStoredRows(previous, base)
+                      : readStoredRows(name_, previous, previous_rows);
     if (!status.ok()) {
       return status;
     }
+    if (inline_format) {
+      previous_rows = base;
+      if (previous_delta) {
+        applyDelta(delta, previous_rows);
+      }
+    }
 
-    // Calculate the differential between previous and current query results.
-    dr = diff(previous_qd, current_qd);
-
-    update_db = (!dr.added.empty() || !dr.removed.empty());
+    // Results stored in another format are always replaced.
+    update_db =
+        diffStoredRows(previous_rows, current_qd, keep_rows, dr, stored) ||
+        !inline_format;
   } else {
+    storeRows(current_qd, keep_rows, stored);
     dr.added = std::move(current_qd);
-    target_gd = &dr.added;
   }
 
-  counter = getQueryCounter(fresh_results || new_query);
-  auto status =
-      setDatabaseValue(kQueries, name_ + "counter", std::to_string(counter));
-  if (!status.ok()) {
-    return status;
+  // The metadata and results are replaced together.
+  DatabaseBatch batch;
+  QueryMetadata meta;
+  getQueryMetadata(name_, meta);
+  counter = (fresh_results || new_query || !meta.executed) ? 0
+                                                           : meta.counter + 1;
+  putQueryMetadata(
+      name_, current_epoch, counter, query_.query, meta.legacy, batch);
+  if (update_db) {
+    // Large results only store the changes while they are much smaller.
+    delta.clear();
+    if (base.size() >= kQueryCompressSize) {
+      delta = createDelta(base, stored);
+    }
+
+    if (!delta.empty() && delta.size() * 4 < base.size()) {
+      batch.put(kQueries, name_ + kQueryDeltaKey, std::move(delta));
+    } else {
+      // Replace the "previous" query data with the current.
+      encodeStoredRows(stored);
+      batch.put(kQueries, name_, std::move(stored));
+      if (previous_delta) {
+        batch.remove(kQueries, name_ + kQueryDeltaKey);
+      }
+    }
   }
 
-  if (update_db) {
-    // Replace the "previous" query data with the current.
-    std::string json;
-    status = serializeQueryDataJSON(*target_gd, json);
+  if (!previous_chunks.empty()) {
+    size_t generation = 0;
+    size_t chunks = 0;
+    parseChunkIndex(previous_chunks, generation, chunks, nullptr);
+    deleteChunks(name_, generation, chunks, batch);
+  }
+  return writeQueryMetadata(
+      name_, current_epoch, counter, query_.query, batch);
+}
+
+QueryDiffStream::QueryDiffStream(const Query& query,
+                                 uint64_t epoch,
+                                 size_t chunk,
+                                 Emitter emit)
+    : query_(query),
+      epoch_(epoch),
+      chunk_size_((chunk > 0) ? chunk : 1),
+      emit_(std::move(emit)),
+      keep_rows_(query.keepRows()) {}
+
+Status QueryDiffStream::begin(uint64_t& counter) {
+  bool new_query = false;
+  fresh_ = query_.checkResults(epoch_, new_query);
+
+  // Previous chunks are replaced even if the results are fresh.
+  std::string raw;
+  getDatabaseValue(kQueries, query_.name_, raw);
+  if (isStoredFormat(raw, kQueryChunks)) {
+    previous_chunked_ = true;
+    std::vector<std::pair<uint64_t, size_t>> rows;
+    parseChunkIndex(raw,
+                    previous_generation_,
+                    previous_chunks_,
+                    (fresh_) ? nullptr : &rows);
+    previous_.reserve(rows.size());
+    for (const auto& row : rows) {
+      previous_.push_back(
+          std::make_pair(row.first, std::make_pair(row.second, size_t(0))));
+    }
+  } else if (!fresh_ && !raw.empty()) {
+    // Results stored in another format are read once, then replaced.
+    auto status = readStoredRows(query_.name_, raw, previous_rows_);
     if (!status.ok()) {
       return status;
     }
+    parseStoredRows(previous_rows_, previous_, kQueryFingerprints.size());
+  }
+  consumed_.resize(previous_.size(), false);
+  generation_ = previous_generation_ + 1;
+  previous_inline_ = isInlineFormat(raw);
+
+  QueryMetadata meta;
+  getQueryMetadata(query_.name_, meta);
+  previous_epoch_ = meta.epoch;
+  counter_ = (fresh_ || new_query || !meta.executed) ? 0 : meta.counter + 1;
+  counter = counter_;
+  if (raw.empty()) {
+    // The metadata of a new query is stored with its results.
+    return Status(0, "OK");
+  }
 
-    status = setDatabaseValue(kQueries, name_, json);
-    if (!status.ok()) {
-      return status;
+  DatabaseBatch batch;
+  putQueryMetadata(query_.name_,
+                   previous_epoch_,
+                   counter_,
+                   query_.query_.query,
+                   meta.legacy,
+                   batch);
+  return writeQueryMetadata(
+      query_.name_, previous_epoch_, counter_, query_.query_.query, batch);
+}
+
+Status QueryDiffStream::add(Row& r) {
+  auto fingerprint = getRowFingerprint(r);
+  bool found = false;
+  auto it = std::lower_bound(
+      previous_.begin(),
+      previous_.end(),
+      std::make_pair(fingerprint, std::make_pair(size_t(0), size_t(0))));
+  for (; it != previous_.end() && it->first == fingerprint; ++it) {
+    auto k = static_cast<size_t>(it - previous_.begin());
+    if (!consumed_[k]) {
+      consumed_[k] = true;
+      found = true;
+      break;
     }
+  }
+
+  size_t chunk = 0;
+  if (keep_rows_) {
+    appendStoredRow(fingerprint, r, true, chunk_);
+    chunk = chunks_ + 1;
+    if (++chunk_rows_ >= chunk_size_) {
+      auto status = flushChunk();
+      if (!status.ok()) {
+        return status;
+      }
+    }
+  }
+  index_.push_back(std::make_pair(fingerprint, chunk));
+
+  if (!found) {
+    added_.added.push_back(std::move(r));
+    if (added_.added.size() >= chunk_size_) {
+      return flush(added_);
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status QueryDiffStream::flushChunk() {
+  chunks_++;
+  auto status = setDatabaseValue(
+      kQueries, getChunkKey(query_.name_, generation_, chunks_), chunk_);
+  chunk_.clear();
+  chunk_rows_ = 0;
+  return status;
+}
 
-    status = setDatabaseValue(
-        kQueries, name_ + "epoch", std::to_string(current_epoch));
+Status QueryDiffStream::flush(DiffResults& results) {
+  if (results.added.empty() && results.removed.empty()) {
+    return Status(0, "OK");
+  }
+  auto status = emit_(results);
+  results = DiffResults();
+  return status;
+}
+
+Status QueryDiffStream::emitRemoved(const std::string& stored,
+                                    size_t offset,
+                                    size_t size,
+                                    DiffResults& removed) {
+  if (size == 0) {
+    // Rows stored only as fingerprints cannot be materialized.
+    return Status(0, "OK");
+  }
+
+  Row r;
+  if (deserializeRowJSONRJ(stored.substr(offset, size), r).ok()) {
+    removed.removed.push_back(std::move(r));
+  }
+  if (removed.removed.size() >= chunk_size_) {
+    return flush(removed);
+  }
+  return Status(0, "OK");
+}
+
+Status QueryDiffStream::end() {
+  if (!chunk_.empty()) {
+    auto status = flushChunk();
     if (!status.ok()) {
       return status;
     }
   }
-  return Status(0, "OK");
+
+  auto status = flush(added_);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Previous rows that were not seen are removed.
+  DiffResults removed;
+  if (!previous_chunked_) {
+    for (size_t k = 0; k < previous_.size() && status.ok(); ++k) {
+      if (!consumed_[k]) {
+        const auto& location = previous_[k].second;
+        status = emitRemoved(
+            previous_rows_, location.first, location.second, removed);
+      }
+    }
+  } else {
+    // Group the removed fingerprints by chunk, each chunk is read once.
+    std::vector<std::pair<size_t, uint64_t>> missing;
+    for (size_t k = 0; k < previous_.size(); ++k) {
+      if (!consumed_[k] && previous_[k].second.first > 0) {
+        missing.push_back(
+            std::make_pair(previous_[k].second.first, previous_[k].first));
+      }
+    }
+    std::sort(missing.begin(), missing.end());
+
+    for (size_t k = 0; k < missing.size() && status.ok();) {
+      auto chunk = missing[k].first;
+      std::string content;
+      getDatabaseValue(kQueries,
+                       getChunkKey(query_.name_, previous_generation_, chunk),
+                       content);
+      std::vector<StoredRow> rows;
+      parseStoredRows(content, rows, 0);
+
+      // Both are sorted by fingerprint, duplicate rows are matched in turn.
+      size_t j = 0;
+      for (; k < missing.size() && missing[k].first == chunk && status.ok();
+           ++k) {
+        while (j < rows.size() && rows[j].first < missing[k].second) {
+          j++;
+        }
+        if (j < rows.size() && rows[j].first == missing[k].second) {
+          status = emitRemoved(content,
+                               rows[j].second.first,
+                               rows[j].second.second,
+                               removed);
+          j++;
+        }
+      }
+    }
+  }
+
+  if (status.ok()) {
+    status = flush(removed);
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Replace the previous results with the index of the current chunks.
+  std::sort(index_.begin(), index_.end());
+  std::string stored = kQueryChunks + std::to_string(generation_) + " " +
+                       std::to_string(chunks_) + "\n";
+  for (const auto& row : index_) {
+    auto chunk = std::to_string(row.second);
+    appendStoredRow(row.first, chunk.data(), chunk.size(), stored);
+  }
+
+  DatabaseBatch batch;
+  QueryMetadata meta;
+  getQueryMetadata(query_.name_, meta);
+  batch.put(kQueries, query_.name_, std::move(stored));
+  putQueryMetadata(
+      query_.name_, epoch_, counter_, query_.query_.query, meta.legacy, batch);
+  if (previous_inline_) {
+    batch.remove(kQueries, query_.name_ + kQueryDeltaKey);
+  }
+  if (previous_chunked_) {
+    deleteChunks(query_.name_, previous_generation_, previous_chunks_, batch);
+  }
+  return writeQueryMetadata(
+      query_.name_, epoch_, counter_, query_.query_.query, batch);
 }
 
 Status serializeRow(const Row& r, pt::ptree& tree) {
@@ -451,21 +1307,72 @@ Status deserializeDiffResults(const pt::ptree& tree, DiffResults& dr) {
   return Status(0, "OK");
 }
 
-Status serializeDiffResultsJSON(const DiffResults& d, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeDiffResults(d, tree);
-  if (!status.ok()) {
-    return status;
+/// A single-pass JSON writer for results, rendering strings as they are.
+using ResultsWriter = rj::Writer<rj::StringBuffer>;
+
+static inline void writeJSONString(ResultsWriter& w, const std::string& s) {
+  w.String(s.c_str(), static_cast<rj::SizeType>(s.size()));
+}
+
+static inline void writeJSONKey(ResultsWriter& w, const std::string& s) {
+  w.Key(s.c_str(), static_cast<rj::SizeType>(s.size()));
+}
+
+/**
+ * @brief Write a row, matching the property tree JSON representation.
+ *
+ * Empty rows, like empty property trees, are written as an empty string.
+ */
+static void writeRowJSON(ResultsWriter& w, const Row& r) {
+  if (r.empty()) {
+    w.String("");
+    return;
   }
 
-  std::ostringstream output;
-  try {
-    pt::write_json(output, tree, false);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    // The content could not be represented as JSON.
-    return Status(1, e.what());
+  w.StartObject();
+  for (const auto& i : r) {
+    writeJSONKey(w, i.first);
+    writeJSONString(w, i.second);
   }
-  json = output.str();
+  w.EndObject();
+}
+
+static void writeQueryDataJSON(ResultsWriter& w, const QueryData& q) {
+  if (q.empty()) {
+    w.String("");
+    return;
+  }
+
+  w.StartArray();
+  for (const auto& r : q) {
+    writeRowJSON(w, r);
+  }
+  w.EndArray();
+}
+
+static void writeDiffResultsJSON(ResultsWriter& w, const DiffResults& d) {
+  // Removed results are written first, see serializeDiffResults.
+  w.StartObject();
+  w.Key("removed");
+  writeQueryDataJSON(w, d.removed);
+  w.Key("added");
+  writeQueryDataJSON(w, d.added);
+  w.EndObject();
+}
+
+/// Complete a JSON line, with the newline included by pt::write_json.
+static inline void finishJSONLine(const rj::StringBuffer& sb,
+                                  std::string& json) {
+  json.reserve(sb.GetSize() + 1);
+  json.assign(sb.GetString(), sb.GetSize());
+  json.push_back('\n');
+}
+
+Status serializeDiffResultsJSON(const DiffResults& d, std::string& json) {
+  rj::StringBuffer sb;
+  ResultsWriter w(sb);
+  writeDiffResultsJSON(w, d);
+  finishJSONLine(sb, json);
   return Status(0, "OK");
 }
 
@@ -526,6 +1433,43 @@ inline void getLegacyFieldsAndDecorations(const pt::ptree& tree,
   item.time = tree.get<int>("unixTime", 0);
 }
 
+static void writeLegacyFieldsAndDecorations(ResultsWriter& w,
+                                            const QueryLogItem& item) {
+  // Apply legacy fields, numbers are strings as in a property tree.
+  w.Key("name");
+  writeJSONString(w, item.name);
+  w.Key("hostIdentifier");
+  writeJSONString(w, item.identifier);
+  w.Key("calendarTime");
+  writeJSONString(w, item.calendar_time);
+  w.Key("unixTime");
+  writeJSONString(w, std::to_string(item.time));
+  w.Key("epoch");
+  writeJSONString(w, std::to_string(item.epoch));
+  w.Key("counter");
+  writeJSONString(w, std::to_string(item.counter));
+
+  // Append the decorations, the rendered object is reused when nested.
+  if (item.decorations_json != nullptr && !FLAGS_decorations_top_level) {
+    w.Key("decorations");
+    w.RawValue(item.decorations_json->c_str(),
+               item.decorations_json->size(),
+               rj::kObjectType);
+  } else if (item.decorations.size() > 0) {
+    if (!FLAGS_decorations_top_level) {
+      w.Key("decorations");
+      w.StartObject();
+    }
+    for (const auto& name : item.decorations) {
+      writeJSONKey(w, name.first);
+      writeJSONString(w, name.second);
+    }
+    if (!FLAGS_decorations_top_level) {
+      w.EndObject();
+    }
+  }
+}
+
 Status serializeQueryLogItem(const QueryLogItem& item, pt::ptree& tree) {
   pt::ptree results;
   if (item.results.added.size() > 0 || item.results.removed.size() > 0) {
@@ -593,20 +1537,22 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& item,
 }
 
 Status serializeQueryLogItemJSON(const QueryLogItem& i, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeQueryLogItem(i, tree);
-  if (!status.ok()) {
-    return status;
+  rj::StringBuffer sb;
+  ResultsWriter w(sb);
+  w.StartObject();
+  if (i.results.added.size() > 0 || i.results.removed.size() > 0) {
+    w.Key("diffResults");
+    writeDiffResultsJSON(w, i.results);
+  } else {
+    w.Key("snapshot");
+    writeQueryDataJSON(w, i.snapshot_results);
+    w.Key("action");
+    w.String("snapshot");
   }
+  writeLegacyFieldsAndDecorations(w, i);
+  w.EndObject();
 
-  std::ostringstream output;
-  try {
-    pt::write_json(output, tree, false);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    // The content could not be represented as JSON.
-    return Status(1, e.what());
-  }
-  json = output.str();
+  finishJSONLine(sb, json);
   return Status(0, "OK");
 }
 
@@ -642,24 +1588,93 @@ Status deserializeQueryLogItemJSON(const std::string& json,
   return deserializeQueryLogItem(tree, item);
 }
 
+/// Write a row of a QueryLogItem's results as an event JSON line.
+static void writeEventJSON(const QueryLogItem& item,
+                           const Row& r,
+                           const char* action,
+                           rj::StringBuffer& sb,
+                           std::vector<std::string>& items) {
+  sb.Clear();
+  ResultsWriter w(sb);
+  w.StartObject();
+  writeLegacyFieldsAndDecorations(w, item);
+  // Yield results as a "columns." map to avoid namespace collisions.
+  w.Key("columns");
+  writeRowJSON(w, r);
+  w.Key("action");
+  w.String(action);
+  w.EndObject();
+
+  items.emplace_back();
+  finishJSONLine(sb, items.back());
+}
+
+/// Write each row of a QueryLogItem's results as an event JSON line.
+static void writeEventsJSON(const QueryLogItem& item,
+                            const QueryData& q,
+                            const char* action,
+                            std::vector<std::string>& items) {
+  rj::StringBuffer sb;
+  for (const auto& r : q) {
+    writeEventJSON(item, r, action, sb, items);
+  }
+}
+
 Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
                                          std::vector<std::string>& items) {
-  pt::ptree tree;
-  auto status = serializeQueryLogItemAsEvents(i, tree);
-  if (!status.ok()) {
-    return status;
+  if (!i.results.added.empty() || !i.results.removed.empty()) {
+    items.reserve(items.size() + i.results.removed.size() +
+                  i.results.added.size());
+    writeEventsJSON(i, i.results.removed, "removed", items);
+    writeEventsJSON(i, i.results.added, "added", items);
+  } else if (!i.snapshot_results.empty()) {
+    items.reserve(items.size() + i.snapshot_results.size());
+    writeEventsJSON(i, i.snapshot_results, "snapshot", items);
+  } else {
+    // This error case may also be represented in serializeQueryLogItem.
+    return Status(1, "No diff results or snapshot results");
   }
+  return Status(0, "OK");
+}
 
-  for (auto& event : tree) {
-    std::ostringstream output;
-    try {
-      pt::write_json(output, event.second, false);
-    } catch (const pt::json_parser::json_parser_error& e) {
-      return Status(1, e.what());
-    }
-    items.push_back(output.str());
+SnapshotJSONWriter::SnapshotJSONWriter(const QueryLogItem& item, bool events)
+    : item_(item), events_(events), writer_(sb_) {
+  if (!events_) {
+    writer_.StartObject();
+    writer_.Key("snapshot");
   }
-  return Status(0, "OK");
+}
+
+void SnapshotJSONWriter::add(const Row& r, std::vector<std::string>& lines) {
+  if (events_) {
+    writeEventJSON(item_, r, "snapshot", sb_, lines);
+    return;
+  }
+
+  if (rows_++ == 0) {
+    writer_.StartArray();
+  }
+  writeRowJSON(writer_, r);
+}
+
+void SnapshotJSONWriter::end(std::vector<std::string>& lines) {
+  if (events_) {
+    return;
+  }
+
+  // An empty snapshot is written as an empty string, see writeQueryDataJSON.
+  if (rows_ == 0) {
+    writer_.String("");
+  } else {
+    writer_.EndArray();
+  }
+  writer_.Key("action");
+  writer_.String("snapshot");
+  writeLegacyFieldsAndDecorations(writer_, item_);
+  writer_.EndObject();
+
+  lines.emplace_back();
+  finishJSONLine(sb_, lines.back());
 }
 
 Status serializeQueryDataRJ(const QueryData& q, rj::Document& d) {
@@ -725,6 +1740,54 @@ Status serializeDiffResultsRJ(const DiffResults& d, rj::Document& doc) {
   return Status(0, "OK");
 }
 
+void PerformanceHistogram::add(uint64_t value) {
+  max = std::max(max, value);
+  size_t bucket = 0;
+  while (value > 0 && bucket < kBuckets - 1) {
+    value >>= 1;
+    bucket++;
+  }
+  counts[bucket]++;
+}
+
+uint64_t PerformanceHistogram::percentile(double percent) const {
+  uint64_t total = 0;
+  for (const auto& count : counts) {
+    total += count;
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  // The rank of the percentile value, counting from 1.
+  auto rank = static_cast<uint64_t>(std::ceil(total * percent / 100.0));
+  rank = std::min(std::max<uint64_t>(rank, 1), total);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets - 1; i++) {
+    seen += counts[i];
+    if (seen >= rank) {
+      uint64_t upper = (i == 0) ? 0 : (1ULL << i) - 1;
+      return std::min(upper, max);
+    }
+  }
+  return max;
+}
+
+std::string PerformanceHistogram::toString() const {
+  std::string buckets;
+  for (size_t i = 0; i < kBuckets; i++) {
+    if (counts[i] == 0) {
+      continue;
+    }
+    uint64_t lower = (i == 0) ? 0 : (1ULL << (i - 1));
+    if (!buckets.empty()) {
+      buckets += ',';
+    }
+    buckets += std::to_string(lower) + ':' + std::to_string(counts[i]);
+  }
+  return buckets;
+}
+
 bool addUniqueRowToQueryData(QueryData& q, const Row& r) {
   if (std::find(q.begin(), q.end(), r) != q.end()) {
     return false;
@@ -0,0 +1,100 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/**
+ * @brief A bounded, lock-free, single-producer single-consumer queue.
+ *
+ * Exactly one thread may push and exactly one other thread may pop. The
+ * capacity is rounded up to a power of two, and a push to a full queue fails
+ * rather than blocking, such that the producer may count the drop.
+ */
+template <typename T>
+class RingQueue : private boost::noncopyable {
+ public:
+  explicit RingQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    slots_.resize(size);
+    mask_ = size - 1;
+  }
+
+  /// Producer only: move an item into the queue, false if the queue is full.
+  bool push(T&& item) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= slots_.size()) {
+      return false;
+    }
+
+    slots_[tail & mask_] = std::move(item);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// See RingQueue::push, the item is copied.
+  bool push(const T& item) {
+    T copy = item;
+    return push(std::move(copy));
+  }
+
+  /// Consumer only: move the front item out of the queue, false if empty.
+  bool pop(T& item) {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    item = std::move(slots_[head & mask_]);
+    slots_[head & mask_] = T();
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// The number of queued items, exact only when called by either thread.
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /// The maximum number of queued items.
+  size_t capacity() const {
+    return slots_.size();
+  }
+
+ private:
+  /// The ring of item slots, sized to a power of two.
+  std::vector<T> slots_;
+
+  /// Mask an ever-increasing position to a slot index.
+  size_t mask_{0};
+
+  /// The next position to pop, only written by the consumer.
+  alignas(64) std::atomic<size_t> head_{0};
+
+  /// The next position to push, only written by the producer.
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+} // namespace osquery
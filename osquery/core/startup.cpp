@@ -0,0 +1,50 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <osquery/core.h>
+
+#include "osquery/core/startup.h"
+
+namespace osquery {
+
+using StartupClock = std::chrono::steady_clock;
+
+/// Phase times are relative to static initialization of the process.
+static const StartupClock::time_point kStartupOrigin = StartupClock::now();
+
+static std::vector<StartupPhase> kStartupPhases;
+static Mutex kStartupPhasesMutex;
+
+static uint64_t startupMilliseconds(StartupClock::duration duration) {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+}
+
+StartupPhaseScope::StartupPhaseScope(std::string name, bool background)
+    : name_(std::move(name)),
+      background_(background),
+      start_(StartupClock::now()) {}
+
+StartupPhaseScope::~StartupPhaseScope() {
+  StartupPhase phase;
+  phase.name = std::move(name_);
+  phase.start = startupMilliseconds(start_ - kStartupOrigin);
+  phase.duration = startupMilliseconds(StartupClock::now() - start_);
+  phase.background = background_;
+
+  WriteLock lock(kStartupPhasesMutex);
+  kStartupPhases.push_back(std::move(phase));
+}
+
+std::vector<StartupPhase> getStartupPhases() {
+  ReadLock lock(kStartupPhasesMutex);
+  return kStartupPhases;
+}
+} // namespace osquery
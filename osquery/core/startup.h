@@ -0,0 +1,56 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/// A step of the process startup, see StartupPhaseScope.
+struct StartupPhase {
+  std::string name;
+
+  /// Milliseconds since the process started when the phase began.
+  uint64_t start{0};
+
+  /// Milliseconds the phase took.
+  uint64_t duration{0};
+
+  /// The phase completed after the initializer started the daemon.
+  bool background{false};
+};
+
+/**
+ * @brief Record the time taken by a phase of startup.
+ *
+ * Phases are recorded when the scope ends, including phases that run in
+ * their own threads, such as the setup of each event publisher.
+ */
+class StartupPhaseScope : private boost::noncopyable {
+ public:
+  explicit StartupPhaseScope(std::string name, bool background = false);
+  ~StartupPhaseScope();
+
+ private:
+  std::string name_;
+  bool background_{false};
+  std::chrono::steady_clock::time_point start_;
+};
+
+/// The recorded phases in the order they completed.
+std::vector<StartupPhase> getStartupPhases();
+} // namespace osquery
@@ -29,7 +29,9 @@
 #include <WinSock2.h>
 #endif
 
+#include <algorithm>
 #include <ctime>
+#include <random>
 #include <sstream>
 
 #include <boost/algorithm/string/trim.hpp>
@@ -306,6 +308,13 @@ size_t getUnixTime() {
   return ut < 0 ? 0 : ut;
 }
 
+size_t getBackoffDelay(size_t base, size_t previous, size_t cap) {
+  static thread_local std::mt19937_64 engine(std::random_device{}());
+  std::uniform_int_distribution<size_t> delay(base,
+                                              std::max(base, previous) * 3);
+  return std::min(delay(engine), cap);
+}
+
 Status checkStalePid(const std::string& content) {
   int pid;
   try {
@@ -8,11 +8,18 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#ifndef WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
 #include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
 
 namespace pt = boost::property_tree;
@@ -21,6 +28,11 @@ namespace osquery {
 
 FLAG(bool, disable_caching, false, "Disable scheduled query caching");
 
+FLAG(uint64,
+     static_tables_refresh,
+     0,
+     "Seconds static table results are kept, 0 until osquery restarts");
+
 CREATE_LAZY_REGISTRY(TablePlugin, "table");
 
 size_t TablePlugin::kCacheInterval = 0;
@@ -36,6 +48,173 @@ const std::map<ColumnType, std::string> kColumnTypeNames = {
     {BLOB_TYPE, "BLOB"},
 };
 
+const size_t TableRows::kInvalidColumn = static_cast<size_t>(-1);
+
+TableRows::TableRows(const TableColumns& columns)
+    : owned_arena_(std::make_unique<Arena>()) {
+  for (const auto& column : columns) {
+    names_.push_back(std::get<0>(column));
+    types_.push_back(std::get<1>(column));
+  }
+  cells_.resize(types_.size());
+}
+
+TableRows::TableRows(const TableColumns& columns, Arena& arena)
+    : arena_(&arena) {
+  for (const auto& column : columns) {
+    names_.push_back(std::get<0>(column));
+    types_.push_back(std::get<1>(column));
+  }
+  cells_.resize(types_.size());
+}
+
+size_t TableRows::bytes() const {
+  const auto* arena = (arena_ != nullptr) ? arena_ : owned_arena_.get();
+  return rows_ * cells_.size() * sizeof(TableCell) + arena->used();
+}
+
+size_t TableRows::column(const std::string& name) const {
+  for (size_t i = 0; i < names_.size(); i++) {
+    if (names_[i] == name) {
+      return i;
+    }
+  }
+  return kInvalidColumn;
+}
+
+void TableRows::addRow() {
+  for (auto& column : cells_) {
+    column.emplace_back();
+  }
+  rows_++;
+}
+
+void TableRows::addRow(const Row& row) {
+  addRow();
+  for (const auto& item : row) {
+    auto index = column(item.first);
+    if (index != kInvalidColumn) {
+      set(index, item.second);
+    }
+  }
+}
+
+void TableRows::setInteger(size_t column, int64_t value) {
+  auto& cell = last(column);
+  cell.kind = TableCell::Kind::Integer;
+  cell.value.integer = value;
+}
+
+void TableRows::setDouble(size_t column, double value) {
+  auto& cell = last(column);
+  cell.kind = TableCell::Kind::Double;
+  cell.value.real = value;
+}
+
+void TableRows::setText(size_t column, const char* data, size_t size) {
+  auto& cell = last(column);
+  cell.kind = TableCell::Kind::Text;
+  cell.value.text = arena().copy(data, size);
+  cell.size = static_cast<uint32_t>(size);
+}
+
+void TableRows::set(size_t column, const std::string& value) {
+  auto type = types_[column];
+  if (type == INTEGER_TYPE || type == BIGINT_TYPE ||
+      type == UNSIGNED_BIGINT_TYPE) {
+    long long afinite;
+    if (safeStrtoll(value, 0, afinite)) {
+      setInteger(column, afinite);
+    } else {
+      last(column).kind = TableCell::Kind::Null;
+    }
+  } else if (type == DOUBLE_TYPE) {
+    char* end = nullptr;
+    double afinite = strtod(value.c_str(), &end);
+    if (end == nullptr || end == value.c_str() || *end != '\0') {
+      last(column).kind = TableCell::Kind::Null;
+    } else {
+      setDouble(column, afinite);
+    }
+  } else {
+    setText(column, value);
+  }
+}
+
+Row TableRows::toRow(size_t row) const {
+  Row r;
+  for (size_t i = 0; i < names_.size(); i++) {
+    const auto& cell = cells_[i][row];
+    switch (cell.kind) {
+    case TableCell::Kind::Integer:
+      r[names_[i]] = std::to_string(cell.value.integer);
+      break;
+    case TableCell::Kind::Double:
+      r[names_[i]] = DOUBLE(cell.value.real);
+      break;
+    case TableCell::Kind::Text:
+      r[names_[i]] = std::string(cell.value.text, cell.size);
+      break;
+    case TableCell::Kind::Null:
+      if (types_[i] != UNKNOWN_TYPE) {
+        r[names_[i]] = SQL_NULL_RESULT;
+      }
+      break;
+    }
+  }
+  return r;
+}
+
+QueryData TableRows::toQueryData() const {
+  QueryData results;
+  results.reserve(rows_);
+  for (size_t i = 0; i < rows_; i++) {
+    results.push_back(toRow(i));
+  }
+  return results;
+}
+
+void TableRows::clear() {
+  for (auto& column : cells_) {
+    column.clear();
+  }
+  rows_ = 0;
+  if (owned_arena_ != nullptr) {
+    owned_arena_->reset();
+  }
+}
+
+QueryData TablePlugin::generate(QueryContext& context) {
+  if (!usesTypedRows()) {
+    return QueryData();
+  }
+
+  // Typed tables are converted into QueryData for the generate action.
+  TableRows results(columns());
+  if (!usesGenerator()) {
+    generateRows(results, context);
+    return results.toQueryData();
+  }
+
+  QueryData data;
+  TableRowsGenerator::pull_type generator([&](TableRowsYield& yield) {
+    rowsGenerator(yield, results, context);
+    if (!results.empty()) {
+      yield(results);
+    }
+  });
+  while (generator) {
+    auto& batch = generator.get();
+    auto rows = batch.toQueryData();
+    data.insert(data.end(),
+                std::make_move_iterator(rows.begin()),
+                std::make_move_iterator(rows.end()));
+    batch.clear();
+    generator();
+  }
+  return data;
+}
+
 Status TablePlugin::addExternal(const std::string& name,
                                 const PluginResponse& response) {
   // Attach the table.
@@ -71,6 +250,27 @@ void TablePlugin::setRequestFromContext(const QueryContext& context,
   }
   tree.add_child("constraints", constraints);
 
+  // The requested scan order and limit are hints for the table.
+  if (context.limit > 0) {
+    tree.put("limit", context.limit);
+  }
+  if (!context.orderBy.empty()) {
+    tree.put("order_by", context.orderBy);
+    tree.put("order_descending", context.orderDescending);
+  }
+
+  // The used columns are only included when known, all columns are used
+  // otherwise.
+  if (context.colsUsed) {
+    pt::ptree cols_used;
+    for (const auto& column : *context.colsUsed) {
+      pt::ptree child;
+      child.put("", column);
+      cols_used.push_back(std::make_pair("", child));
+    }
+    tree.add_child("cols_used", cols_used);
+  }
+
   // Write the property tree as a JSON string into the PluginRequest.
   std::ostringstream output;
   try {
@@ -102,6 +302,19 @@ void TablePlugin::setContextFromRequest(const PluginRequest& request,
     auto column_name = constraint.second.get<std::string>("name");
     context.constraints[column_name].unserialize(constraint.second);
   }
+
+  context.limit = tree.get<size_t>("limit", 0);
+  context.orderBy = tree.get<std::string>("order_by", "");
+  context.orderDescending = tree.get<bool>("order_descending", false);
+
+  auto cols_used = tree.get_child_optional("cols_used");
+  if (cols_used) {
+    UsedColumns columns;
+    for (const auto& column : *cols_used) {
+      columns.insert(column.second.data());
+    }
+    context.colsUsed = std::move(columns);
+  }
 }
 
 Status TablePlugin::call(const PluginRequest& request,
@@ -166,6 +379,11 @@ PluginResponse TablePlugin::routeInfo() const {
   response.push_back(
       {{"id", "attributes"},
        {"attributes", INTEGER(static_cast<size_t>(attributes()))}});
+
+  // The core keeps the results of an extension's table for the TTL.
+  if (cacheTTL() > 0) {
+    response.push_back({{"id", "cache"}, {"ttl", INTEGER(cacheTTL())}});
+  }
   return response;
 }
 
@@ -197,6 +415,7 @@ bool TablePlugin::isCached(size_t step, const QueryContext& ctx) const {
 
 QueryData TablePlugin::getCache() const {
   VLOG(1) << "Retrieving results from cache for table: " << getName();
+  cache_hits_++;
   // Lookup results from database and deserialize.
   std::string content;
   getDatabaseValue(kQueries, "cache." + getName(), content);
@@ -213,6 +432,11 @@ void TablePlugin::setCache(size_t step,
     return;
   }
 
+  if (ctx.limit > 0) {
+    // The table may have stopped generating at the query's limit.
+    return;
+  }
+
   // Serialize QueryData and save to database.
   std::string content;
   if (serializeQueryDataJSON(results, content)) {
@@ -222,6 +446,127 @@ void TablePlugin::setCache(size_t step,
   }
 }
 
+/// Check if the kept results of a STATIC table may answer a query.
+static bool staticCacheAllowed(const TableColumns& cols,
+                               const QueryContext& ctx) {
+  return !FLAGS_disable_caching && ctx.limit == 0 && cacheAllowed(cols, ctx);
+}
+
+/// The dependency state of results that must not be kept.
+static const std::string kUnsettledState = "unsettled";
+
+#ifndef WIN32
+/**
+ * @brief Append a file's inode, size, and modify and change times.
+ *
+ * The times have a resolution of seconds, a file changed within the current
+ * second may change again without a new time, and is not settled.
+ */
+static bool appendFileState(const std::string& path,
+                            time_t now,
+                            std::string& state) {
+  struct stat file_stat;
+  if (::stat(path.c_str(), &file_stat) != 0) {
+    state += path + ":none;";
+    return true;
+  }
+
+  if (file_stat.st_mtime >= now || file_stat.st_ctime >= now) {
+    return false;
+  }
+
+  state += path + ":" + std::to_string(file_stat.st_ino) + "," +
+           std::to_string(file_stat.st_size) + "," +
+           std::to_string(file_stat.st_mtime) + "," +
+           std::to_string(file_stat.st_ctime) + ";";
+  return true;
+}
+#endif
+
+/// Describe the files a table depends on, false if any is not settled.
+static bool getDependencyState(const std::vector<std::string>& paths,
+                               std::string& state) {
+#ifndef WIN32
+  auto now = static_cast<time_t>(getUnixTime());
+  for (const auto& path : paths) {
+    if (!appendFileState(path, now, state)) {
+      return false;
+    }
+
+    if (path.empty() || path.back() != '/') {
+      continue;
+    }
+
+    auto* dir = ::opendir(path.c_str());
+    if (dir == nullptr) {
+      continue;
+    }
+
+    bool settled = true;
+    struct dirent* entry = nullptr;
+    while (settled && (entry = ::readdir(dir)) != nullptr) {
+      std::string name = entry->d_name;
+      if (name != "." && name != "..") {
+        settled = appendFileState(path + name, now, state);
+      }
+    }
+    ::closedir(dir);
+    if (!settled) {
+      return false;
+    }
+  }
+  return true;
+#else
+  // Change times are not inspected, results with dependencies are not kept.
+  return paths.empty();
+#endif
+}
+
+bool TablePlugin::getStaticCache(const QueryContext& ctx,
+                                 QueryData& results,
+                                 std::string& state) const {
+  state.clear();
+  if (!staticCacheAllowed(columns(), ctx)) {
+    return false;
+  }
+
+  if (!getDependencyState(dependencies(), state)) {
+    state = kUnsettledState;
+    return false;
+  }
+
+  ReadLock lock(static_mutex_);
+  if (static_time_ == 0 || static_state_ != state ||
+      (FLAGS_static_tables_refresh > 0 &&
+       getUnixTime() >= static_time_ + FLAGS_static_tables_refresh)) {
+    return false;
+  }
+
+  cache_hits_++;
+  results = static_results_;
+  return true;
+}
+
+void TablePlugin::setStaticCache(const QueryContext& ctx,
+                                 const QueryData& results,
+                                 const std::string& state) {
+  if (!staticCacheAllowed(columns(), ctx) || state == kUnsettledState) {
+    return;
+  }
+
+  WriteLock lock(static_mutex_);
+  static_results_ = results;
+  static_time_ = getUnixTime();
+  static_state_ = state;
+}
+
+void TablePlugin::clearStaticCache() {
+  WriteLock lock(static_mutex_);
+  static_results_.clear();
+  static_time_ = 0;
+  static_state_.clear();
+}
+
 std::string columnDefinition(const TableColumns& columns) {
   std::map<std::string, bool> epilog;
   bool indexed = false;
@@ -318,6 +663,262 @@ ColumnType columnTypeName(const std::string& type) {
   return UNKNOWN_TYPE;
 }
 
+/**
+ * @brief A LIKE or GLOB pattern, classified when the constraint is added.
+ *
+ * Most patterns are an exact value or a prefix, such as '/etc/%', and are
+ * matched without backtracking.
+ */
+struct ConstraintPattern {
+  enum class Kind { Exact, Prefix, General };
+
+  ConstraintPattern(const std::string& expr, bool is_glob)
+      : pattern(expr), glob(is_glob) {
+    auto wildcards = (glob) ? "*?[" : "%_";
+    auto any = (glob) ? '*' : '%';
+    auto first = pattern.find_first_of(wildcards);
+    if (first == std::string::npos) {
+      kind = Kind::Exact;
+      literal = pattern;
+    } else if (pattern.find_first_not_of(any, first) == std::string::npos) {
+      kind = Kind::Prefix;
+      literal = pattern.substr(0, first);
+    }
+
+    if (!glob) {
+      // LIKE is case-insensitive for ASCII characters.
+      for (auto& c : literal) {
+        c = lower(c);
+      }
+    }
+  }
+
+  static char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+  }
+
+  bool matches(const std::string& value) const {
+    if (kind == Kind::General) {
+      return (glob) ? globMatches(pattern, value)
+                    : likeMatches(pattern, value);
+    }
+
+    if (value.size() < literal.size() ||
+        (kind == Kind::Exact && value.size() != literal.size())) {
+      return false;
+    } else if (glob) {
+      return value.compare(0, literal.size(), literal) == 0;
+    }
+
+    for (size_t i = 0; i < literal.size(); i++) {
+      if (lower(value[i]) != literal[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  Kind kind{Kind::General};
+  std::string pattern;
+  std::string literal;
+  bool glob{false};
+};
+
+class ConstraintMatcher {
+ public:
+  explicit ConstraintMatcher(ColumnType affinity) : affinity_(affinity) {}
+  virtual ~ConstraintMatcher() = default;
+
+  ColumnType affinity() const {
+    return affinity_;
+  }
+
+  /// Compile an additional constraint.
+  virtual void add(const Constraint& constraint) = 0;
+
+  /// See ConstraintList::matches.
+  virtual bool matches(const std::string& expr) const = 0;
+
+ private:
+  ColumnType affinity_;
+};
+
+namespace {
+
+/// Only TEXT constraints match patterns, others match every pattern.
+template <typename T>
+bool patternsMatch(const std::vector<ConstraintPattern>& patterns,
+                   const T& value) {
+  return true;
+}
+
+template <>
+bool patternsMatch<TEXT_LITERAL>(const std::vector<ConstraintPattern>& patterns,
+                                 const TEXT_LITERAL& value) {
+  for (const auto& pattern : patterns) {
+    if (!pattern.matches(value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Constraints compiled for a literal type.
+ *
+ * This is equivalent to ConstraintList::literal_matches, which evaluates the
+ * constraints in order: the first unsupported operator matches every value
+ * and the first expression that cannot be parsed matches no value, regardless
+ * of the constraints before them.
+ */
+template <typename T>
+class LiteralConstraintMatcher : public ConstraintMatcher {
+ public:
+  explicit LiteralConstraintMatcher(ColumnType affinity)
+      : ConstraintMatcher(affinity) {}
+
+  void add(const Constraint& constraint) override {
+    if (done_) {
+      // The later constraints are never evaluated.
+      return;
+    }
+
+    if ((constraint.op == LIKE || constraint.op == GLOB) &&
+        affinity() == TEXT_TYPE) {
+      patterns_.emplace_back(constraint.expr, constraint.op == GLOB);
+      return;
+    } else if (constraint.op != EQUALS && constraint.op != GREATER_THAN &&
+               constraint.op != GREATER_THAN_OR_EQUALS &&
+               constraint.op != LESS_THAN &&
+               constraint.op != LESS_THAN_OR_EQUALS) {
+      // Unsupported constraint. Should match every thing.
+      done_ = true;
+      result_ = true;
+      return;
+    }
+
+    T value;
+    try {
+      value = AS_LITERAL(T, constraint.expr);
+    } catch (const boost::bad_lexical_cast& /* e */) {
+      done_ = true;
+      result_ = false;
+      return;
+    }
+
+    if (constraint.op == EQUALS) {
+      if (equals_ && *equals_ != value) {
+        contradiction_ = true;
+      }
+      equals_ = value;
+    } else if (constraint.op == GREATER_THAN ||
+               constraint.op == GREATER_THAN_OR_EQUALS) {
+      bool inclusive = (constraint.op == GREATER_THAN_OR_EQUALS);
+      if (!lower_ || value > *lower_ ||
+          (value == *lower_ && !inclusive && lower_inclusive_)) {
+        lower_ = value;
+        lower_inclusive_ = inclusive;
+      }
+    } else {
+      bool inclusive = (constraint.op == LESS_THAN_OR_EQUALS);
+      if (!upper_ || value < *upper_ ||
+          (value == *upper_ && !inclusive && upper_inclusive_)) {
+        upper_ = value;
+        upper_inclusive_ = inclusive;
+      }
+    }
+  }
+
+  bool matches(const std::string& expr) const override {
+    T value;
+    try {
+      value = AS_LITERAL(T, expr);
+    } catch (const boost::bad_lexical_cast& /* e */) {
+      return false;
+    }
+    return matchesLiteral(value);
+  }
+
+ private:
+  bool matchesLiteral(const T& value) const {
+    if (done_) {
+      return result_;
+    } else if (contradiction_ || (equals_ && value != *equals_)) {
+      return false;
+    }
+
+    if (lower_ &&
+        (value < *lower_ || (value == *lower_ && !lower_inclusive_))) {
+      return false;
+    }
+
+    if (upper_ &&
+        (value > *upper_ || (value == *upper_ && !upper_inclusive_))) {
+      return false;
+    }
+    return patternsMatch(patterns_, value);
+  }
+
+ private:
+  /// A later constraint is unsupported or cannot be parsed.
+  bool done_{false};
+
+  /// The result of the unsupported or unparsable constraint.
+  bool result_{true};
+
+  /// The value required by every EQUALS, unless they differ.
+  boost::optional<T> equals_;
+  bool contradiction_{false};
+
+  /// The range interval of the comparisons.
+  boost::optional<T> lower_;
+  bool lower_inclusive_{false};
+  boost::optional<T> upper_;
+  bool upper_inclusive_{false};
+
+  /// The LIKE and GLOB patterns of TEXT constraints.
+  std::vector<ConstraintPattern> patterns_;
+};
+
+template <>
+bool LiteralConstraintMatcher<TEXT_LITERAL>::matches(
+    const std::string& expr) const {
+  return matchesLiteral(expr);
+}
+
+/// Compile constraints for an affinity, nullptr if the affinity never matches.
+std::shared_ptr<ConstraintMatcher> createConstraintMatcher(
+    ColumnType affinity, const std::vector<Constraint>& constraints) {
+  std::shared_ptr<ConstraintMatcher> matcher;
+  if (affinity == TEXT_TYPE) {
+    matcher.reset(new LiteralConstraintMatcher<TEXT_LITERAL>(affinity));
+  } else if (affinity == INTEGER_TYPE) {
+    matcher.reset(new LiteralConstraintMatcher<INTEGER_LITERAL>(affinity));
+  } else if (affinity == BIGINT_TYPE) {
+    matcher.reset(new LiteralConstraintMatcher<BIGINT_LITERAL>(affinity));
+  } else if (affinity == UNSIGNED_BIGINT_TYPE) {
+    matcher.reset(
+        new LiteralConstraintMatcher<UNSIGNED_BIGINT_LITERAL>(affinity));
+  } else {
+    return nullptr;
+  }
+
+  for (const auto& constraint : constraints) {
+    matcher->add(constraint);
+  }
+  return matcher;
+}
+} // namespace
+
+void ConstraintList::add(const struct Constraint& constraint) {
+  constraints_.push_back(constraint);
+  if (matcher_ != nullptr && matcher_->affinity() == affinity) {
+    matcher_->add(constraint);
+  } else {
+    matcher_ = createConstraintMatcher(affinity, constraints_);
+  }
+}
+
 bool ConstraintList::exists(const ConstraintOperatorFlag ops) const {
   if (ops == ANY_OP) {
     return (constraints_.size() > 0);
@@ -332,25 +933,13 @@ bool ConstraintList::exists(const ConstraintOperatorFlag ops) const {
 }
 
 bool ConstraintList::matches(const std::string& expr) const {
-  // Support each SQL affinity type casting.
-  try {
-    if (affinity == TEXT_TYPE) {
-      return literal_matches<TEXT_LITERAL>(expr);
-    } else if (affinity == INTEGER_TYPE) {
-      INTEGER_LITERAL lexpr = AS_LITERAL(INTEGER_LITERAL, expr);
-      return literal_matches<INTEGER_LITERAL>(lexpr);
-    } else if (affinity == BIGINT_TYPE) {
-      BIGINT_LITERAL lexpr = AS_LITERAL(BIGINT_LITERAL, expr);
-      return literal_matches<BIGINT_LITERAL>(lexpr);
-    } else if (affinity == UNSIGNED_BIGINT_TYPE) {
-      UNSIGNED_BIGINT_LITERAL lexpr = AS_LITERAL(UNSIGNED_BIGINT_LITERAL, expr);
-      return literal_matches<UNSIGNED_BIGINT_LITERAL>(lexpr);
-    }
-  } catch (const boost::bad_lexical_cast& /* e */) {
-    // Unsupported affinity type or unable to cast content type.
+  if (matcher_ != nullptr && matcher_->affinity() == affinity) {
+    return matcher_->matches(expr);
   }
 
-  return false;
+  // The affinity changed after the constraints were added.
+  auto matcher = createConstraintMatcher(affinity, constraints_);
+  return matcher != nullptr && matcher->matches(expr);
 }
 
 template <typename T>
@@ -406,12 +995,12 @@ void ConstraintList::serialize(boost::property_tree::ptree& tree) const {
 void ConstraintList::unserialize(const boost::property_tree::ptree& tree) {
   // Iterate through the list of operand/expressions, then set the constraint
   // type affinity.
+  affinity = columnTypeName(tree.get<std::string>("affinity", "UNKNOWN"));
   for (const auto& list : tree.get_child("list")) {
     Constraint constraint(list.second.get<unsigned char>("op"));
     constraint.expr = list.second.get<std::string>("expr");
-    constraints_.push_back(constraint);
+    add(constraint);
   }
-  affinity = columnTypeName(tree.get<std::string>("affinity", "UNKNOWN"));
 }
 
 void QueryContext::useCache(bool use_cache) {
@@ -453,6 +1042,14 @@ bool QueryContext::hasConstraint(const std::string& column,
   return constraints.at(column).exists(op);
 }
 
+bool QueryContext::isColumnUsed(const std::string& column) const {
+  return !colsUsed || colsUsed->count(column) > 0;
+}
+
+bool QueryContext::isCancelled() const {
+  return deadline > 0 && getUnixTime() >= deadline;
+}
+
 Status QueryContext::expandConstraints(
     const std::string& column,
     ConstraintOperator op,
@@ -0,0 +1,67 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/arena.h"
+
+namespace osquery {
+
+class ArenaTests : public testing::Test {};
+
+TEST_F(ArenaTests, test_copy) {
+  Arena arena(128);
+  auto* first = arena.copy("first");
+  auto* second = arena.copy(std::string("second"));
+  EXPECT_STREQ(first, "first");
+  EXPECT_STREQ(second, "second");
+  EXPECT_EQ(arena.used(), 13U);
+  EXPECT_EQ(arena.reserved(), 128U);
+}
+
+TEST_F(ArenaTests, test_alignment) {
+  Arena arena(128);
+  arena.copy("a");
+  auto* aligned = arena.allocate(sizeof(uint64_t), alignof(uint64_t));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % alignof(uint64_t), 0U);
+}
+
+TEST_F(ArenaTests, test_large_allocations) {
+  Arena arena(128);
+  auto* small = arena.copy("small");
+
+  // A large allocation is given a dedicated block.
+  std::string large(1024, 'A');
+  auto* copied = arena.copy(large);
+  EXPECT_EQ(std::string(copied), large);
+  EXPECT_GT(arena.reserved(), 1024U);
+
+  // The small allocation block continues to be used.
+  auto* next = arena.copy("next");
+  EXPECT_EQ(next, small + 6);
+}
+
+TEST_F(ArenaTests, test_reset) {
+  Arena arena(128);
+  for (size_t i = 0; i < 100; i++) {
+    arena.copy("some content");
+  }
+  EXPECT_GT(arena.reserved(), 128U);
+
+  // A reset keeps a single block for reuse.
+  arena.reset();
+  EXPECT_EQ(arena.used(), 0U);
+  EXPECT_EQ(arena.reserved(), 128U);
+  EXPECT_STREQ(arena.copy("again"), "again");
+}
+}
@@ -0,0 +1,45 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/cgroup.h"
+
+namespace osquery {
+
+class CgroupTests : public testing::Test {};
+
+TEST_F(CgroupTests, test_parse_pressure_stall) {
+  std::string content =
+      "some avg10=12.50 avg60=3.00 avg300=0.75 total=123456\n"
+      "full avg10=1.00 avg60=0.50 avg300=0.10 total=2345\n";
+  double stall = 0;
+  EXPECT_TRUE(parsePressureStall(content, stall));
+  EXPECT_DOUBLE_EQ(12.5, stall);
+
+  EXPECT_FALSE(parsePressureStall("", stall));
+  EXPECT_FALSE(parsePressureStall("full avg10=1.00", stall));
+  EXPECT_FALSE(parsePressureStall("some avg10=", stall));
+}
+
+TEST_F(CgroupTests, test_pressure_priority) {
+  EXPECT_EQ(0U, getPressurePriority(0.0, 10));
+  EXPECT_EQ(0U, getPressurePriority(9.99, 10));
+  EXPECT_EQ(1U, getPressurePriority(10.0, 10));
+  EXPECT_EQ(2U, getPressurePriority(25.0, 10));
+  EXPECT_EQ(3U, getPressurePriority(40.0, 10));
+
+  // The highest priority class is never deferred.
+  EXPECT_EQ(3U, getPressurePriority(100.0, 10));
+
+  // A limit of 0 disables deferral.
+  EXPECT_EQ(0U, getPressurePriority(100.0, 0));
+}
+} // namespace osquery
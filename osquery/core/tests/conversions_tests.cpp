@@ -150,4 +150,35 @@ TEST_F(ConversionsTests, test_json_strings) {
   std::string expected = "{\"key\":\"value\",\"key2\":\"value2\"}";
   EXPECT_EQ(expected, result);
 }
+
+TEST_F(ConversionsTests, test_like_matches) {
+  EXPECT_TRUE(likeMatches("/etc/%", "/etc/passwd"));
+  EXPECT_TRUE(likeMatches("/ETC/%", "/etc/passwd"));
+  EXPECT_TRUE(likeMatches("%/bin/_h", "/usr/bin/sh"));
+  EXPECT_TRUE(likeMatches("%%", ""));
+  EXPECT_TRUE(likeMatches("a%b%c", "aXbYbZc"));
+  EXPECT_FALSE(likeMatches("/etc/%", "/tmp/etc/passwd"));
+  EXPECT_FALSE(likeMatches("_", ""));
+  EXPECT_FALSE(likeMatches("a%b", "aXbY"));
+
+  // A '_' is a single UTF-8 character, only ASCII is case-insensitive.
+  EXPECT_TRUE(likeMatches("_", "\xc3\xa9"));
+  EXPECT_FALSE(likeMatches("__", "\xc3\xa9"));
+  EXPECT_FALSE(likeMatches("\xc3\x89", "\xc3\xa9"));
+}
+
+TEST_F(ConversionsTests, test_glob_matches) {
+  EXPECT_TRUE(globMatches("/etc/*", "/etc/passwd"));
+  EXPECT_FALSE(globMatches("/ETC/*", "/etc/passwd"));
+  EXPECT_TRUE(globMatches("a*[0-9]", "abc7"));
+  EXPECT_TRUE(globMatches("[a-c]?", "bz"));
+  EXPECT_FALSE(globMatches("[a-c]?", "dz"));
+  EXPECT_TRUE(globMatches("*.[^ch]", "a.o"));
+  EXPECT_FALSE(globMatches("*.[^ch]", "a.c"));
+
+  // A leading ']' or trailing '-' is a member of the set.
+  EXPECT_TRUE(globMatches("[]x]", "]"));
+  EXPECT_TRUE(globMatches("[a-]", "-"));
+  EXPECT_FALSE(globMatches("[abc", "a"));
+}
 }
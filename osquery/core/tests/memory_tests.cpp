@@ -0,0 +1,50 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/memory.h"
+
+namespace osquery {
+
+class MemoryTests : public testing::Test {};
+
+TEST_F(MemoryTests, test_memory_tag_scope) {
+  EXPECT_EQ(getMemoryTag(), MemoryTag::UNTAGGED);
+  {
+    MemoryTagScope scheduler(MemoryTag::SCHEDULER);
+    EXPECT_EQ(getMemoryTag(), MemoryTag::SCHEDULER);
+    {
+      MemoryTagScope tables(MemoryTag::TABLES);
+      EXPECT_EQ(getMemoryTag(), MemoryTag::TABLES);
+    }
+    EXPECT_EQ(getMemoryTag(), MemoryTag::SCHEDULER);
+  }
+  EXPECT_EQ(getMemoryTag(), MemoryTag::UNTAGGED);
+}
+
+TEST_F(MemoryTests, test_memory_tag_stats) {
+  auto before = getMemoryTagStats();
+  ASSERT_EQ(before.size(), kMemoryTags);
+  EXPECT_EQ(before[static_cast<size_t>(MemoryTag::CONFIG)].tag, "config");
+
+  // Accounting is keyed by the tag, not by the allocating thread.
+  recordMemoryAllocation(MemoryTag::CONFIG, 1 << 20);
+  recordMemoryAllocation(MemoryTag::CONFIG, 1 << 20);
+  recordMemoryFree(MemoryTag::CONFIG, 1 << 20);
+  recordMemoryFree(MemoryTag::CONFIG, 1 << 20);
+
+  auto after = getMemoryTagStats();
+  const auto& config = after[static_cast<size_t>(MemoryTag::CONFIG)];
+  const auto& previous = before[static_cast<size_t>(MemoryTag::CONFIG)];
+  EXPECT_EQ(config.allocations - previous.allocations, 2U);
+  EXPECT_GE(config.peak_bytes, previous.live_bytes + (2 << 20));
+}
+} // namespace osquery
@@ -0,0 +1,79 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/metrics.h"
+
+namespace osquery {
+
+class MetricsTests : public testing::Test {};
+
+static Metric kTestMetric("osquery_test_total", "A test counter");
+static MetricHistogram kTestHistogram("osquery_test_ms", "A test histogram");
+
+TEST_F(MetricsTests, test_metric_registry) {
+  auto before = kTestMetric.value();
+  kTestMetric.add();
+  kTestMetric.add(2);
+  EXPECT_EQ(kTestMetric.value(), before + 3);
+
+  bool found = false;
+  for (const auto& metric : getMetrics()) {
+    found = found || (metric == &kTestMetric);
+  }
+  EXPECT_TRUE(found);
+
+  MetricsText text;
+  text.add(kTestMetric);
+  EXPECT_EQ(text.str(),
+            "# HELP osquery_test_total A test counter\n"
+            "# TYPE osquery_test_total counter\n"
+            "osquery_test_total " +
+                std::to_string(before + 3) + "\n");
+}
+
+TEST_F(MetricsTests, test_metric_histogram) {
+  MetricHistogram histogram("osquery_test_histogram", "A histogram");
+  histogram.observe(0);
+  histogram.observe(1);
+  histogram.observe(5);
+  histogram.observe(7);
+  histogram.observe(1ULL << 40);
+
+  EXPECT_EQ(histogram.bucket(0), 1U);
+  EXPECT_EQ(histogram.bucket(1), 1U);
+  EXPECT_EQ(histogram.bucket(3), 2U);
+  EXPECT_EQ(histogram.bucket(MetricHistogram::kBuckets - 1), 1U);
+  EXPECT_EQ(histogram.sum(), 13 + (1ULL << 40));
+
+  // Buckets are cumulative and end with +Inf and the count.
+  MetricsText text;
+  text.add(histogram);
+  const auto& str = text.str();
+  EXPECT_NE(str.find("osquery_test_histogram_bucket{le=\"0\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(str.find("osquery_test_histogram_bucket{le=\"7\"} 4\n"),
+            std::string::npos);
+  EXPECT_NE(str.find("osquery_test_histogram_bucket{le=\"+Inf\"} 5\n"),
+            std::string::npos);
+  EXPECT_NE(str.find("osquery_test_histogram_count 5\n"), std::string::npos);
+}
+
+TEST_F(MetricsTests, test_metric_labels) {
+  MetricsText text;
+  text.family("osquery_test_gauge", "gauge", "A gauge");
+  text.sample("osquery_test_gauge", {{"query", "a\"b\\c\nd"}, {"x", "y"}}, 2);
+  EXPECT_EQ(text.str(),
+            "# HELP osquery_test_gauge A gauge\n"
+            "# TYPE osquery_test_gauge gauge\n"
+            "osquery_test_gauge{query=\"a\\\"b\\\\c\\nd\",x=\"y\"} 2\n");
+}
+} // namespace osquery
@@ -0,0 +1,90 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/msgpack.h"
+
+namespace osquery {
+
+class MessagePackTests : public testing::Test {};
+
+TEST_F(MessagePackTests, test_writer) {
+  std::string output;
+  MessagePackWriter w(output);
+  w.nil();
+  w.integer(1);
+  w.integer(300);
+  w.string("abc");
+  w.array(2);
+  w.map(1);
+  EXPECT_EQ(output, std::string("\xc0\x01\xcd\x01\x2c\xa3" "abc\x92\x81", 11));
+
+  output.clear();
+  w.string(std::string(40, 'a'));
+  EXPECT_EQ(output.substr(0, 2), "\xd9\x28");
+  EXPECT_EQ(output.size(), 42U);
+
+  output.clear();
+  w.array(0x10000);
+  EXPECT_EQ(output, std::string("\xdd\x00\x01\x00\x00", 5));
+}
+
+TEST_F(MessagePackTests, test_query_log_item) {
+  QueryLogItem item;
+  item.name = "test_query";
+  item.identifier = "host";
+  item.time = 1;
+
+  Row r1 = {{"a", "1"}, {"b", "2"}};
+  Row r2 = {{"b", "3"}};
+  item.snapshot_results = {r1, r2};
+
+  std::string record;
+  EXPECT_TRUE(serializeQueryLogItemMessagePack(item, record));
+
+  // The record is length-delimited.
+  ASSERT_GT(record.size(), 4U);
+  auto size = (static_cast<uint8_t>(record[2]) << 8) |
+              static_cast<uint8_t>(record[3]);
+  EXPECT_EQ(record.substr(0, 2), std::string("\0\0", 2));
+  EXPECT_EQ(record.size() - 4, static_cast<size_t>(size));
+  EXPECT_EQ(getMessagePackRecordName(record), "test_query");
+
+  // Columns are named once, the second row does not have column "a".
+  std::string rows("\xa7" "columns\x92\xa1" "a\xa1" "b\xa8" "snapshot\x92"
+                   "\x92\xa1" "1\xa1" "2\x92\xc0\xa1" "3");
+  EXPECT_NE(record.find(rows), std::string::npos);
+
+  std::vector<std::string> records;
+  EXPECT_TRUE(serializeQueryLogItemAsEventsMessagePack(item, records));
+  ASSERT_EQ(records.size(), 2U);
+  EXPECT_EQ(getMessagePackRecordName(records[1]), "test_query");
+
+  item.snapshot_results.clear();
+  EXPECT_FALSE(serializeQueryLogItemAsEventsMessagePack(item, records));
+}
+
+TEST_F(MessagePackTests, test_event) {
+  Row r = {{"pid", "1"}, {"time", "2"}, {"other", "3"}};
+
+  std::string record;
+  serializeEventMessagePack("process_events", 7, {"pid", "path", "time"}, r,
+                            record);
+  EXPECT_EQ(getMessagePackRecordName(record), "process_events");
+
+  std::string values("\xa6" "schema\x07\xa6" "values\x93\xa1" "1\xc0\xa1" "2"
+                     "\xa5" "extra\x81\xa5" "other\xa1" "3");
+  EXPECT_EQ(record.substr(4 + 1 + 5 + 15), values);
+  EXPECT_EQ(record[4], '\x84');
+
+  EXPECT_EQ(getMessagePackRecordName("malformed"), "");
+}
+}
@@ -105,6 +105,38 @@ TEST_F(ProcessTests, test_getpid) {
   EXPECT_EQ(process->pid(), pid);
 }
 
+TEST_F(ProcessTests, test_getProcessUsage) {
+  ProcessUsage usage;
+  auto status = getProcessUsage(static_cast<pid_t>(platformGetPid()), usage);
+  ASSERT_TRUE(status.ok());
+
+  // The tests are resident and have a parent.
+  EXPECT_GT(usage.resident_size, 0U);
+  EXPECT_NE(usage.parent, 0);
+
+  // An invalid process has no usage.
+  EXPECT_FALSE(getProcessUsage(static_cast<pid_t>(-1), usage).ok());
+}
+
+TEST_F(ProcessTests, test_getThreadUsage) {
+  ThreadUsage t0;
+  ASSERT_TRUE(getThreadUsage(t0).ok());
+
+  // Spin until the thread has used CPU, the resolution varies by platform.
+  ThreadUsage t1;
+  volatile size_t spin = 0;
+  for (size_t i = 0; i < 1000; i++) {
+    for (size_t j = 0; j < 100000; j++) {
+      spin = spin + j;
+    }
+    ASSERT_TRUE(getThreadUsage(t1).ok());
+    if (t1.user_time + t1.system_time > t0.user_time + t0.system_time) {
+      break;
+    }
+  }
+  EXPECT_GT(t1.user_time + t1.system_time, t0.user_time + t0.system_time);
+}
+
 TEST_F(ProcessTests, test_envVar) {
   auto val = getEnvVar("GTEST_OSQUERY");
   EXPECT_FALSE(val);
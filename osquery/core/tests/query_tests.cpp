@@ -18,6 +18,7 @@
 
 #include <osquery/query.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
@@ -73,6 +74,251 @@ TEST_F(QueryTests, test_add_and_get_current_results) {
   }
 }
 
+TEST_F(QueryTests, test_fingerprint_results) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("fingerprints", query);
+  auto results = getTestDBExpectedResults();
+  uint64_t counter = 0;
+  DiffResults dr;
+  ASSERT_TRUE(cf.addNewResults(results, 0, counter, dr).ok());
+
+  // The stored results are sorted row fingerprints and each row's JSON.
+  std::string stored;
+  getDatabaseValue(kQueries, "fingerprints", stored);
+  auto lines = split(stored, "\n");
+  ASSERT_EQ(lines.size(), results.size() + 1);
+  EXPECT_EQ(lines[0], "fingerprints");
+  EXPECT_TRUE(std::is_sorted(lines.begin() + 1, lines.end()));
+
+  // Removing a row only materializes the removed row.
+  auto removed = results.back();
+  results.pop_back();
+  dr = DiffResults();
+  ASSERT_TRUE(cf.addNewResults(results, 0, counter, dr).ok());
+  EXPECT_TRUE(dr.added.empty());
+  ASSERT_EQ(dr.removed.size(), 1U);
+  EXPECT_EQ(dr.removed[0], removed);
+
+  // Queries that do not report removed rows only store fingerprints.
+  query.options["removed"] = false;
+  auto cf_fingerprints = Query("fingerprints_only", query);
+  ASSERT_TRUE(cf_fingerprints.addNewResults(results, 0, counter, dr).ok());
+  getDatabaseValue(kQueries, "fingerprints_only", stored);
+  EXPECT_EQ(stored.find('{'), std::string::npos);
+
+  dr = DiffResults();
+  results.push_back(removed);
+  ASSERT_TRUE(cf_fingerprints.addNewResults(results, 0, counter, dr).ok());
+  ASSERT_EQ(dr.added.size(), 1U);
+  EXPECT_EQ(dr.added[0], removed);
+}
+
+TEST_F(QueryTests, test_legacy_results) {
+  // Results stored as a JSON array are diffed and replaced with fingerprints.
+  auto encoded_qd = getSerializedQueryDataJSON();
+  setDatabaseValue(kQueries, "legacy_results", encoded_qd.first);
+
+  auto cf = Query("legacy_results", getOsqueryScheduledQuery());
+  uint64_t counter = 0;
+  DiffResults dr;
+  ASSERT_TRUE(cf.addNewResults(encoded_qd.second, 0, counter, dr).ok());
+  EXPECT_TRUE(dr.added.empty());
+  EXPECT_TRUE(dr.removed.empty());
+
+  std::string stored;
+  getDatabaseValue(kQueries, "legacy_results", stored);
+  EXPECT_EQ(stored.find("fingerprints\n"), 0U);
+
+  QueryDataSet previous_qd;
+  ASSERT_TRUE(cf.getPreviousQueryResults(previous_qd).ok());
+  EXPECT_EQ(previous_qd.size(), encoded_qd.second.size());
+}
+
+TEST_F(QueryTests, test_compressed_results) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("compressed_results", query);
+  QueryData results;
+  for (size_t i = 0; i < 256; i++) {
+    results.push_back({{"name", "row_" + std::to_string(i)},
+                       {"path", "/usr/local/lib/row_" + std::to_string(i)}});
+  }
+
+  // Large results are compressed.
+  uint64_t counter = 0;
+  DiffResults dr;
+  ASSERT_TRUE(cf.addNewResults(results, 0, counter, dr).ok());
+  std::string base;
+  getDatabaseValue(kQueries, "compressed_results", base);
+  EXPECT_EQ(base.find("zstd\n"), 0U);
+
+  std::string meta;
+  getDatabaseValue(kQueries, "compressed_results" + kQueryMetadataKey, meta);
+  EXPECT_EQ(meta, "0 0\n" + query.query);
+
+  // A small change is stored as a delta, the compressed results are kept.
+  auto removed = results.back();
+  results.pop_back();
+  Row added = {{"name", "compressed"}};
+  results.push_back(added);
+  dr = DiffResults();
+  ASSERT_TRUE(cf.addNewResults(results, 0, counter, dr).ok());
+  ASSERT_EQ(dr.added.size(), 1U);
+  EXPECT_EQ(dr.added[0], added);
+  ASSERT_EQ(dr.removed.size(), 1U);
+  EXPECT_EQ(dr.removed[0], removed);
+
+  std::string stored;
+  getDatabaseValue(kQueries, "compressed_results", stored);
+  EXPECT_EQ(stored, base);
+  std::string delta;
+  getDatabaseValue(kQueries, "compressed_results" + kQueryDeltaKey, delta);
+  EXPECT_EQ(delta.find("delta\n"), 0U);
+
+  QueryDataSet previous_qd;
+  ASSERT_TRUE(cf.getPreviousQueryResults(previous_qd).ok());
+  EXPECT_EQ(previous_qd, QueryDataSet(results.begin(), results.end()));
+
+  // Unchanged results are not written.
+  dr = DiffResults();
+  ASSERT_TRUE(cf.addNewResults(results, 0, counter, dr).ok());
+  EXPECT_TRUE(dr.added.empty());
+  EXPECT_TRUE(dr.removed.empty());
+  EXPECT_EQ(counter, 2U);
+
+  // A large change replaces the compressed results and removes the delta.
+  for (auto& row : results) {
+    row["path"] = "/opt";
+  }
+  dr = DiffResults();
+  ASSERT_TRUE(cf.addNewResults(results, 0, counter, dr).ok());
+  EXPECT_EQ(dr.added.size(), results.size());
+  getDatabaseValue(kQueries, "compressed_results", stored);
+  EXPECT_NE(stored, base);
+  delta.clear();
+  getDatabaseValue(kQueries, "compressed_results" + kQueryDeltaKey, delta);
+  EXPECT_TRUE(delta.empty());
+
+  previous_qd.clear();
+  ASSERT_TRUE(cf.getPreviousQueryResults(previous_qd).ok());
+  EXPECT_EQ(previous_qd, QueryDataSet(results.begin(), results.end()));
+}
+
+TEST_F(QueryTests, test_legacy_metadata) {
+  // The epoch, counter, and query stored as separate keys are migrated.
+  auto query = getOsqueryScheduledQuery();
+  auto encoded_qd = getSerializedQueryDataJSON();
+  setDatabaseValue(kQueries, "legacy_metadata", encoded_qd.first);
+  setDatabaseValue(kQueries, "legacy_metadataepoch", "5");
+  setDatabaseValue(kQueries, "legacy_metadatacounter", "3");
+  setDatabaseValue(kQueries, "query.legacy_metadata", query.query);
+
+  auto cf = Query("legacy_metadata", query);
+  EXPECT_EQ(cf.getPreviousEpoch(), 5U);
+  EXPECT_EQ(cf.getQueryCounter(false), 4U);
+  EXPECT_FALSE(cf.isNewQuery());
+
+  uint64_t counter = 0;
+  ASSERT_TRUE(cf.addNewResults(encoded_qd.second, 5, counter).ok());
+  EXPECT_EQ(counter, 4U);
+
+  std::string value;
+  EXPECT_FALSE(getDatabaseValue(kQueries, "legacy_metadataepoch", value).ok());
+  EXPECT_FALSE(getDatabaseValue(kQueries, "query.legacy_metadata", value).ok());
+  getDatabaseValue(kQueries, "legacy_metadata" + kQueryMetadataKey, value);
+  EXPECT_EQ(value, "5 4\n" + query.query);
+}
+
+TEST_F(QueryTests, test_mirrored_metadata) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("mirrored_metadata", query);
+  uint64_t counter = 0;
+  ASSERT_TRUE(cf.addNewResults(getTestDBExpectedResults(), 2, counter).ok());
+  EXPECT_EQ(cf.getPreviousEpoch(), 2U);
+
+  // Metadata written without the Query API is read once invalidated.
+  setDatabaseValue(
+      kQueries, "mirrored_metadata" + kQueryMetadataKey, "7 9\n" + query.query);
+  EXPECT_EQ(cf.getPreviousEpoch(), 2U);
+  Query::invalidateMetadata("mirrored_metadata");
+  EXPECT_EQ(cf.getPreviousEpoch(), 7U);
+  EXPECT_EQ(cf.getQueryCounter(false), 10U);
+
+  ASSERT_TRUE(cf.addNewResults(getTestDBExpectedResults(), 7, counter).ok());
+  EXPECT_EQ(counter, 10U);
+  EXPECT_EQ(cf.getQueryCounter(false), 11U);
+}
+
+TEST_F(QueryTests, test_stream_results) {
+  auto cf = Query("stream_results", getOsqueryScheduledQuery());
+  auto results = getTestDBExpectedResults();
+
+  DiffResults dr;
+  size_t batches = 0;
+  auto emit = [&dr, &batches](DiffResults& batch) {
+    batches++;
+    dr.added.insert(dr.added.end(), batch.added.begin(), batch.added.end());
+    dr.removed.insert(
+        dr.removed.end(), batch.removed.begin(), batch.removed.end());
+    return Status(0, "OK");
+  };
+
+  // Each chunk holds, and each batch emits, a single row.
+  uint64_t counter = 0;
+  {
+    QueryDiffStream stream(cf, 0, 1, emit);
+    ASSERT_TRUE(stream.begin(counter).ok());
+    for (auto row : results) {
+      ASSERT_TRUE(stream.add(row).ok());
+    }
+    ASSERT_TRUE(stream.end().ok());
+  }
+  EXPECT_EQ(counter, 0U);
+  EXPECT_EQ(dr.added, results);
+  EXPECT_EQ(batches, results.size());
+
+  std::string stored;
+  getDatabaseValue(kQueries, "stream_results", stored);
+  EXPECT_EQ(stored.find("chunks\n1 " + std::to_string(results.size())), 0U);
+
+  // Remove a row and add a new row, unchanged rows are not emitted.
+  auto removed = results.back();
+  results.pop_back();
+  Row added = {{"name", "stream"}};
+  results.push_back(added);
+
+  dr = DiffResults();
+  {
+    QueryDiffStream stream(cf, 0, 1, emit);
+    ASSERT_TRUE(stream.begin(counter).ok());
+    for (auto row : results) {
+      ASSERT_TRUE(stream.add(row).ok());
+    }
+    ASSERT_TRUE(stream.end().ok());
+  }
+  EXPECT_EQ(counter, 1U);
+  ASSERT_EQ(dr.added.size(), 1U);
+  EXPECT_EQ(dr.added[0], added);
+  ASSERT_EQ(dr.removed.size(), 1U);
+  EXPECT_EQ(dr.removed[0], removed);
+
+  // The previous generation of chunks is removed.
+  std::string chunk;
+  getDatabaseValue(kQueries, "stream_results" + kQueryChunkKey + "1.1", chunk);
+  EXPECT_TRUE(chunk.empty());
+
+  // Chunked results are read, and replaced, by a whole-results differential.
+  QueryDataSet previous_qd;
+  ASSERT_TRUE(cf.getPreviousQueryResults(previous_qd).ok());
+  EXPECT_EQ(previous_qd.size(), results.size());
+
+  dr = DiffResults();
+  ASSERT_TRUE(cf.addNewResults(results, 0, counter, dr).ok());
+  EXPECT_TRUE(dr.added.empty());
+  EXPECT_TRUE(dr.removed.empty());
+  getDatabaseValue(kQueries, "stream_results", stored);
+  EXPECT_EQ(stored.find("fingerprints\n"), 0U);
+}
+
 TEST_F(QueryTests, test_get_query_results) {
   // Grab an expected set of query data and add it as the previous result.
   auto encoded_qd = getSerializedQueryDataJSON();
@@ -145,4 +391,27 @@ TEST_F(QueryTests, test_get_stored_query_names) {
   auto in_vector = std::find(names.begin(), names.end(), "foobar");
   EXPECT_NE(in_vector, names.end());
 }
+
+TEST_F(QueryTests, test_performance_histogram) {
+  PerformanceHistogram histogram;
+  EXPECT_EQ(histogram.toString(), "");
+
+  histogram.add(0);
+  histogram.add(1);
+  histogram.add(5);
+  histogram.add(7);
+  histogram.add(8);
+  EXPECT_EQ(histogram.toString(), "0:1,1:1,4:2,8:1");
+
+  // Percentiles are bounded by the end of their bucket and the largest value.
+  EXPECT_EQ(histogram.percentile(50), 7U);
+  EXPECT_EQ(histogram.percentile(99), 8U);
+  EXPECT_EQ(histogram.max, 8U);
+  EXPECT_EQ(PerformanceHistogram().percentile(99), 0U);
+
+  // Values beyond the last bucket are counted within it.
+  histogram.add(~0ULL);
+  EXPECT_EQ(histogram.counts[PerformanceHistogram::kBuckets - 1], 1U);
+  EXPECT_EQ(histogram.percentile(100), ~0ULL);
+}
 }
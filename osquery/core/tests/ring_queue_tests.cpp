@@ -0,0 +1,81 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <memory>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/ring_queue.h"
+
+namespace osquery {
+
+class RingQueueTests : public testing::Test {};
+
+TEST_F(RingQueueTests, test_capacity) {
+  RingQueue<int> queue(3);
+  EXPECT_EQ(queue.capacity(), 4U);
+  EXPECT_TRUE(queue.empty());
+
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(queue.push(i));
+  }
+
+  // A full queue drops the item.
+  EXPECT_FALSE(queue.push(4));
+  EXPECT_EQ(queue.size(), 4U);
+
+  int item = 0;
+  EXPECT_TRUE(queue.pop(item));
+  EXPECT_EQ(item, 0);
+  EXPECT_TRUE(queue.push(4));
+}
+
+TEST_F(RingQueueTests, test_order) {
+  RingQueue<std::shared_ptr<int>> queue(8);
+
+  // Positions wrap around the ring.
+  for (int i = 0; i < 20; i++) {
+    EXPECT_TRUE(queue.push(std::make_shared<int>(i)));
+    std::shared_ptr<int> item;
+    EXPECT_TRUE(queue.pop(item));
+    EXPECT_EQ(*item, i);
+  }
+
+  std::shared_ptr<int> item;
+  EXPECT_FALSE(queue.pop(item));
+}
+
+TEST_F(RingQueueTests, test_producer_consumer) {
+  RingQueue<size_t> queue(16);
+  const size_t count = 100000;
+
+  std::thread producer([&queue, count]() {
+    for (size_t i = 0; i < count; i++) {
+      while (!queue.push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  size_t expected = 0;
+  while (expected < count) {
+    size_t item = 0;
+    if (queue.pop(item)) {
+      EXPECT_EQ(item, expected++);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  producer.join();
+  EXPECT_TRUE(queue.empty());
+}
+}
@@ -0,0 +1,45 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/startup.h"
+
+namespace osquery {
+
+class StartupTests : public testing::Test {};
+
+TEST_F(StartupTests, test_startup_phases) {
+  auto count = getStartupPhases().size();
+  {
+    StartupPhaseScope phase("test_outer");
+    std::thread([]() {
+      StartupPhaseScope inner("test_inner", true);
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }).join();
+  }
+
+  auto phases = getStartupPhases();
+  ASSERT_EQ(phases.size(), count + 2);
+
+  // Phases are recorded as they complete.
+  const auto& inner = phases[count];
+  const auto& outer = phases[count + 1];
+  EXPECT_EQ(inner.name, "test_inner");
+  EXPECT_TRUE(inner.background);
+  EXPECT_GE(inner.duration, 20U);
+  EXPECT_EQ(outer.name, "test_outer");
+  EXPECT_FALSE(outer.background);
+  EXPECT_LE(outer.start, inner.start);
+  EXPECT_GE(outer.duration, inner.duration);
+}
+} // namespace osquery
@@ -138,6 +138,52 @@ TEST_F(TablesTests, test_constraint_map_cast) {
   EXPECT_FALSE(cm["num"].existsAndMatches("hello"));
 }
 
+TEST_F(TablesTests, test_constraint_patterns) {
+  ConstraintList cl;
+  cl.affinity = TEXT_TYPE;
+  cl.add(Constraint(LIKE, "/ETC/%"));
+  EXPECT_TRUE(cl.matches("/etc/hosts"));
+  EXPECT_TRUE(cl.matches("/Etc/"));
+  EXPECT_FALSE(cl.matches("/tmp/hosts"));
+
+  // Every pattern must match.
+  cl.add(Constraint(GLOB, "*hosts"));
+  EXPECT_TRUE(cl.matches("/etc/hosts"));
+  EXPECT_FALSE(cl.matches("/ETC/HOSTS"));
+  EXPECT_FALSE(cl.matches("/etc/passwd"));
+
+  // Patterns are only TEXT comparisons.
+  ConstraintList cl2;
+  cl2.affinity = INTEGER_TYPE;
+  cl2.add(Constraint(LIKE, "1%"));
+  EXPECT_TRUE(cl2.matches(2));
+}
+
+TEST_F(TablesTests, test_constraint_compiled) {
+  ConstraintList cl;
+  cl.affinity = BIGINT_TYPE;
+  cl.add(Constraint(EQUALS, "1"));
+  cl.add(Constraint(EQUALS, "2"));
+  EXPECT_FALSE(cl.matches(1));
+  EXPECT_FALSE(cl.matches(2));
+
+  // Constraints are compiled incrementally.
+  ConstraintList cl2;
+  cl2.affinity = BIGINT_TYPE;
+  cl2.add(Constraint(GREATER_THAN, "1"));
+  EXPECT_TRUE(cl2.matches(3));
+  cl2.add(Constraint(LESS_THAN, "3"));
+  EXPECT_FALSE(cl2.matches(3));
+  EXPECT_TRUE(cl2.matches(2));
+
+  // The affinity may be set after the constraints are added.
+  ConstraintList cl3;
+  cl3.add(Constraint(GREATER_THAN, "9"));
+  EXPECT_FALSE(cl3.matches("10"));
+  cl3.affinity = INTEGER_TYPE;
+  EXPECT_TRUE(cl3.matches("10"));
+}
+
 class TestTablePlugin : public TablePlugin {
  public:
   void testSetCache(size_t step, size_t interval) {
@@ -179,4 +225,71 @@ TEST_F(TablesTests, test_caching) {
   EXPECT_TRUE(test.testIsCached(6));
   EXPECT_FALSE(test.testIsCached(7));
 }
+
+TEST_F(TablesTests, test_table_rows) {
+  TableColumns columns = {
+      std::make_tuple("name", TEXT_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("count", BIGINT_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("ratio", DOUBLE_TYPE, ColumnOptions::DEFAULT),
+  };
+
+  TableRows rows(columns);
+  EXPECT_TRUE(rows.empty());
+  EXPECT_EQ(rows.columns(), 3U);
+  EXPECT_EQ(rows.column("count"), 1U);
+  EXPECT_EQ(rows.column("missing"), TableRows::kInvalidColumn);
+
+  rows.addRow();
+  rows.setText(0, "first");
+  rows.setInteger(1, 10);
+  rows.setDouble(2, 0.5);
+
+  // String rows are converted once using the column affinity.
+  rows.addRow({{"name", "second"}, {"count", "not_a_number"}});
+  ASSERT_EQ(rows.size(), 2U);
+
+  const auto& text = rows.cell(0, 0);
+  EXPECT_EQ(text.kind, TableCell::Kind::Text);
+  EXPECT_EQ(std::string(text.value.text, text.size), "first");
+  EXPECT_EQ(rows.cell(0, 1).kind, TableCell::Kind::Integer);
+  EXPECT_EQ(rows.cell(0, 1).value.integer, 10);
+  EXPECT_EQ(rows.cell(0, 2).kind, TableCell::Kind::Double);
+  EXPECT_EQ(rows.cell(1, 1).kind, TableCell::Kind::Null);
+  EXPECT_EQ(rows.cell(1, 2).kind, TableCell::Kind::Null);
+
+  auto results = rows.toQueryData();
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["name"], "first");
+  EXPECT_EQ(results[0]["count"], "10");
+  EXPECT_EQ(results[1]["name"], "second");
+  EXPECT_EQ(results[1]["count"], "");
+
+  rows.clear();
+  EXPECT_TRUE(rows.empty());
+}
+
+TEST_F(TablesTests, test_context_request_columns) {
+  QueryContext context;
+  context.limit = 3;
+  context.colsUsed = UsedColumns({"pid", "name"});
+
+  PluginRequest request;
+  TablePlugin::setRequestFromContext(context, request);
+
+  QueryContext output;
+  TablePlugin::setContextFromRequest(request, output);
+  EXPECT_EQ(output.limit, 3U);
+  ASSERT_TRUE(output.colsUsed);
+  EXPECT_EQ(output.colsUsed->size(), 2U);
+  EXPECT_TRUE(output.isColumnUsed("pid"));
+  EXPECT_FALSE(output.isColumnUsed("path"));
+
+  // Without known used columns every column is used.
+  context.colsUsed = boost::none;
+  TablePlugin::setRequestFromContext(context, request);
+  QueryContext all;
+  TablePlugin::setContextFromRequest(request, all);
+  EXPECT_FALSE(all.colsUsed);
+  EXPECT_TRUE(all.isColumnUsed("path"));
+}
 }
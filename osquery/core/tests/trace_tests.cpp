@@ -0,0 +1,70 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/trace.h"
+
+namespace osquery {
+
+class TraceTests : public testing::Test {
+ protected:
+  void TearDown() override {
+    setTraceEnabled(false);
+    clearTraceSpans();
+  }
+};
+
+TEST_F(TraceTests, test_trace_spans) {
+  setTraceEnabled(false);
+  clearTraceSpans();
+  { TRACE_SPAN("test_disabled"); }
+  EXPECT_TRUE(getTraceSpans().empty());
+
+  setTraceEnabled(true);
+  std::string table = "processes";
+  {
+    TRACE_SPAN("test_outer");
+    std::thread([&table]() {
+      TRACE_SPAN("test_inner", table);
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }).join();
+  }
+
+  // Spans of every thread are ordered by their start.
+  auto spans = getTraceSpans();
+  ASSERT_EQ(spans.size(), 2U);
+  EXPECT_EQ(std::string(spans[0].name), "test_outer");
+  EXPECT_EQ(std::string(spans[1].name), "test_inner");
+  EXPECT_EQ(spans[1].detail, "processes");
+  EXPECT_NE(spans[0].thread, spans[1].thread);
+  EXPECT_GE(spans[1].duration, 2000000U);
+  EXPECT_GE(spans[0].duration, spans[1].duration);
+
+  auto json = serializeTraceSpans(spans);
+  EXPECT_NE(json.find("\"name\":\"test_inner\""), std::string::npos);
+  EXPECT_NE(json.find("\"ph\":\"X\""), std::string::npos);
+  EXPECT_NE(json.find("\"args\":{\"detail\":\"processes\"}"),
+            std::string::npos);
+}
+
+TEST_F(TraceTests, test_trace_ring) {
+  setTraceEnabled(true);
+  clearTraceSpans();
+  for (size_t i = 0; i < kTraceBufferSpans + 10; i++) {
+    TRACE_SPAN("test_ring");
+  }
+
+  // A thread keeps its most recent spans.
+  EXPECT_EQ(getTraceSpans().size(), kTraceBufferSpans);
+}
+} // namespace osquery
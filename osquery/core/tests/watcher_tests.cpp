@@ -196,15 +196,16 @@ class FakeWatcherRunner : public WatcherRunner {
   /**
    * @brief What the runner's internals will use as process state.
    *
-   * Internal calls to getProcessRow will return this structure.
+   * Internal calls to getProcessUsage will return this structure.
    */
-  void setProcessRow(QueryData qd) {
-    qd_ = std::move(qd);
+  void setProcessUsage(const ProcessUsage& usage) {
+    usage_ = usage;
   }
 
-  /// The tests do not have access to the processes table.
-  QueryData getProcessRow(pid_t pid) const {
-    return qd_;
+  /// The tests report the usage of a fake process.
+  Status getProcessUsage(pid_t pid, ProcessUsage& usage) const override {
+    usage = usage_;
+    return Status(0, "OK");
   }
 
  private:
@@ -212,20 +213,20 @@ class FakeWatcherRunner : public WatcherRunner {
   void stopChild(const PlatformProcess& child) const {}
 
  private:
-  QueryData qd_;
+  ProcessUsage usage_;
 };
 
 TEST_F(WatcherTests, test_watcherrunner_watcherhealth) {
   FakeWatcherRunner runner(0, nullptr, true);
 
-  // Construct a process state, assume this would have been returned from the
-  // processes table, which the WorkerRunner normally uses internally.
-  Row r;
-  r["parent"] = INTEGER(1);
-  r["user_time"] = INTEGER(100);
-  r["system_time"] = INTEGER(100);
-  r["resident_size"] = INTEGER(100);
-  runner.setProcessRow({r});
+  // Construct a process state, assume this would have been read from the
+  // process' accounting, which the WorkerRunner normally uses internally.
+  ProcessUsage r;
+  r.parent = 1;
+  r.user_time = 100;
+  r.system_time = 100;
+  r.resident_size = 100;
+  runner.setProcessUsage(r);
 
   // Hold the process and process state externally.
   // Normally the WatcherRunner's entry point will persist these and use them
@@ -248,22 +249,22 @@ TEST_F(WatcherTests, test_watcherrunner_watcherhealth) {
 
   // Now we can alter the performance.
   // Let us emulate the watcher having just allocated 1G of memory.
-  r["resident_size"] = INTEGER(1024 * 1024 * 1024);
-  runner.setProcessRow({r});
+  r.resident_size = 1024 * 1024 * 1024;
+  runner.setProcessUsage(r);
 
   auto status = runner.isWatcherHealthy(*test_process, state);
   EXPECT_FALSE(status.ok());
   EXPECT_EQ(status.getMessage(), "Memory limits exceeded");
 
   // Now emulate a rapid increase in CPU requirements.
-  r["user_time"] = INTEGER(1024 * 1024 * 1024);
-  runner.setProcessRow({r});
+  r.user_time = 1024 * 1024 * 1024;
+  runner.setProcessUsage(r);
   runner.isWatcherHealthy(*test_process, state);
   EXPECT_EQ(1U, state.sustained_latency);
 
   // And again, the CPU continues to increase from the system perspective.
-  r["system_time"] = INTEGER(1024 * 1024 * 1024);
-  runner.setProcessRow({r});
+  r.system_time = 1024 * 1024 * 1024;
+  runner.setProcessUsage(r);
   runner.isWatcherHealthy(*test_process, state);
   EXPECT_EQ(2U, state.sustained_latency);
 }
@@ -276,21 +277,21 @@ TEST_F(WatcherTests, test_watcherrunner_unhealthy_delay) {
   fake_test_process.setStatus(PROCESS_STILL_ALIVE, 0);
 
   // Set up a fake test process and place it into an healthy state.
-  Row r;
-  r["parent"] = isPlatform(PlatformType::TYPE_WINDOWS)
-                    ? INTEGER(test_process->pid())
-                    : INTEGER(test_process->nativeHandle());
-  r["user_time"] = INTEGER(100);
-  r["system_time"] = INTEGER(100);
-  r["resident_size"] = INTEGER(100);
-  runner.setProcessRow({r});
+  ProcessUsage r;
+  r.parent = isPlatform(PlatformType::TYPE_WINDOWS)
+                 ? static_cast<pid_t>(test_process->pid())
+                 : static_cast<pid_t>(test_process->nativeHandle());
+  r.user_time = 100;
+  r.system_time = 100;
+  r.resident_size = 100;
+  runner.setProcessUsage(r);
 
   // Check the fake process sanity, which records the state at t=0.
   EXPECT_TRUE(runner.isChildSane(fake_test_process));
 
   // Update the fake process resident memory, make it unhealthy.
-  r["resident_size"] = INTEGER(1024 * 1024 * 1024);
-  runner.setProcessRow({r});
+  r.resident_size = 1024 * 1024 * 1024;
+  runner.setProcessUsage(r);
 
   // Set the watchdog to delay 1000s.
   auto delay = FLAGS_watchdog_delay;
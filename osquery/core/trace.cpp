@@ -0,0 +1,250 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <csignal>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+#include <osquery/core.h>
+#include <osquery/dispatcher.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/json.h"
+#include "osquery/core/process.h"
+#include "osquery/core/trace.h"
+
+namespace rj = rapidjson;
+
+namespace osquery {
+
+FLAG(bool, trace, false, "Record spans of work for trace dumps");
+
+FLAG(string,
+     trace_path,
+     OSQUERY_DB_HOME "/osquery.trace",
+     "Path prefix of trace dumps requested with SIGUSR2");
+
+using TraceClock = std::chrono::steady_clock;
+
+/// Span times are relative to static initialization of the process.
+static const TraceClock::time_point kTraceOrigin = TraceClock::now();
+
+/// The most rings kept, the rings of exited threads are replaced first.
+static const size_t kTraceBuffersMax = 256;
+
+/// The spans of a single thread.
+struct TraceBuffer {
+  std::mutex mutex;
+  std::vector<TraceSpan> spans;
+
+  /// The position of the next span, wrapping at kTraceBufferSpans.
+  size_t next{0};
+
+  uint64_t thread{0};
+};
+
+/// Every thread's ring, the dump reads each under its own lock.
+static std::vector<std::shared_ptr<TraceBuffer>> kTraceBuffers;
+static Mutex kTraceBuffersMutex;
+
+/// The ring of the calling thread, shared with kTraceBuffers.
+static thread_local std::shared_ptr<TraceBuffer> kTraceBuffer{nullptr};
+
+static std::atomic<bool> kTraceEnabled{false};
+static std::atomic<bool> kTraceFlagRead{false};
+static std::atomic<uint64_t> kTraceThreads{0};
+
+/// Set by a SIGUSR2, cleared when the dump is written.
+static volatile std::sig_atomic_t kTraceDumpRequested{0};
+
+static inline uint64_t traceNanoseconds() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(TraceClock::now() -
+                                                           kTraceOrigin)
+          .count());
+}
+
+bool isTraceEnabled() {
+  if (!kTraceFlagRead) {
+    // The flag is parsed after static initialization, read it on first use.
+    kTraceEnabled = FLAGS_trace;
+    kTraceFlagRead = true;
+  }
+  return kTraceEnabled;
+}
+
+void setTraceEnabled(bool enabled) {
+  kTraceEnabled = enabled;
+  kTraceFlagRead = true;
+}
+
+static TraceBuffer& getTraceBuffer() {
+  if (kTraceBuffer == nullptr) {
+    kTraceBuffer = std::make_shared<TraceBuffer>();
+    kTraceBuffer->spans.resize(kTraceBufferSpans);
+    kTraceBuffer->thread = ++kTraceThreads;
+
+    WriteLock lock(kTraceBuffersMutex);
+    if (kTraceBuffers.size() >= kTraceBuffersMax) {
+      auto exited = std::find_if(kTraceBuffers.begin(),
+                                 kTraceBuffers.end(),
+                                 [](const std::shared_ptr<TraceBuffer>& b) {
+                                   return b.use_count() == 1;
+                                 });
+      if (exited != kTraceBuffers.end()) {
+        kTraceBuffers.erase(exited);
+      }
+    }
+    kTraceBuffers.push_back(kTraceBuffer);
+  }
+  return *kTraceBuffer;
+}
+
+TraceScope::TraceScope(const char* name) : name_(name) {
+  if (isTraceEnabled()) {
+    start_ = traceNanoseconds();
+  }
+}
+
+TraceScope::TraceScope(const char* name, const std::string& detail)
+    : name_(name), detail_(&detail) {
+  if (isTraceEnabled()) {
+    start_ = traceNanoseconds();
+  }
+}
+
+TraceScope::~TraceScope() {
+  if (start_ == 0) {
+    return;
+  }
+
+  auto end = traceNanoseconds();
+  auto& buffer = getTraceBuffer();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  auto& span = buffer.spans[buffer.next % kTraceBufferSpans];
+  span.name = name_;
+  if (detail_ != nullptr) {
+    span.detail.assign(*detail_);
+  } else {
+    span.detail.clear();
+  }
+  span.start = start_;
+  span.duration = end - start_;
+  span.thread = buffer.thread;
+  buffer.next++;
+}
+
+std::vector<TraceSpan> getTraceSpans() {
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+  {
+    ReadLock lock(kTraceBuffersMutex);
+    buffers = kTraceBuffers;
+  }
+
+  std::vector<TraceSpan> spans;
+  for (const auto& buffer : buffers) {
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    auto count = std::min(buffer->next, kTraceBufferSpans);
+    for (size_t i = buffer->next - count; i < buffer->next; i++) {
+      spans.push_back(buffer->spans[i % kTraceBufferSpans]);
+    }
+  }
+
+  std::sort(spans.begin(),
+            spans.end(),
+            [](const TraceSpan& a, const TraceSpan& b) {
+              return a.start < b.start;
+            });
+  return spans;
+}
+
+void clearTraceSpans() {
+  ReadLock lock(kTraceBuffersMutex);
+  for (const auto& buffer : kTraceBuffers) {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    buffer->next = 0;
+  }
+}
+
+std::string serializeTraceSpans(const std::vector<TraceSpan>& spans) {
+  auto doc = JSON::newArray();
+  auto& allocator = doc.doc().GetAllocator();
+  auto pid = static_cast<size_t>(platformGetPid());
+  for (const auto& span : spans) {
+    auto event = doc.getObject();
+    doc.addCopy("name", span.name, event);
+    doc.addCopy("cat", "osquery", event);
+    doc.addCopy("ph", "X", event);
+    // Chrome trace events use microseconds.
+    doc.add("ts", static_cast<size_t>(span.start / 1000), event);
+    doc.add("dur", static_cast<size_t>(span.duration / 1000), event);
+    doc.add("pid", pid, event);
+    doc.add("tid", static_cast<size_t>(span.thread), event);
+    if (!span.detail.empty()) {
+      rj::Value args(rj::kObjectType);
+      args.AddMember("detail",
+                     rj::Value(span.detail.c_str(), allocator).Move(),
+                     allocator);
+      event.AddMember("args", args, allocator);
+    }
+    doc.push(event);
+  }
+
+  std::string json;
+  doc.toString(json);
+  return json;
+}
+
+Status dumpTrace(const std::string& path) {
+  auto spans = getTraceSpans();
+  auto status = writeTextFile(path, serializeTraceSpans(spans), 0600);
+  if (status.ok()) {
+    VLOG(1) << "Wrote " << spans.size() << " trace spans to " << path;
+  }
+  return status;
+}
+
+void requestTraceDump(int) {
+  kTraceDumpRequested = 1;
+}
+
+/// Write a dump for each SIGUSR2 received.
+class TraceDumpRunner : public InternalRunnable {
+ public:
+  TraceDumpRunner() : InternalRunnable("TraceDumpRunner") {}
+
+  void start() override {
+    while (!interrupted()) {
+      if (kTraceDumpRequested != 0) {
+        kTraceDumpRequested = 0;
+        auto path = FLAGS_trace_path + "." +
+                    std::to_string(platformGetPid()) + ".json";
+        auto status = dumpTrace(path);
+        if (!status.ok()) {
+          LOG(WARNING) << "Cannot write trace: " << status.getMessage();
+        }
+      }
+      pauseMilli(200);
+    }
+  }
+};
+
+void startTraceDumps() {
+  if (isTraceEnabled()) {
+    Dispatcher::addService(std::make_shared<TraceDumpRunner>());
+  }
+}
+} // namespace osquery
@@ -0,0 +1,100 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// The most spans kept for each thread, older spans are overwritten.
+const size_t kTraceBufferSpans = 8192;
+
+/// A completed span of work on a thread.
+struct TraceSpan {
+  /// A static name of the instrumented work, such as "xFilter".
+  const char* name{nullptr};
+
+  /// An optional detail, such as the table name.
+  std::string detail;
+
+  /// Nanoseconds since the process started when the span began.
+  uint64_t start{0};
+
+  /// Nanoseconds the span took.
+  uint64_t duration{0};
+
+  /// A small number identifying the thread.
+  uint64_t thread{0};
+};
+
+/**
+ * @brief Record the time taken by a scope of work when --trace is enabled.
+ *
+ * Each thread records into its own ring of kTraceBufferSpans spans, so
+ * tracing does not contend between threads. Use the TRACE_SPAN macro, which
+ * compiles to nothing when osquery is built with SKIP_TRACE.
+ *
+ * The detail is referenced, not copied, and must outlive the scope.
+ */
+class TraceScope : private boost::noncopyable {
+ public:
+  explicit TraceScope(const char* name);
+  TraceScope(const char* name, const std::string& detail);
+  ~TraceScope();
+
+ private:
+  const char* name_{nullptr};
+  const std::string* detail_{nullptr};
+
+  /// Zero if tracing was disabled when the scope began.
+  uint64_t start_{0};
+};
+
+/// Check if spans are recorded.
+bool isTraceEnabled();
+
+/// Start or stop recording spans, such as from the shell's .trace command.
+void setTraceEnabled(bool enabled);
+
+/// Copy the recorded spans of every thread, ordered by start time.
+std::vector<TraceSpan> getTraceSpans();
+
+/// Forget the recorded spans.
+void clearTraceSpans();
+
+/// Encode spans as Chrome trace event JSON, readable by Perfetto.
+std::string serializeTraceSpans(const std::vector<TraceSpan>& spans);
+
+/// Write the recorded spans as Chrome trace event JSON to a path.
+Status dumpTrace(const std::string& path);
+
+/// Request a dump to --trace_path, the SIGUSR2 handler.
+void requestTraceDump(int);
+
+/// Start a thread writing requested dumps, if --trace is enabled.
+void startTraceDumps();
+} // namespace osquery
+
+#if defined(SKIP_TRACE)
+#define TRACE_SPAN(...)
+#else
+#define TRACE_SPAN_CONCAT_(a, b) a##b
+#define TRACE_SPAN_CONCAT(a, b) TRACE_SPAN_CONCAT_(a, b)
+#define TRACE_SPAN(...)                                                        \
+  ::osquery::TraceScope TRACE_SPAN_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#endif
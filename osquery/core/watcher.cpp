@@ -25,6 +25,7 @@
 #include <osquery/sql.h>
 #include <osquery/system.h>
 
+#include "osquery/core/cgroup.h"
 #include "osquery/core/process.h"
 #include "osquery/core/watcher.h"
 
@@ -94,6 +95,16 @@ CLI_FLAG(bool,
 
 CLI_FLAG(bool, disable_watchdog, false, "Disable userland watchdog process");
 
+CLI_FLAG(bool,
+         watchdog_cgroup,
+         false,
+         "Throttle the worker using cgroup v2 limits before stopping it");
+
+CLI_FLAG(uint64,
+         watchdog_pressure_limit,
+         10,
+         "Percent of time the worker stalls before deferring queries");
+
 void Watcher::resetWorkerCounters(size_t respawn_time) {
   // Reset the monitoring counters for the watcher.
   state_.sustained_latency = 0;
@@ -347,21 +358,16 @@ void WatcherRunner::stopChild(const PlatformProcess& child) const {
   }
 }
 
-PerformanceChange getChange(const Row& r, PerformanceState& state) {
+PerformanceChange getChange(const ProcessUsage& usage,
+                            PerformanceState& state) {
   PerformanceChange change;
 
   // IV is the check interval in seconds, and utilization is set per-second.
   change.iv = std::max(getWorkerLimit(WatchdogLimitType::INTERVAL), 1_sz);
-  UNSIGNED_BIGINT_LITERAL user_time = 0, system_time = 0;
-  try {
-    change.parent =
-        static_cast<pid_t>(AS_LITERAL(BIGINT_LITERAL, r.at("parent")));
-    user_time = AS_LITERAL(BIGINT_LITERAL, r.at("user_time")) / change.iv;
-    system_time = AS_LITERAL(BIGINT_LITERAL, r.at("system_time")) / change.iv;
-    change.footprint = AS_LITERAL(BIGINT_LITERAL, r.at("resident_size"));
-  } catch (const std::exception& /* e */) {
-    state.sustained_latency = 0;
-  }
+  change.parent = usage.parent;
+  UNSIGNED_BIGINT_LITERAL user_time = usage.user_time / change.iv;
+  UNSIGNED_BIGINT_LITERAL system_time = usage.system_time / change.iv;
+  change.footprint = usage.resident_size;
 
   // Check the difference of CPU time used since last check.
   auto ul = getWorkerLimit(WatchdogLimitType::UTILIZATION_LIMIT);
@@ -415,13 +421,13 @@ static bool exceededCyclesLimit(const PerformanceChange& change) {
 
 Status WatcherRunner::isWatcherHealthy(const PlatformProcess& watcher,
                                        PerformanceState& watcher_state) const {
-  auto rows = getProcessRow(watcher.pid());
-  if (rows.size() == 0) {
+  ProcessUsage usage;
+  if (!getProcessUsage(watcher.pid(), usage).ok()) {
     // Could not find worker process?
     return Status(1, "Cannot find watcher process");
   }
 
-  auto change = getChange(rows[0], watcher_state);
+  auto change = getChange(usage, watcher_state);
   if (exceededMemoryLimit(change)) {
     return Status(1, "Memory limits exceeded");
   }
@@ -429,22 +435,18 @@ Status WatcherRunner::isWatcherHealthy(const PlatformProcess& watcher,
   return Status(0);
 }
 
-QueryData WatcherRunner::getProcessRow(pid_t pid) const {
+Status WatcherRunner::getProcessUsage(pid_t pid, ProcessUsage& usage) const {
   // On Windows, pid_t = DWORD, which is unsigned. However invalidity
-  // of processes is denoted by a pid_t of -1. We check for this
-  // by comparing the max value of DWORD, or ULONG_MAX, and then casting
-  // our query back to an int value, as ULONG_MAX causes boost exceptions
-  // as it's out of the range of an int.
-  int p = pid;
-#ifdef WIN32
-  p = (pid == ULONG_MAX) ? -1 : pid;
-#endif
-  return SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(p));
+  // of processes is denoted by a pid_t of -1.
+  if (pid == static_cast<pid_t>(-1)) {
+    return Status(1, "Invalid process");
+  }
+  return ::osquery::getProcessUsage(pid, usage);
 }
 
 Status WatcherRunner::isChildSane(const PlatformProcess& child) const {
-  auto rows = getProcessRow(child.pid());
-  if (rows.size() == 0) {
+  ProcessUsage usage;
+  if (!getProcessUsage(child.pid(), usage).ok()) {
     // Could not find worker process?
     return Status(1, "Cannot find process");
   }
@@ -453,7 +455,7 @@ Status WatcherRunner::isChildSane(const PlatformProcess& child) const {
   {
     WatcherExtensionsLocker locker;
     auto& state = Watcher::get().getState(child);
-    change = getChange(rows[0], state);
+    change = getChange(usage, state);
   }
 
   // Only make a decision about the child sanity if it is still the watcher's
@@ -544,6 +546,18 @@ void WatcherRunner::createWorker() {
     return;
   }
 
+  if (FLAGS_watchdog_cgroup && FLAGS_watchdog_level >= 0) {
+    // Throttling keeps the worker within its limits, stopping it is the last
+    // resort.
+    auto status = limitWorkerCgroup(
+        worker->pid(),
+        getWorkerLimit(WatchdogLimitType::UTILIZATION_LIMIT),
+        getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024);
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot limit the worker cgroup: " << status.getMessage();
+    }
+  }
+
   watcher.setWorker(worker);
   watcher.resetWorkerCounters(getUnixTime());
   VLOG(1) << "osqueryd watcher (" << PlatformProcess::getCurrentProcess()->pid()
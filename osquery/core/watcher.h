@@ -310,8 +310,8 @@ class WatcherRunner : public InternalRunnable {
   virtual Status isWatcherHealthy(const PlatformProcess& watcher,
                                   PerformanceState& watcher_state) const;
 
-  /// Get row data from the processes table for a given pid.
-  virtual QueryData getProcessRow(pid_t pid) const;
+  /// Get the CPU time and memory used by a process.
+  virtual Status getProcessUsage(pid_t pid, ProcessUsage& usage) const;
 
  private:
   /// Fork and execute a worker process.
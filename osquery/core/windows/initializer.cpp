@@ -14,6 +14,8 @@
 
 #include <osquery/system.h>
 
+#include "osquery/core/windows/wmi.h"
+
 namespace osquery {
 
 void Initializer::platformSetup() {
@@ -26,6 +28,7 @@ void Initializer::platformSetup() {
 
 void Initializer::platformTeardown() {
   // Before we shutdown, we must insure to free the COM libs in windows
+  releaseWmiConnections();
   ::CoUninitialize();
 }
 
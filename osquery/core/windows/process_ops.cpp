@@ -8,6 +8,9 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <psapi.h>
+#include <tlhelp32.h>
+
 #include "osquery/core/windows/process_ops.h"
 #include "osquery/core/conversions.h"
 
@@ -211,6 +214,20 @@ bool platformModuleClose(ModuleHandle module) {
 
 void setToBackgroundPriority() {}
 
+BackgroundPriorityGuard::BackgroundPriorityGuard(bool background) {
+  // Background processing mode lowers the thread's CPU, I/O, and memory
+  // priority.
+  background_ = background &&
+                ::SetThreadPriority(::GetCurrentThread(),
+                                    THREAD_MODE_BACKGROUND_BEGIN) != FALSE;
+}
+
+BackgroundPriorityGuard::~BackgroundPriorityGuard() {
+  if (background_) {
+    ::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+  }
+}
+
 // Helper function to determine if thread is running with admin privilege.
 bool isUserAdmin() {
   HANDLE hToken = nullptr;
@@ -238,4 +255,109 @@ int platformGetPid() {
 int platformGetTid() {
   return static_cast<int>(GetCurrentThreadId());
 }
+
+/// Convert a FILETIME of 100 nanosecond ticks to seconds.
+static inline uint64_t filetimeToSeconds(const FILETIME& ft) {
+  ULARGE_INTEGER ticks;
+  ticks.HighPart = ft.dwHighDateTime;
+  ticks.LowPart = ft.dwLowDateTime;
+  return ticks.QuadPart / 10000000;
+}
+
+Status getProcessUsage(pid_t pid, ProcessUsage& usage) {
+  auto process = (pid == GetCurrentProcessId())
+                     ? GetCurrentProcess()
+                     : OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION |
+                                       PROCESS_VM_READ,
+                                   FALSE,
+                                   pid);
+  if (process == nullptr) {
+    return Status(1, "Cannot open process");
+  }
+
+  FILETIME create_time;
+  FILETIME exit_time;
+  FILETIME kernel_time;
+  FILETIME user_time;
+  PROCESS_MEMORY_COUNTERS counters;
+  auto times = GetProcessTimes(
+      process, &create_time, &exit_time, &kernel_time, &user_time);
+  auto memory = GetProcessMemoryInfo(process, &counters, sizeof(counters));
+  if (pid != GetCurrentProcessId()) {
+    CloseHandle(process);
+  }
+
+  if (times == FALSE || memory == FALSE) {
+    return Status(1, "Cannot read process usage");
+  }
+  usage.user_time = filetimeToSeconds(user_time);
+  usage.system_time = filetimeToSeconds(kernel_time);
+  usage.resident_size = counters.WorkingSetSize;
+
+  // The parent is only available from a snapshot of every process.
+  auto snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+  if (snapshot == INVALID_HANDLE_VALUE) {
+    return Status(1, "Cannot read process parent");
+  }
+
+  PROCESSENTRY32 entry;
+  entry.dwSize = sizeof(entry);
+  auto found = false;
+  for (auto more = Process32First(snapshot, &entry); more;
+       more = Process32Next(snapshot, &entry)) {
+    if (entry.th32ProcessID == pid) {
+      usage.parent = static_cast<pid_t>(entry.th32ParentProcessID);
+      found = true;
+      break;
+    }
+  }
+  CloseHandle(snapshot);
+  return (found) ? Status(0, "OK") : Status(1, "Cannot read process parent");
+}
+
+/// Convert a FILETIME of 100 nanosecond ticks to microseconds.
+static inline uint64_t filetimeToMicroseconds(const FILETIME& ft) {
+  ULARGE_INTEGER ticks;
+  ticks.HighPart = ft.dwHighDateTime;
+  ticks.LowPart = ft.dwLowDateTime;
+  return ticks.QuadPart / 10;
+}
+
+Status getThreadUsage(ThreadUsage& usage) {
+  FILETIME create_time;
+  FILETIME exit_time;
+  FILETIME kernel_time;
+  FILETIME user_time;
+  if (GetThreadTimes(GetCurrentThread(),
+                     &create_time,
+                     &exit_time,
+                     &kernel_time,
+                     &user_time) == FALSE) {
+    return Status(1, "Cannot read thread usage");
+  }
+
+  usage.user_time = filetimeToMicroseconds(user_time);
+  usage.system_time = filetimeToMicroseconds(kernel_time);
+  return Status(0, "OK");
+}
+
+ThreadCounterScope::ThreadCounterScope() {
+  ULONG64 cycles = 0;
+  if (QueryThreadCycleTime(GetCurrentThread(), &cycles) != FALSE) {
+    start_.cycles = cycles;
+  }
+}
+
+ThreadCounterScope::~ThreadCounterScope() {}
+
+Status ThreadCounterScope::read(ThreadCounters& counters) const {
+  ULONG64 cycles = 0;
+  if (QueryThreadCycleTime(GetCurrentThread(), &cycles) == FALSE) {
+    return Status(1, "Cannot read thread cycles");
+  }
+
+  // Hardware counters require ETW tracing sessions and are not counted.
+  counters.cycles = cycles - start_.cycles;
+  return Status(0, "OK");
+}
 }
@@ -9,6 +9,8 @@
  */
 
 #include <locale>
+#include <map>
+#include <mutex>
 #include <string>
 
 #include <osquery/logger.h>
@@ -254,52 +256,146 @@ Status WmiResultItem::GetVectorOfStrings(const std::string& name,
   return Status(0);
 }
 
+/// Pooled connections by namespace, see getWmiConnection.
+static std::map<std::wstring, IWbemServices*> kWmiConnections;
+
+/// The locator creating pooled connections.
+static IWbemLocator* kWmiLocator{nullptr};
+
+static std::mutex kWmiConnectionsMutex;
+
+/// Get a reference to a namespace's connection, connecting when needed.
+static Status getWmiConnection(BSTR nspace, IWbemServices** services) {
+  // Security is set for the process, only once, before the first connection.
+  static std::once_flag security;
+  std::call_once(security, []() {
+    ::CoInitializeSecurity(nullptr,
+                           -1,
+                           nullptr,
+                           nullptr,
+                           RPC_C_AUTHN_LEVEL_DEFAULT,
+                           RPC_C_IMP_LEVEL_IMPERSONATE,
+                           nullptr,
+                           EOAC_NONE,
+                           nullptr);
+  });
+
+  std::lock_guard<std::mutex> lock(kWmiConnectionsMutex);
+  std::wstring name(static_cast<const wchar_t*>(nspace));
+  auto it = kWmiConnections.find(name);
+  if (it == kWmiConnections.end()) {
+    if (kWmiLocator == nullptr) {
+      HRESULT hr = ::CoCreateInstance(CLSID_WbemLocator,
+                                      0,
+                                      CLSCTX_INPROC_SERVER,
+                                      IID_IWbemLocator,
+                                      (LPVOID*)&kWmiLocator);
+      if (hr != S_OK) {
+        kWmiLocator = nullptr;
+        return Status(1, "Cannot create a WMI locator");
+      }
+    }
+
+    IWbemServices* connection = nullptr;
+    HRESULT hr = kWmiLocator->ConnectServer(
+        nspace, nullptr, nullptr, nullptr, 0, nullptr, nullptr, &connection);
+    if (hr != S_OK) {
+      return Status(1, "Cannot connect to WMI namespace");
+    }
+    it = kWmiConnections.emplace(name, connection).first;
+  }
+
+  it->second->AddRef();
+  *services = it->second;
+  return Status(0, "OK");
+}
+
+/// Forget a pooled connection that failed, such as when WMI restarted.
+static void dropWmiConnection(BSTR nspace, IWbemServices* services) {
+  std::lock_guard<std::mutex> lock(kWmiConnectionsMutex);
+  std::wstring name(static_cast<const wchar_t*>(nspace));
+  auto it = kWmiConnections.find(name);
+  if (it != kWmiConnections.end() && it->second == services) {
+    it->second->Release();
+    kWmiConnections.erase(it);
+  }
+}
+
+void releaseWmiConnections() {
+  std::lock_guard<std::mutex> lock(kWmiConnectionsMutex);
+  for (auto& connection : kWmiConnections) {
+    connection.second->Release();
+  }
+  kWmiConnections.clear();
+
+  if (kWmiLocator != nullptr) {
+    kWmiLocator->Release();
+    kWmiLocator = nullptr;
+  }
+}
+
 WmiRequest::WmiRequest(const std::string& query, BSTR nspace) {
+  execute(query, nspace, nullptr);
+}
+
+WmiRequest::WmiRequest(
+    const std::string& query,
+    const std::function<void(const WmiResultItem&)>& callback,
+    BSTR nspace) {
+  execute(query, nspace, callback);
+}
+
+void WmiRequest::execute(
+    const std::string& query,
+    BSTR nspace,
+    const std::function<void(const WmiResultItem&)>& callback) {
   std::wstring wql = stringToWstring(query);
 
   HRESULT hr = E_FAIL;
+  for (size_t attempt = 0; attempt < 2; attempt++) {
+    if (!getWmiConnection(nspace, &services_).ok()) {
+      services_ = nullptr;
+      return;
+    }
 
-  hr = ::CoInitializeSecurity(nullptr,
-                              -1,
+    hr = services_->ExecQuery((BSTR)L"WQL",
+                              (BSTR)wql.c_str(),
+                              WBEM_FLAG_FORWARD_ONLY |
+                                  WBEM_FLAG_RETURN_IMMEDIATELY,
                               nullptr,
-                              nullptr,
-                              RPC_C_AUTHN_LEVEL_DEFAULT,
-                              RPC_C_IMP_LEVEL_IMPERSONATE,
-                              nullptr,
-                              EOAC_NONE,
-                              nullptr);
-  hr = ::CoCreateInstance(CLSID_WbemLocator,
-                          0,
-                          CLSCTX_INPROC_SERVER,
-                          IID_IWbemLocator,
-                          (LPVOID*)&locator_);
-  if (hr != S_OK) {
-    locator_ = nullptr;
-    return;
-  }
+                              &enum_);
+    if (hr != RPC_E_DISCONNECTED && hr != WBEM_E_TRANSPORT_FAILURE) {
+      break;
+    }
 
-  hr = locator_->ConnectServer(
-      nspace, nullptr, nullptr, nullptr, 0, nullptr, nullptr, &services_);
-  if (hr != S_OK) {
+    // The pooled connection is stale, reconnect once.
+    dropWmiConnection(nspace, services_);
+    services_->Release();
     services_ = nullptr;
-    return;
   }
 
-  hr = services_->ExecQuery(
-      (BSTR)L"WQL", (BSTR)wql.c_str(), WBEM_FLAG_FORWARD_ONLY, nullptr, &enum_);
   if (hr != S_OK) {
     enum_ = nullptr;
     return;
   }
 
+  IWbemClassObject* objects[kWmiEnumBatch];
   hr = WBEM_S_NO_ERROR;
   while (hr == WBEM_S_NO_ERROR) {
-    IWbemClassObject* result = nullptr;
-    ULONG result_count = 0;
+    ULONG count = 0;
+    // A short batch, WBEM_S_FALSE, ends the enumeration.
+    hr = enum_->Next(WBEM_INFINITE, kWmiEnumBatch, objects, &count);
+    if (FAILED(hr)) {
+      break;
+    }
 
-    hr = enum_->Next(WBEM_INFINITE, 1, &result, &result_count);
-    if (SUCCEEDED(hr) && result_count > 0) {
-      results_.push_back(WmiResultItem(result));
+    for (ULONG i = 0; i < count; i++) {
+      if (callback != nullptr) {
+        WmiResultItem item(objects[i]);
+        callback(item);
+      } else {
+        results_.push_back(WmiResultItem(objects[i]));
+      }
     }
   }
 
@@ -307,8 +403,8 @@ WmiRequest::WmiRequest(const std::string& query, BSTR nspace) {
 }
 
 WmiRequest::WmiRequest(WmiRequest&& src) {
-  locator_ = nullptr;
-  std::swap(locator_, src.locator_);
+  std::swap(status_, src.status_);
+  std::swap(results_, src.results_);
 
   services_ = nullptr;
   std::swap(services_, src.services_);
@@ -329,10 +425,5 @@ WmiRequest::~WmiRequest() {
     services_->Release();
     services_ = nullptr;
   }
-
-  if (locator_ != nullptr) {
-    locator_->Release();
-    locator_ = nullptr;
-  }
 }
 }
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <codecvt>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -172,16 +173,34 @@ class WmiResultItem {
   IWbemClassObject* result_{nullptr};
 };
 
+/// Result objects requested from a WMI enumerator by each call to Next.
+const ULONG kWmiEnumBatch = 64;
+
 /**
 * @brief Windows wrapper class for querying WMI
 *
 * This class abstracts away the WMI querying logic and
 * will return WMI results given a query string.
+*
+* Connections to each namespace are pooled and shared by every thread, which
+* join the process' multithreaded apartment. Queries are semisynchronous and
+* forward-only, and result objects are requested in batches.
 */
 class WmiRequest {
  public:
+  /// Run a query and keep each result object, see results.
   explicit WmiRequest(const std::string& query,
                       BSTR nspace = (BSTR)L"ROOT\\CIMV2");
+
+  /**
+  * @brief Run a query and pass each result object to a callback.
+  *
+  * Each object is released after the callback, such that a large enumeration
+  * is not held in memory. The results vector remains empty.
+  */
+  WmiRequest(const std::string& query,
+             const std::function<void(const WmiResultItem&)>& callback,
+             BSTR nspace = (BSTR)L"ROOT\\CIMV2");
   WmiRequest(WmiRequest&& src);
   ~WmiRequest();
 
@@ -198,11 +217,20 @@ class WmiRequest {
     return status_;
   }
 
+ private:
+  void execute(const std::string& query,
+               BSTR nspace,
+               const std::function<void(const WmiResultItem&)>& callback);
+
  private:
   Status status_;
   std::vector<WmiResultItem> results_;
-  IWbemLocator* locator_{nullptr};
+
+  /// A reference to the namespace's pooled connection.
   IWbemServices* services_{nullptr};
   IEnumWbemClassObject* enum_{nullptr};
 };
+
+/// Release the pooled WMI connections, before COM is uninitialized.
+void releaseWmiConnections();
 }
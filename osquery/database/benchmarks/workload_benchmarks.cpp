@@ -0,0 +1,432 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/database.h>
+#include <osquery/events.h>
+#include <osquery/filesystem.h>
+#include <osquery/query.h>
+#include <osquery/registry.h>
+
+#include "osquery/carver/carver.h"
+#include "osquery/logger/plugins/buffered.h"
+#include "osquery/tests/test_util.h"
+
+namespace fs = boost::filesystem;
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+DECLARE_string(database_path);
+
+/**
+ * @brief The database plugins each workload runs against.
+ *
+ * Workload benchmarks take the plugin index as their first argument and
+ * report the p99 latency of the workload's operations and the size of the
+ * database on disk after the workload.
+ */
+const std::vector<std::string> kWorkloadPlugins = {
+    "rocksdb", "sqlite", "ephemeral"};
+
+/// Replace the active database with an empty instance of a plugin.
+class WorkloadDatabase : private boost::noncopyable {
+ public:
+  explicit WorkloadDatabase(size_t plugin)
+      : name_(kWorkloadPlugins.at(plugin)) {
+    auto& rf = RegistryFactory::get();
+    existing_ = rf.getActive("database");
+    rf.plugin("database", existing_)->tearDown();
+
+    existing_path_ = FLAGS_database_path;
+    path_ = existing_path_ + ".workload";
+    FLAGS_database_path = path_;
+    removePath(path_);
+
+    db_ = std::dynamic_pointer_cast<DatabasePlugin>(
+        rf.plugin("database", name_));
+    db_->reset();
+    rf.setActive("database", name_);
+  }
+
+  ~WorkloadDatabase() {
+    auto& rf = RegistryFactory::get();
+    db_->tearDown();
+    removePath(path_);
+
+    FLAGS_database_path = existing_path_;
+    rf.setActive("database", existing_);
+    std::dynamic_pointer_cast<DatabasePlugin>(
+        rf.plugin("database", existing_))
+        ->reset();
+  }
+
+  /// The size of the database files, including journals.
+  size_t getDiskSize() const {
+    size_t size = 0;
+    for (const auto& path : {path_, path_ + "-wal", path_ + "-journal"}) {
+      boost::system::error_code ec;
+      if (fs::is_regular_file(path, ec)) {
+        size += fs::file_size(path, ec);
+      } else if (fs::is_directory(path, ec)) {
+        for (fs::recursive_directory_iterator it(path, ec), end;
+             !ec && it != end;
+             it.increment(ec)) {
+          if (fs::is_regular_file(it->path(), ec)) {
+            size += fs::file_size(it->path(), ec);
+          }
+        }
+      }
+    }
+    return size;
+  }
+
+ private:
+  /// The workload plugin name.
+  std::string name_;
+
+  /// The workload plugin.
+  std::shared_ptr<DatabasePlugin> db_;
+
+  /// The workload database path.
+  std::string path_;
+
+  /// The active plugin and path before the workload.
+  std::string existing_;
+  std::string existing_path_;
+};
+
+/// Latency samples of a workload operation, in microseconds.
+class WorkloadLatency {
+ public:
+  /// Time a single operation.
+  template <typename F>
+  void time(F&& operation) {
+    auto start = std::chrono::steady_clock::now();
+    operation();
+    samples_.push_back(static_cast<size_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count()));
+  }
+
+  /// The 99th percentile sample, 0 if there are no samples.
+  size_t getP99() {
+    if (samples_.empty()) {
+      return 0;
+    }
+
+    auto p99 = samples_.begin() + (samples_.size() - 1) * 99 / 100;
+    std::nth_element(samples_.begin(), p99, samples_.end());
+    return *p99;
+  }
+
+ private:
+  std::vector<size_t> samples_;
+};
+
+/// Report the workload latency and disk size as the benchmark label.
+static void setWorkloadLabel(benchmark::State& state,
+                             const WorkloadDatabase& db,
+                             const std::string& latencies) {
+  state.SetLabel(kWorkloadPlugins.at(state.range_x()) + " " + latencies +
+                 " disk=" + std::to_string(db.getDiskSize() / 1024) + "KB");
+}
+
+class WorkloadEventPublisher
+    : public EventPublisher<SubscriptionContext, EventContext> {
+  DECLARE_PUBLISHER("workload");
+};
+
+class WorkloadEventSubscriber : public EventSubscriber<WorkloadEventPublisher> {
+ public:
+  WorkloadEventSubscriber() {
+    setName("workload");
+  }
+
+  /// Store an event similar to a process event.
+  void ingest(EventTime time) {
+    Row r;
+    r["pid"] = "12345";
+    r["path"] = "/usr/bin/example";
+    r["cmdline"] = "/usr/bin/example --flag value --other-flag other-value";
+    r["cwd"] = "/home/user";
+    r["uid"] = "1000";
+    r["parent"] = "1234";
+    add(r, time);
+  }
+
+  /// Select the events within a time range, as a query would.
+  size_t read(EventTime start, EventTime stop) {
+    size_t rows = 0;
+    RowGenerator::pull_type generator(
+        std::bind(&EventSubscriberPlugin::get,
+                  this,
+                  std::placeholders::_1,
+                  start,
+                  stop));
+    while (generator) {
+      generator.get();
+      rows++;
+      generator();
+    }
+    return rows;
+  }
+
+  /// Expire the events before a time.
+  void expire(EventTime time) {
+    expire_events_ = true;
+    expire_time_ = time;
+    expireEvents();
+  }
+};
+
+/**
+ * @brief Ingest events while a concurrent query reads a time range.
+ *
+ * Each iteration ingests one second of events at range_y events per second.
+ * Events older than a minute expire, and the reader selects the last minute.
+ */
+static void DATABASE_workload_events(benchmark::State& state) {
+  WorkloadDatabase db(state.range_x());
+  auto sub = std::make_shared<WorkloadEventSubscriber>();
+
+  std::atomic<EventTime> now{1};
+  std::atomic<bool> stop{false};
+  std::atomic<size_t> reads{0};
+  std::thread reader([&sub, &now, &stop, &reads]() {
+    while (!stop) {
+      EventTime time = now;
+      sub->read((time > 60) ? time - 60 : 0, time);
+      reads++;
+    }
+  });
+
+  WorkloadLatency latency;
+  while (state.KeepRunning()) {
+    EventTime time = now;
+    for (int i = 0; i < state.range_y(); ++i) {
+      latency.time([&sub, time]() { sub->ingest(time); });
+    }
+
+    if (time % 10 == 0 && time > 60) {
+      sub->expire(time - 60);
+    }
+    now++;
+  }
+
+  stop = true;
+  reader.join();
+  state.SetItemsProcessed(state.iterations() * state.range_y());
+  setWorkloadLabel(state,
+                   db,
+                   "add_p99=" + std::to_string(latency.getP99()) +
+                       "us reads=" + std::to_string(reads));
+}
+
+BENCHMARK(DATABASE_workload_events)
+    ->ArgPair(0, 1000)
+    ->ArgPair(1, 1000)
+    ->ArgPair(2, 1000)
+    ->ArgPair(0, 10000)
+    ->ArgPair(1, 10000)
+    ->ArgPair(2, 10000);
+
+class WorkloadLogForwarder : public BufferedLogForwarder {
+ public:
+  explicit WorkloadLogForwarder(size_t max_log_lines)
+      : BufferedLogForwarder("WorkloadLogForwarder",
+                             "workload",
+                             kLogPeriod,
+                             max_log_lines) {}
+
+  /// Forward buffered logs, then purge the oldest beyond the maximum.
+  void flush() {
+    check();
+  }
+
+ protected:
+  Status send(std::vector<std::string>& log_data,
+              const std::string& log_type) override {
+    return Status(0, "OK");
+  }
+};
+
+/**
+ * @brief Enqueue, flush, and purge buffered logs.
+ *
+ * Each iteration enqueues range_y result and status lines, then forwards them.
+ */
+static void DATABASE_workload_logger(benchmark::State& state) {
+  WorkloadDatabase db(state.range_x());
+  WorkloadLogForwarder forwarder(static_cast<size_t>(2 * state.range_y()));
+  forwarder.setUp();
+
+  std::string result = "{\"name\":\"workload\",\"action\":\"added\","
+                       "\"columns\":{\"pid\":\"12345\",\"path\":\"/bin/sh\"}}";
+  std::vector<StatusLogLine> status = {
+      {O_INFO, "workload.cpp", 1, "A status log line", "", 0, ""}};
+
+  WorkloadLatency enqueue;
+  WorkloadLatency flush;
+  while (state.KeepRunning()) {
+    for (int i = 0; i < state.range_y(); ++i) {
+      enqueue.time([&forwarder, &result]() { forwarder.logString(result); });
+      enqueue.time([&forwarder, &status]() { forwarder.logStatus(status); });
+    }
+    flush.time([&forwarder]() { forwarder.flush(); });
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range_y() * 2);
+  setWorkloadLabel(state,
+                   db,
+                   "enqueue_p99=" + std::to_string(enqueue.getP99()) +
+                       "us flush_p99=" + std::to_string(flush.getP99()) +
+                       "us");
+}
+
+BENCHMARK(DATABASE_workload_logger)
+    ->ArgPair(0, 100)
+    ->ArgPair(1, 100)
+    ->ArgPair(2, 100)
+    ->ArgPair(0, 1000)
+    ->ArgPair(1, 1000)
+    ->ArgPair(2, 1000);
+
+/// Results similar to a processes query, where 1% of the rows change.
+static QueryData getWorkloadResults(size_t rows, size_t generation) {
+  QueryData results;
+  results.reserve(rows);
+  for (size_t i = 0; i < rows; ++i) {
+    Row r;
+    r["pid"] = std::to_string(i);
+    r["name"] = "process" + std::to_string(i);
+    r["path"] = "/usr/bin/process" + std::to_string(i);
+    r["uid"] = "1000";
+    r["start_time"] = std::to_string((i % 100 == 0) ? generation : 0);
+    results.push_back(std::move(r));
+  }
+  return results;
+}
+
+/**
+ * @brief Store a scheduled query's results and compute the differential.
+ *
+ * Each iteration stores range_y rows, 1% of which differ from the previous.
+ */
+static void DATABASE_workload_query_diff(benchmark::State& state) {
+  WorkloadDatabase db(state.range_x());
+  auto query = Query("workload", getOsqueryScheduledQuery());
+  auto rows = static_cast<size_t>(state.range_y());
+
+  uint64_t counter = 0;
+  DiffResults diff_results;
+  query.addNewResults(getWorkloadResults(rows, 0), 0, counter, diff_results);
+
+  WorkloadLatency latency;
+  size_t generation = 1;
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    auto results = getWorkloadResults(rows, generation++);
+    diff_results = DiffResults();
+    state.ResumeTiming();
+
+    latency.time([&]() {
+      query.addNewResults(std::move(results), 0, counter, diff_results);
+    });
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range_y());
+  setWorkloadLabel(
+      state, db, "diff_p99=" + std::to_string(latency.getP99()) + "us");
+}
+
+BENCHMARK(DATABASE_workload_query_diff)
+    ->ArgPair(0, 10000)
+    ->ArgPair(1, 10000)
+    ->ArgPair(2, 10000)
+    ->ArgPair(0, 50000)
+    ->ArgPair(1, 50000)
+    ->ArgPair(2, 50000);
+
+/**
+ * @brief Record the lifecycle of a carve, then enumerate stored carves.
+ *
+ * Carved blocks are read from the archive on disk as they are posted, the
+ * database stores each carve's status. Each iteration creates a carve and
+ * updates it as the carver does, with range_y carves stored.
+ */
+static void DATABASE_workload_carves(benchmark::State& state) {
+  WorkloadDatabase db(state.range_x());
+
+  auto createCarve = [](const std::string& guid) {
+    pt::ptree tree;
+    tree.put("carve_guid", guid);
+    tree.put("time", 1500000000);
+    tree.put("status", "STARTING");
+    tree.put("sha256", "");
+    tree.put("size", -1);
+    tree.put("path", "/var/log/example.log");
+
+    std::ostringstream os;
+    pt::write_json(os, tree, false);
+    setDatabaseValue(kCarveDbDomain, kCarverDBPrefix + guid, os.str());
+  };
+
+  for (int i = 0; i < state.range_y(); ++i) {
+    auto guid = "stored" + std::to_string(i);
+    createCarve(guid);
+    updateCarveValue(guid, "status", "SUCCESS");
+  }
+
+  WorkloadLatency latency;
+  size_t carve = 0;
+  while (state.KeepRunning()) {
+    auto guid = "workload" + std::to_string(carve++);
+    latency.time([&]() {
+      createCarve(guid);
+      updateCarveValue(guid, "status", "PENDING");
+      updateCarveValue(guid, "size", "1048576");
+      updateCarveValue(guid, "sha256", std::string(64, 'a'));
+      updateCarveValue(guid, "status", "SUCCESS");
+    });
+
+    // Enumerate the carves, as the carves table does.
+    size_t carves = 0;
+    scanDatabasePrefix(kCarveDbDomain,
+                       kCarverDBPrefix,
+                       [&carves](const std::string&, const std::string&) {
+                         carves++;
+                         return true;
+                       });
+    deleteDatabaseValue(kCarveDbDomain, kCarverDBPrefix + guid);
+  }
+
+  setWorkloadLabel(
+      state, db, "carve_p99=" + std::to_string(latency.getP99()) + "us");
+}
+
+BENCHMARK(DATABASE_workload_carves)
+    ->ArgPair(0, 10)
+    ->ArgPair(1, 10)
+    ->ArgPair(2, 10)
+    ->ArgPair(0, 1000)
+    ->ArgPair(1, 1000)
+    ->ArgPair(2, 1000);
+}
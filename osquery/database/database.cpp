@@ -8,11 +8,21 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+#include <list>
+#include <map>
+
+#include <boost/noncopyable.hpp>
+
 #include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/registry.h>
 
+#include "osquery/core/memory.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/trace.h"
+
 namespace osquery {
 
 /// Generate a specific-use registry for database access abstraction.
@@ -20,6 +30,11 @@ CREATE_REGISTRY(DatabasePlugin, "database");
 
 CLI_FLAG(bool, database_dump, false, "Dump the contents of the backing store");
 
+CLI_FLAG(bool,
+         database_read_only,
+         false,
+         "Open the backing store read-only, without the daemon's lock");
+
 CLI_FLAG(string,
          database_path,
          OSQUERY_DB_HOME "/osquery.db",
@@ -28,15 +43,29 @@ FLAG_ALIAS(std::string, db_path, database_path);
 
 FLAG(bool, disable_database, false, "Disable the persistent RocksDB storage");
 
+FLAG(uint64,
+     database_cache_size,
+     1,
+     "In-memory cache of small database values in MB, 0 to disable");
+
 const std::string kInternalDatabase = "rocksdb";
 const std::string kPersistentSettings = "configurations";
 const std::string kQueries = "queries";
 const std::string kEvents = "events";
 const std::string kCarves = "carves";
 const std::string kLogs = "logs";
-
-const std::vector<std::string> kDomains = {
-    kPersistentSettings, kQueries, kEvents, kLogs, kCarves};
+const std::string kFileHashes = "file_hashes";
+const std::string kPackages = "packages";
+const std::string kSignatures = "signatures";
+
+const std::vector<std::string> kDomains = {kPersistentSettings,
+                                           kQueries,
+                                           kEvents,
+                                           kLogs,
+                                           kCarves,
+                                           kFileHashes,
+                                           kPackages,
+                                           kSignatures};
 
 std::atomic<bool> DatabasePlugin::kDBAllowOpen(false);
 std::atomic<bool> DatabasePlugin::kDBRequireWrite(false);
@@ -51,6 +80,275 @@ std::atomic<bool> DatabasePlugin::kDBChecking(false);
  */
 Mutex kDatabaseReset;
 
+/// The key and value bytes of puts, before the plugin's compression.
+static Metric kDatabaseWritten("osquery_database_written_bytes_total",
+                               "Key and value bytes put into the database");
+
+namespace {
+
+/**
+ * @brief A write-through cache of small values in front of the database.
+ *
+ * Query epochs, counters, and settings are read each schedule step. Domains
+ * with a policy cache values up to the policy's size, the least recently used
+ * values are evicted beyond --database_cache_size.
+ *
+ * Values are written to the database plugin before the cache. Writes to cached
+ * domains are serialized such that the cache applies them in the same order,
+ * and a value read from the plugin is only cached if no write completed while
+ * it was read.
+ */
+class DatabaseCache : private boost::noncopyable {
+ public:
+  DatabaseCache() {
+    // Domains read by key, where values are small, are cached.
+    domains_[kPersistentSettings].max_value = 4096;
+    domains_[kQueries].max_value = 1024;
+  }
+
+  /// Check if a domain's values are cached.
+  bool isCached(const std::string& domain) const {
+    return FLAGS_database_cache_size > 0 && domains_.count(domain) > 0;
+  }
+
+  /// Check if a batch writes to a cached domain.
+  bool isCached(const DatabaseBatch& batch) const {
+    for (const auto& operation : batch.operations()) {
+      if (isCached(operation.domain)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Drop every value if the active plugin changed.
+  void use(const DatabasePlugin* plugin) {
+    WriteLock lock(mutex_);
+    if (plugin != plugin_) {
+      clearLocked();
+      plugin_ = plugin;
+    }
+  }
+
+  /**
+   * @brief Get a cached value.
+   *
+   * @param generation Output, pass to fill if the value is not cached.
+   * @return true if the value was cached.
+   */
+  bool get(const std::string& domain,
+           const std::string& key,
+           std::string& value,
+           size_t& generation) {
+    WriteLock lock(mutex_);
+    auto& cached = domains_.at(domain);
+    auto entry = cached.entries.find(key);
+    if (entry == cached.entries.end()) {
+      cached.misses++;
+      generation = generation_;
+      return false;
+    }
+
+    cached.hits++;
+    lru_.splice(lru_.begin(), lru_, entry->second.lru);
+    value = entry->second.value;
+    return true;
+  }
+
+  /// Cache a value read from the plugin, unless a write has since completed.
+  void fill(const std::string& domain,
+            const std::string& key,
+            const std::string& value,
+            size_t generation) {
+    WriteLock lock(mutex_);
+    if (generation == generation_) {
+      setLocked(domain, key, value);
+    }
+  }
+
+  /// Serialize writes to cached domains, held while writing to the plugin.
+  Mutex& writeMutex() {
+    return write_mutex_;
+  }
+
+  /// Apply a write, or drop the written keys if the write failed.
+  void write(const DatabaseBatch& batch, bool applied) {
+    WriteLock lock(mutex_);
+    for (const auto& operation : batch.operations()) {
+      if (domains_.count(operation.domain) == 0) {
+        continue;
+      }
+
+      if (operation.type == DatabaseBatch::Type::RemoveRange) {
+        removeLocked(operation.domain, operation.key, operation.value);
+      } else if (applied && operation.type == DatabaseBatch::Type::Put) {
+        setLocked(operation.domain, operation.key, operation.value);
+      } else {
+        removeLocked(operation.domain, operation.key, operation.key);
+      }
+    }
+    generation_++;
+  }
+
+  /// Apply a single put, or drop the key if the put failed.
+  void set(const std::string& domain,
+           const std::string& key,
+           const std::string& value,
+           bool applied) {
+    WriteLock lock(mutex_);
+    if (applied) {
+      setLocked(domain, key, value);
+    } else {
+      removeLocked(domain, key, key);
+    }
+    generation_++;
+  }
+
+  /// Drop the values of a written key range, inclusive.
+  void invalidate(const std::string& domain,
+                  const std::string& low,
+                  const std::string& high) {
+    WriteLock lock(mutex_);
+    if (domains_.count(domain) > 0) {
+      removeLocked(domain, low, high);
+    }
+    generation_++;
+  }
+
+  /// Drop every value.
+  void clear() {
+    WriteLock lock(mutex_);
+    clearLocked();
+  }
+
+  /// Add the hit and miss counts to each domain's statistics.
+  void getStats(std::vector<DatabaseDomainStats>& stats) {
+    WriteLock lock(mutex_);
+    for (auto& domain_stats : stats) {
+      auto cached = domains_.find(domain_stats.domain);
+      if (cached != domains_.end()) {
+        domain_stats.cache_hits = cached->second.hits;
+        domain_stats.cache_misses = cached->second.misses;
+        domain_stats.cache_bytes = cached->second.bytes;
+      }
+    }
+  }
+
+ private:
+  /// The least recently used order of domains and keys.
+  using LRUList = std::list<std::pair<const std::string*, std::string>>;
+
+  struct Entry {
+    std::string value;
+    LRUList::iterator lru;
+  };
+
+  struct Domain {
+    /// The largest cached value.
+    size_t max_value{0};
+
+    /// The cached values.
+    std::map<std::string, Entry> entries;
+
+    /// The size of the cached keys and values.
+    size_t bytes{0};
+
+    /// Lookups of the domain's keys.
+    uint64_t hits{0};
+    uint64_t misses{0};
+  };
+
+  /// The accounted size of a cached value.
+  static size_t getEntrySize(const std::string& key, const std::string& value) {
+    return 2 * key.size() + value.size();
+  }
+
+  void setLocked(const std::string& domain,
+                 const std::string& key,
+                 const std::string& value) {
+    auto cached = domains_.find(domain);
+    if (cached->second.max_value < value.size()) {
+      removeLocked(domain, key, key);
+      return;
+    }
+
+    auto& entries = cached->second.entries;
+    auto entry = entries.find(key);
+    if (entry == entries.end()) {
+      lru_.emplace_front(&cached->first, key);
+      entry = entries.emplace(key, Entry{"", lru_.begin()}).first;
+    } else {
+      lru_.splice(lru_.begin(), lru_, entry->second.lru);
+      cached->second.bytes -= getEntrySize(key, entry->second.value);
+      bytes_ -= getEntrySize(key, entry->second.value);
+    }
+
+    entry->second.value = value;
+    cached->second.bytes += getEntrySize(key, value);
+    bytes_ += getEntrySize(key, value);
+
+    // Evict the least recently used values.
+    auto max = FLAGS_database_cache_size * 1024 * 1024;
+    while (bytes_ > max && !lru_.empty()) {
+      auto evict = lru_.back();
+      removeLocked(*evict.first, evict.second, evict.second);
+    }
+  }
+
+  void removeLocked(const std::string& domain,
+                    const std::string& low,
+                    const std::string& high) {
+    auto& cached = domains_.at(domain);
+    auto it = cached.entries.lower_bound(low);
+    auto end = cached.entries.upper_bound(high);
+    while (it != end) {
+      auto size = getEntrySize(it->first, it->second.value);
+      cached.bytes -= size;
+      bytes_ -= size;
+      lru_.erase(it->second.lru);
+      it = cached.entries.erase(it);
+    }
+  }
+
+  void clearLocked() {
+    for (auto& cached : domains_) {
+      cached.second.entries.clear();
+      cached.second.bytes = 0;
+    }
+    lru_.clear();
+    bytes_ = 0;
+    generation_++;
+  }
+
+ private:
+  /// The cached domains, by name.
+  std::map<std::string, Domain> domains_;
+
+  /// The least recently used order of all cached values.
+  LRUList lru_;
+
+  /// The size of all cached keys and values.
+  size_t bytes_{0};
+
+  /// Incremented for each write, see fill.
+  size_t generation_{0};
+
+  /// The plugin whose values are cached.
+  const DatabasePlugin* plugin_{nullptr};
+
+  /// Protection around the cached values.
+  Mutex mutex_;
+
+  /// Serialization of writes to cached domains.
+  Mutex write_mutex_;
+};
+
+DatabaseCache& getDatabaseCache() {
+  static DatabaseCache cache;
+  return cache;
+}
+} // namespace
+
 Status DatabasePlugin::initPlugin() {
   // Initialize the database plugin using the flag.
   auto plugin = (FLAGS_disable_database) ? "ephemeral" : kInternalDatabase;
@@ -72,6 +370,9 @@ void DatabasePlugin::shutdown() {
 }
 
 Status DatabasePlugin::reset() {
+  // The reset database may not contain the cached values.
+  getDatabaseCache().clear();
+
   // Keep this simple, scope the critical section to the broader methods.
   tearDown();
   return setUp();
@@ -102,6 +403,71 @@ Status DatabasePlugin::scan(const std::string& domain,
   return Status(0, "Not used");
 }
 
+/// Scan keys within a range, then get and visit each value.
+static Status scanKeysRange(const std::vector<std::string>& keys,
+                            const std::string& low,
+                            const std::string& high,
+                            const std::function<Status(const std::string& key,
+                                                       std::string& value)>& get,
+                            const DatabaseScanCallback& callback) {
+  for (const auto& key : keys) {
+    if (key < low || (!high.empty() && key >= high)) {
+      continue;
+    }
+
+    std::string value;
+    auto status = get(key, value);
+    if (!status.ok()) {
+      // The key may have been removed after the scan.
+      continue;
+    }
+
+    if (!callback(key, value)) {
+      break;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::scanRange(const std::string& domain,
+                                 const std::string& low,
+                                 const std::string& high,
+                                 const DatabaseScanCallback& callback) const {
+  std::vector<std::string> keys;
+  auto status = scan(domain, keys, "", 0);
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::sort(keys.begin(), keys.end());
+  return scanKeysRange(keys,
+                       low,
+                       high,
+                       [this, &domain](const std::string& key,
+                                       std::string& value) {
+                         return get(domain, key, value);
+                       },
+                       callback);
+}
+
+Status DatabasePlugin::write(const DatabaseBatch& batch) {
+  for (const auto& operation : batch.operations()) {
+    Status status;
+    if (operation.type == DatabaseBatch::Type::Put) {
+      status = put(operation.domain, operation.key, operation.value);
+    } else if (operation.type == DatabaseBatch::Type::Remove) {
+      status = remove(operation.domain, operation.key);
+    } else {
+      status = removeRange(operation.domain, operation.key, operation.value);
+    }
+
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
 Status DatabasePlugin::call(const PluginRequest& request,
                             PluginResponse& response) {
   if (request.count("action") == 0) {
@@ -138,13 +504,20 @@ Status DatabasePlugin::call(const PluginRequest& request,
     if (request.count("value") == 0) {
       return Status(1, "Database plugin put action requires a value");
     }
-    return this->put(domain, key, request.at("value"));
+    // Writes routed from extensions do not pass through the cache.
+    auto status = this->put(domain, key, request.at("value"));
+    getDatabaseCache().invalidate(domain, key, key);
+    return status;
   } else if (request.at("action") == "remove") {
-    return this->remove(domain, key);
+    auto status = this->remove(domain, key);
+    getDatabaseCache().invalidate(domain, key, key);
+    return status;
   } else if (request.at("action") == "remove_range") {
     auto key_high = (request.count("high") > 0) ? request.at("key_high") : "";
     if (!key_high.empty() && !key.empty()) {
-      return this->removeRange(domain, key, key_high);
+      auto status = this->removeRange(domain, key, key_high);
+      getDatabaseCache().invalidate(domain, key, key_high);
+      return status;
     }
     return Status(1, "Missing range");
   } else if (request.at("action") == "scan") {
@@ -166,18 +539,15 @@ Status DatabasePlugin::call(const PluginRequest& request,
 }
 
 static inline std::shared_ptr<DatabasePlugin> getDatabasePlugin() {
-  auto& rf = RegistryFactory::get();
-  if (!rf.exists("database", rf.getActive("database"), true)) {
-    return nullptr;
-  }
-
-  auto plugin = rf.plugin("database", rf.getActive("database"));
-  return std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+  thread_local PluginHandle<DatabasePlugin> handle("database");
+  return handle.get();
 }
 
 Status getDatabaseValue(const std::string& domain,
                         const std::string& key,
                         std::string& value) {
+  TRACE_SPAN("getDatabaseValue", domain);
+  MEMORY_TAG(DATABASE);
   if (domain.empty()) {
     return Status(1, "Missing domain");
   }
@@ -201,15 +571,32 @@ Status getDatabaseValue(const std::string& domain,
   ReadLock lock(kDatabaseReset);
   if (!DatabasePlugin::kDBInitialized) {
     throw std::runtime_error("Cannot get database value: " + key);
-  } else {
-    auto plugin = getDatabasePlugin();
+  }
+
+  auto plugin = getDatabasePlugin();
+  auto& cache = getDatabaseCache();
+  if (!cache.isCached(domain)) {
     return plugin->get(domain, key, value);
   }
+
+  cache.use(plugin.get());
+  size_t generation = 0;
+  if (cache.get(domain, key, value, generation)) {
+    return Status(0, "OK");
+  }
+
+  auto status = plugin->get(domain, key, value);
+  if (status.ok()) {
+    cache.fill(domain, key, value, generation);
+  }
+  return status;
 }
 
 Status setDatabaseValue(const std::string& domain,
                         const std::string& key,
                         const std::string& value) {
+  TRACE_SPAN("setDatabaseValue", domain);
+  MEMORY_TAG(DATABASE);
   if (domain.empty()) {
     return Status(1, "Missing domain");
   }
@@ -225,10 +612,20 @@ Status setDatabaseValue(const std::string& domain,
   ReadLock lock(kDatabaseReset);
   if (!DatabasePlugin::kDBInitialized) {
     throw std::runtime_error("Cannot set database value: " + key);
-  } else {
-    auto plugin = getDatabasePlugin();
+  }
+
+  kDatabaseWritten.add(key.size() + value.size());
+  auto plugin = getDatabasePlugin();
+  auto& cache = getDatabaseCache();
+  if (!cache.isCached(domain)) {
     return plugin->put(domain, key, value);
   }
+
+  cache.use(plugin.get());
+  WriteLock write_lock(cache.writeMutex());
+  auto status = plugin->put(domain, key, value);
+  cache.set(domain, key, value, status.ok());
+  return status;
 }
 
 Status deleteDatabaseValue(const std::string& domain, const std::string& key) {
@@ -247,10 +644,140 @@ Status deleteDatabaseValue(const std::string& domain, const std::string& key) {
   ReadLock lock(kDatabaseReset);
   if (!DatabasePlugin::kDBInitialized) {
     throw std::runtime_error("Cannot delete database value: " + key);
+  }
+
+  auto plugin = getDatabasePlugin();
+  auto& cache = getDatabaseCache();
+  if (!cache.isCached(domain)) {
+    return plugin->remove(domain, key);
+  }
+
+  cache.use(plugin.get());
+  WriteLock write_lock(cache.writeMutex());
+  auto status = plugin->remove(domain, key);
+  cache.invalidate(domain, key, key);
+  return status;
+}
+
+Status scanDatabaseRange(const std::string& domain,
+                         const std::string& low,
+                         const std::string& high,
+                         const DatabaseScanCallback& callback) {
+  if (domain.empty()) {
+    return Status(1, "Missing domain");
+  }
+
+  if (RegistryFactory::get().external()) {
+    // External registries (extensions) do not have databases active.
+    // Scan the keys sharing the bounds' prefix, then get each value.
+    size_t size = 0;
+    while (size < low.size() && size < high.size() && low[size] == high[size]) {
+      size++;
+    }
+
+    std::vector<std::string> keys;
+    auto status = scanDatabaseKeys(domain, keys, low.substr(0, size));
+    if (!status.ok()) {
+      return status;
+    }
+
+    std::sort(keys.begin(), keys.end());
+    return scanKeysRange(keys,
+                         low,
+                         high,
+                         [&domain](const std::string& key, std::string& value) {
+                           return getDatabaseValue(domain, key, value);
+                         },
+                         callback);
+  }
+
+  ReadLock lock(kDatabaseReset);
+  if (!DatabasePlugin::kDBInitialized) {
+    throw std::runtime_error("Cannot scan database range: " + low);
   } else {
     auto plugin = getDatabasePlugin();
-    return plugin->remove(domain, key);
+    return plugin->scanRange(domain, low, high, callback);
+  }
+}
+
+std::string getPrefixUpperBound(const std::string& prefix) {
+  // The successor of the prefix, ignoring trailing bytes that cannot increase.
+  auto high = prefix;
+  while (!high.empty() && static_cast<unsigned char>(high.back()) == 0xff) {
+    high.pop_back();
+  }
+  if (!high.empty()) {
+    high.back() = static_cast<char>(high.back() + 1);
+  }
+  return high;
+}
+
+Status scanDatabasePrefix(const std::string& domain,
+                          const std::string& prefix,
+                          const DatabaseScanCallback& callback,
+                          size_t max) {
+  size_t count = 0;
+  return scanDatabaseRange(
+      domain,
+      prefix,
+      getPrefixUpperBound(prefix),
+      [&callback, &count, max](const std::string& key,
+                               const std::string& value) {
+        return callback(key, value) && (max == 0 || ++count < max);
+      });
+}
+
+Status writeDatabaseBatch(const DatabaseBatch& batch) {
+  if (batch.empty()) {
+    return Status(0, "OK");
+  }
+
+  MEMORY_TAG(DATABASE);
+
+  if (RegistryFactory::get().external()) {
+    // External registries (extensions) do not have databases active.
+    // Each operation is routed separately, the batch is not atomic.
+    for (const auto& operation : batch.operations()) {
+      Status status;
+      if (operation.type == DatabaseBatch::Type::Put) {
+        status =
+            setDatabaseValue(operation.domain, operation.key, operation.value);
+      } else if (operation.type == DatabaseBatch::Type::Remove) {
+        status = deleteDatabaseValue(operation.domain, operation.key);
+      } else {
+        status = deleteDatabaseRange(
+            operation.domain, operation.key, operation.value);
+      }
+
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    return Status(0, "OK");
   }
+
+  ReadLock lock(kDatabaseReset);
+  if (!DatabasePlugin::kDBInitialized) {
+    throw std::runtime_error("Cannot write database batch");
+  }
+
+  for (const auto& operation : batch.operations()) {
+    if (operation.type == DatabaseBatch::Type::Put) {
+      kDatabaseWritten.add(operation.key.size() + operation.value.size());
+    }
+  }
+
+  auto plugin = getDatabasePlugin();
+  auto& cache = getDatabaseCache();
+  if (!cache.isCached(batch)) {
+    return plugin->write(batch);
+  }
+
+  cache.use(plugin.get());
+  WriteLock write_lock(cache.writeMutex());
+  auto status = plugin->write(batch);
+  cache.write(batch, status.ok());
+  return status;
 }
 
 Status deleteDatabaseRange(const std::string& domain,
@@ -274,10 +801,19 @@ Status deleteDatabaseRange(const std::string& domain,
   if (!DatabasePlugin::kDBInitialized) {
     throw std::runtime_error("Cannot delete database values: " + low + " - " +
                              high);
-  } else {
-    auto plugin = getDatabasePlugin();
+  }
+
+  auto plugin = getDatabasePlugin();
+  auto& cache = getDatabaseCache();
+  if (!cache.isCached(domain)) {
     return plugin->removeRange(domain, low, high);
   }
+
+  cache.use(plugin.get());
+  WriteLock write_lock(cache.writeMutex());
+  auto status = plugin->removeRange(domain, low, high);
+  cache.invalidate(domain, low, high);
+  return status;
 }
 
 Status scanDatabaseKeys(const std::string& domain,
@@ -327,6 +863,56 @@ void resetDatabase() {
   Registry::call("database", request);
 }
 
+Status getDatabaseStats(std::vector<DatabaseDomainStats>& stats) {
+  if (RegistryFactory::get().external()) {
+    // External registries (extensions) do not have databases active.
+    return Status(1, "Database statistics are not available in extensions");
+  }
+
+  ReadLock lock(kDatabaseReset);
+  if (!DatabasePlugin::kDBInitialized) {
+    return Status(1, "Database is not initialized");
+  }
+
+  auto status = getDatabasePlugin()->getStats(stats);
+  if (!status.ok()) {
+    // The cache statistics are reported without storage statistics.
+    stats.clear();
+    for (const auto& domain : kDomains) {
+      DatabaseDomainStats domain_stats;
+      domain_stats.domain = domain;
+      stats.push_back(std::move(domain_stats));
+    }
+  }
+  getDatabaseCache().getStats(stats);
+  return Status(0, "OK");
+}
+
+Status compactDatabase(const std::string& domain) {
+  if (RegistryFactory::get().external()) {
+    return Status(1, "Database compaction is not available in extensions");
+  }
+
+  // A compaction must not race a reset closing the database.
+  ReadLock lock(kDatabaseReset);
+  if (!DatabasePlugin::kDBInitialized) {
+    return Status(1, "Database is not initialized");
+  }
+  return getDatabasePlugin()->compact(domain);
+}
+
+Status flushDatabase() {
+  if (RegistryFactory::get().external()) {
+    return Status(1, "Database flushes are not available in extensions");
+  }
+
+  ReadLock lock(kDatabaseReset);
+  if (!DatabasePlugin::kDBInitialized) {
+    return Status(1, "Database is not initialized");
+  }
+  return getDatabasePlugin()->flush();
+}
+
 void dumpDatabase() {
   for (const auto& domain : kDomains) {
     std::vector<std::string> keys;
@@ -42,6 +42,12 @@ class EphemeralDatabasePlugin : public DatabasePlugin {
               const std::string& prefix,
               size_t max) const override;
 
+  /// Ordered key/value range iteration method.
+  Status scanRange(const std::string& domain,
+                   const std::string& low,
+                   const std::string& high,
+                   const DatabaseScanCallback& callback) const override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override {
@@ -83,15 +89,9 @@ Status EphemeralDatabasePlugin::remove(const std::string& domain,
 Status EphemeralDatabasePlugin::removeRange(const std::string& domain,
                                             const std::string& low,
                                             const std::string& high) {
-  std::vector<std::string> keys;
-  for (const auto& it : db_[domain]) {
-    if (it.first >= low && it.first <= high) {
-      keys.push_back(it.first);
-    }
-  }
-
-  for (const auto& key : keys) {
-    db_[domain].erase(key);
+  if (low <= high) {
+    auto& keys = db_[domain];
+    keys.erase(keys.lower_bound(low), keys.upper_bound(high));
   }
   return Status(0);
 }
@@ -117,4 +117,23 @@ Status EphemeralDatabasePlugin::scan(const std::string& domain,
   }
   return Status(0);
 }
+
+Status EphemeralDatabasePlugin::scanRange(
+    const std::string& domain,
+    const std::string& low,
+    const std::string& high,
+    const DatabaseScanCallback& callback) const {
+  if (db_.count(domain) == 0) {
+    return Status(0);
+  }
+
+  const auto& keys = db_.at(domain);
+  for (auto it = keys.lower_bound(low); it != keys.end(); ++it) {
+    if ((!high.empty() && it->first >= high) ||
+        !callback(it->first, it->second)) {
+      break;
+    }
+  }
+  return Status(0);
+}
 }
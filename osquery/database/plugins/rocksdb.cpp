@@ -8,14 +8,22 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+
 #include <sys/stat.h>
 
 #include <rocksdb/db.h>
+#include <rocksdb/cache.h>
 #include <rocksdb/env.h>
+#include <rocksdb/filter_policy.h>
 #include <rocksdb/options.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/table.h>
+#include <rocksdb/write_batch.h>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 
 #include "osquery/database/plugins/rocksdb.h"
 #include "osquery/filesystem/fileops.h"
@@ -29,7 +37,24 @@ HIDDEN_FLAG(int32, rocksdb_write_buffer, 16, "Max write buffer number");
 HIDDEN_FLAG(int32, rocksdb_merge_number, 4, "Min write buffer number to merge");
 HIDDEN_FLAG(int32, rocksdb_background_flushes, 4, "Max background flushes");
 HIDDEN_FLAG(uint64, rocksdb_buffer_blocks, 256, "Write buffer blocks (4k)");
+HIDDEN_FLAG(int32, rocksdb_bloom_bits, 10, "Bloom filter bits per key");
+
+FLAG(string,
+     rocksdb_compression,
+     "none",
+     "Compression of the JSON-valued domains: none, zstd, lz4, or snappy");
+
+FLAG(string,
+     rocksdb_queue_compaction,
+     "level",
+     "Compaction of the events and logs domains: level or universal");
 
+FLAG(uint64,
+     rocksdb_cache_size,
+     8,
+     "Block cache size in MB of the queries and settings domains");
+
+DECLARE_bool(database_read_only);
 DECLARE_string(database_path);
 
 /**
@@ -43,6 +68,125 @@ std::atomic<bool> kRocksDBCorruptionIndicator{false};
 /// Backing-storage provider for osquery internal/core.
 REGISTER_INTERNAL(RocksDBDatabasePlugin, "database", "rocksdb");
 
+/// Key prefixes end with the first of these, such as "data." or "tls_r_".
+const std::string kRocksDBPrefixDelimiters = "._";
+
+namespace {
+
+/**
+ * @brief Extract the key prefix up to, and including, the first delimiter.
+ *
+ * Every key within a domain is namespaced this way, for example the event
+ * "data.", "indexes." and "records." keys, or the buffered log "tls_" keys.
+ * A key without a delimiter is its own prefix.
+ *
+ * A scan prefix that contains a delimiter shares the extracted prefix with
+ * every key it may match, so such scans use the prefix bloom filters.
+ */
+class DelimitedPrefixTransform : public rocksdb::SliceTransform {
+ public:
+  const char* Name() const override {
+    return "osquery.DelimitedPrefix";
+  }
+
+  rocksdb::Slice Transform(const rocksdb::Slice& key) const override {
+    return rocksdb::Slice(key.data(), prefixSize(key));
+  }
+
+  bool InDomain(const rocksdb::Slice& key) const override {
+    return true;
+  }
+
+  bool InRange(const rocksdb::Slice& dst) const override {
+    return prefixSize(dst) == dst.size();
+  }
+
+ private:
+  static size_t prefixSize(const rocksdb::Slice& key) {
+    for (size_t i = 0; i < key.size(); i++) {
+      if (kRocksDBPrefixDelimiters.find(key[i]) != std::string::npos) {
+        return i + 1;
+      }
+    }
+    return key.size();
+  }
+};
+
+/// Check if a prefix scan may seek using the prefix bloom filters.
+bool isDelimitedPrefix(const std::string& prefix) {
+  return prefix.find_first_of(kRocksDBPrefixDelimiters) != std::string::npos;
+}
+
+rocksdb::CompressionType getCompressionType(const std::string& name) {
+  if (name == "zstd") {
+    return rocksdb::kZSTD;
+  } else if (name == "lz4") {
+    return rocksdb::kLZ4Compression;
+  } else if (name == "snappy") {
+    return rocksdb::kSnappyCompression;
+  } else if (name != "none") {
+    LOG(WARNING) << "Unknown RocksDB compression: " << name;
+  }
+  return rocksdb::kNoCompression;
+}
+
+/**
+ * @brief Get the tuning profile of a domain.
+ *
+ * The events and logs domains are queues: appended, read in order, and then
+ * removed. The queries, settings, file hashes, packages and signatures
+ * domains are overwritten in place and read by key. Values other than
+ * settings are mostly JSON.
+ */
+std::string getDomainProfile(const std::string& domain) {
+  if (domain == kEvents || domain == kLogs) {
+    return "queue";
+  } else if (domain == kQueries || domain == kPersistentSettings ||
+             domain == kFileHashes || domain == kPackages ||
+             domain == kSignatures) {
+    return "lookup";
+  }
+  return "default";
+}
+
+rocksdb::ColumnFamilyOptions getDomainOptions(
+    const std::string& domain,
+    const rocksdb::Options& base,
+    const std::shared_ptr<rocksdb::Cache>& cache) {
+  // Domains are scanned by key prefix, and read by key.
+  // Bloom filters on both allow most table files to be skipped.
+  rocksdb::ColumnFamilyOptions options(base);
+  options.prefix_extractor = std::make_shared<DelimitedPrefixTransform>();
+  options.memtable_prefix_bloom_size_ratio = 0.1;
+
+  rocksdb::BlockBasedTableOptions table_options;
+  if (FLAGS_rocksdb_bloom_bits > 0) {
+    table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(
+        static_cast<int>(FLAGS_rocksdb_bloom_bits), false));
+  }
+
+  auto profile = getDomainProfile(domain);
+  if (profile == "queue") {
+    // Universal compaction rewrites an append-mostly queue less often.
+    if (FLAGS_rocksdb_queue_compaction == "universal") {
+      options.compaction_style = rocksdb::kCompactionStyleUniversal;
+    }
+  } else if (profile == "lookup" && cache != nullptr) {
+    // Point lookups of values that are overwritten in place read cached
+    // blocks, shared by these domains.
+    table_options.block_cache = cache;
+  }
+
+  if (domain != kPersistentSettings) {
+    options.compression = getCompressionType(FLAGS_rocksdb_compression);
+  }
+
+  options.table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(table_options));
+  return options;
+}
+} // namespace
+
 void GlogRocksDBLogger::Logv(const char* format, va_list ap) {
   // Convert RocksDB log to string and check if header or level-ed log.
   std::string log_line;
@@ -111,12 +255,22 @@ Status RocksDBDatabasePlugin::setUp() {
     }
     options_.info_log = logger_;
 
-    column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
-        rocksdb::kDefaultColumnFamilyName, options_));
+    std::shared_ptr<rocksdb::Cache> cache;
+    if (FLAGS_rocksdb_cache_size > 0) {
+      cache = rocksdb::NewLRUCache(FLAGS_rocksdb_cache_size * 1024 * 1024);
+    }
 
-    for (const auto& cf_name : kDomains) {
+    // Each domain uses the handle at its index, see getHandleForColumnFamily,
+    // such that the first domain is stored in the default column family.
+    // The profiles follow the handles, the last column family is not used.
+    for (size_t i = 0; i <= kDomains.size(); i++) {
+      const auto& cf_name =
+          (i == 0) ? rocksdb::kDefaultColumnFamilyName : kDomains[i - 1];
+      auto cf_options = (i < kDomains.size())
+                            ? getDomainOptions(kDomains[i], options_, cache)
+                            : rocksdb::ColumnFamilyOptions(options_);
       column_families_.push_back(
-          rocksdb::ColumnFamilyDescriptor(cf_name, options_));
+          rocksdb::ColumnFamilyDescriptor(cf_name, cf_options));
     }
   }
 
@@ -135,6 +289,20 @@ Status RocksDBDatabasePlugin::setUp() {
   // Tests may trash calls to setUp, make sure subsequent calls do not leak.
   close();
 
+  if (FLAGS_database_read_only && !kDBRequireWrite) {
+    auto s = openReadOnly();
+    if (s.ok()) {
+      // Event publishers cannot store events.
+      Flag::updateValue("disable_events", "true");
+      read_only_ = true;
+      return Status(0);
+    }
+
+    if (!DatabasePlugin::kDBChecking) {
+      LOG(INFO) << "Opening RocksDB read-only failed: " << s.ToString();
+    }
+  }
+
   // Attempt to create a RocksDB instance and handles.
   auto s =
       rocksdb::DB::Open(options_, path_, column_families_, &handles_, &db_);
@@ -145,6 +313,17 @@ Status RocksDBDatabasePlugin::setUp() {
     s = rocksdb::DB::Open(options_, path_, column_families_, &handles_, &db_);
   }
 
+  if (s.IsInvalidArgument() && FLAGS_rocksdb_compression != "none") {
+    // The compression may not be supported by this build, existing table
+    // files keep their compression.
+    LOG(WARNING) << "Cannot use RocksDB compression "
+                 << FLAGS_rocksdb_compression << ": " << s.ToString();
+    for (auto& cf : column_families_) {
+      cf.options.compression = rocksdb::kNoCompression;
+    }
+    s = rocksdb::DB::Open(options_, path_, column_families_, &handles_, &db_);
+  }
+
   if (!s.ok() || db_ == nullptr) {
     LOG(INFO) << "Rocksdb open failed (" << s.code() << ":" << s.subcode()
               << ") " << s.ToString();
@@ -168,6 +347,41 @@ Status RocksDBDatabasePlugin::setUp() {
   return Status(0);
 }
 
+rocksdb::Status RocksDBDatabasePlugin::openReadOnly() {
+  // A read-only instance cannot create the missing column families.
+  std::vector<std::string> names;
+  auto s = rocksdb::DB::ListColumnFamilies(options_, path_, &names);
+  if (!s.ok()) {
+    return s;
+  }
+
+  std::vector<rocksdb::ColumnFamilyDescriptor> existing;
+  std::vector<size_t> positions;
+  for (size_t i = 0; i < column_families_.size(); i++) {
+    if (std::find(names.begin(), names.end(), column_families_[i].name) !=
+        names.end()) {
+      existing.push_back(column_families_[i]);
+      positions.push_back(i);
+    }
+  }
+
+  auto options = options_;
+  options.allow_mmap_reads = true;
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  s = rocksdb::DB::OpenForReadOnly(options, path_, existing, &handles, &db_);
+  if (!s.ok() || db_ == nullptr) {
+    db_ = nullptr;
+    return (s.ok()) ? rocksdb::Status::IOError("No database handle") : s;
+  }
+
+  // Domains without a column family have no handle.
+  handles_.assign(column_families_.size(), nullptr);
+  for (size_t i = 0; i < handles.size(); i++) {
+    handles_[positions[i]] = handles[i];
+  }
+  return s;
+}
+
 void RocksDBDatabasePlugin::tearDown() {
   close();
 }
@@ -329,6 +543,140 @@ Status RocksDBDatabasePlugin::removeRange(const std::string& domain,
   return Status(s.code(), s.ToString());
 }
 
+Status RocksDBDatabasePlugin::write(const DatabaseBatch& batch) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  rocksdb::WriteBatch write_batch;
+  // Batches only containing events do not need to force syncs.
+  bool sync = false;
+  for (const auto& operation : batch.operations()) {
+    auto cfh = getHandleForColumnFamily(operation.domain);
+    if (cfh == nullptr) {
+      return Status(1, "Could not get column family for " + operation.domain);
+    }
+
+    if (operation.type == DatabaseBatch::Type::Put) {
+      write_batch.Put(cfh, operation.key, operation.value);
+    } else if (operation.type == DatabaseBatch::Type::Remove) {
+      write_batch.Delete(cfh, operation.key);
+    } else {
+      // The range is inclusive, as with removeRange.
+      write_batch.DeleteRange(cfh, operation.key, operation.value);
+      if (operation.key <= operation.value) {
+        write_batch.Delete(cfh, operation.value);
+      }
+    }
+    sync = sync || kEvents != operation.domain;
+  }
+
+  auto options = rocksdb::WriteOptions();
+  options.sync = sync;
+  auto s = getDB()->Write(options, &write_batch);
+  return Status(s.code(), s.ToString());
+}
+
+Status RocksDBDatabasePlugin::getStats(
+    std::vector<DatabaseDomainStats>& stats) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  for (const auto& domain : kDomains) {
+    auto cfh = getHandleForColumnFamily(domain);
+    if (cfh == nullptr) {
+      continue;
+    }
+
+    DatabaseDomainStats domain_stats;
+    domain_stats.domain = domain;
+    domain_stats.profile = getDomainProfile(domain);
+    getDB()->GetIntProperty(
+        cfh, "rocksdb.estimate-num-keys", &domain_stats.keys);
+    getDB()->GetIntProperty(
+        cfh, "rocksdb.total-sst-files-size", &domain_stats.disk_bytes);
+    getDB()->GetIntProperty(
+        cfh, "rocksdb.cur-size-all-mem-tables", &domain_stats.memory_bytes);
+    getDB()->GetIntProperty(cfh,
+                            "rocksdb.estimate-pending-compaction-bytes",
+                            &domain_stats.pending_compaction_bytes);
+    // Write stalls are database-wide, and reported for each domain.
+    getDB()->GetIntProperty(cfh,
+                            "rocksdb.actual-delayed-write-rate",
+                            &domain_stats.delayed_write_rate);
+    uint64_t stopped = 0;
+    getDB()->GetIntProperty(cfh, "rocksdb.is-write-stopped", &stopped);
+    domain_stats.write_stopped = (stopped != 0);
+    {
+      ReadLock lock(compaction_mutex_);
+      auto compaction = last_compaction_.find(domain);
+      if (compaction != last_compaction_.end()) {
+        domain_stats.last_compaction = compaction->second;
+      }
+    }
+    stats.push_back(std::move(domain_stats));
+  }
+  return Status(0, "OK");
+}
+
+Status RocksDBDatabasePlugin::compact(const std::string& domain) {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  // Persist the memtables such that removed keys are compacted.
+  auto s = getDB()->Flush(rocksdb::FlushOptions(), cfh);
+  if (!s.ok()) {
+    return Status(s.code(), s.ToString());
+  }
+
+  // Automatic compactions may continue alongside the manual compaction.
+  rocksdb::CompactRangeOptions options;
+  options.exclusive_manual_compaction = false;
+  s = getDB()->CompactRange(options, cfh, nullptr, nullptr);
+  if (!s.ok()) {
+    return Status(s.code(), s.ToString());
+  }
+
+  WriteLock lock(compaction_mutex_);
+  last_compaction_[domain] = getUnixTime();
+  return Status(0, "OK");
+}
+
+Status RocksDBDatabasePlugin::flush() {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  // Memtables are written to table files, the block cache is kept.
+  for (const auto& domain : kDomains) {
+    auto cfh = getHandleForColumnFamily(domain);
+    if (cfh == nullptr) {
+      continue;
+    }
+
+    auto s = getDB()->Flush(rocksdb::FlushOptions(), cfh);
+    if (!s.ok()) {
+      return Status(s.code(), s.ToString());
+    }
+  }
+  return Status(0, "OK");
+}
+
 Status RocksDBDatabasePlugin::scan(const std::string& domain,
                                    std::vector<std::string>& results,
                                    const std::string& prefix,
@@ -344,19 +692,64 @@ Status RocksDBDatabasePlugin::scan(const std::string& domain,
   auto options = rocksdb::ReadOptions();
   options.verify_checksums = false;
   options.fill_cache = false;
+  // Scans without a complete key prefix, such as a full scan, are ordered
+  // across every prefix.
+  options.total_order_seek = !isDelimitedPrefix(prefix);
   auto it = getDB()->NewIterator(options, cfh);
   if (it == nullptr) {
     return Status(1, "Could not get iterator for " + domain);
   }
 
+  // Keys are ordered, those sharing the prefix follow a seek to the prefix.
   size_t count = 0;
-  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+  for (it->Seek(prefix); it->Valid(); it->Next()) {
     auto key = it->key().ToString();
-    if (key.find(prefix) == 0) {
-      results.push_back(std::move(key));
-      if (max > 0 && ++count >= max) {
-        break;
-      }
+    if (key.compare(0, prefix.size(), prefix) != 0) {
+      break;
+    }
+    results.push_back(std::move(key));
+    if (max > 0 && ++count >= max) {
+      break;
+    }
+  }
+  delete it;
+  return Status(0, "OK");
+}
+
+Status RocksDBDatabasePlugin::scanRange(
+    const std::string& domain,
+    const std::string& low,
+    const std::string& high,
+    const DatabaseScanCallback& callback) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+  auto options = rocksdb::ReadOptions();
+  options.verify_checksums = false;
+  options.fill_cache = false;
+  // A range may span several key prefixes.
+  options.total_order_seek = true;
+  // The iterator stops at the bound rather than reading past it.
+  rocksdb::Slice upper_bound(high);
+  if (!high.empty()) {
+    options.iterate_upper_bound = &upper_bound;
+  }
+
+  // The iterator reads from an implicit snapshot, keys and values written
+  // during the scan are not visited.
+  auto it = getDB()->NewIterator(options, cfh);
+  if (it == nullptr) {
+    return Status(1, "Could not get iterator for " + domain);
+  }
+
+  for (it->Seek(low); it->Valid(); it->Next()) {
+    if (!callback(it->key().ToString(), it->value().ToString())) {
+      break;
     }
   }
   delete it;
@@ -9,6 +9,7 @@
  */
 
 #include <atomic>
+#include <map>
 
 #include <rocksdb/db.h>
 
@@ -58,6 +59,24 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
               const std::string& prefix,
               size_t max) const override;
 
+  /// Ordered key/value range iteration method.
+  Status scanRange(const std::string& domain,
+                   const std::string& low,
+                   const std::string& high,
+                   const DatabaseScanCallback& callback) const override;
+
+  /// Atomic batch write method.
+  Status write(const DatabaseBatch& batch) override;
+
+  /// Column family statistics method.
+  Status getStats(std::vector<DatabaseDomainStats>& stats) const override;
+
+  /// Flush memtables and compact a column family.
+  Status compact(const std::string& domain) override;
+
+  /// Flush the memtables of every column family.
+  Status flush() override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override;
@@ -74,6 +93,14 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
   /// Obtain a close lock and release resources.
   void close();
 
+  /**
+   * @brief Open the existing column families read-only with mmap reads.
+   *
+   * A read-only instance does not take the database lock, it may open the
+   * database of a running daemon.
+   */
+  rocksdb::Status openReadOnly();
+
   /**
    * @brief Private helper around accessing the column family handle for a
    * specific column family, based on its name
@@ -96,9 +123,6 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
    */
   void repairDB();
 
-  /// Flush memtables and trigger compaction.
-  void flush();
-
  private:
   /**
    * @brief Mark the RocksDB database as corrupted.
@@ -132,6 +156,12 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
   /// Deconstruction mutex.
   Mutex close_mutex_;
 
+  /// The UNIX time of the last compaction of each domain.
+  std::map<std::string, uint64_t> last_compaction_;
+
+  /// Protection around the compaction times.
+  mutable Mutex compaction_mutex_;
+
  private:
   friend class GlogRocksDBLogger;
   FRIEND_TEST(RocksDBDatabasePluginTests, test_corruption);
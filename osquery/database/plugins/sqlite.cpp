@@ -22,6 +22,7 @@
 
 namespace osquery {
 
+DECLARE_bool(database_read_only);
 DECLARE_string(database_path);
 
 const std::map<std::string, std::string> kDBSettings = {
@@ -60,6 +61,15 @@ class SQLiteDatabasePlugin : public DatabasePlugin {
               const std::string& prefix,
               size_t max) const override;
 
+  /// Apply a batch within a single transaction.
+  Status write(const DatabaseBatch& batch) override;
+
+  /// Key and value range iteration method.
+  Status scanRange(const std::string& domain,
+                   const std::string& low,
+                   const std::string& high,
+                   const DatabaseScanCallback& callback) const override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override;
@@ -109,7 +119,20 @@ Status SQLiteDatabasePlugin::setUp() {
   close();
 
   // Open the SQLite backing storage at path_
-  auto result = sqlite3_open_v2(
+  int result = SQLITE_ERROR;
+  if (FLAGS_database_read_only && !DatabasePlugin::kDBRequireWrite) {
+    result = sqlite3_open_v2(path_.c_str(),
+                             &db_,
+                             (SQLITE_OPEN_FULLMUTEX | SQLITE_OPEN_READONLY),
+                             nullptr);
+    if (result == SQLITE_OK && db_ != nullptr) {
+      read_only_ = true;
+      return Status(0);
+    }
+    close();
+  }
+
+  result = sqlite3_open_v2(
       path_.c_str(),
       &db_,
       (SQLITE_OPEN_FULLMUTEX | SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE),
@@ -286,6 +309,27 @@ Status SQLiteDatabasePlugin::removeRange(const std::string& domain,
   return Status(0);
 }
 
+Status SQLiteDatabasePlugin::write(const DatabaseBatch& batch) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  // The operations are committed together, or not at all.
+  if (sqlite3_exec(db_, "begin transaction;", nullptr, nullptr, nullptr) !=
+      SQLITE_OK) {
+    return Status(1, "Could not begin database batch");
+  }
+
+  auto status = DatabasePlugin::write(batch);
+  auto end = (status.ok()) ? "commit;" : "rollback;";
+  if (sqlite3_exec(db_, end, nullptr, nullptr, nullptr) != SQLITE_OK &&
+      status.ok()) {
+    sqlite3_exec(db_, "rollback;", nullptr, nullptr, nullptr);
+    return Status(1, "Could not commit database batch");
+  }
+  return status;
+}
+
 Status SQLiteDatabasePlugin::scan(const std::string& domain,
                                   std::vector<std::string>& results,
                                   const std::string& prefix,
@@ -310,4 +354,47 @@ Status SQLiteDatabasePlugin::scan(const std::string& domain,
 
   return Status(0, "OK");
 }
+
+Status SQLiteDatabasePlugin::scanRange(
+    const std::string& domain,
+    const std::string& low,
+    const std::string& high,
+    const DatabaseScanCallback& callback) const {
+  std::string q = "select key, value from " + domain + " where key >= ?1";
+  if (!high.empty()) {
+    q += " and key < ?2";
+  }
+  q += " order by key;";
+
+  // A single statement reads a consistent view of the domain.
+  sqlite3_stmt* stmt = nullptr;
+  auto rc = sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    return Status(1, "Could not scan " + domain);
+  }
+
+  sqlite3_bind_text(stmt, 1, low.c_str(), -1, SQLITE_STATIC);
+  if (!high.empty()) {
+    sqlite3_bind_text(stmt, 2, high.c_str(), -1, SQLITE_STATIC);
+  }
+
+  auto text = [stmt](int column) {
+    auto data =
+        reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
+    return (data == nullptr)
+               ? std::string()
+               : std::string(data, sqlite3_column_bytes(stmt, column));
+  };
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if (!callback(text(0), text(1))) {
+      rc = SQLITE_DONE;
+      break;
+    }
+  }
+  sqlite3_finalize(stmt);
+  return (rc == SQLITE_DONE) ? Status(0, "OK")
+                             : Status(1, "Could not scan " + domain);
+}
 }
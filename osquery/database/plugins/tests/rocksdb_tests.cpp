@@ -16,6 +16,9 @@
 
 namespace osquery {
 
+DECLARE_bool(database_read_only);
+DECLARE_bool(disable_events);
+
 class RocksDBDatabasePluginTests : public DatabasePluginTests {
  protected:
   std::string name() override {
@@ -36,6 +39,98 @@ TEST_F(RocksDBDatabasePluginTests, test_rocksdb_loglevel) {
   ASSERT_EQ(details.size(), 0U);
 }
 
+TEST_F(RocksDBDatabasePluginTests, test_scan_prefix_seek) {
+  getPlugin()->put(kEvents, "data.a.1", "");
+  getPlugin()->put(kEvents, "data.a.2", "");
+  getPlugin()->put(kEvents, "data.b.1", "");
+  getPlugin()->put(kEvents, "datab", "");
+  getPlugin()->put(kEvents, "indexes.a.1", "");
+
+  // Scans within a delimited key prefix.
+  std::vector<std::string> keys;
+  EXPECT_TRUE(getPlugin()->scan(kEvents, keys, "data.a.", 0));
+  EXPECT_EQ(keys, std::vector<std::string>({"data.a.1", "data.a.2"}));
+
+  keys.clear();
+  EXPECT_TRUE(getPlugin()->scan(kEvents, keys, "data.", 0));
+  EXPECT_EQ(keys.size(), 3U);
+
+  // Scans across key prefixes.
+  keys.clear();
+  EXPECT_TRUE(getPlugin()->scan(kEvents, keys, "data", 0));
+  EXPECT_EQ(keys.size(), 4U);
+
+  keys.clear();
+  EXPECT_TRUE(getPlugin()->scan(kEvents, keys, "", 0));
+  EXPECT_EQ(keys.size(), 5U);
+}
+
+TEST_F(RocksDBDatabasePluginTests, test_domain_stats) {
+  getPlugin()->put(kEvents, "data.a.1", "1");
+
+  std::vector<DatabaseDomainStats> stats;
+  ASSERT_TRUE(getPlugin()->getStats(stats));
+  ASSERT_EQ(stats.size(), kDomains.size());
+  for (const auto& domain : stats) {
+    if (domain.domain == kEvents || domain.domain == kLogs) {
+      EXPECT_EQ(domain.profile, "queue");
+    } else if (domain.domain == kQueries) {
+      EXPECT_EQ(domain.profile, "lookup");
+    }
+
+    if (domain.domain == kEvents) {
+      EXPECT_GT(domain.memory_bytes, 0U);
+    }
+  }
+}
+
+TEST_F(RocksDBDatabasePluginTests, test_compact) {
+  for (size_t i = 0; i < 100; ++i) {
+    getPlugin()->put(kEvents, "data.a." + std::to_string(i), "value");
+  }
+  getPlugin()->removeRange(kEvents, "data.a.", "data.a.~");
+  ASSERT_TRUE(getPlugin()->compact(kEvents));
+
+  std::vector<DatabaseDomainStats> stats;
+  ASSERT_TRUE(getPlugin()->getStats(stats));
+  for (const auto& domain : stats) {
+    if (domain.domain == kEvents) {
+      EXPECT_GT(domain.last_compaction, 0U);
+      EXPECT_FALSE(domain.write_stopped);
+    } else {
+      EXPECT_EQ(domain.last_compaction, 0U);
+    }
+  }
+
+  std::vector<std::string> keys;
+  getPlugin()->scan(kEvents, keys, "", 0);
+  EXPECT_TRUE(keys.empty());
+}
+
+TEST_F(RocksDBDatabasePluginTests, test_read_only) {
+  getPlugin()->put(kQueries, "read_only", "value");
+
+  // The read-only handle is opened while the database is locked.
+  auto disable_events = FLAGS_disable_events;
+  FLAGS_database_read_only = true;
+  RocksDBDatabasePlugin plugin;
+  auto status = plugin.setUp();
+  FLAGS_database_read_only = false;
+  FLAGS_disable_events = disable_events;
+  ASSERT_TRUE(status.ok());
+
+  // Builds without read-only support continue without a handle.
+  std::string value;
+  if (plugin.get(kQueries, "read_only", value).ok()) {
+    EXPECT_EQ(value, "value");
+  }
+
+  // Writes are ignored.
+  EXPECT_TRUE(plugin.put(kQueries, "read_only_write", "value"));
+  EXPECT_FALSE(getPlugin()->get(kQueries, "read_only_write", value));
+  plugin.tearDown();
+}
+
 TEST_F(RocksDBDatabasePluginTests, test_corruption) {
   ASSERT_TRUE(pathExists(path_));
   ASSERT_FALSE(pathExists(path_ + ".backup"));
@@ -56,6 +56,40 @@ TEST_F(DatabaseTests, test_scan_values) {
   EXPECT_EQ(keys.size(), 2U);
 }
 
+TEST_F(DatabaseTests, test_scan_prefix_values) {
+  setDatabaseValue(kLogs, "prefix_1", "1");
+  setDatabaseValue(kLogs, "prefix_2", "2");
+  setDatabaseValue(kLogs, "prefix_3", "3");
+  setDatabaseValue(kLogs, "prefiy", "0");
+
+  std::vector<std::string> values;
+  auto s = scanDatabasePrefix(
+      kLogs, "prefix_", [&values](const std::string&, const std::string& v) {
+        values.push_back(v);
+        return true;
+      });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(values, std::vector<std::string>({"1", "2", "3"}));
+
+  values.clear();
+  s = scanDatabasePrefix(kLogs,
+                         "prefix_",
+                         [&values](const std::string&, const std::string& v) {
+                           values.push_back(v);
+                           return true;
+                         },
+                         2);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(values, std::vector<std::string>({"1", "2"}));
+}
+
+TEST_F(DatabaseTests, test_prefix_upper_bound) {
+  EXPECT_EQ(getPrefixUpperBound("abc"), "abd");
+  EXPECT_EQ(getPrefixUpperBound("ab\xff"), "ac");
+  EXPECT_EQ(getPrefixUpperBound("\xff"), "");
+  EXPECT_EQ(getPrefixUpperBound(""), "");
+}
+
 TEST_F(DatabaseTests, test_delete_values) {
   setDatabaseValue(kLogs, "k", "0");
 
@@ -72,4 +106,56 @@ TEST_F(DatabaseTests, test_delete_values) {
   EXPECT_FALSE(s.ok());
   EXPECT_TRUE(value.empty());
 }
+
+/// Get the cache statistics of a domain.
+static DatabaseDomainStats getCacheStats(const std::string& domain) {
+  std::vector<DatabaseDomainStats> stats;
+  getDatabaseStats(stats);
+  for (const auto& domain_stats : stats) {
+    if (domain_stats.domain == domain) {
+      return domain_stats;
+    }
+  }
+  return DatabaseDomainStats();
+}
+
+TEST_F(DatabaseTests, test_cache) {
+  setDatabaseValue(kQueries, "cache_test_epoch", "1");
+  auto before = getCacheStats(kQueries);
+
+  // Written values are read from the cache.
+  std::string value;
+  EXPECT_TRUE(getDatabaseValue(kQueries, "cache_test_epoch", value));
+  EXPECT_EQ(value, "1");
+  auto after = getCacheStats(kQueries);
+  EXPECT_EQ(after.cache_hits, before.cache_hits + 1);
+  EXPECT_GT(after.cache_bytes, 0U);
+
+  // Writes and removes are coherent with the cache.
+  DatabaseBatch batch;
+  batch.put(kQueries, "cache_test_epoch", "2");
+  EXPECT_TRUE(writeDatabaseBatch(batch));
+  EXPECT_TRUE(getDatabaseValue(kQueries, "cache_test_epoch", value));
+  EXPECT_EQ(value, "2");
+
+  EXPECT_TRUE(deleteDatabaseRange(kQueries, "cache_test_", "cache_test_~"));
+  value.clear();
+  EXPECT_FALSE(getDatabaseValue(kQueries, "cache_test_epoch", value));
+  EXPECT_TRUE(value.empty());
+
+  // Large values are not cached.
+  setDatabaseValue(kQueries, "cache_test_results", std::string(4096, 'a'));
+  before = getCacheStats(kQueries);
+  EXPECT_TRUE(getDatabaseValue(kQueries, "cache_test_results", value));
+  EXPECT_EQ(value.size(), 4096U);
+  after = getCacheStats(kQueries);
+  EXPECT_EQ(after.cache_misses, before.cache_misses + 1);
+  deleteDatabaseValue(kQueries, "cache_test_results");
+
+  // Uncached domains do not count lookups.
+  before = getCacheStats(kLogs);
+  getDatabaseValue(kLogs, "does_not_exist", value);
+  after = getCacheStats(kLogs);
+  EXPECT_EQ(after.cache_misses, before.cache_misses);
+}
 }
@@ -8,6 +8,7 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
 #include <future>
 
 #include <osquery/filesystem.h>
@@ -190,4 +191,89 @@ void DatabasePluginTests::testScanLimit() {
   EXPECT_EQ(s.getMessage(), "OK");
   EXPECT_EQ(keys.size(), 2U);
 }
+
+void DatabasePluginTests::testScanRange() {
+  getPlugin()->put(kEvents, "test_range.1", "1");
+  getPlugin()->put(kEvents, "test_range.3", "3");
+  getPlugin()->put(kEvents, "test_range.2", "2");
+  getPlugin()->put(kEvents, "test_range.4", "4");
+  getPlugin()->put(kEvents, "test_range0", "0");
+
+  // The low key is inclusive, the high key is exclusive.
+  std::vector<std::string> values;
+  auto s = getPlugin()->scanRange(
+      kEvents,
+      "test_range.2",
+      "test_range.4",
+      [&values](const std::string& key, const std::string& value) {
+        values.push_back(value);
+        return true;
+      });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(values, std::vector<std::string>({"2", "3"}));
+
+  // Keys are visited in order, until the callback returns false.
+  values.clear();
+  s = getPlugin()->scanRange(
+      kEvents,
+      "test_range.",
+      "test_range.~",
+      [&values](const std::string& key, const std::string& value) {
+        values.push_back(value);
+        return values.size() < 3;
+      });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(values, std::vector<std::string>({"1", "2", "3"}));
+
+  // An empty high key does not bound the range.
+  values.clear();
+  s = getPlugin()->scanRange(
+      kEvents,
+      "test_range.4",
+      "",
+      [&values](const std::string& key, const std::string& value) {
+        values.push_back(value);
+        return true;
+      });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(values, std::vector<std::string>({"4", "0"}));
+}
+
+void DatabasePluginTests::testWriteBatch() {
+  getPlugin()->put(kQueries, "test_batch_remove", "baz");
+
+  DatabaseBatch batch;
+  batch.put(kQueries, "test_batch1", "1");
+  batch.put(kEvents, "test_batch2", "2");
+  batch.remove(kQueries, "test_batch_remove");
+  EXPECT_EQ(batch.size(), 3U);
+
+  auto s = getPlugin()->write(batch);
+  EXPECT_TRUE(s.ok());
+
+  std::string r;
+  getPlugin()->get(kQueries, "test_batch1", r);
+  EXPECT_EQ(r, "1");
+  getPlugin()->get(kEvents, "test_batch2", r);
+  EXPECT_EQ(r, "2");
+  s = getPlugin()->get(kQueries, "test_batch_remove", r);
+  EXPECT_FALSE(s.ok());
+
+  // Ranges are removed inclusively, with the other operations.
+  getPlugin()->put(kEvents, "test_batch_range.1", "1");
+  getPlugin()->put(kEvents, "test_batch_range.2", "2");
+  getPlugin()->put(kEvents, "test_batch_range.3", "3");
+  batch.clear();
+  batch.removeRange(kEvents, "test_batch_range.1", "test_batch_range.2");
+  batch.put(kEvents, "test_batch_range.4", "4");
+  s = getPlugin()->write(batch);
+  EXPECT_TRUE(s.ok());
+
+  std::vector<std::string> keys;
+  getPlugin()->scan(kEvents, keys, "test_batch_range.", 0);
+  std::sort(keys.begin(), keys.end());
+  EXPECT_EQ(keys,
+            std::vector<std::string>(
+                {"test_batch_range.3", "test_batch_range.4"}));
+}
 }
@@ -41,6 +41,12 @@
   }                                                                            \
   TEST_F(n, test_scan_limit) {                                                 \
     testScanLimit();                                                           \
+  }                                                                            \
+  TEST_F(n, test_scan_range) {                                                 \
+    testScanRange();                                                           \
+  }                                                                            \
+  TEST_F(n, test_write_batch) {                                                \
+    testWriteBatch();                                                          \
   }
 
 namespace osquery {
@@ -91,5 +97,7 @@ class DatabasePluginTests : public testing::Test {
   void testDeleteRange();
   void testScan();
   void testScanLimit();
+  void testScanRange();
+  void testWriteBatch();
 };
 }
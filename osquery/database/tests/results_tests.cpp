@@ -157,6 +157,98 @@ TEST_F(ResultsTests, test_serialize_query_log_item_json) {
   EXPECT_EQ(results.first, json);
 }
 
+TEST_F(ResultsTests, test_serialize_query_log_item_json_escapes) {
+  QueryLogItem item;
+  item.name = "escapes";
+  item.identifier = "host\"name";
+  item.decorations["tab"] = "a\tb";
+
+  // Empty snapshot results are written as an empty string.
+  std::string json;
+  EXPECT_TRUE(serializeQueryLogItemJSON(item, json));
+  pt::ptree tree;
+  EXPECT_TRUE(serializeQueryLogItem(item, tree));
+  std::ostringstream expected;
+  pt::write_json(expected, tree, false);
+  EXPECT_EQ(expected.str(), json);
+
+  Row r;
+  r["quote"] = "\"";
+  r["control"] = "\x01\n";
+  r["utf8"] = "\xc3\xa9";
+  item.snapshot_results = {r, Row()};
+
+  json.clear();
+  EXPECT_TRUE(serializeQueryLogItemJSON(item, json));
+  tree.clear();
+  EXPECT_TRUE(serializeQueryLogItem(item, tree));
+  expected.str("");
+  pt::write_json(expected, tree, false);
+  EXPECT_EQ(expected.str(), json);
+
+  std::vector<std::string> events;
+  EXPECT_TRUE(serializeQueryLogItemAsEventsJSON(item, events));
+  tree.clear();
+  EXPECT_TRUE(serializeQueryLogItemAsEvents(item, tree));
+  ASSERT_EQ(tree.size(), events.size());
+  auto event = events.begin();
+  for (const auto& expected_event : tree) {
+    expected.str("");
+    pt::write_json(expected, expected_event.second, false);
+    EXPECT_EQ(expected.str(), *event++);
+  }
+}
+
+TEST_F(ResultsTests, test_snapshot_json_writer) {
+  QueryLogItem item;
+  item.name = "snapshot";
+  item.identifier = "host";
+  item.decorations["key"] = "value";
+
+  // An empty snapshot is a single line.
+  std::vector<std::string> lines;
+  SnapshotJSONWriter empty(item, false);
+  empty.end(lines);
+  std::string expected;
+  EXPECT_TRUE(serializeQueryLogItemJSON(item, expected));
+  ASSERT_EQ(lines.size(), 1U);
+  EXPECT_EQ(lines[0], expected);
+
+  Row r;
+  r["quote"] = "\"";
+  r["number"] = "1";
+  QueryData rows = {r, Row(), r};
+
+  // Rows are written as they are added, matching the whole snapshot.
+  lines.clear();
+  SnapshotJSONWriter writer(item, false);
+  for (const auto& row : rows) {
+    writer.add(row, lines);
+  }
+  EXPECT_TRUE(lines.empty());
+  writer.end(lines);
+
+  QueryLogItem snapshot = item;
+  snapshot.snapshot_results = rows;
+  expected.clear();
+  EXPECT_TRUE(serializeQueryLogItemJSON(snapshot, expected));
+  ASSERT_EQ(lines.size(), 1U);
+  EXPECT_EQ(lines[0], expected);
+
+  // As events each row is a line when it is added.
+  lines.clear();
+  SnapshotJSONWriter events(item, true);
+  events.add(rows[0], lines);
+  EXPECT_EQ(lines.size(), 1U);
+  events.add(rows[1], lines);
+  events.add(rows[2], lines);
+  events.end(lines);
+
+  std::vector<std::string> expected_events;
+  EXPECT_TRUE(serializeQueryLogItemAsEventsJSON(snapshot, expected_events));
+  EXPECT_EQ(lines, expected_events);
+}
+
 TEST_F(ResultsTests, test_deserialize_query_log_item_json) {
   auto results = getSerializedQueryLogItemJSON();
 
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <stdio.h>
+
 #include <map>
 #include <string>
 #include <vector>
@@ -124,4 +126,58 @@ std::string generateHeader(const std::map<std::string, size_t>& lengths,
 std::string generateRow(const Row& r,
                         const std::map<std::string, size_t>& lengths,
                         const std::vector<std::string>& columns);
+
+/**
+ * @brief Print a query's rows as they are generated.
+ *
+ * In JSON mode each row is printed when it is added, within the same array
+ * jsonPrint prints. In pretty mode the first rows are held to size the
+ * columns, later rows are printed when they are added. A later row that
+ * does not fit widens its columns and the header is printed again.
+ */
+class ResultPrinter {
+ public:
+  /**
+   * @param json Print JSON instead of a pretty table.
+   * @param sample The number of rows held to size the columns.
+   * @param out Write the results here.
+   */
+  ResultPrinter(bool json, size_t sample, FILE* out = stdout)
+      : json_(json), sample_(sample), out_(out) {}
+
+  /// Set the column order, before the first row is added.
+  void setColumns(std::vector<std::string> columns);
+
+  /// Check if the column order is set.
+  bool hasColumns() const {
+    return !columns_.empty();
+  }
+
+  /// Add and possibly print a row.
+  void addRow(Row r);
+
+  /// Print the held rows and the end of the results, then reset.
+  void finish();
+
+ private:
+  /// Print the header and the held rows.
+  void start();
+
+ private:
+  bool json_{false};
+  size_t sample_{0};
+  FILE* out_{nullptr};
+
+  std::vector<std::string> columns_;
+  std::map<std::string, size_t> lengths_;
+
+  /// Rows held to size the columns.
+  QueryData rows_;
+
+  /// The number of rows printed.
+  size_t printed_{0};
+
+  /// The header was printed, see start.
+  bool started_{false};
+};
 }
@@ -147,6 +147,96 @@ void jsonPrint(const QueryData& q) {
   printf("\n]\n");
 }
 
+void ResultPrinter::setColumns(std::vector<std::string> columns) {
+  columns_ = std::move(columns);
+}
+
+void ResultPrinter::addRow(Row r) {
+  if (json_) {
+    std::string row_string;
+    if (serializeRowJSON(r, row_string).ok()) {
+      row_string.pop_back();
+      fprintf(out_, (printed_++ == 0) ? "[\n  %s" : ",\n  %s",
+              row_string.c_str());
+    }
+    return;
+  }
+
+  if (!started_) {
+    computeRowLengths(r, lengths_);
+    rows_.push_back(std::move(r));
+    if (rows_.size() >= sample_) {
+      start();
+    }
+    return;
+  }
+
+  // A value wider than its column widens it and repeats the header.
+  bool fits = true;
+  for (const auto& column : r) {
+    auto length = lengths_.find(column.first);
+    if (length == lengths_.end() ||
+        utf8StringSize(column.second) > length->second) {
+      fits = false;
+      break;
+    }
+  }
+
+  if (!fits) {
+    fprintf(out_, "%s", generateToken(lengths_, columns_).c_str());
+    computeRowLengths(r, lengths_);
+    auto separator = generateToken(lengths_, columns_);
+    fprintf(out_,
+            "%s%s%s",
+            separator.c_str(),
+            generateHeader(lengths_, columns_).c_str(),
+            separator.c_str());
+  }
+  fprintf(out_, "%s", generateRow(r, lengths_, columns_).c_str());
+  printed_++;
+}
+
+void ResultPrinter::start() {
+  started_ = true;
+  if (rows_.empty()) {
+    return;
+  }
+
+  // Use the column names as minimum lengths.
+  computeRowLengths(rows_.front(), lengths_, true);
+  auto separator = generateToken(lengths_, columns_);
+  fprintf(out_,
+          "%s%s%s",
+          separator.c_str(),
+          generateHeader(lengths_, columns_).c_str(),
+          separator.c_str());
+  for (const auto& row : rows_) {
+    fprintf(out_, "%s", generateRow(row, lengths_, columns_).c_str());
+  }
+  printed_ += rows_.size();
+  rows_.clear();
+}
+
+void ResultPrinter::finish() {
+  if (json_) {
+    fprintf(out_, "%s\n]\n", (printed_ == 0) ? "[\n" : "");
+  } else {
+    if (!started_) {
+      start();
+    }
+    if (printed_ > 0) {
+      fprintf(out_, "%s", generateToken(lengths_, columns_).c_str());
+    }
+  }
+  fflush(out_);
+
+  columns_.clear();
+  lengths_.clear();
+  rows_.clear();
+  printed_ = 0;
+  started_ = false;
+}
+
 void computeRowLengths(const Row& r,
                        std::map<std::string, size_t>& lengths,
                        bool use_columns) {
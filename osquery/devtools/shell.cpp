@@ -13,8 +13,12 @@
 ** utility for accessing SQLite databases.
 */
 
+#include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <cstdio>
+#include <string>
+#include <vector>
 
 #ifdef WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -38,6 +42,7 @@
 #include <osquery/packs.h>
 
 #include "osquery/core/process.h"
+#include "osquery/core/trace.h"
 #include "osquery/devtools/devtools.h"
 #include "osquery/filesystem/fileops.h"
 #include "osquery/sql/virtual_table.h"
@@ -59,12 +64,25 @@ SHELL_FLAG(bool, line, false, "Set output mode to 'line'");
 SHELL_FLAG(bool, list, false, "Set output mode to 'list'");
 SHELL_FLAG(string, separator, "|", "Set output field separator, default '|'");
 SHELL_FLAG(bool, header, true, "Toggle column headers true/false");
+SHELL_FLAG(uint64,
+           pretty_rows,
+           1000,
+           "Rows used to size the columns before pretty output is printed");
 SHELL_FLAG(string, pack, "", "Run all queries in a pack");
+SHELL_FLAG(int32,
+           benchmark,
+           0,
+           "Run the query a number of times and report its timing");
+SHELL_FLAG(bool,
+           benchmark_warm,
+           false,
+           "Allow table caches between benchmark iterations");
 
 /// Define short-hand shell switches.
 SHELL_FLAG(bool, L, false, "List all table names");
 SHELL_FLAG(string, A, "", "Select all from a table");
 
+DECLARE_bool(disable_caching);
 DECLARE_string(nullvalue);
 DECLARE_string(extensions_socket);
 DECLARE_string(tls_hostname);
@@ -84,6 +102,7 @@ static char zHelp[] =
     "\n"
     ".all [TABLE]     Select all from a table\n"
     ".bail ON|OFF     Stop after hitting an error\n"
+    ".bench N [warm] SQL  Run SQL N times, report timing and table scans\n"
     ".echo ON|OFF     Turn command echo on or off\n"
     ".exit            Exit this program\n"
     ".features        List osquery's features and their statuses\n"
@@ -104,6 +123,8 @@ static char zHelp[] =
     ".show            Show the current values for various settings\n"
     ".summary         Alias for the show meta command\n"
     ".tables [TABLE]  List names of tables\n"
+    ".trace ON|OFF    Record spans of work, see .trace dump\n"
+    ".trace dump PATH Write recorded spans as Chrome trace JSON\n"
     ".width [NUM1]+   Set column widths for \"column\" mode\n";
 
 static char zTimerHelp[] =
@@ -339,15 +360,6 @@ static char* one_input_line(FILE* in, char* zPrior, int isContinuation) {
   return zResult;
 }
 
-/*
-** Pretty print structure
- */
-struct prettyprint_data {
-  osquery::QueryData results;
-  std::vector<std::string> columns;
-  std::map<std::string, size_t> lengths;
-};
-
 /*
 ** An pointer to an instance of this structure is passed from
 ** the main program to the callback.  This is used to communicate
@@ -375,7 +387,7 @@ struct callback_data {
   int iIndent; /* Index of current op in aiIndent[] */
 
   /* Additional attributes to be used in pretty mode */
-  struct prettyprint_data* prettyPrint;
+  osquery::ResultPrinter* prettyPrint;
 };
 
 // Number of elements in an array
@@ -514,10 +526,12 @@ static int shell_callback(
 
   switch (p->mode) {
   case MODE_Pretty: {
-    if (p->prettyPrint->columns.empty()) {
+    if (!p->prettyPrint->hasColumns()) {
+      std::vector<std::string> columns;
       for (i = 0; i < nArg; i++) {
-        p->prettyPrint->columns.push_back(std::string(azCol[i]));
+        columns.push_back(std::string(azCol[i]));
       }
+      p->prettyPrint->setColumns(std::move(columns));
     }
 
     osquery::Row r;
@@ -528,8 +542,7 @@ static int shell_callback(
                                        : std::string(azArg[i]);
       }
     }
-    osquery::computeRowLengths(r, p->prettyPrint->lengths);
-    p->prettyPrint->results.push_back(r);
+    p->prettyPrint->addRow(std::move(r));
     break;
   }
   case MODE_Line: {
@@ -795,6 +808,9 @@ static int shell_exec(
     *pzErrMsg = nullptr;
   }
 
+  // Attach the tables used by the statements before they are prepared.
+  osquery::attachQueryTables(zSql, dbc);
+
   while ((zSql[0] != 0) && (SQLITE_OK == rc)) {
     auto lock(dbc->attachLock());
 
@@ -906,16 +922,7 @@ static int shell_exec(
   dbc->clearAffectedTables();
 
   if ((pArg != nullptr) && pArg->mode == MODE_Pretty) {
-    if (osquery::FLAGS_json) {
-      osquery::jsonPrint(pArg->prettyPrint->results);
-    } else {
-      osquery::prettyPrint(pArg->prettyPrint->results,
-                           pArg->prettyPrint->columns,
-                           pArg->prettyPrint->lengths);
-    }
-    pArg->prettyPrint->results.clear();
-    pArg->prettyPrint->columns.clear();
-    pArg->prettyPrint->lengths.clear();
+    pArg->prettyPrint->finish();
   }
 
   return rc;
@@ -1205,6 +1212,121 @@ inline void meta_show(struct callback_data* p) {
   }
 }
 
+/*
+** Count the rows of a benchmarked statement without printing them.
+*/
+static int bench_callback(
+    void* pArg, int nArg, char** azArg, char** azCol, int* aiType) {
+  auto* p = reinterpret_cast<struct callback_data*>(pArg);
+  p->cnt++;
+  return 0;
+}
+
+/*
+** The nearest-rank percentile of sorted samples.
+*/
+static uint64_t bench_percentile(const std::vector<uint64_t>& samples,
+                                 size_t percent) {
+  auto rank = (samples.size() * percent + 99) / 100;
+  return samples[(rank > 0) ? rank - 1 : 0];
+}
+
+static void bench_print(struct callback_data* p,
+                        const char* name,
+                        std::vector<uint64_t>& samples) {
+  std::sort(samples.begin(), samples.end());
+  fprintf(p->out,
+          "%13.13s: min %llu, median %llu, p99 %llu\n",
+          name,
+          static_cast<unsigned long long>(samples.front()),
+          static_cast<unsigned long long>(bench_percentile(samples, 50)),
+          static_cast<unsigned long long>(bench_percentile(samples, 99)));
+}
+
+/*
+** Run a query a number of times and report its wall and CPU time in
+** microseconds, the rows it returned, and the generates of each table.
+**
+** Cold iterations generate every table. Warm iterations allow the table
+** and scan caches, as scheduled queries do.
+*/
+static int meta_bench(struct callback_data* p,
+                      sqlite3_int64 iterations,
+                      const std::string& query,
+                      bool warm) {
+  if (iterations <= 0 || query.empty()) {
+    fprintf(stderr, "Error: usage .bench N [warm|cold] SQL\n");
+    return 1;
+  }
+
+  auto caching = osquery::FLAGS_disable_caching;
+  osquery::FLAGS_disable_caching = !warm;
+  osquery::SQLiteDBManager::get()->useCache(warm);
+  osquery::clearTableExecutionStats();
+
+  struct callback_data data {};
+  memcpy(&data, p, sizeof(data));
+  std::vector<uint64_t> wall;
+  std::vector<uint64_t> cpu;
+  int rc = 0;
+  for (sqlite3_int64 i = 0; i < iterations && rc == 0; i++) {
+    osquery::ThreadUsage before;
+    osquery::getThreadUsage(before);
+    auto start = std::chrono::steady_clock::now();
+
+    char* error = nullptr;
+    rc = shell_exec(query.c_str(), bench_callback, &data, &error);
+    if (error != nullptr) {
+      fprintf(stderr, "Error: %s\n", error);
+      sqlite3_free(error);
+      rc = (rc == 0) ? 1 : rc;
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    osquery::ThreadUsage after;
+    osquery::getThreadUsage(after);
+    wall.push_back(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+            .count());
+    cpu.push_back(after.user_time + after.system_time - before.user_time -
+                  before.system_time);
+  }
+
+  osquery::SQLiteDBManager::get()->useCache(false);
+  osquery::FLAGS_disable_caching = caching;
+  if (rc != 0) {
+    return rc;
+  }
+
+  fprintf(p->out,
+          "%13.13s: %lld (%s)\n",
+          "iterations",
+          iterations,
+          (warm) ? "warm" : "cold");
+  fprintf(p->out, "%13.13s: %d\n", "rows", data.cnt);
+  bench_print(p, "wall (us)", wall);
+  bench_print(p, "cpu (us)", cpu);
+
+  // The table instrumentation splits the time between the scanned tables.
+  for (const auto& table : osquery::getTableExecutionStats()) {
+    const auto& stats = table.second;
+    auto calls = std::max<uint64_t>(stats.generate_calls, 1);
+    fprintf(p->out,
+            "%13.13s: %llu generates, %llu rows, %llu us/generate",
+            table.first.c_str(),
+            static_cast<unsigned long long>(stats.generate_calls),
+            static_cast<unsigned long long>(stats.rows_generated),
+            static_cast<unsigned long long>(stats.wall_time / calls));
+    for (const auto& shape : stats.shapes) {
+      if (!shape.first.empty()) {
+        fprintf(p->out, ", WHERE %s", shape.first.c_str());
+      }
+    }
+    fprintf(p->out, "\n");
+  }
+  return 0;
+}
+
 /*
 ** If an input line begins with "." then invoke this routine to
 ** process that line.
@@ -1272,6 +1394,19 @@ static int do_meta_command(char* zLine, struct callback_data* p) {
     return rc;
   }
 
+  if (c == 'b' && n >= 3 && strncmp(azArg[0], "bench", n) == 0 && nArg > 2) {
+    int j = 2;
+    bool warm = (strcmp(azArg[j], "warm") == 0);
+    if (warm || strcmp(azArg[j], "cold") == 0) {
+      j++;
+    }
+    std::string query;
+    for (; j < nArg; j++) {
+      query += (query.empty()) ? azArg[j] : std::string(" ") + azArg[j];
+    }
+    return meta_bench(p, integerValue(azArg[1]), query, warm);
+  }
+
   if (c == 's' && strncmp(azArg[0], "socket", n) == 0 && nArg == 1) {
     fprintf(p->out, "%s\n", osquery::FLAGS_extensions_socket.c_str());
     return rc;
@@ -1365,6 +1500,16 @@ static int do_meta_command(char* zLine, struct callback_data* p) {
   } else if (HAS_TIMER && c == 't' && n >= 5 &&
              strncmp(azArg[0], "timer", n) == 0 && nArg == 2) {
     enableTimer = booleanValue(azArg[1]);
+  } else if (c == 't' && n >= 3 && strncmp(azArg[0], "trace", n) == 0 &&
+             nArg == 3 && strcmp(azArg[1], "dump") == 0) {
+    auto status = osquery::dumpTrace(azArg[2]);
+    if (!status.ok()) {
+      fprintf(stderr, "Error: %s\n", status.getMessage().c_str());
+      rc = 1;
+    }
+  } else if (c == 't' && n >= 3 && strncmp(azArg[0], "trace", n) == 0 &&
+             nArg == 2) {
+    osquery::setTraceEnabled(booleanValue(azArg[1]) != 0);
   } else if (c == 'v' && strncmp(azArg[0], "version", n) == 0) {
     meta_version(p);
   } else if (c == 'w' && strncmp(azArg[0], "width", n) == 0 && nArg > 1) {
@@ -1583,7 +1728,8 @@ static int process_input(struct callback_data* p, FILE* in) {
 */
 static void main_init(struct callback_data* data) {
   memset(data, 0, sizeof(struct callback_data));
-  data->prettyPrint = new struct prettyprint_data();
+  data->prettyPrint = new osquery::ResultPrinter(osquery::FLAGS_json,
+                                                 osquery::FLAGS_pretty_rows);
   data->mode = MODE_Pretty;
   data->showHeader = 1;
   data->separator[0] = '|';
@@ -1704,6 +1850,9 @@ int launchIntoShell(int argc, char** argv) {
     delete[] cmd;
   } else if (!FLAGS_pack.empty()) {
     rc = runPack(&data);
+  } else if (FLAGS_benchmark > 0 && argc > 1 && argv[1] != nullptr) {
+    // Benchmark a statement from CLI, see .bench
+    rc = meta_bench(&data, FLAGS_benchmark, argv[1], FLAGS_benchmark_warm);
   } else if (argc > 1 && argv[1] != nullptr) {
     // Run a command or statement from CLI
     char* query = argv[1];
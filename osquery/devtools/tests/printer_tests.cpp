@@ -95,6 +95,98 @@ TEST_F(PrinterTests, test_generate_row) {
   EXPECT_EQ(results, expected);
 }
 
+/// Read everything written to a temporary file.
+static std::string readPrinted(FILE* out) {
+  std::string printed;
+  rewind(out);
+  char buffer[256];
+  size_t size = 0;
+  while ((size = fread(buffer, 1, sizeof(buffer), out)) > 0) {
+    printed.append(buffer, size);
+  }
+  fclose(out);
+  return printed;
+}
+
+TEST_F(PrinterTests, test_result_printer) {
+  // Rows within the sample are printed as a single table.
+  auto* out = tmpfile();
+  ASSERT_NE(out, nullptr);
+  ResultPrinter printer(false, 10, out);
+  printer.setColumns(order);
+  for (const auto& row : q) {
+    printer.addRow(row);
+  }
+  printer.finish();
+
+  std::map<std::string, size_t> lengths;
+  for (const auto& row : q) {
+    computeRowLengths(row, lengths);
+  }
+  computeRowLengths(q.front(), lengths, true);
+  auto separator = generateToken(lengths, order);
+  auto expected = separator + generateHeader(lengths, order) + separator;
+  for (const auto& row : q) {
+    expected += generateRow(row, lengths, order);
+  }
+  expected += separator;
+  EXPECT_EQ(readPrinted(out), expected);
+
+  // Rows wider than the sampled rows repeat the header with wider columns.
+  out = tmpfile();
+  ASSERT_NE(out, nullptr);
+  ResultPrinter streaming(false, 1, out);
+  streaming.setColumns(order);
+  for (const auto& row : q) {
+    streaming.addRow(row);
+  }
+  streaming.finish();
+
+  auto printed = readPrinted(out);
+  auto last = generateHeader(lengths, order) + separator +
+              generateRow(q.back(), lengths, order) + separator;
+  ASSERT_GT(printed.size(), last.size());
+  EXPECT_EQ(printed.substr(printed.size() - last.size()), last);
+
+  size_t headers = 0;
+  for (auto pos = printed.find("| name "); pos != std::string::npos;
+       pos = printed.find("| name ", pos + 1)) {
+    headers++;
+  }
+  EXPECT_EQ(headers, 3U);
+
+  // Nothing is printed without rows.
+  out = tmpfile();
+  ASSERT_NE(out, nullptr);
+  ResultPrinter empty(false, 10, out);
+  empty.finish();
+  EXPECT_TRUE(readPrinted(out).empty());
+}
+
+TEST_F(PrinterTests, test_result_printer_json) {
+  auto* out = tmpfile();
+  ASSERT_NE(out, nullptr);
+  ResultPrinter printer(true, 0, out);
+  printer.setColumns(order);
+  printer.addRow(q[0]);
+  printer.addRow(q[1]);
+  printer.finish();
+
+  std::string first;
+  std::string second;
+  serializeRowJSON(q[0], first);
+  serializeRowJSON(q[1], second);
+  first.pop_back();
+  second.pop_back();
+  EXPECT_EQ(readPrinted(out), "[\n  " + first + ",\n  " + second + "\n]\n");
+
+  out = tmpfile();
+  ASSERT_NE(out, nullptr);
+  ResultPrinter empty(true, 0, out);
+  empty.finish();
+  EXPECT_EQ(readPrinted(out), "[\n\n]\n");
+}
+
 TEST_F(PrinterTests, test_unicode) {
   Row r = {{"name", "Àlex Smith"}};
   std::map<std::string, size_t> lengths;
@@ -8,6 +8,8 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+
 #include <osquery/dispatcher.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
@@ -20,6 +22,11 @@ namespace osquery {
 /// The worker_threads define the default thread pool size.
 FLAG(int32, worker_threads, 4, "Number of work dispatch threads");
 
+FLAG(int32,
+     service_threads,
+     2,
+     "Threads shared by periodic services, 0 for a thread per service");
+
 /// Cancel the pause request.
 void RunnerInterruptPoint::cancel() {
   std::unique_lock<std::mutex> lock(mutex_);
@@ -45,6 +52,11 @@ void InterruptableRunnable::interrupt() {
   stop();
   // Cancel the run loop's pause request.
   point_.cancel();
+
+  // A periodic service is removed by its next tick.
+  if (dynamic_cast<PeriodicRunnable*>(this) != nullptr) {
+    Dispatcher::wakePeriodic(this);
+  }
 }
 
 bool InterruptableRunnable::interrupted() {
@@ -73,6 +85,21 @@ void InternalRunnable::run() {
   Dispatcher::removeService(this);
 }
 
+void PeriodicRunnable::start() {
+  while (!interrupted()) {
+    tick();
+    pauseMilli(period());
+  }
+}
+
+bool PeriodicRunnable::tickOnce() {
+  if (interrupted()) {
+    return false;
+  }
+  tick();
+  return true;
+}
+
 Status Dispatcher::addService(InternalRunnableRef service) {
   if (service->hasRun()) {
     return Status(1, "Cannot schedule a service twice");
@@ -85,6 +112,28 @@ Status Dispatcher::addService(InternalRunnableRef service) {
     return Status(1, "Cannot add service, dispatcher is stopping");
   }
 
+  auto periodic = std::dynamic_pointer_cast<PeriodicRunnable>(service);
+  if (periodic != nullptr && FLAGS_service_threads > 0) {
+    // The service is ticked by the executor threads, starting a thread if
+    // there are fewer than services.
+    service->run_ = true;
+    WriteLock lock(self.mutex_);
+    DLOG(INFO) << "Adding new periodic service: " << service->name() << " ("
+               << service.get() << ") in process " << platformGetPid();
+    self.services_.push_back(std::move(service));
+
+    std::lock_guard<std::mutex> periodic_lock(self.periodic_mutex_);
+    self.periodic_.push_back({periodic, std::chrono::steady_clock::now()});
+    auto threads = static_cast<size_t>(FLAGS_service_threads);
+    if (self.periodic_threads_ < std::min(threads, self.periodic_.size())) {
+      self.periodic_threads_++;
+      self.service_threads_.push_back(
+          std::make_shared<std::thread>(&Dispatcher::runPeriodic));
+    }
+    self.periodic_condition_.notify_one();
+    return Status(0, "OK");
+  }
+
   auto thread = std::make_shared<std::thread>(
       std::bind(&InternalRunnable::run, &*service));
   WriteLock lock(self.mutex_);
@@ -111,6 +160,70 @@ void Dispatcher::removeService(const InternalRunnable* service) {
       self.services_.end());
 }
 
+void Dispatcher::runPeriodic() {
+  auto& self = instance();
+  std::unique_lock<std::mutex> lock(self.periodic_mutex_);
+  while (!self.periodic_.empty()) {
+    // Find the idle service with the earliest deadline.
+    auto next = self.periodic_.end();
+    for (auto it = self.periodic_.begin(); it != self.periodic_.end(); ++it) {
+      if (!it->ticking &&
+          (next == self.periodic_.end() || it->deadline < next->deadline)) {
+        next = it;
+      }
+    }
+
+    if (next == self.periodic_.end()) {
+      self.periodic_condition_.wait(lock);
+      continue;
+    } else if (next->deadline > std::chrono::steady_clock::now()) {
+      self.periodic_condition_.wait_until(lock, next->deadline);
+      continue;
+    }
+
+    auto service = next->service;
+    next->ticking = true;
+    lock.unlock();
+    auto active = service->tickOnce();
+    auto deadline = std::chrono::steady_clock::now();
+    if (active) {
+      deadline += service->period();
+    } else {
+      // The service is complete.
+      removeService(service.get());
+    }
+    lock.lock();
+
+    auto it = std::find_if(self.periodic_.begin(),
+                           self.periodic_.end(),
+                           [&service](const PeriodicService& target) {
+                             return target.service == service;
+                           });
+    if (!active) {
+      self.periodic_.erase(it);
+      self.periodic_condition_.notify_all();
+    } else {
+      // An interruption during the tick keeps the next tick due.
+      if (it->deadline != std::chrono::steady_clock::time_point::min()) {
+        it->deadline = deadline;
+      }
+      it->ticking = false;
+    }
+  }
+  self.periodic_threads_--;
+}
+
+void Dispatcher::wakePeriodic(const InterruptableRunnable* service) {
+  auto& self = instance();
+  std::lock_guard<std::mutex> lock(self.periodic_mutex_);
+  for (auto& periodic : self.periodic_) {
+    if (periodic.service.get() == service) {
+      periodic.deadline = std::chrono::steady_clock::time_point::min();
+    }
+  }
+  self.periodic_condition_.notify_all();
+}
+
 inline static void assureRun(const InternalRunnableRef& service) {
   while (true) {
     // Wait for each thread's entry point (start) meaning the thread context
@@ -8,11 +8,14 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <chrono>
+
 #include <osquery/database.h>
 #include <osquery/distributed.h>
 #include <osquery/flags.h>
 #include <osquery/system.h>
 
+#include "osquery/carver/carver.h"
 #include "osquery/core/conversions.h"
 #include "osquery/dispatcher/distributed.h"
 
@@ -23,36 +26,78 @@ FLAG(uint64,
      60,
      "Seconds between polling for new queries (default 60)")
 
+FLAG(uint64,
+     distributed_long_poll,
+     0,
+     "Seconds the server may hold a read until queries are available");
+
 DECLARE_bool(disable_distributed);
 DECLARE_string(distributed_plugin);
 
 const size_t kDistributedAccelerationInterval = 5;
 
+/// Failed reads back off up to this multiple of the read interval.
+const size_t kDistributedBackoffFactor = 8;
+
 void DistributedRunner::start() {
   auto dist = Distributed();
+  size_t backoff = 0;
   while (!interrupted()) {
-    dist.pullUpdates();
-    if (dist.getPendingQueryCount() > 0) {
+    auto start = std::chrono::steady_clock::now();
+    auto status = dist.pullUpdates();
+    auto held = std::chrono::steady_clock::now() - start;
+    bool delivered = (dist.getPendingQueryCount() > 0);
+    if (delivered) {
       dist.runQueries();
     }
 
+    // A long-poll read is repeated as soon as it returns, unless it failed or
+    // the server answered early without queries and does not support holding.
+    auto wait = std::chrono::seconds(FLAGS_distributed_long_poll);
+    if (wait.count() > 0 && status.ok() && (delivered || held * 2 >= wait)) {
+      continue;
+    }
+
+    // The server may advertise the interval between reads.
+    size_t interval = FLAGS_distributed_interval;
+    std::string advertised;
+    getDatabaseValue(kPersistentSettings, "distributed_interval", advertised);
+    unsigned long advertised_interval = 0;
+    if (safeStrtoul(advertised, 10, advertised_interval).ok() &&
+        advertised_interval > 0) {
+      interval = advertised_interval;
+    }
+
     std::string str_acu = "0";
     Status database = getDatabaseValue(
         kPersistentSettings, "distributed_accelerate_checkins_expire", str_acu);
     unsigned long accelerate_checkins_expire;
     Status conversion = safeStrtoul(str_acu, 10, accelerate_checkins_expire);
-    if (!database.ok() || !conversion.ok() ||
-        getUnixTime() > accelerate_checkins_expire) {
-      pauseMilli(FLAGS_distributed_interval * 1000);
+    size_t delay = interval * 1000;
+    if (database.ok() && conversion.ok() &&
+        getUnixTime() <= accelerate_checkins_expire) {
+      delay = kDistributedAccelerationInterval * 1000;
+    }
+
+    // Failed reads back off with jitter, hosts return to a recovered server
+    // spread over time rather than together.
+    if (status.ok()) {
+      backoff = 0;
     } else {
-      pauseMilli(kDistributedAccelerationInterval * 1000);
+      backoff = getBackoffDelay(
+          delay, backoff, interval * 1000 * kDistributedBackoffFactor);
+      delay = backoff;
     }
+    pauseMilli(delay);
   }
 }
 
 Status startDistributed() {
   if (!FLAGS_disable_distributed) {
     Dispatcher::addService(std::make_shared<DistributedRunner>());
+
+    // Carves are requested by distributed queries, continue their uploads.
+    resumeCarves();
     return Status(0, "OK");
   } else {
     return Status(1, "Distributed query service not enabled.");
@@ -0,0 +1,112 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <osquery/database.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/sql.h>
+#include <osquery/system.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/process.h"
+#include "osquery/core/watcher.h"
+#include "osquery/dispatcher/maintenance.h"
+#include "osquery/dispatcher/scheduler.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     database_maintenance_interval,
+     3600,
+     "Seconds between idle database compactions, 0 to disable");
+
+FLAG(uint64,
+     database_maintenance_idle,
+     30,
+     "Seconds without executing scheduled queries before maintenance");
+
+DECLARE_bool(disable_database);
+
+/// Seconds between checks for a quiet period.
+const size_t kMaintenanceCheckInterval = 10;
+
+bool DatabaseMaintenanceRunner::isQuiet() {
+  if (getScheduleIdleTime() < FLAGS_database_maintenance_idle) {
+    return false;
+  }
+
+  auto now = getUnixTime();
+  auto pid = std::to_string(PlatformProcess::getCurrentProcess()->pid());
+  auto rows = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
+  if (rows.empty() || now <= sample_time_) {
+    return false;
+  }
+
+  long long user_time = 0;
+  long long system_time = 0;
+  safeStrtoll(rows[0]["user_time"], 10, user_time);
+  safeStrtoll(rows[0]["system_time"], 10, system_time);
+
+  // Require half of the watchdog utilization limit as headroom.
+  bool quiet = false;
+  if (sample_time_ > 0) {
+    auto limit = getWorkerLimit(WatchdogLimitType::UTILIZATION_LIMIT) / 2;
+    auto elapsed = now - sample_time_;
+    auto user = (static_cast<size_t>(user_time) - user_time_) / elapsed;
+    auto system = (static_cast<size_t>(system_time) - system_time_) / elapsed;
+    quiet = (user <= limit && system <= limit);
+  }
+
+  user_time_ = static_cast<size_t>(user_time);
+  system_time_ = static_cast<size_t>(system_time);
+  sample_time_ = now;
+  return quiet;
+}
+
+void DatabaseMaintenanceRunner::tick() {
+  if (maintained_ == 0) {
+    // The interval starts when the service is added.
+    maintained_ = getUnixTime();
+    return;
+  }
+
+  if (getUnixTime() < maintained_ + FLAGS_database_maintenance_interval) {
+    return;
+  }
+
+  // Domains are compacted one at a time, resuming after a busy period.
+  while (domain_ < kDomains.size() && !interrupted() && isQuiet()) {
+    const auto& domain = kDomains[domain_++];
+    auto status = compactDatabase(domain);
+    if (!status.ok()) {
+      VLOG(1) << "Cannot compact database domain " << domain << ": "
+              << status.getMessage();
+    }
+  }
+
+  if (domain_ == kDomains.size()) {
+    domain_ = 0;
+    maintained_ = getUnixTime();
+  }
+}
+
+std::chrono::milliseconds DatabaseMaintenanceRunner::period() {
+  return std::chrono::seconds(kMaintenanceCheckInterval);
+}
+
+Status startDatabaseMaintenance() {
+  if (FLAGS_disable_database || FLAGS_database_maintenance_interval == 0) {
+    return Status(1, "Database maintenance not enabled.");
+  }
+
+  Dispatcher::addService(std::make_shared<DatabaseMaintenanceRunner>());
+  return Status(0, "OK");
+}
+}
@@ -0,0 +1,59 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <osquery/dispatcher.h>
+
+namespace osquery {
+
+/**
+ * @brief A periodic Dispatcher service that compacts the database while idle.
+ *
+ * Expired events, buffered logs, and query results are removed in ranges,
+ * their space is reclaimed when compaction rewrites the table files. Each
+ * --database_maintenance_interval the domains are flushed and compacted one
+ * at a time, only while the schedule and the process CPU are quiet.
+ */
+class DatabaseMaintenanceRunner : public PeriodicRunnable {
+ public:
+  virtual ~DatabaseMaintenanceRunner() {}
+  DatabaseMaintenanceRunner()
+      : PeriodicRunnable("DatabaseMaintenanceRunner") {}
+
+ protected:
+  /// Compact the domains if the maintenance interval elapsed.
+  void tick() override;
+
+  /// The pause between checks for a quiet period.
+  std::chrono::milliseconds period() override;
+
+ protected:
+  /// Check the schedule is idle and the process CPU has headroom.
+  bool isQuiet();
+
+ protected:
+  /// The index of the next domain to compact, in kDomains.
+  size_t domain_{0};
+
+  /// The time the last maintenance completed.
+  size_t maintained_{0};
+
+  /// The process user and system time at the last quiet check.
+  size_t user_time_{0};
+  size_t system_time_{0};
+
+  /// The time of the last quiet check.
+  size_t sample_time_{0};
+};
+
+/// Start idle-time database maintenance, see --database_maintenance_interval.
+Status startDatabaseMaintenance();
+}
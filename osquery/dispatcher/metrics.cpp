@@ -0,0 +1,329 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/config.h>
+#include <osquery/database.h>
+#include <osquery/events.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/cgroup.h"
+#include "osquery/core/memory.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/watcher.h"
+#include "osquery/dispatcher/metrics.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+FLAG(string,
+     metrics_path,
+     "",
+     "Write Prometheus text metrics to this path for a textfile collector");
+
+FLAG(uint64, metrics_interval, 15, "Seconds between writes of metrics_path");
+
+/// Quantile labels and the percentiles reported for them.
+const std::vector<std::pair<std::string, double>> kMetricQuantiles = {
+    {"0.5", 50}, {"0.95", 95}, {"0.99", 99},
+};
+
+/// Add the tail of each scheduled query's executions.
+static void genScheduleMetrics(MetricsText& text) {
+  struct QueryMetrics {
+    std::string name;
+    QueryPerformance perf;
+  };
+
+  // Copy the names first, the performance is read under its own lock.
+  std::vector<QueryMetrics> queries;
+  Config::get().scheduledQueries(
+      [&queries](const std::string& name, const ScheduledQuery&) {
+        QueryMetrics metrics;
+        metrics.name = name;
+        queries.push_back(std::move(metrics));
+      });
+  for (auto& query : queries) {
+    Config::get().getPerformanceStats(
+        query.name,
+        [&query](const QueryPerformance& perf) { query.perf = perf; });
+  }
+
+  text.family("osquery_schedule_executions_total",
+              "counter",
+              "Executions of each scheduled query");
+  for (const auto& query : queries) {
+    text.sample("osquery_schedule_executions_total",
+                {{"query", query.name}},
+                query.perf.executions);
+  }
+
+  text.family("osquery_schedule_lateness_seconds_total",
+              "counter",
+              "Seconds executions started after their scheduled time");
+  for (const auto& query : queries) {
+    text.sample("osquery_schedule_lateness_seconds_total",
+                {{"query", query.name}},
+                query.perf.lateness);
+  }
+
+  text.family("osquery_schedule_missed_total",
+              "counter",
+              "Scheduled executions coalesced into a later execution");
+  for (const auto& query : queries) {
+    text.sample("osquery_schedule_missed_total",
+                {{"query", query.name}},
+                query.perf.missed);
+  }
+
+  // The percentiles of each histogram, as reported by osquery_schedule.
+  auto quantiles = [&text, &queries](
+      const std::string& name,
+      const std::string& help,
+      const PerformanceHistogram QueryPerformance::*histogram) {
+    text.family(name, "gauge", help);
+    for (const auto& query : queries) {
+      const auto& h = query.perf.*histogram;
+      for (const auto& q : kMetricQuantiles) {
+        text.sample(name,
+                    {{"query", query.name}, {"quantile", q.first}},
+                    h.percentile(q.second));
+      }
+      text.sample(name, {{"query", query.name}, {"quantile", "1"}}, h.max);
+    }
+  };
+  quantiles("osquery_schedule_wall_time_milliseconds",
+            "Wall time of scheduled query executions",
+            &QueryPerformance::wall_time_histogram);
+  quantiles("osquery_schedule_cpu_time_milliseconds",
+            "Thread CPU time of scheduled query executions",
+            &QueryPerformance::cpu_time_histogram);
+  quantiles("osquery_schedule_lateness_seconds",
+            "Seconds scheduled query executions started late",
+            &QueryPerformance::lateness_histogram);
+  quantiles("osquery_schedule_sqlite_memory_bytes",
+            "SQLite heap bytes allocated by scheduled query executions",
+            &QueryPerformance::sqlite_memory_histogram);
+}
+
+/// Add the counts of each event publisher and subscriber.
+static void genEventMetrics(MetricsText& text) {
+  auto publishers = EventFactory::publisherTypes();
+  text.family("osquery_event_publisher_events_total",
+              "counter",
+              "Events fired by each publisher");
+  for (const auto& type : publishers) {
+    auto publisher = EventFactory::getEventPublisher(type);
+    if (publisher != nullptr) {
+      text.sample("osquery_event_publisher_events_total",
+                  {{"publisher", type}},
+                  publisher->numEvents());
+    }
+  }
+
+  text.family("osquery_event_publisher_dropped_total",
+              "counter",
+              "Events dropped by each publisher");
+  for (const auto& type : publishers) {
+    auto publisher = EventFactory::getEventPublisher(type);
+    if (publisher != nullptr) {
+      text.sample("osquery_event_publisher_dropped_total",
+                  {{"publisher", type}},
+                  publisher->droppedCount());
+    }
+  }
+
+  auto subscribers = EventFactory::subscriberNames();
+  text.family("osquery_event_subscriber_events_total",
+              "counter",
+              "Events received by each subscriber");
+  for (const auto& name : subscribers) {
+    auto subscriber = EventFactory::getEventSubscriber(name);
+    if (subscriber != nullptr) {
+      text.sample("osquery_event_subscriber_events_total",
+                  {{"subscriber", name}},
+                  subscriber->numEvents());
+    }
+  }
+
+  text.family("osquery_event_subscriber_dropped_total",
+              "counter",
+              "Events dropped from each subscriber's queue");
+  for (const auto& name : subscribers) {
+    auto subscriber = EventFactory::getEventSubscriber(name);
+    if (subscriber != nullptr) {
+      text.sample("osquery_event_subscriber_dropped_total",
+                  {{"subscriber", name}},
+                  subscriber->droppedCount());
+    }
+  }
+
+  text.family("osquery_event_subscriber_queued",
+              "gauge",
+              "Events waiting in each subscriber's queue");
+  for (const auto& name : subscribers) {
+    auto subscriber = EventFactory::getEventSubscriber(name);
+    if (subscriber != nullptr) {
+      text.sample("osquery_event_subscriber_queued",
+                  {{"subscriber", name}},
+                  subscriber->queuedCount());
+    }
+  }
+}
+
+/// Add the sizes of each backing store domain.
+static void genDatabaseMetrics(MetricsText& text) {
+  std::vector<DatabaseDomainStats> stats;
+  if (!getDatabaseStats(stats).ok()) {
+    return;
+  }
+
+  text.family("osquery_database_keys", "gauge", "Estimated keys by domain");
+  for (const auto& domain : stats) {
+    text.sample(
+        "osquery_database_keys", {{"domain", domain.domain}}, domain.keys);
+  }
+
+  text.family("osquery_database_disk_bytes",
+              "gauge",
+              "Size of persisted table files by domain");
+  for (const auto& domain : stats) {
+    text.sample("osquery_database_disk_bytes",
+                {{"domain", domain.domain}},
+                domain.disk_bytes);
+  }
+
+  text.family("osquery_database_memory_bytes",
+              "gauge",
+              "Size of unpersisted writes by domain");
+  for (const auto& domain : stats) {
+    text.sample("osquery_database_memory_bytes",
+                {{"domain", domain.domain}},
+                domain.memory_bytes);
+  }
+
+  text.family("osquery_database_pending_compaction_bytes",
+              "gauge",
+              "Estimated bytes compaction will rewrite by domain");
+  for (const auto& domain : stats) {
+    text.sample("osquery_database_pending_compaction_bytes",
+                {{"domain", domain.domain}},
+                domain.pending_compaction_bytes);
+  }
+}
+
+/// Add the buffered logger lines and the pressure deferring queries.
+static void genPressureMetrics(MetricsText& text) {
+  text.family("osquery_logger_buffered_lines",
+              "gauge",
+              "Lines each buffering logger has not yet sent");
+  for (const auto& logger : getLoggerBuffered()) {
+    text.sample("osquery_logger_buffered_lines",
+                {{"logger", logger.first}},
+                logger.second);
+  }
+
+  text.family("osquery_logger_backpressure",
+              "gauge",
+              "Priority classes deferred by logger backpressure");
+  text.sample("osquery_logger_backpressure", getLoggerBackpressure());
+
+  text.family("osquery_resource_pressure",
+              "gauge",
+              "Priority classes deferred by cgroup stall pressure");
+  text.sample("osquery_resource_pressure", getResourcePressure());
+
+  text.family("osquery_watchdog_memory_limit_megabytes",
+              "gauge",
+              "The worker's watchdog memory limit");
+  text.sample("osquery_watchdog_memory_limit_megabytes",
+              getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT));
+
+  text.family("osquery_watchdog_utilization_limit",
+              "gauge",
+              "The worker's watchdog CPU utilization limit");
+  text.sample("osquery_watchdog_utilization_limit",
+              getWorkerLimit(WatchdogLimitType::UTILIZATION_LIMIT));
+
+  if (!isMemoryTagging()) {
+    return;
+  }
+
+  auto tags = getMemoryTagStats();
+  text.family("osquery_memory_live_bytes",
+              "gauge",
+              "Bytes allocated by a subsystem and not yet freed");
+  for (const auto& tag : tags) {
+    text.sample(
+        "osquery_memory_live_bytes", {{"tag", tag.tag}}, tag.live_bytes);
+  }
+
+  text.family("osquery_memory_peak_bytes",
+              "gauge",
+              "The most live bytes allocated by a subsystem");
+  for (const auto& tag : tags) {
+    text.sample(
+        "osquery_memory_peak_bytes", {{"tag", tag.tag}}, tag.peak_bytes);
+  }
+}
+
+std::string genMetrics() {
+  MetricsText text;
+  for (const auto& metric : getMetrics()) {
+    text.add(*metric);
+  }
+  for (const auto& histogram : getMetricHistograms()) {
+    text.add(*histogram);
+  }
+
+  genScheduleMetrics(text);
+  genEventMetrics(text);
+  genDatabaseMetrics(text);
+  genPressureMetrics(text);
+  return text.str();
+}
+
+Status writeMetrics(const std::string& path) {
+  // Collectors may read at any time, the file is replaced once written.
+  auto temp = path + ".tmp";
+  auto status = writeTextFile(temp, genMetrics(), 0644, true);
+  if (!status.ok()) {
+    return status;
+  }
+
+  boost::system::error_code ec;
+  fs::rename(temp, path, ec);
+  if (ec) {
+    return Status(1, "Cannot replace " + path + ": " + ec.message());
+  }
+  return Status(0, "OK");
+}
+
+void MetricsRunner::tick() {
+  auto status = writeMetrics(FLAGS_metrics_path);
+  if (!status.ok()) {
+    VLOG(1) << "Cannot write metrics: " << status.getMessage();
+  }
+}
+
+std::chrono::milliseconds MetricsRunner::period() {
+  return std::chrono::seconds(std::max<uint64_t>(FLAGS_metrics_interval, 1));
+}
+
+void startMetrics() {
+  if (!FLAGS_metrics_path.empty()) {
+    Dispatcher::addService(std::make_shared<MetricsRunner>());
+  }
+}
+} // namespace osquery
@@ -0,0 +1,46 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <osquery/dispatcher.h>
+
+namespace osquery {
+
+/**
+ * @brief Generate the daemon's metrics in the Prometheus text format.
+ *
+ * This includes every registered Metric and MetricHistogram, the timing and
+ * lateness of each scheduled query, event publisher and subscriber counts,
+ * backing store domain sizes, buffered logger lines, and watchdog limits.
+ */
+std::string genMetrics();
+
+/// Write the metrics to a path, replacing the file atomically.
+Status writeMetrics(const std::string& path);
+
+/// Writes --metrics_path every --metrics_interval seconds.
+class MetricsRunner : public PeriodicRunnable {
+ public:
+  MetricsRunner() : PeriodicRunnable("MetricsRunner") {}
+
+ protected:
+  /// Write the metrics.
+  void tick() override;
+
+  /// The --metrics_interval.
+  std::chrono::milliseconds period() override;
+};
+
+/// Start the metrics runner, if --metrics_path is set.
+void startMetrics();
+} // namespace osquery
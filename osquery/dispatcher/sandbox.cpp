@@ -0,0 +1,419 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+#include <chrono>
+
+#include <osquery/database.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/registry.h>
+#include <osquery/sql.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/dispatcher/sandbox.h"
+#include "osquery/sql/sqlite_util.h"
+
+#ifndef WIN32
+extern char** environ;
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace osquery {
+
+FLAG(uint64,
+     sandbox_workers,
+     0,
+     "Number of processes executing scheduled queries with the sandbox option");
+
+FLAG(uint64,
+     sandbox_memory_limit,
+     500,
+     "Megabytes of memory each query sandbox may allocate");
+
+FLAG(uint64,
+     sandbox_cpu_limit,
+     60,
+     "Seconds of CPU time a sandboxed query may use");
+
+FLAG(uint64,
+     sandbox_timeout,
+     300,
+     "Seconds before a sandboxed query is stopped");
+
+/// Each message and field is prefixed with its size.
+using SandboxSize = uint32_t;
+
+/// The largest message accepted from a socket.
+const SandboxSize kSandboxMaxMessage = 1U << 30;
+
+using SandboxClock = std::chrono::steady_clock;
+
+static void appendSandboxField(std::string& message, const std::string& value) {
+  auto size = static_cast<SandboxSize>(value.size());
+  message.append(reinterpret_cast<const char*>(&size), sizeof(size));
+  message.append(value);
+}
+
+static bool readSandboxField(const std::string& message,
+                             size_t& offset,
+                             std::string& value) {
+  SandboxSize size = 0;
+  if (message.size() - offset < sizeof(size)) {
+    return false;
+  }
+  memcpy(&size, message.data() + offset, sizeof(size));
+  offset += sizeof(size);
+  if (message.size() - offset < size) {
+    return false;
+  }
+  value = message.substr(offset, size);
+  offset += size;
+  return true;
+}
+
+std::string serializeSandboxResult(const SandboxResult& result) {
+  std::string rows;
+  serializeQueryDataJSON(result.rows, rows);
+
+  std::string message;
+  appendSandboxField(message, std::to_string(result.status.getCode()));
+  appendSandboxField(message, result.status.getMessage());
+  appendSandboxField(message, std::to_string(result.user_time));
+  appendSandboxField(message, std::to_string(result.system_time));
+  appendSandboxField(message, rows);
+  return message;
+}
+
+bool deserializeSandboxResult(const std::string& message,
+                              SandboxResult& result) {
+  std::vector<std::string> fields(5);
+  size_t offset = 0;
+  for (auto& field : fields) {
+    if (!readSandboxField(message, offset, field)) {
+      return false;
+    }
+  }
+
+  long int code = 0;
+  unsigned long long int user_time = 0;
+  unsigned long long int system_time = 0;
+  if (offset != message.size() || !safeStrtol(fields[0], 10, code) ||
+      !safeStrtoull(fields[2], 10, user_time) ||
+      !safeStrtoull(fields[3], 10, system_time)) {
+    return false;
+  }
+
+  result.rows.clear();
+  if (!deserializeQueryDataJSON(fields[4], result.rows).ok()) {
+    return false;
+  }
+  result.status = Status(static_cast<int>(code), fields[1]);
+  result.user_time = user_time;
+  result.system_time = system_time;
+  return true;
+}
+
+#ifndef WIN32
+static bool sendSandboxMessage(int fd, const std::string& message) {
+  std::string frame;
+  appendSandboxField(frame, message);
+
+  size_t sent = 0;
+  while (sent < frame.size()) {
+    auto size =
+        ::send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+    if (size < 0 && errno == EINTR) {
+      continue;
+    } else if (size <= 0) {
+      return false;
+    }
+    sent += static_cast<size_t>(size);
+  }
+  return true;
+}
+
+/// Receive bytes until the deadline, time_point::max waits forever.
+static bool receiveSandboxBytes(int fd,
+                                char* data,
+                                size_t size,
+                                SandboxClock::time_point deadline) {
+  size_t received = 0;
+  while (received < size) {
+    if (deadline != SandboxClock::time_point::max()) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - SandboxClock::now());
+      if (remaining.count() <= 0) {
+        return false;
+      }
+
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      auto ready = ::poll(&pfd, 1, static_cast<int>(remaining.count()));
+      if (ready < 0 && errno == EINTR) {
+        continue;
+      } else if (ready <= 0) {
+        return false;
+      }
+    }
+
+    auto count = ::recv(fd, data + received, size - received, 0);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    } else if (count <= 0) {
+      return false;
+    }
+    received += static_cast<size_t>(count);
+  }
+  return true;
+}
+
+static bool receiveSandboxMessage(int fd,
+                                  std::string& message,
+                                  SandboxClock::time_point deadline) {
+  SandboxSize size = 0;
+  if (!receiveSandboxBytes(
+          fd, reinterpret_cast<char*>(&size), sizeof(size), deadline) ||
+      size > kSandboxMaxMessage) {
+    return false;
+  }
+
+  message.assign(size, '\0');
+  return size == 0 || receiveSandboxBytes(fd, &message[0], size, deadline);
+}
+#endif
+
+void SandboxPool::setArguments(int argc, char* argv[]) {
+  arguments_.clear();
+  for (int i = 0; i < argc; i++) {
+    arguments_.push_back(argv[i]);
+  }
+}
+
+void SandboxPool::start() {
+  if (FLAGS_sandbox_workers == 0 || arguments_.empty()) {
+    return;
+  }
+
+  // A sandbox executes the same binary as the worker.
+  auto qd = SQL::selectAllFrom(
+      "processes", "pid", EQUALS, INTEGER(platformGetPid()));
+  if (qd.size() != 1 || qd[0]["path"].empty()) {
+    LOG(WARNING) << "Cannot determine the process path for query sandboxes";
+    return;
+  }
+  path_ = qd[0]["path"];
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (size_ < FLAGS_sandbox_workers) {
+    Sandbox sandbox;
+    auto status = launch(sandbox);
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot launch a query sandbox: " << status.getMessage();
+      break;
+    }
+    idle_.push_back(sandbox);
+    size_++;
+  }
+}
+
+bool SandboxPool::enabled() const {
+  return FLAGS_sandbox_workers > 0 && !path_.empty();
+}
+
+Status SandboxPool::run(const std::string& query, SandboxResult& result) {
+  Sandbox sandbox;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this]() {
+      return !idle_.empty() || size_ < FLAGS_sandbox_workers;
+    });
+    if (!idle_.empty()) {
+      sandbox = idle_.back();
+      idle_.pop_back();
+    } else {
+      // Replace a sandbox that stopped.
+      size_++;
+    }
+  }
+
+  Status status;
+  if (sandbox.process == nullptr) {
+    status = launch(sandbox);
+  }
+
+#ifndef WIN32
+  if (status.ok()) {
+    auto deadline =
+        SandboxClock::now() + std::chrono::seconds(FLAGS_sandbox_timeout);
+    std::string response;
+    if (!sendSandboxMessage(sandbox.socket, query)) {
+      status = Status(1, "Cannot send the query to a sandbox");
+    } else if (!receiveSandboxMessage(sandbox.socket, response, deadline)) {
+      status = Status(1, "The sandbox stopped or exceeded its limits");
+    } else if (!deserializeSandboxResult(response, result)) {
+      status = Status(1, "Invalid sandbox result");
+    }
+  }
+#endif
+
+  if (!status.ok()) {
+    stop(sandbox);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (status.ok()) {
+      idle_.push_back(sandbox);
+    } else {
+      size_--;
+    }
+  }
+  condition_.notify_one();
+  return status;
+}
+
+Status SandboxPool::launch(Sandbox& sandbox) {
+#ifndef WIN32
+  if (path_.empty()) {
+    return Status(1, "Sandboxes are not started");
+  }
+
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    return Status(1, "Cannot create a sandbox socket");
+  }
+
+  // The worker's end is not inherited by other sandboxes.
+  ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+#ifdef __APPLE__
+  int on = 1;
+  ::setsockopt(fds[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+  auto arguments = arguments_;
+  std::vector<char*> argv;
+  for (auto& argument : arguments) {
+    argv.push_back(&argument[0]);
+  }
+  argv.push_back(nullptr);
+
+  auto pid = ::fork();
+  if (pid < 0) {
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return Status(1, "Cannot fork a sandbox");
+  } else if (pid == 0) {
+    if (fds[1] != kSandboxFd) {
+      ::dup2(fds[1], kSandboxFd);
+      ::close(fds[1]);
+    }
+
+    // A sandbox is neither a worker nor a watcher.
+    unsetEnvVar("OSQUERY_WORKER");
+    setEnvVar(kSandboxEnv, "1");
+    ::execve(path_.c_str(), argv.data(), ::environ);
+    ::_exit(EXIT_FAILURE);
+  }
+
+  ::close(fds[1]);
+  sandbox.process = std::make_shared<PlatformProcess>(pid);
+  sandbox.socket = fds[0];
+  return Status(0, "OK");
+#else
+  return Status(1, "Query sandboxes are not supported");
+#endif
+}
+
+void SandboxPool::stop(Sandbox& sandbox) {
+#ifndef WIN32
+  if (sandbox.socket >= 0) {
+    ::close(sandbox.socket);
+    sandbox.socket = -1;
+  }
+#endif
+
+  if (sandbox.process != nullptr) {
+    sandbox.process->kill();
+    sandbox.process->cleanup();
+    sandbox.process = nullptr;
+  }
+}
+
+bool isSandboxProcess() {
+  return getEnvVar(kSandboxEnv).is_initialized();
+}
+
+int startSandbox() {
+#ifndef WIN32
+  // The worker holds the daemon's database, perform the same setup as profile.
+  DatabasePlugin::setAllowOpen(true);
+  RegistryFactory::get().setActive("database", "ephemeral");
+
+  // Private allocations are limited, mapped libraries and stacks are not.
+  struct rlimit memory;
+  memory.rlim_cur = FLAGS_sandbox_memory_limit * 1024 * 1024;
+  memory.rlim_max = memory.rlim_cur;
+  ::setrlimit(RLIMIT_DATA, &memory);
+
+  auto dbc = SQLiteDBManager::get();
+  std::string query;
+  while (receiveSandboxMessage(
+      kSandboxFd, query, SandboxClock::time_point::max())) {
+    // Each query may use the CPU limit beyond the time used by earlier queries.
+    struct rusage used;
+    struct rlimit cpu;
+    if (::getrusage(RUSAGE_SELF, &used) == 0 &&
+        ::getrlimit(RLIMIT_CPU, &cpu) == 0) {
+      cpu.rlim_cur = static_cast<rlim_t>(used.ru_utime.tv_sec +
+                                         used.ru_stime.tv_sec + 1 +
+                                         FLAGS_sandbox_cpu_limit);
+      if (cpu.rlim_max != RLIM_INFINITY && cpu.rlim_cur > cpu.rlim_max) {
+        cpu.rlim_cur = cpu.rlim_max;
+      }
+      ::setrlimit(RLIMIT_CPU, &cpu);
+    }
+
+    SandboxResult result;
+    ThreadUsage r0;
+    ThreadUsage r1;
+    auto usage = getThreadUsage(r0);
+    result.status = queryInternal(query, result.rows, dbc);
+    dbc->clearAffectedTables();
+    if (usage.ok() && getThreadUsage(r1).ok()) {
+      result.user_time = r1.user_time - r0.user_time;
+      result.system_time = r1.system_time - r0.system_time;
+    }
+
+    if (!sendSandboxMessage(kSandboxFd, serializeSandboxResult(result))) {
+      break;
+    }
+  }
+  return 0;
+#else
+  return 1;
+#endif
+}
+} // namespace osquery
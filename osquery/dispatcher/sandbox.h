@@ -0,0 +1,126 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/query.h>
+
+#include "osquery/core/process.h"
+
+namespace osquery {
+
+/// The environment variable set for a sandbox process.
+const std::string kSandboxEnv = "OSQUERY_SANDBOX";
+
+/// The socket a sandbox reads queries from and writes results to.
+const int kSandboxFd = 3;
+
+/// The result of a query executed in a sandbox.
+struct SandboxResult {
+  Status status;
+  QueryData rows;
+
+  /// The CPU time, in microseconds, the sandbox used for the query.
+  uint64_t user_time{0};
+  uint64_t system_time{0};
+};
+
+/// Encode a result for the sandbox socket.
+std::string serializeSandboxResult(const SandboxResult& result);
+
+/// Decode a result written by serializeSandboxResult.
+bool deserializeSandboxResult(const std::string& message,
+                              SandboxResult& result);
+
+/**
+ * @brief A pool of pre-forked processes executing risky or heavy queries.
+ *
+ * Scheduled queries with the "sandbox" option execute in a separate osqueryd
+ * process, such that a query exceeding memory or CPU limits stops only its
+ * sandbox, not the worker's caches and event publishers. Each sandbox reads
+ * queries and writes results over a socket pair, and is replaced when it
+ * exits or exceeds --sandbox_timeout.
+ *
+ * A sandbox uses an ephemeral database, event-based tables are not available.
+ */
+class SandboxPool : private boost::noncopyable {
+ public:
+  static SandboxPool& get() {
+    static SandboxPool pool;
+    return pool;
+  }
+
+  /// Keep the process arguments used to launch sandboxes.
+  void setArguments(int argc, char* argv[]);
+
+  /// Launch the --sandbox_workers processes.
+  void start();
+
+  /// Check if queries may execute in sandboxes.
+  bool enabled() const;
+
+  /**
+   * @brief Execute a query in an idle sandbox, waiting for one if needed.
+   *
+   * @param query The SQL query.
+   * @param result Output, the sandbox's results and status.
+   * @return A failure if the sandbox could not execute the query.
+   */
+  Status run(const std::string& query, SandboxResult& result);
+
+ private:
+  /// A running sandbox and the worker's end of its socket.
+  struct Sandbox {
+    std::shared_ptr<PlatformProcess> process;
+    int socket{-1};
+  };
+
+  SandboxPool() = default;
+
+  /// Fork and execute a sandbox process.
+  Status launch(Sandbox& sandbox);
+
+  /// Stop a sandbox and close its socket.
+  void stop(Sandbox& sandbox);
+
+ private:
+  /// The arguments used to launch a sandbox.
+  std::vector<std::string> arguments_;
+
+  /// The path of the osqueryd binary.
+  std::string path_;
+
+  /// Sandboxes that are not executing a query.
+  std::vector<Sandbox> idle_;
+
+  /// The number of sandboxes, idle or executing.
+  size_t size_{0};
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+};
+
+/// Check if this process was launched as a sandbox.
+bool isSandboxProcess();
+
+/// A sandbox process' entry point, executes queries until the worker exits.
+int startSandbox();
+} // namespace osquery
@@ -8,20 +8,37 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
 #include <ctime>
+#include <limits>
 
 #include <osquery/config.h>
 #include <osquery/core.h>
 #include <osquery/database.h>
+#include <osquery/events.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/query.h>
+#include <osquery/registry.h>
+#include <osquery/sql.h>
 #include <osquery/system.h>
 
 #include "osquery/config/parsers/decorators.h"
+#include "osquery/core/cgroup.h"
+#include "osquery/core/conversions.h"
+#include "osquery/core/memory.h"
+#include "osquery/core/metrics.h"
 #include "osquery/core/process.h"
+#include "osquery/core/trace.h"
+#include "osquery/core/watcher.h"
+#include "osquery/dispatcher/metrics.h"
+#include "osquery/dispatcher/sandbox.h"
 #include "osquery/dispatcher/scheduler.h"
 #include "osquery/sql/sqlite_util.h"
+#include "osquery/sql/virtual_table.h"
 
 namespace osquery {
 
@@ -34,6 +51,47 @@ FLAG(uint64,
 
 FLAG(uint64, schedule_epoch, 0, "Epoch for scheduled queries");
 
+FLAG(bool,
+     schedule_parallel,
+     false,
+     "Execute due scheduled queries concurrently on --worker_threads");
+
+FLAG(uint64,
+     schedule_utilization_limit,
+     0,
+     "Parallel schedule CPU budget, 0 uses the watchdog utilization limit");
+
+FLAG(uint64,
+     schedule_diff_chunk,
+     0,
+     "Stream differentials in chunks of rows, 0 to diff whole results");
+
+FLAG(uint64,
+     schedule_query_timeout,
+     0,
+     "Seconds a scheduled query may execute before it is cancelled, 0 for no "
+     "limit");
+
+FLAG(bool,
+     schedule_placement,
+     true,
+     "Offset the deadlines of scheduled queries to flatten their CPU load");
+
+FLAG(bool,
+     schedule_perf_counters,
+     false,
+     "Count hardware and scheduler events of each scheduled query");
+
+FLAG(bool,
+     schedule_batch_results,
+     true,
+     "Hand the results of each schedule step to the loggers as one batch");
+
+FLAG(uint64,
+     schedule_trigger_delay,
+     5,
+     "Seconds without events before an event-triggered query executes");
+
 HIDDEN_FLAG(bool, enable_monitor, true, "Enable the schedule monitor");
 
 HIDDEN_FLAG(bool,
@@ -41,63 +99,381 @@ HIDDEN_FLAG(bool,
             false,
             "Reload the SQL implementation during schedule reload");
 
+FLAG(bool,
+     schedule_reload_reset,
+     false,
+     "Close and reopen the database, rather than release memory, during "
+     "schedule reload");
+
 /// Used to bypass (optimize-out) the set-differential of query results.
 DECLARE_bool(events_optimize);
 
-SQLInternal monitor(const std::string& name, const ScheduledQuery& query) {
-  // Snapshot the performance and times for the worker before running.
-  auto pid = std::to_string(PlatformProcess::getCurrentProcess()->pid());
-  auto r0 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
+/// The size of the parallel schedule's worker pool.
+DECLARE_int32(worker_threads);
+
+const size_t kScheduleMaxCatchup = 10;
+
+const size_t kSchedulePlacementHorizon = 3600;
+
+/// The number of executing scheduled queries.
+static std::atomic<size_t> kScheduleRunning{0};
+
+/// The time the last scheduled query completed, or the schedule started.
+static std::atomic<size_t> kScheduleActivity{0};
+
+/// Executions deferred by logger backpressure or resource pressure.
+static Metric kScheduleDeferred(
+    "osquery_schedule_deferred_total",
+    "Scheduled executions deferred by logger or resource pressure");
+
+/// Count a scheduled query as executing for the guard's lifetime.
+class ScheduleActivityGuard : private boost::noncopyable {
+ public:
+  ScheduleActivityGuard() {
+    kScheduleRunning++;
+  }
+
+  ~ScheduleActivityGuard() {
+    kScheduleActivity = getUnixTime();
+    kScheduleRunning--;
+  }
+};
+
+size_t getScheduleIdleTime() {
+  if (kScheduleRunning > 0) {
+    return 0;
+  }
+
+  auto now = getUnixTime();
+  size_t activity = kScheduleActivity;
+  return (now > activity) ? now - activity : 0;
+}
+
+/// Calculate a size as the expected byte output of a row.
+static inline size_t getRowSize(const Row& r) {
+  size_t size = 0;
+  for (const auto& column : r) {
+    size += column.first.size();
+    size += column.second.size();
+  }
+  return size;
+}
+
+/// Check if a query uses event-based tables, or its tables are unknown.
+static bool usesEventTables(const std::string& query) {
+  std::vector<std::string> tables;
+  if (!getQueryTables(query, tables).ok()) {
+    return true;
+  }
+
+  auto registry = Registry::get().registry("table");
+  for (const auto& table : tables) {
+    auto plugin =
+        std::dynamic_pointer_cast<TablePlugin>(registry->plugin(table));
+    if (plugin != nullptr &&
+        (plugin->attributes() & TableAttributes::EVENT_BASED) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Check if a query executes in a sandbox, see SandboxPool.
+static bool isSandboxed(const ScheduledQuery& query) {
+  if (query.options.count("sandbox") == 0 || !query.options.at("sandbox") ||
+      !SandboxPool::get().enabled()) {
+    return false;
+  }
+
+  // A sandbox does not have the worker's stored events.
+  return !usesEventTables(query.query);
+}
+
+/// Execute a scheduled query in a sandbox and record its performance.
+static SQLInternal monitorSandbox(const std::string& name,
+                                  const ScheduledQuery& query) {
+  auto t0 = getUnixTime();
+  auto start = std::chrono::steady_clock::now();
+  Config::get().recordQueryStart(name);
+
+  SandboxResult result;
+  auto status = SandboxPool::get().run(query.query, result);
+  if (!status.ok()) {
+    result.rows.clear();
+    result.status = status;
+  }
+
+  // Table usage is counted by the sandbox's process and is not included.
+  QueryUsage usage;
+  for (const auto& row : result.rows) {
+    usage.output_size += getRowSize(row);
+  }
+  usage.rows = result.rows.size();
+  usage.wall_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  usage.user_time = result.user_time;
+  usage.system_time = result.system_time;
+  Config::get().recordQueryPerformance(name, getUnixTime() - t0, usage);
+  return SQLInternal(std::move(result.rows), result.status);
+}
+
+SQLInternal monitor(const std::string& name,
+                    const ScheduledQuery& query,
+                    const RowCallback& callback) {
+  if (callback == nullptr && isSandboxed(query)) {
+    return monitorSandbox(name, query);
+  }
+
+  // Snapshot the times of the executing thread before running, such that work
+  // done concurrently by publishers, loggers, and other queries is excluded.
+  ThreadUsage r0;
+  auto status = getThreadUsage(r0);
   auto t0 = getUnixTime();
+  auto start = std::chrono::steady_clock::now();
+  std::unique_ptr<ThreadCounterScope> counters;
+  if (FLAGS_schedule_perf_counters) {
+    counters = std::make_unique<ThreadCounterScope>();
+  }
   Config::get().recordQueryStart(name);
-  SQLInternal sql(query.query, true);
-  // Snapshot the performance after, and compare.
+  // A query executing past its timeout is interrupted, rather than killing
+  // the worker, and tables stop generating, see QueryContext::isCancelled.
+  size_t deadline = 0;
+  if (FLAGS_schedule_query_timeout > 0) {
+    deadline = t0 + FLAGS_schedule_query_timeout;
+    setQueryDeadline(deadline);
+  }
+  // Results past the query's budget are not generated, see QueryBudget.
+  setQueryBudget(query.max_rows, query.max_bytes);
+  // This does not dedup result differentials and is not aware of snapshots.
+  QueryUsage usage;
+  TableUsageScope tables;
+  auto sql = (callback == nullptr)
+                 ? SQLInternal(query.query, true)
+                 : SQLInternal(query.query,
+                               [&usage, &callback](Row& r) {
+                                 usage.output_size += getRowSize(r);
+                                 usage.rows++;
+                                 return callback(r);
+                               },
+                               true);
+  // Snapshot the times after, and compare.
   auto t1 = getUnixTime();
-  auto r1 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
-  if (r0.size() > 0 && r1.size() > 0) {
-    // Calculate a size as the expected byte output of results.
-    // This does not dedup result differentials and is not aware of snapshots.
-    size_t size = 0;
+  if (deadline > 0) {
+    setQueryDeadline(0);
+    usage.timed_out = !sql.ok() && t1 >= deadline;
+    if (usage.timed_out) {
+      LOG(WARNING) << "Scheduled query " << name << " timed out after "
+                   << FLAGS_schedule_query_timeout << " seconds";
+    }
+  }
+  usage.truncated = getQueryBudget().truncated;
+  usage.sqlite_memory = getQueryBudget().memory;
+  setQueryBudget(0, 0);
+  if (usage.truncated) {
+    LOG(WARNING) << "Scheduled query " << name << " was truncated at "
+                 << sql.rows().size() + usage.rows << " rows";
+  }
+  ThreadUsage r1;
+  if (status.ok() && getThreadUsage(r1).ok()) {
+    usage.tables = tables.tables();
     for (const auto& row : sql.rows()) {
-      for (const auto& column : row) {
-        size += column.first.size();
-        size += column.second.size();
-      }
+      usage.output_size += getRowSize(row);
     }
-    // Always called while processes table is working.
-    Config::get().recordQueryPerformance(name, t1 - t0, size, r0[0], r1[0]);
+    usage.rows += sql.rows().size();
+    usage.wall_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    usage.user_time =
+        (r1.user_time > r0.user_time) ? r1.user_time - r0.user_time : 0;
+    usage.system_time =
+        (r1.system_time > r0.system_time) ? r1.system_time - r0.system_time : 0;
+    ThreadCounters events;
+    if (counters != nullptr && counters->read(events).ok()) {
+      usage.instructions = events.instructions;
+      usage.cycles = events.cycles;
+      usage.cache_misses = events.cache_misses;
+      usage.context_switches = events.context_switches;
+      usage.major_faults = events.major_faults;
+      usage.minor_faults = events.minor_faults;
+    }
+    Config::get().recordQueryPerformance(name, t1 - t0, usage);
   }
   return sql;
 }
 
-inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
-  // Execute the scheduled query and create a named query object.
-  LOG(INFO) << "Executing scheduled query " << name << ": " << query.query;
-  runDecorators(DECORATE_ALWAYS);
+/// Fill in the query metadata of a log item.
+static void initQueryLogItem(const std::string& name,
+                             const ScheduledQuery& query,
+                             QueryLogItem& item) {
+  item.name = name;
+  item.priority = query.priority;
+  // Fill in a host identifier fields based on configuration or availability.
+  item.identifier = getHostIdentifier();
+  item.time = osquery::getUnixTime();
+  item.epoch = FLAGS_schedule_epoch;
+  item.calendar_time = osquery::getAsciiTime();
+  getDecorations(item.decorations, item.decorations_json);
+}
+
+static void requestDatabaseShutdown(const Status& status) {
+  std::string line = "Error adding new results to database: " + status.what();
+  LOG(ERROR) << line;
+
+  // If the database is not available then the daemon cannot continue.
+  Initializer::requestShutdown(EXIT_CATASTROPHIC, line);
+}
+
+static void requestLoggerShutdown(const std::string& name,
+                                  const Status& status) {
+  // If log directory is not available, then the daemon shouldn't continue.
+  std::string error = "Error logging the results of query: " + name + ": " +
+                      status.toString();
+  LOG(ERROR) << error;
+  Initializer::requestShutdown(EXIT_CATASTROPHIC, error);
+}
+
+/// Hand the results batched during a schedule step to the loggers.
+static void flushQueryResults() {
+  auto status = flushLoggerBatch();
+  if (!status.ok()) {
+    std::string error =
+        "Error logging batched query results: " + status.toString();
+    LOG(ERROR) << error;
+    Initializer::requestShutdown(EXIT_CATASTROPHIC, error);
+  }
+}
+
+/**
+ * @brief Release the memory of the SQL implementation and database.
+ *
+ * By default the databases are kept open, with their caches, and only the
+ * virtual tables whose definition changed are attached again.
+ */
+static void reloadDatabases() {
+  if (FLAGS_schedule_reload_reset) {
+    if (FLAGS_schedule_reload_sql) {
+      SQLiteDBManager::resetPrimary();
+    }
+    resetDatabase();
+    return;
+  }
+
+  SQLiteDBManager::refreshPrimary();
+  auto status = flushDatabase();
+  if (!status.ok()) {
+    VLOG(1) << "Cannot flush the database: " << status.getMessage();
+  }
+}
+
+/// Check if a query's results may skip the differential, see events_optimize.
+static bool isEventOptimized(const std::string& query) {
+  if (!FLAGS_events_optimize) {
+    return false;
+  }
+
+  // If the tables are unknown, do not stream the differential.
+  return usesEventTables(query);
+}
+
+/**
+ * @brief Execute a scheduled query, logging the differential in chunks.
+ *
+ * See schedule_diff_chunk, rows are compared with the stored results as they
+ * are generated such that neither result set is held in memory.
+ */
+static void launchStreamedQuery(const std::string& name,
+                                const ScheduledQuery& query) {
+  QueryLogItem item;
+  initQueryLogItem(name, query, item);
+
+  bool removed =
+      !(query.options.count("removed") && !query.options.at("removed"));
+  Status log_status;
+  auto emit = [&name, &item, &log_status, removed](DiffResults& results) {
+    if (!removed) {
+      results.removed.clear();
+    }
+
+    if (results.added.empty() && results.removed.empty()) {
+      return Status(0, "OK");
+    }
+
+    VLOG(1) << "Found results for query: " << name;
+    item.results = std::move(results);
+    log_status = logQueryLogItem(item);
+    item.results = DiffResults();
+    return log_status;
+  };
+
+  auto dbQuery = Query(name, query);
+  QueryDiffStream stream(dbQuery, item.epoch, FLAGS_schedule_diff_chunk, emit);
+  auto status = stream.begin(item.counter);
+  if (!status.ok()) {
+    requestDatabaseShutdown(status);
+    return;
+  }
+
+  auto sql = monitor(name, query, [&stream, &status](Row& r) {
+    // Comparisons and stores must include escaped data.
+    SQL::escapeRow(r);
+    status = stream.add(r);
+    return status.ok();
+  });
+
+  if (status.ok() && sql.ok()) {
+    status = stream.end();
+  }
+
+  if (!log_status.ok()) {
+    requestLoggerShutdown(name, log_status);
+  } else if (!status.ok()) {
+    requestDatabaseShutdown(status);
+  } else if (!sql.ok()) {
+    // The stored results are kept, rows logged as added may be logged again.
+    LOG(ERROR) << "Error executing scheduled query " << name << ": "
+               << sql.getMessageString();
+  }
+}
+
+/**
+ * @brief Execute a snapshot query, logging its rows as they are generated.
+ *
+ * See SnapshotLogStream, the snapshot's rows are not held in memory.
+ */
+static void launchSnapshotQuery(const std::string& name,
+                                const ScheduledQuery& query) {
+  QueryLogItem item;
+  initQueryLogItem(name, query, item);
+
+  SnapshotLogStream stream(std::move(item));
+  auto sql = monitor(name, query, [&stream](Row& r) {
+    stream.add(r);
+    return true;
+  });
 
-  auto sql = monitor(name, query);
   if (!sql.ok()) {
+    // Rows logged as events before the error are kept.
     LOG(ERROR) << "Error executing scheduled query " << name << ": "
                << sql.getMessageString();
     return;
   }
+  stream.end();
+}
 
-  // Fill in a host identifier fields based on configuration or availability.
-  std::string ident = getHostIdentifier();
-
+/// Log the results of an execution, as a snapshot or a differential.
+static void logQueryResults(const std::string& name,
+                            const ScheduledQuery& query,
+                            QueryData rows,
+                            bool event_based) {
   // A query log item contains an optional set of differential results or
   // a copy of the most-recent execution alongside some query metadata.
   QueryLogItem item;
-  item.name = name;
-  item.identifier = ident;
-  item.time = osquery::getUnixTime();
-  item.epoch = FLAGS_schedule_epoch;
-  item.calendar_time = osquery::getAsciiTime();
-  getDecorations(item.decorations);
+  initQueryLogItem(name, query, item);
 
   if (query.options.count("snapshot") && query.options.at("snapshot")) {
     // This is a snapshot query, emit results with a differential or state.
-    item.snapshot_results = std::move(sql.rows());
+    item.snapshot_results = std::move(rows);
     logSnapshotQuery(item);
     return;
   }
@@ -105,26 +481,23 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
   // Create a database-backed set of query results.
   auto dbQuery = Query(name, query);
   // Comparisons and stores must include escaped data.
-  sql.escapeResults();
+  for (auto& r : rows) {
+    SQL::escapeRow(r);
+  }
 
   Status status;
   DiffResults& diff_results = item.results;
   // Add this execution's set of results to the database-tracked named query.
   // We can then ask for a differential from the last time this named query
   // was executed by exact matching each row.
-  if (!FLAGS_events_optimize || !sql.eventBased()) {
+  if (!FLAGS_events_optimize || !event_based) {
     status = dbQuery.addNewResults(
-        std::move(sql.rows()), item.epoch, item.counter, diff_results);
+        std::move(rows), item.epoch, item.counter, diff_results);
     if (!status.ok()) {
-      std::string line =
-          "Error adding new results to database: " + status.what();
-      LOG(ERROR) << line;
-
-      // If the database is not available then the daemon cannot continue.
-      Initializer::requestShutdown(EXIT_CATASTROPHIC, line);
+      requestDatabaseShutdown(status);
     }
   } else {
-    diff_results.added = std::move(sql.rows());
+    diff_results.added = std::move(rows);
   }
 
   if (query.options.count("removed") && !query.options.at("removed")) {
@@ -140,47 +513,725 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
 
   status = logQueryLogItem(item);
   if (!status.ok()) {
-    // If log directory is not available, then the daemon shouldn't continue.
-    std::string error = "Error logging the results of query: " + name + ": " +
-                        status.toString();
-    LOG(ERROR) << error;
-    Initializer::requestShutdown(EXIT_CATASTROPHIC, error);
+    requestLoggerShutdown(name, status);
   }
 }
 
-void SchedulerRunner::start() {
-  // Start the counter at the second.
-  auto i = osquery::getUnixTime();
-  for (; (timeout_ == 0) || (i <= timeout_); ++i) {
-    Config::get().scheduledQueries(
-        ([&i](const std::string& name, const ScheduledQuery& query) {
-          if (query.splayed_interval > 0 && i % query.splayed_interval == 0) {
-            TablePlugin::kCacheInterval = query.splayed_interval;
-            TablePlugin::kCacheStep = i;
-            launchQuery(name, query);
+void launchQuery(const std::string& name,
+                 const ScheduledQuery& query,
+                 const SharedQueries& shared) {
+  TRACE_SPAN("launchQuery", name);
+  MEMORY_TAG(SCHEDULER);
+  ScheduleActivityGuard activity;
+
+  // Heavy queries may yield the CPU and disk to the event publishers.
+  BackgroundPriorityGuard priority(query.options.count("background") > 0 &&
+                                   query.options.at("background"));
+
+  // Execute the scheduled query and create a named query object.
+  LOG(INFO) << "Executing scheduled query " << name << ": " << query.query;
+  runDecorators(DECORATE_ALWAYS);
+
+  bool snapshot =
+      query.options.count("snapshot") && query.options.at("snapshot");
+  if (FLAGS_schedule_diff_chunk > 0 && shared.empty() && !snapshot &&
+      !isEventOptimized(query.query) && !isSandboxed(query)) {
+    launchStreamedQuery(name, query);
+    return;
+  } else if (snapshot && shared.empty() && !isSandboxed(query)) {
+    launchSnapshotQuery(name, query);
+    return;
+  }
+
+  auto sql = monitor(name, query);
+  if (!sql.ok()) {
+    LOG(ERROR) << "Error executing scheduled query " << name << ": "
+               << sql.getMessageString();
+    return;
+  }
+
+  for (const auto& identical : shared) {
+    VLOG(1) << "Logging the results of scheduled query " << name
+            << " for identical query " << identical.first;
+    // The execution's cost is recorded for the query that executed.
+    QueryUsage usage;
+    for (const auto& row : sql.rows()) {
+      usage.output_size += getRowSize(row);
+    }
+    usage.rows = sql.rows().size();
+    Config::get().recordQueryStart(identical.first);
+    Config::get().recordQueryPerformance(identical.first, 0, usage);
+    logQueryResults(
+        identical.first, identical.second, sql.rows(), sql.eventBased());
+  }
+  logQueryResults(name, query, std::move(sql.rows()), sql.eventBased());
+}
+
+std::string getCanonicalQuery(const std::string& query) {
+  std::string canonical;
+  canonical.reserve(query.size());
+  char quote = 0;
+  bool space = false;
+  for (const auto& c : query) {
+    if (quote == 0 && std::isspace(static_cast<unsigned char>(c))) {
+      space = !canonical.empty();
+      continue;
+    }
+
+    if (space) {
+      canonical += ' ';
+      space = false;
+    }
+    canonical += c;
+    if (quote == 0 && (c == '\'' || c == '"' || c == '`')) {
+      quote = c;
+    } else if (c == quote) {
+      quote = 0;
+    }
+  }
+
+  // Trailing semicolons do not change the query.
+  while (!canonical.empty() &&
+         (canonical.back() == ';' || canonical.back() == ' ')) {
+    canonical.pop_back();
+  }
+  return canonical;
+}
+
+SchedulerPool::SchedulerPool(size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    threads_.emplace_back(&SchedulerPool::work, this);
+  }
+}
+
+SchedulerPool::~SchedulerPool() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+bool SchedulerPool::tryRun(SchedulerTask& task) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (busy_ + tasks_.size() >= threads_.size()) {
+      return false;
+    }
+
+    for (const auto& table : task.tables) {
+      if (tables_.count(table) > 0) {
+        return false;
+      }
+    }
+    tables_.insert(task.tables.begin(), task.tables.end());
+    tasks_.push_back(std::move(task));
+  }
+  condition_.notify_all();
+  return true;
+}
+
+void SchedulerPool::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  condition_.wait(lock, [this]() { return busy_ == 0 && tasks_.empty(); });
+}
+
+size_t SchedulerPool::running() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return busy_ + tasks_.size();
+}
+
+void SchedulerPool::work() {
+  while (true) {
+    SchedulerTask task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+      busy_++;
+    }
+
+    launchQuery(task.name, task.query, task.shared);
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (const auto& table : task.tables) {
+        tables_.erase(table);
+      }
+      busy_--;
+    }
+    condition_.notify_all();
+  }
+}
+
+bool SchedulerRunner::isExclusive(const std::string& query,
+                                  std::set<std::string>& tables) {
+  auto cached = inspected_.find(query);
+  if (cached != inspected_.end()) {
+    tables = cached->second.second;
+    return cached->second.first;
+  }
+
+  auto exclusive = isQueryExclusive(query, tables);
+  inspected_[query] = std::make_pair(exclusive, tables);
+  return exclusive;
+}
+
+bool SchedulerRunner::withinBudget() {
+  auto now = getUnixTime();
+  if (now <= budget_time_) {
+    return within_budget_;
+  }
+
+  ProcessUsage usage;
+  if (!getProcessUsage(static_cast<pid_t>(platformGetPid()), usage).ok()) {
+    return within_budget_;
+  }
+
+  auto user_time = usage.user_time;
+  auto system_time = usage.system_time;
+
+  // Utilization is compared per-second, in the same units as the watchdog.
+  size_t limit = FLAGS_schedule_utilization_limit;
+  if (limit == 0) {
+    limit = getWorkerLimit(WatchdogLimitType::UTILIZATION_LIMIT);
+  }
+
+  if (budget_time_ > 0) {
+    auto elapsed = now - budget_time_;
+    auto user = (static_cast<size_t>(user_time) - user_time_) / elapsed;
+    auto system = (static_cast<size_t>(system_time) - system_time_) / elapsed;
+    within_budget_ = (user <= limit && system <= limit);
+    if (!within_budget_) {
+      VLOG(1) << "Parallel schedule is above CPU budget, delaying "
+              << pending_.size() << " queries";
+    }
+  }
+
+  user_time_ = static_cast<size_t>(user_time);
+  system_time_ = static_cast<size_t>(system_time);
+  budget_time_ = now;
+  return within_budget_;
+}
+
+void SchedulerRunner::schedule(const std::string& name,
+                               const ScheduledQuery& query,
+                               size_t step,
+                               SharedQueries shared) {
+  for (const auto& task : pending_) {
+    if (task.name == name) {
+      // The query is still waiting on an earlier step.
+      return;
+    }
+  }
+
+  SchedulerTask task;
+  task.name = name;
+  task.query = query;
+  task.step = step;
+  task.exclusive = isExclusive(query.query, task.tables);
+  task.shared = std::move(shared);
+  pending_.push_back(std::move(task));
+}
+
+void SchedulerRunner::drain() {
+  auto budget = withinBudget();
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    if (it->exclusive) {
+      if (pool_->running() > 0) {
+        // Later queries wait behind an exclusive query to avoid starving it.
+        break;
+      }
+
+      TablePlugin::kCacheInterval = it->query.splayed_interval;
+      TablePlugin::kCacheStep = it->step;
+      launchQuery(it->name, it->query, it->shared);
+      it = pending_.erase(it);
+      continue;
+    }
+
+    if (!budget) {
+      break;
+    }
+
+    if (pool_->tryRun(*it)) {
+      it = pending_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+size_t SchedulerRunner::nextDeadline(const ScheduledQuery& query,
+                                     size_t deadline,
+                                     size_t now) {
+  auto interval = query.splayed_interval;
+  auto next = deadline + interval;
+  if (next > now) {
+    return next;
+  }
+
+  if (query.options.count("catchup") && query.options.at("catchup") &&
+      (now - deadline) / interval <= kScheduleMaxCatchup) {
+    // The missed deadlines will execute back-to-back.
+    return next;
+  }
+
+  // Coalesce the missed deadlines into this execution.
+  auto phase = deadline % interval;
+  return ((now - phase) / interval + 1) * interval + phase;
+}
+
+size_t SchedulerRunner::adaptInterval(const ScheduledQuery& query,
+                                      size_t load) {
+  auto interval = query.splayed_interval;
+  auto lower = (query.min_interval > 0)
+                   ? std::min(query.min_interval, interval)
+                   : interval;
+  auto upper = (query.max_interval > 0)
+                   ? std::max(query.max_interval, interval)
+                   : interval;
+  return std::max(lower, std::min(interval * load / 100, upper));
+}
+
+/// The schedule load, the server's signal doubled by each pressure class.
+static size_t getScheduleLoad() {
+  return Config::get().getScheduleLoad() << getResourcePressure();
+}
+
+void placeSchedule(std::vector<SchedulePlacement>& placements) {
+  // The CPU time started within each second of the horizon.
+  std::vector<size_t> load(kSchedulePlacementHorizon, 0);
+  auto add = [&load](const SchedulePlacement& placement) {
+    for (auto t = placement.phase % load.size(); t < load.size();
+         t += placement.interval) {
+      load[t] += placement.cost;
+    }
+  };
+
+  std::vector<SchedulePlacement*> unplaced;
+  for (auto& placement : placements) {
+    if (placement.interval == 0) {
+      continue;
+    }
+
+    if (placement.fixed) {
+      add(placement);
+    } else {
+      unplaced.push_back(&placement);
+    }
+  }
+
+  // The most expensive, then the most frequent, executions are placed first.
+  std::stable_sort(unplaced.begin(),
+                   unplaced.end(),
+                   [](const SchedulePlacement* a, const SchedulePlacement* b) {
+                     if (a->cost != b->cost) {
+                       return a->cost > b->cost;
+                     }
+                     return a->interval < b->interval;
+                   });
+
+  for (auto* placement : unplaced) {
+    auto interval = placement->interval;
+    auto best = std::make_pair(std::numeric_limits<size_t>::max(), size_t{0});
+    placement->phase = 0;
+    for (size_t phase = 0; phase < std::min(interval, load.size()); phase++) {
+      // Prefer the lowest peak, then the least loaded seconds.
+      size_t peak = 0;
+      size_t total = 0;
+      for (auto t = phase; t < load.size(); t += interval) {
+        peak = std::max(peak, load[t]);
+        total += load[t];
+      }
+
+      auto score = std::make_pair(peak, total);
+      if (score < best) {
+        best = score;
+        placement->phase = phase;
+      }
+    }
+    add(*placement);
+  }
+}
+
+/// Restore a query's phase if it was placed for the same splayed interval.
+static bool restorePhase(const std::string& name,
+                         size_t interval,
+                         size_t& phase) {
+  std::string content;
+  getDatabaseValue(kPersistentSettings, "phase." + name, content);
+  auto details = osquery::split(content, ":");
+  if (details.size() != 2) {
+    return false;
+  }
+
+  long last_interval, last_phase;
+  if (!safeStrtol(details[0], 10, last_interval) ||
+      !safeStrtol(details[1], 10, last_phase)) {
+    return false;
+  }
+
+  if (last_interval != static_cast<long>(interval) || last_phase < 0 ||
+      last_phase >= last_interval) {
+    return false;
+  }
+  phase = static_cast<size_t>(last_phase);
+  return true;
+}
+
+void SchedulerRunner::place(std::map<std::string, ScheduleTimer>& timers,
+                            const std::map<std::string, std::string>& leaders) {
+  // Recorded costs place the whole schedule again when the config changes.
+  bool replace =
+      !timers_.empty() && generation_ != Config::get().getScheduleGeneration();
+
+  std::vector<std::string> names;
+  std::vector<SchedulePlacement> placements;
+  for (const auto& timer : timers) {
+    auto leader = leaders.find(timer.first);
+    if (leader != leaders.end() && leader->second != timer.first) {
+      continue;
+    }
+
+    SchedulePlacement placement;
+    placement.interval = timer.second.query.splayed_interval;
+    Config::get().getPerformanceStats(
+        timer.first, ([&placement](const QueryPerformance& query) {
+          if (query.executions > 0) {
+            auto cpu = query.user_time + query.system_time;
+            auto cost = static_cast<size_t>(cpu / query.executions);
+            placement.cost = std::max<size_t>(cost, 1);
           }
         }));
-    // Configuration decorators run on 60 second intervals only.
-    if ((i % 60) == 0) {
-      runDecorators(DECORATE_INTERVAL, i);
+
+    auto previous = timers_.find(timer.first);
+    if (replace) {
+      // Every phase is chosen again.
+    } else if (previous != timers_.end()) {
+      placement.phase = previous->second.phase;
+      placement.fixed =
+          previous->second.query.splayed_interval == placement.interval;
+    } else {
+      placement.fixed =
+          restorePhase(timer.first, placement.interval, placement.phase);
+    }
+    names.push_back(timer.first);
+    placements.push_back(placement);
+  }
+
+  placeSchedule(placements);
+  for (size_t i = 0; i < names.size(); i++) {
+    const auto& placement = placements[i];
+    timers[names[i]].phase = placement.phase;
+    if (!placement.fixed) {
+      setDatabaseValue(kPersistentSettings,
+                       "phase." + names[i],
+                       std::to_string(placement.interval) + ":" +
+                           std::to_string(placement.phase));
+    }
+  }
+
+  for (const auto& leader : leaders) {
+    timers[leader.first].phase = timers[leader.second].phase;
+  }
+}
+
+void SchedulerRunner::rebuild(size_t now) {
+  std::map<std::string, ScheduleTimer> timers;
+  std::map<std::string, std::vector<std::string>> identical;
+  Config::get().scheduledQueries(
+      ([&timers, &identical](const std::string& name,
+                             const ScheduledQuery& query) {
+        if (query.splayed_interval == 0) {
+          return;
+        }
+
+        auto& timer = timers[name];
+        timer.query = query;
+        timer.canonical = getCanonicalQuery(query.query);
+        identical[timer.canonical].push_back(name);
+      }));
+
+  shared_.clear();
+  std::map<std::string, std::string> leaders;
+  for (const auto& names : identical) {
+    if (names.second.size() < 2 || usesEventTables(names.first)) {
+      continue;
     }
-    if (FLAGS_schedule_reload > 0 && (i % FLAGS_schedule_reload) == 0) {
-      if (FLAGS_schedule_reload_sql) {
-        SQLiteDBManager::resetPrimary();
+
+    // Align the intervals to the splay of the shortest.
+    const ScheduledQuery* shortest = nullptr;
+    for (const auto& name : names.second) {
+      const auto& query = timers[name].query;
+      if (shortest == nullptr || query.interval < shortest->interval) {
+        shortest = &query;
       }
-      resetDatabase();
     }
 
-    // GLog is not re-entrant, so logs must be flushed in a dedicated thread.
-    if ((i % 3) == 0) {
-      relayStatusLogs(true);
+    auto interval = shortest->interval;
+    auto splayed_interval = shortest->splayed_interval;
+    for (const auto& name : names.second) {
+      auto& query = timers[name].query;
+      if (interval > 0 && query.interval % interval == 0) {
+        query.splayed_interval = splayed_interval * (query.interval / interval);
+      }
     }
 
-    // Put the thread into an interruptible sleep without a config instance.
-    pauseMilli(interval_ * 1000);
+    // The leader, with the shortest interval, chooses the shared phase.
+    for (const auto& name : names.second) {
+      if (&timers[name].query == shortest) {
+        for (const auto& member : names.second) {
+          leaders[member] = name;
+        }
+      }
+    }
+    shared_[names.first] = names.second;
+  }
+
+  if (FLAGS_schedule_placement) {
+    place(timers, leaders);
+  }
+
+  for (auto& timer : timers) {
+    const auto& query = timer.second.query;
+    auto previous = timers_.find(timer.first);
+    auto phase = timer.second.phase;
+    if (previous != timers_.end() && previous->second.query == query &&
+        previous->second.query.splayed_interval == query.splayed_interval &&
+        previous->second.phase == phase) {
+      timer.second.deadline = previous->second.deadline;
+      timer.second.interval = previous->second.interval;
+      timer.second.triggered = previous->second.triggered;
+    } else {
+      // Deadlines are multiples of the interval past the phase.
+      auto interval = query.splayed_interval;
+      timer.second.deadline =
+          ((now + interval - 1 - phase) / interval) * interval + phase;
+      timer.second.interval = interval;
+      timer.second.triggered = now;
+    }
+  }
+
+  timers_.swap(timers);
+  decltype(deadlines_)().swap(deadlines_);
+  for (const auto& timer : timers_) {
+    deadlines_.push(std::make_pair(timer.second.deadline, timer.first));
+  }
+  generation_ = Config::get().getScheduleGeneration();
+  rebuilt_ = now;
+}
+
+void SchedulerRunner::trigger(size_t now) {
+  for (auto& timer : timers_) {
+    if (timer.second.query.triggers.empty()) {
+      continue;
+    }
+
+    size_t latest = 0;
+    for (const auto& table : timer.second.query.triggers) {
+      if (EventFactory::exists(table)) {
+        auto subscriber = EventFactory::getEventSubscriber(table);
+        latest = std::max(latest, subscriber->lastEventTime());
+      }
+    }
+
+    // Wait for a burst of events to settle, bursts execute the query once.
+    if (latest <= timer.second.triggered ||
+        now < latest + FLAGS_schedule_trigger_delay) {
+      continue;
+    }
+
+    timer.second.triggered = latest;
+    if (timer.second.deadline <= now) {
+      // The query is already due.
+      continue;
+    }
+    timer.second.deadline = now;
+    deadlines_.push(std::make_pair(now, timer.first));
+  }
+}
+
+void SchedulerRunner::fire(size_t now) {
+  while (!deadlines_.empty() && deadlines_.top().first <= now) {
+    auto deadline = deadlines_.top().first;
+    auto name = deadlines_.top().second;
+    deadlines_.pop();
+
+    auto timer = timers_.find(name);
+    if (timer == timers_.end() || timer->second.deadline != deadline) {
+      // The query was removed or rescheduled when the timers were rebuilt.
+      continue;
+    }
+
+    if (!advance(name, timer->second, now)) {
+      continue;
+    }
+
+    // Identical queries that are also due are logged from this execution.
+    SharedQueries shared;
+    auto identical = shared_.find(timer->second.canonical);
+    if (identical != shared_.end() && FLAGS_schedule_diff_chunk == 0) {
+      for (const auto& other : identical->second) {
+        auto other_timer = timers_.find(other);
+        if (other == name || other_timer == timers_.end() ||
+            other_timer->second.deadline > now) {
+          continue;
+        }
+
+        if (advance(other, other_timer->second, now)) {
+          shared.emplace_back(other, other_timer->second.query);
+        }
+      }
+    }
+
+    const auto& query = timer->second.query;
+    TablePlugin::kCacheInterval = query.splayed_interval;
+    TablePlugin::kCacheStep = deadline;
+    if (pool_ != nullptr) {
+      schedule(name, query, deadline, std::move(shared));
+    } else {
+      launchQuery(name, query, shared);
+    }
+  }
+}
+
+bool SchedulerRunner::advance(const std::string& name,
+                              ScheduleTimer& timer,
+                              size_t now) {
+  const auto& query = timer.query;
+  auto deadline = timer.deadline;
+  auto splayed_interval = query.splayed_interval;
+  auto interval = adaptInterval(query, getScheduleLoad());
+  size_t next = 0;
+  if (interval != splayed_interval) {
+    // Adapted deadlines follow the previous, missed deadlines are coalesced.
+    next = deadline + ((now - deadline) / interval + 1) * interval;
+  } else if (timer.interval != splayed_interval) {
+    // Return to the multiples of the splayed interval past the phase.
+    auto phase = timer.phase % interval;
+    next = ((now - phase) / interval + 1) * interval + phase;
+  } else {
+    next = nextDeadline(query, deadline, now);
+  }
+
+  if (timer.interval != interval) {
+    VLOG(1) << "Scheduled query " << name << " interval adapted to "
+            << interval << " seconds";
+  }
+  timer.interval = interval;
+  timer.deadline = next;
+  deadlines_.push(std::make_pair(next, name));
+  Config::get().recordQueryInterval(name, interval);
+
+  if (query.priority < getLoggerBackpressure()) {
+    // The logger is backed up, the next execution includes these results.
+    VLOG(1) << "Deferring scheduled query " << name
+            << " while the logger is saturated";
+    kScheduleDeferred.add();
+    return false;
+  }
+
+  if (query.priority < getResourcePressure()) {
+    // The worker is stalling on CPU or memory within its cgroup limits.
+    VLOG(1) << "Deferring scheduled query " << name
+            << " while the worker is under pressure";
+    kScheduleDeferred.add();
+    return false;
+  }
+
+  // Serial executions delay the following queries, measure each start.
+  auto start = getUnixTime();
+  auto missed = (next - deadline) / interval;
+  Config::get().recordQueryLateness(name,
+                                    (start > deadline) ? start - deadline : 0,
+                                    (missed > 0) ? missed - 1 : 0);
+  return true;
+}
+
+void SchedulerRunner::start() {
+  if (FLAGS_schedule_parallel && FLAGS_worker_threads > 1) {
+    pool_ = std::make_unique<SchedulerPool>(
+        static_cast<size_t>(FLAGS_worker_threads));
+  }
+
+  // Results of the queries executed within a step are logged together.
+  if (FLAGS_schedule_batch_results) {
+    setLoggerBatching(true);
+  }
+
+  auto now = osquery::getUnixTime();
+  rebuild(now);
+
+  // Bookkeeping runs for each second, including those spent executing.
+  auto step = now;
+  while ((timeout_ == 0) || (now <= timeout_)) {
+    // Pack discovery and blacklist expiration are checked each minute.
+    if (generation_ != Config::get().getScheduleGeneration() ||
+        now >= rebuilt_ + 60) {
+      rebuild(now);
+    }
+
+    trigger(now);
+    fire(now);
+    if (pool_ != nullptr) {
+      drain();
+    }
+    if (FLAGS_schedule_batch_results) {
+      flushQueryResults();
+    }
+
+    for (; step <= now; ++step) {
+      // Configuration decorators run on 60 second intervals only.
+      if ((step % 60) == 0) {
+        runDecorators(DECORATE_INTERVAL, step);
+        checkMemoryTags(
+            getWorkerLimit(WatchdogLimitType::MEMORY_LIMIT) * 1024 * 1024);
+      }
+      if (FLAGS_schedule_reload > 0 && (step % FLAGS_schedule_reload) == 0) {
+        if (pool_ != nullptr) {
+          // The database and SQL implementation cannot reset below a query.
+          pool_->wait();
+          inspected_.clear();
+        }
+        reloadDatabases();
+      }
+    }
+
+    // Sleep until the next deadline, or at most the schedule interval.
+    size_t wake = now + std::max(interval_, size_t{1});
+    if (!deadlines_.empty() && deadlines_.top().first < wake) {
+      wake = deadlines_.top().first;
+    }
+
+    auto milli = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+    if (static_cast<long long>(wake * 1000) > milli) {
+      // Put the thread into an interruptible sleep without a config instance.
+      pauseMilli(static_cast<size_t>(wake * 1000 - milli));
+    }
     if (interrupted()) {
       break;
     }
+    now = osquery::getUnixTime();
+  }
+
+  if (pool_ != nullptr) {
+    pool_->wait();
+    pool_.reset();
+  }
+
+  if (FLAGS_schedule_batch_results) {
+    flushQueryResults();
+    setLoggerBatching(false);
   }
 }
 
@@ -189,6 +1240,9 @@ void startScheduler() {
 }
 
 void startScheduler(unsigned long int timeout, size_t interval) {
+  kScheduleActivity = getUnixTime();
+  SandboxPool::get().start();
+  startMetrics();
   Dispatcher::addService(std::make_shared<SchedulerRunner>(timeout, interval));
 }
 }
@@ -10,14 +10,156 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <osquery/dispatcher.h>
+#include <osquery/query.h>
 
 #include "osquery/sql/sqlite_util.h"
 
 namespace osquery {
 
+/// Named scheduled queries logged from the execution of an identical query.
+using SharedQueries = std::vector<std::pair<std::string, ScheduledQuery>>;
+
+/// A due scheduled query, copied such that it may outlive a config update.
+struct SchedulerTask {
+  /// The scheduled query name.
+  std::string name;
+
+  /// A copy of the scheduled query.
+  ScheduledQuery query;
+
+  /// The schedule step when the query became due.
+  size_t step{0};
+
+  /// The tables used by the query, locked while the query executes.
+  std::set<std::string> tables;
+
+  /// The query must execute alone, see SchedulerRunner::isExclusive.
+  bool exclusive{false};
+
+  /// Identical queries due at the same time, logged from this execution.
+  SharedQueries shared;
+};
+
+/**
+ * @brief A bounded pool of threads executing scheduled queries.
+ *
+ * Each worker executes a single query at a time. The SQL layer hands out a
+ * transient SQLiteDBInstance when the primary instance is in use, so
+ * concurrent queries use separate connections.
+ *
+ * Table implementations are not assumed to be thread-safe: a query is only
+ * accepted if none of its tables are used by another executing query.
+ */
+class SchedulerPool : private boost::noncopyable {
+ public:
+  explicit SchedulerPool(size_t size);
+  ~SchedulerPool();
+
+  /**
+   * @brief Start a query on a free worker.
+   *
+   * @return false if all workers are busy or one of the query's tables is
+   * used by an executing query.
+   */
+  bool tryRun(SchedulerTask& task);
+
+  /// Wait for all executing queries to complete.
+  void wait();
+
+  /// The number of executing queries.
+  size_t running();
+
+ private:
+  /// The worker thread entry point.
+  void work();
+
+ private:
+  /// The pool of worker threads.
+  std::vector<std::thread> threads_;
+
+  /// A task handed to a worker, at most one per free worker.
+  std::deque<SchedulerTask> tasks_;
+
+  /// The tables used by executing queries.
+  std::set<std::string> tables_;
+
+  /// The number of workers executing a query.
+  size_t busy_{0};
+
+  /// Set when the pool is destroyed.
+  bool stopping_{false};
+
+  /// Protection around the task queue and table set.
+  std::mutex mutex_;
+
+  /// Signaled when a task is added, completes, or the pool is stopping.
+  std::condition_variable condition_;
+};
+
+/// The maximum number of missed deadlines a "catchup" query executes.
+extern const size_t kScheduleMaxCatchup;
+
+/// The seconds of schedule load modeled when placing deadlines.
+extern const size_t kSchedulePlacementHorizon;
+
+/// The executions of a scheduled query, see placeSchedule.
+struct SchedulePlacement {
+  /// The splayed interval in seconds.
+  size_t interval{0};
+
+  /// The average CPU time of an execution in milliseconds.
+  size_t cost{1};
+
+  /// The offset of the deadlines within the interval.
+  size_t phase{0};
+
+  /// The phase is kept, the executions only add to the load.
+  bool fixed{false};
+};
+
+/**
+ * @brief Choose the phase of each placement that is not fixed.
+ *
+ * Placements are chosen from the most to the least expensive, each at the
+ * offset whose executions land on the least loaded seconds, such that the
+ * peak CPU time started within a second stays low. The load is modeled over
+ * the first kSchedulePlacementHorizon seconds of the schedule.
+ */
+void placeSchedule(std::vector<SchedulePlacement>& placements);
+
+/// A scheduled query and its next deadline in the schedule.
+struct ScheduleTimer {
+  /// A copy of the scheduled query.
+  ScheduledQuery query;
+
+  /// The next absolute UNIX time, in seconds, the query is due.
+  size_t deadline{0};
+
+  /// The query with its whitespace normalized, see SchedulerRunner::shared_.
+  std::string canonical;
+
+  /// Deadlines are this offset past a multiple of the splayed interval.
+  size_t phase{0};
+
+  /// The interval to the deadline, adapted to the schedule load.
+  size_t interval{0};
+
+  /// The time of the last trigger event handled, see ScheduledQuery::triggers.
+  size_t triggered{0};
+};
+
 /// A Dispatcher service thread that watches an ExtensionManagerHandler.
 class SchedulerRunner : public InternalRunnable {
  public:
@@ -33,18 +175,181 @@ class SchedulerRunner : public InternalRunnable {
   /// The Dispatcher interrupt point.
   void stop() override {}
 
+ protected:
+  /**
+   * @brief Rebuild the deadlines from the config's schedule.
+   *
+   * Queries that did not change keep their deadline, new queries are due at
+   * the next multiple of their splayed interval past their phase.
+   *
+   * Identical queries, such as the same SQL in several packs, share the
+   * splayed interval of the one with the shortest interval, multiplied for
+   * intervals that are a multiple of it, such that their deadlines coincide.
+   */
+  void rebuild(size_t now);
+
+  /**
+   * @brief Choose the phase of new timers, see --schedule_placement.
+   *
+   * Phases are restored from the database at start and kept across rebuilds.
+   * When the config changes, every phase is chosen again using the recorded
+   * cost of each query. Identical queries use the phase of their leader.
+   */
+  void place(std::map<std::string, ScheduleTimer>& timers,
+             const std::map<std::string, std::string>& leaders);
+
+  /**
+   * @brief Make queries due after activity in their triggering event tables.
+   *
+   * A query is due once its triggering tables received an event since it was
+   * last triggered, and no event for --schedule_trigger_delay seconds.
+   */
+  void trigger(size_t now);
+
+  /// Execute, or queue, each query with a deadline at or before now.
+  void fire(size_t now);
+
+  /**
+   * @brief Advance a due query's timer to its next deadline.
+   *
+   * @return false if the execution is deferred by logger or resource pressure.
+   */
+  bool advance(const std::string& name, ScheduleTimer& timer, size_t now);
+
+  /**
+   * @brief Calculate a query's deadline after executing at time now.
+   *
+   * By default missed deadlines are coalesced into a single execution and the
+   * next deadline is the first after now, keeping the deadline's phase. Queries
+   * with the "catchup" option execute once for each missed deadline, up to
+   * kScheduleMaxCatchup, before coalescing.
+   */
+  static size_t nextDeadline(const ScheduledQuery& query,
+                             size_t deadline,
+                             size_t now);
+
+  /**
+   * @brief Calculate a query's interval adapted to the schedule load.
+   *
+   * The splayed interval is scaled by the load, a percent, within the query's
+   * min_interval and max_interval. Without bounds the interval is kept.
+   */
+  static size_t adaptInterval(const ScheduledQuery& query, size_t load);
+
+  /// Queue a due query for the parallel schedule.
+  void schedule(const std::string& name,
+                const ScheduledQuery& query,
+                size_t step,
+                SharedQueries shared);
+
+  /// Start pending queries while workers and the CPU budget are available.
+  void drain();
+
+  /**
+   * @brief Check if a query must execute alone, see isQueryExclusive.
+   *
+   * The inspection is cached for each query. Exclusive queries are executed
+   * on the scheduler thread once the pool is idle.
+   */
+  bool isExclusive(const std::string& query, std::set<std::string>& tables);
+
+  /// Check the process CPU utilization since the last check is in budget.
+  bool withinBudget();
+
  protected:
   /// The UNIX domain socket path for the ExtensionManager.
   std::map<std::string, size_t> splay_;
 
-  /// Interval in seconds between schedule steps.
+  /// The longest interval in seconds between schedule steps.
   size_t interval_;
 
   /// Maximum number of steps.
   unsigned long int timeout_;
+
+  /// The scheduled queries by name, with their next deadline.
+  std::map<std::string, ScheduleTimer> timers_;
+
+  /// A min-heap of deadlines, entries not matching timers_ are stale.
+  std::priority_queue<std::pair<size_t, std::string>,
+                      std::vector<std::pair<size_t, std::string>>,
+                      std::greater<std::pair<size_t, std::string>>>
+      deadlines_;
+
+  /**
+   * @brief The names of identical scheduled queries, by canonical query.
+   *
+   * Only queries that may share an execution are included, queries using
+   * event-based tables track the events returned to each query name.
+   */
+  std::map<std::string, std::vector<std::string>> shared_;
+
+  /// The config schedule generation used to build the timers.
+  size_t generation_{0};
+
+  /// The time the timers were last rebuilt.
+  size_t rebuilt_{0};
+
+  /// Workers for the parallel schedule, see --schedule_parallel.
+  std::unique_ptr<SchedulerPool> pool_;
+
+  /// Due queries waiting for a worker, their tables, or CPU budget.
+  std::deque<SchedulerTask> pending_;
+
+  /// Cached table inspection results for each scheduled query string.
+  std::map<std::string, std::pair<bool, std::set<std::string>>> inspected_;
+
+  /// The process user and system time at the last budget check.
+  size_t user_time_{0};
+  size_t system_time_{0};
+
+  /// The time of the last budget check.
+  size_t budget_time_{0};
+
+  /// The result of the last budget check.
+  bool within_budget_{true};
+
+ private:
+  FRIEND_TEST(SchedulerTests, test_scheduler_parallel);
+  FRIEND_TEST(SchedulerTests, test_scheduler_exclusive);
+  FRIEND_TEST(SchedulerTests, test_scheduler_deadlines);
+  FRIEND_TEST(SchedulerTests, test_scheduler_next_deadline);
+  FRIEND_TEST(SchedulerTests, test_scheduler_adaptive_interval);
+  FRIEND_TEST(SchedulerTests, test_scheduler_triggers);
+  FRIEND_TEST(SchedulerTests, test_scheduler_identical_queries);
+  FRIEND_TEST(SchedulerTests, test_scheduler_placement);
 };
 
-SQLInternal monitor(const std::string& name, const ScheduledQuery& query);
+/**
+ * @brief Execute a scheduled query and record its performance.
+ *
+ * @param name the scheduled query name.
+ * @param query the scheduled query.
+ * @param callback [optional] stream each result row instead of keeping rows.
+ */
+SQLInternal monitor(const std::string& name,
+                    const ScheduledQuery& query,
+                    const RowCallback& callback = nullptr);
+
+/**
+ * @brief Execute a scheduled query and log the results.
+ *
+ * @param name the scheduled query name.
+ * @param query the scheduled query.
+ * @param shared [optional] identical queries also logged from the results.
+ */
+void launchQuery(const std::string& name,
+                 const ScheduledQuery& query,
+                 const SharedQueries& shared = {});
+
+/// Normalize the whitespace and trailing semicolons of a query.
+std::string getCanonicalQuery(const std::string& query);
+
+/**
+ * @brief Get the seconds since a scheduled query last executed.
+ *
+ * @return 0 while any scheduled query is executing.
+ */
+size_t getScheduleIdleTime();
 
 /// Start querying according to the config's schedule
 void startScheduler();
@@ -10,9 +10,12 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/database.h>
+#include <osquery/events.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/dispatcher/sandbox.h"
 #include "osquery/dispatcher/scheduler.h"
 #include "osquery/sql/sqlite_util.h"
 #include "osquery/tests/test_util.h"
@@ -21,6 +24,9 @@ namespace osquery {
 
 DECLARE_bool(disable_logging);
 DECLARE_uint64(schedule_reload);
+DECLARE_bool(schedule_parallel);
+DECLARE_int32(worker_threads);
+DECLARE_uint64(schedule_trigger_delay);
 
 class SchedulerTests : public testing::Test {
   void SetUp() override {
@@ -64,6 +70,16 @@ TEST_F(SchedulerTests, test_monitor) {
   EXPECT_EQ(perf.executions, 1U);
   EXPECT_GT(perf.output_size, 0U);
 
+  // The rows generated by each table and a single execution are recorded.
+  ASSERT_EQ(perf.tables.count("time"), 1U);
+  EXPECT_EQ(perf.tables.at("time").rows, 1U);
+  EXPECT_GT(perf.tables.at("time").bytes, 0U);
+  EXPECT_GT(perf.average_memory, 0U);
+  EXPECT_FALSE(perf.wall_time_histogram.toString().empty());
+  EXPECT_FALSE(perf.cpu_time_histogram.toString().empty());
+  EXPECT_EQ(perf.rows_histogram.max, 1U);
+  EXPECT_EQ(perf.output_size_histogram.max, perf.output_size);
+
   // A bit more testing, potentially redundant, check the database results.
   // Since we are only monitoring, no 'actual' results are stored.
   std::string content;
@@ -173,6 +189,329 @@ TEST_F(SchedulerTests, test_scheduler) {
   TablePlugin::kCacheInterval = backup_interval;
 }
 
+TEST_F(SchedulerTests, test_scheduler_parallel) {
+  auto backup_parallel = FLAGS_schedule_parallel;
+  auto backup_threads = FLAGS_worker_threads;
+  FLAGS_schedule_parallel = true;
+  FLAGS_worker_threads = 2;
+
+  std::string config =
+      "{"
+      "\"packs\": {"
+      "\"parallel\": {"
+      "\"queries\": {"
+      "\"1\": {\"query\": \"select * from time\", \"interval\": 1},"
+      "\"2\": {\"query\": \"select * from osquery_info\", \"interval\": 1},"
+      "\"3\": {\"query\": \"select * from osquery_info\", \"interval\": 1}"
+      "}"
+      "}"
+      "}"
+      "}";
+  Config::get().update({{"data", config}});
+
+  auto now = osquery::getUnixTime();
+  SchedulerRunner runner(static_cast<unsigned long int>(now + 1), 1);
+  runner.start();
+
+  // The pool is drained and joined when the schedule ends.
+  EXPECT_EQ(runner.pool_, nullptr);
+
+  // The queries were executed by the pool workers.
+  size_t executions = 0;
+  for (const auto& name : {"pack_parallel_1", "pack_parallel_2"}) {
+    Config::get().getPerformanceStats(
+        name, ([&executions](const QueryPerformance& r) {
+          executions += r.executions;
+        }));
+  }
+  EXPECT_GT(executions, 0U);
+
+  // No queries are left marked as executing.
+  std::string executing;
+  getDatabaseValue(kPersistentSettings, kExecutingQuery, executing);
+  EXPECT_TRUE(executing.empty());
+
+  FLAGS_schedule_parallel = backup_parallel;
+  FLAGS_worker_threads = backup_threads;
+}
+
+TEST_F(SchedulerTests, test_scheduler_exclusive) {
+  SchedulerRunner runner(0, 1);
+
+  std::set<std::string> tables;
+  EXPECT_FALSE(runner.isExclusive("select * from time", tables));
+  EXPECT_EQ(tables, std::set<std::string>{"time"});
+
+  // The inspection is cached by query.
+  EXPECT_EQ(runner.inspected_.count("select * from time"), 1U);
+
+  // A query without tables is not inspected and executes alone.
+  tables.clear();
+  EXPECT_TRUE(runner.isExclusive("select 1", tables));
+  EXPECT_TRUE(tables.empty());
+}
+
+TEST_F(SchedulerTests, test_scheduler_deadlines) {
+  std::string config =
+      "{\"schedule\":{\"deadlines\":{"
+      "\"query\":\"select * from time\", \"interval\":10}}}";
+  Config::get().update({{"data", config}});
+
+  SchedulerRunner runner(0, 1);
+  runner.rebuild(1000);
+  ASSERT_EQ(runner.timers_.count("deadlines"), 1U);
+  EXPECT_EQ(runner.deadlines_.size(), 1U);
+
+  // The first deadline is the next multiple of the splayed interval.
+  const auto& timer = runner.timers_.at("deadlines");
+  auto interval = timer.query.splayed_interval;
+  ASSERT_GT(interval, 0U);
+  EXPECT_EQ(timer.deadline % interval, 0U);
+  EXPECT_GE(timer.deadline, 1000U);
+  EXPECT_LT(timer.deadline, 1000U + interval);
+
+  // An unchanged query keeps its deadline across rebuilds.
+  auto deadline = timer.deadline;
+  runner.rebuild(deadline + 1);
+  EXPECT_EQ(runner.timers_.at("deadlines").deadline, deadline);
+  EXPECT_EQ(runner.generation_, Config::get().getScheduleGeneration());
+}
+
+TEST_F(SchedulerTests, test_scheduler_identical_queries) {
+  EXPECT_EQ(getCanonicalQuery(" select *\n  from time ;; "),
+            "select * from time");
+  EXPECT_EQ(getCanonicalQuery("select 'a  b'  as c;"), "select 'a  b' as c");
+
+  std::string config =
+      "{\"schedule\":{"
+      "\"identical_1\":{\"query\":\"select * from time\", \"interval\":10},"
+      "\"identical_2\":{\"query\":\"select *  from time;\", \"interval\":20},"
+      "\"different\":{\"query\":\"select 1 from time\", \"interval\":10}"
+      "}}";
+  Config::get().update({{"data", config}});
+
+  SchedulerRunner runner(0, 1);
+  runner.rebuild(1000);
+  ASSERT_EQ(runner.timers_.size(), 3U);
+  ASSERT_EQ(runner.shared_.size(), 1U);
+  EXPECT_EQ(runner.shared_.begin()->second.size(), 2U);
+
+  // The longer interval is a multiple of the shorter's splayed interval.
+  const auto& leader = runner.timers_.at("identical_1");
+  auto interval = leader.query.splayed_interval;
+  const auto& timer = runner.timers_.at("identical_2");
+  EXPECT_EQ(timer.query.splayed_interval, interval * 2);
+  EXPECT_EQ(timer.phase, leader.phase);
+  EXPECT_EQ(timer.deadline % interval, leader.deadline % interval);
+}
+
+TEST_F(SchedulerTests, test_scheduler_placement) {
+  std::vector<SchedulePlacement> placements(4);
+  placements[0].interval = 10;
+  placements[0].cost = 100;
+  placements[0].fixed = true;
+  placements[1].interval = 10;
+  placements[1].cost = 100;
+  placements[2].interval = 20;
+  placements[2].cost = 50;
+  placements[3].interval = 10;
+  placements[3].cost = 1;
+  placeSchedule(placements);
+
+  // Fixed phases are kept, expensive executions do not collide.
+  EXPECT_EQ(placements[0].phase, 0U);
+  EXPECT_NE(placements[1].phase, 0U);
+  EXPECT_NE(placements[2].phase % 10, 0U);
+  EXPECT_NE(placements[2].phase % 10, placements[1].phase);
+  EXPECT_NE(placements[3].phase, placements[1].phase);
+
+  std::string config =
+      "{\"schedule\":{"
+      "\"placement_1\":{\"query\":\"select 1 from time\", \"interval\":10},"
+      "\"placement_2\":{\"query\":\"select 2 from time\", \"interval\":10}"
+      "}}";
+  Config::get().update({{"data", config}});
+
+  SchedulerRunner runner(0, 1);
+  runner.rebuild(1000);
+  ASSERT_EQ(runner.timers_.size(), 2U);
+  const auto& first = runner.timers_.at("placement_1");
+  const auto& second = runner.timers_.at("placement_2");
+  EXPECT_EQ(first.deadline % first.query.splayed_interval, first.phase);
+  EXPECT_EQ(second.deadline % second.query.splayed_interval, second.phase);
+
+  // Phases are persisted with their splayed interval.
+  std::string content;
+  getDatabaseValue(kPersistentSettings, "phase.placement_2", content);
+  EXPECT_EQ(content,
+            std::to_string(second.query.splayed_interval) + ":" +
+                std::to_string(second.phase));
+
+  // A restarted schedule restores the phases.
+  SchedulerRunner restarted(0, 1);
+  restarted.rebuild(2000);
+  EXPECT_EQ(restarted.timers_.at("placement_2").phase, second.phase);
+}
+
+TEST_F(SchedulerTests, test_scheduler_next_deadline) {
+  ScheduledQuery query;
+  query.splayed_interval = 10;
+
+  // A query executing on time is due at its next interval.
+  EXPECT_EQ(SchedulerRunner::nextDeadline(query, 100, 105), 110U);
+
+  // Missed deadlines are coalesced into a single execution by default.
+  EXPECT_EQ(SchedulerRunner::nextDeadline(query, 100, 135), 140U);
+  EXPECT_EQ(SchedulerRunner::nextDeadline(query, 100, 140), 150U);
+
+  // Coalesced deadlines keep their phase within the interval.
+  EXPECT_EQ(SchedulerRunner::nextDeadline(query, 103, 135), 143U);
+
+  // The catchup option executes each missed deadline, up to a limit.
+  query.options["catchup"] = true;
+  EXPECT_EQ(SchedulerRunner::nextDeadline(query, 100, 135), 110U);
+  auto late = 100 + 10 * (kScheduleMaxCatchup + 1);
+  EXPECT_EQ(SchedulerRunner::nextDeadline(query, 100, late), late + 10);
+}
+
+TEST_F(SchedulerTests, test_scheduler_adaptive_interval) {
+  ScheduledQuery query;
+  query.splayed_interval = 100;
+
+  // Without bounds the interval is kept.
+  EXPECT_EQ(SchedulerRunner::adaptInterval(query, 300), 100U);
+
+  // The interval is scaled by the load, within the bounds.
+  query.min_interval = 50;
+  query.max_interval = 200;
+  EXPECT_EQ(SchedulerRunner::adaptInterval(query, 100), 100U);
+  EXPECT_EQ(SchedulerRunner::adaptInterval(query, 150), 150U);
+  EXPECT_EQ(SchedulerRunner::adaptInterval(query, 300), 200U);
+  EXPECT_EQ(SchedulerRunner::adaptInterval(query, 10), 50U);
+
+  std::string config =
+      "{\"schedule\":{\"adaptive\":{"
+      "\"query\":\"select * from time\", \"interval\":10, "
+      "\"max_interval\":40}}}";
+  Config::get().update({{"data", config}});
+
+  SchedulerRunner runner(0, 1);
+  runner.rebuild(1000);
+  ASSERT_EQ(runner.timers_.count("adaptive"), 1U);
+  auto& timer = runner.timers_.at("adaptive");
+  auto interval = timer.query.splayed_interval;
+  auto deadline = timer.deadline;
+
+  // A loaded server stretches the interval.
+  Config::get().setScheduleLoad(200);
+  EXPECT_TRUE(runner.advance("adaptive", timer, deadline));
+  EXPECT_EQ(timer.interval, interval * 2);
+  EXPECT_EQ(timer.deadline, deadline + interval * 2);
+
+  size_t effective = 0;
+  Config::get().getPerformanceStats(
+      "adaptive", [&effective](const QueryPerformance& perf) {
+        effective = perf.effective_interval;
+      });
+  EXPECT_EQ(effective, interval * 2);
+
+  // Then deadlines return to multiples of the splayed interval.
+  Config::get().setScheduleLoad(100);
+  deadline = timer.deadline;
+  EXPECT_TRUE(runner.advance("adaptive", timer, deadline));
+  EXPECT_EQ(timer.interval, interval);
+  EXPECT_GT(timer.deadline, deadline);
+  EXPECT_LE(timer.deadline, deadline + interval);
+  EXPECT_EQ(timer.deadline % interval, timer.phase % interval);
+}
+
+class TriggerEventPublisher
+    : public EventPublisher<SubscriptionContext, EventContext> {
+  DECLARE_PUBLISHER("TriggerPublisher");
+};
+
+class TriggerEventSubscriber : public EventSubscriber<TriggerEventPublisher> {
+ public:
+  TriggerEventSubscriber() {
+    setName("trigger_events");
+  }
+
+  Status testAdd() {
+    Row r;
+    r["value"] = "1";
+    return add(r, 0);
+  }
+};
+
+TEST_F(SchedulerTests, test_scheduler_triggers) {
+  auto pub = std::make_shared<TriggerEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto sub = std::make_shared<TriggerEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+
+  std::string config =
+      "{\"schedule\":{\"triggered\":{"
+      "\"query\":\"select * from time\", \"interval\":3600, "
+      "\"triggers\":[\"trigger_events\"]}}}";
+  Config::get().update({{"data", config}});
+
+  SchedulerRunner runner(0, 1);
+  auto now = getUnixTime() - 1;
+  runner.rebuild(now);
+  ASSERT_EQ(runner.timers_.count("triggered"), 1U);
+  auto& timer = runner.timers_.at("triggered");
+  ASSERT_EQ(timer.query.triggers.size(), 1U);
+  timer.deadline = now + 3600;
+  auto deadline = timer.deadline;
+
+  // Without events the query waits for its interval.
+  runner.trigger(now + 60);
+  EXPECT_EQ(timer.deadline, deadline);
+
+  // After an event, the query is due once the events settle.
+  ASSERT_TRUE(sub->testAdd().ok());
+  auto latest = sub->lastEventTime();
+  ASSERT_GT(latest, now);
+  runner.trigger(latest);
+  EXPECT_EQ(timer.deadline, deadline);
+  auto settled = latest + FLAGS_schedule_trigger_delay;
+  runner.trigger(settled);
+  EXPECT_EQ(timer.deadline, settled);
+  EXPECT_EQ(runner.deadlines_.top().first, settled);
+
+  // The same events trigger the query once.
+  timer.deadline = deadline;
+  runner.trigger(settled + 1);
+  EXPECT_EQ(timer.deadline, deadline);
+
+  EventFactory::deregisterEventSubscriber(sub->getName());
+  EventFactory::deregisterEventPublisher(pub->type());
+}
+
+TEST_F(SchedulerTests, test_sandbox_result) {
+  SandboxResult result;
+  result.status = Status(1, "no such table: missing");
+  result.rows = {{{"name", "a"}, {"value", "1"}}, {{"name", "b"}}};
+  result.user_time = 1500;
+  result.system_time = 20;
+
+  auto message = serializeSandboxResult(result);
+  SandboxResult copy;
+  ASSERT_TRUE(deserializeSandboxResult(message, copy));
+  EXPECT_EQ(copy.status.getCode(), 1);
+  EXPECT_EQ(copy.status.getMessage(), "no such table: missing");
+  EXPECT_EQ(copy.rows, result.rows);
+  EXPECT_EQ(copy.user_time, 1500U);
+  EXPECT_EQ(copy.system_time, 20U);
+
+  // A truncated result, from a sandbox that stopped, is rejected.
+  message.resize(message.size() - 1);
+  EXPECT_FALSE(deserializeSandboxResult(message, copy));
+
+  // Sandboxes are disabled by default, queries execute in the worker.
+  EXPECT_FALSE(SandboxPool::get().enabled());
+}
+
 TEST_F(SchedulerTests, test_scheduler_reload) {
   std::string config =
       "{\"schedule\":{\"1\":{"
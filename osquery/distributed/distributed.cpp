@@ -8,7 +8,12 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <thread>
 #include <utility>
 
 #include <osquery/database.h>
@@ -33,9 +38,24 @@ FLAG(bool,
      true,
      "Disable distributed queries (default true)");
 
+FLAG(uint64,
+     distributed_concurrency,
+     4,
+     "Number of distributed queries executed concurrently");
+
+FLAG(uint64,
+     distributed_query_timeout,
+     0,
+     "Seconds before a distributed query is interrupted (0 = no limit)");
+
+FLAG(uint64,
+     distributed_chunk_size,
+     0,
+     "Bytes of results written per distributed request (0 = unlimited)");
+
 const std::string kDistributedQueryPrefix{"distributed."};
 
-std::string Distributed::currentRequestId_{""};
+thread_local std::string Distributed::currentRequestId_{""};
 
 Status DistributedPlugin::call(const PluginRequest& request,
                                PluginResponse& response) {
@@ -123,30 +143,262 @@ Status Distributed::serializeResults(std::string& json) {
   return Status(0, "OK");
 }
 
+/// Calculate a size as the expected byte output of a row.
+static inline size_t getRowSize(const Row& r) {
+  size_t size = 0;
+  for (const auto& column : r) {
+    size += column.first.size();
+    size += column.second.size();
+  }
+  return size;
+}
+
+/// A span of rows from one result written within a chunk.
+struct ResultChunk {
+  const DistributedQueryResult* result{nullptr};
+  size_t begin{0};
+  size_t end{0};
+  bool split{false};
+};
+
+Status Distributed::serializeChunk(std::string& json,
+                                   size_t& completed,
+                                   size_t& offset) {
+  // Fill the chunk with rows from each result, at least one row is written.
+  std::vector<ResultChunk> chunks;
+  size_t size = 0;
+  completed = 0;
+  offset = 0;
+  for (const auto& result : results_) {
+    ResultChunk chunk;
+    chunk.result = &result;
+    chunk.begin = (chunks.empty()) ? chunk_offset_ : 0;
+    chunk.end = chunk.begin;
+    while (chunk.end < result.results.size() &&
+           (size < FLAGS_distributed_chunk_size || size == 0)) {
+      size += getRowSize(result.results[chunk.end++]);
+    }
+
+    chunk.split = (chunk.begin > 0 || chunk.end < result.results.size());
+    chunks.push_back(chunk);
+    if (chunk.end < result.results.size()) {
+      offset = chunk.end;
+      break;
+    }
+    completed++;
+    if (size >= FLAGS_distributed_chunk_size) {
+      break;
+    }
+  }
+
+  rj::StringBuffer sb;
+  rj::Writer<rj::StringBuffer> w(sb);
+  auto key = [&w](const std::string& s) {
+    w.Key(s.c_str(), static_cast<rj::SizeType>(s.size()));
+  };
+
+  w.StartObject();
+  w.Key("queries");
+  w.StartObject();
+  for (const auto& chunk : chunks) {
+    key(chunk.result->request.id);
+    w.StartArray();
+    for (auto i = chunk.begin; i < chunk.end; ++i) {
+      const auto& row = chunk.result->results[i];
+      if (chunk.result->columns.empty()) {
+        continue;
+      }
+
+      w.StartObject();
+      for (const auto& column : chunk.result->columns) {
+        auto value = row.find(column);
+        if (value == row.end()) {
+          return Status(1, "Missing column in distributed result: " + column);
+        }
+        key(column);
+        w.String(value->second.c_str(),
+                 static_cast<rj::SizeType>(value->second.size()));
+      }
+      w.EndObject();
+    }
+    w.EndArray();
+  }
+  w.EndObject();
+
+  w.Key("statuses");
+  w.StartObject();
+  for (const auto& chunk : chunks) {
+    if (chunk.end == chunk.result->results.size()) {
+      key(chunk.result->request.id);
+      w.Int(chunk.result->status.getCode());
+    }
+  }
+  w.EndObject();
+
+  w.Key("chunks");
+  w.StartObject();
+  for (const auto& chunk : chunks) {
+    if (chunk.split) {
+      key(chunk.result->request.id);
+      w.StartObject();
+      w.Key("sequence");
+      w.Uint64((chunk.begin > 0) ? chunk_sequence_ : 0);
+      w.Key("final");
+      w.Bool(chunk.end == chunk.result->results.size());
+      w.EndObject();
+    }
+  }
+  w.EndObject();
+  w.EndObject();
+
+  json.assign(sb.GetString(), sb.GetSize());
+  return Status(0, "OK");
+}
+
 void Distributed::addResult(const DistributedQueryResult& result) {
   results_.push_back(result);
 }
 
+/// A distributed query waiting for a worker.
+struct DistributedTask {
+  DistributedQueryRequest request;
+
+  /// The tables used by the query, queries sharing a table are not concurrent.
+  std::set<std::string> tables;
+
+  /// The query must execute alone, see isQueryExclusive.
+  bool exclusive{false};
+};
+
+DistributedQueryResult Distributed::runRequest(
+    const DistributedQueryRequest& request) {
+  LOG(INFO) << "Executing distributed query: " << request.id << ": "
+            << request.query;
+
+  // Keep track of the currently executing request
+  Distributed::setCurrentRequestId(request.id);
+  if (FLAGS_distributed_query_timeout > 0) {
+    setQueryDeadline(getUnixTime() + FLAGS_distributed_query_timeout);
+  }
+
+  SQL sql(request.query);
+  setQueryDeadline(0);
+  if (!sql.getStatus().ok()) {
+    LOG(ERROR) << "Error executing distributed query: " << request.id << ": "
+               << sql.getMessageString();
+  }
+
+  return DistributedQueryResult(
+      request, sql.rows(), sql.columns(), sql.getStatus());
+}
+
 Status Distributed::runQueries() {
-  while (getPendingQueryCount() > 0) {
-    auto request = popRequest();
-    LOG(INFO) << "Executing distributed query: " << request.id << ": "
-              << request.query;
-
-    // Keep track of the currently executing request
-    Distributed::setCurrentRequestId(request.id);
-
-    SQL sql(request.query);
-    if (!sql.getStatus().ok()) {
-      LOG(ERROR) << "Error executing distributed query: " << request.id << ": "
-                 << sql.getMessageString();
+  std::list<DistributedTask> pending;
+  while (true) {
+    DistributedTask task;
+    task.request = popRequest();
+    if (task.request.id.empty()) {
+      break;
+    }
+    task.exclusive = isQueryExclusive(task.request.query, task.tables);
+    pending.push_back(std::move(task));
+  }
+
+  // Workers take the first query that does not share a table with, or need
+  // to be alone with, the executing queries.
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::vector<DistributedQueryResult> completed;
+  std::set<std::string> tables;
+  size_t running = 0;
+  bool exclusive = false;
+  auto next = [&]() {
+    for (auto it = pending.begin(); it != pending.end(); ++it) {
+      if (exclusive || (it->exclusive && running > 0)) {
+        break;
+      }
+
+      bool shared = false;
+      for (const auto& table : it->tables) {
+        if (tables.count(table) > 0) {
+          shared = true;
+          break;
+        }
+      }
+      if (!shared) {
+        return it;
+      }
     }
+    return pending.end();
+  };
+
+  auto work = [&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      auto it = pending.end();
+      condition.wait(lock, [&]() {
+        it = next();
+        return pending.empty() || it != pending.end();
+      });
+      if (pending.empty()) {
+        return;
+      }
+
+      auto task = std::move(*it);
+      pending.erase(it);
+      tables.insert(task.tables.begin(), task.tables.end());
+      exclusive = task.exclusive;
+      running++;
+
+      lock.unlock();
+      auto result = runRequest(task.request);
+      lock.lock();
+
+      for (const auto& table : task.tables) {
+        tables.erase(table);
+      }
+      exclusive = false;
+      running--;
+      completed.push_back(std::move(result));
+      condition.notify_all();
+    }
+  };
 
-    DistributedQueryResult result(
-        request, sql.rows(), sql.columns(), sql.getStatus());
-    addResult(result);
+  auto size = std::min<size_t>(
+      std::max<size_t>(FLAGS_distributed_concurrency, 1), pending.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < size; ++i) {
+    workers.emplace_back(work);
+  }
+
+  // Flush the results as queries complete, those completing during a flush
+  // are sent with the next.
+  Status status;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      condition.wait(lock, [&]() {
+        return !completed.empty() || (pending.empty() && running == 0);
+      });
+      if (completed.empty()) {
+        break;
+      }
+
+      std::vector<DistributedQueryResult> results;
+      results.swap(completed);
+      lock.unlock();
+      for (auto& result : results) {
+        results_.push_back(std::move(result));
+      }
+      status = flushCompleted();
+      lock.lock();
+    }
   }
-  return flushCompleted();
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  return status;
 }
 
 Status Distributed::flushCompleted() {
@@ -159,20 +411,56 @@ Status Distributed::flushCompleted() {
     return Status(1, "Missing distributed plugin " + distributed_plugin);
   }
 
-  std::string results;
-  auto s = serializeResults(results);
-  if (!s.ok()) {
+  if (FLAGS_distributed_chunk_size == 0) {
+    std::string results;
+    auto s = serializeResults(results);
+    if (!s.ok()) {
+      return s;
+    }
+
+    PluginResponse response;
+    s = Registry::call("distributed",
+                       {{"action", "writeResults"}, {"results", results}},
+                       response);
+    if (s.ok()) {
+      results_.clear();
+    }
     return s;
   }
 
-  PluginResponse response;
-  s = Registry::call("distributed",
-                     {{"action", "writeResults"}, {"results", results}},
-                     response);
-  if (s.ok()) {
-    results_.clear();
+  while (!results_.empty()) {
+    std::string results;
+    size_t completed = 0;
+    size_t offset = 0;
+    auto s = serializeChunk(results, completed, offset);
+    if (!s.ok()) {
+      return s;
+    }
+
+    PluginResponse response;
+    s = Registry::call("distributed",
+                       {{"action", "writeResults"}, {"results", results}},
+                       response);
+    if (!s.ok()) {
+      // The chunk is written again, with the same sequence, by the next flush.
+      return s;
+    }
+
+    // Release the written results, and rows of a result split across chunks.
+    results_.erase(results_.begin(), results_.begin() + completed);
+    if (offset > 0) {
+      auto& rows = results_.front().results;
+      for (auto i = (completed > 0) ? 0 : chunk_offset_; i < offset; ++i) {
+        Row().swap(rows[i]);
+      }
+      chunk_sequence_ = (completed > 0) ? 1 : chunk_sequence_ + 1;
+      chunk_offset_ = offset;
+    } else {
+      chunk_sequence_ = 0;
+      chunk_offset_ = 0;
+    }
   }
-  return s;
+  return Status(0, "OK");
 }
 
 Status Distributed::acceptWork(const std::string& work) {
@@ -232,20 +520,49 @@ Status Distributed::acceptWork(const std::string& work) {
       LOG(WARNING) << "Failed to Accelerate: Timeframe is not an integer";
     }
   }
+
+  // The server may ask for a different interval between reads, 0 resets it.
+  if (d.HasMember("interval")) {
+    const auto& value = d["interval"];
+    unsigned long interval = 0;
+    Status conversion(1);
+    if (value.IsString()) {
+      conversion = safeStrtoul(value.GetString(), 10, interval);
+    } else if (value.IsUint()) {
+      interval = value.GetUint();
+      conversion = Status(0);
+    }
+
+    if (conversion.ok()) {
+      VLOG(1) << "Distributed read interval set to " << interval
+              << " seconds by the server";
+      setDatabaseValue(kPersistentSettings,
+                       "distributed_interval",
+                       std::to_string(interval));
+    } else {
+      LOG(WARNING) << "Distributed read interval is not an integer";
+    }
+  }
   return Status(0, "OK");
 }
 
 DistributedQueryRequest Distributed::popRequest() {
-  // Read all pending queries.
-  std::vector<std::string> queries;
-  scanDatabaseKeys(kQueries, queries, kDistributedQueryPrefix);
-
-  // Set the last-most-recent query as the request, and delete it.
+  // Read the first pending query, set it as the request, and delete it.
   DistributedQueryRequest request;
-  const auto& next = queries.front();
-  request.id = next.substr(kDistributedQueryPrefix.size());
-  getDatabaseValue(kQueries, next, request.query);
-  deleteDatabaseValue(kQueries, next);
+  std::string next;
+  scanDatabasePrefix(kQueries,
+                     kDistributedQueryPrefix,
+                     [&request, &next](const std::string& key,
+                                       const std::string& value) {
+                       next = key;
+                       request.id = key.substr(kDistributedQueryPrefix.size());
+                       request.query = value;
+                       return false;
+                     },
+                     1);
+  if (!next.empty()) {
+    deleteDatabaseValue(kQueries, next);
+  }
   return request;
 }
 
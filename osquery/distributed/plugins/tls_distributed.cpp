@@ -13,8 +13,7 @@
 #include "osquery/remote/transports/tls.h"
 // clang-format on
 
-#include <vector>
-#include <sstream>
+#include <string>
 
 #include <boost/property_tree/ptree.hpp>
 
@@ -28,10 +27,15 @@
 #include "osquery/remote/utility.h"
 
 namespace pt = boost::property_tree;
+namespace rj = rapidjson;
 
 namespace osquery {
 
 DECLARE_bool(tls_node_api);
+DECLARE_uint64(distributed_long_poll);
+
+/// Seconds to wait for a long-poll response beyond the time the server holds.
+const size_t kLongPollTimeoutMargin = 15;
 
 FLAG(string,
      distributed_tls_read_endpoint,
@@ -48,6 +52,71 @@ FLAG(uint64,
      3,
      "Number of times to attempt a request")
 
+FLAG(bool,
+     distributed_tls_compress,
+     false,
+     "Compress TLS/HTTPS distributed query results, see tls_compression");
+
+/// A rapidjson output stream appending blocks to a request body.
+class RequestBodyStream : private boost::noncopyable {
+ public:
+  typedef char Ch;
+
+  explicit RequestBodyStream(RequestBody& body) : body_(body) {}
+
+  void Put(char c) {
+    buffer_.push_back(c);
+    if (buffer_.size() >= kBlockSize) {
+      Flush();
+    }
+  }
+
+  void Flush() {
+    body_.append(buffer_);
+    buffer_.clear();
+  }
+
+ private:
+  static const size_t kBlockSize = 16384;
+
+  RequestBody& body_;
+
+  std::string buffer_;
+};
+
+/**
+ * @brief Rewrite distributed results into a request body, adding a node_key.
+ *
+ * The results are rewritten as they are parsed, numbers keep their text.
+ */
+class ResultsWriter : public rj::Writer<RequestBodyStream> {
+ public:
+  ResultsWriter(RequestBodyStream& stream, const std::string& node_key)
+      : rj::Writer<RequestBodyStream>(stream), node_key_(node_key) {}
+
+  bool StartObject() {
+    if (!rj::Writer<RequestBodyStream>::StartObject()) {
+      return false;
+    }
+
+    // Only the top-level object is identified with the node_key.
+    if (root_) {
+      root_ = false;
+      if (!node_key_.empty()) {
+        return Key("node_key", 8) &&
+               String(node_key_.c_str(),
+                      static_cast<rj::SizeType>(node_key_.size()));
+      }
+    }
+    return true;
+  }
+
+ private:
+  std::string node_key_;
+
+  bool root_{true};
+};
+
 class TLSDistributedPlugin : public DistributedPlugin {
  public:
   Status setUp() override;
@@ -72,22 +141,57 @@ Status TLSDistributedPlugin::setUp() {
 Status TLSDistributedPlugin::getQueries(std::string& json) {
   pt::ptree params;
   params.put("_verb", "POST");
+  if (FLAGS_distributed_long_poll > 0) {
+    // The server may hold the read until queries are available.
+    params.put("wait", FLAGS_distributed_long_poll);
+    params.put("_timeout",
+               FLAGS_distributed_long_poll + kLongPollTimeoutMargin);
+  }
   return TLSRequestHelper::go<JSONSerializer>(
       read_uri_, params, json, FLAGS_distributed_tls_max_attempts);
 }
 
 Status TLSDistributedPlugin::writeResults(const std::string& json) {
-  pt::ptree params;
-  try {
-    std::stringstream ss(json);
-    pt::read_json(ss, params);
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error parsing JSON: " + std::string(e.what()));
+  auto start = json.find_first_not_of(" \t\r\n");
+  if (start == std::string::npos || json[start] != '{') {
+    return Status(1, "Error parsing JSON: Results are not an object");
+  }
+
+  // Stream the results into the, optionally compressed, request body.
+  // The node_key is included in the URI when using the node API.
+  // Chunked results, see distributed_chunk_size, are written one per request
+  // and their "chunks" object is passed to the server unchanged.
+  RequestBody body(FLAGS_distributed_tls_compress ? FLAGS_tls_compression
+                                                  : "");
+  {
+    RequestBodyStream output(body);
+    ResultsWriter writer(output,
+                         (FLAGS_tls_node_api) ? "" : getNodeKey("tls"));
+    rj::Reader reader;
+    rj::StringStream input(json.c_str());
+    auto result = reader.Parse<rj::kParseNumbersAsStringsFlag>(input, writer);
+    if (result.IsError()) {
+      return Status(1,
+                    "Error parsing JSON: " +
+                        std::string(rj::GetParseError_En(result.Code())));
+    }
+    output.Flush();
+  }
+
+  std::string serialized;
+  std::string encoding;
+  auto s = body.finish(serialized, encoding);
+  if (!s.ok()) {
+    return s;
   }
 
   // The response is ignored.
-  std::string response;
+  pt::ptree response;
   return TLSRequestHelper::go<JSONSerializer>(
-      write_uri_, params, response, FLAGS_distributed_tls_max_attempts);
+      write_uri_,
+      serialized,
+      encoding,
+      response,
+      FLAGS_distributed_tls_max_attempts);
 }
 }
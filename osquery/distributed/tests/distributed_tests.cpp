@@ -30,6 +30,7 @@
 #undef GetObject
 
 namespace pt = boost::property_tree;
+namespace rj = rapidjson;
 
 DECLARE_string(distributed_tls_read_endpoint);
 DECLARE_string(distributed_tls_write_endpoint);
@@ -216,4 +217,59 @@ TEST_F(DistributedTests, test_workflow) {
   EXPECT_EQ(dist.getPendingQueryCount(), 0U);
   EXPECT_EQ(dist.results_.size(), 0U);
 }
+
+TEST_F(DistributedTests, test_chunked_results) {
+  auto chunk_size = Flag::getValue("distributed_chunk_size");
+  Flag::updateValue("distributed_chunk_size", "8");
+
+  auto dist = Distributed();
+  DistributedQueryResult first;
+  first.request.id = "first";
+  first.columns = {"a"};
+  first.results = {{{"a", "123"}}, {{"a", "456"}}, {{"a", "789"}}};
+  dist.results_.push_back(first);
+
+  DistributedQueryResult second;
+  second.request.id = "second";
+  second.columns = {"a"};
+  second.results = {{{"a", "0"}}};
+  dist.results_.push_back(second);
+
+  // The first chunk holds two rows of the first result, about 8 bytes.
+  std::string json;
+  size_t completed = 0;
+  size_t offset = 0;
+  auto s = dist.serializeChunk(json, completed, offset);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(completed, 0U);
+  EXPECT_EQ(offset, 2U);
+
+  rj::Document d;
+  d.Parse(json.c_str());
+  ASSERT_FALSE(d.HasParseError());
+  EXPECT_EQ(d["queries"]["first"].Size(), 2U);
+  EXPECT_FALSE(d["statuses"].HasMember("first"));
+  EXPECT_EQ(d["chunks"]["first"]["sequence"].GetUint64(), 0U);
+  EXPECT_FALSE(d["chunks"]["first"]["final"].GetBool());
+
+  // Resume with the final chunk of the first result and all of the second.
+  dist.chunk_offset_ = offset;
+  dist.chunk_sequence_ = 1;
+  s = dist.serializeChunk(json, completed, offset);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(completed, 2U);
+  EXPECT_EQ(offset, 0U);
+
+  d.Parse(json.c_str());
+  ASSERT_FALSE(d.HasParseError());
+  EXPECT_EQ(d["queries"]["first"].Size(), 1U);
+  EXPECT_EQ(std::string(d["queries"]["first"][0]["a"].GetString()), "789");
+  EXPECT_EQ(d["queries"]["second"].Size(), 1U);
+  EXPECT_EQ(d["statuses"]["first"].GetInt(), 0);
+  EXPECT_EQ(d["chunks"]["first"]["sequence"].GetUint64(), 1U);
+  EXPECT_TRUE(d["chunks"]["first"]["final"].GetBool());
+  EXPECT_FALSE(d["chunks"].HasMember("second"));
+
+  Flag::updateValue("distributed_chunk_size", chunk_size);
+}
 }
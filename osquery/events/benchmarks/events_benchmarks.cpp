@@ -70,7 +70,7 @@ class BenchmarkEventSubscriber
     auto et = expire_time_;
     expire_events_ = true;
     expire_time_ = -1;
-    getIndexes(0, 0);
+    expireEvents();
     expire_events_ = ee;
     expire_time_ = et;
   }
@@ -171,6 +171,88 @@ BENCHMARK(EVENTS_gentable)
     ->ArgPair(0, 1000)
     ->ArgPair(0, 10000);
 
+/// A row similar to an audit-based process event.
+static Row getBenchmarkEventRow() {
+  Row r;
+  r["pid"] = "12345";
+  r["path"] = "/usr/bin/example";
+  r["mode"] = "0100755";
+  r["cmdline"] = "/usr/bin/example --flag value --other-flag other-value";
+  r["cwd"] = "/home/user";
+  r["auid"] = "1000";
+  r["uid"] = "1000";
+  r["euid"] = "1000";
+  r["gid"] = "1000";
+  r["egid"] = "1000";
+  r["parent"] = "1234";
+  r["time"] = "1500000000";
+  r["uptime"] = "123456";
+  r["eid"] = "0000012345";
+  return r;
+}
+
+static EventRowCodec& getBenchmarkEventCodec() {
+  static EventRowCodec codec({"pid",
+                              "path",
+                              "mode",
+                              "cmdline",
+                              "cwd",
+                              "auid",
+                              "uid",
+                              "euid",
+                              "gid",
+                              "egid",
+                              "parent",
+                              "time",
+                              "uptime",
+                              "eid"});
+  return codec;
+}
+
+static void EVENTS_serialize_json(benchmark::State& state) {
+  auto r = getBenchmarkEventRow();
+  while (state.KeepRunning()) {
+    std::string data;
+    serializeRowJSON(r, data);
+  }
+}
+
+BENCHMARK(EVENTS_serialize_json);
+
+static void EVENTS_serialize_codec(benchmark::State& state) {
+  auto r = getBenchmarkEventRow();
+  const auto& codec = getBenchmarkEventCodec();
+  while (state.KeepRunning()) {
+    std::string data;
+    codec.encode(r, data);
+  }
+}
+
+BENCHMARK(EVENTS_serialize_codec);
+
+static void EVENTS_deserialize_json(benchmark::State& state) {
+  std::string data;
+  serializeRowJSON(getBenchmarkEventRow(), data);
+  while (state.KeepRunning()) {
+    Row r;
+    deserializeRowJSON(data, r);
+  }
+}
+
+BENCHMARK(EVENTS_deserialize_json);
+
+static void EVENTS_deserialize_codec(benchmark::State& state) {
+  const auto& codec = getBenchmarkEventCodec();
+  std::string data;
+  codec.encode(getBenchmarkEventRow(), data);
+  while (state.KeepRunning()) {
+    Row r;
+    codec.decode(data, r);
+  }
+}
+
+BENCHMARK(EVENTS_deserialize_codec);
+
 static void EVENTS_add_and_gentable(benchmark::State& state) {
   auto sub = std::make_shared<BenchmarkEventSubscriber>();
 
@@ -0,0 +1,154 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/// An event is released after being held for this many windows.
+const size_t kCoalesceMaxWindows = 10;
+
+/// Events are fired as they arrive once this many are held.
+const size_t kCoalesceMaxEvents = 16384;
+
+/**
+ * @brief Merge bursts of events for the same path and action.
+ *
+ * A publisher holds events that may be merged, such as repeated writes to a
+ * file, and releases a single event with the number of merged events once no
+ * event with the same path, action, and subscription has been added for the
+ * window. Subscribers that hash or stat the file then read it once, after it
+ * is quiet. An event written to continuously is released after
+ * kCoalesceMaxWindows.
+ *
+ * The coalescer is not thread safe, events are added and released by the
+ * publisher's run loop.
+ */
+template <typename EC>
+class EventCoalescer : private boost::noncopyable {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using ECRef = std::shared_ptr<EC>;
+
+  /// Called with each released event and the number of events merged.
+  using Release = std::function<void(const ECRef&, size_t)>;
+
+ public:
+  /**
+   * @brief Hold an event, or merge it into a held event.
+   *
+   * @param owner The subscription, events are only merged within one.
+   * @return false if the event was not held and should be fired.
+   */
+  bool add(const std::string& path,
+           const std::string& action,
+           const void* owner,
+           const ECRef& ec,
+           Clock::time_point now = Clock::now()) {
+    auto key = path + '\0' + action + '\0' +
+               std::to_string(reinterpret_cast<uintptr_t>(owner));
+    auto entry = entries_.find(key);
+    if (entry == entries_.end()) {
+      if (entries_.size() >= kCoalesceMaxEvents) {
+        return false;
+      }
+      entry = entries_.emplace(key, Entry{ec, 0, now, now}).first;
+    }
+    entry->second.count++;
+    entry->second.last = now;
+    return true;
+  }
+
+  /**
+   * @brief Release the held events for a path.
+   *
+   * Events that cannot be merged, such as a deletion, are fired after the
+   * held events for their path to keep each path's events in order.
+   */
+  void release(const std::string& path, const Release& fn) {
+    auto prefix = path + '\0';
+    std::vector<Entry> released;
+    auto it = entries_.lower_bound(prefix);
+    while (it != entries_.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0) {
+      released.push_back(std::move(it->second));
+      it = entries_.erase(it);
+    }
+    emit(released, fn);
+  }
+
+  /// Release the events that are quiet for the window, or held too long.
+  void flush(std::chrono::milliseconds window,
+             const Release& fn,
+             Clock::time_point now = Clock::now()) {
+    std::vector<Entry> released;
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      if (now - it->second.last >= window ||
+          now - it->second.first >= window * kCoalesceMaxWindows) {
+        released.push_back(std::move(it->second));
+        it = entries_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    emit(released, fn);
+  }
+
+  /// Drop the held events.
+  void clear() {
+    entries_.clear();
+  }
+
+  bool empty() const {
+    return entries_.empty();
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+ private:
+  struct Entry {
+    /// The first event merged.
+    ECRef ec;
+    size_t count;
+    Clock::time_point first;
+    Clock::time_point last;
+  };
+
+  /// Fire released events in the order they were first seen.
+  void emit(std::vector<Entry>& released, const Release& fn) {
+    std::stable_sort(released.begin(),
+                     released.end(),
+                     [](const Entry& l, const Entry& r) {
+                       return l.first < r.first;
+                     });
+    for (const auto& entry : released) {
+      fn(entry.ec, entry.count);
+    }
+  }
+
+ private:
+  /// Held events by path, action, and owner.
+  std::map<std::string, Entry> entries_;
+};
+} // namespace osquery
@@ -20,6 +20,7 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/events/darwin/diskarbitration.h"
+#include "osquery/events/darwin/dispatch_queue.h"
 
 namespace fs = boost::filesystem;
 namespace errc = boost::system::errc;
@@ -30,11 +31,23 @@ const std::string kIOHIDXClassPath{"IOService:/IOResources/IOHDIXController/"};
 
 REGISTER(DiskArbitrationEventPublisher, "event_publisher", "diskarbitration");
 
+void DiskArbitrationEventPublisher::configure() {
+  if (!hasStarted()) {
+    return;
+  }
+
+  // The session is created once, its callbacks do not depend on subscriptions.
+  syncDarwinEventQueue([this]() {
+    if (session_ == nullptr) {
+      restart();
+    }
+  });
+}
+
 void DiskArbitrationEventPublisher::restart() {
   stop();
 
   WriteLock lock(mutex_);
-  run_loop_ = CFRunLoopGetCurrent();
   session_ = DASessionCreate(kCFAllocatorDefault);
   DARegisterDiskAppearedCallback(
       session_,
@@ -47,29 +60,20 @@ void DiskArbitrationEventPublisher::restart() {
       DiskArbitrationEventPublisher::DiskDisappearedCallback,
       nullptr);
 
-  DASessionScheduleWithRunLoop(session_, run_loop_, kCFRunLoopDefaultMode);
-}
-
-Status DiskArbitrationEventPublisher::run() {
-  restart();
-  CFRunLoopRun();
-  return Status(0, "OK");
+  // Deliver the session's callbacks on the shared event queue.
+  DASessionSetDispatchQueue(session_, getDarwinEventQueue());
 }
 
 void DiskArbitrationEventPublisher::stop() {
-  WriteLock lock(mutex_);
-
-  if (run_loop_ == nullptr) {
-    return;
-  }
-
-  if (session_ != nullptr) {
-    DASessionUnscheduleFromRunLoop(session_, run_loop_, kCFRunLoopDefaultMode);
-    CFRelease(session_);
-    session_ = nullptr;
-  }
-  CFRunLoopStop(run_loop_);
-  run_loop_ = nullptr;
+  // Release the session between callbacks.
+  syncDarwinEventQueue([this]() {
+    WriteLock lock(mutex_);
+    if (session_ != nullptr) {
+      DASessionSetDispatchQueue(session_, nullptr);
+      CFRelease(session_);
+      session_ = nullptr;
+    }
+  });
 }
 
 void DiskArbitrationEventPublisher::tearDown() {
@@ -59,14 +59,17 @@ class DiskArbitrationEventPublisher
   DECLARE_PUBLISHER("diskarbitration");
 
  public:
-  void configure() override {}
+  void configure() override;
 
   void tearDown() override;
 
   bool shouldFire(const DiskArbitrationSubscriptionContextRef& sc,
                   const DiskArbitrationEventContextRef& ec) const override;
 
-  Status run() override;
+  /// Callbacks are delivered on the shared darwin event queue.
+  bool usesThread() const override {
+    return false;
+  }
 
   static void DiskAppearedCallback(DADiskRef disk, void* context);
 
@@ -90,9 +93,6 @@ class DiskArbitrationEventPublisher
   /// Disk arbitration session.
   DASessionRef session_{nullptr};
 
-  /// Publisher's run loop.
-  CFRunLoopRef run_loop_{nullptr};
-
   mutable Mutex mutex_;
 };
 }
@@ -0,0 +1,42 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include "osquery/events/darwin/dispatch_queue.h"
+
+namespace osquery {
+
+/// The queue's specific value, set to identify calls from the queue.
+static char kDarwinEventQueueKey;
+
+dispatch_queue_t getDarwinEventQueue() {
+  static dispatch_queue_t queue = ([]() {
+    auto attributes = dispatch_queue_attr_make_with_qos_class(
+        DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0);
+    auto created = dispatch_queue_create("osquery.events", attributes);
+    dispatch_queue_set_specific(
+        created, &kDarwinEventQueueKey, &kDarwinEventQueueKey, nullptr);
+    return created;
+  })();
+  return queue;
+}
+
+void syncDarwinEventQueue(const std::function<void()>& func) {
+  if (dispatch_get_specific(&kDarwinEventQueueKey) != nullptr) {
+    func();
+    return;
+  }
+
+  dispatch_sync_f(getDarwinEventQueue(),
+                  const_cast<std::function<void()>*>(&func),
+                  [](void* context) {
+                    (*static_cast<std::function<void()>*>(context))();
+                  });
+}
+}
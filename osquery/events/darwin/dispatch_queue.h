@@ -0,0 +1,37 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <functional>
+
+#include <dispatch/dispatch.h>
+
+namespace osquery {
+
+/**
+ * @brief The serial dispatch queue shared by darwin event publishers.
+ *
+ * FSEvents streams, IOKit notification ports and DiskArbitration sessions
+ * deliver their callbacks on this queue instead of a CFRunLoop within a thread
+ * of each publisher. The queue runs at utility QoS and only occupies a
+ * libdispatch worker while callbacks are pending.
+ */
+dispatch_queue_t getDarwinEventQueue();
+
+/**
+ * @brief Call a function on the darwin event queue and wait for it.
+ *
+ * Publishers create and remove their OS callbacks this way, such that none of
+ * their callbacks run during, or after, a removal. When called from the queue
+ * the function is called immediately.
+ */
+void syncDarwinEventQueue(const std::function<void()>& func);
+}
@@ -14,9 +14,12 @@
 
 #include <osquery/config.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/events/coalescer.h"
+#include "osquery/events/darwin/dispatch_queue.h"
 #include "osquery/events/darwin/fsevents.h"
 
 /**
@@ -32,6 +35,13 @@ namespace fs = boost::filesystem;
 
 namespace osquery {
 
+FLAG(uint64,
+     fsevents_latency,
+     1000,
+     "Milliseconds the FSEvents stream batches events before delivery");
+
+DECLARE_uint64(file_events_coalesce_window);
+
 std::map<FSEventStreamEventFlags, std::string> kMaskActions = {
     {kFSEventStreamEventFlagItemChangeOwner, "ATTRIBUTES_MODIFIED"},
     {kFSEventStreamEventFlagItemXattrMod, "ATTRIBUTES_MODIFIED"},
@@ -57,19 +67,21 @@ void FSEventsSubscriptionContext::requireAction(const std::string& action) {
 }
 
 void FSEventsEventPublisher::restart() {
+  if (!hasStarted()) {
+    // The stream is created once the publisher is started.
+    return;
+  }
+
+  // The stream is replaced on the event queue, between callbacks.
+  syncDarwinEventQueue([this]() { restartStream(); });
+}
+
+void FSEventsEventPublisher::restartStream() {
   // Remove any existing stream.
-  stop();
+  stopStream();
 
   // Build paths as CFStrings
   WriteLock lock(mutex_);
-  if (run_loop_ == nullptr) {
-    return;
-  }
-
-  if (paths_.empty()) {
-    // There are no paths to watch.
-    paths_.insert("/dev/null");
-  }
 
   std::vector<CFStringRef> cf_paths;
   for (const auto& path : paths_) {
@@ -94,17 +106,34 @@ void FSEventsEventPublisher::restart() {
     flags |= kFSEventStreamCreateFlagIgnoreSelf;
   }
 
+  // The stream delivers a batch of events once per latency, bursts within a
+  // batch are merged by the callback.
+  CFTimeInterval latency = FLAGS_fsevents_latency / 1000.0;
+  if (FLAGS_file_events_coalesce_window > 0) {
+    latency = FLAGS_file_events_coalesce_window / 1000.0;
+  }
+
+  // A replaced stream resumes after the last event delivered by the previous
+  // stream, events that occurred while the streams were swapped are replayed.
+  auto since = kFSEventStreamEventIdSinceNow;
+  if (last_event_id_ != 0) {
+    since = last_event_id_;
+  }
+
+  // The callback receives the publisher, to check exclusions once per event.
+  FSEventStreamContext context = {0, this, nullptr, nullptr, nullptr};
+
   // Create the FSEvent stream.
   stream_ = FSEventStreamCreate(nullptr,
                                 &FSEventsEventPublisher::Callback,
-                                nullptr,
+                                &context,
                                 watch_list,
-                                kFSEventStreamEventIdSinceNow,
-                                1,
+                                since,
+                                latency,
                                 flags);
   if (stream_ != nullptr) {
-    // Schedule the stream on the run loop.
-    FSEventStreamScheduleWithRunLoop(stream_, run_loop_, kCFRunLoopDefaultMode);
+    // Deliver the stream's events on the shared event queue.
+    FSEventStreamSetDispatchQueue(stream_, getDarwinEventQueue());
     if (FSEventStreamStart(stream_)) {
       stream_started_ = true;
     } else {
@@ -122,33 +151,26 @@ void FSEventsEventPublisher::restart() {
 }
 
 void FSEventsEventPublisher::stop() {
-  // Stop the stream.
-  WriteLock lock(mutex_);
-  if (run_loop_ == nullptr) {
-    // No need to stop if there is not run loop.
-    return;
-  }
+  syncDarwinEventQueue([this]() { stopStream(); });
+}
 
+void FSEventsEventPublisher::stopStream() {
+  WriteLock lock(mutex_);
   if (stream_ != nullptr) {
+    auto last_event_id = FSEventStreamGetLatestEventId(stream_);
+    if (last_event_id != 0 && last_event_id != kFSEventStreamEventIdSinceNow) {
+      last_event_id_ = last_event_id;
+    }
     FSEventStreamStop(stream_);
     stream_started_ = false;
-    FSEventStreamUnscheduleFromRunLoop(
-        stream_, run_loop_, kCFRunLoopDefaultMode);
     FSEventStreamInvalidate(stream_);
     FSEventStreamRelease(stream_);
     stream_ = nullptr;
   }
-
-  // Stop the run loop.
-  CFRunLoopStop(run_loop_);
 }
 
 void FSEventsEventPublisher::tearDown() {
   stop();
-
-  // Do not keep a reference to the run loop.
-  WriteLock lock(mutex_);
-  run_loop_ = nullptr;
 }
 
 std::set<std::string> FSEventsEventPublisher::transformSubscription(
@@ -205,46 +227,34 @@ void FSEventsEventPublisher::buildExcludePathsSet() {
 }
 
 void FSEventsEventPublisher::configure() {
-  // Rebuild the watch paths.
-  stop();
-
   buildExcludePathsSet();
 
-  {
-    WriteLock lock(mutex_);
-    paths_.clear();
-    for (auto& sub : subscriptions_) {
-      auto sc = getSubscriptionContext(sub->context);
-      if (sc->discovered_.size() > 0) {
-        continue;
-      }
-      auto paths = transformSubscription(sc);
-      paths_.insert(paths.begin(), paths.end());
+  // Rebuild the watch paths, subscriptions are only transformed once.
+  std::set<std::string> paths;
+  for (auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->discovered_.empty()) {
+      sc->watched_ = transformSubscription(sc);
     }
+    paths.insert(sc->watched_.begin(), sc->watched_.end());
   }
 
-  restart();
-}
+  if (paths.empty()) {
+    // There are no paths to watch.
+    paths.insert("/dev/null");
+  }
 
-Status FSEventsEventPublisher::run() {
-  // The run entrypoint executes in a dedicated thread.
-  bool needs_reset = false;
   {
     WriteLock lock(mutex_);
-    if (run_loop_ == nullptr) {
-      needs_reset = true;
-      run_loop_ = CFRunLoopGetCurrent();
+    if (paths == paths_ && stream_ != nullptr) {
+      // The running stream already watches every path, only the exclusions
+      // and subscriptions changed.
+      return;
     }
+    paths_ = std::move(paths);
   }
 
-  // Restart the stream creation.
-  if (needs_reset) {
-    restart();
-  }
-
-  // Start the run loop, it may be removed with a tearDown.
-  CFRunLoopRun();
-  return Status(0, "OK");
+  restart();
 }
 
 void FSEventsEventPublisher::Callback(
@@ -254,6 +264,13 @@ void FSEventsEventPublisher::Callback(
     void* event_paths,
     const FSEventStreamEventFlags fsevent_flags[],
     const FSEventStreamEventId fsevent_ids[]) {
+  auto* publisher = static_cast<FSEventsEventPublisher*>(callback_info);
+  EventCoalescer<FSEventsEventContext> coalescer;
+  auto release = ([](const FSEventsEventContextRef& held, size_t count) {
+    held->count = count;
+    EventFactory::fire<FSEventsEventPublisher>(held);
+  });
+
   for (size_t i = 0; i < num_events; ++i) {
     auto ec = createEventContext();
     ec->fsevent_stream = stream;
@@ -261,6 +278,16 @@ void FSEventsEventPublisher::Callback(
     ec->transaction_id = fsevent_ids[i];
     ec->path = std::string(((char**)event_paths)[i]);
 
+    if (ec->fsevent_flags & kFSEventStreamEventFlagHistoryDone) {
+      // A resumed stream finished replaying the events since its start.
+      continue;
+    }
+
+    if (publisher != nullptr && publisher->isExcluded(ec->path)) {
+      // Excluded paths are dropped before matching any subscription.
+      continue;
+    }
+
     if (ec->fsevent_flags & kFSEventStreamEventFlagMustScanSubDirs) {
       // The FSEvents thread coalesced events within and will report a root.
       TLOG << "FSEvents collision, root: " << ec->path;
@@ -289,25 +316,41 @@ void FSEventsEventPublisher::Callback(
       if (ec->fsevent_flags & action.first) {
         // Actions may be multiplexed. Fire and event for each.
         ec->action = action.second;
-        EventFactory::fire<FSEventsEventPublisher>(ec);
         has_action = true;
+        if (FLAGS_file_events_coalesce_window == 0) {
+          EventFactory::fire<FSEventsEventPublisher>(ec);
+          continue;
+        }
+
+        // Merge repeated modifications of a path within the batch.
+        auto action_ec = std::make_shared<FSEventsEventContext>(*ec);
+        if ((action.second == "UPDATED" ||
+             action.second == "ATTRIBUTES_MODIFIED") &&
+            coalescer.add(ec->path, action.second, nullptr, action_ec)) {
+          continue;
+        }
+        coalescer.release(ec->path, release);
+        EventFactory::fire<FSEventsEventPublisher>(action_ec);
       }
     }
 
     if (!has_action) {
       // If no action was matched for this path event, fire and unknown.
       ec->action = "UNKNOWN";
+      coalescer.release(ec->path, release);
       EventFactory::fire<FSEventsEventPublisher>(ec);
     }
   }
+
+  // The stream latency is the window, release every merged event.
+  coalescer.flush(std::chrono::milliseconds(0), release);
 }
 
 bool FSEventsEventPublisher::shouldFire(
     const FSEventsSubscriptionContextRef& sc,
     const FSEventsEventContextRef& ec) const {
   if (sc->recursive && !sc->recursive_match) {
-    ssize_t found = ec->path.find(sc->path);
-    if (found != 0) {
+    if (ec->path.compare(0, sc->path.size(), sc->path) != 0) {
       return false;
     }
   } else if (fnmatch((sc->path + "*").c_str(),
@@ -324,15 +367,16 @@ bool FSEventsEventPublisher::shouldFire(
     return false;
   }
 
-  auto path = ec->path.substr(0, ec->path.rfind('/'));
-  // Need to have two finds,
-  // what if somebody excluded an individual file inside a directory
-  if (!exclude_paths_.empty() &&
-      (exclude_paths_.find(path) || exclude_paths_.find(ec->path))) {
+  return !isExcluded(ec->path);
+}
+
+bool FSEventsEventPublisher::isExcluded(const std::string& path) const {
+  if (exclude_paths_.empty()) {
     return false;
   }
 
-  return true;
+  // An individual file inside a directory may be excluded.
+  return exclude_paths_.findSelfOrParent(path);
 }
 
 void FSEventsEventPublisher::flush(bool async) {
@@ -351,10 +395,6 @@ size_t FSEventsEventPublisher::numSubscriptionedPaths() const {
 
 bool FSEventsEventPublisher::isStreamRunning() const {
   WriteLock lock(mutex_);
-  if (stream_ == nullptr || !stream_started_ || run_loop_ == nullptr) {
-    return false;
-  }
-
-  return CFRunLoopIsWaiting(run_loop_);
+  return stream_ != nullptr && stream_started_;
 }
 }
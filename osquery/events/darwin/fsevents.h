@@ -61,6 +61,9 @@ struct FSEventsSubscriptionContext : public SubscriptionContext {
   /// A configure-time pattern was expanded to match absolute paths.
   bool recursive_match{false};
 
+  /// The paths watched for this subscription, kept across reconfigures.
+  std::set<std::string> watched_;
+
  private:
   friend class FSEventsEventPublisher;
 };
@@ -73,6 +76,9 @@ struct FSEventsEventContext : public EventContext {
 
   std::string path;
   std::string action;
+
+  /// The number of events merged into this event.
+  size_t count{1};
 };
 
 using FSEventsEventContextRef = std::shared_ptr<FSEventsEventContext>;
@@ -99,8 +105,10 @@ class FSEventsEventPublisher
   /// Another alias for `::end` or `::stop`.
   void tearDown() override;
 
-  /// Entrypoint to the run loop
-  Status run() override;
+  /// The stream delivers events on the shared darwin event queue.
+  bool usesThread() const override {
+    return false;
+  }
 
  public:
   /// FSEvents registers a client callback instead of using a select/poll loop.
@@ -115,13 +123,22 @@ class FSEventsEventPublisher
   bool shouldFire(const FSEventsSubscriptionContextRef& sc,
                   const FSEventsEventContextRef& ec) const override;
 
+  /// Check if events for a path are not to be propagated.
+  bool isExcluded(const std::string& path) const;
+
  private:
-  /// Restart the run loop.
+  /// Replace the stream, once the publisher has started.
   void restart();
 
-  /// Stop the stream and the run loop.
+  /// Stop the stream.
   void stop() override;
 
+  /// Replace the stream, called on the darwin event queue.
+  void restartStream();
+
+  /// Stop the stream, called on the darwin event queue.
+  void stopStream();
+
   /// Cause the FSEvents to flush kernel-buffered events.
   void flush(bool async = false);
 
@@ -143,7 +160,7 @@ class FSEventsEventPublisher
   void buildExcludePathsSet();
 
  private:
-  /// Check if the stream (and run loop) are running.
+  /// Check if the stream is running.
   bool isStreamRunning() const;
 
   /// Count the number of subscriptioned paths.
@@ -153,7 +170,7 @@ class FSEventsEventPublisher
   /// Local reference to the start, stop, restart event stream.
   FSEventStreamRef stream_{nullptr};
 
-  /// Has the FSEvents run loop and stream been started.
+  /// Has the FSEvents stream been started.
   std::atomic<bool> stream_started_{false};
 
   /// Set of paths to monitor, determined by a configure step.
@@ -162,8 +179,8 @@ class FSEventsEventPublisher
   /// Events pertaining to these paths not to be propagated.
   ExcludePathSet exclude_paths_;
 
-  /// Reference to the run loop for this thread.
-  CFRunLoopRef run_loop_{nullptr};
+  /// The last event delivered by a stopped stream, a restart resumes here.
+  FSEventStreamEventId last_event_id_{0};
 
  private:
   /// For testing only, ask the event stream to publish events immediately.
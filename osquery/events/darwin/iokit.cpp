@@ -14,6 +14,7 @@
 #include <IOKit/IOMessage.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/events/darwin/dispatch_queue.h"
 #include "osquery/events/darwin/iokit.h"
 
 namespace osquery {
@@ -118,19 +119,14 @@ void IOKitEventPublisher::restart() {
       &kIOPlatformDeviceClassname_,
   };
 
-  if (run_loop_ == nullptr) {
-    return;
-  }
-
-  // Remove any existing stream.
+  // Remove any existing notification port.
   stop();
 
   {
     WriteLock lock(mutex_);
     port_ = IONotificationPortCreate(kIOMasterPortDefault);
-    // Get a run loop source from the created IOKit notification port.
-    auto run_loop_source = IONotificationPortGetRunLoopSource(port_);
-    CFRunLoopAddSource(run_loop_, run_loop_source, kCFRunLoopDefaultMode);
+    // Deliver the port's notifications on the shared event queue.
+    IONotificationPortSetDispatchQueue(port_, getDarwinEventQueue());
   }
 
   publisher_started_ = false;
@@ -275,17 +271,18 @@ void IOKitEventPublisher::deviceDetach(void* refcon,
   }
 }
 
-Status IOKitEventPublisher::run() {
-  // The run entrypoint executes in a dedicated thread.
-  if (run_loop_ == nullptr) {
-    run_loop_ = CFRunLoopGetCurrent();
-    // Restart the stream creation.
-    restart();
+void IOKitEventPublisher::configure() {
+  if (!hasStarted()) {
+    return;
   }
 
-  // Start the run loop, it may be removed with a tearDown.
-  CFRunLoopRun();
-  return Status(0, "OK");
+  // The notification port is created once, and the matched devices are seeded
+  // on the event queue.
+  syncDarwinEventQueue([this]() {
+    if (port_ == nullptr) {
+      restart();
+    }
+  });
 }
 
 bool IOKitEventPublisher::shouldFire(const IOKitSubscriptionContextRef& sc,
@@ -302,38 +299,23 @@ bool IOKitEventPublisher::shouldFire(const IOKitSubscriptionContextRef& sc,
 }
 
 void IOKitEventPublisher::stop() {
-  if (run_loop_ == nullptr) {
-    // If there is no run loop then the publisher thread has not started.
-    return;
-  }
-
-  // Stop the run loop.
-  WriteLock lock(mutex_);
-  CFRunLoopStop(run_loop_);
-
-  // Stop the run loop before operating on containers.
-  // Destroy the IOPort.
-  if (port_ != nullptr) {
-    auto source = IONotificationPortGetRunLoopSource(port_);
-    if (CFRunLoopContainsSource(run_loop_, source, kCFRunLoopDefaultMode)) {
-      CFRunLoopRemoveSource(run_loop_, source, kCFRunLoopDefaultMode);
+  // Destroy the port between callbacks.
+  syncDarwinEventQueue([this]() {
+    WriteLock lock(mutex_);
+    if (port_ != nullptr) {
+      IONotificationPortDestroy(port_);
+      port_ = nullptr;
     }
-    // And destroy the port.
-    IONotificationPortDestroy(port_);
-    port_ = nullptr;
-  }
 
-  // Clear all devices and their notifications.
-  for (const auto& device : devices_) {
-    IOObjectRelease(device->notification);
-  }
-  devices_.clear();
+    // Clear all devices and their notifications.
+    for (const auto& device : devices_) {
+      IOObjectRelease(device->notification);
+    }
+    devices_.clear();
+  });
 }
 
 void IOKitEventPublisher::tearDown() {
   stop();
-
-  // Do not keep a reference to the run loop.
-  run_loop_ = nullptr;
 }
 }
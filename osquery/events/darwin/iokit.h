@@ -90,9 +90,14 @@ class IOKitEventPublisher
   DECLARE_PUBLISHER("iokit");
 
  public:
+  void configure() override;
+
   void tearDown() override;
 
-  Status run() override;
+  /// Notifications are delivered on the shared darwin event queue.
+  bool usesThread() const override {
+    return false;
+  }
 
   bool shouldFire(const IOKitSubscriptionContextRef& sc,
                   const IOKitEventContextRef& ec) const override;
@@ -112,9 +117,6 @@ class IOKitEventPublisher
   void stop() override;
 
  private:
-  /// The publisher state machine will start, restart, and stop the run loop.
-  CFRunLoopRef run_loop_{nullptr};
-
   /// Notification port, should close.
   IONotificationPortRef port_{nullptr};
 
@@ -8,7 +8,15 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
 #include <bsm/libbsm.h>
+#include <security/audit/audit_ioctl.h>
 
 #include <osquery/flags.h>
 #include <osquery/logger.h>
@@ -25,75 +33,197 @@ FLAG(bool,
 
 REGISTER(OpenBSMEventPublisher, "event_publisher", "openbsm");
 
+/// Scratch space for reading records, larger than the largest record.
+const size_t kOpenBSMBufferSize = 128 * 1024;
+
+/// The number of reads of a busy auditpipe before returning to the run loop.
+const size_t kOpenBSMMaxReads = 16;
+
+/// Milliseconds to wait for records before returning to the run loop.
+const int kOpenBSMPollTimeout = 200;
+
+/// Tokens reserved for each record, an execve record uses about 10.
+const size_t kOpenBSMRecordTokens = 16;
+
+/// The size of the token ID and record length beginning each header token.
+const size_t kOpenBSMHeaderPrefix = 5;
+
+size_t getAuditRecordLength(const unsigned char* data, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+
+  switch (data[0]) {
+  case AUT_HEADER32:
+  case AUT_HEADER32_EX:
+  case AUT_HEADER64:
+  case AUT_HEADER64_EX:
+    break;
+  default:
+    return 0;
+  }
+
+  if (size < kOpenBSMHeaderPrefix) {
+    // The record length has not been read.
+    return kOpenBSMHeaderPrefix;
+  }
+
+  // The record length is stored in network byte order.
+  size_t length = (static_cast<size_t>(data[1]) << 24) |
+                  (static_cast<size_t>(data[2]) << 16) |
+                  (static_cast<size_t>(data[3]) << 8) |
+                  static_cast<size_t>(data[4]);
+  return (length < kOpenBSMHeaderPrefix) ? 0 : length;
+}
+
 Status OpenBSMEventPublisher::setUp() {
   if (FLAGS_disable_audit) {
     return Status(1, "Publisher disabled via configuration");
   }
-  audit_pipe_ = fopen("/dev/auditpipe", "r");
-  if (audit_pipe_ == nullptr) {
+  audit_pipe_ = ::open("/dev/auditpipe", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (audit_pipe_ < 0) {
     LOG(WARNING) << "The auditpipe couldn't be opened.";
     return Status(1, "Could not open OpenBSM pipe");
   }
+
+  // Hold as many records as the auditpipe allows between reads.
+  u_int qlimit = 0;
+  if (::ioctl(audit_pipe_, AUDITPIPE_GET_QLIMIT_MAX, &qlimit) == 0 &&
+      ::ioctl(audit_pipe_, AUDITPIPE_SET_QLIMIT, &qlimit) == 0) {
+    VLOG(1) << "The auditpipe queue holds " << qlimit << " records";
+  }
+
+  u_int64_t drops = 0;
+  if (::ioctl(audit_pipe_, AUDITPIPE_GET_DROPS, &drops) == 0) {
+    pipe_drops_ = drops;
+  }
+
+  buffer_ = std::make_shared<std::vector<unsigned char>>(kOpenBSMBufferSize);
   return Status(0);
 }
 
 void OpenBSMEventPublisher::configure() {}
 
 void OpenBSMEventPublisher::tearDown() {
-  if (audit_pipe_ != nullptr) {
-    fclose(audit_pipe_);
-    audit_pipe_ = nullptr;
+  if (audit_pipe_ >= 0) {
+    ::close(audit_pipe_);
+    audit_pipe_ = -1;
   }
+  buffer_ = nullptr;
+  partial_ = 0;
 }
 
 Status OpenBSMEventPublisher::run() {
-  if (audit_pipe_ == nullptr) {
+  if (audit_pipe_ < 0) {
     return Status(1, "No open audit_pipe");
   }
-  tokenstr_t tok;
-  auto reclen = 0;
-  auto bytesread = 0;
-  auto event_id = 0;
-  auto buffer = static_cast<unsigned char*>(nullptr);
-  std::vector<tokenstr_t> tokens{};
 
-  while (!isEnding() && (reclen = au_read_rec(audit_pipe_, &buffer)) != -1) {
-    bytesread = 0;
+  struct pollfd fds[1];
+  fds[0].fd = audit_pipe_;
+  fds[0].events = POLLIN;
+  auto result = ::poll(fds, 1, kOpenBSMPollTimeout);
+  if (result < 0 && errno != EINTR) {
+    return Status(1, std::string("Could not poll auditpipe: ") +
+                         strerror(errno));
+  }
 
+  for (size_t reads = 0; result > 0 && reads < kOpenBSMMaxReads; reads++) {
+    if (isEnding()) {
+      break;
+    }
+
+    if (partial_ == buffer_->size()) {
+      // The record does not fit in the buffer.
+      dropped_count_++;
+      partial_ = 0;
+    }
+
+    auto bytes = ::read(
+        audit_pipe_, buffer_->data() + partial_, buffer_->size() - partial_);
+    if (bytes <= 0) {
+      break;
+    }
+
+    auto size = partial_ + static_cast<size_t>(bytes);
+    auto used = consume(size);
+    partial_ = size - used;
+
+    // Events queued for subscribers keep the buffer, read into another.
+    if (buffer_.use_count() > 1) {
+      auto buffer =
+          std::make_shared<std::vector<unsigned char>>(kOpenBSMBufferSize);
+      memcpy(buffer->data(), buffer_->data() + used, partial_);
+      buffer_ = std::move(buffer);
+    } else if (partial_ > 0) {
+      memmove(buffer_->data(), buffer_->data() + used, partial_);
+    }
+  }
+  updateDrops();
+  return Status(0);
+}
+
+size_t OpenBSMEventPublisher::consume(size_t size) {
+  auto data = buffer_->data();
+  size_t offset = 0;
+  while (offset < size) {
+    auto reclen = getAuditRecordLength(data + offset, size - offset);
+    if (reclen == 0) {
+      // The remaining data does not begin with a record.
+      dropped_count_++;
+      return size;
+    }
+
+    if (reclen > size - offset) {
+      break;
+    }
+
+    auto ec = createEventContext();
+    ec->event_id = 0;
+    ec->tokens.reserve(kOpenBSMRecordTokens);
+
+    tokenstr_t tok;
+    size_t bytesread = 0;
     while (bytesread < reclen) {
-      if (au_fetch_tok(&tok, buffer + bytesread, reclen - bytesread) == -1) {
+      if (au_fetch_tok(&tok,
+                       data + offset + bytesread,
+                       static_cast<int>(reclen - bytesread)) == -1) {
         break;
       }
       switch (tok.id) {
       case AUT_HEADER32:
-        event_id = tok.tt.hdr32_ex.e_type;
+        ec->event_id = tok.tt.hdr32_ex.e_type;
         break;
       case AUT_HEADER32_EX:
-        event_id = tok.tt.hdr32_ex.e_type;
+        ec->event_id = tok.tt.hdr32_ex.e_type;
         break;
       case AUT_HEADER64:
-        event_id = tok.tt.hdr64.e_type;
+        ec->event_id = tok.tt.hdr64.e_type;
         break;
       case AUT_HEADER64_EX:
-        event_id = tok.tt.hdr64_ex.e_type;
+        ec->event_id = tok.tt.hdr64_ex.e_type;
         break;
       }
-      tokens.push_back(tok);
+      ec->tokens.push_back(tok);
       bytesread += tok.len;
     }
-    // We probably don't need a lambda here but it's useful to put debug
-    // lines in to validate destruction.
-    std::shared_ptr<unsigned char> sp_buffer(
-        buffer, [](unsigned char* p) { delete p; });
-    auto ec = createEventContext();
-    ec->event_id = event_id;
-    ec->tokens = tokens;
-    ec->buffer = sp_buffer;
+
+    // The tokens point into the buffer, which is kept with the event.
+    ec->buffer = buffer_;
     fire(ec);
-    tokens.clear();
-    event_id = 0;
+    offset += reclen;
   }
-  return Status(0);
+  return offset;
+}
+
+void OpenBSMEventPublisher::updateDrops() {
+  u_int64_t drops = 0;
+  if (::ioctl(audit_pipe_, AUDITPIPE_GET_DROPS, &drops) != 0 ||
+      drops <= pipe_drops_) {
+    return;
+  }
+
+  dropped_count_ += static_cast<size_t>(drops - pipe_drops_);
+  pipe_drops_ = drops;
 }
 
 bool OpenBSMEventPublisher::shouldFire(const OpenBSMSubscriptionContextRef& mc,
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include <osquery/events.h>
 
 namespace osquery {
@@ -24,17 +26,33 @@ struct OpenBSMEventContext : public EventContext {
   int event_id;
   // The tokens for the event to pass to the subscriber
   std::vector<tokenstr_t> tokens;
-  // A smart pointer to the memory returned by OpenBSM
-  std::shared_ptr<unsigned char> buffer;
+  // The records read from the auditpipe, which the tokens point into
+  std::shared_ptr<std::vector<unsigned char>> buffer;
 };
 
 using OpenBSMEventContextRef = std::shared_ptr<OpenBSMEventContext>;
 using OpenBSMSubscriptionContextRef =
     std::shared_ptr<OpenBSMSubscriptionContext>;
 
+/**
+ * @brief Get the length of the audit record at the start of a buffer.
+ *
+ * Every header token begins with its token ID and the record length.
+ *
+ * @return 0 if the buffer does not begin with a header token.
+ */
+size_t getAuditRecordLength(const unsigned char* data, size_t size);
+
 /// This is a dispatched service that handles published audit replies.
 class OpenBSMConsumerRunner;
 
+/**
+ * @brief Audit records read from the auditpipe.
+ *
+ * Records are read in batches into a shared buffer, and each record's tokens
+ * are parsed in place. The auditpipe queue is raised to its maximum, and
+ * records dropped by the kernel are counted as dropped events.
+ */
 class OpenBSMEventPublisher
     : public EventPublisher<OpenBSMSubscriptionContext, OpenBSMEventContext> {
   DECLARE_PUBLISHER("openbsm");
@@ -55,7 +73,25 @@ class OpenBSMEventPublisher
   }
 
  private:
-  FILE* audit_pipe_ = nullptr;
+  /// Fire the complete records in the buffer, returns the bytes used.
+  size_t consume(size_t size);
+
+  /// Count the records dropped by the auditpipe.
+  void updateDrops();
+
+ private:
+  /// The auditpipe descriptor.
+  int audit_pipe_{-1};
+
+  /// Scratch space for reading records, kept while events reference it.
+  std::shared_ptr<std::vector<unsigned char>> buffer_;
+
+  /// The bytes of a partially read record at the start of the buffer.
+  size_t partial_{0};
+
+  /// The records dropped by the auditpipe when they were last counted.
+  uint64_t pipe_drops_{0};
+
   /// Apply normal subscription to event matching logic.
   bool shouldFire(const OpenBSMSubscriptionContextRef& mc,
                   const OpenBSMEventContextRef& ec) const override;
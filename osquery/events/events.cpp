@@ -8,8 +8,12 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <exception>
+#include <future>
 #include <thread>
 
 #include <boost/algorithm/string.hpp>
@@ -25,6 +29,12 @@
 #include <osquery/system.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/memory.h"
+#include "osquery/core/msgpack.h"
+#include "osquery/core/startup.h"
+#include "osquery/core/trace.h"
+#include "osquery/events/predicates.h"
+#include "osquery/events/rollups.h"
 
 namespace osquery {
 
@@ -49,6 +59,467 @@ FLAG(uint64, events_expiry, 3600, "Timeout to expire event subscriber results");
 // overriding in subclasses
 FLAG(uint64, events_max, 50000, "Maximum number of events per type to buffer");
 
+FLAG(uint64,
+     events_batch_size,
+     1,
+     "Number of events per subscriber buffered before writing a batch");
+
+FLAG(uint64,
+     events_batch_interval,
+     1000,
+     "Milliseconds before buffered events are written as a batch");
+
+FLAG(bool,
+     events_pushdown,
+     false,
+     "Only store events that may be selected by scheduled queries");
+
+HIDDEN_FLAG(uint64,
+            events_subscriber_queue_size,
+            4096,
+            "Events queued for each subscriber using the callback threads");
+
+FLAG(uint64,
+     events_callback_threads,
+     2,
+     "Number of threads calling queued event subscriber callbacks");
+
+FLAG(bool,
+     events_async_callbacks,
+     false,
+     "Call every event subscriber's callbacks from the callback threads");
+
+FLAG(bool,
+     events_expire_consumed,
+     false,
+     "Expire events once every scheduled query selected them (scheduler only)");
+
+FLAG(uint64,
+     events_expiry_interval,
+     60,
+     "Seconds between expiring stored events in the background (0 disables)");
+
+FLAG(bool,
+     events_defer_configure,
+     true,
+     "Configure event publishers in their threads after startup (daemon only)");
+
+FLAG(uint64,
+     file_events_coalesce_window,
+     0,
+     "Milliseconds to merge bursts of file events for a path (0 disables)");
+
+/// The number of callbacks called for a subscriber before other subscribers.
+static const size_t kEventCallbackBatch = 64;
+
+/**
+ * @brief The ordered callbacks of a subscriber called by the callback pool.
+ *
+ * Publishers push callbacks from any thread. A queue is scheduled on the pool
+ * at most once, such that a subscriber's callbacks are called by one pool
+ * thread at a time and in order. See EventSubscriberPlugin::usesQueue.
+ */
+class EventSubscriberQueue
+    : public std::enable_shared_from_this<EventSubscriberQueue> {
+ public:
+  /// Queue a callback, false if the queue is full and it was dropped.
+  bool push(std::function<void()> callback);
+
+  /// Call a batch of callbacks, called by a pool thread.
+  void run();
+
+  /// Drop the queued callbacks and do not accept more.
+  void stop();
+
+  /// The number of queued callbacks.
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return callbacks_.size();
+  }
+
+  /// The number of callbacks dropped because the queue was full.
+  size_t droppedCount() const {
+    return dropped_count_;
+  }
+
+ private:
+  /// The queued callbacks.
+  std::deque<std::function<void()>> callbacks_;
+
+  /// Set while the queue is waiting for, or being run by, a pool thread.
+  bool scheduled_{false};
+
+  /// Set when the subscriber is removed.
+  bool stopped_{false};
+
+  std::atomic<size_t> dropped_count_{0};
+
+  mutable std::mutex mutex_;
+};
+
+class EventCallbackRunner : public InternalRunnable {
+ public:
+  EventCallbackRunner() : InternalRunnable("EventCallbackRunner") {}
+
+  /// Thread entrypoint.
+  void start() override;
+
+  /// Wake the thread such that it observes the interruption.
+  void stop() override;
+
+ private:
+  /// Set when the runner is stopped, protected by the pool mutex.
+  bool stopped_{false};
+
+ private:
+  friend class EventCallbackPool;
+};
+
+/// The number of events shared by scheduled queries kept for a subscriber.
+static const size_t kEventHistoryMax = 16384;
+
+/// Milliseconds between expiring subscribers, to spread database writes.
+static const size_t kEventExpirationPause = 200;
+
+/**
+ * @brief A service expiring the stored events of every subscriber.
+ *
+ * Without the service, events are expired by count from the publisher's
+ * thread as events are added, and by time from the scheduler as events are
+ * selected. Each pass visits the running subscribers in turn and expires at
+ * most one subscriber every kEventExpirationPause.
+ */
+class EventExpirationRunner : public InternalRunnable {
+ public:
+  EventExpirationRunner() : InternalRunnable("EventExpirationRunner") {}
+
+  /// Thread entrypoint.
+  void start() override;
+
+  /// Start the service, if it is enabled and not running.
+  static void startService();
+
+  /// Check if the service expires events rather than the subscribers.
+  static bool active() {
+    return active_;
+  }
+
+ private:
+  /// Set from when the service is added until its thread stops.
+  static std::atomic<bool> active_;
+};
+
+std::atomic<bool> EventExpirationRunner::active_{false};
+
+void EventExpirationRunner::startService() {
+  bool active = false;
+  if (FLAGS_events_expiry_interval == 0 ||
+      !active_.compare_exchange_strong(active, true)) {
+    return;
+  }
+
+  if (!Dispatcher::addService(std::make_shared<EventExpirationRunner>())
+           .ok()) {
+    active_ = false;
+  }
+}
+
+void EventExpirationRunner::start() {
+  while (!interrupted()) {
+    pauseMilli(std::chrono::seconds(FLAGS_events_expiry_interval));
+    for (const auto& name : EventFactory::subscriberNames()) {
+      if (interrupted()) {
+        break;
+      }
+
+      auto sub = EventFactory::getEventSubscriber(name);
+      if (sub == nullptr || sub->state() != EventState::EVENT_RUNNING) {
+        continue;
+      }
+      sub->expireStored();
+      pauseMilli(kEventExpirationPause);
+    }
+  }
+  active_ = false;
+}
+
+/**
+ * @brief The threads calling queued event subscriber callbacks.
+ *
+ * Subscriber queues with callbacks wait in a single ready queue, and an idle
+ * thread takes the next subscriber. After a batch of callbacks a subscriber is
+ * requeued, such that a slow subscriber does not delay the others.
+ */
+class EventCallbackPool : private boost::noncopyable {
+ public:
+  static EventCallbackPool& get() {
+    static EventCallbackPool instance;
+    return instance;
+  }
+
+  /// Start the pool threads that are not running.
+  void start();
+
+  /// Add a subscriber queue with callbacks to the ready queue.
+  void schedule(std::shared_ptr<EventSubscriberQueue> queue);
+
+  /// Wait for a ready subscriber queue, nullptr if the runner is stopped.
+  std::shared_ptr<EventSubscriberQueue> next(EventCallbackRunner& runner);
+
+  /// Stop and wake a runner.
+  void stop(EventCallbackRunner& runner);
+
+ private:
+  EventCallbackPool() = default;
+
+ private:
+  /// Subscriber queues waiting for a pool thread.
+  std::deque<std::shared_ptr<EventSubscriberQueue>> ready_;
+
+  /// The runners started by the pool.
+  std::vector<std::shared_ptr<EventCallbackRunner>> runners_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+bool EventSubscriberQueue::push(std::function<void()> callback) {
+  bool schedule = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_ || callbacks_.size() >= FLAGS_events_subscriber_queue_size) {
+      dropped_count_++;
+      return false;
+    }
+
+    callbacks_.push_back(std::move(callback));
+    if (!scheduled_) {
+      scheduled_ = schedule = true;
+    }
+  }
+
+  if (schedule) {
+    EventCallbackPool::get().schedule(shared_from_this());
+  }
+  return true;
+}
+
+void EventSubscriberQueue::run() {
+  for (size_t i = 0; i < kEventCallbackBatch; i++) {
+    std::function<void()> callback;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (callbacks_.empty()) {
+        scheduled_ = false;
+        return;
+      }
+      callback = std::move(callbacks_.front());
+      callbacks_.pop_front();
+    }
+    callback();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (callbacks_.empty()) {
+      scheduled_ = false;
+      return;
+    }
+  }
+  // The remaining callbacks are called after other ready subscribers.
+  EventCallbackPool::get().schedule(shared_from_this());
+}
+
+void EventSubscriberQueue::stop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stopped_ = true;
+  callbacks_.clear();
+}
+
+void EventCallbackRunner::start() {
+  auto& pool = EventCallbackPool::get();
+  while (!interrupted()) {
+    auto queue = pool.next(*this);
+    if (queue == nullptr) {
+      break;
+    }
+    queue->run();
+  }
+}
+
+void EventCallbackRunner::stop() {
+  EventCallbackPool::get().stop(*this);
+}
+
+void EventCallbackPool::start() {
+  std::vector<std::shared_ptr<EventCallbackRunner>> runners;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Runners are stopped with the other services, and then restarted.
+    runners_.erase(
+        std::remove_if(runners_.begin(),
+                       runners_.end(),
+                       [](const std::shared_ptr<EventCallbackRunner>& runner) {
+                         return runner->stopped_;
+                       }),
+        runners_.end());
+    auto threads = std::max<size_t>(FLAGS_events_callback_threads, 1);
+    while (runners_.size() < threads) {
+      runners_.push_back(std::make_shared<EventCallbackRunner>());
+      runners.push_back(runners_.back());
+    }
+  }
+
+  for (const auto& runner : runners) {
+    if (!Dispatcher::addService(runner).ok()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      runner->stopped_ = true;
+    }
+  }
+}
+
+void EventCallbackPool::schedule(std::shared_ptr<EventSubscriberQueue> queue) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready_.push_back(std::move(queue));
+  }
+  cv_.notify_one();
+}
+
+std::shared_ptr<EventSubscriberQueue> EventCallbackPool::next(
+    EventCallbackRunner& runner) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock,
+           [this, &runner]() { return runner.stopped_ || !ready_.empty(); });
+  if (runner.stopped_) {
+    return nullptr;
+  }
+
+  auto queue = std::move(ready_.front());
+  ready_.pop_front();
+  return queue;
+}
+
+void EventCallbackPool::stop(EventCallbackRunner& runner) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    runner.stopped_ = true;
+  }
+  cv_.notify_all();
+}
+
+const char EventRowCodec::kVersion = '\x01';
+
+/// The size of the encoded row header, the version and 32-bit schema.
+static const size_t kEventRowHeaderSize = 5;
+
+static inline void putVarint(size_t value, std::string& data) {
+  while (value >= 0x80) {
+    data.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  data.push_back(static_cast<char>(value));
+}
+
+static inline bool getVarint(const std::string& data,
+                             size_t& pos,
+                             size_t& value) {
+  value = 0;
+  for (size_t shift = 0; pos < data.size() && shift < 64; shift += 7) {
+    auto byte = static_cast<unsigned char>(data[pos++]);
+    value |= static_cast<size_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline void putString(const std::string& value, std::string& data) {
+  putVarint(value.size(), data);
+  data.append(value);
+}
+
+static inline bool getString(const std::string& data,
+                             size_t& pos,
+                             std::string& value) {
+  size_t size = 0;
+  if (!getVarint(data, pos, size) || size > data.size() - pos) {
+    return false;
+  }
+  value.assign(data, pos, size);
+  pos += size;
+  return true;
+}
+
+EventRowCodec::EventRowCodec(std::vector<std::string> columns)
+    : columns_(std::move(columns)) {
+  // A 32-bit FNV-1a of the column names.
+  schema_ = 2166136261U;
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    ids_[columns_[i]] = i;
+    for (const auto& c : columns_[i] + '\n') {
+      schema_ = (schema_ ^ static_cast<unsigned char>(c)) * 16777619U;
+    }
+  }
+}
+
+void EventRowCodec::encode(const Row& r, std::string& data) const {
+  data.push_back(kVersion);
+  for (size_t i = 0; i < 4; ++i) {
+    data.push_back(static_cast<char>((schema_ >> (i * 8)) & 0xff));
+  }
+
+  for (const auto& column : r) {
+    auto id = ids_.find(column.first);
+    if (id != ids_.end()) {
+      putVarint(id->second + 1, data);
+    } else {
+      putVarint(0, data);
+      putString(column.first, data);
+    }
+    putString(column.second, data);
+  }
+}
+
+Status EventRowCodec::decode(const std::string& data, Row& r) const {
+  if (!isEncoded(data) || getSchema(data) != schema_) {
+    return Status(1, "Unexpected event row encoding");
+  }
+
+  size_t pos = kEventRowHeaderSize;
+  while (pos < data.size()) {
+    size_t key = 0;
+    if (!getVarint(data, pos, key) || key > columns_.size()) {
+      return Status(1, "Invalid event row column");
+    }
+
+    std::string name;
+    if (key == 0 && !getString(data, pos, name)) {
+      return Status(1, "Invalid event row column name");
+    }
+
+    auto& value = r[(key == 0) ? name : columns_[key - 1]];
+    if (!getString(data, pos, value)) {
+      return Status(1, "Invalid event row value");
+    }
+  }
+  return Status(0, "OK");
+}
+
+bool EventRowCodec::isEncoded(const std::string& data) {
+  return data.size() >= kEventRowHeaderSize && data[0] == kVersion;
+}
+
+uint32_t EventRowCodec::getSchema(const std::string& data) {
+  uint32_t schema = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    schema |= static_cast<uint32_t>(static_cast<unsigned char>(data[i + 1]))
+              << (i * 8);
+  }
+  return schema;
+}
+
 static inline EventTime timeFromRecord(const std::string& record) {
   // Convert a stored index "as string bytes" to a time value.
   long long afinite;
@@ -67,6 +538,30 @@ static inline std::string toIndex(size_t i) {
   return (n >= 10) ? j : std::string(10 - n, '0').append(std::move(j));
 }
 
+/// An upper bound for event keys sharing a prefix, all keys are digits or '.'.
+static const std::string kEventKeyHigh{"~"};
+
+/// The key prefix for events at a time, followed by '.' and the EventID.
+static inline std::string getTimeKey(const std::string& data_key,
+                                     EventTime time) {
+  return data_key + toIndex(time);
+}
+
+/// Parse the time and EventID from an event's key.
+static inline bool parseEventKey(const std::string& key,
+                                 size_t prefix,
+                                 EventTime& time,
+                                 size_t& eid) {
+  auto dot = key.find('.', prefix);
+  if (dot == std::string::npos) {
+    return false;
+  }
+
+  time = timeFromRecord(key.substr(prefix, dot - prefix));
+  eid = static_cast<size_t>(timeFromRecord(key.substr(dot + 1)));
+  return true;
+}
+
 static inline void getOptimizeData(EventTime& o_time,
                                    size_t& o_eid,
                                    std::string& query_name,
@@ -106,8 +601,25 @@ static inline void setOptimizeData(EventTime time,
     return;
   }
 
-  setDatabaseValue(kEvents, "optimize." + query_name, std::to_string(time));
-  setDatabaseValue(kEvents, "optimize_eid." + query_name, toIndex(eid));
+  DatabaseBatch batch;
+  batch.put(kEvents, "optimize." + query_name, std::to_string(time));
+  batch.put(kEvents, "optimize_eid." + query_name, toIndex(eid));
+  writeDatabaseBatch(batch);
+}
+
+/// The oldest cursor time, or 0 if a scheduled query has not selected.
+static inline EventTime getConsumedTime(
+    const std::map<std::string, std::pair<EventTime, size_t>>& cursors,
+    size_t query_count) {
+  if (cursors.empty() || cursors.size() < query_count) {
+    return 0;
+  }
+
+  auto consumed = cursors.begin()->second.first;
+  for (const auto& cursor : cursors) {
+    consumed = std::min(consumed, cursor.second.first);
+  }
+  return consumed;
 }
 
 void EventSubscriberPlugin::genTable(RowYield& yield, QueryContext& context) {
@@ -138,16 +650,29 @@ void EventSubscriberPlugin::genTable(RowYield& yield, QueryContext& context) {
     start = optimize_time_;
     optimize_time_ = getUnixTime() - 1;
 
-    // Track the queries that have selected data.
-    WriteLock lock(event_query_record_);
-    if (!query_name.empty() && queries_.count(query_name) == 0) {
-      queries_.insert(query_name);
+    {
+      // Track the queries that have selected data.
+      WriteLock lock(event_query_record_);
+      if (!query_name.empty() && queries_.count(query_name) == 0) {
+        queries_.insert(query_name);
+      }
+    }
+
+    // Scheduled queries without a requested order or limit share reads.
+    if (!query_name.empty() && context.limit == 0 &&
+        context.orderBy != "time" && getShared(yield, query_name, start)) {
+      return;
     }
   }
-  get(yield, start, stop);
+  // Event keys are ordered by time, the table's time column is ORDERED.
+  bool descending = (context.orderBy == "time" && context.orderDescending);
+  getRange(yield, start, stop, descending, context.limit);
 }
 
 void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
+  // Each publisher fires from its own thread, which identifies the span.
+  TRACE_SPAN("EventPublisherPlugin::fire");
+  MEMORY_TAG(EVENTS);
   if (isEnding()) {
     // Cannot emit/fire while ending
     return;
@@ -170,213 +695,133 @@ void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
     }
   }
 
-  WriteLock lock(subscription_lock_);
-  for (const auto& subscription : subscriptions_) {
-    auto es = EventFactory::getEventSubscriber(subscription->subscriber_name);
-    if (es != nullptr && es->state() == EventState::EVENT_RUNNING) {
-      fireCallback(subscription, ec);
-    }
-  }
-}
-
-std::vector<std::string> EventSubscriberPlugin::getIndexes(EventTime start,
-                                                           EventTime stop,
-                                                           bool sort) {
-  auto index_key = "indexes." + dbNamespace();
-  std::vector<std::string> indexes;
-
-  EventTime l_start = (start > 0) ? start / 60 : 0;
-  EventTime r_stop = (stop > 0) ? stop / 60 + 1 : 0;
-
-  std::string content;
-  getDatabaseValue(kEvents, index_key + ".60", content);
-  if (content.empty()) {
-    return indexes;
+  auto subscriptions = std::atomic_load(&fire_subscriptions_);
+  if (subscriptions == nullptr) {
+    return;
   }
 
-  std::vector<std::string> bins, expirations;
-  boost::split(bins, content, boost::is_any_of(","));
-  for (const auto& bin : bins) {
-    auto step = timeFromRecord(bin);
-    auto step_start = step * 60;
-    auto step_stop = (step + 1) * 60;
-    if (step_stop <= expire_time_) {
-      expirations.push_back(bin);
-    } else if (step_start < expire_time_ && sort) {
-      expireRecords("60", bin, false);
+  std::shared_ptr<EventPublisherPlugin> publisher;
+  for (const auto& subscription : *subscriptions) {
+    auto es = EventFactory::getEventSubscriber(subscription->subscriber_name);
+    if (es == nullptr || es->state() != EventState::EVENT_RUNNING) {
+      continue;
     }
 
-    if (step >= l_start && (r_stop == 0 || step < r_stop) && sort) {
-      indexes.push_back("60." + bin);
+    auto queue = std::atomic_load(&es->queue_);
+    if (queue == nullptr) {
+      TRACE_SPAN("subscriber", subscription->subscriber_name);
+      fireCallback(subscription, ec);
+      continue;
     }
-  }
 
-  // Rewrite the index lists and delete each expired item.
-  if (!expirations.empty()) {
-    expireIndexes("60", bins, expirations);
-  }
-
-  // Return indexes in binning order.
-  if (sort) {
-    std::sort(indexes.begin(),
-              indexes.end(),
-              [](const std::string& left, const std::string& right) {
-                auto n1 = timeFromRecord(left.substr(left.find('.') + 1));
-                auto n2 = timeFromRecord(right.substr(right.find('.') + 1));
-                return n1 < n2;
-              });
+    // The queued callback keeps the publisher, subscription, and event.
+    if (publisher == nullptr) {
+      publisher = EventFactory::getEventPublisher(type());
+      if (publisher == nullptr) {
+        return;
+      }
+    }
+    // A full queue drops the event and counts it for the subscriber.
+    queue->push([publisher, subscription, ec]() {
+      TRACE_SPAN("subscriber", subscription->subscriber_name);
+      publisher->fireCallback(subscription, ec);
+    });
   }
-
-  // Update the new time that events expire to now - expiry.
-  return indexes;
 }
 
-void EventSubscriberPlugin::expireRecords(const std::string& list_type,
-                                          const std::string& index,
-                                          bool all) {
-  if (!executedAllQueries()) {
-    return;
-  }
+size_t EventSubscriberPlugin::queuedCount() const {
+  auto queue = std::atomic_load(&queue_);
+  return (queue != nullptr) ? queue->size() : 0;
+}
 
-  auto record_key = "records." + dbNamespace();
-  auto data_key = "data." + dbNamespace();
+size_t EventSubscriberPlugin::droppedCount() const {
+  auto queue = std::atomic_load(&queue_);
+  return (queue != nullptr) ? queue->droppedCount() : 0;
+}
 
-  // If the expirations is not removing all records, rewrite the persisting.
-  std::vector<std::string> persisting_records;
-  // Request all records within this list-size + bin offset.
-  auto expired_records = getRecords({list_type + '.' + index}, false);
-  if (all && expired_records.size() > 1) {
-    deleteDatabaseRange(kEvents,
-                        data_key + '.' + expired_records.begin()->first,
-                        data_key + '.' + expired_records.rbegin()->first);
-  } else {
-    for (const auto& record : expired_records) {
-      if (record.second <= expire_time_) {
-        deleteDatabaseValue(kEvents, data_key + '.' + record.first);
-      } else {
-        persisting_records.push_back(record.first + ':' +
-                                     std::to_string(record.second));
-      }
-    }
-  }
+size_t EventSubscriberPlugin::storedCount() const {
+  ReadLock lock(event_record_lock_);
+  return (stored_events_ != kUnknownStoredEvents) ? stored_events_ : 0;
+}
 
-  // Either drop or overwrite the record list.
-  if (all) {
-    deleteDatabaseValue(kEvents, record_key + "." + list_type + "." + index);
-  } else if (persisting_records.size() < expired_records.size()) {
-    auto new_records = boost::algorithm::join(persisting_records, ",");
-    setDatabaseValue(
-        kEvents, record_key + "." + list_type + "." + index, new_records);
-  }
+void EventPublisherPlugin::updateSubscriptions() {
+  std::atomic_store(
+      &fire_subscriptions_,
+      std::shared_ptr<const SubscriptionVector>(
+          std::make_shared<SubscriptionVector>(subscriptions_)));
 }
 
-void EventSubscriberPlugin::expireIndexes(
-    const std::string& list_type,
-    const std::vector<std::string>& indexes,
-    const std::vector<std::string>& expirations) {
-  if (!executedAllQueries()) {
+void EventSubscriberPlugin::expireEvents() {
+  if (expire_time_ == 0 || expire_time_ == expired_time_) {
+    // The events at or before the expire time were already removed.
     return;
   }
 
-  auto index_key = "indexes." + dbNamespace();
-
-  // Construct a mutable list of persisting indexes to rewrite as records.
-  std::vector<std::string> persisting_indexes = indexes;
-  // Remove the records using the list of expired indexes.
-  for (const auto& bin : expirations) {
-    expireRecords(list_type, bin, true);
-    persisting_indexes.erase(
-        std::remove(persisting_indexes.begin(), persisting_indexes.end(), bin),
-        persisting_indexes.end());
+  // Events at or before the expire time are removed.
+  auto data_key = getDataKey();
+  auto status = deleteDatabaseRange(
+      kEvents, data_key, getTimeKey(data_key, expire_time_) + kEventKeyHigh);
+  if (status.ok()) {
+    expired_time_ = expire_time_;
   }
-
-  // Update the list of indexes with the non-expired indexes.
-  auto new_indexes = boost::algorithm::join(persisting_indexes, ",");
-  setDatabaseValue(kEvents, index_key + "." + list_type, new_indexes);
 }
 
 void EventSubscriberPlugin::expireCheck() {
-  auto data_key = "data." + dbNamespace();
-  auto eid_key = "eid." + dbNamespace();
-  // Min key will be the last surviving key.
-  size_t threshold_key = 0;
+  flushEvents();
 
+  auto limit = getEventsMax();
   {
-    auto limit = getEventsMax();
-    std::vector<std::string> keys;
-    scanDatabaseKeys(kEvents, keys, data_key);
-    if (keys.size() <= limit) {
+    // The stored count is an upper bound, expiration removes an unknown
+    // number of events. Only an overflowing count is scanned.
+    ReadLock lock(event_record_lock_);
+    if (stored_events_ <= limit) {
       return;
     }
-
-    // There is an overflow of events buffered for this subscriber.
-    LOG(WARNING) << "Expiring events for subscriber: " << getName()
-                 << " (overflowed limit " << limit << ")";
-    VLOG(1) << "Subscriber events " << getName() << " exceeded limit " << limit
-            << " by: " << keys.size() - limit;
-    // Inspect the N-FLAGS_events_max -th event's value and expire before the
-    // time within the content.
-    std::string last_key;
-    getDatabaseValue(kEvents, eid_key, last_key);
-    // The EID is the next-index.
-    // EID - events_max is the most last-recent event to keep.
-    threshold_key = boost::lexical_cast<size_t>(last_key) - getEventsMax();
-
-    // Scan each of the keys in keys, if their ID portion is < threshold.
-    // Nix them, this requires lots of conversions, use with care.
-    std::string max_key;
-    std::string min_key;
-    unsigned long min_key_value = 0;
-    unsigned long max_key_value = 0;
-    for (const auto& key : keys) {
-      unsigned long key_value = 0;
-      safeStrtoul(key.substr(key.rfind('.') + 1), 10, key_value);
-
-      if (key_value < static_cast<unsigned long>(threshold_key)) {
-        min_key_value = (min_key_value == 0 || key_value < min_key_value)
-                            ? key_value
-                            : min_key_value;
-        if (min_key_value == key_value) {
-          min_key = key;
-        }
-
-        max_key_value = (key_value > max_key_value) ? key_value : max_key_value;
-        if (max_key_value == key_value) {
-          max_key = key;
-        }
-      }
-    }
-
-    if (!min_key.empty()) {
-      if (max_key_value == min_key_value) {
-        deleteDatabaseValue(kEvents, min_key);
-      } else {
-        deleteDatabaseRange(kEvents, min_key, max_key);
-      }
-    }
   }
 
-  // Convert the key index into a time using the content.
-  // The last-recent event is fetched and the corresponding time is used as
-  // the expiration time for the subscriber.
-  std::string content;
-  getDatabaseValue(kEvents, data_key + "." + toIndex(threshold_key), content);
-
-  // Decode the value into a row structure to extract the time.
-  Row r;
-  if (!deserializeRowJSON(content, r) || r.count("time") == 0) {
+  auto data_key = getDataKey();
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, data_key);
+  {
+    WriteLock lock(event_record_lock_);
+    stored_events_ = std::min(keys.size(), limit);
+  }
+  if (keys.size() <= limit) {
     return;
   }
 
-  // The last time will become the implicit expiration time.
-  size_t last_time = boost::lexical_cast<size_t>(r.at("time"));
-  if (last_time > 0) {
-    expire_time_ = last_time - (last_time % 60);
+  // There is an overflow of events buffered for this subscriber.
+  LOG(WARNING) << "Expiring events for subscriber: " << getName()
+               << " (overflowed limit " << limit << ")";
+  VLOG(1) << "Subscriber events " << getName() << " exceeded limit " << limit
+          << " by: " << keys.size() - limit;
+
+  // Keys are ordered by time, the oldest overflowing events are removed.
+  std::sort(keys.begin(), keys.end());
+  auto overflow = keys.size() - limit;
+  deleteDatabaseRange(kEvents, keys.front(), keys[overflow - 1]);
+
+  // The time of the last-recent event becomes the implicit expiration time.
+  EventTime last_time = 0;
+  size_t eid = 0;
+  if (parseEventKey(keys[overflow], data_key.size(), last_time, eid) &&
+      last_time > 0) {
+    expire_time_ = std::max(expire_time_, last_time - 1);
   }
+}
 
-  // Finally, attempt an index query to trigger expirations.
-  // In this case the result set is not used.
-  getIndexes(expire_time_, 0, false);
+void EventSubscriberPlugin::expireStored() {
+  WriteLock lock(event_expire_lock_);
+  flushEvents();
+
+  auto expired_time = expired_time_;
+  expireEvents();
+  if (expired_time_ != expired_time) {
+    // Count the remaining events, rather than when the next event is added.
+    WriteLock record_lock(event_record_lock_);
+    stored_events_ = kUnknownStoredEvents;
+  }
+  expireCheck();
 }
 
 bool EventSubscriberPlugin::executedAllQueries() const {
@@ -384,86 +829,95 @@ bool EventSubscriberPlugin::executedAllQueries() const {
   return queries_.size() >= query_count_;
 }
 
-std::vector<EventRecord> EventSubscriberPlugin::getRecords(
-    const std::vector<std::string>& indexes, bool optimize) {
-  auto record_key = "records." + dbNamespace();
+void EventSubscriberPlugin::recordEvent(const std::string& eid,
+                                        EventTime et,
+                                        std::string data) {
+  auto event_key = getTimeKey(getDataKey(), et) + "." + eid;
 
-  std::vector<EventRecord> records;
-  for (const auto& index : indexes) {
-    std::vector<std::string> bin_records;
-    {
-      std::string record_value;
-      getDatabaseValue(kEvents, record_key + "." + index, record_value);
-      if (record_value.empty()) {
-        // There are actually no events in this bin, interesting error case.
-        continue;
-      }
+  WriteLock lock(event_record_lock_);
+  if (pending_.empty()) {
+    pending_start_ = std::chrono::steady_clock::now();
+  }
+  pending_.put(kEvents, event_key, std::move(data));
+}
 
-      // Each list is tokenized into a record=event_id:time.
-      boost::split(bin_records, record_value, boost::is_any_of(",:"));
-    }
+bool EventSubscriberPlugin::shouldFlushEvents() {
+  ReadLock lock(event_record_lock_);
+  if (pending_.empty()) {
+    return false;
+  }
 
-    auto bin_it = bin_records.begin();
-    // Iterate over every 2 items: EID:TIME.
-    for (; bin_it != bin_records.end(); bin_it++) {
-      const auto& eid = *bin_it;
-      EventTime et = timeFromRecord(*(++bin_it));
-      if (FLAGS_events_optimize && optimize && et <= optimize_time_ + 1) {
-        // There is an optimization collision, check for colliding IDs.
-        auto eidr = timeFromRecord(eid);
-        if (eidr <= optimize_eid_) {
-          continue;
-        }
-      }
-      records.push_back(std::make_pair(eid, et));
-    }
+  if (pending_.size() >= FLAGS_events_batch_size) {
+    return true;
   }
 
-  return records;
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - pending_start_);
+  return static_cast<uint64_t>(elapsed.count()) >= FLAGS_events_batch_interval;
 }
 
-Status EventSubscriberPlugin::recordEvent(const std::string& eid,
-                                          EventTime et) {
-  std::string time_value = boost::lexical_cast<std::string>(et);
+Status EventSubscriberPlugin::flushEvents() {
+  WriteLock lock(event_record_lock_);
+  auto status = writeDatabaseBatch(pending_);
+  if (!status.ok()) {
+    LOG(ERROR) << "Could not write event batch for: " << dbNamespace();
+  } else if (stored_events_ != kUnknownStoredEvents) {
+    stored_events_ += pending_.size();
+  }
+  pending_.clear();
+  return status;
+}
 
-  // The record is identified by the event type then module name.
-  std::string index_key = "indexes." + dbNamespace();
-  std::string record_key = "records." + dbNamespace();
-  // The list key includes the list type (bin size) and the list ID (bin).
-  std::string list_id;
+void EventSubscriberPlugin::migrateEvents() {
+  // Events were previously indexed by comma-joined lists of 60 second bins.
+  auto index_key = "indexes." + dbNamespace() + ".60";
+  auto record_key = "records." + dbNamespace() + ".60.";
+  auto data_key = getDataKey();
 
-  // The list_id is the MOST-Specific key ID, the bin for this list.
-  // If the event time was 13 and the time_list is 5 seconds, lid = 2.
-  list_id = boost::lexical_cast<std::string>(et / 60);
+  std::string content;
+  getDatabaseValue(kEvents, index_key, content);
+  if (!content.empty()) {
+    VLOG(1) << "Migrating stored events for subscriber: " << getName();
+  }
 
-  WriteLock lock(event_record_lock_);
-  // Append the record (eid, unix_time) to the list bin.
-  std::string record_value;
-  getDatabaseValue(kEvents, record_key + ".60." + list_id, record_value);
-
-  if (record_value.length() == 0) {
-    // This is a new list_id for list_key, append the ID to the indirect
-    // lookup for this list_key.
-    std::string index_value;
-    getDatabaseValue(kEvents, index_key + ".60", index_value);
-    if (index_value.length() == 0) {
-      // A new index.
-      index_value = list_id;
-    } else {
-      index_value += "," + list_id;
+  std::vector<std::string> bins;
+  boost::split(bins, content, boost::is_any_of(","));
+  for (const auto& bin : bins) {
+    if (bin.empty()) {
+      continue;
     }
-    setDatabaseValue(kEvents, index_key + ".60", index_value);
-    record_value = eid + ":" + time_value;
-  } else {
-    // Tokenize a record using ',' and the EID/time using ':'.
-    record_value += "," + eid + ":" + time_value;
+
+    std::string record_value;
+    getDatabaseValue(kEvents, record_key + bin, record_value);
+
+    // Each list is tokenized into a record=event_id:time.
+    std::vector<std::string> bin_records;
+    boost::split(bin_records, record_value, boost::is_any_of(",:"));
+
+    DatabaseBatch batch;
+    for (size_t i = 0; i + 1 < bin_records.size(); i += 2) {
+      const auto& eid = bin_records[i];
+      std::string data;
+      getDatabaseValue(kEvents, data_key + eid, data);
+      if (!data.empty()) {
+        auto et = timeFromRecord(bin_records[i + 1]);
+        batch.put(kEvents, getTimeKey(data_key, et) + "." + eid, data);
+      }
+      batch.remove(kEvents, data_key + eid);
+    }
+    batch.remove(kEvents, record_key + bin);
+    writeDatabaseBatch(batch);
   }
-  auto status =
-      setDatabaseValue(kEvents, record_key + ".60." + list_id, record_value);
-  if (!status.ok()) {
-    LOG(ERROR) << "Could not put Event Record key: " << record_key;
+
+  // Remove the index and any event data that was not indexed.
+  deleteDatabaseValue(kEvents, index_key);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, data_key);
+  for (const auto& key : keys) {
+    if (key.find('.', data_key.size()) == std::string::npos) {
+      deleteDatabaseValue(kEvents, key);
+    }
   }
-  return Status(0, "OK");
 }
 
 size_t EventSubscriberPlugin::getEventsExpiry() {
@@ -502,42 +956,198 @@ const std::string EventSubscriberPlugin::getEventID() {
 void EventSubscriberPlugin::get(RowYield& yield,
                                 EventTime start,
                                 EventTime stop) {
-  // Get the records for this time range.
-  auto indexes = getIndexes(start, stop);
-  auto records = getRecords(indexes);
+  getRange(yield, start, stop, false, 0);
+}
 
-  std::string events_key = "data." + dbNamespace();
-  std::vector<std::string> mapped_records;
-  for (const auto& record : records) {
-    if (record.second >= start && (record.second <= stop || stop == 0)) {
-      mapped_records.push_back(events_key + "." + record.first);
+void EventSubscriberPlugin::getRange(RowYield& yield,
+                                     EventTime start,
+                                     EventTime stop,
+                                     bool descending,
+                                     size_t limit) {
+  // Buffered events are written, and expired events removed, before reading.
+  flushEvents();
+  EventTime expire_time = 0;
+  {
+    WriteLock lock(event_expire_lock_);
+    if (!EventExpirationRunner::active()) {
+      expireEvents();
     }
+    expire_time = expire_time_;
+  }
+
+  // Events waiting for the expiration runner are not selected.
+  if (expire_time > 0 && start <= expire_time) {
+    start = expire_time + 1;
+  }
+
+  // Event keys are ordered by time, the range is a single seek and scan.
+  auto data_key = getDataKey();
+  auto high = (stop == 0) ? data_key + kEventKeyHigh
+                          : getTimeKey(data_key, stop) + kEventKeyHigh;
+
+  size_t last_eid = 0;
+  std::deque<std::string> values;
+  scanDatabaseRange(
+      kEvents,
+      getTimeKey(data_key, start),
+      high,
+      [&](const std::string& key, const std::string& value) {
+        EventTime et = 0;
+        size_t eid = 0;
+        if (!parseEventKey(key, data_key.size(), et, eid)) {
+          return true;
+        }
+
+        if (FLAGS_events_optimize && et <= optimize_time_ + 1 &&
+            eid <= optimize_eid_) {
+          // There is an optimization collision, the event was selected.
+          return true;
+        }
+
+        last_eid = std::max(last_eid, eid);
+        values.push_back(value);
+        if (limit > 0 && values.size() > limit) {
+          // Only the newest events are kept when selecting in reverse.
+          values.pop_front();
+        }
+        // The oldest events are selected once the limit is reached.
+        return descending || limit == 0 || values.size() < limit;
+      });
+
+  if (FLAGS_events_optimize && !values.empty()) {
+    // If records were returned save the last as the optimization EID.
+    optimize_eid_ = last_eid;
   }
 
-  if (FLAGS_events_optimize && !records.empty()) {
-    // If records were returned save the ordered-last as the optimization EID.
-    unsigned long int eidr = 0;
-    if (safeStrtoul(records.back().first, 10, eidr)) {
-      optimize_eid_ = static_cast<size_t>(eidr);
+  // Events are only deserialized as the rows are used.
+  auto yieldEvent = ([this, &yield](const std::string& value) {
+    Row r;
+    if (deserializeEvent(value, r).ok()) {
+      yield(r);
     }
+  });
+  if (descending) {
+    std::for_each(values.rbegin(), values.rend(), yieldEvent);
+  } else {
+    std::for_each(values.begin(), values.end(), yieldEvent);
   }
+  recordSelect();
+}
 
-  // Select mapped_records using event_ids as keys.
-  std::string data_value;
-  for (const auto& record : mapped_records) {
-    Row r;
-    auto status = getDatabaseValue(kEvents, record, data_value);
-    if (data_value.length() == 0) {
-      // There is no record here, interesting error case.
-      continue;
+bool EventSubscriberPlugin::getShared(RowYield& yield,
+                                      const std::string& query,
+                                      EventTime start) {
+  // Buffered events are written, and expired events removed, before reading.
+  flushEvents();
+  EventTime expire_time = 0;
+  {
+    WriteLock lock(event_expire_lock_);
+    if (!EventExpirationRunner::active()) {
+      expireEvents();
     }
-    status = deserializeRowJSON(data_value, r);
-    data_value.clear();
-    if (status.ok()) {
-      yield(r);
+    expire_time = expire_time_;
+  }
+
+  // Rows are yielded after the history is unlocked.
+  std::vector<Row> rows;
+  size_t last_eid = 0;
+  {
+    WriteLock lock(history_lock_);
+    if (!history_valid_) {
+      history_start_ = history_time_ = start;
+      history_valid_ = true;
+    }
+
+    if (start < history_start_) {
+      // The query's cursor is older than the events kept.
+      return false;
     }
+
+    readHistory(expire_time);
+    for (const auto& event : history_) {
+      if (event.time < start || event.time <= expire_time ||
+          (event.time <= optimize_time_ + 1 && event.eid <= optimize_eid_)) {
+        // The event was selected by this query.
+        continue;
+      }
+      last_eid = std::max(last_eid, event.eid);
+      rows.push_back(event.row);
+    }
+
+    if (!rows.empty()) {
+      optimize_eid_ = last_eid;
+    }
+    cursors_[query] = std::make_pair(optimize_time_, optimize_eid_);
+    trimHistory(expire_time);
   }
 
+  for (auto& r : rows) {
+    yield(r);
+  }
+  recordSelect();
+  return true;
+}
+
+void EventSubscriberPlugin::readHistory(EventTime expire_time) {
+  auto data_key = getDataKey();
+  auto start = history_time_;
+  if (expire_time > 0 && start <= expire_time) {
+    start = expire_time + 1;
+  }
+
+  auto read_time = getUnixTime() - 1;
+  auto last_eid = history_eid_;
+  scanDatabaseRange(
+      kEvents,
+      getTimeKey(data_key, start),
+      data_key + kEventKeyHigh,
+      [&](const std::string& key, const std::string& value) {
+        EventTime et = 0;
+        size_t eid = 0;
+        if (!parseEventKey(key, data_key.size(), et, eid)) {
+          return true;
+        }
+
+        if (et <= history_time_ + 1 && eid <= history_eid_) {
+          // The event was read by a previous shared read.
+          return true;
+        }
+
+        Row r;
+        if (deserializeEvent(value, r).ok()) {
+          last_eid = std::max(last_eid, eid);
+          history_.push_back({et, eid, std::move(r)});
+        }
+        return true;
+      });
+
+  history_time_ = read_time;
+  history_eid_ = last_eid;
+}
+
+void EventSubscriberPlugin::trimHistory(EventTime expire_time) {
+  // Every scheduled query selects events at or after its cursor time.
+  auto consumed =
+      std::max(expire_time + 1, getConsumedTime(cursors_, query_count_));
+
+  if (consumed > history_start_) {
+    history_.erase(std::remove_if(history_.begin(),
+                                  history_.end(),
+                                  [consumed](const HistoryEvent& event) {
+                                    return event.time < consumed;
+                                  }),
+                   history_.end());
+    history_start_ = consumed;
+  }
+
+  if (history_.size() > kEventHistoryMax) {
+    // Queries with older cursors read the stored events.
+    history_.clear();
+    history_start_ = history_time_;
+  }
+}
+
+void EventSubscriberPlugin::recordSelect() {
   auto expiry = getEventsExpiry();
   if (expiry > 0) {
     // Make sure the configured expiration is at least the minimum needed to
@@ -547,9 +1157,24 @@ void EventSubscriberPlugin::get(RowYield& yield,
     }
 
     // Set the expire time to NOW - "configured lifetime".
-    // Index retrieval will apply the constraints checking and auto-expire.
-    expire_time_ = getUnixTime() - expiry;
-    expire_time_ = expire_time_ - (expire_time_ % 60);
+    // The next selection, or expiration pass, will remove the expired events.
+    auto expire_time = getUnixTime() - expiry;
+    WriteLock lock(event_expire_lock_);
+    expire_time_ = expire_time - (expire_time % 60);
+  }
+
+  if (FLAGS_events_expire_consumed && expire_events_) {
+    // Events before the cursor of every scheduled query will not be selected.
+    EventTime consumed = 0;
+    {
+      WriteLock lock(history_lock_);
+      consumed = getConsumedTime(cursors_, query_count_);
+    }
+
+    if (consumed > 0) {
+      WriteLock lock(event_expire_lock_);
+      expire_time_ = std::max(expire_time_, consumed - 1);
+    }
   }
 
   if (FLAGS_events_optimize) {
@@ -567,34 +1192,137 @@ Status EventSubscriberPlugin::add(Row& r, EventTime event_time) {
 
   r["time"] = std::to_string(event_time);
   r["eid"] = eid;
-  // Serialize and store the row data, for query-time retrieval.
-  std::string data;
-  auto status = serializeRowJSON(r, data);
-  if (!status.ok()) {
-    return status;
-  }
-  // Then remove the newline.
-  if (data.size() > 0 && data.back() == '\n') {
-    data.pop_back();
-  }
 
   // Use the last EventID and a checkpoint bucket size to periodically apply
   // buffer eviction. Eviction occurs if the total count exceeds events_max.
-  if (last_eid_ % EVENTS_CHECKPOINT == 0) {
+  if (last_eid_ % EVENTS_CHECKPOINT == 0 && !EventExpirationRunner::active()) {
+    WriteLock lock(event_expire_lock_);
     expireCheck();
   }
 
-  // Logger plugins may request events to be forwarded directly.
+  // Logger plugins may request events to be forwarded directly as JSON.
   // If no active logger is marked 'usesLogEvent' then this is a no-op.
-  EventFactory::forwardEvent(data);
-
-  // Store the event data.
-  std::string event_key = "data." + dbNamespace() + "." + eid;
-  status = setDatabaseValue(kEvents, event_key, data);
-  // Record the event in the indexing bins, using the index time.
-  recordEvent(eid, event_time);
+  if (EventFactory::forwardsEvents() && loggerUsesMessagePack()) {
+    // Values are ordered by the table schema, rather than keyed by column.
+    const auto& codec = getCodec();
+    std::string record;
+    serializeEventMessagePack(
+        getName(), codec->schema(), codec->columns(), r, record);
+    EventFactory::forwardEvent(record);
+  } else if (EventFactory::forwardsEvents()) {
+    std::string json;
+    auto status = serializeRowJSON(r, json);
+    if (!status.ok()) {
+      return status;
+    }
+    // Then remove the newline.
+    if (json.size() > 0 && json.back() == '\n') {
+      json.pop_back();
+    }
+    EventFactory::forwardEvent(json);
+  }
   event_count_++;
-  return status;
+
+  // Scheduled queries triggered by this table are due after the activity.
+  last_event_time_ = getUnixTime();
+
+  // Rollups aggregate every event, including those that are not stored.
+  auto rollups = std::atomic_load(&rollups_);
+  if (rollups != nullptr) {
+    for (const auto& rollup : *rollups) {
+      rollup->add(r, event_time);
+    }
+  }
+
+  if (!store_events_) {
+    return Status(0, "OK");
+  }
+
+  // Discard events that no scheduled query selecting from this table returns.
+  auto predicates = std::atomic_load(&predicates_);
+  if (predicates != nullptr && !predicates->matches(r)) {
+    return Status(0, "OK");
+  }
+
+  // Serialize and store the row data, for query-time retrieval.
+  std::string data;
+  serializeEvent(r, data);
+
+  // Buffer the event data, which is keyed by the event time.
+  recordEvent(eid, event_time, std::move(data));
+  if (shouldFlushEvents()) {
+    return flushEvents();
+  }
+  return Status(0, "OK");
+}
+
+const EventRowCodecRef& EventSubscriberPlugin::getCodec() {
+  std::call_once(codec_flag_, [this]() {
+    std::vector<std::string> columns;
+    auto plugin = std::dynamic_pointer_cast<TablePlugin>(
+        Registry::get().registry("table")->plugin(getName()));
+    if (plugin != nullptr) {
+      for (const auto& column : plugin->columns()) {
+        columns.push_back(std::get<0>(column));
+      }
+    }
+
+    // The event time and ID are added to every row.
+    for (const auto& column : {"time", "eid"}) {
+      if (std::find(columns.begin(), columns.end(), column) == columns.end()) {
+        columns.push_back(column);
+      }
+    }
+
+    codec_ = std::make_shared<EventRowCodec>(std::move(columns));
+    setDatabaseValue(kEvents,
+                     "schema." + dbNamespace() + "." +
+                         std::to_string(codec_->schema()),
+                     boost::algorithm::join(codec_->columns(), "\n"));
+  });
+  return codec_;
+}
+
+void EventSubscriberPlugin::serializeEvent(const Row& r, std::string& data) {
+  getCodec()->encode(r, data);
+}
+
+Status EventSubscriberPlugin::deserializeEvent(const std::string& data,
+                                               Row& r) {
+  if (!EventRowCodec::isEncoded(data)) {
+    // Events stored before the binary encoding are JSON.
+    return deserializeRowJSON(data, r);
+  }
+
+  const auto& current = getCodec();
+  auto schema = EventRowCodec::getSchema(data);
+  if (current->schema() == schema) {
+    return current->decode(data, r);
+  }
+
+  EventRowCodecRef codec;
+  {
+    WriteLock lock(codec_lock_);
+    auto previous = previous_codecs_.find(schema);
+    if (previous != previous_codecs_.end()) {
+      codec = previous->second;
+    } else {
+      // Events may be encoded by a previous process using other columns.
+      std::string content;
+      getDatabaseValue(kEvents,
+                       "schema." + dbNamespace() + "." + std::to_string(schema),
+                       content);
+      if (content.empty()) {
+        return Status(1, "Unknown event row schema");
+      }
+
+      std::vector<std::string> columns;
+      boost::split(columns, content, boost::is_any_of("\n"));
+      codec = std::make_shared<EventRowCodec>(std::move(columns));
+      previous_codecs_[schema] = codec;
+    }
+  }
+  return codec->decode(data, r);
 }
 
 EventPublisherRef EventSubscriberPlugin::getPublisher() const {
@@ -621,6 +1349,14 @@ void EventFactory::delay() {
   // Create a thread for each event publisher.
   auto& ef = EventFactory::getInstance();
   for (const auto& publisher : EventFactory::getInstance().event_pubs_) {
+    if (!publisher.second->usesThread()) {
+      // Publishers without a run loop are started from the calling thread.
+      if (!publisher.second->isEnding()) {
+        run(publisher.first);
+      }
+      continue;
+    }
+
     // Publishers that did not set up correctly are put into an ending state.
     if (!publisher.second->isEnding()) {
       auto thread_ = std::make_shared<std::thread>(
@@ -636,6 +1372,7 @@ Status EventPublisherPlugin::addSubscription(
   // subscriptions will be walked.
   WriteLock lock(subscription_lock_);
   subscriptions_.push_back(subscription);
+  updateSubscriptions();
   return Status(0);
 }
 
@@ -649,23 +1386,28 @@ void EventPublisherPlugin::removeSubscriptions(const std::string& subscriber) {
                        return (subscription->subscriber_name == subscriber);
                      });
   subscriptions_.erase(end, subscriptions_.end());
+  updateSubscriptions();
 }
 
 void EventFactory::addForwarder(const std::string& logger) {
   getInstance().loggers_.push_back(logger);
 }
 
+bool EventFactory::forwardsEvents() {
+  return !getInstance().loggers_.empty();
+}
+
 void EventFactory::forwardEvent(const std::string& event) {
-  for (const auto& logger : getInstance().loggers_) {
-    Registry::call("logger", logger, {{"event", event}});
-  }
+  logEvent(event, getInstance().loggers_);
 }
 
 void EventFactory::configUpdate() {
   // Scan the schedule for queries that touch "_events" tables.
   // We will count the queries
   std::map<std::string, SubscriberExpirationDetails> subscriber_details;
-  Config::get().scheduledQueries([&subscriber_details](
+  // The predicates each subscriber's queries apply, nullptr to keep all events.
+  std::map<std::string, std::shared_ptr<EventQueryPredicates>> predicates;
+  Config::get().scheduledQueries([&subscriber_details, &predicates](
       const std::string& name, const ScheduledQuery& query) {
     std::vector<std::string> tables;
     // Convert query string into a list of virtual tables effected.
@@ -688,6 +1430,28 @@ void EventFactory::configUpdate() {
                                  ? query.interval
                                  : details.max_interval;
       details.query_count++;
+
+      if (predicates.count(subscriber) > 0 && predicates[subscriber] == nullptr) {
+        continue;
+      }
+
+      auto plugin = std::dynamic_pointer_cast<TablePlugin>(
+          Registry::get().registry("table")->plugin(subscriber));
+      std::vector<EventPredicate> query_predicates;
+      if (plugin == nullptr ||
+          !getQueryPredicates(
+              query.query, subscriber, plugin->columns(), query_predicates) ||
+          query_predicates.empty()) {
+        // This query may select every event.
+        predicates[subscriber] = nullptr;
+        continue;
+      }
+
+      auto& subscriber_predicates = predicates[subscriber];
+      if (subscriber_predicates == nullptr) {
+        subscriber_predicates = std::make_shared<EventQueryPredicates>();
+      }
+      subscriber_predicates->add(std::move(query_predicates));
     }
   });
 
@@ -710,14 +1474,145 @@ void EventFactory::configUpdate() {
     }
     subscriber->query_count_ = details.second.query_count;
 
-    WriteLock subscriber_lock(subscriber->event_query_record_);
-    subscriber->queries_.clear();
+    {
+      WriteLock subscriber_lock(subscriber->event_query_record_);
+      subscriber->queries_.clear();
+    }
+
+    // Queries removed from the schedule no longer hold the shared history.
+    WriteLock history_lock(subscriber->history_lock_);
+    subscriber->cursors_.clear();
+  }
+
+  {
+    // Subscribers without scheduled queries keep every event for ad-hoc use.
+    WriteLock lock(ef.factory_lock_);
+    for (const auto& subscriber : ef.event_subs_) {
+      std::shared_ptr<const EventQueryPredicates> subscriber_predicates;
+      auto it = predicates.find(subscriber.first);
+      if (FLAGS_events_pushdown && it != predicates.end()) {
+        subscriber_predicates = it->second;
+      }
+      std::atomic_store(&subscriber.second->predicates_, subscriber_predicates);
+    }
   }
+  configureRollups();
 
   // If events are enabled configure the subscribers before publishers.
   if (!FLAGS_disable_events) {
     RegistryFactory::get().registry("event_subscriber")->configure();
+    configurePublishers();
+  }
+}
+
+void EventFactory::configureRollups() {
+  auto& ef = EventFactory::getInstance();
+  std::map<std::string, std::shared_ptr<EventRollup>> rollups;
+  std::set<std::string> unstored;
+  auto plugin = Config::get().getParser("events");
+  if (plugin != nullptr && plugin.get() != nullptr) {
+    const auto& events = plugin->getData().get_child("events");
+    if (events.count("rollups") > 0) {
+      for (const auto& item : events.get_child("rollups")) {
+        RollupSpec spec;
+        auto status = parseRollup(item.first, item.second, spec);
+        if (!status.ok()) {
+          LOG(WARNING) << status.getMessage();
+          continue;
+        }
+
+        // An unchanged rollup keeps its in-memory buckets.
+        auto existing = ef.rollups_.find(spec.name);
+        if (existing != ef.rollups_.end() &&
+            existing->second->spec() == spec) {
+          rollups[spec.name] = existing->second;
+        } else if (existing == ef.rollups_.end() &&
+                   Registry::get().exists("table", spec.name)) {
+          LOG(WARNING) << "Rollup name is an existing table: " << spec.name;
+        } else {
+          rollups[spec.name] = std::make_shared<EventRollup>(std::move(spec));
+        }
+      }
+    }
+
+    if (events.count("disable_storage") > 0) {
+      for (const auto& item : events.get_child("disable_storage")) {
+        unstored.insert(item.second.data());
+      }
+    }
+  }
+
+  WriteLock lock(ef.factory_lock_);
+  auto tables = RegistryFactory::get().registry("table");
+  for (const auto& rollup : ef.rollups_) {
+    auto it = rollups.find(rollup.first);
+    if (it != rollups.end() && it->second == rollup.second) {
+      continue;
+    }
+
+    // The table of a removed or changed rollup is dropped with its buckets.
+    tables->remove(rollup.first);
+    Registry::call(
+        "sql", "sql", {{"action", "detach"}, {"table", rollup.first}});
+    rollup.second->clear();
+  }
+
+  for (const auto& rollup : rollups) {
+    auto it = ef.rollups_.find(rollup.first);
+    if (it == ef.rollups_.end() || it->second != rollup.second) {
+      tables->add(rollup.first,
+                  std::make_shared<RollupTablePlugin>(rollup.second));
+    }
+  }
+  ef.rollups_ = rollups;
+
+  for (const auto& subscriber : ef.event_subs_) {
+    auto subscriber_rollups =
+        std::make_shared<std::vector<std::shared_ptr<EventRollup>>>();
+    for (const auto& rollup : rollups) {
+      if (rollup.second->spec().table == subscriber.first) {
+        subscriber_rollups->push_back(rollup.second);
+      }
+    }
+
+    if (subscriber_rollups->empty()) {
+      subscriber_rollups.reset();
+    }
+    std::atomic_store(
+        &subscriber.second->rollups_,
+        std::shared_ptr<const std::vector<std::shared_ptr<EventRollup>>>(
+            subscriber_rollups));
+    subscriber.second->store_events_ = (unstored.count(subscriber.first) == 0);
+  }
+}
+
+void EventFactory::deferConfigure() {
+  getInstance().defer_configure_ = FLAGS_events_defer_configure;
+}
+
+void EventFactory::configurePublishers() {
+  auto& ef = EventFactory::getInstance();
+  if (!ef.defer_configure_) {
     RegistryFactory::get().registry("event_publisher")->configure();
+    return;
+  }
+
+  std::vector<EventPublisherRef> publishers;
+  {
+    ReadLock lock(ef.factory_lock_);
+    for (const auto& publisher : ef.event_pubs_) {
+      publishers.push_back(publisher.second);
+    }
+  }
+
+  for (const auto& publisher : publishers) {
+    // A publisher that failed to set up never starts, nor needs a configure.
+    WriteLock lock(publisher->configure_lock_);
+    if (publisher->hasStarted()) {
+      publisher->configure();
+    } else if (!publisher->isEnding()) {
+      publisher->configure_pending_ = true;
+    }
   }
 }
 
@@ -744,7 +1639,21 @@ Status EventFactory::run(const std::string& type_id) {
     return Status(1, "Cannot restart an event publisher");
   }
   VLOG(1) << "Starting event publisher run loop: " + type_id;
-  publisher->hasStarted(true);
+  {
+    WriteLock lock(publisher->configure_lock_);
+    publisher->hasStarted(true);
+    if (publisher->configure_pending_ || !publisher->usesThread()) {
+      // A publisher without a run loop creates its callbacks when configured.
+      publisher->configure_pending_ = false;
+      StartupPhaseScope phase("configure " + type_id, true);
+      publisher->configure();
+    }
+  }
+
+  if (!publisher->usesThread()) {
+    // The publisher is torn down when it is deregistered.
+    return Status(0, "OK");
+  }
 
   auto status = Status(0, "OK");
   while (!publisher->isEnding()) {
@@ -890,7 +1799,18 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
 
   // Let the subscriber initialize any Subscriptions.
   if (!FLAGS_disable_events && !specialized_sub->disabled) {
-    specialized_sub->expireCheck();
+    specialized_sub->migrateEvents();
+    {
+      WriteLock lock(specialized_sub->event_expire_lock_);
+      specialized_sub->expireCheck();
+    }
+    EventExpirationRunner::startService();
+    if ((specialized_sub->usesQueue() || FLAGS_events_async_callbacks) &&
+        std::atomic_load(&specialized_sub->queue_) == nullptr) {
+      std::atomic_store(&specialized_sub->queue_,
+                        std::make_shared<EventSubscriberQueue>());
+      EventCallbackPool::get().start();
+    }
     status = specialized_sub->init();
     specialized_sub->state(EventState::EVENT_RUNNING);
   } else {
@@ -980,9 +1900,10 @@ Status EventFactory::deregisterEventPublisher(const std::string& type_id) {
 
   if (!FLAGS_disable_events) {
     publisher->isEnding(true);
-    if (!publisher->hasStarted()) {
+    if (!publisher->hasStarted() || !publisher->usesThread()) {
       // If a publisher's run loop was not started, call tearDown since
-      // the setUp happened at publisher registration time.
+      // the setUp happened at publisher registration time. Publishers without
+      // a run loop are always torn down here.
       publisher->tearDown();
       publisher->state(EventState::EVENT_NONE);
       // If the run loop did run the tear down and erase will happen in the
@@ -1005,6 +1926,15 @@ Status EventFactory::deregisterEventSubscriber(const std::string& sub) {
 
   auto& subscriber = ef.event_subs_.at(sub);
   subscriber->state(EventState::EVENT_NONE);
+  auto queue = std::atomic_load(&subscriber->queue_);
+  if (queue != nullptr) {
+    queue->stop();
+    std::atomic_store(&subscriber->queue_,
+                      std::shared_ptr<EventSubscriberQueue>());
+  }
+  if (DatabasePlugin::kDBInitialized) {
+    subscriber->flushEvents();
+  }
   subscriber->tearDown();
   ef.event_subs_.erase(sub);
   return Status(0);
@@ -1054,16 +1984,43 @@ void EventFactory::end(bool join) {
 
     // Threads may still be executing, when they finish, release publishers.
     ef.event_pubs_.clear();
+    if (DatabasePlugin::kDBInitialized) {
+      // Write events buffered by each subscriber before releasing them.
+      for (const auto& subscriber : ef.event_subs_) {
+        subscriber.second->flushEvents();
+      }
+      for (const auto& rollup : ef.rollups_) {
+        rollup.second->flush();
+      }
+    }
     ef.event_subs_.clear();
   }
 }
 
 void attachEvents() {
+  attachEventPublishers();
+  attachEventSubscribers();
+}
+
+void attachEventPublishers() {
+  // Publishers do not depend on each other, a slow setUp delays only itself.
+  std::vector<std::future<void>> setups;
   const auto& publishers = RegistryFactory::get().plugins("event_publisher");
   for (const auto& publisher : publishers) {
-    EventFactory::registerEventPublisher(publisher.second);
+    auto name = publisher.first;
+    auto plugin = publisher.second;
+    setups.push_back(std::async(std::launch::async, [name, plugin]() {
+      StartupPhaseScope phase("setup " + name);
+      EventFactory::registerEventPublisher(plugin);
+    }));
   }
 
+  for (auto& setup : setups) {
+    setup.wait();
+  }
+}
+
+void attachEventSubscribers() {
   const auto& subscribers = RegistryFactory::get().plugins("event_subscriber");
   for (const auto& subscriber : subscribers) {
     if (subscriber.first.find("_events") == std::string::npos ||
@@ -8,6 +8,8 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <set>
+
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
@@ -23,11 +25,8 @@ const std::string kKernelDevice = "/dev/osquery";
 /// Kernel shared buffer size in bytes.
 static const size_t kKernelQueueSize = (20 * (1 << 20));
 
-/// Handle a maximum of 1000 events before requesting a resync.
-static const int kKernelEventsSyncMax = 1000;
-
-/// Handle a maximum of 10 events before request another lock.
-static const int kKernelEventsIterate = 10;
+/// The number of synchronizations of a busy queue before pausing.
+static const size_t kKernelSyncMax = 64;
 
 REGISTER(KernelEventPublisher, "event_publisher", "kernel");
 
@@ -64,11 +63,26 @@ Status KernelEventPublisher::setUp() {
 
 void KernelEventPublisher::configure() {
   WriteLock lock(mutex_);
+  if (queue_ == nullptr) {
+    return;
+  }
+
+  // The kernel filters are replaced by the current subscriptions' filters.
+  std::set<osquery_event_t> types;
   for (const auto &sub : subscriptions_) {
-    if (queue_ != nullptr) {
+    types.insert(getSubscriptionContext(sub->context)->event_type);
+  }
+
+  try {
+    for (const auto &type : types) {
+      queue_->unsubscribe(type);
+    }
+    for (const auto &sub : subscriptions_) {
       auto sc = getSubscriptionContext(sub->context);
-      queue_->subscribe(sc->event_type);
+      queue_->subscribe(sc->event_type, sc->filter);
     }
+  } catch (const CQueueException &e) {
+    LOG(WARNING) << "Kernel subscription error: " << e.what();
   }
 }
 
@@ -88,29 +102,37 @@ Status KernelEventPublisher::run() {
     }
   }
 
-  // Perform queue read min/max synchronization.
-  try {
-    int drops = 0;
+  // Drain every event readable after each synchronization, synchronizing
+  // again to return the read space to the kernel, until the queues are empty.
+  bool busy = true;
+  for (size_t syncs = 0; syncs < kKernelSyncMax && busy; ++syncs) {
     WriteLock lock(mutex_);
-    if ((drops = queue_->kernelSync(OSQUERY_OPTIONS_NO_BLOCK)) > 0 &&
-        Initializer::isDaemon()) {
-      LOG(WARNING) << "Dropping " << drops << " kernel events";
+    // The kernel publisher may have been torn down.
+    if (queue_ == nullptr) {
+      busy = false;
+      break;
     }
-  } catch (const CQueueException &e) {
-    LOG(WARNING) << "Queue synchronization error: " << e.what();
-  }
 
-  auto dequeueEvents = [this]() {
-    // Dequeue several events while holding the lock.
-    int max_before_lock = kKernelEventsIterate;
-    while (max_before_lock > 0) {
-      // Request an event from the synchronized, safe, portion of the queue.
-      CQueue::event *event = nullptr;
-      auto event_type = queue_->dequeue(&event);
-      if (event_type == OSQUERY_NULL_EVENT) {
-        return false;
+    // Perform queue read min/max synchronization.
+    try {
+      int drops = queue_->kernelSync(OSQUERY_OPTIONS_NO_BLOCK);
+      if (drops > 0) {
+        // Events dropped by the kernel are reported by osquery_events.
+        dropped_count_ += drops;
+        if (Initializer::isDaemon()) {
+          LOG(WARNING) << "Dropping " << drops << " kernel events";
+        }
       }
+    } catch (const CQueueException &e) {
+      LOG(WARNING) << "Queue synchronization error: " << e.what();
+      busy = false;
+      break;
+    }
 
+    size_t events = 0;
+    CQueue::event *event = nullptr;
+    osquery_event_t event_type;
+    while ((event_type = queue_->dequeue(&event)) != OSQUERY_NULL_EVENT) {
       // Each event type may use a specific event type structure.
       KernelEventContextRef ec = nullptr;
       switch (event_type) {
@@ -126,29 +148,18 @@ Status KernelEventPublisher::run() {
         LOG(WARNING) << "Unknown kernel event received: " << event_type;
         break;
       }
-      max_before_lock--;
+      events++;
     }
-    return true;
-  };
 
-  // Iterate over each event type in the queue and appropriately fire each.
-  int max_before_sync = kKernelEventsSyncMax;
-  while (max_before_sync > 0) {
-    WriteLock lock(mutex_);
-    // The kernel publisher may have been torn down.
-    if (queue_ == nullptr) {
-      break;
-    }
-    // A NULL event occurred, stop dequeuing.
-    if (!dequeueEvents()) {
-      break;
-    }
-    // Append the number of dequeue events to the synchronization counter.
-    max_before_sync -= kKernelEventsIterate;
+    busy = (events > 0);
   }
 
   // Pause for a cool-off since we implement comms in a no-blocking mode.
-  pauseMilli(1000);
+  // A queue that was still busy after the maximum synchronizations is drained
+  // again without pausing.
+  if (!busy) {
+    pauseMilli(1000);
+  }
   return Status(0, "Continue");
 }
 
@@ -171,6 +182,26 @@ KernelEventContextRef KernelEventPublisher::createEventContextFrom(
 
 bool KernelEventPublisher::shouldFire(const KernelSubscriptionContextRef &sc,
                                       const KernelEventContextRef &ec) const {
-  return ec->event_type == sc->event_type;
+  if (ec->event_type != sc->event_type) {
+    return false;
+  }
+
+  // The kernel publishes events matching any subscription's filter.
+  using FileContext = TypedKernelEventContext<osquery_file_event_t>;
+  using ProcessContext = TypedKernelEventContext<osquery_process_event_t>;
+  const char *path = nullptr;
+  if (ec->event_type == OSQUERY_FILE_EVENT) {
+    const auto &event = static_cast<const FileContext &>(*ec).event;
+    if (sc->filter.actions != OSQUERY_FILE_ACTION_NONE &&
+        (sc->filter.actions & event.action) == 0) {
+      return false;
+    }
+    path = event.path;
+  } else if (ec->event_type == OSQUERY_PROCESS_EVENT) {
+    path = static_cast<const ProcessContext &>(*ec).event.path;
+  }
+
+  auto length = strnlen(sc->filter.path, MAXPATHLEN);
+  return path == nullptr || strncmp(path, sc->filter.path, length) == 0;
 }
 } // namespace osquery
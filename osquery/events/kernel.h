@@ -39,6 +39,9 @@ struct KernelSubscriptionContext : public SubscriptionContext {
   /// The kernel event subscription type.
   osquery_event_t event_type;
 
+  /// The events of the type to publish, evaluated by the kernel.
+  osquery_event_filter_t filter = {};
+
   /// Optional category passed to the callback.
   std::string category;
 };
@@ -21,6 +21,7 @@ CQueue::CQueue(const std::string &device, size_t size) {
   alloc.size = size;
   alloc.buffer = nullptr;
   alloc.version = OSQUERY_KERNEL_COMM_VERSION;
+  alloc.queues = 0;
 
   fd_ = open(device.c_str(), O_RDWR);
   if (fd_ < 0) {
@@ -31,10 +32,22 @@ CQueue::CQueue(const std::string &device, size_t size) {
     throw CQueueException("Could not allocate shared buffer");
   }
 
+  if (alloc.queues == 0 || alloc.queues > OSQUERY_MAX_CQUEUES) {
+    close(fd_);
+    fd_ = -1;
+    throw CQueueException("Invalid number of kernel queues");
+  }
+
+  // The buffer is divided equally, with each queue aligned as by the kernel.
   buffer_ = (uint8_t *)alloc.buffer;
-  size_ = size;
-  read_ = (uint8_t *)alloc.buffer;
-  max_read_ = (uint8_t *)alloc.buffer;
+  size_t lane_size = (size / alloc.queues) & ~(sizeof(uint64_t) - 1);
+  lanes_.resize(alloc.queues);
+  for (size_t i = 0; i < lanes_.size(); i++) {
+    lanes_[i].buffer = buffer_ + i * lane_size;
+    lanes_[i].size = lane_size;
+    lanes_[i].read = lanes_[i].buffer;
+    lanes_[i].max_read = lanes_[i].buffer;
+  }
 }
 
 CQueue::~CQueue() {
@@ -44,32 +57,60 @@ CQueue::~CQueue() {
   }
 }
 
-void CQueue::subscribe(osquery_event_t event) {
+void CQueue::subscribe(osquery_event_t event,
+                       const osquery_event_filter_t &filter) {
   osquery_subscription_args_t sub;
   sub.event = event;
   sub.subscribe = 1;
+  sub.filter = filter;
 
   if (ioctl(fd_, OSQUERY_IOCTL_SUBSCRIPTION, &sub)) {
     throw CQueueException("Could not subscribe to event");
   }
 }
 
+void CQueue::unsubscribe(osquery_event_t event) {
+  osquery_subscription_args_t sub = {};
+  sub.event = event;
+  sub.subscribe = 0;
+
+  if (ioctl(fd_, OSQUERY_IOCTL_SUBSCRIPTION, &sub)) {
+    throw CQueueException("Could not unsubscribe from event");
+  }
+}
+
 osquery_event_t CQueue::dequeue(CQueue::event **event) {
-  if (read_ == max_read_ || event == nullptr) {
+  if (event == nullptr) {
     return (osquery_event_t)0;
   }
-  osquery_data_header_t *header = (osquery_data_header_t *)read_;
-  if (read_ + sizeof(osquery_data_header_t) > buffer_ + size_ ||
+
+  // Drain each queue in turn, so an event needs one check when busy.
+  for (size_t checked = 0; checked < lanes_.size(); checked++) {
+    auto event_type = dequeue(lanes_[lane_], event);
+    if (event_type != (osquery_event_t)0) {
+      return event_type;
+    }
+    lane_ = (lane_ + 1) % lanes_.size();
+  }
+  return (osquery_event_t)0;
+}
+
+osquery_event_t CQueue::dequeue(Lane &lane, CQueue::event **event) {
+  if (lane.read == lane.max_read) {
+    return (osquery_event_t)0;
+  }
+  osquery_data_header_t *header = (osquery_data_header_t *)lane.read;
+  if (lane.read + sizeof(osquery_data_header_t) > lane.buffer + lane.size ||
       header->event == END_OF_BUFFER_EVENT) {
-    read_ = buffer_;
-    if (read_ == max_read_) {
+    lane.read = lane.buffer;
+    if (lane.read == lane.max_read) {
       return (osquery_event_t)0;
     }
   }
-  header = (osquery_data_header_t *)read_;
+  header = (osquery_data_header_t *)lane.read;
   if (header->event != END_OF_BUFFER_EVENT) {
     size_t size = header->size + sizeof(osquery_data_header_t);
-    read_ = (read_ + size - buffer_) % size_ + buffer_;
+    lane.read = (lane.read + size - lane.buffer) % lane.size + lane.buffer;
   }
 
   *event = (CQueue::event *)&(header->size);
@@ -80,15 +121,20 @@ int CQueue::kernelSync(int options) {
   // A positive return indicates drops, 0 is all good in the hood.
   // Options are listed in kernel feeds; primarily OSQUERY_OPTIONS_NO_BLOCK.
   osquery_buf_sync_args_t sync;
-  sync.read_offset = read_ - buffer_;
+  for (size_t i = 0; i < lanes_.size(); i++) {
+    sync.read_offset[i] = lanes_[i].read - buffer_;
+  }
   sync.options = options;
 
   int err = 0;
   err = ioctl(fd_, OSQUERY_IOCTL_BUF_SYNC, &sync);
-  uint8_t *new_max_read = sync.max_read_offset + buffer_;
-  max_read_ = new_max_read;
+  for (size_t i = 0; i < lanes_.size(); i++) {
+    lanes_[i].max_read = sync.max_read_offset[i] + buffer_;
+    if (err) {
+      lanes_[i].read = lanes_[i].max_read;
+    }
+  }
   if (err) {
-    read_ = max_read_;
     throw CQueueException("Could not sync buffer with kernel properly");
   }
 
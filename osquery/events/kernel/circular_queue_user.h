@@ -12,6 +12,7 @@
 
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 
@@ -61,20 +62,33 @@ class CQueue : private boost::noncopyable {
    * @brief Sends a subscription call to the kernel extension.
    *
    * This sets up the event callbacks so we start hearing about the given event.
+   * The kernel only queues the events matching a subscribed filter.
    *
    * @param event The event we are interested in.
+   * @param filter The events of the type to queue.
    */
-  void subscribe(osquery_event_t event);
+  void subscribe(osquery_event_t event, const osquery_event_filter_t &filter);
+
+  /// Remove the subscription, and every filter, of an event type.
+  void unsubscribe(osquery_event_t event);
 
   /**
    * @brief Dequeue's an event from the shared buffer.
    *
+   * The kernel writes to a queue for each CPU, events are dequeued from each
+   * queue in turn. Events are ordered within a queue, but not between queues.
+   *
    * @param event (output) A pointer to the event dequeue if any.
    * @return Returns 0 if queue is empty, otherwise the number of the event put
    * into event.
    */
   osquery_event_t dequeue(event **event);
 
+  /// The number of per-CPU queues within the shared buffer.
+  size_t queues() const {
+    return lanes_.size();
+  }
+
   /**
    * @brief Sync the cqueue structure with the cqueue structure in the kernel.
    *
@@ -87,11 +101,24 @@ class CQueue : private boost::noncopyable {
    */
   int kernelSync(int options);
 
+ private:
+  /// The readable region of a per-CPU queue.
+  struct Lane {
+    uint8_t *buffer{nullptr};
+    size_t size{0};
+    uint8_t *max_read{nullptr};
+    uint8_t *read{nullptr};
+  };
+
+  /// Dequeue an event from a single per-CPU queue.
+  static osquery_event_t dequeue(Lane &lane, event **event);
+
  private:
   uint8_t *buffer_{nullptr};
-  size_t size_{0};
-  uint8_t *max_read_{nullptr};
-  uint8_t *read_{nullptr};
+  std::vector<Lane> lanes_;
+
+  /// The queue dequeued from until it is empty.
+  size_t lane_{0};
   int fd_{-1};
 };
 
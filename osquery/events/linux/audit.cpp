@@ -10,7 +10,10 @@
 
 #include <poll.h>
 
-#include <queue>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <tuple>
 
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
@@ -23,6 +26,7 @@
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/ring_queue.h"
 #include "osquery/events/linux/audit.h"
 
 namespace osquery {
@@ -44,8 +48,19 @@ FLAG(bool,
 
 HIDDEN_FLAG(uint64, audit_queue_size, 8192 * 4, "Size of the userland queue");
 
+HIDDEN_FLAG(uint64,
+            audit_batch_size,
+            32,
+            "Number of netlink replies received with a single syscall");
+
 HIDDEN_FLAG(bool, audit_debug, false, "Debug Linux audit messages");
 
+/// The most rule changes sent to the kernel within a single netlink message.
+const size_t kAuditRuleBatchSize = 32;
+
+/// The time to wait for the kernel to acknowledge a batch of rule changes.
+const int kAuditRuleAckTimeout = 1000;
+
 REGISTER(AuditEventPublisher, "event_publisher", "audit");
 
 enum AuditStatus {
@@ -61,26 +76,45 @@ class AuditConsumer : private boost::noncopyable {
     return instance;
   }
 
-  /// Add and copy an audit reply into the queue.
-  void push(AuditEventContextRef& reply);
+  /**
+   * @brief Add an audit reply to the queue, called by the publisher thread.
+   *
+   * @return false if the userland queue is full and the reply was dropped.
+   */
+  bool push(AuditEventContextRef& reply);
+
+  /// Remove the front reply, called by the consumer thread.
+  bool pop(AuditEventContextRef& reply);
+
+  /// Wait for queued replies, or a wakeup, up to a timeout.
+  void wait(size_t milli);
 
-  /// Inspect the front of the queue, usually to move the content.
-  AuditEventContextRef& peek();
+  /// Wake a waiting consumer.
+  void wakeup();
 
-  size_t size() const;
+  /// Get an empty event context, reusing a context the consumer released.
+  AuditEventContextRef acquire();
 
-  /// Remove the front element.
-  void pop();
+  /// Return a fired event context for reuse, called by the consumer thread.
+  void release(AuditEventContextRef& ec);
 
  private:
-  /// The managed thread-unsafe queue.
-  std::queue<AuditEventContextRef> queue_;
+  AuditConsumer()
+      : queue_(FLAGS_audit_queue_size), pool_(FLAGS_audit_batch_size * 4) {}
 
-  /// An observed max-size of the queue.
-  size_t max_size_ = 0;
+ private:
+  /// The single-producer, single-consumer queue of replies.
+  RingQueue<AuditEventContextRef> queue_;
+
+  /// Fired contexts returned by the consumer to the producer for reuse.
+  RingQueue<AuditEventContextRef> pool_;
 
-  /// The queue-protecting Mutex.
-  mutable Mutex mutex_;
+  /// Set while the consumer is waiting, the producer only notifies if set.
+  std::atomic<bool> waiting_{false};
+
+  /// The wait-protecting mutex and condition, the queue is lock-free.
+  std::mutex wait_mutex_;
+  std::condition_variable wait_cv_;
 };
 
 class AuditConsumerRunner : public InternalRunnable {
@@ -91,6 +125,9 @@ class AuditConsumerRunner : public InternalRunnable {
   /// Thread entrypoint.
   void start() override;
 
+  /// Wake the consumer such that it observes the interruption.
+  void stop() override;
+
  private:
   AuditEventPublisher* publisher_;
 };
@@ -109,9 +146,8 @@ void AuditAssembler::start(size_t capacity,
   types_ = std::move(types);
 }
 
-boost::optional<AuditFields> AuditAssembler::add(AuditId id,
-                                                 size_t type,
-                                                 const AuditFields& fields) {
+boost::optional<AuditFields> AuditAssembler::add(
+    AuditId id, size_t type, const AuditFieldView& fields) {
   auto it = m_.find(id);
   if (it == m_.end()) {
     // A new audit ID.
@@ -187,6 +223,167 @@ bool AuditAssembler::complete(AuditId id) {
   return true;
 }
 
+/// Build the rule data for a rule and the set of syscalls merged into it.
+static AuditRuleData getRuleData(const AuditRule& rule,
+                                 const std::vector<int>& syscalls) {
+  // The library may reallocate the rule to append filter strings.
+  auto data = static_cast<struct audit_rule_data*>(
+      calloc(1, sizeof(struct audit_rule_data)));
+  if (data == nullptr) {
+    return "";
+  }
+
+  for (const auto& syscall : syscalls) {
+    audit_rule_syscall_data(data, syscall);
+  }
+
+  if (!rule.filter.empty() &&
+      audit_rule_fieldpair_data(&data, rule.filter.c_str(), rule.flags) < 0) {
+    LOG(WARNING) << "Cannot parse audit rule filter: '" << rule.filter << "'";
+    free(data);
+    return "";
+  }
+
+  // The add and delete requests set the flags and action the same way.
+  data->flags = static_cast<uint32_t>(rule.flags);
+  data->action = static_cast<uint32_t>(rule.action);
+  AuditRuleData rule_data(reinterpret_cast<const char*>(data),
+                          sizeof(struct audit_rule_data) + data->buflen);
+  free(data);
+  return rule_data;
+}
+
+std::set<AuditRuleData> getAuditRuleData(const std::vector<AuditRule>& rules) {
+  // Rules without a syscall are never merged with syscall rules.
+  using RuleKey = std::tuple<std::string, int, int, bool>;
+  std::map<RuleKey, std::pair<const AuditRule*, std::vector<int>>> merged;
+  for (const auto& rule : rules) {
+    if (!rule.apply_rule) {
+      continue;
+    }
+
+    auto& entry = merged[std::make_tuple(
+        rule.filter, rule.flags, rule.action, rule.syscall != 0)];
+    entry.first = &rule;
+    if (rule.syscall != 0) {
+      entry.second.push_back(rule.syscall);
+    }
+  }
+
+  std::set<AuditRuleData> rule_data;
+  for (const auto& entry : merged) {
+    auto data = getRuleData(*entry.second.first, entry.second.second);
+    if (!data.empty()) {
+      rule_data.insert(std::move(data));
+    }
+  }
+  return rule_data;
+}
+
+/**
+ * @brief Send rule changes within one netlink message and read each ack.
+ *
+ * A separate audit handle is used such that the acknowledgements are not
+ * consumed by the publisher's run loop.
+ */
+static void sendAuditRules(
+    const std::vector<std::pair<int, const AuditRuleData*>>& changes) {
+  auto handle = audit_open();
+  if (handle <= 0) {
+    LOG(WARNING) << "Cannot open audit handle to change rules";
+    return;
+  }
+
+  std::vector<char> request;
+  for (size_t i = 0; i < changes.size(); i++) {
+    const auto& data = *changes[i].second;
+    auto offset = request.size();
+    request.resize(offset + NLMSG_SPACE(data.size()), 0);
+
+    auto message = reinterpret_cast<struct nlmsghdr*>(&request[offset]);
+    message->nlmsg_len = static_cast<uint32_t>(NLMSG_LENGTH(data.size()));
+    message->nlmsg_type = static_cast<uint16_t>(changes[i].first);
+    message->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    message->nlmsg_seq = static_cast<uint32_t>(i + 1);
+    memcpy(NLMSG_DATA(message), data.data(), data.size());
+  }
+
+  struct sockaddr_nl kernel;
+  memset(&kernel, 0, sizeof(kernel));
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(handle,
+             request.data(),
+             request.size(),
+             0,
+             reinterpret_cast<struct sockaddr*>(&kernel),
+             sizeof(kernel)) < 0) {
+    LOG(WARNING) << "Cannot send audit rule changes: " << strerror(errno);
+    audit_close(handle);
+    return;
+  }
+
+  // Each change is acknowledged, the kernel handles them in order.
+  size_t acks = 0;
+  std::vector<char> buffer(MAX_AUDIT_MESSAGE_LENGTH);
+  struct pollfd fds[1];
+  fds[0].fd = handle;
+  fds[0].events = POLLIN;
+  while (acks < changes.size() && ::poll(fds, 1, kAuditRuleAckTimeout) > 0) {
+    auto bytes = recv(handle, buffer.data(), buffer.size(), MSG_DONTWAIT);
+    if (bytes < 0 && (errno == EINTR || errno == EAGAIN)) {
+      continue;
+    } else if (bytes <= 0) {
+      break;
+    }
+
+    auto size = static_cast<int>(bytes);
+    for (auto reply = reinterpret_cast<struct nlmsghdr*>(buffer.data());
+         NLMSG_OK(reply, size);
+         reply = NLMSG_NEXT(reply, size)) {
+      if (reply->nlmsg_type != NLMSG_ERROR || reply->nlmsg_seq == 0 ||
+          reply->nlmsg_seq > changes.size()) {
+        continue;
+      }
+
+      acks++;
+      auto error = static_cast<struct nlmsgerr*>(NLMSG_DATA(reply));
+      auto type = changes[reply->nlmsg_seq - 1].first;
+      if (error->error == 0 ||
+          (type == AUDIT_ADD_RULE && error->error == -EEXIST) ||
+          (type == AUDIT_DEL_RULE && error->error == -ENOENT)) {
+        // The rule is installed or removed as requested.
+        continue;
+      }
+      LOG(WARNING) << "Cannot "
+                   << ((type == AUDIT_ADD_RULE) ? "add" : "delete")
+                   << " audit rule: " << strerror(-error->error);
+    }
+  }
+
+  if (acks < changes.size()) {
+    LOG(WARNING) << "Audit rule changes were not acknowledged";
+  }
+  audit_close(handle);
+}
+
+void AuditEventPublisher::applyRules(
+    const std::vector<const AuditRuleData*>& additions,
+    const std::vector<const AuditRuleData*>& deletions) {
+  std::vector<std::pair<int, const AuditRuleData*>> changes;
+  for (const auto& rule : additions) {
+    changes.push_back(std::make_pair(AUDIT_ADD_RULE, rule));
+  }
+  for (const auto& rule : deletions) {
+    changes.push_back(std::make_pair(AUDIT_DEL_RULE, rule));
+  }
+
+  // Large changes are split to bound the size of each netlink message.
+  for (size_t i = 0; i < changes.size(); i += kAuditRuleBatchSize) {
+    auto end = std::min(changes.size(), i + kAuditRuleBatchSize);
+    sendAuditRules({changes.begin() + i, changes.begin() + end});
+  }
+}
+
 Status AuditEventPublisher::setUp() {
   if (FLAGS_disable_audit) {
     return Status(1, "Publisher disabled via configuration");
@@ -234,16 +431,30 @@ Status AuditEventPublisher::setUp() {
     set_aumessage_mode(MSG_QUIET, DBG_NO);
   }
 
+  // Before reply data is ever filled in, allocate the reply buffers.
+  batch_.resize(std::max<size_t>(FLAGS_audit_batch_size, 1));
+
   Dispatcher::addService(std::make_shared<AuditConsumerRunner>(this));
   return Status(0, "OK");
 }
 
 void AuditEventPublisher::configure() {
-  // Able to issue libaudit API calls.
-  struct AuditRuleInternal rule;
+  // Collect the fields used by each subscription.
+  std::shared_ptr<AuditFieldFilter> filter;
+  for (auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->fields.empty()) {
+      filter = nullptr;
+      break;
+    }
 
-  // Before reply data is ever filled in, assure an empty message.
-  memset(&reply_, 0, sizeof(struct audit_reply));
+    if (filter == nullptr) {
+      filter = std::make_shared<AuditFieldFilter>();
+    }
+    filter->insert(filter->end(), sc->fields.begin(), sc->fields.end());
+  }
+  std::atomic_store(&field_filter_,
+                    std::shared_ptr<const AuditFieldFilter>(filter));
 
   if (handle_ <= 0 || FLAGS_disable_audit || immutable_) {
     // No configuration or rule manipulation needed.
@@ -256,47 +467,56 @@ void AuditEventPublisher::configure() {
     return;
   }
 
+  // Only the difference from the installed rules is applied, the kernel is
+  // never left without rules that are still subscribed.
+  std::vector<AuditRule> rules;
   for (auto& sub : subscriptions_) {
     auto sc = getSubscriptionContext(sub->context);
-    for (const auto& scr : sc->rules) {
-      // Reset all members to nothing.
-      memset(&rule.rule, 0, sizeof(struct audit_rule_data));
-
-      if (scr.syscall != 0) {
-        audit_rule_syscall_data(&rule.rule, scr.syscall);
-      }
-
-      if (scr.filter.size() > 0) {
-        // Fill in rule's filter data.
-        auto* rrule = &rule.rule;
-        audit_rule_fieldpair_data(&rrule, scr.filter.c_str(), scr.flags);
-      }
-
-      // Apply this rule to the EXIT filter, ALWAYS.
-      VLOG(1) << "Adding audit rule: syscall=" << scr.syscall
-              << " action=" << scr.action << " filter='" << scr.filter << "'";
-      int rc = audit_add_rule_data(handle_, &rule.rule, scr.flags, scr.action);
-      if (rc < 0) {
-        // Problem adding rule. If errno == EEXIST then fine.
-        LOG(WARNING) << "Cannot add audit rule: syscall=" << scr.syscall
-                     << " filter='" << scr.filter << "': error " << rc;
+    rules.insert(rules.end(), sc->rules.begin(), sc->rules.end());
+  }
+  auto configured = getAuditRuleData(rules);
+
+  std::vector<const AuditRuleData*> additions;
+  std::vector<const AuditRuleData*> deletions;
+  {
+    WriteLock lock(rules_mutex_);
+    for (const auto& rule : configured) {
+      // Rules removed by another process since the last list are added again.
+      if (transient_rules_.count(rule) == 0 ||
+          (listed_ && listed_rules_.count(rule) == 0)) {
+        additions.push_back(&rule);
       }
+    }
+  }
 
-      // Note: all rules are considered transient if added by subscribers.
-      // Add this rule data to the publisher's list of transient rules.
-      // These will be removed during tear down or re-configure.
-      rule.flags = scr.flags;
-      rule.action = scr.action;
-      transient_rules_.push_back(rule);
+  for (const auto& rule : transient_rules_) {
+    if (configured.count(rule) == 0) {
+      deletions.push_back(&rule);
     }
   }
 
+  if (!additions.empty() || !deletions.empty()) {
+    VLOG(1) << "Changing audit rules: " << additions.size() << " added, "
+            << deletions.size() << " deleted";
+    applyRules(additions, deletions);
+  }
+
+  // Note: all rules are considered transient if added by subscribers.
+  // These will be removed during tear down or re-configure.
+  transient_rules_ = std::move(configured);
+
   // The audit library provides an API to send a netlink request that fills in
-  // a netlink reply with audit rules. As such, this process will maintain a
-  // single open handle and reply to audit-metadata tables with the buffered
-  // content from the publisher.
+  // a netlink reply with audit rules. The run loop caches the listed rules,
+  // the next configure compares the subscribed rules with them.
+  {
+    WriteLock lock(rules_mutex_);
+    listing_ = true;
+    listing_rules_.clear();
+  }
   if (audit_request_rules_list_data(handle_) <= 0) {
     // Could not request audit rules.
+    WriteLock lock(rules_mutex_);
+    listing_ = false;
   }
 }
 
@@ -309,9 +529,12 @@ void AuditEventPublisher::tearDown() {
   // Each of these rules has been added by the publisher and should be remove
   // when the process tears down.
   if (!immutable_) {
-    for (auto& rule : transient_rules_) {
-      audit_delete_rule_data(handle_, &rule.rule, rule.flags, rule.action);
+    std::vector<const AuditRuleData*> deletions;
+    for (const auto& rule : transient_rules_) {
+      deletions.push_back(&rule);
     }
+    applyRules({}, deletions);
+    transient_rules_.clear();
 
     // Restore audit configuration defaults.
     audit_set_backlog_limit(handle_, 0);
@@ -346,12 +569,41 @@ inline bool checkUserCache(AuditId aid) {
   return true;
 }
 
+/// Check if a field is selected by a subscription's field filter.
+static inline bool isFieldSelected(const AuditFieldFilter* filter,
+                                   boost::string_ref key) {
+  if (filter == nullptr || key == "syscall") {
+    return true;
+  }
+
+  for (const auto& field : *filter) {
+    if (!field.empty() && field.back() == '*') {
+      if (key.starts_with(
+              boost::string_ref(field.data(), field.size() - 1))) {
+        return true;
+      }
+    } else if (key == field) {
+      return true;
+    }
+  }
+  return false;
+}
+
 bool handleAuditReply(const struct audit_reply& reply,
                       AuditEventContextRef& ec) {
+  return handleAuditReply(reply, ec, nullptr);
+}
+
+bool handleAuditReply(const struct audit_reply& reply,
+                      AuditEventContextRef& ec,
+                      const AuditFieldFilter* filter) {
   // Build an event context around this reply.
   ec->type = reply.type;
-  // Tokenize the message.
-  boost::string_ref message_view(reply.message, reply.len);
+  ec->fields.clear();
+
+  // Keep a copy of the message, fields are slices of this content.
+  ec->message.assign(reply.message, reply.len);
+  boost::string_ref message_view(ec->message);
   auto preamble_end = message_view.find("): ");
   if (preamble_end == std::string::npos) {
     return false;
@@ -363,52 +615,63 @@ bool handleAuditReply(const struct audit_reply& reply,
               ec->audit_id);
   boost::string_ref field_view(message_view.substr(preamble_end + 3));
 
-  // The linear search will construct series of key value pairs.
-  std::string key, value;
-  key.reserve(20);
-  value.reserve(256);
+  // The linear search will find series of key value pairs.
+  // Keys and values are contiguous, only their bounds are tracked.
+  size_t key_start = 0, key_size = 0, value_start = 0, value_size = 0;
+  auto addField = [&]() {
+    if (key_size > 0) {
+      auto key = field_view.substr(key_start, key_size);
+      if (isFieldSelected(filter, key)) {
+        ec->fields.add(key, field_view.substr(value_start, value_size));
+      }
+    }
+    key_size = 0;
+    value_size = 0;
+  };
 
   // There are several ways of representing value data (enclosed strings, etc).
   bool found_assignment{false}, found_enclose{false};
-  for (const auto& c : field_view) {
+  for (size_t i = 0; i < field_view.size(); i++) {
     // Iterate over each character in the audit message.
+    auto c = field_view[i];
     if ((found_enclose && c == '"') || (!found_enclose && c == ' ')) {
       if (c == '"') {
-        value += c;
+        value_size++;
       }
       // This is a terminating sequence, the end of an enclosure or space tok.
-      if (!key.empty()) {
-        // Multiple space tokens are supported.
-        ec->fields.emplace(std::make_pair(std::move(key), std::move(value)));
-      }
+      // Multiple space tokens are supported.
+      addField();
       found_enclose = false;
       found_assignment = false;
-      key.clear();
-      value.clear();
-    } else if (!found_assignment && c == ' ') {
-      // A field tokenizer.
     } else if (found_assignment) {
       // Enclosure sequences appear immediately following assignment.
       if (c == '"') {
         found_enclose = true;
       }
-      value += c;
+      value_size++;
     } else if (c == '=') {
       found_assignment = true;
+      value_start = i + 1;
     } else {
-      key += c;
+      if (key_size == 0) {
+        key_start = i;
+      }
+      key_size++;
     }
   }
 
   // Last step, if there was no trailing tokenizer.
-  if (!key.empty()) {
-    ec->fields.emplace(std::make_pair(std::move(key), std::move(value)));
-  }
+  addField();
 
   if (FLAGS_audit_debug) {
     fprintf(stdout, "%zu: (%d) ", ec->audit_id, ec->type);
     for (const auto& f : ec->fields) {
-      fprintf(stdout, "%s=%s ", f.first.c_str(), f.second.c_str());
+      fprintf(stdout,
+              "%.*s=%.*s ",
+              static_cast<int>(f.first.size()),
+              f.first.data(),
+              static_cast<int>(f.second.size()),
+              f.second.data());
     }
     fprintf(stdout, "\n");
   }
@@ -421,9 +684,8 @@ bool handleAuditReply(const struct audit_reply& reply,
 
   // There is a special field for syscalls.
   if (ec->fields.count("syscall") == 1) {
-    const auto& syscall_string = ec->fields.at("syscall").c_str();
     long long syscall{0};
-    if (!safeStrtoll(syscall_string, 10, syscall)) {
+    if (!safeStrtoll(ec->fields.get("syscall"), 10, syscall)) {
       syscall = 0;
     }
     ec->syscall = syscall;
@@ -432,9 +694,27 @@ bool handleAuditReply(const struct audit_reply& reply,
   return true;
 }
 
-void AuditEventPublisher::handleListRules() {
-  // Store the rules response.
-  // This is not needed until there are audit meta-tables listing the rules.
+void AuditEventPublisher::handleListRules(const struct audit_reply& reply) {
+  WriteLock lock(rules_mutex_);
+  if (!listing_) {
+    return;
+  }
+
+  // A rule list is a reply per rule, followed by a done message.
+  if (reply.type == NLMSG_DONE) {
+    listed_rules_ = std::move(listing_rules_);
+    listing_rules_.clear();
+    listing_ = false;
+    listed_ = true;
+  } else if (reply.ruledata != nullptr &&
+             static_cast<size_t>(reply.len) >=
+                 NLMSG_LENGTH(sizeof(struct audit_rule_data))) {
+    auto size = std::min<size_t>(
+        sizeof(struct audit_rule_data) + reply.ruledata->buflen,
+        static_cast<size_t>(reply.len) - NLMSG_LENGTH(0));
+    listing_rules_.insert(
+        AuditRuleData(reinterpret_cast<const char*>(reply.ruledata), size));
+  }
 }
 
 static inline bool adjust_reply(struct audit_reply* rep, int len) {
@@ -477,7 +757,30 @@ static inline bool adjust_reply(struct audit_reply* rep, int len) {
   return true;
 }
 
-static inline int safe_audit_get_reply(int fd, struct audit_reply* rep) {
+void AuditReplyBatch::resize(size_t capacity) {
+  replies.assign(capacity, {});
+  headers.assign(capacity, {});
+  vectors.assign(capacity, {});
+  addresses.assign(capacity, {});
+  count = 0;
+
+  for (size_t i = 0; i < capacity; i++) {
+    vectors[i].iov_base = &replies[i].msg;
+    vectors[i].iov_len = sizeof(replies[i].msg);
+    headers[i].msg_hdr.msg_name = &addresses[i];
+    headers[i].msg_hdr.msg_iov = &vectors[i];
+    headers[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+/**
+ * @brief Receive up to a batch of audit replies with a single syscall.
+ *
+ * @return The number of replies received, 0 if none are pending, or a
+ *  negative errno.
+ */
+static inline int safe_audit_get_replies(int fd, AuditReplyBatch& batch) {
+  batch.count = 0;
   if (fd < 0) {
     return -EBADF;
   }
@@ -495,87 +798,125 @@ static inline int safe_audit_get_reply(int fd, struct audit_reply* rep) {
     return -1;
   }
 
-  struct sockaddr_nl nladdr;
-  socklen_t nladdrlen = sizeof(nladdr);
-
-  int len = recvfrom(fd,
-                     &rep->msg,
-                     sizeof(rep->msg),
-                     0,
-                     (struct sockaddr*)&nladdr,
-                     &nladdrlen);
-  if (len < 0) {
-    return -errno;
+  for (auto& header : batch.headers) {
+    header.msg_hdr.msg_namelen = sizeof(struct sockaddr_nl);
+    header.msg_len = 0;
   }
 
-  if (nladdrlen != sizeof(nladdr)) {
-    return -EPROTO;
+  int received = recvmmsg(fd,
+                          batch.headers.data(),
+                          static_cast<unsigned int>(batch.headers.size()),
+                          MSG_DONTWAIT,
+                          nullptr);
+  if (received < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -errno;
   }
 
-  if (nladdr.nl_pid) {
-    return -EINVAL;
-  }
+  // Compact the valid replies to the front of the batch.
+  for (int i = 0; i < received; i++) {
+    const auto& header = batch.headers[i];
+    if (header.msg_hdr.msg_namelen != sizeof(struct sockaddr_nl) ||
+        batch.addresses[i].nl_pid != 0) {
+      // Replies must originate from the kernel.
+      continue;
+    }
+
+    auto& reply = batch.replies[batch.count];
+    if (static_cast<size_t>(i) != batch.count) {
+      memcpy(&reply.msg, &batch.replies[i].msg, header.msg_len);
+    }
 
-  if (!adjust_reply(rep, len)) {
-    return -errno;
+    if (adjust_reply(&reply, static_cast<int>(header.msg_len))) {
+      batch.count++;
+    }
   }
-  return len;
+  return received;
 }
 
-void AuditConsumer::push(AuditEventContextRef& reply) {
-  auto& self = get();
-  WriteLock lock(self.mutex_);
-
-  if (self.queue_.size() > FLAGS_audit_queue_size) {
+bool AuditConsumer::push(AuditEventContextRef& reply) {
+  if (!queue_.push(reply)) {
     // The userland queue is filled, drop.
-    return;
+    return false;
   }
-  self.queue_.push(reply);
-}
 
-AuditEventContextRef& AuditConsumer::peek() {
-  ReadLock lock(get().mutex_);
+  // Order the push before reading the consumer's waiting state.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting_.load(std::memory_order_relaxed)) {
+    wakeup();
+  }
+  return true;
+}
 
-  return get().queue_.front();
+bool AuditConsumer::pop(AuditEventContextRef& reply) {
+  return queue_.pop(reply);
 }
 
-void AuditConsumer::pop() {
-  auto& self = get();
-  WriteLock lock(self.mutex_);
+void AuditConsumer::wait(size_t milli) {
+  std::unique_lock<std::mutex> lock(wait_mutex_);
+  waiting_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (queue_.empty()) {
+    wait_cv_.wait_for(lock, std::chrono::milliseconds(milli));
+  }
+  waiting_.store(false, std::memory_order_relaxed);
+}
 
-  self.queue_.pop();
+void AuditConsumer::wakeup() {
+  std::lock_guard<std::mutex> lock(wait_mutex_);
+  wait_cv_.notify_one();
+}
 
-  if (self.queue_.size() > self.max_size_) {
-    self.max_size_ = self.queue_.size();
-  } else if (self.queue_.empty() && self.max_size_ > 100) {
-    std::queue<AuditEventContextRef> empty;
-    std::swap(empty, self.queue_);
-    self.max_size_ = 0;
+AuditEventContextRef AuditConsumer::acquire() {
+  AuditEventContextRef ec;
+  if (!pool_.pop(ec)) {
+    ec = std::make_shared<AuditEventContext>();
   }
+  return ec;
 }
 
-size_t AuditConsumer::size() const {
-  ReadLock lock(get().mutex_);
+void AuditConsumer::release(AuditEventContextRef& ec) {
+  if (ec.use_count() != 1) {
+    // A subscriber retained the context, it cannot be reused.
+    ec.reset();
+    return;
+  }
 
-  return get().queue_.size();
+  ec->id = 0;
+  ec->EventContext::time = 0;
+  ec->type = 0;
+  ec->syscall = 0;
+  ec->fields.clear();
+  ec->message.clear();
+  ec->audit_id = 0;
+  ec->time = 0;
+
+  // If the pool is full the context is freed.
+  if (!pool_.push(std::move(ec))) {
+    ec.reset();
+  }
 }
 
 void AuditConsumerRunner::start() {
+  auto& consumer = AuditConsumer::get();
+  AuditEventContextRef reply;
   while (!interrupted()) {
-    size_t events = AuditConsumer::get().size();
-    for (size_t i = 0; i < events; i++) {
+    while (consumer.pop(reply)) {
       // Build the event context from the reply type and parse the message.
-      publisher_->fire(AuditConsumer::get().peek());
-      AuditConsumer::get().pop();
+      publisher_->fire(reply);
+      consumer.release(reply);
     }
 
-    if (!interrupted() && events == 0) {
-      // Only pause if there were no events to process.
-      pauseMilli(1000);
+    if (!interrupted()) {
+      // Sleep until the publisher queues a reply, the timeout is a fallback.
+      consumer.wait(1000);
     }
   }
 }
 
+void AuditConsumerRunner::stop() {
+  AuditConsumer::get().wakeup();
+}
+
 Status AuditEventPublisher::run() {
   if (!FLAGS_disable_audit && (count_ == 0 || count_++ % 10 == 0)) {
     // Request an update to the audit status.
@@ -583,25 +924,27 @@ Status AuditEventPublisher::run() {
     audit_request_status(handle_);
   }
 
-  auto inspectReply = ([this]() {
+  // Only parse the fields used by subscriptions.
+  auto filter = std::atomic_load(&field_filter_);
+  auto inspectReply = ([this, &filter](const struct audit_reply& reply) {
     bool handle_reply = false;
 
-    switch (reply_.type) {
+    switch (reply.type) {
     case NLMSG_NOOP:
-    case NLMSG_DONE:
     case NLMSG_ERROR:
       // Not handled, request another reply.
       break;
+    case NLMSG_DONE:
     case AUDIT_LIST_RULES:
       // Build rules cache.
-      handleListRules();
+      handleListRules(reply);
       break;
     case AUDIT_SECCOMP:
       break;
     case AUDIT_GET:
       // Make a copy of the status reply and store as the most-recent.
-      if (reply_.status != nullptr) {
-        memcpy(&status_, reply_.status, sizeof(struct audit_status));
+      if (reply.status != nullptr) {
+        memcpy(&status_, reply.status, sizeof(struct audit_status));
       }
       break;
     case AUDIT_FIRST_USER_MSG ... AUDIT_LAST_USER_MSG:
@@ -613,7 +956,7 @@ Status AuditEventPublisher::run() {
       break;
     case AUDIT_DAEMON_START ... AUDIT_DAEMON_CONFIG: // 1200 - 1203
     case AUDIT_CONFIG_CHANGE:
-      handleAuditConfigChange(reply_);
+      handleAuditConfigChange(reply);
       break;
     case AUDIT_SYSCALL: // 1300
       // A monitored syscall was issued, most likely part of a multi-record.
@@ -637,25 +980,26 @@ Status AuditEventPublisher::run() {
 
     // Replies are 'handled' as potential events for several audit types.
     if (handle_reply) {
-      auto ec = createEventContext();
-      if (handleAuditReply(reply_, ec)) {
-        AuditConsumer::get().push(ec);
+      auto ec = AuditConsumer::get().acquire();
+      if (handleAuditReply(reply, ec, filter.get()) &&
+          !AuditConsumer::get().push(ec)) {
+        if (dropped_count_++ == 0) {
+          LOG(WARNING) << "Audit userland queue is full, dropping events";
+        }
       }
     }
   });
 
-  // Reset the reply data.
   int result = 0;
   do {
-    // Request a reply in a non-blocking mode.
+    // Request replies in a non-blocking mode.
     // This allows the publisher's run loop to periodically request an audit
     // status update. These updates can check for other processes attempting to
     // gain control over the audit sink.
-    // This non-blocking also allows faster receipt of multi-message events.
-    result = safe_audit_get_reply(handle_, &reply_);
-
-    if (result > 0) {
-      inspectReply();
+    // A burst of multi-message events is received with a single syscall.
+    result = safe_audit_get_replies(handle_, batch_);
+    for (size_t i = 0; i < batch_.count; i++) {
+      inspectReply(batch_.replies[i]);
     }
   } while (result > 0 && !isEnding());
 
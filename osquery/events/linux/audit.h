@@ -11,12 +11,16 @@
 #pragma once
 
 #include <libaudit.h>
+#include <sys/socket.h>
 
+#include <algorithm>
 #include <map>
 #include <set>
+#include <string>
 #include <vector>
 
 #include <boost/algorithm/hex.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/events.h>
 
@@ -55,12 +59,21 @@ struct AuditRule {
       : syscall(_syscall), filter(std::move(_filter)) {}
 };
 
-/// Internal rule storage for transient rule additions/removals.
-struct AuditRuleInternal {
-  struct audit_rule_data rule;
-  int flags{0};
-  int action{0};
-};
+/**
+ * @brief The data of a kernel audit rule, including its string buffer.
+ *
+ * The flags and action are set within the data, so rules added by the
+ * publisher compare equal to the rules listed by the kernel.
+ */
+using AuditRuleData = std::string;
+
+/**
+ * @brief Build the rule data to install for a set of subscription rules.
+ *
+ * Syscalls of rules sharing a filter, flags, and action are merged into a
+ * single kernel rule. Rules that should not be applied are skipped.
+ */
+std::set<AuditRuleData> getAuditRuleData(const std::vector<AuditRule>& rules);
 
 /// The audit ID is a smaller integer.
 using AuditId = size_t;
@@ -68,6 +81,85 @@ using AuditId = size_t;
 /// Alias the field container so we can replace and improve with refactors.
 using AuditFields = std::map<std::string, std::string>;
 
+/**
+ * @brief A flat lookup of the fields within a single audit message.
+ *
+ * Keys and values are slices of the message content owned by the event
+ * context, they are only valid while that context is alive. Fields are kept
+ * in message order and, like an AuditFields map, the first of any duplicate
+ * key is used for lookups.
+ */
+class AuditFieldView {
+ public:
+  using Field = std::pair<boost::string_ref, boost::string_ref>;
+  using const_iterator = std::vector<Field>::const_iterator;
+
+  /// Append a field, the key and value must outlive the view.
+  void add(boost::string_ref key, boost::string_ref value) {
+    fields_.emplace_back(key, value);
+  }
+
+  /// Remove every field, retaining capacity.
+  void clear() {
+    fields_.clear();
+  }
+
+  size_t size() const {
+    return fields_.size();
+  }
+
+  bool empty() const {
+    return fields_.empty();
+  }
+
+  size_t count(boost::string_ref key) const {
+    return (find(key) != fields_.end()) ? 1 : 0;
+  }
+
+  /// Get the value of a field, throws std::out_of_range if is not present.
+  boost::string_ref at(boost::string_ref key) const {
+    auto it = find(key);
+    if (it == fields_.end()) {
+      throw std::out_of_range("Audit field not found: " + key.to_string());
+    }
+    return it->second;
+  }
+
+  /// Copy the value of a field, or a default if it is not present.
+  std::string get(boost::string_ref key, const std::string& def = "") const {
+    auto it = find(key);
+    return (it == fields_.end()) ? def : it->second.to_string();
+  }
+
+  const_iterator begin() const {
+    return fields_.begin();
+  }
+
+  const_iterator end() const {
+    return fields_.end();
+  }
+
+ private:
+  const_iterator find(boost::string_ref key) const {
+    for (auto it = fields_.begin(); it != fields_.end(); ++it) {
+      if (it->first == key) {
+        return it;
+      }
+    }
+    return fields_.end();
+  }
+
+ private:
+  std::vector<Field> fields_;
+};
+
+/**
+ * @brief The set of fields a subscription uses.
+ *
+ * A field ending with '*' selects every field beginning with the prefix.
+ */
+using AuditFieldFilter = std::vector<std::string>;
+
 /**
  * @brief The message callback method used within AuditAssembler.
  *
@@ -77,13 +169,13 @@ using AuditFields = std::map<std::string, std::string>;
  * row data.
  *
  * @param type The audit message type.
- * @param fields The current message's fields.
+ * @param fields The current message's fields, valid only during the call.
  * @param r The persistent row data.
  * @return true if the message was parsed correctly, false if the multi-message
  *   encountered an error and should be removed.
  */
-using AuditUpdate =
-    std::function<bool(size_t type, const AuditFields& fields, AuditFields& r)>;
+using AuditUpdate = std::function<bool(
+    size_t type, const AuditFieldView& fields, AuditFields& r)>;
 
 /**
  * @brief A multi-message assembler based on expectations of message-type sets.
@@ -107,7 +199,7 @@ class AuditAssembler : private boost::noncopyable {
   /// Add a message from audit.
   boost::optional<AuditFields> add(AuditId id,
                                    size_t type,
-                                   const AuditFields& fields);
+                                   const AuditFieldView& fields);
 
   /// Allow the publisher to explicit-set fields.
   void set(AuditId id, const std::string& key, const std::string& value) {
@@ -146,16 +238,84 @@ class AuditAssembler : private boost::noncopyable {
   FRIEND_TEST(AuditTests, test_audit_assembler);
 };
 
-/// Handle quote and hex-encoded audit field content.
-inline std::string decodeAuditValue(const std::string& s) {
+/// The value of a hex digit, -1 if the character is not a hex digit.
+inline int getAuditHexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+/**
+ * @brief The size of decoded audit field content, see appendAuditValue.
+ *
+ * Hex-encoded content is checked but not decoded.
+ */
+inline size_t getAuditValueSize(boost::string_ref s) {
   if (s.size() > 1 && s[0] == '"') {
-    return s.substr(1, s.size() - 2);
+    return s.size() - 2;
   }
-  try {
-    return boost::algorithm::unhex(s);
-  } catch (const boost::algorithm::hex_decode_error& e) {
-    return s;
+  if (s.size() % 2 != 0) {
+    return s.size();
   }
+  for (auto c : s) {
+    if (getAuditHexDigit(c) < 0) {
+      return s.size();
+    }
+  }
+  return s.size() / 2;
+}
+
+/**
+ * @brief Append quote or hex-encoded audit field content to a string.
+ *
+ * Hex-encoded content is decoded in place within the output, content that
+ * fails to decode is appended as is. At most limit bytes are appended.
+ */
+inline void appendAuditValue(boost::string_ref s,
+                             std::string& out,
+                             size_t limit = std::string::npos) {
+  if (s.size() > 1 && s[0] == '"') {
+    out.append(s.data() + 1, std::min(s.size() - 2, limit));
+    return;
+  }
+
+  if (s.size() % 2 == 0) {
+    auto start = out.size();
+    out.resize(start + s.size() / 2);
+    auto* decoded = &out[start];
+    size_t i = 0;
+    for (; i < s.size(); i += 2) {
+      auto high = getAuditHexDigit(s[i]);
+      auto low = getAuditHexDigit(s[i + 1]);
+      if (high < 0 || low < 0) {
+        break;
+      }
+      *decoded++ = static_cast<char>((high << 4) | low);
+    }
+
+    if (i == s.size()) {
+      if (out.size() - start > limit) {
+        out.resize(start + limit);
+      }
+      return;
+    }
+    out.resize(start);
+  }
+  out.append(s.data(), std::min(s.size(), limit));
+}
+
+/// Handle quote and hex-encoded audit field content.
+inline std::string decodeAuditValue(boost::string_ref s) {
+  std::string decoded;
+  appendAuditValue(s, decoded);
+  return decoded;
 }
 
 struct AuditSubscriptionContext : public SubscriptionContext {
@@ -181,6 +341,14 @@ struct AuditSubscriptionContext : public SubscriptionContext {
   /// Macro for all types related to user messages.
   bool user_types{false};
 
+  /**
+   * @brief The set of message fields the subscription callback uses.
+   *
+   * Fields not used by any subscription are skipped when messages are parsed.
+   * If any subscription leaves this empty every field is parsed.
+   */
+  AuditFieldFilter fields;
+
  private:
   friend class AuditEventPublisher;
 };
@@ -193,13 +361,16 @@ struct AuditEventContext : public EventContext {
   /// Otherwise this set to 0.
   int syscall{0};
 
+  /// A copy of the audit message content, the fields are slices of this.
+  std::string message;
+
   /**
    * @brief The audit message tokenized into fields.
    *
    * If the field contained a space in the value the data will be hex encoded.
    * It is the responsibility of the subscription callback/handler to parse.
    */
-  AuditFields fields;
+  AuditFieldView fields;
 
   /// Each message will contain the audit ID.
   AuditId audit_id{0};
@@ -211,6 +382,32 @@ struct AuditEventContext : public EventContext {
 using AuditEventContextRef = std::shared_ptr<AuditEventContext>;
 using AuditSubscriptionContextRef = std::shared_ptr<AuditSubscriptionContext>;
 
+/**
+ * @brief Preallocated netlink reply buffers for a multi-message receive.
+ *
+ * A single recvmmsg fills up to capacity replies, each reply's message header
+ * and source address are prepared once when the batch is sized.
+ */
+struct AuditReplyBatch : private boost::noncopyable {
+  /// The reply buffers, only the first count are filled.
+  std::vector<struct audit_reply> replies;
+
+  /// The recvmmsg headers, one per reply.
+  std::vector<struct mmsghdr> headers;
+
+  /// The receive vectors, each points to a reply's netlink message.
+  std::vector<struct iovec> vectors;
+
+  /// The source addresses, validated for each reply.
+  std::vector<struct sockaddr_nl> addresses;
+
+  /// The number of valid replies from the last receive.
+  size_t count{0};
+
+  /// Allocate and prepare capacity reply buffers.
+  void resize(size_t capacity);
+};
+
 /// This is a dispatched service that handles published audit replies.
 class AuditConsumerRunner;
 
@@ -257,7 +454,16 @@ class AuditEventPublisher
 
  private:
   /// Maintain a list of audit rule data for displaying or deleting.
-  void handleListRules();
+  void handleListRules(const struct audit_reply& reply);
+
+  /**
+   * @brief Add and delete rules with a single batched netlink exchange.
+   *
+   * Additions are applied before deletions such that events matching both an
+   * old and a new rule are not missed.
+   */
+  void applyRules(const std::vector<const AuditRuleData*>& additions,
+                  const std::vector<const AuditRuleData*>& deletions);
 
   /// Apply normal subscription to event matching logic.
   bool shouldFire(const AuditSubscriptionContextRef& mc,
@@ -290,11 +496,27 @@ class AuditEventPublisher
   /// Is this process in control of the audit subsystem.
   bool control_{false};
 
-  /// The last (most recent) audit reply.
-  struct audit_reply reply_ {};
+  /// Reply buffers filled by each netlink receive.
+  AuditReplyBatch batch_;
+
+  /// The union of fields used by subscriptions, nullptr selects every field.
+  std::shared_ptr<const AuditFieldFilter> field_filter_;
 
   /// Track all rule data added by the publisher.
-  std::vector<struct AuditRuleInternal> transient_rules_;
+  std::set<AuditRuleData> transient_rules_;
+
+  /// The rules listed by the kernel after the last rule change.
+  std::set<AuditRuleData> listed_rules_;
+
+  /// The rules received so far while a rule list is pending.
+  std::set<AuditRuleData> listing_rules_;
+
+  /// Set while a rule list is pending, and once a full list was received.
+  bool listing_{false};
+  bool listed_{false};
+
+  /// Protect the rule list, replies are read by the run loop.
+  Mutex rules_mutex_;
 
  private:
   friend class AuditConsumerRunner;
@@ -305,4 +527,14 @@ class AuditEventPublisher
  */
 bool handleAuditReply(const struct audit_reply& reply,
                       AuditEventContextRef& ec);
+
+/**
+ * @brief Populate an event context from a single audit reply.
+ *
+ * Only the fields selected by the filter are added to the context, the
+ * 'syscall' field is always added.
+ */
+bool handleAuditReply(const struct audit_reply& reply,
+                      AuditEventContextRef& ec,
+                      const AuditFieldFilter* filter);
 }
@@ -19,7 +19,7 @@
 namespace osquery {
 
 /// This is a poor interface.
-extern bool ProcessUpdate(size_t, const AuditFields&, AuditFields&);
+extern bool ProcessUpdate(size_t, const AuditFieldView&, AuditFields&);
 
 const std::vector<std::string> kBenchmarkMessages = {
     "audit(1480751147.912:48372): arch=c000003e syscall=59 success=yes exit=0 "
@@ -101,4 +101,35 @@ static void AUDIT_assembler(benchmark::State& state) {
 }
 
 BENCHMARK(AUDIT_assembler);
+
+/// The EXECVE arguments of a compiler invocation, half are hex-encoded.
+static void AUDIT_execve_cmdline(benchmark::State& state) {
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+  for (int i = 0; i < state.range_x(); i++) {
+    keys.push_back("a" + std::to_string(i));
+    if (i % 2 == 0) {
+      values.push_back("\"-I/usr/local/include/project/module_" +
+                       std::to_string(i) + "\"");
+    } else {
+      // "-DVALUE=\"a b\"", encoded as audit does for quotes and spaces.
+      values.push_back("2D4456414C55453D2261206222");
+    }
+  }
+
+  AuditFieldView fields;
+  auto argc = std::to_string(state.range_x());
+  fields.add("argc", argc);
+  for (size_t i = 0; i < keys.size(); i++) {
+    fields.add(keys[i], values[i]);
+  }
+
+  AuditFields r;
+  while (state.KeepRunning()) {
+    ProcessUpdate(AUDIT_EXECVE, fields, r);
+    benchmark::DoNotOptimize(r);
+  }
+}
+
+BENCHMARK(AUDIT_execve_cmdline)->Arg(10)->Arg(100)->Arg(500);
 }
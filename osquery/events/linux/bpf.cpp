@@ -0,0 +1,886 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/bpf.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/bpf.h"
+#include "osquery/filesystem/linux/proc.h"
+
+namespace osquery {
+
+/// eBPF programs are an alternative to the audit publisher.
+FLAG(bool,
+     disable_bpf,
+     true,
+     "Disable receiving events from eBPF tracepoint programs");
+
+FLAG(uint32,
+     bpf_buffer_size,
+     8 * 1024 * 1024,
+     "Bytes in the eBPF ring buffer, rounded up to a power of 2");
+
+REGISTER(BPFEventPublisher, "event_publisher", "bpf");
+
+/// Settings read by the programs from the config map.
+struct BPFConfig {
+  /// Activity of this process is not reported.
+  uint64_t self;
+
+  /// Opens must use any of these flags, 0 reports every open.
+  uint64_t open_flags;
+};
+
+/// A syscall tracepoint pair and the activity it reports.
+struct BPFSyscall {
+  BPFEventType type;
+  const char* name;
+};
+
+/// Syscalls that are missing on an architecture are skipped.
+const std::vector<BPFSyscall> kBPFSyscalls = {
+    {kBPFExec, "execve"},
+    {kBPFExec, "execveat"},
+    {kBPFConnect, "connect"},
+    {kBPFBind, "bind"},
+    {kBPFAccept, "accept"},
+    {kBPFAccept, "accept4"},
+    {kBPFOpen, "open"},
+    {kBPFOpen, "openat"},
+};
+
+/// Mount points of tracefs.
+const std::vector<std::string> kTracingPaths = {
+    "/sys/kernel/tracing", "/sys/kernel/debug/tracing",
+};
+
+/// Threads within a syscall that may be tracked at once.
+const uint32_t kBPFPendingRecords = 16384;
+
+/// The most records fired by a single run.
+const size_t kBPFMaxBatch = 4096;
+
+/// Size of the verifier log when a program is rejected.
+const size_t kBPFLogSize = 64 * 1024;
+
+/// Records of activity other than exec do not include arguments.
+const size_t kBPFShortRecord = offsetof(BPFRecord, args);
+
+static int bpf(int cmd, union bpf_attr& attr) {
+  return static_cast<int>(::syscall(__NR_bpf, cmd, &attr, sizeof(attr)));
+}
+
+static int createMap(bpf_map_type type,
+                     uint32_t key,
+                     uint32_t value,
+                     uint32_t entries) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = type;
+  attr.key_size = key;
+  attr.value_size = value;
+  attr.max_entries = entries;
+  return bpf(BPF_MAP_CREATE, attr);
+}
+
+/**
+ * @brief A minimal eBPF assembler.
+ *
+ * Jumps name a label, their offsets are resolved when the program is
+ * finished. Registers 6 through 9 are preserved across helper calls.
+ */
+class BPFAssembler {
+ public:
+  void mov(int dst, int32_t imm) {
+    emit(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm);
+  }
+
+  void movReg(int dst, int src) {
+    emit(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0);
+  }
+
+  void add(int dst, int32_t imm) {
+    emit(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm);
+  }
+
+  void rsh(int dst, int32_t imm) {
+    emit(BPF_ALU64 | BPF_RSH | BPF_K, dst, 0, 0, imm);
+  }
+
+  void andReg(int dst, int src) {
+    emit(BPF_ALU64 | BPF_AND | BPF_X, dst, src, 0, 0);
+  }
+
+  /// Load a register from memory, size is BPF_W or BPF_DW.
+  void load(int size, int dst, int src, size_t off) {
+    emit(BPF_LDX | BPF_MEM | size, dst, src, static_cast<int16_t>(off), 0);
+  }
+
+  void store(int size, int dst, int src, size_t off) {
+    emit(BPF_STX | BPF_MEM | size, dst, src, static_cast<int16_t>(off), 0);
+  }
+
+  void storeImm(int size, int dst, size_t off, int32_t imm) {
+    emit(BPF_ST | BPF_MEM | size, dst, 0, static_cast<int16_t>(off), imm);
+  }
+
+  /// Set a register to point to the stack, below the frame pointer.
+  void stack(int dst, int32_t off) {
+    movReg(dst, BPF_REG_10);
+    add(dst, off);
+  }
+
+  /// Load a map descriptor, relocated to the map by the kernel.
+  void loadMap(int dst, int fd) {
+    emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+    emit(0, 0, 0, 0, 0);
+  }
+
+  void call(int helper) {
+    emit(BPF_JMP | BPF_CALL, 0, 0, 0, helper);
+  }
+
+  /// Compare a register to an immediate, op is a jump such as BPF_JEQ.
+  void jump(int op, int dst, int32_t imm, const std::string& label) {
+    fixups_.emplace_back(insns_.size(), label);
+    emit(BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+  }
+
+  void jumpReg(int op, int dst, int src, const std::string& label) {
+    fixups_.emplace_back(insns_.size(), label);
+    emit(BPF_JMP | op | BPF_X, dst, src, 0, 0);
+  }
+
+  void jumpAlways(const std::string& label) {
+    fixups_.emplace_back(insns_.size(), label);
+    emit(BPF_JMP | BPF_JA, 0, 0, 0, 0);
+  }
+
+  void label(const std::string& name) {
+    labels_[name] = insns_.size();
+  }
+
+  /// Return 0.
+  void exit() {
+    mov(BPF_REG_0, 0);
+    emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+  }
+
+  std::vector<struct bpf_insn> finish() {
+    for (const auto& fixup : fixups_) {
+      insns_[fixup.first].off =
+          static_cast<int16_t>(labels_.at(fixup.second) - fixup.first - 1);
+    }
+    return std::move(insns_);
+  }
+
+ private:
+  void emit(uint8_t code, int dst, int src, int16_t off, int32_t imm) {
+    struct bpf_insn insn;
+    memset(&insn, 0, sizeof(insn));
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    insns_.push_back(insn);
+  }
+
+ private:
+  std::vector<struct bpf_insn> insns_;
+  std::map<std::string, size_t> labels_;
+  std::vector<std::pair<size_t, std::string>> fixups_;
+};
+
+Status parseTracepointFormat(const std::string& content,
+                             TracepointFormat& format) {
+  // Lines describe a field as: field:<declaration>;offset:<n>;size:<n>;...
+  for (const auto& line : split(content, "\n")) {
+    auto begin = line.find("field:");
+    if (begin == std::string::npos) {
+      continue;
+    }
+
+    auto parts = split(line.substr(begin), ";");
+    if (parts.size() < 3 || parts[1].find("offset:") != 0 ||
+        parts[2].find("size:") != 0) {
+      continue;
+    }
+
+    // The name is the last token of the declaration, without array bounds.
+    auto declaration = split(parts[0].substr(6), " ");
+    if (declaration.empty()) {
+      continue;
+    }
+    auto name = declaration.back();
+    name = name.substr(0, name.find('['));
+
+    long offset = 0;
+    long size = 0;
+    if (!safeStrtol(parts[1].substr(7), 10, offset).ok() ||
+        !safeStrtol(parts[2].substr(5), 10, size).ok()) {
+      return Status(1, "Invalid tracepoint field: " + name);
+    }
+    format[name] = {static_cast<size_t>(offset), static_cast<size_t>(size)};
+  }
+
+  if (format.empty()) {
+    return Status(1, "No tracepoint fields");
+  }
+  return Status(0, "OK");
+}
+
+/// Find the offset of an 8-byte syscall tracepoint field.
+static bool getSyscallField(const TracepointFormat& format,
+                            const std::string& name,
+                            size_t& offset) {
+  auto field = format.find(name);
+  if (field == format.end() || field->second.size != 8) {
+    return false;
+  }
+  offset = field->second.offset;
+  return true;
+}
+
+/**
+ * @brief Assemble a program that captures a syscall's arguments.
+ *
+ * The record is built in per-CPU scratch space and stored by thread until the
+ * syscall returns. Exec records are complete at entry since the arguments
+ * are replaced by a successful exec.
+ */
+static Status assembleEnter(BPFEventType type,
+                            const TracepointFormat& format,
+                            const std::map<std::string, int>& maps,
+                            std::vector<struct bpf_insn>& program) {
+  std::vector<std::string> names;
+  switch (type) {
+  case kBPFExec:
+    names = {"filename", "argv"};
+    break;
+  case kBPFConnect:
+    names = {"fd", "uservaddr", "addrlen"};
+    break;
+  case kBPFBind:
+    names = {"fd", "umyaddr", "addrlen"};
+    break;
+  case kBPFAccept:
+    names = {"fd", "upeer_sockaddr"};
+    break;
+  case kBPFOpen:
+    names = {"filename", "flags"};
+    break;
+  }
+
+  std::map<std::string, size_t> fields;
+  for (const auto& name : names) {
+    if (!getSyscallField(format, name, fields[name])) {
+      return Status(1, "Missing tracepoint field: " + name);
+    }
+  }
+
+  BPFAssembler a;
+  a.movReg(BPF_REG_6, BPF_REG_1);
+  a.call(BPF_FUNC_get_current_pid_tgid);
+  a.store(BPF_DW, BPF_REG_10, BPF_REG_0, -8);
+  a.movReg(BPF_REG_8, BPF_REG_0);
+
+  // Skip this process, and opens without a requested flag.
+  a.storeImm(BPF_W, BPF_REG_10, -16, 0);
+  a.loadMap(BPF_REG_1, maps.at("config"));
+  a.stack(BPF_REG_2, -16);
+  a.call(BPF_FUNC_map_lookup_elem);
+  a.jump(BPF_JEQ, BPF_REG_0, 0, "out");
+  a.load(BPF_DW, BPF_REG_1, BPF_REG_0, offsetof(BPFConfig, self));
+  a.movReg(BPF_REG_2, BPF_REG_8);
+  a.rsh(BPF_REG_2, 32);
+  a.jumpReg(BPF_JEQ, BPF_REG_1, BPF_REG_2, "out");
+  if (type == kBPFOpen) {
+    a.load(BPF_DW, BPF_REG_9, BPF_REG_0, offsetof(BPFConfig, open_flags));
+    a.jump(BPF_JEQ, BPF_REG_9, 0, "record");
+    a.load(BPF_DW, BPF_REG_1, BPF_REG_6, fields["flags"]);
+    a.andReg(BPF_REG_1, BPF_REG_9);
+    a.jump(BPF_JEQ, BPF_REG_1, 0, "out");
+  }
+
+  a.label("record");
+  a.loadMap(BPF_REG_1, maps.at("scratch"));
+  a.stack(BPF_REG_2, -16);
+  a.call(BPF_FUNC_map_lookup_elem);
+  a.jump(BPF_JEQ, BPF_REG_0, 0, "out");
+  a.movReg(BPF_REG_7, BPF_REG_0);
+
+  a.storeImm(BPF_W, BPF_REG_7, offsetof(BPFRecord, type), type);
+  a.movReg(BPF_REG_1, BPF_REG_8);
+  a.rsh(BPF_REG_1, 32);
+  a.store(BPF_W, BPF_REG_7, BPF_REG_1, offsetof(BPFRecord, tgid));
+  a.store(BPF_W, BPF_REG_7, BPF_REG_8, offsetof(BPFRecord, tid));
+  a.call(BPF_FUNC_get_current_uid_gid);
+  a.store(BPF_W, BPF_REG_7, BPF_REG_0, offsetof(BPFRecord, uid));
+  a.rsh(BPF_REG_0, 32);
+  a.store(BPF_W, BPF_REG_7, BPF_REG_0, offsetof(BPFRecord, gid));
+  a.call(BPF_FUNC_ktime_get_ns);
+  a.store(BPF_DW, BPF_REG_7, BPF_REG_0, offsetof(BPFRecord, time));
+  a.storeImm(BPF_W, BPF_REG_7, offsetof(BPFRecord, count), 0);
+  a.storeImm(BPF_DW, BPF_REG_7, offsetof(BPFRecord, ret), 0);
+  a.storeImm(BPF_DW, BPF_REG_7, offsetof(BPFRecord, arg), 0);
+  a.storeImm(BPF_DW, BPF_REG_7, offsetof(BPFRecord, ptr), 0);
+  a.movReg(BPF_REG_1, BPF_REG_7);
+  a.add(BPF_REG_1, offsetof(BPFRecord, comm));
+  a.mov(BPF_REG_2, sizeof(BPFRecord::comm));
+  a.call(BPF_FUNC_get_current_comm);
+
+  if (type == kBPFExec || type == kBPFOpen) {
+    a.movReg(BPF_REG_1, BPF_REG_7);
+    a.add(BPF_REG_1, offsetof(BPFRecord, path));
+    a.mov(BPF_REG_2, sizeof(BPFRecord::path));
+    a.load(BPF_DW, BPF_REG_3, BPF_REG_6, fields["filename"]);
+    a.call(BPF_FUNC_probe_read_user_str);
+  }
+
+  if (type == kBPFExec) {
+    // Copy each argument, a pointer past the last captured one truncates.
+    a.load(BPF_DW, BPF_REG_9, BPF_REG_6, fields["argv"]);
+    for (size_t i = 0; i <= kBPFMaxArgs; i++) {
+      a.stack(BPF_REG_1, -24);
+      a.mov(BPF_REG_2, sizeof(uint64_t));
+      a.movReg(BPF_REG_3, BPF_REG_9);
+      a.add(BPF_REG_3, i * sizeof(uint64_t));
+      a.call(BPF_FUNC_probe_read_user);
+      a.jump(BPF_JNE, BPF_REG_0, 0, "update");
+      a.load(BPF_DW, BPF_REG_3, BPF_REG_10, -24);
+      a.jump(BPF_JEQ, BPF_REG_3, 0, "update");
+      a.storeImm(BPF_W, BPF_REG_7, offsetof(BPFRecord, count), i + 1);
+      if (i == kBPFMaxArgs) {
+        break;
+      }
+      a.movReg(BPF_REG_1, BPF_REG_7);
+      a.add(BPF_REG_1, offsetof(BPFRecord, args) + i * kBPFMaxArgSize);
+      a.mov(BPF_REG_2, kBPFMaxArgSize);
+      a.call(BPF_FUNC_probe_read_user_str);
+    }
+  } else if (type == kBPFOpen) {
+    a.load(BPF_DW, BPF_REG_1, BPF_REG_6, fields["flags"]);
+    a.store(BPF_DW, BPF_REG_7, BPF_REG_1, offsetof(BPFRecord, arg));
+  } else if (type == kBPFAccept) {
+    // The peer address is written by the syscall.
+    a.load(BPF_DW, BPF_REG_1, BPF_REG_6, fields["fd"]);
+    a.store(BPF_DW, BPF_REG_7, BPF_REG_1, offsetof(BPFRecord, arg));
+    a.load(BPF_DW, BPF_REG_1, BPF_REG_6, fields["upeer_sockaddr"]);
+    a.store(BPF_DW, BPF_REG_7, BPF_REG_1, offsetof(BPFRecord, ptr));
+  } else {
+    a.load(BPF_DW, BPF_REG_1, BPF_REG_6, fields["fd"]);
+    a.store(BPF_DW, BPF_REG_7, BPF_REG_1, offsetof(BPFRecord, arg));
+    a.load(BPF_DW, BPF_REG_2, BPF_REG_6, fields["addrlen"]);
+    a.jump(BPF_JLE, BPF_REG_2, sizeof(BPFRecord::path), "address");
+    a.mov(BPF_REG_2, sizeof(BPFRecord::path));
+    a.label("address");
+    a.store(BPF_W, BPF_REG_7, BPF_REG_2, offsetof(BPFRecord, count));
+    a.movReg(BPF_REG_1, BPF_REG_7);
+    a.add(BPF_REG_1, offsetof(BPFRecord, path));
+    a.load(BPF_DW, BPF_REG_3, BPF_REG_6, fields[names[1]]);
+    a.call(BPF_FUNC_probe_read_user);
+  }
+
+  a.label("update");
+  a.loadMap(BPF_REG_1, maps.at("pending"));
+  a.stack(BPF_REG_2, -8);
+  a.movReg(BPF_REG_3, BPF_REG_7);
+  a.mov(BPF_REG_4, BPF_ANY);
+  a.call(BPF_FUNC_map_update_elem);
+
+  a.label("out");
+  a.exit();
+  program = a.finish();
+  return Status(0, "OK");
+}
+
+/// Assemble a program that outputs the record of a successful syscall.
+static Status assembleExit(BPFEventType type,
+                           const TracepointFormat& format,
+                           const std::map<std::string, int>& maps,
+                           std::vector<struct bpf_insn>& program) {
+  size_t ret = 0;
+  if (!getSyscallField(format, "ret", ret)) {
+    return Status(1, "Missing tracepoint field: ret");
+  }
+
+  BPFAssembler a;
+  a.movReg(BPF_REG_6, BPF_REG_1);
+  a.call(BPF_FUNC_get_current_pid_tgid);
+  a.store(BPF_DW, BPF_REG_10, BPF_REG_0, -8);
+  a.loadMap(BPF_REG_1, maps.at("pending"));
+  a.stack(BPF_REG_2, -8);
+  a.call(BPF_FUNC_map_lookup_elem);
+  a.jump(BPF_JEQ, BPF_REG_0, 0, "out");
+  a.movReg(BPF_REG_7, BPF_REG_0);
+
+  // The thread may have been interrupted within another syscall.
+  a.load(BPF_W, BPF_REG_1, BPF_REG_7, offsetof(BPFRecord, type));
+  a.jump(BPF_JNE, BPF_REG_1, type, "delete");
+  a.load(BPF_DW, BPF_REG_8, BPF_REG_6, ret);
+  a.store(BPF_DW, BPF_REG_7, BPF_REG_8, offsetof(BPFRecord, ret));
+  if (type == kBPFConnect) {
+    // Non-blocking connects complete later.
+    a.jump(BPF_JEQ, BPF_REG_8, -EINPROGRESS, "output");
+  }
+  a.jump(BPF_JSLT, BPF_REG_8, 0, "delete");
+
+  if (type == kBPFAccept) {
+    a.load(BPF_DW, BPF_REG_3, BPF_REG_7, offsetof(BPFRecord, ptr));
+    a.jump(BPF_JEQ, BPF_REG_3, 0, "output");
+    a.storeImm(BPF_W,
+               BPF_REG_7,
+               offsetof(BPFRecord, count),
+               sizeof(struct sockaddr_in6));
+    a.movReg(BPF_REG_1, BPF_REG_7);
+    a.add(BPF_REG_1, offsetof(BPFRecord, path));
+    a.mov(BPF_REG_2, sizeof(struct sockaddr_in6));
+    a.call(BPF_FUNC_probe_read_user);
+  }
+
+  a.label("output");
+  a.loadMap(BPF_REG_1, maps.at("ring"));
+  a.movReg(BPF_REG_2, BPF_REG_7);
+  a.mov(BPF_REG_3,
+        (type == kBPFExec) ? sizeof(BPFRecord) : kBPFShortRecord);
+  a.mov(BPF_REG_4, 0);
+  a.call(BPF_FUNC_ringbuf_output);
+
+  a.label("delete");
+  a.loadMap(BPF_REG_1, maps.at("pending"));
+  a.stack(BPF_REG_2, -8);
+  a.call(BPF_FUNC_map_delete_elem);
+
+  a.label("out");
+  a.exit();
+  program = a.finish();
+  return Status(0, "OK");
+}
+
+/// Parse a socket address into a family, printable address, and port.
+static void parseSockaddr(const char* data, size_t size, BPFEventContext& ec) {
+  if (size < sizeof(sa_family_t)) {
+    return;
+  }
+
+  sa_family_t family = 0;
+  memcpy(&family, data, sizeof(family));
+  ec.family = family;
+
+  char address[INET6_ADDRSTRLEN] = {0};
+  if (family == AF_INET && size >= sizeof(struct sockaddr_in)) {
+    struct sockaddr_in sin;
+    memcpy(&sin, data, sizeof(sin));
+    inet_ntop(AF_INET, &sin.sin_addr, address, sizeof(address));
+    ec.address = address;
+    ec.port = ntohs(sin.sin_port);
+  } else if (family == AF_INET6 && size >= sizeof(struct sockaddr_in6)) {
+    struct sockaddr_in6 sin6;
+    memcpy(&sin6, data, sizeof(sin6));
+    inet_ntop(AF_INET6, &sin6.sin6_addr, address, sizeof(address));
+    ec.address = address;
+    ec.port = ntohs(sin6.sin6_port);
+  } else if (family == AF_UNIX && size > sizeof(sa_family_t)) {
+    // Abstract socket names begin with a null byte.
+    auto path = data + sizeof(sa_family_t);
+    auto length = size - sizeof(sa_family_t);
+    if (path[0] == '\0') {
+      ec.address = "@" + std::string(path + 1, strnlen(path + 1, length - 1));
+    } else {
+      ec.address = std::string(path, strnlen(path, length));
+    }
+  }
+}
+
+bool parseBPFRecord(const char* data, size_t size, BPFEventContext& ec) {
+  if (size < kBPFShortRecord) {
+    return false;
+  }
+
+  auto record = reinterpret_cast<const BPFRecord*>(data);
+  ec.type = static_cast<BPFEventType>(record->type);
+  ec.pid = record->tgid;
+  ec.tid = record->tid;
+  ec.uid = record->uid;
+  ec.gid = record->gid;
+  ec.ret = record->ret;
+  ec.uptime = record->time / 1000000000;
+  ec.arg = record->arg;
+  ec.comm.assign(record->comm, strnlen(record->comm, sizeof(record->comm)));
+
+  switch (ec.type) {
+  case kBPFExec:
+    if (size < sizeof(BPFRecord)) {
+      return false;
+    }
+    ec.path.assign(record->path, strnlen(record->path, sizeof(record->path)));
+    ec.args_truncated = (record->count > kBPFMaxArgs);
+    for (size_t i = 0; i < record->count && i < kBPFMaxArgs; i++) {
+      auto length = strnlen(record->args[i], kBPFMaxArgSize);
+      if (length == kBPFMaxArgSize - 1) {
+        ec.args_truncated = true;
+      }
+      ec.args.emplace_back(record->args[i], length);
+    }
+    return true;
+  case kBPFOpen:
+    ec.path.assign(record->path, strnlen(record->path, sizeof(record->path)));
+    return true;
+  case kBPFConnect:
+  case kBPFBind:
+  case kBPFAccept:
+    parseSockaddr(record->path,
+                  std::min<size_t>(record->count, sizeof(record->path)),
+                  ec);
+    return true;
+  }
+  return false;
+}
+
+Status BPFEventPublisher::setUp() {
+  if (FLAGS_disable_bpf) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  for (const auto& path : kTracingPaths) {
+    if (isDirectory(path + "/events/syscalls").ok()) {
+      tracing_ = path;
+      break;
+    }
+  }
+
+  if (tracing_.empty()) {
+    return Status(1, "Cannot find syscall tracepoints, is tracefs mounted");
+  }
+
+  // The ring buffer is a power of 2 number of pages.
+  auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  ring_size_ = page;
+  while (ring_size_ < FLAGS_bpf_buffer_size) {
+    ring_size_ <<= 1;
+  }
+
+  ring_fd_ = createMap(BPF_MAP_TYPE_RINGBUF, 0, 0, ring_size_);
+  if (ring_fd_ < 0) {
+    return Status(1,
+                  std::string("Could not create eBPF ring buffer: ") +
+                      strerror(errno));
+  }
+
+  // The data pages are mapped twice so records that wrap are contiguous.
+  consumer_ =
+      mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd_, 0);
+  producer_ = mmap(
+      nullptr, page + 2 * ring_size_, PROT_READ, MAP_SHARED, ring_fd_, page);
+  if (consumer_ == MAP_FAILED || producer_ == MAP_FAILED) {
+    consumer_ = (consumer_ == MAP_FAILED) ? nullptr : consumer_;
+    producer_ = (producer_ == MAP_FAILED) ? nullptr : producer_;
+    return Status(1, "Could not map eBPF ring buffer");
+  }
+
+  scratch_fd_ = createMap(
+      BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(uint32_t), sizeof(BPFRecord), 1);
+  pending_fd_ = createMap(BPF_MAP_TYPE_LRU_HASH,
+                          sizeof(uint64_t),
+                          sizeof(BPFRecord),
+                          kBPFPendingRecords);
+  config_fd_ =
+      createMap(BPF_MAP_TYPE_ARRAY, sizeof(uint32_t), sizeof(BPFConfig), 1);
+  if (scratch_fd_ < 0 || pending_fd_ < 0 || config_fd_ < 0) {
+    return Status(1,
+                  std::string("Could not create eBPF maps: ") +
+                      strerror(errno));
+  }
+  return Status(0, "OK");
+}
+
+void BPFEventPublisher::configure() {
+  if (config_fd_ < 0) {
+    return;
+  }
+
+  uint32_t types = 0;
+  bool every_open = false;
+  BPFConfig config;
+  config.self = getpid();
+  config.open_flags = 0;
+  for (auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    types |= sc->types;
+    if (sc->types & kBPFOpen) {
+      every_open = every_open || sc->open_flags == 0;
+      config.open_flags |= sc->open_flags;
+    }
+  }
+
+  if (every_open) {
+    config.open_flags = 0;
+  }
+
+  uint32_t key = 0;
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = config_fd_;
+  attr.key = reinterpret_cast<uint64_t>(&key);
+  attr.value = reinterpret_cast<uint64_t>(&config);
+  attr.flags = BPF_ANY;
+  if (bpf(BPF_MAP_UPDATE_ELEM, attr) != 0) {
+    LOG(WARNING) << "Could not configure eBPF programs: " << strerror(errno);
+    return;
+  }
+
+  // Only the tracepoints used by subscriptions have programs attached.
+  if (types == types_) {
+    return;
+  }
+
+  detach();
+  for (const auto& syscall : kBPFSyscalls) {
+    if ((types & syscall.type) == 0) {
+      continue;
+    }
+
+    for (auto enter : {true, false}) {
+      auto status = attach(syscall.type, syscall.name, enter);
+      if (!status.ok()) {
+        VLOG(1) << status.getMessage();
+      }
+    }
+  }
+  types_ = types;
+}
+
+Status BPFEventPublisher::attach(BPFEventType type,
+                                 const std::string& syscall,
+                                 bool enter) {
+  auto name = ((enter) ? "sys_enter_" : "sys_exit_") + syscall;
+  auto path = tracing_ + "/events/syscalls/" + name;
+
+  std::string content;
+  long id = 0;
+  if (!readFile(path + "/format", content).ok()) {
+    return Status(1, "Tracepoint not found: " + name);
+  }
+
+  TracepointFormat format;
+  auto status = parseTracepointFormat(content, format);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (!readFile(path + "/id", content).ok() ||
+      !safeStrtol(content, 10, id).ok()) {
+    return Status(1, "Cannot read tracepoint ID: " + name);
+  }
+
+  std::map<std::string, int> maps = {
+      {"ring", ring_fd_},
+      {"scratch", scratch_fd_},
+      {"pending", pending_fd_},
+      {"config", config_fd_},
+  };
+  std::vector<struct bpf_insn> program;
+  status = (enter) ? assembleEnter(type, format, maps, program)
+                   : assembleExit(type, format, maps, program);
+  if (!status.ok()) {
+    return Status(1, name + ": " + status.getMessage());
+  }
+
+  const char* license = "GPL";
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_TRACEPOINT;
+  attr.insns = reinterpret_cast<uint64_t>(program.data());
+  attr.insn_cnt = static_cast<uint32_t>(program.size());
+  attr.license = reinterpret_cast<uint64_t>(license);
+
+  BPFAttachment attachment;
+  attachment.program = bpf(BPF_PROG_LOAD, attr);
+  if (attachment.program < 0) {
+    // Load again with a log of the verifier's rejection.
+    std::vector<char> log(kBPFLogSize);
+    attr.log_buf = reinterpret_cast<uint64_t>(log.data());
+    attr.log_size = static_cast<uint32_t>(log.size());
+    attr.log_level = 1;
+    bpf(BPF_PROG_LOAD, attr);
+    log.back() = '\0';
+    VLOG(1) << "eBPF verifier log for " << name << ": " << log.data();
+    return Status(1, "Could not load eBPF program: " + name);
+  }
+
+  struct perf_event_attr event;
+  memset(&event, 0, sizeof(event));
+  event.type = PERF_TYPE_TRACEPOINT;
+  event.size = sizeof(event);
+  event.config = static_cast<uint64_t>(id);
+  event.sample_period = 1;
+  event.wakeup_events = 1;
+  attachment.event = static_cast<int>(::syscall(
+      __NR_perf_event_open, &event, -1, 0, -1, PERF_FLAG_FD_CLOEXEC));
+  if (attachment.event < 0 ||
+      ioctl(attachment.event, PERF_EVENT_IOC_SET_BPF, attachment.program) !=
+          0 ||
+      ioctl(attachment.event, PERF_EVENT_IOC_ENABLE, 0) != 0) {
+    auto error = std::string(strerror(errno));
+    if (attachment.event >= 0) {
+      close(attachment.event);
+    }
+    close(attachment.program);
+    return Status(1, "Could not attach eBPF program to " + name + ": " + error);
+  }
+
+  attachments_[name] = attachment;
+  return Status(0, "OK");
+}
+
+void BPFEventPublisher::detach() {
+  for (const auto& attachment : attachments_) {
+    close(attachment.second.event);
+    close(attachment.second.program);
+  }
+  attachments_.clear();
+  types_ = 0;
+}
+
+void BPFEventPublisher::tearDown() {
+  detach();
+
+  auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  if (consumer_ != nullptr) {
+    munmap(consumer_, page);
+    consumer_ = nullptr;
+  }
+
+  if (producer_ != nullptr) {
+    munmap(producer_, page + 2 * ring_size_);
+    producer_ = nullptr;
+  }
+
+  for (auto fd : {&ring_fd_, &scratch_fd_, &pending_fd_, &config_fd_}) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+void BPFEventPublisher::resolve(ProcReader& reader,
+                                BPFEventContext& ec) const {
+  // The process may have exited since the record was written.
+  if (!reader.open(std::to_string(ec.pid))) {
+    return;
+  }
+
+  reader.readLink("exe", ec.exe);
+  if (ec.type == kBPFExec) {
+    reader.readLink("cwd", ec.cwd);
+    if (reader.read("stat").ok()) {
+      // The parent follows the state, after the parenthesized command.
+      const auto& stat = reader.content();
+      auto fields = split(stat.substr(stat.rfind(')') + 1), " ");
+      long parent = 0;
+      if (fields.size() > 1 && safeStrtol(fields[1], 10, parent).ok()) {
+        ec.parent = static_cast<pid_t>(parent);
+      }
+    }
+  } else if (ec.type == kBPFOpen) {
+    reader.readLink(("fd/" + std::to_string(ec.ret)).c_str(), ec.target);
+  }
+}
+
+size_t BPFEventPublisher::consume() {
+  auto consumer = static_cast<uint64_t*>(consumer_);
+  auto producer = static_cast<uint64_t*>(producer_);
+  auto data = static_cast<char*>(producer_) + sysconf(_SC_PAGESIZE);
+
+  // Records are copied and space is released before events are fired.
+  batch_.clear();
+  auto position = __atomic_load_n(consumer, __ATOMIC_ACQUIRE);
+  auto end = __atomic_load_n(producer, __ATOMIC_ACQUIRE);
+  while (position < end && batch_.size() < kBPFMaxBatch) {
+    auto header =
+        reinterpret_cast<uint32_t*>(data + (position & (ring_size_ - 1)));
+    auto length = __atomic_load_n(header, __ATOMIC_ACQUIRE);
+    if (length & BPF_RINGBUF_BUSY_BIT) {
+      break;
+    }
+
+    auto size = length & ~(BPF_RINGBUF_BUSY_BIT | BPF_RINGBUF_DISCARD_BIT);
+    if ((length & BPF_RINGBUF_DISCARD_BIT) == 0) {
+      auto ec = createEventContext();
+      if (parseBPFRecord(reinterpret_cast<char*>(header) + BPF_RINGBUF_HDR_SZ,
+                         size,
+                         *ec)) {
+        batch_.push_back(ec);
+      }
+    }
+    position += (size + BPF_RINGBUF_HDR_SZ + 7) & ~7ULL;
+  }
+  __atomic_store_n(consumer, position, __ATOMIC_RELEASE);
+
+  ProcReader reader;
+  for (const auto& ec : batch_) {
+    resolve(reader, *ec);
+    fire(ec);
+  }
+  return batch_.size();
+}
+
+Status BPFEventPublisher::run() {
+  if (ring_fd_ < 0 || producer_ == nullptr) {
+    return Status(1, "eBPF ring buffer is not open");
+  }
+
+  struct pollfd fds[1];
+  fds[0].fd = ring_fd_;
+  fds[0].events = POLLIN;
+  int selector = ::poll(fds, 1, 1000);
+  if (selector == -1) {
+    if (errno == EINTR) {
+      return Status(0, "eBPF poll interrupted");
+    }
+    LOG(WARNING) << "Could not read eBPF ring buffer: " << strerror(errno);
+    return Status(1, "eBPF poll failed");
+  }
+
+  // A full batch is read again without waiting.
+  while (consume() == kBPFMaxBatch && !isEnding()) {
+  }
+  return Status(0, "OK");
+}
+
+bool BPFEventPublisher::shouldFire(const BPFSubscriptionContextRef& sc,
+                                   const BPFEventContextRef& ec) const {
+  if ((sc->types & ec->type) == 0) {
+    return false;
+  }
+
+  // Other subscriptions may have requested more opens.
+  return ec->type != kBPFOpen || sc->open_flags == 0 ||
+         (ec->arg & sc->open_flags) != 0;
+}
+} // namespace osquery
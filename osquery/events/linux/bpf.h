@@ -0,0 +1,256 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+class ProcReader;
+
+/// Activity reported by the eBPF programs, subscriptions select a mask.
+enum BPFEventType : uint32_t {
+  kBPFExec = 1 << 0,
+  kBPFConnect = 1 << 1,
+  kBPFBind = 1 << 2,
+  kBPFAccept = 1 << 3,
+  kBPFOpen = 1 << 4,
+};
+
+/// The number of execve arguments captured by the kernel.
+const size_t kBPFMaxArgs = 16;
+
+/// The captured length of each execve argument, including the terminator.
+const size_t kBPFMaxArgSize = 128;
+
+/**
+ * @brief The record written by each program and read from the ring buffer.
+ *
+ * Records are assembled in a map while a syscall runs and copied to the ring
+ * buffer when it returns successfully. Only exec records include arguments.
+ */
+struct BPFRecord {
+  /// A single BPFEventType.
+  uint32_t type;
+  uint32_t tgid;
+  uint32_t tid;
+  uint32_t uid;
+  uint32_t gid;
+
+  /// Captured arguments (more than kBPFMaxArgs if truncated), or path size.
+  uint32_t count;
+
+  /// The syscall return value.
+  int64_t ret;
+
+  /// Nanoseconds since boot.
+  uint64_t time;
+
+  /// The socket descriptor, or open flags.
+  uint64_t arg;
+
+  /// A user address read when the syscall returns.
+  uint64_t ptr;
+
+  char comm[16];
+
+  /// The executed or opened path, or a socket address.
+  char path[256];
+
+  char args[kBPFMaxArgs][kBPFMaxArgSize];
+};
+
+/// A field of a tracepoint record.
+struct TracepointField {
+  size_t offset{0};
+  size_t size{0};
+};
+
+/// Tracepoint record fields by name.
+using TracepointFormat = std::map<std::string, TracepointField>;
+
+/**
+ * @brief Parse the format description of a tracepoint.
+ *
+ * Programs are assembled using the field offsets of the running kernel rather
+ * than offsets compiled into osquery.
+ *
+ * @param content The content of a tracefs event's format file.
+ * @param format Output, fields by name.
+ */
+Status parseTracepointFormat(const std::string& content,
+                             TracepointFormat& format);
+
+struct BPFSubscriptionContext : public SubscriptionContext {
+  /// A mask of BPFEventType.
+  uint32_t types{0};
+
+  /**
+   * @brief Only report opens using any of these flags, 0 reports every open.
+   *
+   * The union of subscriptions is applied by the kernel programs.
+   */
+  uint64_t open_flags{0};
+
+  /// The file_paths category, if the subscription matches opened paths.
+  std::string category;
+
+ private:
+  friend class BPFEventPublisher;
+};
+
+struct BPFEventContext : public EventContext {
+  BPFEventType type{kBPFExec};
+
+  pid_t pid{0};
+  pid_t tid{0};
+  uid_t uid{0};
+  gid_t gid{0};
+
+  /// The parent process, if it could be read when the event was received.
+  pid_t parent{-1};
+
+  /// The syscall return value, a descriptor for opens and accepts.
+  int64_t ret{0};
+
+  /// Seconds since boot.
+  uint64_t uptime{0};
+
+  /// The socket descriptor, or open flags.
+  uint64_t arg{0};
+
+  std::string comm;
+
+  /// The process executable, read when the event was received.
+  std::string exe;
+
+  /// The executed path, or opened path as passed to the syscall.
+  std::string path;
+
+  /// The opened path resolved using the returned descriptor.
+  std::string target;
+
+  /// The working directory of an executed process.
+  std::string cwd;
+
+  /// The execve arguments.
+  std::vector<std::string> args;
+
+  /// Arguments were truncated by the kernel capture limits.
+  bool args_truncated{false};
+
+  /// The socket address family, address, and port or UNIX domain path.
+  int family{0};
+  std::string address;
+  int port{0};
+};
+
+using BPFEventContextRef = std::shared_ptr<BPFEventContext>;
+using BPFSubscriptionContextRef = std::shared_ptr<BPFSubscriptionContext>;
+
+/**
+ * @brief Populate an event context from a ring buffer record.
+ *
+ * @return false if the record is not a complete BPFRecord.
+ */
+bool parseBPFRecord(const char* data, size_t size, BPFEventContext& ec);
+
+/// A tracepoint with an attached program.
+struct BPFAttachment {
+  int program{-1};
+  int event{-1};
+};
+
+/**
+ * @brief Process, socket, and file activity from eBPF tracepoint programs.
+ *
+ * Small programs are assembled for the syscall tracepoints selected by the
+ * subscriptions and write records into a single ring buffer. Unlike audit,
+ * the publisher does not need control of a single kernel consumer, and
+ * failed syscalls and this process' own activity are dropped in the kernel.
+ */
+class BPFEventPublisher
+    : public EventPublisher<BPFSubscriptionContext, BPFEventContext> {
+  DECLARE_PUBLISHER("bpf");
+
+ public:
+  /// Create the maps and ring buffer, requires Linux 5.8 and CAP_SYS_ADMIN.
+  Status setUp() override;
+
+  /// Attach programs for the activity used by subscriptions.
+  void configure() override;
+
+  /// Detach programs and release the maps.
+  void tearDown() override;
+
+  /// Wait for records and fire them in batches.
+  Status run() override;
+
+ public:
+  BPFEventPublisher() : EventPublisher() {}
+
+  virtual ~BPFEventPublisher() {
+    tearDown();
+  }
+
+ private:
+  /// Assemble, load, and attach a program to a syscall tracepoint.
+  Status attach(BPFEventType type, const std::string& syscall, bool enter);
+
+  /// Detach and unload each program.
+  void detach();
+
+  /// Read the available records, returns the number fired.
+  size_t consume();
+
+  /// Fill in process details that are not captured by the kernel.
+  void resolve(ProcReader& reader, BPFEventContext& ec) const;
+
+  /// Apply normal subscription to event matching logic.
+  bool shouldFire(const BPFSubscriptionContextRef& sc,
+                  const BPFEventContextRef& ec) const override;
+
+ private:
+  /// The tracefs mount.
+  std::string tracing_;
+
+  /// The ring buffer map and its mapped consumer, producer, and data pages.
+  int ring_fd_{-1};
+  void* consumer_{nullptr};
+  void* producer_{nullptr};
+  size_t ring_size_{0};
+
+  /// Per-CPU scratch space for assembling a record.
+  int scratch_fd_{-1};
+
+  /// Records for syscalls that have not returned, by thread.
+  int pending_fd_{-1};
+
+  /// Settings applied by the programs.
+  int config_fd_{-1};
+
+  /// Attached programs by tracepoint.
+  std::map<std::string, BPFAttachment> attachments_;
+
+  /// The mask of types attached.
+  uint32_t types_{0};
+
+  /// Records received with each run.
+  std::vector<BPFEventContextRef> batch_;
+};
+} // namespace osquery
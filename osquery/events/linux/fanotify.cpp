@@ -0,0 +1,313 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/fanotify.h"
+
+// Kernel headers before Linux 5.9 do not define directory entry reporting.
+#ifndef FAN_REPORT_DIR_FID
+#define FAN_REPORT_DIR_FID 0x00000400
+#endif
+#ifndef FAN_REPORT_NAME
+#define FAN_REPORT_NAME 0x00000800
+#endif
+#ifndef FAN_MARK_FILESYSTEM
+#define FAN_MARK_FILESYSTEM 0x00000100
+#endif
+#ifndef FAN_ATTRIB
+#define FAN_ATTRIB 0x00000004
+#endif
+#ifndef FAN_MOVED_FROM
+#define FAN_MOVED_FROM 0x00000040
+#define FAN_MOVED_TO 0x00000080
+#define FAN_CREATE 0x00000100
+#define FAN_DELETE 0x00000200
+#endif
+#ifndef FAN_EVENT_INFO_TYPE_FID
+#define FAN_EVENT_INFO_TYPE_FID 1
+struct fanotify_event_info_header {
+  __u8 info_type;
+  __u8 pad;
+  __u16 len;
+};
+struct fanotify_event_info_fid {
+  struct fanotify_event_info_header hdr;
+  __kernel_fsid_t fsid;
+  unsigned char handle[0];
+};
+#endif
+#ifndef FAN_EVENT_INFO_TYPE_DFID_NAME
+#define FAN_EVENT_INFO_TYPE_DFID_NAME 2
+#define FAN_EVENT_INFO_TYPE_DFID 3
+#endif
+
+namespace osquery {
+
+// fanotify and inotify share the bits of each action.
+static_assert(FAN_ACCESS == IN_ACCESS && FAN_MODIFY == IN_MODIFY &&
+                  FAN_ATTRIB == IN_ATTRIB && FAN_CLOSE_WRITE == IN_CLOSE_WRITE &&
+                  FAN_OPEN == IN_OPEN && FAN_MOVED_FROM == IN_MOVED_FROM &&
+                  FAN_MOVED_TO == IN_MOVED_TO && FAN_CREATE == IN_CREATE &&
+                  FAN_DELETE == IN_DELETE,
+              "fanotify actions must match inotify actions");
+
+/// Actions reported by a group with directory handles and names.
+const uint32_t kFanotifyActions = FAN_ACCESS | FAN_MODIFY | FAN_ATTRIB |
+                                  FAN_CLOSE_WRITE | FAN_OPEN | FAN_MOVED_FROM |
+                                  FAN_MOVED_TO | FAN_CREATE | FAN_DELETE;
+
+/// Actions reported by a group with event file descriptors.
+const uint32_t kFanotifyContentActions =
+    FAN_ACCESS | FAN_MODIFY | FAN_CLOSE_WRITE | FAN_OPEN;
+
+/// Scratch space for reading events.
+const size_t kFanotifyBufferSize = 64 * 1024;
+
+/// The number of reads of a busy queue before returning to the run loop.
+const size_t kFanotifyMaxReads = 16;
+
+std::string getFanotifyPatterns(const std::string& pattern,
+                                std::vector<std::string>& patterns) {
+  auto path = pattern;
+  replaceGlobWildcards(path);
+
+  std::string base;
+  std::string matched;
+  bool wildcard = false;
+  for (const auto& component : split(path, "/")) {
+    if (component == "**") {
+      matched += "/**";
+      wildcard = true;
+      break;
+    }
+
+    if (component.find('*') != std::string::npos) {
+      matched += "/*";
+      wildcard = true;
+      continue;
+    }
+
+    matched += "/" + component;
+    if (!wildcard) {
+      base += "/" + component;
+    }
+  }
+
+  if (matched.empty()) {
+    matched = "/";
+  }
+  patterns.push_back(matched);
+  if (!wildcard && isDirectory(matched).ok()) {
+    // A directory matches its direct children.
+    patterns.push_back((matched == "/") ? "/*" : matched + "/*");
+  }
+
+  // Mark the deepest existing path.
+  while (!base.empty() && !pathExists(base).ok()) {
+    base = base.substr(0, base.rfind('/'));
+  }
+  return (base.empty()) ? "/" : base;
+}
+
+/// Read the target of a descriptor.
+static std::string getDescriptorPath(int fd) {
+  char path[PATH_MAX] = {0};
+  auto link = "/proc/self/fd/" + std::to_string(fd);
+  auto size = ::readlink(link.c_str(), path, sizeof(path) - 1);
+  if (size <= 0) {
+    return "";
+  }
+  return std::string(path, size);
+}
+
+Status FanotifyMonitor::open() {
+  // Directory entry events require directory handles and names.
+  fd_ = ::fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK |
+                            FAN_REPORT_DIR_FID | FAN_REPORT_NAME,
+                        O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+  report_names_ = (fd_ >= 0);
+  if (fd_ < 0 && errno == EINVAL) {
+    fd_ = ::fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK,
+                          O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+  }
+
+  if (fd_ < 0) {
+    return Status(1,
+                  std::string("Could not start fanotify: ") + strerror(errno));
+  }
+  buffer_.resize(kFanotifyBufferSize);
+  return Status(0, "OK");
+}
+
+void FanotifyMonitor::close() {
+  if (fd_ < 0) {
+    return;
+  }
+
+  clear();
+  ::close(fd_);
+  fd_ = -1;
+  buffer_.clear();
+}
+
+void FanotifyMonitor::clear() {
+  ::fanotify_mark(
+      fd_, FAN_MARK_FLUSH | FAN_MARK_FILESYSTEM, 0, AT_FDCWD, nullptr);
+  ::fanotify_mark(fd_, FAN_MARK_FLUSH | FAN_MARK_MOUNT, 0, AT_FDCWD, nullptr);
+  for (const auto& mount : mount_fds_) {
+    ::close(mount.second);
+  }
+  mount_fds_.clear();
+}
+
+Status FanotifyMonitor::mark(const std::string& path, uint32_t mask) {
+  if (!report_names_ && (mask & ~kFanotifyContentActions) != 0) {
+    // Keep the subscription on inotify rather than lose actions.
+    return Status(1, "Actions for " + path + " require Linux 5.9 fanotify");
+  }
+
+  uint64_t events =
+      mask & ((report_names_) ? kFanotifyActions : kFanotifyContentActions);
+  if (events == 0) {
+    return Status(1, "No actions can be reported for: " + path);
+  }
+
+  unsigned int flags = FAN_MARK_ADD;
+  if (report_names_) {
+    flags |= FAN_MARK_FILESYSTEM;
+    events |= FAN_ONDIR;
+  } else {
+    flags |= FAN_MARK_MOUNT;
+  }
+
+  if (::fanotify_mark(fd_, flags, events, AT_FDCWD, path.c_str()) != 0) {
+    return Status(1, "Could not mark " + path + ": " + strerror(errno));
+  }
+
+  if (report_names_) {
+    // Directory handles are opened relative to their filesystem, which
+    // cannot be referenced by an O_PATH descriptor.
+    struct statfs st;
+    if (::statfs(path.c_str(), &st) == 0) {
+      auto fsid = std::make_pair(st.f_fsid.__val[0], st.f_fsid.__val[1]);
+      if (mount_fds_.count(fsid) == 0) {
+        auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+          mount_fds_[fsid] = fd;
+        }
+      }
+    }
+  }
+  return Status(0, "OK");
+}
+
+bool FanotifyMonitor::resolveName(const char* info,
+                                  size_t size,
+                                  std::string& path) {
+  auto fid = reinterpret_cast<const struct fanotify_event_info_fid*>(info);
+  if (size < sizeof(struct fanotify_event_info_fid) ||
+      (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME &&
+       fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID)) {
+    return false;
+  }
+
+  auto fsid = std::make_pair(fid->fsid.val[0], fid->fsid.val[1]);
+  auto mount = mount_fds_.find(fsid);
+  if (mount == mount_fds_.end()) {
+    return false;
+  }
+
+  // The handle is followed by the name of the entry within the directory.
+  auto handle = reinterpret_cast<struct file_handle*>(
+      const_cast<unsigned char*>(fid->handle));
+  const char* name = nullptr;
+  if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+    name = reinterpret_cast<const char*>(handle->f_handle) +
+           handle->handle_bytes;
+  }
+
+  // A directory that was removed can no longer be opened.
+  auto dir = ::open_by_handle_at(mount->second, handle, O_PATH | O_CLOEXEC);
+  if (dir < 0) {
+    return false;
+  }
+  path = getDescriptorPath(dir);
+  ::close(dir);
+
+  if (path.empty()) {
+    return false;
+  }
+
+  if (name != nullptr && name[0] != '\0' && strcmp(name, ".") != 0) {
+    if (path.back() != '/') {
+      path += '/';
+    }
+    path += name;
+  }
+  return true;
+}
+
+bool FanotifyMonitor::read(
+    const std::function<void(const std::string&, uint32_t)>& handler) {
+  bool complete = true;
+  auto self = getpid();
+  for (size_t reads = 0; reads < kFanotifyMaxReads; reads++) {
+    auto bytes = ::read(fd_, buffer_.data(), buffer_.size());
+    if (bytes <= 0) {
+      break;
+    }
+
+    auto metadata =
+        reinterpret_cast<struct fanotify_event_metadata*>(buffer_.data());
+    for (; FAN_EVENT_OK(metadata, bytes);
+         metadata = FAN_EVENT_NEXT(metadata, bytes)) {
+      if (metadata->vers != FANOTIFY_METADATA_VERSION) {
+        LOG(WARNING) << "Unsupported fanotify event version";
+        return complete;
+      }
+
+      if (metadata->mask & FAN_Q_OVERFLOW) {
+        complete = false;
+        continue;
+      }
+
+      std::string path;
+      if (metadata->fd >= 0) {
+        path = getDescriptorPath(metadata->fd);
+        ::close(metadata->fd);
+      } else if (report_names_) {
+        auto info = reinterpret_cast<const char*>(metadata) +
+                    metadata->metadata_len;
+        resolveName(info, metadata->event_len - metadata->metadata_len, path);
+      }
+
+      // Reading files, such as to hash them, should not cause more events.
+      if (path.empty() || metadata->pid == self) {
+        continue;
+      }
+      handler(path, metadata->mask & kFanotifyActions);
+    }
+  }
+  return complete;
+}
+} // namespace osquery
@@ -0,0 +1,109 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief Convert a file_paths pattern into the paths matched by fanotify.
+ *
+ * fanotify marks cover an entire mount or filesystem, so events are matched
+ * against a PathSet of the subscription's patterns. A directory matches
+ * itself and its direct children, and a component with a partial wildcard,
+ * such as '%.conf', matches every name like a directory inotify watch.
+ *
+ * @param pattern A file_paths pattern.
+ * @param patterns Output, patterns for a PathSet<patternedPath>.
+ * @return The existing path to mark, the deepest directory before a wildcard.
+ */
+std::string getFanotifyPatterns(const std::string& pattern,
+                                std::vector<std::string>& patterns);
+
+/**
+ * @brief A fanotify group with marks on whole filesystems or mounts.
+ *
+ * On kernels that report directory handles and names (Linux 5.9), each
+ * filesystem containing a monitored path is marked and every inotify action
+ * is reported. Older kernels mark each mount, and only report file access,
+ * modification, and open actions.
+ *
+ * Events caused by this process, such as hashing a changed file, are not
+ * reported.
+ */
+class FanotifyMonitor : private boost::noncopyable {
+ public:
+  ~FanotifyMonitor() {
+    close();
+  }
+
+  /// Create the fanotify group, requires CAP_SYS_ADMIN.
+  Status open();
+
+  /// Remove every mark and close the group.
+  void close();
+
+  /// The fanotify group descriptor, for polling.
+  int getHandle() const {
+    return fd_;
+  }
+
+  /// True if creation, deletion, moves, and attribute changes are reported.
+  bool reportsNames() const {
+    return report_names_;
+  }
+
+  /// Remove every mark.
+  void clear();
+
+  /**
+   * @brief Mark the filesystem, or mount, containing a path.
+   *
+   * @param path An existing path.
+   * @param mask inotify actions, marking fails if any are unsupported.
+   */
+  Status mark(const std::string& path, uint32_t mask);
+
+  /**
+   * @brief Read the queued events.
+   *
+   * @param handler Called with each event's path and inotify action mask.
+   * @return false if the queue overflowed and events were lost.
+   */
+  bool read(const std::function<void(const std::string&, uint32_t)>& handler);
+
+ private:
+  /// Resolve the path of an event with a directory handle and name.
+  bool resolveName(const char* info, size_t size, std::string& path);
+
+ private:
+  /// The fanotify group descriptor.
+  int fd_{-1};
+
+  /// The group reports directory handles and names.
+  bool report_names_{false};
+
+  /// An open descriptor within each marked filesystem, by filesystem id.
+  std::map<std::pair<int, int>, int> mount_fds_;
+
+  /// Scratch space for reading events.
+  std::vector<char> buffer_;
+};
+} // namespace osquery
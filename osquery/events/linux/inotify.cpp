@@ -8,6 +8,9 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <set>
 #include <sstream>
 
 #include <fnmatch.h>
@@ -18,6 +21,7 @@
 
 #include <osquery/config.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
@@ -27,11 +31,23 @@ namespace fs = boost::filesystem;
 
 namespace osquery {
 
-static const size_t kINotifyMaxEvents = 512;
+FLAG(bool,
+     file_events_fanotify,
+     false,
+     "Monitor file_paths with fanotify filesystem marks instead of watches");
+
+DECLARE_uint64(file_events_coalesce_window);
+
+static const size_t kINotifyMinEvents = 16;
+static const size_t kINotifyMaxEvents = 2048;
 static const size_t kINotifyEventSize =
     sizeof(struct inotify_event) + (NAME_MAX + 1);
-static const size_t kINotifyBufferSize =
-    (kINotifyMaxEvents * kINotifyEventSize);
+
+/// The number of reads of a busy queue before returning to the run loop.
+static const size_t kINotifyMaxReads = 16;
+
+/// Wakeups using a fraction of the scratch space before it is shrunk.
+static const size_t kINotifyShrinkReads = 1024;
 
 std::map<int, std::string> kMaskActions = {
     {IN_ACCESS, "ACCESSED"},
@@ -50,17 +66,35 @@ const uint32_t kFileDefaultMasks = IN_MOVED_TO | IN_MOVED_FROM | IN_MODIFY |
                                    IN_ATTRIB;
 const uint32_t kFileAccessMasks = IN_OPEN | IN_ACCESS;
 
+/// Actions that are repeated while a file is written or read.
+static const std::set<std::string> kCoalescedActions = {
+    "UPDATED", "ATTRIBUTES_MODIFIED", "ACCESSED", "OPENED",
+};
+
 REGISTER(INotifyEventPublisher, "event_publisher", "inotify");
 
 Status INotifyEventPublisher::setUp() {
-  inotify_handle_ = ::inotify_init();
+  // The queue is drained by reading until it would block.
+  inotify_handle_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
   // If this does not work throw an exception.
   if (inotify_handle_ == -1) {
     return Status(1, "Could not start inotify: inotify_init failed");
   }
 
+  if (FLAGS_file_events_fanotify) {
+    // Subscriptions that cannot be marked still use inotify watches.
+    WriteLock lock(fanotify_mutex_);
+    auto status = fanotify_.open();
+    if (!status.ok()) {
+      LOG(WARNING) << status.getMessage();
+    } else if (!fanotify_.reportsNames()) {
+      LOG(WARNING) << "fanotify cannot report file creation, deletion, and "
+                   << "moves before Linux 5.9";
+    }
+  }
+
   WriteLock lock(scratch_mutex_);
-  scratch_ = (char*)malloc(kINotifyBufferSize);
+  scratch_ = (char*)malloc(inotify_events_ * kINotifyEventSize);
   if (scratch_ == nullptr) {
     return Status(1, "Could not allocate scratch space");
   }
@@ -127,6 +161,27 @@ bool INotifyEventPublisher::monitorSubscription(
   return needMonitoring(discovered, sc, sc->mask, sc->recursive, add_watch);
 }
 
+bool INotifyEventPublisher::monitorFanotify(INotifySubscriptionContextRef& sc) {
+  // The subscription path is rewritten when inotify watches are added.
+  std::vector<std::string> patterns;
+  auto base =
+      getFanotifyPatterns((sc->opath.empty()) ? sc->path : sc->opath, patterns);
+  auto status =
+      fanotify_.mark(base, (sc->mask == 0) ? kFileDefaultMasks : sc->mask);
+  if (!status.ok()) {
+    VLOG(1) << status.getMessage();
+    return false;
+  }
+
+  auto paths = std::make_shared<PathSet<patternedPath>>();
+  for (const auto& pattern : patterns) {
+    paths->insert(pattern);
+  }
+  sc->fanotify_paths_ = paths;
+  fanotify_subscriptions_.push_back(sc);
+  return true;
+}
+
 void INotifyEventPublisher::buildExcludePathsSet() {
   auto parser = Config::getParser("file_paths");
 
@@ -165,6 +220,7 @@ void INotifyEventPublisher::configure() {
           return false;
         });
     subscriptions_.erase(end, subscriptions_.end());
+    updateSubscriptions();
   }
 
   for (auto& sub : delete_subscriptions) {
@@ -178,33 +234,74 @@ void INotifyEventPublisher::configure() {
 
   buildExcludePathsSet();
 
+  WriteLock lock(fanotify_mutex_);
+  if (fanotify_.getHandle() != -1) {
+    fanotify_.clear();
+    fanotify_subscriptions_.clear();
+  }
+
   for (auto& sub : subscriptions_) {
     // Anytime a configure is called, try to monitor all subscriptions.
     // Configure is called as a response to removing/adding subscriptions.
     // This means recalculating all monitored paths.
     auto sc = getSubscriptionContext(sub->context);
+    if (fanotify_.getHandle() != -1 && monitorFanotify(sc)) {
+      continue;
+    }
+    sc->fanotify_paths_ = nullptr;
     monitorSubscription(sc);
   }
+
+  if (!usesThread()) {
+    // Both handles share a handler, adding them again keeps the handler.
+    EventReactor::get().add(getHandle(), [this]() { react(); });
+    if (fanotify_.getHandle() != -1) {
+      EventReactor::get().add(fanotify_.getHandle(), [this]() { react(); });
+    }
+  }
 }
 
 void INotifyEventPublisher::tearDown() {
+  if (!usesThread() && inotify_handle_ > -1) {
+    EventReactor::get().remove(inotify_handle_);
+    EventReactor::get().remove(fanotify_.getHandle());
+  }
+
   if (inotify_handle_ > -1) {
     ::close(inotify_handle_);
   }
   inotify_handle_ = -1;
 
+  {
+    WriteLock lock(fanotify_mutex_);
+    fanotify_.close();
+    fanotify_subscriptions_.clear();
+  }
+
   WriteLock lock(scratch_mutex_);
+  coalescer_.clear();
   if (scratch_ != nullptr) {
     free(scratch_);
     scratch_ = nullptr;
   }
 }
 
+bool INotifyEventPublisher::resizeScratch(size_t events) {
+  auto scratch = (char*)realloc(scratch_, events * kINotifyEventSize);
+  if (scratch == nullptr) {
+    return false;
+  }
+  scratch_ = scratch;
+  inotify_events_ = events;
+  quiet_reads_ = 0;
+  return true;
+}
+
 void INotifyEventPublisher::handleOverflow() {
-  if (inotify_events_ < kINotifyMaxEvents) {
-    VLOG(1) << "inotify was overflown: increasing scratch buffer";
+  if (inotify_events_ < kINotifyMaxEvents &&
+      resizeScratch(inotify_events_ * 2)) {
     // Exponential increment.
-    inotify_events_ = inotify_events_ * 2;
+    VLOG(1) << "inotify was overflown: increasing scratch buffer";
   } else if (last_overflow_ != -1 && getUnixTime() - last_overflow_ < 60) {
     return;
   } else {
@@ -213,11 +310,80 @@ void INotifyEventPublisher::handleOverflow() {
   }
 }
 
+void INotifyEventPublisher::readFanotify() {
+  WriteLock lock(fanotify_mutex_);
+  auto complete = fanotify_.read(([this](const std::string& path,
+                                          uint32_t mask) {
+    // Marks cover entire filesystems, match the path of each event.
+    for (const auto& isc : fanotify_subscriptions_) {
+      auto actions = mask & ((isc->mask == 0) ? kFileDefaultMasks : isc->mask);
+      if (actions == 0 || !isc->fanotify_paths_->find(path)) {
+        continue;
+      }
+
+      // Consecutive actions on a file are merged into a single event.
+      for (const auto& action : kMaskActions) {
+        if (actions & action.first) {
+          fireCoalesced(createEventContextFrom(path, action.first, isc));
+        }
+      }
+    }
+  }));
+
+  if (!complete) {
+    VLOG(1) << "fanotify was overflown";
+  }
+}
+
+void INotifyEventPublisher::fireCoalesced(const INotifyEventContextRef& ec) {
+  if (FLAGS_file_events_coalesce_window == 0) {
+    fire(ec);
+    return;
+  }
+
+  if (kCoalescedActions.count(ec->action) > 0 &&
+      coalescer_.add(ec->path, ec->action, ec->isub_ctx.get(), ec)) {
+    return;
+  }
+
+  // Creation, deletion, and moves follow the held events for their path.
+  coalescer_.release(ec->path,
+                     ([this](const INotifyEventContextRef& held, size_t count) {
+                       held->count = count;
+                       fire(held);
+                     }));
+  fire(ec);
+}
+
+void INotifyEventPublisher::flushCoalesced() {
+  if (coalescer_.empty()) {
+    return;
+  }
+
+  auto window = std::chrono::milliseconds(FLAGS_file_events_coalesce_window);
+  coalescer_.flush(window,
+                   ([this](const INotifyEventContextRef& held, size_t count) {
+                     held->count = count;
+                     fire(held);
+                   }));
+}
+
 Status INotifyEventPublisher::run() {
-  struct pollfd fds[1];
+  // Held events are fired from the run loop, after their path is quiet.
+  flushCoalesced();
+  int timeout = 1000;
+  if (!coalescer_.empty()) {
+    timeout = static_cast<int>(
+        std::min<uint64_t>(timeout, FLAGS_file_events_coalesce_window));
+  }
+
+  struct pollfd fds[2];
   fds[0].fd = getHandle();
   fds[0].events = POLLIN;
-  int selector = ::poll(fds, 1, 1000);
+  fds[1].fd = fanotify_.getHandle();
+  fds[1].events = POLLIN;
+  fds[1].revents = 0;
+  int selector = ::poll(fds, (fds[1].fd == -1) ? 1 : 2, timeout);
   if (selector == -1) {
     if (errno == EINTR) {
       return Status(0, "inotify poll interrupted");
@@ -231,23 +397,89 @@ Status INotifyEventPublisher::run() {
     return Status(0, "Continue");
   }
 
+  if (fds[1].revents & POLLIN) {
+    readFanotify();
+  }
+
   if (!(fds[0].revents & POLLIN)) {
     return Status(0, "Invalid poll response");
   }
+  return readINotify();
+}
+
+void INotifyEventPublisher::react() {
+  WriteLock lock(react_mutex_);
+  flushCoalesced();
+  if (fanotify_.getHandle() != -1) {
+    readFanotify();
+  }
+
+  auto status = readINotify();
+  if (!status.ok()) {
+    VLOG(1) << "Cannot read inotify events: " << status.getMessage();
+  }
 
+  // Held events are fired once their path is quiet, without a read.
+  if (!coalescer_.empty()) {
+    EventReactor::get().wake(
+        getHandle(),
+        std::chrono::milliseconds(FLAGS_file_events_coalesce_window));
+  }
+}
+
+Status INotifyEventPublisher::readINotify() {
   WriteLock lock(scratch_mutex_);
-  ssize_t record_num =
-      ::read(getHandle(), scratch_, inotify_events_ * kINotifyEventSize);
-  if (record_num == 0 || record_num == -1) {
-    return Status(1, "INotify read failed");
+  if (scratch_ == nullptr) {
+    return Status(1, "INotify scratch space is not allocated");
+  }
+
+  // Drain a burst of events before returning to the run loop.
+  bool overflow = false;
+  for (size_t reads = 0; reads < kINotifyMaxReads; reads++) {
+    auto size = inotify_events_ * kINotifyEventSize;
+    ssize_t record_num = ::read(getHandle(), scratch_, size);
+    if (record_num == -1 && (errno == EAGAIN || errno == EINTR)) {
+      break;
+    }
+
+    if (record_num <= 0) {
+      return Status(1, "INotify read failed");
+    }
+
+    overflow = readEvents(record_num) || overflow;
+    auto used = static_cast<size_t>(record_num);
+    if (used + kINotifyEventSize > size) {
+      // The scratch space was filled, read larger batches of the burst.
+      if (inotify_events_ < kINotifyMaxEvents) {
+        resizeScratch(inotify_events_ * 2);
+      }
+      continue;
+    }
+
+    // A read with space remaining emptied the queue.
+    if (reads > 0 || used >= size / 4) {
+      quiet_reads_ = 0;
+    } else if (inotify_events_ > kINotifyMinEvents &&
+               ++quiet_reads_ >= kINotifyShrinkReads) {
+      resizeScratch(inotify_events_ / 2);
+    }
+    break;
   }
 
-  for (char* p = scratch_; p < scratch_ + record_num;) {
+  if (overflow) {
+    handleOverflow();
+  }
+  return Status(0, "OK");
+}
+
+bool INotifyEventPublisher::readEvents(size_t size) {
+  bool overflow = false;
+  for (char* p = scratch_; p < scratch_ + size;) {
     // Cast the inotify struct, make shared pointer, and append to contexts.
     auto event = reinterpret_cast<struct inotify_event*>(p);
     if (event->mask & IN_Q_OVERFLOW) {
       // The inotify queue was overflown (try to recieve more events from OS).
-      handleOverflow();
+      overflow = true;
     } else if (event->mask & IN_IGNORED) {
       // This inotify watch was removed.
       removeMonitor(event->wd, false);
@@ -260,34 +492,36 @@ Status INotifyEventPublisher::run() {
     } else {
       auto ec = createEventContextFrom(event);
       if (!ec->action.empty()) {
-        fire(ec);
+        fireCoalesced(ec);
       }
     }
     // Continue to iterate
     p += (sizeof(struct inotify_event)) + event->len;
   }
-
-  return Status(0, "OK");
+  return overflow;
 }
 
 INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
     struct inotify_event* event) const {
-  auto shared_event = std::make_shared<struct inotify_event>(*event);
   auto ec = createEventContext();
-  ec->event = shared_event;
 
   // Get the pathname the watch fired on.
   {
     WriteLock lock(path_mutex_);
-    if (descriptor_inosubctx_.find(event->wd) == descriptor_inosubctx_.end()) {
+    auto isc = descriptor_inosubctx_.find(event->wd);
+    if (isc == descriptor_inosubctx_.end()) {
       // return a blank event context if we can't find the paths for the event
       return ec;
-    } else {
-      auto isc = descriptor_inosubctx_.at(event->wd);
-      ec->path = isc->descriptor_paths_.at(event->wd);
-      ec->isub_ctx = isc;
     }
+
+    auto path = isc->second->descriptor_paths_.find(event->wd);
+    if (path == isc->second->descriptor_paths_.end()) {
+      return ec;
+    }
+    ec->path = path->second;
+    ec->isub_ctx = isc->second;
   }
+  ec->event = std::make_shared<struct inotify_event>(*event);
 
   if (event->len > 1) {
     ec->path += event->name;
@@ -302,6 +536,30 @@ INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
   return ec;
 }
 
+INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
+    const std::string& path,
+    uint32_t mask,
+    const INotifySubscriptionContextRef& isc) const {
+  // fanotify events are not paired by a cookie and have no watch.
+  auto shared_event = std::make_shared<struct inotify_event>();
+  shared_event->wd = -1;
+  shared_event->mask = mask;
+  shared_event->cookie = 0;
+  shared_event->len = 0;
+
+  auto ec = createEventContext();
+  ec->event = shared_event;
+  ec->path = path;
+  ec->isub_ctx = isc;
+  for (const auto& action : kMaskActions) {
+    if (mask & action.first) {
+      ec->action = action.second;
+      break;
+    }
+  }
+  return ec;
+}
+
 bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
                                        const INotifyEventContextRef& ec) const {
   if (sc.get() != ec->isub_ctx.get()) {
@@ -315,7 +573,8 @@ bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
   }
 
   // inotify will not monitor recursively, new directories need watches.
-  if (sc->recursive && ec->action == "CREATED" && isDirectory(ec->path)) {
+  if (sc->recursive && ec->event->wd != -1 && ec->action == "CREATED" &&
+      isDirectory(ec->path) && !exclude_paths_.findDescendants(ec->path)) {
     const_cast<INotifyEventPublisher*>(this)->addMonitor(
         ec->path + '/',
         const_cast<INotifySubscriptionContextRef&>(sc),
@@ -323,12 +582,9 @@ bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
         true);
   }
 
-  // exclude paths should be applied at last
-  auto path = ec->path.substr(0, ec->path.rfind('/'));
-  // Need to have two finds,
-  // what if somebody excluded an individual file inside a directory
-  if (!exclude_paths_.empty() &&
-      (exclude_paths_.find(path) || exclude_paths_.find(ec->path))) {
+  // Exclude paths are applied last, to the path and its directory, as an
+  // individual file inside a directory may be excluded.
+  if (!exclude_paths_.empty() && exclude_paths_.findSelfOrParent(ec->path)) {
     return false;
   }
 
@@ -376,7 +632,10 @@ bool INotifyEventPublisher::addMonitor(const std::string& path,
     boost::system::error_code ec;
     for (const auto& child : children) {
       auto canonicalized = fs::canonical(child, ec).string() + '/';
-      addMonitor(canonicalized, isc, mask, false);
+      // A directory whose contents are all excluded is not watched.
+      if (!exclude_paths_.findDescendants(canonicalized)) {
+        addMonitor(canonicalized, isc, mask, false);
+      }
     }
   }
 
@@ -442,6 +701,7 @@ Status INotifyEventPublisher::addSubscription(
   }
 
   subscriptions_.push_back(subscription);
+  updateSubscriptions();
   return Status(0);
 }
 
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 #include <sys/inotify.h>
@@ -18,6 +19,9 @@
 
 #include <osquery/events.h>
 
+#include "osquery/events/coalescer.h"
+#include "osquery/events/linux/fanotify.h"
+#include "osquery/events/linux/reactor.h"
 #include "osquery/events/pathset.h"
 
 namespace osquery {
@@ -29,7 +33,7 @@ extern const uint32_t kFileAccessMasks;
 
 // INotifySubscriptionContext containers
 using PathDescriptorMap = std::map<std::string, int>;
-using DescriptorPathMap = std::map<int, std::string>;
+using DescriptorPathMap = std::unordered_map<int, std::string>;
 using PathStatusChangeTimeMap = std::map<std::string, time_t>;
 
 /**
@@ -87,6 +91,9 @@ struct INotifySubscriptionContext : public SubscriptionContext {
   /// Map of path and status change time of file/directory.
   PathStatusChangeTimeMap path_sc_time_;
 
+  /// Paths matched against fanotify events, if the subscription uses marks.
+  std::shared_ptr<PathSet<patternedPath>> fanotify_paths_;
+
  private:
   friend class INotifyEventPublisher;
 };
@@ -116,6 +123,9 @@ struct INotifyEventContext : public EventContext {
   /// A no-op event transaction id.
   uint32_t transaction_id{0};
 
+  /// The number of events merged into this event.
+  size_t count{1};
+
   /// This event ctx belongs to isub_ctx
   INotifySubscriptionContextRef isub_ctx;
 };
@@ -123,7 +133,8 @@ struct INotifyEventContext : public EventContext {
 using INotifyEventContextRef = std::shared_ptr<INotifyEventContext>;
 
 // Publisher container
-using DescriptorINotifySubCtxMap = std::map<int, INotifySubscriptionContextRef>;
+using DescriptorINotifySubCtxMap =
+    std::unordered_map<int, INotifySubscriptionContextRef>;
 
 using ExcludePathSet = PathSet<patternedPath>;
 
@@ -164,6 +175,11 @@ class INotifyEventPublisher
   /// The calling for beginning the thread's run loop.
   Status run() override;
 
+  /// With --events_reactor the handles are read by the EventReactor.
+  bool usesThread() const override {
+    return !EventReactor::enabled();
+  }
+
   /// Mark for delete, subscriptions.
   void removeSubscriptions(const std::string& subscriber) override;
 
@@ -175,6 +191,12 @@ class INotifyEventPublisher
   INotifyEventContextRef createEventContextFrom(
       struct inotify_event* event) const;
 
+  /// Create an event context for a fanotify event matching a subscription.
+  INotifyEventContextRef createEventContextFrom(
+      const std::string& path,
+      uint32_t mask,
+      const INotifySubscriptionContextRef& isc) const;
+
   /// Check if the application-global `inotify` handle is alive.
   bool isHandleOpen() const {
     return inotify_handle_ > 0;
@@ -223,6 +245,24 @@ class INotifyEventPublisher
   bool monitorSubscription(INotifySubscriptionContextRef& sc,
                            bool add_watch = true);
 
+  /// Mark the filesystem of a subscription, instead of adding watches.
+  bool monitorFanotify(INotifySubscriptionContextRef& sc);
+
+  /// Read fanotify events and fire them for each matching subscription.
+  void readFanotify();
+
+  /// Fire an event, or hold it to merge a burst of events for its path.
+  void fireCoalesced(const INotifyEventContextRef& ec);
+
+  /// Fire the held events that are quiet for the window.
+  void flushCoalesced();
+
+  /// Read the available inotify events, until the read would block.
+  Status readINotify();
+
+  /// The EventReactor handler of the inotify and fanotify handles.
+  void react();
+
   /// Build the set of excluded paths for which events are not to be propogated.
   void buildExcludePathsSet();
 
@@ -246,6 +286,12 @@ class INotifyEventPublisher
   /// If we overflow, try to read more events from OS at time.
   void handleOverflow();
 
+  /// Fire the events read into the scratch space, returns true on overflow.
+  bool readEvents(size_t size);
+
+  /// Resize the scratch space to read a number of events.
+  bool resizeScratch(size_t events);
+
   /// Map of watched path string to inotify watch file descriptor.
   /// Used for sanity check from unit test(s).
   PathDescriptorMap path_descriptors_;
@@ -259,12 +305,24 @@ class INotifyEventPublisher
   /// The inotify file descriptor handle.
   std::atomic<int> inotify_handle_{-1};
 
+  /// Whole filesystem marks, used for subscriptions when enabled.
+  FanotifyMonitor fanotify_;
+
+  /// Subscriptions matched against fanotify events.
+  std::vector<INotifySubscriptionContextRef> fanotify_subscriptions_;
+
+  /// Events held to merge bursts for a path, used by the run loop.
+  EventCoalescer<INotifyEventContext> coalescer_;
+
   /// Time in seconds of the last inotify overflow.
   std::atomic<int> last_overflow_{-1};
 
   /// Tracks how many events to be received from OS.
   size_t inotify_events_{16};
 
+  /// Consecutive wakeups that used a fraction of the scratch space.
+  size_t quiet_reads_{0};
+
   /// Enable for sanity check from unit test(s).
   bool inotify_sanity_check{false};
 
@@ -285,6 +343,12 @@ class INotifyEventPublisher
   /// Access the Inofity response scratch space.
   mutable Mutex scratch_mutex_;
 
+  /// Access to the fanotify marks and subscriptions.
+  mutable Mutex fanotify_mutex_;
+
+  /// Serializes the reactor handlers, which share the coalescer.
+  Mutex react_mutex_;
+
  public:
   friend class INotifyTests;
   FRIEND_TEST(INotifyTests, test_inotify_init);
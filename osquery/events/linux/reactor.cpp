@@ -0,0 +1,357 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/process.h"
+#include "osquery/events/linux/reactor.h"
+
+namespace osquery {
+
+FLAG(bool,
+     events_reactor,
+     false,
+     "Handle the inotify, udev, and syslog publishers on a shared reactor");
+
+FLAG(uint64,
+     events_reactor_threads,
+     2,
+     "Number of threads calling event publisher handlers for the reactor");
+
+FLAG(uint64,
+     events_reactor_utilization_limit,
+     0,
+     "Percent of a CPU each reactor thread may use, 0 for no limit");
+
+/// The number of readiness events a worker takes from each wait.
+const size_t kReactorEvents = 16;
+
+/// The pause before a descriptor that hung up is armed again.
+const std::chrono::milliseconds kReactorHangupPause(1000);
+
+/// The pause before waking a descriptor whose handler is running.
+const std::chrono::milliseconds kReactorRetryPause(10);
+
+/// The window over which a worker's CPU utilization is measured.
+const std::chrono::milliseconds kReactorBudgetWindow(1000);
+
+/// The descriptor whose handler the calling worker is running, or -1.
+static thread_local int kReactorHandling{-1};
+
+EventReactor& EventReactor::get() {
+  static EventReactor reactor;
+  return reactor;
+}
+
+bool EventReactor::enabled() {
+  return FLAGS_events_reactor;
+}
+
+EventReactor::~EventReactor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+
+  // The interrupt stays readable, such that every worker stops.
+  if (interrupt_ != -1) {
+    ::eventfd_write(interrupt_, 1);
+  }
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+
+  if (epoll_ != -1) {
+    ::close(epoll_);
+  }
+  if (interrupt_ != -1) {
+    ::close(interrupt_);
+  }
+}
+
+Status EventReactor::add(int fd, Handler handler) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (epoll_ == -1) {
+    epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+    interrupt_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_ == -1 || interrupt_ == -1) {
+      return Status(1, "Cannot create the event reactor");
+    }
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = interrupt_;
+    ::epoll_ctl(epoll_, EPOLL_CTL_ADD, interrupt_, &event);
+  }
+
+  auto entry = entries_.find(fd);
+  if (entry != entries_.end()) {
+    entry->second.handler = std::move(handler);
+    return Status(0, "OK");
+  }
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN | EPOLLONESHOT;
+  event.data.fd = fd;
+  if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) != 0) {
+    return Status(1, "Cannot add a descriptor to the event reactor");
+  }
+  entries_[fd].handler = std::move(handler);
+
+  if (threads_.empty()) {
+    auto count = std::max<uint64_t>(FLAGS_events_reactor_threads, 1);
+    for (size_t i = 0; i < count; i++) {
+      threads_.emplace_back(&EventReactor::work, this);
+    }
+  }
+  return Status(0, "OK");
+}
+
+void EventReactor::remove(int fd) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (entries_.count(fd) == 0) {
+    return;
+  }
+
+  if (kReactorHandling != fd) {
+    returned_.wait(lock, [this, fd]() {
+      auto entry = entries_.find(fd);
+      return entry == entries_.end() || !entry->second.running;
+    });
+  }
+  ::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+  entries_.erase(fd);
+}
+
+void EventReactor::wake(int fd, std::chrono::milliseconds delay) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = entries_.find(fd);
+    if (entry == entries_.end()) {
+      return;
+    }
+
+    auto wake = std::chrono::steady_clock::now() + delay;
+    if (!entry->second.waking || wake < entry->second.wake) {
+      entry->second.waking = true;
+      entry->second.wake = wake;
+    }
+  }
+
+  // A waiting worker recalculates its timeout.
+  ::eventfd_write(interrupt_, 1);
+}
+
+size_t EventReactor::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+int EventReactor::nextWake() {
+  auto now = std::chrono::steady_clock::now();
+  int timeout = -1;
+  for (const auto& entry : entries_) {
+    if (!entry.second.waking) {
+      continue;
+    }
+
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         entry.second.wake - now)
+                         .count();
+    auto wait = static_cast<int>(std::max<decltype(remaining)>(remaining, 0));
+    timeout = (timeout == -1) ? wait : std::min(timeout, wait);
+  }
+  return timeout;
+}
+
+void EventReactor::call(int fd) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    auto entry = entries_.find(fd);
+    if (entry == entries_.end()) {
+      break;
+    }
+
+    auto handler = entry->second.handler;
+    lock.unlock();
+    kReactorHandling = fd;
+    handler();
+    kReactorHandling = -1;
+    lock.lock();
+
+    // The handler may have been removed while it was called.
+    entry = entries_.find(fd);
+    if (entry == entries_.end()) {
+      break;
+    }
+
+    if (!entry->second.again) {
+      entry->second.running = false;
+      break;
+    }
+    entry->second.again = false;
+  }
+  returned_.notify_all();
+  lock.unlock();
+  throttle();
+}
+
+void EventReactor::throttle() {
+  if (FLAGS_events_reactor_utilization_limit == 0) {
+    return;
+  }
+
+  ThreadUsage usage;
+  if (!getThreadUsage(usage).ok()) {
+    return;
+  }
+
+  // Each worker measures its own CPU time within a window.
+  auto used = usage.user_time + usage.system_time;
+  auto now = std::chrono::steady_clock::now();
+  static thread_local auto window_start = now;
+  static thread_local auto window_usage = used;
+
+  auto wall = std::chrono::duration_cast<std::chrono::microseconds>(
+                  now - window_start)
+                  .count();
+  if (wall < std::chrono::duration_cast<std::chrono::microseconds>(
+                 kReactorBudgetWindow)
+                 .count()) {
+    return;
+  }
+
+  // Pause until the window's utilization is within the limit.
+  auto cpu = used - window_usage;
+  auto allowed = cpu * 100 / FLAGS_events_reactor_utilization_limit;
+  if (allowed > static_cast<uint64_t>(wall)) {
+    std::this_thread::sleep_for(std::chrono::microseconds(allowed - wall));
+  }
+  window_start = std::chrono::steady_clock::now();
+  window_usage = used;
+}
+
+void EventReactor::work() {
+  std::vector<struct epoll_event> events(kReactorEvents);
+  while (true) {
+    std::vector<std::pair<int, bool>> due;
+    int timeout = -1;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_) {
+        break;
+      }
+
+      // Take the handlers that are due to wake.
+      auto now = std::chrono::steady_clock::now();
+      for (auto& entry : entries_) {
+        if (!entry.second.waking || entry.second.wake > now) {
+          continue;
+        }
+
+        if (entry.second.running) {
+          if (entry.second.disarmed) {
+            // Arm the descriptor once the running handler returns.
+            entry.second.wake = now + kReactorRetryPause;
+            continue;
+          }
+          entry.second.again = true;
+        } else {
+          entry.second.running = true;
+          due.emplace_back(entry.first, entry.second.disarmed);
+        }
+        entry.second.waking = false;
+        entry.second.disarmed = false;
+      }
+      timeout = nextWake();
+    }
+
+    for (const auto& fd : due) {
+      call(fd.first);
+      if (fd.second) {
+        // The descriptor hung up, it is armed again after a pause.
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (entries_.count(fd.first) > 0) {
+          struct epoll_event event = {};
+          event.events = EPOLLIN | EPOLLONESHOT;
+          event.data.fd = fd.first;
+          ::epoll_ctl(epoll_, EPOLL_CTL_MOD, fd.first, &event);
+        }
+      }
+    }
+    if (!due.empty()) {
+      continue;
+    }
+
+    auto count = ::epoll_wait(
+        epoll_, events.data(), static_cast<int>(events.size()), timeout);
+    if (count == -1 && errno != EINTR) {
+      LOG(ERROR) << "Event reactor wait failed: " << errno;
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      auto fd = events[i].data.fd;
+      if (fd == interrupt_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!stopping_) {
+          eventfd_t value = 0;
+          ::eventfd_read(interrupt_, &value);
+        }
+        continue;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto entry = entries_.find(fd);
+        if (entry == entries_.end()) {
+          continue;
+        }
+
+        if (entry->second.running) {
+          entry->second.again = true;
+          continue;
+        }
+        entry->second.running = true;
+      }
+      call(fd);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto entry = entries_.find(fd);
+      if (entry == entries_.end()) {
+        continue;
+      }
+
+      bool hangup = (events[i].events & (EPOLLHUP | EPOLLERR)) &&
+                    !(events[i].events & EPOLLIN);
+      if (hangup) {
+        // Avoid spinning on a descriptor that stays in an error state.
+        entry->second.disarmed = true;
+        entry->second.waking = true;
+        entry->second.wake =
+            std::chrono::steady_clock::now() + kReactorHangupPause;
+        continue;
+      }
+
+      struct epoll_event event = {};
+      event.events = EPOLLIN | EPOLLONESHOT;
+      event.data.fd = fd;
+      ::epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &event);
+    }
+  }
+}
+}
@@ -0,0 +1,125 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief The epoll reactor shared by Linux event publishers.
+ *
+ * Publishers add their file descriptors with a handler instead of polling
+ * them within a thread of each publisher, see --events_reactor. A small pool
+ * of workers waits on a single epoll instance and calls the handler of each
+ * readable descriptor. A descriptor is handled by one worker at a time, and
+ * is armed again once its handler returns.
+ *
+ * Workers measure the CPU time of the handlers they call, and pause when over
+ * --events_reactor_utilization_limit.
+ */
+class EventReactor : private boost::noncopyable {
+ public:
+  using Handler = std::function<void()>;
+
+  static EventReactor& get();
+
+  /// Check if publishers use the reactor, see --events_reactor.
+  static bool enabled();
+
+  /**
+   * @brief Call a handler when a descriptor is readable.
+   *
+   * Adding a descriptor again replaces its handler. The workers are started
+   * with the first descriptor.
+   */
+  Status add(int fd, Handler handler);
+
+  /**
+   * @brief Stop handling a descriptor.
+   *
+   * Waits for a running handler of the descriptor to return, unless called
+   * from that handler, such that the descriptor may be closed afterward.
+   */
+  void remove(int fd);
+
+  /// Call a descriptor's handler after a delay, even if it is not readable.
+  void wake(int fd, std::chrono::milliseconds delay);
+
+  /// The number of descriptors handled.
+  size_t size();
+
+  ~EventReactor();
+
+ private:
+  EventReactor() = default;
+
+  /// The worker thread entry point.
+  void work();
+
+  /// Call a handler, again while it is woken during the call.
+  void call(int fd);
+
+  /// Pause the calling worker if its handlers are over the CPU limit.
+  void throttle();
+
+  /// The milliseconds until the earliest wake, -1 if there is none.
+  int nextWake();
+
+ private:
+  /// A handled descriptor.
+  struct Entry {
+    Handler handler;
+
+    /// A worker is calling the handler.
+    bool running{false};
+
+    /// The handler is called again when it returns.
+    bool again{false};
+
+    /// The handler is called at this time, if set.
+    bool waking{false};
+    std::chrono::steady_clock::time_point wake;
+
+    /// The descriptor hung up, it is armed again when woken.
+    bool disarmed{false};
+  };
+
+  /// The epoll instance, and an eventfd to interrupt the workers.
+  int epoll_{-1};
+  int interrupt_{-1};
+
+  /// Handled descriptors.
+  std::map<int, Entry> entries_;
+
+  /// The worker threads.
+  std::vector<std::thread> threads_;
+
+  /// Set when the reactor is destroyed.
+  bool stopping_{false};
+
+  /// Protection around the entries and the epoll setup.
+  std::mutex mutex_;
+
+  /// Signaled when a handler returns.
+  std::condition_variable returned_;
+};
+}
@@ -8,22 +8,21 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <string.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
-#include <istream>
 #include <string>
 
-#include <boost/algorithm/string/trim.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/json_parser.hpp>
-#include <boost/tokenizer.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
@@ -45,7 +44,7 @@ FLAG(string,
 FLAG(uint64,
      syslog_rate_limit,
      100,
-     "Maximum number of logs to ingest per run (~200ms between runs)");
+     "Maximum number of logs to ingest per run, others are sampled");
 
 REGISTER(SyslogEventPublisher, "event_publisher", "syslog");
 
@@ -57,6 +56,70 @@ const std::vector<std::string> kCsvFields = {
     "time", "host", "severity", "facility", "tag", "message"};
 const size_t kErrorThreshold = 10;
 
+/// The size of each read from the pipe.
+const size_t kSyslogReadSize = 64 * 1024;
+
+/// The number of reads of a busy pipe before returning to the run loop.
+const size_t kSyslogMaxReads = 16;
+
+/// A partial line longer than this is dropped.
+const size_t kSyslogMaxLineSize = 1024 * 1024;
+
+size_t splitRsyslogCsv(const char* data,
+                       size_t size,
+                       std::vector<std::string>& fields) {
+  if (size == 0) {
+    return 0;
+  }
+
+  size_t count = 0;
+  auto next = data;
+  auto end = data + size;
+  bool last = true;
+  while (last) {
+    if (count == fields.size()) {
+      fields.emplace_back();
+    }
+    auto& tok = fields[count++];
+    tok.clear();
+
+    bool in_quote = false;
+    last = false;
+    while (next != end) {
+      // Append runs of characters without a separator or quote.
+      auto run = next;
+      while (run != end && *run != ',' && *run != '"') {
+        ++run;
+      }
+      tok.append(next, run);
+      next = run;
+      if (next == end) {
+        break;
+      }
+
+      if (*next == ',') {
+        ++next;
+        if (!in_quote) {
+          last = true;
+          break;
+        }
+        tok += ',';
+      } else if (!in_quote) {
+        in_quote = true;
+        ++next;
+      } else if (next + 1 != end && next[1] == '"') {
+        // rsyslog escapes " with "", so reverse this by inserting "
+        tok += '"';
+        next += 2;
+      } else {
+        in_quote = false;
+        ++next;
+      }
+    }
+  }
+  return count;
+}
+
 Status SyslogEventPublisher::setUp() {
   if (!FLAGS_enable_syslog) {
     return Status(1, "Publisher disabled via configuration");
@@ -85,12 +148,11 @@ Status SyslogEventPublisher::setUp() {
   }
 
   // Opening with both flags appears to be the only way to open the pipe
-  // without blocking for a writer. We won't ever write to the pipe, but we
-  // don't want to block here and will instead block waiting for a read in the
-  // run() method
-  readStream_.open(FLAGS_syslog_pipe_path,
-                   std::ifstream::in | std::ifstream::out);
-  if (!readStream_.good()) {
+  // without blocking for a writer, and without reading an end of file when
+  // rsyslog restarts. We won't ever write to the pipe.
+  readFd_ = ::open(
+      FLAGS_syslog_pipe_path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (readFd_ == -1) {
     return Status(1,
                   "Error opening pipe for reading: " + FLAGS_syslog_pipe_path);
   }
@@ -150,66 +212,151 @@ void SyslogEventPublisher::unlockPipe() {
 
 Status SyslogEventPublisher::run() {
   // This run function will be called by the event factory with ~100ms pause
-  // (see InterruptableRunnable::pause()) between runs. In case something goes
-  // weird and there is a huge amount of input, we limit how many logs we
-  // take in per run to avoid pegging the CPU.
-  for (size_t i = 0; i < FLAGS_syslog_rate_limit; ++i) {
-    if (readStream_.rdbuf()->in_avail() == 0) {
+  // (see InterruptableRunnable::pause()) between runs. Read everything rsyslog
+  // has written so it does not block on a full pipe, in large reads.
+  for (size_t reads = 0; reads < kSyslogMaxReads; ++reads) {
+    auto offset = buffer_.size();
+    buffer_.resize(offset + kSyslogReadSize);
+    auto bytes = ::read(readFd_, &buffer_[offset], kSyslogReadSize);
+    buffer_.resize(offset + ((bytes > 0) ? bytes : 0));
+    if (bytes < static_cast<ssize_t>(kSyslogReadSize)) {
       // If there is no pending data, we have flushed everything and can wait
       // until the next time EventFactory calls run(). This also allows the
       // thread to join when it is stopped by EventFactory.
-      return Status(0, "OK");
+      break;
     }
-    std::string line;
-    std::getline(readStream_, line);
-    auto ec = createEventContext();
-    Status status = populateEventContext(line, ec);
-    if (status.ok()) {
-      fire(ec);
-      if (errorCount_ > 0) {
-        --errorCount_;
-      }
-    } else {
-      LOG(ERROR) << status.getMessage() << " in line: " << line;
-      ++errorCount_;
-      if (errorCount_ >= kErrorThreshold) {
-        return Status(1, "Too many errors in syslog parsing.");
-      }
+  }
+
+  lines_.clear();
+  size_t start = 0;
+  while (start < buffer_.size()) {
+    auto newline = static_cast<const char*>(
+        memchr(buffer_.data() + start, '\n', buffer_.size() - start));
+    if (newline == nullptr) {
+      break;
+    }
+    size_t end = newline - buffer_.data();
+    if (end > start) {
+      lines_.emplace_back(start, end - start);
+    }
+    start = end + 1;
+  }
+
+  // In case something goes weird and there is a huge amount of input, limit
+  // how many logs are parsed per run and sample evenly from the rest.
+  size_t stride = 1;
+  if (FLAGS_syslog_rate_limit > 0 && lines_.size() > FLAGS_syslog_rate_limit) {
+    stride = (lines_.size() + FLAGS_syslog_rate_limit - 1) /
+             FLAGS_syslog_rate_limit;
+    VLOG(1) << "Syslog rate limit reached: sampling 1 of " << stride
+            << " lines";
+  }
+
+  Status status;
+  for (size_t i = 0; i < lines_.size() && status.ok(); i += stride) {
+    status = fireLine(buffer_.data() + lines_[i].first, lines_[i].second);
+  }
+
+  buffer_.erase(0, start);
+  if (buffer_.size() > kSyslogMaxLineSize) {
+    LOG(ERROR) << "Dropping syslog line longer than " << kSyslogMaxLineSize;
+    buffer_.clear();
+  }
+  return status;
+}
+
+Status SyslogEventPublisher::fireLine(const char* data, size_t size) {
+  auto ec = createEventContext();
+  auto count = splitRsyslogCsv(data, size, fields_);
+  Status status = populateEventContext(fields_, count, ec);
+  if (status.ok()) {
+    fire(ec);
+    if (errorCount_ > 0) {
+      --errorCount_;
+    }
+  } else {
+    LOG(ERROR) << status.getMessage()
+               << " in line: " << std::string(data, size);
+    ++errorCount_;
+    if (errorCount_ >= kErrorThreshold) {
+      return Status(1, "Too many errors in syslog parsing.");
     }
   }
   return Status(0, "OK");
 }
 
+void SyslogEventPublisher::configure() {
+  if (usesThread() || readFd_ == -1) {
+    return;
+  }
+
+  auto status = EventReactor::get().add(readFd_, [this]() {
+    auto s = run();
+    if (!s.ok()) {
+      LOG(ERROR) << "Syslog publisher: " << s.getMessage();
+    }
+  });
+  if (!status.ok()) {
+    LOG(ERROR) << "Syslog publisher: " << status.getMessage();
+  }
+}
+
 void SyslogEventPublisher::tearDown() {
+  if (readFd_ != -1) {
+    if (!usesThread()) {
+      EventReactor::get().remove(readFd_);
+    }
+    ::close(readFd_);
+    readFd_ = -1;
+  }
+  buffer_.clear();
   unlockPipe();
 }
 
 Status SyslogEventPublisher::populateEventContext(const std::string& line,
                                                   SyslogEventContextRef& ec) {
-  boost::tokenizer<RsyslogCsvSeparator> tokenizer(line);
-  auto key = kCsvFields.begin();
-  for (std::string value : tokenizer) {
-    if (key == kCsvFields.end()) {
-      return Status(1, "Received more fields than expected");
+  std::vector<std::string> fields;
+  auto count = splitRsyslogCsv(line.data(), line.size(), fields);
+  return populateEventContext(fields, count, ec);
+}
+
+Status SyslogEventPublisher::populateEventContext(
+    const std::vector<std::string>& fields,
+    size_t count,
+    SyslogEventContextRef& ec) {
+  if (count > kCsvFields.size()) {
+    return Status(1, "Received more fields than expected");
+  } else if (count < kCsvFields.size()) {
+    return Status(1, "Received fewer fields than expected");
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    const auto& key = kCsvFields[i];
+    const auto& field = fields[i];
+
+    // Fields are stripped of surrounding space.
+    auto begin = field.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+      begin = field.size();
+    }
+    auto end = field.find_last_not_of(" \t\r\n") + 1;
+    if (end < begin) {
+      end = begin;
     }
 
-    boost::trim(value);
-    if (*key == "time") {
-      ec->fields["datetime"] = value;
-    } else if (*key == "tag" && !value.empty() && value.back() == ':') {
+    if (key == "tag" && end > begin && field[end - 1] == ':') {
       // rsyslog sends "tag" with a trailing colon that we don't need
-      ec->fields.emplace(*key, value.substr(0, value.size() - 1));
-    } else {
-      ec->fields.emplace(*key, value);
+      --end;
     }
-    ++key;
-  }
 
-  if (key == kCsvFields.end()) {
-    return Status(0, "OK");
-  } else {
-    return Status(1, "Received fewer fields than expected");
+    auto value = field.substr(begin, end - begin);
+    if (key == "time") {
+      ec->fields["datetime"] = std::move(value);
+    } else {
+      ec->fields.emplace(key, std::move(value));
+    }
   }
+  return Status(0, "OK");
 }
 
 bool SyslogEventPublisher::shouldFire(const SyslogSubscriptionContextRef& sc,
@@ -12,13 +12,17 @@
 
 #include <stdio.h>
 
-#include <fstream>
 #include <map>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/events.h>
 
+#include "osquery/events/linux/reactor.h"
+
 namespace osquery {
 
 /**
@@ -48,6 +52,19 @@ struct SyslogEventContext : public EventContext {
 using SyslogEventContextRef = std::shared_ptr<SyslogEventContext>;
 using SyslogSubscriptionContextRef = std::shared_ptr<SyslogSubscriptionContext>;
 
+/**
+ * @brief Split a line of rsyslog CSV output into fields.
+ *
+ * This follows RsyslogCsvSeparator, but reuses the strings in fields so that
+ * parsing a stream of lines does not allocate for each field.
+ *
+ * @param fields Scratch space, the first count strings are the line's fields.
+ * @return The number of fields, 0 for an empty line.
+ */
+size_t splitRsyslogCsv(const char* data,
+                       size_t size,
+                       std::vector<std::string>& fields);
+
 /**
  * @brief Event publisher for syslog lines forwarded through rsyslog
  *
@@ -63,12 +80,17 @@ class SyslogEventPublisher
  public:
   Status setUp() override;
 
-  void configure() override {}
+  void configure() override;
 
   void tearDown() override;
 
   Status run() override;
 
+  /// The pipe is read by the EventReactor if enabled.
+  bool usesThread() const override {
+    return !EventReactor::enabled();
+  }
+
  public:
   SyslogEventPublisher() : EventPublisher(), errorCount_(0), lockFd_(-1) {}
 
@@ -114,10 +136,27 @@ class SyslogEventPublisher
   static Status populateEventContext(const std::string& line,
                                      SyslogEventContextRef& ec);
 
+  /// Populate the SyslogEventContext with fields split from a line.
+  static Status populateEventContext(const std::vector<std::string>& fields,
+                                     size_t count,
+                                     SyslogEventContextRef& ec);
+
+  /// Parse and fire a line, counting errors.
+  Status fireLine(const char* data, size_t size);
+
   /**
-   * @brief Input stream for reading from the pipe.
+   * @brief Non-blocking descriptor for reading from the pipe.
    */
-  std::fstream readStream_;
+  int readFd_{-1};
+
+  /// Data read from the pipe that does not yet end with a newline.
+  std::string buffer_;
+
+  /// The offset and size of each complete line in the buffer.
+  std::vector<std::pair<size_t, size_t>> lines_;
+
+  /// Scratch space for splitting lines into fields.
+  std::vector<std::string> fields_;
 
   /**
    * @brief Counter used to shut down thread when too many errors occur.
@@ -133,7 +172,7 @@ class SyslogEventPublisher
    * @brief File descriptor used to lock the pipe for reading.
    *
    * This fd should not be used for reading from the pipe, instead use
-   * readStream_.
+   * readFd_.
    */
   int lockFd_;
 
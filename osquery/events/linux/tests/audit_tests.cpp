@@ -55,19 +55,35 @@ TEST_F(AuditTests, test_handle_reply) {
   memset((void*)reply.message, 0, message.size() + 1);
   memcpy((void*)reply.message, message.c_str(), message.size());
 
-  // Perform the parsing.
+  // Perform the parsing, the fields are slices of the context's message.
   handleAuditReply(reply, ec);
-  free((char*)reply.message);
+  memset((void*)reply.message, 0, message.size());
 
   EXPECT_EQ(reply.type, ec->type);
   EXPECT_EQ(1440542781U, ec->time);
   EXPECT_EQ(403030U, ec->audit_id);
   EXPECT_EQ(ec->fields.size(), 4U);
   EXPECT_EQ(ec->fields.count("argc"), 1U);
-  EXPECT_EQ(ec->fields["argc"], "3");
-  EXPECT_EQ(ec->fields["a0"], "\"H=1 \"");
-  EXPECT_EQ(ec->fields["a1"], "\"/bin/sh\"");
-  EXPECT_EQ(ec->fields["a2"], "c");
+  EXPECT_EQ(ec->fields.at("argc"), "3");
+  EXPECT_EQ(ec->fields.at("a0"), "\"H=1 \"");
+  EXPECT_EQ(ec->fields.at("a1"), "\"/bin/sh\"");
+  EXPECT_EQ(ec->fields.at("a2"), "c");
+  EXPECT_THROW(ec->fields.at("a3"), std::out_of_range);
+  EXPECT_EQ(ec->fields.get("a3", "none"), "none");
+
+  // Fields are kept in message order.
+  auto it = ec->fields.begin();
+  EXPECT_EQ(it->first, "argc");
+  EXPECT_EQ((++it)->first, "a0");
+
+  // Only fields selected by a filter are parsed, a prefix ends with '*'.
+  memcpy((void*)reply.message, message.c_str(), message.size());
+  AuditFieldFilter filter = {"a*"};
+  handleAuditReply(reply, ec, &filter);
+  free((char*)reply.message);
+  EXPECT_EQ(ec->fields.size(), 3U);
+  EXPECT_EQ(ec->fields.count("argc"), 0U);
+  EXPECT_EQ(ec->fields.at("a2"), "c");
 }
 
 TEST_F(AuditTests, test_audit_value_decode) {
@@ -82,18 +98,42 @@ TEST_F(AuditTests, test_audit_value_decode) {
   // When the hex fails to decode the input value is returned as the result.
   auto decoded_fail = decodeAuditValue("7");
   EXPECT_EQ(decoded_fail, "7");
+  EXPECT_EQ(decodeAuditValue("736c6565702G"), "736c6565702G");
+
+  // Sizes are calculated without decoding.
+  EXPECT_EQ(getAuditValueSize("\"/bin/ls\""), 7U);
+  EXPECT_EQ(getAuditValueSize("736C6565702031"), 7U);
+  EXPECT_EQ(getAuditValueSize("736C6565702G"), 12U);
+
+  // Values are appended in place, up to a limit.
+  std::string cmdline = "sleep ";
+  appendAuditValue("31", cmdline);
+  EXPECT_EQ(cmdline, "sleep 1");
+  appendAuditValue("736C6565702031", cmdline, 3);
+  EXPECT_EQ(cmdline, "sleep 1sle");
+  appendAuditValue("\"/bin/ls\"", cmdline, 4);
+  EXPECT_EQ(cmdline, "sleep 1sle/bin");
 }
 
 size_t kAuditCounter{0};
 
-bool SimpleUpdate(size_t t, const AuditFields& f, AuditFields& m) {
+bool SimpleUpdate(size_t t, const AuditFieldView& f, AuditFields& m) {
   kAuditCounter++;
   for (const auto& i : f) {
-    m[i.first] = i.second;
+    m[i.first.to_string()] = i.second.to_string();
   }
   return true;
 }
 
+/// Create a view of the fields, the fields must outlive the view.
+AuditFieldView getFieldView(const AuditFields& fields) {
+  AuditFieldView view;
+  for (const auto& field : fields) {
+    view.add(field.first, field.second);
+  }
+  return view;
+}
+
 TEST_F(AuditTests, test_audit_assembler) {
   // Test the queue correctness.
   AuditAssembler asmb;
@@ -102,7 +142,7 @@ TEST_F(AuditTests, test_audit_assembler) {
   asmb.start(3, expected_types, nullptr);
 
   AuditFields expected_fields{{"1", "1"}};
-  asmb.add(100U, 1, expected_fields);
+  asmb.add(100U, 1, getFieldView(expected_fields));
 
   EXPECT_EQ(3U, asmb.capacity_);
   EXPECT_EQ(1U, asmb.queue_.size());
@@ -112,14 +152,14 @@ TEST_F(AuditTests, test_audit_assembler) {
   EXPECT_TRUE(asmb.m_[100].empty());
 
   expected_fields = {{"2", "2"}};
-  asmb.add(100U, 1, expected_fields);
+  asmb.add(100U, 1, getFieldView(expected_fields));
 
   // Again empty.
   EXPECT_TRUE(asmb.m_[100].empty());
   EXPECT_EQ(1U, asmb.mt_[100].size());
 
-  asmb.add(100U, 2, expected_fields);
-  asmb.add(100U, 3, expected_fields);
+  asmb.add(100U, 2, getFieldView(expected_fields));
+  asmb.add(100U, 3, getFieldView(expected_fields));
   EXPECT_TRUE(asmb.m_.empty());
   EXPECT_EQ(0U, asmb.queue_.size());
 
@@ -144,15 +184,15 @@ TEST_F(AuditTests, test_audit_assembler) {
   EXPECT_EQ(0U, asmb.m_.size());
 
   asmb.start(3U, {1, 2, 3}, &SimpleUpdate);
-  EXPECT_FALSE(asmb.add(1, 1, expected_fields).is_initialized());
+  EXPECT_FALSE(asmb.add(1, 1, getFieldView(expected_fields)).is_initialized());
   EXPECT_EQ(1U, kAuditCounter);
 
   // Inject duplicate.
-  EXPECT_FALSE(asmb.add(1, 1, expected_fields).is_initialized());
+  EXPECT_FALSE(asmb.add(1, 1, getFieldView(expected_fields)).is_initialized());
   EXPECT_EQ(2U, kAuditCounter);
 
-  EXPECT_FALSE(asmb.add(1, 2, expected_fields).is_initialized());
-  auto fields = asmb.add(1, 3, expected_fields);
+  EXPECT_FALSE(asmb.add(1, 2, getFieldView(expected_fields)).is_initialized());
+  auto fields = asmb.add(1, 3, getFieldView(expected_fields));
   EXPECT_TRUE(fields.is_initialized());
   EXPECT_EQ(*fields, expected_fields);
 }
@@ -173,6 +213,13 @@ TEST_F(AuditTests, test_parse_sock_addr) {
   EXPECT_EQ(r3["remote_address"], "fe80:0000:0000:0000:0225:22ff:feb0:3684");
   EXPECT_EQ(r3["remote_port"], "8081");
 
+  // Truncated or non-hex addresses are not decoded.
+  Row r5;
+  parseSockAddr("02001F907F00", r5);
+  EXPECT_TRUE(r5["remote_address"].empty());
+  parseSockAddr("02001F907F0000ZZ0000000000000000", r5);
+  EXPECT_TRUE(r5["remote_address"].empty());
+
   auto socket_flag = FLAGS_audit_allow_unix;
   FLAGS_audit_allow_unix = true;
   Row r4;
@@ -186,4 +233,37 @@ TEST_F(AuditTests, test_parse_sock_addr) {
   EXPECT_EQ(r4["socket"], "/tmp/osquery.em");
   FLAGS_audit_allow_unix = socket_flag;
 }
+
+TEST_F(AuditTests, test_audit_rule_data) {
+  // Syscalls sharing a filter, flags, and action become a single rule.
+  std::vector<AuditRule> rules = {{59, ""}, {49, ""}, {42, ""}};
+  auto data = getAuditRuleData(rules);
+  ASSERT_EQ(data.size(), 1U);
+
+  auto rule = reinterpret_cast<const struct audit_rule_data*>(
+      data.begin()->data());
+  EXPECT_EQ(rule->flags, static_cast<uint32_t>(AUDIT_FILTER_EXIT));
+  EXPECT_EQ(rule->action, static_cast<uint32_t>(AUDIT_ALWAYS));
+  EXPECT_EQ(rule->field_count, 0U);
+  for (const auto& syscall : {59, 49, 42}) {
+    EXPECT_NE(rule->mask[AUDIT_WORD(syscall)] & AUDIT_BIT(syscall), 0U);
+  }
+  EXPECT_EQ(rule->mask[AUDIT_WORD(43)] & AUDIT_BIT(43), 0U);
+
+  // The same rules build the same data, which is compared on reconfigure.
+  EXPECT_EQ(getAuditRuleData(rules), data);
+
+  // A different action is a separate rule, unapplied rules are skipped.
+  rules.push_back({59, ""});
+  rules.back().action = AUDIT_NEVER;
+  rules.push_back({2, ""});
+  rules.back().apply_rule = false;
+  data = getAuditRuleData(rules);
+  EXPECT_EQ(data.size(), 2U);
+
+  // Without any applied rules there is nothing to install.
+  rules = {{59, ""}};
+  rules.back().apply_rule = false;
+  EXPECT_TRUE(getAuditRuleData(rules).empty());
+}
 }
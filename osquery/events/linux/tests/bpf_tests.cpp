@@ -0,0 +1,117 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "osquery/events/linux/bpf.h"
+
+namespace osquery {
+
+class BPFTests : public testing::Test {};
+
+TEST_F(BPFTests, test_parse_tracepoint_format) {
+  std::string content =
+      "name: sys_enter_connect\n"
+      "ID: 2130\n"
+      "format:\n"
+      "\tfield:unsigned short common_type;\toffset:0;\tsize:2;\tsigned:0;\n"
+      "\tfield:int __syscall_nr;\toffset:8;\tsize:4;\tsigned:1;\n"
+      "\tfield:int fd;\toffset:16;\tsize:8;\tsigned:0;\n"
+      "\tfield:struct sockaddr * uservaddr;\toffset:24;\tsize:8;\tsigned:0;\n"
+      "\tfield:char comm[16];\toffset:32;\tsize:16;\tsigned:0;\n"
+      "\n"
+      "print fmt: \"fd: 0x%08lx\", ((unsigned long)(REC->fd))\n";
+
+  TracepointFormat format;
+  ASSERT_TRUE(parseTracepointFormat(content, format).ok());
+  EXPECT_EQ(format.size(), 5U);
+  EXPECT_EQ(format["fd"].offset, 16U);
+  EXPECT_EQ(format["uservaddr"].offset, 24U);
+  EXPECT_EQ(format["uservaddr"].size, 8U);
+  EXPECT_EQ(format["comm"].size, 16U);
+
+  TracepointFormat empty;
+  EXPECT_FALSE(parseTracepointFormat("name: missing\n", empty).ok());
+}
+
+TEST_F(BPFTests, test_parse_record) {
+  BPFRecord record;
+  memset(&record, 0, sizeof(record));
+  record.type = kBPFExec;
+  record.tgid = 100;
+  record.tid = 101;
+  record.time = 5000000000ULL;
+  record.count = kBPFMaxArgs + 1;
+  strcpy(record.comm, "bash");
+  strcpy(record.path, "/bin/ls");
+  strcpy(record.args[0], "ls");
+  strcpy(record.args[1], "-l");
+
+  BPFEventContext ec;
+  auto data = reinterpret_cast<const char*>(&record);
+  ASSERT_TRUE(parseBPFRecord(data, sizeof(record), ec));
+  EXPECT_EQ(ec.pid, 100);
+  EXPECT_EQ(ec.tid, 101);
+  EXPECT_EQ(ec.uptime, 5U);
+  EXPECT_EQ(ec.comm, "bash");
+  EXPECT_EQ(ec.path, "/bin/ls");
+  ASSERT_EQ(ec.args.size(), kBPFMaxArgs);
+  EXPECT_EQ(ec.args[1], "-l");
+  EXPECT_TRUE(ec.args_truncated);
+
+  // Exec records must include arguments.
+  BPFEventContext short_ec;
+  EXPECT_FALSE(parseBPFRecord(data, offsetof(BPFRecord, args), short_ec));
+}
+
+TEST_F(BPFTests, test_parse_socket_record) {
+  BPFRecord record;
+  memset(&record, 0, sizeof(record));
+  record.type = kBPFConnect;
+
+  struct sockaddr_in sin;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(443);
+  inet_pton(AF_INET, "10.0.0.1", &sin.sin_addr);
+  memcpy(record.path, &sin, sizeof(sin));
+  record.count = sizeof(sin);
+
+  BPFEventContext ec;
+  auto data = reinterpret_cast<const char*>(&record);
+  ASSERT_TRUE(parseBPFRecord(data, offsetof(BPFRecord, args), ec));
+  EXPECT_EQ(ec.family, AF_INET);
+  EXPECT_EQ(ec.address, "10.0.0.1");
+  EXPECT_EQ(ec.port, 443);
+
+  struct sockaddr_in6 sin6;
+  memset(&sin6, 0, sizeof(sin6));
+  sin6.sin6_family = AF_INET6;
+  sin6.sin6_port = htons(22);
+  inet_pton(AF_INET6, "::1", &sin6.sin6_addr);
+  memcpy(record.path, &sin6, sizeof(sin6));
+  record.count = sizeof(sin6);
+
+  BPFEventContext ec6;
+  ASSERT_TRUE(parseBPFRecord(data, offsetof(BPFRecord, args), ec6));
+  EXPECT_EQ(ec6.address, "::1");
+  EXPECT_EQ(ec6.port, 22);
+
+  // A truncated address is not parsed.
+  record.count = 4;
+  BPFEventContext truncated;
+  ASSERT_TRUE(parseBPFRecord(data, offsetof(BPFRecord, args), truncated));
+  EXPECT_TRUE(truncated.address.empty());
+}
+} // namespace osquery
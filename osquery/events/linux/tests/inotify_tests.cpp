@@ -110,6 +110,7 @@ class INotifyTests : public testing::Test {
 
   void RemoveAll(std::shared_ptr<INotifyEventPublisher>& pub) {
     pub->subscriptions_.clear();
+    pub->updateSubscriptions();
     // Reset monitors.
     std::vector<int> wds;
     for (const auto& path : pub->descriptor_inosubctx_) {
@@ -533,4 +534,34 @@ TEST_F(INotifyTests, test_inotify_embedded_wildcards) {
   ASSERT_EQ(event_pub_->numDescriptors(), 1U);
   EXPECT_EQ(event_pub_->path_descriptors_.count(real_test_dir + "/2/1/"), 1U);
 }
+
+TEST_F(INotifyTests, test_fanotify_patterns) {
+  fs::create_directories(real_test_dir + "/2/1");
+
+  // A directory matches itself and its direct children.
+  std::vector<std::string> patterns;
+  EXPECT_EQ(getFanotifyPatterns(real_test_dir, patterns), real_test_dir);
+  std::vector<std::string> expected = {real_test_dir, real_test_dir + "/*"};
+  EXPECT_EQ(patterns, expected);
+
+  // The deepest existing path before a wildcard is marked.
+  patterns.clear();
+  EXPECT_EQ(getFanotifyPatterns(real_test_dir + "/%%", patterns),
+            real_test_dir);
+  expected = {real_test_dir + "/**"};
+  EXPECT_EQ(patterns, expected);
+
+  patterns.clear();
+  EXPECT_EQ(getFanotifyPatterns(real_test_dir + "/%/1/%.conf", patterns),
+            real_test_dir);
+  expected = {real_test_dir + "/*/1/*"};
+  EXPECT_EQ(patterns, expected);
+
+  // Missing paths are matched once they are created.
+  patterns.clear();
+  EXPECT_EQ(getFanotifyPatterns(real_test_dir + "/3/file", patterns),
+            real_test_dir);
+  expected = {real_test_dir + "/3/file"};
+  EXPECT_EQ(patterns, expected);
+}
 }
@@ -26,6 +26,15 @@ class SyslogTests : public testing::Test {
     std::vector<std::string> result(tokenizer.begin(), tokenizer.end());
     return result;
   }
+
+  std::vector<std::string> splitFields(const std::string& line) {
+    auto count = splitRsyslogCsv(line.data(), line.size(), fields_);
+    return std::vector<std::string>(fields_.begin(), fields_.begin() + count);
+  }
+
+ protected:
+  /// Scratch space reused across lines, as by the publisher.
+  std::vector<std::string> fields_;
 };
 
 TEST_F(SyslogTests, test_populate_event_context) {
@@ -80,4 +89,23 @@ TEST_F(SyslogTests, test_csv_separator) {
   ASSERT_EQ(std::vector<std::string>({"\",f\\ø\"o,", "\",bá\\'r", "baz\\,\""}),
             splitCsv("\"\"\",f\\ø\"\"o,\",\"\"\",bá\\'r\",\"baz\\,\"\"\""));
 }
+
+TEST_F(SyslogTests, test_split_rsyslog_csv) {
+  std::vector<std::string> lines = {
+      ",,,,",
+      " , , , , ",
+      "foo,bar,baz",
+      "\"foo\",\"bar\",\"baz\"",
+      "\",foo,\",\",bar\",\"baz,\"",
+      "\"\"\",f\\o\"\"o,\",\"\"\",ba\\'r\",\"baz\\,\"\"\"",
+      "foo",
+      "",
+  };
+
+  // Fields match the tokenizer, including when scratch space is reused.
+  for (const auto& line : lines) {
+    EXPECT_EQ(splitCsv(line), splitFields(line)) << line;
+  }
+  EXPECT_EQ(std::vector<std::string>({"a", "b"}), splitFields("a,b"));
+}
 }
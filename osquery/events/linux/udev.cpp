@@ -20,6 +20,9 @@ namespace osquery {
 
 static const int kUdevMLatency = 200;
 
+/// The devices fired by each reactor handler call, before yielding.
+static const size_t kUdevMaxReceives = 64;
+
 REGISTER(UdevEventPublisher, "event_publisher", "udev");
 
 Status UdevEventPublisher::setUp() {
@@ -45,7 +48,56 @@ Status UdevEventPublisher::setUp() {
   return Status(0, "OK");
 }
 
+void UdevEventPublisher::configure() {
+  if (usesThread()) {
+    return;
+  }
+
+  int fd = -1;
+  {
+    WriteLock lock(mutex_);
+    if (monitor_ == nullptr) {
+      return;
+    }
+    fd = udev_monitor_get_fd(monitor_);
+  }
+  EventReactor::get().add(fd, [this]() { react(); });
+}
+
+void UdevEventPublisher::react() {
+  WriteLock lock(mutex_);
+  if (monitor_ == nullptr) {
+    return;
+  }
+
+  // The monitor does not block, receive until it is empty.
+  for (size_t i = 0; i < kUdevMaxReceives; i++) {
+    struct udev_device* device = udev_monitor_receive_device(monitor_);
+    if (device == nullptr) {
+      break;
+    }
+
+    auto ec = createEventContextFrom(device);
+    fire(ec);
+    udev_device_unref(device);
+  }
+}
+
 void UdevEventPublisher::tearDown() {
+  if (!usesThread()) {
+    // Wait for a running handler before releasing the monitor.
+    int fd = -1;
+    {
+      WriteLock lock(mutex_);
+      if (monitor_ != nullptr) {
+        fd = udev_monitor_get_fd(monitor_);
+      }
+    }
+    if (fd != -1) {
+      EventReactor::get().remove(fd);
+    }
+  }
+
   WriteLock lock(mutex_);
   if (monitor_ != nullptr) {
     udev_monitor_unref(monitor_);
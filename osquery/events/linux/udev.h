@@ -15,6 +15,8 @@
 #include <osquery/events.h>
 #include <osquery/status.h>
 
+#include "osquery/events/linux/reactor.h"
+
 namespace osquery {
 
 enum udev_event_action {
@@ -85,10 +87,17 @@ class UdevEventPublisher
 
   Status setUp() override;
 
+  /// With --events_reactor the monitor is read by the EventReactor.
+  void configure() override;
+
   void tearDown() override;
 
   Status run() override;
 
+  bool usesThread() const override {
+    return !EventReactor::enabled();
+  }
+
   /**
    * @brief Return a string representation of a udev property.
    *
@@ -109,6 +118,10 @@ class UdevEventPublisher
   static std::string getAttr(struct udev_device* device,
                              const std::string& attr);
 
+ private:
+  /// The EventReactor handler, fire the devices the monitor received.
+  void react();
+
  private:
   /// udev handle (socket descriptor contained within).
   struct udev* handle_{nullptr};
@@ -10,9 +10,11 @@
 
 #pragma once
 
+#include <memory>
 #include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/noncopyable.hpp>
@@ -24,12 +26,13 @@
 namespace osquery {
 
 /**
- * @brief multiset based implemention for path search.
+ * @brief Set based implemention for path search.
  *
- * 'multiset' is used because with patterns we can serach for equivalent keys.
+ * Patterns are searched for equivalent keys.
  * Since  '/This/Path/is' ~= '/This/Path/%' ~= '/This/Path/%%' (equivalent).
  *
- * multiset is protected by lock. It is threadsafe.
+ * Patterned paths are kept in a PathTrie, resolved paths in a multiset.
+ * The set is protected by lock. It is threadsafe.
  *
  * PathSet can take any of the two policies -
  * 1. patternedPath - Path can contain pattern '%' and '%%'.
@@ -61,10 +64,35 @@ class PathSet : private boost::noncopyable {
     auto path = PathType::createPath(str);
 
     ReadLock lock(mset_lock_);
-    if (paths_.find(path) != paths_.end()) {
-      return true;
-    }
-    return false;
+    return paths_.count(path) > 0;
+  }
+
+  /**
+   * @brief Find a path or its parent directory, tokenizing the path once.
+   *
+   * A path ending with '/' is a directory, and only the path is found. This
+   * is only available with the patternedPath policy.
+   */
+  bool findSelfOrParent(const std::string& str) const {
+    auto path = PathType::createPath(str);
+    bool parent = !str.empty() && str.back() != '/' && !path.empty();
+
+    ReadLock lock(mset_lock_);
+    return paths_.count(path, path.size()) > 0 ||
+           (parent && paths_.count(path, path.size() - 1) > 0);
+  }
+
+  /**
+   * @brief Check if every path below a path is found.
+   *
+   * Publishers need not watch a directory whose contents are all excluded.
+   * This is only available with the patternedPath policy.
+   */
+  bool findDescendants(const std::string& str) const {
+    auto path = PathType::createPath(str);
+
+    ReadLock lock(mset_lock_);
+    return paths_.descendants(path);
   }
 
   void clear() {
@@ -78,50 +106,146 @@ class PathSet : private boost::noncopyable {
   }
 
  private:
-  typedef typename PathType::Path Path;
-  typedef typename PathType::Compare Compare;
-  std::multiset<Path, Compare> paths_;
+  typename PathType::Set paths_;
   mutable Mutex mset_lock_;
 };
 
-class patternedPath {
+/**
+ * @brief A trie of path components.
+ *
+ * A path is matched in time linear to its number of components, regardless of
+ * the number of patterns. A '*' component matches any single component, and a
+ * pattern ending with '*' also matches the paths below its matches. A
+ * trailing '**' matches every path below its prefix.
+ */
+class PathTrie : private boost::noncopyable {
  public:
-  typedef boost::tokenizer<boost::char_separator<char>> tokenizer;
   typedef std::vector<std::string> Path;
-  typedef std::vector<Path> VPath;
-  struct Compare {
-    bool operator()(const Path& lhs, const Path& rhs) const {
-      size_t psize = (lhs.size() < rhs.size()) ? lhs.size() : rhs.size();
-      unsigned ndx;
-      for (ndx = 0; ndx < psize; ++ndx) {
-        if (lhs[ndx] == "**" || rhs[ndx] == "**") {
-          return false;
-        }
-
-        if (lhs[ndx] == "*" || rhs[ndx] == "*") {
-          continue;
-        }
-
-        int rc = lhs[ndx].compare(rhs[ndx]);
-
-        if (rc > 0) {
-          return false;
-        }
-
-        if (rc < 0) {
-          return true;
-        }
+
+  void insert(const Path& path) {
+    auto* node = &root_;
+    for (size_t i = 0; i < path.size(); ++i) {
+      const auto& component = path[i];
+      if (component == "**") {
+        node->descendants = true;
+        size_++;
+        return;
       }
 
-      if ((ndx == rhs.size() && rhs[ndx - 1] == "*") ||
-          (ndx == lhs.size() && lhs[ndx - 1] == "*")) {
-        return false;
+      std::unique_ptr<Node>* child = nullptr;
+      if (component == "*") {
+        child = &node->wildcard;
+      } else {
+        child = &node->children[component];
       }
+      if (*child == nullptr) {
+        child->reset(new Node());
+      }
+      node = child->get();
 
-      return (lhs.size() < rhs.size());
+      if (component == "*" && i + 1 == path.size()) {
+        node->descendants = true;
+      }
     }
+    node->terminal = true;
+    size_++;
+  }
+
+  /// The number of matching patterns is not counted, only 0 or 1.
+  size_t count(const Path& path) const {
+    return count(path, path.size());
+  }
+
+  /// Count the first size components of a path.
+  size_t count(const Path& path, size_t size) const {
+    return (find(root_, path, 0, size)) ? 1 : 0;
+  }
+
+  /// Check if a pattern matches every path below a path.
+  bool descendants(const Path& path) const {
+    return findDescendants(root_, path, 0);
+  }
+
+  void clear() {
+    root_.children.clear();
+    root_.wildcard.reset();
+    root_.terminal = false;
+    root_.descendants = false;
+    size_ = 0;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+ private:
+  struct Node {
+    /// Literal components.
+    std::unordered_map<std::string, std::unique_ptr<Node>> children;
+
+    /// The '*' component.
+    std::unique_ptr<Node> wildcard;
+
+    /// A pattern ends at this node.
+    bool terminal{false};
+
+    /// Every path below this node matches.
+    bool descendants{false};
   };
 
+  bool find(const Node& node,
+            const Path& path,
+            size_t index,
+            size_t size) const {
+    if (index == size) {
+      return node.terminal;
+    }
+
+    if (node.descendants) {
+      return true;
+    }
+
+    auto child = node.children.find(path[index]);
+    if (child != node.children.end() &&
+        find(*child->second, path, index + 1, size)) {
+      return true;
+    }
+    return node.wildcard != nullptr &&
+           find(*node.wildcard, path, index + 1, size);
+  }
+
+  bool findDescendants(const Node& node,
+                       const Path& path,
+                       size_t index) const {
+    if (node.descendants) {
+      return true;
+    }
+
+    if (index == path.size()) {
+      return false;
+    }
+
+    auto child = node.children.find(path[index]);
+    if (child != node.children.end() &&
+        findDescendants(*child->second, path, index + 1)) {
+      return true;
+    }
+    return node.wildcard != nullptr &&
+           findDescendants(*node.wildcard, path, index + 1);
+  }
+
+ private:
+  Node root_;
+  size_t size_{0};
+};
+
+class patternedPath {
+ public:
+  typedef boost::tokenizer<boost::char_separator<char>> tokenizer;
+  typedef std::vector<std::string> Path;
+  typedef std::vector<Path> VPath;
+  typedef PathTrie Set;
+
   static Path createPath(const std::string& str) {
     boost::char_separator<char> sep{"/"};
     tokenizer tokens(str, sep);
@@ -193,6 +317,8 @@ class resolvedPath {
     }
   };
 
+  typedef std::multiset<Path, Compare> Set;
+
   static Path createPath(const std::string& str) {
     return Path(str);
   }
@@ -0,0 +1,159 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/// The most free blocks kept by each EventContextPool.
+const size_t kEventContextPoolSize = 1024;
+
+/**
+ * @brief Recycle the memory of a publisher's EventContext%s.
+ *
+ * Publishers create an EventContext for every event, and each is released
+ * once the subscribers' callbacks return. The pool keeps the memory of
+ * released contexts, including their shared_ptr control block, such that a
+ * busy publisher does not return to the allocator for each event.
+ *
+ * Only the storage is recycled; every context is constructed and destroyed.
+ * The pool is never destroyed, contexts may be released during shutdown.
+ */
+template <typename EC>
+class EventContextPool : private boost::noncopyable {
+ public:
+  static EventContextPool& get() {
+    static auto* pool = new EventContextPool();
+    return *pool;
+  }
+
+  /// Take a block of size bytes, from the free blocks if possible.
+  void* take(size_t size) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (size_ == 0) {
+        size_ = size;
+      }
+
+      if (size == size_ && !free_.empty()) {
+        auto* block = free_.back();
+        free_.pop_back();
+        reused_++;
+        return block;
+      }
+    }
+
+    allocated_++;
+    return ::operator new(size);
+  }
+
+  /// Return a block, it is freed if the pool is full.
+  void give(void* block, size_t size) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (size == size_ && free_.size() < kEventContextPoolSize) {
+        free_.push_back(block);
+        return;
+      }
+    }
+
+    ::operator delete(block);
+  }
+
+  /// The number of blocks taken from the allocator.
+  size_t allocated() const {
+    return allocated_;
+  }
+
+  /// The number of blocks taken from the free blocks.
+  size_t reused() const {
+    return reused_;
+  }
+
+  /// The number of free blocks.
+  size_t available() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return free_.size();
+  }
+
+ private:
+  EventContextPool() = default;
+
+ private:
+  /// The size of pooled blocks, set by the first take.
+  size_t size_{0};
+
+  /// Released blocks.
+  std::vector<void*> free_;
+
+  /// Protection around the free blocks.
+  std::mutex mutex_;
+
+  std::atomic<size_t> allocated_{0};
+  std::atomic<size_t> reused_{0};
+};
+
+/**
+ * @brief An allocator for std::allocate_shared using an EventContextPool.
+ *
+ * The allocator is rebound to the shared_ptr's combined control block and
+ * context, whose storage is kept by the pool of the context's type.
+ */
+template <typename T, typename EC>
+class EventContextAllocator {
+ public:
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = EventContextAllocator<U, EC>;
+  };
+
+  EventContextAllocator() = default;
+
+  template <typename U>
+  EventContextAllocator(const EventContextAllocator<U, EC>&) {}
+
+  T* allocate(size_t n) {
+    if (n != 1) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(EventContextPool<EC>::get().take(sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (n != 1) {
+      ::operator delete(p);
+      return;
+    }
+    EventContextPool<EC>::get().give(p, sizeof(T));
+  }
+};
+
+template <typename T, typename U, typename EC>
+bool operator==(const EventContextAllocator<T, EC>&,
+                const EventContextAllocator<U, EC>&) {
+  return true;
+}
+
+template <typename T, typename U, typename EC>
+bool operator!=(const EventContextAllocator<T, EC>&,
+                const EventContextAllocator<U, EC>&) {
+  return false;
+}
+} // namespace osquery
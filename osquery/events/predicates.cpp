@@ -0,0 +1,373 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <cctype>
+#include <cstdlib>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/predicates.h"
+
+namespace osquery {
+
+namespace {
+
+/// A SQL token, keywords and identifiers are both words.
+struct Token {
+  enum class Kind { Word, Identifier, String, Number, Symbol };
+
+  Kind kind;
+
+  /// The token content, unquoted for strings and quoted identifiers.
+  std::string value;
+
+  /// The parenthesis depth of the token.
+  size_t depth{0};
+
+  /// Check if the token is an unquoted word, such as a keyword.
+  bool is(const char* word) const {
+    return kind == Kind::Word && boost::iequals(value, word);
+  }
+
+  /// Check if the token is a symbol.
+  bool isSymbol(const char* symbol) const {
+    return kind == Kind::Symbol && value == symbol;
+  }
+
+  /// Check if the token names a table or column.
+  bool isName() const {
+    return kind == Kind::Word || kind == Kind::Identifier;
+  }
+};
+
+/// Read a quoted token ending with close, a doubled close is an escape.
+bool readQuoted(const std::string& query, size_t& i, char close, Token& t) {
+  for (i++; i < query.size(); i++) {
+    if (query[i] == close) {
+      if (close != ']' && i + 1 < query.size() && query[i + 1] == close) {
+        t.value += close;
+        i++;
+        continue;
+      }
+      i++;
+      return true;
+    }
+    t.value += query[i];
+  }
+  return false;
+}
+
+/// Split a query into tokens, false if the query is not terminated.
+bool tokenize(const std::string& query, std::vector<Token>& tokens) {
+  size_t depth = 0;
+  size_t i = 0;
+  while (i < query.size()) {
+    auto c = query[i];
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      i++;
+    } else if (c == '-' && i + 1 < query.size() && query[i + 1] == '-') {
+      // Line comment.
+      while (i < query.size() && query[i] != '\n') {
+        i++;
+      }
+    } else if (c == '/' && i + 1 < query.size() && query[i + 1] == '*') {
+      // Block comment.
+      auto end = query.find("*/", i + 2);
+      if (end == std::string::npos) {
+        return false;
+      }
+      i = end + 2;
+    } else if (c == '\'' || c == '"' || c == '`' || c == '[') {
+      Token t{(c == '\'') ? Token::Kind::String : Token::Kind::Identifier,
+              "",
+              depth};
+      if (!readQuoted(query, i, (c == '[') ? ']' : c, t)) {
+        return false;
+      }
+      tokens.push_back(std::move(t));
+    } else if (std::isdigit(static_cast<unsigned char>(c)) ||
+               (c == '.' && i + 1 < query.size() &&
+                std::isdigit(static_cast<unsigned char>(query[i + 1])))) {
+      auto start = i;
+      while (i < query.size() &&
+             (std::isalnum(static_cast<unsigned char>(query[i])) ||
+              query[i] == '.')) {
+        i++;
+      }
+      tokens.push_back(
+          {Token::Kind::Number, query.substr(start, i - start), depth});
+    } else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+      auto start = i;
+      while (i < query.size() &&
+             (std::isalnum(static_cast<unsigned char>(query[i])) ||
+              query[i] == '_' || query[i] == '$')) {
+        i++;
+      }
+      tokens.push_back(
+          {Token::Kind::Word, query.substr(start, i - start), depth});
+    } else {
+      std::string symbol(1, c);
+      if (i + 1 < query.size()) {
+        auto pair = query.substr(i, 2);
+        if (pair == "==" || pair == "!=" || pair == "<>" || pair == "<=" ||
+            pair == ">=" || pair == "||" || pair == "<<" || pair == ">>") {
+          symbol = pair;
+        }
+      }
+
+      if (symbol == ")") {
+        if (depth == 0) {
+          return false;
+        }
+        depth--;
+      }
+      tokens.push_back({Token::Kind::Symbol, symbol, depth});
+      if (symbol == "(") {
+        depth++;
+      }
+      i += symbol.size();
+    }
+  }
+  return depth == 0;
+}
+
+/// Check if a top-level token ends the WHERE clause.
+bool isClauseEnd(const Token& t) {
+  return t.depth == 0 && (t.is("GROUP") || t.is("ORDER") || t.is("LIMIT") ||
+                          t.is("HAVING") || t.is("WINDOW") || t.isSymbol(";"));
+}
+
+/// Parse a number, false if the value is not entirely numeric.
+bool toNumber(const std::string& value, double& number) {
+  if (value.empty()) {
+    return false;
+  }
+  char* end = nullptr;
+  number = std::strtod(value.c_str(), &end);
+  return *end == '\0';
+}
+
+/// Parse a single term, 'column op literal', false if it is not supported.
+bool parseTerm(const std::vector<Token>& term,
+               const std::string& table,
+               const std::string& alias,
+               const TableColumns& columns,
+               EventPredicate& predicate) {
+  size_t i = 0;
+  if (term.size() > 3 && term[1].isSymbol(".")) {
+    // The column may be qualified with the table name or alias.
+    if (!term[0].isName() || (!boost::iequals(term[0].value, table) &&
+                              !boost::iequals(term[0].value, alias))) {
+      return false;
+    }
+    i = 2;
+  }
+
+  if (term.size() < i + 3 || !term[i].isName()) {
+    return false;
+  }
+
+  const ColumnType* type = nullptr;
+  for (const auto& column : columns) {
+    if (boost::iequals(std::get<0>(column), term[i].value)) {
+      predicate.column = std::get<0>(column);
+      type = &std::get<1>(column);
+      break;
+    }
+  }
+  if (type == nullptr) {
+    return false;
+  }
+
+  const auto& op = term[i + 1];
+  if (op.isSymbol("=") || op.isSymbol("==")) {
+    predicate.op = EQUALS;
+  } else if (op.isSymbol("<")) {
+    predicate.op = LESS_THAN;
+  } else if (op.isSymbol("<=")) {
+    predicate.op = LESS_THAN_OR_EQUALS;
+  } else if (op.isSymbol(">")) {
+    predicate.op = GREATER_THAN;
+  } else if (op.isSymbol(">=")) {
+    predicate.op = GREATER_THAN_OR_EQUALS;
+  } else if (op.is("LIKE")) {
+    predicate.op = LIKE;
+  } else {
+    return false;
+  }
+
+  // The literal may be a string, or a signed number.
+  size_t literal = i + 2;
+  bool has_sign = term[literal].isSymbol("-") || term[literal].isSymbol("+");
+  if (has_sign) {
+    literal++;
+  }
+
+  if (literal + 1 != term.size()) {
+    return false;
+  } else if (term[literal].kind == Token::Kind::String && !has_sign) {
+    predicate.expr = term[literal].value;
+  } else if (term[literal].kind == Token::Kind::Number) {
+    predicate.expr = (term[i + 2].isSymbol("-") ? "-" : "") +
+                     term[literal].value;
+  } else {
+    return false;
+  }
+
+  predicate.numeric = predicate.op != LIKE &&
+                      (*type == INTEGER_TYPE || *type == BIGINT_TYPE ||
+                       *type == UNSIGNED_BIGINT_TYPE || *type == DOUBLE_TYPE);
+  // Only compare numbers with numeric literals.
+  double number = 0;
+  return !predicate.numeric || toNumber(predicate.expr, number);
+}
+
+template <typename T>
+bool compare(ConstraintOperator op, const T& left, const T& right) {
+  switch (op) {
+  case EQUALS:
+    return left == right;
+  case LESS_THAN:
+    return left < right;
+  case LESS_THAN_OR_EQUALS:
+    return left <= right;
+  case GREATER_THAN:
+    return left > right;
+  case GREATER_THAN_OR_EQUALS:
+    return left >= right;
+  default:
+    return true;
+  }
+}
+} // namespace
+
+bool EventPredicate::matches(const Row& r) const {
+  auto it = r.find(column);
+  if (it == r.end()) {
+    return true;
+  }
+
+  if (op == LIKE) {
+    return likeMatches(expr, it->second);
+  }
+
+  if (numeric) {
+    double left = 0, right = 0;
+    if (!toNumber(it->second, left) || !toNumber(expr, right)) {
+      return true;
+    }
+    return compare(op, left, right);
+  }
+  return compare(op, it->second, expr);
+}
+
+bool EventQueryPredicates::matches(const Row& r) const {
+  for (const auto& predicates : queries_) {
+    bool matched = true;
+    for (const auto& predicate : predicates) {
+      if (!predicate.matches(r)) {
+        matched = false;
+        break;
+      }
+    }
+    if (matched) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool getQueryPredicates(const std::string& query,
+                        const std::string& table,
+                        const TableColumns& columns,
+                        std::vector<EventPredicate>& predicates) {
+  std::vector<Token> tokens;
+  if (!tokenize(query, tokens) || tokens.empty() || !tokens[0].is("SELECT")) {
+    return false;
+  }
+
+  // Only a single top-level select from the single table is analyzed.
+  size_t from = 0;
+  for (size_t i = 0; i < tokens.size(); i++) {
+    const auto& t = tokens[i];
+    if (t.depth > 0) {
+      continue;
+    }
+
+    if (t.is("UNION") || t.is("INTERSECT") || t.is("EXCEPT") ||
+        t.is("JOIN")) {
+      return false;
+    } else if (t.is("FROM")) {
+      if (from > 0) {
+        return false;
+      }
+      from = i;
+    }
+  }
+
+  size_t i = from + 1;
+  if (from == 0 || i >= tokens.size() || !tokens[i].isName() ||
+      !boost::iequals(tokens[i].value, table)) {
+    return false;
+  }
+
+  // The table may have an alias.
+  std::string alias;
+  i++;
+  if (i < tokens.size() && tokens[i].is("AS")) {
+    i++;
+  }
+  if (i < tokens.size() && tokens[i].isName() && !tokens[i].is("WHERE") &&
+      !isClauseEnd(tokens[i])) {
+    alias = tokens[i++].value;
+  }
+
+  if (i == tokens.size() || isClauseEnd(tokens[i])) {
+    // There is no WHERE clause.
+    return true;
+  } else if (!tokens[i].is("WHERE")) {
+    return false;
+  }
+
+  // Split the WHERE clause into top-level AND-connected terms.
+  std::vector<std::vector<Token>> terms(1);
+  for (i++; i < tokens.size() && !isClauseEnd(tokens[i]); i++) {
+    const auto& t = tokens[i];
+    if (t.depth == 0) {
+      if (t.is("OR") || t.is("BETWEEN") || t.is("CASE")) {
+        return false;
+      } else if (t.is("AND")) {
+        terms.emplace_back();
+        continue;
+      }
+    }
+    terms.back().push_back(t);
+  }
+
+  for (const auto& term : terms) {
+    // Terms that are not simple comparisons are not required of the rows.
+    bool simple = true;
+    for (const auto& t : term) {
+      if (t.depth > 0 || t.isSymbol("(")) {
+        simple = false;
+        break;
+      }
+    }
+
+    EventPredicate predicate;
+    if (simple && parseTerm(term, table, alias, columns, predicate)) {
+      predicates.push_back(std::move(predicate));
+    }
+  }
+  return true;
+}
+} // namespace osquery
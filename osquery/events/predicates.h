@@ -0,0 +1,94 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <osquery/query.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+
+/**
+ * @brief A comparison of a row's column against a literal.
+ *
+ * The supported operators are EQUALS, LESS_THAN, LESS_THAN_OR_EQUALS,
+ * GREATER_THAN, GREATER_THAN_OR_EQUALS, and LIKE.
+ */
+struct EventPredicate {
+  /// The column name, as declared by the table.
+  std::string column;
+
+  /// The comparison operator.
+  ConstraintOperator op{EQUALS};
+
+  /// The unquoted literal.
+  std::string expr;
+
+  /// Compare as numbers, the column has a numeric type.
+  bool numeric{false};
+
+  /**
+   * @brief Check if a row may satisfy the predicate.
+   *
+   * A row without the column, or with a value that cannot be compared, is
+   * matched such that it is never incorrectly discarded.
+   */
+  bool matches(const Row& r) const;
+};
+
+/**
+ * @brief The predicates of every scheduled query selecting from a table.
+ *
+ * Each query contributes a conjunction of predicates. A row is matched if any
+ * query's conjunction is matched.
+ */
+class EventQueryPredicates {
+ public:
+  /// Add the conjunction of predicates for a query.
+  void add(std::vector<EventPredicate> predicates) {
+    queries_.push_back(std::move(predicates));
+  }
+
+  /// Check if any query may select the row.
+  bool matches(const Row& r) const;
+
+  /// The number of queries.
+  size_t size() const {
+    return queries_.size();
+  }
+
+ private:
+  std::vector<std::vector<EventPredicate>> queries_;
+};
+
+/**
+ * @brief Extract the simple column predicates a query applies to a table.
+ *
+ * Only a query selecting from the single table is analyzed. The predicates
+ * are the top-level AND-connected terms of the WHERE clause that compare a
+ * table column to a literal; other terms are ignored. This is conservative,
+ * every row the query may select matches the resulting predicates.
+ *
+ * A query without a WHERE clause succeeds with no predicates.
+ *
+ * @param query The SQL query.
+ * @param table The event subscriber table name.
+ * @param columns The table's columns.
+ * @param predicates Output, the conjunction of predicates.
+ * @return false if the query cannot be analyzed, every row must be kept.
+ */
+bool getQueryPredicates(const std::string& query,
+                        const std::string& table,
+                        const TableColumns& columns,
+                        std::vector<EventPredicate>& predicates);
+} // namespace osquery
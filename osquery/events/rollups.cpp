@@ -0,0 +1,407 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <algorithm>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/database.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/rollups.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+DECLARE_uint64(events_expiry);
+
+/// The groups of a bucket, new groups of a full bucket share an empty group.
+const size_t kRollupMaxGroups = 10000;
+
+/// The key prefix of a rollup's persisted buckets.
+static inline std::string getRollupPrefix(const std::string& name) {
+  return "rollup." + name + ".";
+}
+
+static inline std::string toIndex(EventTime time) {
+  auto index = std::to_string(time);
+  return (index.size() < 10) ? std::string(10 - index.size(), '0') + index
+                             : index;
+}
+
+static inline void putVarint(size_t value, std::string& data) {
+  while (value >= 0x80) {
+    data.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  data.push_back(static_cast<char>(value));
+}
+
+static inline bool getVarint(const std::string& data,
+                             size_t& pos,
+                             size_t& value) {
+  value = 0;
+  for (size_t shift = 0; pos < data.size() && shift < 64; shift += 7) {
+    auto byte = static_cast<unsigned char>(data[pos++]);
+    value |= static_cast<size_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline void putString(const std::string& value, std::string& data) {
+  putVarint(value.size(), data);
+  data.append(value);
+}
+
+static inline bool getString(const std::string& data,
+                             size_t& pos,
+                             std::string& value) {
+  size_t size = 0;
+  if (!getVarint(data, pos, size) || size > data.size() - pos) {
+    return false;
+  }
+  value.assign(data, pos, size);
+  pos += size;
+  return true;
+}
+
+static Status parseAggregate(const std::string& name,
+                             std::string expr,
+                             RollupAggregate& aggregate) {
+  aggregate.name = name;
+  boost::algorithm::trim(expr);
+  if (expr == "count" || expr == "count(*)") {
+    aggregate.function = RollupAggregate::Function::COUNT;
+    return Status(0, "OK");
+  }
+
+  auto open = expr.find('(');
+  if (open == std::string::npos || expr.back() != ')') {
+    return Status(1, "Unknown rollup aggregate: " + expr);
+  }
+
+  auto function = expr.substr(0, open);
+  if (function == "sum") {
+    aggregate.function = RollupAggregate::Function::SUM;
+  } else if (function == "min") {
+    aggregate.function = RollupAggregate::Function::MIN;
+  } else if (function == "max") {
+    aggregate.function = RollupAggregate::Function::MAX;
+  } else {
+    return Status(1, "Unknown rollup aggregate: " + expr);
+  }
+
+  aggregate.column = expr.substr(open + 1, expr.size() - open - 2);
+  boost::algorithm::trim(aggregate.column);
+  if (aggregate.column.empty()) {
+    return Status(1, "Rollup aggregate has no column: " + expr);
+  }
+  return Status(0, "OK");
+}
+
+Status parseRollup(const std::string& name,
+                   const pt::ptree& tree,
+                   RollupSpec& spec) {
+  spec = RollupSpec();
+  spec.name = name;
+  spec.table = tree.get<std::string>("table", "");
+  if (spec.name.empty() || spec.table.empty()) {
+    return Status(1, "Rollup has no table: " + name);
+  }
+
+  // Every column name must be unique, the bucket time is the first column.
+  std::vector<std::string> names = {"time"};
+  auto unique = [&names](const std::string& column) {
+    if (std::find(names.begin(), names.end(), column) != names.end()) {
+      return false;
+    }
+    names.push_back(column);
+    return true;
+  };
+
+  if (tree.count("group_by") > 0) {
+    for (const auto& column : tree.get_child("group_by")) {
+      auto value = column.second.data();
+      if (value.empty() || !unique(value)) {
+        return Status(1, "Invalid rollup group_by column: " + name);
+      }
+      spec.group_by.push_back(std::move(value));
+    }
+  }
+
+  if (tree.count("aggregates") > 0) {
+    for (const auto& item : tree.get_child("aggregates")) {
+      RollupAggregate aggregate;
+      auto status = parseAggregate(item.first, item.second.data(), aggregate);
+      if (!status.ok()) {
+        return status;
+      } else if (aggregate.name.empty() || !unique(aggregate.name)) {
+        return Status(1, "Invalid rollup aggregate name: " + name);
+      }
+      spec.aggregates.push_back(std::move(aggregate));
+    }
+  }
+
+  if (spec.aggregates.empty()) {
+    return Status(1, "Rollup has no aggregates: " + name);
+  }
+
+  spec.bucket = tree.get<size_t>("bucket", 60);
+  if (spec.bucket == 0) {
+    return Status(1, "Rollup bucket must be positive: " + name);
+  }
+  return Status(0, "OK");
+}
+
+void EventRollup::add(const Row& r, EventTime time) {
+  std::vector<Value> values(spec_.aggregates.size());
+  for (size_t i = 0; i < spec_.aggregates.size(); i++) {
+    const auto& aggregate = spec_.aggregates[i];
+    if (aggregate.function == RollupAggregate::Function::COUNT) {
+      values[i] = {1, true};
+      continue;
+    }
+
+    // Missing and non-numeric values are not aggregated.
+    auto column = r.find(aggregate.column);
+    long long value = 0;
+    if (column != r.end() && safeStrtoll(column->second, 10, value).ok()) {
+      values[i] = {value, true};
+    }
+  }
+
+  std::vector<std::string> group;
+  group.reserve(spec_.group_by.size());
+  for (const auto& column : spec_.group_by) {
+    auto value = r.find(column);
+    group.push_back((value != r.end()) ? value->second : "");
+  }
+
+  auto bucket = time - (time % spec_.bucket);
+  WriteLock lock(mutex_);
+  if (!buckets_.empty() && bucket > buckets_.rbegin()->first &&
+      bucket >= spec_.bucket) {
+    // A new bucket began, late events may still add to the previous bucket.
+    persist(bucket - spec_.bucket);
+  }
+
+  auto& groups = buckets_[bucket];
+  auto it = groups.find(group);
+  if (it == groups.end()) {
+    if (groups.size() >= kRollupMaxGroups) {
+      std::fill(group.begin(), group.end(), "");
+    }
+    it = groups.emplace(std::move(group), std::vector<Value>(values.size()))
+             .first;
+  }
+  merge(values, it->second);
+}
+
+void EventRollup::flush() {
+  WriteLock lock(mutex_);
+  if (!buckets_.empty()) {
+    persist(buckets_.rbegin()->first + 1);
+  }
+}
+
+void EventRollup::clear() {
+  WriteLock lock(mutex_);
+  buckets_.clear();
+  auto prefix = getRollupPrefix(spec_.name);
+  deleteDatabaseRange(kEvents, prefix, prefix + "~");
+}
+
+void EventRollup::merge(const std::vector<Value>& from,
+                        std::vector<Value>& into) const {
+  for (size_t i = 0; i < from.size() && i < into.size(); i++) {
+    if (!from[i].set) {
+      continue;
+    } else if (!into[i].set) {
+      into[i] = from[i];
+      continue;
+    }
+
+    auto& value = into[i].value;
+    switch (spec_.aggregates[i].function) {
+    case RollupAggregate::Function::COUNT:
+    case RollupAggregate::Function::SUM:
+      value += from[i].value;
+      break;
+    case RollupAggregate::Function::MIN:
+      value = std::min(value, from[i].value);
+      break;
+    case RollupAggregate::Function::MAX:
+      value = std::max(value, from[i].value);
+      break;
+    }
+  }
+}
+
+void EventRollup::persist(EventTime before) {
+  auto end = buckets_.lower_bound(before);
+  for (auto it = buckets_.begin(); it != end; ++it) {
+    // A late event's bucket may have been persisted, the values are merged.
+    auto key = getKey(it->first);
+    std::string data;
+    Groups stored;
+    if (getDatabaseValue(kEvents, key, data).ok() && decode(data, stored)) {
+      for (auto& group : it->second) {
+        auto previous = stored.find(group.first);
+        if (previous != stored.end()) {
+          merge(previous->second, group.second);
+        }
+      }
+      for (auto& group : stored) {
+        it->second.emplace(group.first, std::move(group.second));
+      }
+    }
+
+    data.clear();
+    encode(it->second, data);
+    setDatabaseValue(kEvents, key, data);
+  }
+  buckets_.erase(buckets_.begin(), end);
+
+  // Buckets are expired with the events, as their time ends.
+  auto now = getUnixTime();
+  if (FLAGS_events_expiry > 0 && now > FLAGS_events_expiry + spec_.bucket) {
+    auto prefix = getRollupPrefix(spec_.name);
+    deleteDatabaseRange(
+        kEvents,
+        prefix,
+        getKey(now - FLAGS_events_expiry - spec_.bucket));
+  }
+}
+
+QueryData EventRollup::rows() {
+  QueryData rows;
+  std::vector<std::string> keys;
+  auto prefix = getRollupPrefix(spec_.name);
+
+  ReadLock lock(mutex_);
+  scanDatabaseKeys(kEvents, keys, prefix);
+  std::sort(keys.begin(), keys.end());
+  for (const auto& key : keys) {
+    long long bucket = 0;
+    std::string data;
+    Groups groups;
+    if (!safeStrtoll(key.substr(prefix.size()), 10, bucket).ok() ||
+        !getDatabaseValue(kEvents, key, data).ok() || !decode(data, groups)) {
+      continue;
+    }
+
+    // A bucket with late events is also in memory, until it is persisted.
+    auto current = buckets_.find(static_cast<EventTime>(bucket));
+    if (current != buckets_.end()) {
+      for (auto& group : groups) {
+        auto it = current->second.find(group.first);
+        if (it != current->second.end()) {
+          merge(it->second, group.second);
+        }
+      }
+      for (const auto& group : current->second) {
+        groups.emplace(group.first, group.second);
+      }
+    }
+    appendRows(static_cast<EventTime>(bucket), groups, rows);
+  }
+
+  for (const auto& bucket : buckets_) {
+    if (std::find(keys.begin(), keys.end(), getKey(bucket.first)) ==
+        keys.end()) {
+      appendRows(bucket.first, bucket.second, rows);
+    }
+  }
+  return rows;
+}
+
+TableColumns EventRollup::columns() const {
+  TableColumns columns = {
+      std::make_tuple("time", BIGINT_TYPE, ColumnOptions::DEFAULT)};
+  for (const auto& column : spec_.group_by) {
+    columns.push_back(
+        std::make_tuple(column, TEXT_TYPE, ColumnOptions::DEFAULT));
+  }
+  for (const auto& aggregate : spec_.aggregates) {
+    columns.push_back(
+        std::make_tuple(aggregate.name, BIGINT_TYPE, ColumnOptions::DEFAULT));
+  }
+  return columns;
+}
+
+void EventRollup::appendRows(EventTime bucket,
+                             const Groups& groups,
+                             QueryData& rows) const {
+  for (const auto& group : groups) {
+    Row r;
+    r["time"] = std::to_string(bucket);
+    for (size_t i = 0; i < spec_.group_by.size(); i++) {
+      r[spec_.group_by[i]] = (i < group.first.size()) ? group.first[i] : "";
+    }
+    for (size_t i = 0; i < spec_.aggregates.size(); i++) {
+      const auto& value = group.second[i];
+      r[spec_.aggregates[i].name] =
+          (value.set) ? std::to_string(value.value) : "";
+    }
+    rows.push_back(std::move(r));
+  }
+}
+
+void EventRollup::encode(const Groups& groups, std::string& data) const {
+  putVarint(groups.size(), data);
+  for (const auto& group : groups) {
+    for (const auto& value : group.first) {
+      putString(value, data);
+    }
+    for (const auto& value : group.second) {
+      putString((value.set) ? std::to_string(value.value) : "", data);
+    }
+  }
+}
+
+bool EventRollup::decode(const std::string& data, Groups& groups) const {
+  size_t pos = 0;
+  size_t count = 0;
+  if (!getVarint(data, pos, count)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    std::vector<std::string> group(spec_.group_by.size());
+    for (auto& value : group) {
+      if (!getString(data, pos, value)) {
+        return false;
+      }
+    }
+
+    std::vector<Value> values(spec_.aggregates.size());
+    for (auto& value : values) {
+      std::string number;
+      if (!getString(data, pos, number)) {
+        return false;
+      }
+      value.set = !number.empty() &&
+                  safeStrtoll(number, 10, value.value).ok();
+    }
+    groups[std::move(group)] = std::move(values);
+  }
+  return pos == data.size();
+}
+
+std::string EventRollup::getKey(EventTime bucket) const {
+  return getRollupPrefix(spec_.name) + toIndex(bucket);
+}
+} // namespace osquery
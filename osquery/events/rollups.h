@@ -0,0 +1,178 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <osquery/events.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+
+/// An aggregate a rollup maintains for each group.
+struct RollupAggregate {
+  enum class Function { COUNT, SUM, MIN, MAX };
+
+  /// The rollup table column.
+  std::string name;
+
+  Function function{Function::COUNT};
+
+  /// The aggregated event column, empty for COUNT.
+  std::string column;
+
+  bool operator==(const RollupAggregate& other) const {
+    return name == other.name && function == other.function &&
+           column == other.column;
+  }
+};
+
+/**
+ * @brief A config-defined rollup of a subscriber's events.
+ *
+ * Example of an "events" config key defining a rollup table:
+ *
+ * @code{.json}
+ *   "rollups": {
+ *     "socket_events_minutes": {
+ *       "table": "socket_events",
+ *       "group_by": ["remote_address", "remote_port"],
+ *       "aggregates": {"connections": "count", "last": "max(time)"},
+ *       "bucket": 60
+ *     }
+ *   }
+ * @endcode
+ */
+struct RollupSpec {
+  /// The rollup table name.
+  std::string name;
+
+  /// The event subscriber table.
+  std::string table;
+
+  std::vector<std::string> group_by;
+  std::vector<RollupAggregate> aggregates;
+
+  /// The seconds of event time aggregated into a row.
+  size_t bucket{60};
+
+  bool operator==(const RollupSpec& other) const {
+    return name == other.name && table == other.table &&
+           group_by == other.group_by && aggregates == other.aggregates &&
+           bucket == other.bucket;
+  }
+};
+
+/**
+ * @brief Parse a rollup from its config.
+ *
+ * @param name The rollup table name, the config key.
+ * @param tree The rollup config.
+ * @param spec Output, the parsed rollup.
+ */
+Status parseRollup(const std::string& name,
+                   const boost::property_tree::ptree& tree,
+                   RollupSpec& spec);
+
+/**
+ * @brief The aggregates of a subscriber's events, grouped per time bucket.
+ *
+ * Events are aggregated as the subscriber adds them, before they are stored
+ * or discarded. The two most recent buckets are kept in memory, older buckets
+ * are persisted in the backing store as one compact value per bucket, and are
+ * expired with the events_expiry.
+ */
+class EventRollup : private boost::noncopyable {
+ public:
+  explicit EventRollup(RollupSpec spec) : spec_(std::move(spec)) {}
+
+  const RollupSpec& spec() const {
+    return spec_;
+  }
+
+  /// Aggregate an event, persisting buckets older than the previous bucket.
+  void add(const Row& r, EventTime time);
+
+  /// Persist every bucket kept in memory.
+  void flush();
+
+  /// Remove every bucket, the rollup was removed or changed.
+  void clear();
+
+  /// The rows of the persisted and in-memory buckets.
+  QueryData rows();
+
+  /// The rollup table columns, the bucket time, group, and aggregates.
+  TableColumns columns() const;
+
+ private:
+  /// An aggregate's value, MIN and MAX are unset until a numeric value.
+  struct Value {
+    long long value{0};
+    bool set{false};
+  };
+
+  /// The group-by values of a bucket's groups and their aggregates.
+  using Groups = std::map<std::vector<std::string>, std::vector<Value>>;
+
+  /// Aggregate a group's values into the group of another bucket.
+  void merge(const std::vector<Value>& from, std::vector<Value>& into) const;
+
+  /// Persist the buckets starting before a time, merged with stored values.
+  void persist(EventTime before);
+
+  /// Append the rows of a bucket.
+  void appendRows(EventTime bucket,
+                  const Groups& groups,
+                  QueryData& rows) const;
+
+  /// Encode and decode a bucket's groups.
+  void encode(const Groups& groups, std::string& data) const;
+  bool decode(const std::string& data, Groups& groups) const;
+
+  /// The backing store key of a bucket.
+  std::string getKey(EventTime bucket) const;
+
+ private:
+  RollupSpec spec_;
+
+  /// The in-memory buckets, keyed by their start time.
+  std::map<EventTime, Groups> buckets_;
+
+  /// Protection around the in-memory buckets.
+  Mutex mutex_;
+};
+
+/// A rollup exposed as a virtual table.
+class RollupTablePlugin : public TablePlugin {
+ public:
+  explicit RollupTablePlugin(std::shared_ptr<EventRollup> rollup)
+      : rollup_(std::move(rollup)) {}
+
+ protected:
+  TableColumns columns() const override {
+    return rollup_->columns();
+  }
+
+  QueryData generate(QueryContext& context) override {
+    return rollup_->rows();
+  }
+
+ private:
+  std::shared_ptr<EventRollup> rollup_;
+};
+} // namespace osquery
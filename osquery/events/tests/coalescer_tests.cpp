@@ -0,0 +1,99 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/events/coalescer.h"
+
+namespace osquery {
+
+struct FakeFileEventContext {
+  std::string path;
+  std::string action;
+};
+
+using FakeCoalescer = EventCoalescer<FakeFileEventContext>;
+using FakeRef = std::shared_ptr<FakeFileEventContext>;
+
+class EventCoalescerTests : public testing::Test {
+ protected:
+  bool add(const std::string& path,
+           const std::string& action,
+           std::chrono::milliseconds offset) {
+    auto ec = std::make_shared<FakeFileEventContext>();
+    ec->path = path;
+    ec->action = action;
+    return coalescer_.add(path, action, nullptr, ec, start_ + offset);
+  }
+
+  void flush(std::chrono::milliseconds offset) {
+    coalescer_.flush(std::chrono::milliseconds(100),
+                     ([this](const FakeRef& ec, size_t count) {
+                       released_.push_back(ec->path + " " + ec->action + " " +
+                                           std::to_string(count));
+                     }),
+                     start_ + offset);
+  }
+
+ protected:
+  FakeCoalescer coalescer_;
+  FakeCoalescer::Clock::time_point start_{FakeCoalescer::Clock::now()};
+  std::vector<std::string> released_;
+};
+
+TEST_F(EventCoalescerTests, test_merge_until_quiet) {
+  using ms = std::chrono::milliseconds;
+  EXPECT_TRUE(add("/tmp/a", "UPDATED", ms(0)));
+  EXPECT_TRUE(add("/tmp/a", "UPDATED", ms(50)));
+  EXPECT_TRUE(add("/tmp/b", "UPDATED", ms(60)));
+  EXPECT_TRUE(add("/tmp/a", "UPDATED", ms(100)));
+  EXPECT_TRUE(add("/tmp/a", "ATTRIBUTES_MODIFIED", ms(120)));
+  EXPECT_EQ(3U, coalescer_.size());
+
+  // Each event was added within the window.
+  flush(ms(150));
+  EXPECT_TRUE(released_.empty());
+
+  flush(ms(210));
+  std::vector<std::string> expected = {"/tmp/a UPDATED 3", "/tmp/b UPDATED 1"};
+  EXPECT_EQ(expected, released_);
+
+  flush(ms(220));
+  expected.push_back("/tmp/a ATTRIBUTES_MODIFIED 1");
+  EXPECT_EQ(expected, released_);
+  EXPECT_TRUE(coalescer_.empty());
+}
+
+TEST_F(EventCoalescerTests, test_release_continuous) {
+  using ms = std::chrono::milliseconds;
+  for (size_t i = 0; i <= 12; i++) {
+    add("/tmp/a", "UPDATED", ms(i * 90));
+    flush(ms(i * 90));
+  }
+
+  // A path that is never quiet is released after 10 windows.
+  ASSERT_EQ(1U, released_.size());
+  EXPECT_EQ("/tmp/a UPDATED 13", released_[0]);
+}
+
+TEST_F(EventCoalescerTests, test_release_path) {
+  using ms = std::chrono::milliseconds;
+  add("/tmp/a", "UPDATED", ms(0));
+  add("/tmp/ab", "UPDATED", ms(0));
+  add("/tmp/a", "OPENED", ms(10));
+
+  coalescer_.release("/tmp/a", ([this](const FakeRef& ec, size_t count) {
+                       released_.push_back(ec->path + " " + ec->action);
+                     }));
+  std::vector<std::string> expected = {"/tmp/a UPDATED", "/tmp/a OPENED"};
+  EXPECT_EQ(expected, released_);
+  EXPECT_EQ(1U, coalescer_.size());
+}
+}
@@ -23,6 +23,7 @@
 
 #include <osquery/logger.h>
 
+#include "osquery/events/predicates.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
@@ -30,6 +31,8 @@ namespace osquery {
 DECLARE_uint64(events_expiry);
 DECLARE_uint64(events_max);
 DECLARE_bool(events_optimize);
+DECLARE_uint64(events_batch_size);
+DECLARE_uint64(events_batch_interval);
 
 class EventsDatabaseTests : public ::testing::Test {
   void SetUp() override {
@@ -74,6 +77,55 @@ class DBFakeEventSubscriber : public EventSubscriber<DBFakeEventPublisher> {
     return add(r, t);
   }
 
+  /// Select the events within an inclusive time range.
+  QueryData testGet(EventTime start, EventTime stop) {
+    QueryData results;
+    RowGenerator::pull_type generator(std::bind(
+        &EventSubscriberPlugin::get, this, std::placeholders::_1, start, stop));
+    while (generator) {
+      results.push_back(generator.get());
+      generator();
+    }
+    return results;
+  }
+
+  /// Select the events within a range, in order, up to a limit.
+  QueryData testGetRange(EventTime start,
+                         EventTime stop,
+                         bool descending,
+                         size_t limit) {
+    QueryData results;
+    RowGenerator::pull_type generator(
+        [this, start, stop, descending, limit](RowYield& yield) {
+          getRange(yield, start, stop, descending, limit);
+        });
+    while (generator) {
+      results.push_back(generator.get());
+      generator();
+    }
+    return results;
+  }
+
+  /// Select the events a scheduled query has not consumed.
+  QueryData testGetShared(const std::string& query,
+                          EventTime start,
+                          size_t eid,
+                          bool& shared) {
+    optimize_time_ = getUnixTime() - 1;
+    optimize_eid_ = eid;
+
+    QueryData results;
+    RowGenerator::pull_type generator(
+        [this, &query, start, &shared](RowYield& yield) {
+          shared = getShared(yield, query, start);
+        });
+    while (generator) {
+      results.push_back(generator.get());
+      generator();
+    }
+    return results;
+  }
+
   size_t getEventsMax() override {
     return max_;
   }
@@ -113,80 +165,180 @@ TEST_F(EventsDatabaseTests, test_event_add) {
   EXPECT_TRUE(status.ok());
 }
 
-TEST_F(EventsDatabaseTests, test_record_indexing) {
+TEST_F(EventsDatabaseTests, test_event_row_codec) {
+  EventRowCodec codec({"testing", "time"});
+  Row r = {{"testing", "hello"}, {"time", "1"}, {"other", ""}};
+
+  std::string data;
+  codec.encode(r, data);
+  EXPECT_TRUE(EventRowCodec::isEncoded(data));
+  EXPECT_EQ(EventRowCodec::getSchema(data), codec.schema());
+
+  // Declared columns are stored as a 1-byte key.
+  EXPECT_LT(data.size(), 32U);
+
+  Row decoded;
+  ASSERT_TRUE(codec.decode(data, decoded).ok());
+  EXPECT_EQ(decoded, r);
+
+  // Rows are only decoded using the columns they were encoded with.
+  EventRowCodec other({"time", "testing"});
+  EXPECT_NE(other.schema(), codec.schema());
+  decoded.clear();
+  EXPECT_FALSE(other.decode(data, decoded).ok());
+
+  // Truncated rows are invalid.
+  decoded.clear();
+  EXPECT_FALSE(codec.decode(data.substr(0, data.size() - 1), decoded).ok());
+}
+
+TEST_F(EventsDatabaseTests, test_event_serialize) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
-  auto status = sub->testAdd(2);
-  status = sub->testAdd(11);
-  status = sub->testAdd(61);
-  status = sub->testAdd((1 * 3600) + 1);
-  status = sub->testAdd((2 * 3600) + 1);
+  Row r = {{"testing", "hello"}, {"time", "1"}, {"eid", "0000000001"}};
+
+  std::string data;
+  sub->serializeEvent(r, data);
+  EXPECT_TRUE(EventRowCodec::isEncoded(data));
+
+  Row decoded;
+  ASSERT_TRUE(sub->deserializeEvent(data, decoded).ok());
+  EXPECT_EQ(decoded, r);
+
+  // Events stored as JSON are still decoded.
+  std::string json;
+  ASSERT_TRUE(serializeRowJSON(r, json).ok());
+  decoded.clear();
+  ASSERT_TRUE(sub->deserializeEvent(json, decoded).ok());
+  EXPECT_EQ(decoded, r);
+
+  // Events encoded against stored columns are decoded.
+  EventRowCodec previous({"eid", "testing"});
+  setDatabaseValue(kEvents,
+                   "schema." + sub->dbNamespace() + "." +
+                       std::to_string(previous.schema()),
+                   "eid\ntesting");
+  data.clear();
+  previous.encode(r, data);
+  decoded.clear();
+  ASSERT_TRUE(sub->deserializeEvent(data, decoded).ok());
+  EXPECT_EQ(decoded, r);
+}
+
+TEST_F(EventsDatabaseTests, test_event_batch) {
+  auto batch_size = FLAGS_events_batch_size;
+  auto batch_interval = FLAGS_events_batch_interval;
+  FLAGS_events_batch_size = 3;
+  FLAGS_events_batch_interval = 60 * 1000;
+
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->testAdd(1);
+  sub->testAdd(2);
+
+  // Events are buffered until the batch is full.
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, "data." + sub->dbNamespace());
+  EXPECT_TRUE(keys.empty());
+
+  sub->testAdd(61);
+  scanDatabaseKeys(kEvents, keys, "data." + sub->dbNamespace());
+  EXPECT_EQ(keys.size(), 3U);
+
+  // Buffered events are written before events are selected.
+  sub->testAdd(62);
+  EXPECT_EQ(sub->testGet(0, 0).size(), 4U);
 
-  // An "all" range, will pick up everything in the largest index.
-  auto indexes = sub->getIndexes(0, 3 * 3600);
-  auto output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ("60.0, 60.1, 60.60, 60.120", output);
-
-  // Restrict range to "most specific", which is an index by 10.
-  indexes = sub->getIndexes(0, 5);
-  output = boost::algorithm::join(indexes, ", ");
-  // The order 10, 0th index include results with t = [0, 10).
-  EXPECT_EQ("60.0", output);
-
-  // Add specific indexes to the upper bound.
-  status = sub->testAdd((2 * 3600) + 11);
-  status = sub->testAdd((2 * 3600) + 61);
-  indexes = sub->getIndexes(2 * 3600, (2 * 3600) + 62);
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ("60.120, 60.121", output);
-
-  // Request specific lower and upper bounding.
-  indexes = sub->getIndexes(2, (2 * 3600) + 62);
-  output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ("60.0, 60.1, 60.60, 60.120, 60.121", output);
+  FLAGS_events_batch_size = batch_size;
+  FLAGS_events_batch_interval = batch_interval;
+}
+
+TEST_F(EventsDatabaseTests, test_event_pushdown) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  auto predicates = std::make_shared<EventQueryPredicates>();
+  predicates->add({{"testing", EQUALS, "hello from earth", false}});
+  std::atomic_store(&sub->predicates_,
+                    std::shared_ptr<const EventQueryPredicates>(predicates));
+
+  // Events that no query selects are counted but not stored.
+  sub->testAdd(1);
+  EXPECT_EQ(sub->numEvents(), 1U);
+  EXPECT_TRUE(sub->testGet(0, 0).empty());
+
+  predicates->add({{"uptime", GREATER_THAN_OR_EQUALS, "10", true}});
+  sub->testAdd(2);
+  EXPECT_EQ(sub->testGet(0, 0).size(), 1U);
+}
+
+TEST_F(EventsDatabaseTests, test_record_keys) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->testAdd(61);
+  sub->testAdd(2);
+  sub->testAdd((1 * 3600) + 1);
+
+  // Event data is keyed by time then EventID.
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, sub->getDataKey());
+  std::sort(keys.begin(), keys.end());
+  ASSERT_EQ(keys.size(), 3U);
+  EXPECT_EQ(keys[0], sub->getDataKey() + "0000000002.0000000002");
+  EXPECT_EQ(keys[1], sub->getDataKey() + "0000000061.0000000001");
+  EXPECT_EQ(keys[2], sub->getDataKey() + "0000003601.0000000003");
 }
 
 TEST_F(EventsDatabaseTests, test_record_range) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   auto status = sub->testAdd(1);
   status = sub->testAdd(2);
+  status = sub->testAdd(10);
   status = sub->testAdd(11);
   status = sub->testAdd(61);
   status = sub->testAdd((1 * 3600) + 1);
   status = sub->testAdd((2 * 3600) + 1);
 
-  // Search within a specific record range.
-  auto indexes = sub->getIndexes(0, 10);
-  EXPECT_EQ(1U, indexes.size());
-  auto records = sub->getRecords(indexes);
-  // This will return 3 results, ::get filters records by an absolute range.
-  EXPECT_EQ(3U, records.size()); // 1, 2, 11
+  // Search within a specific, inclusive, range.
+  auto results = sub->testGet(0, 10);
+  EXPECT_EQ(3U, results.size()); // 1, 2, 10
+
+  results = sub->testGet(2, 11);
+  EXPECT_EQ(3U, results.size()); // 2, 10, 11
 
   // Search within a large bound.
-  indexes = sub->getIndexes(3, 3601);
-  // This will include the 0-10 bucket meaning 1, 2 will show up.
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(5U, records.size()); // 1, 2, 11, 61, 3601
+  results = sub->testGet(3, 3601);
+  EXPECT_EQ(4U, results.size()); // 10, 11, 61, 3601
 
   // Get all of the records.
-  indexes = sub->getIndexes(0, 3 * 3600);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(6U, records.size()); // 1, 2, 11, 61, 3601, 7201
+  results = sub->testGet(0, 3 * 3600);
+  EXPECT_EQ(7U, results.size());
 
   // stop = 0 is an alias for everything.
-  indexes = sub->getIndexes(0, 0);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(6U, records.size());
+  results = sub->testGet(0, 0);
+  EXPECT_EQ(7U, results.size());
 
   for (size_t j = 0; j < 30; j++) {
-    // 110 is 10 below an index (60.2).
     sub->testAdd(110 + static_cast<int>(j));
   }
 
-  indexes = sub->getIndexes(110, 0);
-  auto output = boost::algorithm::join(indexes, ", ");
-  EXPECT_EQ("60.1, 60.2, 60.60, 60.120", output);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(33U, records.size()); // (61) 110 - 139 + 3601, 7201
+  results = sub->testGet(110, 0);
+  EXPECT_EQ(32U, results.size()); // 110 - 139, 3601, 7201
+
+  // Events are returned in time order.
+  EXPECT_EQ(results.front()["time"], "110");
+  EXPECT_EQ(results.back()["time"], "7201");
+
+  // A limited selection uses the oldest, or latest, events.
+  results = sub->testGetRange(110, 0, false, 3);
+  ASSERT_EQ(3U, results.size());
+  EXPECT_EQ(results[0]["time"], "110");
+  EXPECT_EQ(results[2]["time"], "112");
+
+  results = sub->testGetRange(110, 0, true, 3);
+  ASSERT_EQ(3U, results.size());
+  EXPECT_EQ(results[0]["time"], "7201");
+  EXPECT_EQ(results[1]["time"], "3601");
+  EXPECT_EQ(results[2]["time"], "139");
+
+  results = sub->testGetRange(0, 0, true, 0);
+  EXPECT_EQ(37U, results.size());
+  EXPECT_EQ(results.back()["time"], "1");
 }
 
 TEST_F(EventsDatabaseTests, test_record_expiration) {
@@ -199,34 +351,90 @@ TEST_F(EventsDatabaseTests, test_record_expiration) {
   status = sub->testAdd((2 * 3600) + 1);
 
   // No expiration
-  auto indexes = sub->getIndexes(0, 5000);
-  auto records = sub->getRecords(indexes);
-  EXPECT_EQ(5U, records.size()); // 1, 2, 11, 61, 3601
+  auto results = sub->testGet(0, 5000);
+  EXPECT_EQ(5U, results.size()); // 1, 2, 11, 61, 3601
 
   sub->expire_events_ = true;
   sub->expire_time_ = 10;
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(3U, records.size()); // 11, 61, 3601
-
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(3U, records.size()); // 11, 61, 3601
+  results = sub->testGet(0, 5000);
+  EXPECT_EQ(3U, results.size()); // 11, 61, 3601
 
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(3U, records.size()); // 11, 61, 3601
-
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(3U, records.size()); // 11, 61, 3601
+  results = sub->testGet(0, 5000);
+  EXPECT_EQ(3U, results.size()); // 11, 61, 3601
 
   // Check that get/deletes did not act on cache.
   // This implies that RocksDB is flushing the requested delete records.
   sub->expire_time_ = 0;
-  indexes = sub->getIndexes(0, 5000);
-  records = sub->getRecords(indexes);
-  EXPECT_EQ(3U, records.size()); // 11, 61, 3601
+  results = sub->testGet(0, 5000);
+  EXPECT_EQ(3U, results.size()); // 11, 61, 3601
+
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, sub->getDataKey());
+  EXPECT_EQ(4U, keys.size()); // 11, 61, 3601, 7201
+}
+
+TEST_F(EventsDatabaseTests, test_expire_stored) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->testAdd(1);
+  sub->testAdd(2);
+  sub->testAdd(11);
+  sub->testAdd(61);
+
+  // Expired events are not selected before the expiration runner removes them.
+  sub->expire_time_ = 10;
+  sub->expired_time_ = 10;
+  auto results = sub->testGet(0, 5000);
+  EXPECT_EQ(2U, results.size()); // 11, 61
+
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, sub->getDataKey());
+  EXPECT_EQ(4U, keys.size());
+
+  // The runner removes the expired events and counts those remaining.
+  sub->expired_time_ = 0;
+  sub->expireStored();
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, sub->getDataKey());
+  EXPECT_EQ(2U, keys.size());
+  EXPECT_EQ(2U, sub->storedCount());
+}
+
+TEST_F(EventsDatabaseTests, test_event_migration) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  auto data_key = sub->getDataKey();
+
+  // Events stored using the previous 60 second list-bin indexes.
+  Row r = {{"testing", "hello"}, {"time", "61"}, {"eid", "0000000001"}};
+  std::string data;
+  sub->serializeEvent(r, data);
+  setDatabaseValue(kEvents, data_key + "0000000001", data);
+  setDatabaseValue(kEvents, data_key + "0000000002", data);
+  setDatabaseValue(kEvents, data_key + "0000000003", data);
+  setDatabaseValue(kEvents, "indexes." + sub->dbNamespace() + ".60", "0,1");
+  setDatabaseValue(kEvents,
+                   "records." + sub->dbNamespace() + ".60.0",
+                   "0000000002:2");
+  setDatabaseValue(kEvents,
+                   "records." + sub->dbNamespace() + ".60.1",
+                   "0000000001:61");
+
+  sub->migrateEvents();
+
+  // Indexed events are moved, the remaining event was not indexed.
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, data_key);
+  std::sort(keys.begin(), keys.end());
+  ASSERT_EQ(keys.size(), 2U);
+  EXPECT_EQ(keys[0], data_key + "0000000002.0000000002");
+  EXPECT_EQ(keys[1], data_key + "0000000061.0000000001");
+
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, "indexes." + sub->dbNamespace());
+  EXPECT_TRUE(keys.empty());
+  scanDatabaseKeys(kEvents, keys, "records." + sub->dbNamespace());
+  EXPECT_TRUE(keys.empty());
+
+  EXPECT_EQ(sub->testGet(0, 0).size(), 2U);
 }
 
 TEST_F(EventsDatabaseTests, test_gentable) {
@@ -252,9 +460,8 @@ TEST_F(EventsDatabaseTests, test_gentable) {
 
   std::vector<std::string> keys;
   scanDatabaseKeys("events", keys);
-  // 9 data records, 1 eid counter, 3 indexes, 15 index records.
-  // Depending on the moment, an additional 3 indexes may be introduced.
-  EXPECT_LE(16U, keys.size());
+  // 9 data records, 1 eid counter, 1 schema.
+  EXPECT_LE(10U, keys.size());
 
   // Perform a "select" equivalent.
   auto results = genRows(sub.get());
@@ -273,9 +480,10 @@ TEST_F(EventsDatabaseTests, test_gentable) {
   results = genRows(sub.get());
   EXPECT_EQ(3U, results.size());
 
+  // 3 data records, 1 eid counter, 1 schema.
   keys.clear();
   scanDatabaseKeys("events", keys);
-  EXPECT_LE(6U, keys.size());
+  EXPECT_LE(5U, keys.size());
 }
 
 TEST_F(EventsDatabaseTests, test_optimize) {
@@ -319,6 +527,47 @@ TEST_F(EventsDatabaseTests, test_optimize) {
   kToolType = default_type;
 }
 
+TEST_F(EventsDatabaseTests, test_shared_history) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setEventsExpiry(0);
+  sub->query_count_ = 2;
+  for (size_t i = 100; i < 110; i++) {
+    sub->testAdd(i);
+  }
+
+  // The first query reads the events into the history.
+  bool shared = false;
+  auto results = sub->testGetShared("query_1", 0, 0, shared);
+  EXPECT_TRUE(shared);
+  EXPECT_EQ(10U, results.size());
+  EXPECT_EQ(10U, sub->history_.size());
+
+  // The second query selects from the history.
+  results = sub->testGetShared("query_2", 0, 0, shared);
+  EXPECT_TRUE(shared);
+  EXPECT_EQ(10U, results.size());
+
+  // Both queries consumed the events, which are dropped from the history.
+  EXPECT_TRUE(sub->history_.empty());
+  auto cursor = sub->cursors_["query_1"];
+
+  auto t = getUnixTime();
+  sub->testAdd(t);
+  sub->testAdd(t + 1);
+  results = sub->testGetShared("query_1", cursor.first, cursor.second, shared);
+  EXPECT_TRUE(shared);
+  EXPECT_EQ(2U, results.size());
+
+  results = sub->testGetShared("query_2", cursor.first, cursor.second, shared);
+  EXPECT_TRUE(shared);
+  EXPECT_EQ(2U, results.size());
+
+  // A query selecting events before the history reads the stored events.
+  results = sub->testGetShared("query_3", 0, 0, shared);
+  EXPECT_FALSE(shared);
+  EXPECT_TRUE(results.empty());
+}
+
 TEST_F(EventsDatabaseTests, test_expire_check) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   // Set the max number of buffered events to something reasonably small.
@@ -352,16 +601,9 @@ TEST_F(EventsDatabaseTests, test_expire_check) {
         sub->testAdd(t++);
       }
 
-      // Records hold the event_id + time indexes.
-      // Data hosts the event_id + JSON content.
-      auto record_key = "records." + sub->dbNamespace();
-      auto data_key = "data." + sub->dbNamespace();
-
-      std::vector<std::string> records, datas;
-      scanDatabaseKeys(kEvents, records, record_key);
-      scanDatabaseKeys(kEvents, datas, data_key);
-
-      EXPECT_LT(records.size(), 20U);
+      // Data hosts the time + event_id keyed content.
+      std::vector<std::string> datas;
+      scanDatabaseKeys(kEvents, datas, sub->getDataKey());
       EXPECT_LT(datas.size(), 60U);
     }
   }
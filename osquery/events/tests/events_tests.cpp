@@ -8,6 +8,9 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <atomic>
+#include <thread>
+
 #include <boost/filesystem/operations.hpp>
 
 #include <gtest/gtest.h>
@@ -328,6 +331,32 @@ TEST_F(EventsTests, test_tear_down) {
   EXPECT_FALSE(status.ok());
 }
 
+class QueuedEventPublisher : public TestEventPublisher {
+ public:
+  bool usesThread() const override {
+    return false;
+  }
+};
+
+TEST_F(EventsTests, test_publisher_without_thread) {
+  auto pub = std::make_shared<QueuedEventPublisher>();
+  auto status = EventFactory::registerEventPublisher(pub);
+  ASSERT_TRUE(status.ok());
+
+  // Starting the publisher configures it and returns without a run loop.
+  status = EventFactory::run(pub->type());
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(pub->hasStarted());
+  EXPECT_TRUE(pub->configure_run);
+  EXPECT_EQ(pub->getTestValue(), 1);
+
+  // The started publisher is torn down when deregistered.
+  status = EventFactory::deregisterEventPublisher(pub->type());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(pub->getTestValue(), 2);
+  EXPECT_EQ(EventFactory::numEventPublishers(), 0U);
+}
+
 static int kBellHathTolled = 0;
 
 Status TestTheeCallback(const EventContextRef& ec,
@@ -437,6 +466,28 @@ TEST_F(EventsTests, test_event_subscriber_context) {
   EXPECT_TRUE(status.ok());
 }
 
+TEST_F(EventsTests, test_event_context_pool) {
+  auto pub = std::make_shared<FakeEventPublisher>();
+  auto ec = pub->createEventContext();
+  ec->required_value = 42;
+  auto allocated = pub->contextsAllocated();
+  auto reused = pub->contextsReused();
+
+  // A released context's allocation is used by the next context.
+  auto* storage = ec.get();
+  ec.reset();
+  ec = pub->createEventContext();
+  EXPECT_EQ(storage, ec.get());
+  EXPECT_EQ(allocated, pub->contextsAllocated());
+  EXPECT_EQ(reused + 1, pub->contextsReused());
+
+  // Contexts alive at the same time use separate allocations.
+  auto other = pub->createEventContext();
+  EXPECT_NE(ec.get(), other.get());
+  EXPECT_EQ(allocated + reused + 2,
+            pub->contextsAllocated() + pub->contextsReused());
+}
+
 TEST_F(EventsTests, test_event_subscriber_configure) {
   auto sub = std::make_shared<FakeEventSubscriber>();
   // Register this subscriber (within the RegistryFactory), so it receives
@@ -519,6 +570,68 @@ TEST_F(EventsTests, test_fire_event) {
   EXPECT_TRUE(status.ok());
 }
 
+class QueuedEventSubscriber : public EventSubscriber<FakeEventPublisher> {
+ public:
+  QueuedEventSubscriber() {
+    setName("queued_events");
+  }
+
+  bool usesQueue() const override {
+    return true;
+  }
+
+  Status init() override {
+    subscribe(&QueuedEventSubscriber::Callback, createSubscriptionContext());
+    return Status(0, "OK");
+  }
+
+  Status Callback(const ECRef& ec, const SCRef& sc) {
+    if (ec->required_value != static_cast<int>(callback_count)) {
+      ordered = false;
+    }
+    callback_thread = std::this_thread::get_id();
+    callback_count++;
+    return Status(0, "OK");
+  }
+
+  std::atomic<size_t> callback_count{0};
+  std::atomic<bool> ordered{true};
+  std::thread::id callback_thread;
+};
+
+TEST_F(EventsTests, test_fire_queued_event) {
+  auto pub = std::make_shared<FakeEventPublisher>();
+  auto status = EventFactory::registerEventPublisher(pub);
+  ASSERT_TRUE(status.ok());
+
+  auto sub = std::make_shared<QueuedEventSubscriber>();
+  status = EventFactory::registerEventSubscriber(sub);
+  ASSERT_TRUE(status.ok());
+
+  // The subscriber callbacks are called, in order, by a callback thread.
+  for (int i = 0; i < 100; i++) {
+    auto ec = pub->createEventContext();
+    ec->required_value = i;
+    pub->fire(ec, 0);
+  }
+  for (size_t i = 0; i < 100 && sub->callback_count < 100; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(sub->callback_count, 100U);
+  EXPECT_TRUE(sub->ordered);
+  EXPECT_NE(sub->callback_thread, std::this_thread::get_id());
+  EXPECT_EQ(sub->queuedCount(), 0U);
+  EXPECT_EQ(sub->droppedCount(), 0U);
+
+  status = EventFactory::deregisterEventSubscriber(sub->getName());
+  EXPECT_TRUE(status.ok());
+  Dispatcher::stopServices();
+  Dispatcher::joinServices();
+
+  status = EventFactory::deregisterEventPublisher(pub->type());
+  EXPECT_TRUE(status.ok());
+}
+
 class SubFakeEventSubscriber : public FakeEventSubscriber {
  public:
   SubFakeEventSubscriber() : FakeEventSubscriber(true) {
@@ -0,0 +1,86 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/events/pathset.h"
+
+namespace osquery {
+
+class PathSetTests : public testing::Test {};
+
+TEST_F(PathSetTests, test_path_trie) {
+  PathTrie trie;
+  EXPECT_TRUE(trie.empty());
+
+  trie.insert({"etc", "hosts"});
+  trie.insert({"var", "*", "log"});
+  trie.insert({"tmp", "*"});
+  trie.insert({"usr", "**"});
+  EXPECT_FALSE(trie.empty());
+
+  EXPECT_EQ(trie.count({"etc", "hosts"}), 1U);
+  EXPECT_EQ(trie.count({"etc"}), 0U);
+  EXPECT_EQ(trie.count({"etc", "hosts", "more"}), 0U);
+
+  // A wildcard matches a single component within a pattern.
+  EXPECT_EQ(trie.count({"var", "db", "log"}), 1U);
+  EXPECT_EQ(trie.count({"var", "log"}), 0U);
+  EXPECT_EQ(trie.count({"var", "db", "log", "system.log"}), 0U);
+
+  // A trailing wildcard also matches the paths below its matches.
+  EXPECT_EQ(trie.count({"tmp", "file"}), 1U);
+  EXPECT_EQ(trie.count({"tmp", "dir", "file"}), 1U);
+  EXPECT_EQ(trie.count({"tmp"}), 0U);
+
+  // A recursive wildcard matches every path below its prefix.
+  EXPECT_EQ(trie.count({"usr", "bin", "env"}), 1U);
+  EXPECT_EQ(trie.count({"usr"}), 0U);
+
+  trie.clear();
+  EXPECT_TRUE(trie.empty());
+  EXPECT_EQ(trie.count({"etc", "hosts"}), 0U);
+}
+
+TEST_F(PathSetTests, test_patterned_path_set) {
+  PathSet<patternedPath> paths;
+  paths.insert("/osquery_pathset/%%");
+  paths.insert("/osquery_pathset_file/%/config");
+
+  EXPECT_TRUE(paths.find("/osquery_pathset"));
+  EXPECT_TRUE(paths.find("/osquery_pathset/a/b/c"));
+  EXPECT_TRUE(paths.find("/osquery_pathset_file/a/config"));
+  EXPECT_FALSE(paths.find("/osquery_pathset_file/a/other"));
+  EXPECT_FALSE(paths.find("/osquery"));
+}
+
+TEST_F(PathSetTests, test_patterned_path_set_parent) {
+  PathSet<patternedPath> paths;
+  paths.insert("/osquery_pathset/excluded");
+  paths.insert("/osquery_pathset/file");
+  paths.insert("/osquery_pathset/cache/%%");
+
+  // A file is found by its directory, or itself.
+  EXPECT_TRUE(paths.findSelfOrParent("/osquery_pathset/excluded/a"));
+  EXPECT_TRUE(paths.findSelfOrParent("/osquery_pathset/file"));
+  EXPECT_FALSE(paths.findSelfOrParent("/osquery_pathset/excluded/a/b"));
+  EXPECT_FALSE(paths.findSelfOrParent("/osquery_pathset/other"));
+
+  // A directory is not found by its parent.
+  EXPECT_TRUE(paths.findSelfOrParent("/osquery_pathset/excluded/"));
+  EXPECT_FALSE(paths.findSelfOrParent("/osquery_pathset/excluded/a/"));
+
+  // Only a recursive pattern matches every path below a directory.
+  EXPECT_TRUE(paths.findDescendants("/osquery_pathset/cache/"));
+  EXPECT_TRUE(paths.findDescendants("/osquery_pathset/cache/a/"));
+  EXPECT_FALSE(paths.findDescendants("/osquery_pathset/excluded/"));
+  EXPECT_FALSE(paths.findDescendants("/osquery_pathset/"));
+}
+} // namespace osquery
@@ -0,0 +1,100 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/events/predicates.h"
+
+namespace osquery {
+
+class EventPredicatesTests : public testing::Test {
+ protected:
+  bool getPredicates(const std::string& query,
+                     std::vector<EventPredicate>& predicates) {
+    predicates.clear();
+    return getQueryPredicates(query, "fake_events", columns_, predicates);
+  }
+
+ protected:
+  TableColumns columns_ = {
+      std::make_tuple("path", TEXT_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("pid", BIGINT_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("time", BIGINT_TYPE, ColumnOptions::DEFAULT),
+  };
+};
+
+TEST_F(EventPredicatesTests, test_get_query_predicates) {
+  std::vector<EventPredicate> predicates;
+  EXPECT_TRUE(getPredicates("SELECT * FROM fake_events;", predicates));
+  EXPECT_TRUE(predicates.empty());
+
+  EXPECT_TRUE(getPredicates("select path from fake_events as e where "
+                            "e.path like '/etc/%' and pid > -1 and "
+                            "time > (select unix_time from time) "
+                            "order by time;",
+                            predicates));
+  ASSERT_EQ(predicates.size(), 2U);
+  EXPECT_EQ(predicates[0].column, "path");
+  EXPECT_EQ(predicates[0].op, LIKE);
+  EXPECT_EQ(predicates[0].expr, "/etc/%");
+  EXPECT_FALSE(predicates[0].numeric);
+  EXPECT_EQ(predicates[1].column, "pid");
+  EXPECT_EQ(predicates[1].op, GREATER_THAN);
+  EXPECT_EQ(predicates[1].expr, "-1");
+  EXPECT_TRUE(predicates[1].numeric);
+
+  // Terms that are not simple comparisons to literals are not used.
+  EXPECT_TRUE(getPredicates("SELECT * FROM fake_events WHERE "
+                            "path != 'a' AND other = 'b' AND pid = 'c' AND "
+                            "path = 'it''s' AND 'x' = path",
+                            predicates));
+  ASSERT_EQ(predicates.size(), 1U);
+  EXPECT_EQ(predicates[0].expr, "it's");
+
+  // Queries that cannot be entirely analyzed keep every event.
+  EXPECT_FALSE(getPredicates(
+      "SELECT * FROM fake_events WHERE path = 'a' OR pid = 1", predicates));
+  EXPECT_FALSE(getPredicates(
+      "SELECT * FROM fake_events, processes WHERE path = 'a'", predicates));
+  EXPECT_FALSE(getPredicates(
+      "SELECT * FROM fake_events JOIN processes USING (pid)", predicates));
+  EXPECT_FALSE(getPredicates(
+      "SELECT * FROM other_events WHERE path = 'a'", predicates));
+  EXPECT_FALSE(getPredicates("SELECT * FROM fake_events WHERE path = 'a' "
+                             "UNION SELECT * FROM fake_events",
+                             predicates));
+  EXPECT_FALSE(getPredicates(
+      "SELECT * FROM fake_events WHERE pid BETWEEN 1 AND 2", predicates));
+}
+
+TEST_F(EventPredicatesTests, test_predicate_matches) {
+  std::vector<EventPredicate> predicates;
+  ASSERT_TRUE(getPredicates(
+      "SELECT * FROM fake_events WHERE path LIKE '/etc/%' AND pid >= 10",
+      predicates));
+
+  EventQueryPredicates queries;
+  queries.add(predicates);
+  EXPECT_TRUE(queries.matches({{"path", "/etc/hosts"}, {"pid", "100"}}));
+  EXPECT_FALSE(queries.matches({{"path", "/tmp/hosts"}, {"pid", "100"}}));
+  // Numeric columns are not compared as text.
+  EXPECT_FALSE(queries.matches({{"path", "/etc/hosts"}, {"pid", "9"}}));
+  // Missing or incomparable values are matched.
+  EXPECT_TRUE(queries.matches({{"path", "/etc/hosts"}, {"pid", ""}}));
+  EXPECT_TRUE(queries.matches({{"pid", "100"}}));
+
+  // A row is matched by any query.
+  ASSERT_TRUE(getPredicates(
+      "SELECT * FROM fake_events WHERE path = '/tmp/hosts'", predicates));
+  queries.add(predicates);
+  EXPECT_TRUE(queries.matches({{"path", "/tmp/hosts"}, {"pid", "100"}}));
+  EXPECT_FALSE(queries.matches({{"path", "/tmp/other"}, {"pid", "100"}}));
+}
+}
@@ -0,0 +1,144 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <boost/property_tree/json_parser.hpp>
+
+#include <osquery/database.h>
+#include <osquery/system.h>
+
+#include "osquery/events/rollups.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+class EventRollupsTests : public testing::Test {
+ protected:
+  Status parse(const std::string& json, RollupSpec& spec) {
+    pt::ptree tree;
+    std::stringstream stream(json);
+    pt::read_json(stream, tree);
+    return parseRollup("fake_rollup", tree, spec);
+  }
+
+  /// Find the aggregates of a group in a bucket.
+  Row find(const QueryData& rows,
+           EventTime bucket,
+           const std::string& path) {
+    for (const auto& r : rows) {
+      if (r.at("time") == std::to_string(bucket) && r.at("path") == path) {
+        return r;
+      }
+    }
+    return Row();
+  }
+};
+
+TEST_F(EventRollupsTests, test_parse_rollup) {
+  RollupSpec spec;
+  ASSERT_TRUE(parse("{\"table\": \"fake_events\", \"group_by\": [\"path\"], "
+                    "\"aggregates\": {\"events\": \"count\", "
+                    "\"total\": \"sum(size)\", \"last\": \"max( time )\"}, "
+                    "\"bucket\": 300}",
+                    spec)
+                  .ok());
+  EXPECT_EQ(spec.name, "fake_rollup");
+  EXPECT_EQ(spec.table, "fake_events");
+  EXPECT_EQ(spec.group_by, std::vector<std::string>{"path"});
+  ASSERT_EQ(spec.aggregates.size(), 3U);
+  EXPECT_EQ(spec.aggregates[0].function, RollupAggregate::Function::COUNT);
+  EXPECT_EQ(spec.aggregates[1].name, "total");
+  EXPECT_EQ(spec.aggregates[1].function, RollupAggregate::Function::SUM);
+  EXPECT_EQ(spec.aggregates[1].column, "size");
+  EXPECT_EQ(spec.aggregates[2].column, "time");
+  EXPECT_EQ(spec.bucket, 300U);
+
+  // Columns are unique, and every rollup has a table and an aggregate.
+  EXPECT_FALSE(parse("{\"group_by\": [\"path\"], "
+                     "\"aggregates\": {\"events\": \"count\"}}",
+                     spec)
+                   .ok());
+  EXPECT_FALSE(parse("{\"table\": \"fake_events\"}", spec).ok());
+  EXPECT_FALSE(parse("{\"table\": \"fake_events\", \"group_by\": [\"a\"], "
+                     "\"aggregates\": {\"a\": \"count\"}}",
+                     spec)
+                   .ok());
+  EXPECT_FALSE(parse("{\"table\": \"fake_events\", "
+                     "\"aggregates\": {\"a\": \"avg(size)\"}}",
+                     spec)
+                   .ok());
+  EXPECT_FALSE(parse("{\"table\": \"fake_events\", \"bucket\": 0, "
+                     "\"aggregates\": {\"a\": \"count\"}}",
+                     spec)
+                   .ok());
+}
+
+TEST_F(EventRollupsTests, test_rollup_aggregates) {
+  RollupSpec spec;
+  ASSERT_TRUE(parse("{\"table\": \"fake_events\", \"group_by\": [\"path\"], "
+                    "\"aggregates\": {\"events\": \"count\", "
+                    "\"total\": \"sum(size)\", \"smallest\": \"min(size)\"}}",
+                    spec)
+                  .ok());
+  EventRollup rollup(std::move(spec));
+  rollup.clear();
+
+  auto now = getUnixTime();
+  auto bucket = now - (now % 60) - 120;
+  rollup.add({{"path", "a"}, {"size", "10"}}, bucket);
+  rollup.add({{"path", "a"}, {"size", "5"}}, bucket + 30);
+  rollup.add({{"path", "b"}, {"size", "x"}}, bucket + 59);
+  rollup.add({{"path", "a"}, {"size", "1"}}, bucket + 60);
+
+  auto rows = rollup.rows();
+  EXPECT_EQ(rows.size(), 3U);
+  auto r = find(rows, bucket, "a");
+  EXPECT_EQ(r["events"], "2");
+  EXPECT_EQ(r["total"], "15");
+  EXPECT_EQ(r["smallest"], "5");
+
+  // Values that are not numbers are only counted.
+  r = find(rows, bucket, "b");
+  EXPECT_EQ(r["events"], "1");
+  EXPECT_EQ(r["total"], "");
+  EXPECT_EQ(find(rows, bucket + 60, "a")["total"], "1");
+
+  // A new bucket persists the buckets before the previous bucket.
+  rollup.add({{"path", "a"}, {"size", "2"}}, bucket + 120);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, "rollup.fake_rollup.");
+  EXPECT_EQ(keys.size(), 1U);
+
+  // Late events are merged with the persisted bucket.
+  rollup.add({{"path", "a"}, {"size", "3"}}, bucket + 1);
+  r = find(rollup.rows(), bucket, "a");
+  EXPECT_EQ(r["events"], "3");
+  EXPECT_EQ(r["smallest"], "3");
+
+  rollup.flush();
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, "rollup.fake_rollup.");
+  EXPECT_EQ(keys.size(), 3U);
+
+  rows = rollup.rows();
+  EXPECT_EQ(rows.size(), 4U);
+  r = find(rows, bucket, "a");
+  EXPECT_EQ(r["events"], "3");
+  EXPECT_EQ(r["total"], "18");
+  EXPECT_EQ(find(rows, bucket + 120, "a")["events"], "1");
+
+  rollup.clear();
+  EXPECT_TRUE(rollup.rows().empty());
+}
+} // namespace osquery
@@ -0,0 +1,74 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/windows/usn_journal.h"
+
+namespace osquery {
+
+class USNJournalTests : public testing::Test {};
+
+TEST_F(USNJournalTests, test_register_event_pub) {
+  auto pub = std::make_shared<USNJournalEventPublisher>();
+  auto status = EventFactory::registerEventPublisher(pub);
+  EXPECT_TRUE(status.ok());
+
+  status = EventFactory::deregisterEventPublisher("usn_journal");
+  EXPECT_TRUE(status.ok());
+}
+
+TEST_F(USNJournalTests, test_get_action) {
+  // A created file reports the creation, then its content once closed.
+  EXPECT_EQ(USNJournalEventPublisher::getAction(USN_REASON_FILE_CREATE),
+            "CREATED");
+  EXPECT_EQ(USNJournalEventPublisher::getAction(USN_REASON_FILE_CREATE |
+                                                USN_REASON_DATA_EXTEND |
+                                                USN_REASON_CLOSE),
+            "UPDATED");
+  EXPECT_EQ(USNJournalEventPublisher::getAction(USN_REASON_FILE_CREATE |
+                                                USN_REASON_CLOSE),
+            "");
+
+  // Writes are reported when the file closes.
+  EXPECT_EQ(USNJournalEventPublisher::getAction(USN_REASON_DATA_OVERWRITE), "");
+  EXPECT_EQ(USNJournalEventPublisher::getAction(USN_REASON_SECURITY_CHANGE |
+                                                USN_REASON_CLOSE),
+            "ATTRIBUTES_MODIFIED");
+  EXPECT_EQ(USNJournalEventPublisher::getAction(USN_REASON_FILE_DELETE |
+                                                USN_REASON_CLOSE),
+            "DELETED");
+  EXPECT_EQ(USNJournalEventPublisher::getAction(USN_REASON_RENAME_OLD_NAME),
+            "MOVED_FROM");
+  EXPECT_EQ(USNJournalEventPublisher::getAction(USN_REASON_RENAME_NEW_NAME),
+            "MOVED_TO");
+}
+
+TEST_F(USNJournalTests, test_match_pattern) {
+  auto match = USNJournalEventPublisher::matchPattern;
+  EXPECT_TRUE(match("c:\\windows\\hosts", "c:\\windows\\hosts"));
+  EXPECT_FALSE(match("c:\\windows\\hosts", "c:\\windows\\hosts.bak"));
+
+  // A '%' matches within a path component.
+  EXPECT_TRUE(match("c:\\windows\\%", "c:\\windows\\hosts"));
+  EXPECT_FALSE(match("c:\\windows\\%", "c:\\windows\\system32\\hosts"));
+  EXPECT_TRUE(match("c:\\users\\%\\downloads\\%.exe",
+                    "c:\\users\\admin\\downloads\\setup.exe"));
+  EXPECT_FALSE(match("c:\\users\\%\\downloads\\%.exe",
+                     "c:\\users\\admin\\downloads\\setup.msi"));
+
+  // A trailing '%%' matches recursively.
+  EXPECT_TRUE(match("c:\\windows\\%%", "c:\\windows\\system32\\hosts"));
+  EXPECT_FALSE(match("c:\\windows\\%%", "c:\\windows\\"));
+  EXPECT_FALSE(match("c:\\windows\\%%", "c:\\program files\\hosts"));
+}
+}
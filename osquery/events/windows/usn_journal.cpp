@@ -0,0 +1,440 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <set>
+
+#include <boost/algorithm/string.hpp>
+
+#include <osquery/database.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/windows/wmi.h"
+#include "osquery/events/windows/usn_journal.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     usn_journal_interval,
+     1000,
+     "Milliseconds between reads of the NTFS change journals");
+
+REGISTER(USNJournalEventPublisher, "event_publisher", "usn_journal");
+
+/// The size of each FSCTL_READ_USN_JOURNAL read.
+const size_t kUSNJournalReadSize = 64 * 1024;
+
+/// Persist a volume's cursor after this many records.
+const size_t kUSNJournalCursorRecords = 4096;
+
+/// The most directory paths kept for each volume.
+const size_t kUSNJournalDirectories = 4096;
+
+/// Volume cursors are stored as persistent settings with this prefix.
+const std::string kUSNJournalCursorPrefix = "usn_journal.cursor.";
+
+/// Records are read when a file is closed, created, deleted or renamed.
+const DWORD kUSNJournalReasons = USN_REASON_CLOSE | USN_REASON_FILE_CREATE |
+                                 USN_REASON_FILE_DELETE |
+                                 USN_REASON_RENAME_OLD_NAME |
+                                 USN_REASON_RENAME_NEW_NAME;
+
+/// Reasons of a closed file that changed its content.
+const DWORD kUSNJournalDataReasons =
+    USN_REASON_DATA_OVERWRITE | USN_REASON_DATA_EXTEND |
+    USN_REASON_DATA_TRUNCATION | USN_REASON_NAMED_DATA_OVERWRITE |
+    USN_REASON_NAMED_DATA_EXTEND | USN_REASON_NAMED_DATA_TRUNCATION |
+    USN_REASON_STREAM_CHANGE;
+
+/// Reasons of a closed file that changed its attributes.
+const DWORD kUSNJournalAttributeReasons =
+    USN_REASON_BASIC_INFO_CHANGE | USN_REASON_SECURITY_CHANGE |
+    USN_REASON_EA_CHANGE | USN_REASON_HARD_LINK_CHANGE;
+
+static bool queryJournal(HANDLE handle, USN_JOURNAL_DATA_V0& journal) {
+  DWORD returned = 0;
+  return DeviceIoControl(handle,
+                         FSCTL_QUERY_USN_JOURNAL,
+                         nullptr,
+                         0,
+                         &journal,
+                         sizeof(journal),
+                         &returned,
+                         nullptr) != FALSE;
+}
+
+void USNJournalEventPublisher::configure() {
+  stop();
+
+  // Each volume with a subscribed path is read once.
+  std::set<std::string> drives;
+  for (auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    sc->pattern = boost::to_lower_copy(sc->path);
+    boost::replace_all(sc->pattern, "/", "\\");
+    boost::replace_all(sc->pattern, "*", "%");
+    if (!sc->pattern.empty() && sc->pattern.back() == '\\') {
+      // A directory selects the files within it.
+      sc->pattern += '%';
+    }
+    if (sc->pattern.size() < 2 || sc->pattern[1] != ':') {
+      LOG(WARNING) << "Cannot read the NTFS change journal for " << sc->path
+                   << ": the path has no drive";
+      continue;
+    }
+
+    auto drive = boost::to_upper_copy(sc->pattern.substr(0, 2));
+    if (!drives.insert(drive).second) {
+      continue;
+    }
+
+    USNJournalVolume volume;
+    auto s = openVolume(drive, volume);
+    if (!s.ok()) {
+      LOG(WARNING) << "Cannot read the NTFS change journal of " << drive << ": "
+                   << s.getMessage() << " (" << s.getCode() << ")";
+      continue;
+    }
+    volumes_[drive] = std::move(volume);
+  }
+}
+
+Status USNJournalEventPublisher::openVolume(const std::string& drive,
+                                            USNJournalVolume& volume) {
+  auto device = "\\\\.\\" + drive;
+  volume.handle = CreateFileA(device.c_str(),
+                              GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              nullptr,
+                              OPEN_EXISTING,
+                              0,
+                              nullptr);
+  if (volume.handle == INVALID_HANDLE_VALUE) {
+    return Status(GetLastError(), "Cannot open the volume");
+  }
+
+  // The journal is not created, only volumes with an active journal are read.
+  USN_JOURNAL_DATA_V0 journal;
+  if (!queryJournal(volume.handle, journal)) {
+    auto error = GetLastError();
+    CloseHandle(volume.handle);
+    volume.handle = INVALID_HANDLE_VALUE;
+    return Status(error, "Cannot query the change journal");
+  }
+
+  // Without a cursor for this journal, start with new records.
+  volume.journal_id = journal.UsnJournalID;
+  volume.next_usn = journal.NextUsn;
+
+  std::string cursor;
+  auto key = kUSNJournalCursorPrefix + drive;
+  if (!getDatabaseValue(kPersistentSettings, key, cursor).ok()) {
+    return Status(0, "OK");
+  }
+
+  auto parts = split(cursor, ":");
+  long long usn = 0;
+  if (parts.size() != 2 || parts[0] != std::to_string(journal.UsnJournalID) ||
+      !safeStrtoll(parts[1], 10, usn).ok() || usn > journal.NextUsn) {
+    VLOG(1) << "The NTFS change journal of " << drive << " was recreated";
+    return Status(0, "OK");
+  }
+
+  if (usn < journal.LowestValidUsn) {
+    LOG(WARNING) << "The NTFS change journal of " << drive
+                 << " wrapped, file changes were missed";
+    usn = journal.FirstUsn;
+  }
+  volume.next_usn = usn;
+  return Status(0, "OK");
+}
+
+Status USNJournalEventPublisher::run() {
+  if (volumes_.empty()) {
+    pause();
+    return Status(0, "OK");
+  }
+
+  for (auto& volume : volumes_) {
+    if (volume.second.handle == INVALID_HANDLE_VALUE) {
+      // The journal was deleted or recreated, resume after the saved cursor.
+      auto s = openVolume(volume.first, volume.second);
+      if (!s.ok()) {
+        continue;
+      }
+    }
+
+    readVolume(volume.first, volume.second);
+
+    // Persist the cursor once the available records are read.
+    if (volume.second.unsaved > 0) {
+      saveCursor(volume.first, volume.second);
+    }
+  }
+
+  pauseMilli(FLAGS_usn_journal_interval);
+  return Status(0, "OK");
+}
+
+size_t USNJournalEventPublisher::readVolume(const std::string& drive,
+                                            USNJournalVolume& volume) {
+  read_buffer_.resize(kUSNJournalReadSize);
+  size_t fired = 0;
+
+  while (!isEnding()) {
+    READ_USN_JOURNAL_DATA_V0 read = {0};
+    read.StartUsn = volume.next_usn;
+    read.ReasonMask = kUSNJournalReasons;
+    read.ReturnOnlyOnClose = FALSE;
+    read.UsnJournalID = volume.journal_id;
+
+    DWORD returned = 0;
+    if (!DeviceIoControl(volume.handle,
+                         FSCTL_READ_USN_JOURNAL,
+                         &read,
+                         sizeof(read),
+                         read_buffer_.data(),
+                         static_cast<DWORD>(read_buffer_.size()),
+                         &returned,
+                         nullptr)) {
+      auto error = GetLastError();
+      USN_JOURNAL_DATA_V0 journal;
+      if (error == ERROR_JOURNAL_ENTRY_DELETED &&
+          queryJournal(volume.handle, journal) &&
+          journal.UsnJournalID == volume.journal_id) {
+        LOG(WARNING) << "The NTFS change journal of " << drive
+                     << " wrapped, file changes were missed";
+        volume.next_usn = journal.FirstUsn;
+        continue;
+      }
+
+      VLOG(1) << "Cannot read the NTFS change journal of " << drive << ": "
+              << error;
+      saveCursor(drive, volume);
+      CloseHandle(volume.handle);
+      volume.handle = INVALID_HANDLE_VALUE;
+      break;
+    }
+
+    // The output begins with the USN following the returned records.
+    if (returned <= sizeof(USN)) {
+      break;
+    }
+    auto next_usn = *reinterpret_cast<USN*>(read_buffer_.data());
+
+    DWORD offset = sizeof(USN);
+    while (offset + sizeof(USN_RECORD) <= returned) {
+      auto record = reinterpret_cast<PUSN_RECORD>(&read_buffer_[offset]);
+      if (record->RecordLength == 0) {
+        break;
+      }
+      offset += record->RecordLength;
+      volume.unsaved++;
+
+      if (record->MajorVersion != 2) {
+        continue;
+      }
+
+      bool directory = (record->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+      if (directory &&
+          (record->Reason & (USN_REASON_FILE_DELETE |
+                             USN_REASON_RENAME_OLD_NAME)) != 0) {
+        // Paths of the directory and its descendants are no longer valid.
+        volume.directories.clear();
+      }
+
+      auto action = getAction(record->Reason);
+      if (action.empty()) {
+        continue;
+      }
+
+      std::string parent;
+      auto parent_ref = record->ParentFileReferenceNumber;
+      if (!getDirectoryPath(volume, parent_ref, parent)) {
+        // The parent directory was removed before the record was read.
+        dropped_count_++;
+        continue;
+      }
+
+      auto name = reinterpret_cast<const wchar_t*>(
+          reinterpret_cast<const char*>(record) + record->FileNameOffset);
+      std::wstring filename(name, record->FileNameLength / sizeof(wchar_t));
+
+      auto ec = createEventContext();
+      ec->action = std::move(action);
+      ec->path = parent + wstringToString(filename.c_str());
+      ec->drive = drive;
+      ec->usn = record->Usn;
+      ec->reason = record->Reason;
+      ec->file_ref = record->FileReferenceNumber;
+      ec->parent_ref = parent_ref;
+      ec->directory = directory;
+      ec->pattern_path = boost::to_lower_copy(ec->path);
+      fire(ec);
+      fired++;
+    }
+
+    volume.next_usn = next_usn;
+    if (volume.unsaved >= kUSNJournalCursorRecords) {
+      saveCursor(drive, volume);
+    }
+  }
+  return fired;
+}
+
+bool USNJournalEventPublisher::getDirectoryPath(USNJournalVolume& volume,
+                                                DWORDLONG ref,
+                                                std::string& path) {
+  auto cached = volume.directories.find(ref);
+  if (cached != volume.directories.end()) {
+    path = cached->second;
+    return true;
+  }
+
+  FILE_ID_DESCRIPTOR id;
+  id.dwSize = sizeof(id);
+  id.Type = FileIdType;
+  id.FileId.QuadPart = static_cast<LONGLONG>(ref);
+  auto handle = OpenFileById(volume.handle,
+                             &id,
+                             0,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE |
+                                 FILE_SHARE_DELETE,
+                             nullptr,
+                             FILE_FLAG_BACKUP_SEMANTICS);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  std::vector<wchar_t> buffer(MAX_PATH + 1);
+  auto length = GetFinalPathNameByHandleW(handle,
+                                          buffer.data(),
+                                          static_cast<DWORD>(buffer.size()),
+                                          FILE_NAME_NORMALIZED);
+  if (length >= buffer.size()) {
+    buffer.resize(length + 1);
+    length = GetFinalPathNameByHandleW(handle,
+                                       buffer.data(),
+                                       static_cast<DWORD>(buffer.size()),
+                                       FILE_NAME_NORMALIZED);
+  }
+  CloseHandle(handle);
+  if (length == 0 || length >= buffer.size()) {
+    return false;
+  }
+
+  // Remove the "\\?\" prefix of the final path.
+  path = wstringToString(buffer.data());
+  if (boost::starts_with(path, "\\\\?\\")) {
+    path.erase(0, 4);
+  }
+  if (path.empty() || path.back() != '\\') {
+    path += '\\';
+  }
+
+  if (volume.directories.size() >= kUSNJournalDirectories) {
+    volume.directories.clear();
+  }
+  volume.directories[ref] = path;
+  return true;
+}
+
+void USNJournalEventPublisher::saveCursor(const std::string& drive,
+                                          USNJournalVolume& volume) {
+  setDatabaseValue(kPersistentSettings,
+                   kUSNJournalCursorPrefix + drive,
+                   std::to_string(volume.journal_id) + ":" +
+                       std::to_string(volume.next_usn));
+  volume.unsaved = 0;
+}
+
+void USNJournalEventPublisher::stop() {
+  for (auto& volume : volumes_) {
+    if (volume.second.handle == INVALID_HANDLE_VALUE) {
+      continue;
+    }
+
+    if (volume.second.unsaved > 0) {
+      saveCursor(volume.first, volume.second);
+    }
+    CloseHandle(volume.second.handle);
+  }
+  volumes_.clear();
+}
+
+void USNJournalEventPublisher::tearDown() {
+  stop();
+}
+
+std::string USNJournalEventPublisher::getAction(DWORD reason) {
+  if (reason & USN_REASON_FILE_DELETE) {
+    return "DELETED";
+  }
+
+  if (reason & USN_REASON_RENAME_OLD_NAME) {
+    return "MOVED_FROM";
+  }
+
+  // Records are written when a reason first occurs and when the file closes.
+  // The close record accumulates every reason, only changes not yet published
+  // are published with it.
+  if ((reason & USN_REASON_CLOSE) == 0) {
+    if (reason & USN_REASON_RENAME_NEW_NAME) {
+      return "MOVED_TO";
+    }
+    if (reason & USN_REASON_FILE_CREATE) {
+      return "CREATED";
+    }
+    return "";
+  }
+
+  if (reason & kUSNJournalDataReasons) {
+    return "UPDATED";
+  }
+  if (reason & kUSNJournalAttributeReasons) {
+    return "ATTRIBUTES_MODIFIED";
+  }
+  return "";
+}
+
+bool USNJournalEventPublisher::matchPattern(const char* pattern,
+                                            const char* path) {
+  for (; *pattern != '\0'; pattern++, path++) {
+    if (*pattern == '%') {
+      if (pattern[1] == '%') {
+        // A trailing '%%' matches any descendant.
+        return *path != '\0';
+      }
+
+      // A '%' matches any characters within a path component.
+      for (;; path++) {
+        if (matchPattern(pattern + 1, path)) {
+          return true;
+        }
+        if (*path == '\0' || *path == '\\') {
+          return false;
+        }
+      }
+    }
+
+    if (*pattern != *path) {
+      return false;
+    }
+  }
+  return *path == '\0';
+}
+
+bool USNJournalEventPublisher::shouldFire(
+    const USNJournalSubscriptionContextRef& sc,
+    const USNJournalEventContextRef& ec) const {
+  return matchPattern(sc->pattern.c_str(), ec->pattern_path.c_str());
+}
+}
@@ -0,0 +1,170 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <winioctl.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/**
+ * @brief The change journal of an NTFS volume.
+ *
+ * The cursor is the USN of the next record to read, it is persisted with the
+ * journal's identifier such that a restarted publisher resumes after the last
+ * record fired.
+ */
+struct USNJournalVolume {
+  /// The volume, opened for FSCTL_READ_USN_JOURNAL and OpenFileById.
+  HANDLE handle{INVALID_HANDLE_VALUE};
+
+  /// The journal's identifier, changes if the journal is recreated.
+  DWORDLONG journal_id{0};
+
+  /// The USN of the next record to read.
+  USN next_usn{0};
+
+  /// Records read since the cursor was persisted.
+  size_t unsaved{0};
+
+  /// Resolved paths of directories by file reference number.
+  std::unordered_map<DWORDLONG, std::string> directories;
+};
+
+/**
+ * @brief Subscription details for USNJournalEventPublisher events.
+ *
+ * Paths use the file_paths syntax, '%' matches within a path component and a
+ * trailing '%%' matches files recursively.
+ */
+struct USNJournalSubscriptionContext : public SubscriptionContext {
+  /// Subscription the following filesystem path.
+  std::string path;
+
+  /// Namespace the filesystem path within a category.
+  std::string category;
+
+ private:
+  /// The lowercase path with '\\' separators, such as "c:\\windows\\%%".
+  std::string pattern;
+
+ private:
+  friend class USNJournalEventPublisher;
+};
+
+/// Event details for USNJournalEventPublisher events.
+struct USNJournalEventContext : public EventContext {
+  /// A string action representation, such as "UPDATED".
+  std::string action;
+
+  /// The resolved path of the file.
+  std::string path;
+
+  /// The drive of the volume, such as "C:".
+  std::string drive;
+
+  /// The update sequence number of the journal record.
+  USN usn{0};
+
+  /// The USN_REASON_ flags of the journal record.
+  DWORD reason{0};
+
+  /// The file's reference number within the volume.
+  DWORDLONG file_ref{0};
+
+  /// The reference number of the file's parent directory.
+  DWORDLONG parent_ref{0};
+
+  /// The change was to a directory.
+  bool directory{false};
+
+ private:
+  /// The lowercase path, matched against subscription patterns.
+  std::string pattern_path;
+
+ private:
+  friend class USNJournalEventPublisher;
+};
+
+using USNJournalEventContextRef = std::shared_ptr<USNJournalEventContext>;
+using USNJournalSubscriptionContextRef =
+    std::shared_ptr<USNJournalSubscriptionContext>;
+
+/**
+ * @brief Publish file changes from the NTFS change journal.
+ *
+ * The journal is maintained by NTFS whether or not osquery runs, so file
+ * changes are read from the journal of each volume with a subscribed path
+ * rather than watching directories. Reading a quiet journal costs a single
+ * FSCTL_READ_USN_JOURNAL per volume and interval.
+ *
+ * Only records written when a file is closed, created, deleted or renamed are
+ * read, such that several writes to an open file are published once.
+ */
+class USNJournalEventPublisher
+    : public EventPublisher<USNJournalSubscriptionContext,
+                            USNJournalEventContext> {
+  DECLARE_PUBLISHER("usn_journal");
+
+ public:
+  void configure() override;
+
+  void tearDown() override;
+
+  /// Read the journal of each volume, then wait for the next interval.
+  Status run() override;
+
+  bool shouldFire(const USNJournalSubscriptionContextRef& sc,
+                  const USNJournalEventContextRef& ec) const override;
+
+  /// The action of a journal record's reason flags, empty if not published.
+  static std::string getAction(DWORD reason);
+
+  /// Match a lowercase path against a subscription's pattern.
+  static bool matchPattern(const char* pattern, const char* path);
+
+ private:
+  /// Close the volumes and persist their cursors.
+  void stop() override;
+
+  /// Open a volume's journal, after its persisted cursor if one exists.
+  Status openVolume(const std::string& drive, USNJournalVolume& volume);
+
+  /// Fire the available records of a volume, returns the number fired.
+  size_t readVolume(const std::string& drive, USNJournalVolume& volume);
+
+  /// Resolve the path of a record's parent directory.
+  bool getDirectoryPath(USNJournalVolume& volume,
+                        DWORDLONG ref,
+                        std::string& path);
+
+  /// Persist a volume's cursor.
+  void saveCursor(const std::string& drive, USNJournalVolume& volume);
+
+ private:
+  /// Open journals by drive, such as "C:".
+  std::map<std::string, USNJournalVolume> volumes_;
+
+  /// Scratch space for journal records.
+  std::vector<char> read_buffer_;
+
+ public:
+  friend class USNJournalTests;
+};
+}
@@ -16,6 +16,7 @@
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/tokenizer.hpp>
 
+#include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
@@ -30,127 +31,293 @@ REGISTER(WindowsEventLogEventPublisher, "event_publisher", "windows_event_log");
 
 const std::chrono::milliseconds kWinEventLogPause(200);
 
+/// The number of events requested from a channel with each read.
+const DWORD kWinEventLogBatchSize = 64;
+
+/// Persist a channel's bookmark after this many events.
+const size_t kWinEventLogBookmarkEvents = 1024;
+
+/// Channel bookmarks are stored as persistent settings with this prefix.
+const std::string kWinEventLogBookmarkPrefix = "windows_event_log.bookmark.";
+
 void WindowsEventLogEventPublisher::configure() {
   stop();
+
+  // Channels may be selected by several subscriptions, read each one once.
   for (auto& sub : subscriptions_) {
     auto sc = getSubscriptionContext(sub->context);
     for (const auto& chan : sc->sources) {
-      /*
-       * We don't apply any filtering to the Windows event logs. It's assumed
-       * that if filtering is required, this will be handled via SQL queries
-       * or in the subscriber logic.
-       */
-      auto hSubscription =
-          EvtSubscribe(nullptr,
-                       nullptr,
-                       chan.c_str(),
-                       L"*",
-                       nullptr,
-                       nullptr,
-                       EVT_SUBSCRIBE_CALLBACK(winEventCallback),
-                       EvtSubscribeToFutureEvents);
-      if (hSubscription == nullptr) {
+      if (channels_.count(chan) > 0) {
+        continue;
+      }
+
+      if (channels_.size() >= MAXIMUM_WAIT_OBJECTS) {
+        LOG(WARNING) << "Cannot subscribe to more than " << MAXIMUM_WAIT_OBJECTS
+                     << " Windows event log channels";
+        return;
+      }
+
+      WindowsEventLogChannel channel;
+      auto s = subscribe(chan, channel);
+      if (!s.ok()) {
         LOG(WARNING) << "Failed to subscribe to "
-                     << wstringToString(chan.c_str()) << ": " << GetLastError();
-      } else {
-        win_event_handles_.push_back(hSubscription);
+                     << wstringToString(chan.c_str()) << ": " << s.getMessage();
+        continue;
       }
+      channels_[chan] = channel;
     }
   }
 }
 
+Status WindowsEventLogEventPublisher::subscribe(
+    const std::wstring& name, WindowsEventLogChannel& channel) {
+  // The signal is set when events are available and reset once read.
+  channel.signal = CreateEvent(nullptr, TRUE, TRUE, nullptr);
+  if (channel.signal == nullptr) {
+    return Status(GetLastError(), "Could not create a signal");
+  }
+
+  /*
+   * We don't apply any filtering to the Windows event logs. It's assumed
+   * that if filtering is required, this will be handled via SQL queries
+   * or in the subscriber logic.
+   */
+  std::string xml;
+  auto key = kWinEventLogBookmarkPrefix + wstringToString(name.c_str());
+  if (getDatabaseValue(kPersistentSettings, key, xml).ok() && !xml.empty()) {
+    channel.bookmark = EvtCreateBookmark(stringToWstring(xml).c_str());
+    if (channel.bookmark != nullptr) {
+      channel.subscription = EvtSubscribe(nullptr,
+                                          channel.signal,
+                                          name.c_str(),
+                                          L"*",
+                                          channel.bookmark,
+                                          nullptr,
+                                          nullptr,
+                                          EvtSubscribeStartAfterBookmark);
+    }
+
+    if (channel.subscription == nullptr) {
+      // The bookmarked event may have been cleared from the channel.
+      VLOG(1) << "Cannot resume Windows event log channel "
+              << wstringToString(name.c_str()) << ": " << GetLastError();
+      if (channel.bookmark != nullptr) {
+        EvtClose(channel.bookmark);
+        channel.bookmark = nullptr;
+      }
+    }
+  }
+
+  if (channel.subscription == nullptr) {
+    channel.subscription = EvtSubscribe(nullptr,
+                                        channel.signal,
+                                        name.c_str(),
+                                        L"*",
+                                        nullptr,
+                                        nullptr,
+                                        nullptr,
+                                        EvtSubscribeToFutureEvents);
+  }
+
+  if (channel.bookmark == nullptr) {
+    channel.bookmark = EvtCreateBookmark(nullptr);
+  }
+
+  if (channel.subscription == nullptr || channel.bookmark == nullptr) {
+    auto error = GetLastError();
+    if (channel.subscription != nullptr) {
+      EvtClose(channel.subscription);
+    }
+    if (channel.bookmark != nullptr) {
+      EvtClose(channel.bookmark);
+    }
+    CloseHandle(channel.signal);
+    channel = WindowsEventLogChannel();
+    return Status(error, "Could not subscribe");
+  }
+  return Status(0, "OK");
+}
+
 Status WindowsEventLogEventPublisher::run() {
-  pause();
+  if (channels_.empty()) {
+    pause();
+    return Status(0, "OK");
+  }
+
+  std::vector<HANDLE> signals;
+  for (const auto& channel : channels_) {
+    signals.push_back(channel.second.signal);
+  }
+
+  auto result =
+      WaitForMultipleObjects(static_cast<DWORD>(signals.size()),
+                             signals.data(),
+                             FALSE,
+                             static_cast<DWORD>(kWinEventLogPause.count()));
+  if (result == WAIT_FAILED) {
+    return Status(GetLastError(), "Cannot wait for Windows event log channels");
+  }
+
+  if (result == WAIT_TIMEOUT) {
+    // Persist bookmarks once channels are quiet.
+    for (auto& channel : channels_) {
+      if (channel.second.unsaved > 0) {
+        saveBookmark(channel.first, channel.second);
+      }
+    }
+    return Status(0, "OK");
+  }
+
+  // Read every signaled channel so that a busy channel does not starve others.
+  for (auto& channel : channels_) {
+    if (WaitForSingleObject(channel.second.signal, 0) != WAIT_OBJECT_0) {
+      continue;
+    }
+
+    readChannel(channel.second);
+    if (channel.second.unsaved >= kWinEventLogBookmarkEvents) {
+      saveBookmark(channel.first, channel.second);
+    }
+  }
   return Status(0, "OK");
 }
 
-void WindowsEventLogEventPublisher::stop() {
-  for (auto& e : win_event_handles_) {
-    if (e != nullptr) {
-      EvtClose(e);
+size_t WindowsEventLogEventPublisher::readChannel(
+    WindowsEventLogChannel& channel) {
+  EVT_HANDLE events[kWinEventLogBatchSize];
+  DWORD returned = 0;
+  size_t fired = 0;
+
+  while (!isEnding()) {
+    if (!EvtNext(channel.subscription,
+                 kWinEventLogBatchSize,
+                 events,
+                 0,
+                 0,
+                 &returned)) {
+      auto error = GetLastError();
+      if (error == ERROR_NO_MORE_ITEMS) {
+        // Wait for the event log service to signal new events.
+        ResetEvent(channel.signal);
+      } else if (error != ERROR_TIMEOUT) {
+        VLOG(1) << "Cannot read Windows event log channel: " << error;
+        ResetEvent(channel.signal);
+      }
+      break;
+    }
+
+    for (DWORD i = 0; i < returned; i++) {
+      pt::ptree propTree;
+      auto s = parseEvent(events[i], render_buffer_, propTree);
+      if (s.ok()) {
+        auto ec = createEventContext();
+        /// We leave the parsing of the properties up to the subscriber
+        ec->eventRecord = propTree;
+        ec->channel = stringToWstring(propTree.get("Event.System.Channel", ""));
+        fire(ec);
+        fired++;
+      } else {
+        VLOG(1) << "Error rendering Windows event log: " << s.getCode();
+        dropped_count_++;
+      }
+
+      EvtUpdateBookmark(channel.bookmark, events[i]);
+      EvtClose(events[i]);
     }
+    channel.unsaved += returned;
   }
-  win_event_handles_.clear();
+  return fired;
 }
 
-void WindowsEventLogEventPublisher::tearDown() {
-  stop();
+void WindowsEventLogEventPublisher::saveBookmark(
+    const std::wstring& name, WindowsEventLogChannel& channel) {
+  DWORD used = 0;
+  DWORD count = 0;
+  EvtRender(nullptr,
+            channel.bookmark,
+            EvtRenderBookmark,
+            0,
+            nullptr,
+            &used,
+            &count);
+  if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+    return;
+  }
+
+  std::vector<wchar_t> xml(used / sizeof(wchar_t) + 1, L'\0');
+  if (!EvtRender(nullptr,
+                 channel.bookmark,
+                 EvtRenderBookmark,
+                 static_cast<DWORD>(xml.size() * sizeof(wchar_t)),
+                 xml.data(),
+                 &used,
+                 &count)) {
+    VLOG(1) << "Cannot render Windows event log bookmark: " << GetLastError();
+    return;
+  }
+
+  auto key = kWinEventLogBookmarkPrefix + wstringToString(name.c_str());
+  setDatabaseValue(kPersistentSettings, key, wstringToString(xml.data()));
+  channel.unsaved = 0;
 }
 
-unsigned long __stdcall WindowsEventLogEventPublisher::winEventCallback(
-    EVT_SUBSCRIBE_NOTIFY_ACTION action, PVOID pContext, EVT_HANDLE hEvent) {
-  UNREFERENCED_PARAMETER(pContext);
-
-  switch (action) {
-  case EvtSubscribeActionError:
-    VLOG(1) << "Windows event callback failed: " << hEvent;
-    break;
-  case EvtSubscribeActionDeliver: {
-    pt::ptree propTree;
-    auto s = parseEvent(hEvent, propTree);
-    if (s.ok()) {
-      auto ec = createEventContext();
-      /// We leave the parsing of the properties up to the subscriber
-      ec->eventRecord = propTree;
-      ec->channel = stringToWstring(propTree.get("Event.System.Channel", ""));
-      EventFactory::fire<WindowsEventLogEventPublisher>(ec);
-    } else {
-      VLOG(1) << "Error rendering Windows event log: " << s.getCode();
+void WindowsEventLogEventPublisher::stop() {
+  for (auto& channel : channels_) {
+    if (channel.second.unsaved > 0) {
+      saveBookmark(channel.first, channel.second);
     }
-  } break;
 
-  default:
-    VLOG(1) << "Received unknown action from Windows event log: "
-            << GetLastError();
+    EvtClose(channel.second.subscription);
+    EvtClose(channel.second.bookmark);
+    CloseHandle(channel.second.signal);
   }
-  return ERROR_SUCCESS;
+  channels_.clear();
+}
+
+void WindowsEventLogEventPublisher::tearDown() {
+  stop();
+}
+
+Status WindowsEventLogEventPublisher::parseEvent(EVT_HANDLE evt,
+                                                 pt::ptree& propTree) {
+  std::vector<wchar_t> buffer;
+  return parseEvent(evt, buffer, propTree);
 }
 
 Status WindowsEventLogEventPublisher::parseEvent(EVT_HANDLE evt,
+                                                 std::vector<wchar_t>& buffer,
                                                  pt::ptree& propTree) {
-  DWORD buffSize = 0;
+  // The subscriber reports named EventData values, which are only available
+  // from the rendered XML. The buffer is kept between events and grown.
   DWORD buffUsed = 0;
   DWORD propCount = 0;
-  LPWSTR xml = nullptr;
-  Status status;
-
   if (!EvtRender(nullptr,
                  evt,
                  EvtRenderEventXml,
-                 buffSize,
-                 xml,
+                 static_cast<DWORD>(buffer.size() * sizeof(wchar_t)),
+                 buffer.data(),
                  &buffUsed,
                  &propCount)) {
-    if (ERROR_INSUFFICIENT_BUFFER == GetLastError()) {
-      buffSize = buffUsed;
-      xml = static_cast<LPWSTR>(malloc(buffSize));
-      if (xml != nullptr) {
-        EvtRender(nullptr,
-                  evt,
-                  EvtRenderEventXml,
-                  buffSize,
-                  xml,
-                  &buffUsed,
-                  &propCount);
-      } else {
-        status = Status(1, "Unable to reserve memory for event log buffer");
-      }
+    if (ERROR_INSUFFICIENT_BUFFER != GetLastError()) {
+      return Status(GetLastError(), "Event rendering failed");
     }
-  }
 
-  if (ERROR_SUCCESS == GetLastError()) {
-    std::stringstream ss;
-    ss << wstringToString(xml);
-    read_xml(ss, propTree);
-  } else {
-    status = Status(GetLastError(), "Event rendering failed");
-  }
-
-  if (xml != nullptr) {
-    free(xml);
+    buffer.resize(buffUsed / sizeof(wchar_t) + 1);
+    if (!EvtRender(nullptr,
+                   evt,
+                   EvtRenderEventXml,
+                   static_cast<DWORD>(buffer.size() * sizeof(wchar_t)),
+                   buffer.data(),
+                   &buffUsed,
+                   &propCount)) {
+      return Status(GetLastError(), "Event rendering failed");
+    }
   }
 
-  return status;
+  std::stringstream ss;
+  ss << wstringToString(buffer.data());
+  read_xml(ss, propTree);
+  return Status(0, "OK");
 }
 
 bool WindowsEventLogEventPublisher::shouldFire(
@@ -160,6 +327,6 @@ bool WindowsEventLogEventPublisher::shouldFire(
 }
 
 bool WindowsEventLogEventPublisher::isSubscriptionActive() const {
-  return win_event_handles_.size() > 0;
+  return !channels_.empty();
 }
 }
@@ -15,10 +15,34 @@
 #include <Windows.h>
 #include <winevt.h>
 
+#include <map>
+#include <string>
+#include <vector>
+
 #include <osquery/events.h>
 
 namespace osquery {
 
+/**
+ * @brief A pull-mode subscription to a single Windows event log channel.
+ *
+ * The bookmark records the last event fired from the channel and is persisted
+ * so that a restarted publisher resumes after it.
+ */
+struct WindowsEventLogChannel {
+  /// The subscription, events are read in batches with EvtNext.
+  EVT_HANDLE subscription{nullptr};
+
+  /// The last event fired.
+  EVT_HANDLE bookmark{nullptr};
+
+  /// Signaled by the event log service when events are available.
+  HANDLE signal{nullptr};
+
+  /// Events fired since the bookmark was persisted.
+  size_t unsaved{0};
+};
+
 /**
  * @brief Subscription details for Windows Event Logs
  *
@@ -67,6 +91,9 @@ using WindowsEventLogSubscriptionContextRef =
  * Log channels, and make _no_ filter queries on the events returned by
  * the system, as any desired filtering should be handled at through SQL
  * queries.
+ *
+ * Each channel is read in batches by the publisher's run loop, and resumes
+ * after the last event fired when osquery restarts.
  */
 class WindowsEventLogEventPublisher
     : public EventPublisher<WindowsEventLogSubscriptionContext,
@@ -82,17 +109,18 @@ class WindowsEventLogEventPublisher
 
   void tearDown() override;
 
-  /// The calling for beginning the thread's run loop.
+  /// Wait for events from any channel and fire them in batches.
   Status run() override;
 
-  /// Windows Event Callback required for API calls
-  static unsigned long __stdcall winEventCallback(
-      EVT_SUBSCRIBE_NOTIFY_ACTION action, PVOID pContext, EVT_HANDLE hEvent);
-
   /// Helper function to convert an XML event blob into a property tree
   static Status parseEvent(EVT_HANDLE evt,
                            boost::property_tree::ptree& propTree);
 
+  /// Convert an event into a property tree, reusing a render buffer.
+  static Status parseEvent(EVT_HANDLE evt,
+                           std::vector<wchar_t>& buffer,
+                           boost::property_tree::ptree& propTree);
+
  private:
   /// Ensures that all Windows event log subscriptions are removed
   void stop() override;
@@ -100,9 +128,21 @@ class WindowsEventLogEventPublisher
   /// Returns whether or not the publisher has active subscriptions
   bool isSubscriptionActive() const;
 
+  /// Subscribe to a channel, after its persisted bookmark if one exists.
+  Status subscribe(const std::wstring& name, WindowsEventLogChannel& channel);
+
+  /// Fire the available events of a channel, returns the number fired.
+  size_t readChannel(WindowsEventLogChannel& channel);
+
+  /// Persist a channel's bookmark.
+  void saveBookmark(const std::wstring& name, WindowsEventLogChannel& channel);
+
  private:
-  /// Vector of all handles to windows event log publisher callbacks
-  std::vector<EVT_HANDLE> win_event_handles_;
+  /// Subscriptions by channel name.
+  std::map<std::wstring, WindowsEventLogChannel> channels_;
+
+  /// Scratch space for rendering events.
+  std::vector<wchar_t> render_buffer_;
 
  public:
   friend class WindowsEventLogTests;
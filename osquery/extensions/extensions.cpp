@@ -8,7 +8,10 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <chrono>
+#include <condition_variable>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <tuple>
@@ -73,6 +76,21 @@ CLI_FLAG(string,
 
 SHELL_FLAG(string, extension, "", "Path to a single extension to autoload");
 
+CLI_FLAG(uint64,
+         extensions_max_calls,
+         8,
+         "Maximum concurrent calls to each extension (0 is unlimited)");
+
+CLI_FLAG(uint64,
+         extensions_call_timeout,
+         300,
+         "Seconds to wait for an extension to respond to a call");
+
+CLI_FLAG(bool,
+         extensions_shared_memory,
+         false,
+         "Deliver extension log lines and events through shared memory");
+
 CLI_FLAG(string,
          extensions_require,
          "",
@@ -431,6 +449,16 @@ Status startExtension(const std::string& manager_path,
   info.sdk_version = sdk_version;
   info.min_sdk_version = min_sdk_version;
 
+  // Offer a ring for one-way calls, the core maps it while registering.
+  std::shared_ptr<SharedRing> ring;
+  if (FLAGS_extensions_shared_memory) {
+    auto name = "/osquery." + std::to_string(platformGetPid()) + "." +
+                std::to_string((uint16_t)rand());
+    if (SharedRing::create(name, kSharedRingSize, ring).ok()) {
+      info.shared_memory = name;
+    }
+  }
+
   // If registration is successful, we will also request the manager's options.
   InternalOptionList options;
   // Register the extension's registry broadcast with the manager.
@@ -451,6 +479,14 @@ Status startExtension(const std::string& manager_path,
     return Status(1, "Extension register failed: " + std::string(e.what()));
   }
 
+  if (ring != nullptr) {
+    // The core has mapped the ring, or will not use it.
+    ring->unlink();
+    if (options["extensions_shared_memory"].value == "true") {
+      Dispatcher::addService(std::make_shared<ExtensionRingRunner>(ring));
+    }
+  }
+
   // Now that the UUID is known, try to clean up stale socket paths.
   auto extension_path = getExtensionSocket(ext_status.uuid, manager_path);
 
@@ -596,6 +632,128 @@ Status getExtensions(const std::string& manager_path,
   return Status(0, "OK");
 }
 
+/// Calls made to an extension, and the calls holding one of its slots.
+struct ExtensionCallState {
+  ExtensionCalls calls;
+  size_t running{0};
+};
+
+/// Calls made to each extension.
+static std::map<RouteUUID, ExtensionCallState> kExtensionCalls;
+
+/// Protect the extension calls, and wake calls waiting for a slot.
+static std::mutex kExtensionCallsMutex;
+static std::condition_variable kExtensionCallsCV;
+
+/**
+ * @brief Limit and measure a call to an extension.
+ *
+ * Each extension serves up to --extensions_max_calls concurrent calls from
+ * this process, so a slow extension delays its own callers rather than
+ * accumulating connections and server threads. A call waits for a slot for
+ * up to --extensions_call_timeout, the latency includes the wait.
+ */
+class ExtensionCallScope : private boost::noncopyable {
+ public:
+  ExtensionCallScope(RouteUUID uuid,
+                     const std::string& registry,
+                     const std::string& item)
+      : uuid_(uuid),
+        name_(registry + "/" + item),
+        start_(std::chrono::steady_clock::now()) {
+    std::unique_lock<std::mutex> lock(kExtensionCallsMutex);
+    auto& state = kExtensionCalls[uuid_];
+    state.calls.active++;
+    if (FLAGS_extensions_max_calls > 0) {
+      acquired_ = kExtensionCallsCV.wait_for(
+          lock,
+          std::chrono::seconds(FLAGS_extensions_call_timeout),
+          [&state]() { return state.running < FLAGS_extensions_max_calls; });
+    }
+    if (acquired_) {
+      state.running++;
+    }
+  }
+
+  ~ExtensionCallScope() {
+    auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - start_)
+                       .count();
+    {
+      std::lock_guard<std::mutex> lock(kExtensionCallsMutex);
+      auto& state = kExtensionCalls[uuid_];
+      state.calls.active--;
+      state.calls.calls++;
+      state.calls.failures += (failed_) ? 1 : 0;
+      state.calls.latency[name_].add(static_cast<uint64_t>(latency));
+      if (acquired_) {
+        state.running--;
+      }
+    }
+
+    if (acquired_) {
+      kExtensionCallsCV.notify_all();
+    }
+  }
+
+  /// The call may be made, otherwise every slot stayed in use.
+  Status status() const {
+    return (acquired_) ? Status(0, "OK")
+                       : Status(1, "Extension call timed out: " + name_);
+  }
+
+  /// Record the result of the call, a call without a result failed.
+  void finish(const Status& status) {
+    failed_ = !status.ok();
+  }
+
+ private:
+  RouteUUID uuid_{0};
+  std::string name_;
+  std::chrono::steady_clock::time_point start_;
+  bool acquired_{true};
+  bool failed_{true};
+};
+
+bool getExtensionCalls(RouteUUID uuid, ExtensionCalls& calls) {
+  std::lock_guard<std::mutex> lock(kExtensionCallsMutex);
+  auto state = kExtensionCalls.find(uuid);
+  if (state == kExtensionCalls.end()) {
+    return false;
+  }
+  calls = state->second.calls;
+  return true;
+}
+
+/// Shared memory rings offered by extensions.
+static std::map<RouteUUID, std::shared_ptr<SharedRing>> kExtensionRings;
+
+/// Protect the extension rings.
+static Mutex kExtensionRingsMutex;
+
+Status attachExtensionRing(RouteUUID uuid, const std::string& name) {
+  std::shared_ptr<SharedRing> ring;
+  auto status = SharedRing::attach(name, ring);
+  if (status.ok()) {
+    WriteLock lock(kExtensionRingsMutex);
+    kExtensionRings[uuid] = ring;
+  }
+  return status;
+}
+
+void detachExtensionRing(RouteUUID uuid) {
+  WriteLock lock(kExtensionRingsMutex);
+  kExtensionRings.erase(uuid);
+}
+
+/// Log lines and events are one-way calls and may use an extension's ring.
+static bool isRingRequest(const std::string& registry,
+                          const PluginRequest& request) {
+  return registry == "logger" &&
+         (request.count("string") > 0 || request.count("snapshot") > 0 ||
+          request.count("event") > 0 || request.count("status") > 0);
+}
+
 Status callExtension(const RouteUUID uuid,
                      const std::string& registry,
                      const std::string& item,
@@ -604,8 +762,32 @@ Status callExtension(const RouteUUID uuid,
   if (FLAGS_disable_extensions) {
     return Status(1, "Extensions disabled");
   }
-  return callExtension(
-      getExtensionSocket(uuid), registry, item, request, response);
+
+  if (isRingRequest(registry, request)) {
+    std::shared_ptr<SharedRing> ring;
+    {
+      ReadLock lock(kExtensionRingsMutex);
+      auto it = kExtensionRings.find(uuid);
+      if (it != kExtensionRings.end()) {
+        ring = it->second;
+      }
+    }
+
+    // A full ring falls back to a socket call.
+    if (ring != nullptr &&
+        ring->write(serializeRingRequest(registry, item, request))) {
+      return Status(0, "OK");
+    }
+  }
+
+  ExtensionCallScope scope(uuid, registry, item);
+  auto status = scope.status();
+  if (status.ok()) {
+    status = callExtension(
+        getExtensionSocket(uuid), registry, item, request, response);
+    scope.finish(status);
+  }
+  return status;
 }
 
 Status callExtension(const std::string& extension_path,
@@ -621,7 +803,7 @@ Status callExtension(const std::string& extension_path,
 
   ExtensionResponse ext_response;
   try {
-    EXClient client(extension_path);
+    EXClient client(extension_path, FLAGS_extensions_call_timeout * 1000);
     client.get()->call(ext_response, registry, item, request);
   } catch (const std::exception& e) {
     return Status(1, "Extension call failed: " + std::string(e.what()));
@@ -636,6 +818,141 @@ Status callExtension(const std::string& extension_path,
   return Status(ext_response.status.code, ext_response.status.message);
 }
 
+/// Extensions that do not implement the typed rows cursor.
+static std::set<RouteUUID> kUntypedExtensions;
+
+/// Protect the set of extensions that do not implement typed rows.
+static Mutex kUntypedExtensionsMutex;
+
+/// Decode a batch of typed rows, and the cursor for the following batch.
+static Status readExtensionRows(const ExtensionRowsResponse& response,
+                                int64_t& cursor,
+                                TableRows& rows) {
+  cursor = 0;
+  if (response.status.code != ExtensionCode::EXT_SUCCESS) {
+    return Status(response.status.code, response.status.message);
+  } else if (response.rows < 0) {
+    return Status(1, "Invalid extension rows");
+  }
+
+  auto status = deserializeTableRows(
+      response.columns, static_cast<size_t>(response.rows), rows);
+  if (status.ok()) {
+    cursor = response.cursor;
+  }
+  return status;
+}
+
+ExtensionTableCursor::ExtensionTableCursor(RouteUUID uuid,
+                                           const std::string& table)
+    : uuid_(uuid), table_(table) {}
+
+ExtensionTableCursor::~ExtensionTableCursor() {
+  if (cursor_ == 0 || client_ == nullptr) {
+    return;
+  }
+
+  // Stop the extension's generator, the remaining rows are not read.
+  try {
+    ExtensionStatus status;
+    client_->get()->closeRows(status, cursor_);
+  } catch (const std::exception& /* e */) {
+    // The extension closes cursors that are not read.
+  }
+}
+
+Status ExtensionTableCursor::open(const PluginRequest& request,
+                                  TableRows& rows) {
+  if (FLAGS_disable_extensions) {
+    return Status(1, "Extensions disabled");
+  }
+
+  auto extension_path = getExtensionSocket(uuid_);
+  auto status = extensionPathActive(extension_path);
+  if (!status.ok()) {
+    return status;
+  }
+
+  ExtensionCallScope scope(uuid_, "table", table_);
+  status = scope.status();
+  if (status.ok()) {
+    status = openRows(extension_path, request, rows);
+    scope.finish(status);
+  }
+  return status;
+}
+
+Status ExtensionTableCursor::openRows(const std::string& extension_path,
+                                      const PluginRequest& request,
+                                      TableRows& rows) {
+  bool typed = false;
+  {
+    ReadLock lock(kUntypedExtensionsMutex);
+    typed = (kUntypedExtensions.count(uuid_) == 0);
+  }
+
+  if (typed) {
+    ExtensionRowsResponse response;
+    try {
+      client_ = std::make_unique<EXClient>(
+          extension_path, FLAGS_extensions_call_timeout * 1000);
+      client_->get()->openRows(response,
+                               table_,
+                               request,
+                               static_cast<int64_t>(kExtensionTableBatch));
+    } catch (const TApplicationException& e) {
+      client_ = nullptr;
+      if (e.getType() != TApplicationException::UNKNOWN_METHOD) {
+        return Status(1, "Extension call failed: " + std::string(e.what()));
+      }
+      // The extension's SDK predates typed rows.
+      WriteLock lock(kUntypedExtensionsMutex);
+      kUntypedExtensions.insert(uuid_);
+      typed = false;
+    } catch (const std::exception& e) {
+      client_ = nullptr;
+      return Status(1, "Extension call failed: " + std::string(e.what()));
+    }
+
+    if (typed) {
+      return readExtensionRows(response, cursor_, rows);
+    }
+  }
+
+  PluginResponse response;
+  auto status =
+      callExtension(extension_path, "table", table_, request, response);
+  if (status.ok()) {
+    for (const auto& row : response) {
+      rows.addRow(row);
+    }
+  }
+  return status;
+}
+
+Status ExtensionTableCursor::next(TableRows& rows) {
+  if (cursor_ == 0 || client_ == nullptr) {
+    return Status(0, "OK");
+  }
+
+  ExtensionCallScope scope(uuid_, "table", table_);
+  auto status = scope.status();
+  if (!status.ok()) {
+    return status;
+  }
+
+  ExtensionRowsResponse response;
+  try {
+    client_->get()->nextRows(response, cursor_);
+  } catch (const std::exception& e) {
+    cursor_ = 0;
+    return Status(1, "Extension call failed: " + std::string(e.what()));
+  }
+  status = readExtensionRows(response, cursor_, rows);
+  scope.finish(status);
+  return status;
+}
+
 Status startExtensionWatcher(const std::string& manager_path,
                              size_t interval,
                              bool fatal) {
@@ -16,8 +16,10 @@
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/registry.h>
 #include <osquery/system.h>
 
+#include "osquery/core/memory.h"
 #include "osquery/extensions/interface.h"
 
 using namespace osquery::extensions;
@@ -25,6 +27,12 @@ using namespace osquery::extensions;
 using chrono_clock = std::chrono::high_resolution_clock;
 
 namespace osquery {
+
+CLI_FLAG(uint64,
+         extensions_server_threads,
+         0,
+         "Threads serving extension API calls (0 is a thread per connection)");
+
 namespace extensions {
 
 const std::vector<std::string> kSDKVersionChanges = {
@@ -41,6 +49,8 @@ void ExtensionHandler::call(ExtensionResponse& _return,
                             const std::string& registry,
                             const std::string& item,
                             const ExtensionPluginRequest& request) {
+  MEMORY_TAG(EXTENSIONS);
+
   // Call will receive an extension or core's request to call the other's
   // internal registry call. It is the ONLY actor that resolves registry
   // item aliases.
@@ -70,6 +80,235 @@ void ExtensionHandler::call(ExtensionResponse& _return,
   }
 }
 
+/// Append a row of typed rows with the same columns to a batch.
+static void appendRow(const TableRows& from, size_t row, TableRows& to) {
+  to.addRow();
+  for (size_t i = 0; i < from.columns(); i++) {
+    const auto& cell = from.cell(row, i);
+    switch (cell.kind) {
+    case TableCell::Kind::Integer:
+      to.setInteger(i, cell.value.integer);
+      break;
+    case TableCell::Kind::Double:
+      to.setDouble(i, cell.value.real);
+      break;
+    case TableCell::Kind::Text:
+      to.setText(i, cell.value.text, cell.size);
+      break;
+    case TableCell::Kind::Null:
+      break;
+    }
+  }
+}
+
+bool readCursorRows(ExtensionRowsCursor& cursor, TableRows& batch) {
+  auto full = [&cursor, &batch]() {
+    return cursor.batch > 0 && batch.size() >= cursor.batch;
+  };
+
+  if (cursor.rows_generator != nullptr) {
+    // Each yielded batch is cleared before the generator is resumed.
+    auto& generator = *cursor.rows_generator;
+    while (generator && !full()) {
+      auto& rows = generator.get();
+      if (cursor.row < rows.size()) {
+        appendRow(rows, cursor.row++, batch);
+        continue;
+      }
+      rows.clear();
+      cursor.row = 0;
+      generator();
+    }
+    return static_cast<bool>(generator);
+  }
+
+  if (cursor.generator != nullptr) {
+    auto& generator = *cursor.generator;
+    while (generator && !full()) {
+      batch.addRow(generator.get());
+      generator();
+    }
+    return static_cast<bool>(generator);
+  }
+
+  if (cursor.plugin->usesTypedRows()) {
+    while (cursor.row < cursor.rows.size() && !full()) {
+      appendRow(cursor.rows, cursor.row++, batch);
+    }
+    return cursor.row < cursor.rows.size();
+  }
+
+  while (cursor.row < cursor.data.size() && !full()) {
+    batch.addRow(cursor.data[cursor.row++]);
+  }
+  return cursor.row < cursor.data.size();
+}
+
+void ExtensionHandler::openRows(ExtensionRowsResponse& _return,
+                                const std::string& table,
+                                const ExtensionPluginRequest& request,
+                                const int64_t batch) {
+  _return.status.uuid = uuid_;
+  _return.cursor = 0;
+  auto local_item = RegistryFactory::get().getAlias("table", table);
+  if (!RegistryFactory::get().exists("table", local_item, true)) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "Cannot call registry item: " + table;
+    return;
+  }
+
+  expireCursors();
+  {
+    ReadLock lock(cursors_mutex_);
+    if (cursors_.size() >= kExtensionMaxCursors) {
+      _return.status.code = ExtensionCode::EXT_FAILED;
+      _return.status.message = "Too many open cursors";
+      return;
+    }
+  }
+
+  auto plugin = std::dynamic_pointer_cast<TablePlugin>(
+      RegistryFactory::get().plugin("table", local_item));
+  auto cursor = std::make_shared<ExtensionRowsCursor>(plugin->columns());
+  cursor->plugin = plugin;
+  cursor->batch = (batch > 0) ? static_cast<size_t>(batch) : 0;
+  cursor->read = std::chrono::steady_clock::now();
+  PluginRequest plugin_request(request.begin(), request.end());
+  if (plugin_request.count("context") > 0) {
+    TablePlugin::setContextFromRequest(plugin_request, cursor->context);
+  }
+
+  // Generators start, and run until their first yield, as the cursor opens.
+  auto* state = cursor.get();
+  try {
+    if (plugin->usesTypedRows() && plugin->usesGenerator()) {
+      state->rows_generator = std::make_unique<TableRowsGenerator::pull_type>(
+          [state](TableRowsYield& yield) {
+            state->plugin->rowsGenerator(yield, state->rows, state->context);
+            if (!state->rows.empty()) {
+              yield(state->rows);
+            }
+          });
+    } else if (plugin->usesTypedRows()) {
+      plugin->generateRows(state->rows, state->context);
+    } else if (plugin->usesGenerator()) {
+      state->generator = std::make_unique<RowGenerator::pull_type>(
+          [state](RowYield& yield) {
+            state->plugin->generator(yield, state->context);
+          });
+    } else {
+      state->data = plugin->generate(state->context);
+    }
+  } catch (const std::exception& e) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = e.what();
+    return;
+  }
+
+  int64_t id = 0;
+  {
+    WriteLock lock(cursors_mutex_);
+    id = next_cursor_++;
+    cursors_[id] = cursor;
+  }
+  readRows(_return, id, cursor);
+}
+
+void ExtensionHandler::nextRows(ExtensionRowsResponse& _return,
+                                const int64_t cursor) {
+  _return.status.uuid = uuid_;
+  _return.cursor = 0;
+  std::shared_ptr<ExtensionRowsCursor> state;
+  {
+    ReadLock lock(cursors_mutex_);
+    auto it = cursors_.find(cursor);
+    if (it != cursors_.end()) {
+      state = it->second;
+    }
+  }
+
+  if (state == nullptr) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "No open cursor";
+    return;
+  }
+  readRows(_return, cursor, state);
+}
+
+void ExtensionHandler::closeRows(ExtensionStatus& _return,
+                                 const int64_t cursor) {
+  std::shared_ptr<ExtensionRowsCursor> state;
+  {
+    WriteLock lock(cursors_mutex_);
+    auto it = cursors_.find(cursor);
+    if (it != cursors_.end()) {
+      state = it->second;
+      cursors_.erase(it);
+    }
+  }
+
+  // Destroying a generator unwinds it, stopping the table's generation.
+  if (state != nullptr) {
+    WriteLock lock(state->mutex);
+    state->rows_generator = nullptr;
+    state->generator = nullptr;
+  }
+  _return.code = ExtensionCode::EXT_SUCCESS;
+  _return.message = "OK";
+  _return.uuid = uuid_;
+}
+
+void ExtensionHandler::readRows(
+    ExtensionRowsResponse& _return,
+    int64_t id,
+    const std::shared_ptr<ExtensionRowsCursor>& cursor) {
+  bool more = false;
+  bool failed = false;
+  TableRows batch(cursor->plugin->columns());
+  try {
+    WriteLock lock(cursor->mutex);
+    cursor->read = std::chrono::steady_clock::now();
+    more = readCursorRows(*cursor, batch);
+  } catch (const std::exception& e) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = e.what();
+    failed = true;
+  }
+
+  if (!more || failed) {
+    WriteLock lock(cursors_mutex_);
+    cursors_.erase(id);
+  }
+
+  if (failed) {
+    return;
+  }
+
+  serializeTableRows(batch, _return.columns);
+  _return.rows = static_cast<int64_t>(batch.size());
+  _return.cursor = (more) ? id : 0;
+  _return.status.code = ExtensionCode::EXT_SUCCESS;
+  _return.status.message = "OK";
+}
+
+void ExtensionHandler::expireCursors() {
+  auto now = std::chrono::steady_clock::now();
+  auto timeout = std::chrono::seconds(kExtensionCursorTimeout);
+  // Expired generators are unwound after the cursors are unlocked.
+  std::vector<std::shared_ptr<ExtensionRowsCursor>> expired;
+  {
+    WriteLock lock(cursors_mutex_);
+    for (auto it = cursors_.begin(); it != cursors_.end();) {
+      if (now - it->second->read > timeout) {
+        expired.push_back(it->second);
+        it = cursors_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
 void ExtensionHandler::shutdown() {
   // Request a graceful shutdown of the Thrift listener.
   VLOG(1) << "Extension " << uuid_ << " requested shutdown";
@@ -151,6 +390,15 @@ void ExtensionManagerHandler::registerExtension(
     return;
   }
 
+  if (FLAGS_extensions_shared_memory && !info.shared_memory.empty()) {
+    // The extension's socket remains available if the ring is not.
+    status = attachExtensionRing(uuid, info.shared_memory);
+    if (!status.ok()) {
+      VLOG(1) << "Extension " << info.name
+              << " shared memory unavailable: " << status.getMessage();
+    }
+  }
+
   WriteLock lock(extensions_mutex_);
   extensions_[uuid] = info;
   _return.code = ExtensionCode::EXT_SUCCESS;
@@ -172,6 +420,7 @@ void ExtensionManagerHandler::deregisterExtension(
 
   // On success return the uuid of the now de-registered extension.
   RegistryFactory::get().removeBroadcast(uuid);
+  detachExtensionRing(uuid);
 
   WriteLock lock(extensions_mutex_);
   extensions_.erase(uuid);
@@ -225,6 +474,7 @@ void ExtensionManagerHandler::refresh() {
   // Remove each from the manager's list of extension metadata.
   for (const auto& uuid : removed_routes) {
     extensions_.erase(uuid);
+    detachExtensionRing(uuid);
   }
 }
 
@@ -240,6 +490,98 @@ bool ExtensionManagerHandler::exists(const std::string& name) {
   }
   return false;
 }
+
+void serializeTableRows(const TableRows& rows,
+                        std::vector<ExtensionColumn>& columns) {
+  columns.resize(rows.columns());
+  for (size_t i = 0; i < rows.columns(); i++) {
+    auto& column = columns[i];
+    column.name = rows.name(i);
+    column.kinds.resize(rows.size());
+    for (size_t row = 0; row < rows.size(); row++) {
+      const auto& cell = rows.cell(row, i);
+      column.kinds[row] = static_cast<char>(cell.kind);
+      switch (cell.kind) {
+      case TableCell::Kind::Integer:
+        column.integers.push_back(cell.value.integer);
+        break;
+      case TableCell::Kind::Double:
+        column.doubles.push_back(cell.value.real);
+        break;
+      case TableCell::Kind::Text:
+        column.texts.emplace_back(cell.value.text, cell.size);
+        break;
+      case TableCell::Kind::Null:
+        break;
+      }
+    }
+  }
+}
+
+Status deserializeTableRows(const std::vector<ExtensionColumn>& columns,
+                            size_t count,
+                            TableRows& rows) {
+  // Map each response column to a column of the rows, and validate the sizes.
+  std::vector<size_t> indexes;
+  for (const auto& column : columns) {
+    if (column.kinds.size() != count) {
+      return Status(1, "Invalid column: " + column.name);
+    }
+
+    size_t integers = 0;
+    size_t doubles = 0;
+    size_t texts = 0;
+    for (auto kind : column.kinds) {
+      auto cell_kind = static_cast<TableCell::Kind>(kind);
+      integers += (cell_kind == TableCell::Kind::Integer) ? 1 : 0;
+      doubles += (cell_kind == TableCell::Kind::Double) ? 1 : 0;
+      texts += (cell_kind == TableCell::Kind::Text) ? 1 : 0;
+    }
+    if (integers != column.integers.size() ||
+        doubles != column.doubles.size() || texts != column.texts.size()) {
+      return Status(1, "Invalid column: " + column.name);
+    }
+    indexes.push_back(rows.column(column.name));
+  }
+
+  // Each column is read using its own position within the values of a kind.
+  std::vector<size_t> integers(columns.size(), 0);
+  std::vector<size_t> doubles(columns.size(), 0);
+  std::vector<size_t> texts(columns.size(), 0);
+  for (size_t row = 0; row < count; row++) {
+    rows.addRow();
+    for (size_t i = 0; i < columns.size(); i++) {
+      const auto& column = columns[i];
+      auto index = indexes[i];
+      switch (static_cast<TableCell::Kind>(column.kinds[row])) {
+      case TableCell::Kind::Integer: {
+        auto value = column.integers[integers[i]++];
+        if (index != TableRows::kInvalidColumn) {
+          rows.setInteger(index, value);
+        }
+        break;
+      }
+      case TableCell::Kind::Double: {
+        auto value = column.doubles[doubles[i]++];
+        if (index != TableRows::kInvalidColumn) {
+          rows.setDouble(index, value);
+        }
+        break;
+      }
+      case TableCell::Kind::Text: {
+        const auto& value = column.texts[texts[i]++];
+        if (index != TableRows::kInvalidColumn) {
+          rows.setText(index, value.data(), value.size());
+        }
+        break;
+      }
+      default:
+        break;
+      }
+    }
+  }
+  return Status(0, "OK");
+}
 } // namespace extensions
 
 ExtensionRunner::ExtensionRunner(const std::string& manager_path,
@@ -297,8 +639,18 @@ void ExtensionRunnerCore::startServer(TProcessorRef processor) {
     auto protocol_fac = TProtocolFactoryRef(new TBinaryProtocolFactory());
 
     // Start the Thrift server's run loop.
-    server_ = TThreadedServerRef(new TThreadedServer(
-        processor, transport_, transport_fac, protocol_fac));
+    if (FLAGS_extensions_server_threads > 0) {
+      // Each connection, usually a single call, is served by a pool thread.
+      auto threads = ThreadManager::newSimpleThreadManager(
+          static_cast<size_t>(FLAGS_extensions_server_threads));
+      threads->threadFactory(std::make_shared<PlatformThreadFactory>());
+      threads->start();
+      server_ = TServerRef(new TThreadPoolServer(
+          processor, transport_, transport_fac, protocol_fac, threads));
+    } else {
+      server_ = TServerRef(new TThreadedServer(
+          processor, transport_, transport_fac, protocol_fac));
+    }
   }
 
   server_->serve();
@@ -322,6 +674,35 @@ void ExtensionRunner::start() {
   }
 }
 
+void ExtensionRingRunner::start() {
+  std::vector<std::string> messages;
+  while (!interrupted()) {
+    messages.clear();
+    if (ring_->read(messages, kSharedRingBatch) == 0) {
+      pauseMilli(kExtensionRingInterval);
+      continue;
+    }
+
+    for (const auto& message : messages) {
+      std::string registry;
+      std::string item;
+      PluginRequest request;
+      if (!deserializeRingRequest(message, registry, item, request)) {
+        continue;
+      }
+
+      // Resolve item aliases the same as ExtensionHandler::call.
+      auto local_item = RegistryFactory::get().getAlias(registry, item);
+      if (local_item.empty()) {
+        local_item = RegistryFactory::get().getActive(registry);
+      }
+
+      PluginResponse response;
+      RegistryFactory::call(registry, local_item, request, response);
+    }
+  }
+}
+
 ExtensionManagerRunner::~ExtensionManagerRunner() {
   // Only attempt to remove stale paths if the server was started.
   WriteLock lock(service_start_);
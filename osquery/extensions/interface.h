@@ -10,8 +10,12 @@
 
 #pragma once
 
+#include <chrono>
+#include <map>
+
 #include <osquery/dispatcher.h>
 #include <osquery/extensions.h>
+#include <osquery/tables.h>
 
 #ifdef WIN32
 #pragma warning(push, 3)
@@ -27,6 +31,7 @@
 #endif
 
 #include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/server/TThreadPoolServer.h>
 #include <thrift/server/TThreadedServer.h>
 
 #ifdef WIN32
@@ -37,6 +42,7 @@
 #include <thrift/transport/TSocket.h>
 #endif
 
+#include <thrift/concurrency/PlatformThreadFactory.h>
 #include <thrift/concurrency/ThreadManager.h>
 #include <thrift/transport/TBufferTransports.h>
 
@@ -44,6 +50,8 @@
 #include "Extension.h"
 #include "ExtensionManager.h"
 
+#include "osquery/extensions/shared_ring.h"
+
 namespace osquery {
 
 using namespace apache::thrift;
@@ -71,10 +79,52 @@ typedef std::shared_ptr<TTransportFactory> TTransportFactoryRef;
 typedef std::shared_ptr<TProtocolFactory> TProtocolFactoryRef;
 typedef std::shared_ptr<ThreadManager> TThreadManagerRef;
 
-using TThreadedServerRef = std::shared_ptr<TThreadedServer>;
+using TServerRef = std::shared_ptr<TServerFramework>;
 
 namespace extensions {
 
+/// Cursors not read for this many seconds are closed by the extension.
+const size_t kExtensionCursorTimeout = 60;
+
+/// The maximum number of cursors open within an extension.
+const size_t kExtensionMaxCursors = 64;
+
+/// A table plugin generating rows for an open cursor.
+struct ExtensionRowsCursor : private boost::noncopyable {
+  explicit ExtensionRowsCursor(const TableColumns& columns) : rows(columns) {}
+
+  std::shared_ptr<TablePlugin> plugin;
+  QueryContext context;
+
+  /// The maximum rows of each batch, 0 if unlimited.
+  size_t batch{0};
+
+  /// Materialized rows, or the current batch yielded by a typed generator.
+  TableRows rows;
+
+  /// The position within rows.
+  size_t row{0};
+
+  /// Generated rows of a table that does not use typed rows.
+  QueryData data;
+
+  std::unique_ptr<TableRowsGenerator::pull_type> rows_generator{nullptr};
+  std::unique_ptr<RowGenerator::pull_type> generator{nullptr};
+
+  /// The last time the cursor was read.
+  std::chrono::steady_clock::time_point read;
+
+  /// A cursor is read by a single request at a time.
+  Mutex mutex;
+};
+
+/**
+ * @brief Fill a batch from an open cursor.
+ *
+ * @return true if the cursor has more rows.
+ */
+bool readCursorRows(ExtensionRowsCursor& cursor, TableRows& batch);
+
 /**
  * @brief The Thrift API server used by an osquery Extension process.
  *
@@ -107,9 +157,52 @@ class ExtensionHandler : virtual public ExtensionIf {
   /// Request an extension to shutdown.
   virtual void shutdown() override;
 
+  /**
+   * @brief Start generating a local table plugin's rows as typed columns.
+   *
+   * Unlike a table plugin call, each column name is sent once and integer and
+   * double values are not converted to and from strings. If the table has
+   * more rows than a batch, a cursor is kept to read the following batches,
+   * and generator tables are resumed only as batches are read.
+   *
+   * @param _return The return status, first batch, and cursor.
+   * @param table The table plugin name.
+   * @param request The table plugin request, a "generate" action.
+   * @param batch The maximum rows of each batch, 0 if unlimited.
+   */
+  void openRows(ExtensionRowsResponse& _return,
+                const std::string& table,
+                const ExtensionPluginRequest& request,
+                const int64_t batch) override;
+
+  /// Return the next batch of an open cursor.
+  void nextRows(ExtensionRowsResponse& _return, const int64_t cursor) override;
+
+  /// Close a cursor, stopping its table generator.
+  void closeRows(ExtensionStatus& _return, const int64_t cursor) override;
+
+ private:
+  /// Fill a response with the next batch of a cursor, closing it when read.
+  void readRows(ExtensionRowsResponse& _return,
+                int64_t id,
+                const std::shared_ptr<ExtensionRowsCursor>& cursor);
+
+  /// Close the cursors that are not read within kExtensionCursorTimeout.
+  void expireCursors();
+
  protected:
   /// Transient UUID assigned to the extension after registering.
   std::atomic<RouteUUID> uuid_;
+
+ private:
+  /// Open cursors by ID.
+  std::map<int64_t, std::shared_ptr<ExtensionRowsCursor>> cursors_;
+
+  /// The ID of the next cursor.
+  int64_t next_cursor_{1};
+
+  /// Protect the open cursors.
+  Mutex cursors_mutex_;
 };
 
 /**
@@ -223,6 +316,20 @@ class ExtensionManagerHandler : virtual public ExtensionManagerIf,
 
 typedef std::shared_ptr<ExtensionHandler> ExtensionHandlerRef;
 typedef std::shared_ptr<ExtensionManagerHandler> ExtensionManagerHandlerRef;
+
+/// Encode typed rows as the columns of an ExtensionRowsResponse.
+void serializeTableRows(const TableRows& rows,
+                        std::vector<ExtensionColumn>& columns);
+
+/**
+ * @brief Decode the columns of an ExtensionRowsResponse into typed rows.
+ *
+ * Columns are matched to the rows' columns by name, unknown columns are
+ * ignored and missing columns are NULL.
+ */
+Status deserializeTableRows(const std::vector<ExtensionColumn>& columns,
+                            size_t count,
+                            TableRows& rows);
 }
 
 /// A Dispatcher service thread that watches an ExtensionManagerHandler.
@@ -292,7 +399,7 @@ class ExtensionRunnerCore : public InternalRunnable {
   TServerTransportRef transport_{nullptr};
 
   /// Server instance, will be stopped if thread service is removed.
-  TThreadedServerRef server_{nullptr};
+  TServerRef server_{nullptr};
 
   /// Protect the service start and stop, this mutex protects server creation.
   Mutex service_start_;
@@ -341,6 +448,39 @@ class ExtensionManagerRunner : public ExtensionRunnerCore {
   void start() override;
 };
 
+/// Milliseconds an extension waits before reading an empty ring again.
+const size_t kExtensionRingInterval = 20;
+
+/**
+ * @brief A Dispatcher service thread that reads an extension's ring.
+ *
+ * An extension that offered a shared memory ring when registering receives
+ * one-way registry calls, such as log lines and events, from the ring in
+ * batches rather than as individual socket requests.
+ */
+class ExtensionRingRunner : public InternalRunnable {
+ public:
+  explicit ExtensionRingRunner(std::shared_ptr<SharedRing> ring)
+      : InternalRunnable("ExtensionRingRunner"), ring_(std::move(ring)) {}
+
+ public:
+  void start() override;
+
+ private:
+  std::shared_ptr<SharedRing> ring_;
+};
+
+/**
+ * @brief Map the ring an extension offered when registering.
+ *
+ * One-way calls to the extension are written to the ring while it has room,
+ * and use the extension's socket otherwise.
+ */
+Status attachExtensionRing(RouteUUID uuid, const std::string& name);
+
+/// Release the ring of an extension that was removed.
+void detachExtensionRing(RouteUUID uuid);
+
 /// Internal accessor for extension clients.
 class EXInternal : private boost::noncopyable {
  public:
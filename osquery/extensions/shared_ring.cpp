@@ -0,0 +1,261 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "osquery/extensions/shared_ring.h"
+
+namespace osquery {
+
+/// Identifies a mapped ring, and its layout.
+const uint64_t kSharedRingMagic = 0x6f73717279726e31ULL;
+
+/// Each message is prefixed with its size.
+using RingSize = uint32_t;
+
+/**
+ * @brief The start of a ring's shared memory, followed by the data.
+ *
+ * Positions count bytes written and read since the ring was created, and
+ * are reduced modulo the capacity to index the data.
+ */
+struct SharedRing::Header {
+  uint64_t magic;
+  uint64_t capacity;
+  std::atomic<uint64_t> head;
+  std::atomic<uint64_t> tail;
+};
+
+SharedRing::~SharedRing() {
+#ifndef WIN32
+  if (header_ != nullptr) {
+    ::munmap(header_, mapped_);
+  }
+#endif
+  unlink();
+}
+
+Status SharedRing::create(const std::string& name,
+                          size_t size,
+                          std::shared_ptr<SharedRing>& ring) {
+#ifndef WIN32
+  auto fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    return Status(1, "Cannot create shared memory " + name);
+  }
+
+  ring = std::shared_ptr<SharedRing>(new SharedRing(name, true));
+  auto status = ring->map(fd, sizeof(Header) + size, true);
+  ::close(fd);
+  if (!status.ok()) {
+    ring = nullptr;
+  }
+  return status;
+#else
+  return Status(1, "Shared memory rings are not supported");
+#endif
+}
+
+Status SharedRing::attach(const std::string& name,
+                          std::shared_ptr<SharedRing>& ring) {
+#ifndef WIN32
+  auto fd = ::shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    return Status(1, "Cannot open shared memory " + name);
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size <= (off_t)sizeof(Header)) {
+    ::close(fd);
+    return Status(1, "Invalid shared memory size " + name);
+  }
+
+  ring = std::shared_ptr<SharedRing>(new SharedRing(name, false));
+  auto status = ring->map(fd, static_cast<size_t>(st.st_size), false);
+  ::close(fd);
+  if (!status.ok()) {
+    ring = nullptr;
+  }
+  return status;
+#else
+  return Status(1, "Shared memory rings are not supported");
+#endif
+}
+
+Status SharedRing::map(int fd, size_t size, bool create) {
+#ifndef WIN32
+  if (create && ::ftruncate(fd, size) != 0) {
+    return Status(1, "Cannot size shared memory " + name_);
+  }
+
+  auto memory =
+      ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (memory == MAP_FAILED) {
+    return Status(1, "Cannot map shared memory " + name_);
+  }
+
+  header_ = static_cast<Header*>(memory);
+  data_ = static_cast<char*>(memory) + sizeof(Header);
+  mapped_ = size;
+  capacity_ = size - sizeof(Header);
+  if (create) {
+    header_->capacity = capacity_;
+    header_->head = 0;
+    header_->tail = 0;
+    header_->magic = kSharedRingMagic;
+  } else if (header_->magic != kSharedRingMagic ||
+             header_->capacity != capacity_) {
+    return Status(1, "Invalid shared memory ring " + name_);
+  }
+  return Status(0, "OK");
+#else
+  return Status(1, "Shared memory rings are not supported");
+#endif
+}
+
+void SharedRing::copyIn(uint64_t position, const void* data, size_t size) {
+  auto offset = position % capacity_;
+  auto first = std::min(size, capacity_ - offset);
+  memcpy(data_ + offset, data, first);
+  memcpy(data_, static_cast<const char*>(data) + first, size - first);
+}
+
+void SharedRing::copyOut(uint64_t position, void* data, size_t size) const {
+  auto offset = position % capacity_;
+  auto first = std::min(size, capacity_ - offset);
+  memcpy(data, data_ + offset, first);
+  memcpy(static_cast<char*>(data) + first, data_, size - first);
+}
+
+bool SharedRing::write(const std::string& message) {
+  if (header_ == nullptr) {
+    return false;
+  }
+
+  size_t needed = sizeof(RingSize) + message.size();
+  WriteLock lock(write_mutex_);
+  auto head = header_->head.load(std::memory_order_relaxed);
+  auto tail = header_->tail.load(std::memory_order_acquire);
+  if (head < tail || head - tail > capacity_ ||
+      capacity_ - (head - tail) < needed) {
+    return false;
+  }
+
+  auto size = static_cast<RingSize>(message.size());
+  copyIn(head, &size, sizeof(size));
+  copyIn(head + sizeof(size), message.data(), message.size());
+  header_->head.store(head + needed, std::memory_order_release);
+  return true;
+}
+
+size_t SharedRing::read(std::vector<std::string>& messages, size_t max) {
+  if (header_ == nullptr) {
+    return 0;
+  }
+
+  auto tail = header_->tail.load(std::memory_order_relaxed);
+  auto head = header_->head.load(std::memory_order_acquire);
+  size_t count = 0;
+  while (count < max && head - tail >= sizeof(RingSize)) {
+    RingSize size = 0;
+    copyOut(tail, &size, sizeof(size));
+    if (size > head - tail - sizeof(size)) {
+      // The writer never publishes a partial message, drop the ring content.
+      tail = head;
+      break;
+    }
+
+    std::string message(size, '\0');
+    copyOut(tail + sizeof(size), &message[0], size);
+    messages.push_back(std::move(message));
+    tail += sizeof(size) + size;
+    count++;
+  }
+  header_->tail.store(tail, std::memory_order_release);
+  return count;
+}
+
+void SharedRing::unlink() {
+#ifndef WIN32
+  if (owner_) {
+    ::shm_unlink(name_.c_str());
+    owner_ = false;
+  }
+#endif
+}
+
+static void appendRingString(std::string& message, const std::string& value) {
+  auto size = static_cast<RingSize>(value.size());
+  message.append(reinterpret_cast<const char*>(&size), sizeof(size));
+  message.append(value);
+}
+
+static bool readRingString(const std::string& message,
+                           size_t& offset,
+                           std::string& value) {
+  RingSize size = 0;
+  if (message.size() - offset < sizeof(size)) {
+    return false;
+  }
+  memcpy(&size, message.data() + offset, sizeof(size));
+  offset += sizeof(size);
+  if (message.size() - offset < size) {
+    return false;
+  }
+  value = message.substr(offset, size);
+  offset += size;
+  return true;
+}
+
+std::string serializeRingRequest(const std::string& registry,
+                                 const std::string& item,
+                                 const PluginRequest& request) {
+  std::string message;
+  appendRingString(message, registry);
+  appendRingString(message, item);
+  for (const auto& field : request) {
+    appendRingString(message, field.first);
+    appendRingString(message, field.second);
+  }
+  return message;
+}
+
+bool deserializeRingRequest(const std::string& message,
+                            std::string& registry,
+                            std::string& item,
+                            PluginRequest& request) {
+  size_t offset = 0;
+  if (!readRingString(message, offset, registry) ||
+      !readRingString(message, offset, item)) {
+    return false;
+  }
+
+  while (offset < message.size()) {
+    std::string key;
+    std::string value;
+    if (!readRingString(message, offset, key) ||
+        !readRingString(message, offset, value)) {
+      return false;
+    }
+    request[key] = std::move(value);
+  }
+  return true;
+}
+} // namespace osquery
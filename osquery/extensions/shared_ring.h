@@ -0,0 +1,112 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/registry.h>
+
+namespace osquery {
+
+/// The data size of the ring an extension offers to the core.
+const size_t kSharedRingSize = 4 * 1024 * 1024;
+
+/// The most messages delivered from a ring with each read.
+const size_t kSharedRingBatch = 512;
+
+/**
+ * @brief A single-writer, single-reader message ring in shared memory.
+ *
+ * An extension creates a ring and names it when registering, the core maps
+ * the ring and writes one-way requests, such as log lines and events, that
+ * would otherwise each be a socket round trip. The extension reads messages
+ * in batches.
+ *
+ * The writer only trusts the ring's size, read and write positions are
+ * checked before each write, so a misbehaving reader can drop messages but
+ * cannot cause the writer to access memory outside of the ring.
+ */
+class SharedRing : private boost::noncopyable {
+ public:
+  ~SharedRing();
+
+  /// Create and map a new ring, used by the reader.
+  static Status create(const std::string& name,
+                       size_t size,
+                       std::shared_ptr<SharedRing>& ring);
+
+  /// Map an existing ring, used by the writer.
+  static Status attach(const std::string& name,
+                       std::shared_ptr<SharedRing>& ring);
+
+  /**
+   * @brief Append a message.
+   *
+   * @return false if the ring does not have room for the message.
+   */
+  bool write(const std::string& message);
+
+  /// Remove up to max messages, returns the number read.
+  size_t read(std::vector<std::string>& messages, size_t max);
+
+  /// Remove the ring's name once the writer has mapped it.
+  void unlink();
+
+  const std::string& name() const {
+    return name_;
+  }
+
+ private:
+  struct Header;
+
+  SharedRing(const std::string& name, bool owner)
+      : name_(name), owner_(owner) {}
+
+  /// Map a shared memory object, initializing the header if created.
+  Status map(int fd, size_t size, bool create);
+
+  /// Copy between a ring position and a buffer, wrapping at the end.
+  void copyIn(uint64_t position, const void* data, size_t size);
+  void copyOut(uint64_t position, void* data, size_t size) const;
+
+ private:
+  std::string name_;
+
+  /// The reader created the ring and removes its name.
+  bool owner_{false};
+
+  Header* header_{nullptr};
+  char* data_{nullptr};
+  size_t capacity_{0};
+  size_t mapped_{0};
+
+  /// Serialize writes from multiple threads within the writer.
+  Mutex write_mutex_;
+};
+
+/// Encode a registry call for a ring.
+std::string serializeRingRequest(const std::string& registry,
+                                 const std::string& item,
+                                 const PluginRequest& request);
+
+/// Decode a registry call written by serializeRingRequest.
+bool deserializeRingRequest(const std::string& message,
+                            std::string& registry,
+                            std::string& item,
+                            PluginRequest& request);
+} // namespace osquery
@@ -172,6 +172,102 @@ TEST_F(ExtensionsTest, test_extension_start) {
   rf.allowDuplicates(false);
 }
 
+TEST_F(ExtensionsTest, test_table_rows_columns) {
+  TableColumns columns = {
+      std::make_tuple("name", TEXT_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("size", BIGINT_TYPE, ColumnOptions::DEFAULT),
+      std::make_tuple("ratio", DOUBLE_TYPE, ColumnOptions::DEFAULT),
+  };
+
+  TableRows rows(columns);
+  rows.addRow({{"name", "first"}, {"size", "10"}, {"ratio", "0.5"}});
+  rows.addRow({{"name", "second"}, {"size", "invalid"}});
+
+  std::vector<ExtensionColumn> encoded;
+  serializeTableRows(rows, encoded);
+  ASSERT_EQ(encoded.size(), 3U);
+  EXPECT_EQ(encoded[1].name, "size");
+  EXPECT_EQ(encoded[1].integers.size(), 1U);
+
+  // Columns are matched by name, the order may differ from the response.
+  TableColumns reordered = {columns[2], columns[0], columns[1]};
+  TableRows decoded(reordered);
+  auto status = deserializeTableRows(encoded, rows.size(), decoded);
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(decoded.size(), 2U);
+  EXPECT_EQ(decoded.toRow(0), rows.toRow(0));
+  EXPECT_EQ(decoded.toRow(1), rows.toRow(1));
+  EXPECT_EQ(decoded.cell(1, 2).kind, TableCell::Kind::Null);
+
+  // A column whose values do not match its kinds is rejected.
+  encoded[1].integers.clear();
+  TableRows invalid(columns);
+  EXPECT_FALSE(deserializeTableRows(encoded, rows.size(), invalid).ok());
+}
+
+class CursorTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {std::make_tuple("value", INTEGER_TYPE, ColumnOptions::DEFAULT)};
+  }
+
+  bool usesGenerator() const override {
+    return true;
+  }
+
+  void generator(RowYield& yield, QueryContext& context) override {
+    for (size_t i = 0; i < 10; i++) {
+      generated++;
+      Row r = {{"value", INTEGER(i)}};
+      yield(r);
+    }
+  }
+
+ public:
+  size_t generated{0};
+};
+
+TEST_F(ExtensionsTest, test_table_rows_cursor) {
+  auto plugin = std::make_shared<CursorTablePlugin>();
+  auto registry = RegistryFactory::get().registry("table");
+  registry->add("cursor_test", plugin);
+
+  // The first batch is returned with a cursor for the following batches.
+  ExtensionHandler handler;
+  ExtensionRowsResponse response;
+  handler.openRows(response, "cursor_test", {{"action", "generate"}}, 4);
+  ASSERT_EQ(response.status.code, ExtensionCode::EXT_SUCCESS);
+  EXPECT_EQ(response.rows, 4);
+  EXPECT_NE(response.cursor, 0);
+  auto cursor = response.cursor;
+
+  ExtensionRowsResponse next;
+  handler.nextRows(next, cursor);
+  ASSERT_EQ(next.status.code, ExtensionCode::EXT_SUCCESS);
+  EXPECT_EQ(next.rows, 4);
+  ASSERT_EQ(next.columns.size(), 1U);
+  EXPECT_EQ(next.columns[0].integers[0], 4);
+
+  // Closing the cursor stops the generator before the remaining rows.
+  ExtensionStatus status;
+  handler.closeRows(status, cursor);
+  EXPECT_EQ(status.code, ExtensionCode::EXT_SUCCESS);
+  EXPECT_LT(plugin->generated, 10U);
+
+  ExtensionRowsResponse closed;
+  handler.nextRows(closed, cursor);
+  EXPECT_EQ(closed.status.code, ExtensionCode::EXT_FAILED);
+
+  // A cursor is not kept if every row fits within the batch.
+  ExtensionRowsResponse all;
+  handler.openRows(all, "cursor_test", {{"action", "generate"}}, 0);
+  ASSERT_EQ(all.status.code, ExtensionCode::EXT_SUCCESS);
+  EXPECT_EQ(all.rows, 10);
+  EXPECT_EQ(all.cursor, 0);
+
+  registry->remove("cursor_test");
+}
+
 class ExtensionPlugin : public Plugin {
  public:
   Status call(const PluginRequest& request, PluginResponse& response) {
@@ -186,6 +282,53 @@ class TestExtensionPlugin : public ExtensionPlugin {};
 
 CREATE_REGISTRY(ExtensionPlugin, "extension_test");
 
+#ifndef WIN32
+TEST_F(ExtensionsTest, test_shared_ring) {
+  auto name = "/osquery.test." + std::to_string(platformGetPid());
+  std::shared_ptr<SharedRing> reader;
+  ASSERT_TRUE(SharedRing::create(name, 64, reader).ok());
+
+  std::shared_ptr<SharedRing> writer;
+  ASSERT_TRUE(SharedRing::attach(name, writer).ok());
+  reader->unlink();
+
+  // Fill and drain the ring so messages wrap around its end.
+  size_t written = 0;
+  size_t read = 0;
+  std::vector<std::string> messages;
+  for (size_t round = 0; round < 20; round++) {
+    while (writer->write(std::string(round % 13, 'a' + written % 26))) {
+      written++;
+    }
+    messages.clear();
+    reader->read(messages, 3);
+    for (const auto& message : messages) {
+      EXPECT_EQ(message, std::string(message.size(), 'a' + read % 26));
+      read++;
+    }
+  }
+  messages.clear();
+  read += reader->read(messages, kSharedRingBatch);
+  EXPECT_EQ(read, written);
+
+  // A message larger than the ring is not written.
+  EXPECT_FALSE(writer->write(std::string(128, 'a')));
+
+  auto message = serializeRingRequest(
+      "logger", "test", {{"string", "line"}, {"category", "test"}});
+  std::string registry;
+  std::string item;
+  PluginRequest request;
+  ASSERT_TRUE(deserializeRingRequest(message, registry, item, request));
+  EXPECT_EQ(registry, "logger");
+  EXPECT_EQ(item, "test");
+  EXPECT_EQ(request, PluginRequest({{"string", "line"}, {"category", "test"}}));
+
+  message.pop_back();
+  EXPECT_FALSE(deserializeRingRequest(message, registry, item, request));
+}
+#endif
+
 TEST_F(ExtensionsTest, test_extension_broadcast) {
   auto status = startExtensionManager(socket_path);
   EXPECT_TRUE(status.ok());
@@ -260,6 +403,24 @@ TEST_F(ExtensionsTest, test_extension_broadcast) {
   rf.allowDuplicates(false);
 }
 
+TEST_F(ExtensionsTest, test_extension_calls) {
+  RouteUUID uuid = 65535;
+  ExtensionCalls calls;
+  EXPECT_FALSE(getExtensionCalls(uuid, calls));
+
+  // The extension is not running, the call fails and is still measured.
+  PluginResponse response;
+  auto status =
+      callExtension(uuid, "extension_test", "test_item", {}, response);
+  EXPECT_FALSE(status.ok());
+
+  ASSERT_TRUE(getExtensionCalls(uuid, calls));
+  EXPECT_EQ(calls.calls, 1U);
+  EXPECT_EQ(calls.failures, 1U);
+  EXPECT_EQ(calls.active, 0U);
+  ASSERT_EQ(calls.latency.count("extension_test/test_item"), 1U);
+}
+
 TEST_F(ExtensionsTest, test_extension_module_search) {
   createMockFileStructure();
   tearDownMockFileStructure();
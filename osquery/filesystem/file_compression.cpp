@@ -14,6 +14,9 @@
 #include <Windows.h>
 #endif
 
+#include <algorithm>
+#include <memory>
+
 // This define is required for Windows static linking of libarchive
 #define LIBARCHIVE_STATIC
 #include <archive.h>
@@ -25,6 +28,7 @@
 
 #include "osquery/carver/carver.h"
 #include "osquery/filesystem/fileops.h"
+#include "osquery/remote/compression.h"
 
 namespace osquery {
 
@@ -32,68 +36,35 @@ DECLARE_uint32(carver_block_size);
 
 Status compress(const boost::filesystem::path& in,
                 const boost::filesystem::path& out) {
-  PlatformFile inFile(in, PF_OPEN_EXISTING | PF_READ);
+  PlatformFile inFile(in, PF_OPEN_EXISTING | PF_READ | PF_SEQUENTIAL);
   PlatformFile outFile(out, PF_CREATE_NEW | PF_WRITE);
 
-  auto inFileSize = inFile.size();
-  ZSTD_CStream* const cstream = ZSTD_createCStream();
-  if (cstream == nullptr) {
-    return Status(1, "Couldn't create compression stream");
-  }
-
-  size_t const initResult = ZSTD_initCStream(cstream, 1);
-  if (ZSTD_isError(initResult)) {
-    return Status(1, "Couldn't initialize compression stream");
-  }
+  ZstdStream stream;
+  stream.setSink([&outFile](const char* data, size_t size) {
+    return outFile.write(data, size) == static_cast<ssize_t>(size);
+  });
 
-  size_t const buffInSize = ZSTD_CStreamInSize();
-  size_t const buffOutSize = ZSTD_CStreamOutSize();
-  std::vector<void*> buffIn(buffInSize);
-  std::vector<void*> buffOut(buffOutSize);
-  auto read = buffInSize;
-  auto toRead = buffInSize;
+  auto inFileSize = inFile.size();
+  std::vector<char> buffIn(ZSTD_CStreamInSize());
   size_t readSoFar = 0;
   while (true) {
-    read = inFile.read(buffIn.data(), toRead);
+    auto read = inFile.read(buffIn.data(), buffIn.size());
     if (read < 1) {
       break;
     }
     readSoFar += read;
     if (readSoFar > inFileSize) {
-      ZSTD_freeCStream(cstream);
       return Status(1, "File changed during compression");
     }
 
-    ZSTD_inBuffer input = {buffIn.data(), read, 0};
-    while (input.pos < input.size) {
-      ZSTD_outBuffer output = {buffOut.data(), buffOutSize, 0};
-      toRead = ZSTD_compressStream(cstream, &output, &input);
-      if (ZSTD_isError(toRead)) {
-        ZSTD_freeCStream(cstream);
-        return Status(1,
-                      "ZSTD_compressStream() error : " +
-                          std::string(ZSTD_getErrorName(toRead)));
-      }
-      if (toRead > buffInSize) {
-        toRead = buffInSize;
-      }
-      outFile.seek(0, PF_SEEK_END);
-      outFile.write(buffOut.data(), output.pos);
+    if (!stream.write(buffIn.data(), static_cast<size_t>(read))) {
+      return Status(1, "Couldn't compress file");
     }
   }
 
-  ZSTD_outBuffer output = {buffOut.data(), buffOutSize, 0};
-  size_t const remainingToFlush = ZSTD_endStream(cstream, &output);
-
-  if (remainingToFlush) {
-    ZSTD_freeCStream(cstream);
+  if (!stream.finish()) {
     return Status(1, "Couldn't fully flush compressed file");
   }
-
-  outFile.seek(0, PF_SEEK_END);
-  outFile.write(buffOut.data(), output.pos);
-  ZSTD_freeCStream(cstream);
-
   return Status(0);
 }
 
@@ -152,44 +123,108 @@ Status decompress(const boost::filesystem::path& in,
   return Status(0);
 }
 
+/// The libarchive client, handing tar output to a sink or compression stream.
+struct ArchiveClient {
+  const ArchiveSink* sink{nullptr};
+
+  std::unique_ptr<ZstdStream> stream;
+};
+
+static la_ssize_t archiveWrite(struct archive*,
+                               void* data,
+                               const void* buffer,
+                               size_t length) {
+  auto client = static_cast<ArchiveClient*>(data);
+  auto block = static_cast<const char*>(buffer);
+  bool written = (client->stream != nullptr)
+                     ? client->stream->write(block, length)
+                     : (*client->sink)(block, length);
+  return (written) ? static_cast<la_ssize_t>(length) : -1;
+}
+
 Status archive(const std::set<boost::filesystem::path>& paths,
-               const boost::filesystem::path& out) {
+               bool compress,
+               const ArchiveSink& sink) {
+  ArchiveClient client;
+  client.sink = &sink;
+  if (compress) {
+    client.stream.reset(new ZstdStream());
+    client.stream->setSink(sink);
+  }
+
   auto arch = archive_write_new();
   if (arch == nullptr) {
     return Status(1, "Failed to create tar archive");
   }
   archive_write_set_format_pax_restricted(arch);
-  auto ret = archive_write_open_filename(arch, out.string().c_str());
+  auto ret = archive_write_open(arch, &client, nullptr, archiveWrite, nullptr);
   if (ret == ARCHIVE_FATAL) {
     archive_write_free(arch);
     return Status(1, "Failed to open tar archive for writing");
   }
+
+  auto blockSize = FLAGS_carver_block_size > 0 ? FLAGS_carver_block_size : 8192;
+  std::vector<char> block(blockSize, 0);
+  Status status(0, "Ok");
   for (const auto& f : paths) {
-    PlatformFile pFile(f, PF_OPEN_EXISTING | PF_READ);
+    PlatformFile pFile(f, PF_OPEN_EXISTING | PF_READ | PF_SEQUENTIAL);
+    if (!pFile.isValid()) {
+      continue;
+    }
 
+    auto size = pFile.size();
     auto entry = archive_entry_new();
     archive_entry_set_pathname(entry, f.leaf().string().c_str());
-    archive_entry_set_size(entry, pFile.size());
+    archive_entry_set_size(entry, size);
     archive_entry_set_filetype(entry, AE_IFREG);
     archive_entry_set_perm(entry, 0644);
-    archive_write_header(arch, entry);
-
-    auto blockSize =
-        FLAGS_carver_block_size > 0 ? FLAGS_carver_block_size : 8192;
-    auto blkCount = static_cast<size_t>(ceil(static_cast<double>(pFile.size()) /
-                                             static_cast<double>(blockSize)));
-    for (size_t i = 0; i < blkCount; i++) {
-      std::vector<char> block(blockSize, 0);
-      auto r = pFile.read(block.data(), blockSize);
-      if (r != blockSize && r > 0) {
-        // resize the buffer to size we read as last block is likely smaller
-        block.resize(r);
+    ret = archive_write_header(arch, entry);
+    archive_entry_free(entry);
+    if (ret == ARCHIVE_FATAL) {
+      status = Status(1, "Failed to write tar archive");
+      break;
+    }
+
+    // The block buffer is reused, only the size recorded in the header is read.
+    size_t readSoFar = 0;
+    while (readSoFar < size) {
+      auto r =
+          pFile.read(block.data(), std::min(block.size(), size - readSoFar));
+      if (r < 1) {
+        break;
+      }
+      readSoFar += static_cast<size_t>(r);
+      if (archive_write_data(arch, block.data(), static_cast<size_t>(r)) < 0) {
+        status = Status(1, "Failed to write tar archive");
+        break;
       }
-      archive_write_data(arch, block.data(), block.size());
     }
-    archive_entry_free(entry);
+    if (!status.ok()) {
+      break;
+    }
+  }
+
+  // Closing the archive writes the end of archive blocks.
+  if (archive_write_close(arch) != ARCHIVE_OK && status.ok()) {
+    status = Status(1, "Failed to complete tar archive");
   }
   archive_write_free(arch);
-  return Status(0, "Ok");
-};
+
+  if (status.ok() && client.stream != nullptr && !client.stream->finish()) {
+    status = Status(1, "Couldn't fully flush compressed archive");
+  }
+  return status;
+}
+
+Status archive(const std::set<boost::filesystem::path>& paths,
+               const boost::filesystem::path& out) {
+  PlatformFile outFile(out, PF_CREATE_NEW | PF_WRITE);
+  if (!outFile.isValid()) {
+    return Status(1, "Failed to open tar archive for writing");
+  }
+
+  return archive(paths, false, [&outFile](const char* data, size_t size) {
+    return outFile.write(data, size) == static_cast<ssize_t>(size);
+  });
+}
 } // namespace osquery
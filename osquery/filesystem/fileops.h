@@ -21,6 +21,8 @@
 #include <unistd.h>
 #endif
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -94,6 +96,14 @@ const PlatformHandle kInvalidHandle = (PlatformHandle)-1;
 #define PF_NONBLOCK 0x0020
 #define PF_APPEND 0x0040
 
+/**
+ * The file is read once from start to end in large reads, such as when it is
+ * hashed or carved. The platform reads ahead of the caller; on Windows with
+ * --unbuffered_reads the reads are unbuffered and overlapped. Seeking is not
+ * supported while reading ahead.
+ */
+#define PF_SEQUENTIAL 0x0080
+
 /**
  * @brief Modes for seeking through a file.
  *
@@ -129,6 +139,9 @@ struct AsyncEvent {
   bool is_active_{false};
 };
 
+/// Reads a file ahead of the caller, defined by the Windows PlatformFile.
+struct SequentialReader;
+
 /*
  * @brief Converts a Windows short path to a full path
  *
@@ -253,10 +266,53 @@ class PlatformFile : private boost::noncopyable {
 
   AsyncEvent last_read_;
 
+  /// Unbuffered reads ahead of the caller, see PF_SEQUENTIAL.
+  std::shared_ptr<SequentialReader> sequential_;
+
   ssize_t getOverlappedResultForRead(void* buf, size_t requested_size);
 #endif
 };
 
+/**
+ * @brief A read-only mapping of part of a regular file.
+ *
+ * Consumers such as hashing use the mapped content without copying it into
+ * buffers. Mapped file content counts towards the resident memory limited by
+ * the watchdog, so large files are mapped a window at a time.
+ *
+ * On POSIX a file truncated while mapped raises SIGBUS when the missing
+ * content is accessed, see --read_mapped.
+ */
+class MappedFile : private boost::noncopyable {
+ public:
+  /// Map size bytes from an offset that is a multiple of granularity().
+  MappedFile(const PlatformFile& file, size_t offset, size_t size);
+
+  ~MappedFile();
+
+  /// Check if the content was mapped.
+  bool isValid() const {
+    return data_ != nullptr;
+  }
+
+  /// The mapped content.
+  const char* data() const {
+    return static_cast<const char*>(data_);
+  }
+
+  /// The number of mapped bytes.
+  size_t size() const {
+    return size_;
+  }
+
+  /// The alignment of mapping offsets, the page or allocation granularity.
+  static size_t granularity();
+
+ private:
+  void* data_{nullptr};
+  size_t size_{0};
+};
+
 /**
  * @brief Returns the current user's home directory.
  *
@@ -302,6 +358,25 @@ bool platformChmod(const std::string& path, mode_t perms);
  */
 std::vector<std::string> platformGlob(const std::string& find_path);
 
+/**
+ * @brief Walk the files and directories beneath a directory.
+ *
+ * This yields the paths platformGlob would for a wildcard within root, then
+ * for two levels of wildcards, and so on, but reads each directory once and
+ * does not list the upper levels again for each level. Entries are classified
+ * using the directory entry's type, a stat is only needed for links and file
+ * systems that do not report the type. Directories are marked with a trailing
+ * separator, as GLOB_MARK does, and the entries of a directory are sorted.
+ *
+ * @param root The directory to walk.
+ * @param depth The number of levels to walk, 1 yields only root's entries.
+ * @param predicate Called for each entry, return false to stop the walk.
+ * @return false if the predicate stopped the walk.
+ */
+bool platformWalk(const std::string& root,
+                  size_t depth,
+                  const std::function<bool(const std::string&)>& predicate);
+
 /**
  * @brief Checks to see if the current user has the permissions to perform a
  *        specified operation on a file.
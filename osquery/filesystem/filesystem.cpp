@@ -8,6 +8,7 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
 #include <sstream>
 
 #include <fcntl.h>
@@ -33,6 +34,7 @@
 #include "osquery/filesystem/fileops.h"
 
 namespace pt = boost::property_tree;
+namespace rj = rapidjson;
 namespace fs = boost::filesystem;
 namespace errc = boost::system::errc;
 
@@ -46,6 +48,8 @@ HIDDEN_FLAG(bool, allow_unsafe, false, "Allow unsafe executable permissions");
 /// Disable forensics (atime/mtime preserving) file reads.
 HIDDEN_FLAG(bool, disable_forensic, true, "Disable atime/mtime preservation");
 
+FLAG(bool, read_mapped, false, "Map files into memory when hashing them");
+
 static const size_t kMaxRecursiveGlobs = 64;
 
 Status writeTextFile(const fs::path& path,
@@ -74,12 +78,22 @@ Status writeTextFile(const fs::path& path,
   return Status(0, "OK");
 }
 
+/// Blocks at least this large are read sequentially, see PF_SEQUENTIAL.
+const size_t kSequentialReadBlock = 64 * 1024;
+
+/// The bytes of a file mapped at once, a multiple of every granularity.
+const size_t kMappedReadWindow = 8 * 1024 * 1024;
+
 struct OpenReadableFile : private boost::noncopyable {
  public:
-  explicit OpenReadableFile(const fs::path& path, bool blocking = false) {
+  explicit OpenReadableFile(const fs::path& path,
+                            bool blocking = false,
+                            bool sequential = false) {
     int mode = PF_OPEN_EXISTING | PF_READ;
     if (!blocking) {
       mode |= PF_NONBLOCK;
+    } else if (sequential) {
+      mode |= PF_SEQUENTIAL;
     }
 
     // Open the file descriptor and allow caller to perform error checking.
@@ -97,7 +111,9 @@ Status readFile(const fs::path& path,
                 bool preserve_time,
                 std::function<void(std::string& buffer, size_t size)> predicate,
                 bool blocking) {
-  OpenReadableFile handle(path, blocking);
+  // Blocking reads in large blocks, such as hashing, are sequential.
+  OpenReadableFile handle(
+      path, blocking, block_size >= kSequentialReadBlock && !dry_run);
   if (handle.fd == nullptr || !handle.fd->isValid()) {
     return Status(1, "Cannot open file for reading: " + path.string());
   }
@@ -138,8 +154,10 @@ Status readFile(const fs::path& path,
     block_size = (block_size < 4096) ? 4096 : block_size;
     ssize_t part_bytes = 0;
     bool overflow = false;
+    // The block is reused unless the predicate takes its content.
+    std::string part;
     do {
-      std::string part(block_size, '\0');
+      part.resize(block_size);
       part_bytes = handle.fd->read(&part[0], block_size);
       if (part_bytes > 0) {
         total_bytes += static_cast<off_t>(part_bytes);
@@ -193,6 +211,69 @@ Status readFile(const fs::path& path,
                   blocking);
 }
 
+Status readMappedFile(
+    const fs::path& path,
+    size_t block_size,
+    bool preserve_time,
+    std::function<void(const char* buffer, size_t size)> predicate) {
+  auto read_blocks = [&]() {
+    return readFile(path,
+                    0,
+                    block_size,
+                    false,
+                    preserve_time,
+                    ([&predicate](std::string& buffer, size_t size) {
+                      predicate(buffer.data(), size);
+                    }),
+                    true);
+  };
+
+  if (!FLAGS_read_mapped) {
+    return read_blocks();
+  }
+
+  bool mapped = false;
+  {
+    OpenReadableFile handle(path, true);
+    if (handle.fd == nullptr || !handle.fd->isValid()) {
+      return Status(1, "Cannot open file for reading: " + path.string());
+    }
+
+    size_t file_size = handle.fd->size();
+    if (file_size > FLAGS_read_max) {
+      LOG(WARNING) << "Cannot read file that exceeds size limit: "
+                   << path.string();
+      VLOG(1) << "Cannot read " << path.string()
+              << " size exceeds limit: " << file_size << " > "
+              << FLAGS_read_max;
+      return Status(1, "File exceeds read limits");
+    }
+
+    PlatformTime times;
+    handle.fd->getFileTimes(times);
+    for (size_t offset = 0; offset < file_size; offset += kMappedReadWindow) {
+      MappedFile mapping(*handle.fd,
+                         offset,
+                         std::min(kMappedReadWindow, file_size - offset));
+      if (!mapping.isValid()) {
+        if (mapped) {
+          return Status(1, "Cannot map file: " + path.string());
+        }
+        // Special and empty files, and some file systems, cannot be mapped.
+        break;
+      }
+      predicate(mapping.data(), mapping.size());
+      mapped = true;
+    }
+
+    if (mapped && preserve_time && !FLAGS_disable_forensic) {
+      handle.fd->setFileTimes(times);
+    }
+  }
+
+  return (mapped) ? Status(0, "OK") : read_blocks();
+}
+
 Status readFile(const fs::path& path, bool blocking) {
   std::string blank;
   return readFile(path, blank, 0, true, false, blocking);
@@ -271,19 +352,76 @@ Status removePath(const fs::path& path) {
   return Status(0, std::to_string(removed_files));
 }
 
-static void genGlobs(std::string path,
-                     std::vector<std::string>& results,
-                     GlobLimits limits) {
+/// Check if a globbed path is a requested type of match.
+static inline bool isGlobMatch(const std::string& found, GlobLimits limits) {
+  if (found.empty()) {
+    return false;
+  }
+
+  bool folder = found.back() == '/' || found.back() == '\\';
+  return (folder && (limits & GLOB_FOLDERS)) ||
+         (!folder && (limits & GLOB_FILES));
+}
+
+/// Check if a pattern ends with a recursive wildcard, such as "/etc/**".
+static inline bool isRecursiveGlob(const std::string& path) {
+  return path.size() >= 3 && path.compare(path.size() - 2, 2, "**") == 0 &&
+         (path[path.size() - 3] == '/' || path[path.size() - 3] == '\\');
+}
+
+/// Walk each directory matching the pattern before a recursive wildcard.
+static bool walkGlobs(
+    const std::string& path,
+    GlobLimits limits,
+    const std::function<bool(const std::string&)>& predicate) {
+  auto base = path.substr(0, path.size() - 3);
+  std::vector<std::string> roots;
+  if (base.find_first_of("*?[{~") == std::string::npos) {
+    roots.push_back(base);
+  } else {
+    // Only the literal prefix is listed, the walks start at its matches.
+    for (auto& match : platformGlob(base)) {
+      if (isGlobMatch(match, GLOB_FOLDERS)) {
+        roots.push_back(std::move(match));
+      }
+    }
+  }
+
+  // Each level of the walk is one level of the recursive glob.
+  for (const auto& root : roots) {
+    if (!platformWalk(root,
+                      kMaxRecursiveGlobs - 1,
+                      ([&limits, &predicate](const std::string& found) {
+                        return !isGlobMatch(found, limits) || predicate(found);
+                      }))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Glob each recursion level, false if the predicate stopped the search.
+static bool genGlobs(std::string path,
+                     GlobLimits limits,
+                     const std::function<bool(const std::string&)>& predicate) {
   // Use our helped escape/replace for wildcards.
   replaceGlobWildcards(path, limits);
 
+  // A trailing double star is walked, rather than globbed for each level.
+  if (isRecursiveGlob(path)) {
+    return walkGlobs(path, limits, predicate);
+  }
+
   // Generate a glob set and recurse for double star.
   size_t glob_index = 0;
   while (++glob_index < kMaxRecursiveGlobs) {
     auto glob_results = platformGlob(path);
 
+    // Prune results based on settings/requested glob limitations.
     for (auto const& result_path : glob_results) {
-      results.push_back(result_path);
+      if (isGlobMatch(result_path, limits) && !predicate(result_path)) {
+        return false;
+      }
     }
 
     // The end state is a non-recursive ending or empty set of matches.
@@ -295,18 +433,16 @@ static void genGlobs(std::string path,
     }
     path += "/**";
   }
+  return true;
+}
 
-  // Prune results based on settings/requested glob limitations.
-  auto end = std::remove_if(
-      results.begin(), results.end(), [limits](const std::string& found) {
-        return !(((found[found.length() - 1] == '/' ||
-                   found[found.length() - 1] == '\\') &&
-                  limits & GLOB_FOLDERS) ||
-                 ((found[found.length() - 1] != '/' &&
-                   found[found.length() - 1] != '\\') &&
-                  limits & GLOB_FILES));
-      });
-  results.erase(end, results.end());
+static void genGlobs(const std::string& path,
+                     std::vector<std::string>& results,
+                     GlobLimits limits) {
+  genGlobs(path, limits, ([&results](const std::string& found) {
+             results.push_back(found);
+             return true;
+           }));
 }
 
 Status resolveFilePattern(const fs::path& fs_path,
@@ -321,6 +457,14 @@ Status resolveFilePattern(const fs::path& fs_path,
   return Status(0, "OK");
 }
 
+Status resolveFilePattern(
+    const fs::path& fs_path,
+    GlobLimits setting,
+    std::function<bool(const std::string& path)> predicate) {
+  genGlobs(fs_path.string(), setting, predicate);
+  return Status(0, "OK");
+}
+
 inline void replaceGlobWildcards(std::string& pattern, GlobLimits limits) {
   // Replace SQL-wildcard '%' with globbing wildcard '*'.
   if (pattern.find('%') != std::string::npos) {
@@ -520,15 +664,102 @@ Status parseJSON(const fs::path& path, pt::ptree& tree) {
   return parseJSONContent(json_data, tree);
 }
 
+namespace {
+/**
+ * @brief Build a property tree from RapidJSON reader events.
+ *
+ * The tree is filled as the content is read, without an intermediate DOM.
+ * Values are stored as text the same way boost's JSON parser stores them:
+ * numbers keep their literal form and array elements use empty keys.
+ */
+class PropertyTreeHandler
+    : public rj::BaseReaderHandler<rj::UTF8<>, PropertyTreeHandler> {
+ public:
+  explicit PropertyTreeHandler(pt::ptree& tree) : stack_({&tree}) {}
+
+  bool Null() {
+    return value("null", 4);
+  }
+
+  bool Bool(bool b) {
+    return (b) ? value("true", 4) : value("false", 5);
+  }
+
+  bool RawNumber(const char* str, rj::SizeType length, bool /* copy */) {
+    return value(str, length);
+  }
+
+  bool String(const char* str, rj::SizeType length, bool /* copy */) {
+    return value(str, length);
+  }
+
+  bool Key(const char* str, rj::SizeType length, bool /* copy */) {
+    key_.assign(str, length);
+    return true;
+  }
+
+  bool StartObject() {
+    stack_.push_back(&next());
+    return true;
+  }
+
+  bool EndObject(rj::SizeType /* members */) {
+    stack_.pop_back();
+    return true;
+  }
+
+  bool StartArray() {
+    return StartObject();
+  }
+
+  bool EndArray(rj::SizeType elements) {
+    return EndObject(elements);
+  }
+
+ private:
+  /// The first value is the root, every other value is a child of the top.
+  pt::ptree& next() {
+    if (root_) {
+      root_ = false;
+      return *stack_.back();
+    }
+
+    auto& child =
+        stack_.back()->push_back(std::make_pair(key_, pt::ptree()))->second;
+    key_.clear();
+    return child;
+  }
+
+  bool value(const char* str, rj::SizeType length) {
+    next().data().assign(str, length);
+    return true;
+  }
+
+ private:
+  std::vector<pt::ptree*> stack_;
+  std::string key_;
+  bool root_{true};
+};
+} // namespace
+
 Status parseJSONContent(const std::string& content, pt::ptree& tree) {
-  // Read the extensions data into a JSON blob, then property tree.
-  try {
-    std::stringstream json_stream;
-    json_stream << content;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
+  // The in situ parser needs a writable buffer.
+  auto buffer = content;
+  return parseJSONContent(std::move(buffer), tree);
+}
+
+Status parseJSONContent(std::string&& content, pt::ptree& tree) {
+  // Strings are decoded within the content, the reader does not allocate.
+  rj::InsituStringStream stream(&content[0]);
+  pt::ptree output;
+  PropertyTreeHandler handler(output);
+  rj::Reader reader;
+  auto result = reader.Parse<rj::kParseInsituFlag |
+                             rj::kParseNumbersAsStringsFlag>(stream, handler);
+  if (result.IsError()) {
     return Status(1, "Could not parse JSON from file");
   }
+  tree.swap(output);
   return Status(0, "OK");
 }
 } // namespace osquery
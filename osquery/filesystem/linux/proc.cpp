@@ -8,69 +8,243 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <unistd.h>
 
-#include <boost/filesystem.hpp>
-
+#include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/filesystem/linux/proc.h"
+
 namespace osquery {
 
+FLAG(uint64,
+     proc_walk_threads,
+     4,
+     "Threads used to read /proc for process tables (1 disables)");
+
 const std::string kLinuxProcPath = "/proc";
 
-Status procProcesses(std::set<std::string>& processes) {
-  // Iterate over each process-like directory in proc.
-  boost::filesystem::directory_iterator it(kLinuxProcPath), end;
-  try {
-    for (; it != end; ++it) {
-      if (boost::filesystem::is_directory(it->status())) {
-        // See #792: std::regex is incomplete until GCC 4.9
-        if (std::atoll(it->path().leaf().string().c_str()) > 0) {
-          processes.insert(it->path().leaf().string());
-        }
+/// Read proc files in pages, they report a size of 0.
+const size_t kProcReadSize = 4096;
+
+/// Below this many pids a walk is not worth starting workers.
+const size_t kProcWalkMinimum = 64;
+
+ProcReader::~ProcReader() {
+  close();
+}
+
+void ProcReader::close() {
+  if (dirfd_ >= 0) {
+    ::close(dirfd_);
+    dirfd_ = -1;
+  }
+}
+
+bool ProcReader::open(const std::string& pid) {
+  close();
+  auto path = kLinuxProcPath + "/" + pid;
+  dirfd_ = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  return dirfd_ >= 0;
+}
+
+Status ProcReader::read(const char* attr) {
+  buffer_.clear();
+  auto fd = ::openat(dirfd_, attr, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(1, "Cannot open " + std::string(attr));
+  }
+
+  size_t size = 0;
+  while (true) {
+    buffer_.resize(size + kProcReadSize);
+    auto bytes = ::read(fd, &buffer_[size], kProcReadSize);
+    if (bytes <= 0) {
+      break;
+    }
+    size += bytes;
+  }
+  buffer_.resize(size);
+  ::close(fd);
+  return Status(0, "OK");
+}
+
+Status ProcReader::readLink(const char* attr, std::string& result) const {
+  char link[PATH_MAX] = {0};
+  auto size = ::readlinkat(dirfd_, attr, link, sizeof(link) - 1);
+  if (size < 0) {
+    return Status(1, "Could not read path");
+  }
+  result.assign(link, size);
+  return Status(0, "OK");
+}
+
+Status ProcReader::descriptors(
+    std::map<std::string, std::string>& descriptors) const {
+  // Access to the process' /fd may be restricted.
+  auto fd = ::openat(dirfd_, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  auto dir = (fd >= 0) ? ::fdopendir(fd) : nullptr;
+  if (dir == nullptr) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    return Status(1, "Cannot access descriptors");
+  }
+
+  char link[PATH_MAX] = {0};
+  struct dirent* entry = nullptr;
+  while ((entry = ::readdir(dir)) != nullptr) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+
+    auto size = ::readlinkat(fd, entry->d_name, link, sizeof(link) - 1);
+    if (size >= 0) {
+      descriptors[entry->d_name] = std::string(link, size);
+    }
+  }
+  ::closedir(dir);
+  return Status(0, "OK");
+}
+
+void procWalk(const std::set<std::string>& pids,
+              const ProcGenerator& generator,
+              QueryData& results) {
+  std::vector<std::string> list(pids.begin(), pids.end());
+  std::vector<QueryData> rows(list.size());
+  std::atomic<size_t> next(0);
+
+  auto worker = ([&list, &rows, &next, &generator]() {
+    ProcReader reader;
+    for (auto i = next++; i < list.size(); i = next++) {
+      // A process may exit before it is read.
+      if (reader.open(list[i])) {
+        generator(reader, list[i], rows[i]);
       }
     }
-  } catch (const boost::filesystem::filesystem_error& e) {
-    VLOG(1) << "Exception iterating Linux processes " << e.what();
-    return Status(1, e.what());
+  });
+
+  size_t threads = FLAGS_proc_walk_threads;
+  if (threads <= 1 || list.size() < kProcWalkMinimum) {
+    worker();
+  } else {
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++) {
+      workers.emplace_back(worker);
+    }
+    for (auto& thread : workers) {
+      thread.join();
+    }
+  }
+
+  for (auto& pid_rows : rows) {
+    for (auto& row : pid_rows) {
+      results.push_back(std::move(row));
+    }
+  }
+}
+
+/// The descriptor index of the last schedule step.
+static std::shared_ptr<const ProcDescriptorIndex> kProcDescriptorIndex;
+
+/// The schedule step of the shared descriptor index.
+static size_t kProcDescriptorStep{0};
+
+/// Tables within a step wait for a single index to be built.
+static Mutex kProcDescriptorMutex;
+
+static std::shared_ptr<const ProcDescriptorIndex> buildProcDescriptorIndex() {
+  std::set<std::string> pids;
+  procProcesses(pids);
+
+  QueryData rows;
+  procWalk(pids,
+           ([](ProcReader& reader, const std::string& pid, QueryData& fds) {
+             std::map<std::string, std::string> descriptors;
+             reader.descriptors(descriptors);
+             for (auto& fd : descriptors) {
+               fds.push_back({{"pid", pid},
+                              {"fd", fd.first},
+                              {"path", std::move(fd.second)}});
+             }
+           }),
+           rows);
+
+  auto index = std::make_shared<ProcDescriptorIndex>();
+  for (auto& row : rows) {
+    auto& path = row["path"];
+    if (path.find("socket:[") == 0 && path.back() == ']') {
+      // Later processes replace the owner of a shared socket.
+      index->sockets[path.substr(8, path.size() - 9)] =
+          std::make_pair(row["fd"], row["pid"]);
+    }
+    index->descriptors[row["pid"]][row["fd"]] = std::move(path);
   }
+  return index;
+}
 
+std::shared_ptr<const ProcDescriptorIndex> getProcDescriptorIndex(
+    size_t step) {
+  if (step == 0) {
+    return buildProcDescriptorIndex();
+  }
+
+  WriteLock lock(kProcDescriptorMutex);
+  if (kProcDescriptorIndex == nullptr || kProcDescriptorStep != step) {
+    kProcDescriptorIndex = buildProcDescriptorIndex();
+    kProcDescriptorStep = step;
+  }
+  return kProcDescriptorIndex;
+}
+
+Status procProcesses(std::set<std::string>& processes) {
+  // Iterate over each process-like directory in proc.
+  auto dir = ::opendir(kLinuxProcPath.c_str());
+  if (dir == nullptr) {
+    VLOG(1) << "Cannot iterate Linux processes";
+    return Status(1, "Cannot open " + kLinuxProcPath);
+  }
+
+  struct dirent* entry = nullptr;
+  while ((entry = ::readdir(dir)) != nullptr) {
+    if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) {
+      continue;
+    }
+
+    // See #792: std::regex is incomplete until GCC 4.9
+    if (std::atoll(entry->d_name) > 0) {
+      processes.insert(entry->d_name);
+    }
+  }
+  ::closedir(dir);
   return Status(0, "OK");
 }
 
 Status procDescriptors(const std::string& process,
                        std::map<std::string, std::string>& descriptors) {
-  auto descriptors_path = kLinuxProcPath + "/" + process + "/fd";
-  try {
-    // Access to the process' /fd may be restricted.
-    boost::filesystem::directory_iterator it(descriptors_path), end;
-    for (; it != end; ++it) {
-      auto fd = it->path().leaf().string();
-      std::string linkname;
-      if (procReadDescriptor(process, fd, linkname).ok()) {
-        descriptors[fd] = linkname;
-      }
-    }
-  } catch (boost::filesystem::filesystem_error& e) {
+  ProcReader reader;
+  if (!reader.open(process) || !reader.descriptors(descriptors).ok()) {
     return Status(1, "Cannot access descriptors for " + process);
   }
-
   return Status(0, "OK");
 }
 
 Status procReadDescriptor(const std::string& process,
                           const std::string& descriptor,
                           std::string& result) {
-  auto link = kLinuxProcPath + "/" + process + "/fd/" + descriptor;
-
-  char result_path[PATH_MAX] = {0};
-  auto size = readlink(link.c_str(), result_path, sizeof(result_path) - 1);
-  if (size >= 0) {
-    result = std::string(result_path);
-    return Status(0);
+  ProcReader reader;
+  if (!reader.open(process)) {
+    return Status(1, "Could not read path");
   }
-  return Status(1, "Could not read path");
+  return reader.readLink(("fd/" + descriptor).c_str(), result);
 }
 }
@@ -0,0 +1,109 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/query.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief A reader for the /proc directory of a single process.
+ *
+ * The process directory is opened once and each attribute is opened relative
+ * to it, so paths are not built and resolved again for every attribute.
+ * A reader may be opened for another pid, keeping its content buffer.
+ * Readers are not shared between threads.
+ */
+class ProcReader : private boost::noncopyable {
+ public:
+  ProcReader() = default;
+  ~ProcReader();
+
+  /// Open the /proc directory of a pid, closing any previous process.
+  bool open(const std::string& pid);
+
+  /// Read an attribute file such as "stat" into the content buffer.
+  Status read(const char* attr);
+
+  /// The content of the last read, valid until the next read.
+  const std::string& content() const {
+    return buffer_;
+  }
+
+  /// Read the target of an attribute link such as "exe" or "fd/3".
+  Status readLink(const char* attr, std::string& result) const;
+
+  /// Read each descriptor of the process and the target of its link.
+  Status descriptors(std::map<std::string, std::string>& descriptors) const;
+
+ private:
+  void close();
+
+ private:
+  /// The descriptor of the open /proc/<pid> directory.
+  int dirfd_{-1};
+
+  /// Reused content buffer, proc files are read without a known size.
+  std::string buffer_;
+};
+
+/// Generate rows for a single pid from an open reader.
+using ProcGenerator =
+    std::function<void(ProcReader&, const std::string&, QueryData&)>;
+
+/**
+ * @brief Generate rows for each pid using a small pool of workers.
+ *
+ * Workers claim pids from the list and each owns a ProcReader. Rows are
+ * appended to the results in the order of the input pid list.
+ *
+ * @param pids The input list of process pids.
+ * @param generator Called for each pid that could be opened.
+ * @param results Output rows in pid order.
+ */
+void procWalk(const std::set<std::string>& pids,
+              const ProcGenerator& generator,
+              QueryData& results);
+
+/**
+ * @brief An index of every process' descriptors.
+ *
+ * Tables reading descriptors of all processes share one index within a
+ * schedule step, instead of each walking every /proc/<pid>/fd.
+ */
+struct ProcDescriptorIndex : private boost::noncopyable {
+  /// Each pid's descriptors, a map of descriptor number to link target.
+  std::map<std::string, std::map<std::string, std::string>> descriptors;
+
+  /// Socket inodes and the descriptor number and pid that own each.
+  std::map<std::string, std::pair<std::string, std::string>> sockets;
+};
+
+/**
+ * @brief Get the descriptor index for a schedule step.
+ *
+ * The index is built for the first request within a step and reused until
+ * the step changes. A step of 0, outside of the schedule, builds a new index.
+ *
+ * @param step The schedule step, see TablePlugin::kCacheStep.
+ */
+std::shared_ptr<const ProcDescriptorIndex> getProcDescriptorIndex(size_t step);
+} // namespace osquery
@@ -8,16 +8,20 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <dirent.h>
 #include <glob.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 
+#include <algorithm>
+
 #include <boost/optional.hpp>
 
 #include <osquery/filesystem.h>
@@ -90,6 +94,15 @@ PlatformFile::PlatformFile(const fs::path& path, int mode, int perms)
   } else {
     handle_ = ::open(fname_.c_str(), oflag, perms);
   }
+
+  if (handle_ != kInvalidHandle && (mode & PF_SEQUENTIAL) == PF_SEQUENTIAL) {
+    // Ask the kernel to read further ahead of the caller.
+#if defined(__linux__)
+    ::posix_fadvise(handle_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(__APPLE__)
+    ::fcntl(handle_, F_RDAHEAD, 1);
+#endif
+  }
 }
 
 PlatformFile::~PlatformFile() {
@@ -263,6 +276,39 @@ size_t PlatformFile::size() const {
   return file.st_size;
 }
 
+MappedFile::MappedFile(const PlatformFile& file, size_t offset, size_t size) {
+  struct stat file_stat;
+  if (size == 0 || ::fstat(file.nativeHandle(), &file_stat) < 0 ||
+      !S_ISREG(file_stat.st_mode)) {
+    return;
+  }
+
+  auto data = ::mmap(nullptr,
+                     size,
+                     PROT_READ,
+                     MAP_PRIVATE,
+                     file.nativeHandle(),
+                     static_cast<off_t>(offset));
+  if (data == MAP_FAILED) {
+    return;
+  }
+
+  // Read ahead aggressively and release pages soon after they are read.
+  ::posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+  data_ = data;
+  size_ = size;
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    ::munmap(data_, size_);
+  }
+}
+
+size_t MappedFile::granularity() {
+  return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
 boost::optional<std::string> getHomeDirectory() {
   // Try to get the caller's home directory using HOME and getpwuid.
   auto user = ::getpwuid(getuid());
@@ -301,6 +347,81 @@ std::vector<std::string> platformGlob(const std::string& find_path) {
   return results;
 }
 
+/// Yield the entries of an open directory, then walk its subdirectories.
+static bool walkDirectory(
+    int dir_fd,
+    const std::string& path,
+    size_t depth,
+    const std::function<bool(const std::string&)>& predicate) {
+  auto* dir = ::fdopendir(dir_fd);
+  if (dir == nullptr) {
+    ::close(dir_fd);
+    return true;
+  }
+
+  // Pairs of entry name and whether the entry is a directory.
+  std::vector<std::pair<std::string, bool>> entries;
+  struct dirent* entry = nullptr;
+  while ((entry = ::readdir(dir)) != nullptr) {
+    // A glob wildcard does not match hidden files.
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+
+    bool folder = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+      // Links to directories are marked and walked, as glob does.
+      struct stat entry_stat;
+      folder = ::fstatat(::dirfd(dir), entry->d_name, &entry_stat, 0) == 0 &&
+               S_ISDIR(entry_stat.st_mode);
+    }
+    entries.emplace_back(entry->d_name, folder);
+  }
+  std::sort(entries.begin(), entries.end());
+
+  bool walking = true;
+  for (const auto& dir_entry : entries) {
+    auto entry_path = path + dir_entry.first;
+    if (!predicate((dir_entry.second) ? entry_path + '/' : entry_path)) {
+      walking = false;
+      break;
+    }
+  }
+
+  for (size_t i = 0; walking && depth > 1 && i < entries.size(); i++) {
+    if (!entries[i].second) {
+      continue;
+    }
+
+    // Open subdirectories relative to the directory, not by their full path.
+    int fd = ::openat(::dirfd(dir),
+                      entries[i].first.c_str(),
+                      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+      walking = walkDirectory(
+          fd, path + entries[i].first + '/', depth - 1, predicate);
+    }
+  }
+
+  ::closedir(dir);
+  return walking;
+}
+
+bool platformWalk(const std::string& root,
+                  size_t depth,
+                  const std::function<bool(const std::string&)>& predicate) {
+  auto path = root;
+  if (path.empty() || path.back() != '/') {
+    path += '/';
+  }
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return true;
+  }
+  return walkDirectory(fd, path, depth, predicate);
+}
+
 int platformAccess(const std::string& path, mode_t mode) {
   return ::access(path.c_str(), mode);
 }
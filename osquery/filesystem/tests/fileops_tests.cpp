@@ -706,6 +706,40 @@ TEST_F(FileOpsTests, test_glob) {
   }
 }
 
+TEST_F(FileOpsTests, test_walk) {
+  // Each level of the walk matches a glob with one more wildcard.
+  std::vector<fs::path> expected;
+  auto pattern = kFakeDirectory;
+  for (size_t depth = 1; depth <= 2; depth++) {
+    pattern += "/*";
+    for (const auto& path : platformGlob(pattern)) {
+      expected.push_back(path);
+    }
+  }
+
+  std::vector<std::string> results;
+  EXPECT_TRUE(platformWalk(
+      kFakeDirectory, 2, ([&results](const std::string& path) {
+        results.push_back(path);
+        return true;
+      })));
+  EXPECT_TRUE(globResultsMatch(results, expected));
+
+  // The predicate may stop the walk.
+  size_t count = 0;
+  EXPECT_FALSE(platformWalk(
+      kFakeDirectory, 8, ([&count](const std::string& path) {
+        return ++count < 3;
+      })));
+  EXPECT_EQ(count, 3U);
+
+  // A missing directory has nothing to walk.
+  EXPECT_TRUE(platformWalk(
+      kFakeDirectory + "/not_a_directory", 8, ([](const std::string& path) {
+        return false;
+      })));
+}
+
 TEST_F(FileOpsTests, test_zero_permissions_file) {
   TempFile tmp_file;
   std::string path = tmp_file.path();
@@ -10,12 +10,14 @@
 
 #include <algorithm>
 #include <fstream>
+#include <sstream>
 
 #include <stdio.h>
 
 #include <gtest/gtest.h>
 
 #include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/filesystem.h>
@@ -23,6 +25,9 @@
 #include <osquery/system.h>
 
 #include "osquery/core/process.h"
+#ifdef __linux__
+#include "osquery/filesystem/linux/proc.h"
+#endif
 #include "osquery/tests/test_util.h"
 
 namespace fs = boost::filesystem;
@@ -31,6 +36,7 @@ namespace pt = boost::property_tree;
 namespace osquery {
 
 DECLARE_uint64(read_max);
+DECLARE_bool(read_mapped);
 
 class FilesystemTests : public testing::Test {
  protected:
@@ -172,6 +178,48 @@ TEST_F(FilesystemTests, test_read_limit) {
   EXPECT_TRUE(status.ok());
 }
 
+TEST_F(FilesystemTests, test_read_mapped_file) {
+  // A file larger than one mapped window.
+  auto path = kTestWorkingDirectory + "/mapped.txt";
+  std::string content(9 * 1024 * 1024 + 7, 'a');
+  content.back() = 'z';
+  ASSERT_TRUE(writeTextFile(path, content).ok());
+  auto empty_path = kTestWorkingDirectory + "/mapped_empty.txt";
+  ASSERT_TRUE(writeTextFile(empty_path, "").ok());
+
+  auto mapped = FLAGS_read_mapped;
+  for (bool read_mapped : {false, true}) {
+    FLAGS_read_mapped = read_mapped;
+    std::string read_content;
+    auto status = readMappedFile(
+        path, 4096, false, ([&read_content](const char* buffer, size_t size) {
+          read_content.append(buffer, size);
+        }));
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(read_content, content);
+
+    // Empty files are read, not mapped.
+    size_t calls = 0;
+    status = readMappedFile(
+        empty_path, 4096, false, ([&calls](const char* buffer, size_t size) {
+          calls++;
+        }));
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(calls, 0U);
+
+    // The read limit applies.
+    auto max = FLAGS_read_max;
+    FLAGS_read_max = 3;
+    status = readMappedFile(
+        path, 4096, false, ([](const char* buffer, size_t size) {}));
+    EXPECT_FALSE(status.ok());
+    FLAGS_read_max = max;
+  }
+  FLAGS_read_mapped = mapped;
+  removePath(path);
+  removePath(empty_path);
+}
+
 TEST_F(FilesystemTests, test_list_files_missing_directory) {
   std::vector<std::string> results;
   auto status = listFilesInDirectory("/foo/bar", results);
@@ -322,6 +370,26 @@ TEST_F(FilesystemTests, test_wildcard_double_folders) {
                            .string()));
 }
 
+TEST_F(FilesystemTests, test_wildcard_double_stream) {
+  // Streamed matches are the same as the collected matches.
+  std::vector<std::string> results;
+  auto status = resolveFilePattern(
+      kFakeDirectory + "/%%", GLOB_ALL, ([&results](const std::string& path) {
+        results.push_back(path);
+        return true;
+      }));
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 20U);
+
+  // The predicate may stop resolving the pattern.
+  size_t count = 0;
+  resolveFilePattern(
+      kFakeDirectory + "/%%", GLOB_ALL, ([&count](const std::string& path) {
+        return ++count < 3;
+      }));
+  EXPECT_EQ(count, 3U);
+}
+
 TEST_F(FilesystemTests, test_wildcard_end_last_component) {
   std::vector<std::string> results;
   auto status = resolveFilePattern(kFakeDirectory + "/%11/%sh", results);
@@ -470,4 +538,87 @@ TEST_F(FilesystemTests, test_read_urandom) {
     EXPECT_NE(first, second);
   }
 }
+
+TEST_F(FilesystemTests, test_parse_json_content) {
+  std::string content =
+      "{\"options\": {\"a\": 1.50, \"b\": true, \"c\": null},"
+      " \"list\": [1, \"two\", {\"k\": \"\\u00e9\\n\"}, []],"
+      " \"a\": {}, \"a\": \"dup\"}";
+
+  // The tree must match the content read by boost's JSON parser.
+  pt::ptree expected;
+  std::stringstream input;
+  input << content;
+  pt::read_json(input, expected);
+
+  pt::ptree tree;
+  auto status = parseJSONContent(content, tree);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(expected, tree);
+  EXPECT_EQ("1.50", tree.get<std::string>("options.a"));
+
+  // Malformed content leaves the output tree untouched.
+  status = parseJSONContent(std::string("{\"a\": [1, 2}"), tree);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(expected, tree);
+}
+
+#ifdef __linux__
+TEST_F(FilesystemTests, test_proc_reader) {
+  auto pid = std::to_string(PlatformProcess::getCurrentProcess()->pid());
+
+  ProcReader reader;
+  ASSERT_TRUE(reader.open(pid));
+  EXPECT_TRUE(reader.read("stat").ok());
+  EXPECT_EQ(0U, reader.content().find(pid + " ("));
+
+  std::string exe;
+  EXPECT_TRUE(reader.readLink("exe", exe).ok());
+  EXPECT_FALSE(exe.empty());
+
+  // Files opened by the test are visible through the process descriptors.
+  std::map<std::string, std::string> descriptors;
+  EXPECT_TRUE(reader.descriptors(descriptors).ok());
+  EXPECT_FALSE(descriptors.empty());
+
+  EXPECT_FALSE(reader.read("not_an_attribute").ok());
+  EXPECT_FALSE(reader.open("0"));
+}
+
+TEST_F(FilesystemTests, test_proc_walk) {
+  std::set<std::string> pids;
+  EXPECT_TRUE(procProcesses(pids).ok());
+  pids.insert("0");
+
+  QueryData results;
+  procWalk(pids,
+           ([](ProcReader& /* reader */,
+               const std::string& pid,
+               QueryData& rows) { rows.push_back({{"pid", pid}}); }),
+           results);
+
+  // The pid 0 cannot be opened, each other process is walked in order.
+  ASSERT_FALSE(results.empty());
+  EXPECT_LE(results.size(), pids.size() - 1);
+  for (size_t i = 1; i < results.size(); i++) {
+    EXPECT_LT(results[i - 1]["pid"], results[i]["pid"]);
+  }
+}
+
+TEST_F(FilesystemTests, test_proc_descriptor_index) {
+  // Outside of the schedule each request builds a new index.
+  auto index = getProcDescriptorIndex(0);
+  EXPECT_NE(index, getProcDescriptorIndex(0));
+
+  // The test process has open descriptors.
+  auto pid = std::to_string(PlatformProcess::getCurrentProcess()->pid());
+  ASSERT_EQ(1U, index->descriptors.count(pid));
+  EXPECT_FALSE(index->descriptors.at(pid).empty());
+
+  // Within a step the index is shared, until the step changes.
+  index = getProcDescriptorIndex(1);
+  EXPECT_EQ(index, getProcDescriptorIndex(1));
+  EXPECT_NE(index, getProcDescriptorIndex(2));
+}
+#endif
 }
@@ -15,6 +15,8 @@
 #include <io.h>
 #include <sddl.h>
 
+#include <algorithm>
+#include <array>
 #include <memory>
 #include <regex>
 #include <vector>
@@ -22,6 +24,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
 
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/core/process.h"
@@ -35,6 +38,11 @@ namespace errc = boost::system::errc;
 
 namespace osquery {
 
+FLAG(bool,
+     unbuffered_reads,
+     false,
+     "Read hashed and carved files with unbuffered, overlapped reads ahead");
+
 /*
  * Avoid having the same right being used in multiple CHMOD_* macros. Doing so
  * will cause issues when requesting certain permissions in the presence of deny
@@ -168,6 +176,138 @@ AsyncEvent::~AsyncEvent() {
   }
 }
 
+/**
+ * @brief Reads a file ahead of the caller with unbuffered, overlapped I/O.
+ *
+ * Two large page-aligned blocks are read in turn. While the caller consumes
+ * one block, the next is read into the other, bypassing the cache manager.
+ */
+struct SequentialReader : private boost::noncopyable {
+  /// The size of each block, a multiple of any sector size.
+  static const DWORD kBlockSize = 1024 * 1024;
+
+  struct Block {
+    AsyncEvent event;
+    char* data{nullptr};
+    DWORD size{0};
+    bool pending{false};
+  };
+
+  explicit SequentialReader(HANDLE handle) : handle_(handle) {
+    for (auto& block : blocks_) {
+      block.data = static_cast<char*>(::VirtualAlloc(
+          nullptr, kBlockSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+      if (block.data == nullptr) {
+        failed_ = true;
+        return;
+      }
+    }
+
+    for (auto& block : blocks_) {
+      request(block);
+    }
+  }
+
+  ~SequentialReader() {
+    ::CancelIo(handle_);
+    for (auto& block : blocks_) {
+      if (block.pending) {
+        DWORD bytes = 0;
+        ::GetOverlappedResult(
+            handle_, &block.event.overlapped_, &bytes, TRUE);
+      }
+      if (block.data != nullptr) {
+        ::VirtualFree(block.data, 0, MEM_RELEASE);
+      }
+    }
+  }
+
+  ssize_t read(void* buf, size_t nbyte) {
+    auto* out = static_cast<char*>(buf);
+    size_t copied = 0;
+    while (copied < nbyte && !failed_) {
+      auto& block = blocks_[current_];
+      if (!ready_) {
+        complete(block);
+        ready_ = true;
+        position_ = 0;
+        continue;
+      }
+
+      if (position_ == block.size) {
+        if (block.size < kBlockSize) {
+          // A short block is the end of the file.
+          break;
+        }
+
+        // Refill the consumed block after the other block.
+        request(block);
+        current_ = (current_ + 1) % blocks_.size();
+        ready_ = false;
+        continue;
+      }
+
+      auto count =
+          min(nbyte - copied, static_cast<size_t>(block.size - position_));
+      ::memcpy(out + copied, block.data + position_, count);
+      position_ += static_cast<DWORD>(count);
+      copied += count;
+    }
+
+    if (failed_ && copied == 0) {
+      return -1;
+    }
+    return static_cast<ssize_t>(copied);
+  }
+
+ private:
+  void request(Block& block) {
+    auto& overlapped = block.event.overlapped_;
+    overlapped.Offset = static_cast<DWORD>(offset_ & 0xFFFFFFFF);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset_ >> 32);
+    offset_ += kBlockSize;
+
+    block.size = 0;
+    block.pending = false;
+    if (::ReadFile(handle_, block.data, kBlockSize, nullptr, &overlapped) ||
+        ::GetLastError() == ERROR_IO_PENDING) {
+      block.pending = true;
+    } else if (::GetLastError() != ERROR_HANDLE_EOF) {
+      failed_ = true;
+    }
+  }
+
+  void complete(Block& block) {
+    if (!block.pending) {
+      return;
+    }
+
+    block.pending = false;
+    if (!::GetOverlappedResult(
+            handle_, &block.event.overlapped_, &block.size, TRUE)) {
+      block.size = 0;
+      if (::GetLastError() != ERROR_HANDLE_EOF) {
+        failed_ = true;
+      }
+    }
+  }
+
+ private:
+  HANDLE handle_;
+  std::array<Block, 2> blocks_;
+
+  /// The block being consumed, and the bytes consumed from it.
+  size_t current_{0};
+  DWORD position_{0};
+
+  /// The current block's read has completed.
+  bool ready_{false};
+
+  /// The file offset of the next block requested.
+  uint64_t offset_{0};
+  bool failed_{false};
+};
+
 // Inspired by glob-to-regexp node package
 static std::string globToRegex(const std::string& glob) {
   bool in_group = false;
@@ -586,6 +726,18 @@ PlatformFile::PlatformFile(const fs::path& path, int mode, int perms)
     is_nonblock_ = true;
   }
 
+  // Sequential reads are unbuffered and overlapped if requested, otherwise
+  // the cache manager is asked to read further ahead.
+  bool unbuffered = false;
+  if ((mode & PF_SEQUENTIAL) == PF_SEQUENTIAL) {
+    flags_and_attrs |= FILE_FLAG_SEQUENTIAL_SCAN;
+    unbuffered = FLAGS_unbuffered_reads && !is_nonblock_ &&
+                 access_mask == GENERIC_READ;
+    if (unbuffered) {
+      flags_and_attrs |= FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED;
+    }
+  }
+
   if (perms != -1) {
     // TODO(#2001): set up a security descriptor based off the perms
   }
@@ -604,9 +756,16 @@ PlatformFile::PlatformFile(const fs::path& path, int mode, int perms)
   if (handle_ != INVALID_HANDLE_VALUE && (mode & PF_APPEND) == PF_APPEND) {
     seek(0, PF_SEEK_END);
   }
+
+  if (handle_ != INVALID_HANDLE_VALUE && unbuffered) {
+    sequential_ = std::make_shared<SequentialReader>(handle_);
+  }
 }
 
 PlatformFile::~PlatformFile() {
+  // Outstanding reads ahead complete before the handle is closed.
+  sequential_.reset();
+
   if (handle_ != kInvalidHandle && handle_ != nullptr) {
     // Only cancel IO if we are a non-blocking HANDLE
     if (is_nonblock_) {
@@ -954,7 +1113,9 @@ ssize_t PlatformFile::read(void* buf, size_t nbyte) {
 
   has_pending_io_ = false;
 
-  if (is_nonblock_) {
+  if (sequential_ != nullptr) {
+    nret = sequential_->read(buf, nbyte);
+  } else if (is_nonblock_) {
     if (last_read_.is_active_) {
       nret = getOverlappedResultForRead(buf, nbyte);
     } else {
@@ -1050,7 +1211,7 @@ ssize_t PlatformFile::write(const void* buf, size_t nbyte) {
 }
 
 off_t PlatformFile::seek(off_t offset, SeekMode mode) {
-  if (!isValid()) {
+  if (!isValid() || sequential_ != nullptr) {
     return -1;
   }
 
@@ -1313,6 +1474,100 @@ std::vector<std::string> platformGlob(const std::string& find_path) {
   return results;
 }
 
+MappedFile::MappedFile(const PlatformFile& file, size_t offset, size_t size) {
+  if (size == 0 || ::GetFileType(file.nativeHandle()) != FILE_TYPE_DISK) {
+    return;
+  }
+
+  // The view keeps the mapping open, its handle is not needed after mapping.
+  auto mapping = ::CreateFileMappingA(
+      file.nativeHandle(), nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping == nullptr) {
+    return;
+  }
+
+  ULARGE_INTEGER view_offset;
+  view_offset.QuadPart = offset;
+  data_ = ::MapViewOfFile(mapping,
+                          FILE_MAP_READ,
+                          view_offset.HighPart,
+                          view_offset.LowPart,
+                          size);
+  ::CloseHandle(mapping);
+  if (data_ != nullptr) {
+    size_ = size;
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    ::UnmapViewOfFile(data_);
+  }
+}
+
+size_t MappedFile::granularity() {
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return static_cast<size_t>(info.dwAllocationGranularity);
+}
+
+/// Yield the entries of a directory, then walk its subdirectories.
+static bool walkDirectory(
+    const std::string& path,
+    size_t depth,
+    const std::function<bool(const std::string&)>& predicate) {
+  // The basic information and large fetch reduce the calls per directory.
+  WIN32_FIND_DATAA fd;
+  auto handle = ::FindFirstFileExA((path + "*").c_str(),
+                                   FindExInfoBasic,
+                                   &fd,
+                                   FindExSearchNameMatch,
+                                   nullptr,
+                                   FIND_FIRST_EX_LARGE_FETCH);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return true;
+  }
+
+  // Pairs of entry name and whether the entry is a directory.
+  std::vector<std::pair<std::string, bool>> entries;
+  do {
+    std::string name(fd.cFileName);
+    if (name != "." && name != "..") {
+      entries.emplace_back(
+          name, (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    }
+  } while (::FindNextFileA(handle, &fd));
+  ::FindClose(handle);
+  std::sort(entries.begin(), entries.end());
+
+  bool walking = true;
+  for (const auto& entry : entries) {
+    auto entry_path = path + entry.first;
+    if (!predicate((entry.second) ? entry_path + '\\' : entry_path)) {
+      walking = false;
+      break;
+    }
+  }
+
+  for (size_t i = 0; walking && depth > 1 && i < entries.size(); i++) {
+    if (entries[i].second) {
+      walking = walkDirectory(
+          path + entries[i].first + '\\', depth - 1, predicate);
+    }
+  }
+  return walking;
+}
+
+bool platformWalk(const std::string& root,
+                  size_t depth,
+                  const std::function<bool(const std::string&)>& predicate) {
+  auto path = fs::path(root).make_preferred().string();
+  if (path.empty() || path.back() != '\\') {
+    path += '\\';
+  }
+  return walkDirectory(path, depth, predicate);
+}
+
 boost::optional<std::string> getHomeDirectory() {
   std::vector<char> profile(MAX_PATH);
   auto value = getEnvVar("USERPROFILE");
@@ -13,6 +13,7 @@
 #include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/query.h>
 
 namespace osquery {
 
@@ -83,4 +84,65 @@ static void LOGGER_logstring_plugin(benchmark::State& state) {
 }
 
 BENCHMARK(LOGGER_logstring_plugin);
+
+static QueryLogItem getExampleQueryLogItem(size_t x, size_t y) {
+  QueryLogItem item;
+  item.name = "example";
+  item.identifier = "hostname";
+  item.time = 1408993857;
+  item.calendar_time = "Mon Aug 25 12:10:57 2014";
+  item.decorations["host_uuid"] = "A2C3E4F6-1234-5678-9ABC-DEF012345678";
+
+  Row r;
+  for (size_t i = 0; i < x; i++) {
+    r["key" + std::to_string(i)] = "/path/to/" + std::to_string(i) + "content";
+  }
+  for (size_t i = 0; i < y; i++) {
+    item.results.added.push_back(r);
+    item.results.removed.push_back(r);
+  }
+  return item;
+}
+
+static void LOGGER_serialize_query_log_item(benchmark::State& state) {
+  auto item = getExampleQueryLogItem(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    std::string json;
+    serializeQueryLogItemJSON(item, json);
+  }
+}
+
+BENCHMARK(LOGGER_serialize_query_log_item)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100)
+    ->ArgPair(100, 100);
+
+static void LOGGER_serialize_query_log_item_events(benchmark::State& state) {
+  auto item = getExampleQueryLogItem(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    std::vector<std::string> items;
+    serializeQueryLogItemAsEventsJSON(item, items);
+  }
+}
+
+BENCHMARK(LOGGER_serialize_query_log_item_events)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100)
+    ->ArgPair(100, 100);
+
+static void LOGGER_serialize_query_log_item_ptree(benchmark::State& state) {
+  auto item = getExampleQueryLogItem(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    boost::property_tree::ptree tree;
+    serializeQueryLogItem(item, tree);
+  }
+}
+
+BENCHMARK(LOGGER_serialize_query_log_item_ptree)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100)
+    ->ArgPair(100, 100);
 }
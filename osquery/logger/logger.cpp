@@ -16,12 +16,17 @@
 
 #include <algorithm>
 #include <future>
+#include <iterator>
+#include <map>
+#include <mutex>
 #include <queue>
 #include <thread>
+#include <tuple>
 
 #include <boost/noncopyable.hpp>
 
 #include <osquery/database.h>
+#include <osquery/dispatcher.h>
 #include <osquery/events.h>
 #include <osquery/extensions.h>
 #include <osquery/filesystem.h>
@@ -31,6 +36,10 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/core/memory.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/msgpack.h"
+#include "osquery/core/trace.h"
 
 namespace pt = boost::property_tree;
 namespace rj = rapidjson;
@@ -56,6 +65,12 @@ FLAG(bool,
      false,
      "Log scheduled snapshot results as events");
 
+/// Log results and forwarded events as length-delimited MessagePack records.
+FLAG(string,
+     logger_format,
+     "json",
+     "Format of results and forwarded events: json, msgpack");
+
 /// Alias for the minloglevel used internally by GLOG.
 FLAG(int32, logger_min_status, 0, "Minimum level for status log recording");
 
@@ -80,13 +95,18 @@ CLI_FLAG(bool, logger_stderr, true, "Write status logs to stderr");
  * Otherwise they are buffered and an async request for draining is sent
  * for each log.
  *
- * Within the daemon, logs are drained every 3 seconds.
+ * Within the daemon, logs are drained every --logger_status_interval.
  */
 HIDDEN_FLAG(bool,
             logger_status_sync,
             false,
             "Always send status logs synchronously");
 
+FLAG(uint64,
+     logger_status_interval,
+     3000,
+     "Milliseconds between relays of buffered status logs in the daemon");
+
 /**
  * @brief Logger plugin registry.
  *
@@ -98,6 +118,31 @@ CREATE_REGISTRY(LoggerPlugin, "logger");
 
 class LoggerDisabler;
 
+/// Status log lines buffered by one logging thread.
+struct StatusLogBuffer {
+  /// Only contended while the relay takes the lines.
+  std::mutex mutex;
+
+  /// Lines with their sequence, to order lines from several threads.
+  std::vector<std::pair<size_t, StatusLogLine>> lines;
+};
+
+/// The buffer of this thread, or nullptr if the thread has none.
+static thread_local StatusLogBuffer* kThreadStatusBuffer{nullptr};
+
+/// Set when the thread's buffer is released at thread exit.
+static thread_local bool kThreadStatusBufferReleased{false};
+
+/// Release the thread's buffer, lines left are taken by the next relay.
+struct StatusLogBufferHolder {
+  ~StatusLogBufferHolder() {
+    kThreadStatusBuffer = nullptr;
+    kThreadStatusBufferReleased = true;
+  }
+
+  std::shared_ptr<StatusLogBuffer> buffer;
+};
+
 /**
  * @brief A custom Glog log sink for forwarding or buffering status logs.
  *
@@ -132,8 +177,17 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
   void WaitTillSent() override;
 
  public:
-  /// Accessor/mutator to dump all of the buffered logs.
-  std::vector<StatusLogLine>& dump();
+  /**
+   * @brief Take all of the buffered logs, in the order they were sent.
+   *
+   * Buffers of threads that exited are removed once they are taken.
+   */
+  void take(std::vector<StatusLogLine>& logs);
+
+  /// The number of buffered logs.
+  size_t queued() const {
+    return queued_;
+  }
 
   /// Remove the buffered log sink from Glog.
   void disable();
@@ -192,14 +246,33 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
 
  private:
   /// Create the log sink as buffering or forwarding.
-  BufferedLogSink() = default;
+  BufferedLogSink()
+      : released_(std::make_shared<StatusLogBuffer>()),
+        buffers_({released_}) {}
+
+  /// The calling thread's buffer, created when the thread first logs.
+  StatusLogBuffer& buffer();
 
   /// Remove the log sink.
   ~BufferedLogSink();
 
  private:
-  /// Intermediate log storage until an osquery logger is initialized.
-  std::vector<StatusLogLine> logs_;
+  /// Used by threads logging while they exit, after their buffer is released.
+  std::shared_ptr<StatusLogBuffer> released_;
+
+  /**
+   * @brief Intermediate log storage until the logs are relayed.
+   *
+   * Each thread appends to its own buffer, such that logging threads do not
+   * contend with each other. A buffer is only shared with the relay.
+   */
+  std::vector<std::shared_ptr<StatusLogBuffer>> buffers_;
+
+  /// Orders the lines of every buffer.
+  std::atomic<size_t> sequence_{0};
+
+  /// The number of lines in every buffer.
+  std::atomic<size_t> queued_{0};
 
   /**
    * @Brief Is the logger temporarily disabled.
@@ -231,12 +304,74 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
   friend class LoggerDisabler;
 };
 
-/// Mutex protecting accesses to buffered status logs.
+/// Mutex protecting the list of status log buffers.
 Mutex kBufferedLogSinkLogs;
 
 /// Mutex protecting queued status log futures.
 Mutex kBufferedLogSinkSenders;
 
+/// The backpressure reported by each buffering logger.
+static std::map<std::string, size_t> kLoggerBackpressure;
+
+/// Mutex protecting the reported logger backpressure.
+static Mutex kLoggerBackpressureMutex;
+
+/// The lines buffered by each buffering logger.
+static std::map<std::string, size_t> kLoggerBuffered;
+
+/// Protect the buffered lines of each logger.
+static Mutex kLoggerBufferedMutex;
+
+/// Batched results, by receiver and priority class, in the order logged.
+using LoggerBatch =
+    std::map<std::pair<std::string, size_t>, std::vector<std::string>>;
+
+/// Results batched since the last flush, see setLoggerBatching.
+static LoggerBatch kLoggerBatch;
+
+/// The size of the batched results.
+static size_t kLoggerBatchSize{0};
+
+/// Queue results rather than logging them.
+static std::atomic<bool> kLoggerBatching{false};
+
+/// Protect the batched results.
+static Mutex kLoggerBatchMutex;
+
+/// Orders flushes of the batched results.
+static std::mutex kLoggerBatchFlushMutex;
+
+/// The largest batch kept before the logging thread flushes it.
+const size_t kLoggerBatchMax = 4 * 1024 * 1024;
+
+/// The bytes of result and snapshot lines handed to the loggers.
+static Metric kLoggerWritten("osquery_logger_result_bytes_total",
+                             "Bytes of result and snapshot log lines");
+
+/// Relays the daemon's buffered status logs to the logger plugins.
+class StatusLogRelayRunner : public PeriodicRunnable {
+ public:
+  StatusLogRelayRunner() : PeriodicRunnable("StatusLogRelayRunner") {}
+
+  /// The relay may be started again once it is stopped.
+  ~StatusLogRelayRunner() override {
+    started_ = false;
+  }
+
+  /// Start the relay service once.
+  static void startRelay();
+
+ protected:
+  void tick() override;
+
+  std::chrono::milliseconds period() override;
+
+ private:
+  static std::atomic<bool> started_;
+};
+
+std::atomic<bool> StatusLogRelayRunner::started_{false};
+
 /// Scoped helper to perform logging actions without races.
 class LoggerDisabler : private boost::noncopyable {
  public:
@@ -403,9 +538,30 @@ void initLogger(const std::string& name) {
     // Begin forwarding after all plugins have been set up.
     BufferedLogSink::get().enable();
     relayStatusLogs(true);
+
+    // GLog is not re-entrant, so the daemon relays from a dedicated thread.
+    if (Initializer::isDaemon()) {
+      StatusLogRelayRunner::startRelay();
+    }
+  }
+}
+
+void StatusLogRelayRunner::startRelay() {
+  bool started = false;
+  if (started_.compare_exchange_strong(started, true) &&
+      !Dispatcher::addService(std::make_shared<StatusLogRelayRunner>()).ok()) {
+    started_ = false;
   }
 }
 
+void StatusLogRelayRunner::tick() {
+  relayStatusLogs(true);
+}
+
+std::chrono::milliseconds StatusLogRelayRunner::period() {
+  return std::chrono::milliseconds(FLAGS_logger_status_interval);
+}
+
 BufferedLogSink& BufferedLogSink::get() {
   static BufferedLogSink sink;
   return sink;
@@ -457,18 +613,22 @@ void BufferedLogSink::send(google::LogSeverity severity,
 
   // WARNING, be extremely careful when accessing data here.
   // This should not cause any persistent storage or logging actions.
+  // The host identifier is added when the lines are relayed.
+  StatusLogLine log = {(StatusLogSeverity)severity,
+                       std::string(base_filename),
+                       static_cast<size_t>(line),
+                       std::string(message, message_len),
+                       toAsciiTimeUTC(tm_time),
+                       toUnixTime(tm_time),
+                       std::string()};
   {
-    WriteLock lock(kBufferedLogSinkLogs);
-    logs_.push_back({(StatusLogSeverity)severity,
-                     std::string(base_filename),
-                     static_cast<size_t>(line),
-                     std::string(message, message_len),
-                     toAsciiTimeUTC(tm_time),
-                     toUnixTime(tm_time),
-                     std::string()});
+    auto& buffer = this->buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.lines.emplace_back(sequence_++, std::move(log));
+    queued_++;
   }
 
-  // The daemon will relay according to the schedule.
+  // The daemon's StatusLogRelayRunner will relay the buffered lines.
   if (enabled_ && !Initializer::isDaemon()) {
     relayStatusLogs(FLAGS_logger_status_sync);
   }
@@ -501,8 +661,57 @@ void BufferedLogSink::setPrimary(const std::string& plugin) {
   }
 }
 
-std::vector<StatusLogLine>& BufferedLogSink::dump() {
-  return logs_;
+StatusLogBuffer& BufferedLogSink::buffer() {
+  if (kThreadStatusBuffer != nullptr) {
+    return *kThreadStatusBuffer;
+  } else if (kThreadStatusBufferReleased) {
+    return *released_;
+  }
+
+  thread_local StatusLogBufferHolder holder;
+  holder.buffer = std::make_shared<StatusLogBuffer>();
+  {
+    WriteLock lock(kBufferedLogSinkLogs);
+    buffers_.push_back(holder.buffer);
+  }
+  kThreadStatusBuffer = holder.buffer.get();
+  return *kThreadStatusBuffer;
+}
+
+void BufferedLogSink::take(std::vector<StatusLogLine>& logs) {
+  std::vector<std::pair<size_t, StatusLogLine>> lines;
+  {
+    WriteLock lock(kBufferedLogSinkLogs);
+    for (auto it = buffers_.begin(); it != buffers_.end();) {
+      // A buffer only held by the sink belongs to a thread that exited.
+      bool released = (it->use_count() == 1 && *it != released_);
+      {
+        std::lock_guard<std::mutex> buffer_lock((*it)->mutex);
+        std::move((*it)->lines.begin(),
+                  (*it)->lines.end(),
+                  std::back_inserter(lines));
+        queued_ -= (*it)->lines.size();
+        (*it)->lines.clear();
+      }
+
+      if (released) {
+        it = buffers_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  std::sort(lines.begin(),
+            lines.end(),
+            [](const std::pair<size_t, StatusLogLine>& l,
+               const std::pair<size_t, StatusLogLine>& r) {
+              return l.first < r.first;
+            });
+  logs.reserve(logs.size() + lines.size());
+  for (auto& line : lines) {
+    logs.push_back(std::move(line.second));
+  }
 }
 
 bool BufferedLogSink::isPrimaryLogger(const std::string& plugin) const {
@@ -531,6 +740,11 @@ Status LoggerPlugin::call(const PluginRequest& request,
   QueryLogItem item;
   std::vector<StatusLogLine> intermediate_logs;
   if (request.count("string") > 0) {
+    unsigned long long priority = 0;
+    if (request.count("priority") > 0 &&
+        safeStrtoull(request.at("priority"), 10, priority).ok()) {
+      return this->logPriorityString(request.at("string"), priority);
+    }
     return this->logString(request.at("string"));
   } else if (request.count("snapshot") > 0) {
     return this->logSnapshot(request.at("snapshot"));
@@ -554,18 +768,46 @@ Status LoggerPlugin::call(const PluginRequest& request,
   }
 }
 
+/**
+ * @brief Get an internal logger plugin.
+ *
+ * Internal plugins are given log lines by reference, the lines are only
+ * copied into a request when calling a logger plugin within an extension.
+ *
+ * @return nullptr if the logger is not an internal plugin.
+ */
+static std::shared_ptr<LoggerPlugin> getInternalLogger(
+    const std::string& logger) {
+  // Each logging thread keeps a handle to each logger it uses.
+  thread_local std::map<std::string, PluginHandle<LoggerPlugin>> handles;
+  auto handle = handles.find(logger);
+  if (handle == handles.end()) {
+    handle = handles
+                 .emplace(std::piecewise_construct,
+                          std::forward_as_tuple(logger),
+                          std::forward_as_tuple("logger", logger))
+                 .first;
+  }
+  return handle->second.get();
+}
+
 Status logString(const std::string& message, const std::string& category) {
   return logString(
       message, category, RegistryFactory::get().getActive("logger"));
 }
 
-Status logString(const std::string& message,
-                 const std::string& category,
-                 const std::string& receiver) {
+/// Log a results string to each receiver, with its query's priority class.
+static Status logPriorityString(const std::string& message,
+                                const std::string& category,
+                                const std::string& receiver,
+                                size_t priority) {
+  MEMORY_TAG(LOGGER);
   if (FLAGS_disable_logging) {
     return Status(0, "Logging disabled");
   }
 
+  TRACE_SPAN("logString", category);
+  kLoggerWritten.add(message.size());
   Status status;
   for (const auto& logger : osquery::split(receiver, ",")) {
     if (FLAGS_logger_secondary_status_only &&
@@ -573,83 +815,182 @@ Status logString(const std::string& message,
       continue;
     }
 
-    if (Registry::get().exists("logger", logger, true)) {
-      auto plugin = Registry::get().plugin("logger", logger);
-      auto logger_plugin = std::dynamic_pointer_cast<LoggerPlugin>(plugin);
-      status = logger_plugin->logString(message);
+    auto logger_plugin = getInternalLogger(logger);
+    if (logger_plugin != nullptr) {
+      status = (priority > 0)
+                   ? logger_plugin->logPriorityString(message, priority)
+                   : logger_plugin->logString(message);
     } else {
-      status = Registry::call(
-          "logger", logger, {{"string", message}, {"category", category}});
+      PluginRequest request = {{"string", message}, {"category", category}};
+      if (priority > 0) {
+        request["priority"] = std::to_string(priority);
+      }
+      status = Registry::call("logger", logger, request);
     }
   }
   return status;
 }
 
-Status logQueryLogItem(const QueryLogItem& results) {
-  return logQueryLogItem(results, RegistryFactory::get().getActive("logger"));
+Status logString(const std::string& message,
+                 const std::string& category,
+                 const std::string& receiver) {
+  return logPriorityString(message, category, receiver, 0);
 }
 
-Status logQueryLogItem(const QueryLogItem& results,
-                       const std::string& receiver) {
-  if (FLAGS_disable_logging) {
-    return Status(0, "Logging disabled");
+/// Log a batch of results strings to each receiver.
+static Status logPriorityStrings(const std::vector<std::string>& messages,
+                                 const std::string& receiver,
+                                 size_t priority) {
+  MEMORY_TAG(LOGGER);
+  TRACE_SPAN("logPriorityStrings", receiver);
+  for (const auto& message : messages) {
+    kLoggerWritten.add(message.size());
   }
 
-  std::vector<std::string> json_items;
   Status status;
-  if (FLAGS_logger_event_type) {
-    status = serializeQueryLogItemAsEventsJSON(results, json_items);
-  } else {
-    std::string json;
-    status = serializeQueryLogItemJSON(results, json);
-    json_items.emplace_back(json);
+  for (const auto& logger : osquery::split(receiver, ",")) {
+    if (FLAGS_logger_secondary_status_only &&
+        !BufferedLogSink::get().isPrimaryLogger(logger)) {
+      continue;
+    }
+
+    auto logger_plugin = getInternalLogger(logger);
+    if (logger_plugin != nullptr) {
+      status = logger_plugin->logPriorityStrings(messages, priority);
+      continue;
+    }
+
+    // Extension loggers receive a request for each string.
+    for (const auto& message : messages) {
+      PluginRequest request = {{"string", message}, {"category", "event"}};
+      if (priority > 0) {
+        request["priority"] = std::to_string(priority);
+      }
+      status = Registry::call("logger", logger, request);
+    }
   }
-  if (!status.ok()) {
-    return status;
+  return status;
+}
+
+/// Queue results strings, flushing the batch if it is large.
+static Status batchPriorityStrings(std::vector<std::string>& messages,
+                                   const std::string& receiver,
+                                   size_t priority) {
+  bool full = false;
+  {
+    WriteLock lock(kLoggerBatchMutex);
+    auto& batch = kLoggerBatch[std::make_pair(receiver, priority)];
+    for (auto& message : messages) {
+      if (!message.empty()) {
+        kLoggerBatchSize += message.size();
+        batch.push_back(std::move(message));
+      }
+    }
+    full = (kLoggerBatchSize >= kLoggerBatchMax);
+  }
+
+  return (full) ? flushLoggerBatch() : Status(0, "OK");
+}
+
+void setLoggerBatching(bool enabled) {
+  kLoggerBatching = enabled;
+  if (!enabled) {
+    flushLoggerBatch();
   }
+}
 
-  for (auto& json : json_items) {
+Status flushLoggerBatch() {
+  std::lock_guard<std::mutex> flush_lock(kLoggerBatchFlushMutex);
+  LoggerBatch batch;
+  {
+    WriteLock lock(kLoggerBatchMutex);
+    batch.swap(kLoggerBatch);
+    kLoggerBatchSize = 0;
+  }
+
+  Status status;
+  for (const auto& messages : batch) {
+    auto result = logPriorityStrings(
+        messages.second, messages.first.first, messages.first.second);
+    if (!result.ok()) {
+      status = result;
+    }
+  }
+  return status;
+}
+
+/// Serialize a QueryLogItem as log lines, or records, in the logger_format.
+static Status serializeLogLines(const QueryLogItem& item,
+                                bool events,
+                                std::vector<std::string>& lines) {
+  if (loggerUsesMessagePack()) {
+    if (events) {
+      return serializeQueryLogItemAsEventsMessagePack(item, lines);
+    }
+    lines.emplace_back();
+    return serializeQueryLogItemMessagePack(item, lines.back());
+  }
+
+  Status status;
+  if (events) {
+    status = serializeQueryLogItemAsEventsJSON(item, lines);
+  } else {
+    lines.emplace_back();
+    status = serializeQueryLogItemJSON(item, lines.back());
+  }
+
+  // Then remove the newlines.
+  for (auto& json : lines) {
     if (!json.empty() && json.back() == '\n') {
       json.pop_back();
-      status = logString(json, "event", receiver);
     }
   }
   return status;
 }
 
-Status logSnapshotQuery(const QueryLogItem& item) {
+Status logQueryLogItem(const QueryLogItem& results) {
+  return logQueryLogItem(results, RegistryFactory::get().getActive("logger"));
+}
+
+Status logQueryLogItem(const QueryLogItem& results,
+                       const std::string& receiver) {
   if (FLAGS_disable_logging) {
     return Status(0, "Logging disabled");
   }
 
   std::vector<std::string> json_items;
-  Status status;
-  if (FLAGS_logger_snapshot_event_type) {
-    status = serializeQueryLogItemAsEventsJSON(item, json_items);
-  } else {
-    std::string json;
-    status = serializeQueryLogItemJSON(item, json);
-    json_items.emplace_back(json);
-  }
+  auto status = serializeLogLines(results, FLAGS_logger_event_type, json_items);
   if (!status.ok()) {
     return status;
   }
 
-  for (auto& json : json_items) {
-    if (!json.empty() && json.back() == '\n') {
-      json.pop_back();
+  if (kLoggerBatching) {
+    return batchPriorityStrings(json_items, receiver, results.priority);
+  }
+
+  for (const auto& json : json_items) {
+    if (!json.empty()) {
+      status = logPriorityString(json, "event", receiver, results.priority);
     }
+  }
+  return status;
+}
 
-    auto receiver = RegistryFactory::get().getActive("logger");
-    for (const auto& logger : osquery::split(receiver, ",")) {
+/// Hand each serialized snapshot line to the loggers.
+static Status logSnapshotLines(const std::vector<std::string>& json_items) {
+  Status status;
+  auto receiver = RegistryFactory::get().getActive("logger");
+  auto loggers = osquery::split(receiver, ",");
+  for (const auto& json : json_items) {
+    kLoggerWritten.add(json.size());
+    for (const auto& logger : loggers) {
       if (FLAGS_logger_secondary_status_only &&
           !BufferedLogSink::get().isPrimaryLogger(logger)) {
         continue;
       }
 
-      if (Registry::get().exists("logger", logger, true)) {
-        auto plugin = Registry::get().plugin("logger", logger);
-        auto logger_plugin = std::dynamic_pointer_cast<LoggerPlugin>(plugin);
+      auto logger_plugin = getInternalLogger(logger);
+      if (logger_plugin != nullptr) {
         status = logger_plugin->logSnapshot(json);
       } else {
         status = Registry::call("logger", logger, {{"snapshot", json}});
@@ -660,9 +1001,89 @@ Status logSnapshotQuery(const QueryLogItem& item) {
   return status;
 }
 
+Status logSnapshotQuery(const QueryLogItem& item) {
+  if (FLAGS_disable_logging) {
+    return Status(0, "Logging disabled");
+  }
+
+  std::vector<std::string> json_items;
+  auto status =
+      serializeLogLines(item, FLAGS_logger_snapshot_event_type, json_items);
+  if (!status.ok()) {
+    return status;
+  }
+  return logSnapshotLines(json_items);
+}
+
+SnapshotLogStream::SnapshotLogStream(QueryLogItem item)
+    : item_(std::move(item)) {
+  if (!loggerUsesMessagePack()) {
+    writer_ = std::make_unique<SnapshotJSONWriter>(
+        item_, FLAGS_logger_snapshot_event_type);
+  }
+}
+
+Status SnapshotLogStream::add(Row& r) {
+  if (FLAGS_disable_logging) {
+    return Status(0, "Logging disabled");
+  } else if (writer_ == nullptr) {
+    item_.snapshot_results.push_back(std::move(r));
+    return Status(0, "OK");
+  }
+
+  auto count = lines_.size();
+  writer_->add(r, lines_);
+  for (; count < lines_.size(); count++) {
+    size_ += lines_[count].size();
+  }
+  return (size_ >= kLoggerBatchMax) ? flush() : Status(0, "OK");
+}
+
+Status SnapshotLogStream::end() {
+  if (FLAGS_disable_logging) {
+    return Status(0, "Logging disabled");
+  } else if (writer_ == nullptr) {
+    return logSnapshotQuery(item_);
+  }
+
+  writer_->end(lines_);
+  flush();
+  return status_;
+}
+
+Status SnapshotLogStream::flush() {
+  // Then remove the newlines, see serializeLogLines.
+  for (auto& json : lines_) {
+    if (!json.empty() && json.back() == '\n') {
+      json.pop_back();
+    }
+  }
+
+  auto status = logSnapshotLines(lines_);
+  if (!status.ok()) {
+    status_ = status;
+  }
+  lines_.clear();
+  size_ = 0;
+  return status;
+}
+
+Status logEvent(const std::string& event,
+                const std::vector<std::string>& loggers) {
+  Status status;
+  for (const auto& logger : loggers) {
+    auto logger_plugin = getInternalLogger(logger);
+    if (logger_plugin != nullptr) {
+      status = logger_plugin->logEvent(event);
+    } else {
+      status = Registry::call("logger", logger, {{"event", event}});
+    }
+  }
+  return status;
+}
+
 size_t queuedStatuses() {
-  ReadLock lock(kBufferedLogSinkLogs);
-  return BufferedLogSink::get().dump().size();
+  return BufferedLogSink::get().queued();
 }
 
 size_t queuedSenders() {
@@ -670,6 +1091,34 @@ size_t queuedSenders() {
   return BufferedLogSink::get().senders.size();
 }
 
+void setLoggerBackpressure(const std::string& name, size_t priority) {
+  WriteLock lock(kLoggerBackpressureMutex);
+  if (priority == 0) {
+    kLoggerBackpressure.erase(name);
+  } else {
+    kLoggerBackpressure[name] = priority;
+  }
+}
+
+size_t getLoggerBackpressure() {
+  ReadLock lock(kLoggerBackpressureMutex);
+  size_t priority = 0;
+  for (const auto& logger : kLoggerBackpressure) {
+    priority = std::max(priority, logger.second);
+  }
+  return priority;
+}
+
+void setLoggerBuffered(const std::string& name, size_t lines) {
+  WriteLock lock(kLoggerBufferedMutex);
+  kLoggerBuffered[name] = lines;
+}
+
+std::map<std::string, size_t> getLoggerBuffered() {
+  ReadLock lock(kLoggerBufferedMutex);
+  return kLoggerBuffered;
+}
+
 void relayStatusLogs(bool async) {
   if (FLAGS_disable_logging || !DatabasePlugin::kDBInitialized) {
     // The logger plugins may not be setUp if logging is disabled.
@@ -678,40 +1127,45 @@ void relayStatusLogs(bool async) {
     return;
   }
 
-  {
-    ReadLock lock(kBufferedLogSinkLogs);
-    if (BufferedLogSink::get().dump().size() == 0) {
-      return;
-    }
+  if (queuedStatuses() == 0) {
+    return;
   }
 
   auto sender = ([]() {
-    auto identifier = getHostIdentifier();
-
-    // Construct a status log plugin request.
-    PluginRequest request = {{"status", "true"}};
-    {
-      WriteLock lock(kBufferedLogSinkLogs);
-      auto& status_logs = BufferedLogSink::get().dump();
-      for (auto& log : status_logs) {
-        // Copy the host identifier into each status log.
-        log.identifier = identifier;
-      }
-
-      serializeIntermediateLog(status_logs, request);
+    std::vector<StatusLogLine> status_logs;
+    BufferedLogSink::get().take(status_logs);
+    if (status_logs.empty()) {
+      return;
+    }
 
-      // Flush the buffered status logs.
-      status_logs.clear();
+    // The host identifier is read once for the batch, without holding a lock.
+    auto identifier = getHostIdentifier();
+    for (auto& log : status_logs) {
+      log.identifier = identifier;
     }
 
+    // The status log plugin request is only built for extension loggers.
+    PluginRequest request;
     auto logger_plugin = RegistryFactory::get().getActive("logger");
     for (const auto& logger : osquery::split(logger_plugin, ",")) {
       auto& enabled = BufferedLogSink::get().enabledPlugins();
-      if (std::find(enabled.begin(), enabled.end(), logger) != enabled.end()) {
-        // Skip the registry's logic, and send directly to the core's logger.
-        PluginResponse response;
-        Registry::call("logger", logger, request, response);
+      if (std::find(enabled.begin(), enabled.end(), logger) == enabled.end()) {
+        continue;
+      }
+
+      // Skip the registry's logic, and send directly to the core's logger.
+      auto internal = getInternalLogger(logger);
+      if (internal != nullptr) {
+        internal->logStatus(status_logs);
+        continue;
+      }
+
+      if (request.empty()) {
+        request["status"] = "true";
+        serializeIntermediateLog(status_logs, request);
       }
+      PluginResponse response;
+      Registry::call("logger", logger, request, response);
     }
   });
 
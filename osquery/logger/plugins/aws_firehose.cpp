@@ -33,6 +33,11 @@ FLAG(uint64,
 
 FLAG(string, aws_firehose_stream, "", "Name of Firehose stream for logging")
 
+FLAG(uint64,
+     aws_firehose_concurrent_batches,
+     4,
+     "Maximum number of batches sent to Firehose at the same time (default 4)");
+
 Status FirehoseLoggerPlugin::setUp() {
   initAwsSdk();
 
@@ -52,6 +57,16 @@ Status FirehoseLoggerPlugin::logString(const std::string& s) {
   return forwarder_->logString(s);
 }
 
+Status FirehoseLoggerPlugin::logPriorityString(const std::string& s,
+                                               size_t priority) {
+  return forwarder_->logPriorityString(s, priority);
+}
+
+Status FirehoseLoggerPlugin::logPriorityStrings(
+    const std::vector<std::string>& strings, size_t priority) {
+  return forwarder_->logPriorityStrings(strings, priority);
+}
+
 Status FirehoseLoggerPlugin::logStatus(const std::vector<StatusLogLine>& log) {
   return forwarder_->logStatus(log);
 }
@@ -106,6 +121,10 @@ size_t FirehoseLogForwarder::getInitialRetryDelay() const {
   return 3000U;
 }
 
+size_t FirehoseLogForwarder::getMaxConcurrentBatches() const {
+  return static_cast<size_t>(FLAGS_aws_firehose_concurrent_batches);
+}
+
 bool FirehoseLogForwarder::appendNewlineSeparators() const {
   return true;
 }
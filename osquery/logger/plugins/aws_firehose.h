@@ -52,6 +52,7 @@ class FirehoseLogForwarder final : public IFirehoseLogForwarder {
   size_t getMaxBytesPerBatch() const override;
   size_t getMaxRetryCount() const override;
   size_t getInitialRetryDelay() const override;
+  size_t getMaxConcurrentBatches() const override;
   bool appendNewlineSeparators() const override;
 
   size_t getFailedRecordCount(Outcome& outcome) const override;
@@ -77,6 +78,13 @@ class FirehoseLoggerPlugin : public LoggerPlugin {
 
   Status logString(const std::string& s) override;
 
+  /// Log a result string in the queue of its query's priority class.
+  Status logPriorityString(const std::string& s, size_t priority) override;
+
+  /// Log a batch of result strings in the queue of their priority class.
+  Status logPriorityStrings(const std::vector<std::string>& strings,
+                            size_t priority) override;
+
   /// Log a status (ERROR/WARNING/INFO) message.
   Status logStatus(const std::vector<StatusLogLine>& log) override;
 
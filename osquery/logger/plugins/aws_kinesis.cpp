@@ -45,6 +45,11 @@ FLAG(bool,
      false,
      "Enable random kinesis partition keys");
 
+FLAG(uint64,
+     aws_kinesis_concurrent_batches,
+     4,
+     "Maximum number of batches sent to Kinesis at the same time (default 4)");
+
 Status KinesisLoggerPlugin::setUp() {
   initAwsSdk();
   forwarder_ = std::make_shared<KinesisLogForwarder>(
@@ -62,6 +67,16 @@ Status KinesisLoggerPlugin::logString(const std::string& s) {
   return forwarder_->logString(s);
 }
 
+Status KinesisLoggerPlugin::logPriorityString(const std::string& s,
+                                              size_t priority) {
+  return forwarder_->logPriorityString(s, priority);
+}
+
+Status KinesisLoggerPlugin::logPriorityStrings(
+    const std::vector<std::string>& strings, size_t priority) {
+  return forwarder_->logPriorityStrings(strings, priority);
+}
+
 Status KinesisLoggerPlugin::logStatus(const std::vector<StatusLogLine>& log) {
   return forwarder_->logStatus(log);
 }
@@ -127,6 +142,10 @@ size_t KinesisLogForwarder::getInitialRetryDelay() const {
   return 3000U;
 }
 
+size_t KinesisLogForwarder::getMaxConcurrentBatches() const {
+  return static_cast<size_t>(FLAGS_aws_kinesis_concurrent_batches);
+}
+
 bool KinesisLogForwarder::appendNewlineSeparators() const {
   return false;
 }
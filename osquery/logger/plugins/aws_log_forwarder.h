@@ -10,14 +10,19 @@
 
 #pragma once
 
+#include <algorithm>
 #include <chrono>
+#include <deque>
+#include <future>
 #include <memory>
+#include <sstream>
 #include <vector>
 
 #include <osquery/core.h>
 #include <osquery/dispatcher.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/msgpack.h"
 #include "osquery/logger/plugins/buffered.h"
 #include "osquery/utils/aws_util.h"
 
@@ -127,9 +132,15 @@ class AwsLogForwarder : public BufferedLogForwarder {
     Batch current_batch;
     size_t current_batch_byte_size = 0U;
 
+    // MessagePack result records are length-delimited and cannot be tagged
+    // with their log type, status logs are always JSON.
+    bool binary = (log_type == "result" && loggerUsesMessagePack());
+    bool newlines = !binary && appendNewlineSeparators();
+
     for (auto& record : log_data) {
       // Initialize the line and make sure we are still within protocol limits
-      Status status = appendLogTypeToJson(log_type, record);
+      Status status =
+          (binary) ? Status(0, "OK") : appendLogTypeToJson(log_type, record);
       if (!status.ok()) {
         // To achieve behavior parity with TLS logger plugin, skip non-JSON
         // content
@@ -141,7 +152,7 @@ class AwsLogForwarder : public BufferedLogForwarder {
       }
 
       size_t record_size = record.size();
-      if (appendNewlineSeparators()) {
+      if (newlines) {
         ++record_size;
       }
 
@@ -164,7 +175,7 @@ class AwsLogForwarder : public BufferedLogForwarder {
       auto buffer = Aws::Utils::ByteBuffer(
           reinterpret_cast<unsigned char*>(&record[0]), record_size);
 
-      if (appendNewlineSeparators()) {
+      if (newlines) {
         buffer[record_size - 1] = '\n';
       }
 
@@ -273,22 +284,77 @@ class AwsLogForwarder : public BufferedLogForwarder {
     dumpDiscardedRecordsToErrorLog(discarded_records);
     discarded_records.clear();
 
-    // Send each batch
+    if (batch_list.empty()) {
+      return Status(0, "OK");
+    }
+
+    size_t record_count = 0;
+    for (const auto& batch : batch_list) {
+      record_count += batch.size();
+    }
+
+    // Send each batch, with a bounded number of batches in flight. Each batch
+    // retries only the records that failed.
+    auto start = std::chrono::steady_clock::now();
+    std::vector<char> sent(batch_list.size(), 0);
+    std::vector<std::string> errors(batch_list.size());
+    auto send_batch = [this, &batch_list, &sent, &errors](size_t i) {
+      std::stringstream status_output;
+      sent[i] = sendBatch(batch_list[i], status_output);
+      errors[i] = status_output.str();
+    };
+
+    auto max_concurrent = getMaxConcurrentBatches();
+    if (max_concurrent <= 1 || batch_list.size() == 1) {
+      for (size_t i = 0; i < batch_list.size(); i++) {
+        send_batch(i);
+      }
+    } else {
+      std::deque<std::future<void>> in_flight;
+      for (size_t i = 0; i < batch_list.size(); i++) {
+        if (in_flight.size() >= max_concurrent) {
+          in_flight.front().wait();
+          in_flight.pop_front();
+        }
+        in_flight.push_back(std::async(std::launch::async, send_batch, i));
+      }
+      for (auto& batch_send : in_flight) {
+        batch_send.wait();
+      }
+    }
+
     size_t error_count = 0;
+    size_t failed_record_count = 0;
     std::stringstream status_output;
-
-    for (auto batch_it = batch_list.begin(); batch_it != batch_list.end();) {
-      auto& batch = *batch_it;
-      if (!sendBatch(batch, status_output)) {
-        // We couldn't write some of the records; log them locally so that the
-        // administrator will at least be able to inspect them
-        dumpBatchToErrorLog(batch);
-        error_count++;
+    for (size_t i = 0; i < batch_list.size(); i++) {
+      if (sent[i]) {
+        continue;
       }
 
-      batch_it = batch_list.erase(batch_it);
+      // We couldn't write some of the records; log them locally so that the
+      // administrator will at least be able to inspect them
+      dumpBatchToErrorLog(batch_list[i]);
+      failed_record_count += batch_list[i].size();
+      if (!errors[i].empty()) {
+        if (!status_output.str().empty()) {
+          status_output << "\n";
+        }
+        status_output << errors[i];
+      }
+      error_count++;
     }
 
+    // Report the drain rate, which matters most when draining a backlog.
+    auto elapsed = static_cast<size_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+    auto sent_record_count = record_count - failed_record_count;
+    VLOG(1) << name_ << ": Sent " << sent_record_count << " log records in "
+            << batch_list.size() << " batches over " << elapsed << "ms ("
+            << (sent_record_count * 1000) / std::max<size_t>(elapsed, 1)
+            << " records/s)";
+
     if (error_count != 0) {
       return Status(1, status_output.str());
     }
@@ -321,6 +387,9 @@ class AwsLogForwarder : public BufferedLogForwarder {
   /// Must return the initial delay, in seconds, between each retry
   virtual size_t getInitialRetryDelay() const = 0;
 
+  /// Must return the maximum amount of batches sent at the same time
+  virtual size_t getMaxConcurrentBatches() const = 0;
+
   /// Must return true if records should be terminated with newlines
   virtual bool appendNewlineSeparators() const = 0;
 
@@ -12,18 +12,17 @@
 #include <chrono>
 #include <thread>
 
-#include <boost/property_tree/ptree.hpp>
-
 #include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/registry.h>
 #include <osquery/system.h>
 
 #include "osquery/config/parsers/decorators.h"
+#include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
 #include "osquery/logger/plugins/buffered.h"
 
-namespace pt = boost::property_tree;
+namespace rj = rapidjson;
 
 namespace osquery {
 
@@ -32,67 +31,290 @@ FLAG(uint64,
      1000000,
      "Maximum number of logs in buffered output plugins (0 = unlimited)");
 
+FLAG(bool,
+     buffered_log_backpressure,
+     false,
+     "Defer low priority scheduled queries while buffered logs back up");
+
 const std::chrono::seconds BufferedLogForwarder::kLogPeriod{
     std::chrono::seconds(4)};
 const size_t BufferedLogForwarder::kMaxLogLines{1024};
+const size_t BufferedLogForwarder::kSegmentLines{1024};
+const size_t BufferedLogForwarder::kLogPriorities{4};
+
+/// Queue positions are zero-padded so the indexes sort in queue order.
+const size_t kPositionWidth{20};
+
+/// Parse a queue position or time from an index, 0 if it is malformed.
+static size_t toNumber(const std::string& digits) {
+  unsigned long long number = 0;
+  if (!safeStrtoull(digits, 10, number).ok()) {
+    return 0;
+  }
+  return static_cast<size_t>(number);
+}
+
+/**
+ * @brief Share max lines between the priority classes, weighted by 2^priority.
+ *
+ * Classes with fewer lines than their share are read in full and the rest is
+ * shared again, lines left by rounding go to the highest classes.
+ */
+static std::vector<size_t> getQuotas(const std::vector<size_t>& counts,
+                                     size_t max) {
+  std::vector<size_t> quotas(counts.size(), 0);
+  std::vector<bool> full(counts.size(), false);
+  for (size_t i = 0; i < counts.size(); ++i) {
+    full[i] = (counts[i] == 0);
+  }
+
+  bool refill = true;
+  while (refill && max > 0) {
+    refill = false;
+    size_t weights = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+      weights += (full[i]) ? 0 : (size_t(1) << i);
+    }
+    if (weights == 0) {
+      break;
+    }
+
+    std::vector<size_t> shares(counts.size(), 0);
+    size_t left = max;
+    for (size_t i = counts.size(); i-- > 0;) {
+      if (full[i]) {
+        continue;
+      }
+      shares[i] = std::max<size_t>(1, max * (size_t(1) << i) / weights);
+      if (counts[i] <= shares[i]) {
+        quotas[i] = std::min(counts[i], left);
+        left -= quotas[i];
+        full[i] = true;
+        refill = true;
+      }
+    }
+
+    if (!refill) {
+      // Every remaining class has more lines than its share.
+      for (size_t i = counts.size(); i-- > 0;) {
+        if (!full[i]) {
+          quotas[i] = std::min(shares[i], left);
+          left -= quotas[i];
+        }
+      }
+    }
+    max = left;
+  }
+
+  for (size_t i = counts.size(); i-- > 0;) {
+    auto extra = std::min(counts[i] - quotas[i], max);
+    quotas[i] += extra;
+    max -= extra;
+  }
+  return quotas;
+}
 
 Status BufferedLogForwarder::setUp() {
-  // initialize buffer_count_ by scanning the DB
-  std::vector<std::string> indexes;
-  auto status = scanDatabaseKeys(kLogs, indexes, index_name_, 0);
+  for (size_t priority = 0; priority < kLogPriorities; ++priority) {
+    recover(true, priority);
+  }
+  recover(false, 0);
+
+  for (auto results : {true, false}) {
+    auto status = migrate(results);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0);
+}
+
+void BufferedLogForwarder::recover(bool results, size_t priority) {
+  // Lines are only removed from the head, so the queue is contiguous. The
+  // head is the first line, find the tail by searching for the first
+  // position, after the head, without any line at or beyond it.
+  auto prefix = genIndexPrefix(results, priority);
+  auto high = prefix + '1';
+  auto exists = [this, results, priority, &high](size_t position,
+                                                 std::string& key) {
+    key.clear();
+    scanDatabaseRange(kLogs,
+                      genIndexBound(results, priority, position),
+                      high,
+                      [&key](const std::string& index, const std::string&) {
+                        key = index;
+                        return false;
+                      });
+    return !key.empty();
+  };
+
+  Queue queue;
+  std::string key;
+  if (exists(0, key)) {
+    queue.head = toNumber(key.substr(prefix.size(), kPositionWidth));
+    size_t low = queue.head;
+    size_t step = 1;
+    while (exists(low + step, key)) {
+      low += step;
+      step *= 2;
+    }
+
+    // The tail is within (low, low + step].
+    size_t tail = low + step;
+    while (tail - low > 1) {
+      auto middle = low + (tail - low) / 2;
+      if (exists(middle, key)) {
+        low = middle;
+      } else {
+        tail = middle;
+      }
+    }
+    queue.tail = tail;
+  }
+
+  WriteLock lock(queue_mutex_);
+  getQueue(results, priority) = queue;
+}
 
+Status BufferedLogForwarder::migrate(bool results) {
+  // Earlier versions indexed lines by a time, which does not start with a 0,
+  // followed by a counter. These sort after every queue position.
+  auto prefix = genIndexPrefix(results, 0);
+  std::vector<std::pair<std::string, std::string>> lines;
+  auto status = scanDatabaseRange(
+      kLogs,
+      prefix + '1',
+      getPrefixUpperBound(prefix),
+      [&lines](const std::string& index, const std::string& value) {
+        lines.push_back(std::make_pair(index, value));
+        return true;
+      });
   if (!status.ok()) {
-    return Status(1, "Error scanning for buffered log count");
+    return Status(1, "Error scanning for buffered logs");
+  } else if (lines.empty()) {
+    return Status(0);
   }
 
-  RecursiveLock lock(count_mutex_);
-  buffer_count_ = indexes.size();
+  WriteLock lock(queue_mutex_);
+  auto& queue = getQueue(results, 0);
+  DatabaseBatch batch;
+  size_t position = queue.tail;
+  for (auto& line : lines) {
+    auto time = line.first.substr(prefix.size());
+    time = time.substr(0, time.find('_'));
+    batch.remove(kLogs, line.first);
+    batch.put(kLogs,
+              genIndex(results, 0, position++, toNumber(time)),
+              std::move(line.second));
+  }
+
+  status = writeDatabaseBatch(batch);
+  if (!status.ok()) {
+    return Status(1, "Error moving buffered logs: " + status.getMessage());
+  }
+  queue.tail = position;
   return Status(0);
 }
 
+size_t BufferedLogForwarder::read(bool results,
+                                  size_t priority,
+                                  std::vector<std::string>& lines,
+                                  size_t max) {
+  size_t head = 0;
+  {
+    WriteLock lock(queue_mutex_);
+    head = getQueue(results, priority).head;
+  }
+
+  if (max == 0) {
+    return head;
+  }
+
+  size_t count = 0;
+  auto prefix = genIndexPrefix(results, priority);
+  scanDatabaseRange(
+      kLogs,
+      genIndexBound(results, priority, head),
+      prefix + '1',
+      [&lines, &count, max](const std::string& index,
+                            const std::string& value) {
+        lines.push_back(value);
+        return ++count < max;
+      });
+  return head;
+}
+
+Status BufferedLogForwarder::remove(bool results,
+                                    size_t priority,
+                                    size_t head,
+                                    size_t count) {
+  WriteLock lock(queue_mutex_);
+  auto& queue = getQueue(results, priority);
+  head = std::max(head + count, queue.head);
+  if (head == queue.head) {
+    // The lines were purged while they were sent.
+    return Status(0);
+  }
+
+  // The bound at head is not a line index, so this removes [queue.head, head).
+  auto status =
+      deleteDatabaseRange(kLogs,
+                          genIndexBound(results, priority, queue.head),
+                          genIndexBound(results, priority, head));
+  if (status.ok()) {
+    queue.head = head;
+  }
+  return status;
+}
+
 void BufferedLogForwarder::check() {
-  // Get a list of all the buffered log items, with a max of 1024 lines.
-  std::vector<std::string> indexes;
-  auto status = scanDatabaseKeys(kLogs, indexes, index_name_, max_log_lines_);
+  // Read the buffered log items, with a max of max_log_lines_ lines.
+  // Results are read first, the max is shared between the priority classes by
+  // weight, and status lines fill the remainder.
+  std::vector<size_t> counts(kLogPriorities, 0);
+  {
+    WriteLock lock(queue_mutex_);
+    for (size_t priority = 0; priority < kLogPriorities; ++priority) {
+      counts[priority] = results_[priority].tail - results_[priority].head;
+    }
+  }
 
-  // For each index, accumulate the log line into the result or status set.
+  // The results are sent together, the highest priority class first.
   std::vector<std::string> results, statuses;
-  iterate(indexes, ([&results, &statuses, this](std::string& index) {
-            std::string value;
-            auto& target = isResultIndex(index) ? results : statuses;
-            if (getDatabaseValue(kLogs, index, value)) {
-              target.emplace_back(std::move(value));
-            }
-          }));
+  std::vector<size_t> heads(kLogPriorities, 0);
+  auto quotas = getQuotas(counts, max_log_lines_);
+  for (size_t priority = kLogPriorities; priority-- > 0;) {
+    auto size = results.size();
+    heads[priority] = read(true, priority, results, quotas[priority]);
+    counts[priority] = results.size() - size;
+  }
+  auto statuses_head =
+      read(false, 0, statuses, max_log_lines_ - results.size());
 
+  size_t sent = 0;
   // If any results/statuses were found in the flushed buffer, send.
   if (results.size() > 0) {
-    status = send(results, "result");
+    auto status = send(results, "result");
     if (!status.ok()) {
       VLOG(1) << "Error sending results to logger: " << status.getMessage();
     } else {
       // Clear the results logs once they were sent.
-      iterate(indexes, ([this](std::string& index) {
-                if (!isResultIndex(index)) {
-                  return;
-                }
-                deleteValueWithCount(kLogs, index);
-              }));
+      for (size_t priority = 0; priority < kLogPriorities; ++priority) {
+        remove(true, priority, heads[priority], counts[priority]);
+        sent += counts[priority];
+      }
     }
   }
 
   if (statuses.size() > 0) {
-    status = send(statuses, "status");
+    auto count = statuses.size();
+    auto status = send(statuses, "status");
     if (!status.ok()) {
       VLOG(1) << "Error sending status to logger: " << status.getMessage();
     } else {
       // Clear the status logs once they were sent.
-      iterate(indexes, ([this](std::string& index) {
-                if (!isStatusIndex(index)) {
-                  return;
-                }
-                deleteValueWithCount(kLogs, index);
-              }));
+      remove(false, 0, statuses_head, count);
+      sent += count;
     }
   }
 
@@ -100,134 +322,217 @@ void BufferedLogForwarder::check() {
   if (FLAGS_buffered_log_max > 0) {
     purge();
   }
+
+  if (FLAGS_buffered_log_backpressure) {
+    applyBackpressure(sent);
+  }
+  setLoggerBuffered(index_name_, getBufferedCount());
 }
 
-void BufferedLogForwarder::purge() {
-  RecursiveLock lock(count_mutex_);
-  if (buffer_count_ <= FLAGS_buffered_log_max) {
-    return;
+void BufferedLogForwarder::applyBackpressure(size_t sent) {
+  size_t enqueued = 0;
+  {
+    WriteLock lock(queue_mutex_);
+    enqueued = enqueued_;
+    enqueued_ = 0;
   }
 
-  size_t purge_count = buffer_count_ - FLAGS_buffered_log_max;
+  // The forwarder is saturated when the buffer is half full and still growing,
+  // it recovers once the buffer has drained to a quarter of the max.
+  auto count = getBufferedCount();
+  auto max = FLAGS_buffered_log_max;
+  if (max == 0) {
+    saturated_ = false;
+  } else if (!saturated_) {
+    saturated_ = (count > max / 2 && enqueued > sent);
+  } else {
+    saturated_ = (count > max / 4);
+  }
 
-  // Collect purge_count indexes of each type (result/status) before
-  // partitioning to find the oldest. Note this assumes that the indexes are
-  // returned in ascending lexicographic order (true for RocksDB).
-  std::vector<std::string> indexes;
-  auto status =
-      scanDatabaseKeys(kLogs, indexes, genIndexPrefix(true), purge_count);
-  if (!status.ok()) {
-    LOG(ERROR) << "Error scanning DB during buffered log purge";
+  // Queries in the lowest priority class are deferred while saturated.
+  setLoggerBackpressure(index_name_, (saturated_) ? 1 : 0);
+}
+
+void BufferedLogForwarder::purge() {
+  WriteLock lock(queue_mutex_);
+  auto count = getCount();
+  if (count <= FLAGS_buffered_log_max) {
     return;
   }
 
   LOG(WARNING) << "Purging buffered logs limit (" << FLAGS_buffered_log_max
-               << ") exceeded: " << buffer_count_;
+               << ") exceeded: " << count;
+
+  // Remove the head segments of the lowest priority class until the count is
+  // within the max. Status lines are in the lowest class, the queue with the
+  // oldest head line is purged first. Each segment is a single range delete.
+  auto results = results_;
+  auto statuses = statuses_;
+  DatabaseBatch batch;
+  size_t priority = 0;
+  while (count > FLAGS_buffered_log_max) {
+    bool purge_results = true;
+    if (priority == 0 && statuses.head != statuses.tail) {
+      purge_results = (results[0].head != results[0].tail) &&
+                      getLineTime(true, 0, results[0].head) <=
+                          getLineTime(false, 0, statuses.head);
+    } else if (results[priority].head == results[priority].tail) {
+      priority++;
+      continue;
+    }
 
-  std::vector<std::string> status_indexes;
-  status = scanDatabaseKeys(
-      kLogs, status_indexes, genIndexPrefix(false), purge_count);
-  if (!status.ok()) {
-    LOG(ERROR) << "Error scanning DB during buffered log purge";
+    auto& queue = (purge_results) ? results[priority] : statuses;
+    auto segment = (queue.head / segment_lines_ + 1) * segment_lines_;
+    auto head = std::min(segment, queue.tail);
+    batch.removeRange(kLogs,
+                      genIndexBound(purge_results, priority, queue.head),
+                      genIndexBound(purge_results, priority, head));
+    count -= head - queue.head;
+    queue.head = head;
+  }
+
+  if (!writeDatabaseBatch(batch).ok()) {
+    LOG(ERROR) << "Error deleting values during buffered log purge";
     return;
   }
+  results_ = results;
+  statuses_ = statuses;
+}
 
-  indexes.insert(indexes.end(), status_indexes.begin(), status_indexes.end());
+size_t BufferedLogForwarder::getBufferedCount() {
+  WriteLock lock(queue_mutex_);
+  return getCount();
+}
 
-  if (indexes.size() < purge_count) {
-    LOG(ERROR) << "Trying to purge " << purge_count << " logs but only found "
-               << indexes.size();
-    return;
+size_t BufferedLogForwarder::getCount() {
+  size_t count = statuses_.tail - statuses_.head;
+  for (const auto& queue : results_) {
+    count += queue.tail - queue.head;
   }
+  return count;
+}
 
-  size_t prefix_size = genIndexPrefix(true).size();
-  // Partition the indexes so that the first purge_count elements are the
-  // oldest indexes (the ones to be purged)
-  std::nth_element(indexes.begin(),
-                   indexes.begin() + purge_count - 1,
-                   indexes.end(),
-                   [&](const std::string& a, const std::string& b) {
-                     // Skip the prefix when doing comparisons
-                     return a.compare(prefix_size,
-                                      std::string::npos,
-                                      b,
-                                      prefix_size,
-                                      std::string::npos) < 0;
-                   });
-  indexes.erase(indexes.begin() + purge_count, indexes.end());
-
-  // Now only indexes of logs to be deleted remain
-  iterate(indexes, [this](const std::string& index) {
-    if (!deleteValueWithCount(kLogs, index).ok()) {
-      LOG(ERROR) << "Error deleting value during buffered log purge";
-    }
-  });
+size_t BufferedLogForwarder::getLineTime(bool results,
+                                         size_t priority,
+                                         size_t position) {
+  size_t time = 0;
+  auto prefix = genIndexPrefix(results, priority);
+  scanDatabaseRange(
+      kLogs,
+      genIndexBound(results, priority, position),
+      prefix + '1',
+      [&time, &prefix](const std::string& index, const std::string&) {
+        auto offset = prefix.size() + kPositionWidth + 1;
+        if (index.size() > offset) {
+          time = toNumber(index.substr(offset));
+        }
+        return false;
+      });
+  return time;
 }
 
-void BufferedLogForwarder::start() {
-  while (!interrupted()) {
-    check();
+void BufferedLogForwarder::tick() {
+  check();
+}
 
-    // Cool off and time wait the configured period.
-    pauseMilli(log_period_);
-  }
+std::chrono::milliseconds BufferedLogForwarder::period() {
+  return log_period_;
 }
 
 Status BufferedLogForwarder::logString(const std::string& s, size_t time) {
-  std::string index = genResultIndex(time);
-  return addValueWithCount(kLogs, index, s);
+  return logPriorityString(s, 0, time);
 }
 
-Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log,
-                                       size_t time) {
-  // Append decorations to status
-  // Assemble a decorations tree to append to each status buffer line.
-  pt::ptree dtree;
-  std::map<std::string, std::string> decorations;
-  getDecorations(decorations);
-  for (const auto& decoration : decorations) {
-    dtree.put(decoration.first, decoration.second);
+Status BufferedLogForwarder::logPriorityString(const std::string& s,
+                                               size_t priority,
+                                               size_t time) {
+  priority = std::min(priority, kLogPriorities - 1);
+  WriteLock lock(queue_mutex_);
+  auto& queue = results_[priority];
+  auto status =
+      setDatabaseValue(kLogs, genIndex(true, priority, queue.tail, time), s);
+  if (status.ok()) {
+    queue.tail++;
+    enqueued_++;
+  }
+  return status;
+}
+
+Status BufferedLogForwarder::logPriorityStrings(
+    const std::vector<std::string>& strings, size_t priority, size_t time) {
+  priority = std::min(priority, kLogPriorities - 1);
+  WriteLock lock(queue_mutex_);
+  auto& queue = results_[priority];
+  DatabaseBatch batch;
+  auto position = queue.tail;
+  for (const auto& s : strings) {
+    batch.put(kLogs, genIndex(true, priority, position++, time), s);
   }
 
+  auto status = writeDatabaseBatch(batch);
+  if (status.ok()) {
+    enqueued_ += position - queue.tail;
+    queue.tail = position;
+  }
+  return status;
+}
+
+Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log,
+                                       size_t time) {
+  // Append decorations to status, the object is rendered when they change.
+  auto decorations = getDecorationsJSON();
+
+  auto put = [](rj::Writer<rj::StringBuffer>& w,
+                const char* key,
+                const std::string& value) {
+    w.Key(key);
+    w.String(value.c_str(), static_cast<rj::SizeType>(value.size()));
+  };
+
+  // Every status line is stored, or none are.
+  std::vector<std::string> lines;
+  rj::StringBuffer sb;
   for (const auto& item : log) {
-    // Convert the StatusLogLine into ptree format, to convert to JSON.
-    pt::ptree buffer;
-    buffer.put("hostIdentifier", item.identifier);
-    buffer.put("calendarTime", item.calendar_time);
-    buffer.put("unixTime", item.time);
-    buffer.put("severity", (google::LogSeverity)item.severity);
-    buffer.put("filename", item.filename);
-    buffer.put("line", item.line);
-    buffer.put("message", item.message);
-    buffer.put("version", kVersion);
-    if (decorations.size() > 0) {
-      buffer.put_child("decorations", dtree);
+    // Write the StatusLogLine as JSON, values are strings as they were when
+    // these lines were rendered from a property tree.
+    sb.Clear();
+    rj::Writer<rj::StringBuffer> w(sb);
+    w.StartObject();
+    put(w, "hostIdentifier", item.identifier);
+    put(w, "calendarTime", item.calendar_time);
+    put(w, "unixTime", std::to_string(item.time));
+    put(w, "severity", std::to_string(static_cast<int>(item.severity)));
+    put(w, "filename", item.filename);
+    put(w, "line", std::to_string(item.line));
+    put(w, "message", item.message);
+    put(w, "version", kVersion);
+    if (decorations != nullptr) {
+      w.Key("decorations");
+      w.RawValue(decorations->c_str(), decorations->size(), rj::kObjectType);
     }
+    w.EndObject();
 
-    // Convert to JSON, for storing a string-representation in the database.
-    std::string json;
-    try {
-      std::stringstream json_output;
-      pt::write_json(json_output, buffer, false);
-      json = json_output.str();
-    } catch (const pt::json_parser::json_parser_error& e) {
-      // The log could not be represented as JSON.
-      return Status(1, e.what());
-    }
+    lines.emplace_back(sb.GetString(), sb.GetSize());
+  }
+  return logStatusStrings(lines, time);
+}
 
-    // Store the status line in a backing store.
-    if (!json.empty()) {
-      json.pop_back();
-    }
-    std::string index = genStatusIndex(time);
-    Status status = addValueWithCount(kLogs, index, json);
-    if (!status.ok()) {
-      // Do not continue if any line fails.
-      return status;
-    }
+Status BufferedLogForwarder::logStatusStrings(std::vector<std::string>& lines,
+                                              size_t time) {
+  // Store the status lines in a backing store.
+  WriteLock lock(queue_mutex_);
+  DatabaseBatch batch;
+  auto position = statuses_.tail;
+  for (auto& line : lines) {
+    batch.put(kLogs, genIndex(false, 0, position++, time), std::move(line));
   }
 
-  return Status(0);
+  auto status = writeDatabaseBatch(batch);
+  if (status.ok()) {
+    enqueued_ += position - statuses_.tail;
+    statuses_.tail = position;
+  }
+  return status;
 }
 
 bool BufferedLogForwarder::isIndex(const std::string& index, bool results) {
@@ -244,45 +549,46 @@ bool BufferedLogForwarder::isStatusIndex(const std::string& index) {
 }
 
 std::string BufferedLogForwarder::genResultIndex(size_t time) {
-  return genIndex(true, time);
+  WriteLock lock(queue_mutex_);
+  return genIndex(true, 0, results_[0].tail, time);
 }
 
 std::string BufferedLogForwarder::genStatusIndex(size_t time) {
-  return genIndex(false, time);
+  WriteLock lock(queue_mutex_);
+  return genIndex(false, 0, statuses_.tail, time);
 }
 
-std::string BufferedLogForwarder::genIndexPrefix(bool results) {
-  return index_name_ + '_' + ((results) ? 'r' : 's') + '_';
+BufferedLogForwarder::Queue& BufferedLogForwarder::getQueue(bool results,
+                                                            size_t priority) {
+  return (results) ? results_[priority] : statuses_;
 }
 
-std::string BufferedLogForwarder::genIndex(bool results, size_t time) {
-  if (time == 0) {
-    time = getUnixTime();
+std::string BufferedLogForwarder::genIndexPrefix(bool results,
+                                                 size_t priority) {
+  // The lowest priority class uses the index prefix of earlier versions.
+  auto prefix = index_name_ + '_' + ((results) ? 'r' : 's');
+  if (priority > 0) {
+    prefix += std::to_string(priority);
   }
-  return genIndexPrefix(results) + std::to_string(time) + '_' +
-         std::to_string(++log_index_);
+  return prefix + '_';
 }
 
-Status BufferedLogForwarder::addValueWithCount(const std::string& domain,
-                                               const std::string& key,
-                                               const std::string& value) {
-  Status status = setDatabaseValue(domain, key, value);
-  if (status.ok()) {
-    RecursiveLock lock(count_mutex_);
-    buffer_count_++;
-  }
-  return status;
+std::string BufferedLogForwarder::genIndexBound(bool results,
+                                                size_t priority,
+                                                size_t position) {
+  auto digits = std::to_string(position);
+  return genIndexPrefix(results, priority) +
+         std::string(kPositionWidth - digits.size(), '0') + digits;
 }
 
-Status BufferedLogForwarder::deleteValueWithCount(const std::string& domain,
-                                                  const std::string& key) {
-  Status status = deleteDatabaseValue(domain, key);
-  if (status.ok()) {
-    RecursiveLock lock(count_mutex_);
-    if (buffer_count_ > 0) {
-      buffer_count_--;
-    }
+std::string BufferedLogForwarder::genIndex(bool results,
+                                           size_t priority,
+                                           size_t position,
+                                           size_t time) {
+  if (time == 0) {
+    time = getUnixTime();
   }
-  return status;
+  return genIndexBound(results, priority, position) + '_' +
+         std::to_string(time);
 }
 }
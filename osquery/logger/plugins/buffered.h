@@ -17,6 +17,7 @@
 #include <thread>
 #include <vector>
 
+#include <osquery/database.h>
 #include <osquery/dispatcher.h>
 #include <osquery/logger.h>
 
@@ -45,20 +46,33 @@ inline void iterate(std::vector<std::string>& input,
  * status and result logs. Subclasses take advantage of this reliable sending
  * logic, and implement their own methods for actually sending logs.
  *
+ * Result and status lines are appended to separate queues in the backing
+ * store. Each line is keyed by its position in the queue, so the lines are
+ * read in order from the queue's head and removed, once sent, with a single
+ * range delete. The positions are grouped into fixed-size segments, which are
+ * the unit of purging.
+ *
+ * Results are buffered in a queue for each priority class of the scheduled
+ * queries. Each check shares its lines between the classes by weight, and
+ * purges drop the lowest class first. When buffered_log_backpressure is set a
+ * saturated forwarder asks the scheduler to defer the lowest class.
+ *
  * Subclasses must define the send() method, and if a subclass overrides
  * setUp(), it **MUST** call this base class setUp() from that method.
  */
-class BufferedLogForwarder : public InternalRunnable {
+class BufferedLogForwarder : public PeriodicRunnable {
  protected:
   static const std::chrono::seconds kLogPeriod;
   static const size_t kMaxLogLines;
+  static const size_t kSegmentLines;
+  static const size_t kLogPriorities;
 
  protected:
   // These constructors are made available for subclasses to use, but
   // subclasses should expose appropriate constructors to their users.
   explicit BufferedLogForwarder(const std::string& service_name,
                                 const std::string& name)
-      : InternalRunnable(service_name),
+      : PeriodicRunnable(service_name),
         log_period_(kLogPeriod),
         max_log_lines_(kMaxLogLines),
         index_name_(name) {}
@@ -68,7 +82,7 @@ class BufferedLogForwarder : public InternalRunnable {
       const std::string& service_name,
       const std::string& name,
       const std::chrono::duration<Rep, Period>& log_period)
-      : InternalRunnable(service_name),
+      : PeriodicRunnable(service_name),
         log_period_(
             std::chrono::duration_cast<std::chrono::seconds>(log_period)),
         max_log_lines_(kMaxLogLines),
@@ -80,22 +94,26 @@ class BufferedLogForwarder : public InternalRunnable {
       const std::string& name,
       const std::chrono::duration<Rep, Period>& log_period,
       size_t max_log_lines)
-      : InternalRunnable(service_name),
+      : PeriodicRunnable(service_name),
         log_period_(
             std::chrono::duration_cast<std::chrono::seconds>(log_period)),
         max_log_lines_(max_log_lines),
         index_name_(name) {}
 
  public:
-  /// A simple wait lock, and flush based on settings.
-  void start() override;
+  /// Send the buffered logs.
+  void tick() override;
+
+  /// The configured log period.
+  std::chrono::milliseconds period() override;
 
   /**
    * @brief Set up the forwarder. May be used to init remote clients, etc.
    *
    * This base class setUp() **MUST** be called by subclasses of
-   * BufferedLogForwarder in order to properly initialize the buffer count.
-  */
+   * BufferedLogForwarder in order to recover the buffered queues, and their
+   * count, from the backing store.
+   */
   virtual Status setUp();
 
   /**
@@ -109,6 +127,30 @@ class BufferedLogForwarder : public InternalRunnable {
    */
   Status logString(const std::string& s, size_t time = 0);
 
+  /**
+   * @brief Log a results string in the queue of a priority class
+   *
+   * Priorities above the highest class are buffered in the highest class.
+   *
+   * @param s Results string to log
+   * @param priority The priority class of the results' query
+   */
+  Status logPriorityString(const std::string& s,
+                           size_t priority,
+                           size_t time = 0);
+
+  /**
+   * @brief Log several results strings in the queue of a priority class
+   *
+   * The strings are written to the backing store in one batch.
+   *
+   * @param strings Results strings to log
+   * @param priority The priority class of the results' queries
+   */
+  Status logPriorityStrings(const std::vector<std::string>& strings,
+                            size_t priority,
+                            size_t time = 0);
+
   /**
    * @brief Log a vector of status lines
    *
@@ -120,6 +162,16 @@ class BufferedLogForwarder : public InternalRunnable {
    */
   Status logStatus(const std::vector<StatusLogLine>& log, size_t time = 0);
 
+  /**
+   * @brief Log status lines that are already serialized
+   *
+   * The lines are moved to the backing store in one batch, such as the
+   * status logs of other hosts forwarded by a relay.
+   *
+   * @param lines JSON status lines to log
+   */
+  Status logStatusStrings(std::vector<std::string>& lines, size_t time = 0);
+
  protected:
   /**
    * @brief Send labeled result logs.
@@ -134,9 +186,10 @@ class BufferedLogForwarder : public InternalRunnable {
   /**
    * @brief Check for new logs and send.
    *
-   * Scan the logs domain for up to max_log_lines_ log lines.
-   * Sort those lines into status and request types then forward (send) each
-   * set. On success, clear the data and indexes. Calls purge upon completion.
+   * Read up to max_log_lines_ log lines from the head of the result, then
+   * status, queues and forward (send) each set. The result lines are shared
+   * between the priority classes, each class weighted by 2^priority. On
+   * success, remove the sent lines from the queue. Calls purge upon completion.
    */
   void check();
 
@@ -144,11 +197,27 @@ class BufferedLogForwarder : public InternalRunnable {
    * @brief Purge the oldest logs, if the max is exceeded
    *
    * Uses the buffered_log_max flag to determine the maximum number of buffered
-   * logs. If this number is exceeded, the logs with the oldest timestamp are
-   * purged. Order of purging for logs with the same timestamp is undefined.
+   * logs. If this number is exceeded, the oldest segments of the lowest
+   * priority class are purged until the count is within the max. Status lines
+   * are in the lowest class, of its queues the queue whose head line has the
+   * oldest timestamp is purged first, results first if the times match.
    */
   void purge();
 
+  /**
+   * @brief Report backpressure if the buffered logs are backing up.
+   *
+   * The forwarder is saturated when the buffer is more than half of
+   * buffered_log_max and more lines were buffered than sent since the last
+   * check. It recovers once a quarter of the max, or less, is buffered.
+   *
+   * @param sent The number of lines sent by this check.
+   */
+  void applyBackpressure(size_t sent);
+
+  /// The number of buffered result and status lines
+  size_t getBufferedCount();
+
  protected:
   /// Return whether the string is a result index
   bool isResultIndex(const std::string& index);
@@ -161,31 +230,52 @@ class BufferedLogForwarder : public InternalRunnable {
   bool isIndex(const std::string& index, bool results);
 
  protected:
-  /// Generate a result index string to use with the backing store
+  /// Generate the index string of the next result line
   std::string genResultIndex(size_t time = 0);
 
-  /// Generate a status index string to use with the backing store
+  /// Generate the index string of the next status line
   std::string genStatusIndex(size_t time = 0);
 
  private:
-  std::string genIndexPrefix(bool results);
+  /// The read and write positions of a queue, it holds the lines [head, tail).
+  struct Queue {
+    size_t head{0};
+    size_t tail{0};
+  };
 
-  std::string genIndex(bool results, size_t time = 0);
+  /// The queue of a priority class, status lines only use the lowest class.
+  Queue& getQueue(bool results, size_t priority);
 
-  /**
-   * @brief Add a database value while maintaining count
-   *
-   */
-  Status addValueWithCount(const std::string& domain,
-                           const std::string& key,
-                           const std::string& value);
+  std::string genIndexPrefix(bool results, size_t priority);
 
-  /**
-   * @brief Delete a database value while maintaining count
-   *
-   */
-  Status deleteValueWithCount(const std::string& domain,
-                              const std::string& key);
+  /// The lowest index of a position, every line index at position is greater.
+  std::string genIndexBound(bool results, size_t priority, size_t position);
+
+  std::string genIndex(bool results,
+                       size_t priority,
+                       size_t position,
+                       size_t time = 0);
+
+  /// Read the queue's head and tail, called by setUp.
+  void recover(bool results, size_t priority);
+
+  /// Append lines buffered with time-based indexes, used before the queues.
+  Status migrate(bool results);
+
+  /// Read up to max lines from the head of a queue, returns the head.
+  size_t read(bool results,
+              size_t priority,
+              std::vector<std::string>& lines,
+              size_t max);
+
+  /// Remove the count lines at head, unless they were purged.
+  Status remove(bool results, size_t priority, size_t head, size_t count);
+
+  /// The time of the line at position, 0 if it cannot be read.
+  size_t getLineTime(bool results, size_t priority, size_t position);
+
+  /// The number of buffered lines, the queue mutex must be held.
+  size_t getCount();
 
  protected:
   /// Seconds between flushing logs
@@ -194,6 +284,9 @@ class BufferedLogForwarder : public InternalRunnable {
   /// Max number of logs to flush per check
   size_t max_log_lines_;
 
+  /// Number of queue positions in each segment, the unit of purges
+  size_t segment_lines_{kSegmentLines};
+
   /**
    * @brief Name to use in index
    *
@@ -204,13 +297,19 @@ class BufferedLogForwarder : public InternalRunnable {
   std::string index_name_;
 
  private:
-  /// Hold an incrementing index for buffering logs
-  std::atomic<size_t> log_index_{0};
+  /// The queues of result lines, indexed by priority class
+  std::vector<Queue> results_{std::vector<Queue>(kLogPriorities)};
+
+  /// The queue of status lines
+  Queue statuses_;
+
+  /// The number of lines buffered since the last backpressure check
+  size_t enqueued_{0};
 
-  /// Stores the count of buffered logs
-  size_t buffer_count_{0};
+  /// Whether the forwarder reported backpressure
+  bool saturated_{false};
 
-  /// Protects the count of buffered logs
-  RecursiveMutex count_mutex_;
+  /// Protects the queue positions, lines are appended while it is held
+  Mutex queue_mutex_;
 };
 }
@@ -9,11 +9,23 @@
  */
 
 #include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
 
+#ifndef WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/msgpack.h"
+#include "osquery/filesystem/fileops.h"
+
 namespace fs = boost::filesystem;
 
 /**
@@ -33,9 +45,341 @@ FLAG_ALIAS(std::string, osquery_log_dir, logger_path);
 
 FLAG(int32, logger_mode, 0640, "Decimal mode for log files (default '0640')");
 
+FLAG(uint64,
+     logger_write_period,
+     0,
+     "Milliseconds between batched results log writes (default 0, no batch)");
+
+FLAG(bool, logger_write_sync, false, "Sync results logs to disk when written");
+
+FLAG(uint64,
+     logger_rotate_size,
+     0,
+     "Rotate results logs larger than this many bytes (default 0, no rotate)");
+
+FLAG(uint64,
+     logger_rotate_max_files,
+     25,
+     "Number of rotated results logs to keep");
+
 const std::string kFilesystemLoggerFilename = "osqueryd.results.log";
 const std::string kFilesystemLoggerSnapshots = "osqueryd.snapshots.log";
 
+/// Batched lines are written early if they exceed this size.
+const size_t kFilesystemLoggerBatchSize = 1024 * 1024;
+
+/**
+ * @brief A results log file kept open between writes.
+ *
+ * The file is reopened if it was moved or removed, such as by logrotate.
+ */
+class FilesystemLogFile : private boost::noncopyable {
+ public:
+  explicit FilesystemLogFile(const fs::path& path) : path_(path) {}
+
+  /// Append data to the file, creating or rotating it as needed.
+  Status write(const std::string& data);
+
+ private:
+  /// Open or create the file for appending.
+  Status open();
+
+  /// Check if the path no longer names the open file.
+  bool replaced() const;
+
+  /// The size of the open file, it may have been truncated by another process.
+  size_t size() const;
+
+  /// Move the file to path.1, and each existing path.N to path.N+1.
+  void rotate();
+
+  /// Flush written data to disk.
+  void sync();
+
+ private:
+  fs::path path_;
+
+  std::unique_ptr<PlatformFile> file_;
+
+  /// The file size, including the bytes written since it was opened.
+  size_t size_{0};
+};
+
+Status FilesystemLogFile::open() {
+  file_.reset(new PlatformFile(
+      path_, PF_OPEN_ALWAYS | PF_WRITE | PF_APPEND, FLAGS_logger_mode));
+  if (!file_->isValid()) {
+    file_.reset();
+    return Status(1, "Could not create file: " + path_.string());
+  }
+
+  // If the file existed with different permissions before our open
+  // they must be restricted.
+  if (!platformChmod(path_.string(), FLAGS_logger_mode)) {
+    file_.reset();
+    return Status(1,
+                  "Failed to change permissions for file: " + path_.string());
+  }
+
+  size_ = size();
+  return Status(0, "OK");
+}
+
+bool FilesystemLogFile::replaced() const {
+#ifndef WIN32
+  struct stat path_stat;
+  struct stat file_stat;
+  if (::stat(path_.string().c_str(), &path_stat) != 0 ||
+      ::fstat(file_->nativeHandle(), &file_stat) != 0) {
+    return true;
+  }
+  return path_stat.st_dev != file_stat.st_dev ||
+         path_stat.st_ino != file_stat.st_ino;
+#else
+  // Open files cannot be moved or removed on Windows.
+  boost::system::error_code ec;
+  return !fs::exists(path_, ec);
+#endif
+}
+
+size_t FilesystemLogFile::size() const {
+  return file_->size();
+}
+
+void FilesystemLogFile::rotate() {
+  file_.reset();
+
+  auto rotated = [this](size_t i) {
+    return fs::path(path_.string() + "." + std::to_string(i));
+  };
+
+  boost::system::error_code ec;
+  auto max_files = static_cast<size_t>(FLAGS_logger_rotate_max_files);
+  if (max_files == 0) {
+    fs::remove(path_, ec);
+    return;
+  }
+
+  fs::remove(rotated(max_files), ec);
+  for (size_t i = max_files; i > 1; i--) {
+    fs::rename(rotated(i - 1), rotated(i), ec);
+  }
+  fs::rename(path_, rotated(1), ec);
+}
+
+void FilesystemLogFile::sync() {
+#ifdef WIN32
+  ::FlushFileBuffers(file_->nativeHandle());
+#elif defined(__linux__)
+  ::fdatasync(file_->nativeHandle());
+#else
+  ::fsync(file_->nativeHandle());
+#endif
+}
+
+Status FilesystemLogFile::write(const std::string& data) {
+  if (file_ == nullptr || replaced()) {
+    auto status = open();
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  auto rotate_size = static_cast<size_t>(FLAGS_logger_rotate_size);
+  if (rotate_size > 0 && size_ > 0 && size_ + data.size() > rotate_size) {
+    // The file may have been truncated, by a logrotate copytruncate.
+    size_ = size();
+    if (size_ > 0 && size_ + data.size() > rotate_size) {
+      rotate();
+      auto status = open();
+      if (!status.ok()) {
+        return status;
+      }
+    }
+  }
+
+  if (data.empty()) {
+    return Status(0, "OK");
+  }
+
+  auto bytes = file_->write(data.c_str(), data.size());
+  if (bytes < 0 || static_cast<size_t>(bytes) != data.size()) {
+    file_.reset();
+    return Status(1, "Failed to write contents to file: " + path_.string());
+  }
+  size_ += data.size();
+
+  if (FLAGS_logger_write_sync) {
+    sync();
+  }
+  return Status(0, "OK");
+}
+
+/**
+ * @brief Write results and snapshot logs, optionally batched on a thread.
+ *
+ * Batched lines are appended to a buffer for each file. The buffers are
+ * written by the writer thread every logger_write_period milliseconds, or by
+ * a logging thread once a buffer is large.
+ */
+class FilesystemLogWriter : public PeriodicRunnable {
+ public:
+  explicit FilesystemLogWriter(const fs::path& log_path)
+      : PeriodicRunnable("FilesystemLogWriter"), log_path_(log_path) {}
+
+  /// Write, or batch, a line to a file within the log path.
+  Status write(const std::string& line, const std::string& filename);
+
+  /// Write, or batch, several lines to a file within the log path.
+  Status write(const std::vector<std::string>& lines,
+               const std::string& filename);
+
+  /// Create the file if it does not exist.
+  Status create(const std::string& filename);
+
+  /// Write the batched lines.
+  Status flush();
+
+ protected:
+  void tick() override;
+
+  std::chrono::milliseconds period() override;
+
+  void stop() override;
+
+ private:
+  /// Write data to a file, the caller must hold the files mutex.
+  Status writeFile(const std::string& data, const std::string& filename);
+
+ private:
+  /// The folder where the result/snapshot files are written.
+  fs::path log_path_;
+
+  /// Open files, by filename.
+  std::map<std::string, std::unique_ptr<FilesystemLogFile>> files_;
+
+  /// Batched lines, by filename.
+  std::map<std::string, std::string> batches_;
+
+  /// The total size of the batched lines.
+  size_t batched_{0};
+
+  /// Protects the files, and orders flushes of the batches.
+  std::mutex files_mutex_;
+
+  /// Protects the batches.
+  std::mutex batches_mutex_;
+};
+
+Status FilesystemLogWriter::writeFile(const std::string& data,
+                                      const std::string& filename) {
+  auto& file = files_[filename];
+  if (file == nullptr) {
+    file.reset(new FilesystemLogFile(log_path_ / filename));
+  }
+
+  try {
+    return file->write(data);
+  } catch (const std::exception& e) {
+    return Status(1, e.what());
+  }
+}
+
+Status FilesystemLogWriter::create(const std::string& filename) {
+  std::lock_guard<std::mutex> lock(files_mutex_);
+  return writeFile("", filename);
+}
+
+Status FilesystemLogWriter::write(const std::string& line,
+                                  const std::string& filename) {
+  // MessagePack records are length-delimited, rather than newline-delimited.
+  bool newline = !loggerUsesMessagePack();
+  if (FLAGS_logger_write_period == 0 || !hasRun()) {
+    // Without batches, or a writer thread, lines are written immediately.
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    return writeFile((newline) ? line + '\n' : line, filename);
+  }
+
+  bool full = false;
+  {
+    std::lock_guard<std::mutex> lock(batches_mutex_);
+    auto& batch = batches_[filename];
+    batch.append(line);
+    if (newline) {
+      batch.push_back('\n');
+    }
+    batched_ += line.size() + ((newline) ? 1 : 0);
+    full = (batched_ >= kFilesystemLoggerBatchSize);
+  }
+
+  return (full) ? flush() : Status(0, "OK");
+}
+
+Status FilesystemLogWriter::write(const std::vector<std::string>& lines,
+                                  const std::string& filename) {
+  bool newline = !loggerUsesMessagePack();
+  auto append = [newline, &lines](std::string& data) {
+    for (const auto& line : lines) {
+      data.append(line);
+      if (newline) {
+        data.push_back('\n');
+      }
+    }
+  };
+
+  if (FLAGS_logger_write_period == 0 || !hasRun()) {
+    // The lines are written together.
+    std::string data;
+    append(data);
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    return writeFile(data, filename);
+  }
+
+  bool full = false;
+  {
+    std::lock_guard<std::mutex> lock(batches_mutex_);
+    auto& batch = batches_[filename];
+    auto size = batch.size();
+    append(batch);
+    batched_ += batch.size() - size;
+    full = (batched_ >= kFilesystemLoggerBatchSize);
+  }
+
+  return (full) ? flush() : Status(0, "OK");
+}
+
+Status FilesystemLogWriter::flush() {
+  std::lock_guard<std::mutex> lock(files_mutex_);
+  std::map<std::string, std::string> batches;
+  {
+    std::lock_guard<std::mutex> batches_lock(batches_mutex_);
+    batches.swap(batches_);
+    batched_ = 0;
+  }
+
+  Status status;
+  for (const auto& batch : batches) {
+    auto s = writeFile(batch.second, batch.first);
+    if (!s.ok()) {
+      status = s;
+    }
+  }
+  return status;
+}
+
+void FilesystemLogWriter::tick() {
+  flush();
+}
+
+std::chrono::milliseconds FilesystemLogWriter::period() {
+  return std::chrono::milliseconds(FLAGS_logger_write_period);
+}
+
+void FilesystemLogWriter::stop() {
+  // Write the remaining batched lines.
+  flush();
+}
+
 class FilesystemLoggerPlugin : public LoggerPlugin {
  public:
   Status setUp() override;
@@ -43,6 +387,10 @@ class FilesystemLoggerPlugin : public LoggerPlugin {
   /// Log results (differential) to a distinct path.
   Status logString(const std::string& s) override;
 
+  /// Log a batch of results with one write.
+  Status logPriorityStrings(const std::vector<std::string>& strings,
+                            size_t priority) override;
+
   /// Log snapshot data to a distinct path.
   Status logSnapshot(const std::string& s) override;
 
@@ -65,11 +413,17 @@ class FilesystemLoggerPlugin : public LoggerPlugin {
                          const std::string& filename,
                          bool empty = false);
 
+  /// Get the writer, nullptr if the plugin is not set up.
+  std::shared_ptr<FilesystemLogWriter> getWriter();
+
  private:
   /// The folder where Glog and the result/snapshot files are written.
   fs::path log_path_;
 
-  /// Filesystem writer mutex.
+  /// The results/snapshot files writer.
+  std::shared_ptr<FilesystemLogWriter> writer_;
+
+  /// Protects the writer.
   Mutex mutex_;
 
  private:
@@ -81,6 +435,17 @@ REGISTER(FilesystemLoggerPlugin, "logger", "filesystem");
 Status FilesystemLoggerPlugin::setUp() {
   log_path_ = fs::path(FLAGS_logger_path);
 
+  {
+    WriteLock lock(mutex_);
+    if (writer_ != nullptr) {
+      writer_->flush();
+    }
+    writer_ = std::make_shared<FilesystemLogWriter>(log_path_);
+    if (FLAGS_logger_write_period > 0) {
+      Dispatcher::addService(writer_);
+    }
+  }
+
   // Ensure that the Glog status logs use the same mode as our results log.
   // Glog 0.3.4 does not support a logfile mode.
   // FLAGS_logfile_mode = FLAGS_logger_mode;
@@ -93,20 +458,28 @@ Status FilesystemLoggerPlugin::logString(const std::string& s) {
   return logStringToFile(s, kFilesystemLoggerFilename);
 }
 
+Status FilesystemLoggerPlugin::logPriorityStrings(
+    const std::vector<std::string>& strings, size_t /*priority*/) {
+  auto writer = getWriter();
+  if (writer == nullptr) {
+    return Status(1, "Filesystem logger is not set up");
+  }
+  return writer->write(strings, kFilesystemLoggerFilename);
+}
+
+std::shared_ptr<FilesystemLogWriter> FilesystemLoggerPlugin::getWriter() {
+  ReadLock lock(mutex_);
+  return writer_;
+}
+
 Status FilesystemLoggerPlugin::logStringToFile(const std::string& s,
                                                const std::string& filename,
                                                bool empty) {
-  WriteLock lock(mutex_);
-  Status status;
-  try {
-    status = writeTextFile((log_path_ / filename).string(),
-                           (empty) ? "" : s + '\n',
-                           FLAGS_logger_mode,
-                           true);
-  } catch (const std::exception& e) {
-    return Status(1, e.what());
+  auto writer = getWriter();
+  if (writer == nullptr) {
+    return Status(1, "Filesystem logger is not set up");
   }
-  return status;
+  return (empty) ? writer->create(filename) : writer->write(s, filename);
 }
 
 Status FilesystemLoggerPlugin::logStatus(
@@ -20,6 +20,7 @@
 #include <osquery/system.h>
 
 #include "osquery/config/parsers/kafka_topics.h"
+#include "osquery/core/msgpack.h"
 #include "osquery/logger/plugins/kafka_producer.h"
 #include "osquery/remote/transports/tls.h"
 
@@ -43,8 +44,28 @@ FLAG(string,
      "all",
      "The number of acknowledgments the leader has to receive (0, 1, 'all')");
 
-/// How often to poll Kafka broker for publish results.
-const std::chrono::seconds kKafkaPollDuration = std::chrono::seconds(5);
+FLAG(uint64,
+     logger_kafka_linger_ms,
+     50,
+     "Milliseconds to batch Kafka messages before sending (default 50)");
+
+FLAG(uint64,
+     logger_kafka_batch_messages,
+     10000,
+     "Maximum number of Kafka messages sent in one batch");
+
+FLAG(string,
+     logger_kafka_compression,
+     "none",
+     "Kafka message batch compression codec (none, gzip, snappy, lz4)");
+
+FLAG(uint64,
+     logger_kafka_poll_interval,
+     100,
+     "Milliseconds between polls for Kafka delivery reports");
+
+/// How long a producer waits for queued messages to be sent, when full.
+const int kKafkaQueueFullTimeout = 100;
 
 /// Default Kafka topic to publish to if payload name is not found.
 const std::string kKafkaBaseTopic("base_topic");
@@ -128,18 +149,16 @@ void onMsgDelivery(rd_kafka_t* rk,
 }
 
 void KafkaProducerPlugin::flushMessages() {
-  WriteLock lock(producerMutex_);
   rd_kafka_flush(producer_.get(), 3 * 1000);
 }
 
 void KafkaProducerPlugin::pollKafka() {
-  WriteLock lock(producerMutex_);
   rd_kafka_poll(producer_.get(), 0 /*non-blocking*/);
 }
 
 void KafkaProducerPlugin::start() {
   while (!interrupted() && running_.load()) {
-    pauseMilli(kKafkaPollDuration);
+    pauseMilli(FLAGS_logger_kafka_poll_interval);
     if (interrupted()) {
       return;
     }
@@ -193,6 +212,22 @@ void KafkaProducerPlugin::init(const std::string& name,
     return;
   }
 
+  // Messages are batched by the producer, and sent by its own threads.
+  if (!setConf(conf,
+               "queue.buffering.max.ms",
+               std::to_string(FLAGS_logger_kafka_linger_ms),
+               errstr) ||
+      !setConf(conf,
+               "batch.num.messages",
+               std::to_string(FLAGS_logger_kafka_batch_messages),
+               errstr) ||
+      !setConf(conf,
+               "compression.codec",
+               FLAGS_logger_kafka_compression,
+               errstr)) {
+    return;
+  }
+
   // Register send callback.
   rd_kafka_conf_set_dr_msg_cb(conf, onMsgDelivery);
 
@@ -229,7 +264,8 @@ Status KafkaProducerPlugin::logString(const std::string& payload) {
         1, "Cannot log because Kafka producer did not initiate properly.");
   }
 
-  std::string name(getMsgName(payload));
+  std::string name((loggerUsesMessagePack()) ? getMessagePackRecordName(payload)
+                                             : getMsgName(payload));
 
   rd_kafka_topic_t* topic = nullptr;
   try {
@@ -246,27 +282,41 @@ Status KafkaProducerPlugin::logString(const std::string& payload) {
     return Status(2, errMsg);
   }
 
-  Status status = publishMsg(topic, payload);
+  // Delivery reports are polled by the producer's service thread.
+  Status status = publishMsg(topic, getMsgKey(name), payload);
   if (!status.ok()) {
     LOG(ERROR) << "Could not publish message: " << status.getMessage();
   }
-
-  // Poll after every produce attempt.
-  pollKafka();
-
   return status;
 }
 
+std::string KafkaProducerPlugin::getMsgKey(const std::string& name) const {
+  // Keep each host's results for a query within the same partition.
+  return (name.empty()) ? msgKey_ : msgKey_ + "_" + name;
+}
+
 Status KafkaProducerPlugin::publishMsg(rd_kafka_topic_t* topic,
+                                       const std::string& key,
                                        const std::string& payload) {
-  if (rd_kafka_produce(topic,
-                       RD_KAFKA_PARTITION_UA,
-                       RD_KAFKA_MSG_F_COPY,
-                       (char*)payload.c_str(),
-                       payload.length(),
-                       msgKey_.c_str(), // Optional key
-                       msgKey_.length(), // key length
-                       nullptr) == -1) {
+  auto produce = [&]() {
+    return rd_kafka_produce(topic,
+                            RD_KAFKA_PARTITION_UA,
+                            RD_KAFKA_MSG_F_COPY,
+                            const_cast<char*>(payload.c_str()),
+                            payload.length(),
+                            key.c_str(), // Optional key
+                            key.length(), // key length
+                            nullptr);
+  };
+
+  auto result = produce();
+  if (result == -1 && rd_kafka_last_error() == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+    // Wait for queued messages to be sent, serving their delivery reports.
+    rd_kafka_poll(producer_.get(), kKafkaQueueFullTimeout);
+    result = produce();
+  }
+
+  if (result == -1) {
     return Status(1,
                   "Failed to produce on Kafka topic " +
                       std::string(rd_kafka_topic_name(topic)) + " : " +
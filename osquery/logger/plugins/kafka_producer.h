@@ -33,8 +33,8 @@ class KafkaProducerPlugin : public LoggerPlugin, public InternalRunnable {
   /*
    * @brief Logs string s as payload to configured Kafka brokers.
    *
-   * Calls rd_kafka_poll regardless of production success.  rd_kafka_poll
-   * invokes callback that actually reports if message sends failed.
+   * Messages are queued and batched by the producer. The service thread calls
+   * rd_kafka_poll, which invokes the callback reporting failed sends.
    */
   Status logString(const std::string& s) override;
 
@@ -72,23 +72,30 @@ class KafkaProducerPlugin : public LoggerPlugin, public InternalRunnable {
   /**
    * @brief Publishes message to Kafka topic.
    *
+   * The producer is thread safe, messages are published without locking.
+   *
    * @param topic Kafka topic to publish to
+   * @param key message key, used to select the topic partition
    * @param msg message body
    *
    * @return Status of publish attempt
    */
   virtual Status publishMsg(rd_kafka_topic_t* topic,
+                            const std::string& key,
                             const std::string& payload);
 
+  /// The message key for a payload's query name, prefixed by the host.
+  std::string getMsgKey(const std::string& name) const;
+
   /**
    * @brief Flushes all buffered messages to Kafka, waiting for a maximum of 3
-   * seconds.  Wrapper with mutex locking around rd_kafka_flush.
+   * seconds.  Wrapper around rd_kafka_flush.
    */
   virtual void flushMessages();
 
   /**
    * @brief polls to ensure onMsgDelivery callback is invoked message receipt.
-   * Wrapper with mutex locking around rd_kafka_poll.
+   * Wrapper around a non-blocking rd_kafka_poll.
    */
   virtual void pollKafka();
 
@@ -116,9 +123,6 @@ class KafkaProducerPlugin : public LoggerPlugin, public InternalRunnable {
   /// OS hostname and binary name interpolated as the Kafka message key.
   std::string msgKey_;
 
-  /// Mutex for managing access to the producer_ pointer.
-  Mutex producerMutex_;
-
   /// Flag to ensure shutdown method is called only once
   static std::once_flag shutdownFlag_;
 };
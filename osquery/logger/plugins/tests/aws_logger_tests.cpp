@@ -97,6 +97,10 @@ class DummyLogForwarder final : public IDummyLogForwarder {
     return 0U;
   }
 
+  std::size_t getMaxConcurrentBatches() const override {
+    return 1U;
+  }
+
   bool appendNewlineSeparators() const override {
     return true;
   }
@@ -30,6 +30,7 @@ namespace pt = boost::property_tree;
 namespace osquery {
 
 DECLARE_uint64(buffered_log_max);
+DECLARE_bool(buffered_log_backpressure);
 
 // Check that the string matches the StatusLogLine
 MATCHER_P(MatchesStatus, expected, "") {
@@ -84,17 +85,30 @@ class MockBufferedLogForwarder : public BufferedLogForwarder {
   FRIEND_TEST(BufferedLogForwarderTests, test_split);
   FRIEND_TEST(BufferedLogForwarderTests, test_purge);
   FRIEND_TEST(BufferedLogForwarderTests, test_purge_max);
+  FRIEND_TEST(BufferedLogForwarderTests, test_purge_segments);
+  FRIEND_TEST(BufferedLogForwarderTests, test_recover);
+  FRIEND_TEST(BufferedLogForwarderTests, test_priority);
+  FRIEND_TEST(BufferedLogForwarderTests, test_purge_priority);
+  FRIEND_TEST(BufferedLogForwarderTests, test_batch);
+  FRIEND_TEST(BufferedLogForwarderTests, test_backpressure);
 };
 
 TEST_F(BufferedLogForwarderTests, test_index) {
   MockBufferedLogForwarder runner;
   if (!isPlatform(PlatformType::TYPE_WINDOWS)) {
-    EXPECT_THAT(runner.genResultIndex(), ContainsRegex("mock_r_[0-9]+_1"));
-    EXPECT_THAT(runner.genStatusIndex(), ContainsRegex("mock_s_[0-9]+_2"));
-    EXPECT_THAT(runner.genResultIndex(), ContainsRegex("mock_r_[0-9]+_3"));
-    EXPECT_THAT(runner.genStatusIndex(), ContainsRegex("mock_s_[0-9]+_4"));
+    EXPECT_THAT(runner.genResultIndex(), ContainsRegex("mock_r_0{20}_[0-9]+"));
+    EXPECT_THAT(runner.genStatusIndex(), ContainsRegex("mock_s_0{20}_[0-9]+"));
   }
 
+  // The index is the position of the next line in the queue.
+  runner.logString("foo");
+  EXPECT_EQ(runner.genResultIndex(10), "mock_r_00000000000000000001_10");
+  EXPECT_EQ(runner.genStatusIndex(10), "mock_s_00000000000000000000_10");
+
+  EXPECT_CALL(runner, send(ElementsAre("foo"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
   EXPECT_TRUE(runner.isResultIndex(runner.genResultIndex()));
   EXPECT_FALSE(runner.isResultIndex(runner.genStatusIndex()));
   EXPECT_FALSE(runner.isResultIndex("foo"));
@@ -281,6 +295,8 @@ TEST_F(BufferedLogForwarderTests, test_split) {
 TEST_F(BufferedLogForwarderTests, test_purge) {
   FLAGS_buffered_log_max = 3;
   StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 100);
+  // Purge single lines.
+  runner.segment_lines_ = 1;
   size_t time = getUnixTime();
   for (uint64_t i = 0; i < 10; ++i) {
     runner.logString(std::to_string(i), time);
@@ -310,6 +326,7 @@ TEST_F(BufferedLogForwarderTests, test_purge_max) {
   FLAGS_buffered_log_max = 2;
 
   StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 5);
+  runner.segment_lines_ = 1;
   StatusLogLine log1 = makeStatusLogLine(O_INFO, "foo", 1, "foo status");
   StatusLogLine log2 = makeStatusLogLine(O_ERROR, "bar", 30, "bar error");
   size_t time = getUnixTime();
@@ -347,4 +364,169 @@ TEST_F(BufferedLogForwarderTests, test_purge_max) {
 
   runner.check();
 }
+
+// Verify that whole segments are purged, the oldest first
+TEST_F(BufferedLogForwarderTests, test_purge_segments) {
+  FLAGS_buffered_log_max = 5;
+
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 100);
+  runner.segment_lines_ = 4;
+  for (size_t i = 0; i < 10; ++i) {
+    runner.logString(std::to_string(i));
+  }
+
+  // Two segments are purged to fit within the max.
+  runner.purge();
+  EXPECT_CALL(runner, send(ElementsAre("8", "9"), "result"))
+      .WillOnce(Return(Status(1, "fail")));
+  runner.check();
+
+  // The queue positions continue within the third segment.
+  for (size_t i = 10; i < 14; ++i) {
+    runner.logString(std::to_string(i));
+  }
+  runner.purge();
+  EXPECT_CALL(runner, send(ElementsAre("12", "13"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  runner.check();
+}
+
+// Verify that buffered lines, and their count, are recovered
+TEST_F(BufferedLogForwarderTests, test_recover) {
+  FLAGS_buffered_log_max = 3;
+  StatusLogLine log = makeStatusLogLine(O_INFO, "foo", 1, "foo status");
+  size_t time = getUnixTime();
+
+  {
+    StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 100);
+    runner.logString("foo", time);
+    runner.logString("bar", time);
+    runner.logStatus({log}, time);
+
+    EXPECT_CALL(runner, send(ElementsAre("foo", "bar"), "result"))
+        .WillOnce(Return(Status(0)));
+    EXPECT_CALL(runner, send(ElementsAre(MatchesStatus(log)), "status"))
+        .WillOnce(Return(Status(1, "fail")));
+    runner.check();
+    runner.logString("baz", time + 1);
+  }
+
+  // Lines buffered by earlier versions are indexed by time.
+  setDatabaseValue(kLogs, "mock_r_1000_1", "legacy");
+
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 100);
+  runner.segment_lines_ = 1;
+  ASSERT_TRUE(runner.setUp().ok());
+  runner.logString("qux", time + 1);
+  EXPECT_EQ(4U, runner.getBufferedCount());
+
+  // The legacy line was appended, then the oldest (status) line is purged.
+  EXPECT_CALL(runner, send(ElementsAre("baz", "legacy", "qux"), "result"))
+      .WillOnce(Return(Status(1, "fail")));
+  EXPECT_CALL(runner, send(ElementsAre(MatchesStatus(log)), "status"))
+      .WillOnce(Return(Status(1, "fail")));
+  runner.check();
+
+  EXPECT_CALL(runner, send(ElementsAre("baz", "legacy", "qux"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  runner.check();
+}
+
+// Verify that the priority classes share each check by weight
+TEST_F(BufferedLogForwarderTests, test_priority) {
+  FLAGS_buffered_log_max = 100;
+
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 6);
+  for (size_t i = 0; i < 10; ++i) {
+    runner.logString("a" + std::to_string(i));
+    runner.logPriorityString("b" + std::to_string(i), 1);
+  }
+
+  // The higher class is given twice the lines of the lower class.
+  EXPECT_CALL(runner,
+              send(ElementsAre("b0", "b1", "b2", "b3", "a0", "a1"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  // A class with fewer lines than its share is read in full, priorities above
+  // the highest class use the highest class.
+  runner.logPriorityString("c0", 10);
+  EXPECT_CALL(runner,
+              send(ElementsAre("c0", "b4", "b5", "b6", "b7", "a2"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  EXPECT_EQ(9U, runner.getBufferedCount());
+
+  EXPECT_CALL(runner,
+              send(ElementsAre("b8", "b9", "a3", "a4", "a5", "a6"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  EXPECT_CALL(runner, send(ElementsAre("a7", "a8", "a9"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  runner.check();
+}
+
+// Verify that the lowest priority class is purged first
+TEST_F(BufferedLogForwarderTests, test_purge_priority) {
+  FLAGS_buffered_log_max = 2;
+
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 100);
+  runner.segment_lines_ = 1;
+  size_t time = getUnixTime();
+  runner.logPriorityString("foo", 2, time);
+  runner.logPriorityString("bar", 2, time);
+  runner.logString("baz", time + 1);
+  runner.logString("qux", time + 1);
+
+  runner.purge();
+  EXPECT_CALL(runner, send(ElementsAre("foo", "bar"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  runner.check();
+}
+
+// Verify that a batch of strings is queued in order with single strings
+TEST_F(BufferedLogForwarderTests, test_batch) {
+  FLAGS_buffered_log_max = 100;
+
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 100);
+  runner.logPriorityString("a", 1);
+  EXPECT_TRUE(runner.logPriorityStrings({"b", "c", "d"}, 1).ok());
+  runner.logPriorityString("e", 1);
+  EXPECT_EQ(5U, runner.getBufferedCount());
+
+  EXPECT_CALL(runner, send(ElementsAre("a", "b", "c", "d", "e"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  EXPECT_EQ(0U, runner.getBufferedCount());
+}
+
+// Verify that a backed up forwarder reports backpressure until it drains
+TEST_F(BufferedLogForwarderTests, test_backpressure) {
+  FLAGS_buffered_log_max = 4;
+  FLAGS_buffered_log_backpressure = true;
+
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 100);
+  for (size_t i = 0; i < 3; ++i) {
+    runner.logString(std::to_string(i));
+  }
+
+  EXPECT_CALL(runner, send(ElementsAre("0", "1", "2"), "result"))
+      .WillOnce(Return(Status(1, "fail")))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  EXPECT_EQ(1U, getLoggerBackpressure());
+
+  runner.check();
+  EXPECT_EQ(0U, getLoggerBackpressure());
+  FLAGS_buffered_log_backpressure = false;
+}
 }
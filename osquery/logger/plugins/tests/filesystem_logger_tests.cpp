@@ -23,6 +23,7 @@ namespace osquery {
 
 DECLARE_string(logger_path);
 DECLARE_bool(disable_logging);
+DECLARE_uint64(logger_rotate_size);
 
 class FilesystemLoggerTests : public testing::Test {
  public:
@@ -167,4 +168,25 @@ TEST_F(FilesystemLoggerTests, test_log_snapshot) {
       "\"unixTime\":\"0\",\"epoch\":\"0\",\"counter\":\"0\"}\n";
   EXPECT_EQ(content, expected);
 }
+
+TEST_F(FilesystemLoggerTests, test_log_rotate) {
+  auto rotated_path = results_path_ + ".1";
+  fs::remove(rotated_path);
+
+  EXPECT_TRUE(logString("{\"first\": true}", "event"));
+  auto size = fs::file_size(results_path_);
+
+  // The next line will not fit, the existing lines are rotated.
+  auto rotate_size = FLAGS_logger_rotate_size;
+  FLAGS_logger_rotate_size = size + 1;
+  EXPECT_TRUE(logString("{\"second\": true}", "event"));
+  FLAGS_logger_rotate_size = rotate_size;
+
+  ASSERT_TRUE(fs::exists(rotated_path));
+  EXPECT_EQ(size, fs::file_size(rotated_path));
+
+  std::string content;
+  EXPECT_TRUE(readFile(results_path_, content));
+  EXPECT_EQ(content, "{\"second\": true}\n");
+}
 }
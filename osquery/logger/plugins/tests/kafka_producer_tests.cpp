@@ -42,6 +42,7 @@ class MockKafkaProducerPlugin : public KafkaProducerPlugin {
 
  protected:
   Status publishMsg(rd_kafka_topic_t* topic,
+                    const std::string& key,
                     const std::string& payload) override {
     if (publishedMsgs_.find(topic) == publishedMsgs_.end()) {
       std::vector<std::string> msgs;
@@ -49,6 +50,7 @@ class MockKafkaProducerPlugin : public KafkaProducerPlugin {
     }
 
     publishedMsgs_[topic].push_back(payload);
+    publishedKeys_.push_back(key);
 
     return Status(0, "OK");
   }
@@ -64,6 +66,8 @@ class MockKafkaProducerPlugin : public KafkaProducerPlugin {
  public:
   std::map<rd_kafka_topic_t*, std::vector<std::string>> publishedMsgs_;
 
+  std::vector<std::string> publishedKeys_;
+
   std::atomic<int> timesFlushed_;
 
   std::atomic<int> timesPolled_;
@@ -165,7 +169,10 @@ TEST_F(KafkaProducerPluginTest, logString_single_topic_happy_path) {
 
   EXPECT_EQ(msgs, mkpp.publishedMsgs_[topic]);
 
-  EXPECT_TRUE(mkpp.timesPolled_.load() == 4);
+  // Messages are keyed by query name, delivery reports are polled separately.
+  std::vector<std::string> keys = {"_test1", "_test2", "_test3", "_test4"};
+  EXPECT_EQ(keys, mkpp.publishedKeys_);
+  EXPECT_EQ(0, mkpp.timesPolled_.load());
 }
 
 TEST_F(KafkaProducerPluginTest, logString_multi_topic_happy_path) {
@@ -229,8 +236,6 @@ TEST_F(KafkaProducerPluginTest, logString_multi_topic_happy_path) {
       "{\"name\": \"topic3\", \"snapshot\": \"8\"}",
   };
   EXPECT_EQ(expected, mkpp.publishedMsgs_[topic3]);
-
-  EXPECT_TRUE(mkpp.timesPolled_.load() == 8);
 }
 
 TEST_F(KafkaProducerPluginTest, flush_on_stop) {
@@ -14,6 +14,7 @@
 #include <osquery/flags.h>
 #include <osquery/registry.h>
 
+#include "osquery/remote/requests.h"
 #include "osquery/remote/serializers/json.h"
 #include "osquery/remote/utility.h"
 
@@ -22,6 +23,7 @@
 #include "osquery/logger/plugins/tls_logger.h"
 
 namespace pt = boost::property_tree;
+namespace rj = rapidjson;
 
 namespace osquery {
 
@@ -39,13 +41,20 @@ FLAG(uint64,
      1 * 1024 * 1024,
      "Max size in bytes allowed per log line");
 
-FLAG(bool, logger_tls_compress, false, "GZip compress TLS/HTTPS request body");
+FLAG(bool,
+     logger_tls_compress,
+     false,
+     "Compress TLS/HTTPS request body, see tls_compression");
 
 REGISTER(TLSLoggerPlugin, "logger", "tls");
 
 TLSLogForwarder::TLSLogForwarder()
-    : BufferedLogForwarder("TLSLogForwarder",
-                           "tls",
+    : TLSLogForwarder("TLSLogForwarder", "tls") {}
+
+TLSLogForwarder::TLSLogForwarder(const std::string& service_name,
+                                 const std::string& name)
+    : BufferedLogForwarder(service_name,
+                           name,
                            std::chrono::seconds(FLAGS_logger_tls_period),
                            kTLSMaxLogLines) {
   uri_ = TLSRequestHelper::makeURI(FLAGS_logger_tls_endpoint);
@@ -55,6 +64,16 @@ Status TLSLoggerPlugin::logString(const std::string& s) {
   return forwarder_->logString(s);
 }
 
+Status TLSLoggerPlugin::logPriorityString(const std::string& s,
+                                          size_t priority) {
+  return forwarder_->logPriorityString(s, priority);
+}
+
+Status TLSLoggerPlugin::logPriorityStrings(
+    const std::vector<std::string>& strings, size_t priority) {
+  return forwarder_->logPriorityStrings(strings, priority);
+}
+
 Status TLSLoggerPlugin::logStatus(const std::vector<StatusLogLine>& log) {
   return forwarder_->logStatus(log);
 }
@@ -84,44 +103,68 @@ void TLSLoggerPlugin::init(const std::string& name,
   logStatus(log);
 }
 
+/// Check that a buffered log line is a JSON object, without a DOM.
+static bool isJSONObject(const std::string& line) {
+  auto start = line.find_first_not_of(" \t\r\n");
+  if (start == std::string::npos || line[start] != '{') {
+    return false;
+  }
+
+  rj::Reader reader;
+  rj::BaseReaderHandler<> handler;
+  rj::StringStream stream(line.c_str());
+  return !reader.Parse(stream, handler).IsError();
+}
+
+/// Quote and escape a JSON string.
+static std::string quoteJSON(const std::string& value) {
+  rj::StringBuffer sb;
+  rj::Writer<rj::StringBuffer> writer(sb);
+  writer.String(value.c_str(), static_cast<rj::SizeType>(value.size()));
+  return sb.GetString();
+}
+
 Status TLSLogForwarder::send(std::vector<std::string>& log_data,
                              const std::string& log_type) {
-  pt::ptree params;
-  params.put<std::string>("node_key", getNodeKey("tls"));
-  params.put<std::string>("log_type", log_type);
-
-  {
-    // Read each logged line into JSON and populate a list of lines.
-    // The result list will use the 'data' key.
-    pt::ptree children;
-    iterate(log_data, ([&children](std::string& item) {
-              // Enforce a max log line size for TLS logging.
-              if (item.size() > FLAGS_logger_tls_max) {
-                LOG(WARNING) << "Line exceeds TLS logger max: " << item.size();
-                return;
-              }
-
-              pt::ptree child;
-              try {
-                std::stringstream input;
-                input << item;
-                std::string().swap(item);
-                pt::read_json(input, child);
-              } catch (const pt::json_parser::json_parser_error& /* e */) {
-                // The log line entered was not valid JSON, skip it.
-                return;
-              }
-              children.push_back(std::make_pair("", std::move(child)));
-            }));
-    params.add_child("data", std::move(children));
+  // The buffered lines are JSON, they are appended to the body verbatim.
+  // The body is optionally compressed as it is appended.
+  RequestBody body(FLAGS_logger_tls_compress ? FLAGS_tls_compression : "");
+
+  body.append("{\"node_key\":" + quoteJSON(getNodeKey("tls")) +
+              ",\"log_type\":" + quoteJSON(log_type) + ",\"data\":[");
+  bool first = true;
+  iterate(log_data, ([&body, &first](std::string& item) {
+            // Enforce a max log line size for TLS logging.
+            if (item.size() > FLAGS_logger_tls_max) {
+              LOG(WARNING) << "Line exceeds TLS logger max: " << item.size();
+              return;
+            }
+
+            if (!isJSONObject(item)) {
+              // The log line entered was not valid JSON, skip it.
+              return;
+            }
+
+            if (!first) {
+              body.append(",");
+            }
+            first = false;
+            body.append(item);
+            std::string().swap(item);
+          }));
+  body.append("]}");
+
+  std::string serialized;
+  std::string encoding;
+  auto s = body.finish(serialized, encoding);
+  if (!s.ok()) {
+    return s;
   }
 
   // The response body is ignored (status is set appropriately by
   // TLSRequestHelper::go())
-  std::string response;
-  if (FLAGS_logger_tls_compress) {
-    params.put("_compress", true);
-  }
-  return TLSRequestHelper::go<JSONSerializer>(uri_, params, response);
+  pt::ptree response;
+  return TLSRequestHelper::go<JSONSerializer>(
+      uri_, serialized, encoding, response);
 }
 }
@@ -28,6 +28,9 @@ class TLSLogForwarder : public BufferedLogForwarder {
  public:
   explicit TLSLogForwarder();
 
+  /// A forwarder with its own backing store index, such as a relay's.
+  TLSLogForwarder(const std::string& service_name, const std::string& name);
+
  protected:
   Status send(std::vector<std::string>& log_data,
               const std::string& log_type) override;
@@ -64,6 +67,13 @@ class TLSLoggerPlugin : public LoggerPlugin {
   /// Log a result string. This is the basic catch-all for snapshots and events.
   Status logString(const std::string& s) override;
 
+  /// Log a result string in the queue of its query's priority class.
+  Status logPriorityString(const std::string& s, size_t priority) override;
+
+  /// Log a batch of result strings in the queue of their priority class.
+  Status logPriorityStrings(const std::vector<std::string>& strings,
+                            size_t priority) override;
+
   /// Log a status (ERROR/WARNING/INFO) message.
   Status logStatus(const std::vector<StatusLogLine>& log) override;
 
@@ -40,6 +40,7 @@ class LoggerTests : public testing::Test {
     log_lines.clear();
     status_messages.clear();
     statuses_logged = 0;
+    events_logged = 0;
     last_status = {O_INFO, "", 10, "", "cal_time", 0, "host"};
   }
 
@@ -178,6 +179,15 @@ TEST_F(LoggerTests, test_log_string) {
   EXPECT_EQ(2U, LoggerTests::log_lines.size());
 }
 
+TEST_F(LoggerTests, test_log_event) {
+  // Internal logger plugins are called directly.
+  EXPECT_TRUE(logEvent("{\"json\": true}", {"test"}));
+  EXPECT_EQ(1U, LoggerTests::events_logged);
+
+  EXPECT_FALSE(logEvent("{\"json\": true}", {"does_not_exist"}));
+  EXPECT_EQ(1U, LoggerTests::events_logged);
+}
+
 TEST_F(LoggerTests, test_logger_log_status) {
   std::string warning = "Logger test is generating a warning status (2)";
   auto now = getUnixTime();
@@ -229,6 +239,31 @@ TEST_F(LoggerTests, test_logger_status_level) {
   FLAGS_logger_min_status = logger_min_status;
 }
 
+TEST_F(LoggerTests, test_logger_status_threads) {
+  // The daemon buffers status logs until they are relayed.
+  auto tool_type = kToolType;
+  kToolType = ToolType::DAEMON;
+
+  LOG(WARNING) << "first";
+  std::thread([]() { LOG(WARNING) << "second"; }).join();
+  LOG(WARNING) << "third";
+  EXPECT_EQ(3U, queuedStatuses());
+  EXPECT_EQ(0U, LoggerTests::statuses_logged);
+
+  // Lines from each thread, including threads that exited, are relayed once.
+  relayStatusLogs(true);
+  EXPECT_EQ(0U, queuedStatuses());
+  ASSERT_EQ(3U, LoggerTests::status_messages.size());
+  EXPECT_EQ("first", LoggerTests::status_messages[0]);
+  EXPECT_EQ("second", LoggerTests::status_messages[1]);
+  EXPECT_EQ("third", LoggerTests::status_messages[2]);
+  EXPECT_EQ(getHostIdentifier(), LoggerTests::last_status.identifier);
+
+  relayStatusLogs(true);
+  EXPECT_EQ(3U, LoggerTests::statuses_logged);
+  kToolType = tool_type;
+}
+
 TEST_F(LoggerTests, test_feature_request) {
   // Retrieve the test logger plugin.
   auto plugin = RegistryFactory::get().plugin("logger", "test");
@@ -394,6 +429,32 @@ TEST_F(LoggerTests, test_logger_scheduled_query) {
   EXPECT_EQ(LoggerTests::log_lines.back(), expected);
 }
 
+TEST_F(LoggerTests, test_logger_batch) {
+  RegistryFactory::get().setActive("logger", "test");
+  initLogger("scheduled_query");
+
+  QueryLogItem item;
+  item.name = "test_query";
+  item.results.added.push_back({{"test_column", "test_value"}});
+
+  // Batched results are logged when the batch is flushed.
+  setLoggerBatching(true);
+  logQueryLogItem(item);
+  logQueryLogItem(item);
+  EXPECT_EQ(0U, LoggerTests::log_lines.size());
+  EXPECT_TRUE(flushLoggerBatch().ok());
+  EXPECT_EQ(2U, LoggerTests::log_lines.size());
+  EXPECT_TRUE(flushLoggerBatch().ok());
+  EXPECT_EQ(2U, LoggerTests::log_lines.size());
+
+  // Disabling batching flushes the remaining results.
+  logQueryLogItem(item);
+  setLoggerBatching(false);
+  EXPECT_EQ(3U, LoggerTests::log_lines.size());
+  logQueryLogItem(item);
+  EXPECT_EQ(4U, LoggerTests::log_lines.size());
+}
+
 class RecursiveLoggerPlugin : public LoggerPlugin {
  protected:
   bool usesLogStatus() override {
@@ -460,7 +521,7 @@ TEST_F(LoggerTests, test_recursion) {
   kToolType = ToolType::DAEMON;
   LOG(WARNING) << "recurse";
 
-  // The daemon calls the status relay within the scheduler.
+  // The daemon calls the status relay within the StatusLogRelayRunner.
   EXPECT_EQ(3U, plugin->statuses);
 
   // All of recursive log lines will sink during the next call.
@@ -31,10 +31,14 @@
 #include "osquery/core/watcher.h"
 #include "osquery/devtools/devtools.h"
 #include "osquery/dispatcher/distributed.h"
+#include "osquery/dispatcher/maintenance.h"
+#include "osquery/dispatcher/sandbox.h"
 #include "osquery/dispatcher/scheduler.h"
 #include "osquery/filesystem/fileops.h"
 #include "osquery/main/main.h"
+#include "osquery/remote/relay.h"
 #include "osquery/sql/sqlite_util.h"
+#include "osquery/sql/table_fixtures.h"
 
 namespace osquery {
 
@@ -53,6 +57,7 @@ CLI_FLAG(bool, install, false, "Install osqueryd as a service");
 CLI_FLAG(bool, uninstall, false, "Uninstall osqueryd as a service");
 
 DECLARE_bool(disable_caching);
+DECLARE_string(table_replay_path);
 
 const std::string kWatcherWorkerName{"osqueryd: worker"};
 
@@ -106,9 +111,21 @@ int startDaemon(Initializer& runner) {
     VLOG(1) << "Not starting the distributed query service: " << s.toString();
   }
 
+  // Conditionally relay the remote requests of other hosts.
+  s = startRelay();
+  if (!s.ok()) {
+    VLOG(1) << "Not starting the TLS relay: " << s.toString();
+  }
+
   // Begin the schedule runloop.
   startScheduler();
 
+  // Compact the database during quiet periods.
+  s = startDatabaseMaintenance();
+  if (!s.ok()) {
+    VLOG(1) << "Not starting database maintenance: " << s.toString();
+  }
+
   // Finally wait for a signal / interrupt to shutdown.
   runner.waitForShutdown();
   return 0;
@@ -130,6 +147,14 @@ int startShell(osquery::Initializer& runner, int argc, char* argv[]) {
   }
 
   int retcode = 0;
+  if (!FLAGS_table_replay_path.empty()) {
+    // Queries select from recorded rows, such as when profiling.
+    auto status = replayTableFixtures(FLAGS_table_replay_path);
+    if (!status.ok()) {
+      LOG(ERROR) << "Cannot replay tables: " << status.getMessage();
+    }
+  }
+
   if (osquery::FLAGS_profile <= 0) {
     runner.start();
 
@@ -160,9 +185,17 @@ int startOsquery(int argc, char* argv[], std::function<void()> shutdown) {
     return 1;
   }
 
+  // A sandbox executes a worker's scheduled queries, see --sandbox_workers.
+  if (isSandboxProcess()) {
+    return startSandbox();
+  }
+
   runner.installShutdown(shutdown);
   runner.initDaemon();
 
+  // Sandboxes are launched with the arguments, a worker clears them.
+  SandboxPool::get().setArguments(argc, argv);
+
   // When a watchdog is used, the current daemon will fork/exec into a worker.
   // In either case the watcher may start optionally loaded extensions.
   runner.initWorkerWatcher(kWatcherWorkerName);
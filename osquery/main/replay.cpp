@@ -0,0 +1,310 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include <osquery/config.h>
+#include <osquery/core.h>
+#include <osquery/events.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/json.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/process.h"
+#include "osquery/dispatcher/scheduler.h"
+#include "osquery/sql/table_fixtures.h"
+#include "osquery/sql/virtual_table.h"
+
+namespace osquery {
+
+CLI_FLAG(uint64,
+         replay_minutes,
+         60,
+         "Virtual minutes of the config's schedule to replay");
+
+CLI_FLAG(uint64,
+         replay_event_rate,
+         0,
+         "Synthetic events per virtual second added to each event subscriber");
+
+CLI_FLAG(string,
+         replay_output,
+         "",
+         "Write the replay results to this path instead of stdout");
+
+CLI_FLAG(string, replay_format, "json", "Format of the results, json or csv");
+
+DECLARE_string(table_replay_path);
+
+/// A measurement of the replay, such as the CPU time of a subsystem.
+struct ReplayResult {
+  /// One of "replay", "subsystem", "query", or "table".
+  std::string scope;
+
+  /// The subsystem, query, or table name.
+  std::string name;
+
+  std::string metric;
+  uint64_t value{0};
+};
+
+/// Add synthetic rows to every running event subscriber.
+class ReplayEvents {
+ public:
+  /**
+   * @brief Add a number of events to each subscriber.
+   *
+   * Rows fill each column of the subscriber's table, numeric columns with a
+   * counter, such that stored events are not all alike.
+   *
+   * @return The number of events added.
+   */
+  size_t ingest(size_t rate) {
+    size_t added = 0;
+    for (const auto& name : EventFactory::subscriberNames()) {
+      auto subscriber = EventFactory::getEventSubscriber(name);
+      if (subscriber == nullptr ||
+          subscriber->state() != EventState::EVENT_RUNNING) {
+        continue;
+      }
+
+      auto table = std::dynamic_pointer_cast<TablePlugin>(
+          Registry::get().registry("table")->plugin(name));
+      if (table == nullptr) {
+        continue;
+      }
+
+      for (size_t i = 0; i < rate; i++) {
+        Row r;
+        auto value = std::to_string(counter_++);
+        for (const auto& column : table->columns()) {
+          auto type = std::get<1>(column);
+          if (type == TEXT_TYPE || type == BLOB_TYPE) {
+            r[std::get<0>(column)] = "replay-" + value;
+          } else {
+            r[std::get<0>(column)] = value;
+          }
+        }
+        subscriber->add(r, 0);
+        added++;
+      }
+    }
+    return added;
+  }
+
+ private:
+  size_t counter_{0};
+};
+
+/**
+ * @brief Execute the config's schedule against a virtual clock.
+ *
+ * The deadlines, splay, lateness accounting, and caching use the virtual
+ * time, queries execute serially on the calling thread without sleeping.
+ */
+class ReplayRunner : public SchedulerRunner {
+ public:
+  ReplayRunner() : SchedulerRunner(0, 1) {}
+
+  /// Rebuild the deadlines as the daemon would, then fire due queries.
+  void step(size_t now) {
+    if (generation_ != Config::get().getScheduleGeneration() ||
+        now >= rebuilt_ + 60 || timers_.empty()) {
+      rebuild(now);
+    }
+    fire(now);
+  }
+};
+
+/// The process CPU time in microseconds.
+static uint64_t getReplayProcessTime() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+
+  auto time = [](const struct timeval& tv) {
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+  };
+  return time(usage.ru_utime) + time(usage.ru_stime);
+}
+
+/// The calling thread's CPU time in microseconds.
+static uint64_t getReplayThreadTime() {
+  ThreadUsage usage;
+  getThreadUsage(usage);
+  return usage.user_time + usage.system_time;
+}
+
+static uint64_t getReplayResidentSize() {
+  ProcessUsage usage;
+  getProcessUsage(platformGetPid(), usage);
+  return usage.resident_size;
+}
+
+std::vector<ReplayResult> replaySchedule(size_t minutes, size_t rate) {
+  ReplayRunner runner;
+  ReplayEvents events;
+  clearTableExecutionStats();
+
+  auto process_start = getReplayProcessTime();
+  auto db_start = getMetricValue("osquery_database_written_bytes_total");
+  auto log_start = getMetricValue("osquery_logger_result_bytes_total");
+  uint64_t resident_max = getReplayResidentSize();
+
+  uint64_t schedule_time = 0;
+  uint64_t events_time = 0;
+  uint64_t events_added = 0;
+  auto start = getUnixTime();
+  for (size_t now = start; now < start + minutes * 60; now++) {
+    if (rate > 0) {
+      auto before = getReplayThreadTime();
+      events_added += events.ingest(rate);
+      events_time += getReplayThreadTime() - before;
+    }
+
+    auto before = getReplayThreadTime();
+    runner.step(now);
+    schedule_time += getReplayThreadTime() - before;
+
+    if ((now - start) % 60 == 0) {
+      resident_max = std::max(resident_max, getReplayResidentSize());
+      relayStatusLogs(true);
+    }
+  }
+  resident_max = std::max(resident_max, getReplayResidentSize());
+
+  // Publisher run loops, loggers, and other threads are the remainder.
+  auto process_time = getReplayProcessTime() - process_start;
+  auto other_time = process_time - std::min(process_time,
+                                            schedule_time + events_time);
+
+  std::vector<ReplayResult> results = {
+      {"replay", "", "virtual_minutes", minutes},
+      {"replay", "", "cpu_time_us", process_time},
+      {"replay", "", "resident_max_bytes", resident_max},
+      {"replay",
+       "",
+       "database_written_bytes",
+       getMetricValue("osquery_database_written_bytes_total") - db_start},
+      {"replay",
+       "",
+       "logger_written_bytes",
+       getMetricValue("osquery_logger_result_bytes_total") - log_start},
+      {"subsystem", "schedule", "cpu_time_us", schedule_time},
+      {"subsystem", "events", "cpu_time_us", events_time},
+      {"subsystem", "events", "added", events_added},
+      {"subsystem", "other", "cpu_time_us", other_time},
+  };
+
+  Config::get().scheduledQueries(
+      [&results](const std::string& name, const ScheduledQuery&) {
+        results.push_back({"query", name, "executions", 0});
+      });
+  auto queries = results.size();
+  for (size_t i = 0; i < queries; i++) {
+    if (results[i].scope != "query") {
+      continue;
+    }
+
+    auto name = results[i].name;
+    Config::get().getPerformanceStats(
+        name, [&results, &name, i](const QueryPerformance& perf) {
+          results[i].value = perf.executions;
+          results.push_back({"query", name, "wall_time", perf.wall_time});
+          auto cpu_time = perf.user_time + perf.system_time;
+          results.push_back({"query", name, "cpu_time", cpu_time});
+          results.push_back(
+              {"query", name, "average_memory", perf.average_memory});
+          results.push_back({"query", name, "output_size", perf.output_size});
+          results.push_back({"query", name, "missed", perf.missed});
+        });
+  }
+
+  for (const auto& table : getTableExecutionStats()) {
+    const auto& stats = table.second;
+    results.push_back(
+        {"table", table.first, "generate_calls", stats.generate_calls});
+    results.push_back(
+        {"table", table.first, "rows_generated", stats.rows_generated});
+    results.push_back({"table",
+                       table.first,
+                       "cpu_time_us",
+                       stats.user_time + stats.system_time});
+  }
+  return results;
+}
+
+std::string serializeReplayResults(const std::vector<ReplayResult>& results,
+                                   const std::string& format) {
+  if (format == "csv") {
+    std::string csv = "scope,name,metric,value\n";
+    for (const auto& result : results) {
+      csv += result.scope + ',' + result.name + ',' + result.metric + ',' +
+             std::to_string(result.value) + '\n';
+    }
+    return csv;
+  }
+
+  auto doc = JSON::newArray();
+  for (const auto& result : results) {
+    auto line = doc.getObject();
+    doc.addCopy("scope", result.scope, line);
+    doc.addCopy("name", result.name, line);
+    doc.addCopy("metric", result.metric, line);
+    doc.add("value", static_cast<size_t>(result.value), line);
+    doc.push(line);
+  }
+
+  std::string json;
+  doc.toString(json);
+  return json + '\n';
+}
+} // namespace osquery
+
+int main(int argc, char* argv[]) {
+  // The schedule is replayed within this process, it is never daemonized.
+  osquery::Initializer runner(argc, argv, osquery::ToolType::DAEMON);
+  runner.start();
+  if (!osquery::FLAGS_table_replay_path.empty()) {
+    auto status =
+        osquery::replayTableFixtures(osquery::FLAGS_table_replay_path);
+    if (!status.ok()) {
+      std::cerr << "Cannot replay tables: " << status.getMessage() << "\n";
+      runner.requestShutdown(EXIT_FAILURE);
+      return EXIT_FAILURE;
+    }
+  }
+
+  auto results =
+      osquery::replaySchedule(osquery::FLAGS_replay_minutes,
+                              osquery::FLAGS_replay_event_rate);
+  auto output = osquery::serializeReplayResults(results,
+                                                osquery::FLAGS_replay_format);
+
+  int retcode = EXIT_SUCCESS;
+  if (osquery::FLAGS_replay_output.empty()) {
+    std::cout << output;
+  } else if (!osquery::writeTextFile(osquery::FLAGS_replay_output, output)
+                  .ok()) {
+    std::cerr << "Cannot write " << osquery::FLAGS_replay_output << "\n";
+    retcode = EXIT_FAILURE;
+  }
+
+  runner.requestShutdown(retcode);
+  return retcode;
+}
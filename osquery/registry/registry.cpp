@@ -46,6 +46,7 @@ void RegistryInterface::remove(const std::string& item_name) {
   if (items_.count(item_name) > 0) {
     items_[item_name]->tearDown();
     items_.erase(item_name);
+    generation_++;
   }
 
   // Populate list of aliases to remove (those that mask item_name).
@@ -79,6 +80,7 @@ Status RegistryInterface::setActive(const std::string& item_name) {
 
   Status status;
   active_ = item_name;
+  generation_++;
   // The active plugin is setup when initialized.
   for (const auto& item : osquery::split(item_name, ",")) {
     if (exists(item, true)) {
@@ -173,6 +175,7 @@ Status RegistryInterface::addPlugin(const std::string& plugin_name,
 
   plugin_item->setName(plugin_name);
   items_.emplace(std::make_pair(plugin_name, plugin_item));
+  generation_++;
 
   // The item can be listed as internal, meaning it does not broadcast.
   if (internal) {
@@ -419,6 +422,15 @@ Status RegistryFactory::call(const std::string& registry_name,
       return Status(0);
     }
     return get().registry(registry_name)->call(item_name, request, response);
+  } catch (...) {
+    return pluginException(registry_name, item_name);
+  }
+}
+
+Status RegistryFactory::pluginException(const std::string& registry_name,
+                                        const std::string& item_name) {
+  try {
+    throw;
   } catch (const std::exception& e) {
     LOG(ERROR) << registry_name << " registry " << item_name
                << " plugin caused exception: " << e.what();
@@ -236,6 +236,32 @@ TEST_F(RegistryTests, test_registry_api) {
   EXPECT_EQ(response[0].at("secret_power"), "magic");
 }
 
+TEST_F(RegistryTests, test_plugin_handle) {
+  auto& rf = TestCoreRegistry::get();
+  rf.add("handles", std::make_shared<RegistryType<CatPlugin>>("handles"));
+  auto handles = rf.registry("handles");
+
+  PluginHandle<CatPlugin> named("handles", "tabby");
+  PluginHandle<CatPlugin> active("handles");
+  EXPECT_EQ(named.get(), nullptr);
+  EXPECT_EQ(active.get(), nullptr);
+
+  // Handles look up plugins again after the registry changes.
+  handles->add("tabby", std::make_shared<HouseCat>());
+  handles->add("calico", std::make_shared<HouseCat>());
+  EXPECT_EQ(named.get(), rf.plugin("handles", "tabby"));
+  EXPECT_TRUE(rf.setActive("handles", "calico").ok());
+  EXPECT_EQ(active.get(), rf.plugin("handles", "calico"));
+
+  // A handle only returns plugins of its plugin type.
+  PluginHandle<DogPlugin> dog("handles", "tabby");
+  EXPECT_EQ(dog.get(), nullptr);
+
+  handles->remove("tabby");
+  EXPECT_EQ(named.get(), nullptr);
+  EXPECT_NE(active.get(), nullptr);
+}
+
 TEST_F(RegistryTests, test_real_registry) {
   EXPECT_TRUE(Registry::get().count() > 0U);
 
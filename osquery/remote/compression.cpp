@@ -0,0 +1,255 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <cstring>
+#include <vector>
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include "osquery/remote/compression.h"
+
+namespace osquery {
+
+#define MOD_GZIP_ZLIB_WINDOWSIZE 15
+#define MOD_GZIP_ZLIB_CFACTOR 9
+
+/// The size of compressed output blocks.
+const size_t kCompressionBlockSize = 16384;
+
+bool CompressionStream::write(const char* data, size_t size) {
+  if (!ok_) {
+    return false;
+  }
+  ok_ = (size == 0 || update(data, size, false));
+  return ok_;
+}
+
+bool CompressionStream::finish() {
+  if (!ok_) {
+    return false;
+  }
+  ok_ = update(nullptr, 0, true);
+  return ok_;
+}
+
+bool CompressionStream::emit(const char* data, size_t size) {
+  if (size == 0) {
+    return true;
+  } else if (sink_ != nullptr) {
+    return sink_(data, size);
+  }
+  output_.append(data, size);
+  return true;
+}
+
+struct GzipStream::State {
+  z_stream stream;
+};
+
+GzipStream::GzipStream() : state_(new State) {
+  memset(&state_->stream, 0, sizeof(z_stream));
+  ok_ = (deflateInit2(&state_->stream,
+                      Z_BEST_COMPRESSION,
+                      Z_DEFLATED,
+                      MOD_GZIP_ZLIB_WINDOWSIZE + 16,
+                      MOD_GZIP_ZLIB_CFACTOR,
+                      Z_DEFAULT_STRATEGY) == Z_OK);
+}
+
+GzipStream::~GzipStream() {
+  deflateEnd(&state_->stream);
+}
+
+bool GzipStream::update(const char* data, size_t size, bool finish) {
+  auto& zs = state_->stream;
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  zs.avail_in = static_cast<uInt>(size);
+
+  int flush = (finish) ? Z_FINISH : Z_NO_FLUSH;
+  char buffer[kCompressionBlockSize];
+  int ret = Z_OK;
+  do {
+    zs.next_out = reinterpret_cast<Bytef*>(buffer);
+    zs.avail_out = sizeof(buffer);
+    ret = ::deflate(&zs, flush);
+    if (!emit(buffer, sizeof(buffer) - zs.avail_out)) {
+      return false;
+    }
+  } while (ret == Z_OK && zs.avail_out == 0);
+
+  // The input is consumed, or the stream ended, unless compression failed.
+  return (ret == Z_OK || ret == Z_BUF_ERROR || (finish && ret == Z_STREAM_END));
+}
+
+struct ZstdStream::State {
+  ZSTD_CStream* stream{nullptr};
+
+  std::vector<char> buffer;
+};
+
+ZstdStream::ZstdStream() : state_(new State) {
+  state_->stream = ZSTD_createCStream();
+  if (state_->stream != nullptr) {
+    ok_ = !ZSTD_isError(ZSTD_initCStream(state_->stream, 1));
+  }
+  state_->buffer.resize(ZSTD_CStreamOutSize());
+}
+
+ZstdStream::~ZstdStream() {
+  if (state_->stream != nullptr) {
+    ZSTD_freeCStream(state_->stream);
+  }
+}
+
+bool ZstdStream::update(const char* data, size_t size, bool finish) {
+  auto& buffer = state_->buffer;
+  ZSTD_inBuffer input = {data, size, 0};
+  while (input.pos < input.size) {
+    ZSTD_outBuffer output = {buffer.data(), buffer.size(), 0};
+    auto ret = ZSTD_compressStream(state_->stream, &output, &input);
+    if (ZSTD_isError(ret) || !emit(buffer.data(), output.pos)) {
+      return false;
+    }
+  }
+
+  if (!finish) {
+    return true;
+  }
+
+  // Flush the remaining output, endStream returns the amount left to flush.
+  size_t remaining = 0;
+  do {
+    ZSTD_outBuffer output = {buffer.data(), buffer.size(), 0};
+    remaining = ZSTD_endStream(state_->stream, &output);
+    if (ZSTD_isError(remaining) || !emit(buffer.data(), output.pos)) {
+      return false;
+    }
+  } while (remaining > 0);
+  return true;
+}
+
+std::unique_ptr<CompressionStream> makeCompressionStream(
+    const std::string& encoding) {
+  if (encoding == "gzip") {
+    return std::unique_ptr<CompressionStream>(new GzipStream());
+  } else if (encoding == "zstd") {
+    return std::unique_ptr<CompressionStream>(new ZstdStream());
+  }
+  return nullptr;
+}
+
+RequestBody::RequestBody(const std::string& encoding) {
+  if (encoding.empty()) {
+    return;
+  }
+
+  stream_ = makeCompressionStream(encoding);
+  if (stream_ == nullptr) {
+    stream_ = std::unique_ptr<CompressionStream>(new GzipStream());
+  }
+}
+
+bool RequestBody::append(const char* data, size_t size) {
+  if (stream_ == nullptr) {
+    body_.append(data, size);
+  } else if (ok_) {
+    ok_ = stream_->write(data, size);
+  }
+  return ok_;
+}
+
+Status RequestBody::finish(std::string& body, std::string& encoding) {
+  if (stream_ == nullptr) {
+    body = std::move(body_);
+    encoding.clear();
+    return Status(0, "OK");
+  }
+
+  if (!ok_ || !stream_->finish()) {
+    return Status(1, "Cannot compress request body");
+  }
+  body = std::move(stream_->output());
+  encoding = stream_->encoding();
+  return Status(0, "OK");
+}
+
+/// Inflate a GZip body, false if it is corrupt or larger than max.
+static bool inflateGzip(const std::string& body,
+                        std::string& output,
+                        size_t max) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(z_stream));
+  if (inflateInit2(&stream, MOD_GZIP_ZLIB_WINDOWSIZE + 16) != Z_OK) {
+    return false;
+  }
+
+  std::vector<char> buffer(kCompressionBlockSize);
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(body.data()));
+  stream.avail_in = static_cast<uInt>(body.size());
+  int ret = Z_OK;
+  while (ret == Z_OK && output.size() <= max) {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+    stream.avail_out = static_cast<uInt>(buffer.size());
+    ret = inflate(&stream, Z_NO_FLUSH);
+    if (ret == Z_OK || ret == Z_STREAM_END) {
+      output.append(buffer.data(), buffer.size() - stream.avail_out);
+    }
+  }
+  inflateEnd(&stream);
+  return ret == Z_STREAM_END && output.size() <= max;
+}
+
+/// Decompress a zstd body, false if it is corrupt or larger than max.
+static bool decompressZstd(const std::string& body,
+                           std::string& output,
+                           size_t max) {
+  auto stream = ZSTD_createDStream();
+  if (stream == nullptr || ZSTD_isError(ZSTD_initDStream(stream))) {
+    ZSTD_freeDStream(stream);
+    return false;
+  }
+
+  std::vector<char> buffer(ZSTD_DStreamOutSize());
+  ZSTD_inBuffer input = {body.data(), body.size(), 0};
+  size_t ret = 1;
+  while (ret != 0 && output.size() <= max) {
+    ZSTD_outBuffer out = {buffer.data(), buffer.size(), 0};
+    ret = ZSTD_decompressStream(stream, &out, &input);
+    if (ZSTD_isError(ret) || (out.pos == 0 && input.pos == input.size)) {
+      break;
+    }
+    output.append(buffer.data(), out.pos);
+  }
+  ZSTD_freeDStream(stream);
+  return ret == 0 && output.size() <= max;
+}
+
+Status decompressBody(const std::string& encoding,
+                      const std::string& body,
+                      std::string& output,
+                      size_t max) {
+  output.clear();
+  bool ok = false;
+  if (encoding == "gzip") {
+    ok = inflateGzip(body, output, max);
+  } else if (encoding == "zstd") {
+    ok = decompressZstd(body, output, max);
+  } else {
+    return Status(1, "Unsupported Content-Encoding: " + encoding);
+  }
+
+  if (!ok) {
+    output.clear();
+    return Status(1, "Cannot decompress " + encoding + " body");
+  }
+  return Status(0, "OK");
+}
+} // namespace osquery
@@ -0,0 +1,187 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief Compress data as it is appended.
+ *
+ * Compressed output is produced in bounded blocks. Each block is handed to
+ * the sink, if one is set, otherwise it is appended to the output.
+ */
+class CompressionStream : private boost::noncopyable {
+ public:
+  /// Receives blocks of compressed output, return false to stop compressing.
+  using Sink = std::function<bool(const char* data, size_t size)>;
+
+ public:
+  virtual ~CompressionStream() = default;
+
+  /// Hand compressed blocks to a sink rather than the output.
+  void setSink(Sink sink) {
+    sink_ = std::move(sink);
+  }
+
+  /// Compress data, false if compression failed.
+  bool write(const char* data, size_t size);
+
+  /// Compress data, false if compression failed.
+  bool write(const std::string& data) {
+    return write(data.data(), data.size());
+  }
+
+  /// Compress the remaining input and end the stream.
+  bool finish();
+
+  /// The HTTP Content-Encoding of the compressed output.
+  virtual std::string encoding() const = 0;
+
+  /// The compressed output, complete after finish, if there is no sink.
+  std::string& output() {
+    return output_;
+  }
+
+ protected:
+  /// Compress input, emitting output, the input is empty when finishing.
+  virtual bool update(const char* data, size_t size, bool finish) = 0;
+
+  /// Hand a block of compressed output to the sink or output.
+  bool emit(const char* data, size_t size);
+
+ protected:
+  /// False if the stream could not be initialized or compression failed.
+  bool ok_{false};
+
+ private:
+  Sink sink_;
+
+  std::string output_;
+};
+
+/**
+ * @brief Compress data using GZip.
+ *
+ * The output is the same GZip stream as compressString.
+ */
+class GzipStream : public CompressionStream {
+ public:
+  GzipStream();
+  ~GzipStream() override;
+
+  std::string encoding() const override {
+    return "gzip";
+  }
+
+ protected:
+  bool update(const char* data, size_t size, bool finish) override;
+
+ private:
+  struct State;
+
+  std::unique_ptr<State> state_;
+};
+
+/**
+ * @brief Compress data using Zstandard.
+ *
+ * The output is a single zstd frame, using the fastest compression level.
+ */
+class ZstdStream : public CompressionStream {
+ public:
+  ZstdStream();
+  ~ZstdStream() override;
+
+  std::string encoding() const override {
+    return "zstd";
+  }
+
+ protected:
+  bool update(const char* data, size_t size, bool finish) override;
+
+ private:
+  struct State;
+
+  std::unique_ptr<State> state_;
+};
+
+/**
+ * @brief Create a compression stream for an HTTP Content-Encoding.
+ *
+ * @param encoding Either "gzip" or "zstd".
+ * @return nullptr if the encoding is not supported.
+ */
+std::unique_ptr<CompressionStream> makeCompressionStream(
+    const std::string& encoding);
+
+/**
+ * @brief A remote request body, optionally compressed as it is appended.
+ *
+ * Only the compressed body is held in memory when compressing.
+ */
+class RequestBody : private boost::noncopyable {
+ public:
+  /**
+   * @brief Create a request body.
+   *
+   * @param encoding The Content-Encoding, empty to not compress. GZip is used
+   * if the encoding is not supported.
+   */
+  explicit RequestBody(const std::string& encoding);
+
+  /// Append data to the body, false if compression failed.
+  bool append(const char* data, size_t size);
+
+  /// Append data to the body, false if compression failed.
+  bool append(const std::string& data) {
+    return append(data.data(), data.size());
+  }
+
+  /**
+   * @brief Complete the body.
+   *
+   * @param body Output, the optionally compressed body.
+   * @param encoding Output, the Content-Encoding, empty if not compressed.
+   * @return failure if the body could not be compressed.
+   */
+  Status finish(std::string& body, std::string& encoding);
+
+ private:
+  std::unique_ptr<CompressionStream> stream_;
+
+  std::string body_;
+
+  bool ok_{true};
+};
+
+/**
+ * @brief Decompress a request or response body.
+ *
+ * @param encoding The Content-Encoding, either "gzip" or "zstd".
+ * @param body The compressed body.
+ * @param output Output, the decompressed body.
+ * @param max The largest decompressed size accepted.
+ * @return failure if the encoding is not supported, the body is corrupt, or
+ * it decompresses to more than max bytes.
+ */
+Status decompressBody(const std::string& encoding,
+                      const std::string& body,
+                      std::string& output,
+                      size_t max);
+} // namespace osquery
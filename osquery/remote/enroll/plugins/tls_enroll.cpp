@@ -61,15 +61,24 @@ std::string TLSEnrollPlugin::enroll() {
 
   std::string node_key;
   VLOG(1) << "TLSEnrollPlugin requesting a node enroll key from: " << uri;
+  size_t delay = 0;
   for (size_t i = 1; i <= FLAGS_config_tls_max_attempts; i++) {
     auto status = requestKey(uri, node_key);
     if (status.ok() || i == FLAGS_config_tls_max_attempts) {
       break;
     }
 
+    // Hosts failing to enroll together spread their retries.
+    delay = getTLSBackoffDelay(delay);
+    if (delay == 0) {
+      LOG(WARNING) << "Failed enrollment request to " << uri << " ("
+                   << status.what() << ") server is busy";
+      break;
+    }
+
     LOG(WARNING) << "Failed enrollment request to " << uri << " ("
                  << status.what() << ") retrying...";
-    sleepFor(i * i * 1000);
+    sleepFor(delay);
   }
 
   return node_key;
@@ -57,9 +57,7 @@ void Client::closeSocket() {
   if (sock_.is_open()) {
     boost_system::error_code rc;
     sock_.shutdown(boost_asio::ip::tcp::socket::shutdown_both, rc);
-    if (rc) {
-      return;
-    }
+    // The socket is closed even if the connection was already shut down.
     sock_.close(rc);
   }
 }
@@ -129,7 +127,41 @@ void Client::createConnection() {
 }
 
 void Client::encryptConnection() {
-  boost_asio::ssl::context ctx{boost_asio::ssl::context::sslv23};
+  if (ssl_ctx_ == nullptr) {
+    ssl_ctx_ = createSSLContext();
+  }
+
+  ssl_sock_ = std::make_shared<ssl_stream>(sock_, *ssl_ctx_);
+  if (client_options_.sni_hostname_) {
+    ::SSL_set_tlsext_host_name(ssl_sock_->native_handle(),
+                               client_options_.sni_hostname_->c_str());
+  }
+
+  // Resume the previous session with the server, avoiding a full handshake.
+  if (ssl_session_ != nullptr) {
+    ::SSL_set_session(ssl_sock_->native_handle(), ssl_session_);
+  }
+
+  boost_system::error_code rc;
+  ssl_sock_->handshake(boost_asio::ssl::stream_base::client, rc);
+
+  if (rc) {
+    throw std::system_error(rc.value(), adapted_category(&rc.category()));
+  }
+
+  auto session = ::SSL_get1_session(ssl_sock_->native_handle());
+  if (session != nullptr) {
+    if (ssl_session_ != nullptr) {
+      ::SSL_SESSION_free(ssl_session_);
+    }
+    ssl_session_ = session;
+  }
+}
+
+std::shared_ptr<boost_asio::ssl::context> Client::createSSLContext() {
+  auto ctx_ptr = std::make_shared<boost_asio::ssl::context>(
+      boost_asio::ssl::context::sslv23);
+  auto& ctx = *ctx_ptr;
 
   if (client_options_.always_verify_peer_) {
     ctx.set_verify_mode(boost_asio::ssl::verify_peer);
@@ -166,24 +198,62 @@ void Client::encryptConnection() {
                              boost_asio::ssl::context::pem);
   }
 
-  ssl_sock_ = std::make_shared<ssl_stream>(sock_, ctx);
-  if (client_options_.sni_hostname_) {
-    ::SSL_set_tlsext_host_name(ssl_sock_->native_handle(),
-                               client_options_.sni_hostname_->c_str());
+  return ctx_ptr;
+}
+
+bool Client::isConnectionUsable() {
+  if (!sock_.is_open() || (ssl_connection && ssl_sock_ == nullptr)) {
+    return false;
   }
 
+  // An idle connection has nothing to read, unless the server closed it.
   boost_system::error_code rc;
-  ssl_sock_->handshake(boost_asio::ssl::stream_base::client, rc);
-
+  sock_.non_blocking(true, rc);
   if (rc) {
-    throw std::system_error(rc.value(), adapted_category(&rc.category()));
+    return false;
+  }
+
+  char c;
+  sock_.receive(boost_asio::buffer(&c, 1),
+                boost_asio::ip::tcp::socket::message_peek,
+                rc);
+  boost_system::error_code ignored;
+  sock_.non_blocking(false, ignored);
+  return rc == boost_asio::error::would_block;
+}
+
+bool Client::openConnection() {
+  if (!client_options_.remote_hostname_ || !client_options_.remote_port_) {
+    throw std::runtime_error("Remote hostname missing");
   }
+
+  auto connection = std::string((ssl_connection) ? "https://" : "http://") +
+                    *client_options_.remote_hostname_ + ":" +
+                    *client_options_.remote_port_;
+  if (client_options_.keep_alive_ && connection == connection_ &&
+      isConnectionUsable()) {
+    return true;
+  }
+
+  // A TLS session is only resumed with the same server.
+  if (connection != connection_ && ssl_session_ != nullptr) {
+    ::SSL_SESSION_free(ssl_session_);
+    ssl_session_ = nullptr;
+  }
+  connection_ = connection;
+
+  createConnection();
+  if (ssl_connection) {
+    encryptConnection();
+  }
+  return false;
 }
 
 template <typename STREAM_TYPE>
 void Client::sendRequest(STREAM_TYPE& stream,
                          Request& req,
                          beast_http_response_parser& resp) {
+  ec_.clear();
   req.target((req.remotePath()) ? *req.remotePath() : "/");
   req.version(11);
 
@@ -280,20 +350,31 @@ Response Client::sendHTTPRequest(Request& req) {
       }
     }
 
-    beast_http_response_parser resp;
-    createConnection();
-
-    if (ssl_connection) {
-      encryptConnection();
+    std::unique_ptr<beast_http_response_parser> resp;
+    while (true) {
+      auto reused = openConnection();
+      resp.reset(new beast_http_response_parser());
+      try {
+        if (ssl_connection) {
+          sendRequest(*ssl_sock_, req, *resp);
+        } else {
+          sendRequest(sock_, req, *resp);
+        }
+        break;
+      } catch (const std::exception&) {
+        closeSocket();
+        // The server may close a kept-alive connection before it is reused.
+        if (!reused || ec_ == boost_system::errc::timed_out) {
+          throw;
+        }
+      }
     }
 
-    if (ssl_connection) {
-      sendRequest(*ssl_sock_, req, resp);
-    } else {
-      sendRequest(sock_, req, resp);
+    if (!client_options_.keep_alive_ || !resp->get().keep_alive()) {
+      closeSocket();
     }
 
-    switch (resp.get().result()) {
+    switch (resp->get().result()) {
     case beast_http::status::moved_permanently:
     case beast_http::status::found:
     case beast_http::status::see_other:
@@ -302,10 +383,10 @@ Response Client::sendHTTPRequest(Request& req) {
     case beast_http::status::temporary_redirect:
     case beast_http::status::permanent_redirect: {
       if (!client_options_.follow_redirects_) {
-        return Response(resp.release());
+        return Response(resp->release());
       }
 
-      std::string redir_url = Response(resp.release()).headers()["Location"];
+      std::string redir_url = Response(resp->release()).headers()["Location"];
       if (redir_url.empty()) {
         throw std::runtime_error(
             "Location header missing in redirect response.");
@@ -316,7 +397,7 @@ Response Client::sendHTTPRequest(Request& req) {
       break;
     }
     default:
-      return Response(resp.release());
+      return Response(resp->release());
     }
   } while (true);
 }
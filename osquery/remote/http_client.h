@@ -102,7 +102,39 @@ class Client {
         : ssl_options_(0),
           timeout_(0),
           always_verify_peer_(false),
-          follow_redirects_(false) {}
+          follow_redirects_(false),
+          keep_alive_(false) {}
+
+    /**
+     * @brief Compare the connection options.
+     *
+     * The remote hostname and port are not compared, they are set from each
+     * request's URI.
+     */
+    bool operator==(const Options& other) const {
+      return server_certificate_ == other.server_certificate_ &&
+             verify_path_ == other.verify_path_ &&
+             client_certificate_file_ == other.client_certificate_file_ &&
+             client_private_key_file_ == other.client_private_key_file_ &&
+             ciphers_ == other.ciphers_ &&
+             sni_hostname_ == other.sni_hostname_ &&
+             proxy_hostname_ == other.proxy_hostname_ &&
+             ssl_options_ == other.ssl_options_ &&
+             timeout_ == other.timeout_ &&
+             always_verify_peer_ == other.always_verify_peer_ &&
+             follow_redirects_ == other.follow_redirects_ &&
+             keep_alive_ == other.keep_alive_;
+    }
+
+    bool operator!=(const Options& other) const {
+      return !(*this == other);
+    }
+
+    /// Keep the connection open between requests, if the server allows.
+    Options& keep_alive(bool ka) {
+      keep_alive_ = ka;
+      return *this;
+    }
 
     Options& follow_redirects(bool fr) {
       follow_redirects_ = fr;
@@ -183,6 +215,7 @@ class Client {
     int timeout_;
     bool always_verify_peer_;
     bool follow_redirects_;
+    bool keep_alive_;
     friend class Client;
   };
 
@@ -219,8 +252,16 @@ class Client {
   /// HTTP delete_ request method.
   Response delete_(Request& req);
 
+  /// The options used to create the client.
+  const Options& options() const {
+    return client_options_;
+  }
+
   ~Client() {
     closeSocket();
+    if (ssl_session_ != nullptr) {
+      ::SSL_SESSION_free(ssl_session_);
+    }
   }
 
  private:
@@ -230,6 +271,19 @@ class Client {
   /// Convert plain socket to TLS socket.
   void encryptConnection();
 
+  /// Create the TLS context, which is kept for every connection.
+  std::shared_ptr<boost_asio::ssl::context> createSSLContext();
+
+  /**
+   * @brief Open a connection for a request, reusing a kept-alive connection.
+   *
+   * @return true if an open connection to the same server is reused.
+   */
+  bool openConnection();
+
+  /// Check that a kept-alive connection was not closed by the server.
+  bool isConnectionUsable();
+
   template <typename STREAM_TYPE>
   void sendRequest(STREAM_TYPE& stream,
                    Request& req,
@@ -257,9 +311,16 @@ class Client {
   boost_asio::ip::tcp::resolver r_;
   boost_asio::ip::tcp::socket sock_;
   boost_asio::deadline_timer timer_;
+  std::shared_ptr<boost_asio::ssl::context> ssl_ctx_;
   std::shared_ptr<ssl_stream> ssl_sock_;
   boost_system::error_code ec_;
 
+  /// The protocol, host, and port of the open connection.
+  std::string connection_;
+
+  /// The last TLS session, used to resume the session when reconnecting.
+  SSL_SESSION* ssl_session_{nullptr};
+
   /**
    * @brief This general-purpose HTTP Client allows HTTP and HTTPS.
    *
@@ -0,0 +1,526 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+// clang-format off
+// This must be here to prevent a WinSock.h exists error
+#include "osquery/remote/transports/tls.h"
+// clang-format on
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <osquery/enroll.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/core/json.h"
+#include "osquery/logger/plugins/tls_logger.h"
+#include "osquery/remote/compression.h"
+#include "osquery/remote/relay.h"
+#include "osquery/remote/serializers/json.h"
+
+namespace pt = boost::property_tree;
+namespace rj = rapidjson;
+
+namespace osquery {
+
+FLAG(uint32,
+     relay_port,
+     0,
+     "Port of a TLS endpoint relaying other hosts' requests (0 disabled)");
+
+FLAG(string,
+     relay_address,
+     "0.0.0.0",
+     "Address the TLS relay listens on, see relay_port");
+
+FLAG(string,
+     relay_server_cert,
+     "",
+     "Path to the TLS relay's PEM certificate chain");
+
+FLAG(string,
+     relay_server_key,
+     "",
+     "Path to the TLS relay's PEM private key");
+
+FLAG(bool,
+     relay_shared_config,
+     false,
+     "Answer relayed config requests with the relay's own config");
+
+FLAG(uint64,
+     relay_config_ttl,
+     60,
+     "Seconds the relay's shared config is reused");
+
+FLAG(uint64,
+     relay_max_connections,
+     256,
+     "Max connections served by the TLS relay at once");
+
+DECLARE_string(config_tls_endpoint);
+DECLARE_string(enroll_tls_endpoint);
+DECLARE_string(logger_tls_endpoint);
+
+/// The seconds a relayed connection may be idle or take to send a request.
+const size_t kRelayTimeout = 30;
+
+/// The largest request body relayed, after decompression.
+const size_t kRelayMaxBody = 16 * 1024 * 1024;
+
+/// The most node keys recorded as accepted by the server.
+const size_t kRelayMaxNodes = 100000;
+
+/// The seconds a relayed request waits for the server, beyond a long-poll.
+const size_t kRelayRequestTimeout = 16;
+
+/// Completes an asynchronous operation of a RelaySession.
+using RelayHandler = std::function<void(const boost_system::error_code&)>;
+
+/// A connection of the relay, served on its own thread.
+struct RelaySession {
+  explicit RelaySession(boost_asio::ssl::context& context)
+      : socket(ios), stream(socket, context), timer(ios) {}
+
+  /**
+   * @brief Run an asynchronous operation of the session.
+   *
+   * The connection is closed if the operation does not complete in time.
+   *
+   * @return false if the operation failed or timed out, or the relay stopped.
+   */
+  bool run(const std::function<void(RelayHandler)>& operation) {
+    auto error = boost_system::error_code(boost_asio::error::operation_aborted);
+    timer.expires_from_now(boost::posix_time::seconds(kRelayTimeout));
+    timer.async_wait([this](const boost_system::error_code& ec) {
+      if (!ec) {
+        boost_system::error_code ignored;
+        socket.close(ignored);
+      }
+    });
+    operation([this, &error](const boost_system::error_code& ec) {
+      timer.cancel();
+      error = ec;
+    });
+    ios.run();
+    ios.reset();
+    return !error;
+  }
+
+  boost_asio::io_service ios;
+  boost_asio::ip::tcp::socket socket;
+  boost_asio::ssl::stream<boost_asio::ip::tcp::socket&> stream;
+  boost_asio::deadline_timer timer;
+
+  std::thread thread;
+
+  /// Set when the session's thread may be joined.
+  std::atomic<bool> done{false};
+};
+
+/// True if a response asks the host to enroll again.
+static bool isNodeInvalid(const rj::Document& doc) {
+  if (!doc.IsObject() || !doc.HasMember("node_invalid")) {
+    return false;
+  }
+
+  const auto& invalid = doc["node_invalid"];
+  if (invalid.IsBool()) {
+    return invalid.GetBool();
+  } else if (invalid.IsString()) {
+    std::string value = invalid.GetString();
+    return value == "1" || value == "true" || value == "True";
+  }
+  return false;
+}
+
+/// Get a string member of a request or response, empty if it is missing.
+static std::string getMember(const rj::Document& doc, const char* name) {
+  if (doc.IsObject() && doc.HasMember(name) && doc[name].IsString()) {
+    return doc[name].GetString();
+  }
+  return "";
+}
+
+/// Buffer the lines of a host's log upload.
+static Status bufferLogs(TLSLogForwarder& logs, const rj::Document& doc) {
+  if (!doc.HasMember("data") || !doc["data"].IsArray()) {
+    return Status(1, "Relayed log upload has no data");
+  }
+
+  // The lines are stored as they were sent, with their host identifier.
+  std::vector<std::string> lines;
+  rj::StringBuffer sb;
+  for (const auto& line : doc["data"].GetArray()) {
+    if (line.IsObject()) {
+      sb.Clear();
+      rj::Writer<rj::StringBuffer> w(sb);
+      line.Accept(w);
+      lines.emplace_back(sb.GetString(), sb.GetSize());
+    }
+  }
+
+  auto log_type = getMember(doc, "log_type");
+  if (log_type == "result") {
+    return logs.logPriorityStrings(lines, 0);
+  } else if (log_type == "status") {
+    return logs.logStatusStrings(lines);
+  }
+  return Status(1, "Relayed log upload has an unknown type: " + log_type);
+}
+
+/// The response asking a host to retry, when the server is busy or failed.
+static RelayResponse retryLater(size_t delay) {
+  RelayResponse response;
+  response.code = 503;
+  response.retry_after = delay;
+  return response;
+}
+
+TLSRelay::TLSRelay(std::shared_ptr<TLSLogForwarder> logs)
+    : InternalRunnable("TLSRelay"), logs_(std::move(logs)) {}
+
+RelayResponse TLSRelay::handle(const std::string& target,
+                               const std::string& body) {
+  // Hosts wait as long as the server asked the relay to.
+  auto delay = getTLSRetryDelay();
+  if (delay > 0) {
+    return retryLater(delay);
+  }
+
+  rj::Document doc;
+  doc.Parse(body.c_str(), body.size());
+  auto node_key = getMember(doc, "node_key");
+  auto path = target.substr(0, target.find('?'));
+  if (!doc.HasParseError() && isKnownNode(node_key)) {
+    if (logs_ != nullptr && path == FLAGS_logger_tls_endpoint) {
+      auto status = bufferLogs(*logs_, doc);
+      if (!status.ok()) {
+        VLOG(1) << "Cannot buffer relayed logs: " << status.getMessage();
+        return retryLater(0);
+      }
+
+      RelayResponse response;
+      response.body = "{\"node_invalid\":false}";
+      return response;
+    } else if (FLAGS_relay_shared_config && path == FLAGS_config_tls_endpoint) {
+      RelayResponse response;
+      if (sharedConfig(response.body).ok()) {
+        return response;
+      }
+    }
+  }
+
+  // Long-polls are held by the server for up to their wait.
+  size_t timeout = kRelayRequestTimeout;
+  unsigned long long wait = 0;
+  if (doc.IsObject() && doc.HasMember("wait") && doc["wait"].IsUint()) {
+    timeout += doc["wait"].GetUint();
+  } else if (safeStrtoull(getMember(doc, "wait"), 10, wait).ok()) {
+    timeout += static_cast<size_t>(wait);
+  }
+  return relay(target, body, node_key, timeout);
+}
+
+void TLSRelay::start() {
+  using boost_asio::ssl::context;
+  context ssl_context(context::sslv23_server);
+  boost_system::error_code ec;
+  ssl_context.set_options(context::default_workarounds | context::no_sslv2 |
+                              context::no_sslv3 | context::no_tlsv1 |
+                              context::no_tlsv1_1,
+                          ec);
+  ::SSL_CTX_set_cipher_list(ssl_context.native_handle(), kTLSCiphers.c_str());
+  ssl_context.use_certificate_chain_file(FLAGS_relay_server_cert, ec);
+  if (!ec) {
+    ssl_context.use_private_key_file(
+        FLAGS_relay_server_key, context::pem, ec);
+  }
+  if (ec) {
+    LOG(ERROR) << "Cannot load the TLS relay certificate: " << ec.message();
+    return;
+  }
+
+  {
+    WriteLock lock(sessions_mutex_);
+    if (stopped_) {
+      return;
+    }
+    listener_ = std::make_shared<RelaySession>(ssl_context);
+  }
+
+  using boost_asio::ip::tcp;
+  auto& ios = listener_->ios;
+  tcp::acceptor acceptor(ios);
+  tcp::endpoint endpoint(boost_asio::ip::address::from_string(
+                             FLAGS_relay_address, ec),
+                         static_cast<unsigned short>(FLAGS_relay_port));
+  if (!ec) {
+    acceptor.open(endpoint.protocol(), ec);
+  }
+  if (!ec) {
+    acceptor.set_option(tcp::acceptor::reuse_address(true), ec);
+    acceptor.bind(endpoint, ec);
+  }
+  if (!ec) {
+    acceptor.listen(boost_asio::socket_base::max_connections, ec);
+  }
+  if (ec) {
+    LOG(ERROR) << "Cannot listen for TLS relay connections on "
+               << FLAGS_relay_address << ":" << FLAGS_relay_port << ": "
+               << ec.message();
+    return;
+  }
+
+  while (!interrupted()) {
+    // Join the sessions whose connections were closed.
+    {
+      WriteLock lock(sessions_mutex_);
+      for (auto it = sessions_.begin(); it != sessions_.end();) {
+        if ((*it)->done) {
+          (*it)->thread.join();
+          it = sessions_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+
+    auto session = std::make_shared<RelaySession>(ssl_context);
+    auto error = boost_system::error_code(boost_asio::error::operation_aborted);
+    acceptor.async_accept(
+        session->socket,
+        [&error](const boost_system::error_code& accepted) {
+          error = accepted;
+        });
+    ios.run();
+    ios.reset();
+    if (interrupted()) {
+      acceptor.close(ec);
+      break;
+    } else if (error) {
+      // Such as running out of descriptors, wait for connections to close.
+      pauseMilli(100);
+      continue;
+    }
+
+    WriteLock lock(sessions_mutex_);
+    if (!stopped_ && sessions_.size() < FLAGS_relay_max_connections) {
+      sessions_.push_back(session);
+      session->thread = std::thread([this, session]() {
+        serve(*session);
+        session->done = true;
+      });
+    }
+  }
+
+  // Every session was stopped with the relay.
+  std::list<std::shared_ptr<RelaySession>> sessions;
+  {
+    WriteLock lock(sessions_mutex_);
+    sessions.swap(sessions_);
+  }
+  for (auto& session : sessions) {
+    session->thread.join();
+  }
+}
+
+void TLSRelay::stop() {
+  WriteLock lock(sessions_mutex_);
+  stopped_ = true;
+  if (listener_ != nullptr) {
+    listener_->ios.stop();
+  }
+  for (auto& session : sessions_) {
+    session->ios.stop();
+  }
+}
+
+void TLSRelay::serve(RelaySession& session) {
+  auto& stream = session.stream;
+  if (!session.run([&stream](RelayHandler handler) {
+        stream.async_handshake(boost_asio::ssl::stream_base::server, handler);
+      })) {
+    return;
+  }
+
+  boost::beast::flat_buffer buffer;
+  while (!interrupted()) {
+    beast_http::request_parser<beast_http::string_body> parser;
+    parser.body_limit(kRelayMaxBody);
+    if (!session.run([&stream, &buffer, &parser](RelayHandler handler) {
+          beast_http::async_read(
+              stream,
+              buffer,
+              parser,
+              [handler](const boost_system::error_code& ec, size_t) {
+                handler(ec);
+              });
+        })) {
+      break;
+    }
+
+    // Compressed bodies are relayed decompressed.
+    auto request = parser.release();
+    auto encoding =
+        std::string(request[beast_http::field::content_encoding]);
+    std::string body;
+    RelayResponse response;
+    if (encoding.empty()) {
+      body = std::move(request.body());
+    } else if (!decompressBody(encoding, request.body(), body, kRelayMaxBody)
+                    .ok()) {
+      response = retryLater(0);
+    }
+
+    if (response.code == 200) {
+      response = handle(std::string(request.target()), body);
+    }
+
+    beast_http::response<beast_http::string_body> reply(
+        static_cast<beast_http::status>(response.code), request.version());
+    reply.set(beast_http::field::content_type, "application/json");
+    if (response.retry_after > 0) {
+      reply.set(beast_http::field::retry_after,
+                std::to_string(response.retry_after));
+    }
+    reply.keep_alive(request.keep_alive());
+    reply.body() = std::move(response.body);
+    reply.prepare_payload();
+    if (!session.run([&stream, &reply](RelayHandler handler) {
+          beast_http::async_write(
+              stream,
+              reply,
+              [handler](const boost_system::error_code& ec, size_t) {
+                handler(ec);
+              });
+        }) ||
+        !reply.keep_alive()) {
+      break;
+    }
+  }
+
+  session.run([&stream](RelayHandler handler) {
+    stream.async_shutdown(handler);
+  });
+}
+
+Status TLSRelay::forward(const std::string& target,
+                         const std::string& body,
+                         size_t timeout,
+                         std::string& response) {
+  auto request =
+      Request<TLSTransport, JSONSerializer>("https://" + FLAGS_tls_hostname +
+                                            target);
+  request.setOption("hostname", FLAGS_tls_hostname);
+  request.setOption("timeout", static_cast<int>(timeout));
+  auto status = request.call(body);
+  if (status.ok()) {
+    response = request.getResponseBody();
+  }
+  return status;
+}
+
+RelayResponse TLSRelay::relay(const std::string& target,
+                              const std::string& body,
+                              const std::string& node_key,
+                              size_t timeout) {
+  RelayResponse response;
+  auto status = forward(target, body, timeout, response.body);
+  if (!status.ok()) {
+    VLOG(1) << "Cannot relay request to " << target << ": "
+            << status.getMessage();
+    return retryLater(getTLSRetryDelay());
+  }
+
+  // Record if the server accepted the node key, or enrolled a host.
+  rj::Document doc;
+  doc.Parse(response.body.c_str(), response.body.size());
+  if (!doc.HasParseError() && doc.IsObject()) {
+    auto enrolled = getMember(doc, "node_key");
+    WriteLock lock(nodes_mutex_);
+    if (isNodeInvalid(doc)) {
+      nodes_.erase(node_key);
+    } else if (nodes_.size() < kRelayMaxNodes) {
+      if (!node_key.empty()) {
+        nodes_.insert(node_key);
+      }
+      if (!enrolled.empty()) {
+        nodes_.insert(enrolled);
+      }
+    }
+  }
+  return response;
+}
+
+Status TLSRelay::sharedConfig(std::string& config) {
+  WriteLock lock(config_mutex_);
+  if (!config_.empty() &&
+      getUnixTime() < config_time_ + FLAGS_relay_config_ttl) {
+    config = config_;
+    return Status(0, "OK");
+  }
+
+  // The relay requests its own config, once for every waiting host.
+  pt::ptree params;
+  params.put("node_key", getNodeKey("tls"));
+  std::string body;
+  auto status = JSONSerializer().serialize(params, body);
+  if (status.ok()) {
+    status = forward(
+        FLAGS_config_tls_endpoint, body, kRelayRequestTimeout, config);
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+  rj::Document doc;
+  doc.Parse(config.c_str(), config.size());
+  if (doc.HasParseError() || isNodeInvalid(doc)) {
+    return Status(1, "The relay's config request was not accepted");
+  }
+
+  config_ = config;
+  config_time_ = getUnixTime();
+  return Status(0, "OK");
+}
+
+bool TLSRelay::isKnownNode(const std::string& node_key) {
+  ReadLock lock(nodes_mutex_);
+  return !node_key.empty() && nodes_.count(node_key) > 0;
+}
+
+Status startRelay() {
+  if (FLAGS_relay_port == 0) {
+    return Status(1, "TLS relay not enabled");
+  } else if (FLAGS_tls_hostname.empty()) {
+    return Status(1, "The TLS relay requires a --tls_hostname");
+  }
+
+  // The hosts' logs are sent upstream in the relay's batches.
+  std::shared_ptr<TLSLogForwarder> logs;
+  if (!FLAGS_logger_tls_endpoint.empty()) {
+    logs = std::make_shared<TLSLogForwarder>("TLSRelayLogForwarder", "relay");
+    auto status = logs->setUp();
+    if (status.ok()) {
+      Dispatcher::addService(logs);
+    } else {
+      LOG(WARNING) << "Relayed logs are not buffered: " << status.getMessage();
+      logs.reset();
+    }
+  }
+  return Dispatcher::addService(std::make_shared<TLSRelay>(logs));
+}
+} // namespace osquery
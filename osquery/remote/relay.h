@@ -0,0 +1,141 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <set>
+#include <string>
+
+#include <osquery/dispatcher.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+class TLSLogForwarder;
+struct RelaySession;
+
+/// A relay response, the HTTP status code and body.
+struct RelayResponse {
+  unsigned code{200};
+  std::string body;
+
+  /// Seconds a busy upstream server asked requests to wait.
+  size_t retry_after{0};
+};
+
+/**
+ * @brief A TLS endpoint relaying the remote requests of nearby hosts.
+ *
+ * Hosts behind a constrained link use the relay as their --tls_hostname, with
+ * the same enroll, config, logger, and distributed endpoints. The relay sends
+ * their requests to its own --tls_hostname over its kept-alive connections.
+ *
+ * Log uploads are answered at once. Their lines are buffered in the relay's
+ * backing store and sent upstream in batches of every host's lines, under the
+ * relay's node key, optionally compressed. With --relay_shared_config the
+ * hosts' config requests are answered with the relay's own config, requested
+ * once for every host.
+ *
+ * Logs and shared configs are only answered for node keys the server accepted
+ * in a relayed response, other requests are relayed unchanged.
+ */
+class TLSRelay : public InternalRunnable {
+ public:
+  /// Create a relay, buffering the hosts' logs in a forwarder if it is set.
+  explicit TLSRelay(std::shared_ptr<TLSLogForwarder> logs);
+
+  /// Accept connections until interrupted, serving each on a thread.
+  void start() override;
+
+  /**
+   * @brief Answer a request of a host.
+   *
+   * @param target The request target, the endpoint path and parameters.
+   * @param body The decompressed request body.
+   * @return The response to the host.
+   */
+  RelayResponse handle(const std::string& target, const std::string& body);
+
+ protected:
+  /// Close the listening socket and the hosts' connections.
+  void stop() override;
+
+  /**
+   * @brief Send a request upstream, unchanged.
+   *
+   * @param target The request target.
+   * @param body The request body.
+   * @param timeout The seconds to wait for the response.
+   * @param response Output, the upstream response body.
+   */
+  virtual Status forward(const std::string& target,
+                         const std::string& body,
+                         size_t timeout,
+                         std::string& response);
+
+ private:
+  /// Relay a request upstream, recording the node keys the server accepted.
+  RelayResponse relay(const std::string& target,
+                      const std::string& body,
+                      const std::string& node_key,
+                      size_t timeout);
+
+  /// Get the relay's config, requested again once it is older than the TTL.
+  Status sharedConfig(std::string& config);
+
+  /// True if the server accepted a node key in a relayed response.
+  bool isKnownNode(const std::string& node_key);
+
+  /// Serve the requests of a connection until it is closed.
+  void serve(RelaySession& session);
+
+ protected:
+  /// Buffers and sends the hosts' log lines.
+  std::shared_ptr<TLSLogForwarder> logs_;
+
+ private:
+  /// Node keys the server accepted.
+  std::set<std::string> nodes_;
+
+  /// Protection around the node keys.
+  Mutex nodes_mutex_;
+
+  /// The relay's config and the unix time it was requested.
+  std::string config_;
+  size_t config_time_{0};
+
+  /// Only one config request is made at a time, others wait and share it.
+  Mutex config_mutex_;
+
+  /// The connections, finished sessions are joined by the accept loop.
+  std::list<std::shared_ptr<RelaySession>> sessions_;
+
+  /// The accept loop's session, stopping it stops accepting connections.
+  std::shared_ptr<RelaySession> listener_;
+
+  /// True once the relay is stopped, no more connections are served.
+  bool stopped_{false};
+
+  /// Protection around the sessions.
+  Mutex sessions_mutex_;
+
+ private:
+  friend class RelayTests;
+};
+
+/**
+ * @brief Start the relay if --relay_port is set.
+ *
+ * @return A status returning if the relay was started
+ */
+Status startRelay();
+} // namespace osquery
@@ -14,11 +14,14 @@
 #include <utility>
 #include <string>
 
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/logger.h>
 #include <osquery/status.h>
 
+#include "osquery/remote/compression.h"
+
 namespace osquery {
 
 class Serializer;
@@ -236,6 +239,19 @@ class Request {
     return transport_->sendRequest(serialized, options_.get("compress", false));
   }
 
+  /**
+   * @brief Send a request with an already serialized body
+   *
+   * Set the "content_encoding" option if the body is already compressed.
+   *
+   * @param serialized The serialized parameters
+   *
+   * @return success or failure of the operation
+   */
+  Status call(const std::string& serialized) {
+    return transport_->sendRequest(serialized, options_.get("compress", false));
+  }
+
   /**
    * @brief Get the request response
    *
@@ -246,6 +262,24 @@ class Request {
     return transport_->getResponseStatus();
   }
 
+  /**
+   * @brief Get a header of the request response
+   *
+   * Only available for transports with response headers.
+   */
+  std::string getResponseHeader(const std::string& name) {
+    return transport_->getResponseHeader(name);
+  }
+
+  /**
+   * @brief Get the body of the request response, before deserializing
+   *
+   * Only available for transports with response bodies.
+   */
+  std::string getResponseBody() {
+    return transport_->getResponseBody();
+  }
+
   template <typename T>
   void setOption(const std::string& name, const T& value) {
     options_.put(name, value);
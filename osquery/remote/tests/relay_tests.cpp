@@ -0,0 +1,141 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <atomic>
+
+#include <gtest/gtest.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <osquery/database.h>
+#include <osquery/flags.h>
+
+#include "osquery/logger/plugins/tls_logger.h"
+#include "osquery/remote/relay.h"
+
+namespace osquery {
+
+DECLARE_string(config_tls_endpoint);
+DECLARE_string(logger_tls_endpoint);
+DECLARE_bool(relay_shared_config);
+
+/// A relay answering every request with a canned upstream response.
+class MockRelay : public TLSRelay {
+ public:
+  explicit MockRelay(std::shared_ptr<TLSLogForwarder> logs)
+      : TLSRelay(std::move(logs)) {}
+
+  std::string upstream{"{\"node_invalid\":false}"};
+  std::string last_target;
+  std::atomic<size_t> requests{0};
+
+ protected:
+  Status forward(const std::string& target,
+                 const std::string& body,
+                 size_t timeout,
+                 std::string& response) override {
+    requests++;
+    last_target = target;
+    response = upstream;
+    return Status(0, "OK");
+  }
+};
+
+class RelayTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    FLAGS_config_tls_endpoint = "/config";
+    FLAGS_logger_tls_endpoint = "/logger";
+  }
+
+  void TearDown() override {
+    FLAGS_config_tls_endpoint = "";
+    FLAGS_logger_tls_endpoint = "";
+    FLAGS_relay_shared_config = false;
+
+    std::vector<std::string> indexes;
+    scanDatabaseKeys(kLogs, indexes, "relay_");
+    for (const auto& index : indexes) {
+      deleteDatabaseValue(kLogs, index);
+    }
+  }
+
+  bool isKnownNode(TLSRelay& relay, const std::string& node_key) {
+    return relay.isKnownNode(node_key);
+  }
+};
+
+TEST_F(RelayTests, test_known_nodes) {
+  MockRelay relay(nullptr);
+  EXPECT_FALSE(isKnownNode(relay, "key"));
+
+  // An accepted node key is recorded from the relayed response.
+  auto response = relay.handle("/config", "{\"node_key\":\"key\"}");
+  EXPECT_EQ(response.code, 200U);
+  EXPECT_EQ(response.body, relay.upstream);
+  EXPECT_EQ(relay.last_target, "/config");
+  EXPECT_TRUE(isKnownNode(relay, "key"));
+
+  // So is the key of a host the server enrolled.
+  relay.upstream = "{\"node_key\":\"enrolled\"}";
+  relay.handle("/enroll", "{\"enroll_secret\":\"secret\"}");
+  EXPECT_TRUE(isKnownNode(relay, "enrolled"));
+
+  // A host asked to enroll again is forgotten.
+  relay.upstream = "{\"node_invalid\":true}";
+  relay.handle("/config", "{\"node_key\":\"key\"}");
+  EXPECT_FALSE(isKnownNode(relay, "key"));
+  EXPECT_EQ(relay.requests, 3U);
+}
+
+TEST_F(RelayTests, test_buffered_logs) {
+  auto logs = std::make_shared<TLSLogForwarder>("TLSRelayLogForwarder",
+                                                "relay");
+  MockRelay relay(logs);
+  std::string upload =
+      "{\"node_key\":\"key\",\"log_type\":\"result\","
+      "\"data\":[{\"name\":\"a\",\"hostIdentifier\":\"host\"}]}";
+
+  // The upload of an unknown host is relayed.
+  relay.handle("/logger", upload);
+  EXPECT_EQ(relay.requests, 1U);
+
+  // Then buffered, once the server accepted the host.
+  auto response = relay.handle("/logger", upload);
+  EXPECT_EQ(response.code, 200U);
+  EXPECT_EQ(response.body, "{\"node_invalid\":false}");
+  EXPECT_EQ(relay.requests, 1U);
+
+  std::vector<std::string> indexes;
+  scanDatabaseKeys(kLogs, indexes, "relay_");
+  ASSERT_EQ(indexes.size(), 1U);
+  std::string line;
+  getDatabaseValue(kLogs, indexes[0], line);
+  EXPECT_TRUE(boost::starts_with(line, "{\"name\":\"a\""));
+}
+
+TEST_F(RelayTests, test_shared_config) {
+  MockRelay relay(nullptr);
+  relay.handle("/config", "{\"node_key\":\"key\"}");
+  EXPECT_EQ(relay.requests, 1U);
+
+  // The relay's config is requested once and shared.
+  FLAGS_relay_shared_config = true;
+  relay.upstream = "{\"schedule\":{}}";
+  auto response = relay.handle("/config", "{\"node_key\":\"key\"}");
+  EXPECT_EQ(response.body, relay.upstream);
+  relay.handle("/config", "{\"node_key\":\"key\"}");
+  EXPECT_EQ(relay.requests, 2U);
+
+  // Distributed reads are always relayed.
+  relay.handle("/distributed_read", "{\"node_key\":\"key\"}");
+  EXPECT_EQ(relay.requests, 3U);
+}
+} // namespace osquery
@@ -8,8 +8,13 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <cstring>
+
 #include <gtest/gtest.h>
 
+#include <zlib.h>
+#include <zstd.h>
+
 #include "osquery/remote/requests.h"
 #include "osquery/remote/serializers/json.h"
 #include "osquery/remote/transports/tls.h"
@@ -154,4 +159,82 @@ TEST_F(RequestsTests, test_compression) {
   EXPECT_EQ(compressed, expected);
   EXPECT_LT(compressed.size(), uncompressed.size());
 }
+
+TEST_F(RequestsTests, test_gzip_stream) {
+  std::string uncompressed;
+  GzipStream stream;
+  for (size_t i = 0; i < 4096; i++) {
+    auto line = "{\"line\":\"" + std::to_string(i) + "\"},";
+    uncompressed += line;
+    ASSERT_TRUE(stream.write(line.data(), line.size()));
+  }
+  ASSERT_TRUE(stream.finish());
+  EXPECT_LT(stream.output().size(), uncompressed.size());
+
+  // The appended output is a single GZip stream.
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  ASSERT_EQ(inflateInit2(&zs, MAX_WBITS + 16), Z_OK);
+  std::string output(uncompressed.size(), '\0');
+  zs.next_in = reinterpret_cast<Bytef*>(&stream.output()[0]);
+  zs.avail_in = static_cast<uInt>(stream.output().size());
+  zs.next_out = reinterpret_cast<Bytef*>(&output[0]);
+  zs.avail_out = static_cast<uInt>(output.size());
+  EXPECT_EQ(inflate(&zs, Z_FINISH), Z_STREAM_END);
+  inflateEnd(&zs);
+  EXPECT_EQ(output, uncompressed);
+}
+
+TEST_F(RequestsTests, test_zstd_stream) {
+  std::string uncompressed;
+  std::string compressed;
+  ZstdStream stream;
+  stream.setSink([&compressed](const char* data, size_t size) {
+    compressed.append(data, size);
+    return true;
+  });
+  for (size_t i = 0; i < 4096; i++) {
+    auto line = "{\"line\":\"" + std::to_string(i) + "\"},";
+    uncompressed += line;
+    ASSERT_TRUE(stream.write(line));
+  }
+  ASSERT_TRUE(stream.finish());
+  EXPECT_EQ(stream.encoding(), "zstd");
+
+  // The output is handed to the sink as a single zstd frame.
+  EXPECT_TRUE(stream.output().empty());
+  EXPECT_LT(compressed.size(), uncompressed.size());
+  std::string output(uncompressed.size(), '\0');
+  auto size = ZSTD_decompress(
+      &output[0], output.size(), compressed.data(), compressed.size());
+  ASSERT_FALSE(ZSTD_isError(size));
+  EXPECT_EQ(size, uncompressed.size());
+  EXPECT_EQ(output, uncompressed);
+}
+
+TEST_F(RequestsTests, test_request_body) {
+  std::string body;
+  std::string encoding;
+  RequestBody plain("");
+  plain.append("{\"foo\":");
+  plain.append("\"bar\"}");
+  EXPECT_TRUE(plain.finish(body, encoding).ok());
+  EXPECT_EQ(body, "{\"foo\":\"bar\"}");
+  EXPECT_TRUE(encoding.empty());
+
+  RequestBody gzip("gzip");
+  gzip.append("{\"foo\":\"bar\"}");
+  EXPECT_TRUE(gzip.finish(body, encoding).ok());
+  EXPECT_EQ(body, compressString("{\"foo\":\"bar\"}"));
+  EXPECT_EQ(encoding, "gzip");
+
+  // Unsupported encodings use GZip.
+  RequestBody unknown("unknown");
+  unknown.append("{\"foo\":\"bar\"}");
+  EXPECT_TRUE(unknown.finish(body, encoding).ok());
+  EXPECT_EQ(encoding, "gzip");
+
+  EXPECT_EQ(makeCompressionStream("unknown"), nullptr);
+  EXPECT_NE(makeCompressionStream("zstd"), nullptr);
+}
 }
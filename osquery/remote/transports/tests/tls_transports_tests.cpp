@@ -8,6 +8,8 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <thread>
 
 #include <gtest/gtest.h>
@@ -26,6 +28,8 @@ namespace pt = boost::property_tree;
 namespace osquery {
 
 DECLARE_string(tls_server_certs);
+DECLARE_uint64(tls_max_connections);
+DECLARE_uint64(tls_backoff_max);
 
 class TLSTransportsTests : public testing::Test {
  public:
@@ -180,4 +184,97 @@ TEST_F(TLSTransportsTests, test_call_client_auth) {
     EXPECT_TRUE(status.ok());
   }
 }
+
+TEST_F(TLSTransportsTests, test_client_pool) {
+  auto& pool = TLSClientPool::get();
+  pool.clear();
+
+  http::Client::Options options;
+  options.keep_alive(true).timeout(16);
+  auto endpoint = "https://localhost:" + port_;
+
+  // A released client is reused for the same endpoint and options.
+  auto client = pool.acquire(endpoint, options);
+  auto first = client.get();
+  client.reset();
+  EXPECT_EQ(pool.size(), 1U);
+
+  client = pool.acquire(endpoint, options);
+  EXPECT_EQ(client.get(), first);
+  EXPECT_EQ(pool.size(), 0U);
+
+  // Clients are not shared between endpoints or different options.
+  auto other = pool.acquire("https://other:443", options);
+  EXPECT_NE(other.get(), first);
+  other.reset();
+  client.reset();
+  EXPECT_EQ(pool.size(), 2U);
+
+  auto verify_peer = options;
+  verify_peer.always_verify_peer(true);
+  client = pool.acquire(endpoint, verify_peer);
+  EXPECT_NE(client.get(), first);
+  client.reset();
+  EXPECT_EQ(pool.size(), 3U);
+
+  pool.clear();
+  EXPECT_EQ(pool.size(), 0U);
+}
+
+TEST_F(TLSTransportsTests, test_client_pool_limit) {
+  auto& pool = TLSClientPool::get();
+  pool.clear();
+
+  auto max_connections = FLAGS_tls_max_connections;
+  FLAGS_tls_max_connections = 1;
+
+  http::Client::Options options;
+  options.keep_alive(true).timeout(16);
+  auto endpoint = "https://localhost:" + port_;
+
+  // A request waits for the single connection to be released.
+  auto client = pool.acquire(endpoint, options);
+  std::atomic<bool> acquired{false};
+  std::thread waiter([&pool, &endpoint, &options, &acquired]() {
+    auto other = pool.acquire(endpoint, options);
+    acquired = true;
+  });
+
+  sleepFor(200);
+  EXPECT_FALSE(acquired);
+  client.reset();
+  waiter.join();
+  EXPECT_TRUE(acquired);
+  EXPECT_EQ(pool.size(), 1U);
+
+  pool.clear();
+  FLAGS_tls_max_connections = max_connections;
+}
+
+TEST_F(TLSTransportsTests, test_backoff_delay) {
+  auto backoff_max = FLAGS_tls_backoff_max;
+  FLAGS_tls_backoff_max = 10;
+
+  // Delays grow with jitter from a second, up to the maximum.
+  size_t delay = 0;
+  for (size_t i = 0; i < 20; i++) {
+    auto next = getTLSBackoffDelay(delay);
+    EXPECT_GE(next, 1000U);
+    EXPECT_LE(next, std::min(std::max(delay, size_t{1000}) * 3, size_t{10000}));
+    delay = next;
+  }
+
+  // The server's retry delay is the shortest wait.
+  setTLSRetryDelay(5);
+  EXPECT_GT(getTLSRetryDelay(), 3U);
+  EXPECT_GE(getTLSBackoffDelay(0), 4000U);
+
+  // Retries stop if the server asked for a longer wait than the maximum.
+  setTLSRetryDelay(60);
+  EXPECT_EQ(getTLSBackoffDelay(0), 0U);
+
+  setTLSRetryDelay(0);
+  EXPECT_EQ(getTLSRetryDelay(), 0U);
+  FLAGS_tls_backoff_max = backoff_max;
+}
 }
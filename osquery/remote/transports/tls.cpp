@@ -13,15 +13,31 @@
 #include "osquery/remote/transports/tls.h"
 // clang-format on
 
+#include <algorithm>
+#include <atomic>
+
 #include <boost/filesystem.hpp>
 
+#include <osquery/config.h>
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/system.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/metrics.h"
+#include "osquery/core/trace.h"
 
 namespace fs = boost::filesystem;
 
 namespace osquery {
 
+/// TLS requests, exported with --metrics_path.
+static MetricHistogram kTLSRequestLatency(
+    "osquery_tls_request_duration_milliseconds",
+    "Milliseconds taken by TLS requests, including failures");
+static Metric kTLSRequestFailures("osquery_tls_request_failures_total",
+                                  "TLS requests that failed");
+
 const std::string kTLSUserAgentBase = "osquery/";
 
 /// TLS server hostname.
@@ -60,11 +76,182 @@ HIDDEN_FLAG(bool,
 
 HIDDEN_FLAG(bool, tls_dump, false, "Print remote requests and responses");
 
+/// Content-Encoding used when compressing request bodies.
+FLAG(string,
+     tls_compression,
+     "gzip",
+     "Content-Encoding of compressed TLS/HTTPS requests: gzip or zstd");
+
+/// Keep connections to the TLS server open between requests.
+FLAG(bool,
+     tls_keep_alive,
+     true,
+     "Reuse TLS/HTTPS connections and sessions between requests");
+
+FLAG(uint64,
+     tls_max_connections,
+     0,
+     "Max TLS/HTTPS connections to each server, requests wait (0 no limit)");
+
+FLAG(uint64,
+     tls_idle_timeout,
+     30,
+     "Seconds an idle TLS/HTTPS connection is kept open for reuse");
+
+FLAG(uint64,
+     tls_backoff_max,
+     60,
+     "Max seconds between retries of failed TLS/HTTPS requests");
+
 /// Undocumented feature to override TLS endpoints.
 HIDDEN_FLAG(bool, tls_node_api, false, "Use node key as TLS endpoints");
 
 DECLARE_bool(verbose);
 
+/// The default seconds to wait for a response.
+const int kTLSRequestTimeout = 16;
+
+/// The maximum number of idle clients kept for an endpoint.
+const size_t kTLSMaxIdleClients = 4;
+
+/// The longest a request waits for a connection, before exceeding the limit.
+const std::chrono::seconds kTLSConnectionWait{60};
+
+/// The milliseconds waited before the first retry of a failed request.
+const size_t kTLSBackoffBase = 1000;
+
+/// The longest a server's Retry-After delay is honored.
+const size_t kTLSRetryAfterMax = 3600;
+
+/// The largest schedule load percent a server may signal.
+const size_t kTLSScheduleLoadMax = 1000;
+
+/// The unix time a busy server asked requests to wait until.
+static std::atomic<size_t> kTLSRetryAfter{0};
+
+size_t getTLSRetryDelay() {
+  auto now = getUnixTime();
+  auto until = kTLSRetryAfter.load();
+  return (until > now) ? until - now : 0;
+}
+
+void setTLSRetryDelay(size_t seconds) {
+  kTLSRetryAfter = getUnixTime() + std::min(seconds, kTLSRetryAfterMax);
+}
+
+size_t getTLSBackoffDelay(size_t previous) {
+  auto cap = FLAGS_tls_backoff_max * 1000;
+  auto retry = getTLSRetryDelay() * 1000;
+  if (retry > cap) {
+    return 0;
+  }
+  return std::max(getBackoffDelay(kTLSBackoffBase, previous, cap), retry);
+}
+
+std::shared_ptr<http::Client> TLSClientPool::acquire(
+    const std::string& endpoint, const http::Client::Options& options) {
+  std::unique_ptr<http::Client> client;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto deadline = std::chrono::steady_clock::now() + kTLSConnectionWait;
+    while (true) {
+      expire();
+      size_t idle = 0;
+      auto unused = idle_.end();
+      for (auto it = idle_.begin(); it != idle_.end(); ++it) {
+        if (it->endpoint != endpoint) {
+          continue;
+        } else if (it->client->options() == options) {
+          client = std::move(it->client);
+          idle_.erase(it);
+          break;
+        }
+        idle++;
+        unused = it;
+      }
+
+      if (client != nullptr) {
+        break;
+      }
+
+      auto limit = static_cast<size_t>(FLAGS_tls_max_connections);
+      if (limit == 0 || active_[endpoint] + idle < limit) {
+        break;
+      } else if (unused != idle_.end()) {
+        // Close the least recently used connection with different options.
+        idle_.erase(unused);
+        break;
+      } else if (cv_.wait_until(lock, deadline) == std::cv_status::timeout) {
+        VLOG(1) << "Exceeding the TLS/HTTPS connection limit for: "
+                << endpoint;
+        break;
+      }
+    }
+    active_[endpoint]++;
+  }
+
+  if (client == nullptr) {
+    client = std::unique_ptr<http::Client>(new http::Client(options));
+  }
+
+  return std::shared_ptr<http::Client>(
+      client.release(), [this, endpoint](http::Client* released) {
+        release(endpoint, std::unique_ptr<http::Client>(released));
+      });
+}
+
+void TLSClientPool::release(const std::string& endpoint,
+                            std::unique_ptr<http::Client> client) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--active_[endpoint] == 0) {
+      active_.erase(endpoint);
+    }
+
+    if (FLAGS_tls_keep_alive) {
+      size_t count = 0;
+      for (auto it = idle_.begin(); it != idle_.end();) {
+        if (it->endpoint == endpoint && ++count >= kTLSMaxIdleClients) {
+          it = idle_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      idle_.push_front(
+          {endpoint, std::move(client), std::chrono::steady_clock::now()});
+    }
+  }
+  cv_.notify_all();
+}
+
+void TLSClientPool::expire() {
+  auto timeout = std::chrono::seconds(FLAGS_tls_idle_timeout);
+  auto now = std::chrono::steady_clock::now();
+  while (!idle_.empty() && now - idle_.back().since >= timeout) {
+    idle_.pop_back();
+  }
+}
+
+void TLSClientPool::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  idle_.clear();
+}
+
+size_t TLSClientPool::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  expire();
+  return idle_.size();
+}
+
+std::string TLSClientPool::getEndpoint(http::Request& r) {
+  auto endpoint = (r.protocol()) ? *r.protocol() : "https";
+  endpoint += "://" + ((r.remoteHost()) ? *r.remoteHost() : "");
+  if (r.remotePort()) {
+    endpoint += ":" + *r.remotePort();
+  }
+  return endpoint;
+}
+
 TLSTransport::TLSTransport() : verify_peer_(true) {
   if (FLAGS_tls_server_certs.size() > 0) {
     server_certificate_file_ = FLAGS_tls_server_certs;
@@ -77,14 +264,26 @@ TLSTransport::TLSTransport() : verify_peer_(true) {
 }
 
 void TLSTransport::decorateRequest(http::Request& r) {
-  r << http::Request::Header("Content-Type", serializer_->getContentType());
+  // Requests may send a body that is not serialized, such as binary data.
+  r << http::Request::Header(
+      "Content-Type",
+      options_.get("content_type", serializer_->getContentType()));
+
+  // Conditional requests send the entity tag of the content already held.
+  if (options_.count("if_none_match")) {
+    r << http::Request::Header("If-None-Match",
+                               options_.get<std::string>("if_none_match"));
+  }
   r << http::Request::Header("Accept", serializer_->getContentType());
   r << http::Request::Header("User-Agent", kTLSUserAgentBase + kVersion);
 }
 
 http::Client::Options TLSTransport::getOptions() {
   http::Client::Options options;
-  options.follow_redirects(true).always_verify_peer(verify_peer_).timeout(16);
+  // Requests the server may hold open, such as long-polls, extend the timeout.
+  options.follow_redirects(true).always_verify_peer(verify_peer_);
+  options.timeout(options_.get<int>("timeout", kTLSRequestTimeout));
+  options.keep_alive(FLAGS_tls_keep_alive);
 
   if (FLAGS_proxy_hostname.size() > 0) {
     options.proxy_hostname(FLAGS_proxy_hostname);
@@ -144,6 +343,40 @@ http::Client::Options TLSTransport::getOptions() {
   return options;
 }
 
+Status TLSTransport::readResponse() {
+  // The server's load adapts the schedule, until a response without it.
+  unsigned long long load = 0;
+  if (!safeStrtoull(getResponseHeader("X-Osquery-Schedule-Load"), 10, load)
+           .ok()) {
+    load = 100;
+  }
+  Config::get().setScheduleLoad(
+      std::min(static_cast<size_t>(load), kTLSScheduleLoadMax));
+
+  // A conditional request for unchanged content has no response body.
+  if (response_.status() == 304 && options_.count("if_none_match")) {
+    response_params_.clear();
+    return Status(0, kTLSNotModified);
+  }
+
+  // A busy server may ask every request to wait before retrying.
+  auto code = response_.status();
+  if (code == 429 || code == 503) {
+    unsigned long long delay = 0;
+    if (safeStrtoull(getResponseHeader("Retry-After"), 10, delay).ok()) {
+      setTLSRetryDelay(static_cast<size_t>(delay));
+    }
+    response_params_.clear();
+    return Status(1, "Server busy: HTTP " + std::to_string(code));
+  }
+
+  const auto& response_body = response_.body();
+  if (FLAGS_verbose && FLAGS_tls_dump) {
+    fprintf(stdout, "%s\n", response_body.c_str());
+  }
+  return serializer_->deserialize(response_body, response_params_);
+}
+
 inline bool tlsFailure(const std::string& what) {
   if (what.find("Error") == 0 || what.find("refused") != std::string::npos) {
     return false;
@@ -151,42 +384,69 @@ inline bool tlsFailure(const std::string& what) {
   return true;
 }
 
+/// Record the latency of a request, and count it if it failed.
+static Status recordTLSRequest(std::chrono::steady_clock::time_point start,
+                               Status status) {
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+  kTLSRequestLatency.observe(static_cast<uint64_t>(elapsed.count()));
+  if (!status.ok()) {
+    kTLSRequestFailures.add();
+  }
+  return status;
+}
+
 Status TLSTransport::sendRequest() {
+  TRACE_SPAN("TLSTransport::sendRequest", destination_);
   if (destination_.find("https://") == std::string::npos) {
     return Status(1, "Cannot create TLS request for non-HTTPS protocol URI");
   }
 
-  http::Client client(getOptions());
   http::Request r(destination_);
+  auto client = TLSClientPool::get().acquire(TLSClientPool::getEndpoint(r),
+                                             getOptions());
   decorateRequest(r);
 
   VLOG(1) << "TLS/HTTPS GET request to URI: " << destination_;
+  auto start = std::chrono::steady_clock::now();
   try {
-    response_ = client.get(r);
-    const auto& response_body = response_.body();
-    if (FLAGS_verbose && FLAGS_tls_dump) {
-      fprintf(stdout, "%s\n", response_body.c_str());
-    }
-    response_status_ =
-        serializer_->deserialize(response_body, response_params_);
+    response_ = client->get(r);
+    response_status_ = readResponse();
   } catch (const std::exception& e) {
-    return Status((tlsFailure(e.what())) ? 2 : 1,
-                  std::string("Request error: ") + e.what());
+    return recordTLSRequest(start,
+                            Status((tlsFailure(e.what())) ? 2 : 1,
+                                   std::string("Request error: ") + e.what()));
   }
-  return response_status_;
+  return recordTLSRequest(start, response_status_);
 }
 
 Status TLSTransport::sendRequest(const std::string& params, bool compress) {
+  TRACE_SPAN("TLSTransport::sendRequest", destination_);
   if (destination_.find("https://") == std::string::npos) {
     return Status(1, "Cannot create TLS request for non-HTTPS protocol URI");
   }
 
-  http::Client client(getOptions());
   http::Request r(destination_);
+  auto client = TLSClientPool::get().acquire(TLSClientPool::getEndpoint(r),
+                                             getOptions());
   decorateRequest(r);
-  if (compress) {
-    // Later, when posting/putting, the data will be optionally compressed.
-    r << http::Request::Header("Content-Encoding", "gzip");
+
+  // The caller may have compressed the data while serializing.
+  auto encoding = options_.get("content_encoding", "");
+  bool compressed = !encoding.empty();
+  std::string body;
+  if (compress && !compressed) {
+    // Compress the data before posting/putting.
+    RequestBody request_body(FLAGS_tls_compression);
+    request_body.append(params);
+    auto status = request_body.finish(body, encoding);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  if (!encoding.empty()) {
+    r << http::Request::Header("Content-Encoding", encoding);
   }
 
   // Allow request calls to override the default HTTP POST verb.
@@ -197,27 +457,24 @@ Status TLSTransport::sendRequest(const std::string& params, bool compress) {
 
   VLOG(1) << "TLS/HTTPS " << ((verb == HTTP_POST) ? "POST" : "PUT")
           << " request to URI: " << destination_;
-  if (FLAGS_verbose && FLAGS_tls_dump) {
+  if (FLAGS_verbose && FLAGS_tls_dump && !compressed) {
     fprintf(stdout, "%s\n", params.c_str());
   }
 
+  auto start = std::chrono::steady_clock::now();
   try {
+    const auto& data = (compress && !compressed) ? body : params;
     if (verb == HTTP_POST) {
-      response_ = client.post(r, (compress) ? compressString(params) : params);
+      response_ = client->post(r, data);
     } else {
-      response_ = client.put(r, (compress) ? compressString(params) : params);
-    }
-
-    const auto& response_body = response_.body();
-    if (FLAGS_verbose && FLAGS_tls_dump) {
-      fprintf(stdout, "%s\n", response_body.c_str());
+      response_ = client->put(r, data);
     }
-    response_status_ =
-        serializer_->deserialize(response_body, response_params_);
+    response_status_ = readResponse();
   } catch (const std::exception& e) {
-    return Status((tlsFailure(e.what())) ? 2 : 1,
-                  std::string("Request error: ") + e.what());
+    return recordTLSRequest(start,
+                            Status((tlsFailure(e.what())) ? 2 : 1,
+                                   std::string("Request error: ") + e.what()));
   }
-  return response_status_;
+  return recordTLSRequest(start, response_status_);
 }
 }
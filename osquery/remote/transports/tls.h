@@ -10,6 +10,14 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
 #include <osquery/flags.h>
 
 #include "osquery/remote/http_client.h"
@@ -39,8 +47,107 @@ enum HTTPVerb {
   HTTP_PUT,
 };
 
+/**
+ * @brief A process-wide pool of HTTP clients with kept-alive connections.
+ *
+ * The TLS config, enroll, logger, distributed, and carver plugins share the
+ * pool. A client is used by one request at a time, it is returned to the pool
+ * when released. Returned clients keep their connection and TLS session for
+ * the next request to the endpoint, until they are idle for too long.
+ *
+ * The number of connections to an endpoint may be limited, requests then
+ * wait for a connection to be released rather than opening another.
+ */
+class TLSClientPool : private boost::noncopyable {
+ public:
+  static TLSClientPool& get() {
+    static TLSClientPool pool;
+    return pool;
+  }
+
+  /**
+   * @brief Take an idle client for an endpoint, or create a client.
+   *
+   * If the endpoint's connection limit is reached this waits for a client to
+   * be released.
+   *
+   * @param endpoint The protocol, host, and port of the request URI.
+   * @param options A reused client must have been created with equal options.
+   * @return The client, it is returned to the pool when released.
+   */
+  std::shared_ptr<http::Client> acquire(const std::string& endpoint,
+                                        const http::Client::Options& options);
+
+  /// The protocol, host, and port of a request, connections are kept for each.
+  static std::string getEndpoint(http::Request& r);
+
+  /// Close every idle client.
+  void clear();
+
+  /// The number of idle clients.
+  size_t size();
+
+ private:
+  TLSClientPool() = default;
+
+  /// Return a client to the pool.
+  void release(const std::string& endpoint,
+               std::unique_ptr<http::Client> client);
+
+  /// Close clients idle for longer than the idle timeout.
+  void expire();
+
+ private:
+  struct IdleClient {
+    std::string endpoint;
+    std::unique_ptr<http::Client> client;
+    std::chrono::steady_clock::time_point since;
+  };
+
+  /// Idle clients, the most recently returned first.
+  std::list<IdleClient> idle_;
+
+  /// The number of acquired clients for each endpoint.
+  std::map<std::string, size_t> active_;
+
+  std::mutex mutex_;
+
+  /// Notified when a client is released.
+  std::condition_variable cv_;
+};
+
+/// The response status message of an unchanged conditional request.
+const std::string kTLSNotModified = "Not Modified";
+
+/**
+ * @brief Seconds until the TLS server accepts requests again, or 0.
+ *
+ * A server responding 429 or 503 with a Retry-After delay in seconds asks
+ * every request to wait, requests are not sent until the delay passes.
+ */
+size_t getTLSRetryDelay();
+
+/// Ask TLS requests to wait, the delay is capped at an hour.
+void setTLSRetryDelay(size_t seconds);
+
+/**
+ * @brief Get the milliseconds to wait before retrying a failed request.
+ *
+ * Delays grow exponentially with jitter, up to --tls_backoff_max seconds, and
+ * are at least the server's retry delay.
+ *
+ * @param previous The previous delay, 0 before the first retry.
+ * @return The delay, or 0 if the server asked for a longer wait than
+ * --tls_backoff_max and the request should not be retried.
+ */
+size_t getTLSBackoffDelay(size_t previous);
+
 /**
  * @brief HTTPS (TLS) transport.
+ *
+ * Set the "if_none_match" option to an entity tag to make a conditional
+ * request. If the server responds that the content is unchanged the response
+ * status is successful, with the kTLSNotModified message and no parameters.
  */
 class TLSTransport : public Transport {
  public:
@@ -64,6 +171,16 @@ class TLSTransport : public Transport {
    */
   Status sendRequest(const std::string& params, bool compress = false) override;
 
+  /// Get a header of the response, empty if it is missing.
+  std::string getResponseHeader(const std::string& name) {
+    return response_.headers()[name];
+  }
+
+  /// Get the body of the response, as it was received.
+  std::string getResponseBody() {
+    return response_.body();
+  }
+
   /**
    * @brief Class destructor
    */
@@ -113,6 +230,9 @@ class TLSTransport : public Transport {
    */
   void decorateRequest(http::Request& r);
 
+  /// Deserialize the response body into the response parameters.
+  Status readResponse();
+
  protected:
   /// Storage for the HTTP response object
   http::Response response_;
@@ -22,6 +22,7 @@ namespace osquery {
 
 DECLARE_string(tls_enroll_override);
 DECLARE_string(tls_hostname);
+DECLARE_string(tls_compression);
 DECLARE_bool(tls_node_api);
 DECLARE_bool(tls_secret_always);
 DECLARE_bool(disable_reenrollment);
@@ -67,7 +68,9 @@ class TLSRequestHelper : private boost::noncopyable {
    *
    * @param uri is the URI to send the request to
    * @param params is a ptree of the params to send to the server. This isn't
-   * const because it will be modified to include node_key.
+   * const because it will be modified to include node_key. An _if_none_match
+   * param makes the request conditional, the response's _etag is returned in
+   * params, with _not_modified if the content is unchanged.
    * @param output is the ptree which will be populated with the deserialized
    * results
    *
@@ -77,6 +80,11 @@ class TLSRequestHelper : private boost::noncopyable {
   static Status go(const std::string& uri,
                    boost::property_tree::ptree& params,
                    boost::property_tree::ptree& output) {
+    auto status = checkRetryDelay();
+    if (!status.ok()) {
+      return status;
+    }
+
     auto node_key = getNodeKey("tls");
 
     // If using a GET request, append the node_key to the URI variables.
@@ -98,6 +106,22 @@ class TLSRequestHelper : private boost::noncopyable {
       params.erase("_compress");
     }
 
+    // The caller-supplied parameters may make the request conditional.
+    std::string if_none_match;
+    if (params.count("_if_none_match")) {
+      if_none_match = params.get<std::string>("_if_none_match");
+      request.setOption("if_none_match", if_none_match);
+      params.erase("_if_none_match");
+    }
+
+    // The caller-supplied parameters may extend the response timeout.
+    int timeout = 0;
+    if (params.count("_timeout")) {
+      timeout = params.get<int>("_timeout");
+      request.setOption("timeout", timeout);
+      params.erase("_timeout");
+    }
+
     // The caller-supplied parameters may force a POST request.
     bool force_post = false;
     if (params.count("_verb")) {
@@ -111,7 +135,7 @@ class TLSRequestHelper : private boost::noncopyable {
       params.erase("_get");
     }
     bool should_post = (use_post || force_post);
-    auto status = (should_post) ? request.call(params) : request.call();
+    status = (should_post) ? request.call(params) : request.call();
 
     // Restore caller-supplied parameters.
     if (force_post) {
@@ -122,6 +146,14 @@ class TLSRequestHelper : private boost::noncopyable {
       params.put("_compress", true);
     }
 
+    if (timeout > 0) {
+      params.put("_timeout", timeout);
+    }
+
+    if (!if_none_match.empty()) {
+      params.put("_if_none_match", if_none_match);
+    }
+
     if (!status.ok()) {
       return status;
     }
@@ -132,27 +164,100 @@ class TLSRequestHelper : private boost::noncopyable {
       return status;
     }
 
-    // Receive config or key rejection
-    if (output.count("node_invalid") > 0) {
-      auto invalid = output.get("node_invalid", "");
-      if (invalid == "1" || invalid == "true" || invalid == "True") {
-        if (!FLAGS_disable_reenrollment) {
-          clearNodeKey();
-        }
+    // Report the content's entity tag, and if it is unchanged, to the caller.
+    auto etag = request.getResponseHeader("ETag");
+    if (!etag.empty()) {
+      params.put("_etag", etag);
+    }
+    if (status.getMessage() == kTLSNotModified) {
+      params.put("_not_modified", true);
+      return status;
+    }
+    return checkResponse(output);
+  }
 
-        std::string message = "Request failed: Invalid node key";
-        if (output.count("error") > 0) {
-          message += ": " + output.get("error", "<unknown>");
-        }
-        return Status(1, message);
-      }
+  /**
+   * @brief Send a TLS request with an already serialized body
+   *
+   * The body must include the node_key, it cannot be added to serialized
+   * parameters.
+   *
+   * @param uri is the URI to send the request to
+   * @param body is the serialized params, optionally compressed
+   * @param encoding is the Content-Encoding of the body, empty if it is not
+   * compressed
+   * @param output is the ptree which will be populated with the deserialized
+   * results
+   *
+   * @return a Status object indicating the success or failure of the operation
+   */
+  template <class TSerializer>
+  static Status go(const std::string& uri,
+                   const std::string& body,
+                   const std::string& encoding,
+                   boost::property_tree::ptree& output) {
+    auto status = checkRetryDelay();
+    if (!status.ok()) {
+      return status;
     }
 
-    if (output.count("error") > 0) {
-      return Status(1, "Request failed: " + output.get("error", "<unknown>"));
+    // If using a GET request, append the node_key to the URI variables.
+    std::string uri_suffix;
+    if (FLAGS_tls_node_api) {
+      uri_suffix = "&node_key=" + getNodeKey("tls");
     }
 
-    return Status(0, "OK");
+    auto request = Request<TLSTransport, TSerializer>(uri + uri_suffix);
+    request.setOption("hostname", FLAGS_tls_hostname);
+    if (!encoding.empty()) {
+      request.setOption("content_encoding", encoding);
+    }
+
+    status = request.call(body);
+    if (!status.ok()) {
+      return status;
+    }
+
+    status = request.getResponse(output);
+    if (!status.ok()) {
+      return status;
+    }
+    return checkResponse(output);
+  }
+
+  /**
+   * @brief Send a TLS request with an already serialized body
+   *
+   * @param uri is the URI to send the request to
+   * @param body is the serialized params, optionally compressed
+   * @param encoding is the Content-Encoding of the body, empty if it is not
+   * compressed
+   * @param output is the ptree which will be populated with the deserialized
+   * results
+   * @param attempts is the number of attempts to make if the request fails
+   *
+   * @return a Status object indicating the success or failure of the operation
+   */
+  template <class TSerializer>
+  static Status go(const std::string& uri,
+                   const std::string& body,
+                   const std::string& encoding,
+                   boost::property_tree::ptree& output,
+                   const size_t attempts) {
+    Status s;
+    size_t delay = 0;
+    for (size_t i = 1; i <= attempts; i++) {
+      s = TLSRequestHelper::go<TSerializer>(uri, body, encoding, output);
+      if (s.ok() || i == attempts) {
+        break;
+      }
+      delay = getTLSBackoffDelay(delay);
+      if (delay == 0) {
+        break;
+      }
+      sleepFor(delay);
+    }
+    return s;
   }
 
   /**
@@ -237,6 +342,7 @@ class TLSRequestHelper : private boost::noncopyable {
       }
     }
 
+    size_t delay = 0;
     for (size_t i = 1; i <= attempts; i++) {
       s = TLSRequestHelper::go<TSerializer>(uri, params, output);
       if (s.ok()) {
@@ -245,10 +351,14 @@ class TLSRequestHelper : private boost::noncopyable {
       if (i == attempts) {
         break;
       }
+      delay = getTLSBackoffDelay(delay);
+      if (delay == 0) {
+        break;
+      }
       for (const auto& param : override_params) {
         params.put(param.first, param.second.data());
       }
-      sleepFor(i * i * 1000);
+      sleepFor(delay);
     }
     return s;
   }
@@ -271,5 +381,42 @@ class TLSRequestHelper : private boost::noncopyable {
     params.put("_get", true);
     return TLSRequestHelper::go<TSerializer>(uri, params, output, attempts);
   }
+
+ private:
+  /// Fail requests without sending them while the server asked to wait.
+  static Status checkRetryDelay() {
+    auto delay = getTLSRetryDelay();
+    if (delay > 0) {
+      return Status(1,
+                    "Server busy: retry in " + std::to_string(delay) +
+                        " seconds");
+    }
+    return Status(0, "OK");
+  }
+
+  /// Check a response for a node key rejection or an error.
+  static Status checkResponse(const boost::property_tree::ptree& output) {
+    // Receive config or key rejection
+    if (output.count("node_invalid") > 0) {
+      auto invalid = output.get("node_invalid", "");
+      if (invalid == "1" || invalid == "true" || invalid == "True") {
+        if (!FLAGS_disable_reenrollment) {
+          clearNodeKey();
+        }
+
+        std::string message = "Request failed: Invalid node key";
+        if (output.count("error") > 0) {
+          message += ": " + output.get("error", "<unknown>");
+        }
+        return Status(1, message);
+      }
+    }
+
+    if (output.count("error") > 0) {
+      return Status(1, "Request failed: " + output.get("error", "<unknown>"));
+    }
+
+    return Status(0, "OK");
+  }
 };
 }
@@ -8,6 +8,8 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <boost/context/protected_fixedsize_stack.hpp>
+
 #include <benchmark/benchmark.h>
 
 #include <osquery/core.h>
@@ -15,6 +17,7 @@
 #include <osquery/sql.h>
 #include <osquery/tables.h>
 
+#include "osquery/sql/stack_pool.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
@@ -111,6 +114,36 @@ static void SQL_virtual_table_internal_yield(benchmark::State& state) {
 
 BENCHMARK(SQL_virtual_table_internal_yield);
 
+/// Create and drain a generator as a filtered generator table cursor does.
+template <typename StackAllocator>
+static void runBenchmarkGenerator(StackAllocator&& stack) {
+  RowGenerator::pull_type generator(std::forward<StackAllocator>(stack),
+                                    [](RowYield& yield) {
+                                      Row r;
+                                      r["test_int"] = "0";
+                                      yield(r);
+                                    });
+  for (const auto& r : generator) {
+    benchmark::DoNotOptimize(r);
+  }
+}
+
+static void SQL_generator_stack_fixedsize(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    runBenchmarkGenerator(boost::context::protected_fixedsize_stack());
+  }
+}
+
+BENCHMARK(SQL_generator_stack_fixedsize);
+
+static void SQL_generator_stack_pooled(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    runBenchmarkGenerator(PooledProtectedStack());
+  }
+}
+
+BENCHMARK(SQL_generator_stack_pooled);
+
 static void SQL_virtual_table_internal_global(benchmark::State& state) {
   auto tables = RegistryFactory::get().registry("table");
   tables->add("benchmark", std::make_shared<BenchmarkTablePlugin>());
@@ -189,6 +222,33 @@ static void SQL_virtual_table_internal_long(benchmark::State& state) {
 
 BENCHMARK(SQL_virtual_table_internal_long);
 
+static void SQL_virtual_table_internal_yield_join(benchmark::State& state) {
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add("benchmark_yield", std::make_shared<BenchmarkTableYieldPlugin>());
+  tables->add("long_benchmark", std::make_shared<BenchmarkLongTablePlugin>());
+
+  PluginResponse res;
+  Registry::call("table", "benchmark_yield", {{"action", "columns"}}, res);
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("benchmark_yield", columnDefinition(res), dbc);
+  Registry::call("table", "long_benchmark", {{"action", "columns"}}, res);
+  attachTableInternal("long_benchmark", columnDefinition(res), dbc);
+
+  // The generator table is filtered, and a coroutine created, per outer row.
+  // A CROSS JOIN keeps the generator table as the inner loop.
+  while (state.KeepRunning()) {
+    QueryData results;
+    queryInternal(
+        "select count(*) from long_benchmark l cross join benchmark_yield y "
+        "where y.test_text = l.test_text",
+        results,
+        dbc);
+    dbc->clearAffectedTables();
+  }
+}
+
+BENCHMARK(SQL_virtual_table_internal_yield_join);
+
 size_t kWideCount{0};
 
 class BenchmarkWideTablePlugin : public TablePlugin {
@@ -232,6 +292,22 @@ class BenchmarkWideTableYieldPlugin : public BenchmarkWideTablePlugin {
   }
 };
 
+class BenchmarkWideTableTypedPlugin : public BenchmarkWideTablePlugin {
+ public:
+  bool usesTypedRows() const override {
+    return true;
+  }
+
+  void generateRows(TableRows& results, QueryContext& ctx) override {
+    for (size_t k = 0; k < kWideCount; k++) {
+      results.addRow();
+      for (size_t i = 0; i < 20; i++) {
+        results.setInteger(i, 0);
+      }
+    }
+  }
+};
+
 static void SQL_virtual_table_internal_wide(benchmark::State& state) {
   auto tables = RegistryFactory::get().registry("table");
   tables->add("wide_benchmark", std::make_shared<BenchmarkWideTablePlugin>());
@@ -283,6 +359,32 @@ BENCHMARK(SQL_virtual_table_internal_wide_yield)
     ->ArgPair(0, 100)
     ->ArgPair(0, 1000);
 
+static void SQL_virtual_table_internal_wide_typed(benchmark::State& state) {
+  auto tables = RegistryFactory::get().registry("table");
+  tables->add("wide_benchmark_typed",
+              std::make_shared<BenchmarkWideTableTypedPlugin>());
+
+  PluginResponse res;
+  Registry::call("table", "wide_benchmark_typed", {{"action", "columns"}}, res);
+
+  // Attach a sample virtual table.
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("wide_benchmark_typed", columnDefinition(res), dbc);
+
+  kWideCount = state.range_y();
+  while (state.KeepRunning()) {
+    QueryData results;
+    queryInternal("select * from wide_benchmark_typed", results, dbc);
+    dbc->clearAffectedTables();
+  }
+}
+
+BENCHMARK(SQL_virtual_table_internal_wide_typed)
+    ->ArgPair(0, 1)
+    ->ArgPair(0, 10)
+    ->ArgPair(0, 100)
+    ->ArgPair(0, 1000);
+
 static void SQL_select_metadata(benchmark::State& state) {
   auto dbc = SQLiteDBManager::getUnique();
   while (state.KeepRunning()) {
@@ -302,4 +404,32 @@ static void SQL_select_basic(benchmark::State& state) {
 }
 
 BENCHMARK(SQL_select_basic);
+
+static void SQL_constraint_matches_range(benchmark::State& state) {
+  ConstraintList cl;
+  cl.affinity = BIGINT_TYPE;
+  cl.add(Constraint(GREATER_THAN_OR_EQUALS, "1000"));
+  cl.add(Constraint(LESS_THAN, "2000"));
+  while (state.KeepRunning()) {
+    for (long long i = 0; i < state.range_x(); i++) {
+      benchmark::DoNotOptimize(cl.matches(i));
+    }
+  }
+}
+
+BENCHMARK(SQL_constraint_matches_range)->Arg(1)->Arg(100)->Arg(10000);
+
+static void SQL_constraint_matches_like(benchmark::State& state) {
+  ConstraintList cl;
+  cl.affinity = TEXT_TYPE;
+  cl.add(Constraint(LIKE, "/usr/lib/%"));
+  std::string path = "/usr/lib/x86_64-linux-gnu/libc.so.6";
+  while (state.KeepRunning()) {
+    for (long long i = 0; i < state.range_x(); i++) {
+      benchmark::DoNotOptimize(cl.matches(path));
+    }
+  }
+}
+
+BENCHMARK(SQL_constraint_matches_like)->Arg(1)->Arg(100)->Arg(10000);
 }
@@ -0,0 +1,145 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/sql/extension_cache.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     extensions_cache_max,
+     16 * 1024 * 1024,
+     "Maximum bytes of extension table results kept by the core");
+
+DECLARE_bool(disable_caching);
+
+/// An estimate of the bytes used by a row.
+static size_t getRowSize(const Row& r) {
+  size_t size = 0;
+  for (const auto& column : r) {
+    size += column.first.size() + column.second.size();
+  }
+  return size;
+}
+
+bool ExtensionTableCache::allowed(const VirtualTableContent& table) {
+  return !FLAGS_disable_caching && FLAGS_extensions_cache_max > 0 &&
+         table.cache_ttl > 0;
+}
+
+std::string ExtensionTableCache::key(const std::string& table,
+                                     const PluginRequest& request) {
+  auto context = request.find("context");
+  if (context == request.end()) {
+    return table;
+  }
+  return table + '\n' + context->second;
+}
+
+void ExtensionTableCache::expire(size_t now) {
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.expires <= now) {
+      size_ -= it->second.size;
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool ExtensionTableCache::find(const std::string& table,
+                               const std::string& key,
+                               size_t now,
+                               QueryData& results) {
+  std::shared_ptr<const QueryData> kept;
+  {
+    WriteLock lock(mutex_);
+    auto& stats = stats_[table];
+    auto it = entries_.find(key);
+    if (it == entries_.end() || it->second.expires <= now) {
+      stats.misses++;
+      return false;
+    }
+    stats.hits++;
+    kept = it->second.results;
+  }
+
+  // Copy outside of the lock, the kept results are not changed.
+  VLOG(1) << "Retrieving results from cache for extension table: " << table;
+  results = *kept;
+  return true;
+}
+
+void ExtensionTableCache::add(const std::string& table,
+                              const std::string& key,
+                              size_t expires,
+                              const QueryData& results) {
+  size_t size = key.size();
+  for (const auto& r : results) {
+    size += getRowSize(r);
+  }
+
+  WriteLock lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    size_ -= it->second.size;
+    entries_.erase(it);
+  }
+
+  if (size_ + size > FLAGS_extensions_cache_max) {
+    // Make room by dropping expired results, the results must fit.
+    expire(getUnixTime());
+    if (size_ + size > FLAGS_extensions_cache_max) {
+      return;
+    }
+  }
+
+  Entry entry;
+  entry.table = table;
+  entry.results = std::make_shared<const QueryData>(results);
+  entry.expires = expires;
+  entry.size = size;
+  entries_[key] = std::move(entry);
+  size_ += size;
+}
+
+void ExtensionTableCache::remove(const std::string& table) {
+  WriteLock lock(mutex_);
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.table == table) {
+      size_ -= it->second.size;
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+std::map<std::string, ExtensionTableCache::Stats> ExtensionTableCache::stats()
+    const {
+  ReadLock lock(mutex_);
+  return stats_;
+}
+
+size_t ExtensionTableCache::size() const {
+  ReadLock lock(mutex_);
+  return size_;
+}
+
+void ExtensionTableCache::clear() {
+  WriteLock lock(mutex_);
+  entries_.clear();
+  stats_.clear();
+  size_ = 0;
+}
+}
@@ -0,0 +1,115 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/query.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+
+/**
+ * @brief Results of extension tables kept by the core.
+ *
+ * An extension table advertising a cache TTL in its route info has its
+ * results kept in memory, for each serialized query context, meaning the
+ * constraints, used columns, order, and limit. Repeated queries within the
+ * TTL are answered without calling the extension.
+ *
+ * The results of a table are dropped when the table is detached, such as when
+ * its extension deregisters.
+ */
+class ExtensionTableCache : private boost::noncopyable {
+ public:
+  /// Hit and miss counters of a table's cacheable scans.
+  struct Stats {
+    size_t hits{0};
+    size_t misses{0};
+  };
+
+ public:
+  static ExtensionTableCache& get() {
+    static ExtensionTableCache cache;
+    return cache;
+  }
+
+  /// Check if the results of an extension table may be kept.
+  static bool allowed(const VirtualTableContent& table);
+
+  /// The key of a table's generate request, its serialized context.
+  static std::string key(const std::string& table,
+                         const PluginRequest& request);
+
+  /**
+   * @brief Copy the kept results of a request.
+   *
+   * @param table The table name, used for the counters.
+   * @param key The request key, see ExtensionTableCache::key.
+   * @param now The current UNIX time in seconds.
+   * @param results Output, the kept results.
+   * @return true if the results were kept, otherwise a miss is counted.
+   */
+  bool find(const std::string& table,
+            const std::string& key,
+            size_t now,
+            QueryData& results);
+
+  /// Keep the results of a request until the expiration time.
+  void add(const std::string& table,
+           const std::string& key,
+           size_t expires,
+           const QueryData& results);
+
+  /// Drop the kept results of a table.
+  void remove(const std::string& table);
+
+  /// Copy the counters for each table.
+  std::map<std::string, Stats> stats() const;
+
+  /// The bytes held by the kept results.
+  size_t size() const;
+
+  /// Drop every kept result and counter.
+  void clear();
+
+ private:
+  ExtensionTableCache() = default;
+
+  /// Drop the expired results, the mutex must be held.
+  void expire(size_t now);
+
+ private:
+  struct Entry {
+    std::string table;
+    std::shared_ptr<const QueryData> results;
+    size_t expires{0};
+    size_t size{0};
+  };
+
+  /// The kept results, by request key.
+  std::unordered_map<std::string, Entry> entries_;
+
+  /// The approximate bytes of the kept results.
+  size_t size_{0};
+
+  /// Counters for each table.
+  std::map<std::string, Stats> stats_;
+
+  mutable Mutex mutex_;
+};
+}
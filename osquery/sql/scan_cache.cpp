@@ -0,0 +1,145 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/sql/scan_cache.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     scan_cache_max,
+     16 * 1024 * 1024,
+     "Maximum bytes of table scans shared by scheduled queries in one second");
+
+/// An estimate of the bytes used by a row.
+static size_t getRowSize(const Row& r) {
+  size_t size = 0;
+  for (const auto& column : r) {
+    size += column.first.size() + column.second.size();
+  }
+  return size;
+}
+
+bool SharedScanCache::allowed(const VirtualTableContent& table,
+                              const QueryContext& context) {
+  if (FLAGS_scan_cache_max == 0 || !context.useCache() || context.limit > 0) {
+    return false;
+  }
+
+  auto unshared = TableAttributes::EVENT_BASED | TableAttributes::UTILITY;
+  return (table.attributes & unshared) == 0;
+}
+
+std::string SharedScanCache::key(const std::string& table,
+                                 const QueryContext& context) {
+  std::string key = table;
+  for (const auto& column : context.constraints) {
+    if (!column.second.exists()) {
+      continue;
+    }
+
+    // The order of a column's constraints does not change the results.
+    std::vector<std::string> terms;
+    for (const auto& constraint : column.second.getAll()) {
+      terms.push_back(std::to_string(constraint.op) + ":" + constraint.expr);
+    }
+    std::sort(terms.begin(), terms.end());
+    key += '\n' + column.first;
+    for (const auto& term : terms) {
+      key += '\t' + term;
+    }
+  }
+
+  if (context.colsUsed) {
+    std::vector<std::string> columns(context.colsUsed->begin(),
+                                     context.colsUsed->end());
+    std::sort(columns.begin(), columns.end());
+    key += "\ncolumns";
+    for (const auto& column : columns) {
+      key += '\t' + column;
+    }
+  }
+  return key;
+}
+
+void SharedScanCache::expire(size_t tick) {
+  if (tick > tick_) {
+    entries_.clear();
+    size_ = 0;
+    tick_ = tick;
+  }
+}
+
+bool SharedScanCache::find(const std::string& table,
+                           const std::string& key,
+                           size_t tick,
+                           QueryData& results) {
+  std::shared_ptr<const QueryData> shared;
+  {
+    WriteLock lock(mutex_);
+    expire(tick);
+    auto& stats = stats_[table];
+    auto it = entries_.find(key);
+    if (tick != tick_ || it == entries_.end()) {
+      stats.misses++;
+      return false;
+    }
+    stats.hits++;
+    shared = it->second;
+  }
+
+  // Copy outside of the lock, the shared results are not changed.
+  VLOG(1) << "Sharing the scan of table: " << table;
+  results = *shared;
+  return true;
+}
+
+void SharedScanCache::add(const std::string& key,
+                          size_t tick,
+                          const QueryData& results) {
+  size_t size = key.size();
+  for (const auto& r : results) {
+    size += getRowSize(r);
+  }
+
+  WriteLock lock(mutex_);
+  expire(tick);
+  if (tick != tick_ || size_ + size > FLAGS_scan_cache_max ||
+      entries_.count(key) > 0) {
+    // The scan began in a passed tick, or does not fit.
+    return;
+  }
+
+  entries_[key] = std::make_shared<const QueryData>(results);
+  size_ += size;
+}
+
+std::map<std::string, SharedScanCache::Stats> SharedScanCache::stats() const {
+  ReadLock lock(mutex_);
+  return stats_;
+}
+
+size_t SharedScanCache::size() const {
+  ReadLock lock(mutex_);
+  return size_;
+}
+
+void SharedScanCache::clear() {
+  WriteLock lock(mutex_);
+  entries_.clear();
+  stats_.clear();
+  size_ = 0;
+}
+}
@@ -0,0 +1,107 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/query.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+
+/**
+ * @brief Table scans shared by the scheduled queries of the same second.
+ *
+ * Many scheduled queries select from the same tables, and are often due in
+ * the same scheduler tick. The first scan of a table within a tick is kept in
+ * memory, and reused by the following scans with identical constraints and
+ * used columns. All scans are dropped when the tick passes.
+ *
+ * Only scans requesting the warm cache, meaning scheduled queries, are shared.
+ * Scans with a LIMIT may stop early, and event-based and utility tables return
+ * different results for each query, these are never shared.
+ */
+class SharedScanCache : private boost::noncopyable {
+ public:
+  /// Hit and miss counters of a table's shareable scans.
+  struct Stats {
+    size_t hits{0};
+    size_t misses{0};
+  };
+
+ public:
+  static SharedScanCache& get() {
+    static SharedScanCache cache;
+    return cache;
+  }
+
+  /// Check if the results of a table scan may be shared.
+  static bool allowed(const VirtualTableContent& table,
+                      const QueryContext& context);
+
+  /// Normalize a scan's constraints and used columns into a key.
+  static std::string key(const std::string& table,
+                         const QueryContext& context);
+
+  /**
+   * @brief Copy the results of a scan generated during the tick.
+   *
+   * @param table The table name, used for the counters.
+   * @param key The scan key, see SharedScanCache::key.
+   * @param tick The current scheduler tick, the UNIX time in seconds.
+   * @param results Output, the shared results.
+   * @return true if the scan was shared, otherwise a miss is counted.
+   */
+  bool find(const std::string& table,
+            const std::string& key,
+            size_t tick,
+            QueryData& results);
+
+  /// Keep the results of a scan for the remainder of the tick.
+  void add(const std::string& key, size_t tick, const QueryData& results);
+
+  /// Copy the counters for each table.
+  std::map<std::string, Stats> stats() const;
+
+  /// The bytes held by the shared scans.
+  size_t size() const;
+
+  /// Drop every shared scan and counter.
+  void clear();
+
+ private:
+  SharedScanCache() = default;
+
+  /// Drop the scans when a later tick begins, the mutex must be held.
+  void expire(size_t tick);
+
+ private:
+  /// The shared scans of the current tick.
+  std::unordered_map<std::string, std::shared_ptr<const QueryData>> entries_;
+
+  /// The tick of the shared scans.
+  size_t tick_{0};
+
+  /// The approximate bytes of the shared scans.
+  size_t size_{0};
+
+  /// Counters for each table.
+  std::map<std::string, Stats> stats_;
+
+  mutable Mutex mutex_;
+};
+}
@@ -10,6 +10,12 @@
 
 #include <sstream>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/registry.h>
@@ -59,8 +65,48 @@ std::string SQL::getMessageString() const {
   return status_.toString();
 }
 
+/// Find the first byte, from an offset, below 0x20 or above 0x7F.
+static inline size_t findNonPrintableByte(const std::string& data,
+                                          size_t offset) {
+  const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+  auto size = data.size();
+  auto i = offset;
+
+  // Most values are clean, whole blocks are checked first.
+#if defined(__SSE2__)
+  // As signed bytes, those above 0x7F are negative and compare below 0x20.
+  const auto space = _mm_set1_epi8(0x20);
+  for (; i + 16 <= size; i += 16) {
+    auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+    if (_mm_movemask_epi8(_mm_cmplt_epi8(block, space)) != 0) {
+      break;
+    }
+  }
+#elif defined(__aarch64__)
+  const auto space = vdupq_n_s8(0x20);
+  for (; i + 16 <= size; i += 16) {
+    auto block = vld1q_s8(reinterpret_cast<const int8_t*>(bytes + i));
+    if (vmaxvq_u8(vcltq_s8(block, space)) != 0) {
+      break;
+    }
+  }
+#endif
+
+  for (; i < size; i++) {
+    if (bytes[i] < 0x20 || bytes[i] >= 0x80) {
+      return i;
+    }
+  }
+  return std::string::npos;
+}
+
 static inline void escapeNonPrintableBytes(std::string& data) {
-  std::string escaped;
+  auto next = findNonPrintableByte(data, 0);
+  if (next == std::string::npos) {
+    // Only replace if any escapes are needed.
+    return;
+  }
+
   // clang-format off
   char const hex_chars[16] = {
     '0', '1', '2', '3', '4', '5', '6', '7',
@@ -68,22 +114,21 @@ static inline void escapeNonPrintableBytes(std::string& data) {
   };
   // clang-format on
 
-  bool needs_replacement = false;
-  for (size_t i = 0; i < data.length(); i++) {
-    if (((unsigned char)data[i]) < 0x20 || ((unsigned char)data[i]) >= 0x80) {
-      needs_replacement = true;
-      escaped += "\\x";
-      escaped += hex_chars[(((unsigned char)data[i])) >> 4];
-      escaped += hex_chars[((unsigned char)data[i] & 0x0F) >> 0];
-    } else {
-      escaped += data[i];
-    }
-  }
-
-  // Only replace if any escapes were made.
-  if (needs_replacement) {
-    data = std::move(escaped);
+  // The printable runs between escaped bytes are copied whole.
+  std::string escaped;
+  escaped.reserve(data.size() + 16);
+  size_t start = 0;
+  while (next != std::string::npos) {
+    escaped.append(data, start, next - start);
+    auto byte = static_cast<unsigned char>(data[next]);
+    escaped += "\\x";
+    escaped += hex_chars[byte >> 4];
+    escaped += hex_chars[byte & 0x0F];
+    start = next + 1;
+    next = findNonPrintableByte(data, start);
   }
+  escaped.append(data, start, std::string::npos);
+  data = std::move(escaped);
 }
 
 void escapeNonPrintableBytesEx(std::string& data) {
@@ -92,9 +137,13 @@ void escapeNonPrintableBytesEx(std::string& data) {
 
 void SQL::escapeResults() {
   for (auto& row : results_) {
-    for (auto& column : row) {
-      escapeNonPrintableBytes(column.second);
-    }
+    escapeRow(row);
+  }
+}
+
+void SQL::escapeRow(Row& r) {
+  for (auto& column : r) {
+    escapeNonPrintableBytes(column.second);
   }
 }
 
@@ -160,7 +209,21 @@ Status SQLPlugin::call(const PluginRequest& request, PluginResponse& response) {
   return Status(1, "Unknown action");
 }
 
+/// Get the local "sql" plugin of the calling thread.
+static std::shared_ptr<SQLPlugin> getSQLPlugin() {
+  thread_local PluginHandle<SQLPlugin> handle("sql", "sql");
+  return handle.get();
+}
+
 Status query(const std::string& q, QueryData& results, bool use_cache) {
+  auto plugin = getSQLPlugin();
+  if (plugin != nullptr) {
+    results.clear();
+    return Registry::callLocal("sql", "sql", [&]() {
+      return plugin->query(q, results, use_cache);
+    });
+  }
+
   return Registry::call(
       "sql",
       "sql",
@@ -169,6 +232,17 @@ Status query(const std::string& q, QueryData& results, bool use_cache) {
 }
 
 Status getQueryColumns(const std::string& q, TableColumns& columns) {
+  auto plugin = getSQLPlugin();
+  if (plugin != nullptr) {
+    // Column options are not part of the plugin's response.
+    auto status = Registry::callLocal(
+        "sql", "sql", [&]() { return plugin->getQueryColumns(q, columns); });
+    for (auto& column : columns) {
+      std::get<2>(column) = ColumnOptions::DEFAULT;
+    }
+    return status;
+  }
+
   PluginResponse response;
   auto status = Registry::call(
       "sql", "sql", {{"action", "columns"}, {"query", q}}, response);
@@ -202,6 +276,12 @@ Status getQueryTables(const std::string& q, std::vector<std::string>& tables) {
     return mockGetQueryTables(q, tables);
   }
 
+  auto plugin = getSQLPlugin();
+  if (plugin != nullptr) {
+    return Registry::callLocal(
+        "sql", "sql", [&]() { return plugin->getQueryTables(q, tables); });
+  }
+
   PluginResponse response;
   auto status = Registry::call(
       "sql", "sql", {{"action", "tables"}, {"query", q}}, response);
@@ -211,4 +291,55 @@ Status getQueryTables(const std::string& q, std::vector<std::string>& tables) {
   }
   return status;
 }
+
+bool isQueryExclusive(const std::string& q, std::set<std::string>& tables) {
+  std::vector<std::string> used;
+  auto exclusive = !getQueryTables(q, used).ok() || used.empty();
+  auto registry = Registry::get().registry("table");
+  for (const auto& table : used) {
+    tables.insert(table);
+    if (exclusive) {
+      continue;
+    }
+
+    if (registry->getExternal().count(table) > 0) {
+      exclusive = true;
+      continue;
+    }
+
+    auto plugin =
+        std::dynamic_pointer_cast<TablePlugin>(registry->plugin(table));
+    if (plugin == nullptr ||
+        (plugin->attributes() &
+         (TableAttributes::EVENT_BASED | TableAttributes::CACHEABLE)) != 0) {
+      exclusive = true;
+    }
+  }
+  return exclusive;
+}
+
+/// The deadline of queries executed by the thread.
+static thread_local size_t kQueryDeadline{0};
+
+void setQueryDeadline(size_t deadline) {
+  kQueryDeadline = deadline;
+}
+
+size_t getQueryDeadline() {
+  return kQueryDeadline;
+}
+
+/// The result limits of queries executed by the thread.
+static thread_local QueryBudget kQueryBudget;
+
+void setQueryBudget(size_t rows, size_t bytes) {
+  kQueryBudget.rows = rows;
+  kQueryBudget.bytes = bytes;
+  kQueryBudget.truncated = false;
+  kQueryBudget.memory = 0;
+}
+
+QueryBudget& getQueryBudget() {
+  return kQueryBudget;
+}
 }
@@ -31,10 +31,11 @@ static void hashSqliteValue(sqlite3_context* ctx,
     return;
   }
 
-  // Parse and verify the split input parameters.
-  std::string input((char*)sqlite3_value_text(argv[0]));
+  // Hash the value's text in place.
+  const auto* input = sqlite3_value_text(argv[0]);
+  auto size = static_cast<size_t>(sqlite3_value_bytes(argv[0]));
 
-  auto result = hashFromBuffer(ht, input.data(), input.size());
+  auto result = hashFromBuffer(ht, input, size);
   sqlite3_result_text(
       ctx, result.c_str(), static_cast<int>(result.size()), SQLITE_TRANSIENT);
 }
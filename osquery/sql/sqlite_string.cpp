@@ -16,7 +16,8 @@
 #include <arpa/inet.h>
 #endif
 
-#include <functional>
+#include <list>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -30,8 +31,78 @@
 namespace osquery {
 
 using SplitResult = std::vector<std::string>;
-using StringSplitFunction = std::function<SplitResult(
-    const std::string& input, const std::string& tokens)>;
+
+/// A compiled pattern, shared by a connection's cache and SQLite auxdata.
+using RegexRef = std::shared_ptr<boost::regex>;
+
+/// Compiled patterns kept for each connection and function.
+const size_t kRegexCacheSize{16};
+
+/**
+ * @brief The most recently used compiled patterns of a connection.
+ *
+ * A constant pattern is compiled once per statement and kept by SQLite as
+ * auxdata. Patterns read from a column are compiled through this cache. A
+ * connection is used by a single thread at a time, the cache is not locked.
+ */
+class RegexCache {
+ public:
+  /// Get a compiled pattern, throws boost::regex_error if it is invalid.
+  RegexRef get(const std::string& pattern) {
+    for (auto it = patterns_.begin(); it != patterns_.end(); ++it) {
+      if (it->first == pattern) {
+        patterns_.splice(patterns_.begin(), patterns_, it);
+        return it->second;
+      }
+    }
+
+    auto regex = std::make_shared<boost::regex>(pattern);
+    patterns_.emplace_front(pattern, regex);
+    if (patterns_.size() > kRegexCacheSize) {
+      patterns_.pop_back();
+    }
+    return regex;
+  }
+
+ private:
+  std::list<std::pair<std::string, RegexRef>> patterns_;
+};
+
+static void deleteRegexCache(void* cache) {
+  delete static_cast<RegexCache*>(cache);
+}
+
+static void deleteRegexRef(void* regex) {
+  delete static_cast<RegexRef*>(regex);
+}
+
+/**
+ * @brief Get the compiled pattern of a function argument.
+ *
+ * The function's user data is its connection's RegexCache. On failure the
+ * result is set to an error and nullptr is returned.
+ */
+static RegexRef getRegexArgument(sqlite3_context* context,
+                                 sqlite3_value** argv,
+                                 int arg) {
+  auto aux = static_cast<RegexRef*>(sqlite3_get_auxdata(context, arg));
+  if (aux != nullptr) {
+    return *aux;
+  }
+
+  RegexRef regex;
+  std::string pattern((char*)sqlite3_value_text(argv[arg]));
+  try {
+    regex = static_cast<RegexCache*>(sqlite3_user_data(context))->get(pattern);
+  } catch (const boost::regex_error& /* e */) {
+    sqlite3_result_error(context, "Invalid regex pattern", -1);
+    return nullptr;
+  }
+
+  // SQLite keeps the auxdata while the argument is constant.
+  sqlite3_set_auxdata(context, arg, new RegexRef(regex), deleteRegexRef);
+  return regex;
+}
 
 /**
  * @brief A simple SQLite column string split implementation.
@@ -68,36 +139,42 @@ static SplitResult tokenSplit(const std::string& input,
  *      192.168
  */
 static SplitResult regexSplit(const std::string& input,
-                              const std::string& token) {
+                              const boost::regex& token) {
   // Split using the token as a regex to support multi-character tokens.
   std::vector<std::string> result;
-  boost::algorithm::split_regex(result, input, boost::regex(token));
+  boost::algorithm::split_regex(result, input, token);
   return result;
 }
 
-static void callStringSplitFunc(sqlite3_context* context,
-                                int argc,
-                                sqlite3_value** argv,
-                                StringSplitFunction f) {
+/// Parse and verify the split input parameters, false if a result is set.
+static bool getSplitArguments(sqlite3_context* context,
+                              int argc,
+                              sqlite3_value** argv,
+                              std::string& input,
+                              std::string& token,
+                              size_t& index) {
   assert(argc == 3);
   if (SQLITE_NULL == sqlite3_value_type(argv[0]) ||
       SQLITE_NULL == sqlite3_value_type(argv[1]) ||
       SQLITE_NULL == sqlite3_value_type(argv[2])) {
     sqlite3_result_null(context);
-    return;
+    return false;
   }
 
-  // Parse and verify the split input parameters.
-  std::string input((char*)sqlite3_value_text(argv[0]));
-  std::string token((char*)sqlite3_value_text(argv[1]));
-  auto index = static_cast<size_t>(sqlite3_value_int(argv[2]));
+  input = (char*)sqlite3_value_text(argv[0]);
+  token = (char*)sqlite3_value_text(argv[1]);
+  index = static_cast<size_t>(sqlite3_value_int(argv[2]));
   if (token.empty()) {
     // Allow the input string to be empty.
     sqlite3_result_error(context, "Invalid input to split function", -1);
-    return;
+    return false;
   }
+  return true;
+}
 
-  auto result = f(input, token);
+static void resultSplitIndex(sqlite3_context* context,
+                             const SplitResult& result,
+                             size_t index) {
   if (index >= result.size()) {
     // Could emit a warning about a selected index that is out of bounds.
     sqlite3_result_null(context);
@@ -115,13 +192,71 @@ static void callStringSplitFunc(sqlite3_context* context,
 static void tokenStringSplitFunc(sqlite3_context* context,
                                  int argc,
                                  sqlite3_value** argv) {
-  callStringSplitFunc(context, argc, argv, tokenSplit);
+  std::string input;
+  std::string token;
+  size_t index = 0;
+  if (getSplitArguments(context, argc, argv, input, token, index)) {
+    resultSplitIndex(context, tokenSplit(input, token), index);
+  }
 }
 
 static void regexStringSplitFunc(sqlite3_context* context,
                                  int argc,
                                  sqlite3_value** argv) {
-  callStringSplitFunc(context, argc, argv, regexSplit);
+  std::string input;
+  std::string token;
+  size_t index = 0;
+  if (!getSplitArguments(context, argc, argv, input, token, index)) {
+    return;
+  }
+
+  auto regex = getRegexArgument(context, argv, 1);
+  if (regex != nullptr) {
+    resultSplitIndex(context, regexSplit(input, *regex), index);
+  }
+}
+
+/**
+ * @brief Search a column value with a regex and select a matched group.
+ *
+ * Group 0 is the entire match. If the value does not match, or the group did
+ * not participate in the match, a NULL type is returned.
+ *
+ * Example:
+ *   1. SELECT path from file where directory = "/usr/bin";
+ *      /usr/bin/python2.7
+ *   2. SELECT REGEX_MATCH(path, "python([0-9.]+)$", 1) from file ...;
+ *      2.7
+ */
+static void regexStringMatchFunc(sqlite3_context* context,
+                                 int argc,
+                                 sqlite3_value** argv) {
+  assert(argc == 3);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0]) ||
+      SQLITE_NULL == sqlite3_value_type(argv[1]) ||
+      SQLITE_NULL == sqlite3_value_type(argv[2])) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  auto regex = getRegexArgument(context, argv, 1);
+  if (regex == nullptr) {
+    return;
+  }
+
+  auto input = (const char*)sqlite3_value_text(argv[0]);
+  auto index = static_cast<size_t>(sqlite3_value_int(argv[2]));
+  boost::cmatch match;
+  if (!boost::regex_search(input, match, *regex) || index >= match.size() ||
+      !match[index].matched) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  sqlite3_result_text(context,
+                      match[index].first,
+                      static_cast<int>(match[index].length()),
+                      SQLITE_TRANSIENT);
 }
 
 /**
@@ -161,14 +296,24 @@ void registerStringExtensions(sqlite3* db) {
                           tokenStringSplitFunc,
                           nullptr,
                           nullptr);
-  sqlite3_create_function(db,
-                          "regex_split",
-                          3,
-                          SQLITE_UTF8,
-                          nullptr,
-                          regexStringSplitFunc,
-                          nullptr,
-                          nullptr);
+  sqlite3_create_function_v2(db,
+                             "regex_split",
+                             3,
+                             SQLITE_UTF8,
+                             new RegexCache(),
+                             regexStringSplitFunc,
+                             nullptr,
+                             nullptr,
+                             deleteRegexCache);
+  sqlite3_create_function_v2(db,
+                             "regex_match",
+                             3,
+                             SQLITE_UTF8,
+                             new RegexCache(),
+                             regexStringMatchFunc,
+                             nullptr,
+                             nullptr,
+                             deleteRegexCache);
   sqlite3_create_function(db,
                           "inet_aton",
                           1,
@@ -8,10 +8,16 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+#include <cctype>
+
+#include <boost/algorithm/string/predicate.hpp>
+
 #include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
+#include <osquery/system.h>
 
 #include "osquery/sql/sqlite_util.h"
 #include "osquery/sql/virtual_table.h"
@@ -25,10 +31,58 @@ FLAG(string,
 
 FLAG(string, nullvalue, "", "Set string for NULL values, default ''");
 
+FLAG(uint32,
+     sql_statement_cache_size,
+     512,
+     "Maximum prepared statements cached by each SQLite connection");
+
+FLAG(uint32,
+     sql_connection_pool_size,
+     4,
+     "Maximum idle SQLite connections kept for concurrent queries");
+
+FLAG(uint64,
+     sqlite_soft_heap_limit,
+     1,
+     "Bytes of SQLite heap before caches are released, 0 for no limit");
+
+FLAG(uint64,
+     sqlite_hard_heap_limit,
+     0,
+     "Bytes of SQLite heap past which queries fail, 0 for no limit");
+
+FLAG(uint32,
+     sqlite_lookaside_size,
+     0,
+     "Bytes of each SQLite connection lookaside slot, 0 for the default");
+
+FLAG(uint32,
+     sqlite_lookaside_slots,
+     0,
+     "Number of SQLite connection lookaside slots, 0 for the default");
+
+FLAG(uint32,
+     sqlite_cache_size,
+     0,
+     "KiB of page cache for each SQLite connection");
+
+FLAG(string,
+     sqlite_temp_store,
+     "",
+     "Store SQLite sorts and temporary tables in 'memory' or 'file'");
+
+FLAG(string,
+     sqlite_temp_directory,
+     "",
+     "Directory of SQLite temporary files, with --sqlite_temp_store=file");
+
 using OpReg = QueryPlanner::Opcode::Register;
 
 using SQLiteDBInstanceRef = std::shared_ptr<SQLiteDBInstance>;
 
+/// Virtual machine instructions between checks of a query's deadline and heap.
+const int kDeadlineInstructions{1000};
+
 /**
  * @brief A map of SQLite status codes to their corresponding message string
  *
@@ -163,8 +217,21 @@ Status SQLiteSQLPlugin::getQueryColumns(const std::string& query,
 Status SQLiteSQLPlugin::getQueryTables(const std::string& query,
                                        std::vector<std::string>& tables) const {
   auto dbc = SQLiteDBManager::get();
+  auto lock = dbc->attachLock();
+  auto* statements = dbc->statements();
+  if (statements != nullptr) {
+    auto* cached = statements->find(query);
+    if (cached != nullptr && cached->tables) {
+      tables = *cached->tables;
+      return Status(0);
+    }
+  }
+
   QueryPlanner planner(query, dbc);
   tables = planner.tables();
+  if (statements != nullptr) {
+    statements->get(query).tables = tables;
+  }
   return Status(0);
 }
 
@@ -180,6 +247,21 @@ SQLInternal::SQLInternal(const std::string& query, bool use_cache) {
   dbc->clearAffectedTables();
 }
 
+SQLInternal::SQLInternal(const std::string& query,
+                         const RowCallback& callback,
+                         bool use_cache) {
+  auto dbc = SQLiteDBManager::get();
+  dbc->useCache(use_cache);
+  status_ = queryInternal(query, callback, dbc);
+  event_based_ = (dbc->getAttributes() & TableAttributes::EVENT_BASED) != 0;
+  dbc->clearAffectedTables();
+}
+
+SQLInternal::SQLInternal(QueryData results, const Status& status) {
+  results_ = std::move(results);
+  status_ = status;
+}
+
 bool SQLInternal::eventBased() const {
   return event_based_;
 }
@@ -192,6 +274,8 @@ Status SQLiteSQLPlugin::attach(const std::string& name) {
     return status;
   }
 
+  // The plugin may have changed, virtual tables request the columns again.
+  clearTableColumns(name);
   auto statement = columnDefinition(response);
   // Attach requests occurring via the plugin/registry APIs must act on the
   // primary database. To allow this, getConnection can explicitly request the
@@ -201,6 +285,7 @@ Status SQLiteSQLPlugin::attach(const std::string& name) {
 }
 
 void SQLiteSQLPlugin::detach(const std::string& name) {
+  clearTableColumns(name);
   auto dbc = SQLiteDBManager::get();
   if (!dbc->isPrimary()) {
     return;
@@ -213,19 +298,38 @@ SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db, Mutex& mtx)
   if (lock_.owns_lock()) {
     primary_ = true;
   } else {
+    // The DB manager provides a pooled connection instead.
     db_ = nullptr;
-    VLOG(1) << "DBManager contention: opening transient SQLite database";
-    init();
   }
 }
 
 static inline void openOptimized(sqlite3*& db) {
   sqlite3_open(":memory:", &db);
 
+  // Lookaside slots must be configured before the connection allocates.
+  if (FLAGS_sqlite_lookaside_size > 0 && FLAGS_sqlite_lookaside_slots > 0) {
+    sqlite3_db_config(db,
+                      SQLITE_DBCONFIG_LOOKASIDE,
+                      nullptr,
+                      static_cast<int>(FLAGS_sqlite_lookaside_size),
+                      static_cast<int>(FLAGS_sqlite_lookaside_slots));
+  }
+
   std::string settings;
   for (const auto& setting : kMemoryDBSettings) {
     settings += "PRAGMA " + setting.first + "=" + setting.second + "; ";
   }
+
+  // A negative cache size is a limit in KiB, rather than pages.
+  if (FLAGS_sqlite_cache_size > 0) {
+    settings += "PRAGMA cache_size=-" +
+                std::to_string(FLAGS_sqlite_cache_size) + "; ";
+  }
+  if (FLAGS_sqlite_temp_store == "memory") {
+    settings += "PRAGMA temp_store=2; ";
+  } else if (FLAGS_sqlite_temp_store == "file") {
+    settings += "PRAGMA temp_store=1; ";
+  }
   sqlite3_exec(db, settings.c_str(), nullptr, nullptr, nullptr);
 
   // Register function extensions.
@@ -265,6 +369,84 @@ void SQLiteDBInstance::addAffectedTable(VirtualTableContent* table) {
   affected_tables_.insert(std::make_pair(table->name, table));
 }
 
+Arena* SQLiteDBInstance::acquireArena() {
+  if (!free_arenas_.empty()) {
+    auto* arena = free_arenas_.back();
+    free_arenas_.pop_back();
+    return arena;
+  }
+
+  arenas_.push_back(std::make_unique<Arena>());
+  return arenas_.back().get();
+}
+
+void SQLiteDBInstance::releaseArena(Arena* arena) {
+  if (arena != nullptr) {
+    arena->reset();
+    free_arenas_.push_back(arena);
+  }
+}
+
+SQLiteStatementCache* SQLiteDBInstance::statements() {
+  if (FLAGS_sql_statement_cache_size == 0 || !(isPrimary() || pooled_)) {
+    return nullptr;
+  }
+  return &connection()->statements_;
+}
+
+SQLiteDBInstance* SQLiteDBInstance::connection() {
+  if (isPrimary() && !managed_) {
+    // Similarly to clearAffectedTables, the connection may be forwarded.
+    return SQLiteDBManager::getConnection(true).get();
+  }
+  return this;
+}
+
+bool SQLiteDBInstance::tableAttached(const std::string& name) {
+  return connection()->attached_tables_.count(name) > 0;
+}
+
+void SQLiteDBInstance::setTableAttached(const std::string& name,
+                                        bool attached,
+                                        const std::string& statement) {
+  auto& tables = connection()->attached_tables_;
+  if (attached) {
+    tables[name] = statement;
+  } else {
+    tables.erase(name);
+  }
+}
+
+void SQLiteDBInstance::refreshTables() {
+  auto lock(attachLock());
+  std::vector<std::string> changed;
+  for (const auto& table : attached_tables_) {
+    if (getTableDefinition(table.first) != table.second) {
+      changed.push_back(table.first);
+    }
+  }
+
+  for (const auto& name : changed) {
+    auto format = "DROP TABLE IF EXISTS temp." + name;
+    sqlite3_exec(db_, format.c_str(), nullptr, nullptr, nullptr);
+    attached_tables_.erase(name);
+  }
+
+  if (!changed.empty()) {
+    // Cached statements may reference the tables, see attachTableInternal.
+    statements_.clear();
+  }
+  sqlite3_db_release_memory(db_);
+}
+
+size_t SQLiteDBInstance::arenaReserved() const {
+  size_t reserved = 0;
+  for (const auto& arena : arenas_) {
+    reserved += arena->reserved();
+  }
+  return reserved;
+}
+
 bool SQLiteDBInstance::tableCalled(VirtualTableContent* table) {
   return (affected_tables_.count(table->name) > 0);
 }
@@ -293,16 +475,27 @@ void SQLiteDBInstance::clearAffectedTables() {
 
   for (const auto& table : affected_tables_) {
     table.second->constraints.clear();
+    table.second->colsUsed.clear();
+    table.second->scanPlans.clear();
+    table.second->scanMemos.clear();
     table.second->cache.clear();
   }
   // Since the affected tables are cleared, there are no more affected tables.
   // There is no concept of compounding tables between queries.
   affected_tables_.clear();
   use_cache_ = false;
+
+  // Release all per-query arena memory, unless a cursor is still open.
+  if (free_arenas_.size() == arenas_.size()) {
+    free_arenas_.clear();
+    arenas_.clear();
+  }
 }
 
 SQLiteDBInstance::~SQLiteDBInstance() {
   if (!isPrimary() && db_ != nullptr) {
+    // The database cannot be closed while statements are not finalized.
+    statements_.clear();
     sqlite3_close(db_);
   } else {
     db_ = nullptr;
@@ -310,7 +503,17 @@ SQLiteDBInstance::~SQLiteDBInstance() {
 }
 
 SQLiteDBManager::SQLiteDBManager() : db_(nullptr) {
-  sqlite3_soft_heap_limit64(1);
+  sqlite3_soft_heap_limit64(FLAGS_sqlite_soft_heap_limit);
+#if SQLITE_VERSION_NUMBER >= 3031000
+  sqlite3_hard_heap_limit64(FLAGS_sqlite_hard_heap_limit);
+#endif
+
+  // Temporary files are created in the directory, rather than the default.
+  if (FLAGS_sqlite_temp_store == "file" &&
+      !FLAGS_sqlite_temp_directory.empty()) {
+    sqlite3_temp_directory =
+        sqlite3_mprintf("%s", FLAGS_sqlite_temp_directory.c_str());
+  }
   setDisabledTables(Flag::getValue("disable_tables"));
 }
 
@@ -323,8 +526,17 @@ void SQLiteDBManager::resetPrimary() {
   auto& self = instance();
 
   WriteLock connection_lock(self.mutex_);
+  if (self.connection_ != nullptr) {
+    // The database cannot be closed while statements are not finalized.
+    self.connection_->statements_.clear();
+  }
   self.connection_.reset();
 
+  {
+    WriteLock pool_lock(self.pool_mutex_);
+    self.pool_.clear();
+  }
+
   {
     WriteLock create_lock(self.create_mutex_);
     sqlite3_close(self.db_);
@@ -332,6 +544,20 @@ void SQLiteDBManager::resetPrimary() {
   }
 }
 
+void SQLiteDBManager::refreshPrimary() {
+  auto& self = instance();
+
+  WriteLock connection_lock(self.mutex_);
+  if (self.connection_ != nullptr) {
+    self.connection_->refreshTables();
+  }
+
+  WriteLock pool_lock(self.pool_mutex_);
+  for (auto& dbc : self.pool_) {
+    dbc->refreshTables();
+  }
+}
+
 void SQLiteDBManager::setDisabledTables(const std::string& list) {
   const auto& tables = split(list, ",");
   disabled_tables_ =
@@ -362,13 +588,59 @@ SQLiteDBInstanceRef SQLiteDBManager::getConnection(bool primary) {
 
   // Create a 'database connection' for the managed database instance.
   auto instance = std::make_shared<SQLiteDBInstance>(self.db_, self.mutex_);
-  if (!instance->isPrimary()) {
+  if (instance->isPrimary()) {
+    return instance;
+  }
+
+  lock.unlock();
+  return getPooled();
+}
+
+SQLiteDBInstanceRef SQLiteDBManager::getPooled() {
+  auto& self = instance();
+  SQLiteDBInstance* dbc = nullptr;
+  {
+    WriteLock lock(self.pool_mutex_);
+    if (!self.pool_.empty()) {
+      dbc = self.pool_.back().release();
+      self.pool_.pop_back();
+    }
+  }
+
+  bool opened = (dbc == nullptr);
+  if (opened) {
+    VLOG(1) << "DBManager contention: opening pooled SQLite database";
+    dbc = new SQLiteDBInstance();
+    dbc->pooled_ = true;
+  }
+
+  auto instance = SQLiteDBInstanceRef(dbc, &SQLiteDBManager::release);
+  if (opened) {
     attachVirtualTables(instance);
   }
   return instance;
 }
 
+void SQLiteDBManager::release(SQLiteDBInstance* dbc) {
+  // Per-query state is not kept, the tables and statements are.
+  dbc->clearAffectedTables();
+
+  auto& self = instance();
+  {
+    WriteLock lock(self.pool_mutex_);
+    if (self.pool_.size() < FLAGS_sql_connection_pool_size) {
+      self.pool_.emplace_back(dbc);
+      return;
+    }
+  }
+  delete dbc;
+}
+
 SQLiteDBManager::~SQLiteDBManager() {
+  pool_.clear();
+  if (connection_ != nullptr) {
+    connection_->statements_.clear();
+  }
   connection_ = nullptr;
   if (db_ != nullptr) {
     sqlite3_close(db_);
@@ -376,6 +648,114 @@ SQLiteDBManager::~SQLiteDBManager() {
   }
 }
 
+SQLiteStatementCache::Entry* SQLiteStatementCache::find(
+    const std::string& query) {
+  auto it = index_.find(query);
+  if (it == index_.end()) {
+    return nullptr;
+  }
+
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return &it->second->second;
+}
+
+SQLiteStatementCache::Entry& SQLiteStatementCache::get(
+    const std::string& query) {
+  auto* entry = find(query);
+  if (entry != nullptr) {
+    return *entry;
+  }
+
+  entries_.emplace_front(query, Entry());
+  index_[query] = entries_.begin();
+  evict();
+  return entries_.front().second;
+}
+
+SQLiteStatementCache::Entry SQLiteStatementCache::take(
+    const std::string& query) {
+  Entry entry;
+  auto it = index_.find(query);
+  if (it != index_.end()) {
+    entry = std::move(it->second->second);
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+  entry.generation = generation_;
+  return entry;
+}
+
+void SQLiteStatementCache::put(const std::string& query, Entry&& entry) {
+  if (entry.generation != generation_) {
+    // The cache was cleared, the statement is finalized when dropped.
+    return;
+  }
+
+  auto it = index_.find(query);
+  if (it != index_.end()) {
+    // Introspection, or a nested execution, recorded the query meanwhile.
+    auto& existing = it->second->second;
+    if (existing.stmt == nullptr) {
+      existing.stmt = std::move(entry.stmt);
+      existing.plans = std::move(entry.plans);
+    }
+    if (!existing.columns) {
+      existing.columns = std::move(entry.columns);
+    }
+    if (!existing.tables) {
+      existing.tables = std::move(entry.tables);
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+
+  if (entry.stmt == nullptr && !entry.columns && !entry.tables) {
+    return;
+  }
+  entries_.emplace_front(query, std::move(entry));
+  index_[query] = entries_.begin();
+  evict();
+}
+
+void SQLiteStatementCache::clear() {
+  index_.clear();
+  entries_.clear();
+  planned_.clear();
+  generation_++;
+}
+
+void SQLiteStatementCache::evict() {
+  while (entries_.size() > FLAGS_sql_statement_cache_size) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+void SQLiteStatementCache::addPlan(VirtualTableContent* table, size_t index) {
+  TablePlan plan;
+  plan.table = table;
+  plan.index = index;
+  plan.constraints = table->constraints[index];
+  plan.colsUsed = table->colsUsed[index];
+  plan.scan = table->scanPlans[index];
+  planned_.push_back(std::move(plan));
+}
+
+std::vector<SQLiteStatementCache::TablePlan> SQLiteStatementCache::takePlans() {
+  std::vector<TablePlan> plans;
+  plans.swap(planned_);
+  return plans;
+}
+
+void SQLiteStatementCache::restorePlans(const Entry& entry) {
+  // The constraint sets are cleared from the tables after each query.
+  for (const auto& plan : entry.plans) {
+    plan.table->constraints[plan.index] = plan.constraints;
+    plan.table->colsUsed[plan.index] = plan.colsUsed;
+    plan.table->scanPlans[plan.index] = plan.scan;
+  }
+}
+
 QueryPlanner::QueryPlanner(const std::string& query,
                            const SQLiteDBInstanceRef& instance) {
   QueryData plan;
@@ -426,14 +806,7 @@ Status QueryPlanner::applyTypes(TableColumns& columns) {
   return Status(0);
 }
 
-int queryDataCallback(void* argument, int argc, char* argv[], char* column[]) {
-  if (argument == nullptr) {
-    VLOG(1) << "Query execution failed: received a bad callback argument";
-    return SQLITE_MISUSE;
-  }
-
-  auto qData = static_cast<QueryData*>(argument);
-  Row r;
+static inline void fillRow(Row& r, int argc, char* argv[], char* column[]) {
   for (int i = 0; i < argc; i++) {
     if (column[i] != nullptr) {
       if (r.count(column[i])) {
@@ -444,17 +817,43 @@ int queryDataCallback(void* argument, int argc, char* argv[], char* column[]) {
       r[column[i]] = (argv[i] != nullptr) ? argv[i] : FLAGS_nullvalue;
     }
   }
+}
+
+int queryDataCallback(void* argument, int argc, char* argv[], char* column[]) {
+  if (argument == nullptr) {
+    VLOG(1) << "Query execution failed: received a bad callback argument";
+    return SQLITE_MISUSE;
+  }
+
+  auto qData = static_cast<QueryData*>(argument);
+  Row r;
+  fillRow(r, argc, argv, column);
   (*qData).push_back(std::move(r));
   return 0;
 }
 
-Status queryInternal(const std::string& q,
-                     QueryData& results,
-                     const SQLiteDBInstanceRef& instance) {
+int queryRowCallback(void* argument, int argc, char* argv[], char* column[]) {
+  if (argument == nullptr) {
+    VLOG(1) << "Query execution failed: received a bad callback argument";
+    return SQLITE_MISUSE;
+  }
+
+  auto callback = static_cast<const RowCallback*>(argument);
+  Row r;
+  fillRow(r, argc, argv, column);
+  return ((*callback)(r)) ? 0 : SQLITE_ABORT;
+}
+
+/// Execute a query with sqlite3_exec, the text may contain many statements.
+static Status execInternal(const std::string& q,
+                           const RowCallback& callback,
+                           sqlite3* db) {
   char* err = nullptr;
-  auto lock = instance->attachLock();
-  sqlite3_exec(instance->db(), q.c_str(), queryDataCallback, &results, &err);
-  sqlite3_db_release_memory(instance->db());
+  sqlite3_exec(db,
+               q.c_str(),
+               queryRowCallback,
+               const_cast<RowCallback*>(&callback),
+               &err);
   if (err != nullptr) {
     auto error_string = std::string(err);
     sqlite3_free(err);
@@ -463,6 +862,189 @@ Status queryInternal(const std::string& q,
   return Status(0, "OK");
 }
 
+/// Step a prepared statement, handing each result row to the callback.
+static int stepStatement(sqlite3_stmt* stmt, const RowCallback& callback) {
+  int rc = SQLITE_OK;
+  auto argc = sqlite3_column_count(stmt);
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    Row r;
+    for (int i = 0; i < argc; i++) {
+      auto column = sqlite3_column_name(stmt, i);
+      if (column == nullptr) {
+        continue;
+      }
+      if (r.count(column)) {
+        // Found a column name collision in the result.
+        VLOG(1) << "Detected overloaded column name " << column
+                << " in query result consider using aliases";
+      }
+      auto value = (const char*)sqlite3_column_text(stmt, i);
+      r[column] = (value != nullptr) ? value : FLAGS_nullvalue;
+    }
+
+    if (!callback(r)) {
+      return SQLITE_ABORT;
+    }
+  }
+  return rc;
+}
+
+/// Execute a query using, or adding to, the instance's statement cache.
+static Status executeCached(const std::string& q,
+                            const RowCallback& callback,
+                            sqlite3* db,
+                            SQLiteStatementCache& statements) {
+  auto entry = statements.take(q);
+  if (entry.stmt == nullptr) {
+    // Planned constraint sets not taken by a statement are stale.
+    statements.takePlans();
+
+    sqlite3_stmt* stmt = nullptr;
+    const char* tail = nullptr;
+    auto rc = sqlite3_prepare_v2(
+        db, q.c_str(), static_cast<int>(q.size()), &stmt, &tail);
+    entry.stmt.reset(stmt);
+    entry.plans = statements.takePlans();
+    if (rc != SQLITE_OK) {
+      auto status =
+          Status(1, "Error running query: " + std::string(sqlite3_errmsg(db)));
+      entry.stmt.reset();
+      statements.put(q, std::move(entry));
+      return status;
+    }
+
+    bool single = true;
+    for (; tail != nullptr && *tail != 0; tail++) {
+      if (!std::isspace(static_cast<unsigned char>(*tail))) {
+        single = false;
+        break;
+      }
+    }
+
+    if (!single || entry.stmt == nullptr) {
+      // Only single statements are cached, others are executed as before.
+      entry.stmt.reset();
+      entry.plans.clear();
+      statements.put(q, std::move(entry));
+      return (single) ? Status(0, "OK") : execInternal(q, callback, db);
+    }
+  } else {
+    SQLiteStatementCache::restorePlans(entry);
+  }
+
+  auto rc = stepStatement(entry.stmt.get(), callback);
+  auto status = Status(0, "OK");
+  if (rc != SQLITE_DONE) {
+    // A stopped callback is reported as sqlite3_exec would, as aborted.
+    std::string error =
+        (rc == SQLITE_ABORT) ? sqlite3_errstr(rc) : sqlite3_errmsg(db);
+    status = Status(1, "Error running query: " + error);
+  }
+  sqlite3_reset(entry.stmt.get());
+
+  // SQLite re-prepares a statement if the schema changed, planning again.
+  auto plans = statements.takePlans();
+  if (!plans.empty()) {
+    entry.plans = std::move(plans);
+  }
+  statements.put(q, std::move(entry));
+  return status;
+}
+
+Status queryInternal(const std::string& q,
+                     QueryData& results,
+                     const SQLiteDBInstanceRef& instance) {
+  return queryInternal(q,
+                       [&results](Row& r) {
+                         results.push_back(std::move(r));
+                         return true;
+                       },
+                       instance);
+}
+
+/// The state of a query checked between virtual machine instructions.
+struct QueryProgress {
+  /// The UNIX time the query is interrupted, 0 for no deadline.
+  size_t deadline{0};
+
+  /// The most bytes of SQLite heap observed while executing.
+  sqlite3_int64 memory{0};
+};
+
+/// Record the SQLite heap and interrupt a query past its thread's deadline.
+static int checkQueryProgress(void* data) {
+  auto* progress = static_cast<QueryProgress*>(data);
+  progress->memory = std::max(progress->memory, sqlite3_memory_used());
+  return (progress->deadline > 0 && getUnixTime() >= progress->deadline) ? 1
+                                                                         : 0;
+}
+
+Status queryInternal(const std::string& q,
+                     const RowCallback& callback,
+                     const SQLiteDBInstanceRef& instance) {
+  auto lock = instance->attachLock();
+  attachQueryTables(q, instance);
+  auto* statements = instance->statements();
+
+  // The budget applies to this query, not to queries its tables execute.
+  auto budget = getQueryBudget();
+  setQueryBudget(0, 0);
+  RowCallback limited;
+  if (budget.rows > 0 || budget.bytes > 0) {
+    size_t rows = 0;
+    size_t bytes = 0;
+    limited = [&budget, &callback, rows, bytes](Row& r) mutable {
+      size_t size = 0;
+      for (const auto& column : r) {
+        size += column.first.size() + column.second.size();
+      }
+
+      // Stepping stops before the row over the budget, as if it completed.
+      if ((budget.rows > 0 && rows >= budget.rows) ||
+          (budget.bytes > 0 && bytes + size > budget.bytes)) {
+        budget.truncated = true;
+        return false;
+      }
+      rows++;
+      bytes += size;
+      return callback(r);
+    };
+  }
+  const auto& consumer = (limited != nullptr) ? limited : callback;
+
+  // The deadline and heap are checked between virtual machine instructions.
+  QueryProgress progress;
+  progress.deadline = getQueryDeadline();
+  auto memory = sqlite3_memory_used();
+  progress.memory = memory;
+  sqlite3_progress_handler(
+      instance->db(), kDeadlineInstructions, checkQueryProgress, &progress);
+
+  Status status;
+  if (statements != nullptr && !boost::istarts_with(q, "EXPLAIN")) {
+    status = executeCached(q, consumer, instance->db(), *statements);
+  } else {
+    // The QueryPlanner results are cached, not its EXPLAIN statements.
+    status = execInternal(q, consumer, instance->db());
+    if (statements != nullptr) {
+      statements->takePlans();
+    }
+  }
+
+  sqlite3_progress_handler(instance->db(), 0, nullptr, nullptr);
+  checkQueryProgress(&progress);
+  sqlite3_db_release_memory(instance->db());
+
+  // The heap is shared by every connection, this is an approximation.
+  budget.memory = static_cast<size_t>(progress.memory - memory);
+
+  if (budget.truncated) {
+    status = Status(0, "OK");
+  }
+  getQueryBudget() = budget;
+  return status;
+}
+
 Status getQueryColumnsInternal(const std::string& q,
                                TableColumns& columns,
                                const SQLiteDBInstanceRef& instance) {
@@ -470,6 +1052,15 @@ Status getQueryColumnsInternal(const std::string& q,
   TableColumns results;
   {
     auto lock = instance->attachLock();
+    attachQueryTables(q, instance);
+    auto* statements = instance->statements();
+    if (statements != nullptr) {
+      auto* cached = statements->find(q);
+      if (cached != nullptr && cached->columns) {
+        columns = *cached->columns;
+        return Status(0, "OK");
+      }
+    }
 
     // Turn the query into a prepared statement
     sqlite3_stmt* stmt{nullptr};
@@ -515,6 +1106,10 @@ Status getQueryColumnsInternal(const std::string& q,
       planner.applyTypes(results);
     }
     sqlite3_finalize(stmt);
+
+    if (status.ok() && statements != nullptr) {
+      statements->get(q).columns = results;
+    }
   }
 
   if (status.ok()) {
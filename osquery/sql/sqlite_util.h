@@ -11,22 +11,135 @@
 #pragma once
 
 #include <atomic>
+#include <functional>
+#include <list>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <sqlite3.h>
 
 #include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
 
 #include <osquery/sql.h>
 
+#include "osquery/core/arena.h"
+
 #define SQLITE_SOFT_HEAP_LIMIT (5 * 1024 * 1024)
 
 namespace osquery {
 
 class SQLiteDBManager;
 
+/// Finalize an owned prepared statement.
+struct SQLiteStatementDeleter {
+  void operator()(sqlite3_stmt* stmt) const {
+    sqlite3_finalize(stmt);
+  }
+};
+
+using SQLiteStatementRef =
+    std::unique_ptr<sqlite3_stmt, SQLiteStatementDeleter>;
+
+/**
+ * @brief A least-recently-used cache of prepared statements and query metadata.
+ *
+ * Scheduled and distributed queries repeat the same text. A cached statement
+ * is prepared, and its virtual table constraints planned, once rather than on
+ * every execution. The scanned tables and result columns of a query are also
+ * cached such that only the first introspection runs a QueryPlanner.
+ *
+ * The cache is owned by a single connection and must only be accessed while
+ * holding the connection's attach lock. Attaching or detaching a table clears
+ * the cache, since statements and metadata depend on the schema.
+ */
+class SQLiteStatementCache : private boost::noncopyable {
+ public:
+  /// A constraint set planned by xBestIndex while preparing a statement.
+  struct TablePlan {
+    VirtualTableContent* table{nullptr};
+    size_t index{0};
+    ConstraintSet constraints;
+    UsedColumns colsUsed;
+    TableScanPlan scan;
+  };
+
+  struct Entry {
+    /// The prepared statement, empty if the query has not been executed.
+    SQLiteStatementRef stmt;
+
+    /// The constraint sets restored to the tables before each execution.
+    std::vector<TablePlan> plans;
+
+    /// The result columns and types, see getQueryColumnsInternal.
+    boost::optional<TableColumns> columns;
+
+    /// The tables scanned, see QueryPlanner::tables.
+    boost::optional<std::vector<std::string>> tables;
+
+    /// The cache generation the entry was taken from.
+    size_t generation{0};
+  };
+
+ public:
+  /// Find the entry for a query, nullptr if the query is not cached.
+  Entry* find(const std::string& query);
+
+  /// Find or insert the entry for a query, used to record metadata.
+  Entry& get(const std::string& query);
+
+  /**
+   * @brief Remove an entry such that its statement may be executed.
+   *
+   * The caller owns the entry, a nested execution of the same query will not
+   * reuse the statement. Return the entry with put when execution completes.
+   */
+  Entry take(const std::string& query);
+
+  /// Return an entry, it is dropped if the cache was cleared since take.
+  void put(const std::string& query, Entry&& entry);
+
+  /// Finalize every cached statement and drop all metadata.
+  void clear();
+
+  /// The number of cached queries.
+  size_t size() const {
+    return entries_.size();
+  }
+
+  /// Record a constraint set planned by xBestIndex.
+  void addPlan(VirtualTableContent* table, size_t index);
+
+  /// Move the constraint sets planned since the last call.
+  std::vector<TablePlan> takePlans();
+
+  /// Restore the constraint sets of a statement before it is executed.
+  static void restorePlans(const Entry& entry);
+
+ private:
+  /// Evict the least recently used entries above the maximum size.
+  void evict();
+
+ private:
+  using EntryList = std::list<std::pair<std::string, Entry>>;
+
+  /// Cached entries, the most recently used first.
+  EntryList entries_;
+
+  /// An index into the entries by query text.
+  std::unordered_map<std::string, EntryList::iterator> index_;
+
+  /// Constraint sets planned by xBestIndex since the last takePlans.
+  std::vector<TablePlan> planned_;
+
+  /// Incremented when the cache is cleared.
+  size_t generation_{0};
+};
+
 /**
  * @brief An RAII wrapper around an `sqlite3` object.
  *
@@ -35,8 +148,8 @@ class SQLiteDBManager;
  * database is needed during the life of an osquery tool.
  *
  * If there is resource contention (multiple threads want access to the SQLite
- * abstraction layer), then the SQLiteDBManager will provide a transient
- * SQLiteDBInstance.
+ * abstraction layer), then the SQLiteDBManager will provide a pooled
+ * SQLiteDBInstance, or a transient one if the pool is empty.
  */
 class SQLiteDBInstance : private boost::noncopyable {
  public:
@@ -71,6 +184,36 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Check if a virtual table had been called already.
   bool tableCalled(VirtualTableContent* table);
 
+  /// Check if a table plugin was attached to, or failed to attach to, the db.
+  bool tableAttached(const std::string& name);
+
+  /**
+   * @brief Record an attach or detach of a table plugin.
+   *
+   * @param name The table name.
+   * @param attached True if the table was attached, or requested.
+   * @param statement The column definition the table was attached with.
+   */
+  void setTableAttached(const std::string& name,
+                        bool attached,
+                        const std::string& statement = "");
+
+  /**
+   * @brief Release cached memory and detach tables whose definition changed.
+   *
+   * Tables that are no longer registered, or whose columns changed, are
+   * dropped and attached again when a query uses them. The other tables are
+   * kept attached.
+   */
+  void refreshTables();
+
+  /**
+   * @brief The instance owning the database and its virtual tables.
+   *
+   * A temporary primary instance forwards to the DB manager's connection.
+   */
+  SQLiteDBInstance* connection();
+
   /// Request that virtual tables use a warm cache for their results.
   void useCache(bool use_cache);
 
@@ -80,6 +223,31 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Lock the database for attaching virtual tables.
   RecursiveLock attachLock() const;
 
+  /**
+   * @brief Acquire an arena for materializing virtual table results.
+   *
+   * Virtual table cursors copy result text into an arena owned by this
+   * instance. The arena is returned with releaseArena when the cursor closes
+   * and may be reused by other cursors within the same query. All arena
+   * memory is freed at once when the query's affected tables are cleared.
+   */
+  Arena* acquireArena();
+
+  /// Return an arena acquired with acquireArena, the memory is kept.
+  void releaseArena(Arena* arena);
+
+  /// The number of bytes reserved by this instance's per-query arenas.
+  size_t arenaReserved() const;
+
+  /**
+   * @brief The prepared statement cache used by this instance.
+   *
+   * A temporary primary instance forwards to the DB manager's connection.
+   * Transient instances, other than pooled connections, do not cache
+   * statements and return nullptr, as does a disabled cache.
+   */
+  SQLiteStatementCache* statements();
+
  private:
   /// Handle the primary/forwarding requests for table attribute accesses.
   TableAttributes getAttributes() const;
@@ -99,6 +267,9 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// True if this query should bypass table cache.
   bool use_cache_{false};
 
+  /// Track whether this instance is returned to the DB manager's pool.
+  bool pooled_{false};
+
   /// Either the managed primary database or an ephemeral instance.
   sqlite3* db_{nullptr};
 
@@ -125,12 +296,28 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Vector of tables that need their constraints cleared after execution.
   std::map<std::string, VirtualTableContent*> affected_tables_;
 
+  /// The per-query arenas owned by this instance.
+  std::vector<std::unique_ptr<Arena>> arenas_;
+
+  /// Arenas that are not in use by a cursor.
+  std::vector<Arena*> free_arenas_;
+
+  /// Prepared statements, only used by the managed primary connection.
+  SQLiteStatementCache statements_;
+
+  /// Table plugins attached, or requested, and their column definitions.
+  std::unordered_map<std::string, std::string> attached_tables_;
+
  private:
   friend class SQLiteDBManager;
   friend class SQLInternal;
 
  private:
   FRIEND_TEST(SQLiteUtilTests, test_affected_tables);
+  FRIEND_TEST(SQLiteUtilTests, test_query_arena);
+  FRIEND_TEST(SQLiteUtilTests, test_statement_cache);
+  FRIEND_TEST(SQLiteUtilTests, test_connection_pool);
+  FRIEND_TEST(SQLiteUtilTests, test_refresh_primary);
 };
 
 using SQLiteDBInstanceRef = std::shared_ptr<SQLiteDBInstance>;
@@ -182,6 +369,15 @@ class SQLiteDBManager : private boost::noncopyable {
    */
   static void resetPrimary();
 
+  /**
+   * @brief Release the memory of the primary and pooled databases.
+   *
+   * Unlike resetPrimary, the databases are kept open, only the tables whose
+   * definition changed are detached, see SQLiteDBInstance::refreshTables.
+   * Databases in use by a query are not refreshed.
+   */
+  static void refreshPrimary();
+
   /**
    * @brief Check if `table_name` is disabled.
    *
@@ -214,6 +410,18 @@ class SQLiteDBManager : private boost::noncopyable {
   /// A write mutex for initializing the primary database.
   Mutex create_mutex_;
 
+  /**
+   * @brief Idle connections used when the primary database is in use.
+   *
+   * Each pooled connection is an independent `sqlite3` database that keeps
+   * its attached tables and cached statements between queries, such that
+   * concurrent queries do not open and attach a transient database.
+   */
+  std::vector<std::unique_ptr<SQLiteDBInstance>> pool_;
+
+  /// Protect the idle connections.
+  Mutex pool_mutex_;
+
   /// Member variable to hold set of disabled tables.
   std::unordered_set<std::string> disabled_tables_;
 
@@ -223,6 +431,12 @@ class SQLiteDBManager : private boost::noncopyable {
   /// Request a connection, optionally request the primary connection.
   static SQLiteDBInstanceRef getConnection(bool primary = false);
 
+  /// Reuse an idle pooled connection, or open one if none are idle.
+  static SQLiteDBInstanceRef getPooled();
+
+  /// Return a pooled connection, it is closed if the pool is full.
+  static void release(SQLiteDBInstance* dbc);
+
  private:
   friend class SQLiteDBInstance;
   friend class SQLiteSQLPlugin;
@@ -316,6 +530,29 @@ Status queryInternal(const std::string& q,
                      QueryData& results,
                      const SQLiteDBInstanceRef& instance);
 
+/**
+ * @brief A consumer of streamed query results.
+ *
+ * The row may be moved from, return false to stop the query.
+ */
+using RowCallback = std::function<bool(Row& r)>;
+
+/**
+ * @brief SQLite Internal: Execute a query, streaming each result row.
+ *
+ * See queryInternal, rows are not accumulated and are handed to the callback
+ * as SQLite steps through the results.
+ *
+ * @param q the query to execute
+ * @param callback the consumer of each result row.
+ * @param db the SQLite3 database to execute query q against
+ *
+ * @return A status indicating SQL query results.
+ */
+Status queryInternal(const std::string& q,
+                     const RowCallback& callback,
+                     const SQLiteDBInstanceRef& instance);
+
 /**
  * @brief SQLite Intern: Analyze a query, providing information about the
  * result columns
@@ -348,6 +585,27 @@ class SQLInternal : public SQL {
    */
   explicit SQLInternal(const std::string& query, bool use_cache = false);
 
+  /**
+   * @brief Instantiate an instance of the class with a streamed query.
+   *
+   * Result rows are handed to the callback and not kept in the results.
+   *
+   * @param query An osquery SQL query.
+   * @param callback The consumer of each result row.
+   * @param use_cache [optional] Set true to use the query cache.
+   */
+  SQLInternal(const std::string& query,
+              const RowCallback& callback,
+              bool use_cache = false);
+
+  /**
+   * @brief Wrap the results of a query executed by another process.
+   *
+   * @param results The result rows.
+   * @param status The status of the execution.
+   */
+  SQLInternal(QueryData results, const Status& status);
+
  public:
   /**
    * @brief Check if the SQL query's results use event-based tables.
@@ -380,6 +638,13 @@ std::string getStringForSQLiteReturnCode(int code);
  */
 int queryDataCallback(void* argument, int argc, char* argv[], char* column[]);
 
+/**
+ * @brief Hand each row from an SQLite exec to a RowCallback.
+ *
+ * See queryDataCallback, "argument" should be a const RowCallback pointer.
+ */
+int queryRowCallback(void* argument, int argc, char* argv[], char* column[]);
+
 /**
  * @brief Register math-related 'custom' functions.
  */
@@ -0,0 +1,92 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <algorithm>
+#include <exception>
+#include <map>
+#include <vector>
+
+#include <boost/context/protected_fixedsize_stack.hpp>
+#include <boost/context/stack_traits.hpp>
+
+#include <osquery/core.h>
+
+#include "osquery/sql/stack_pool.h"
+
+namespace ctx = boost::context;
+
+namespace osquery {
+
+/// Released stacks kept for each size, more are unmapped.
+const size_t kStackPoolLimit{16};
+
+/// Released stacks by size.
+static std::map<size_t, std::vector<ctx::stack_context>> kStackPool;
+
+static Mutex kStackPoolMutex;
+
+PooledProtectedStack::PooledProtectedStack(size_t size) : size_(size) {
+  if (size_ == 0) {
+    size_ = ctx::stack_traits::default_size();
+  }
+  size_ = std::max(size_, ctx::stack_traits::minimum_size());
+  if (!ctx::stack_traits::is_unbounded()) {
+    size_ = std::min(size_, ctx::stack_traits::maximum_size());
+  }
+}
+
+ctx::stack_context PooledProtectedStack::allocate() {
+  {
+    WriteLock lock(kStackPoolMutex);
+    auto it = kStackPool.find(size_);
+    if (it != kStackPool.end() && !it->second.empty()) {
+      auto sctx = it->second.back();
+      it->second.pop_back();
+      return sctx;
+    }
+  }
+
+  return ctx::protected_fixedsize_stack(size_).allocate();
+}
+
+void PooledProtectedStack::deallocate(ctx::stack_context& sctx) noexcept {
+  try {
+    WriteLock lock(kStackPoolMutex);
+    auto& stacks = kStackPool[size_];
+    if (stacks.size() < kStackPoolLimit) {
+      stacks.push_back(sctx);
+      return;
+    }
+  } catch (const std::exception& /* e */) {
+    // A stack that cannot be pooled is unmapped.
+  }
+
+  ctx::protected_fixedsize_stack(size_).deallocate(sctx);
+}
+
+size_t PooledProtectedStack::pooled() {
+  WriteLock lock(kStackPoolMutex);
+  size_t count = 0;
+  for (const auto& stacks : kStackPool) {
+    count += stacks.second.size();
+  }
+  return count;
+}
+
+void PooledProtectedStack::clear() {
+  WriteLock lock(kStackPoolMutex);
+  for (auto& stacks : kStackPool) {
+    for (auto& sctx : stacks.second) {
+      ctx::protected_fixedsize_stack(stacks.first).deallocate(sctx);
+    }
+  }
+  kStackPool.clear();
+}
+} // namespace osquery
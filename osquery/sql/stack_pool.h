@@ -0,0 +1,56 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include <boost/context/stack_context.hpp>
+
+namespace osquery {
+
+/**
+ * @brief A coroutine stack allocator reusing protected fixed-size stacks.
+ *
+ * Each generator table cursor runs its table in a coroutine with its own
+ * stack. A JOIN filters the inner table once per outer row, mapping and
+ * unmapping a stack each time. Released stacks are instead kept in a process
+ * wide pool, by size, and handed to the next cursor.
+ *
+ * Stacks keep their guard page, an overflow faults rather than corrupting the
+ * pooled neighbor.
+ */
+class PooledProtectedStack {
+ public:
+  /// Use stacks of a size, 0 uses the default coroutine stack size.
+  explicit PooledProtectedStack(size_t size = 0);
+
+  /// Reuse a pooled stack of this size, or map a new one.
+  boost::context::stack_context allocate();
+
+  /// Return a stack to the pool, unmapping it if the pool is full.
+  void deallocate(boost::context::stack_context& sctx) noexcept;
+
+  /// The size of the stacks used by this allocator.
+  size_t size() const {
+    return size_;
+  }
+
+ public:
+  /// The number of pooled stacks, of all sizes.
+  static size_t pooled();
+
+  /// Unmap all pooled stacks.
+  static void clear();
+
+ private:
+  size_t size_;
+};
+} // namespace osquery
@@ -0,0 +1,163 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/registry.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/core/process.h"
+#include "osquery/sql/table_fixtures.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+FLAG(string,
+     table_record_path,
+     "",
+     "Append the rows each table generates to fixtures in this directory");
+
+FLAG(string,
+     table_replay_path,
+     "",
+     "Replace tables with the fixtures recorded in this directory");
+
+FLAG(bool,
+     table_replay_timing,
+     true,
+     "Fixture tables take the recorded time of each generate");
+
+/// The extension of fixture files, named by their table.
+const std::string kTableFixtureExtension{".rows"};
+
+/// Protect appends to the fixture files.
+static std::mutex kTableFixtureMutex;
+
+QueryData FixtureTablePlugin::generate(QueryContext& context) {
+  TableFixtureGenerate generate;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (generates_.empty()) {
+      return {};
+    }
+    generate = generates_[next_];
+    next_ = (next_ + 1) % generates_.size();
+  }
+
+  if (FLAGS_table_replay_timing && generate.first >= 1000) {
+    sleepFor(generate.first / 1000);
+  }
+  return std::move(generate.second);
+}
+
+bool isTableRecording() {
+  return !FLAGS_table_record_path.empty();
+}
+
+void recordTableFixture(const std::string& name,
+                        const QueryData& rows,
+                        uint64_t wall_time) {
+  std::string json;
+  if (!serializeQueryDataJSON(rows, json).ok()) {
+    return;
+  }
+
+  // The JSON array is kept on a single line.
+  if (!json.empty() && json.back() == '\n') {
+    json.pop_back();
+  }
+
+  auto path =
+      fs::path(FLAGS_table_record_path) / (name + kTableFixtureExtension);
+  std::lock_guard<std::mutex> lock(kTableFixtureMutex);
+  std::ofstream output(path.string(), std::ios::app | std::ios::binary);
+  output << wall_time << '\t' << json << '\n';
+}
+
+Status readTableFixture(const std::string& path,
+                        std::vector<TableFixtureGenerate>& generates) {
+  std::string content;
+  auto status = readFile(path, content);
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::istringstream input(content);
+  std::string line;
+  while (std::getline(input, line)) {
+    if (line.empty()) {
+      continue;
+    }
+
+    auto tab = line.find('\t');
+    unsigned long long wall_time = 0;
+    if (tab == std::string::npos ||
+        !safeStrtoull(line.substr(0, tab), 10, wall_time)) {
+      return Status(1, "Invalid fixture line in " + path);
+    }
+
+    TableFixtureGenerate generate;
+    generate.first = wall_time;
+    status = deserializeQueryDataJSON(line.substr(tab + 1), generate.second);
+    if (!status.ok()) {
+      return Status(1, "Invalid fixture rows in " + path);
+    }
+    generates.push_back(std::move(generate));
+  }
+  return Status(0, "OK");
+}
+
+Status replayTableFixtures(const std::string& path) {
+  std::vector<std::string> files;
+  auto status = listFilesInDirectory(path, files);
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto registry = RegistryFactory::get().registry("table");
+  for (const auto& file : files) {
+    fs::path fixture(file);
+    if (fixture.extension().string() != kTableFixtureExtension) {
+      continue;
+    }
+
+    auto name = fixture.stem().string();
+    if (!registry->exists(name, true)) {
+      VLOG(1) << "Skipping fixture of unknown table: " << name;
+      continue;
+    }
+
+    auto table =
+        std::dynamic_pointer_cast<TablePlugin>(registry->plugin(name));
+    std::vector<TableFixtureGenerate> generates;
+    status = readTableFixture(file, generates);
+    if (table == nullptr || !status.ok()) {
+      LOG(WARNING) << "Cannot replay fixture " << file << ": "
+                   << status.getMessage();
+      continue;
+    }
+
+    // Virtual tables look up their plugin by name for each scan.
+    auto columns = table->columns();
+    registry->remove(name);
+    registry->add(name,
+                  std::make_shared<FixtureTablePlugin>(std::move(columns),
+                                                       std::move(generates)));
+  }
+  return Status(0, "OK");
+}
+} // namespace osquery
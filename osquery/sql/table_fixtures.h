@@ -0,0 +1,81 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osquery/query.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+
+/// The rows of a recorded generate and the microseconds it took.
+using TableFixtureGenerate = std::pair<uint64_t, QueryData>;
+
+/**
+ * @brief A table serving the rows another table generated on a real host.
+ *
+ * Fixtures are recorded with --table_record_path. Each <table>.rows file
+ * holds one line per generate call: the generate's wall time in microseconds,
+ * a tab, and the rows as a JSON array.
+ *
+ * Generates return the recorded generates in turn, starting over after the
+ * last. With --table_replay_timing each generate also takes the recorded
+ * time, such that benchmarks see production-shaped data and latency.
+ */
+class FixtureTablePlugin : public TablePlugin {
+ public:
+  FixtureTablePlugin(TableColumns columns,
+                     std::vector<TableFixtureGenerate> generates)
+      : columns_(std::move(columns)), generates_(std::move(generates)) {}
+
+  TableColumns columns() const override {
+    return columns_;
+  }
+
+  QueryData generate(QueryContext& context) override;
+
+ private:
+  /// The replaced table's columns.
+  TableColumns columns_;
+
+  /// The recorded generates, in the order they were recorded.
+  std::vector<TableFixtureGenerate> generates_;
+
+  /// The next recorded generate to return.
+  size_t next_{0};
+
+  std::mutex mutex_;
+};
+
+/// Check if generated rows are recorded, see --table_record_path.
+bool isTableRecording();
+
+/// Append a generate's rows and wall time to the table's fixture.
+void recordTableFixture(const std::string& name,
+                        const QueryData& rows,
+                        uint64_t wall_time);
+
+/// Parse the generates of a fixture file.
+Status readTableFixture(const std::string& path,
+                        std::vector<TableFixtureGenerate>& generates);
+
+/**
+ * @brief Replace tables with the fixtures recorded in a directory.
+ *
+ * Each <table>.rows file replaces the registered table of the same name,
+ * keeping its columns. Fixtures of unknown tables are skipped.
+ */
+Status replayTableFixtures(const std::string& path);
+} // namespace osquery
@@ -0,0 +1,117 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+#include <osquery/system.h>
+
+#include "osquery/sql/extension_cache.h"
+
+namespace osquery {
+
+DECLARE_bool(disable_caching);
+DECLARE_uint64(extensions_cache_max);
+
+class ExtensionTableCacheTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    ExtensionTableCache::get().clear();
+  }
+
+  void TearDown() override {
+    ExtensionTableCache::get().clear();
+  }
+};
+
+class CacheableTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {std::make_tuple("name", TEXT_TYPE, ColumnOptions::DEFAULT)};
+  }
+
+  size_t cacheTTL() const override {
+    return 300;
+  }
+};
+
+TEST_F(ExtensionTableCacheTests, test_allowed) {
+  VirtualTableContent table;
+  EXPECT_FALSE(ExtensionTableCache::allowed(table));
+  table.cache_ttl = 10;
+  EXPECT_TRUE(ExtensionTableCache::allowed(table));
+
+  auto disable_caching = FLAGS_disable_caching;
+  FLAGS_disable_caching = true;
+  EXPECT_FALSE(ExtensionTableCache::allowed(table));
+  FLAGS_disable_caching = disable_caching;
+}
+
+TEST_F(ExtensionTableCacheTests, test_route_info_ttl) {
+  // The TTL is advertised with the table's route info.
+  CacheableTablePlugin table;
+  const Plugin& plugin = table;
+  bool advertised = false;
+  for (const auto& item : plugin.routeInfo()) {
+    if (item.at("id") == "cache") {
+      advertised = (item.at("ttl") == "300");
+    }
+  }
+  EXPECT_TRUE(advertised);
+}
+
+TEST_F(ExtensionTableCacheTests, test_keep_until_expired) {
+  auto& cache = ExtensionTableCache::get();
+  PluginRequest request = {{"action", "generate"}, {"context", "{\"a\":1}"}};
+  auto key = ExtensionTableCache::key("inventory", request);
+  request["context"] = "{\"a\":2}";
+  EXPECT_NE(key, ExtensionTableCache::key("inventory", request));
+
+  QueryData results;
+  EXPECT_FALSE(cache.find("inventory", key, 10, results));
+
+  QueryData rows = {{{"name", "host"}}};
+  cache.add("inventory", key, 20, rows);
+  EXPECT_TRUE(cache.find("inventory", key, 19, results));
+  EXPECT_EQ(results, rows);
+
+  // Results are not used once the TTL passed.
+  results.clear();
+  EXPECT_FALSE(cache.find("inventory", key, 20, results));
+  EXPECT_TRUE(results.empty());
+
+  auto stats = cache.stats();
+  ASSERT_EQ(stats.count("inventory"), 1U);
+  EXPECT_EQ(stats["inventory"].hits, 1U);
+  EXPECT_EQ(stats["inventory"].misses, 2U);
+
+  // Detaching the table drops its results.
+  cache.add("inventory", key, 30, rows);
+  EXPECT_GT(cache.size(), 0U);
+  cache.remove("inventory");
+  EXPECT_EQ(cache.size(), 0U);
+  EXPECT_FALSE(cache.find("inventory", key, 19, results));
+}
+
+TEST_F(ExtensionTableCacheTests, test_memory_limit) {
+  auto& cache = ExtensionTableCache::get();
+  auto extensions_cache_max = FLAGS_extensions_cache_max;
+  FLAGS_extensions_cache_max = 16;
+
+  // Results that do not fit are not kept.
+  QueryData rows = {{{"path", "/a/very/long/path"}}};
+  cache.add("file", "key", getUnixTime() + 10, rows);
+  EXPECT_EQ(cache.size(), 0U);
+
+  QueryData results;
+  EXPECT_FALSE(cache.find("file", "key", getUnixTime(), results));
+  FLAGS_extensions_cache_max = extensions_cache_max;
+}
+}
@@ -0,0 +1,116 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/sql/scan_cache.h"
+
+namespace osquery {
+
+DECLARE_uint64(scan_cache_max);
+
+class SharedScanCacheTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    SharedScanCache::get().clear();
+  }
+
+  void TearDown() override {
+    SharedScanCache::get().clear();
+  }
+};
+
+TEST_F(SharedScanCacheTests, test_allowed) {
+  VirtualTableContent table;
+  QueryContext context;
+  // Only scans requesting the warm cache, made by the scheduler, are shared.
+  EXPECT_FALSE(SharedScanCache::allowed(table, context));
+  context.useCache(true);
+  EXPECT_TRUE(SharedScanCache::allowed(table, context));
+
+  context.limit = 1;
+  EXPECT_FALSE(SharedScanCache::allowed(table, context));
+  context.limit = 0;
+
+  table.attributes = TableAttributes::EVENT_BASED;
+  EXPECT_FALSE(SharedScanCache::allowed(table, context));
+  table.attributes = TableAttributes::UTILITY;
+  EXPECT_FALSE(SharedScanCache::allowed(table, context));
+}
+
+TEST_F(SharedScanCacheTests, test_key) {
+  QueryContext context1;
+  context1.constraints["pid"].add(Constraint(EQUALS, "1"));
+  context1.constraints["pid"].add(Constraint(EQUALS, "2"));
+  context1.constraints["name"];
+
+  // The order of constraints, and columns without constraints, do not matter.
+  QueryContext context2;
+  context2.constraints["pid"].add(Constraint(EQUALS, "2"));
+  context2.constraints["pid"].add(Constraint(EQUALS, "1"));
+  EXPECT_EQ(SharedScanCache::key("processes", context1),
+            SharedScanCache::key("processes", context2));
+  EXPECT_NE(SharedScanCache::key("processes", context1),
+            SharedScanCache::key("users", context2));
+
+  context2.constraints["pid"].add(Constraint(GREATER_THAN, "1"));
+  EXPECT_NE(SharedScanCache::key("processes", context1),
+            SharedScanCache::key("processes", context2));
+
+  // The used columns are part of the key.
+  QueryContext context3;
+  context3.colsUsed = UsedColumns({"pid"});
+  EXPECT_NE(SharedScanCache::key("processes", context3),
+            SharedScanCache::key("processes", QueryContext()));
+}
+
+TEST_F(SharedScanCacheTests, test_share_within_tick) {
+  auto& scans = SharedScanCache::get();
+  QueryData rows = {{{"pid", "1"}}, {{"pid", "2"}}};
+
+  QueryData results;
+  EXPECT_FALSE(scans.find("processes", "key", 10, results));
+  scans.add("key", 10, rows);
+  EXPECT_GT(scans.size(), 0U);
+
+  EXPECT_TRUE(scans.find("processes", "key", 10, results));
+  EXPECT_EQ(results, rows);
+
+  // Scans are dropped when the tick passes, those of a passed tick are not
+  // added.
+  results.clear();
+  EXPECT_FALSE(scans.find("processes", "key", 11, results));
+  EXPECT_EQ(scans.size(), 0U);
+  scans.add("key", 10, rows);
+  EXPECT_EQ(scans.size(), 0U);
+
+  auto stats = scans.stats();
+  ASSERT_EQ(stats.count("processes"), 1U);
+  EXPECT_EQ(stats["processes"].hits, 1U);
+  EXPECT_EQ(stats["processes"].misses, 2U);
+}
+
+TEST_F(SharedScanCacheTests, test_memory_limit) {
+  auto& scans = SharedScanCache::get();
+  auto scan_cache_max = FLAGS_scan_cache_max;
+  FLAGS_scan_cache_max = 16;
+
+  // Scans that do not fit are not shared.
+  QueryData rows = {{{"path", "/a/very/long/path"}}};
+  scans.add("key", 10, rows);
+  EXPECT_EQ(scans.size(), 0U);
+
+  QueryData results;
+  EXPECT_FALSE(scans.find("file", "key", 10, results));
+  FLAGS_scan_cache_max = scan_cache_max;
+}
+}
@@ -105,6 +105,15 @@ TEST_F(SQLTests, test_sql_escape) {
   input = "The quick brown fox jumps over the lazy dog.";
   escapeNonPrintableBytesEx(input);
   EXPECT_EQ(input, "The quick brown fox jumps over the lazy dog.");
+
+  // Bytes are found within and after whole blocks of the string.
+  input = std::string("0123456789abcdef01234\t6789abcdef0123") + '\0';
+  escapeNonPrintableBytesEx(input);
+  EXPECT_EQ(input, "0123456789abcdef01234\\x096789abcdef0123\\x00");
+
+  input = "0123456789abcdef\x7F\x80";
+  escapeNonPrintableBytesEx(input);
+  EXPECT_EQ(input, "0123456789abcdef\x7F\\x80");
 }
 
 TEST_F(SQLTests, test_sql_base64_encode) {
@@ -133,6 +142,36 @@ TEST_F(SQLTests, test_sql_base64_conditional_encode) {
   EXPECT_EQ(d2[0]["test"], "5oKq5Zug5oKq5p6c");
 }
 
+TEST_F(SQLTests, test_sql_regex_split) {
+  QueryData d;
+  query("select regex_split('a1b22c', '[0-9]+', 2) as test;", d);
+  ASSERT_EQ(d.size(), 1U);
+  EXPECT_EQ(d[0]["test"], "c");
+
+  // Invalid patterns are an error, rather than an exception.
+  auto status = query("select regex_split('test', '(', 0) as test;", d);
+  EXPECT_FALSE(status.ok());
+}
+
+TEST_F(SQLTests, test_sql_regex_match) {
+  QueryData d;
+  query(
+      "select regex_match(value, '^/usr/(s?bin)/', 1) as test from "
+      "(select '/usr/sbin/sshd' as value union all select '/usr/bin/ls' "
+      "union all select '/opt/bin/tool') order by 1;",
+      d);
+  ASSERT_EQ(d.size(), 3U);
+  EXPECT_EQ(d[0]["test"], "");
+  EXPECT_EQ(d[1]["test"], "bin");
+  EXPECT_EQ(d[2]["test"], "sbin");
+
+  // Group 0 is the entire match, groups that do not exist are NULL.
+  query("select regex_match('python2.7', '[0-9.]+$', 0) as test;", d);
+  EXPECT_EQ(d[0]["test"], "2.7");
+  query("select regex_match('python2.7', '[0-9.]+$', 1) as test;", d);
+  EXPECT_EQ(d[0]["test"], "");
+}
+
 TEST_F(SQLTests, test_sql_md5) {
   QueryData d;
   query("select md5('test') as test;", d);
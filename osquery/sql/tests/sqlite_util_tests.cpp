@@ -14,12 +14,16 @@
 
 #include <osquery/core.h>
 #include <osquery/sql.h>
+#include <osquery/system.h>
 
 #include "osquery/sql/sqlite_util.h"
+#include "osquery/sql/virtual_table.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
 
+DECLARE_uint32(sql_statement_cache_size);
+
 class SQLiteUtilTests : public testing::Test {};
 
 std::shared_ptr<SQLiteDBInstance> getTestDBC() {
@@ -84,6 +88,63 @@ TEST_F(SQLiteUtilTests, test_reset) {
   EXPECT_EQ(results.size(), 0U);
 }
 
+TEST_F(SQLiteUtilTests, test_connection_pool) {
+  // While the primary database is in use, requests use pooled connections.
+  auto primary = SQLiteDBManager::get();
+  ASSERT_TRUE(primary->isPrimary());
+
+  sqlite3* pooled_db = nullptr;
+  {
+    auto dbc = SQLiteDBManager::get();
+    EXPECT_FALSE(dbc->isPrimary());
+    EXPECT_TRUE(dbc->pooled_);
+    EXPECT_NE(primary->db(), dbc->db());
+    pooled_db = dbc->db();
+
+    QueryData results;
+    EXPECT_TRUE(queryInternal("SELECT * FROM time", results, dbc).ok());
+    EXPECT_EQ(results.size(), 1U);
+  }
+
+  // The idle connection is reused, keeping its attached tables.
+  auto dbc = SQLiteDBManager::get();
+  EXPECT_EQ(pooled_db, dbc->db());
+  EXPECT_TRUE(dbc->tableAttached("time"));
+  EXPECT_EQ(dbc->affected_tables_.size(), 0U);
+
+  // Concurrent requests use independent connections.
+  auto other = SQLiteDBManager::get();
+  EXPECT_NE(dbc->db(), other->db());
+  EXPECT_NE(primary->db(), other->db());
+}
+
+TEST_F(SQLiteUtilTests, test_refresh_primary) {
+  auto internal_db = SQLiteDBManager::get()->db();
+  {
+    auto dbc = SQLiteDBManager::get();
+    QueryData results;
+    EXPECT_TRUE(queryInternal("SELECT * FROM time", results, dbc).ok());
+    EXPECT_TRUE(dbc->tableAttached("time"));
+
+    // Pretend the table was attached with different columns.
+    dbc->connection()->attached_tables_["time"] = "(seconds INTEGER)";
+  }
+
+  // The database is kept open, and the changed table is detached.
+  SQLiteDBManager::refreshPrimary();
+  auto dbc = SQLiteDBManager::get();
+  EXPECT_EQ(internal_db, dbc->db());
+  EXPECT_FALSE(dbc->tableAttached("time"));
+
+  // Unchanged tables are kept attached.
+  QueryData results;
+  EXPECT_TRUE(queryInternal("SELECT * FROM time", results, dbc).ok());
+  EXPECT_EQ(results.size(), 1U);
+  dbc.reset();
+  SQLiteDBManager::refreshPrimary();
+  EXPECT_TRUE(SQLiteDBManager::get()->tableAttached("time"));
+}
+
 TEST_F(SQLiteUtilTests, test_direct_query_execution) {
   auto dbc = getTestDBC();
   QueryData results;
@@ -92,6 +153,30 @@ TEST_F(SQLiteUtilTests, test_direct_query_execution) {
   EXPECT_EQ(results, getTestDBExpectedResults());
 }
 
+TEST_F(SQLiteUtilTests, test_streamed_query_execution) {
+  auto dbc = getTestDBC();
+  QueryData results;
+  auto status = queryInternal(kTestQuery,
+                              [&results](Row& r) {
+                                results.push_back(std::move(r));
+                                return true;
+                              },
+                              dbc);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results, getTestDBExpectedResults());
+
+  // The callback may stop the query.
+  results.clear();
+  status = queryInternal(kTestQuery,
+                         [&results](Row& r) {
+                           results.push_back(std::move(r));
+                           return false;
+                         },
+                         dbc);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(results.size(), 1U);
+}
+
 TEST_F(SQLiteUtilTests, test_passing_callback_no_data_param) {
   char* err = nullptr;
   auto dbc = getTestDBC();
@@ -139,6 +224,152 @@ TEST_F(SQLiteUtilTests, test_affected_tables) {
   EXPECT_EQ(dbc->affected_tables_.size(), 0U);
 }
 
+TEST_F(SQLiteUtilTests, test_query_deadline) {
+  auto dbc = getTestDBC();
+  std::string query =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+      "LIMIT 100000) SELECT count(*) AS n FROM c";
+
+  // A query executing past the thread's deadline is interrupted.
+  QueryData results;
+  setQueryDeadline(getUnixTime());
+  auto status = queryInternal(query, results, dbc);
+  setQueryDeadline(0);
+  EXPECT_FALSE(status.ok());
+
+  results.clear();
+  status = queryInternal(query, results, dbc);
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["n"], "100000");
+}
+
+TEST_F(SQLiteUtilTests, test_query_budget) {
+  auto dbc = getTestDBC();
+  std::string query =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+      "LIMIT 100000) SELECT x FROM c";
+
+  // The query stops, successfully, at the row budget.
+  QueryData results;
+  setQueryBudget(10, 0);
+  auto status = queryInternal(query, results, dbc);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(getQueryBudget().truncated);
+  ASSERT_EQ(results.size(), 10U);
+  EXPECT_EQ(results[9]["x"], "10");
+
+  // The first 9 rows are 2 bytes, 'x' and a digit, the 10th is 3 bytes.
+  results.clear();
+  setQueryBudget(0, 19);
+  status = queryInternal(query, results, dbc);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(getQueryBudget().truncated);
+  EXPECT_EQ(results.size(), 9U);
+
+  // A query within its budget is not truncated.
+  results.clear();
+  setQueryBudget(100000, 0);
+  status = queryInternal(query, results, dbc);
+  EXPECT_TRUE(status.ok());
+  EXPECT_FALSE(getQueryBudget().truncated);
+  EXPECT_EQ(results.size(), 100000U);
+  setQueryBudget(0, 0);
+}
+
+TEST_F(SQLiteUtilTests, test_query_memory) {
+  auto dbc = getTestDBC();
+  std::string query =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+      "LIMIT 100000) SELECT x FROM c ORDER BY x DESC";
+
+  // The sorter's heap is recorded while the query executes.
+  QueryData results;
+  setQueryBudget(0, 0);
+  auto status = queryInternal(query, results, dbc);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 100000U);
+  EXPECT_GT(getQueryBudget().memory, 0U);
+
+  setQueryBudget(0, 0);
+  EXPECT_EQ(getQueryBudget().memory, 0U);
+}
+
+TEST_F(SQLiteUtilTests, test_query_arena) {
+  auto dbc = getTestDBC();
+  QueryData results;
+  // The file table generates typed rows, copying text into an arena.
+  auto status =
+      queryInternal("SELECT path FROM file WHERE path = '.'", results, dbc);
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+
+  // The closed cursor returned its arena, the memory is kept for the query.
+  EXPECT_EQ(dbc->arenas_.size(), 1U);
+  EXPECT_EQ(dbc->free_arenas_.size(), 1U);
+  EXPECT_GT(dbc->arenaReserved(), 0U);
+
+  // All arena memory is released once the query's tables are cleared.
+  dbc->clearAffectedTables();
+  EXPECT_EQ(dbc->arenas_.size(), 0U);
+  EXPECT_EQ(dbc->arenaReserved(), 0U);
+}
+
+TEST_F(SQLiteUtilTests, test_statement_cache) {
+  auto dbc = SQLiteDBManager::get();
+  ASSERT_TRUE(dbc->isPrimary());
+  auto* statements = dbc->statements();
+  ASSERT_NE(nullptr, statements);
+  statements->clear();
+
+  // The file table requires a path, the planned constraint is restored each
+  // time the cached statement is executed.
+  std::string query = "SELECT path FROM file WHERE path = '.'";
+  for (size_t i = 0; i < 3; i++) {
+    QueryData results;
+    auto status = queryInternal(query, results, dbc);
+    dbc->clearAffectedTables();
+    EXPECT_TRUE(status.ok());
+    ASSERT_EQ(results.size(), 1U);
+    EXPECT_EQ(results[0]["path"], ".");
+  }
+
+  auto* entry = statements->find(query);
+  ASSERT_NE(nullptr, entry);
+  EXPECT_NE(nullptr, entry->stmt);
+  EXPECT_FALSE(entry->plans.empty());
+
+  // The query metadata is cached alongside the statement.
+  TableColumns columns;
+  EXPECT_TRUE(getQueryColumnsInternal(query, columns, dbc).ok());
+  ASSERT_EQ(columns.size(), 1U);
+  entry = statements->find(query);
+  ASSERT_NE(nullptr, entry);
+  EXPECT_TRUE(entry->columns.is_initialized());
+
+  // Queries with several statements are executed but not cached.
+  QueryData results;
+  std::string multiple = "SELECT 1 AS a; SELECT 2 AS a;";
+  EXPECT_TRUE(queryInternal(multiple, results, dbc).ok());
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(nullptr, statements->find(multiple));
+
+  // The least recently used statements are evicted.
+  auto cache_size = FLAGS_sql_statement_cache_size;
+  FLAGS_sql_statement_cache_size = 2;
+  for (size_t i = 0; i < 3; i++) {
+    results.clear();
+    queryInternal("SELECT " + std::to_string(i) + " AS a", results, dbc);
+  }
+  EXPECT_EQ(statements->size(), 2U);
+  EXPECT_EQ(nullptr, statements->find(query));
+  FLAGS_sql_statement_cache_size = cache_size;
+
+  // Detaching, or attaching, a table invalidates the cache.
+  detachTableInternal("statement_cache_missing", dbc);
+  EXPECT_EQ(statements->size(), 0U);
+}
+
 TEST_F(SQLiteUtilTests, test_table_attributes_event_based) {
   {
     SQLInternal sql_internal("select * from process_events");
@@ -0,0 +1,71 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/tables.h>
+
+#include "osquery/sql/stack_pool.h"
+
+namespace osquery {
+
+class PooledProtectedStackTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    PooledProtectedStack::clear();
+  }
+
+  void TearDown() override {
+    PooledProtectedStack::clear();
+  }
+};
+
+TEST_F(PooledProtectedStackTests, test_reuse) {
+  PooledProtectedStack stacks(64 * 1024);
+  auto first = stacks.allocate();
+  EXPECT_GE(first.size, 64U * 1024);
+  stacks.deallocate(first);
+  EXPECT_EQ(PooledProtectedStack::pooled(), 1U);
+
+  // A released stack is handed to the next allocation of the same size.
+  auto second = stacks.allocate();
+  EXPECT_EQ(second.sp, first.sp);
+  EXPECT_EQ(PooledProtectedStack::pooled(), 0U);
+
+  // Stacks of another size are not shared.
+  PooledProtectedStack larger(256 * 1024);
+  auto third = larger.allocate();
+  EXPECT_NE(third.sp, second.sp);
+  stacks.deallocate(second);
+  larger.deallocate(third);
+  EXPECT_EQ(PooledProtectedStack::pooled(), 2U);
+}
+
+TEST_F(PooledProtectedStackTests, test_generator) {
+  for (size_t i = 0; i < 3; i++) {
+    RowGenerator::pull_type generator(PooledProtectedStack(),
+                                      [](RowYield& yield) {
+                                        for (size_t k = 0; k < 3; k++) {
+                                          Row r;
+                                          r["k"] = std::to_string(k);
+                                          yield(r);
+                                        }
+                                      });
+    size_t rows = 0;
+    for (const auto& r : generator) {
+      EXPECT_EQ(r.at("k"), std::to_string(rows++));
+    }
+    EXPECT_EQ(rows, 3U);
+  }
+
+  // Each generator reused the stack of the previous.
+  EXPECT_EQ(PooledProtectedStack::pooled(), 1U);
+}
+} // namespace osquery
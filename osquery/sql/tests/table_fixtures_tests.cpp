@@ -0,0 +1,106 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <boost/filesystem.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/registry.h>
+
+#include "osquery/sql/table_fixtures.h"
+#include "osquery/tests/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+DECLARE_string(table_record_path);
+DECLARE_bool(table_replay_timing);
+
+class TableFixturesTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = (fs::path(kTestWorkingDirectory) / "fixtures").string();
+    removePath(path_);
+    fs::create_directories(path_);
+    FLAGS_table_record_path = path_;
+    FLAGS_table_replay_timing = false;
+  }
+
+  void TearDown() override {
+    FLAGS_table_record_path = "";
+    FLAGS_table_replay_timing = true;
+    removePath(path_);
+  }
+
+ protected:
+  std::string path_;
+};
+
+class fixtureSourceTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("pid", INTEGER_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("name", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  QueryData generate(QueryContext& context) override {
+    return {{{"pid", "1"}, {"name", "init"}}};
+  }
+};
+
+TEST_F(TableFixturesTests, test_record_replay) {
+  EXPECT_TRUE(isTableRecording());
+  recordTableFixture("fixture_source",
+                     {{{"pid", "1"}, {"name", "init"}},
+                      {{"pid", "2"}, {"name", "tab\tand \"quote\""}}},
+                     1500);
+  recordTableFixture("fixture_source", {}, 10);
+
+  std::vector<TableFixtureGenerate> generates;
+  auto file = (fs::path(path_) / "fixture_source.rows").string();
+  ASSERT_TRUE(readTableFixture(file, generates).ok());
+  ASSERT_EQ(generates.size(), 2U);
+  EXPECT_EQ(generates[0].first, 1500U);
+  ASSERT_EQ(generates[0].second.size(), 2U);
+  EXPECT_EQ(generates[0].second[1]["name"], "tab\tand \"quote\"");
+  EXPECT_TRUE(generates[1].second.empty());
+
+  // The fixture replaces the registered table and keeps its columns.
+  auto registry = RegistryFactory::get().registry("table");
+  auto source = std::make_shared<fixtureSourceTablePlugin>();
+  registry->add("fixture_source", source);
+  ASSERT_TRUE(replayTableFixtures(path_).ok());
+
+  auto table = std::dynamic_pointer_cast<FixtureTablePlugin>(
+      registry->plugin("fixture_source"));
+  ASSERT_NE(table, nullptr);
+  EXPECT_EQ(table->columns().size(), 2U);
+
+  // Recorded generates are returned in turn, then repeat.
+  QueryContext context;
+  EXPECT_EQ(table->generate(context).size(), 2U);
+  EXPECT_EQ(table->generate(context).size(), 0U);
+  EXPECT_EQ(table->generate(context).size(), 2U);
+  registry->remove("fixture_source");
+}
+
+TEST_F(TableFixturesTests, test_invalid_fixture) {
+  auto file = (fs::path(path_) / "invalid.rows").string();
+  writeTextFile(file, "not a time\t[]\n");
+
+  std::vector<TableFixtureGenerate> generates;
+  EXPECT_FALSE(readTableFixture(file, generates).ok());
+}
+} // namespace osquery
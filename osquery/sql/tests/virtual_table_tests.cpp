@@ -11,11 +11,15 @@
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
+#include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/registry.h>
 #include <osquery/sql.h>
+#include <osquery/system.h>
 
+#include "osquery/core/process.h"
 #include "osquery/sql/virtual_table.h"
+#include "osquery/tests/test_util.h"
 
 namespace osquery {
 
@@ -121,6 +125,7 @@ class aliasesTablePlugin : public TablePlugin {
 
  private:
   FRIEND_TEST(VirtualTableTests, test_tableplugin_aliases);
+  FRIEND_TEST(VirtualTableTests, test_column_alias_content);
 };
 
 TEST_F(VirtualTableTests, test_tableplugin_aliases) {
@@ -160,6 +165,45 @@ TEST_F(VirtualTableTests, test_tableplugin_aliases) {
   EXPECT_EQ(expected_statement, columnDefinition(response, false));
 }
 
+class aliasesContentTablePlugin : public aliasesTablePlugin {
+ public:
+  QueryData generate(QueryContext& context) override {
+    return {{{"username", "alice"}, {"name", "Alice"}}, {{"username", "bob"}}};
+  }
+};
+
+TEST_F(VirtualTableTests, test_column_alias_content) {
+  auto table = std::make_shared<aliasesContentTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("alias_content", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("alias_content", table->columnDefinition(), dbc);
+
+  // Column aliases read the content of their target, for every query.
+  for (size_t i = 0; i < 2; i++) {
+    QueryData results;
+    queryInternal(
+        "SELECT name2, user_name, name, username FROM alias_content",
+        results,
+        dbc);
+    dbc->clearAffectedTables();
+    ASSERT_EQ(results.size(), 2U);
+    EXPECT_EQ(results[0]["name2"], "Alice");
+    EXPECT_EQ(results[0]["user_name"], "alice");
+    EXPECT_EQ(results[0]["name"], "Alice");
+    EXPECT_EQ(results[1]["user_name"], "bob");
+  }
+
+  // Missing text content is empty rather than NULL.
+  QueryData results;
+  queryInternal(
+      "SELECT username FROM alias_content WHERE name1 = ''", results, dbc);
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["username"], "bob");
+}
+
 TEST_F(VirtualTableTests, test_sqlite3_attach_vtable) {
   auto table = std::make_shared<sampleTablePlugin>();
   table->setName("sample");
@@ -205,6 +249,36 @@ TEST_F(VirtualTableTests, test_sqlite3_table_joins) {
   EXPECT_EQ(results.size(), 1U);
 }
 
+TEST_F(VirtualTableTests, test_attach_query_tables) {
+  auto dbc = SQLiteDBManager::getUnique();
+
+  // Table plugins are attached when a query uses them.
+  EXPECT_FALSE(dbc->tableAttached("time"));
+  QueryData results;
+  auto status = queryInternal("SELECT * FROM \"time\"", results, dbc);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 1U);
+  EXPECT_TRUE(dbc->tableAttached("time"));
+  EXPECT_FALSE(dbc->tableAttached("processes"));
+
+  // Literals and comments do not name tables.
+  results.clear();
+  status = queryInternal(
+      "SELECT 'processes', 'it''s users' AS a -- osquery_info", results, dbc);
+  EXPECT_TRUE(status.ok());
+  EXPECT_FALSE(dbc->tableAttached("processes"));
+  EXPECT_FALSE(dbc->tableAttached("users"));
+  EXPECT_FALSE(dbc->tableAttached("osquery_info"));
+
+  // Detaching allows the table to be attached again.
+  detachTableInternal("time", dbc);
+  EXPECT_FALSE(dbc->tableAttached("time"));
+  results.clear();
+  status = queryInternal("SELECT * FROM time", results, dbc);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 1U);
+}
+
 class pTablePlugin : public TablePlugin {
  private:
   TableColumns columns() const override {
@@ -530,6 +604,143 @@ TEST_F(VirtualTableTests, test_table_results_cache) {
   EXPECT_EQ(cache->generates_, 4U);
 }
 
+class staticTablePlugin : public TablePlugin {
+ public:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", TEXT_TYPE, ColumnOptions::INDEX),
+        std::make_tuple("d", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  TableAttributes attributes() const override {
+    return TableAttributes::STATIC;
+  }
+
+  QueryData generate(QueryContext& ctx) override {
+    // This is the generate of a spec with attributes(static=True).
+    QueryData results;
+    std::string state;
+    if (getStaticCache(ctx, results, state)) {
+      return results;
+    }
+
+    ctx.colsUsed = boost::none;
+    generates_++;
+    Row r;
+    r["i"] = "1";
+    r["d"] = std::to_string(generates_);
+    results.push_back(r);
+    setStaticCache(ctx, results, state);
+    return results;
+  }
+
+  size_t generates_{0};
+};
+
+TEST_F(VirtualTableTests, test_table_static_cache) {
+  auto tables = RegistryFactory::get().registry("table");
+  auto table = std::make_shared<staticTablePlugin>();
+  tables->add("static_table", table);
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("static_table", table->columnDefinition(), dbc);
+
+  // The results are generated once, with every column, and kept.
+  QueryData results;
+  queryInternal("SELECT i FROM static_table;", results, dbc);
+  dbc->clearAffectedTables();
+  results.clear();
+  queryInternal("SELECT d FROM static_table;", results, dbc);
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["d"], "1");
+  EXPECT_EQ(table->generates_, 1U);
+  EXPECT_EQ(table->cacheHits(), 1U);
+
+  // Constraining the index column generates, and does not replace the rows.
+  results.clear();
+  queryInternal("SELECT d FROM static_table WHERE i = '1';", results, dbc);
+  dbc->clearAffectedTables();
+  EXPECT_EQ(table->generates_, 2U);
+
+  // Once cleared, the next query generates.
+  table->clearStaticCache();
+  results.clear();
+  queryInternal("SELECT d FROM static_table;", results, dbc);
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["d"], "3");
+}
+
+#ifndef WIN32
+class dependencyTablePlugin : public TablePlugin {
+ public:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("content", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  std::vector<std::string> dependencies() const override {
+    return {path_};
+  }
+
+  QueryData generate(QueryContext& ctx) override {
+    // This is the generate of a spec with dependencies.
+    QueryData results;
+    std::string state;
+    if (getStaticCache(ctx, results, state)) {
+      return results;
+    }
+
+    generates_++;
+    Row r;
+    readFile(path_, r["content"]);
+    results.push_back(r);
+    setStaticCache(ctx, results, state);
+    return results;
+  }
+
+  std::string path_{kTestWorkingDirectory + "/dependency_table.txt"};
+  size_t generates_{0};
+};
+
+TEST_F(VirtualTableTests, test_table_dependencies) {
+  auto tables = RegistryFactory::get().registry("table");
+  auto table = std::make_shared<dependencyTablePlugin>();
+  tables->add("dependency_table", table);
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("dependency_table", table->columnDefinition(), dbc);
+
+  // A file changed within the current second is not settled, nothing is kept.
+  ASSERT_TRUE(writeTextFile(table->path_, "first").ok());
+  QueryData results;
+  queryInternal("SELECT * FROM dependency_table;", results, dbc);
+  dbc->clearAffectedTables();
+  EXPECT_EQ(table->generates_, 1U);
+
+  sleepFor(1100);
+  for (size_t i = 0; i < 3; i++) {
+    results.clear();
+    queryInternal("SELECT * FROM dependency_table;", results, dbc);
+    dbc->clearAffectedTables();
+  }
+  EXPECT_EQ(table->generates_, 2U);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["content"], "first");
+
+  // Changing the file generates again.
+  ASSERT_TRUE(writeTextFile(table->path_, "second").ok());
+  results.clear();
+  queryInternal("SELECT * FROM dependency_table;", results, dbc);
+  dbc->clearAffectedTables();
+  EXPECT_EQ(table->generates_, 3U);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["content"], "second");
+  removePath(table->path_);
+}
+#endif
+
 class yieldTablePlugin : public TablePlugin {
  private:
   TableColumns columns() const override {
@@ -575,6 +786,322 @@ TEST_F(VirtualTableTests, test_yield_generator) {
   EXPECT_EQ(results[0]["index"], "10");
 }
 
+class cancelledTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("index", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  bool usesGenerator() const override {
+    return true;
+  }
+
+  void generator(RowYield& yield, QueryContext& qc) override {
+    // Generate rows until the query's deadline, which passes after 5 rows.
+    while (!qc.isCancelled()) {
+      if (++generated_ == 5) {
+        setQueryDeadline(getUnixTime());
+      }
+      Row r;
+      r["index"] = std::to_string(generated_);
+      yield(r);
+    }
+  }
+
+ public:
+  size_t generated_{0};
+};
+
+TEST_F(VirtualTableTests, test_cancelled_generator) {
+  auto table = std::make_shared<cancelledTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("cancelled", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("cancelled", table->columnDefinition(), dbc);
+
+  // The generator is not resumed once the deadline passed.
+  QueryData results;
+  setQueryDeadline(getUnixTime() + 60);
+  auto status = queryInternal("SELECT * from cancelled", results, dbc);
+  setQueryDeadline(0);
+  dbc->clearAffectedTables();
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(table->generated_, 5U);
+
+  // A query started past its deadline does not generate.
+  table->generated_ = 0;
+  setQueryDeadline(getUnixTime());
+  status = queryInternal("SELECT * from cancelled", results, dbc);
+  setQueryDeadline(0);
+  dbc->clearAffectedTables();
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(table->generated_, 0U);
+}
+
+class typedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("name", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("number", BIGINT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("ratio", DOUBLE_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  bool usesTypedRows() const override {
+    return true;
+  }
+
+  void generateRows(TableRows& results, QueryContext& context) override {
+    for (int64_t i = 0; i < 3; i++) {
+      results.addRow();
+      results.setText(0, "row" + std::to_string(i));
+      results.setInteger(1, i);
+      if (i > 0) {
+        results.setDouble(2, static_cast<double>(i) / 2);
+      }
+    }
+  }
+};
+
+TEST_F(VirtualTableTests, test_typed_rows) {
+  auto table = std::make_shared<typedTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("typed", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("typed", table->columnDefinition(), dbc);
+
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT name, number + 1 AS next, typeof(number) AS number_type, ratio "
+      "FROM typed WHERE number > 0",
+      results,
+      dbc);
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["name"], "row1");
+  EXPECT_EQ(results[0]["next"], "2");
+  EXPECT_EQ(results[0]["number_type"], "integer");
+  EXPECT_EQ(results[1]["ratio"], "1.0");
+
+  // A NULL cell is bound as NULL.
+  results.clear();
+  queryInternal("SELECT ratio IS NULL AS missing FROM typed", results, dbc);
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["missing"], "1");
+
+  // The generate action converts typed rows into QueryData.
+  QueryContext context;
+  auto data = table->generate(context);
+  ASSERT_EQ(data.size(), 3U);
+  EXPECT_EQ(data[2]["number"], "2");
+}
+
+class typedYieldTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("index", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  bool usesGenerator() const override {
+    return true;
+  }
+
+  bool usesTypedRows() const override {
+    return true;
+  }
+
+  void rowsGenerator(TableRowsYield& yield,
+                     TableRows& batch,
+                     QueryContext& context) override {
+    for (int64_t i = 0; i < 10; i++) {
+      batch.addRow();
+      batch.setInteger(0, i);
+      if (batch.size() == 4) {
+        yield(batch);
+      }
+    }
+    // The remaining 2 rows are yielded by the caller.
+  }
+};
+
+TEST_F(VirtualTableTests, test_typed_yield_generator) {
+  auto table = std::make_shared<typedYieldTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("typed_yield", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("typed_yield", table->columnDefinition(), dbc);
+
+  QueryData results;
+  queryInternal("SELECT * from typed_yield", results, dbc);
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 10U);
+  EXPECT_EQ(results[0]["index"], "0");
+  EXPECT_EQ(results[9]["index"], "9");
+
+  QueryContext context;
+  EXPECT_EQ(table->generate(context).size(), 10U);
+}
+
+class orderedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, ColumnOptions::ORDERED),
+        std::make_tuple("j", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    limit = context.limit;
+    order_by = context.orderBy;
+
+    // Rows are generated in the requested order of the ORDERED column.
+    QueryData results;
+    for (int i = 0; i < 10; i++) {
+      if (context.isLimitReached(results.size())) {
+        break;
+      }
+      auto value = (context.orderDescending) ? 9 - i : i;
+      results.push_back({{"i", INTEGER(value)}, {"j", INTEGER(i % 2)}});
+    }
+    return results;
+  }
+
+  size_t limit{0};
+  std::string order_by;
+};
+
+TEST_F(VirtualTableTests, test_order_limit_pushdown) {
+  auto table = std::make_shared<orderedTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("ordered_table", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("ordered_table", table->columnDefinition(), dbc);
+
+  // SQLite relies on the table to order by an ORDERED column.
+  QueryData results;
+  queryInternal("SELECT i FROM ordered_table ORDER BY i DESC LIMIT 2 OFFSET 1",
+                results,
+                dbc);
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["i"], "8");
+  EXPECT_EQ(results[1]["i"], "7");
+  EXPECT_EQ(table->order_by, "i");
+#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+  EXPECT_EQ(table->limit, 3U);
+#endif
+
+  // Other columns are sorted by SQLite.
+  results.clear();
+  queryInternal("SELECT i FROM ordered_table ORDER BY j, i DESC LIMIT 1",
+                results,
+                dbc);
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["i"], "8");
+  EXPECT_TRUE(table->order_by.empty());
+  EXPECT_EQ(table->limit, 0U);
+
+  // Constrained rows are filtered by SQLite, the limit is not provided.
+  results.clear();
+  queryInternal(
+      "SELECT i FROM ordered_table WHERE j = 1 LIMIT 2", results, dbc);
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["i"], "1");
+  EXPECT_EQ(results[1]["i"], "3");
+  EXPECT_EQ(table->limit, 0U);
+}
+
+class memoTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("k", BIGINT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("v", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("t", BIGINT_TYPE, ColumnOptions::VOLATILE),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    generated++;
+    QueryData results;
+    for (int i = 0; i < 5; i++) {
+      results.push_back({{"k", INTEGER(i)},
+                         {"v", "v" + INTEGER(i)},
+                         {"t", INTEGER(generated)}});
+    }
+    return results;
+  }
+
+  size_t generated{0};
+};
+
+TEST_F(VirtualTableTests, test_join_scan_memo) {
+  auto table = std::make_shared<memoTablePlugin>();
+  auto table_registry = RegistryFactory::get().registry("table");
+  table_registry->add("memo_table", table);
+
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("memo_table", table->columnDefinition(), dbc);
+
+  // The inner table of the JOIN is scanned once per outer row.
+  QueryData results;
+  queryInternal("SELECT m.v FROM (SELECT 1 AS x UNION ALL SELECT 3 UNION ALL "
+                "SELECT 7 UNION ALL SELECT '04') o CROSS JOIN memo_table m "
+                "WHERE m.k = o.x",
+                results,
+                dbc);
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["v"], "v1");
+  EXPECT_EQ(results[1]["v"], "v3");
+  // SQLite compares the text with the integer affinity of the column.
+  EXPECT_EQ(results[2]["v"], "v4");
+  // The first scan generates normally, the unconstrained rows are reused.
+  EXPECT_EQ(table->generated, 2U);
+
+  // The memoized rows are not kept between queries.
+  table->generated = 0;
+  results.clear();
+  queryInternal("SELECT m.v FROM (SELECT 1 AS x UNION ALL SELECT 2) o "
+                "CROSS JOIN memo_table m WHERE m.k = o.x",
+                results,
+                dbc);
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(table->generated, 2U);
+
+  // A query using a volatile column generates each scan.
+  table->generated = 0;
+  results.clear();
+  queryInternal("SELECT m.t FROM (SELECT 1 AS x UNION ALL SELECT 2 UNION ALL "
+                "SELECT 3) o CROSS JOIN memo_table m WHERE m.k = o.x",
+                results,
+                dbc);
+  dbc->clearAffectedTables();
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[2]["t"], "3");
+  EXPECT_EQ(table->generated, 3U);
+}
+
 class likeTablePlugin : public TablePlugin {
  private:
   TableColumns columns() const override {
@@ -821,4 +1348,72 @@ TEST_F(VirtualTableTests, test_indexing_costs) {
   EXPECT_EQ(10U, i->scans);
   EXPECT_EQ(10U, j->scans);
 }
+
+TEST_F(VirtualTableTests, test_table_scan_stats) {
+  clearTableScanStats();
+  TableScanStats stats;
+  EXPECT_FALSE(getTableScanStats("stats_i", true, stats));
+
+  // The first scan is the estimate, later scans are averaged.
+  recordTableScan("stats_i", true, 8, 800);
+  recordTableScan("stats_i", true, 16, 1600);
+  ASSERT_TRUE(getTableScanStats("stats_i", true, stats));
+  EXPECT_EQ(stats.scans, 2U);
+  EXPECT_DOUBLE_EQ(stats.rows, 9.0);
+  EXPECT_DOUBLE_EQ(stats.micros, 900.0);
+  EXPECT_FALSE(getTableScanStats("stats_i", false, stats));
+
+  auto dbc = SQLiteDBManager::getUnique();
+  auto table_registry = RegistryFactory::get().registry("table");
+
+  auto i = std::make_shared<indexIOptimizedTablePlugin>();
+  table_registry->add("stats_i", i);
+  attachTableInternal("stats_i", i->columnDefinition(), dbc);
+
+  auto default_scan = std::make_shared<defaultScanTablePlugin>();
+  table_registry->add("stats_scan", default_scan);
+  attachTableInternal("stats_scan", default_scan->columnDefinition(), dbc);
+
+  // Indexed scans of stats_i are observed to be very expensive, it is scanned
+  // once in the outer loop rather than once per row of stats_scan.
+  recordTableScan("stats_i", true, 1, 100000000);
+  QueryData results;
+  queryInternal(
+      "SELECT * FROM stats_scan JOIN stats_i USING (i);", results, dbc);
+  dbc->clearAffectedTables();
+  EXPECT_EQ(results.size(), 10U);
+  EXPECT_EQ(i->scans, 1U);
+  ASSERT_TRUE(getTableScanStats("stats_i", false, stats));
+  EXPECT_DOUBLE_EQ(stats.rows, 100.0);
+  clearTableScanStats();
+}
+
+TEST_F(VirtualTableTests, test_table_execution_stats) {
+  clearTableExecutionStats();
+  auto dbc = SQLiteDBManager::getUnique();
+  auto table_registry = RegistryFactory::get().registry("table");
+
+  auto i = std::make_shared<indexIOptimizedTablePlugin>();
+  table_registry->add("exec_i", i);
+  attachTableInternal("exec_i", i->columnDefinition(), dbc);
+
+  QueryData results;
+  queryInternal("SELECT * FROM exec_i WHERE i = 3;", results, dbc);
+  queryInternal("SELECT * FROM exec_i;", results, dbc);
+  dbc->clearAffectedTables();
+  dbc.reset();
+
+  auto all = getTableExecutionStats();
+  ASSERT_EQ(all.count("exec_i"), 1U);
+  const auto& stats = all.at("exec_i");
+  EXPECT_EQ(stats.generate_calls, 2U);
+  EXPECT_EQ(stats.rows_generated, 101U);
+  EXPECT_EQ(stats.rows_consumed, 101U);
+
+  // The constrained and the full scan have separate shapes.
+  ASSERT_EQ(stats.shapes.size(), 2U);
+  EXPECT_EQ(stats.shapes.at("i ="), 1U);
+  EXPECT_EQ(stats.shapes.at(""), 1U);
+  clearTableExecutionStats();
+}
 }
@@ -9,13 +9,23 @@
  */
 
 #include <atomic>
+#include <cctype>
+#include <chrono>
+
+#include <boost/algorithm/string/case_conv.hpp>
 
 #include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/core/memory.h"
 #include "osquery/core/process.h"
+#include "osquery/core/trace.h"
+#include "osquery/sql/extension_cache.h"
+#include "osquery/sql/scan_cache.h"
+#include "osquery/sql/stack_pool.h"
+#include "osquery/sql/table_fixtures.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
@@ -27,12 +37,192 @@ FLAG(uint64,
      0,
      "Add an optional microsecond delay between table scans");
 
+FLAG(bool,
+     table_scan_memo,
+     true,
+     "Memoize table rows across the scans of a JOIN within a query");
+
+FLAG(bool,
+     planner_statistics,
+     true,
+     "Estimate table scan costs from the observed generation times");
+
 SHELL_FLAG(bool, planner, false, "Enable osquery runtime planner output");
 
 DECLARE_bool(disable_events);
+DECLARE_bool(database_read_only);
 
 RecursiveMutex kAttachMutex;
 
+/// Table plugin column responses, requested once per registered table.
+static std::map<std::string, PluginResponse> kTableColumns;
+
+/// Protect the table plugin column responses.
+static Mutex kTableColumnsMutex;
+
+/// Request, or reuse, the column response of a table plugin.
+static Status getTableColumns(const std::string& name,
+                              PluginResponse& response) {
+  {
+    ReadLock lock(kTableColumnsMutex);
+    auto it = kTableColumns.find(name);
+    if (it != kTableColumns.end()) {
+      response = it->second;
+      return Status(0, "OK");
+    }
+  }
+
+  auto status =
+      Registry::call("table", name, {{"action", "columns"}}, response);
+  if (status.ok() && !response.empty()) {
+    WriteLock lock(kTableColumnsMutex);
+    kTableColumns[name] = response;
+  }
+  return status;
+}
+
+void clearTableColumns(const std::string& name) {
+  WriteLock lock(kTableColumnsMutex);
+  kTableColumns.erase(name);
+}
+
+/// The observed scan costs, by table name and if the scan was indexed.
+static std::map<std::pair<std::string, bool>, TableScanStats> kTableScanStats;
+
+/// Protect the observed scan costs.
+static Mutex kTableScanStatsMutex;
+
+/// The weight of a new observation within the moving averages.
+static const double kTableScanWeight = 0.125;
+
+void recordTableScan(const std::string& name,
+                     bool indexed,
+                     size_t rows,
+                     size_t micros) {
+  WriteLock lock(kTableScanStatsMutex);
+  auto& stats = kTableScanStats[std::make_pair(name, indexed)];
+  auto weight = (stats.scans == 0) ? 1.0 : kTableScanWeight;
+  stats.rows += (static_cast<double>(rows) - stats.rows) * weight;
+  stats.micros += (static_cast<double>(micros) - stats.micros) * weight;
+  stats.scans++;
+}
+
+bool getTableScanStats(const std::string& name,
+                       bool indexed,
+                       TableScanStats& stats) {
+  ReadLock lock(kTableScanStatsMutex);
+  auto it = kTableScanStats.find(std::make_pair(name, indexed));
+  if (it == kTableScanStats.end()) {
+    return false;
+  }
+  stats = it->second;
+  return true;
+}
+
+void clearTableScanStats() {
+  WriteLock lock(kTableScanStatsMutex);
+  kTableScanStats.clear();
+}
+
+/// The execution counters by table name.
+static std::map<std::string, TableExecutionStats> kTableExecutionStats;
+
+/// Protect the execution counters.
+static Mutex kTableExecutionStatsMutex;
+
+/// The most distinct constraint shapes counted for a table.
+static const size_t kTableShapesMax = 64;
+
+void recordTableFilter(const std::string& name, const std::string& shape) {
+  WriteLock lock(kTableExecutionStatsMutex);
+  auto& shapes = kTableExecutionStats[name].shapes;
+  auto it = shapes.find(shape);
+  if (it != shapes.end()) {
+    it->second++;
+  } else if (shapes.size() < kTableShapesMax) {
+    shapes[shape] = 1;
+  }
+}
+
+void recordTableGenerate(const std::string& name,
+                         uint64_t rows,
+                         uint64_t wall_time,
+                         uint64_t user_time,
+                         uint64_t system_time) {
+  WriteLock lock(kTableExecutionStatsMutex);
+  auto& stats = kTableExecutionStats[name];
+  stats.generate_calls++;
+  stats.rows_generated += rows;
+  stats.wall_time += wall_time;
+  stats.user_time += user_time;
+  stats.system_time += system_time;
+}
+
+void recordTableConsumed(const std::string& name,
+                         uint64_t rows_generated,
+                         uint64_t rows_consumed) {
+  WriteLock lock(kTableExecutionStatsMutex);
+  auto& stats = kTableExecutionStats[name];
+  stats.rows_generated += rows_generated;
+  stats.rows_consumed += rows_consumed;
+}
+
+std::map<std::string, TableExecutionStats> getTableExecutionStats() {
+  ReadLock lock(kTableExecutionStatsMutex);
+  return kTableExecutionStats;
+}
+
+void clearTableExecutionStats() {
+  WriteLock lock(kTableExecutionStatsMutex);
+  kTableExecutionStats.clear();
+}
+
+/// The table usage scope held by the thread.
+static thread_local TableUsageScope* kTableUsageScope{nullptr};
+
+TableUsageScope::TableUsageScope() : previous_(kTableUsageScope) {
+  kTableUsageScope = this;
+}
+
+TableUsageScope::~TableUsageScope() {
+  kTableUsageScope = previous_;
+}
+
+bool TableUsageScope::active() {
+  return kTableUsageScope != nullptr;
+}
+
+void TableUsageScope::record(const std::string& name,
+                             size_t rows,
+                             size_t bytes) {
+  if (kTableUsageScope != nullptr) {
+    auto& usage = kTableUsageScope->tables_[name];
+    usage.rows += rows;
+    usage.bytes += bytes;
+  }
+}
+
+/// Calculate a size as the expected bytes of a row.
+static inline size_t getRowSize(const Row& r) {
+  size_t size = 0;
+  for (const auto& column : r) {
+    size += column.first.size();
+    size += column.second.size();
+  }
+  return size;
+}
+
+/// Calculate the expected bytes of rows, if a query's usage is recorded.
+static size_t getUsageSize(const QueryData& data) {
+  size_t size = 0;
+  if (TableUsageScope::active()) {
+    for (const auto& r : data) {
+      size += getRowSize(r);
+    }
+  }
+  return size;
+}
+
 namespace tables {
 namespace sqlite {
 
@@ -102,12 +292,85 @@ int xOpen(sqlite3_vtab* tab, sqlite3_vtab_cursor** ppCursor) {
 int xClose(sqlite3_vtab_cursor* cur) {
   BaseCursor* pCur = (BaseCursor*)cur;
   plan("Closing cursor (" + std::to_string(pCur->id) + ")");
+  if (pCur->arena != nullptr) {
+    // Release the rows before returning their arena to the instance.
+    pCur->extension = nullptr;
+    pCur->rows_generator = nullptr;
+    pCur->rows = nullptr;
+    auto* pVtab = (VirtualTable*)cur->pVtab;
+    pVtab->instance->releaseArena(pCur->arena);
+  }
+  auto* pVtab = (VirtualTable*)cur->pVtab;
+  if (pCur->generated.rows > 0) {
+    TableUsageScope::record(pVtab->content->name,
+                            pCur->generated.rows,
+                            pCur->generated.bytes);
+  }
+  recordTableConsumed(
+      pVtab->content->name, pCur->generated.rows, pCur->consumed);
   delete pCur;
   return SQLITE_OK;
 }
 
+/**
+ * @brief Move a typed generator cursor to the next non-empty batch.
+ *
+ * Each batch is cleared before the generator is resumed, such that the
+ * generator may reuse (and refill) the same batch.
+ */
+static void nextTypedBatch(BaseCursor* pCur) {
+  while (pCur->batch != nullptr && pCur->batch_row >= pCur->batch->size()) {
+    pCur->batch->clear();
+    pCur->batch_row = 0;
+    (*pCur->rows_generator)();
+    if (*pCur->rows_generator) {
+      pCur->batch = &pCur->rows_generator->get();
+      pCur->generated.rows += pCur->batch->size();
+      pCur->generated.bytes += pCur->batch->bytes();
+    } else {
+      pCur->batch = nullptr;
+    }
+  }
+}
+
+/**
+ * @brief Move an extension table cursor to the next non-empty batch.
+ *
+ * Each batch, and its text, is released before the next batch is read, such
+ * that memory is bounded by the batch size.
+ */
+static void nextExtensionBatch(BaseCursor* pCur) {
+  while (pCur->batch_row >= pCur->rows->size() && pCur->extension != nullptr &&
+         !pCur->extension->done()) {
+    pCur->rows->clear();
+    pCur->arena->reset();
+    pCur->batch_row = 0;
+    auto status = pCur->extension->next(*pCur->rows);
+    if (!status.ok()) {
+      VLOG(1) << "Extension table batch failed: " << status.getMessage();
+      pCur->rows->clear();
+      pCur->extension = nullptr;
+    }
+    pCur->generated.rows += pCur->rows->size();
+    pCur->generated.bytes += pCur->rows->bytes();
+  }
+}
+
+/// Count a row yielded by a generator, and its bytes if a query's usage is
+/// recorded.
+static inline void countGeneratedRow(BaseCursor* pCur) {
+  pCur->generated.rows++;
+  if (TableUsageScope::active()) {
+    pCur->generated.bytes += getRowSize(pCur->current);
+  }
+}
+
 int xEof(sqlite3_vtab_cursor* cur) {
   BaseCursor* pCur = (BaseCursor*)cur;
+  if (pCur->uses_typed_rows) {
+    return pCur->batch == nullptr || pCur->batch_row >= pCur->batch->size();
+  }
+
   if (pCur->uses_generator) {
     if (*pCur->generator) {
       return false;
@@ -131,15 +394,36 @@ int xDestroy(sqlite3_vtab* p) {
   return SQLITE_OK;
 }
 
+/// Check if the executing query's deadline passed, see setQueryDeadline.
+static inline bool isQueryCancelled() {
+  auto deadline = getQueryDeadline();
+  return deadline > 0 && getUnixTime() >= deadline;
+}
+
 int xNext(sqlite3_vtab_cursor* cur) {
   BaseCursor* pCur = (BaseCursor*)cur;
-  if (pCur->uses_generator) {
+  if ((pCur->uses_generator || pCur->rows_generator != nullptr) &&
+      isQueryCancelled()) {
+    // Stop resuming the generator, it is unwound when the cursor closes.
+    return SQLITE_INTERRUPT;
+  }
+
+  if (pCur->uses_typed_rows) {
+    pCur->batch_row++;
+    if (pCur->rows_generator != nullptr) {
+      nextTypedBatch(pCur);
+    } else if (pCur->extension != nullptr) {
+      nextExtensionBatch(pCur);
+    }
+  } else if (pCur->uses_generator) {
     pCur->generator->operator()();
     if (*pCur->generator) {
       pCur->current = pCur->generator->get();
+      countGeneratedRow(pCur);
     }
   }
   pCur->row++;
+  pCur->consumed++;
   return SQLITE_OK;
 }
 
@@ -170,8 +454,7 @@ int xCreate(sqlite3* db,
   pVtab->content->name = std::string(argv[0]);
   const auto& name = pVtab->content->name;
   // Get the table column information.
-  auto status =
-      Registry::call("table", name, {{"action", "columns"}}, response);
+  auto status = getTableColumns(name, response);
   if (!status.ok() || response.size() == 0) {
     delete pVtab->content;
     delete pVtab;
@@ -234,7 +517,25 @@ int xCreate(sqlite3* db,
       // Store the attributes locally so they may be passed to the SQL object.
       pVtab->content->attributes =
           (TableAttributes)AS_LITERAL(INTEGER_LITERAL, column.at("attributes"));
+    } else if (column.at("id") == "cache" && column.count("ttl")) {
+      // An extension's table results may be kept by the core.
+      pVtab->content->cache_ttl = static_cast<size_t>(
+          AS_LITERAL(UNSIGNED_BIGINT_LITERAL, column.at("ttl")));
+    }
+  }
+
+  // Resolve each column's content once, such that xColumn indexes by column
+  // ordinal rather than looking up names and aliases for every cell.
+  for (size_t i = 0; i < pVtab->content->columns.size(); i++) {
+    size_t index = i;
+    auto alias =
+        pVtab->content->aliases.find(std::get<0>(pVtab->content->columns[i]));
+    if (alias != pVtab->content->aliases.end()) {
+      index = alias->second;
     }
+    const auto& target = pVtab->content->columns[index];
+    pVtab->content->ordinals.push_back(
+        {std::get<0>(target), std::get<1>(target), index});
   }
 
   // Create the requested 'aliases'.
@@ -249,26 +550,49 @@ int xCreate(sqlite3* db,
 int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
   BaseCursor* pCur = (BaseCursor*)cur;
   const auto* pVtab = (VirtualTable*)cur->pVtab;
-  if (col >= static_cast<int>(pVtab->content->columns.size())) {
+  if (col < 0 || col >= static_cast<int>(pVtab->content->ordinals.size())) {
     // Requested column index greater than column set size.
     return SQLITE_ERROR;
   }
+
+  // The content name, type, and position are resolved for aliases.
+  const auto& column = pVtab->content->ordinals[col];
+  if (pCur->uses_typed_rows) {
+    if (pCur->batch == nullptr || pCur->batch_row >= pCur->batch->size()) {
+      // Request row index greater than row set size.
+      return SQLITE_ERROR;
+    }
+
+    // Bind the native cell value without converting from a string.
+    const auto& cell = pCur->batch->cell(pCur->batch_row, column.index);
+    switch (cell.kind) {
+    case TableCell::Kind::Integer:
+      sqlite3_result_int64(ctx, cell.value.integer);
+      break;
+    case TableCell::Kind::Double:
+      sqlite3_result_double(ctx, cell.value.real);
+      break;
+    case TableCell::Kind::Text:
+      sqlite3_result_text(ctx,
+                          cell.value.text,
+                          static_cast<int>(cell.size),
+                          SQLITE_STATIC);
+      break;
+    case TableCell::Kind::Null:
+      sqlite3_result_null(ctx);
+      break;
+    }
+    return SQLITE_OK;
+  }
+
   if (!pCur->uses_generator && pCur->row >= pCur->data.size()) {
     // Request row index greater than row set size.
     return SQLITE_ERROR;
   }
 
-  auto& column_name = std::get<0>(pVtab->content->columns[col]);
-  auto& type = std::get<1>(pVtab->content->columns[col]);
-  if (pVtab->content->aliases.count(column_name)) {
-    // Overwrite the aliased column with the type and name of the new column.
-    type = std::get<1>(
-        pVtab->content->columns[pVtab->content->aliases.at(column_name)]);
-    column_name = std::get<0>(
-        pVtab->content->columns[pVtab->content->aliases.at(column_name)]);
-  }
-
-  Row* row = nullptr;
+  const auto& column_name = column.name;
+  const auto& type = column.type;
+  const Row* row = nullptr;
   if (pCur->uses_generator) {
     row = &pCur->current;
   } else {
@@ -276,12 +600,12 @@ int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
   }
 
   // Attempt to cast each xFilter-populated row/column to the SQLite type.
-  const auto& value = (*row)[column_name];
-  if (row->count(column_name) == 0) {
-    // Missing content.
-    VLOG(1) << "Error " << column_name << " is empty";
-    sqlite3_result_null(ctx);
-  } else if (type == TEXT_TYPE) {
+  // Missing content is empty, which is NULL for all but TEXT columns.
+  static const std::string kMissingContent;
+  auto content = row->find(column_name);
+  const auto& value =
+      (content != row->end()) ? content->second : kMissingContent;
+  if (type == TEXT_TYPE) {
     sqlite3_result_text(
         ctx, value.c_str(), static_cast<int>(value.size()), SQLITE_STATIC);
   } else if (type == INTEGER_TYPE) {
@@ -320,6 +644,11 @@ int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
   return SQLITE_OK;
 }
 
+/// Column options a table may use to generate fewer rows.
+static const auto kIndexColumnOptions =
+    ColumnOptions::INDEX | ColumnOptions::REQUIRED | ColumnOptions::ADDITIONAL |
+    ColumnOptions::OPTIMIZED;
+
 static inline bool sensibleComparison(ColumnType type, unsigned char op) {
   if (type == TEXT_TYPE) {
     if (op == GREATER_THAN || op == GREATER_THAN_OR_EQUALS || op == LESS_THAN ||
@@ -345,6 +674,13 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
   bool required_satisfied = false;
   bool index_used = false;
 
+  // Scans the table can optimize have separately observed costs.
+  bool indexed = false;
+
+  // The LIMIT and OFFSET terms, only used if every other term is applied.
+  std::vector<size_t> limit_terms;
+  bool constraints_skipped = false;
+
   // Expressions operating on the same virtual table are loosely identified by
   // the consecutive sets of terms each of the constraint sets are applied onto.
   // Subsequent attempts from failed (unusable) constraints replace the set,
@@ -359,10 +695,20 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
            std::to_string(constraint_info.iColumn) + " term=" +
            std::to_string((int)constraint_info.iTermOffset) + " usable=" +
            std::to_string((int)constraint_info.usable) + "]");
+#endif
+#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+      if (constraint_info.op == SQLITE_INDEX_CONSTRAINT_LIMIT ||
+          constraint_info.op == SQLITE_INDEX_CONSTRAINT_OFFSET) {
+        if (constraint_info.usable) {
+          limit_terms.push_back(i);
+        }
+        continue;
+      }
 #endif
       if (!constraint_info.usable) {
         // A higher cost less priority, prefer more usable query constraints.
         cost += 10;
+        constraints_skipped = true;
         continue;
       }
 
@@ -371,12 +717,14 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
           static_cast<size_t>(constraint_info.iColumn) >=
               pVtab->content->columns.size()) {
         cost += 10;
+        constraints_skipped = true;
         continue;
       }
       const auto& name = std::get<0>(columns[constraint_info.iColumn]);
       const auto& type = std::get<1>(columns[constraint_info.iColumn]);
       if (!sensibleComparison(type, constraint_info.op)) {
         cost += 10;
+        constraints_skipped = true;
         continue;
       }
 
@@ -388,6 +736,9 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
       } else if (options & (ColumnOptions::INDEX | ColumnOptions::ADDITIONAL)) {
         index_used = true;
       }
+      if (options & kIndexColumnOptions) {
+        indexed = true;
+      }
 
       // Save a pair of the name and the constraint operator.
       // Use this constraint during xFilter by performing a scan and column
@@ -418,6 +769,64 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
     cost += 200;
   }
 
+  // The observed generation time refines the cost. SQLite multiplies the cost
+  // of an inner table by the estimated rows of the outer tables.
+  TableScanStats stats;
+  if (FLAGS_planner_statistics &&
+      getTableScanStats(pVtab->content->name, indexed, stats)) {
+    cost += stats.micros;
+#if SQLITE_VERSION_NUMBER >= 3008002
+    pIdxInfo->estimatedRows =
+        std::max<sqlite3_int64>(1, static_cast<sqlite3_int64>(stats.rows));
+#endif
+  }
+
+  // Record the columns the query may use for this set of constraints.
+  // Bit 63 of colUsed is set if any column after the first 63 is used.
+  UsedColumns colsUsed;
+  for (size_t i = 0; i < columns.size(); i++) {
+    if ((pIdxInfo->colUsed & (1ULL << std::min<size_t>(i, 63))) == 0) {
+      continue;
+    }
+    const auto& name = std::get<0>(columns[i]);
+    colsUsed.insert(name);
+    // The content of an alias is generated by its target column.
+    auto alias = pVtab->content->aliases.find(name);
+    if (alias != pVtab->content->aliases.end()) {
+      colsUsed.insert(std::get<0>(columns[alias->second]));
+    }
+  }
+
+  // A table may generate rows ordered by a single ORDERED column.
+  TableScanPlan scan_plan;
+  if (pIdxInfo->nOrderBy == 1) {
+    const auto& order_by = pIdxInfo->aOrderBy[0];
+    if (order_by.iColumn >= 0 &&
+        static_cast<size_t>(order_by.iColumn) < columns.size() &&
+        std::get<2>(columns[order_by.iColumn]) & ColumnOptions::ORDERED) {
+      scan_plan.order_by = std::get<0>(columns[order_by.iColumn]);
+      scan_plan.descending = (order_by.desc != 0);
+      pIdxInfo->orderByConsumed = 1;
+    }
+  }
+
+#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+  // SQLite still applies every constraint to the generated rows, the limit
+  // only applies to the generated rows if there are no constraints.
+  // The limit arguments follow the constraint arguments in xFilter.
+  if (constraints.empty() && !constraints_skipped) {
+    for (const auto& i : limit_terms) {
+      pIdxInfo->aConstraintUsage[i].argvIndex = static_cast<int>(++expr_index);
+      auto argv = static_cast<int>(expr_index - 1);
+      if (pIdxInfo->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_LIMIT) {
+        scan_plan.limit_argv = argv;
+      } else {
+        scan_plan.offset_argv = argv;
+      }
+    }
+  }
+#endif
+
   pIdxInfo->idxNum = static_cast<int>(kConstraintIndexID++);
 #if defined(DEBUG)
   plan("Recording constraint set for table: " + pVtab->content->name +
@@ -427,18 +836,165 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
 #endif
   // Add the constraint set to the table's tracked constraints.
   pVtab->content->constraints[pIdxInfo->idxNum] = std::move(constraints);
+  pVtab->content->colsUsed[pIdxInfo->idxNum] = std::move(colsUsed);
+  pVtab->content->scanPlans[pIdxInfo->idxNum] = std::move(scan_plan);
+  auto* statements = pVtab->instance->statements();
+  if (statements != nullptr) {
+    // A cached statement restores the constraint set before each execution.
+    statements->addPlan(pVtab->content, pIdxInfo->idxNum);
+  }
   pIdxInfo->estimatedCost = cost;
   return SQLITE_OK;
 }
 
+/**
+ * @brief Find a table's memoized rows for a scan, nullptr if not memoized.
+ *
+ * Only scans whose constraints the table cannot use are memoized, the
+ * unconstrained rows are then a superset of every scan's rows.
+ */
+static TableScanMemo* getScanMemo(VirtualTableContent* content,
+                                  const ConstraintSet& constraints,
+                                  const QueryContext& context) {
+  if (!FLAGS_table_scan_memo || context.limit > 0 ||
+      (content->attributes & TableAttributes::EVENT_BASED) > 0) {
+    return nullptr;
+  }
+
+  for (const auto& column : content->columns) {
+    const auto& options = std::get<2>(column);
+    if (options & ColumnOptions::VOLATILE &&
+        context.isColumnUsed(std::get<0>(column))) {
+      return nullptr;
+    }
+  }
+
+  for (const auto& constraint : constraints) {
+    for (const auto& column : content->columns) {
+      if (std::get<0>(column) == constraint.first &&
+          std::get<2>(column) & kIndexColumnOptions) {
+        return nullptr;
+      }
+    }
+  }
+
+  // The rows depend on the columns used and the scan order.
+  std::string key;
+  if (context.colsUsed) {
+    std::set<std::string> columns(context.colsUsed->begin(),
+                                  context.colsUsed->end());
+    for (const auto& column : columns) {
+      key += column + ",";
+    }
+  } else {
+    key = "*";
+  }
+  key += "|" + context.orderBy + (context.orderDescending ? "|desc" : "");
+  return &content->scanMemos[key];
+}
+
+/**
+ * @brief The value SQLite compares a column content as, false if none.
+ *
+ * Integers are parsed as xColumn parses them, such that equal integers have
+ * the same value.
+ */
+static bool getMemoValue(ColumnType type,
+                         const std::string& content,
+                         size_t base,
+                         std::string& value) {
+  if (type == TEXT_TYPE) {
+    value = content;
+    return true;
+  } else if (type == INTEGER_TYPE || type == BIGINT_TYPE ||
+             type == UNSIGNED_BIGINT_TYPE) {
+    long long afinite;
+    if (!safeStrtoll(content, base, afinite) ||
+        (type == INTEGER_TYPE && (afinite < INT_MIN || afinite > INT_MAX))) {
+      return false;
+    }
+    value = std::to_string(afinite);
+    return true;
+  }
+  return false;
+}
+
+/// Get or build a memoized hash index for a column, nullptr if not indexed.
+static const TableScanMemo::Index* getMemoIndex(TableScanMemo& memo,
+                                                const std::string& column,
+                                                ColumnType type) {
+  auto it = memo.indexes.find(column);
+  if (it != memo.indexes.end()) {
+    return it->second.get_ptr();
+  }
+
+  auto& index = memo.indexes[column];
+  if (type != TEXT_TYPE && type != INTEGER_TYPE && type != BIGINT_TYPE &&
+      type != UNSIGNED_BIGINT_TYPE) {
+    return nullptr;
+  }
+
+  index = TableScanMemo::Index();
+  for (size_t i = 0; i < memo.rows.size(); i++) {
+    auto content = memo.rows[i].find(column);
+    std::string value;
+    // Rows without a comparable value are never equal to a constraint.
+    if (content != memo.rows[i].end() &&
+        getMemoValue(type, content->second, 0, value)) {
+      (*index)[value].push_back(i);
+    }
+  }
+  return index.get_ptr();
+}
+
+/// Select the memoized rows that may satisfy a scan's constraints.
+static void selectMemoRows(TableScanMemo& memo,
+                           const ConstraintSet& constraints,
+                           QueryContext& context,
+                           QueryData& results) {
+  for (const auto& constraint : constraints) {
+    if (constraint.second.op != EQUALS) {
+      continue;
+    }
+
+    const auto& list = context.constraints[constraint.first];
+    auto exprs = list.getAll(EQUALS);
+    if (exprs.size() != 1) {
+      continue;
+    }
+
+    auto* index = getMemoIndex(memo, constraint.first, list.affinity);
+    std::string value;
+    if (index == nullptr ||
+        !getMemoValue(list.affinity, *exprs.begin(), 10, value)) {
+      continue;
+    }
+
+    results.clear();
+    auto rows = index->find(value);
+    if (rows != index->end()) {
+      results.reserve(rows->second.size());
+      for (const auto& i : rows->second) {
+        results.push_back(memo.rows[i]);
+      }
+    }
+    return;
+  }
+
+  // There is no usable index, SQLite filters every row.
+  results = memo.rows;
+}
+
 static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
                    int idxNum,
                    const char* idxStr,
                    int argc,
                    sqlite3_value** argv) {
+  MEMORY_TAG(TABLES);
   BaseCursor* pCur = (BaseCursor*)pVtabCursor;
   auto* pVtab = (VirtualTable*)pVtabCursor->pVtab;
   auto* content = pVtab->content;
+  TRACE_SPAN("xFilter", content->name);
   if (FLAGS_table_delay > 0 && pVtab->instance->tableCalled(content)) {
     // Apply an optional sleep between table calls.
     sleepFor(FLAGS_table_delay);
@@ -448,6 +1004,11 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
   pCur->row = 0;
   pCur->n = 0;
   QueryContext context(content);
+  context.deadline = getQueryDeadline();
+  if (context.isCancelled()) {
+    // A JOIN filters the table again for each outer row.
+    return SQLITE_INTERRUPT;
+  }
 
   // The SQLite instance communicates to the TablePlugin via the context.
   context.useCache(pVtab->instance->useCache());
@@ -458,6 +1019,9 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
   // selected set of constraints for a match.
   bool required_satisfied = true;
 
+  // Scans the table can optimize have separately observed costs.
+  bool indexed = false;
+
   // The specialized table attribute USER_BASED imposes a special requirement
   // for UID. This may be represented in the requirements, but otherwise
   // would benefit from specific notification to the caller.
@@ -465,9 +1029,10 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
       (content->attributes & TableAttributes::USER_BASED) > 0 && isUserAdmin());
 
   // For event-based tables, help the caller if events are disabled.
+  // A read-only backing store is inspected for the events it already holds.
   bool events_satisfied =
       ((content->attributes & TableAttributes::EVENT_BASED) == 0 ||
-       !FLAGS_disable_events);
+       !FLAGS_disable_events || FLAGS_database_read_only);
 
   std::map<std::string, ColumnOptions> options;
   for (size_t i = 0; i < content->columns.size(); ++i) {
@@ -491,11 +1056,37 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
        std::to_string(argc) + " idx=" + std::to_string(idxNum) + "]");
 #endif
 
+  auto cols_used = content->colsUsed.find(idxNum);
+  if (cols_used != content->colsUsed.end()) {
+    context.colsUsed = cols_used->second;
+  }
+
+  auto scan_plan = content->scanPlans.find(idxNum);
+  if (scan_plan != content->scanPlans.end()) {
+    const auto& scan = scan_plan->second;
+    context.orderBy = scan.order_by;
+    context.orderDescending = scan.descending;
+    if (scan.limit_argv >= 0 && scan.limit_argv < argc) {
+      auto limit = sqlite3_value_int64(argv[scan.limit_argv]);
+      if (limit > 0 && scan.offset_argv >= 0 && scan.offset_argv < argc) {
+        limit += std::max<sqlite3_int64>(
+            sqlite3_value_int64(argv[scan.offset_argv]), 0);
+      }
+      context.limit = (limit > 0) ? static_cast<size_t>(limit) : 0;
+    }
+  }
+
+  // The columns and operators used, without expressions, shape the scan.
+  std::string shape;
+
   // Iterate over every argument to xFilter, filling in constraint values.
   if (content->constraints.size() > 0) {
     auto& constraints = content->constraints[idxNum];
     if (argc > 0) {
-      for (size_t i = 0; i < static_cast<size_t>(argc); ++i) {
+      // The LIMIT and OFFSET arguments follow the constraint arguments.
+      auto constraint_argc = std::min(static_cast<size_t>(argc),
+                                      constraints.size());
+      for (size_t i = 0; i < constraint_argc; ++i) {
         auto expr = (const char*)sqlite3_value_text(argv[i]);
         if (expr == nullptr || expr[0] == 0) {
           // SQLite did not expose the expression value.
@@ -517,11 +1108,20 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
     // Evaluate index and optimized constraint requirements.
     // These are satisfied regardless of expression content availability.
     for (const auto& constraint : constraints) {
+      if (!shape.empty()) {
+        shape += ",";
+      }
+      shape += constraint.first + " " + opString(constraint.second.op);
+
       if (options[constraint.first] & ColumnOptions::REQUIRED) {
         // A required option exists in the constraints.
         required_satisfied = true;
       }
 
+      if (options[constraint.first] & kIndexColumnOptions) {
+        indexed = true;
+      }
+
       if (!user_based_satisfied &&
           (constraint.first == "uid" || constraint.first == "username")) {
         // UID was required and exists in the constraints.
@@ -530,6 +1130,8 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
     }
   }
 
+  recordTableFilter(content->name, shape);
+
   if (!user_based_satisfied) {
     LOG(WARNING) << "The " << pVtab->content->name
                  << " table returns data based on the current user by default, "
@@ -552,30 +1154,244 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
 
   // Reset the virtual table contents.
   pCur->data.clear();
+  pCur->extension = nullptr;
+  pCur->rows_generator = nullptr;
+  pCur->rows = nullptr;
+  pCur->batch = nullptr;
+  pCur->batch_row = 0;
   options.clear();
 
   // Generate the row data set.
   plan("Scanning rows for cursor (" + std::to_string(pCur->id) + ")");
+  auto record = [content](bool scan_indexed,
+                          size_t rows,
+                          size_t bytes,
+                          std::chrono::steady_clock::time_point start,
+                          const ThreadUsage& cpu_start) {
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    recordTableScan(content->name,
+                    scan_indexed,
+                    rows,
+                    static_cast<size_t>(micros.count()));
+    TableUsageScope::record(content->name, rows, bytes);
+
+    ThreadUsage cpu;
+    if (!getThreadUsage(cpu).ok()) {
+      cpu = cpu_start;
+    }
+    recordTableGenerate(content->name,
+                        rows,
+                        static_cast<uint64_t>(micros.count()),
+                        cpu.user_time - cpu_start.user_time,
+                        cpu.system_time - cpu_start.system_time);
+  };
   if (Registry::get().exists("table", pVtab->content->name, true)) {
     auto plugin = Registry::get().plugin("table", pVtab->content->name);
     auto table = std::dynamic_pointer_cast<TablePlugin>(plugin);
+    if (table->usesTypedRows()) {
+      pCur->uses_typed_rows = true;
+      if (!table->usesGenerator()) {
+        // Materialized rows copy text into a per-query arena, which is kept
+        // by the cursor and reused if the cursor is filtered again.
+        if (pCur->arena == nullptr) {
+          pCur->arena = pVtab->instance->acquireArena();
+        } else {
+          pCur->arena->reset();
+        }
+        pCur->rows =
+            std::make_unique<TableRows>(content->columns, *pCur->arena);
+        ThreadUsage cpu;
+        getThreadUsage(cpu);
+        TRACE_SPAN("TablePlugin::generateRows", content->name);
+        auto start = std::chrono::steady_clock::now();
+        table->generateRows(*pCur->rows, context);
+        record(indexed, pCur->rows->size(), pCur->rows->bytes(), start, cpu);
+        pCur->batch = pCur->rows.get();
+        pCur->n = pCur->rows->size();
+        return SQLITE_OK;
+      }
+
+      // Generated batches use their own arena, released after each batch.
+      // Streamed rows are counted when the cursor is closed.
+      recordTableGenerate(content->name, 0, 0, 0, 0);
+      pCur->rows = std::make_unique<TableRows>(content->columns);
+      auto* rows = pCur->rows.get();
+      pCur->rows_generator = std::make_unique<TableRowsGenerator::pull_type>(
+          PooledProtectedStack(table->generatorStackSize()),
+          std::bind(
+              [table, rows](TableRowsYield& yield, QueryContext& ctx) {
+                table->rowsGenerator(yield, *rows, ctx);
+                if (!rows->empty()) {
+                  yield(*rows);
+                }
+              },
+              std::placeholders::_1,
+              std::move(context)));
+      if (*pCur->rows_generator) {
+        pCur->batch = &pCur->rows_generator->get();
+        pCur->generated.rows += pCur->batch->size();
+        pCur->generated.bytes += pCur->batch->bytes();
+        nextTypedBatch(pCur);
+      }
+      return SQLITE_OK;
+    }
+
     if (table->usesGenerator()) {
+      recordTableGenerate(content->name, 0, 0, 0, 0);
       pCur->uses_generator = true;
+      // A JOIN filters the table for each outer row, reusing pooled stacks.
       pCur->generator = std::make_unique<RowGenerator::pull_type>(
+          PooledProtectedStack(table->generatorStackSize()),
           std::bind(&TablePlugin::generator,
                     table,
                     std::placeholders::_1,
                     std::move(context)));
       if (*pCur->generator) {
         pCur->current = pCur->generator->get();
+        countGeneratedRow(pCur);
       }
       return SQLITE_OK;
     }
-    pCur->data = table->generate(context);
+
+    auto generate = [content, &table, &record](
+        QueryContext& ctx, QueryData& data, bool scan_indexed) {
+      auto shared = SharedScanCache::allowed(*content, ctx);
+      auto& scans = SharedScanCache::get();
+      std::string key;
+      auto tick = getUnixTime();
+      if (shared) {
+        // Scheduled queries of the same tick share identical table scans.
+        key = SharedScanCache::key(content->name, ctx);
+        if (scans.find(content->name, key, tick, data)) {
+          return;
+        }
+      }
+
+      ThreadUsage cpu;
+      getThreadUsage(cpu);
+      TRACE_SPAN("TablePlugin::generate", content->name);
+      auto start = std::chrono::steady_clock::now();
+      data = table->generate(ctx);
+      record(scan_indexed, data.size(), getUsageSize(data), start, cpu);
+      if (isTableRecording()) {
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+        recordTableFixture(
+            content->name, data, static_cast<uint64_t>(micros.count()));
+      }
+      if (shared) {
+        scans.add(key, tick, data);
+      }
+    };
+
+    // A table scanned again within the query, such as the inner table of a
+    // JOIN, generates its unconstrained rows once.
+    static const ConstraintSet kNoConstraints;
+    auto set = content->constraints.find(idxNum);
+    const auto& constraints =
+        (set != content->constraints.end()) ? set->second : kNoConstraints;
+    auto* memo = getScanMemo(content, constraints, context);
+    if (memo == nullptr || memo->scans++ == 0) {
+      generate(context, pCur->data, indexed);
+    } else {
+      if (!memo->generated) {
+        QueryContext unconstrained(content);
+        unconstrained.useCache(context.useCache());
+        for (const auto& column : content->columns) {
+          unconstrained.constraints[std::get<0>(column)].affinity =
+              std::get<1>(column);
+        }
+        unconstrained.colsUsed = context.colsUsed;
+        unconstrained.orderBy = context.orderBy;
+        unconstrained.orderDescending = context.orderDescending;
+        generate(unconstrained, memo->rows, false);
+        memo->generated = true;
+      }
+      selectMemoRows(*memo, constraints, context, pCur->data);
+    }
   } else {
     PluginRequest request = {{"action", "generate"}};
     TablePlugin::setRequestFromContext(context, request);
+
+    RouteUUID uuid = 0;
+    {
+      auto registry = Registry::get().registry("table");
+      auto route = registry->getExternal().find(pVtab->content->name);
+      if (route != registry->getExternal().end()) {
+        uuid = route->second;
+      }
+    }
+
+    if (uuid != 0 && ExtensionTableCache::allowed(*content)) {
+      // Cacheable extension tables are read completely, and the results are
+      // kept for the TTL, repeated requests do not call the extension.
+      auto& cache = ExtensionTableCache::get();
+      auto key = ExtensionTableCache::key(content->name, request);
+      auto now = getUnixTime();
+      if (!cache.find(content->name, key, now, pCur->data)) {
+        ThreadUsage cpu;
+        getThreadUsage(cpu);
+        auto start = std::chrono::steady_clock::now();
+        ExtensionTableCursor extension(uuid, content->name);
+        TableRows rows(content->columns);
+        auto status = extension.open(request, rows);
+        while (status.ok()) {
+          auto batch = rows.toQueryData();
+          pCur->data.insert(pCur->data.end(),
+                            std::make_move_iterator(batch.begin()),
+                            std::make_move_iterator(batch.end()));
+          rows.clear();
+          if (extension.done()) {
+            break;
+          }
+          status = extension.next(rows);
+        }
+
+        if (status.ok()) {
+          cache.add(content->name, key, now + content->cache_ttl, pCur->data);
+        } else {
+          VLOG(1) << "Extension table " << content->name
+                  << " failed: " << status.getMessage();
+          pCur->data.clear();
+        }
+        record(
+            indexed, pCur->data.size(), getUsageSize(pCur->data), start, cpu);
+      }
+      pCur->n = pCur->data.size();
+      return SQLITE_OK;
+    } else if (uuid != 0) {
+      // Extension tables are decoded from typed columns into the arena, a
+      // batch at a time.
+      pCur->uses_typed_rows = true;
+      if (pCur->arena == nullptr) {
+        pCur->arena = pVtab->instance->acquireArena();
+      } else {
+        pCur->arena->reset();
+      }
+      recordTableGenerate(content->name, 0, 0, 0, 0);
+      pCur->rows = std::make_unique<TableRows>(content->columns, *pCur->arena);
+      pCur->extension =
+          std::make_unique<ExtensionTableCursor>(uuid, pVtab->content->name);
+      auto status = pCur->extension->open(request, *pCur->rows);
+      if (!status.ok()) {
+        VLOG(1) << "Extension table " << pVtab->content->name
+                << " failed: " << status.getMessage();
+        pCur->rows->clear();
+        pCur->extension = nullptr;
+      }
+      pCur->generated.rows += pCur->rows->size();
+      pCur->generated.bytes += pCur->rows->bytes();
+      pCur->batch = pCur->rows.get();
+      nextExtensionBatch(pCur);
+      return SQLITE_OK;
+    }
+
+    ThreadUsage cpu;
+    getThreadUsage(cpu);
+    auto start = std::chrono::steady_clock::now();
     Registry::call("table", pVtab->content->name, request, pCur->data);
+    record(indexed, pCur->data.size(), getUsageSize(pCur->data), start, cpu);
   }
 
   // Set the number of rows.
@@ -625,9 +1441,18 @@ Status attachTableInternal(const std::string& name,
   // Note, if the clientData API is used then this will save a registry call
   // within xCreate.
   auto lock(instance->attachLock());
+  // The table is not requested again, even if attaching fails.
+  instance->setTableAttached(name, true, statement);
+  auto* statements = instance->statements();
+  if (statements != nullptr) {
+    // Prepared statements and query metadata depend on the attached tables.
+    statements->clear();
+  }
 
+  // Virtual tables refer to the instance owning the database, a temporary
+  // primary instance does not outlive its query.
   int rc = sqlite3_create_module(
-      instance->db(), name.c_str(), &module, (void*)&(*instance));
+      instance->db(), name.c_str(), &module, (void*)instance->connection());
   if (rc == SQLITE_OK || rc == SQLITE_MISUSE) {
     auto format =
         "CREATE VIRTUAL TABLE temp." + name + " USING " + name + statement;
@@ -641,8 +1466,18 @@ Status attachTableInternal(const std::string& name,
 Status detachTableInternal(const std::string& name,
                            const SQLiteDBInstanceRef& instance) {
   auto lock(instance->attachLock());
+  auto* statements = instance->statements();
+  if (statements != nullptr) {
+    // Cached statements may reference the table, see attachTableInternal.
+    statements->clear();
+  }
+
   auto format = "DROP TABLE IF EXISTS temp." + name;
   int rc = sqlite3_exec(instance->db(), format.c_str(), nullptr, nullptr, 0);
+  instance->setTableAttached(name, false);
+
+  // The results kept for an extension's table may not match its next route.
+  ExtensionTableCache::get().remove(name);
   if (rc != SQLITE_OK) {
     LOG(ERROR) << "Error detaching table: " << name << " (" << rc << ")";
   }
@@ -670,6 +1505,80 @@ Status attachFunctionInternal(
   return Status(rc);
 }
 
+/// Collect the lowercase words and quoted identifiers used by a query.
+static std::set<std::string> getQueryWords(const std::string& query) {
+  std::set<std::string> words;
+  size_t i = 0;
+  while (i < query.size()) {
+    auto c = query[i];
+    auto next = (i + 1 < query.size()) ? query[i + 1] : 0;
+    if (c == '\'') {
+      // String literals do not name tables, a doubled quote is an escape.
+      i++;
+      while (i < query.size()) {
+        if (query[i++] == '\'') {
+          if (i < query.size() && query[i] == '\'') {
+            i++;
+            continue;
+          }
+          break;
+        }
+      }
+    } else if (c == '-' && next == '-') {
+      i = query.find('\n', i);
+    } else if (c == '/' && next == '*') {
+      i = query.find("*/", i + 2);
+      i = (i == std::string::npos) ? i : i + 2;
+    } else if (c == '"' || c == '`' || c == '[') {
+      auto end = query.find((c == '[') ? ']' : c, i + 1);
+      if (end == std::string::npos) {
+        break;
+      }
+      words.insert(boost::to_lower_copy(query.substr(i + 1, end - i - 1)));
+      i = end + 1;
+    } else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+      auto start = i;
+      while (i < query.size() &&
+             (std::isalnum(static_cast<unsigned char>(query[i])) ||
+              query[i] == '_' || query[i] == '$')) {
+        i++;
+      }
+      words.insert(boost::to_lower_copy(query.substr(start, i - start)));
+    } else {
+      i++;
+    }
+  }
+  return words;
+}
+
+void attachQueryTables(const std::string& query,
+                       const SQLiteDBInstanceRef& instance) {
+  auto lock(instance->attachLock());
+  for (const auto& word : getQueryWords(query)) {
+    // Any word naming a registered table is attached, even a column name.
+    if (instance->tableAttached(word)) {
+      continue;
+    }
+
+    auto statement = getTableDefinition(word);
+    if (!statement.empty()) {
+      attachTableInternal(word, statement, instance);
+    }
+  }
+}
+
+std::string getTableDefinition(const std::string& name) {
+  if (!RegistryFactory::get().exists("table", name)) {
+    return "";
+  }
+
+  PluginResponse response;
+  if (!getTableColumns(name, response).ok()) {
+    return "";
+  }
+  return columnDefinition(response, true);
+}
+
 void attachVirtualTables(const SQLiteDBInstanceRef& instance) {
   if (FLAGS_enable_foreign) {
 #if !defined(OSQUERY_EXTERNAL)
@@ -678,15 +1587,6 @@ void attachVirtualTables(const SQLiteDBInstanceRef& instance) {
 #endif
   }
 
-  PluginResponse response;
-  for (const auto& name : RegistryFactory::get().names("table")) {
-    // Column information is nice for virtual table create call.
-    auto status =
-        Registry::call("table", name, {{"action", "columns"}}, response);
-    if (status.ok()) {
-      auto statement = columnDefinition(response, true);
-      attachTableInternal(name, statement, instance);
-    }
-  }
+  // Tables are attached when a query uses them, see attachQueryTables.
 }
 }
@@ -12,6 +12,7 @@
 
 #include <boost/noncopyable.hpp>
 
+#include <osquery/extensions.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
@@ -54,6 +55,33 @@ struct BaseCursor : private boost::noncopyable {
   /// Does the backing local table use a generator type.
   bool uses_generator{false};
 
+  /// Typed table data generated from last access.
+  std::unique_ptr<TableRows> rows{nullptr};
+
+  /// Callable typed generator, yields batches into rows.
+  std::unique_ptr<TableRowsGenerator::pull_type> rows_generator{nullptr};
+
+  /// The typed batch being read, nullptr if no rows remain.
+  TableRows* batch{nullptr};
+
+  /// Current cursor position within the typed batch.
+  size_t batch_row{0};
+
+  /// Does the backing local table use typed rows.
+  bool uses_typed_rows{false};
+
+  /// Arena acquired from the DB instance for typed rows text.
+  Arena* arena{nullptr};
+
+  /// Rows and bytes yielded by a generator, recorded when closed.
+  TableUsage generated;
+
+  /// Rows SQLite stepped over, recorded when closed.
+  size_t consumed{0};
+
+  /// Reads the batches of an extension table.
+  std::unique_ptr<ExtensionTableCursor> extension{nullptr};
+
   /// Current cursor position.
   size_t row{0};
 
@@ -92,9 +120,134 @@ Status attachFunctionInternal(
     std::function<
         void(sqlite3_context* context, int argc, sqlite3_value** argv)> func);
 
-/// Attach all table plugins to an in-memory SQLite database.
+/**
+ * @brief Prepare an in-memory SQLite database for virtual tables.
+ *
+ * Table plugins are not attached until a query uses them.
+ */
 void attachVirtualTables(const SQLiteDBInstanceRef& instance);
 
+/**
+ * @brief Attach the table plugins a query may use.
+ *
+ * Each word and quoted identifier of the query that names a registered table
+ * is attached, if it is not already. Column definitions are requested once
+ * per table and reused by every database.
+ */
+void attachQueryTables(const std::string& query,
+                       const SQLiteDBInstanceRef& instance);
+
+/**
+ * @brief The column definition a table plugin is attached with.
+ *
+ * @param name The table name.
+ * @return The definition, empty if the table is not registered.
+ */
+std::string getTableDefinition(const std::string& name);
+
+/// Drop the requested column definition of a table, the plugin changed.
+void clearTableColumns(const std::string& name);
+
+/// The observed generation cost of a table's scans.
+struct TableScanStats {
+  /// The number of recorded scans.
+  size_t scans{0};
+
+  /// The moving average of rows generated per scan.
+  double rows{0};
+
+  /// The moving average of microseconds spent generating per scan.
+  double micros{0};
+};
+
+/**
+ * @brief Record the generation cost of a table scan.
+ *
+ * Scans using a constraint on an INDEX, REQUIRED, ADDITIONAL, or OPTIMIZED
+ * column are recorded separately from scans the table cannot optimize.
+ */
+void recordTableScan(const std::string& name,
+                     bool indexed,
+                     size_t rows,
+                     size_t micros);
+
+/// Get the recorded generation cost of a table's scans, false if none.
+bool getTableScanStats(const std::string& name,
+                       bool indexed,
+                       TableScanStats& stats);
+
+/// Forget every recorded table scan.
+void clearTableScanStats();
+
+/// The execution counters of a table, reported by osquery_table_stats.
+struct TableExecutionStats {
+  /// The number of calls to the table's generate.
+  uint64_t generate_calls{0};
+
+  /// Rows generated, and rows SQLite stepped over.
+  uint64_t rows_generated{0};
+  uint64_t rows_consumed{0};
+
+  /// Wall and CPU time in microseconds spent within materialized generates.
+  uint64_t wall_time{0};
+  uint64_t user_time{0};
+  uint64_t system_time{0};
+
+  /// The number of scans by constraint shape, such as "pid =,name LIKE".
+  std::map<std::string, uint64_t> shapes;
+};
+
+/// Count a scan of a table and the shape of its constraints.
+void recordTableFilter(const std::string& name, const std::string& shape);
+
+/// Count a generate call, the rows it produced, and its wall and CPU time.
+void recordTableGenerate(const std::string& name,
+                         uint64_t rows,
+                         uint64_t wall_time,
+                         uint64_t user_time,
+                         uint64_t system_time);
+
+/// Count rows streamed by a closed cursor and the rows SQLite consumed.
+void recordTableConsumed(const std::string& name,
+                         uint64_t rows_generated,
+                         uint64_t rows_consumed);
+
+/// Get the execution counters of every table scanned.
+std::map<std::string, TableExecutionStats> getTableExecutionStats();
+
+/// Forget every table's execution counters.
+void clearTableExecutionStats();
+
+/**
+ * @brief Attribute the table scans of the calling thread to a query.
+ *
+ * The schedule monitor holds a scope while a query executes. Each table scan
+ * on the same thread adds the rows and bytes it generated, such that scans
+ * run concurrently by other threads are not attributed to the query.
+ */
+class TableUsageScope : private boost::noncopyable {
+ public:
+  TableUsageScope();
+  ~TableUsageScope();
+
+  /// Generated rows and bytes by table name.
+  const std::map<std::string, TableUsage>& tables() const {
+    return tables_;
+  }
+
+  /// Check if the calling thread holds a scope.
+  static bool active();
+
+  /// Add a scan to the calling thread's scope, if there is one.
+  static void record(const std::string& name, size_t rows, size_t bytes);
+
+ private:
+  std::map<std::string, TableUsage> tables_;
+
+  /// A scope held when this scope was created.
+  TableUsageScope* previous_{nullptr};
+};
+
 #if !defined(OSQUERY_EXTERNAL)
 /**
  * A generated foreign amalgamation file includes schema for all tables.
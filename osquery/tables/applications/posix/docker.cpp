@@ -8,13 +8,20 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/asio.hpp>
 #include <boost/foreach.hpp>
 
@@ -22,6 +29,8 @@
 #error Boost error: Local sockets not available
 #endif
 
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
@@ -44,63 +53,238 @@ FLAG(string,
      "/var/run/docker.sock",
      "Docker UNIX domain socket path");
 
+FLAG(uint32,
+     docker_api_concurrency,
+     8,
+     "Maximum concurrent docker API requests for per-container tables");
+
 namespace tables {
 
+/// Idle keep-alive connections kept open to the docker socket.
+const size_t kDockerMaxIdleConnections = 8;
+
+/// A keep-alive connection to the docker socket.
+struct DockerConnection {
+  /// The socket path the connection was opened with.
+  std::string socket;
+
+  local::stream_protocol::iostream stream;
+};
+
+using DockerConnectionRef = std::unique_ptr<DockerConnection>;
+
+/// Connections returned after a complete response, reused by later requests.
+static std::vector<DockerConnectionRef> kDockerConnections;
+
+static Mutex kDockerConnectionsMutex;
+
+/// Take an idle connection to the docker socket, if one is available.
+static DockerConnectionRef takeDockerConnection() {
+  WriteLock lock(kDockerConnectionsMutex);
+  while (!kDockerConnections.empty()) {
+    auto connection = std::move(kDockerConnections.back());
+    kDockerConnections.pop_back();
+    if (connection->socket == FLAGS_docker_socket && connection->stream) {
+      return connection;
+    }
+  }
+  return nullptr;
+}
+
+static void returnDockerConnection(DockerConnectionRef connection) {
+  WriteLock lock(kDockerConnectionsMutex);
+  if (kDockerConnections.size() < kDockerMaxIdleConnections) {
+    kDockerConnections.push_back(std::move(connection));
+  }
+}
+
+/**
+ * @brief Read a HTTP/1.1 response body from a docker connection.
+ *
+ * The body is delimited by a Content-Length, chunked transfer encoding, or
+ * the connection closing.
+ *
+ * @param stream The connection, positioned after the request was sent.
+ * @param body Output, the complete response body.
+ * @param reusable Output, true if another request may use the connection.
+ */
+static Status readDockerResponse(std::iostream& stream,
+                                 std::string& body,
+                                 bool& reusable) {
+  reusable = false;
+
+  // All status responses are expected to be 200
+  std::string line;
+  if (!getline(stream, line)) {
+    return Status(1, "Empty docker API response");
+  }
+  if (!boost::starts_with(line, "HTTP/1.") || line.size() < 12 ||
+      line.compare(8, 4, " 200") != 0) {
+    return Status(1, "Invalid docker API response: " + line);
+  }
+  bool keep_alive = boost::starts_with(line, "HTTP/1.1");
+
+  size_t length = 0;
+  bool has_length = false;
+  bool chunked = false;
+  while (getline(stream, line) && line != "\r") {
+    auto colon = line.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+
+    auto name = line.substr(0, colon);
+    auto value = line.substr(colon + 1);
+    boost::trim(value);
+    if (boost::iequals(name, "Content-Length")) {
+      length = std::strtoull(value.c_str(), nullptr, 10);
+      has_length = true;
+    } else if (boost::iequals(name, "Transfer-Encoding")) {
+      chunked = boost::iequals(value, "chunked");
+    } else if (boost::iequals(name, "Connection")) {
+      keep_alive = !boost::iequals(value, "close");
+    }
+  }
+
+  if (chunked) {
+    // Each chunk is a hex size line, the data, and a CRLF.
+    while (getline(stream, line)) {
+      auto size = std::strtoull(line.c_str(), nullptr, 16);
+      if (size == 0) {
+        // Skip trailers until the final empty line.
+        while (getline(stream, line) && line != "\r") {
+        }
+        break;
+      }
+
+      auto offset = body.size();
+      body.resize(offset + size);
+      if (!stream.read(&body[offset], size) || !getline(stream, line)) {
+        return Status(1, "Incomplete docker API response");
+      }
+    }
+  } else if (has_length) {
+    body.resize(length);
+    if (length > 0 && !stream.read(&body[0], length)) {
+      return Status(1, "Incomplete docker API response");
+    }
+  } else {
+    // Without a length the body ends when the connection is closed.
+    body.assign(std::istreambuf_iterator<char>(stream),
+                std::istreambuf_iterator<char>());
+    keep_alive = false;
+  }
+
+  reusable = keep_alive && stream.good();
+  return Status(0, "OK");
+}
+
 /**
  * @brief Makes API calls to the docker UNIX socket.
  *
+ * Requests use HTTP/1.1 keep-alive connections, idle connections are reused
+ * by later requests. A request on a reused connection that the daemon closed
+ * is retried once on a new connection.
+ *
  * @param uri Relative URI to invoke GET HTTP method.
  * @param tree Property tree where JSON result is stored.
  * @return Status with 0 code on success. Non-negative status with error
  *         message.
  */
 Status dockerApi(const std::string& uri, pt::ptree& tree) {
+  std::string body;
   try {
-    local::stream_protocol::endpoint ep(FLAGS_docker_socket);
-    local::stream_protocol::iostream stream(ep);
-    if (!stream) {
-      return Status(
-          1, "Error connecting to docker sock: " + stream.error().message());
-    }
+    Status status;
+    for (size_t attempt = 0; attempt < 2; attempt++) {
+      // A retry does not use another idle connection, it may also be closed.
+      auto connection = (attempt == 0) ? takeDockerConnection() : nullptr;
+      bool reused = (connection != nullptr);
+      if (!reused) {
+        connection.reset(new DockerConnection());
+        connection->socket = FLAGS_docker_socket;
+        connection->stream.connect(
+            local::stream_protocol::endpoint(FLAGS_docker_socket));
+        if (!connection->stream) {
+          return Status(1,
+                        "Error connecting to docker sock: " +
+                            connection->stream.error().message());
+        }
+      }
 
-    // Since keep-alive connections are not used, use HTTP/1.0
-    stream << "GET " << uri
-           << " HTTP/1.0\r\nAccept: */*\r\nConnection: close\r\n\r\n"
-           << std::flush;
-    if (stream.eof()) {
-      stream.close();
-      return Status(1, "Empty docker API response for: " + uri);
-    }
+      auto& stream = connection->stream;
+      stream << "GET " << uri
+             << " HTTP/1.1\r\nHost: docker\r\nAccept: */*\r\n\r\n"
+             << std::flush;
 
-    // All status responses are expected to be 200
-    std::string str;
-    getline(stream, str);
-    if (str != "HTTP/1.0 200 OK\r") {
-      stream.close();
-      return Status(1, "Invalid docker API response for " + uri + ": " + str);
-    }
+      body.clear();
+      bool reusable = false;
+      status = readDockerResponse(stream, body, reusable);
+      if (reusable) {
+        returnDockerConnection(std::move(connection));
+      }
 
-    // Skip empty line between header and body
-    while (!stream.eof() && str != "\r") {
-      getline(stream, str);
+      // Only an idle connection closed by the daemon is retried.
+      if (status.ok() || !reused || !body.empty()) {
+        break;
+      }
     }
 
-    try {
-      pt::read_json(stream, tree);
-    } catch (const pt::ptree_error& e) {
-      stream.close();
-      return Status(
-          1, "Error reading docker API response for " + uri + ": " + e.what());
+    if (!status.ok()) {
+      return Status(1, status.getMessage() + " for " + uri);
     }
-
-    stream.close();
   } catch (const std::exception& e) {
     return Status(1, std::string("Error calling docker API: ") + e.what());
   }
 
+  auto status = parseJSONContent(std::move(body), tree);
+  if (!status.ok()) {
+    return Status(1,
+                  "Error reading docker API response for " + uri + ": " +
+                      status.getMessage());
+  }
   return Status(0);
 }
 
+/**
+ * @brief Call a per-container docker API for each container.
+ *
+ * Requests for different containers are sent concurrently, up to
+ * docker_api_concurrency at a time.
+ *
+ * @param ids The container IDs.
+ * @param uri Builds the relative URI for a container ID.
+ * @param trees Output, the JSON result of each container, in order of ids.
+ * @return The status of each request, in order of ids.
+ */
+std::vector<Status> dockerApiEach(
+    const std::vector<std::string>& ids,
+    const std::function<std::string(const std::string&)>& uri,
+    std::vector<pt::ptree>& trees) {
+  std::vector<Status> statuses(ids.size());
+  trees.resize(ids.size());
+  std::atomic<size_t> next(0);
+
+  auto worker = ([&ids, &uri, &trees, &statuses, &next]() {
+    for (auto i = next++; i < ids.size(); i = next++) {
+      statuses[i] = dockerApi(uri(ids[i]), trees[i]);
+    }
+  });
+
+  size_t threads = std::min<size_t>(FLAGS_docker_api_concurrency, ids.size());
+  if (threads <= 1) {
+    worker();
+  } else {
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++) {
+      workers.emplace_back(worker);
+    }
+    for (auto& thread : workers) {
+      thread.join();
+    }
+  }
+  return statuses;
+}
+
 /**
  * @brief Entry point for docker_version table.
  */
@@ -517,22 +701,38 @@ QueryData genContainerPorts(QueryContext& context) {
   return results;
 }
 
+/// Collect the valid container IDs constrained by a query.
+static std::vector<std::string> getContainerIds(QueryContext& context) {
+  std::vector<std::string> ids;
+  for (const auto& id : context.constraints["id"].getAll(EQUALS)) {
+    if (checkConstraintValue(id)) {
+      ids.push_back(id);
+    }
+  }
+  return ids;
+}
+
 /**
  * @brief Entry point for docker_container_processes table.
  */
+
 QueryData genContainerProcesses(QueryContext& context) {
   QueryData results;
-  for (const auto& id : context.constraints["id"].getAll(EQUALS)) {
-    if (!checkConstraintValue(id)) {
-      continue;
-    }
-
-    pt::ptree container;
-    Status s =
-        dockerApi("/containers/" + id + "/top?ps_args=axwwo%20" +
-                      "pid,state,uid,gid,euid,egid,suid,sgid,rss,vsz,etimes,"
-                      "ppid,pgrp,nlwp,nice,user,time,pcpu,pmem,comm,cmd",
-                  container);
+  auto ids = getContainerIds(context);
+  std::vector<pt::ptree> containers;
+  auto statuses = dockerApiEach(
+      ids,
+      ([](const std::string& id) {
+        return "/containers/" + id + "/top?ps_args=axwwo%20" +
+               "pid,state,uid,gid,euid,egid,suid,sgid,rss,vsz,etimes,"
+               "ppid,pgrp,nlwp,nice,user,time,pcpu,pmem,comm,cmd";
+      }),
+      containers);
+
+  for (size_t i = 0; i < ids.size(); i++) {
+    const auto& id = ids[i];
+    const auto& container = containers[i];
+    const auto& s = statuses[i];
     if (!s.ok()) {
       VLOG(1) << "Error getting docker container " << id << ": " << s.what();
       continue;
@@ -684,14 +884,21 @@ std::string getNetworkBytes(const pt::ptree& tree, const std::string& key) {
  */
 QueryData genContainerStats(QueryContext& context) {
   QueryData results;
-  for (const auto& id : context.constraints["id"].getAll(EQUALS)) {
-    if (!checkConstraintValue(id)) {
-      continue;
-    }
-
-    pt::ptree container;
-    Status s =
-        dockerApi("/containers/" + id + "/stats?stream=false", container);
+  // The daemon samples stats for about a second, containers are requested
+  // concurrently.
+  auto ids = getContainerIds(context);
+  std::vector<pt::ptree> containers;
+  auto statuses = dockerApiEach(
+      ids,
+      ([](const std::string& id) {
+        return "/containers/" + id + "/stats?stream=false";
+      }),
+      containers);
+
+  for (size_t i = 0; i < ids.size(); i++) {
+    const auto& id = ids[i];
+    const auto& container = containers[i];
+    const auto& s = statuses[i];
     if (!s.ok()) {
       VLOG(1) << "Error getting docker container " << id << ": " << s.what();
       continue;
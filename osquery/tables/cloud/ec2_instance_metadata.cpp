@@ -18,8 +18,8 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
-#include "osquery/remote/http_client.h"
 #include "osquery/utils/aws_util.h"
+#include "osquery/utils/cloud_metadata.h"
 
 namespace pt = boost::property_tree;
 
@@ -36,13 +36,6 @@ class Ec2MetaData {
    */
   const std::string url_suffix_;
 
-  /**
-   * @brief Get metadata using HTTP.
-   *
-   * @return HTTP body.
-   */
-  std::string doGet() const;
-
   /**
    * @brief Extract relevant data from return API call, pure virtual
    *
@@ -57,14 +50,20 @@ class Ec2MetaData {
 
   virtual ~Ec2MetaData() {}
 
+  /// The metadata path of the accessor.
+  const std::string& path() const {
+    return url_suffix_;
+  }
+
   /**
-   * @brief HTTP get and extract data
+   * @brief Extract data from the metadata read for every accessor
    *
+   * @param bodies The response bodies by metadata path
    * @param r The row to which the value need to be added
    */
-  void get(Row& r) const {
-    const std::string http_body = doGet();
-    extractResult(http_body, r);
+  void get(const std::map<std::string, std::string>& bodies, Row& r) const {
+    auto body = bodies.find(url_suffix_);
+    extractResult((body != bodies.end()) ? body->second : "", r);
   }
 };
 
@@ -126,38 +125,6 @@ class JSONEc2MetaData : public Ec2MetaData {
   virtual ~JSONEc2MetaData() {}
 };
 
-std::string Ec2MetaData::doGet() const {
-  const static std::string ec2_metadata_url{kEc2MetadataUrl};
-
-  http::Request req(ec2_metadata_url + url_suffix_);
-  http::Client::Options options;
-  options.timeout(3);
-  http::Client client(options);
-
-  try {
-    http::Response res = client.get(req);
-    boost::uint16_t http_status_code = res.status();
-
-    // Silently ignore 404
-    if (http_status_code == 404) {
-      return "";
-    }
-
-    // Log "hard" errors
-    if (http_status_code != 200) {
-      VLOG(1) << "Unexpected HTTP response for: " << url_suffix_
-              << " Status: " << http_status_code;
-      return "";
-    }
-
-    return res.body();
-  } catch (std::system_error& e) {
-    VLOG(1) << "Request for " << url_suffix_ << " failed: " << e.what();
-  }
-
-  return "";
-}
-
 void setRowField(const ColumnType sql_type,
                  const std::string& column_name,
                  const std::string& value,
@@ -245,9 +212,17 @@ QueryData genEc2Metadata(QueryContext& context) {
        std::make_shared<SimpleEc2MetaData>(SimpleEc2MetaData(
            TEXT_TYPE, "security_groups", "meta-data/security-groups"))});
 
+  // Fields are read together, and cached, see cloud_metadata_ttl.
+  std::vector<std::string> paths;
+  for (const auto& it : fields) {
+    paths.push_back(it->path());
+  }
+  std::map<std::string, std::string> bodies;
+  Ec2Metadata::get().read(paths, bodies);
+
   Row r;
   for (const auto& it : fields) {
-    it->get(r);
+    it->get(bodies, r);
   }
 
   results.push_back(r);
@@ -15,18 +15,37 @@
 #include <aws/ec2/model/DescribeTagsRequest.h>
 
 #include <osquery/core.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/utils/aws_util.h"
 
 namespace osquery {
+
+DECLARE_uint64(cloud_metadata_ttl);
+
 namespace tables {
 
 namespace ec2 = Aws::EC2;
 namespace model = Aws::EC2::Model;
 
+/// The described tags, and the time they were described.
+static QueryData kEc2InstanceTags;
+static size_t kEc2InstanceTagsTime{0};
+
+/// Protection around the described tags.
+static Mutex kEc2InstanceTagsMutex;
+
 QueryData genEc2InstanceTags(QueryContext& context) {
+  // Tags are described at most once per cloud_metadata_ttl.
+  WriteLock lock(kEc2InstanceTagsMutex);
+  auto now = getUnixTime();
+  if (kEc2InstanceTagsTime > 0 &&
+      now - kEc2InstanceTagsTime < FLAGS_cloud_metadata_ttl) {
+    return kEc2InstanceTags;
+  }
+
   QueryData results;
   std::string instance_id, region;
   getInstanceIDAndRegion(instance_id, region);
@@ -64,6 +83,8 @@ QueryData genEc2InstanceTags(QueryContext& context) {
     results.push_back(r);
   }
 
+  kEc2InstanceTags = results;
+  kEc2InstanceTagsTime = now;
   return results;
 }
 }
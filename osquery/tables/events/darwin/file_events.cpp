@@ -38,6 +38,11 @@ class FileEventSubscriber : public EventSubscriber<FSEventsEventPublisher> {
   /// Walk the configuration's file paths, create subscriptions.
   void configure() override;
 
+  /// Hashing file content should not delay the publisher.
+  bool usesQueue() const override {
+    return true;
+  }
+
   /**
    * @brief This exports a single Callback for INotifyEventPublisher events.
    *
@@ -101,10 +106,13 @@ Status FileEventSubscriber::Callback(const FSEventsEventContextRef& ec,
   r["target_path"] = ec->path;
   r["category"] = sc->category;
   r["transaction_id"] = INTEGER(ec->transaction_id);
+  r["count"] = INTEGER(ec->count);
 
   // Add hashing and 'join' against the file table for stat-information.
-  decorateFileEvent(
-      ec->path, (ec->action == "CREATED" || ec->action == "UPDATED"), r);
+  decorateFileEvent(ec->path,
+                    (ec->action == "CREATED" || ec->action == "UPDATED"),
+                    r,
+                    [this](Row& hashed) { add(hashed); });
 
   add(r);
   return Status(0, "OK");
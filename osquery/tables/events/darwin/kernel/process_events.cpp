@@ -8,6 +8,8 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+
 #include <osquery/config.h>
 #include <osquery/logger.h>
 
@@ -22,6 +24,9 @@ class ProcessEventSubscriber : public EventSubscriber<KernelEventPublisher> {
   /// The process event subscriber declares a kernel event type subscription.
   Status init() override;
 
+  /// Subscribe to the configured executable paths, or every process.
+  void configure() override;
+
   /// Kernel events matching the event type will fire.
   Status Callback(const TypedKernelEventContextRef<osquery_process_event_t>& ec,
                   const KernelSubscriptionContextRef& sc);
@@ -34,12 +39,42 @@ Status ProcessEventSubscriber::init() {
   if (pubref == nullptr || pubref->isEnding()) {
     return Status(1, "No kernel event publisher");
   }
+  return Status(0, "OK");
+}
 
-  auto sc = createSubscriptionContext();
-  sc->event_type = OSQUERY_PROCESS_EVENT;
-  subscribe(&ProcessEventSubscriber::Callback, sc);
+void ProcessEventSubscriber::configure() {
+  removeSubscriptions();
+
+  // The kernel only publishes executions of paths beginning with a prefix.
+  std::vector<std::string> paths;
+  auto plugin = Config::get().getParser("events");
+  if (plugin != nullptr && plugin.get() != nullptr) {
+    const auto& data = plugin->getData();
+    if (data.get_child("events").count("kernel_process_paths") > 0) {
+      for (const auto& item : data.get_child("events.kernel_process_paths")) {
+        paths.push_back(item.second.data());
+      }
+    }
+  }
 
-  return Status(0, "OK");
+  if (paths.empty()) {
+    paths.push_back("");
+  }
+
+  // A path within another prefix would fire the callback twice.
+  std::sort(paths.begin(), paths.end());
+  for (size_t i = 0; i < paths.size(); i++) {
+    const auto& path = paths[i];
+    if (i > 0 && path.compare(0, paths[i - 1].size(), paths[i - 1]) == 0) {
+      paths[i] = paths[i - 1];
+      continue;
+    }
+
+    auto sc = createSubscriptionContext();
+    sc->event_type = OSQUERY_PROCESS_EVENT;
+    strncpy(sc->filter.path, path.c_str(), MAXPATHLEN - 1);
+    subscribe(&ProcessEventSubscriber::Callback, sc);
+  }
 }
 
 Status ProcessEventSubscriber::Callback(
@@ -8,19 +8,66 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <chrono>
+#include <map>
+#include <vector>
+
+#include <osquery/core.h>
 #include <osquery/events.h>
+#include <osquery/flags.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/process.h"
 #include "osquery/tables/events/event_utils.h"
 #include "osquery/tables/system/hash.h"
 
 namespace osquery {
 
+FLAG(bool,
+     file_events_hash_async,
+     false,
+     "Hash files of file events on a service thread, adding HASHED rows");
+
+FLAG(uint64,
+     file_events_hash_quiesce,
+     1000,
+     "Milliseconds without events before a file event's path is hashed");
+
 const std::set<std::string> kCommonFileColumns = {
     "inode", "uid", "gid", "mode", "size", "atime", "mtime", "ctime",
 };
 
-void decorateFileEvent(const std::string& path, bool hash, Row& r) {
+/// The maximum number of paths queued for the FileEventHasher.
+const size_t kFileEventHashMax = 10000;
+
+/// The pause between checks for quiesced paths.
+const std::chrono::milliseconds kFileEventHashPause(100);
+
+/// A path queued for the FileEventHasher.
+struct FileEventHash {
+  /// The latest event's row.
+  Row row;
+
+  /// Stores the follow-up row.
+  FileEventAdd add;
+
+  /// The number of events since the path was queued.
+  size_t count{0};
+
+  /// The time of the latest event.
+  std::chrono::steady_clock::time_point last;
+};
+
+/// Paths queued for the FileEventHasher.
+static std::map<std::string, FileEventHash> kFileEventHashes;
+
+/// Protection around kFileEventHashes.
+static Mutex kFileEventHashesMutex;
+
+std::atomic<bool> FileEventHasher::active_{false};
+
+/// Add the columns of the file table to a row.
+static void decorateFileStat(const std::string& path, Row& r) {
   auto results = SQL::selectAllFrom("file", "path", EQUALS, path);
   if (results.size() == 1) {
     auto& row = results.at(0);
@@ -30,18 +77,106 @@ void decorateFileEvent(const std::string& path, bool hash, Row& r) {
       }
     }
   }
+}
 
-  if (hash) {
-    auto hashes = hashMultiFromFile(
-        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
-    r["md5"] = std::move(hashes.md5);
-    r["sha1"] = std::move(hashes.sha1);
-    r["sha256"] = std::move(hashes.sha256);
-    // Hashed determines the success/status of hashing, -1 failed, 1 success.
-    r["hashed"] = (r.at("md5").empty()) ? "-1" : "1";
+/// Add the hashes to a row, and whether hashing succeeded.
+static void decorateFileHashes(MultiHashes hashes, Row& r) {
+  r["md5"] = std::move(hashes.md5);
+  r["sha1"] = std::move(hashes.sha1);
+  r["sha256"] = std::move(hashes.sha256);
+  // Hashed determines the success/status of hashing, -1 failed, 1 success.
+  r["hashed"] = (r.at("md5").empty()) ? "-1" : "1";
+}
+
+void decorateFileEvent(const std::string& path,
+                       bool hash,
+                       Row& r,
+                       FileEventAdd add) {
+  decorateFileStat(path, r);
+
+  if (hash && FLAGS_file_events_hash_async && add != nullptr) {
+    // The hashes are added by a follow-up row, -1 if they will not be.
+    r["hashed"] = FileEventHasher::queue(path, r, std::move(add)) ? "0" : "-1";
+  } else if (hash) {
+    decorateFileHashes(
+        hashMultiFromFile(
+            HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path),
+        r);
   } else {
     // Alternatively if hashing wasn't needed hashed is a 0.
     r["hashed"] = "0";
   }
 }
+
+bool FileEventHasher::queue(const std::string& path,
+                            const Row& r,
+                            FileEventAdd add) {
+  {
+    WriteLock lock(kFileEventHashesMutex);
+    auto entry = kFileEventHashes.find(path);
+    if (entry == kFileEventHashes.end()) {
+      if (kFileEventHashes.size() >= kFileEventHashMax) {
+        return false;
+      }
+      entry = kFileEventHashes.emplace(path, FileEventHash()).first;
+    }
+
+    // Repeated events restart the quiesce period.
+    entry->second.row = r;
+    entry->second.add = std::move(add);
+    entry->second.count++;
+    entry->second.last = std::chrono::steady_clock::now();
+  }
+
+  bool active = false;
+  if (active_.compare_exchange_strong(active, true) &&
+      !Dispatcher::addService(std::make_shared<FileEventHasher>()).ok()) {
+    active_ = false;
+  }
+  return true;
+}
+
+size_t FileEventHasher::hash(bool all) {
+  std::vector<std::pair<std::string, FileEventHash>> quiesced;
+  {
+    auto now = std::chrono::steady_clock::now();
+    auto quiesce = std::chrono::milliseconds(FLAGS_file_events_hash_quiesce);
+    WriteLock lock(kFileEventHashesMutex);
+    for (auto it = kFileEventHashes.begin(); it != kFileEventHashes.end();) {
+      if (all || now - it->second.last >= quiesce) {
+        quiesced.emplace_back(it->first, std::move(it->second));
+        it = kFileEventHashes.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Files are hashed without holding the queue lock.
+  for (auto& item : quiesced) {
+    const auto& path = item.first;
+    auto& r = item.second.row;
+    r["action"] = "HASHED";
+    r["count"] = INTEGER(item.second.count);
+    decorateFileStat(path, r);
+
+    // The events changed the file, hashes cached before are stale.
+    invalidateFileHash(path);
+    MultiHashes hashes = {};
+    hashMultiFromCache(
+        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path, hashes);
+    decorateFileHashes(std::move(hashes), r);
+    item.second.add(r);
+  }
+  return quiesced.size();
+}
+
+void FileEventHasher::start() {
+  BackgroundPriorityGuard priority;
+  while (!interrupted()) {
+    pauseMilli(kFileEventHashPause);
+    hash(false);
+  }
+  active_ = false;
+}
 }
@@ -10,9 +10,12 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <set>
 #include <string>
 
+#include <osquery/dispatcher.h>
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -20,15 +23,65 @@ namespace osquery {
 /// List of columns decorated for file events.
 extern const std::set<std::string> kCommonFileColumns;
 
+/// Store a row as an event of the subscriber that decorated a file event.
+using FileEventAdd = std::function<void(Row&)>;
+
 /**
  * @brief A helper function for each platform's implementation of file_events.
  *
  * Given an action and path, this Row decorator assures a common implementation
  * of hashing and common columns from the `file` table.
  *
+ * When file_events_hash_async is set and the subscriber provides add, the
+ * path is hashed by the FileEventHasher instead. The row is stored without
+ * hashes and a follow-up "HASHED" row is added once the file is hashed.
+ *
  * @param path The target path from the file event.
  * @param hash Should the target path be read and hashed.
  * @param r The output parameter row structure.
+ * @param add Stores the follow-up row, see FileEventAdd.
+ */
+void decorateFileEvent(const std::string& path,
+                       bool hash,
+                       Row& r,
+                       FileEventAdd add = nullptr);
+
+/**
+ * @brief Hash the files of file events on a service thread.
+ *
+ * Paths are queued once, repeated events for a queued path update its row
+ * and count. A path is hashed once it has no events for
+ * file_events_hash_quiesce milliseconds, such that a burst of writes to a
+ * file is hashed once, after the writes complete. Hashes are kept in the file
+ * hash cache used by the hash table.
  */
-void decorateFileEvent(const std::string& path, bool hash, Row& r);
+class FileEventHasher : public InternalRunnable {
+ public:
+  FileEventHasher() : InternalRunnable("FileEventHasher") {}
+
+  /// Thread entrypoint.
+  void start() override;
+
+  /**
+   * @brief Queue a path to hash, starting the service if it is not running.
+   *
+   * @param path The target path from the file event.
+   * @param r The event's row, copied into the follow-up row.
+   * @param add Stores the follow-up row.
+   * @return false if the queue is full and the path is not hashed.
+   */
+  static bool queue(const std::string& path, const Row& r, FileEventAdd add);
+
+  /**
+   * @brief Hash the queued paths and add their follow-up rows.
+   *
+   * @param all Hash every queued path, not only those that quiesced.
+   * @return The number of paths hashed.
+   */
+  static size_t hash(bool all);
+
+ private:
+  /// Set from when the service is added until its thread stops.
+  static std::atomic<bool> active_;
+};
 }
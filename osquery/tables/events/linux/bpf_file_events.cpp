@@ -0,0 +1,125 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <fcntl.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <osquery/config.h>
+#include <osquery/core.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/linux/bpf.h"
+#include "osquery/events/linux/fanotify.h"
+#include "osquery/events/pathset.h"
+
+namespace osquery {
+
+/// Opens that may change a file, categories without file_accesses use these.
+const uint64_t kBPFWriteFlags = O_WRONLY | O_RDWR | O_CREAT | O_TRUNC;
+
+/**
+ * @brief Track opens of the paths in file_paths using eBPF.
+ *
+ * Every open on the system is matched against the configured paths, so the
+ * number of monitored paths does not depend on inotify watch limits.
+ */
+class BPFFileEventSubscriber : public EventSubscriber<BPFEventPublisher> {
+ public:
+  Status init() override {
+    return Status(0);
+  }
+
+  /// Walk the configuration's file paths, create a subscription per category.
+  void configure() override;
+
+  /// Opens of a path in the subscription's category fire.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+
+ private:
+  /// Paths matched for each category.
+  std::map<std::string, std::shared_ptr<PathSet<patternedPath>>> paths_;
+
+  /// Protects the paths, which are replaced when the config changes.
+  Mutex paths_mutex_;
+};
+
+REGISTER(BPFFileEventSubscriber, "event_subscriber", "bpf_file_events");
+
+void BPFFileEventSubscriber::configure() {
+  removeSubscriptions();
+
+  std::map<std::string, std::shared_ptr<PathSet<patternedPath>>> paths;
+  Config::get().files(([&paths](const std::string& category,
+                                const std::vector<std::string>& files) {
+    auto& set = paths[category];
+    if (set == nullptr) {
+      set = std::make_shared<PathSet<patternedPath>>();
+    }
+
+    for (const auto& file : files) {
+      std::vector<std::string> patterns;
+      getFanotifyPatterns(file, patterns);
+      for (const auto& pattern : patterns) {
+        set->insert(pattern);
+      }
+    }
+  }));
+
+  {
+    WriteLock lock(paths_mutex_);
+    paths_ = paths;
+  }
+
+  auto parser = Config::getParser("file_paths");
+  auto& accesses = parser->getData().get_child("file_accesses");
+  for (const auto& category : paths) {
+    auto sc = createSubscriptionContext();
+    sc->types = kBPFOpen;
+    sc->category = category.first;
+    sc->open_flags = (accesses.count(category.first) > 0) ? 0 : kBPFWriteFlags;
+    subscribe(&BPFFileEventSubscriber::Callback, sc);
+  }
+}
+
+Status BPFFileEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  // A relative path is only matched if the descriptor was resolved.
+  const auto& path = (ec->target.empty()) ? ec->path : ec->target;
+  if (path.empty() || path[0] != '/') {
+    return Status(0);
+  }
+
+  {
+    ReadLock lock(paths_mutex_);
+    auto paths = paths_.find(sc->category);
+    if (paths == paths_.end() || !paths->second->find(path)) {
+      return Status(0);
+    }
+  }
+
+  Row r;
+  r["action"] = ((ec->arg & kBPFWriteFlags) != 0) ? "OPENED_WRITE" : "OPENED";
+  r["target_path"] = path;
+  r["category"] = sc->category;
+  r["flags"] = BIGINT(ec->arg);
+  r["fd"] = BIGINT(ec->ret);
+  r["pid"] = BIGINT(ec->pid);
+  r["uid"] = BIGINT(ec->uid);
+  r["gid"] = BIGINT(ec->gid);
+  r["path"] = ec->exe;
+  r["uptime"] = BIGINT(ec->uptime);
+  add(r);
+  return Status(0, "OK");
+}
+} // namespace osquery
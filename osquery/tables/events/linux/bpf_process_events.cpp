@@ -0,0 +1,55 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/bpf.h"
+
+namespace osquery {
+
+class BPFProcessEventSubscriber : public EventSubscriber<BPFEventPublisher> {
+ public:
+  /// The subscriber declares an exec subscription.
+  Status init() override;
+
+  /// Successful execs fire.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(BPFProcessEventSubscriber, "event_subscriber", "bpf_process_events");
+
+Status BPFProcessEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->types = kBPFExec;
+  subscribe(&BPFProcessEventSubscriber::Callback, sc);
+  return Status(0, "OK");
+}
+
+Status BPFProcessEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  Row r;
+  r["pid"] = BIGINT(ec->pid);
+  r["tid"] = BIGINT(ec->tid);
+  r["parent"] = BIGINT(ec->parent);
+  r["uid"] = BIGINT(ec->uid);
+  r["gid"] = BIGINT(ec->gid);
+
+  // The executable may have exited before it was resolved.
+  r["path"] = (ec->exe.empty()) ? ec->path : ec->exe;
+  r["cwd"] = ec->cwd;
+  r["cmdline"] = join(ec->args, " ");
+  r["cmdline_size"] = BIGINT(r["cmdline"].size());
+  r["overflows"] = (ec->args_truncated) ? "cmdline" : "";
+  r["uptime"] = BIGINT(ec->uptime);
+  add(r);
+  return Status(0, "OK");
+}
+} // namespace osquery
@@ -0,0 +1,70 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <sys/socket.h>
+
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/linux/bpf.h"
+
+namespace osquery {
+
+class BPFSocketEventSubscriber : public EventSubscriber<BPFEventPublisher> {
+ public:
+  /// The subscriber declares a connect, bind, and accept subscription.
+  Status init() override;
+
+  /// Successful, or in progress, socket syscalls fire.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(BPFSocketEventSubscriber, "event_subscriber", "bpf_socket_events");
+
+Status BPFSocketEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->types = kBPFConnect | kBPFBind | kBPFAccept;
+  subscribe(&BPFSocketEventSubscriber::Callback, sc);
+  return Status(0, "OK");
+}
+
+Status BPFSocketEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  Row r;
+  if (ec->type == kBPFConnect) {
+    r["action"] = "connect";
+  } else if (ec->type == kBPFBind) {
+    r["action"] = "bind";
+  } else {
+    r["action"] = "accept";
+  }
+
+  r["pid"] = BIGINT(ec->pid);
+  r["uid"] = BIGINT(ec->uid);
+  r["path"] = ec->exe;
+  r["comm"] = ec->comm;
+
+  // An accepted socket is the descriptor returned.
+  r["fd"] = BIGINT((ec->type == kBPFAccept) ? ec->ret : ec->arg);
+  r["success"] = INTEGER(ec->ret == 0 || ec->type == kBPFAccept);
+  r["family"] = INTEGER(ec->family);
+  if (ec->family == AF_UNIX) {
+    r["socket"] = ec->address;
+  } else if (ec->type == kBPFBind) {
+    r["local_address"] = ec->address;
+    r["local_port"] = INTEGER(ec->port);
+  } else {
+    r["remote_address"] = ec->address;
+    r["remote_port"] = INTEGER(ec->port);
+  }
+  r["uptime"] = BIGINT(ec->uptime);
+  add(r);
+  return Status(0, "OK");
+}
+} // namespace osquery
@@ -35,6 +35,11 @@ class FileEventSubscriber : public EventSubscriber<INotifyEventPublisher> {
   /// Walk the configuration's file paths, create subscriptions.
   void configure() override;
 
+  /// Hashing file content should not delay the publisher.
+  bool usesQueue() const override {
+    return true;
+  }
+
   /**
    * @brief This exports a single Callback for INotifyEventPublisher events.
    *
@@ -90,11 +95,14 @@ Status FileEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   r["target_path"] = ec->path;
   r["category"] = sc->category;
   r["transaction_id"] = INTEGER(ec->event->cookie);
+  r["count"] = INTEGER(ec->count);
 
   if ((sc->mask & kFileAccessMasks) != kFileAccessMasks) {
     // Add hashing and 'join' against the file table for stat-information.
-    decorateFileEvent(
-        ec->path, (ec->action == "CREATED" || ec->action == "UPDATED"), r);
+    decorateFileEvent(ec->path,
+                      (ec->action == "CREATED" || ec->action == "UPDATED"),
+                      r,
+                      [this](Row& hashed) { add(hashed); });
   } else {
     // The access event on Linux would generate additional events if hashed.
     decorateFileEvent(ec->path, false, r);
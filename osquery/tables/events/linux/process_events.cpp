@@ -9,6 +9,7 @@
  */
 
 #include <osquery/config.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 #include <osquery/system.h>
@@ -17,6 +18,12 @@
 
 namespace osquery {
 
+FLAG(uint64,
+     audit_max_argument_bytes,
+     0,
+     "Bytes of execve arguments recorded in a process_events cmdline, 0 for "
+     "no limit");
+
 #define AUDIT_SYSCALL_EXECVE 59
 
 // Depend on the external getUptime table method.
@@ -24,16 +31,18 @@ namespace tables {
 extern long getUptime();
 }
 
-bool ProcessUpdate(size_t type, const AuditFields& fields, AuditFields& r) {
+bool ProcessUpdate(size_t type,
+                   const AuditFieldView& fields,
+                   AuditFields& r) {
   if (type == AUDIT_SYSCALL) {
-    r["auid"] = (fields.count("auid")) ? fields.at("auid") : "0";
-    r["pid"] = (fields.count("pid")) ? fields.at("pid") : "0";
-    r["parent"] = fields.count("ppid") ? fields.at("ppid") : "0";
-    r["uid"] = fields.count("uid") ? fields.at("uid") : "0";
-    r["euid"] = fields.count("euid") ? fields.at("euid") : "0";
-    r["gid"] = fields.count("gid") ? fields.at("gid") : "0";
-    r["egid"] = fields.count("egid") ? fields.at("euid") : "0";
-    r["path"] = (fields.count("exe")) ? decodeAuditValue(fields.at("exe")) : "";
+    r["auid"] = fields.get("auid", "0");
+    r["pid"] = fields.get("pid", "0");
+    r["parent"] = fields.get("ppid", "0");
+    r["uid"] = fields.get("uid", "0");
+    r["euid"] = fields.get("euid", "0");
+    r["gid"] = fields.get("gid", "0");
+    r["egid"] = fields.count("egid") ? fields.get("euid") : "0";
+    r["path"] = decodeAuditValue(fields.get("exe"));
 
     auto qd = SQL::selectAllFrom("file", "path", EQUALS, r.at("path"));
     if (qd.size() == 1) {
@@ -44,7 +53,7 @@ bool ProcessUpdate(size_t type, const AuditFields& fields, AuditFields& r) {
     }
 
     // This should get overwritten during the EXECVE state.
-    r["cmdline"] = (fields.count("comm")) ? fields.at("comm") : "";
+    r["cmdline"] = fields.get("comm");
     // Do not record a cmdline size. If the final state is reached and no
     // 'argc'
     // has been filled in then the EXECVE state was not used.
@@ -57,37 +66,57 @@ bool ProcessUpdate(size_t type, const AuditFields& fields, AuditFields& r) {
   }
 
   if (type == AUDIT_EXECVE) {
+    // Size the amalgamated "arg*" fields before decoding them.
+    size_t size = 0;
+    for (const auto& arg : fields) {
+      if (arg.first == "argc") {
+        continue;
+      }
+      size += ((size > 0) ? 1 : 0) + getAuditValueSize(arg.second);
+    }
+
+    size_t limit = size;
+    if (FLAGS_audit_max_argument_bytes > 0) {
+      limit = std::min<size_t>(size, FLAGS_audit_max_argument_bytes);
+    }
+
     // Reset the temporary storage from the SYSCALL state.
-    r["cmdline"] = "";
+    auto& cmdline = r["cmdline"];
+    cmdline.clear();
+    cmdline.reserve(limit);
     for (const auto& arg : fields) {
+      if (cmdline.size() >= limit) {
+        break;
+      }
+
       if (arg.first == "argc") {
         continue;
       }
 
-      // Amalgamate all the "arg*" fields.
-      if (r.at("cmdline").size() > 0) {
-        r["cmdline"] += " ";
+      if (cmdline.size() > 0) {
+        cmdline += ' ';
       }
-      r["cmdline"] += decodeAuditValue(arg.second);
+      appendAuditValue(arg.second, cmdline, limit - cmdline.size());
     }
 
-    // There may be a better way to calculate actual size from audit.
-    // Then an overflow could be calculated/determined based on
-    // actual/expected.
-    r["cmdline_size"] = std::to_string(r.at("cmdline").size());
+    // The size of the arguments is reported when the cmdline is truncated.
+    r["cmdline_size"] = std::to_string(size);
+    if (cmdline.size() < size) {
+      r["overflows"] = "cmdline";
+    }
 
     // Uptime is helpful for execution-based events.
     r["uptime"] = std::to_string(tables::getUptime());
   }
 
   if (type == AUDIT_PATH) {
-    r["mode"] = (fields.count("mode")) ? fields.at("mode") : "";
-    r["owner_uid"] = fields.count("ouid") ? fields.at("ouid") : "0";
-    r["owner_gid"] = fields.count("ogid") ? fields.at("ogid") : "0";
+    r["mode"] = fields.get("mode");
+    r["owner_uid"] = fields.get("ouid", "0");
+    r["owner_gid"] = fields.get("ogid", "0");
   }
 
   if (type == AUDIT_CWD) {
-    r["cwd"] = fields.count("cwd") ? decodeAuditValue(fields.at("cwd")) : "";
+    r["cwd"] = decodeAuditValue(fields.get("cwd"));
   }
   return true;
 }
@@ -118,6 +147,12 @@ Status ProcessEventSubscriber::init() {
   // Request call backs for all parts of the process execution state.
   // Drop events if they are encountered outside of the expected state.
   sc->types = {AUDIT_SYSCALL, AUDIT_EXECVE, AUDIT_CWD, AUDIT_PATH};
+
+  // Only the fields used by ProcessUpdate are parsed, EXECVE arguments are
+  // selected with the 'a' prefix.
+  sc->fields = {"success", "item",  "auid", "pid",  "ppid", "uid",
+                "euid",    "gid",   "egid", "exe",  "comm", "argc",
+                "a*",      "mode",  "ouid", "ogid", "cwd"};
   subscribe(&ProcessEventSubscriber::Callback, sc);
 
   return Status(0, "OK");
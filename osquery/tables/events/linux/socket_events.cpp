@@ -8,6 +8,8 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <arpa/inet.h>
+
 #include <boost/algorithm/hex.hpp>
 #include <boost/algorithm/string.hpp>
 
@@ -33,6 +35,14 @@ HIDDEN_FLAG(bool,
             false,
             "Allow socket events to collect domain sockets");
 
+FLAG(uint64,
+     audit_socket_dedupe_window,
+     0,
+     "Seconds to collapse identical socket events into one row (0 disables)");
+
+/// The most distinct socket events collapsed within a window.
+const size_t kSocketDedupeMax = 4096;
+
 // Depend on the external getUptime table method.
 namespace tables {
 extern long getUptime();
@@ -54,45 +64,104 @@ class SocketEventSubscriber : public EventSubscriber<AuditEventPublisher> {
   /// Kernel events matching the event type will fire.
   Status Callback(const ECRef& ec, const SCRef& sc);
 
+  /// Add the collapsed rows of an ended dedupe window before a query.
+  void genTable(RowYield& yield, QueryContext& ctx) override {
+    {
+      WriteLock lock(collapsed_mutex_);
+      addCollapsed(false);
+    }
+    EventSubscriber::genTable(yield, ctx);
+  }
+
+ private:
+  /**
+   * @brief Collapse an event into the current dedupe window.
+   *
+   * Events with the same pid, action, address, and port are added as a single
+   * row with a count when the window ends.
+   */
+  void collapse(AuditFields& fields);
+
+  /// Add the collapsed rows if the window ended, or if forced, while locked.
+  void addCollapsed(bool force);
+
  private:
   AuditAssembler asm_;
+
+  /// The collapsed rows of the current window, and their counts.
+  std::map<std::string, std::pair<AuditFields, size_t>> collapsed_;
+
+  /// The start time of the current dedupe window.
+  size_t window_start_{0};
+
+  /// Protect the collapsed rows, a query may end a window.
+  Mutex collapsed_mutex_;
 };
 
 REGISTER(SocketEventSubscriber, "event_subscriber", "socket_events");
 
-inline std::string ip4FromSaddr(const std::string& saddr, ushort offset) {
-  long result{0};
-  safeStrtol(saddr.substr(offset, 8), 16, result);
-  return std::to_string((result & 0xff000000) >> 24) + '.' +
-         std::to_string((result & 0x00ff0000) >> 16) + '.' +
-         std::to_string((result & 0x0000ff00) >> 8) + '.' +
-         std::to_string((result & 0x000000ff));
+/**
+ * @brief Decode hex digit pairs of an audit saddr field into bytes.
+ *
+ * @return false if the field is too short or contains a non-hex digit.
+ */
+inline bool decodeSaddr(const std::string& saddr,
+                        size_t offset,
+                        size_t size,
+                        unsigned char* bytes) {
+  if (saddr.size() < offset + size * 2) {
+    return false;
+  }
+
+  // Invalid digits are negative, a single check covers every digit.
+  int digits = 0;
+  for (size_t i = 0; i < size; i++) {
+    auto high = getAuditHexDigit(saddr[offset + i * 2]);
+    auto low = getAuditHexDigit(saddr[offset + i * 2 + 1]);
+    digits |= high | low;
+    bytes[i] = static_cast<unsigned char>((high << 4) | low);
+  }
+  return digits >= 0;
 }
 
 bool parseSockAddr(const std::string& saddr, AuditFields& r) {
+  // The sockaddr family, port, and address are at fixed hex offsets.
+  unsigned char port[2];
+  unsigned char address[16];
+
   // The protocol is not included in the audit message.
   if (saddr[0] == '0' && saddr[1] == '2') {
     // IPv4
+    if (!decodeSaddr(saddr, 4, 2, port) || !decodeSaddr(saddr, 8, 4, address)) {
+      return false;
+    }
+
+    char ip[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, address, ip, sizeof(ip));
     r["family"] = '2';
-    long result{0};
-    safeStrtol(saddr.substr(4, 4), 16, result);
-    r["remote_port"] = INTEGER(result);
-    r["remote_address"] = ip4FromSaddr(saddr, 8);
+    r["remote_port"] = INTEGER((port[0] << 8) | port[1]);
+    r["remote_address"] = ip;
   } else if (saddr[0] == '0' && saddr[1] == 'A') {
-    // IPv6
-    r["family"] = "10";
-    long result{0};
-    safeStrtol(saddr.substr(4, 4), 16, result);
-    r["remote_port"] = INTEGER(result);
-    std::string address;
-    for (size_t i = 0; i < 8; ++i) {
-      address += saddr.substr(16 + (i * 4), 4);
-      if (i == 0 || i % 7 != 0) {
-        address += ':';
+    // IPv6, after the port are 4 bytes of flow information.
+    if (!decodeSaddr(saddr, 4, 2, port) ||
+        !decodeSaddr(saddr, 16, 16, address)) {
+      return false;
+    }
+
+    // Each of the 8 groups is written in full, rather than compressed.
+    static const char kHex[] = "0123456789abcdef";
+    char ip[40];
+    size_t length = 0;
+    for (size_t i = 0; i < 16; i++) {
+      ip[length++] = kHex[address[i] >> 4];
+      ip[length++] = kHex[address[i] & 0xf];
+      if (i % 2 == 1 && i != 15) {
+        ip[length++] = ':';
       }
     }
-    boost::algorithm::to_lower(address);
-    r["remote_address"] = std::move(address);
+    r["family"] = "10";
+    r["remote_port"] = INTEGER((port[0] << 8) | port[1]);
+    r["remote_address"] = std::string(ip, length);
   } else if (saddr[0] == '0' && saddr[1] == '1' && saddr.size() > 6) {
     // Unix domain socket.
     if (!FLAGS_audit_allow_unix) {
@@ -117,9 +186,11 @@ bool parseSockAddr(const std::string& saddr, AuditFields& r) {
   return true;
 }
 
-bool SocketUpdate(size_t type, const AuditFields& fields, AuditFields& r) {
+bool SocketUpdate(size_t type,
+                  const AuditFieldView& fields,
+                  AuditFields& r) {
   if (type == AUDIT_TYPE_SOCKADDR) {
-    const auto& saddr = fields.at("saddr");
+    auto saddr = fields.at("saddr").to_string();
     if (saddr.size() < 4 || saddr[0] == '1') {
       return false;
     }
@@ -134,11 +205,11 @@ bool SocketUpdate(size_t type, const AuditFields& fields, AuditFields& r) {
     return true;
   }
 
-  r["auid"] = fields.at("auid");
-  r["pid"] = fields.at("pid");
+  r["auid"] = fields.at("auid").to_string();
+  r["pid"] = fields.at("pid").to_string();
   r["path"] = decodeAuditValue(fields.at("exe"));
   // TODO: This is a hex value.
-  r["fd"] = fields.at("a0");
+  r["fd"] = fields.at("a0").to_string();
   // The open/bind success status.
   r["success"] = (fields.at("success") == "yes") ? "1" : "0";
   r["uptime"] = std::to_string(tables::getUptime());
@@ -156,6 +227,9 @@ Status SocketEventSubscriber::init() {
   // Also grab SADDR structures
   sc->types.insert(AUDIT_TYPE_SOCKADDR);
 
+  // Only the fields used by SocketUpdate and the callback are parsed.
+  sc->fields = {"saddr", "auid", "pid", "exe", "a0", "success", "exit"};
+
   // Drop events if they are encountered outside of the expected state.
   // sc->types = {AUDIT_SYSCALL};
   subscribe(&SocketEventSubscriber::Callback, sc);
@@ -185,9 +259,46 @@ Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
       (*fields)["local_port"] = std::move((*fields)["remote_port"]);
       (*fields)["local_address"] = std::move((*fields)["remote_address"]);
     }
-    add(*fields);
+    if (FLAGS_audit_socket_dedupe_window == 0) {
+      (*fields)["count"] = "1";
+      add(*fields);
+    } else {
+      collapse(*fields);
+    }
   }
 
   return Status(0);
 }
+
+void SocketEventSubscriber::collapse(AuditFields& fields) {
+  // The addresses and ports of a bind are local, remote for a connect.
+  std::string key = fields["pid"] + '\n' + fields["action"] + '\n' +
+                    fields["local_address"] + '\n' + fields["local_port"] +
+                    '\n' + fields["remote_address"] + '\n' +
+                    fields["remote_port"];
+
+  WriteLock lock(collapsed_mutex_);
+  addCollapsed(collapsed_.size() >= kSocketDedupeMax);
+  auto it = collapsed_.find(key);
+  if (it == collapsed_.end()) {
+    collapsed_.emplace(std::move(key), std::make_pair(std::move(fields), 1));
+  } else {
+    it->second.second++;
+  }
+}
+
+void SocketEventSubscriber::addCollapsed(bool force) {
+  auto now = getUnixTime();
+  if (!force && now < window_start_ + FLAGS_audit_socket_dedupe_window) {
+    return;
+  }
+
+  // Each row keeps the fields of the first event, its time is the window end.
+  for (auto& row : collapsed_) {
+    row.second.first["count"] = BIGINT(row.second.second);
+    add(row.second.first);
+  }
+  collapsed_.clear();
+  window_start_ = now;
+}
 } // namespace osquery
@@ -22,9 +22,6 @@ namespace tables {
 extern long getUptime();
 }
 
-// From process_events.
-extern std::string decodeAuditValue(const std::string& s);
-
 class UserEventSubscriber : public EventSubscriber<AuditEventPublisher> {
  public:
   /// The user event subscriber declares an audit event type subscription.
@@ -47,17 +44,16 @@ Status UserEventSubscriber::init() {
 
 Status UserEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   Row r;
-  r["uid"] = ec->fields["uid"];
-  r["pid"] = ec->fields["pid"];
+  r["uid"] = ec->fields.get("uid");
+  r["pid"] = ec->fields.get("pid");
   if (ec->fields.count("msg") && ec->fields.at("msg").size() > 1) {
-    ec->fields["msg"].erase(0, 1);
-    r["message"] = std::move(ec->fields["msg"]);
+    r["message"] = ec->fields.at("msg").substr(1).to_string();
   }
-  r["auid"] = ec->fields["auid"];
+  r["auid"] = ec->fields.get("auid");
   r["type"] = INTEGER(ec->type);
-  r["path"] = decodeAuditValue(ec->fields["exe"]);
-  r["address"] = ec->fields["addr"];
-  r["terminal"] = ec->fields["terminal"];
+  r["path"] = decodeAuditValue(ec->fields.get("exe"));
+  r["address"] = ec->fields.get("addr");
+  r["terminal"] = ec->fields.get("terminal");
   r["uptime"] = INTEGER(tables::getUptime());
 
   add(r);
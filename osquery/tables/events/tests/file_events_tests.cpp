@@ -12,6 +12,7 @@
 
 #include <osquery/config.h>
 #include <osquery/events.h>
+#include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/registry.h>
@@ -19,11 +20,14 @@
 
 #include "osquery/core/json.h"
 #include "osquery/tables/events/event_utils.h"
+#include "osquery/tables/system/hash.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
 
 DECLARE_bool(registry_exceptions);
+DECLARE_bool(file_events_hash_async);
+DECLARE_uint64(file_events_hash_quiesce);
 
 class FileEventSubscriber;
 
@@ -73,6 +77,44 @@ TEST_F(FileEventsTableTests, test_table_empty) {
   EXPECT_EQ(results.size(), 0U);
 }
 
+TEST_F(FileEventsTableTests, test_async_hash) {
+  auto path = kTestWorkingDirectory + "/file_events_hash.txt";
+  ASSERT_TRUE(writeTextFile(path, "file event content").ok());
+
+  auto async = FLAGS_file_events_hash_async;
+  auto quiesce = FLAGS_file_events_hash_quiesce;
+  FLAGS_file_events_hash_async = true;
+  FLAGS_file_events_hash_quiesce = 60000;
+
+  std::vector<Row> added;
+  auto add = [&added](Row& hashed) { added.push_back(hashed); };
+
+  // The event is stored without hashes.
+  Row r;
+  r["action"] = "UPDATED";
+  r["target_path"] = path;
+  decorateFileEvent(path, true, r, add);
+  EXPECT_EQ(r.at("hashed"), "0");
+  EXPECT_EQ(r.count("md5"), 0U);
+
+  // Repeated events are hashed once, after the path quiesces.
+  Row repeated = r;
+  decorateFileEvent(path, true, repeated, add);
+  EXPECT_EQ(FileEventHasher::hash(false), 0U);
+  EXPECT_EQ(FileEventHasher::hash(true), 1U);
+
+  ASSERT_EQ(added.size(), 1U);
+  const auto& hashed = added.at(0);
+  EXPECT_EQ(hashed.at("action"), "HASHED");
+  EXPECT_EQ(hashed.at("target_path"), path);
+  EXPECT_EQ(hashed.at("count"), "2");
+  EXPECT_EQ(hashed.at("hashed"), "1");
+  EXPECT_EQ(hashed.at("md5"), hashFromFile(HASH_TYPE_MD5, path));
+
+  FLAGS_file_events_hash_async = async;
+  FLAGS_file_events_hash_quiesce = quiesce;
+}
+
 class FileEventsTestsConfigPlugin : public ConfigPlugin {
  public:
   Status genConfig(std::map<std::string, std::string>& config) override {
@@ -0,0 +1,95 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <string>
+#include <vector>
+
+#include <osquery/config.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/windows/usn_journal.h"
+#include "osquery/tables/events/event_utils.h"
+#include "osquery/tables/system/hash.h"
+
+namespace osquery {
+
+/**
+ * @brief Track changes to the configuration's file paths on NTFS volumes.
+ *
+ * Changes are read from the change journal of each volume, so paths are not
+ * watched and changes made while osquery was not running are reported.
+ */
+class NTFSFileEventSubscriber
+    : public EventSubscriber<USNJournalEventPublisher> {
+ public:
+  Status init() override {
+    return Status(0);
+  }
+
+  /// Walk the configuration's file paths, create subscriptions.
+  void configure() override;
+
+  /// Hashing file content should not delay the publisher.
+  bool usesQueue() const override {
+    return true;
+  }
+
+  Status Callback(const USNJournalEventContextRef& ec,
+                  const USNJournalSubscriptionContextRef& sc);
+};
+
+REGISTER(NTFSFileEventSubscriber, "event_subscriber", "ntfs_file_events");
+
+void NTFSFileEventSubscriber::configure() {
+  removeSubscriptions();
+
+  Config::get().files([this](const std::string& category,
+                             const std::vector<std::string>& files) {
+    for (const auto& file : files) {
+      VLOG(1) << "Added NTFS file event listener to: " << file;
+      auto sc = createSubscriptionContext();
+      sc->path = file;
+      sc->category = category;
+      subscribe(&NTFSFileEventSubscriber::Callback, sc);
+    }
+  });
+}
+
+Status NTFSFileEventSubscriber::Callback(
+    const USNJournalEventContextRef& ec,
+    const USNJournalSubscriptionContextRef& sc) {
+  if (ec->directory) {
+    return Status(0);
+  }
+
+  // Hashes cached before the change must not be reused.
+  if (ec->action != "CREATED") {
+    invalidateFileHash(ec->path);
+  }
+
+  Row r;
+  r["action"] = ec->action;
+  r["target_path"] = ec->path;
+  r["category"] = sc->category;
+  r["drive"] = ec->drive;
+  r["usn"] = BIGINT(ec->usn);
+  r["file_ref"] = BIGINT(ec->file_ref);
+
+  // Deleted and renamed files cannot be read at their reported path.
+  decorateFileEvent(ec->path,
+                    (ec->action == "CREATED" || ec->action == "UPDATED"),
+                    r,
+                    [this](Row& hashed) { add(hashed); });
+
+  add(r);
+  return Status(0, "OK");
+}
+}
@@ -36,36 +36,30 @@ std::string generateNewUUID();
 namespace tables {
 
 void enumerateCarves(QueryData& results) {
-  std::vector<std::string> carves;
-  scanDatabaseKeys(kCarveDbDomain, carves, kCarverDBPrefix);
-
-  for (const auto& carveGuid : carves) {
-    std::string carve;
-    auto s = getDatabaseValue(kCarveDbDomain, carveGuid, carve);
-    if (!s.ok()) {
-      VLOG(1) << "Failed to retrieve carve GUID";
-      continue;
-    }
-
-    pt::ptree tree;
-    try {
-      std::stringstream ss(carve);
-      pt::read_json(ss, tree);
-    } catch (const pt::ptree_error& e) {
-      VLOG(1) << "Failed to parse carve entries: " << e.what();
-      return;
-    }
+  scanDatabasePrefix(
+      kCarveDbDomain,
+      kCarverDBPrefix,
+      [&results](const std::string& carve_guid, const std::string& carve) {
+        pt::ptree tree;
+        try {
+          std::stringstream ss(carve);
+          pt::read_json(ss, tree);
+        } catch (const pt::ptree_error& e) {
+          VLOG(1) << "Failed to parse carve entries: " << e.what();
+          return false;
+        }
 
-    Row r;
-    r["time"] = BIGINT(tree.get<int>("time"));
-    r["size"] = INTEGER(tree.get<int>("size"));
-    r["sha256"] = SQL_TEXT(tree.get<std::string>("sha256"));
-    r["carve_guid"] = SQL_TEXT(tree.get<std::string>("carve_guid"));
-    r["status"] = SQL_TEXT(tree.get<std::string>("status"));
-    r["carve"] = INTEGER(0);
-    r["path"] = SQL_TEXT(tree.get<std::string>("path"));
-    results.push_back(r);
-  }
+        Row r;
+        r["time"] = BIGINT(tree.get<int>("time"));
+        r["size"] = INTEGER(tree.get<int>("size"));
+        r["sha256"] = SQL_TEXT(tree.get<std::string>("sha256"));
+        r["carve_guid"] = SQL_TEXT(tree.get<std::string>("carve_guid"));
+        r["status"] = SQL_TEXT(tree.get<std::string>("status"));
+        r["carve"] = INTEGER(0);
+        r["path"] = SQL_TEXT(tree.get<std::string>("path"));
+        results.push_back(r);
+        return true;
+      });
 }
 
 QueryData genCarves(QueryContext& context) {
@@ -8,34 +8,55 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <thread>
 
 #include <boost/numeric/conversion/cast.hpp>
 
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/status.h>
 #include <osquery/tables.h>
 
 #include "osquery/remote/http_client.h"
+#include "osquery/remote/transports/tls.h"
 
 namespace osquery {
+
+FLAG(uint32,
+     curl_concurrency,
+     8,
+     "Number of requests the curl tables make concurrently for a query");
+
+FLAG(uint32,
+     curl_timeout,
+     10,
+     "Seconds before a curl table request is abandoned (0 = no limit)");
+
 namespace tables {
 
 const std::string kOsqueryUserAgent{"osquery"};
 
 Status processRequest(Row& r) {
   try {
-    osquery::http::Client client_;
     osquery::http::Response response_;
     osquery::http::Request request_(r["url"]);
 
     // Change the user-agent for the request to be osquery
     request_ << osquery::http::Request::Header("User-Agent", r["user_agent"]);
 
+    // Connections are kept for the next request to a host, see tls_keep_alive.
+    auto options = osquery::http::Client::Options().keep_alive(true).timeout(
+        static_cast<int>(FLAGS_curl_timeout));
+    auto client_ = TLSClientPool::get().acquire(
+        TLSClientPool::getEndpoint(request_), options);
+
     // Measure the rtt using the system clock
     std::chrono::time_point<std::chrono::system_clock> start =
         std::chrono::system_clock::now();
-    response_ = client_.get(request_);
+    response_ = client_->get(request_);
     std::chrono::time_point<std::chrono::system_clock> end =
         std::chrono::system_clock::now();
 
@@ -74,13 +95,31 @@ QueryData genCurl(QueryContext& context) {
     r["method"] = "GET";
     r["user_agent"] =
         user_agents.empty() ? kOsqueryUserAgent : *(user_agents.begin());
+    results.push_back(r);
+  }
 
-    auto status = processRequest(r);
-    if (!status.ok()) {
-      LOG(WARNING) << status.getMessage();
+  // Requests are made concurrently, such that slow hosts overlap.
+  std::atomic<size_t> next{0};
+  auto worker = ([&results, &context, &next]() {
+    for (auto i = next++; i < results.size() && !context.isCancelled();
+         i = next++) {
+      auto status = processRequest(results[i]);
+      if (!status.ok()) {
+        LOG(WARNING) << status.getMessage();
+      }
     }
-
-    results.push_back(r);
+  });
+
+  // The calling thread makes requests too.
+  auto count = std::min<size_t>(std::max<uint32_t>(FLAGS_curl_concurrency, 1),
+                                results.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < count; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
   }
 
   return results;
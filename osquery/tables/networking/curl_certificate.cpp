@@ -8,7 +8,17 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <thread>
+
+#ifdef WIN32
+#include <winsock2.h>
+#else
+#include <sys/select.h>
+#endif
 
 #include <openssl/asn1.h>
 #include <openssl/bio.h>
@@ -16,10 +26,15 @@
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
 
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 namespace osquery {
+
+DECLARE_uint32(curl_concurrency);
+DECLARE_uint32(curl_timeout);
+
 namespace tables {
 
 static void fillRow(Row& r, X509* cert) {
@@ -126,6 +141,34 @@ static void fillRow(Row& r, X509* cert) {
   }
 }
 
+/// Wait for a nonblocking connection to be ready, until the deadline.
+static bool waitForBIO(BIO* bio,
+                       std::chrono::steady_clock::time_point deadline) {
+  int fd = -1;
+  BIO_get_fd(bio, &fd);
+  auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       deadline - std::chrono::steady_clock::now())
+                       .count();
+  if (fd < 0 || remaining <= 0) {
+    return false;
+  }
+
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(fd, &fds);
+  struct timeval timeout;
+  timeout.tv_sec = static_cast<long>(remaining / 1000);
+  timeout.tv_usec = static_cast<long>((remaining % 1000) * 1000);
+
+  // A connecting socket, and a handshake waiting to send, become writable.
+  bool write = BIO_should_write(bio) || BIO_should_io_special(bio);
+  return ::select(fd + 1,
+                  (write) ? nullptr : &fds,
+                  (write) ? &fds : nullptr,
+                  nullptr,
+                  &timeout) > 0;
+}
+
 Status getTLSCertificate(std::string hostname, QueryData& results) {
   SSL_library_init();
 
@@ -175,16 +218,27 @@ Status getTLSCertificate(std::string hostname, QueryData& results) {
                   "Failed to set OpenSSL server name: " + std::to_string(ret));
   }
 
-  ret = BIO_do_connect(server.get());
-  if (ret != 1) {
-    return Status(1,
-                  "Failed to establish TLS connection: " + std::to_string(ret));
+  // The connection and handshake are abandoned at the curl_timeout.
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds(FLAGS_curl_timeout);
+  if (FLAGS_curl_timeout > 0) {
+    BIO_set_nbio(server.get(), 1);
   }
 
-  ret = BIO_do_handshake(server.get());
-  if (ret != 1) {
-    return Status(1,
-                  "Failed to complete TLS handshake: " + std::to_string(ret));
+  while ((ret = BIO_do_connect(server.get())) != 1) {
+    if (FLAGS_curl_timeout == 0 || !BIO_should_retry(server.get()) ||
+        !waitForBIO(server.get(), deadline)) {
+      return Status(
+          1, "Failed to establish TLS connection: " + std::to_string(ret));
+    }
+  }
+
+  while ((ret = BIO_do_handshake(server.get())) != 1) {
+    if (FLAGS_curl_timeout == 0 || !BIO_should_retry(server.get()) ||
+        !waitForBIO(server.get(), deadline)) {
+      return Status(
+          1, "Failed to complete TLS handshake: " + std::to_string(ret));
+    }
   }
 
   auto delX509 = [](X509* cert) { X509_free(cert); };
@@ -203,16 +257,40 @@ Status getTLSCertificate(std::string hostname, QueryData& results) {
 
 QueryData genTLSCertificate(QueryContext& context) {
   QueryData results;
-  auto hostnames = context.constraints["hostname"].getAll(EQUALS);
-
-  for (const auto& hostname : hostnames) {
-    auto s = getTLSCertificate(hostname, results);
-    if (!s.ok()) {
-      LOG(INFO) << "Cannot get certificate for " << hostname << ": "
-                << s.getMessage();
+  auto constraints = context.constraints["hostname"].getAll(EQUALS);
+  std::vector<std::string> hostnames(constraints.begin(), constraints.end());
+
+  // Hosts are connected to concurrently, see curl_concurrency.
+  std::vector<QueryData> certificates(hostnames.size());
+  std::atomic<size_t> next{0};
+  auto worker = ([&hostnames, &certificates, &context, &next]() {
+    for (auto i = next++; i < hostnames.size() && !context.isCancelled();
+         i = next++) {
+      auto s = getTLSCertificate(hostnames[i], certificates[i]);
+      if (!s.ok()) {
+        LOG(INFO) << "Cannot get certificate for " << hostnames[i] << ": "
+                  << s.getMessage();
+      }
     }
+  });
+
+  // The calling thread connects too.
+  auto count = std::min<size_t>(std::max<uint32_t>(FLAGS_curl_concurrency, 1),
+                                hostnames.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < count; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
   }
 
+  for (auto& certificate : certificates) {
+    for (auto& r : certificate) {
+      results.push_back(std::move(r));
+    }
+  }
   return results;
 }
 }
@@ -8,6 +8,11 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <linux/neighbour.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include <cstring>
 #include <fstream>
 
 #include <boost/algorithm/string/split.hpp>
@@ -17,18 +22,21 @@
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
+#include "osquery/tables/networking/linux/netlink.h"
+
 namespace osquery {
 namespace tables {
 
 const std::string kLinuxArpTable = "/proc/net/arp";
 
-QueryData genArpCache(QueryContext& context) {
-  QueryData results;
+/// The MAC of an entry that is not resolved, as /proc/net/arp reports it.
+const std::string kIncompleteMAC = "00:00:00:00:00:00";
 
+void genArpCacheFromProc(QueryData& results) {
   boost::filesystem::path arp_path = kLinuxArpTable;
   if (!osquery::isReadable(arp_path).ok()) {
     VLOG(1) << "Cannot read arp table";
-    return results;
+    return;
   }
 
   std::ifstream fd(arp_path.string(), std::ios::in | std::ios::binary);
@@ -36,7 +44,7 @@ QueryData genArpCache(QueryContext& context) {
 
   if (fd.fail() || fd.eof()) {
     VLOG(1) << "Empty or failed arp table";
-    return results;
+    return;
   }
 
   // Read the header line.
@@ -72,7 +80,65 @@ QueryData genArpCache(QueryContext& context) {
 
     results.push_back(r);
   }
+}
+
+void genNetlinkNeighbor(const struct nlmsghdr* netlink_msg,
+                        const std::map<int, std::string>& interfaces,
+                        QueryData& results) {
+  auto message = static_cast<const struct ndmsg*>(NLMSG_DATA(netlink_msg));
+  if (message->ndm_family != AF_INET ||
+      (message->ndm_state & ~NUD_NOARP) == 0) {
+    // Like /proc/net/arp, entries that do not use ARP are not reported.
+    return;
+  }
 
+  Row r;
+  r["mac"] = kIncompleteMAC;
+  forEachNetlinkAttribute(
+      netlink_msg, sizeof(struct ndmsg), [&](const struct rtattr* attr) {
+        if (attr->rta_type == NDA_DST) {
+          r["address"] = getNetlinkIP(AF_INET, RTA_DATA(attr));
+        } else if (attr->rta_type == NDA_LLADDR) {
+          r["mac"] = getNetlinkMAC(attr);
+        }
+      });
+
+  auto name = interfaces.find(message->ndm_ifindex);
+  r["interface"] = (name != interfaces.end()) ? name->second : "";
+  r["permanent"] = (message->ndm_state & NUD_PERMANENT) ? "1" : "0";
+  results.push_back(std::move(r));
+}
+
+QueryData genArpCache(QueryContext& context) {
+  struct ndmsg header;
+  memset(&header, 0, sizeof(header));
+  header.ndm_family = AF_INET;
+
+  // The neighbors of a single interface are filtered by the kernel.
+  NetlinkRequest request(RTM_GETNEIGH, NLM_F_DUMP, &header, sizeof(header));
+  auto names = context.constraints["interface"].getAll(EQUALS);
+  if (names.size() == 1) {
+    auto index = if_nametoindex(names.begin()->c_str());
+    if (index == 0) {
+      return {};
+    }
+    request.addAttribute(NDA_IFINDEX, &index, sizeof(index));
+  }
+
+  // Rows are only returned if the whole dump was read.
+  auto interfaces = getInterfaceNames();
+  QueryData results;
+  auto status = sendNetlinkRequest(
+      NETLINK_ROUTE, request, [&](const struct nlmsghdr* message) {
+        if (message->nlmsg_type == RTM_NEWNEIGH) {
+          genNetlinkNeighbor(message, interfaces, results);
+        }
+      });
+  if (!status.ok()) {
+    VLOG(1) << "Cannot dump neighbors: " << status.getMessage();
+    results.clear();
+    genArpCacheFromProc(results);
+  }
   return results;
 }
 }
@@ -0,0 +1,142 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include <cstring>
+
+#include <osquery/tables.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+
+namespace osquery {
+namespace tables {
+
+/// Copy the 32 or 64-bit counters of a link, which may not be aligned.
+static void genLinkStats(const struct rtattr* attr,
+                         struct rtnl_link_stats64& stats) {
+  if (attr->rta_type == IFLA_STATS64 && RTA_PAYLOAD(attr) >= sizeof(stats)) {
+    memcpy(&stats, RTA_DATA(attr), sizeof(stats));
+    return;
+  }
+
+  struct rtnl_link_stats stats32;
+  if (RTA_PAYLOAD(attr) < sizeof(stats32)) {
+    return;
+  }
+  memcpy(&stats32, RTA_DATA(attr), sizeof(stats32));
+  stats.rx_packets = stats32.rx_packets;
+  stats.tx_packets = stats32.tx_packets;
+  stats.rx_bytes = stats32.rx_bytes;
+  stats.tx_bytes = stats32.tx_bytes;
+  stats.rx_errors = stats32.rx_errors;
+  stats.tx_errors = stats32.tx_errors;
+  stats.rx_dropped = stats32.rx_dropped;
+  stats.tx_dropped = stats32.tx_dropped;
+  stats.collisions = stats32.collisions;
+}
+
+void genNetlinkLink(const struct nlmsghdr* netlink_msg, QueryData& results) {
+  auto message = static_cast<const struct ifinfomsg*>(NLMSG_DATA(netlink_msg));
+
+  Row r;
+  r["interface"] = "";
+  r["mac"] = "00:00:00:00:00:00";
+  r["type"] = INTEGER(message->ifi_type);
+  r["mtu"] = "0";
+  r["flags"] = INTEGER(message->ifi_flags);
+
+  bool has_stats64 = false;
+  struct rtnl_link_stats64 stats;
+  memset(&stats, 0, sizeof(stats));
+  forEachNetlinkAttribute(
+      netlink_msg, sizeof(struct ifinfomsg), [&](const struct rtattr* attr) {
+        switch (attr->rta_type) {
+        case IFLA_IFNAME: {
+          auto name = static_cast<const char*>(RTA_DATA(attr));
+          r["interface"] = std::string(name, strnlen(name, RTA_PAYLOAD(attr)));
+          break;
+        }
+        case IFLA_ADDRESS:
+          r["mac"] = getNetlinkMAC(attr);
+          break;
+        case IFLA_MTU:
+          if (RTA_PAYLOAD(attr) >= sizeof(uint32_t)) {
+            r["mtu"] = BIGINT(*static_cast<const uint32_t*>(RTA_DATA(attr)));
+          }
+          break;
+        case IFLA_STATS64:
+          has_stats64 = true;
+          genLinkStats(attr, stats);
+          break;
+        case IFLA_STATS:
+          if (!has_stats64) {
+            genLinkStats(attr, stats);
+          }
+          break;
+        }
+      });
+
+  // Linux does not implement interface metrics.
+  r["metric"] = "0";
+  r["ipackets"] = BIGINT(stats.rx_packets);
+  r["opackets"] = BIGINT(stats.tx_packets);
+  r["ibytes"] = BIGINT(stats.rx_bytes);
+  r["obytes"] = BIGINT(stats.tx_bytes);
+  r["ierrors"] = BIGINT(stats.rx_errors);
+  r["oerrors"] = BIGINT(stats.tx_errors);
+  r["idrops"] = BIGINT(stats.rx_dropped);
+  r["odrops"] = BIGINT(stats.tx_dropped);
+  r["collisions"] = BIGINT(stats.collisions);
+
+  // Last change is not implemented in Linux.
+  r["last_change"] = "-1";
+  results.push_back(std::move(r));
+}
+
+Status genInterfaceDetailsFromNetlink(QueryContext& context,
+                                      QueryData& results) {
+  struct ifinfomsg header;
+  memset(&header, 0, sizeof(header));
+
+  auto names = context.constraints["interface"].getAll(EQUALS);
+  if (names.empty()) {
+    // Rows are only returned if the whole dump was read.
+    QueryData links;
+    NetlinkRequest request(RTM_GETLINK, NLM_F_DUMP, &header, sizeof(header));
+    auto status = sendNetlinkRequest(
+        NETLINK_ROUTE, request, [&links](const struct nlmsghdr* message) {
+          if (message->nlmsg_type == RTM_NEWLINK) {
+            genNetlinkLink(message, links);
+          }
+        });
+    if (status.ok()) {
+      results = std::move(links);
+    }
+    return status;
+  }
+
+  // Each requested interface is read alone, unknown names return no rows.
+  for (const auto& name : names) {
+    NetlinkRequest request(RTM_GETLINK, 0, &header, sizeof(header));
+    request.addAttribute(IFLA_IFNAME, name.c_str(), name.size() + 1);
+    sendNetlinkRequest(
+        NETLINK_ROUTE, request, [&results](const struct nlmsghdr* message) {
+          if (message->nlmsg_type == RTM_NEWLINK) {
+            genNetlinkLink(message, results);
+          }
+        });
+  }
+  return Status(0, "OK");
+}
+}
+}
@@ -0,0 +1,182 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "osquery/tables/networking/linux/netlink.h"
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12
+#endif
+
+namespace osquery {
+namespace tables {
+
+NetlinkRequest::NetlinkRequest(uint16_t type,
+                               uint16_t flags,
+                               const void* header,
+                               size_t size)
+    : message_(NLMSG_SPACE(size), 0) {
+  auto message = reinterpret_cast<struct nlmsghdr*>(message_.data());
+  message->nlmsg_len = static_cast<__u32>(NLMSG_LENGTH(size));
+  message->nlmsg_type = type;
+  message->nlmsg_flags = static_cast<uint16_t>(flags | NLM_F_REQUEST);
+  message->nlmsg_seq = 1;
+  memcpy(NLMSG_DATA(message), header, size);
+}
+
+void NetlinkRequest::addAttribute(uint16_t type,
+                                  const void* data,
+                                  size_t size) {
+  auto offset = NLMSG_ALIGN(message_.size());
+  message_.resize(offset + RTA_SPACE(size), 0);
+
+  auto attr = reinterpret_cast<struct rtattr*>(&message_[offset]);
+  attr->rta_type = type;
+  attr->rta_len = static_cast<unsigned short>(RTA_LENGTH(size));
+  memcpy(RTA_DATA(attr), data, size);
+
+  auto message = reinterpret_cast<struct nlmsghdr*>(message_.data());
+  message->nlmsg_len = static_cast<__u32>(offset + RTA_LENGTH(size));
+}
+
+Status sendNetlinkRequest(int protocol,
+                          const NetlinkRequest& request,
+                          const NetlinkCallback& callback) {
+  auto socket_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, protocol);
+  if (socket_fd < 0) {
+    return Status(1, "Cannot open netlink socket");
+  }
+
+  // Older kernels do not check requests strictly, and ignore the filters.
+  int strict = 1;
+  setsockopt(
+      socket_fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &strict, sizeof(strict));
+
+  auto message = reinterpret_cast<const struct nlmsghdr*>(request.data());
+  struct sockaddr_nl kernel;
+  memset(&kernel, 0, sizeof(kernel));
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(socket_fd,
+             request.data(),
+             message->nlmsg_len,
+             0,
+             reinterpret_cast<struct sockaddr*>(&kernel),
+             sizeof(kernel)) < 0) {
+    close(socket_fd);
+    return Status(1, "Cannot send netlink request");
+  }
+
+  std::vector<char> buffer(kNetlinkBufferSize);
+  while (true) {
+    auto bytes = recv(socket_fd, buffer.data(), buffer.size(), 0);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      close(socket_fd);
+      return Status(1, "Cannot read netlink response");
+    }
+
+    auto size = static_cast<int>(bytes);
+    for (auto response = reinterpret_cast<struct nlmsghdr*>(buffer.data());
+         NLMSG_OK(response, size);
+         response = NLMSG_NEXT(response, size)) {
+      if (response->nlmsg_type == NLMSG_DONE) {
+        close(socket_fd);
+        return Status(0, "OK");
+      } else if (response->nlmsg_type == NLMSG_ERROR) {
+        // An acknowledgement is an error message without an error.
+        auto error = static_cast<struct nlmsgerr*>(NLMSG_DATA(response));
+        close(socket_fd);
+        if (error->error == 0) {
+          return Status(0, "OK");
+        }
+        return Status(1,
+                      "Netlink request failed: " +
+                          std::string(strerror(-error->error)));
+      }
+
+      callback(response);
+      if ((response->nlmsg_flags & NLM_F_MULTI) == 0) {
+        // The response to a request that is not a dump is a single message.
+        close(socket_fd);
+        return Status(0, "OK");
+      }
+    }
+  }
+}
+
+void forEachNetlinkAttribute(
+    const struct nlmsghdr* message,
+    size_t header_size,
+    const std::function<void(const struct rtattr* attr)>& callback) {
+  if (message->nlmsg_len < NLMSG_SPACE(header_size)) {
+    return;
+  }
+
+  auto size = static_cast<int>(message->nlmsg_len - NLMSG_SPACE(header_size));
+  auto attr = reinterpret_cast<const struct rtattr*>(
+      static_cast<const char*>(NLMSG_DATA(message)) +
+      NLMSG_ALIGN(header_size));
+  for (; RTA_OK(attr, size); attr = RTA_NEXT(attr, size)) {
+    callback(attr);
+  }
+}
+
+std::string getNetlinkIP(int family, const void* address) {
+  char dst[INET6_ADDRSTRLEN] = {0};
+  if (inet_ntop(family, address, dst, INET6_ADDRSTRLEN) == nullptr) {
+    return "";
+  }
+  return dst;
+}
+
+std::string getNetlinkMAC(const struct rtattr* attr) {
+  static const char kHex[] = "0123456789abcdef";
+
+  auto size = RTA_PAYLOAD(attr);
+  auto data = static_cast<const unsigned char*>(RTA_DATA(attr));
+  std::string mac;
+  mac.reserve(size * 3);
+  for (size_t i = 0; i < size; i++) {
+    if (i > 0) {
+      mac += ':';
+    }
+    mac += kHex[data[i] >> 4];
+    mac += kHex[data[i] & 0xf];
+  }
+  return mac;
+}
+
+std::map<int, std::string> getInterfaceNames() {
+  std::map<int, std::string> names;
+  auto interfaces = if_nameindex();
+  if (interfaces == nullptr) {
+    return names;
+  }
+
+  for (auto i = interfaces; i->if_index != 0 && i->if_name != nullptr; i++) {
+    names[static_cast<int>(i->if_index)] = i->if_name;
+  }
+  if_freenameindex(interfaces);
+  return names;
+}
+}
+}
@@ -0,0 +1,100 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <osquery/status.h>
+
+namespace osquery {
+namespace tables {
+
+/// The size of each read of netlink responses.
+const size_t kNetlinkBufferSize = 32768;
+
+/// Handle each response message of a netlink request.
+using NetlinkCallback = std::function<void(const struct nlmsghdr* message)>;
+
+/**
+ * @brief A netlink request message, a family header followed by attributes.
+ *
+ * The header fields and attributes of a dump request filter the dumped objects
+ * in the kernel, see sendNetlinkRequest.
+ */
+class NetlinkRequest {
+ public:
+  /**
+   * @brief Start a request.
+   *
+   * @param type The message type, such as RTM_GETROUTE.
+   * @param flags The request flags, NLM_F_REQUEST is always set.
+   * @param header The family header, such as an rtmsg.
+   * @param size The size of the family header.
+   */
+  NetlinkRequest(uint16_t type,
+                 uint16_t flags,
+                 const void* header,
+                 size_t size);
+
+  /// Append an attribute to the request.
+  void addAttribute(uint16_t type, const void* data, size_t size);
+
+  const char* data() const {
+    return message_.data();
+  }
+
+  size_t size() const {
+    return message_.size();
+  }
+
+ private:
+  std::vector<char> message_;
+};
+
+/**
+ * @brief Send a request over a new netlink socket and read each response.
+ *
+ * A dump is read until its end. Requests are sent with NETLINK_GET_STRICT_CHK,
+ * such that rtnetlink dumps are filtered by the request. Kernels without
+ * strict checking (before 4.20) may ignore the filters and dump every object,
+ * callers must not rely on the filters.
+ *
+ * @param protocol The netlink protocol, such as NETLINK_ROUTE.
+ * @param request The request message.
+ * @param callback Called for each response message other than errors.
+ * @return Failure if the request failed or the response was not read.
+ */
+Status sendNetlinkRequest(int protocol,
+                          const NetlinkRequest& request,
+                          const NetlinkCallback& callback);
+
+/// Iterate the attributes of a response message after its family header.
+void forEachNetlinkAttribute(
+    const struct nlmsghdr* message,
+    size_t header_size,
+    const std::function<void(const struct rtattr* attr)>& callback);
+
+/// Format an IPv4 or IPv6 address attribute.
+std::string getNetlinkIP(int family, const void* address);
+
+/// Format a link-layer address attribute, such as a MAC.
+std::string getNetlinkMAC(const struct rtattr* attr);
+
+/// Read the name of each interface index once, for a table's generate.
+std::map<int, std::string> getInterfaceNames();
+}
+}
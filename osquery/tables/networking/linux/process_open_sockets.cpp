@@ -8,13 +8,29 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+
 #include <arpa/inet.h>
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/linux/proc.h"
+#include "osquery/tables/networking/linux/inet_diag.h"
+#include "osquery/tables/networking/linux/netlink.h"
 
 namespace osquery {
 namespace tables {
@@ -28,9 +44,30 @@ const std::map<int, std::string> kLinuxProtocolNames = {
     {IPPROTO_RAW, "raw"},
 };
 
+// Protocols with a sock_diag handler, others are only reported by proc.
+const std::set<int> kSockDiagProtocols = {
+    IPPROTO_TCP, IPPROTO_UDP, IPPROTO_UDPLITE,
+};
+
+// Columns the generator filters on, before SQLite applies the constraints.
+const std::vector<std::string> kSocketFilterColumns = {
+    "family", "protocol", "local_port", "remote_port",
+};
+
 // A map of socket handles (inodes) to their pid and file descriptor.
 typedef std::map<std::string, std::pair<std::string, std::string> > InodeMap;
 
+void setSocketProcess(const InodeMap &inodes, Row &r) {
+  auto inode = inodes.find(r["socket"]);
+  if (inode != inodes.end()) {
+    r["pid"] = inode->second.second;
+    r["fd"] = inode->second.first;
+  } else {
+    r["pid"] = "-1";
+    r["fd"] = "-1";
+  }
+}
+
 std::string addressFromHex(const std::string &encoded_address, int family) {
   char addr_buffer[INET6_ADDRSTRLEN] = {0};
   if (family == AF_INET) {
@@ -133,53 +170,215 @@ void genSocketsFromProc(const InodeMap &inodes,
       r["path"] = "";
     }
 
-    if (inodes.count(r["socket"]) > 0) {
-      r["pid"] = inodes.at(r["socket"]).second;
-      r["fd"] = inodes.at(r["socket"]).first;
-    } else {
-      r["pid"] = "-1";
-      r["fd"] = "-1";
+    setSocketProcess(inodes, r);
+    results.push_back(r);
+  }
+}
+
+/// Check if a value may match the query constraints on a column.
+bool socketColumnMatches(const QueryContext &context,
+                         const std::string &column,
+                         const std::string &value) {
+  auto constraints = context.constraints.find(column);
+  return constraints == context.constraints.end() ||
+         !constraints->second.exists() || constraints->second.matches(value);
+}
+
+/**
+ * @brief Build inet_diag bytecode that filters sockets by port in the kernel.
+ *
+ * A single equality constraint on local_port or remote_port becomes a pair of
+ * GE/LE comparisons. A passing comparison continues to the next op, and a
+ * failing one jumps past the end of the program, which rejects the socket.
+ */
+std::vector<struct inet_diag_bc_op> getPortFilter(
+    const QueryContext &context) {
+  std::vector<std::pair<unsigned char, unsigned short> > conditions;
+  auto addPort = ([&context, &conditions](const std::string &column,
+                                          unsigned char ge,
+                                          unsigned char le) {
+    if (context.constraints.count(column) == 0) {
+      return;
     }
 
-    results.push_back(r);
+    auto ports = context.constraints.at(column).getAll(EQUALS);
+    unsigned long int port = 0;
+    if (ports.size() != 1 || !safeStrtoul(*ports.begin(), 10, port).ok() ||
+        port > 65535) {
+      return;
+    }
+    conditions.push_back(std::make_pair(ge, port));
+    conditions.push_back(std::make_pair(le, port));
+  });
+  addPort("local_port", INET_DIAG_BC_S_GE, INET_DIAG_BC_S_LE);
+  addPort("remote_port", INET_DIAG_BC_D_GE, INET_DIAG_BC_D_LE);
+
+  // Each condition is an op followed by an op holding the port.
+  std::vector<struct inet_diag_bc_op> bytecode;
+  size_t op_size = sizeof(struct inet_diag_bc_op);
+  size_t length = conditions.size() * 2 * op_size;
+  for (size_t i = 0; i < conditions.size(); i++) {
+    struct inet_diag_bc_op op;
+    op.code = conditions[i].first;
+    op.yes = static_cast<unsigned char>(2 * op_size);
+    op.no = static_cast<unsigned short>(length - i * 2 * op_size + 4);
+    bytecode.push_back(op);
+
+    op.code = INET_DIAG_BC_NOP;
+    op.yes = 0;
+    op.no = conditions[i].second;
+    bytecode.push_back(op);
+  }
+  return bytecode;
+}
+
+void genSocketFromDiag(const struct inet_diag_msg *message,
+                       int protocol,
+                       QueryData &results) {
+  char local[INET6_ADDRSTRLEN] = {0};
+  char remote[INET6_ADDRSTRLEN] = {0};
+  inet_ntop(message->idiag_family, message->id.idiag_src, local, sizeof(local));
+  inet_ntop(
+      message->idiag_family, message->id.idiag_dst, remote, sizeof(remote));
+
+  Row r;
+  r["socket"] = BIGINT(message->idiag_inode);
+  r["family"] = INTEGER(message->idiag_family);
+  r["protocol"] = INTEGER(protocol);
+  r["local_address"] = local;
+  r["local_port"] = INTEGER(ntohs(message->id.idiag_sport));
+  r["remote_address"] = remote;
+  r["remote_port"] = INTEGER(ntohs(message->id.idiag_dport));
+  // Path is only used for UNIX domain sockets.
+  r["path"] = "";
+  results.push_back(std::move(r));
+}
+
+/**
+ * @brief Dump the sockets of a protocol and family with NETLINK_INET_DIAG.
+ *
+ * The kernel filters sockets by state and by the bytecode port filter.
+ * Rows are only appended if the whole dump was read.
+ */
+Status genSocketsFromDiag(const QueryContext &context,
+                          int protocol,
+                          int family,
+                          QueryData &results) {
+  struct inet_diag_req_v2 header;
+  memset(&header, 0, sizeof(header));
+  header.sdiag_family = static_cast<__u8>(family);
+  header.sdiag_protocol = static_cast<__u8>(protocol);
+  header.idiag_states = ~0U;
+  if (protocol == IPPROTO_TCP &&
+      context.constraints.count("remote_port") > 0 &&
+      context.constraints.at("remote_port").getAll(EQUALS) ==
+          std::set<std::string>{"0"}) {
+    // Only listening TCP sockets have no remote port.
+    header.idiag_states = 1U << TCP_LISTEN;
+  }
+
+  NetlinkRequest request(
+      SOCK_DIAG_BY_FAMILY, NLM_F_DUMP, &header, sizeof(header));
+  auto bytecode = getPortFilter(context);
+  if (!bytecode.empty()) {
+    request.addAttribute(INET_DIAG_REQ_BYTECODE,
+                         bytecode.data(),
+                         bytecode.size() * sizeof(struct inet_diag_bc_op));
+  }
+
+  // The protocol or family may not have a sock_diag handler.
+  QueryData rows;
+  auto status = sendNetlinkRequest(
+      NETLINK_INET_DIAG, request, [&](const struct nlmsghdr *message) {
+        if (message->nlmsg_type == SOCK_DIAG_BY_FAMILY) {
+          genSocketFromDiag(
+              static_cast<const struct inet_diag_msg *>(NLMSG_DATA(message)),
+              protocol,
+              rows);
+        }
+      });
+  if (status.ok()) {
+    for (auto &row : rows) {
+      results.push_back(std::move(row));
+    }
   }
+  return status;
 }
 
 QueryData genOpenSockets(QueryContext &context) {
   QueryData results;
 
-  // If a pid is given then set that as the only item in processes.
-  std::set<std::string> pids;
-  if (context.constraints["pid"].exists(EQUALS)) {
-    pids = context.constraints["pid"].getAll(EQUALS);
-  } else {
-    osquery::procProcesses(pids);
-  }
+  // The socket owners are only needed if the query uses them.
+  bool owners = context.isColumnUsed("pid") || context.isColumnUsed("fd") ||
+                context.constraints["pid"].exists();
 
-  // Generate a map of socket inode to process tid.
+  // Descriptors of every process are shared with other tables in a step.
   InodeMap socket_inodes;
-  for (const auto &process : pids) {
-    std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
+  std::shared_ptr<const ProcDescriptorIndex> index;
+  if (owners && context.constraints["pid"].exists(EQUALS)) {
+    // If a pid is given then only its descriptors are read.
+    auto pids = context.constraints["pid"].getAll(EQUALS);
+    for (const auto &pid : pids) {
+      std::map<std::string, std::string> descriptors;
+      if (!osquery::procDescriptors(pid, descriptors).ok()) {
+        continue;
+      }
       for (const auto &fd : descriptors) {
         if (fd.second.find("socket:[") == 0) {
-          // See #792: std::regex is incomplete until GCC 4.9 (skip 8 chars)
+          // See #792: std::regex is incomplete, skip 8 chars.
           auto inode = fd.second.substr(8);
           socket_inodes[inode.substr(0, inode.size() - 1)] =
-              std::make_pair(fd.first, process);
+              std::make_pair(fd.first, pid);
         }
       }
     }
+  } else if (owners) {
+    index = getProcDescriptorIndex(TablePlugin::kCacheStep);
   }
+  const auto &inodes = (index != nullptr) ? index->sockets : socket_inodes;
 
-  // This used to use netlink (Ref: #1094) to request socket information.
-  // Use proc messages to query socket information.
+  // Request socket information with sock_diag (Ref: #1094), the kernel
+  // filters by state and port. Use proc messages for other protocols, or if
+  // the kernel does not support the request.
   for (const auto &protocol : kLinuxProtocolNames) {
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET, results);
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET6, results);
+    if (!socketColumnMatches(context, "protocol", INTEGER(protocol.first))) {
+      continue;
+    }
+
+    for (const auto &family : {AF_INET, AF_INET6}) {
+      if (!socketColumnMatches(context, "family", INTEGER(family))) {
+        continue;
+      }
+
+      auto size = results.size();
+      if (kSockDiagProtocols.count(protocol.first) == 0 ||
+          !genSocketsFromDiag(context, protocol.first, family, results)
+               .ok()) {
+        genSocketsFromProc(inodes, protocol.first, family, results);
+        continue;
+      }
+
+      for (auto i = size; i < results.size(); i++) {
+        setSocketProcess(inodes, results[i]);
+      }
+    }
   }
 
-  genSocketsFromProc(socket_inodes, IPPROTO_IP, AF_UNIX, results);
+  if (socketColumnMatches(context, "family", INTEGER(AF_UNIX))) {
+    genSocketsFromProc(inodes, IPPROTO_IP, AF_UNIX, results);
+  }
+
+  // Apply the pushed-down constraints to rows read from proc.
+  auto filtered = std::remove_if(
+      results.begin(), results.end(), [&context](const Row &r) {
+        for (const auto &column : kSocketFilterColumns) {
+          if (!socketColumnMatches(context, column, r.at(column))) {
+            return true;
+          }
+        }
+        return false;
+      });
+  results.erase(filtered, results.end());
   return results;
 }
 }
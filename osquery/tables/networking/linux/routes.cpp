@@ -8,132 +8,68 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
-#include <sys/socket.h>
-#include <linux/netlink.h>
-#include <linux/rtnetlink.h>
 #include <net/if.h>
+#include <sys/socket.h>
 
-#include <boost/algorithm/string/trim.hpp>
+#include <cstring>
 
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
-#include "osquery/tables/networking/utils.h"
+#include "osquery/tables/networking/linux/netlink.h"
 
 namespace osquery {
 namespace tables {
 
-#define MAX_NETLINK_SIZE 8192
-#define MAX_NETLINK_ATTEMPTS 8
-
-std::string getNetlinkIP(int family, const char* buffer) {
-  char dst[INET6_ADDRSTRLEN] = {0};
-
-  inet_ntop(family, buffer, dst, INET6_ADDRSTRLEN);
-  std::string address(dst);
-  boost::trim(address);
-
-  return address;
-}
-
-Status readNetlink(int socket_fd, int seq, char* output, size_t* size) {
-  struct nlmsghdr* nl_hdr = nullptr;
-
-  size_t message_size = 0;
-  do {
-    size_t latency = 0;
-    size_t total_bytes = 0;
-    ssize_t bytes = 0;
-    while (bytes == 0) {
-      bytes = recv(socket_fd, output, MAX_NETLINK_SIZE - message_size, 0);
-      if (bytes < 0) {
-        // Unrecoverable NETLINK error, bail.
-        return Status(1, "Could not read from NETLINK");
-      }
-
-      // Bytes were returned by we might need to read more.
-      total_bytes += bytes;
-      if (latency >= MAX_NETLINK_ATTEMPTS) {
-        // Too many attempts to read bytes have occurred.
-        // Prevent the NETLINK socket from handing and bail.
-        return Status(1, "Netlink timeout");
-      } else if (bytes == 0) {
-        if (total_bytes > 0) {
-          // Bytes were read, but now no more are available, attempt to parse
-          // the received NETLINK message.
-          break;
-        }
-        ::usleep(20);
-        latency += 1;
-      }
-    }
-
-    // Assure valid header response, and not an error type.
-    nl_hdr = (struct nlmsghdr*)output;
-    if (NLMSG_OK(nl_hdr, bytes) == 0 || nl_hdr->nlmsg_type == NLMSG_ERROR) {
-      return Status(1, "Read invalid NETLINK message");
-    }
-
-    if (nl_hdr->nlmsg_type == NLMSG_DONE) {
-      break;
-    }
-
-    // Move the buffer pointer
-    output += bytes;
-    message_size += bytes;
-    if ((nl_hdr->nlmsg_flags & NLM_F_MULTI) == 0) {
-      break;
-    }
-  } while (static_cast<pid_t>(nl_hdr->nlmsg_seq) != seq ||
-           static_cast<pid_t>(nl_hdr->nlmsg_pid) != getpid());
-
-  *size = message_size;
-  return Status(0, "OK");
-}
-
-void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
-  std::string address;
+/// The route types reported by the type column.
+const std::map<unsigned char, std::string> kRouteTypes = {
+    {RTN_UNICAST, "gateway"},
+    {RTN_LOCAL, "local"},
+    {RTN_BROADCAST, "broadcast"},
+    {RTN_ANYCAST, "anycast"},
+};
+
+void genNetlinkRoutes(const struct nlmsghdr* netlink_msg,
+                      const std::map<int, std::string>& interfaces,
+                      QueryData& results) {
   int mask = 0;
-  char interface[IF_NAMESIZE] = {0};
-
-  struct rtmsg* message = static_cast<struct rtmsg*>(NLMSG_DATA(netlink_msg));
-  struct rtattr* attr = static_cast<struct rtattr*>(RTM_RTA(message));
-  uint32_t attr_size = RTM_PAYLOAD(netlink_msg);
+  auto message = static_cast<const struct rtmsg*>(NLMSG_DATA(netlink_msg));
 
   Row r;
 
   // Iterate over each route in the netlink message
   bool has_destination = false;
   r["metric"] = "0";
-  while (RTA_OK(attr, attr_size)) {
-    switch (attr->rta_type) {
-    case RTA_OIF:
-      if_indextoname(*(int*)RTA_DATA(attr), interface);
-      r["interface"] = std::string(interface);
-      break;
-    case RTA_GATEWAY:
-      address = getNetlinkIP(message->rtm_family, (char*)RTA_DATA(attr));
-      r["gateway"] = address;
-      break;
-    case RTA_PREFSRC:
-      address = getNetlinkIP(message->rtm_family, (char*)RTA_DATA(attr));
-      r["source"] = address;
-      break;
-    case RTA_DST:
-      if (message->rtm_dst_len != 32 && message->rtm_dst_len != 128) {
-        mask = (int)message->rtm_dst_len;
-      }
-      address = getNetlinkIP(message->rtm_family, (char*)RTA_DATA(attr));
-      r["destination"] = address;
-      has_destination = true;
-      break;
-    case RTA_PRIORITY:
-      r["metric"] = INTEGER(*(int*)RTA_DATA(attr));
-      break;
-    }
-    attr = RTA_NEXT(attr, attr_size);
-  }
+  forEachNetlinkAttribute(
+      netlink_msg, sizeof(struct rtmsg), [&](const struct rtattr* attr) {
+        switch (attr->rta_type) {
+        case RTA_OIF: {
+          auto name = interfaces.find(*(const int*)RTA_DATA(attr));
+          if (name != interfaces.end()) {
+            r["interface"] = name->second;
+          }
+          break;
+        }
+        case RTA_GATEWAY:
+          r["gateway"] = getNetlinkIP(message->rtm_family, RTA_DATA(attr));
+          break;
+        case RTA_PREFSRC:
+          r["source"] = getNetlinkIP(message->rtm_family, RTA_DATA(attr));
+          break;
+        case RTA_DST:
+          if (message->rtm_dst_len != 32 && message->rtm_dst_len != 128) {
+            mask = (int)message->rtm_dst_len;
+          }
+          r["destination"] =
+              getNetlinkIP(message->rtm_family, RTA_DATA(attr));
+          has_destination = true;
+          break;
+        case RTA_PRIORITY:
+          r["metric"] = INTEGER(*(const int*)RTA_DATA(attr));
+          break;
+        }
+      });
 
   if (!has_destination) {
     r["destination"] = "0.0.0.0";
@@ -143,17 +79,8 @@ void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
   }
 
   // Route type determination
-  if (message->rtm_type == RTN_UNICAST) {
-    r["type"] = "gateway";
-  } else if (message->rtm_type == RTN_LOCAL) {
-    r["type"] = "local";
-  } else if (message->rtm_type == RTN_BROADCAST) {
-    r["type"] = "broadcast";
-  } else if (message->rtm_type == RTN_ANYCAST) {
-    r["type"] = "anycast";
-  } else {
-    r["type"] = "other";
-  }
+  auto type = kRouteTypes.find(message->rtm_type);
+  r["type"] = (type != kRouteTypes.end()) ? type->second : "other";
 
   r["flags"] = INTEGER(message->rtm_flags);
 
@@ -162,59 +89,48 @@ void genNetlinkRoutes(const struct nlmsghdr* netlink_msg, QueryData& results) {
 
   // Fields not supported by Linux routes:
   r["mtu"] = "0";
-  results.push_back(r);
+  results.push_back(std::move(r));
 }
 
 QueryData genRoutes(QueryContext& context) {
-  QueryData results;
-
-  int socket_fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
-  if (socket_fd < 0) {
-    VLOG(1) << "Cannot open NETLINK socket";
-    return {};
-  }
-
-  // Create netlink message header
-  auto netlink_buffer = (void*)malloc(MAX_NETLINK_SIZE);
-  if (netlink_buffer == nullptr) {
-    close(socket_fd);
-    return {};
+  struct rtmsg header;
+  memset(&header, 0, sizeof(header));
+
+  // A single route type is filtered by the kernel.
+  auto types = context.constraints["type"].getAll(EQUALS);
+  if (types.size() == 1) {
+    for (const auto& type : kRouteTypes) {
+      if (type.second == *types.begin()) {
+        header.rtm_type = type.first;
+      }
+    }
   }
 
-  memset(netlink_buffer, 0, MAX_NETLINK_SIZE);
-  auto netlink_msg = (struct nlmsghdr*)netlink_buffer;
-  netlink_msg->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-  netlink_msg->nlmsg_type = RTM_GETROUTE; // routes from kernel routing table
-  netlink_msg->nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST | NLM_F_ATOMIC;
-  netlink_msg->nlmsg_seq = 0;
-  netlink_msg->nlmsg_pid = getpid();
-
-  // Send the netlink request to the kernel
-  if (send(socket_fd, netlink_msg, netlink_msg->nlmsg_len, 0) < 0) {
-    TLOG << "Cannot write NETLINK request header to socket";
-    close(socket_fd);
-    free(netlink_buffer);
-    return {};
+  // Routes of a single interface are filtered by the kernel.
+  NetlinkRequest request(RTM_GETROUTE, NLM_F_DUMP, &header, sizeof(header));
+  auto names = context.constraints["interface"].getAll(EQUALS);
+  if (names.size() == 1) {
+    int index = static_cast<int>(if_nametoindex(names.begin()->c_str()));
+    if (index == 0) {
+      return {};
+    }
+    request.addAttribute(RTA_OIF, &index, sizeof(index));
   }
 
-  // Wrap the read socket to support multi-netlink messages
-  size_t size = 0;
-  if (!readNetlink(socket_fd, 1, (char*)netlink_msg, &size).ok()) {
-    TLOG << "Cannot read NETLINK response from socket";
-    close(socket_fd);
-    free(netlink_buffer);
+  // Rows are only returned if the whole dump was read.
+  auto interfaces = getInterfaceNames();
+  QueryData routes;
+  auto status = sendNetlinkRequest(
+      NETLINK_ROUTE, request, [&](const struct nlmsghdr* message) {
+        if (message->nlmsg_type == RTM_NEWROUTE) {
+          genNetlinkRoutes(message, interfaces, routes);
+        }
+      });
+  if (!status.ok()) {
+    TLOG << "Cannot read routes: " << status.getMessage();
     return {};
   }
-
-  // Treat the netlink response as route information
-  while (NLMSG_OK(netlink_msg, size)) {
-    genNetlinkRoutes(netlink_msg, results);
-    netlink_msg = NLMSG_NEXT(netlink_msg, size);
-  }
-
-  close(socket_fd);
-  free(netlink_buffer);
-  return results;
+  return routes;
 }
 }
 }
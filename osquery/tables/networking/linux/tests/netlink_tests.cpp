@@ -0,0 +1,68 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <gtest/gtest.h>
+
+#include <linux/neighbour.h>
+#include <sys/socket.h>
+
+#include <cstring>
+
+#include "osquery/tables/networking/linux/netlink.h"
+
+namespace osquery {
+namespace tables {
+
+class NetlinkTests : public testing::Test {};
+
+TEST_F(NetlinkTests, test_netlink_request) {
+  struct ndmsg header;
+  memset(&header, 0, sizeof(header));
+  header.ndm_family = AF_INET;
+
+  NetlinkRequest request(RTM_GETNEIGH, NLM_F_DUMP, &header, sizeof(header));
+  auto message = reinterpret_cast<const struct nlmsghdr*>(request.data());
+  EXPECT_EQ(message->nlmsg_type, RTM_GETNEIGH);
+  EXPECT_EQ(message->nlmsg_flags, NLM_F_REQUEST | NLM_F_DUMP);
+  EXPECT_EQ(message->nlmsg_len, NLMSG_LENGTH(sizeof(header)));
+
+  // Attributes follow the aligned family header.
+  unsigned int index = 7;
+  request.addAttribute(NDA_IFINDEX, &index, sizeof(index));
+  message = reinterpret_cast<const struct nlmsghdr*>(request.data());
+  EXPECT_EQ(message->nlmsg_len,
+            NLMSG_SPACE(sizeof(header)) + RTA_LENGTH(sizeof(index)));
+
+  size_t attributes = 0;
+  forEachNetlinkAttribute(
+      message, sizeof(header), [&attributes](const struct rtattr* attr) {
+        EXPECT_EQ(attr->rta_type, NDA_IFINDEX);
+        EXPECT_EQ(*static_cast<const unsigned int*>(RTA_DATA(attr)), 7U);
+        attributes++;
+      });
+  EXPECT_EQ(attributes, 1U);
+}
+
+TEST_F(NetlinkTests, test_netlink_mac) {
+  struct {
+    struct rtattr attr;
+    unsigned char address[8];
+  } lladdr;
+  memset(&lladdr, 0, sizeof(lladdr));
+  lladdr.attr.rta_len = RTA_LENGTH(6);
+  unsigned char address[] = {0x00, 0x1b, 0x2c, 0xa0, 0xff, 0x09};
+  memcpy(RTA_DATA(&lladdr.attr), address, sizeof(address));
+  EXPECT_EQ(getNetlinkMAC(&lladdr.attr), "00:1b:2c:a0:ff:09");
+
+  unsigned char ip[] = {10, 0, 0, 1};
+  EXPECT_EQ(getNetlinkIP(AF_INET, ip), "10.0.0.1");
+}
+}
+}
@@ -20,7 +20,9 @@ typedef std::map<std::string, std::vector<ProtoFamilyPair>> PortMap;
 QueryData genListeningPorts(QueryContext& context) {
   QueryData results;
 
-  auto sockets = SQL::selectAllFrom("process_open_sockets");
+  // Tables may use the constraint to filter sockets before returning them.
+  auto sockets =
+      SQL::selectAllFrom("process_open_sockets", "remote_port", EQUALS, "0");
 
   PortMap ports;
   for (const auto& socket : sockets) {
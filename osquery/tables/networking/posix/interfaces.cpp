@@ -30,6 +30,12 @@
 namespace osquery {
 namespace tables {
 
+#ifdef __linux__
+/// Dump the details of each link over rtnetlink, see linux/interface_details.
+Status genInterfaceDetailsFromNetlink(QueryContext& context,
+                                      QueryData& results);
+#endif
+
 // Functions for safe sign-extension
 std::basic_string<char> INTEGER_FROM_UCHAR(unsigned char x) {
   return INTEGER(static_cast<uint16_t>(x));
@@ -162,6 +168,16 @@ QueryData genInterfaceAddresses(QueryContext& context) {
 QueryData genInterfaceDetails(QueryContext& context) {
   QueryData results;
 
+#ifdef __linux__
+  // A link dump avoids the per-interface ioctls and reports 64-bit counters.
+  auto status = genInterfaceDetailsFromNetlink(context, results);
+  if (status.ok()) {
+    return results;
+  }
+  VLOG(1) << "Cannot dump links: " << status.getMessage();
+  results.clear();
+#endif
+
   struct ifaddrs* if_addrs = nullptr;
   struct ifaddrs* if_addr = nullptr;
   if (getifaddrs(&if_addrs) != 0 || if_addrs == nullptr) {
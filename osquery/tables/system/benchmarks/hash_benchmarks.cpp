@@ -0,0 +1,71 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/filesystem.h>
+
+#include "osquery/tables/system/hash.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+static void HASH_buffer(benchmark::State& state) {
+  std::string content(state.range_y(), 'A');
+  auto hash_type = static_cast<HashType>(state.range_x());
+  while (state.KeepRunning()) {
+    auto digest = hashFromBuffer(hash_type, content.data(), content.size());
+    benchmark::DoNotOptimize(digest);
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+BENCHMARK(HASH_buffer)
+    ->ArgPair(HASH_TYPE_MD5, 4096)
+    ->ArgPair(HASH_TYPE_SHA1, 4096)
+    ->ArgPair(HASH_TYPE_SHA256, 4096)
+    ->ArgPair(HASH_TYPE_SHA256, 1 << 20);
+
+static void HASH_multi_buffer(benchmark::State& state) {
+  std::string content(state.range_x(), 'A');
+  auto mask = HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256;
+  while (state.KeepRunning()) {
+    auto hashes = hashMultiFromBuffer(mask, content.data(), content.size());
+    benchmark::DoNotOptimize(hashes);
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+BENCHMARK(HASH_multi_buffer)->Arg(4096)->Arg(1 << 20);
+
+static void HASH_multi_file(benchmark::State& state) {
+  auto path = fs::temp_directory_path() /
+              fs::unique_path("osquery-bench-hash-%%%%-%%%%-%%%%");
+  std::string content(state.range_y(), 'A');
+  writeTextFile(path, content);
+
+  auto mask = static_cast<int>(state.range_x());
+  while (state.KeepRunning()) {
+    auto hashes = hashMultiFromFile(mask, path.string());
+    benchmark::DoNotOptimize(hashes);
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+  removePath(path);
+}
+
+BENCHMARK(HASH_multi_file)
+    ->ArgPair(HASH_TYPE_SHA256, 1 << 20)
+    ->ArgPair(HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, 4096)
+    ->ArgPair(HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, 1 << 20)
+    ->ArgPair(HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, 16 << 20);
+}
@@ -191,9 +191,13 @@ QueryData genOpenSockets(QueryContext& context) {
   return results;
 }
 
-QueryData genOpenFiles(QueryContext& context) {
-  QueryData results;
+/// The number of descriptor rows generated before yielding the batch.
+const size_t kOpenFilesRowsBatch = 256;
 
+void genOpenFiles(TableRowsYield& yield,
+                  TableRows& batch,
+                  QueryContext& context) {
+  QueryData rows;
   auto pidlist = getProcList(context);
   for (auto& pid : pidlist) {
     if (!context.constraints["pid"].matches(pid)) {
@@ -201,10 +205,16 @@ QueryData genOpenFiles(QueryContext& context) {
       continue;
     }
 
-    genOpenDescriptors(pid, DESCRIPTORS_TYPE_VNODE, results);
-  }
+    genOpenDescriptors(pid, DESCRIPTORS_TYPE_VNODE, rows);
+    for (const auto& row : rows) {
+      batch.addRow(row);
+    }
+    rows.clear();
 
-  return results;
+    if (batch.size() >= kOpenFilesRowsBatch) {
+      yield(batch);
+    }
+  }
 }
 }
 }
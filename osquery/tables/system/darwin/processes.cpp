@@ -15,6 +15,7 @@
 
 #include <mach-o/dyld_images.h>
 
+#include <algorithm>
 #include <array>
 #include <map>
 #include <set>
@@ -71,23 +72,22 @@ std::set<int> getProcList(const QueryContext& context) {
     return pidlist;
   }
 
-  int bufsize = proc_listpids(PROC_ALL_PIDS, 0, nullptr, 0);
-  if (bufsize <= 0) {
+  int num_pids = proc_listallpids(nullptr, 0);
+  if (num_pids <= 0) {
     VLOG(1) << "An error occurred retrieving the process list";
     return pidlist;
   }
 
   // Use twice the number of PIDs returned to handle races.
-  std::vector<pid_t> pids(2 * bufsize);
-
-  bufsize = proc_listpids(PROC_ALL_PIDS, 0, pids.data(), 2 * bufsize);
-  if (bufsize <= 0) {
+  std::vector<pid_t> pids(2 * num_pids);
+  num_pids = proc_listallpids(
+      pids.data(), static_cast<int>(pids.size() * sizeof(pid_t)));
+  if (num_pids <= 0) {
     VLOG(1) << "An error occurred retrieving the process list";
     return pidlist;
   }
 
-  size_t num_pids = bufsize / sizeof(pid_t);
-  for (size_t i = 0; i < num_pids; ++i) {
+  for (size_t i = 0; i < static_cast<size_t>(num_pids); ++i) {
     // If the pid is negative or 0, it doesn't represent a real process so
     // continue the iterations so that we don't add it to the results set
     if (pids[i] <= 0) {
@@ -109,22 +109,27 @@ struct proc_cred {
   } real, effective, saved;
 };
 
+static inline void setProcCred(const struct proc_bsdinfo& bsdinfo,
+                               proc_cred& cred) {
+  cred.parent = bsdinfo.pbi_ppid;
+  cred.group = bsdinfo.pbi_pgid;
+  cred.status = bsdinfo.pbi_status;
+  cred.nice = bsdinfo.pbi_nice;
+  cred.real.uid = bsdinfo.pbi_ruid;
+  cred.real.gid = bsdinfo.pbi_rgid;
+  cred.effective.uid = bsdinfo.pbi_uid;
+  cred.effective.gid = bsdinfo.pbi_gid;
+  cred.saved.uid = bsdinfo.pbi_svuid;
+  cred.saved.gid = bsdinfo.pbi_svgid;
+}
+
 inline bool getProcCred(int pid, proc_cred& cred) {
   struct proc_bsdinfo bsdinfo;
   struct proc_bsdshortinfo bsdinfo_short;
 
   if (proc_pidinfo(pid, PROC_PIDTBSDINFO, 1, &bsdinfo, PROC_PIDTBSDINFO_SIZE) ==
       PROC_PIDTBSDINFO_SIZE) {
-    cred.parent = bsdinfo.pbi_ppid;
-    cred.group = bsdinfo.pbi_pgid;
-    cred.status = bsdinfo.pbi_status;
-    cred.nice = bsdinfo.pbi_nice;
-    cred.real.uid = bsdinfo.pbi_ruid;
-    cred.real.gid = bsdinfo.pbi_rgid;
-    cred.effective.uid = bsdinfo.pbi_uid;
-    cred.effective.gid = bsdinfo.pbi_gid;
-    cred.saved.uid = bsdinfo.pbi_svuid;
-    cred.saved.gid = bsdinfo.pbi_svgid;
+    setProcCred(bsdinfo, cred);
     return true;
   } else if (proc_pidinfo(pid,
                           PROC_PIDT_SHORTBSDINFO,
@@ -184,9 +189,15 @@ struct proc_args {
   std::map<std::string, std::string> env;
 };
 
-proc_args getProcRawArgs(int pid, size_t argmax) {
+/**
+ * @brief Read the arguments and environment of a process.
+ *
+ * @param pid The pid requested.
+ * @param procargs A buffer of the max args space, reused for each process.
+ */
+proc_args getProcRawArgs(int pid, std::vector<char>& procargs) {
   proc_args args;
-  std::vector<char> procargs(argmax);
+  size_t argmax = procargs.size();
   int mib[3] = {CTL_KERN, KERN_PROCARGS2, pid};
   if (sysctl(mib, 3, procargs.data(), &argmax, nullptr, 0) == -1 ||
       argmax == 0) {
@@ -194,6 +205,9 @@ proc_args getProcRawArgs(int pid, size_t argmax) {
   }
 
   // The number of arguments is an integer in front of the result buffer.
+  if (argmax <= sizeof(int)) {
+    return args;
+  }
   int nargs = 0;
   memcpy(&nargs, procargs.data(), sizeof(nargs));
   // Walk the \0-tokenized list of arguments until reaching the returned 'max'
@@ -256,24 +270,52 @@ QueryData genProcesses(QueryContext& context) {
   }
 
   auto pidlist = getProcList(context);
-  int argmax = genMaxArgs();
+
+  // Arguments and paths are only read for the columns that are used.
+  bool cmdline = context.isColumnUsed("cmdline");
+  bool directories =
+      context.isColumnUsed("cwd") || context.isColumnUsed("root");
+  bool on_disk = context.isColumnUsed("on_disk");
+
+  // The args buffer is allocated once and reused for each process.
+  std::vector<char> procargs;
+  if (cmdline) {
+    procargs.resize(std::max(genMaxArgs(), 0));
+  }
+
+  // Process start times are relative to a single uptime sample.
+  auto uptime = getUptimeInUSec();
+  uint64_t absoluteTime = mach_absolute_time();
+  auto multiply = static_cast<double>(time_base.numer) /
+                  static_cast<double>(time_base.denom);
 
   for (auto& pid : pidlist) {
     Row r;
     r["pid"] = INTEGER(pid);
 
-    {
+    if (cmdline) {
       // The command line invocation including arguments.
-      auto args = getProcRawArgs(pid, argmax);
-      std::string cmdline = boost::algorithm::join(args.args, " ");
-      r["cmdline"] = cmdline;
+      auto args = getProcRawArgs(pid, procargs);
+      r["cmdline"] = boost::algorithm::join(args.args, " ");
     }
 
-    // The process relative root and current working directory.
-    genProcRootAndCWD(pid, r);
+    if (directories) {
+      // The process relative root and current working directory.
+      genProcRootAndCWD(pid, r);
+    }
 
+    // The BSD and task information are requested together, falling back to
+    // the BSD information alone for processes whose task cannot be read.
     proc_cred cred;
-    if (getProcCred(pid, cred)) {
+    struct proc_taskallinfo allinfo;
+    bool has_allinfo =
+        proc_pidinfo(pid, PROC_PIDTASKALLINFO, 0, &allinfo, sizeof(allinfo)) ==
+        sizeof(allinfo);
+    if (has_allinfo) {
+      setProcCred(allinfo.pbsd, cred);
+    }
+
+    if (has_allinfo || getProcCred(pid, cred)) {
       r["parent"] = BIGINT(cred.parent);
       r["pgroup"] = BIGINT(cred.group);
       // check if process state is one of the expected ones
@@ -308,7 +350,9 @@ QueryData genProcesses(QueryContext& context) {
     // available, set on_disk to -1. If, and only if, the path of the
     // executable is available and the file does NOT exist on disk, set on_disk
     // to 0.
-    if (r["path"].empty()) {
+    if (!on_disk) {
+      r["on_disk"] = "";
+    } else if (r["path"].empty()) {
       r["on_disk"] = INTEGER(-1);
     } else if (pathExists(r["path"])) {
       r["on_disk"] = INTEGER(1);
@@ -333,11 +377,6 @@ QueryData genProcesses(QueryContext& context) {
 
       // Below is the logic to caculate the start_time since boot time
       // with higher precision
-      auto uptime = getUptimeInUSec();
-      uint64_t absoluteTime = mach_absolute_time();
-
-      auto multiply = static_cast<double>(time_base.numer) /
-                      static_cast<double>(time_base.denom);
       auto diff = static_cast<long>(
           (rusage_info_data.ri_proc_start_abstime - absoluteTime));
 
@@ -356,11 +395,8 @@ QueryData genProcesses(QueryContext& context) {
       r["start_time"] = "-1";
     }
 
-    struct proc_taskinfo task_info;
-    status =
-        proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &task_info, sizeof(task_info));
-    if (status == sizeof(task_info)) {
-      r["threads"] = INTEGER(task_info.pti_threadnum);
+    if (has_allinfo) {
+      r["threads"] = INTEGER(allinfo.ptinfo.pti_threadnum);
     } else {
       r["threads"] = "-1";
     }
@@ -371,23 +407,28 @@ QueryData genProcesses(QueryContext& context) {
   return results;
 }
 
-QueryData genProcessEnvs(QueryContext& context) {
-  QueryData results;
+/// The number of per-process rows generated before yielding the batch.
+const size_t kProcessRowsBatch = 256;
 
+void genProcessEnvs(TableRowsYield& yield,
+                    TableRows& batch,
+                    QueryContext& context) {
   auto pidlist = getProcList(context);
-  int argmax = genMaxArgs();
+  std::vector<char> procargs(std::max(genMaxArgs(), 0));
   for (const auto& pid : pidlist) {
-    auto args = getProcRawArgs(pid, argmax);
+    auto args = getProcRawArgs(pid, procargs);
     for (const auto& env : args.env) {
       Row r;
       r["pid"] = INTEGER(pid);
       r["key"] = env.first;
       r["value"] = env.second;
-      results.push_back(r);
+      batch.addRow(r);
     }
-  }
 
-  return results;
+    if (batch.size() >= kProcessRowsBatch) {
+      yield(batch);
+    }
+  }
 }
 
 void genMemoryRegion(int pid,
@@ -627,15 +668,22 @@ static std::string getProcPath(int pid) {
   return std::string(path);
 }
 
-QueryData genProcessMemoryMap(QueryContext& context) {
-  QueryData results;
-
+void genProcessMemoryMap(TableRowsYield& yield,
+                         TableRows& batch,
+                         QueryContext& context) {
+  QueryData rows;
   auto pidlist = getProcList(context);
   for (const auto& pid : pidlist) {
-    genProcessMemoryMap(pid, results);
-  }
+    genProcessMemoryMap(pid, rows);
+    for (const auto& row : rows) {
+      batch.addRow(row);
+    }
+    rows.clear();
 
-  return results;
+    if (batch.size() >= kProcessRowsBatch) {
+      yield(batch);
+    }
+  }
 }
 }
 }
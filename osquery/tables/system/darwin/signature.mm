@@ -23,6 +23,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/tables/system/darwin/keychain.h"
+#include "osquery/tables/system/signature_cache.h"
 
 namespace osquery {
 namespace tables {
@@ -212,7 +213,19 @@ QueryData genSignature(QueryContext& context) {
       continue;
     }
 
-    genSignatureForFile(path_string, results);
+    Row r;
+    auto verifier = ([&path_string](Row& row) {
+      QueryData verified;
+      genSignatureForFile(path_string, verified);
+      if (verified.empty()) {
+        return false;
+      }
+      row = std::move(verified.front());
+      return true;
+    });
+    if (genCachedSignature("signature", path_string, verifier, r)) {
+      results.push_back(r);
+    }
   }
 
   return results;
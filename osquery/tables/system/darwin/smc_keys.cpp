@@ -9,6 +9,7 @@
  */
 
 #include <iomanip>
+#include <map>
 #include <sstream>
 
 #include <IOKit/IOKitLib.h>
@@ -17,6 +18,7 @@
 #include <boost/format.hpp>
 #include <boost/noncopyable.hpp>
 
+#include <osquery/core.h>
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -288,12 +290,17 @@ const std::map<std::string, std::string> kSMCKeyDescriptions = {
     {"PDTR", "DC In Total"},
     {"PSTR", "System Total"}};
 
+/**
+ * @brief A connection to the AppleSMC service, shared by the SMC tables.
+ *
+ * The connection is opened by the first query and kept open for the life of
+ * the process. The type and size of each key, and the list of keys, are
+ * cached after the first read, such that reading a key is a single call.
+ */
 class SMCHelper : private boost::noncopyable {
  public:
   virtual ~SMCHelper() {
-    if (connection_ != 0) {
-      close();
-    }
+    close();
   }
 
   /**
@@ -302,10 +309,10 @@ class SMCHelper : private boost::noncopyable {
    * This will find the userland SMC interface driver and open the service.
    * It will remain open until the helper is deleted.
    */
-  bool open();
+  bool open() const;
 
   /// Shutdown the IOKit connection.
-  void close() { IOServiceClose(connection_); }
+  void close() const;
 
   /// Read a given SMC key into an output parameter value.
   bool read(const std::string &key, SMCValue_t *val) const;
@@ -324,12 +331,32 @@ class SMCHelper : private boost::noncopyable {
 
  private:
   /// IOKit master port.
-  mach_port_t master_port_{0};
+  mutable mach_port_t master_port_{0};
   /// IOKit service connection.
-  io_connect_t connection_{0};
+  mutable io_connect_t connection_{0};
+
+  /// The type and size of each read key, a zero size if the key is missing.
+  mutable std::map<uint32_t, SMCKeyDataKeyInfo_t> key_info_;
+
+  /// The enumerated keys, the SMC keys do not change while running.
+  mutable std::vector<std::string> keys_;
+
+  /// Serialize calls through the connection and access to the caches.
+  mutable RecursiveMutex mutex_;
 };
 
-bool SMCHelper::open() {
+/// The SMC connection, opened by the first query.
+static const SMCHelper &getSMCHelper() {
+  static SMCHelper smc;
+  return smc;
+}
+
+bool SMCHelper::open() const {
+  RecursiveLock lock(mutex_);
+  if (connection_ != 0) {
+    return true;
+  }
+
   auto result = IOMasterPort(MACH_PORT_NULL, &master_port_);
   if (result != kIOReturnSuccess) {
     return false;
@@ -356,20 +383,40 @@ bool SMCHelper::open() {
   result = IOServiceOpen(device, mach_task_self(), 0, &connection_);
   IOObjectRelease(device);
   if (result != kIOReturnSuccess) {
+    connection_ = 0;
     return false;
   }
 
   return true;
 }
 
+void SMCHelper::close() const {
+  RecursiveLock lock(mutex_);
+  if (connection_ != 0) {
+    IOServiceClose(connection_);
+    connection_ = 0;
+  }
+}
+
 kern_return_t SMCHelper::call(uint32_t selector,
                               SMCKeyData_t *in,
                               SMCKeyData_t *out) const {
   size_t in_size = sizeof(SMCKeyData_t);
   size_t out_size = sizeof(SMCKeyData_t);
 
-  return IOConnectCallStructMethod(
+  auto result = IOConnectCallStructMethod(
       connection_, selector, in, in_size, out, &out_size);
+  if (result == MACH_SEND_INVALID_DEST || result == kIOReturnNotOpen) {
+    // The service was restarted, open a new connection and retry once.
+    close();
+    if (!open()) {
+      return result;
+    }
+    out_size = sizeof(SMCKeyData_t);
+    result = IOConnectCallStructMethod(
+        connection_, selector, in, in_size, out, &out_size);
+  }
+  return result;
 }
 
 inline uint32_t strtoul(const char *str, size_t size, size_t base) {
@@ -431,22 +478,36 @@ bool SMCHelper::read(const std::string &key, SMCValue_t *val) const {
 
   in.key = strtoul(key.c_str(), 4, 16);
   memcpy(val->key.bytes, key.c_str(), 4);
-  in.data8 = SMCCMDType::READ_KEYINFO;
 
-  auto result = call(KERNEL_INDEX_SMC, &in, &out);
-  if (result != kIOReturnSuccess) {
+  RecursiveLock lock(mutex_);
+  if (!open()) {
     return false;
   }
 
-  val->dataSize = out.keyInfo.dataSize;
-  val->dataType.bytes[0] = (uint32_t)out.keyInfo.dataType >> 24;
-  val->dataType.bytes[1] = (uint32_t)out.keyInfo.dataType >> 16;
-  val->dataType.bytes[2] = (uint32_t)out.keyInfo.dataType >> 8;
-  val->dataType.bytes[3] = (uint32_t)out.keyInfo.dataType;
+  auto info = key_info_.find(in.key);
+  if (info == key_info_.end()) {
+    in.data8 = SMCCMDType::READ_KEYINFO;
+    auto result = call(KERNEL_INDEX_SMC, &in, &out);
+    if (result != kIOReturnSuccess) {
+      return false;
+    }
+    info = key_info_.emplace(in.key, out.keyInfo).first;
+  }
+
+  val->dataSize = info->second.dataSize;
+  val->dataType.bytes[0] = (uint32_t)info->second.dataType >> 24;
+  val->dataType.bytes[1] = (uint32_t)info->second.dataType >> 16;
+  val->dataType.bytes[2] = (uint32_t)info->second.dataType >> 8;
+  val->dataType.bytes[3] = (uint32_t)info->second.dataType;
+  if (val->dataSize == 0) {
+    // The key does not exist, or is hidden while the SMC is locked.
+    return true;
+  }
+
   in.keyInfo.dataSize = val->dataSize;
   in.data8 = SMCCMDType::READ_BYTES;
 
-  result = call(KERNEL_INDEX_SMC, &in, &out);
+  auto result = call(KERNEL_INDEX_SMC, &in, &out);
   if (result != kIOReturnSuccess) {
     return false;
   }
@@ -462,6 +523,11 @@ size_t SMCHelper::getKeysCount() const {
 }
 
 std::vector<std::string> SMCHelper::getKeys() const {
+  RecursiveLock lock(mutex_);
+  if (!keys_.empty() || !open()) {
+    return keys_;
+  }
+
   std::vector<std::string> keys;
   size_t totalKeys = getKeysCount();
   for (size_t i = 0; i < totalKeys; i++) {
@@ -476,7 +542,8 @@ std::vector<std::string> SMCHelper::getKeys() const {
 
     auto result = call(KERNEL_INDEX_SMC, &in, &out);
     if (result != kIOReturnSuccess) {
-      continue;
+      // An incomplete list is not cached.
+      return keys;
     }
 
     UInt32Char_t key;
@@ -487,6 +554,7 @@ std::vector<std::string> SMCHelper::getKeys() const {
     key.bytes[4] = 0;
     keys.push_back(key.bytes);
   }
+  keys_ = keys;
   return keys;
 }
 
@@ -519,7 +587,7 @@ void genSMCKey(const std::string &key,
 QueryData genSMCKeys(QueryContext &context) {
   QueryData results;
 
-  SMCHelper smc;
+  const auto &smc = getSMCHelper();
   if (!smc.open()) {
     return {};
   }
@@ -553,7 +621,7 @@ inline QueryData getSMCKeysUsingPredicate(
     const QueryContext &context,
     const std::set<std::string> &keys,
     std::function<void(const Row &r, QueryData &results)> predicate) {
-  SMCHelper smc;
+  const auto &smc = getSMCHelper();
   if (!smc.open()) {
     return {};
   }
@@ -680,7 +748,7 @@ std::string getFanName(const std::string &smcVal) {
 QueryData genFanSpeedSensors(QueryContext &context) {
   QueryData results;
 
-  SMCHelper smc;
+  const auto &smc = getSMCHelper();
   if (!smc.open()) {
     return {};
   }
@@ -58,19 +58,29 @@ void genDescriptors(struct procstat* pstat,
   procstat_freefiles(pstat, files);
 }
 
-QueryData genOpenFiles(QueryContext& context) {
-  QueryData results;
+/// The number of descriptor rows generated before yielding the batch.
+const size_t kOpenFilesRowsBatch = 256;
+
+void genOpenFiles(TableRowsYield& yield,
+                  TableRows& batch,
+                  QueryContext& context) {
   struct kinfo_proc* procs = nullptr;
   struct procstat* pstat = nullptr;
+  ProcstatGuard guard(pstat, procs);
 
+  QueryData rows;
   auto cnt = getProcesses(context, &pstat, &procs);
-
   for (size_t i = 0; i < cnt; i++) {
-    genDescriptors(pstat, &procs[i], results);
-  }
+    genDescriptors(pstat, &procs[i], rows);
+    for (const auto& row : rows) {
+      batch.addRow(row);
+    }
+    rows.clear();
 
-  procstatCleanup(pstat, procs);
-  return results;
+    if (batch.size() >= kOpenFilesRowsBatch) {
+      yield(batch);
+    }
+  }
 }
 }
 }
@@ -197,32 +197,44 @@ QueryData genProcesses(QueryContext& context) {
   return results;
 }
 
-QueryData genProcessEnvs(QueryContext& context) {
-  QueryData results;
+/// The number of per-process rows generated before yielding the batch.
+const size_t kProcessRowsBatch = 256;
+
+/// Generate rows one process at a time, yielding full batches.
+static void genProcessRowsBatched(
+    TableRowsYield& yield,
+    TableRows& batch,
+    QueryContext& context,
+    void (*generator)(struct procstat*, struct kinfo_proc*, QueryData&)) {
   struct kinfo_proc* procs = nullptr;
   struct procstat* pstat = nullptr;
+  ProcstatGuard guard(pstat, procs);
 
+  QueryData rows;
   auto cnt = getProcesses(context, &pstat, &procs);
   for (unsigned int i = 0; i < cnt; i++) {
-    genProcessEnvironment(pstat, &procs[i], results);
-  }
+    generator(pstat, &procs[i], rows);
+    for (const auto& row : rows) {
+      batch.addRow(row);
+    }
+    rows.clear();
 
-  procstatCleanup(pstat, procs);
-  return results;
+    if (batch.size() >= kProcessRowsBatch) {
+      yield(batch);
+    }
+  }
 }
 
-QueryData genProcessMemoryMap(QueryContext& context) {
-  QueryData results;
-  struct kinfo_proc* procs = nullptr;
-  struct procstat* pstat = nullptr;
-
-  auto cnt = getProcesses(context, &pstat, &procs);
-  for (unsigned int i = 0; i < cnt; i++) {
-    genProcessMap(pstat, &procs[i], results);
-  }
+void genProcessEnvs(TableRowsYield& yield,
+                    TableRows& batch,
+                    QueryContext& context) {
+  genProcessRowsBatched(yield, batch, context, genProcessEnvironment);
+}
 
-  procstatCleanup(pstat, procs);
-  return results;
+void genProcessMemoryMap(TableRowsYield& yield,
+                         TableRows& batch,
+                         QueryContext& context) {
+  genProcessRowsBatched(yield, batch, context, genProcessMap);
 }
 }
 }
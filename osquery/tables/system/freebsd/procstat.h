@@ -15,6 +15,8 @@
 
 #include <libprocstat.h>
 
+#include <boost/noncopyable.hpp>
+
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -38,5 +40,25 @@ unsigned int getProcesses(QueryContext& context,
 
 /// Helper function to cleanup the libprocstat(3) pointers used.
 void procstatCleanup(struct procstat* pstat, struct kinfo_proc* procs);
+
+/**
+ * @brief Cleanup the libprocstat(3) pointers when leaving a scope.
+ *
+ * Generators that stop yielding, such as for a LIMIT, are unwound and do
+ * not reach a trailing call to procstatCleanup.
+ */
+class ProcstatGuard : private boost::noncopyable {
+ public:
+  ProcstatGuard(struct procstat*& pstat, struct kinfo_proc*& procs)
+      : pstat_(pstat), procs_(procs) {}
+
+  ~ProcstatGuard() {
+    procstatCleanup(pstat_, procs_);
+  }
+
+ private:
+  struct procstat*& pstat_;
+  struct kinfo_proc*& procs_;
+};
 }
 }
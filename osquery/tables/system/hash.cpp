@@ -9,7 +9,13 @@
  */
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <iomanip>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <thread>
@@ -31,9 +37,11 @@
 #include <openssl/md5.h>
 #include <openssl/sha.h>
 
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
@@ -55,11 +63,26 @@ HIDDEN_FLAG(uint32,
             20,
             "Number of milliseconds to delay after hashing");
 
-/// Clear this amount of rows every time cache eviction is triggered.
-#define HASH_CACHE_EVICT_SIZE 5
+FLAG(uint32, hash_threads, 4, "Number of threads hashing files for a query");
 
-/// The buffer read size from file IO to hashing structures.
-#define HASH_CHUNK_SIZE 4096
+FLAG(uint64,
+     hash_io_limit,
+     0,
+     "Maximum bytes per second read to hash files (0 is unlimited)");
+
+/// The number of independently locked file hash cache shards.
+#define HASH_CACHE_SHARDS 16
+
+/// The number of files hashed in parallel before their rows are yielded.
+#define HASH_BATCH_SIZE 64
+
+/**
+ * @brief The buffer read size from file IO to hashing structures.
+ *
+ * Large reads amortize the syscall and per-update overhead, the buffer is
+ * reused for every read of a file.
+ */
+#define HASH_CHUNK_SIZE (128 * 1024)
 
 Hash::~Hash() {
   if (ctx_ != nullptr) {
@@ -124,43 +147,79 @@ std::string hashFromBuffer(HashType hash_type,
   return hash.digest();
 }
 
-MultiHashes hashMultiFromFile(int mask, const std::string& path) {
-  std::map<HashType, std::shared_ptr<Hash>> hashes = {
-      {HASH_TYPE_MD5, std::make_shared<Hash>(HASH_TYPE_MD5)},
-      {HASH_TYPE_SHA1, std::make_shared<Hash>(HASH_TYPE_SHA1)},
-      {HASH_TYPE_SHA256, std::make_shared<Hash>(HASH_TYPE_SHA256)},
-  };
-
-  auto s = readFile(path,
-                    0,
-                    HASH_CHUNK_SIZE,
-                    false,
-                    true,
-                    ([&hashes, &mask](std::string& buffer, size_t size) {
-                      for (auto& hash : hashes) {
-                        if (mask & hash.first) {
-                          hash.second->update(&buffer[0], size);
-                        }
-                      }
-                    }),
-                    true);
-
-  MultiHashes mh = {};
-  if (!s.ok()) {
-    return mh;
+/**
+ * @brief The contexts of the hashes selected by a mask.
+ *
+ * Each buffer is fed to every selected context while it is hot in the cache.
+ * OpenSSL selects the SHA and AVX2 or ARMv8 implementations at runtime.
+ */
+class MultiHash : private boost::noncopyable {
+ public:
+  explicit MultiHash(int mask) : mask_(mask) {
+    if (mask_ & HASH_TYPE_MD5) {
+      md5_.reset(new Hash(HASH_TYPE_MD5));
+    }
+    if (mask_ & HASH_TYPE_SHA1) {
+      sha1_.reset(new Hash(HASH_TYPE_SHA1));
+    }
+    if (mask_ & HASH_TYPE_SHA256) {
+      sha256_.reset(new Hash(HASH_TYPE_SHA256));
+    }
   }
 
-  mh.mask = mask;
-  if (mask & HASH_TYPE_MD5) {
-    mh.md5 = hashes.at(HASH_TYPE_MD5)->digest();
+  void update(const void* buffer, size_t size) {
+    if (md5_ != nullptr) {
+      md5_->update(buffer, size);
+    }
+    if (sha1_ != nullptr) {
+      sha1_->update(buffer, size);
+    }
+    if (sha256_ != nullptr) {
+      sha256_->update(buffer, size);
+    }
   }
-  if (mask & HASH_TYPE_SHA1) {
-    mh.sha1 = hashes.at(HASH_TYPE_SHA1)->digest();
+
+  MultiHashes digest() {
+    MultiHashes mh = {};
+    mh.mask = mask_;
+    if (md5_ != nullptr) {
+      mh.md5 = md5_->digest();
+    }
+    if (sha1_ != nullptr) {
+      mh.sha1 = sha1_->digest();
+    }
+    if (sha256_ != nullptr) {
+      mh.sha256 = sha256_->digest();
+    }
+    return mh;
   }
-  if (mask & HASH_TYPE_SHA256) {
-    mh.sha256 = hashes.at(HASH_TYPE_SHA256)->digest();
+
+ private:
+  int mask_;
+  std::unique_ptr<Hash> md5_;
+  std::unique_ptr<Hash> sha1_;
+  std::unique_ptr<Hash> sha256_;
+};
+
+MultiHashes hashMultiFromBuffer(int mask, const void* buffer, size_t size) {
+  MultiHash hashes(mask);
+  hashes.update(buffer, size);
+  return hashes.digest();
+}
+
+MultiHashes hashMultiFromFile(int mask, const std::string& path) {
+  MultiHash hashes(mask);
+  auto s = readMappedFile(path,
+                          HASH_CHUNK_SIZE,
+                          true,
+                          ([&hashes](const char* buffer, size_t size) {
+                            hashes.update(buffer, size);
+                          }));
+
+  if (!s.ok()) {
+    return MultiHashes();
   }
-  return mh;
+  return hashes.digest();
 }
 
 std::string hashFromFile(HashType hash_type, const std::string& path) {
@@ -179,6 +238,10 @@ std::string hashFromFile(HashType hash_type, const std::string& path) {
  *
  * This cache has LRU eviction policy. The hash is recalculated
  * every time the mtime or size of the file changes.
+ *
+ * Cached hashes are also stored in the backing store, keyed by the file's
+ * identity, such that they survive restarts. Only the algorithms requested are
+ * calculated, the mask of each entry records the hashes it holds.
  */
 struct FileHashCache {
   /// The file's modification time, changes with a touch.
@@ -190,19 +253,14 @@ struct FileHashCache {
   /// The file's size.
   off_t file_size;
 
-  /// For eviction, the last time this cache item was used.
-  time_t cache_access_time;
-
   /// Cache content, the hashes.
   MultiHashes hashes;
 
-  /// Cache index, the file path.
-  std::string path;
+  /// The key of the hashes in the backing store.
+  std::string key;
 
-  /// Comparison function for organizing the LRU heap.
-  static bool greater(const FileHashCache* l, const FileHashCache* r) {
-    return l->cache_access_time > r->cache_access_time;
-  }
+  /// For eviction, the position of the path in the shard's LRU list.
+  std::list<std::string>::iterator lru;
 
   /**
    * @brief Do-it-all access function.
@@ -211,13 +269,37 @@ struct FileHashCache {
    * it is not present in cache calculates the hashes and caches the result.
    *
    * @param path the path of file to hash.
+   * @param mask the hashes to calculate, a mask of HashType%s.
    * @param out stores the calculated hashes.
    *
    * @return true if succeeded, false if something went wrong.
    */
-  static bool load(const std::string& path, MultiHashes& out);
+  static bool load(const std::string& path, int mask, MultiHashes& out);
+};
+
+/**
+ * @brief A shard of the file hash cache.
+ *
+ * Paths are distributed over shards that are locked independently, such that
+ * concurrent hashing threads and queries rarely wait on each other. Files are
+ * never hashed while a shard is locked.
+ */
+struct FileHashCacheShard {
+  /// Synchronize access to the shard.
+  Mutex mutex;
+
+  /// path => cache entry
+  std::unordered_map<std::string, FileHashCache> cache;
+
+  /// The cached paths, most recently used first.
+  std::list<std::string> lru;
 };
 
+static FileHashCacheShard& getFileHashCacheShard(const std::string& path) {
+  static std::array<FileHashCacheShard, HASH_CACHE_SHARDS> shards;
+  return shards[std::hash<std::string>()(path) % shards.size()];
+}
+
 #if defined(WIN32)
 
 #define stat _stat
@@ -244,16 +326,118 @@ static inline bool statInvalid(const struct stat& st, const FileHashCache& fh) {
   return false;
 }
 
-bool FileHashCache::load(const std::string& path, MultiHashes& out) {
-  // synchronize the access to cache
-  static Mutex mx;
-  // path => cache entry
-  static std::unordered_map<std::string, FileHashCache> cache;
-  // minheap on cache_access_time
-  static std::vector<FileHashCache*> lru;
+/**
+ * @brief The backing store key for a file's hashes.
+ *
+ * Across restarts the status change time is also compared, which changes with
+ * content written without a modification time update.
+ */
+static std::string getFileHashKey(const struct stat& st) {
+  return std::to_string(st.st_dev) + "." + std::to_string(st.st_ino) + "." +
+         std::to_string(st.st_mtime) + "." + std::to_string(st.st_ctime) +
+         "." + std::to_string(st.st_size);
+}
+
+/// Serialize hashes as the mask and each hex digest, separated by ':'.
+static std::string serializeHashes(const MultiHashes& hashes) {
+  return std::to_string(hashes.mask) + ":" + hashes.md5 + ":" + hashes.sha1 +
+         ":" + hashes.sha256;
+}
+
+static bool deserializeHashes(const std::string& value, MultiHashes& hashes) {
+  std::vector<std::string> parts;
+  boost::split(parts, value, boost::is_any_of(":"));
+  if (parts.size() != 4) {
+    return false;
+  }
+
+  hashes.mask = static_cast<int>(std::strtol(parts[0].c_str(), nullptr, 10));
+  hashes.md5 = std::move(parts[1]);
+  hashes.sha1 = std::move(parts[2]);
+  hashes.sha256 = std::move(parts[3]);
+  return true;
+}
+
+/// Add the hashes calculated in from to into.
+static void mergeHashes(MultiHashes& into, const MultiHashes& from) {
+  if (from.mask & HASH_TYPE_MD5) {
+    into.md5 = from.md5;
+  }
+  if (from.mask & HASH_TYPE_SHA1) {
+    into.sha1 = from.sha1;
+  }
+  if (from.mask & HASH_TYPE_SHA256) {
+    into.sha256 = from.sha256;
+  }
+  into.mask |= from.mask;
+}
+
+/**
+ * @brief Limit the stored hashes to the size of the in-memory cache.
+ *
+ * Stored hashes are removed when they are evicted from memory. After a
+ * restart, hashes for files that are never selected again are not, so this
+ * is applied once before the backing store is used.
+ */
+static void pruneStoredHashes() {
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kFileHashes, keys);
+  if (keys.size() <= FLAGS_hash_cache_max) {
+    return;
+  }
+
+  DatabaseBatch batch;
+  for (size_t i = FLAGS_hash_cache_max; i < keys.size(); i++) {
+    batch.remove(kFileHashes, keys[i]);
+  }
+  writeDatabaseBatch(batch);
+}
+
+/**
+ * @brief Wait until reading size bytes fits within the hashing I/O budget.
+ *
+ * The budget is shared by all hashing threads. Each read reserves the next
+ * slot of time, its size divided by the hash_io_limit bytes per second.
+ */
+static void waitForHashBudget(size_t size) {
+  if (FLAGS_hash_io_limit == 0) {
+    return;
+  }
+
+  static Mutex mutex;
+  static std::chrono::steady_clock::time_point next;
+
+  std::chrono::steady_clock::time_point slot;
+  {
+    WriteLock lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    if (next < now) {
+      next = now;
+    }
+    slot = next;
+    next += std::chrono::microseconds(static_cast<uint64_t>(
+        static_cast<double>(size) * 1000000 / FLAGS_hash_io_limit));
+  }
+  std::this_thread::sleep_until(slot);
+}
+
+/// Hash a file within the I/O budget, then apply the hash delay.
+static MultiHashes hashFileThrottled(const std::string& path,
+                                     int mask,
+                                     size_t size) {
+  if (mask == 0) {
+    return MultiHashes();
+  }
 
-  WriteLock guard(mx);
+  waitForHashBudget(size);
+  auto hashes = hashMultiFromFile(mask, path);
+  if (FLAGS_hash_delay > 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_hash_delay));
+  }
+  return hashes;
+}
 
+bool FileHashCache::load(const std::string& path, int mask, MultiHashes& out) {
   struct stat st;
   if (stat(path.c_str(), &st) != 0) {
     char buf[0x200] = {0};
@@ -262,160 +446,312 @@ bool FileHashCache::load(const std::string& path, MultiHashes& out) {
     return false;
   }
 
-  auto entry = cache.find(path);
-  if (entry == cache.end()) { // none, load
-    if (cache.size() >= FLAGS_hash_cache_max) {
-      // too large, evict
-      for (size_t i = 0; i < HASH_CACHE_EVICT_SIZE; ++i) {
-        if (lru.empty()) {
-          continue;
-        }
-        std::string key = lru[0]->path;
-        std::pop_heap(lru.begin(), lru.end(), FileHashCache::greater);
-        lru.pop_back();
-        if (cache.find(key) != cache.end()) {
-          cache.erase(key);
-        }
+  auto key = getFileHashKey(st);
+  MultiHashes hashes = {};
+  bool cached = false;
+  auto& shard = getFileHashCacheShard(path);
+  {
+    WriteLock guard(shard.mutex);
+    auto entry = shard.cache.find(path);
+    if (entry != shard.cache.end() && !statInvalid(st, entry->second)) {
+      if ((entry->second.hashes.mask & mask) == mask) {
+        // ok, got it
+        out = entry->second.hashes;
+        shard.lru.splice(shard.lru.begin(), shard.lru, entry->second.lru);
+        return true;
+      }
+      // Some of the requested hashes have not been calculated.
+      hashes = entry->second.hashes;
+      key = entry->second.key;
+      cached = true;
+    }
+  }
+
+  if (!cached) {
+    static std::once_flag prune_flag;
+    std::call_once(prune_flag, pruneStoredHashes);
+
+    // The hashes may have been stored before a restart.
+    std::string value;
+    if (getDatabaseValue(kFileHashes, key, value).ok()) {
+      deserializeHashes(value, hashes);
+    }
+  }
+
+  // none, changed, or missing algorithms, load without holding the shard lock
+  auto missing = mask & ~hashes.mask;
+  if (missing != 0) {
+    mergeHashes(
+        hashes,
+        hashFileThrottled(path, missing, static_cast<size_t>(st.st_size)));
+    setDatabaseValue(kFileHashes, key, serializeHashes(hashes));
+  }
+
+  std::vector<std::string> removed;
+  {
+    WriteLock guard(shard.mutex);
+    auto entry = shard.cache.find(path);
+    if (entry == shard.cache.end()) {
+      // The max size is divided between shards, evict the least recently used.
+      size_t shard_max =
+          std::max<size_t>((FLAGS_hash_cache_max + HASH_CACHE_SHARDS - 1) /
+                               HASH_CACHE_SHARDS,
+                           1);
+      while (shard.cache.size() >= shard_max && !shard.lru.empty()) {
+        auto evicted = shard.cache.find(shard.lru.back());
+        removed.push_back(std::move(evicted->second.key));
+        shard.cache.erase(evicted);
+        shard.lru.pop_back();
+      }
+
+      shard.lru.push_front(path);
+      entry = shard.cache.emplace(path, FileHashCache()).first;
+      entry->second.lru = shard.lru.begin();
+    } else {
+      if (entry->second.key != key) {
+        removed.push_back(entry->second.key);
       }
+      shard.lru.splice(shard.lru.begin(), shard.lru, entry->second.lru);
     }
 
-    auto hashes = hashMultiFromFile(
-        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
-    FileHashCache rec = {st.st_mtime, // .file_mtime
-                         st.st_ino, // .file_inode
-                         st.st_size, // .file_size
-                         time(nullptr), // .cache_access_time
-                         std::move(hashes), // .hashes
-                         path}; // .path
-    cache[path] = std::move(rec);
-    lru.push_back(&cache[path]);
-    std::push_heap(lru.begin(), lru.end(), FileHashCache::greater);
-    out = cache[path].hashes;
-  } else if (statInvalid(st, entry->second)) { // changed, update
-    auto hashes = hashMultiFromFile(
-        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
-    entry->second.cache_access_time = time(nullptr);
     entry->second.file_mtime = st.st_mtime;
+    entry->second.file_inode = st.st_ino;
     entry->second.file_size = st.st_size;
-    entry->second.hashes = std::move(hashes);
-    std::make_heap(lru.begin(), lru.end(), FileHashCache::greater);
-    out = entry->second.hashes;
-  } else { // ok, got it
-    out = entry->second.hashes;
-    entry->second.cache_access_time = time(nullptr);
-    std::make_heap(lru.begin(), lru.end(), FileHashCache::greater);
+    entry->second.hashes = hashes;
+    entry->second.key = key;
   }
+
+  for (const auto& removed_key : removed) {
+    deleteDatabaseValue(kFileHashes, removed_key);
+  }
+  out = std::move(hashes);
   return true;
 }
 
-void genHashForFile(const std::string& path,
-                    const std::string& dir,
-                    QueryContext& context,
-                    QueryData& results) {
-  // Must provide the path, filename, directory separate from boost path->string
-  // helpers to match any explicit (query-parsed) predicate constraints.
-  Row r;
+bool hashMultiFromCache(int mask,
+                        const std::string& path,
+                        MultiHashes& hashes) {
+  return FileHashCache::load(path, mask, hashes);
+}
 
-  MultiHashes hashes;
-  if (!FLAGS_disable_hash_cache) {
-    FileHashCache::load(path, hashes);
-  } else {
-    if (context.isCached(path)) {
-      // Use the inner-query cache if the global hash cache is disabled.
-      // This protects against hashing the same content twice in the same query.
-      r = context.getCache(path);
-    } else {
-      hashes = hashMultiFromFile(
-          HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
-      std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_hash_delay));
+void invalidateFileHash(const std::string& path) {
+  std::string key;
+  auto& shard = getFileHashCacheShard(path);
+  {
+    WriteLock guard(shard.mutex);
+    auto entry = shard.cache.find(path);
+    if (entry == shard.cache.end()) {
+      return;
+    }
+    key = std::move(entry->second.key);
+    shard.lru.erase(entry->second.lru);
+    shard.cache.erase(entry);
+  }
+  deleteDatabaseValue(kFileHashes, key);
+}
+
+/**
+ * @brief Hash files using up to hash_threads threads.
+ *
+ * @param paths The files to hash, each should be unique.
+ * @param mask The hashes to calculate, a mask of HashType%s.
+ * @param context The query, files are not hashed once it is cancelled.
+ * @param hashes Output, the hashes of each file in the order of paths.
+ */
+static void hashFiles(const std::vector<std::string>& paths,
+                      int mask,
+                      const QueryContext& context,
+                      std::vector<MultiHashes>& hashes) {
+  hashes.assign(paths.size(), MultiHashes());
+  if (mask == 0) {
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  auto worker = ([&paths, mask, &context, &hashes, &next]() {
+    for (auto i = next++; i < paths.size() && !context.isCancelled();
+         i = next++) {
+      if (!FLAGS_disable_hash_cache) {
+        FileHashCache::load(paths[i], mask, hashes[i]);
+      } else {
+        boost::system::error_code ec;
+        auto size = boost::filesystem::file_size(paths[i], ec);
+        hashes[i] = hashFileThrottled(
+            paths[i], mask, ec ? 0 : static_cast<size_t>(size));
+      }
+    }
+  });
+
+  // The calling thread hashes files too.
+  auto count = std::min<size_t>(std::max<uint32_t>(FLAGS_hash_threads, 1),
+                                paths.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < count; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void genHashForFiles(const std::vector<std::string>& paths,
+                     const std::vector<std::string>& dirs,
+                     QueryContext& context,
+                     QueryData& results) {
+  // Each file is hashed once, even if it was selected by path and directory.
+  // If the global hash cache is disabled the inner-query cache also protects
+  // against hashing the same content twice in the same query.
+  std::vector<std::string> pending;
+  std::unordered_map<std::string, size_t> pending_index;
+  for (const auto& path : paths) {
+    if (FLAGS_disable_hash_cache && context.isCached(path)) {
+      continue;
+    }
+    if (pending_index.emplace(path, pending.size()).second) {
+      pending.push_back(path);
     }
   }
 
-  r["path"] = path;
-  r["directory"] = dir;
-  r["md5"] = std::move(hashes.md5);
-  r["sha1"] = std::move(hashes.sha1);
-  r["sha256"] = std::move(hashes.sha256);
-  if (FLAGS_disable_hash_cache) {
-    context.setCache(path, r);
+  // Only calculate the hashes the query uses.
+  int mask = 0;
+  if (context.isColumnUsed("md5")) {
+    mask |= HASH_TYPE_MD5;
+  }
+  if (context.isColumnUsed("sha1")) {
+    mask |= HASH_TYPE_SHA1;
+  }
+  if (context.isColumnUsed("sha256")) {
+    mask |= HASH_TYPE_SHA256;
   }
 
-  results.push_back(r);
+  std::vector<MultiHashes> hashes;
+  hashFiles(pending, mask, context, hashes);
+
+  for (size_t i = 0; i < paths.size(); i++) {
+    // Must provide the path, filename, directory separate from boost
+    // path->string helpers to match any explicit (query-parsed) predicate
+    // constraints.
+    Row r;
+    auto index = pending_index.find(paths[i]);
+    if (index == pending_index.end()) {
+      r = context.getCache(paths[i]);
+    } else {
+      const auto& file_hashes = hashes[index->second];
+      r["md5"] = file_hashes.md5;
+      r["sha1"] = file_hashes.sha1;
+      r["sha256"] = file_hashes.sha256;
+      if (FLAGS_disable_hash_cache) {
+        context.setCache(paths[i], r);
+      }
+    }
+
+    r["path"] = paths[i];
+    r["directory"] = dirs[i];
+    results.push_back(std::move(r));
+  }
 }
 
 namespace tables {
 
-QueryData genHash(QueryContext& context) {
-  QueryData results;
+void genHash(RowYield& yield, QueryContext& context) {
   boost::system::error_code ec;
 
+  // Files are collected into batches, each is hashed in parallel and yielded.
+  std::vector<std::string> files;
+  std::vector<std::string> dirs;
+  auto flush = ([&]() {
+    QueryData results;
+    genHashForFiles(files, dirs, context, results);
+    files.clear();
+    dirs.clear();
+    for (auto& r : results) {
+      yield(r);
+    }
+  });
+
+  auto addFile = ([&](const std::string& path, const std::string& directory) {
+    files.push_back(path);
+    dirs.push_back(directory);
+    if (files.size() >= HASH_BATCH_SIZE) {
+      flush();
+    }
+  });
+
   // The query must provide a predicate with constraints including path or
   // directory. We search for the parsed predicate constraints with the equals
-  // operator.
+  // operator. LIKE patterns are resolved as they are walked, and paths are
+  // only remembered if more than one constraint may select them.
   auto paths = context.constraints["path"].getAll(EQUALS);
-  context.expandConstraints(
-      "path",
-      LIKE,
-      paths,
-      ([&](const std::string& pattern, std::set<std::string>& out) {
-        std::vector<std::string> patterns;
-        auto status =
-            resolveFilePattern(pattern, patterns, GLOB_ALL | GLOB_NO_CANON);
-        if (status.ok()) {
-          for (const auto& resolved : patterns) {
-            out.insert(resolved);
-          }
-        }
-        return status;
-      }));
+  auto path_patterns = context.constraints["path"].getAll(LIKE);
+  bool unique_paths = paths.empty() && path_patterns.size() <= 1;
 
   // Iterate through the file paths, adding the hash results
-  for (const auto& path_string : paths) {
+  auto addPath = ([&](const std::string& path_string) {
     boost::filesystem::path path = path_string;
-    if (!boost::filesystem::is_regular_file(path, ec)) {
-      continue;
+    if (boost::filesystem::is_regular_file(path, ec)) {
+      addFile(path_string, path.parent_path().string());
     }
+  });
+
+  for (const auto& path_string : paths) {
+    addPath(path_string);
+  }
 
-    genHashForFile(path_string, path.parent_path().string(), context, results);
+  for (const auto& pattern : path_patterns) {
+    resolveFilePattern(
+        pattern, GLOB_ALL | GLOB_NO_CANON, ([&](const std::string& resolved) {
+          if (unique_paths || paths.insert(resolved).second) {
+            addPath(resolved);
+          }
+          // Stop walking the pattern if the query was cancelled.
+          return !context.isCancelled();
+        }));
   }
 
   // Now loop through constraints using the directory column constraint.
   auto directories = context.constraints["directory"].getAll(EQUALS);
-  context.expandConstraints(
-      "directory",
-      LIKE,
-      directories,
-      ([&](const std::string& pattern, std::set<std::string>& out) {
-        std::vector<std::string> patterns;
-        auto status =
-            resolveFilePattern(pattern, patterns, GLOB_FOLDERS | GLOB_NO_CANON);
-        if (status.ok()) {
-          for (const auto& resolved : patterns) {
-            out.insert(resolved);
-          }
-        }
-        return status;
-      }));
+  auto directory_patterns = context.constraints["directory"].getAll(LIKE);
+  bool unique_directories =
+      directories.empty() && directory_patterns.size() <= 1;
 
-  // Iterate over the directory paths
-  for (const auto& directory_string : directories) {
+  // Iterate over the directory files and generate a hash for each regular
+  // file.
+  auto addDirectory = ([&](const std::string& directory_string) {
     boost::filesystem::path directory = directory_string;
     if (!boost::filesystem::is_directory(directory, ec)) {
-      continue;
+      return;
     }
 
-    // Iterate over the directory files and generate a hash for each regular
-    // file.
-    boost::filesystem::directory_iterator begin(directory), end;
-    for (; begin != end; ++begin) {
+    boost::system::error_code list_ec;
+    boost::filesystem::directory_iterator begin(directory, list_ec), end;
+    for (; !list_ec && begin != end && !context.isCancelled();
+         begin.increment(list_ec)) {
       if (boost::filesystem::is_regular_file(begin->path(), ec)) {
-        genHashForFile(
-            begin->path().string(), directory_string, context, results);
+        addFile(begin->path().string(), directory_string);
       }
     }
+  });
+
+  for (const auto& directory_string : directories) {
+    addDirectory(directory_string);
+  }
+
+  for (const auto& pattern : directory_patterns) {
+    resolveFilePattern(pattern,
+                       GLOB_FOLDERS | GLOB_NO_CANON,
+                       ([&](const std::string& resolved) {
+                         if (unique_directories ||
+                             directories.insert(resolved).second) {
+                           addDirectory(resolved);
+                         }
+                         return !context.isCancelled();
+                       }));
   }
 
-  return results;
+  if (!files.empty()) {
+    flush();
+  }
 }
 }
 }
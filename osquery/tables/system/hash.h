@@ -120,6 +120,17 @@ std::string hashFromFile(HashType hash_type, const std::string& path);
  */
 MultiHashes hashMultiFromFile(int mask, const std::string& path);
 
+/**
+ * @brief Compute multiple hashes from the contents of a buffer in one pass.
+ *
+ * @param mask Bitmask specifying target osquery-supported algorithms.
+ * @param buffer A caller-controlled buffer (already allocated).
+ * @param size The length of buffer in bytes.
+ * @return A struct containing string (hex) representations
+ *         of the hash digests.
+ */
+MultiHashes hashMultiFromBuffer(int mask, const void* buffer, size_t size);
+
 /**
  * @brief Compute a hash digest from the contents of a buffer.
  *
@@ -129,4 +140,30 @@ MultiHashes hashMultiFromFile(int mask, const std::string& path);
  * @return A string (hex) representation of the hash digest.
  */
 std::string hashFromBuffer(HashType hash_type, const void* buffer, size_t size);
+
+/**
+ * @brief Remove a file's hashes from the file hash cache.
+ *
+ * Cached hashes are reused while a file's modification time and size are
+ * unchanged. File event subscribers call this for changes that may not alter
+ * either, such as a write within the same second.
+ *
+ * @param path Filesystem path of the changed file.
+ */
+void invalidateFileHash(const std::string& path);
+
+/**
+ * @brief Compute multiple hashes of a file using the file hash cache.
+ *
+ * The hashes are calculated within the hash budget and kept in the cache,
+ * such that the hash table reuses them while the file is unchanged.
+ *
+ * @param mask Bitmask specifying target osquery-supported algorithms.
+ * @param path Filesystem path (the hash target).
+ * @param hashes Output, the hashes of the file.
+ * @return false if the file could not be read.
+ */
+bool hashMultiFromCache(int mask,
+                        const std::string& path,
+                        MultiHashes& hashes);
 }
@@ -25,11 +25,16 @@ extern "C" {
 #include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/package_cache.h"
+
 namespace osquery {
 namespace tables {
 
 static const std::string kDPKGPath{"/var/lib/dpkg"};
 
+/// dpkg rewrites the status database when packages change.
+static const std::string kDPKGStatus{"/var/lib/dpkg/status"};
+
 /// A comparator used to sort the packages array.
 int pkg_sorter(const void *a, const void *b) {
   const struct pkginfo *pa = *(const struct pkginfo **)a;
@@ -154,14 +159,10 @@ void extractDebPackageInfo(const struct pkginfo *pkg, QueryData &results) {
   results.push_back(r);
 }
 
-QueryData genDebPackages(QueryContext &context) {
+/// Read every installed package from the dpkg database.
+static QueryData genDebPackageInventory() {
   QueryData results;
 
-  if (!osquery::isDirectory(kDPKGPath)) {
-    TLOG << "Cannot find DPKG database: " << kDPKGPath;
-    return results;
-  }
-
   auto dropper = DropPrivileges::get();
   dropper->dropTo("nobody");
 
@@ -183,5 +184,15 @@ QueryData genDebPackages(QueryContext &context) {
   dpkg_teardown(&packages);
   return results;
 }
+
+QueryData genDebPackages(QueryContext &context) {
+  if (!osquery::isDirectory(kDPKGPath)) {
+    TLOG << "Cannot find DPKG database: " << kDPKGPath;
+    return {};
+  }
+
+  return genCachedPackages(
+      "deb_packages", {kDPKGStatus}, genDebPackageInventory);
+}
 }
 }
@@ -8,39 +8,31 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
-#include <mutex>
-#include <set>
-
-#include <grp.h>
-
 #include <osquery/core.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/tables/system/posix/user_directory.h"
+
 namespace osquery {
 namespace tables {
 
-Mutex grpEnumerationMutex;
-
 QueryData genGroups(QueryContext& context) {
   QueryData results;
-  struct group* grp = nullptr;
-  std::set<long> groups_in;
 
-  WriteLock lock(grpEnumerationMutex);
-  setgrent();
-  while ((grp = getgrent()) != nullptr) {
-    if (std::find(groups_in.begin(), groups_in.end(), grp->gr_gid) ==
-        groups_in.end()) {
+  auto& directory = UserDirectory::get();
+  if (context.constraints["gid"].exists(EQUALS)) {
+    auto gids = context.constraints["gid"].getAll(EQUALS);
+    for (const auto& gid : gids) {
+      long agid{0};
       Row r;
-      r["gid"] = INTEGER(grp->gr_gid);
-      r["gid_signed"] = INTEGER((int32_t)grp->gr_gid);
-      r["groupname"] = TEXT(grp->gr_name);
-      results.push_back(r);
-      groups_in.insert(grp->gr_gid);
+      if (safeStrtol(gid, 10, agid) && directory.group(agid, r)) {
+        results.push_back(std::move(r));
+      }
     }
+  } else {
+    results = directory.groups();
   }
-  endgrent();
-  groups_in.clear();
 
   return results;
 }
@@ -8,16 +8,86 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
 #include <mntent.h>
 #include <sys/vfs.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
 #include <osquery/tables.h>
 
 namespace osquery {
+
+FLAG(uint32,
+     mounts_stat_timeout,
+     1000,
+     "Milliseconds to wait for the statistics of mounted filesystems");
+
 namespace tables {
 
+/// Mount statistics are reused for this long.
+const std::chrono::seconds kMountStatsInterval{5};
+
+/// The number of threads calling statfs for a query.
+const size_t kMountStatsThreads = 8;
+
+/// The result of a statfs call, which may not return for a hung mount.
+struct MountStats {
+  explicit MountStats(const std::string& p) : path(p) {}
+
+  std::string path;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done{false};
+  bool ok{false};
+  struct statfs st;
+  std::chrono::steady_clock::time_point time;
+};
+
+/// Statistics for each mount, by device and path.
+static std::map<std::string, std::shared_ptr<MountStats>> kMountStats;
+
+static Mutex kMountStatsMutex;
+
+/// Workers claim pending statistics and outlive a query if a mount hangs.
+static void statMounts(std::vector<std::shared_ptr<MountStats>> pending) {
+  auto next = std::make_shared<std::atomic<size_t>>(0);
+  auto jobs = std::make_shared<std::vector<std::shared_ptr<MountStats>>>(
+      std::move(pending));
+
+  auto worker = ([next, jobs]() {
+    for (auto i = (*next)++; i < jobs->size(); i = (*next)++) {
+      auto& stats = (*jobs)[i];
+      struct statfs st;
+      auto ok = (statfs(stats->path.c_str(), &st) == 0);
+
+      std::lock_guard<std::mutex> lock(stats->mutex);
+      stats->ok = ok;
+      stats->st = st;
+      stats->time = std::chrono::steady_clock::now();
+      stats->done = true;
+      stats->cv.notify_all();
+    }
+  });
+
+  auto threads = std::min(kMountStatsThreads, jobs->size());
+  for (size_t i = 0; i < threads; i++) {
+    std::thread(worker).detach();
+  }
+}
+
 QueryData genMounts(QueryContext &context) {
   QueryData results;
 
@@ -28,6 +98,7 @@ QueryData genMounts(QueryContext &context) {
 
   char real_path[PATH_MAX + 1] = {0};
   struct mntent *ent = nullptr;
+  std::vector<std::string> keys;
   while ((ent = getmntent(mounts))) {
     Row r;
 
@@ -38,20 +109,80 @@ QueryData genMounts(QueryContext &context) {
     r["type"] = std::string(ent->mnt_type);
     r["flags"] = std::string(ent->mnt_opts);
 
-    struct statfs st;
-    if (!statfs(ent->mnt_dir, &st)) {
-      r["blocks_size"] = BIGINT(st.f_bsize);
-      r["blocks"] = BIGINT(st.f_blocks);
-      r["blocks_free"] = BIGINT(st.f_bfree);
-      r["blocks_available"] = BIGINT(st.f_bavail);
-      r["inodes"] = BIGINT(st.f_files);
-      r["inodes_free"] = BIGINT(st.f_ffree);
-    }
-
+    keys.push_back(r["device"] + '\0' + r["path"]);
     results.push_back(std::move(r));
   }
   endmntent(mounts);
 
+  // Reuse recent or pending statistics, and start the rest concurrently.
+  std::vector<std::shared_ptr<MountStats>> stats;
+  std::vector<bool> waiting;
+  {
+    WriteLock lock(kMountStatsMutex);
+    std::map<std::string, std::shared_ptr<MountStats>> current;
+    std::vector<std::shared_ptr<MountStats>> pending;
+    std::set<const MountStats*> started;
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < results.size(); i++) {
+      auto& mount = current[keys[i]];
+      if (mount == nullptr) {
+        auto cached = kMountStats.find(keys[i]);
+        if (cached != kMountStats.end()) {
+          mount = cached->second;
+        }
+      }
+
+      bool expired = false;
+      if (mount != nullptr) {
+        std::lock_guard<std::mutex> stats_lock(mount->mutex);
+        expired = mount->done && now - mount->time >= kMountStatsInterval;
+      }
+
+      if (mount == nullptr || expired) {
+        mount = std::make_shared<MountStats>(results[i]["path"]);
+        pending.push_back(mount);
+        started.insert(mount.get());
+      }
+
+      // Only statistics started by this query are waited for, a mount that
+      // has not returned since an earlier query is reported as stale.
+      stats.push_back(mount);
+      waiting.push_back(started.count(mount.get()) > 0);
+    }
+
+    kMountStats = std::move(current);
+    statMounts(std::move(pending));
+  }
+
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(FLAGS_mounts_stat_timeout);
+  for (size_t i = 0; i < results.size(); i++) {
+    auto& r = results[i];
+    auto& mount = stats[i];
+
+    std::unique_lock<std::mutex> lock(mount->mutex);
+    if (waiting[i] && FLAGS_mounts_stat_timeout == 0) {
+      mount->cv.wait(lock, [&mount]() { return mount->done; });
+    } else if (waiting[i]) {
+      mount->cv.wait_until(lock, deadline, [&mount]() { return mount->done; });
+    }
+
+    if (!mount->done) {
+      r["stale"] = INTEGER(1);
+      continue;
+    }
+
+    r["stale"] = INTEGER(0);
+    if (mount->ok) {
+      r["blocks_size"] = BIGINT(mount->st.f_bsize);
+      r["blocks"] = BIGINT(mount->st.f_blocks);
+      r["blocks_free"] = BIGINT(mount->st.f_bfree);
+      r["blocks_available"] = BIGINT(mount->st.f_bavail);
+      r["inodes"] = BIGINT(mount->st.f_files);
+      r["inodes_free"] = BIGINT(mount->st.f_ffree);
+    }
+  }
+
   return results;
 }
 }
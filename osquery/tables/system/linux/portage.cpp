@@ -25,6 +25,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/package_cache.h"
 
 namespace osquery {
 namespace tables {
@@ -281,8 +282,7 @@ QueryData parsePortageUseContent(const std::vector<std::string>& pkg_paths) {
   return results;
 }
 
-/* Functions refered from tables */
-QueryData portagePackages(QueryContext& context) {
+static QueryData genPortagePackageInventory() {
   std::string content_use;
   std::vector<std::string> pkg_paths;
   if (isDirectory(kPortagePackageDir).ok() &&
@@ -295,7 +295,7 @@ QueryData portagePackages(QueryContext& context) {
   }
 }
 
-QueryData genPortageUse(QueryContext& context) {
+static QueryData genPortageUseInventory() {
   std::vector<std::string> pkg_paths;
   if (isDirectory(kPortagePackageDir).ok() &&
       resolveFilePattern(kPortagePackageDir + "/*/*", pkg_paths, GLOB_FOLDERS)
@@ -306,6 +306,19 @@ QueryData genPortageUse(QueryContext& context) {
   }
 }
 
+/* Functions refered from tables */
+QueryData portagePackages(QueryContext& context) {
+  // Portage updates the package directory time when packages are merged.
+  return genCachedPackages("portage_packages",
+                           {kPortagePackageDir, kPortageWorld},
+                           genPortagePackageInventory);
+}
+
+QueryData genPortageUse(QueryContext& context) {
+  return genCachedPackages(
+      "portage_use", {kPortagePackageDir}, genPortageUseInventory);
+}
+
 QueryData genPortageKeywordSummary(QueryContext& context) {
   std::string keywords;
   std::string masked;
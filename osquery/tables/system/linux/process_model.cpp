@@ -0,0 +1,280 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+
+#include <osquery/dispatcher.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/tables/system/linux/process_model.h"
+
+namespace osquery {
+
+FLAG(bool,
+     processes_from_events,
+     false,
+     "Maintain the Linux processes table from process connector events");
+
+namespace tables {
+
+/// Receive buffer for process connector messages.
+const size_t kProcessEventBufferSize = 4096;
+
+/// The size of a request to subscribe or unsubscribe from process events.
+const size_t kProcessEventRequestSize =
+    NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op));
+
+class ProcessModelRunner : public InternalRunnable {
+ public:
+  ProcessModelRunner() : InternalRunnable("ProcessModelRunner") {}
+
+ protected:
+  /// Subscribe to the process connector and apply each event to the model.
+  void start() override;
+
+ private:
+  /// Send a multicast listen or ignore request.
+  bool subscribe(int sock, enum proc_cn_mcast_op op);
+
+  /// Apply a single process event to the model.
+  void handle(const struct proc_event& event);
+};
+
+bool ProcessModelRunner::subscribe(int sock, enum proc_cn_mcast_op op) {
+  char request[kProcessEventRequestSize] = {0};
+  auto header = reinterpret_cast<struct nlmsghdr*>(request);
+  header->nlmsg_len = kProcessEventRequestSize;
+  header->nlmsg_type = NLMSG_DONE;
+  header->nlmsg_pid = getpid();
+
+  // The connector message carries the multicast operation.
+  auto message = reinterpret_cast<struct cn_msg*>(NLMSG_DATA(header));
+  message->id.idx = CN_IDX_PROC;
+  message->id.val = CN_VAL_PROC;
+  message->len = sizeof(enum proc_cn_mcast_op);
+  memcpy(message->data, &op, sizeof(op));
+  return ::send(sock, request, sizeof(request), 0) >= 0;
+}
+
+void ProcessModelRunner::handle(const struct proc_event& event) {
+  auto& model = ProcessModel::get();
+  switch (event.what) {
+  case proc_event::PROC_EVENT_FORK:
+    // Only new processes, not new threads, are added.
+    if (event.event_data.fork.child_pid == event.event_data.fork.child_tgid) {
+      model.update(std::to_string(event.event_data.fork.child_tgid));
+    }
+    break;
+  case proc_event::PROC_EVENT_EXEC:
+    model.update(std::to_string(event.event_data.exec.process_tgid));
+    break;
+  case proc_event::PROC_EVENT_UID:
+  case proc_event::PROC_EVENT_GID:
+    model.update(std::to_string(event.event_data.id.process_tgid));
+    break;
+  case proc_event::PROC_EVENT_COMM:
+    model.update(std::to_string(event.event_data.comm.process_tgid));
+    break;
+  case proc_event::PROC_EVENT_EXIT:
+    if (event.event_data.exit.process_pid ==
+        event.event_data.exit.process_tgid) {
+      model.remove(std::to_string(event.event_data.exit.process_tgid));
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void ProcessModelRunner::start() {
+  auto sock =
+      ::socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  if (sock < 0) {
+    VLOG(1) << "Cannot open the process connector";
+    return;
+  }
+
+  struct sockaddr_nl addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  addr.nl_pid = getpid();
+  if (::bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      !subscribe(sock, PROC_CN_MCAST_LISTEN)) {
+    VLOG(1) << "Cannot subscribe to process events: " << strerror(errno);
+    ::close(sock);
+    return;
+  }
+
+  auto& model = ProcessModel::get();
+  model.setListening(true);
+
+  char buffer[kProcessEventBufferSize];
+  while (!interrupted()) {
+    struct pollfd fds = {sock, POLLIN, 0};
+    if (::poll(&fds, 1, 1000) <= 0) {
+      continue;
+    }
+
+    auto bytes = ::recv(sock, buffer, sizeof(buffer), 0);
+    if (bytes < 0) {
+      if (errno == ENOBUFS) {
+        // The receive buffer overflowed and events were dropped.
+        model.lost();
+      } else if (errno != EINTR && errno != EAGAIN) {
+        break;
+      }
+      continue;
+    }
+
+    auto size = static_cast<int>(bytes);
+    for (auto header = reinterpret_cast<struct nlmsghdr*>(buffer);
+         NLMSG_OK(header, size);
+         header = NLMSG_NEXT(header, size)) {
+      if (header->nlmsg_type == NLMSG_ERROR ||
+          header->nlmsg_type == NLMSG_OVERRUN) {
+        model.lost();
+        continue;
+      }
+
+      auto message = reinterpret_cast<struct cn_msg*>(NLMSG_DATA(header));
+      if (message->id.idx == CN_IDX_PROC && message->id.val == CN_VAL_PROC &&
+          message->len >= sizeof(struct proc_event)) {
+        handle(*reinterpret_cast<struct proc_event*>(message->data));
+      }
+    }
+  }
+
+  // Without events the model can no longer be trusted.
+  model.setListening(false);
+  subscribe(sock, PROC_CN_MCAST_IGNORE);
+  ::close(sock);
+}
+
+void ProcessModel::update(const std::string& pid) {
+  WriteLock lock(mutex_);
+  processes_[pid].stale = true;
+}
+
+void ProcessModel::remove(const std::string& pid) {
+  WriteLock lock(mutex_);
+  processes_.erase(pid);
+}
+
+void ProcessModel::lost() {
+  WriteLock lock(mutex_);
+  seeded_ = false;
+}
+
+void ProcessModel::setListening(bool listening) {
+  WriteLock lock(mutex_);
+  listening_ = listening;
+  if (!listening) {
+    seeded_ = false;
+  }
+}
+
+bool ProcessModel::generate(const QueryContext& context, QueryData& results) {
+  std::set<std::string> pids;
+  std::map<std::string, Process> snapshot;
+  {
+    WriteLock lock(mutex_);
+    if (!started_) {
+      // Events are only collected once the model is first used.
+      started_ = true;
+      Dispatcher::addService(std::make_shared<ProcessModelRunner>());
+      return false;
+    }
+
+    if (!listening_) {
+      return false;
+    }
+
+    if (!seeded_) {
+      // Subscribe before the scan, so no process is missed between the two.
+      processes_.clear();
+      std::set<std::string> scan;
+      procProcesses(scan);
+      for (const auto& pid : scan) {
+        processes_[pid].stale = true;
+      }
+      seeded_ = true;
+    }
+
+    // Events received while reading will mark processes stale again.
+    for (auto& process : processes_) {
+      pids.insert(process.first);
+      snapshot[process.first] = process.second;
+      process.second.stale = false;
+    }
+  }
+
+  // Changed processes are read completely, with every column.
+  QueryContext all_columns;
+  procWalk(pids,
+           ([&snapshot, &context, &all_columns](ProcReader& reader,
+                                                const std::string& pid,
+                                                QueryData& rows) {
+             const auto& process = snapshot.at(pid);
+             if (process.stale) {
+               genProcess(reader, pid, all_columns, rows);
+               return;
+             }
+
+             Row r = process.row;
+             if (genProcessVolatile(reader, context, r)) {
+               rows.push_back(std::move(r));
+             }
+           }),
+           results);
+
+  WriteLock lock(mutex_);
+  for (const auto& row : results) {
+    const auto& pid = row.at("pid");
+    auto snapped = snapshot.find(pid);
+    if (snapped == snapshot.end()) {
+      continue;
+    }
+
+    // A process that exited while it was read is not added again.
+    auto stored = processes_.find(pid);
+    if (snapped->second.stale && stored != processes_.end()) {
+      // Keep the columns that only change with an event.
+      stored->second.row.clear();
+      for (const auto& column : row) {
+        if (kProcessVolatileColumns.count(column.first) == 0) {
+          stored->second.row.insert(column);
+        }
+      }
+    }
+    snapshot.erase(snapped);
+  }
+
+  // Processes that could not be read have exited.
+  for (const auto& process : snapshot) {
+    auto stored = processes_.find(process.first);
+    if (stored != processes_.end() && !stored->second.stale) {
+      processes_.erase(stored);
+    }
+  }
+  return true;
+}
+}
+}
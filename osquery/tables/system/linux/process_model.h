@@ -0,0 +1,114 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <set>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/tables.h>
+
+#include "osquery/filesystem/linux/proc.h"
+
+namespace osquery {
+namespace tables {
+
+/// Generate a complete processes row for a pid, see processes.cpp.
+void genProcess(ProcReader& reader,
+                const std::string& pid,
+                const QueryContext& context,
+                QueryData& results);
+
+/**
+ * @brief Fill in the volatile processes columns used by a query.
+ *
+ * Volatile columns change without a process event: counters, state, and the
+ * parent, process group, cwd, root, and on_disk values.
+ *
+ * @return false if the process could not be read.
+ */
+bool genProcessVolatile(ProcReader& reader,
+                        const QueryContext& context,
+                        Row& r);
+
+/// The processes columns that are read again for each query.
+extern const std::set<std::string> kProcessVolatileColumns;
+
+/**
+ * @brief An in-memory model of the process list, updated by kernel events.
+ *
+ * The model is seeded from /proc, then the netlink process connector reports
+ * forks, execs, credential and name changes, and exits. Only processes with
+ * events since the last query are read completely. Volatile columns are read
+ * for each query, only if the query uses them. If the connector reports lost
+ * events the model is seeded again.
+ */
+class ProcessModel : private boost::noncopyable {
+ public:
+  static ProcessModel& get() {
+    static ProcessModel model;
+    return model;
+  }
+
+  /**
+   * @brief Generate processes rows from the model.
+   *
+   * The first request starts the process connector service.
+   *
+   * @return false if the model is not listening, the caller scans /proc.
+   */
+  bool generate(const QueryContext& context, QueryData& results);
+
+  /// A process forked or changed, it is read again by the next query.
+  void update(const std::string& pid);
+
+  /// A process exited.
+  void remove(const std::string& pid);
+
+  /// Events were lost, the next query seeds the model again.
+  void lost();
+
+  /// Set when the connector is subscribed to process events.
+  void setListening(bool listening);
+
+ private:
+  ProcessModel() = default;
+
+ private:
+  struct Process {
+    /// The columns that only change with a process event.
+    Row row;
+
+    /// The process changed since it was last read.
+    bool stale{true};
+  };
+
+  /// Known processes, ordered the same as a /proc scan.
+  std::map<std::string, Process> processes_;
+
+  /// Set once the model is filled from /proc, cleared if events were lost.
+  bool seeded_{false};
+
+  /// The connector service was requested.
+  bool started_{false};
+
+  /// The connector is subscribed, events are not being missed.
+  std::atomic<bool> listening_{false};
+
+  /// Protects the processes and seeded state.
+  Mutex mutex_;
+};
+}
+}
@@ -13,6 +13,8 @@
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 
+#include "osquery/filesystem/linux/proc.h"
+
 namespace osquery {
 namespace tables {
 
@@ -37,24 +39,41 @@ void genDescriptors(const std::string& process,
   return;
 }
 
-QueryData genOpenFiles(QueryContext& context) {
-  QueryData results;
+/// The number of descriptor rows generated before yielding the batch.
+const size_t kOpenFilesRowsBatch = 256;
 
-  std::set<std::string> pids;
-  if (context.constraints["pid"].exists(EQUALS)) {
-    pids = context.constraints["pid"].getAll(EQUALS);
-  } else {
-    osquery::procProcesses(pids);
-  }
+void genOpenFiles(TableRowsYield& yield,
+                  TableRows& batch,
+                  QueryContext& context) {
+  QueryData rows;
+  auto yieldDescriptors = ([&](const std::string& pid,
+                               const std::map<std::string, std::string>& fds) {
+    genDescriptors(pid, fds, rows);
+    for (const auto& row : rows) {
+      batch.addRow(row);
+    }
+    rows.clear();
 
-  for (const auto& process : pids) {
-    std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
-      genDescriptors(process, descriptors, results);
+    if (batch.size() >= kOpenFilesRowsBatch) {
+      yield(batch);
     }
+  });
+
+  if (context.constraints["pid"].exists(EQUALS)) {
+    for (const auto& pid : context.constraints["pid"].getAll(EQUALS)) {
+      std::map<std::string, std::string> descriptors;
+      if (osquery::procDescriptors(pid, descriptors).ok()) {
+        yieldDescriptors(pid, descriptors);
+      }
+    }
+    return;
   }
 
-  return results;
+  // Descriptors of every process are shared with other tables in a step.
+  auto index = getProcDescriptorIndex(TablePlugin::kCacheStep);
+  for (const auto& process : index->descriptors) {
+    yieldDescriptors(process.first, process.second);
+  }
 }
 }
 }
@@ -8,9 +8,11 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <functional>
 #include <map>
 #include <string>
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -22,24 +24,41 @@
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/linux/proc.h"
+#include "osquery/tables/system/linux/process_model.h"
 
 namespace osquery {
+
+DECLARE_bool(processes_from_events);
+
 namespace tables {
 
-inline std::string getProcAttr(const std::string& attr,
-                               const std::string& pid) {
-  return "/proc/" + pid + "/" + attr;
-}
+const std::set<std::string> kProcessVolatileColumns = {
+    "parent",
+    "pgroup",
+    "state",
+    "nice",
+    "threads",
+    "cwd",
+    "root",
+    "on_disk",
+    "resident_size",
+    "total_size",
+    "user_time",
+    "system_time",
+};
 
-inline std::string readProcCMDLine(const std::string& pid) {
-  auto attr = getProcAttr("cmdline", pid);
+inline std::string readProcCMDLine(ProcReader& reader) {
+  if (!reader.read("cmdline").ok()) {
+    return "";
+  }
 
-  std::string content;
-  readFile(attr, content);
+  auto content = reader.content();
   // Remove \0 delimiters.
   std::replace_if(content.begin(),
                   content.end(),
@@ -50,12 +69,14 @@ inline std::string readProcCMDLine(const std::string& pid) {
   return content;
 }
 
-inline std::string readProcLink(const std::string& attr,
-                                const std::string& pid) {
+inline std::string readProcLink(const ProcReader& reader, const char* attr) {
   // The exe is a symlink to the binary on-disk.
-  auto attr_path = getProcAttr(attr, pid);
+  std::string target;
+  if (!reader.readLink(attr, target).ok()) {
+    return "";
+  }
 
-  char* link_path = realpath(attr_path.c_str(), nullptr);
+  char* link_path = realpath(target.c_str(), nullptr);
   if (link_path != nullptr) {
     std::string result = std::string(link_path);
     free(link_path);
@@ -65,22 +86,52 @@ inline std::string readProcLink(const std::string& attr,
   return "";
 }
 
+/**
+ * @brief Iterate the whitespace-separated fields within a range of content.
+ *
+ * The callback receives each field's index, offset, and size. Iteration stops
+ * when the callback returns false.
+ *
+ * @return The number of fields visited.
+ */
+static size_t forEachField(
+    const std::string& content,
+    size_t offset,
+    size_t end,
+    const std::function<bool(size_t, size_t, size_t)>& field) {
+  size_t index = 0;
+  while (offset < end) {
+    if (isspace(content[offset])) {
+      offset++;
+      continue;
+    }
+
+    auto stop = offset;
+    while (stop < end && !isspace(content[stop])) {
+      stop++;
+    }
+    if (!field(index++, offset, stop - offset)) {
+      break;
+    }
+    offset = stop;
+  }
+  return index;
+}
+
 // In the case where the linked binary path ends in " (deleted)", and a file
 // actually exists at that path, check whether the inode of that file matches
 // the inode of the mapped file in /proc/%pid/maps
-Status deletedMatchesInode(const std::string& path, const std::string& pid) {
-  const std::string maps_path = getProcAttr("maps", pid);
-  std::string maps_contents;
-  auto s = osquery::readFile(maps_path, maps_contents);
-  if (!s.ok()) {
-    return Status(-1, "Cannot read maps file: " + maps_path);
+Status deletedMatchesInode(const std::string& path, ProcReader& reader) {
+  if (!reader.read("maps").ok()) {
+    return Status(-1, "Cannot read maps file");
   }
+  const auto& maps_contents = reader.content();
 
   // Extract the expected inode of the binary file from /proc/%pid/maps
   boost::smatch what;
   boost::regex expression("([0-9]+)\\h+\\Q" + path + "\\E");
   if (!boost::regex_search(maps_contents, what, expression)) {
-    return Status(-1, "Could not find binary inode in maps file: " + maps_path);
+    return Status(-1, "Could not find binary inode in maps file");
   }
   std::string inode = what[1];
 
@@ -114,12 +165,11 @@ std::set<std::string> getProcList(const QueryContext& context) {
   return pidlist;
 }
 
-void genProcessEnvironment(const std::string& pid, QueryData& results) {
-  auto attr = getProcAttr("environ", pid);
-
-  std::string content;
-  readFile(attr, content);
-  const char* variable = content.c_str();
+void genProcessEnvironment(ProcReader& reader,
+                           const std::string& pid,
+                           QueryData& results) {
+  reader.read("environ");
+  const char* variable = reader.content().c_str();
 
   // Stop at the end of nul-delimited string content.
   while (*variable > 0) {
@@ -135,12 +185,11 @@ void genProcessEnvironment(const std::string& pid, QueryData& results) {
   }
 }
 
-void genProcessMap(const std::string& pid, QueryData& results) {
-  auto map = getProcAttr("maps", pid);
-
-  std::string content;
-  readFile(map, content);
-  for (auto& line : osquery::split(content, "\n")) {
+void genProcessMap(ProcReader& reader,
+                   const std::string& pid,
+                   QueryData& results) {
+  reader.read("maps");
+  for (auto& line : osquery::split(reader.content(), "\n")) {
     auto fields = osquery::split(line, " ");
     // If can't read address, not sure.
     if (fields.size() < 5) {
@@ -210,79 +259,128 @@ struct SimpleProcStat : private boost::noncopyable {
   /// For errors processing proc data.
   Status status;
 
-  explicit SimpleProcStat(const std::string& pid);
+  explicit SimpleProcStat(ProcReader& reader);
 };
 
-SimpleProcStat::SimpleProcStat(const std::string& pid) {
-  std::string content;
-  if (readFile(getProcAttr("stat", pid), content).ok()) {
-    auto start = content.find_last_of(")");
+SimpleProcStat::SimpleProcStat(ProcReader& reader) {
+  if (reader.read("stat").ok()) {
+    const auto& content = reader.content();
+    auto start = content.find_last_of(')');
     // Start parsing stats from ") <MODE>..."
     if (start == std::string::npos || content.size() <= start + 2) {
       status = Status(1, "Invalid /proc/stat header");
       return;
     }
 
-    auto details = osquery::split(content.substr(start + 2), " ");
-    if (details.size() <= 19) {
+    auto fields = forEachField(
+        content,
+        start + 2,
+        content.size(),
+        [this, &content](size_t index, size_t offset, size_t size) {
+          switch (index) {
+          case 0:
+            this->state.assign(content, offset, size);
+            break;
+          case 1:
+            this->parent.assign(content, offset, size);
+            break;
+          case 2:
+            this->group.assign(content, offset, size);
+            break;
+          case 11:
+            this->user_time.assign(content, offset, size);
+            break;
+          case 12:
+            this->system_time.assign(content, offset, size);
+            break;
+          case 16:
+            this->nice.assign(content, offset, size);
+            break;
+          case 17:
+            this->threads.assign(content, offset, size);
+            break;
+          case 19: {
+            // The start time is reported in clock ticks.
+            char* end = nullptr;
+            auto ticks = strtoll(content.c_str() + offset, &end, 10);
+            this->start_time = (end == content.c_str() + offset + size)
+                                   ? std::to_string(ticks / 100)
+                                   : "-1";
+            return false;
+          }
+          }
+          return true;
+        });
+
+    if (fields <= 19) {
       status = Status(1, "Invalid /proc/stat content");
       return;
     }
-
-    this->state = details.at(0);
-    this->parent = details.at(1);
-    this->group = details.at(2);
-    this->user_time = details.at(11);
-    this->system_time = details.at(12);
-    this->nice = details.at(16);
-    this->threads = details.at(17);
-    try {
-      this->start_time = TEXT(AS_LITERAL(BIGINT_LITERAL, details.at(19)) / 100);
-    } catch (const boost::bad_lexical_cast& e) {
-      this->start_time = "-1";
-    }
   }
 
   // /proc/N/status may be not available, or readable by this user.
-  if (!readFile(getProcAttr("status", pid), content).ok()) {
+  if (!reader.read("status").ok()) {
     status = Status(1, "Cannot read /proc/status");
     return;
   }
 
-  for (const auto& line : osquery::split(content, "\n")) {
-    // Status lines are formatted: Key: Value....\n.
-    auto detail = osquery::split(line, ":", 1);
-    if (detail.size() != 2) {
+  // Status lines are formatted: Key: Value....\n.
+  const auto& content = reader.content();
+  for (size_t line = 0; line < content.size();) {
+    auto stop = content.find('\n', line);
+    stop = (stop == std::string::npos) ? content.size() : stop;
+    auto colon = content.find(':', line);
+    if (colon >= stop) {
+      line = stop + 1;
       continue;
     }
 
+    // The value is trimmed of surrounding whitespace.
+    auto value = colon + 1;
+    while (value < stop && isspace(content[value])) {
+      value++;
+    }
+    auto end = stop;
+    while (end > value && isspace(content[end - 1])) {
+      end--;
+    }
+
     // There are specific fields from each detail.
-    if (detail.at(0) == "Name") {
-      this->name = detail.at(1);
-    } else if (detail.at(0) == "VmRSS") {
-      detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
+    auto key = [&content, line, colon](const char* name) {
+      return content.compare(line, colon - line, name) == 0;
+    };
+    if (key("Name")) {
+      this->name.assign(content, value, end - value);
+    } else if (key("VmRSS") && end - value > 3) {
       // Memory is reported in kB.
-      this->resident_size = detail.at(1) + "000";
-    } else if (detail.at(0) == "VmSize") {
-      detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
+      this->resident_size = content.substr(value, end - value - 3) + "000";
+    } else if (key("VmSize") && end - value > 3) {
       // Memory is reported in kB.
-      this->total_size = detail.at(1) + "000";
-    } else if (detail.at(0) == "Gid") {
-      // Format is: R E - -
-      auto gid_detail = osquery::split(detail.at(1), "\t");
-      if (gid_detail.size() == 4) {
-        this->real_gid = gid_detail.at(0);
-        this->effective_gid = gid_detail.at(1);
-        this->saved_gid = gid_detail.at(2);
-      }
-    } else if (detail.at(0) == "Uid") {
-      auto uid_detail = osquery::split(detail.at(1), "\t");
-      if (uid_detail.size() == 4) {
-        this->real_uid = uid_detail.at(0);
-        this->effective_uid = uid_detail.at(1);
-        this->saved_uid = uid_detail.at(2);
+      this->total_size = content.substr(value, end - value - 3) + "000";
+    } else if (key("Gid") || key("Uid")) {
+      // Format is: R E S F
+      std::string ids[4];
+      auto count = forEachField(
+          content,
+          value,
+          end,
+          [&content, &ids](size_t index, size_t offset, size_t size) {
+            if (index < 4) {
+              ids[index].assign(content, offset, size);
+            }
+            return true;
+          });
+      if (count == 4 && key("Gid")) {
+        this->real_gid = std::move(ids[0]);
+        this->effective_gid = std::move(ids[1]);
+        this->saved_gid = std::move(ids[2]);
+      } else if (count == 4) {
+        this->real_uid = std::move(ids[0]);
+        this->effective_uid = std::move(ids[1]);
+        this->saved_uid = std::move(ids[2]);
       }
     }
+    line = stop + 1;
   }
 }
 
@@ -295,12 +393,12 @@ SimpleProcStat::SimpleProcStat(const std::string& pid) {
  * executable is available and the file does NOT exist on disk, set on_disk
  * to 0.
  *
- * @param pid The string (because we're referencing file path) pid.
+ * @param reader The open /proc reader of the process.
  * @param path A mutable string found from /proc/N/exe. If this is found
  *             to contain the (deleted) suffix, it will be removed.
  * @return A tristate -1 error, 1 yes, 0 nope.
  */
-int getOnDisk(const std::string& pid, std::string& path) {
+int getOnDisk(ProcReader& reader, std::string& path) {
   if (path.empty()) {
     return -1;
   }
@@ -321,10 +419,9 @@ int getOnDisk(const std::string& pid, std::string& path) {
   // Special case in which we have to check the inode to see whether the
   // process is actually running from a binary file ending with
   // " (deleted)". See #1607
-  std::string maps_contents;
-  Status deleted = deletedMatchesInode(path, pid);
+  Status deleted = deletedMatchesInode(path, reader);
   if (deleted.getCode() == -1) {
-    LOG(ERROR) << deleted.getMessage();
+    LOG(ERROR) << deleted.getMessage() << ": " << path;
     return -1;
   } else if (deleted.getCode() == 0) {
     // The process is actually running from a binary ending with
@@ -338,9 +435,12 @@ int getOnDisk(const std::string& pid, std::string& path) {
   }
 }
 
-void genProcess(const std::string& pid, QueryData& results) {
+void genProcess(ProcReader& reader,
+                const std::string& pid,
+                const QueryContext& context,
+                QueryData& results) {
   // Parse the process stat and status.
-  SimpleProcStat proc_stat(pid);
+  SimpleProcStat proc_stat(reader);
 
   if (!proc_stat.status.ok()) {
     VLOG(1) << proc_stat.status.getMessage() << " for pid " << pid;
@@ -350,16 +450,25 @@ void genProcess(const std::string& pid, QueryData& results) {
   Row r;
   r["pid"] = pid;
   r["parent"] = proc_stat.parent;
-  r["path"] = readProcLink("exe", pid);
+  // The links and cmdline are only read when the query uses them.
+  if (context.isColumnUsed("path") || context.isColumnUsed("on_disk")) {
+    r["path"] = readProcLink(reader, "exe");
+  }
   r["name"] = proc_stat.name;
   r["pgroup"] = proc_stat.group;
   r["state"] = proc_stat.state;
   r["nice"] = proc_stat.nice;
   r["threads"] = proc_stat.threads;
   // Read/parse cmdline arguments.
-  r["cmdline"] = readProcCMDLine(pid);
-  r["cwd"] = readProcLink("cwd", pid);
-  r["root"] = readProcLink("root", pid);
+  if (context.isColumnUsed("cmdline")) {
+    r["cmdline"] = readProcCMDLine(reader);
+  }
+  if (context.isColumnUsed("cwd")) {
+    r["cwd"] = readProcLink(reader, "cwd");
+  }
+  if (context.isColumnUsed("root")) {
+    r["root"] = readProcLink(reader, "root");
+  }
   r["uid"] = proc_stat.real_uid;
   r["euid"] = proc_stat.effective_uid;
   r["suid"] = proc_stat.saved_uid;
@@ -367,7 +476,9 @@ void genProcess(const std::string& pid, QueryData& results) {
   r["egid"] = proc_stat.effective_gid;
   r["sgid"] = proc_stat.saved_gid;
 
-  r["on_disk"] = INTEGER(getOnDisk(pid, r["path"]));
+  if (context.isColumnUsed("on_disk")) {
+    r["on_disk"] = INTEGER(getOnDisk(reader, r["path"]));
+  }
 
   // size/memory information
   r["wired_size"] = "0"; // No support for unpagable counters in linux.
@@ -379,40 +490,125 @@ void genProcess(const std::string& pid, QueryData& results) {
   r["system_time"] = proc_stat.system_time;
   r["start_time"] = proc_stat.start_time;
 
-  results.push_back(r);
+  results.push_back(std::move(r));
 }
 
-QueryData genProcesses(QueryContext& context) {
-  QueryData results;
+bool genProcessVolatile(ProcReader& reader,
+                        const QueryContext& context,
+                        Row& r) {
+  SimpleProcStat proc_stat(reader);
+  if (!proc_stat.status.ok()) {
+    return false;
+  }
 
-  auto pidlist = getProcList(context);
-  for (const auto& pid : pidlist) {
-    genProcess(pid, results);
+  r["parent"] = proc_stat.parent;
+  r["pgroup"] = proc_stat.group;
+  r["state"] = proc_stat.state;
+  r["nice"] = proc_stat.nice;
+  r["threads"] = proc_stat.threads;
+  if (context.isColumnUsed("cwd")) {
+    r["cwd"] = readProcLink(reader, "cwd");
+  }
+  if (context.isColumnUsed("root")) {
+    r["root"] = readProcLink(reader, "root");
   }
 
-  return results;
+  // The binary may be removed without an event, check the exe again.
+  if (context.isColumnUsed("on_disk")) {
+    r["path"] = readProcLink(reader, "exe");
+    r["on_disk"] = INTEGER(getOnDisk(reader, r["path"]));
+  }
+
+  r["resident_size"] = proc_stat.resident_size;
+  r["total_size"] = proc_stat.total_size;
+  r["user_time"] = proc_stat.user_time;
+  r["system_time"] = proc_stat.system_time;
+  return true;
 }
 
-QueryData genProcessEnvs(QueryContext& context) {
+QueryData genProcesses(QueryContext& context) {
   QueryData results;
 
+  // The model serves complete scans, pid and limit queries read /proc.
+  if (FLAGS_processes_from_events && context.limit == 0 &&
+      (context.constraints.count("pid") == 0 ||
+       !context.constraints.at("pid").exists(EQUALS))) {
+    if (ProcessModel::get().generate(context, results)) {
+      return results;
+    }
+    results.clear();
+  }
+
   auto pidlist = getProcList(context);
-  for (const auto& pid : pidlist) {
-    genProcessEnvironment(pid, results);
+  if (context.limit > 0) {
+    // With a known limit, generate rows in order until it is reached.
+    ProcReader reader;
+    for (const auto& pid : pidlist) {
+      if (context.isLimitReached(results.size())) {
+        break;
+      }
+      if (reader.open(pid)) {
+        genProcess(reader, pid, context, results);
+      }
+    }
+    return results;
   }
 
+  procWalk(pidlist,
+           ([&context](ProcReader& reader,
+                       const std::string& pid,
+                       QueryData& rows) {
+             genProcess(reader, pid, context, rows);
+           }),
+           results);
   return results;
 }
 
-QueryData genProcessMemoryMap(QueryContext& context) {
-  QueryData results;
+/// The number of per-process rows generated before yielding the batch.
+const size_t kProcessRowsBatch = 256;
 
-  auto pidlist = getProcList(context);
-  for (const auto& pid : pidlist) {
-    genProcessMap(pid, results);
+/**
+ * @brief Generate rows one process at a time, yielding full batches.
+ *
+ * Only the rows of one process and one batch are kept, and a query that
+ * stops reading rows, such as with a LIMIT, stops reading processes.
+ */
+static void genProcessRowsBatched(TableRowsYield& yield,
+                                  TableRows& batch,
+                                  const std::set<std::string>& pids,
+                                  const ProcGenerator& generator) {
+  ProcReader reader;
+  QueryData rows;
+  for (const auto& pid : pids) {
+    // A process may exit before it is read.
+    if (!reader.open(pid)) {
+      continue;
+    }
+
+    generator(reader, pid, rows);
+    for (const auto& row : rows) {
+      batch.addRow(row);
+    }
+    rows.clear();
+
+    if (batch.size() >= kProcessRowsBatch) {
+      yield(batch);
+    }
   }
+}
 
-  return results;
+void genProcessEnvs(TableRowsYield& yield,
+                    TableRows& batch,
+                    QueryContext& context) {
+  auto pidlist = getProcList(context);
+  genProcessRowsBatched(yield, batch, pidlist, genProcessEnvironment);
+}
+
+void genProcessMemoryMap(TableRowsYield& yield,
+                         TableRows& batch,
+                         QueryContext& context) {
+  auto pidlist = getProcList(context);
+  genProcessRowsBatched(yield, batch, pidlist, genProcessMap);
 }
 }
 }
@@ -24,6 +24,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/process.h"
+#include "osquery/tables/system/package_cache.h"
 
 namespace osquery {
 namespace tables {
@@ -31,6 +32,11 @@ namespace tables {
 // Maximum number of files per RPM.
 #define MAX_RPM_FILES (64 * 1024)
 
+/// The rpmdb files rewritten when packages change, Berkeley DB or SQLite.
+const std::vector<std::string> kRpmDatabasePaths = {
+    "/var/lib/rpm/Packages", "/var/lib/rpm/rpmdb.sqlite",
+};
+
 /**
  * @brief Return a string representation of the RPM tag type.
  *
@@ -114,6 +120,11 @@ class RpmEnvironmentManager : public boost::noncopyable {
 QueryData genRpmPackages(QueryContext& context) {
   QueryData results;
 
+  std::string stamp;
+  if (getCachedPackages("rpm_packages", kRpmDatabasePaths, results, stamp)) {
+    return results;
+  }
+
   auto dropper = DropPrivileges::get();
   if (!dropper->dropTo("nobody") && isUserAdmin()) {
     LOG(WARNING) << "Cannot drop privileges for rpm_packages";
@@ -132,7 +143,9 @@ QueryData genRpmPackages(QueryContext& context) {
 
   rpmts ts = rpmtsCreate();
   rpmdbMatchIterator matches;
-  if (context.constraints["name"].exists(EQUALS)) {
+  // An inventory of only the constrained package is not cached.
+  auto partial = context.constraints["name"].exists(EQUALS);
+  if (partial) {
     auto name = (*context.constraints["name"].getAll(EQUALS).begin());
     matches = rpmtsInitIterator(ts, RPMTAG_NAME, name.c_str(), name.size());
   } else {
@@ -160,10 +173,36 @@ QueryData genRpmPackages(QueryContext& context) {
   rpmFreeCrypto();
   rpmFreeRpmrc();
 
+  if (!partial) {
+    setCachedPackages("rpm_packages", stamp, results);
+  }
   return results;
 }
 
-void genRpmPackageFiles(RowYield& yield, QueryContext& context) {
+/// The number of package file rows generated before yielding the batch.
+const size_t kRpmFileRowsBatch = 256;
+
+void genRpmPackageFiles(TableRowsYield& yield,
+                        TableRows& batch,
+                        QueryContext& context) {
+  auto packages = context.constraints["package"].getAll(EQUALS);
+  QueryData inventory;
+  std::string stamp;
+  if (getCachedPackages(
+          "rpm_package_files", kRpmDatabasePaths, inventory, stamp)) {
+    for (const auto& row : inventory) {
+      if (!packages.empty() && packages.count(row.at("package")) == 0) {
+        continue;
+      }
+
+      batch.addRow(row);
+      if (batch.size() >= kRpmFileRowsBatch) {
+        yield(batch);
+      }
+    }
+    return;
+  }
+
   auto dropper = DropPrivileges::get();
   if (!dropper->dropTo("nobody") && isUserAdmin()) {
     LOG(WARNING) << "Cannot drop privileges for rpm_package_files";
@@ -180,13 +219,23 @@ void genRpmPackageFiles(RowYield& yield, QueryContext& context) {
 
   rpmts ts = rpmtsCreate();
   rpmdbMatchIterator matches;
-  if (context.constraints["package"].exists(EQUALS)) {
+  // Complete file inventories are also kept for the cache.
+  auto store = packages.empty() && !stamp.empty();
+  if (!packages.empty()) {
     auto name = (*context.constraints["package"].getAll(EQUALS).begin());
     matches = rpmtsInitIterator(ts, RPMTAG_NAME, name.c_str(), name.size());
   } else {
     matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
   }
 
+  auto package_column = batch.column("package");
+  auto path_column = batch.column("path");
+  auto username_column = batch.column("username");
+  auto groupname_column = batch.column("groupname");
+  auto mode_column = batch.column("mode");
+  auto size_column = batch.column("size");
+  auto sha256_column = batch.column("sha256");
+
   Header header;
   while ((header = rpmdbNextIterator(matches)) != nullptr) {
     rpmtd td = rpmtdNew();
@@ -207,24 +256,39 @@ void genRpmPackageFiles(RowYield& yield, QueryContext& context) {
 
     // Iterate over every file in this package.
     for (size_t i = 0; rpmfiNext(fi) >= 0 && i < file_count; i++) {
-      Row r;
+      // The file size is bound natively, without formatting a string.
+      batch.addRow();
       auto path = rpmfiFN(fi);
-      r["package"] = package_name;
-      r["path"] = (path != nullptr) ? path : "";
+      batch.setText(package_column, package_name);
+      batch.setText(path_column, (path != nullptr) ? path : "");
       auto username = rpmfiFUser(fi);
-      r["username"] = (username != nullptr) ? username : "";
+      batch.setText(username_column, (username != nullptr) ? username : "");
       auto groupname = rpmfiFGroup(fi);
-      r["groupname"] = (groupname != nullptr) ? groupname : "";
-      r["mode"] = lsperms(rpmfiFMode(fi));
-      r["size"] = BIGINT(rpmfiFSize(fi));
+      batch.setText(groupname_column, (groupname != nullptr) ? groupname : "");
+      batch.setText(mode_column, lsperms(rpmfiFMode(fi)));
+      batch.setInteger(size_column, rpmfiFSize(fi));
 
       int digest_algo;
       auto digest = rpmfiFDigestHex(fi, &digest_algo);
-      if (digest_algo == PGPHASHALGO_SHA256) {
-        r["sha256"] = (digest != nullptr) ? digest : "";
+      if (digest_algo != PGPHASHALGO_SHA256) {
+        digest = nullptr;
+      }
+      batch.setText(sha256_column, (digest != nullptr) ? digest : "");
+
+      if (store) {
+        inventory.push_back(
+            {{"package", package_name},
+             {"path", (path != nullptr) ? path : ""},
+             {"username", (username != nullptr) ? username : ""},
+             {"groupname", (groupname != nullptr) ? groupname : ""},
+             {"mode", lsperms(rpmfiFMode(fi))},
+             {"size", BIGINT(rpmfiFSize(fi))},
+             {"sha256", (digest != nullptr) ? digest : ""}});
       }
 
-      yield(r);
+      if (batch.size() >= kRpmFileRowsBatch) {
+        yield(batch);
+      }
     }
 
     rpmfiFree(fi);
@@ -234,6 +298,10 @@ void genRpmPackageFiles(RowYield& yield, QueryContext& context) {
   rpmdbFreeIterator(matches);
   rpmtsFree(ts);
   rpmFreeRpmrc();
+
+  if (store) {
+    setCachedPackages("rpm_package_files", stamp, inventory);
+  }
 }
 }
 }
@@ -9,13 +9,14 @@
  */
 
 #include <sys/shm.h>
-#include <pwd.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/posix/user_directory.h"
+
 namespace osquery {
 namespace tables {
 
@@ -28,15 +29,18 @@ struct shm_info {
   unsigned long swap_successes;
 } __attribute__((unused));
 
-QueryData genSharedMemory(QueryContext &context) {
-  QueryData results;
+/// The number of shared memory rows generated before yielding the batch.
+const size_t kSharedMemoryRowsBatch = 256;
 
+void genSharedMemory(TableRowsYield& yield,
+                     TableRows& batch,
+                     QueryContext& context) {
   // Use shared memory control (shmctl) to get the max SHMID.
   struct shm_info shm_info;
   int maxid = shmctl(0, SHM_INFO, (struct shmid_ds *)(void *)&shm_info);
   if (maxid < 0) {
     VLOG(1) << "Linux kernel not configured for shared memory";
-    return {};
+    return;
   }
 
   // Use a static pointer to access IPC permissions structure.
@@ -53,14 +57,14 @@ QueryData genSharedMemory(QueryContext &context) {
     Row r;
     r["shmid"] = INTEGER(shmid);
 
-    struct passwd *pw = getpwuid(shmseg.shm_perm.uid);
-    if (pw != nullptr) {
-      r["owner_uid"] = BIGINT(pw->pw_uid);
+    auto& directory = UserDirectory::get();
+    Row user;
+    if (directory.user(shmseg.shm_perm.uid, user)) {
+      r["owner_uid"] = BIGINT(shmseg.shm_perm.uid);
     }
 
-    pw = getpwuid(shmseg.shm_perm.cuid);
-    if (pw != nullptr) {
-      r["creator_uid"] = BIGINT(pw->pw_uid);
+    if (directory.user(shmseg.shm_perm.cuid, user)) {
+      r["creator_uid"] = BIGINT(shmseg.shm_perm.cuid);
     }
 
     // Accessor, creator pids.
@@ -78,10 +82,11 @@ QueryData genSharedMemory(QueryContext &context) {
     r["status"] = (ipcp->mode & SHM_DEST) ? "dest" : "";
     r["locked"] = (ipcp->mode & SHM_LOCKED) ? "1" : "0";
 
-    results.push_back(r);
+    batch.addRow(r);
+    if (batch.size() >= kSharedMemoryRowsBatch) {
+      yield(batch);
+    }
   }
-
-  return results;
 }
 }
 }
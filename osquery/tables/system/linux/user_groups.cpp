@@ -10,44 +10,43 @@
 
 #include "osquery/tables/system/user_groups.h"
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/posix/user_directory.h"
 
 namespace osquery {
 namespace tables {
 
-extern Mutex pwdEnumerationMutex;
+static void genGroupsForUser(const Row& user, QueryData& results) {
+  auto name = user.find("username");
+  if (name == user.end()) {
+    return;
+  }
+
+  auto uid = AS_LITERAL(BIGINT_LITERAL, user.at("uid"));
+  auto gid = AS_LITERAL(BIGINT_LITERAL, user.at("gid"));
+  auto rows = UserDirectory::get().userGroups(uid, gid, name->second);
+  results.insert(results.end(), rows.begin(), rows.end());
+}
 
 QueryData genUserGroups(QueryContext& context) {
   QueryData results;
-  struct passwd* pwd = nullptr;
 
+  auto& directory = UserDirectory::get();
   if (context.constraints["uid"].exists(EQUALS)) {
     std::set<std::string> uids = context.constraints["uid"].getAll(EQUALS);
     for (const auto& uid : uids) {
       long auid{0};
-      if (safeStrtol(uid, 10, auid) && (pwd = getpwuid(auid)) != nullptr) {
-        user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
-        getGroupsForUser<uid_t, gid_t>(results, user);
+      Row user;
+      if (safeStrtol(uid, 10, auid) && directory.user(auid, user)) {
+        genGroupsForUser(user, results);
       }
     }
   } else {
-    WriteLock lock(pwdEnumerationMutex);
-    std::set<gid_t> users_in;
-    while ((pwd = getpwent()) != nullptr) {
-      if (std::find(users_in.begin(), users_in.end(), pwd->pw_uid) ==
-          users_in.end()) {
-        user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
-        getGroupsForUser<uid_t, gid_t>(results, user);
-        users_in.insert(pwd->pw_uid);
+    std::set<std::string> users_in;
+    for (const auto& user : directory.users()) {
+      if (users_in.insert(user.at("uid")).second) {
+        genGroupsForUser(user, results);
       }
     }
-    endpwent();
-    users_in.clear();
   }
 
   return results;
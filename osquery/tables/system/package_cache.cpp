@@ -0,0 +1,149 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <ctime>
+#include <map>
+
+#include <sys/stat.h>
+
+#include <osquery/core.h>
+#include <osquery/database.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/tables/system/package_cache.h"
+
+namespace osquery {
+
+FLAG(bool,
+     disable_package_cache,
+     false,
+     "Read package databases for every query, without cached inventories");
+
+namespace tables {
+
+/// Recently modified databases may still be written, they are not cached.
+const time_t kPackageSettleSeconds = 2;
+
+/// The most recent inventory of each table, avoiding a database read.
+struct PackageInventory {
+  std::string stamp;
+  QueryData rows;
+};
+
+static std::map<std::string, PackageInventory> kPackageInventories;
+
+static Mutex kPackageInventoriesMutex;
+
+/**
+ * @brief Identify the state of a package database.
+ *
+ * The stamp changes with the device, inode, modification and status change
+ * times, and size of each path. An empty stamp is returned if a path was
+ * changed too recently to be trusted.
+ */
+static std::string getPackageStamp(const std::vector<std::string>& paths) {
+  std::string stamp;
+  auto now = std::time(nullptr);
+  for (const auto& path : paths) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      stamp += "-,";
+      continue;
+    }
+
+    if (now - st.st_mtime < kPackageSettleSeconds ||
+        now - st.st_ctime < kPackageSettleSeconds) {
+      return "";
+    }
+    stamp += std::to_string(st.st_dev) + "." + std::to_string(st.st_ino) +
+             "." + std::to_string(st.st_mtime) + "." +
+             std::to_string(st.st_ctime) + "." + std::to_string(st.st_size) +
+             ",";
+  }
+  return stamp;
+}
+
+bool getCachedPackages(const std::string& name,
+                       const std::vector<std::string>& paths,
+                       QueryData& results,
+                       std::string& stamp) {
+  stamp.clear();
+  if (FLAGS_disable_package_cache) {
+    return false;
+  }
+
+  // The stamp is taken before a miss generates the inventory.
+  stamp = getPackageStamp(paths);
+  if (stamp.empty()) {
+    return false;
+  }
+
+  WriteLock lock(kPackageInventoriesMutex);
+  auto& inventory = kPackageInventories[name];
+  if (inventory.stamp != stamp) {
+    // The inventory may have been stored before a restart.
+    std::string value;
+    if (!getDatabaseValue(kPackages, name, value).ok()) {
+      return false;
+    }
+
+    auto separator = value.find('\n');
+    if (separator == std::string::npos ||
+        value.compare(0, separator, stamp) != 0) {
+      return false;
+    }
+
+    QueryData rows;
+    if (!deserializeQueryDataJSON(value.substr(separator + 1), rows).ok()) {
+      return false;
+    }
+    inventory.stamp = stamp;
+    inventory.rows = std::move(rows);
+  }
+
+  results = inventory.rows;
+  return true;
+}
+
+void setCachedPackages(const std::string& name,
+                       const std::string& stamp,
+                       const QueryData& results) {
+  if (stamp.empty()) {
+    return;
+  }
+
+  std::string json;
+  if (!serializeQueryDataJSON(results, json).ok()) {
+    return;
+  }
+  setDatabaseValue(kPackages, name, stamp + "\n" + json);
+
+  WriteLock lock(kPackageInventoriesMutex);
+  auto& inventory = kPackageInventories[name];
+  inventory.stamp = stamp;
+  inventory.rows = results;
+}
+
+QueryData genCachedPackages(const std::string& name,
+                            const std::vector<std::string>& paths,
+                            const std::function<QueryData()>& generator) {
+  QueryData results;
+  std::string stamp;
+  if (getCachedPackages(name, paths, results, stamp)) {
+    return results;
+  }
+
+  results = generator();
+  setCachedPackages(name, stamp, results);
+  return results;
+}
+} // namespace tables
+} // namespace osquery
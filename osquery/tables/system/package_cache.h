@@ -0,0 +1,58 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/**
+ * @brief Read a cached package inventory if its database is unchanged.
+ *
+ * An inventory is stored with the device, inode, and modification times of
+ * the package manager's database paths. It is valid until any path changes.
+ *
+ * @param name The table name, the key of the stored inventory.
+ * @param paths Package database files or directories.
+ * @param results Output, the cached inventory rows.
+ * @param stamp Output, the state of the paths, used to store an inventory
+ *              generated after a miss. Empty if an inventory cannot be
+ *              stored.
+ * @return true if a valid inventory was cached.
+ */
+bool getCachedPackages(const std::string& name,
+                       const std::vector<std::string>& paths,
+                       QueryData& results,
+                       std::string& stamp);
+
+/// Store a complete package inventory, generated after a miss for stamp.
+void setCachedPackages(const std::string& name,
+                       const std::string& stamp,
+                       const QueryData& results);
+
+/**
+ * @brief Generate a package inventory, reusing it while its database is
+ * unchanged.
+ *
+ * @param name The table name, the key of the stored inventory.
+ * @param paths Package database files or directories.
+ * @param generator Generates the complete inventory on a cache miss.
+ */
+QueryData genCachedPackages(const std::string& name,
+                            const std::vector<std::string>& paths,
+                            const std::function<QueryData()>& generator);
+} // namespace tables
+} // namespace osquery
@@ -8,8 +8,6 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
-#include <pwd.h>
-#include <grp.h>
 #include <sys/stat.h>
 
 #include <boost/filesystem.hpp>
@@ -18,6 +16,8 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/posix/user_directory.h"
+
 namespace fs = boost::filesystem;
 
 namespace osquery {
@@ -38,21 +38,16 @@ Status genBin(const fs::path& path, int perms, QueryData& results) {
   // store path
   Row r;
   r["path"] = path.string();
-  struct passwd* pw = getpwuid(info.st_uid);
-  struct group* gr = getgrgid(info.st_gid);
+  auto& directory = UserDirectory::get();
 
   // get user name + group
-  std::string user;
-  if (pw != nullptr) {
-    user = std::string(pw->pw_name);
-  } else {
+  auto user = directory.username(info.st_uid);
+  if (user.empty()) {
     user = boost::lexical_cast<std::string>(info.st_uid);
   }
 
-  std::string group;
-  if (gr != nullptr) {
-    group = std::string(gr->gr_name);
-  } else {
+  auto group = directory.groupname(info.st_gid);
+  if (group.empty()) {
     group = boost::lexical_cast<std::string>(info.st_gid);
   }
 
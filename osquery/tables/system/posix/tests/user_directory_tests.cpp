@@ -0,0 +1,73 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <pwd.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/tables/system/posix/user_directory.h"
+
+namespace osquery {
+
+DECLARE_uint32(users_cache_ttl);
+
+namespace tables {
+
+class UserDirectoryTests : public testing::Test {};
+
+TEST_F(UserDirectoryTests, test_user_lookup) {
+  auto& directory = UserDirectory::get();
+  auto pwd = getpwuid(getuid());
+  ASSERT_NE(pwd, nullptr);
+  std::string name = pwd->pw_name;
+
+  Row r;
+  ASSERT_TRUE(directory.user(getuid(), r));
+  EXPECT_EQ(r["username"], name);
+  EXPECT_EQ(r["uid"], std::to_string(getuid()));
+  EXPECT_EQ(directory.username(getuid()), name);
+
+  r.clear();
+  ASSERT_TRUE(directory.user(name, r));
+  EXPECT_EQ(r["uid"], std::to_string(getuid()));
+
+  // Missing users are cached like existing users.
+  EXPECT_FALSE(directory.user("osquery_missing_user", r));
+  EXPECT_FALSE(directory.user("osquery_missing_user", r));
+}
+
+TEST_F(UserDirectoryTests, test_cache_hits) {
+  auto& directory = UserDirectory::get();
+  directory.username(getuid());
+  directory.users();
+
+  auto hits = directory.hits();
+  directory.username(getuid());
+  directory.users();
+  EXPECT_EQ(directory.hits(), hits + 2);
+
+  // Without a TTL every lookup is resolved again.
+  auto ttl = FLAGS_users_cache_ttl;
+  FLAGS_users_cache_ttl = 0;
+  directory.username(getuid());
+  auto misses = directory.misses();
+  directory.username(getuid());
+  EXPECT_EQ(directory.misses(), misses + 1);
+  FLAGS_users_cache_ttl = ttl;
+
+  auto users = directory.users();
+  EXPECT_FALSE(users.empty());
+  EXPECT_EQ(directory.users(1).size(), 1U);
+}
+} // namespace tables
+} // namespace osquery
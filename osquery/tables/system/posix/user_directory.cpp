@@ -0,0 +1,357 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <set>
+#include <vector>
+
+#include <grp.h>
+#include <pwd.h>
+#include <sys/stat.h>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/tables/system/posix/user_directory.h"
+#include "osquery/tables/system/user_groups.h"
+
+namespace osquery {
+
+FLAG(uint32,
+     users_cache_ttl,
+     60,
+     "Seconds to reuse users and groups resolved over NSS (0 disables)");
+
+namespace tables {
+
+/// Local databases that invalidate every cached user and group.
+const std::vector<std::string> kUserDirectoryPaths = {
+    "/etc/passwd", "/etc/group", "/etc/nsswitch.conf",
+};
+
+/// Recently modified databases may still be written, they are not cached.
+const time_t kUserDirectorySettleSeconds = 2;
+
+/// NSS sources that only read local files.
+const std::set<std::string> kUserDirectoryFileSources = {"files", "compat"};
+
+static void genUserRow(const struct passwd* pwd, Row& r) {
+  r["uid"] = BIGINT(pwd->pw_uid);
+  r["gid"] = BIGINT(pwd->pw_gid);
+  r["uid_signed"] = BIGINT((int32_t)pwd->pw_uid);
+  r["gid_signed"] = BIGINT((int32_t)pwd->pw_gid);
+
+  if (pwd->pw_name != nullptr) {
+    r["username"] = TEXT(pwd->pw_name);
+  }
+
+  if (pwd->pw_gecos != nullptr) {
+    r["description"] = TEXT(pwd->pw_gecos);
+  }
+
+  if (pwd->pw_dir != nullptr) {
+    r["directory"] = TEXT(pwd->pw_dir);
+  }
+
+  if (pwd->pw_shell != nullptr) {
+    r["shell"] = TEXT(pwd->pw_shell);
+  }
+}
+
+static void genGroupRow(const struct group* grp, Row& r) {
+  r["gid"] = INTEGER(grp->gr_gid);
+  r["gid_signed"] = INTEGER((int32_t)grp->gr_gid);
+  r["groupname"] = TEXT(grp->gr_name);
+}
+
+/// Identify the state of the local databases, empty if recently changed.
+static std::string getUserDirectoryStamp() {
+  std::string stamp;
+  auto now = std::time(nullptr);
+  for (const auto& path : kUserDirectoryPaths) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      stamp += "-,";
+      continue;
+    }
+
+    if (now - st.st_mtime < kUserDirectorySettleSeconds ||
+        now - st.st_ctime < kUserDirectorySettleSeconds) {
+      return "";
+    }
+    stamp += std::to_string(st.st_dev) + "." + std::to_string(st.st_ino) +
+             "." + std::to_string(st.st_mtime) + "." +
+             std::to_string(st.st_ctime) + "." + std::to_string(st.st_size) +
+             ",";
+  }
+  return stamp;
+}
+
+/// Check if users or groups are resolved from a source besides local files.
+static bool usesNetworkSources() {
+  std::string content;
+  if (!readFile("/etc/nsswitch.conf", content).ok()) {
+    return false;
+  }
+
+  for (auto& line : split(content, "\n")) {
+    auto comment = line.find('#');
+    if (comment != std::string::npos) {
+      line.erase(comment);
+    }
+
+    auto separator = line.find(':');
+    if (separator == std::string::npos) {
+      continue;
+    }
+
+    auto database = line.substr(0, separator);
+    boost::trim(database);
+    if (database != "passwd" && database != "group" &&
+        database != "initgroups") {
+      continue;
+    }
+
+    for (const auto& source : split(line.substr(separator + 1))) {
+      // Actions such as [NOTFOUND=return] are not sources.
+      if (source[0] != '[' && kUserDirectoryFileSources.count(source) == 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void UserDirectory::refresh() {
+  auto stamp = getUserDirectoryStamp();
+  if (!stamp.empty() && stamp == stamp_) {
+    return;
+  }
+
+  if (!stamp_.empty()) {
+    VLOG(1) << "User and group databases changed, the cache served "
+            << hits_.load() << " of " << (hits_.load() + misses_.load())
+            << " lookups";
+  }
+
+  users_by_uid_.clear();
+  users_by_name_.clear();
+  groups_by_gid_.clear();
+  user_groups_.clear();
+  users_ = CachedRows();
+  groups_ = CachedRows();
+  stamp_ = std::move(stamp);
+  nss_ = usesNetworkSources();
+}
+
+bool UserDirectory::fresh(time_t time) const {
+  if (FLAGS_users_cache_ttl == 0) {
+    return false;
+  }
+  return !nss_ || std::time(nullptr) - time < FLAGS_users_cache_ttl;
+}
+
+bool UserDirectory::cacheable() const {
+  return !stamp_.empty() && FLAGS_users_cache_ttl > 0;
+}
+
+template <typename K>
+bool UserDirectory::lookup(std::map<K, CachedRow>& cache,
+                           const K& key,
+                           const std::function<bool(Row&)>& resolve,
+                           Row& r) {
+  WriteLock lock(mutex_);
+  refresh();
+  auto cached = cache.find(key);
+  if (cached != cache.end() && fresh(cached->second.time)) {
+    hits_++;
+    r = cached->second.row;
+    return cached->second.found;
+  }
+
+  misses_++;
+  CachedRow entry;
+  entry.time = std::time(nullptr);
+  entry.found = resolve(entry.row);
+  r = entry.row;
+  if (cacheable()) {
+    cache[key] = entry;
+  }
+  return entry.found;
+}
+
+QueryData UserDirectory::enumerate(
+    CachedRows& cache, const std::function<QueryData()>& generate) {
+  // The lock is held by the caller.
+  refresh();
+  if (cache.valid && fresh(cache.time)) {
+    hits_++;
+    return cache.rows;
+  }
+
+  misses_++;
+  cache.time = std::time(nullptr);
+  cache.rows = generate();
+  cache.valid = cacheable();
+  if (cache.valid) {
+    return cache.rows;
+  }
+  return std::move(cache.rows);
+}
+
+bool UserDirectory::user(uid_t uid, Row& r) {
+  return lookup<uid_t>(users_by_uid_,
+                       uid,
+                       ([uid](Row& row) {
+                         auto pwd = getpwuid(uid);
+                         if (pwd == nullptr) {
+                           return false;
+                         }
+                         genUserRow(pwd, row);
+                         return true;
+                       }),
+                       r);
+}
+
+bool UserDirectory::user(const std::string& name, Row& r) {
+  return lookup<std::string>(users_by_name_,
+                             name,
+                             ([&name](Row& row) {
+                               auto pwd = getpwnam(name.c_str());
+                               if (pwd == nullptr) {
+                                 return false;
+                               }
+                               genUserRow(pwd, row);
+                               return true;
+                             }),
+                             r);
+}
+
+bool UserDirectory::group(gid_t gid, Row& r) {
+  return lookup<gid_t>(groups_by_gid_,
+                       gid,
+                       ([gid](Row& row) {
+                         auto grp = getgrgid(gid);
+                         if (grp == nullptr) {
+                           return false;
+                         }
+                         genGroupRow(grp, row);
+                         return true;
+                       }),
+                       r);
+}
+
+std::string UserDirectory::username(uid_t uid) {
+  Row r;
+  if (!user(uid, r)) {
+    return "";
+  }
+  return r["username"];
+}
+
+std::string UserDirectory::groupname(gid_t gid) {
+  Row r;
+  if (!group(gid, r)) {
+    return "";
+  }
+  return r["groupname"];
+}
+
+QueryData UserDirectory::users(size_t limit) {
+  WriteLock lock(mutex_);
+  if (limit > 0 && !(users_.valid && fresh(users_.time))) {
+    // Do not enumerate a complete network directory to answer a LIMIT.
+    QueryData results;
+    setpwent();
+    struct passwd* pwd = nullptr;
+    while (results.size() < limit && (pwd = getpwent()) != nullptr) {
+      Row r;
+      genUserRow(pwd, r);
+      results.push_back(std::move(r));
+    }
+    endpwent();
+    misses_++;
+    return results;
+  }
+
+  auto results = enumerate(users_, ([this]() {
+                             QueryData rows;
+                             setpwent();
+                             struct passwd* pwd = nullptr;
+                             while ((pwd = getpwent()) != nullptr) {
+                               Row r;
+                               genUserRow(pwd, r);
+                               rows.push_back(std::move(r));
+                             }
+                             endpwent();
+                             return rows;
+                           }));
+
+  if (users_.valid) {
+    // Later lookups of enumerated users do not need NSS.
+    for (const auto& row : users_.rows) {
+      CachedRow entry;
+      entry.time = users_.time;
+      entry.found = true;
+      entry.row = row;
+      users_by_uid_.emplace(
+          static_cast<uid_t>(AS_LITERAL(BIGINT_LITERAL, row.at("uid"))),
+          entry);
+      auto name = row.find("username");
+      if (name != row.end()) {
+        users_by_name_.emplace(name->second, entry);
+      }
+    }
+  }
+
+  if (limit > 0 && results.size() > limit) {
+    results.resize(limit);
+  }
+  return results;
+}
+
+QueryData UserDirectory::groups() {
+  WriteLock lock(mutex_);
+  return enumerate(groups_, ([]() {
+                     QueryData rows;
+                     std::set<gid_t> groups_in;
+                     setgrent();
+                     struct group* grp = nullptr;
+                     while ((grp = getgrent()) != nullptr) {
+                       if (groups_in.insert(grp->gr_gid).second) {
+                         Row r;
+                         genGroupRow(grp, r);
+                         rows.push_back(std::move(r));
+                       }
+                     }
+                     endgrent();
+                     return rows;
+                   }));
+}
+
+QueryData UserDirectory::userGroups(uid_t uid,
+                                    gid_t gid,
+                                    const std::string& name) {
+  WriteLock lock(mutex_);
+  return enumerate(user_groups_[uid], ([uid, gid, &name]() {
+                     QueryData rows;
+                     user_t<uid_t, gid_t> user;
+                     user.name = name.c_str();
+                     user.uid = uid;
+                     user.gid = gid;
+                     getGroupsForUser<uid_t, gid_t>(rows, user);
+                     return rows;
+                   }));
+}
+} // namespace tables
+} // namespace osquery
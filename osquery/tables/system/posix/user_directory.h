@@ -0,0 +1,142 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <string>
+
+#include <sys/types.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/**
+ * @brief A shared cache of user and group entries resolved through NSS.
+ *
+ * Entries, including users and groups that were not found, are reused until
+ * /etc/passwd, /etc/group, or /etc/nsswitch.conf change. When nsswitch.conf
+ * resolves users or groups from a source other than local files, such as
+ * LDAP or SSSD, entries also expire after --users_cache_ttl seconds.
+ *
+ * User rows have the columns of the users table, group rows have the
+ * columns of the groups table.
+ */
+class UserDirectory : private boost::noncopyable {
+ public:
+  static UserDirectory& get() {
+    static UserDirectory directory;
+    return directory;
+  }
+
+  /// Lookup a user by uid.
+  bool user(uid_t uid, Row& r);
+
+  /// Lookup a user by username.
+  bool user(const std::string& name, Row& r);
+
+  /// Lookup a group by gid.
+  bool group(gid_t gid, Row& r);
+
+  /// The username of a uid, or empty if the user does not exist.
+  std::string username(uid_t uid);
+
+  /// The name of a gid, or empty if the group does not exist.
+  std::string groupname(gid_t gid);
+
+  /**
+   * @brief Enumerate every user.
+   *
+   * A partial enumeration, up to a limit, is only served from the cache.
+   *
+   * @param limit Stop after this many users, 0 enumerates every user.
+   */
+  QueryData users(size_t limit = 0);
+
+  /// Enumerate every group, once per gid.
+  QueryData groups();
+
+  /// The user_groups rows of a user, including its primary group.
+  QueryData userGroups(uid_t uid, gid_t gid, const std::string& name);
+
+  /// The number of lookups and enumerations served from the cache.
+  size_t hits() const {
+    return hits_;
+  }
+
+  /// The number of lookups and enumerations resolved through NSS.
+  size_t misses() const {
+    return misses_;
+  }
+
+ private:
+  UserDirectory() = default;
+
+  struct CachedRow {
+    time_t time{0};
+    bool found{false};
+    Row row;
+  };
+
+  struct CachedRows {
+    time_t time{0};
+    bool valid{false};
+    QueryData rows;
+  };
+
+  /// Drop every entry if the local databases changed.
+  void refresh();
+
+  /// True if an entry resolved at time may be used.
+  bool fresh(time_t time) const;
+
+  /// True if resolved entries may be stored.
+  bool cacheable() const;
+
+  /// Lookup a row by key, resolving and storing it on a miss.
+  template <typename K>
+  bool lookup(std::map<K, CachedRow>& cache,
+              const K& key,
+              const std::function<bool(Row&)>& resolve,
+              Row& r);
+
+  /// Enumerate rows, generating and storing them on a miss.
+  QueryData enumerate(CachedRows& cache,
+                      const std::function<QueryData()>& generate);
+
+ private:
+  /// The state of the local user and group databases, empty if unstable.
+  std::string stamp_;
+
+  /// True if nsswitch.conf uses a source other than local files.
+  bool nss_{false};
+
+  std::map<uid_t, CachedRow> users_by_uid_;
+  std::map<std::string, CachedRow> users_by_name_;
+  std::map<gid_t, CachedRow> groups_by_gid_;
+  std::map<uid_t, CachedRows> user_groups_;
+  CachedRows users_;
+  CachedRows groups_;
+
+  std::atomic<size_t> hits_{0};
+  std::atomic<size_t> misses_{0};
+
+  Mutex mutex_;
+};
+} // namespace tables
+} // namespace osquery
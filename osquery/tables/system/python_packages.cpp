@@ -17,6 +17,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/package_cache.h"
 
 #ifdef WIN32
 #include "osquery/tables/system/windows/registry.h"
@@ -122,7 +123,8 @@ void genWinPythonPackages(const std::string& keyGlob, QueryData& results) {
 #endif
 }
 
-QueryData genPythonPackages(QueryContext& context) {
+/// Read every python package from the site and dist package directories.
+static QueryData genPythonPackageInventory() {
   QueryData results;
 
   for (const auto& key : kPythonPath) {
@@ -160,5 +162,16 @@ QueryData genPythonPackages(QueryContext& context) {
 
   return results;
 }
+
+QueryData genPythonPackages(QueryContext& context) {
+  if (!isPlatform(PlatformType::TYPE_LINUX)) {
+    // Other platforms discover versioned or registry install locations.
+    return genPythonPackageInventory();
+  }
+
+  // Installing or removing a package changes its site directory.
+  std::vector<std::string> paths(kPythonPath.begin(), kPythonPath.end());
+  return genCachedPackages("python_packages", paths, genPythonPackageInventory);
+}
 } // namespace tables
 } // namespace osquery
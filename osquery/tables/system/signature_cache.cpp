@@ -0,0 +1,234 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <ctime>
+#include <mutex>
+
+#if defined(WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include <osquery/core.h>
+#include <osquery/database.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/query.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/tables/system/signature_cache.h"
+
+namespace osquery {
+
+FLAG(bool,
+     disable_signature_cache,
+     false,
+     "Verify code signatures for every query, without cached verifications");
+
+FLAG(uint64,
+     signature_cache_ttl,
+     86400,
+     "Seconds a cached code signature verification is reused");
+
+namespace tables {
+
+/// Recently modified files may still be written, they are not cached.
+const time_t kSignatureSettleSeconds = 2;
+
+#if defined(WIN32)
+/// Convert a FILETIME, in 100ns intervals since 1601, to a UNIX time.
+static time_t fileTimeToUnix(LARGE_INTEGER ft) {
+  return static_cast<time_t>((ft.QuadPart - 116444736000000000LL) / 10000000);
+}
+#endif
+
+/**
+ * @brief Identify the state of a file.
+ *
+ * An empty identity is returned for directories, files that cannot be opened,
+ * and files changed too recently to be trusted.
+ */
+static std::string getSignatureIdentity(const std::string& path) {
+  auto now = std::time(nullptr);
+#if defined(WIN32)
+  auto handle = CreateFileW(stringToWstring(path).c_str(),
+                            FILE_READ_ATTRIBUTES,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE |
+                                FILE_SHARE_DELETE,
+                            nullptr,
+                            OPEN_EXISTING,
+                            0,
+                            nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return "";
+  }
+
+  BY_HANDLE_FILE_INFORMATION info;
+  FILE_BASIC_INFO basic;
+  auto ok = GetFileInformationByHandle(handle, &info) &&
+            GetFileInformationByHandleEx(
+                handle, FileBasicInfo, &basic, sizeof(basic));
+  CloseHandle(handle);
+  if (!ok || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+    return "";
+  }
+
+  auto mtime = fileTimeToUnix(basic.LastWriteTime);
+  auto ctime = fileTimeToUnix(basic.ChangeTime);
+  if (now - mtime < kSignatureSettleSeconds ||
+      now - ctime < kSignatureSettleSeconds) {
+    return "";
+  }
+
+  ULARGE_INTEGER size;
+  size.HighPart = info.nFileSizeHigh;
+  size.LowPart = info.nFileSizeLow;
+  ULARGE_INTEGER index;
+  index.HighPart = info.nFileIndexHigh;
+  index.LowPart = info.nFileIndexLow;
+  return std::to_string(info.dwVolumeSerialNumber) + "." +
+         std::to_string(index.QuadPart) + "." +
+         std::to_string(basic.LastWriteTime.QuadPart) + "." +
+         std::to_string(basic.ChangeTime.QuadPart) + "." +
+         std::to_string(size.QuadPart);
+#else
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return "";
+  }
+
+  if (now - st.st_mtime < kSignatureSettleSeconds ||
+      now - st.st_ctime < kSignatureSettleSeconds) {
+    return "";
+  }
+  return std::to_string(st.st_dev) + "." + std::to_string(st.st_ino) + "." +
+         std::to_string(st.st_mtime) + "." + std::to_string(st.st_ctime) +
+         "." + std::to_string(st.st_size);
+#endif
+}
+
+/// Split a stored verification into its time and row.
+static bool parseSignatureValue(const std::string& value,
+                                time_t& verified,
+                                std::string& json) {
+  auto separator = value.find('\n');
+  if (separator == std::string::npos) {
+    return false;
+  }
+
+  verified = static_cast<time_t>(
+      std::strtoll(value.substr(0, separator).c_str(), nullptr, 10));
+  json = value.substr(separator + 1);
+  return true;
+}
+
+static bool isSignatureExpired(time_t verified) {
+  return std::time(nullptr) - verified >=
+         static_cast<time_t>(FLAGS_signature_cache_ttl);
+}
+
+/**
+ * @brief Remove expired verifications.
+ *
+ * Verifications of files that changed are never read again, so this is
+ * applied once before the backing store is used.
+ */
+static void pruneStoredSignatures() {
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kSignatures, keys);
+
+  DatabaseBatch batch;
+  for (const auto& key : keys) {
+    std::string value;
+    std::string json;
+    time_t verified = 0;
+    if (!getDatabaseValue(kSignatures, key, value).ok() ||
+        !parseSignatureValue(value, verified, json) ||
+        isSignatureExpired(verified)) {
+      batch.remove(kSignatures, key);
+    }
+  }
+  writeDatabaseBatch(batch);
+}
+
+bool getCachedSignature(const std::string& table,
+                        const std::string& path,
+                        Row& r,
+                        std::string& key) {
+  key.clear();
+  if (FLAGS_disable_signature_cache) {
+    return false;
+  }
+
+  static std::once_flag pruned;
+  std::call_once(pruned, pruneStoredSignatures);
+
+  // The identity is taken before a miss verifies the file.
+  auto identity = getSignatureIdentity(path);
+  if (identity.empty()) {
+    return false;
+  }
+  key = table + "." + identity;
+
+  std::string value;
+  if (!getDatabaseValue(kSignatures, key, value).ok()) {
+    return false;
+  }
+
+  std::string json;
+  time_t verified = 0;
+  if (!parseSignatureValue(value, verified, json) ||
+      isSignatureExpired(verified)) {
+    return false;
+  }
+
+  Row row;
+  if (!deserializeRowJSON(json, row).ok()) {
+    return false;
+  }
+
+  // Hard links share a verification.
+  row["path"] = path;
+  r = std::move(row);
+  return true;
+}
+
+void setCachedSignature(const std::string& key, const Row& r) {
+  if (key.empty()) {
+    return;
+  }
+
+  std::string json;
+  if (!serializeRowJSON(r, json).ok()) {
+    return;
+  }
+  setDatabaseValue(
+      kSignatures, key, std::to_string(std::time(nullptr)) + "\n" + json);
+}
+
+bool genCachedSignature(const std::string& table,
+                        const std::string& path,
+                        const std::function<bool(Row&)>& verifier,
+                        Row& r) {
+  std::string key;
+  if (getCachedSignature(table, path, r, key)) {
+    return true;
+  }
+
+  if (!verifier(r)) {
+    return false;
+  }
+  setCachedSignature(key, r);
+  return true;
+}
+} // namespace tables
+} // namespace osquery
@@ -0,0 +1,60 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/**
+ * @brief Read a cached code signature verification of a file.
+ *
+ * A verification is stored with the file's identity: its volume, file ID,
+ * size, and modification and status change times. It is valid until the file
+ * changes, or for at most --signature_cache_ttl seconds such that revoked
+ * certificates and trust changes are observed. Directories, such as
+ * application bundles, are not cached.
+ *
+ * @param table The verifying table, verifications are not shared by tables.
+ * @param path The file path, set as the path of the cached row.
+ * @param r Output, the cached verification row.
+ * @param key Output, the key used to store a verification made after a miss.
+ *            Empty if a verification cannot be stored.
+ * @return true if a valid verification was cached.
+ */
+bool getCachedSignature(const std::string& table,
+                        const std::string& path,
+                        Row& r,
+                        std::string& key);
+
+/// Store a verification made after a miss for key.
+void setCachedSignature(const std::string& key, const Row& r);
+
+/**
+ * @brief Verify a file's signature, reusing a verification while the file is
+ * unchanged.
+ *
+ * @param table The verifying table.
+ * @param path The file path.
+ * @param verifier Verifies the file on a cache miss, false if no row results.
+ * @param r Output, the verification row.
+ * @return false if the file's signature could not be verified.
+ */
+bool genCachedSignature(const std::string& table,
+                        const std::string& path,
+                        const std::function<bool(Row&)>& verifier,
+                        Row& r);
+} // namespace tables
+} // namespace osquery
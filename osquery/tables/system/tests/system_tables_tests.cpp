@@ -8,12 +8,15 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <sys/stat.h>
+
 #include <gtest/gtest.h>
 
 #include <boost/filesystem.hpp>
 #include <gflags/gflags.h>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
@@ -21,9 +24,17 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/hash.h"
+#include "osquery/tables/system/package_cache.h"
+#include "osquery/tables/system/signature_cache.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
+
+DECLARE_uint32(hash_threads);
+DECLARE_bool(disable_package_cache);
+DECLARE_uint64(signature_cache_ttl);
+
 namespace tables {
 
 class SystemsTablesTests : public testing::Test {};
@@ -241,5 +252,137 @@ TEST_F(HashTableTest, test_cache_updates) {
   EXPECT_NE(rows[0].at("md5"), contentMd5);
   EXPECT_EQ(rows[0].at("md5"), badContentMd5);
 }
+
+TEST_F(HashTableTest, test_directory_threads) {
+  auto hash_threads = FLAGS_hash_threads;
+  FLAGS_hash_threads = 3;
+
+  boost::filesystem::create_directory(tmpPath);
+  for (size_t i = 0; i < 10; i++) {
+    writeTextFile(tmpPath / std::to_string(i), content[i % 2]);
+  }
+
+  // Every file in the directory is hashed once.
+  SQL results("select path, md5 from hash where directory = '" +
+              tmpPath.string() + "'");
+  auto rows = results.rows();
+  ASSERT_EQ(rows.size(), 10U);
+  std::set<std::string> paths;
+  for (const auto& row : rows) {
+    auto content_index = std::stoul(boost::filesystem::path(row.at("path"))
+                                        .filename()
+                                        .string()) %
+                         2;
+    EXPECT_EQ(row.at("md5"),
+              hashFromBuffer(HASH_TYPE_MD5,
+                             content[content_index].data(),
+                             content[content_index].size()));
+    paths.insert(row.at("path"));
+  }
+  EXPECT_EQ(paths.size(), 10U);
+
+  boost::filesystem::remove_all(tmpPath);
+  FLAGS_hash_threads = hash_threads;
+}
+
+TEST_F(HashTableTest, test_cache_persists_used_hashes) {
+  SetContent(0);
+  struct stat st;
+  ASSERT_EQ(stat(tmpPath.string().c_str(), &st), 0);
+  auto key = std::to_string(st.st_dev) + "." + std::to_string(st.st_ino) +
+             "." + std::to_string(st.st_mtime) + "." +
+             std::to_string(st.st_ctime) + "." + std::to_string(st.st_size);
+
+  // Only the selected hash is calculated and stored.
+  SQL r1("select md5 from hash where path = '" + tmpPath.string() + "'");
+  ASSERT_EQ(r1.rows().size(), 1U);
+  EXPECT_EQ(r1.rows()[0].at("md5"), contentMd5);
+
+  std::string value;
+  ASSERT_TRUE(getDatabaseValue(kFileHashes, key, value).ok());
+  EXPECT_EQ(value, std::to_string(HASH_TYPE_MD5) + ":" + contentMd5 + "::");
+
+  // The missing hashes are added to the cached entry.
+  SQL r2(qry);
+  auto rows = r2.rows();
+  ASSERT_EQ(rows.size(), 1U);
+  EXPECT_EQ(rows[0].at("md5"), contentMd5);
+  EXPECT_EQ(rows[0].at("sha1"), contentSha1);
+  EXPECT_EQ(rows[0].at("sha256"), contentSha256);
+
+  ASSERT_TRUE(getDatabaseValue(kFileHashes, key, value).ok());
+  EXPECT_EQ(value,
+            std::to_string(HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256) +
+                ":" + contentMd5 + ":" + contentSha1 + ":" + contentSha256);
+}
+
+TEST_F(SystemsTablesTests, test_package_cache) {
+  size_t generated = 0;
+  auto generator = ([&generated]() {
+    generated++;
+    return QueryData{{{"name", "package"}, {"version", "1.0"}}};
+  });
+
+  // A missing database is a stable state.
+  std::vector<std::string> paths = {kTestWorkingDirectory + "/missing.db"};
+  auto results = genCachedPackages("test_packages", paths, generator);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(generated, 1U);
+
+  results = genCachedPackages("test_packages", paths, generator);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0].at("version"), "1.0");
+  EXPECT_EQ(generated, 1U);
+
+  std::string value;
+  EXPECT_TRUE(getDatabaseValue(kPackages, "test_packages", value).ok());
+
+  // A database that was just written is not cached.
+  paths = {kTestWorkingDirectory + "/packages.db"};
+  writeTextFile(paths[0], "packages");
+  genCachedPackages("test_recent_packages", paths, generator);
+  genCachedPackages("test_recent_packages", paths, generator);
+  EXPECT_EQ(generated, 3U);
+
+  FLAGS_disable_package_cache = true;
+  paths = {kTestWorkingDirectory + "/missing.db"};
+  genCachedPackages("test_packages", paths, generator);
+  EXPECT_EQ(generated, 4U);
+  FLAGS_disable_package_cache = false;
+}
+
+TEST_F(SystemsTablesTests, test_signature_cache) {
+  size_t verified = 0;
+  auto verifier = ([&verified](Row& r) {
+    verified++;
+    r = {{"path", "verified"}, {"signed", "1"}};
+    return true;
+  });
+
+  // The test data was written before the tests started.
+  auto path = kTestDataPath + "test_hashing.bin";
+  Row r;
+  ASSERT_TRUE(genCachedSignature("test_signature", path, verifier, r));
+  EXPECT_EQ(verified, 1U);
+
+  r.clear();
+  ASSERT_TRUE(genCachedSignature("test_signature", path, verifier, r));
+  EXPECT_EQ(verified, 1U);
+  EXPECT_EQ(r["path"], path);
+  EXPECT_EQ(r["signed"], "1");
+
+  // Directories are not cached.
+  genCachedSignature("test_signature", kTestDataPath, verifier, r);
+  genCachedSignature("test_signature", kTestDataPath, verifier, r);
+  EXPECT_EQ(verified, 3U);
+
+  // Expired verifications are made again.
+  auto ttl = FLAGS_signature_cache_ttl;
+  FLAGS_signature_cache_ttl = 0;
+  std::string key;
+  EXPECT_FALSE(getCachedSignature("test_signature", path, r, key));
+  EXPECT_FALSE(key.empty());
+  FLAGS_signature_cache_ttl = ttl;
+}
 } // namespace tables
 } // namespace osquery
@@ -32,6 +32,7 @@
 #include "osquery/core.h"
 #include "osquery/core/conversions.h"
 #include "osquery/core/windows/wmi.h"
+#include "osquery/tables/system/signature_cache.h"
 
 namespace osquery {
 template <typename T, typename DeleterType, DeleterType deleter>
@@ -492,12 +493,18 @@ QueryData genAuthenticode(QueryContext& context) {
       continue;
     }
 
+    // Unchanged files, such as the images of running processes, are only
+    // verified again when their cached verification expires.
     Row r;
-    auto status = generateRow(r, path_string);
-    if (status.ok()) {
+    auto verifier = ([&path_string](Row& row) {
+      auto status = generateRow(row, path_string);
+      if (!status.ok()) {
+        LOG(WARNING) << status.getMessage();
+      }
+      return status.ok();
+    });
+    if (genCachedSignature("authenticode", path_string, verifier, r)) {
       results.push_back(r);
-    } else {
-      LOG(WARNING) << status.getMessage();
     }
   }
 
@@ -8,8 +8,11 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <algorithm>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #define _WIN32_DCOM
 #define WIN32_LEAN_AND_MEAN
@@ -17,6 +20,7 @@
 #include <psapi.h>
 #include <stdlib.h>
 #include <tlhelp32.h>
+#include <winternl.h>
 
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/trim.hpp>
@@ -260,6 +264,222 @@ void genProcess(const WmiResultItem& result, QueryData& results_data) {
   results_data.push_back(r);
 }
 
+/// The full layout of SYSTEM_PROCESS_INFORMATION, winternl.h omits times.
+struct SystemProcessInformation {
+  ULONG NextEntryOffset;
+  ULONG NumberOfThreads;
+  LARGE_INTEGER WorkingSetPrivateSize;
+  ULONG HardFaultCount;
+  ULONG NumberOfThreadsHighWatermark;
+  ULONGLONG CycleTime;
+  LARGE_INTEGER CreateTime;
+  LARGE_INTEGER UserTime;
+  LARGE_INTEGER KernelTime;
+  UNICODE_STRING ImageName;
+  LONG BasePriority;
+  HANDLE UniqueProcessId;
+  HANDLE InheritedFromUniqueProcessId;
+  ULONG HandleCount;
+  ULONG SessionId;
+  ULONG_PTR UniqueProcessKey;
+  SIZE_T PeakVirtualSize;
+  SIZE_T VirtualSize;
+  ULONG PageFaultCount;
+  SIZE_T PeakWorkingSetSize;
+  SIZE_T WorkingSetSize;
+  SIZE_T QuotaPeakPagedPoolUsage;
+  SIZE_T QuotaPagedPoolUsage;
+  SIZE_T QuotaPeakNonPagedPoolUsage;
+  SIZE_T QuotaNonPagedPoolUsage;
+  SIZE_T PagefileUsage;
+  SIZE_T PeakPagefileUsage;
+  SIZE_T PrivatePageCount;
+};
+
+using NtQuerySystemInformationFn =
+    NTSTATUS(NTAPI*)(ULONG, PVOID, ULONG, PULONG);
+using NtQueryInformationProcessFn =
+    NTSTATUS(NTAPI*)(HANDLE, ULONG, PVOID, ULONG, PULONG);
+
+const ULONG kSystemProcessInformation = 5;
+const ULONG kProcessCommandLineInformation = 60;
+const NTSTATUS kStatusInfoLengthMismatch = static_cast<NTSTATUS>(0xC0000004L);
+
+/// Read a process' command line, Windows 8.1 and later.
+static std::string getProcessCmdline(HANDLE proc) {
+  static auto query = reinterpret_cast<NtQueryInformationProcessFn>(
+      GetProcAddress(GetModuleHandleW(L"ntdll.dll"),
+                     "NtQueryInformationProcess"));
+  if (query == nullptr) {
+    return "";
+  }
+
+  ULONG size = 0;
+  query(proc, kProcessCommandLineInformation, nullptr, 0, &size);
+  if (size < sizeof(UNICODE_STRING)) {
+    return "";
+  }
+
+  std::vector<char> buffer(size);
+  if (query(proc, kProcessCommandLineInformation, buffer.data(), size, &size) <
+      0) {
+    return "";
+  }
+
+  auto* cmdline = reinterpret_cast<UNICODE_STRING*>(buffer.data());
+  return wstringToString(
+      std::wstring(cmdline->Buffer, cmdline->Length / sizeof(wchar_t))
+          .c_str());
+}
+
+/// Set the uid and gid columns from the owner of a process' token.
+static void genProcessOwner(HANDLE proc, Row& r) {
+  r["uid"] = INTEGER(-1);
+  r["gid"] = INTEGER(-1);
+  HANDLE tok = nullptr;
+  if (OpenProcessToken(proc, TOKEN_QUERY, &tok) == FALSE) {
+    return;
+  }
+
+  DWORD size = 0;
+  GetTokenInformation(tok, TokenOwner, nullptr, 0, &size);
+  std::vector<char> owner(size);
+  if (size > 0 &&
+      GetTokenInformation(tok, TokenOwner, owner.data(), size, &size) !=
+          FALSE) {
+    auto sid = PTOKEN_OWNER(owner.data())->Owner;
+    r["uid"] = INTEGER(getUidFromSid(sid));
+    r["gid"] = INTEGER(getGidFromSid(sid));
+  }
+  CloseHandle(tok);
+}
+
+/// Convert 100 nanosecond ticks to seconds.
+static inline long long ticksToSeconds(const LARGE_INTEGER& ticks) {
+  return ticks.QuadPart / 10000000;
+}
+
+/**
+ * @brief Generate processes from a single process information snapshot.
+ *
+ * Unlike Win32_Process, the snapshot is one call to the kernel and does not
+ * use the WMI provider host. Each process is only opened when the query uses
+ * its path, command line, or owner.
+ */
+static Status genProcessesNative(const QueryContext& context,
+                                 const std::set<long>& pidlist,
+                                 QueryData& results) {
+  static auto query = reinterpret_cast<NtQuerySystemInformationFn>(
+      GetProcAddress(GetModuleHandleW(L"ntdll.dll"),
+                     "NtQuerySystemInformation"));
+  if (query == nullptr) {
+    return Status(1, "NtQuerySystemInformation is not available");
+  }
+
+  // Processes may start between calls, retry with the required size.
+  std::vector<char> buffer(256 * 1024);
+  NTSTATUS status = kStatusInfoLengthMismatch;
+  while (status == kStatusInfoLengthMismatch) {
+    ULONG size = 0;
+    status = query(kSystemProcessInformation,
+                   buffer.data(),
+                   static_cast<ULONG>(buffer.size()),
+                   &size);
+    if (status == kStatusInfoLengthMismatch) {
+      buffer.resize(std::max<size_t>(size, buffer.size()) + 64 * 1024);
+    }
+  }
+  if (status < 0) {
+    return Status(1, "Cannot snapshot the process list");
+  }
+
+  bool paths = context.isColumnUsed("path") || context.isColumnUsed("cwd") ||
+               context.isColumnUsed("root") || context.isColumnUsed("on_disk");
+  bool cmdline = context.isColumnUsed("cmdline");
+  bool owner = context.isColumnUsed("uid") || context.isColumnUsed("gid");
+
+  size_t offset = 0;
+  while (offset < buffer.size()) {
+    const auto& info =
+        *reinterpret_cast<SystemProcessInformation*>(&buffer[offset]);
+    auto pid = static_cast<long>(
+        reinterpret_cast<ULONG_PTR>(info.UniqueProcessId));
+    if (pidlist.empty() || pidlist.count(pid) > 0) {
+      Row r;
+      r["pid"] = BIGINT(pid);
+      r["parent"] = BIGINT(
+          reinterpret_cast<ULONG_PTR>(info.InheritedFromUniqueProcessId));
+      r["name"] = (info.ImageName.Buffer == nullptr)
+                      ? "System Idle Process"
+                      : wstringToString(
+                            std::wstring(info.ImageName.Buffer,
+                                         info.ImageName.Length /
+                                             sizeof(wchar_t))
+                                .c_str());
+      r["state"] = "";
+      r["nice"] = INTEGER(info.BasePriority);
+      r["threads"] = INTEGER(info.NumberOfThreads);
+      r["pgroup"] = "-1";
+      r["euid"] = "-1";
+      r["suid"] = "-1";
+      r["egid"] = "-1";
+      r["sgid"] = "-1";
+      r["user_time"] = BIGINT(ticksToSeconds(info.UserTime));
+      r["system_time"] = BIGINT(ticksToSeconds(info.KernelTime));
+      FILETIME create;
+      create.dwLowDateTime = info.CreateTime.LowPart;
+      create.dwHighDateTime = info.CreateTime.HighPart;
+      r["start_time"] = (info.CreateTime.QuadPart == 0)
+                            ? BIGINT(-1)
+                            : BIGINT(osquery::filetimeToUnixtime(create));
+      r["wired_size"] = BIGINT(info.PrivatePageCount);
+      r["resident_size"] = BIGINT(info.WorkingSetSize);
+      r["total_size"] = BIGINT(info.VirtualSize);
+      r["uid"] = INTEGER(-1);
+      r["gid"] = INTEGER(-1);
+
+      HANDLE proc = nullptr;
+      if (paths || cmdline || owner) {
+        proc = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+        if (proc == nullptr && GetLastError() == ERROR_ACCESS_DENIED) {
+          // Protected and system processes, as reported by Win32_Process.
+          r["uid"] = INTEGER(0);
+          r["gid"] = INTEGER(0);
+        }
+      }
+
+      if (proc != nullptr && paths) {
+        std::vector<wchar_t> path(MAX_PATH * 4, L'\0');
+        auto length = static_cast<DWORD>(path.size());
+        if (QueryFullProcessImageNameW(proc, 0, path.data(), &length) !=
+            FALSE) {
+          r["path"] = wstringToString(path.data());
+        }
+      }
+      r["cwd"] = r["path"];
+      r["root"] = r["path"];
+      r["on_disk"] = (paths) ? osquery::pathExists(r["path"]).toString() : "-1";
+
+      if (proc != nullptr && cmdline) {
+        r["cmdline"] = getProcessCmdline(proc);
+      }
+      if (proc != nullptr && owner) {
+        genProcessOwner(proc, r);
+      }
+      if (proc != nullptr) {
+        CloseHandle(proc);
+      }
+      results.push_back(std::move(r));
+    }
+
+    if (info.NextEntryOffset == 0) {
+      break;
+    }
+    offset += info.NextEntryOffset;
+  }
+  return Status(0, "OK");
+}
+
 QueryData genProcesses(QueryContext& context) {
   QueryData results;
 
@@ -279,6 +499,14 @@ QueryData genProcesses(QueryContext& context) {
     }
   }
 
+  auto status = genProcessesNative(context, pidlist, results);
+  if (status.ok()) {
+    return results;
+  }
+
+  // Win32_Process remains as a fallback, such as within restricted sessions.
+  VLOG(1) << status.getMessage() << ", using WMI";
+  results.clear();
   if (pidlist.size() > 0) {
     std::vector<std::string> constraints;
     for (const auto& pid : pidlist) {
@@ -289,22 +517,23 @@ QueryData genProcesses(QueryContext& context) {
     }
   }
 
-  WmiRequest request(query);
-  if (request.getStatus().ok()) {
-    for (const auto& item : request.results()) {
-      long pid = 0;
-      if (item.GetLong("ProcessId", pid).ok()) {
-        genProcess(item, results);
-      }
+  // Each process object is released once its row is generated.
+  WmiRequest request(query, [&results](const WmiResultItem& item) {
+    long pid = 0;
+    if (item.GetLong("ProcessId", pid).ok()) {
+      genProcess(item, results);
     }
-  }
+  });
 
   return results;
 }
 
-QueryData genProcessMemoryMap(QueryContext& context) {
-  QueryData results;
+/// The number of memory map rows generated before yielding the batch.
+const size_t kProcessRowsBatch = 256;
 
+void genProcessMemoryMap(TableRowsYield& yield,
+                         TableRows& batch,
+                         QueryContext& context) {
   std::set<long> pidlist;
   if (context.constraints.count("pid") > 0 &&
       context.constraints.at("pid").exists(EQUALS)) {
@@ -318,14 +547,21 @@ QueryData genProcessMemoryMap(QueryContext& context) {
     getProcList(pidlist);
   }
 
+  QueryData rows;
   for (const auto& pid : pidlist) {
-    auto s = genMemoryMap(pid, results);
+    auto s = genMemoryMap(pid, rows);
     if (!s.ok()) {
       VLOG(1) << s.getMessage();
     }
-  }
+    for (const auto& row : rows) {
+      batch.addRow(row);
+    }
+    rows.clear();
 
-  return results;
+    if (batch.size() >= kProcessRowsBatch) {
+      yield(batch);
+    }
+  }
 }
 
 } // namespace tables
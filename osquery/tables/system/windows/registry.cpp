@@ -17,9 +17,13 @@
 #include <sddl.h>
 // clang-format on
 
+#include <atomic>
+#include <functional>
 #include <iterator>
 #include <map>
 #include <string>
+#include <thread>
+#include <unordered_set>
 
 #include <boost/algorithm/hex.hpp>
 #include <boost/algorithm/string.hpp>
@@ -31,6 +35,7 @@
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 #include <osquery/tables.h>
@@ -44,6 +49,12 @@
 namespace fs = boost::filesystem;
 
 namespace osquery {
+
+FLAG(uint32,
+     registry_threads,
+     4,
+     "Number of threads walking registry key patterns for a query");
+
 namespace tables {
 
 auto closeRegHandle = [](HKEY handle) { RegCloseKey(handle); };
@@ -276,7 +287,11 @@ Status queryKey(const std::string& keyPath, QueryData& results) {
   if (retCode != ERROR_SUCCESS) {
     return Status(GetLastError(), "Failed to query registry info for key");
   }
-  auto achKey = std::make_unique<TCHAR[]>(maxKeyLength);
+  // Name and data buffers are reused by each key a thread reads.
+  static thread_local std::vector<TCHAR> achKey;
+  static thread_local std::vector<TCHAR> achValue;
+  static thread_local std::vector<BYTE> bpDataBuff;
+  achKey.resize(maxKeyLength);
   DWORD cbName;
 
   // Process registry subkeys
@@ -285,7 +300,7 @@ Status queryKey(const std::string& keyPath, QueryData& results) {
       cbName = maxKeyLength;
       retCode = RegEnumKeyEx(hRegistryHandle.get(),
                              i,
-                             achKey.get(),
+                             achKey.data(),
                              &cbName,
                              nullptr,
                              nullptr,
@@ -298,8 +313,8 @@ Status queryKey(const std::string& keyPath, QueryData& results) {
       Row r;
       r["key"] = keyPath;
       r["type"] = "subkey";
-      r["name"] = achKey.get();
-      r["path"] = keyPath + kRegSep + achKey.get();
+      r["name"] = achKey.data();
+      r["path"] = keyPath + kRegSep + achKey.data();
       r["mtime"] = std::to_string(osquery::filetimeToUnixtime(ftLastWriteTime));
       results.push_back(r);
     }
@@ -310,8 +325,8 @@ Status queryKey(const std::string& keyPath, QueryData& results) {
   }
 
   DWORD cchValue = maxKeyLength;
-  auto achValue = std::make_unique<TCHAR[]>(maxValueName);
-  auto bpDataBuff = std::make_unique<BYTE[]>(cbMaxValueData);
+  achValue.resize(maxValueName);
+  bpDataBuff.assign(std::max<DWORD>(cbMaxValueData, 1), 0);
 
   // Process registry values
   for (size_t i = 0; i < cValues; i++) {
@@ -320,7 +335,7 @@ Status queryKey(const std::string& keyPath, QueryData& results) {
 
     retCode = RegEnumValue(hRegistryHandle.get(),
                            static_cast<DWORD>(i),
-                           achValue.get(),
+                           achValue.data(),
                            &cchValue,
                            nullptr,
                            nullptr,
@@ -334,10 +349,10 @@ Status queryKey(const std::string& keyPath, QueryData& results) {
     DWORD lpType;
 
     retCode = RegQueryValueEx(hRegistryHandle.get(),
-                              achValue.get(),
+                              achValue.data(),
                               nullptr,
                               &lpType,
-                              bpDataBuff.get(),
+                              bpDataBuff.data(),
                               &lpData);
     if (retCode != ERROR_SUCCESS) {
       return Status(GetLastError(), "Failed to query registry value");
@@ -345,15 +360,15 @@ Status queryKey(const std::string& keyPath, QueryData& results) {
 
     // It's possible for registry entries to have been inserted incorrectly
     // resulting in non-null-terminated strings
-    if (bpDataBuff != nullptr && lpData != 0 &&
+    if (lpData != 0 &&
         kRegistryStringTypes.find(lpType) != kRegistryStringTypes.end()) {
       bpDataBuff[lpData - 1] = 0x00;
     }
 
     Row r;
     r["key"] = keyPath;
-    r["name"] = ((achValue[0] == '\0') ? "(Default)" : achValue.get());
-    r["path"] = keyPath + kRegSep + achValue.get();
+    r["name"] = ((achValue[0] == '\0') ? "(Default)" : achValue.data());
+    r["path"] = keyPath + kRegSep + achValue.data();
     if (kRegistryTypes.count(lpType) > 0) {
       r["type"] = kRegistryTypes.at(lpType);
     } else {
@@ -361,23 +376,24 @@ Status queryKey(const std::string& keyPath, QueryData& results) {
     }
     r["mtime"] = std::to_string(osquery::filetimeToUnixtime(ftLastWriteTime));
 
-    if (bpDataBuff != nullptr) {
+    {
       /// REG_LINK is a Unicode string, which in Windows is wchar_t
-      auto regLinkStr = std::make_unique<char[]>(cbMaxValueData);
+      std::unique_ptr<char[]> regLinkStr;
       if (lpType == REG_LINK) {
+        regLinkStr = std::make_unique<char[]>(cbMaxValueData);
         const size_t newSize = cbMaxValueData;
         size_t convertedChars = 0;
         wcstombs_s(&convertedChars,
                    regLinkStr.get(),
                    newSize,
-                   (wchar_t*)bpDataBuff.get(),
+                   (wchar_t*)bpDataBuff.data(),
                    _TRUNCATE);
       }
 
       std::vector<char> regBinary;
       std::string data;
       std::vector<std::string> multiSzStrs;
-      auto p = bpDataBuff.get();
+      auto p = bpDataBuff.data();
 
       switch (lpType) {
       case REG_FULL_RESOURCE_DESCRIPTOR:
@@ -391,13 +407,13 @@ Status queryKey(const std::string& keyPath, QueryData& results) {
         r["data"] = data;
         break;
       case REG_DWORD:
-        r["data"] = std::to_string(*((int*)bpDataBuff.get()));
+        r["data"] = std::to_string(*((int*)bpDataBuff.data()));
         break;
       case REG_DWORD_BIG_ENDIAN:
-        r["data"] = std::to_string(_byteswap_ulong(*((int*)bpDataBuff.get())));
+        r["data"] = std::to_string(_byteswap_ulong(*((int*)bpDataBuff.data())));
         break;
       case REG_EXPAND_SZ:
-        r["data"] = std::string((char*)bpDataBuff.get());
+        r["data"] = std::string((char*)bpDataBuff.data());
         break;
       case REG_LINK:
         r["data"] = std::string(regLinkStr.get());
@@ -414,130 +430,258 @@ Status queryKey(const std::string& keyPath, QueryData& results) {
         r["data"] = "(zero-length binary value)";
         break;
       case REG_QWORD:
-        r["data"] = std::to_string(*((unsigned long long*)bpDataBuff.get()));
+        r["data"] =
+            std::to_string(*((unsigned long long*)bpDataBuff.data()));
         break;
       case REG_SZ:
-        r["data"] = std::string((char*)bpDataBuff.get());
+        r["data"] = std::string((char*)bpDataBuff.data());
         break;
       default:
         r["data"] = "";
         break;
       }
-      ZeroMemory(bpDataBuff.get(), cbMaxValueData);
+      ZeroMemory(bpDataBuff.data(), cbMaxValueData);
     }
     results.push_back(r);
   }
   return Status();
 }
 
-static inline void populateDefaultKeys(std::set<std::string>& rKeys) {
-  boost::copy(kRegistryHives | boost::adaptors::map_keys,
-              std::inserter(rKeys, rKeys.end()));
-}
+/// List the names of a key's subkeys, without reading its values.
+static Status enumerateSubkeys(const std::string& keyPath,
+                               std::vector<std::string>& subkeys) {
+  std::string hive;
+  std::string key;
+  explodeRegistryPath(keyPath, hive, key);
+  if (kRegistryHives.count(hive) != 1) {
+    return Status();
+  }
 
-static inline Status populateSubkeys(std::set<std::string>& rKeys,
-                                     bool replaceKeys = false) {
-  std::set<std::string> newKeys;
-  if (!replaceKeys) {
-    newKeys = rKeys;
+  HKEY hkey;
+  auto ret = RegOpenKeyEx(kRegistryHives.at(hive),
+                          TEXT(key.c_str()),
+                          0,
+                          KEY_ENUMERATE_SUB_KEYS,
+                          &hkey);
+  if (ret != ERROR_SUCCESS) {
+    return Status(ret, "Failed to open registry handle");
   }
+  reg_handle_t hRegistryHandle(hkey, closeRegHandle);
 
-  for (const auto& key : rKeys) {
-    QueryData regResults;
-    auto ret = queryKey(key, regResults);
-    if (!ret.ok()) {
-      return ret;
-    }
-    for (const auto& r : regResults) {
-      if (r.at("type") == "subkey") {
-        newKeys.insert(r.at("path"));
-      }
+  static thread_local std::vector<TCHAR> achKey(256);
+  for (DWORD i = 0;; i++) {
+    DWORD cbName = static_cast<DWORD>(achKey.size());
+    ret = RegEnumKeyEx(hRegistryHandle.get(),
+                       i,
+                       achKey.data(),
+                       &cbName,
+                       nullptr,
+                       nullptr,
+                       nullptr,
+                       nullptr);
+    if (ret != ERROR_SUCCESS) {
+      break;
     }
+    subkeys.push_back(achKey.data());
   }
-  rKeys = std::move(newKeys);
   return Status();
 }
 
-static inline void appendSubkeyToKeys(const std::string& subkey,
-                                      std::set<std::string>& rKeys) {
-  std::set<std::string> newKeys{};
-  for (auto& key : rKeys) {
-    newKeys.insert(std::move(key) + kRegSep + subkey);
-  }
-  rKeys = std::move(newKeys);
-}
+/// A key reached by a pattern, and the pattern elements left to match.
+struct RegistryWalk {
+  std::string key;
 
-static inline Status populateAllKeysRecursive(
-    std::set<std::string>& rKeys,
-    size_t currDepth = 1,
-    size_t maxDepth = kRegMaxRecursiveDepth) {
-  if (currDepth > maxDepth) {
-    return Status(1, "Max recursive depth reached");
-  }
+  /// The pattern's elements, empty for an exact key.
+  const std::vector<std::string>* elements{nullptr};
+  size_t next{0};
 
-  auto size_pre = rKeys.size();
-  auto ret = populateSubkeys(rKeys);
-  if (!ret.ok()) {
-    return ret;
-  }
-  if (size_pre < rKeys.size()) {
-    auto status = populateAllKeysRecursive(rKeys, ++currDepth);
-    if (!status.ok()) {
-      return status;
+  /// Visit the key and each of its subkeys, for a trailing '%%'.
+  bool recursive{false};
+  size_t depth{0};
+};
+
+/// The keys a walk visited or reached, filled by a worker thread.
+struct RegistryStep {
+  bool visited{false};
+  bool max_depth{false};
+  QueryData rows;
+  std::vector<RegistryWalk> walks;
+};
+
+/**
+ * @brief Advance a walk by one pattern element.
+ *
+ * A literal element is appended without reading the registry. A wildcard
+ * element enumerates the subkeys of the key, keeping those matching the
+ * element. A key matching the whole pattern is visited, and its values are
+ * read in the same pass as its subkeys.
+ */
+static void stepRegistryWalk(const RegistryWalk& walk,
+                             bool values,
+                             RegistryStep& step) {
+  const auto& elements = *walk.elements;
+  if (walk.recursive || walk.next == elements.size()) {
+    step.visited = true;
+    std::vector<std::string> subkeys;
+    if (values) {
+      queryKey(walk.key, step.rows);
+      for (const auto& r : step.rows) {
+        if (walk.recursive && r.at("type") == "subkey") {
+          subkeys.push_back(r.at("name"));
+        }
+      }
+    } else if (walk.recursive) {
+      enumerateSubkeys(walk.key, subkeys);
+    }
+
+    if (walk.recursive && walk.depth >= kRegMaxRecursiveDepth) {
+      step.max_depth = !subkeys.empty();
+      return;
+    }
+    for (const auto& subkey : subkeys) {
+      step.walks.push_back({walk.key + kRegSep + subkey,
+                            walk.elements,
+                            walk.next,
+                            true,
+                            walk.depth + 1});
+    }
+    return;
+  }
+
+  const auto& element = elements[walk.next];
+  if (element.find(kSQLGlobWildcard) == std::string::npos) {
+    step.walks.push_back({walk.key + kRegSep + element,
+                          walk.elements,
+                          walk.next + 1,
+                          false,
+                          walk.depth + 1});
+    return;
+  }
+
+  // Only a trailing '%%' recurses, elsewhere it matches like a single '%'.
+  auto pattern = element;
+  bool recursive = (walk.next + 1 == elements.size() &&
+                    boost::ends_with(element, kSQLGlobRecursive));
+  if (recursive) {
+    pattern.pop_back();
+    if (pattern == kSQLGlobWildcard) {
+      step.walks.push_back(
+          {walk.key, walk.elements, walk.next, true, walk.depth});
+      return;
     }
   }
 
-  return Status();
+  std::vector<std::string> subkeys;
+  enumerateSubkeys(walk.key, subkeys);
+  for (const auto& subkey : subkeys) {
+    if (likeMatches(pattern, subkey)) {
+      step.walks.push_back({walk.key + kRegSep + subkey,
+                            walk.elements,
+                            walk.next + 1,
+                            recursive,
+                            walk.depth + 1});
+    }
+  }
 }
 
-Status expandRegistryGlobs(const std::string& pattern,
-                           std::set<std::string>& results) {
-  auto pathElems = osquery::split(pattern, kRegSep);
-  if (pathElems.size() == 0) {
-    return Status();
+Status walkRegistryKeys(const std::set<std::string>& keys,
+                        const std::vector<std::string>& patterns,
+                        bool values,
+                        const RegistryVisitor& visitor) {
+  static const std::vector<std::string> kExactKey;
+
+  std::vector<std::vector<std::string>> elements;
+  for (const auto& pattern : patterns) {
+    elements.push_back(osquery::split(pattern, kRegSep));
   }
 
-  /*
-   * Pattern is '%%', grab everything.
-   * Note that if '%%' is present but not at the end of the pattern,
-   * then it is treated like a single glob.
-   */
-  if (boost::ends_with(pathElems[0], kSQLGlobRecursive) &&
-      pathElems.size() == 1) {
-    populateDefaultKeys(results);
-    return populateAllKeysRecursive(results);
+  std::vector<RegistryWalk> frontier;
+  for (const auto& key : keys) {
+    frontier.push_back({key, &kExactKey, 0, false, 0});
   }
+  for (const auto& pattern : elements) {
+    if (pattern.empty()) {
+      continue;
+    }
 
-  // Special handling to insert default keys when glob present in first elem
-  if (pathElems[0].find(kSQLGlobWildcard) != std::string::npos) {
-    populateDefaultKeys(results);
-    pathElems.erase(pathElems.begin());
-  } else {
-    results.insert(pathElems[0]);
-    pathElems.erase(pathElems.begin());
-  }
-
-  for (auto&& elem = pathElems.begin(); elem != pathElems.end(); ++elem) {
-    // We only care about  a recursive glob if it comes at the end of the
-    // pattern i.e. 'HKEY_LOCAL_MACHINE\SOFTWARE\%%'
-    if (boost::ends_with(*elem, kSQLGlobRecursive) &&
-        *elem == pathElems.back()) {
-      return populateAllKeysRecursive(results);
-    } else if ((*elem).find(kSQLGlobWildcard) != std::string::npos) {
-      auto ret = populateSubkeys(results, true);
-      if (!ret.ok()) {
-        return ret;
+    // The hive is the first element, each matching hive starts a walk.
+    const auto& hive = pattern[0];
+    if (hive.find(kSQLGlobWildcard) == std::string::npos) {
+      frontier.push_back({hive, &pattern, 1, false, 1});
+      continue;
+    }
+    bool recursive = (pattern.size() == 1 && hive == kSQLGlobRecursive);
+    for (const auto& known : kRegistryHives) {
+      if (recursive || likeMatches(hive, known.first)) {
+        frontier.push_back({known.first, &pattern, 1, recursive, 1});
       }
-    } else {
-      appendSubkeyToKeys(*elem, results);
     }
   }
+
+  // Each key is visited once, and each recursion walks a key once.
+  std::unordered_set<std::string> visited;
+  std::unordered_set<std::string> recursed;
+  bool max_depth = false;
+  while (!frontier.empty()) {
+    // Walks of the same depth are advanced in parallel.
+    std::vector<RegistryStep> steps(frontier.size());
+    std::atomic<size_t> next{0};
+    auto worker = ([&frontier, &steps, &next, values]() {
+      for (auto i = next++; i < frontier.size(); i = next++) {
+        stepRegistryWalk(frontier[i], values, steps[i]);
+      }
+    });
+
+    auto count = std::min<size_t>(std::max<uint32_t>(FLAGS_registry_threads, 1),
+                                  frontier.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < count; i++) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    // Rows are passed to the visitor on the calling thread, in walk order.
+    std::vector<RegistryWalk> walks;
+    for (size_t i = 0; i < frontier.size(); i++) {
+      auto& step = steps[i];
+      max_depth = max_depth || step.max_depth;
+      if (step.visited && visited.insert(frontier[i].key).second) {
+        visitor(frontier[i].key, step.rows);
+      }
+      for (auto& walk : step.walks) {
+        if (!walk.recursive || recursed.insert(walk.key).second) {
+          walks.push_back(std::move(walk));
+        }
+      }
+    }
+    frontier = std::move(walks);
+  }
+
+  if (max_depth) {
+    return Status(1, "Max recursive depth reached");
+  }
   return Status();
 }
 
-static inline void maybeWarnLocalUsers(const std::set<std::string>& rKeys) {
+Status expandRegistryGlobs(const std::string& pattern,
+                           std::set<std::string>& results) {
+  return walkRegistryKeys(
+      {},
+      {pattern},
+      false,
+      [&results](const std::string& key, QueryData&) { results.insert(key); });
+}
+
+static inline void maybeWarnLocalUsers(const std::set<std::string>& keys,
+                                       const std::vector<std::string>& globs) {
+  std::vector<std::string> paths(keys.begin(), keys.end());
+  paths.insert(paths.end(), globs.begin(), globs.end());
+
   std::string hive, _;
-  for (const auto& key : rKeys) {
+  for (const auto& key : paths) {
     explodeRegistryPath(key, hive, _);
     if (hive == "HKEY_CURRENT_USER" ||
         hive == "HKEY_CURRENT_USER_LOCAL_SETTINGS") {
@@ -548,26 +692,23 @@ static inline void maybeWarnLocalUsers(const std::set<std::string>& rKeys) {
   }
 }
 
-QueryData genRegistry(QueryContext& context) {
-  QueryData results;
+void genRegistry(RowYield& yield, QueryContext& context) {
   std::set<std::string> keys;
+  std::vector<std::string> globs;
 
   if (!(context.hasConstraint("key", EQUALS) ||
         context.hasConstraint("key", LIKE) ||
         context.hasConstraint("path", EQUALS) ||
         context.hasConstraint("path", LIKE))) {
     // We default to display all HIVEs
-    expandRegistryGlobs(kSQLGlobWildcard, keys);
+    globs.push_back(kSQLGlobWildcard);
   } else {
     if (context.hasConstraint("key", EQUALS)) {
       keys = context.constraints["key"].getAll(EQUALS);
     }
     if (context.hasConstraint("key", LIKE)) {
       for (const auto& key : context.constraints["key"].getAll(LIKE)) {
-        auto status = expandRegistryGlobs(key, keys);
-        if (!status.ok()) {
-          LOG(INFO) << "Failed to expand globs: " + status.getMessage();
-        }
+        globs.push_back(key);
       }
     }
     if (context.hasConstraint("path", EQUALS)) {
@@ -577,21 +718,23 @@ QueryData genRegistry(QueryContext& context) {
     }
     if (context.hasConstraint("path", LIKE)) {
       for (const auto& path : context.constraints["path"].getAll(LIKE)) {
-        auto status = expandRegistryGlobs(
-            path.substr(0, path.find_last_of(kRegSep)), keys);
-        if (!status.ok()) {
-          LOG(INFO) << "Failed to expand globs: " + status.getMessage();
-        }
+        globs.push_back(path.substr(0, path.find_last_of(kRegSep)));
       }
     }
   }
 
-  maybeWarnLocalUsers(keys);
+  maybeWarnLocalUsers(keys, globs);
 
-  for (const auto& key : keys) {
-    queryKey(key, results);
+  // Rows are yielded as each depth of the walk completes.
+  auto status = walkRegistryKeys(
+      keys, globs, true, [&yield](const std::string& key, QueryData& rows) {
+        for (auto& r : rows) {
+          yield(r);
+        }
+      });
+  if (!status.ok()) {
+    LOG(INFO) << "Failed to expand globs: " + status.getMessage();
   }
-  return results;
 }
 } // namespace tables
 } // namespace osquery
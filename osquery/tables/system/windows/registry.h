@@ -10,6 +10,11 @@
 
 #pragma once
 
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
 #include <osquery/core.h>
 #include <osquery/tables.h>
 namespace osquery {
@@ -86,6 +91,29 @@ Status getClassExecutables(const std::string& clsId,
 Status expandRegistryGlobs(const std::string& pattern,
                            std::set<std::string>& results);
 
+/// Receives a visited registry key and, if values were read, its rows.
+using RegistryVisitor =
+    std::function<void(const std::string& key, QueryData& rows)>;
+
+/*
+ * @brief Walk the registry keys matching exact keys and globbing patterns
+ *
+ * Each pattern is walked from its literal prefix. Only keys matching each
+ * wildcard element are enumerated, and a trailing '%%' recurses below the
+ * keys matched so far. Walks of the same depth are advanced in parallel by
+ * --registry_threads threads, such as the keys of each user in HKEY_USERS.
+ *
+ * @param keys Exact keys to visit, e.g. 'HKEY_LOCAL_MACHINE\SOFTWARE'
+ * @param patterns SQL globbing patterns, e.g. 'HKEY_USERS\%\SOFTWARE\%%'
+ * @param values Read the subkeys and values of each visited key as rows
+ * @param visitor Called on the calling thread once for each visited key
+ * @return Failure if the max recursive depth is reached, otherwise success
+ */
+Status walkRegistryKeys(const std::set<std::string>& keys,
+                        const std::vector<std::string>& patterns,
+                        bool values,
+                        const RegistryVisitor& visitor);
+
 /*
  * @brief Explode a registry path into a HIVE and KEY
  *
@@ -33,18 +33,54 @@ const std::map<fs::file_type, std::string> kTypeNames{
     {fs::status_error, "error"},
 };
 
+/// Column positions within the typed file table results.
+struct FileColumns {
+  explicit FileColumns(const TableRows& results)
+      : path(results.column("path")),
+        directory(results.column("directory")),
+        filename(results.column("filename")),
+        inode(results.column("inode")),
+        uid(results.column("uid")),
+        gid(results.column("gid")),
+        mode(results.column("mode")),
+        device(results.column("device")),
+        size(results.column("size")),
+        block_size(results.column("block_size")),
+        atime(results.column("atime")),
+        mtime(results.column("mtime")),
+        ctime(results.column("ctime")),
+        btime(results.column("btime")),
+        hard_links(results.column("hard_links")),
+        symlink(results.column("symlink")),
+        type(results.column("type")) {}
+
+  size_t path;
+  size_t directory;
+  size_t filename;
+  size_t inode;
+  size_t uid;
+  size_t gid;
+  size_t mode;
+  size_t device;
+  size_t size;
+  size_t block_size;
+  size_t atime;
+  size_t mtime;
+  size_t ctime;
+  size_t btime;
+  size_t hard_links;
+  size_t symlink;
+  size_t type;
+};
+
 void genFileInfo(const fs::path& path,
                  const fs::path& parent,
                  const std::string& pattern,
-                 QueryData& results) {
+                 const FileColumns& columns,
+                 TableRows& results) {
   // Must provide the path, filename, directory separate from boost path->string
   // helpers to match any explicit (query-parsed) predicate constraints.
-
-  Row r;
-  r["path"] = path.string();
-  r["filename"] = path.filename().string();
-  r["directory"] = parent.string();
-  r["symlink"] = "0";
+  bool symlink = false;
 
   struct stat file_stat;
 #if !defined(WIN32)
@@ -55,7 +91,7 @@ void genFileInfo(const fs::path& path,
     return;
   }
   if ((link_stat.st_mode & S_IFLNK) != 0) {
-    r["symlink"] = "1";
+    symlink = true;
   }
 #endif
 
@@ -67,104 +103,119 @@ void genFileInfo(const fs::path& path,
 #endif
   }
 
-  r["inode"] = BIGINT(file_stat.st_ino);
-  r["uid"] = BIGINT(file_stat.st_uid);
-  r["gid"] = BIGINT(file_stat.st_gid);
-  r["mode"] = lsperms(file_stat.st_mode);
-  r["device"] = BIGINT(file_stat.st_rdev);
-  r["size"] = BIGINT(file_stat.st_size);
+  results.addRow();
+  results.setText(columns.path, path.string());
+  results.setText(columns.filename, path.filename().string());
+  results.setText(columns.directory, parent.string());
+  results.setInteger(columns.symlink, (symlink) ? 1 : 0);
+
+  results.setInteger(columns.inode, file_stat.st_ino);
+  results.setInteger(columns.uid, file_stat.st_uid);
+  results.setInteger(columns.gid, file_stat.st_gid);
+  results.setText(columns.mode, lsperms(file_stat.st_mode));
+  results.setInteger(columns.device, file_stat.st_rdev);
+  results.setInteger(columns.size, file_stat.st_size);
 
 #if !defined(WIN32)
-  r["block_size"] = INTEGER(file_stat.st_blksize);
-  r["hard_links"] = INTEGER(file_stat.st_nlink);
+  results.setInteger(columns.block_size, file_stat.st_blksize);
+  results.setInteger(columns.hard_links, file_stat.st_nlink);
 #endif
 
   // Times
-  r["atime"] = BIGINT(file_stat.st_atime);
-  r["mtime"] = BIGINT(file_stat.st_mtime);
-  r["ctime"] = BIGINT(file_stat.st_ctime);
+  results.setInteger(columns.atime, file_stat.st_atime);
+  results.setInteger(columns.mtime, file_stat.st_mtime);
+  results.setInteger(columns.ctime, file_stat.st_ctime);
 #if defined(__linux__) || defined(WIN32)
   // No 'birth' or create time in Linux or Windows.
-  r["btime"] = "0";
+  results.setInteger(columns.btime, 0);
 #else
-  r["btime"] = BIGINT(file_stat.st_birthtimespec.tv_sec);
+  results.setInteger(columns.btime, file_stat.st_birthtimespec.tv_sec);
 #endif
 
   // Type booleans
   boost::system::error_code ec;
   auto status = fs::status(path, ec);
   if (kTypeNames.count(status.type())) {
-    r["type"] = kTypeNames.at(status.type());
+    results.setText(columns.type, kTypeNames.at(status.type()));
   } else {
-    r["type"] = "unknown";
+    results.setText(columns.type, "unknown");
   }
-
-  results.push_back(r);
 }
 
-QueryData genFile(QueryContext& context) {
-  QueryData results;
+/// The number of file rows generated before yielding the batch.
+const size_t kFileRowsBatch = 256;
+
+void genFile(TableRowsYield& yield, TableRows& batch, QueryContext& context) {
+  FileColumns columns(batch);
+  auto yieldFileInfo = ([&](const fs::path& path, const fs::path& parent) {
+    genFileInfo(path, parent, "", columns, batch);
+    if (batch.size() >= kFileRowsBatch) {
+      yield(batch);
+    }
+  });
 
-  // Resolve file paths for EQUALS and LIKE operations.
+  // Resolve file paths for EQUALS and LIKE operations, as they are walked.
+  // Paths are only remembered if more than one constraint may select them.
   auto paths = context.constraints["path"].getAll(EQUALS);
-  context.expandConstraints(
-      "path",
-      LIKE,
-      paths,
-      ([&](const std::string& pattern, std::set<std::string>& out) {
-        std::vector<std::string> patterns;
-        auto status =
-            resolveFilePattern(pattern, patterns, GLOB_ALL | GLOB_NO_CANON);
-        if (status.ok()) {
-          for (const auto& resolved : patterns) {
-            out.insert(resolved);
-          }
-        }
-        return status;
-      }));
+  auto path_patterns = context.constraints["path"].getAll(LIKE);
+  bool unique_paths = paths.empty() && path_patterns.size() <= 1;
 
   // Iterate through each of the resolved/supplied paths.
   for (const auto& path_string : paths) {
     fs::path path = path_string;
-    genFileInfo(path, path.parent_path(), "", results);
+    yieldFileInfo(path, path.parent_path());
+  }
+
+  for (const auto& pattern : path_patterns) {
+    resolveFilePattern(
+        pattern, GLOB_ALL | GLOB_NO_CANON, ([&](const std::string& resolved) {
+          if (unique_paths || paths.insert(resolved).second) {
+            fs::path path = resolved;
+            yieldFileInfo(path, path.parent_path());
+          }
+          // Stop walking the pattern if the query was cancelled.
+          return !context.isCancelled();
+        }));
   }
 
   // Resolve directories for EQUALS and LIKE operations.
   auto directories = context.constraints["directory"].getAll(EQUALS);
-  context.expandConstraints(
-      "directory",
-      LIKE,
-      directories,
-      ([&](const std::string& pattern, std::set<std::string>& out) {
-        std::vector<std::string> patterns;
-        auto status =
-            resolveFilePattern(pattern, patterns, GLOB_FOLDERS | GLOB_NO_CANON);
-        if (status.ok()) {
-          for (const auto& resolved : patterns) {
-            out.insert(resolved);
-          }
-        }
-        return status;
-      }));
+  auto directory_patterns = context.constraints["directory"].getAll(LIKE);
+  bool unique_directories =
+      directories.empty() && directory_patterns.size() <= 1;
 
-  // Now loop through constraints using the directory column constraint.
-  for (const auto& directory_string : directories) {
+  // Loop through constraints using the directory column constraint.
+  auto listDirectory = ([&](const std::string& directory_string) {
     if (!isReadable(directory_string) || !isDirectory(directory_string)) {
-      continue;
+      return;
     }
 
     try {
       // Iterate over the directory and generate info for each regular file.
       fs::directory_iterator begin(directory_string), end;
-      for (; begin != end; ++begin) {
-        genFileInfo(begin->path(), directory_string, "", results);
+      for (; begin != end && !context.isCancelled(); ++begin) {
+        yieldFileInfo(begin->path(), directory_string);
       }
     } catch (const fs::filesystem_error& /* e */) {
-      continue;
+      return;
     }
+  });
+
+  for (const auto& directory_string : directories) {
+    listDirectory(directory_string);
   }
 
-  return results;
+  for (const auto& pattern : directory_patterns) {
+    resolveFilePattern(pattern,
+                       GLOB_FOLDERS | GLOB_NO_CANON,
+                       ([&](const std::string& resolved) {
+                         if (unique_directories ||
+                             directories.insert(resolved).second) {
+                           listDirectory(resolved);
+                         }
+                         return !context.isCancelled();
+                       }));
+  }
 }
 }
 }
@@ -10,6 +10,7 @@
 
 #include <osquery/config.h>
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/events.h>
 #include <osquery/extensions.h>
 #include <osquery/filesystem.h>
@@ -21,7 +22,12 @@
 #include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/memory.h"
 #include "osquery/core/process.h"
+#include "osquery/core/startup.h"
+#include "osquery/sql/extension_cache.h"
+#include "osquery/sql/scan_cache.h"
+#include "osquery/sql/virtual_table.h"
 
 namespace osquery {
 
@@ -45,11 +51,21 @@ QueryData genOsqueryEvents(QueryContext& context) {
       r["subscriptions"] = INTEGER(pubref->numSubscriptions());
       r["events"] = INTEGER(pubref->numEvents());
       r["refreshes"] = INTEGER(pubref->restartCount());
+      r["dropped"] = INTEGER(pubref->droppedCount());
+      r["queued"] = "0";
+      r["stored"] = "0";
+      r["contexts_allocated"] = BIGINT(pubref->contextsAllocated());
+      r["contexts_reused"] = BIGINT(pubref->contextsReused());
       r["active"] = (pubref->hasStarted() && !pubref->isEnding()) ? "1" : "0";
     } else {
       r["subscriptions"] = "0";
       r["events"] = "0";
       r["refreshes"] = "0";
+      r["dropped"] = "0";
+      r["queued"] = "0";
+      r["stored"] = "0";
+      r["contexts_allocated"] = "0";
+      r["contexts_reused"] = "0";
       r["active"] = "-1";
     }
     results.push_back(r);
@@ -60,20 +76,28 @@ QueryData genOsqueryEvents(QueryContext& context) {
     Row r;
     r["name"] = subscriber;
     r["type"] = "subscriber";
-    // Subscribers will never 'restart'.
+    // Subscribers will never 'restart', and do not create contexts.
     r["refreshes"] = "0";
+    r["contexts_allocated"] = "0";
+    r["contexts_reused"] = "0";
 
     auto subref = EventFactory::getEventSubscriber(subscriber);
     if (subref != nullptr) {
       r["publisher"] = subref->getType();
       r["subscriptions"] = INTEGER(subref->numSubscriptions());
       r["events"] = INTEGER(subref->numEvents());
+      r["dropped"] = INTEGER(subref->droppedCount());
+      r["queued"] = INTEGER(subref->queuedCount());
+      r["stored"] = INTEGER(subref->storedCount());
 
       // Subscribers are always active, even if their publisher is not.
       r["active"] = (subref->state() == EventState::EVENT_RUNNING) ? "1" : "0";
     } else {
       r["subscriptions"] = "0";
       r["events"] = "0";
+      r["dropped"] = "0";
+      r["queued"] = "0";
+      r["stored"] = "0";
       r["active"] = "-1";
     }
     results.push_back(r);
@@ -129,6 +153,114 @@ QueryData genOsqueryFlags(QueryContext& context) {
   return results;
 }
 
+QueryData genOsqueryScanCache(QueryContext& context) {
+  QueryData results;
+  for (const auto& table : SharedScanCache::get().stats()) {
+    Row r;
+    r["name"] = table.first;
+    r["hits"] = BIGINT(table.second.hits);
+    r["misses"] = BIGINT(table.second.misses);
+    results.push_back(r);
+  }
+  return results;
+}
+
+QueryData genOsqueryTableStats(QueryContext& context) {
+  QueryData results;
+  auto extension_stats = ExtensionTableCache::get().stats();
+  for (const auto& table : getTableExecutionStats()) {
+    const auto& stats = table.second;
+    Row r;
+    r["name"] = table.first;
+    r["generate_calls"] = BIGINT(stats.generate_calls);
+    r["rows_generated"] = BIGINT(stats.rows_generated);
+    r["rows_consumed"] = BIGINT(stats.rows_consumed);
+    r["wall_time"] = BIGINT(stats.wall_time);
+    r["user_time"] = BIGINT(stats.user_time);
+    r["system_time"] = BIGINT(stats.system_time);
+
+    size_t cache_hits = 0;
+    if (Registry::get().exists("table", table.first, true)) {
+      auto plugin = Registry::get().plugin("table", table.first);
+      auto table_plugin = std::dynamic_pointer_cast<TablePlugin>(plugin);
+      if (table_plugin != nullptr) {
+        cache_hits = table_plugin->cacheHits();
+      }
+    } else {
+      // The results of an extension's table may be kept by the core.
+      auto kept = extension_stats.find(table.first);
+      if (kept != extension_stats.end()) {
+        cache_hits = kept->second.hits;
+      }
+    }
+    r["cache_hits"] = BIGINT(cache_hits);
+
+    r["constraint_shapes"] = INTEGER(stats.shapes.size());
+    auto common = stats.shapes.begin();
+    for (auto it = stats.shapes.begin(); it != stats.shapes.end(); ++it) {
+      if (it->second > common->second) {
+        common = it;
+      }
+    }
+    r["common_shape"] = (common != stats.shapes.end()) ? common->first : "";
+    results.push_back(r);
+  }
+  return results;
+}
+
+QueryData genOsqueryMemory(QueryContext& context) {
+  QueryData results;
+  if (!isMemoryTagging()) {
+    return results;
+  }
+
+  for (const auto& tag : getMemoryTagStats()) {
+    Row r;
+    r["tag"] = tag.tag;
+    r["live_bytes"] = BIGINT(tag.live_bytes);
+    r["peak_bytes"] = BIGINT(tag.peak_bytes);
+    r["allocations"] = BIGINT(tag.allocations);
+    results.push_back(r);
+  }
+  return results;
+}
+
+QueryData genOsqueryStartup(QueryContext& context) {
+  QueryData results;
+  for (const auto& phase : getStartupPhases()) {
+    Row r;
+    r["phase"] = phase.name;
+    r["start"] = BIGINT(phase.start);
+    r["duration"] = BIGINT(phase.duration);
+    r["background"] = INTEGER(phase.background ? 1 : 0);
+    results.push_back(r);
+  }
+  return results;
+}
+
+QueryData genOsqueryDatabase(QueryContext& context) {
+  QueryData results;
+  std::vector<DatabaseDomainStats> stats;
+  getDatabaseStats(stats);
+  for (const auto& domain : stats) {
+    Row r;
+    r["domain"] = domain.domain;
+    r["profile"] = domain.profile;
+    r["keys"] = BIGINT(domain.keys);
+    r["disk_bytes"] = BIGINT(domain.disk_bytes);
+    r["memory_bytes"] = BIGINT(domain.memory_bytes);
+    r["pending_compaction_bytes"] = BIGINT(domain.pending_compaction_bytes);
+    r["delayed_write_rate"] = BIGINT(domain.delayed_write_rate);
+    r["write_stopped"] = INTEGER(domain.write_stopped ? 1 : 0);
+    r["last_compaction"] = BIGINT(domain.last_compaction);
+    r["cache_hits"] = BIGINT(domain.cache_hits);
+    r["cache_misses"] = BIGINT(domain.cache_misses);
+    r["cache_bytes"] = BIGINT(domain.cache_bytes);
+    results.push_back(r);
+  }
+  return results;
+}
+
 QueryData genOsqueryRegistry(QueryContext& context) {
   QueryData results;
 
@@ -188,6 +320,20 @@ QueryData genOsqueryExtensions(QueryContext& context) {
       r["sdk_version"] = extension.second.sdk_version;
       r["path"] = getExtensionSocket(extension.first);
       r["type"] = (extension.first == 0) ? "core" : "extension";
+
+      ExtensionCalls calls;
+      getExtensionCalls(extension.first, calls);
+      r["calls"] = BIGINT(calls.calls);
+      r["failed_calls"] = BIGINT(calls.failures);
+      r["active_calls"] = INTEGER(calls.active);
+      std::string latency;
+      for (const auto& item : calls.latency) {
+        if (!latency.empty()) {
+          latency += ';';
+        }
+        latency += item.first + '=' + item.second.toString();
+      }
+      r["latency_histogram"] = std::move(latency);
       results.push_back(r);
     }
   }
@@ -227,6 +373,16 @@ QueryData genOsqueryInfo(QueryContext& context) {
   return results;
 }
 
+/// Report the tail of a histogram as the name_p50, p95, p99, and max columns.
+static void genPercentiles(const std::string& name,
+                           const PerformanceHistogram& histogram,
+                           Row& r) {
+  r[name + "_p50"] = BIGINT(histogram.percentile(50));
+  r[name + "_p95"] = BIGINT(histogram.percentile(95));
+  r[name + "_p99"] = BIGINT(histogram.percentile(99));
+  r[name + "_max"] = BIGINT(histogram.max);
+}
+
 QueryData genOsquerySchedule(QueryContext& context) {
   QueryData results;
 
@@ -236,6 +392,7 @@ QueryData genOsquerySchedule(QueryContext& context) {
         r["name"] = name;
         r["query"] = query.query;
         r["interval"] = INTEGER(query.interval);
+        r["effective_interval"] = INTEGER(query.splayed_interval);
         r["blacklisted"] = (query.blacklisted) ? "1" : "0";
         // Set default (0) values for each query if it has not yet executed.
         r["executions"] = "0";
@@ -245,6 +402,24 @@ QueryData genOsquerySchedule(QueryContext& context) {
         r["system_time"] = "0";
         r["average_memory"] = "0";
         r["last_executed"] = "0";
+        r["lateness"] = "0";
+        r["missed"] = "0";
+        r["timeouts"] = "0";
+        r["truncations"] = "0";
+        r["instructions"] = "0";
+        r["cycles"] = "0";
+        r["cache_misses"] = "0";
+        r["context_switches"] = "0";
+        r["major_faults"] = "0";
+        r["minor_faults"] = "0";
+        r["wall_time_histogram"] = "";
+        r["cpu_time_histogram"] = "";
+        r["memory_histogram"] = "";
+        r["tables"] = "";
+        for (const auto& name : {"wall_time", "cpu_time", "rows",
+                                 "output_size", "lateness", "sqlite_memory"}) {
+          genPercentiles(name, PerformanceHistogram(), r);
+        }
 
         // Report optional performance information.
         Config::get().getPerformanceStats(
@@ -256,6 +431,40 @@ QueryData genOsquerySchedule(QueryContext& context) {
               r["user_time"] = BIGINT(perf.user_time);
               r["system_time"] = BIGINT(perf.system_time);
               r["average_memory"] = BIGINT(perf.average_memory);
+              r["lateness"] = BIGINT(perf.lateness);
+              r["missed"] = BIGINT(perf.missed);
+              r["timeouts"] = BIGINT(perf.timeouts);
+              r["truncations"] = BIGINT(perf.truncations);
+              if (perf.effective_interval > 0) {
+                r["effective_interval"] = INTEGER(perf.effective_interval);
+              }
+              r["instructions"] = BIGINT(perf.instructions);
+              r["cycles"] = BIGINT(perf.cycles);
+              r["cache_misses"] = BIGINT(perf.cache_misses);
+              r["context_switches"] = BIGINT(perf.context_switches);
+              r["major_faults"] = BIGINT(perf.major_faults);
+              r["minor_faults"] = BIGINT(perf.minor_faults);
+              r["wall_time_histogram"] = perf.wall_time_histogram.toString();
+              r["cpu_time_histogram"] = perf.cpu_time_histogram.toString();
+              r["memory_histogram"] = perf.memory_histogram.toString();
+              genPercentiles("wall_time", perf.wall_time_histogram, r);
+              genPercentiles("cpu_time", perf.cpu_time_histogram, r);
+              genPercentiles("rows", perf.rows_histogram, r);
+              genPercentiles("output_size", perf.output_size_histogram, r);
+              genPercentiles("lateness", perf.lateness_histogram, r);
+              genPercentiles(
+                  "sqlite_memory", perf.sqlite_memory_histogram, r);
+
+              std::string tables;
+              for (const auto& table : perf.tables) {
+                if (!tables.empty()) {
+                  tables += ',';
+                }
+                tables += table.first + ':' +
+                          std::to_string(table.second.rows) + ':' +
+                          std::to_string(table.second.bytes);
+              }
+              r["tables"] = tables;
             });
 
         results.push_back(r);
@@ -11,11 +11,14 @@
 #include <gtest/gtest.h>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 
 #include "osquery/tables/yara/yara_utils.h"
 
 namespace osquery {
 
+DECLARE_uint64(yara_max_file_size);
+
 const std::string ruleFile = "/tmp/osquery-yara.sig";
 const std::string ls = "/bin/ls";
 const std::string alwaysTrue = "rule always_true { condition: true }";
@@ -69,4 +72,25 @@ TEST_F(YARATest, test_match_false) {
   // Should have 0 count
   EXPECT_TRUE(r["count"] == "0");
 }
+
+TEST_F(YARATest, test_scan_size_budget) {
+  YR_RULES* rules = nullptr;
+  ASSERT_EQ(yr_initialize(), ERROR_SUCCESS);
+  writeTextFile(ruleFile, alwaysTrue);
+  ASSERT_TRUE(compileSingleFile(ruleFile, &rules).ok());
+
+  Row r;
+  r["count"] = "0";
+  EXPECT_TRUE(scanYARAFile(rules, ls, r).ok());
+  EXPECT_EQ(r["count"], "1");
+
+  // Files larger than the budget are not scanned.
+  FLAGS_yara_max_file_size = 1;
+  r["count"] = "0";
+  EXPECT_FALSE(scanYARAFile(rules, ls, r).ok());
+  EXPECT_EQ(r["count"], "0");
+  FLAGS_yara_max_file_size = 0;
+
+  yr_rules_destroy(rules);
+}
 } // namespace osquery
@@ -8,9 +8,15 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/status.h>
 #include <osquery/tables.h>
@@ -23,8 +29,24 @@
 #include <yara.h>
 
 namespace osquery {
+
+FLAG(uint32, yara_scan_threads, 4, "Number of threads scanning files for yara");
+
 namespace tables {
 
+/// A file and the signature group to scan it with.
+struct YARAScanJob {
+  std::string path;
+  std::string group;
+  YR_RULES* rules{nullptr};
+
+  /// The row, if the scan completed.
+  QueryData results;
+
+  /// Time spent scanning.
+  std::chrono::microseconds duration{0};
+};
+
 void doYARAScan(YR_RULES* rules,
                 const std::string& path,
                 QueryData& results,
@@ -44,10 +66,49 @@ void doYARAScan(YR_RULES* rules,
   r["sigfile"] = std::string(sigfile);
 
   // Perform the scan, using the static YARA subscriber callback.
-  int result = yr_rules_scan_file(
-      rules, path.c_str(), SCAN_FLAGS_FAST_MODE, YARACallback, (void*)&r, 0);
-  if (result == ERROR_SUCCESS) {
+  auto status = scanYARAFile(rules, path, r);
+  if (status.ok()) {
     results.push_back(std::move(r));
+  } else {
+    VLOG(1) << status.getMessage();
+  }
+}
+
+/**
+ * @brief Scan each job using up to yara_scan_threads threads.
+ *
+ * Each thread claims jobs in order and owns a YARA thread slot, released
+ * when it finishes. Compiled rules are shared between threads.
+ */
+static void scanYARAJobs(std::vector<YARAScanJob>& jobs) {
+  std::atomic<size_t> next(0);
+  auto worker = ([&jobs, &next]() {
+    for (auto i = next++; i < jobs.size(); i = next++) {
+      auto& job = jobs[i];
+      auto start = std::chrono::steady_clock::now();
+      doYARAScan(job.rules, job.path, job.results, job.group, job.group);
+      job.duration = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start);
+    }
+  });
+
+  // YARA scans from at most YR_MAX_THREADS threads, shared with yara_events.
+  size_t threads = std::min<size_t>(
+      {FLAGS_yara_scan_threads, jobs.size(), YR_MAX_THREADS / 2});
+  if (threads <= 1) {
+    worker();
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < threads; i++) {
+    workers.emplace_back([&worker]() {
+      worker();
+      yr_finalize_thread();
+    });
+  }
+  for (auto& thread : workers) {
+    thread.join();
   }
 }
 
@@ -126,14 +187,35 @@ QueryData genYara(QueryContext& context) {
   }
 
   // Scan every path pair.
+  std::vector<YARAScanJob> jobs;
   for (const auto& path : paths) {
     // Scan using the signature groups.
     for (const auto& group : groups) {
       if (rules.count(group) > 0) {
-        doYARAScan(rules[group], path.c_str(), results, group, group);
+        jobs.emplace_back();
+        jobs.back().path = path;
+        jobs.back().group = group;
+        jobs.back().rules = rules[group];
       }
     }
   }
+  scanYARAJobs(jobs);
+
+  // Report the time spent scanning with each signature group.
+  std::map<std::string, std::pair<size_t, std::chrono::microseconds>> timing;
+  for (auto& job : jobs) {
+    auto& group_timing = timing[job.group];
+    group_timing.first++;
+    group_timing.second += job.duration;
+    for (auto& row : job.results) {
+      results.push_back(std::move(row));
+    }
+  }
+  for (const auto& group_timing : timing) {
+    VLOG(1) << "YARA group " << group_timing.first << " scanned "
+            << group_timing.second.first << " files in "
+            << group_timing.second.second.count() / 1000 << "ms";
+  }
 
   return results;
 }
@@ -57,6 +57,11 @@ class YARAEventSubscriber : public FileEventSubscriber {
 
   void configure() override;
 
+  /// Scanning file content should not delay other file event subscribers.
+  bool usesQueue() const override {
+    return true;
+  }
+
  private:
   /**
    * @brief This exports a single Callback for FSEventsEventPublisher events.
@@ -171,15 +176,9 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
   const auto& sig_groups = yara_paths.find(category);
   for (const auto& rule : sig_groups->second) {
     const std::string group = rule.second.data();
-    int result = yr_rules_scan_file(rules[group],
-                                    ec->path.c_str(),
-                                    SCAN_FLAGS_FAST_MODE,
-                                    YARACallback,
-                                    (void*)&r,
-                                    0);
-
-    if (result != ERROR_SUCCESS) {
-      return Status(1, "YARA error: " + std::to_string(result));
+    auto status = scanYARAFile(rules[group], ec->path, r);
+    if (!status.ok()) {
+      return status;
     }
   }
 
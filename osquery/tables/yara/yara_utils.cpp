@@ -8,16 +8,135 @@
  *  You may select, at your option, one of the above-listed licenses.
  */
 
+#include <cstring>
 #include <map>
 #include <string>
+#include <vector>
+
+#include <sys/stat.h>
 
 #include <osquery/config.h>
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/tables/system/hash.h"
 #include "osquery/tables/yara/yara_utils.h"
 
 namespace osquery {
 
+FLAG(bool,
+     disable_yara_cache,
+     false,
+     "Compile YARA rule files without the cached compiled rules");
+
+FLAG(uint32,
+     yara_scan_timeout,
+     0,
+     "Seconds a YARA scan of a single file may take (0 is unlimited)");
+
+FLAG(uint64,
+     yara_max_file_size,
+     0,
+     "Files larger than this many bytes are not YARA scanned (0 is unlimited)");
+
+/// The backing store key prefix of compiled rules.
+const std::string kYARARulesPrefix{"yara_rules."};
+
+/**
+ * @brief Identify a set of rule source files by their paths and content.
+ *
+ * @return An empty string if any file cannot be read.
+ */
+static std::string getRulesHash(const std::vector<std::string>& files) {
+  std::string identity;
+  for (const auto& file : files) {
+    auto hash = hashFromFile(HASH_TYPE_SHA256, file);
+    if (hash.empty()) {
+      return "";
+    }
+    identity += file + ":" + hash + "\n";
+  }
+  return hashFromBuffer(
+      HASH_TYPE_SHA256, identity.data(), identity.size());
+}
+
+/// A YARA stream reading from, or appending to, a string.
+struct YARARulesBuffer {
+  std::string data;
+  size_t offset{0};
+
+  static size_t read(void* ptr, size_t size, size_t count, void* user_data) {
+    auto buffer = static_cast<YARARulesBuffer*>(user_data);
+    size_t items = 0;
+    while (items < count && buffer->offset + size <= buffer->data.size()) {
+      memcpy(static_cast<char*>(ptr) + items * size,
+             &buffer->data[buffer->offset],
+             size);
+      buffer->offset += size;
+      items++;
+    }
+    return items;
+  }
+
+  static size_t write(const void* ptr,
+                      size_t size,
+                      size_t count,
+                      void* user_data) {
+    auto buffer = static_cast<YARARulesBuffer*>(user_data);
+    buffer->data.append(static_cast<const char*>(ptr), size * count);
+    return count;
+  }
+};
+
+/**
+ * @brief Load compiled rules stored for the same source files.
+ *
+ * Stored values are the sources hash, a newline, and the saved rules.
+ */
+static bool loadCachedRules(const std::string& name,
+                            const std::string& hash,
+                            YR_RULES** rules) {
+  if (FLAGS_disable_yara_cache || hash.empty()) {
+    return false;
+  }
+
+  YARARulesBuffer buffer;
+  if (!getDatabaseValue(kPersistentSettings,
+                        kYARARulesPrefix + name,
+                        buffer.data)
+           .ok() ||
+      buffer.data.compare(0, hash.size(), hash) != 0) {
+    return false;
+  }
+  buffer.offset = hash.size() + 1;
+
+  YR_STREAM stream;
+  stream.user_data = &buffer;
+  stream.read = YARARulesBuffer::read;
+  // The saved format may be from another YARA version.
+  return yr_rules_load_stream(&stream, rules) == ERROR_SUCCESS;
+}
+
+static void saveCachedRules(const std::string& name,
+                            const std::string& hash,
+                            YR_RULES* rules) {
+  if (FLAGS_disable_yara_cache || hash.empty()) {
+    return;
+  }
+
+  YARARulesBuffer buffer;
+  buffer.data = hash + "\n";
+
+  YR_STREAM stream;
+  stream.user_data = &buffer;
+  stream.write = YARARulesBuffer::write;
+  if (yr_rules_save_stream(rules, &stream) == ERROR_SUCCESS) {
+    setDatabaseValue(kPersistentSettings, kYARARulesPrefix + name, buffer.data);
+  }
+}
+
 /**
  * The callback used when there are compilation problems in the rules.
  */
@@ -34,9 +153,22 @@ void YARACompilerCallback(int error_level,
 }
 
 /**
- * Compile a single rule file and load it into rule pointer.
+ * Compile rule source files into a single set of rules.
+ *
+ * Rules compiled from the same files are loaded from the backing store.
  */
-Status compileSingleFile(const std::string& file, YR_RULES** rules) {
+static Status compileRuleFiles(const std::string& name,
+                               const std::vector<std::string>& files,
+                               YR_RULES** rules) {
+  std::string hash;
+  if (!FLAGS_disable_yara_cache) {
+    hash = getRulesHash(files);
+  }
+  if (loadCachedRules(name, hash, rules)) {
+    VLOG(1) << "Loaded cached YARA rules for " << name;
+    return Status(0, "OK");
+  }
+
   YR_COMPILER* compiler = nullptr;
   int result = yr_compiler_create(&compiler);
   if (result != ERROR_SUCCESS) {
@@ -46,26 +178,9 @@ Status compileSingleFile(const std::string& file, YR_RULES** rules) {
 
   yr_compiler_set_callback(compiler, YARACompilerCallback, nullptr);
 
-  bool compiled = false;
-  YR_RULES* tmp_rules;
-  VLOG(1) << "Loading " << file;
-
-  // First attempt to load the file, in case it is saved (pre-compiled)
-  // rules.
-  //
-  // If you want to use saved rule files you must have them all in a single
-  // file. This is easy to accomplish with yarac(1).
-  result = yr_rules_load(file.c_str(), &tmp_rules);
-  if (result != ERROR_SUCCESS && result != ERROR_INVALID_FILE) {
-    yr_compiler_destroy(compiler);
-    return Status(1, "Error loading YARA rules: " + std::to_string(result));
-  } else if (result == ERROR_SUCCESS) {
-    *rules = tmp_rules;
-  } else {
-    compiled = true;
+  for (const auto& file : files) {
     // Try to compile the rules.
     FILE* rule_file = fopen(file.c_str(), "r");
-
     if (rule_file == nullptr) {
       yr_compiler_destroy(compiler);
       return Status(1, "Could not open file: " + file);
@@ -84,22 +199,38 @@ Status compileSingleFile(const std::string& file, YR_RULES** rules) {
     }
   }
 
-  if (compiled) {
-    // All the rules for this category have been compiled, save them in the map.
-    result = yr_compiler_get_rules(compiler, *(&rules));
-
-    if (result != ERROR_SUCCESS) {
-      yr_compiler_destroy(compiler);
-      return Status(1, "Insufficient memory to get YARA rules");
-    }
+  // All the rules have been compiled, save them for the caller.
+  result = yr_compiler_get_rules(compiler, rules);
+  yr_compiler_destroy(compiler);
+  if (result != ERROR_SUCCESS) {
+    return Status(1, "Insufficient memory to get YARA rules");
   }
 
-  if (compiler != nullptr) {
-    yr_compiler_destroy(compiler);
-    compiler = nullptr;
+  saveCachedRules(name, hash, *rules);
+  return Status(0, "OK");
+}
+
+/**
+ * Compile a single rule file and load it into rule pointer.
+ */
+Status compileSingleFile(const std::string& file, YR_RULES** rules) {
+  YR_RULES* tmp_rules;
+  VLOG(1) << "Loading " << file;
+
+  // First attempt to load the file, in case it is saved (pre-compiled)
+  // rules.
+  //
+  // If you want to use saved rule files you must have them all in a single
+  // file. This is easy to accomplish with yarac(1).
+  int result = yr_rules_load(file.c_str(), &tmp_rules);
+  if (result != ERROR_SUCCESS && result != ERROR_INVALID_FILE) {
+    return Status(1, "Error loading YARA rules: " + std::to_string(result));
+  } else if (result == ERROR_SUCCESS) {
+    *rules = tmp_rules;
+    return Status(0, "OK");
   }
 
-  return Status(0, "OK");
+  return compileRuleFiles(file, {file}, rules);
 }
 
 /**
@@ -109,16 +240,7 @@ Status compileSingleFile(const std::string& file, YR_RULES** rules) {
 Status handleRuleFiles(const std::string& category,
                        const pt::ptree& rule_files,
                        std::map<std::string, YR_RULES*>& rules) {
-  YR_COMPILER* compiler = nullptr;
-  int result = yr_compiler_create(&compiler);
-  if (result != ERROR_SUCCESS) {
-    VLOG(1) << "Could not create compiler: error " + std::to_string(result);
-    return Status(1, "YARA compile error " + std::to_string(result));
-  }
-
-  yr_compiler_set_callback(compiler, YARACompilerCallback, nullptr);
-
-  bool compiled = false;
+  std::vector<std::string> sources;
   for (const auto& item : rule_files) {
     YR_RULES* tmp_rules = nullptr;
     auto rule = item.second.get("", "");
@@ -141,9 +263,8 @@ Status handleRuleFiles(const std::string& category,
     //
     // If you want to use saved rule files you must have them all in a single
     // file. This is easy to accomplish with yarac(1).
-    result = yr_rules_load(rule.c_str(), &tmp_rules);
+    int result = yr_rules_load(rule.c_str(), &tmp_rules);
     if (result != ERROR_SUCCESS && result != ERROR_INVALID_FILE) {
-      yr_compiler_destroy(compiler);
       return Status(1, "YARA load error " + std::to_string(result));
     } else if (result == ERROR_SUCCESS) {
       // If there are already rules there, destroy them and put new ones in.
@@ -153,44 +274,47 @@ Status handleRuleFiles(const std::string& category,
 
       rules[category] = tmp_rules;
     } else {
-      compiled = true;
-      // Try to compile the rules.
-      FILE* rule_file = fopen(rule.c_str(), "r");
-
-      if (rule_file == nullptr) {
-        yr_compiler_destroy(compiler);
-        return Status(1, "Could not open file: " + rule);
-      }
-
-      int errors =
-          yr_compiler_add_file(compiler, rule_file, nullptr, rule.c_str());
+      sources.push_back(rule);
+    }
+  }
 
-      fclose(rule_file);
-      rule_file = nullptr;
+  if (!sources.empty()) {
+    YR_RULES* tmp_rules = nullptr;
+    auto status = compileRuleFiles(category, sources, &tmp_rules);
+    if (!status.ok()) {
+      return status;
+    }
 
-      if (errors > 0) {
-        yr_compiler_destroy(compiler);
-        // Errors printed via callback.
-        return Status(1, "Compilation errors");
-      }
+    if (rules.count(category) > 0) {
+      yr_rules_destroy(rules[category]);
     }
+    rules[category] = tmp_rules;
   }
 
-  if (compiled) {
-    // All the rules for this category have been compiled, save them in the map.
-    result = yr_compiler_get_rules(compiler, &rules[category]);
+  return Status(0, "OK");
+}
 
-    if (result != ERROR_SUCCESS) {
-      yr_compiler_destroy(compiler);
-      return Status(1, "Insufficient memory to get YARA rules");
+Status scanYARAFile(YR_RULES* rules, const std::string& path, Row& r) {
+  if (FLAGS_yara_max_file_size > 0) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 &&
+        static_cast<uint64_t>(st.st_size) > FLAGS_yara_max_file_size) {
+      return Status(1, "File exceeds the YARA scan size: " + path);
     }
   }
 
-  if (compiler != nullptr) {
-    yr_compiler_destroy(compiler);
-    compiler = nullptr;
+  // Files are mapped into memory and scanned in place.
+  int result = yr_rules_scan_file(rules,
+                                  path.c_str(),
+                                  SCAN_FLAGS_FAST_MODE,
+                                  YARACallback,
+                                  (void*)&r,
+                                  FLAGS_yara_scan_timeout);
+  if (result == ERROR_SCAN_TIMEOUT) {
+    return Status(1, "YARA scan timeout: " + path);
+  } else if (result != ERROR_SUCCESS) {
+    return Status(1, "YARA error: " + std::to_string(result));
   }
-
   return Status(0, "OK");
 }
 
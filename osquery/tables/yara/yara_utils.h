@@ -36,6 +36,15 @@ Status handleRuleFiles(const std::string& category,
 
 int YARACallback(int message, void* message_data, void* user_data);
 
+/**
+ * @brief Scan a file with compiled rules, within the configured budgets.
+ *
+ * Files larger than yara_max_file_size are not scanned, and a scan stops
+ * after yara_scan_timeout seconds. Matches are added to the row by
+ * YARACallback.
+ */
+Status scanYARAFile(YR_RULES* rules, const std::string& path, Row& r);
+
 /**
  * @brief A simple ConfigParserPlugin for a "yara" dictionary key.
  *
@@ -34,6 +34,7 @@
 #include "osquery/remote/http_client.h"
 #include "osquery/remote/transports/tls.h"
 #include "osquery/utils/aws_util.h"
+#include "osquery/utils/cloud_metadata.h"
 
 namespace pt = boost::property_tree;
 
@@ -339,25 +340,25 @@ void getInstanceIDAndRegion(std::string& instance_id, std::string& region) {
     }
 
     initAwsSdk();
-    http::Request req(kEc2MetadataUrl + "dynamic/instance-identity/document");
-    http::Client::Options options;
-    options.timeout(3);
-    http::Client client(options);
-
-    try {
-      http::Response res = client.get(req);
-      if (res.status() == 200) {
+    std::string document;
+    auto status =
+        Ec2Metadata::get().read("dynamic/instance-identity/document", document);
+    if (status.ok() && !document.empty()) {
+      try {
         pt::ptree tree;
-        std::stringstream ss(res.body());
+        std::stringstream ss(document);
         pt::read_json(ss, tree);
         cached_id = tree.get<std::string>("instanceId", ""),
         cached_region = tree.get<std::string>("region", ""),
         VLOG(1) << "EC2 instance ID: " << cached_id
                 << ". Region: " << cached_region;
+      } catch (const pt::json_parser::json_parser_error& e) {
+        VLOG(1) << "Error parsing EC2 instance information: " << e.what();
       }
-    } catch (const std::system_error& e) {
+    } else if (!status.ok()) {
       // Assume that this is not EC2 instance
-      VLOG(1) << "Error getting EC2 instance information: " << e.what();
+      VLOG(1) << "Error getting EC2 instance information: "
+              << status.getMessage();
     }
     checked = true;
   });
@@ -388,19 +389,15 @@ bool isEc2Instance() {
       return; // Not EC2 instance
     }
 
-    http::Request req(kEc2MetadataUrl);
-    http::Client::Options options;
-    options.timeout(3);
-    http::Client client(options);
-
-    try {
-      http::Response res = client.get(req);
-      if (res.status() == 200) {
-        is_ec2_instance = true;
-      }
-    } catch (const std::system_error& e) {
+    // The metadata service may require IMDSv2 session tokens.
+    std::string index;
+    auto status = Ec2Metadata::get().read("", index);
+    if (status.ok() && !index.empty()) {
+      is_ec2_instance = true;
+    } else if (!status.ok()) {
       // Assume that this is not EC2 instance
-      VLOG(1) << "Error checking if this is EC2 instance: " << e.what();
+      VLOG(1) << "Error checking if this is EC2 instance: "
+              << status.getMessage();
     }
   });
 
@@ -0,0 +1,204 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <future>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/remote/http_client.h"
+#include "osquery/remote/transports/tls.h"
+#include "osquery/utils/aws_util.h"
+#include "osquery/utils/cloud_metadata.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     cloud_metadata_ttl,
+     3600,
+     "Seconds cloud instance metadata responses are cached");
+
+/// The seconds to wait for an instance metadata response.
+const int kCloudMetadataTimeout = 3;
+
+/// The seconds an IMDSv2 session token is requested for.
+const size_t kEc2TokenTTL = 21600;
+
+/// Tokens are requested again before they expire.
+const size_t kCloudMetadataTokenSkew = 60;
+
+Status CloudMetadata::read(const std::string& path, std::string& body) {
+  {
+    ReadLock lock(cache_mutex_);
+    auto cached = cache_.find(path);
+    if (cached != cache_.end() &&
+        getUnixTime() - cached->second.first < FLAGS_cloud_metadata_ttl) {
+      body = cached->second.second;
+      return Status(0, "OK");
+    }
+  }
+  return refresh(path, body);
+}
+
+void CloudMetadata::read(const std::vector<std::string>& paths,
+                         std::map<std::string, std::string>& bodies) {
+  std::vector<std::string> uncached;
+  {
+    ReadLock lock(cache_mutex_);
+    auto now = getUnixTime();
+    for (const auto& path : paths) {
+      auto cached = cache_.find(path);
+      if (cached != cache_.end() &&
+          now - cached->second.first < FLAGS_cloud_metadata_ttl) {
+        bodies[path] = cached->second.second;
+      } else {
+        uncached.push_back(path);
+      }
+    }
+  }
+
+  // The token is requested once, before the paths are requested together.
+  std::string token;
+  if (uncached.empty() || !getToken(token).ok()) {
+    return;
+  }
+
+  std::vector<std::future<std::pair<Status, std::string>>> requests;
+  for (const auto& path : uncached) {
+    requests.push_back(std::async(std::launch::async, [this, &path]() {
+      std::string body;
+      auto status = refresh(path, body);
+      return std::make_pair(status, std::move(body));
+    }));
+  }
+
+  for (size_t i = 0; i < uncached.size(); i++) {
+    auto response = requests[i].get();
+    if (response.first.ok()) {
+      bodies[uncached[i]] = std::move(response.second);
+    } else {
+      VLOG(1) << response.first.getMessage();
+    }
+  }
+}
+
+void CloudMetadata::clear() {
+  {
+    WriteLock lock(cache_mutex_);
+    cache_.clear();
+  }
+
+  WriteLock lock(token_mutex_);
+  token_.clear();
+  token_expires_ = 0;
+}
+
+Status CloudMetadata::getToken(std::string& token) {
+  WriteLock lock(token_mutex_);
+  auto now = getUnixTime();
+  if (now < token_expires_) {
+    token = token_;
+    return Status(0, "OK");
+  }
+
+  size_t ttl = 0;
+  auto status = requestToken(token_, ttl);
+  if (!status.ok()) {
+    token_.clear();
+    return status;
+  }
+
+  token_expires_ = now + ((ttl > kCloudMetadataTokenSkew)
+                              ? ttl - kCloudMetadataTokenSkew
+                              : ttl);
+  token = token_;
+  return Status(0, "OK");
+}
+
+Status CloudMetadata::refresh(const std::string& path, std::string& body) {
+  std::string token;
+  auto status = getToken(token);
+  if (status.ok()) {
+    status = request(path, token, body);
+  }
+
+  if (!status.ok()) {
+    if (status.getCode() == 2) {
+      // A rejected token is requested again by the next read.
+      WriteLock lock(token_mutex_);
+      token_expires_ = 0;
+    }
+    return status;
+  }
+
+  WriteLock lock(cache_mutex_);
+  cache_[path] = std::make_pair(getUnixTime(), body);
+  return status;
+}
+
+Status Ec2Metadata::requestToken(std::string& token, size_t& ttl) {
+  http::Request req(kEc2MetadataUrl + "api/token");
+  req << http::Request::Header("X-aws-ec2-metadata-token-ttl-seconds",
+                               std::to_string(kEc2TokenTTL));
+  auto options = http::Client::Options().keep_alive(true).timeout(
+      kCloudMetadataTimeout);
+
+  try {
+    auto client = TLSClientPool::get().acquire(
+        TLSClientPool::getEndpoint(req), options);
+    http::Response res = client->put(req, "");
+    if (res.status() == 200) {
+      token = res.body();
+    } else {
+      // The service only supports IMDSv1 requests, without a token.
+      VLOG(1) << "EC2 metadata token is not available: " << res.status();
+      token.clear();
+    }
+    ttl = kEc2TokenTTL;
+  } catch (const std::exception& e) {
+    return Status(1, std::string("EC2 metadata token failed: ") + e.what());
+  }
+  return Status(0, "OK");
+}
+
+Status Ec2Metadata::request(const std::string& path,
+                            const std::string& token,
+                            std::string& body) {
+  http::Request req(kEc2MetadataUrl + path);
+  if (!token.empty()) {
+    req << http::Request::Header("X-aws-ec2-metadata-token", token);
+  }
+  auto options = http::Client::Options().keep_alive(true).timeout(
+      kCloudMetadataTimeout);
+
+  try {
+    auto client = TLSClientPool::get().acquire(
+        TLSClientPool::getEndpoint(req), options);
+    http::Response res = client->get(req);
+    auto code = res.status();
+    if (code == 404) {
+      // Missing paths, such as an instance without a role, are cached.
+      body.clear();
+      return Status(0, "OK");
+    } else if (code == 401) {
+      return Status(2, "EC2 metadata token was rejected");
+    } else if (code != 200) {
+      return Status(1,
+                    "Unexpected EC2 metadata response for " + path + ": " +
+                        std::to_string(code));
+    }
+    body = res.body();
+  } catch (const std::exception& e) {
+    return Status(1, "EC2 metadata request for " + path + " failed: " +
+                         e.what());
+  }
+  return Status(0, "OK");
+}
+} // namespace osquery
@@ -0,0 +1,126 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief Cached access to a cloud provider's instance metadata service.
+ *
+ * Tables and decorators read instance metadata often, while it rarely
+ * changes. Responses are kept for --cloud_metadata_ttl seconds, and the paths
+ * not cached are requested concurrently. A backend's session token is shared
+ * by every request until it expires.
+ *
+ * Backends implement the token and path requests of their service.
+ */
+class CloudMetadata : private boost::noncopyable {
+ public:
+  virtual ~CloudMetadata() = default;
+
+  /**
+   * @brief Read a metadata path, from the cache if possible.
+   *
+   * @param path The path relative to the service's URL.
+   * @param body The output response body, empty for a missing path.
+   * @return Success if the path was read or is missing.
+   */
+  Status read(const std::string& path, std::string& body);
+
+  /**
+   * @brief Read several metadata paths, requesting the uncached concurrently.
+   *
+   * @param paths The paths relative to the service's URL.
+   * @param bodies The output response bodies of the paths that were read.
+   */
+  void read(const std::vector<std::string>& paths,
+            std::map<std::string, std::string>& bodies);
+
+  /// Forget the cached responses and the session token.
+  void clear();
+
+ protected:
+  /**
+   * @brief Request a session token for the metadata requests.
+   *
+   * @param token The output token, empty if the service does not use tokens.
+   * @param ttl The output seconds the token may be used.
+   */
+  virtual Status requestToken(std::string& token, size_t& ttl) = 0;
+
+  /**
+   * @brief Request a metadata path.
+   *
+   * @param path The path relative to the service's URL.
+   * @param token The session token, may be empty.
+   * @param body The output response body, empty for a missing path.
+   * @return A status code of 2 if the token was rejected.
+   */
+  virtual Status request(const std::string& path,
+                         const std::string& token,
+                         std::string& body) = 0;
+
+ private:
+  /// Get the session token, requesting one if it expired.
+  Status getToken(std::string& token);
+
+  /// Request a path and cache the response.
+  Status refresh(const std::string& path, std::string& body);
+
+ private:
+  /// Response bodies by path, with the time they were requested.
+  std::map<std::string, std::pair<size_t, std::string>> cache_;
+
+  /// The session token, and the time it expires.
+  std::string token_;
+  size_t token_expires_{0};
+
+  /// Protection around the cache.
+  Mutex cache_mutex_;
+
+  /// Only one token is requested at a time.
+  Mutex token_mutex_;
+};
+
+/**
+ * @brief The EC2 instance metadata service.
+ *
+ * Requests use an IMDSv2 session token, or no token if the service only
+ * supports IMDSv1.
+ */
+class Ec2Metadata : public CloudMetadata {
+ public:
+  static Ec2Metadata& get() {
+    static Ec2Metadata metadata;
+    return metadata;
+  }
+
+ protected:
+  Status requestToken(std::string& token, size_t& ttl) override;
+
+  Status request(const std::string& path,
+                 const std::string& token,
+                 std::string& body) override;
+
+ private:
+  Ec2Metadata() = default;
+};
+} // namespace osquery
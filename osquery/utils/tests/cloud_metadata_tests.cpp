@@ -0,0 +1,112 @@
+/**
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under both the Apache 2.0 license (found in the
+ *  LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ *  in the COPYING file in the root directory of this source tree).
+ *  You may select, at your option, one of the above-listed licenses.
+ */
+
+#include <atomic>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/utils/cloud_metadata.h"
+
+namespace osquery {
+
+DECLARE_uint64(cloud_metadata_ttl);
+
+/// A metadata service answering with the path, counting requests.
+class MockCloudMetadata : public CloudMetadata {
+ public:
+  std::atomic<size_t> tokens{0};
+  std::atomic<size_t> requests{0};
+
+  /// The next request rejects its token.
+  std::atomic<bool> reject{false};
+
+ protected:
+  Status requestToken(std::string& token, size_t& ttl) override {
+    token = "token_" + std::to_string(++tokens);
+    ttl = 3600;
+    return Status(0, "OK");
+  }
+
+  Status request(const std::string& path,
+                 const std::string& token,
+                 std::string& body) override {
+    requests++;
+    if (reject.exchange(false)) {
+      return Status(2, "Rejected");
+    } else if (path == "missing") {
+      body.clear();
+      return Status(0, "OK");
+    } else if (path == "error") {
+      return Status(1, "Error");
+    }
+    body = path + ":" + token;
+    return Status(0, "OK");
+  }
+};
+
+class CloudMetadataTests : public testing::Test {
+ protected:
+  void TearDown() override {
+    FLAGS_cloud_metadata_ttl = 3600;
+  }
+};
+
+TEST_F(CloudMetadataTests, test_read_cached) {
+  MockCloudMetadata metadata;
+  std::map<std::string, std::string> bodies;
+  metadata.read({"a", "b", "missing", "error"}, bodies);
+
+  // One token is used by the paths requested together.
+  EXPECT_EQ(metadata.tokens, 1U);
+  EXPECT_EQ(metadata.requests, 4U);
+  ASSERT_EQ(bodies.size(), 3U);
+  EXPECT_EQ(bodies["a"], "a:token_1");
+  EXPECT_EQ(bodies["b"], "b:token_1");
+  EXPECT_TRUE(bodies["missing"].empty());
+
+  // Only the path that failed is requested again.
+  bodies.clear();
+  metadata.read({"a", "b", "missing", "error"}, bodies);
+  EXPECT_EQ(metadata.requests, 5U);
+  EXPECT_EQ(bodies.size(), 3U);
+
+  std::string body;
+  EXPECT_TRUE(metadata.read("a", body).ok());
+  EXPECT_EQ(body, "a:token_1");
+  EXPECT_FALSE(metadata.read("error", body).ok());
+  EXPECT_EQ(metadata.requests, 6U);
+
+  // Without a TTL every read is a request.
+  FLAGS_cloud_metadata_ttl = 0;
+  EXPECT_TRUE(metadata.read("a", body).ok());
+  EXPECT_EQ(metadata.requests, 7U);
+  EXPECT_EQ(metadata.tokens, 1U);
+}
+
+TEST_F(CloudMetadataTests, test_token_rejected) {
+  MockCloudMetadata metadata;
+  std::string body;
+  EXPECT_TRUE(metadata.read("a", body).ok());
+  EXPECT_EQ(metadata.tokens, 1U);
+
+  // A rejected token is requested again by the next read.
+  metadata.reject = true;
+  EXPECT_FALSE(metadata.read("b", body).ok());
+  EXPECT_TRUE(metadata.read("b", body).ok());
+  EXPECT_EQ(body, "b:token_2");
+  EXPECT_EQ(metadata.tokens, 2U);
+
+  metadata.clear();
+  EXPECT_TRUE(metadata.read("a", body).ok());
+  EXPECT_EQ(body, "a:token_3");
+}
+} // namespace osquery
@@ -72,6 +72,8 @@ COLUMN_OPTIONS = {
     "required": "REQUIRED",
     "optimized": "OPTIMIZED",
     "hidden": "HIDDEN",
+    "ordered": "ORDERED",
+    "volatile": "VOLATILE",
 }
 
 # Column options that render tables uncacheable.
@@ -87,6 +89,7 @@ TABLE_ATTRIBUTES = {
     "cacheable": "CACHEABLE",
     "utility": "UTILITY",
     "kernel_required": "KERNEL_REQUIRED",
+    "static": "STATIC",
 }
 
 
@@ -201,9 +204,12 @@ class TableState(Singleton):
         self.examples = []
         self.aliases = []
         self.fuzz_paths = []
+        self.dependencies = []
         self.has_options = False
         self.has_column_aliases = False
         self.generator = False
+        self.typed = False
+        self.stack_size = 0
 
     def columns(self):
         return [i for i in self.schema if isinstance(i, Column)]
@@ -218,6 +224,9 @@ class TableState(Singleton):
         all_options = []
         # Create a list of column options from the kwargs passed to the column.
         for column in self.columns():
+            # Event subscriber tables generate rows in time order.
+            if "event_subscriber" in self.attributes and column.name == "time":
+                column.options["ordered"] = True
             column_options = []
             for option in column.options:
                 # Only allow explicitly-defined options.
@@ -240,6 +249,39 @@ class TableState(Singleton):
                 print(lightred(
                     "Table cannot use a generator and be marked cacheable: %s" % (path)))
                 exit(1)
+            if self.typed:
+                print(lightred(
+                    "Table cannot use typed rows and be marked cacheable: %s" % (path)))
+                exit(1)
+        if "static" in self.attributes:
+            if self.generator or self.typed or self.class_name != "":
+                print(lightred(
+                    "Table cannot be static without a generate function: %s" % (path)))
+                exit(1)
+            if "cacheable" in self.attributes:
+                print(lightred(
+                    "Table cannot be static and be marked cacheable: %s" % (path)))
+                exit(1)
+        if len(self.dependencies) > 0:
+            if self.generator or self.typed or self.class_name != "":
+                print(lightred(
+                    "Table cannot have dependencies without a generate function: %s" % (path)))
+                exit(1)
+            if "cacheable" in self.attributes:
+                print(lightred(
+                    "Table cannot have dependencies and be marked cacheable: %s" % (path)))
+                exit(1)
+            # Dependencies are POSIX paths, Windows tables generate each query.
+            if WINDOWS():
+                self.dependencies = []
+        if self.stack_size > 0 and not self.generator:
+            print(lightred(
+                "Table cannot set a stack size without a generator: %s" % (path)))
+            exit(1)
+        if self.typed and self.class_name != "":
+            print(lightred(
+                "Table cannot use typed rows with a class implementation: %s" % (path)))
+            exit(1)
         if self.table_name == "" or self.function == "":
             print(lightred("Invalid table spec: %s" % (path)))
             exit(1)
@@ -285,6 +327,9 @@ class TableState(Singleton):
             has_options=self.has_options,
             has_column_aliases=self.has_column_aliases,
             generator=self.generator,
+            typed=self.typed,
+            stack_size=self.stack_size,
+            dependencies=self.dependencies,
             attribute_set=[TABLE_ATTRIBUTES[attr] for attr in self.attributes if attr in TABLE_ATTRIBUTES],
         )
 
@@ -391,7 +436,12 @@ def fuzz_paths(paths):
     table.fuzz_paths = paths
 
 
-def implementation(impl_string, generator=False):
+def dependencies(paths):
+    """Keep results until a file, or a file in a '/' directory, changes."""
+    table.dependencies = paths
+
+
+def implementation(impl_string, generator=False, typed=False, stack_size=0):
     """
     define the path to the implementation file and the function which
     implements the virtual table. You should use the following format:
@@ -399,6 +449,16 @@ def implementation(impl_string, generator=False):
       # the path is "osquery/table/implementations/foo.cpp"
       # the function is "QueryData genFoo();"
       implementation("foo@genFoo")
+
+    set typed=True if the function generates a TableRows batch:
+
+      # the function is "void genFoo(TableRows& results, QueryContext&);"
+      implementation("foo@genFoo", typed=True)
+
+    set stack_size to the bytes of stack a generator needs, if it is not the
+    default coroutine stack size:
+
+      implementation("foo@genFoo", generator=True, stack_size=256 * 1024)
     """
     logging.debug("- implementation")
     filename, function = impl_string.split("@")
@@ -413,6 +473,8 @@ def implementation(impl_string, generator=False):
     table.function = function
     table.class_name = class_name
     table.generator = generator
+    table.typed = typed
+    table.stack_size = stack_size
 
     '''Check if the table has a subscriber attribute, if so, enforce time.'''
     if "event_subscriber" in table.attributes:
@@ -138,6 +138,17 @@ class RealSimpleHandler(BaseHTTPRequestHandler):
         content_len = int(self.headers.getheader('content-length', 0))
 
         body = self.rfile.read(content_len)
+
+        # Binary carve blocks identify themselves with URI parameters.
+        path, _, query = self.path.partition('?')
+        content_type = self.headers.getheader('content-type', '')
+        if (path == '/carve_block' and
+                content_type == 'application/octet-stream'):
+            request = dict((k, v[0]) for k, v in parse_qs(query).items())
+            request['data'] = base64.standard_b64encode(body)
+            self.continue_carve(request)
+            return
+
         request = json.loads(body)
 
         # This contains a base64 encoded block of a file printing to the screen